@@ -110,6 +110,7 @@
 #include "ruleset.h"
 #include "parserif.h"
 #include "statsobj.h"
+#include "probes.h"
 
 #define NO_TIME_PROVIDED 0 /* indicate we do not provide any cached time */
 
@@ -185,7 +186,9 @@ static struct cnfparamdescr cnfparamdescr[] = {
 	{ "action.execonlywhenpreviousissuspended", eCmdHdlrBinary, 0 }, /* legacy: actionexeconlywhenpreviousissuspended */
 	{ "action.repeatedmsgcontainsoriginalmsg", eCmdHdlrBinary, 0 }, /* legacy: repeatedmsgcontainsoriginalmsg */
 	{ "action.resumeretrycount", eCmdHdlrInt, 0 }, /* legacy: actionresumeretrycount */
-	{ "action.resumeinterval", eCmdHdlrInt, 0 }
+	{ "action.resumeinterval", eCmdHdlrInt, 0 },
+	{ "action.histogram", eCmdHdlrBinary, 0 },
+	{ "action.maxinflight", eCmdHdlrPositiveInt, 0 }
 };
 static struct cnfparamblk pblk =
 	{ CNFPARAMBLK_VERSION,
@@ -283,6 +286,7 @@ rsRetVal actionDestruct(action_t * const pThis)
 	DEFiRet;
 	ASSERT(pThis != NULL);
 
+	timerCancel(&pThis->tmrResume);
 	if(!strcmp((char*)modGetName(pThis->pMod), "builtin:omdiscard")) {
 		/* discard actions will be optimized out */
 		FINALIZE;
@@ -324,6 +328,16 @@ actionDisable(action_t *__restrict__ const pThis)
 
 
 
+/* callback of the action's resume timer, runs on the timer thread */
+static void
+actionResumeDue(void *pUsr)
+{
+	action_t *const pThis = (action_t*) pUsr;
+
+	ATOMIC_STORE_1_TO_INT(&pThis->bResumeDue, &pThis->mutCAS);
+}
+
+
 /* create a new action descriptor object
  * rgerhards, 2007-08-01
  * Note that it is vital to set proper initial values as the v6 config
@@ -337,8 +351,10 @@ rsRetVal actionConstruct(action_t **ppThis)
 	ASSERT(ppThis != NULL);
 	
 	CHKmalloc(pThis = (action_t*) calloc(1, sizeof(action_t)));
+	timerInit(&pThis->tmrResume, actionResumeDue, pThis);
 	pThis->iResumeInterval = 30;
 	pThis->iResumeRetryCount = 0;
+	pThis->iMaxInFlight = 4;
 	pThis->pszName = NULL;
 	pThis->bWriteAllMarkMsgs = 1;
 	pThis->iExecEveryNthOccur = 0;
@@ -348,6 +364,7 @@ rsRetVal actionConstruct(action_t **ppThis)
 	pThis->bRepMsgHasMsg = 0;
 	pThis->bDisabled = 0;
 	pThis->isTransactional = 0;
+	pThis->bHistogram = 0;
 	pThis->tLastOccur = datetime.GetTime(NULL);	/* done once per action on startup only */
 	pThis->iActionNbr = iActionNbr;
 	pthread_mutex_init(&pThis->mutAction, NULL);
@@ -362,13 +379,74 @@ finalize_it:
 }
 
 
+/* impstats names of the histogram buckets, see ACT_LATENCY_BASE */
+static const char *latencyHistNames[ACT_LATENCY_BUCKETS] = {
+	"call.lt125us", "call.lt250us", "call.lt500us", "call.lt1ms",
+	"call.lt2ms", "call.lt4ms", "call.lt8ms", "call.lt16ms",
+	"call.lt32ms", "call.lt64ms", "call.lt128ms", "call.lt256ms",
+	"call.lt512ms", "call.lt1024ms", "call.lt2048ms", "call.lt4096ms",
+	"call.lt8192ms", "call.lt16384ms", "call.lt32768ms", "call.ge32768ms"
+};
+static const char *batchHistNames[ACT_BATCH_BUCKETS] = {
+	"batch.1", "batch.lt4", "batch.lt8", "batch.lt16", "batch.lt32",
+	"batch.lt64", "batch.lt128", "batch.lt256", "batch.lt512", "batch.lt1024",
+	"batch.lt2048", "batch.lt4096", "batch.lt8192", "batch.ge8192"
+};
+
+/* record the duration of an output module call, which started at tBegin
+ * (monotonic usecs). Only called if the action histogram is enabled.
+ */
+static inline void
+actionRecordCall(action_t *__restrict__ const pThis, const uint64_t tBegin)
+{
+	const uint64_t duration = getMonotonicUsecs() - tBegin;
+	uint64_t units;
+	int bucket;
+
+	units = duration / ACT_LATENCY_BASE;
+	for(bucket = 0 ; units != 0 && bucket < ACT_LATENCY_BUCKETS - 1 ; ++bucket)
+		units >>= 1;
+	STATSCOUNTER_INC(pThis->latencyHist[bucket], pThis->mutHist);
+	STATSCOUNTER_ADD(pThis->ctrCallTime, pThis->mutCtrCallTime, duration);
+}
+
+/* record the number of messages in a transaction (must be at least 1) */
+static inline void
+actionRecordBatch(action_t *__restrict__ const pThis, unsigned nMsgs)
+{
+	int bucket;
+
+	for(bucket = 0 ; (nMsgs >>= 1) != 0 && bucket < ACT_BATCH_BUCKETS - 1 ; ++bucket)
+		/* just count */;
+	STATSCOUNTER_INC(pThis->batchHist[bucket], pThis->mutHist);
+}
+
+/* record the size of the strings handed to the output module */
+static inline void
+actionRecordBytes(action_t *__restrict__ const pThis,
+	const actWrkrIParams_t *__restrict__ const iparams, const unsigned nMsgs)
+{
+	const unsigned nParams = nMsgs * pThis->iNumTpls;
+	uint64_t nBytes = 0;
+	unsigned i;
+
+	if(pThis->eParamPassing != ACT_STRING_PASSING)
+		return;
+	for(i = 0 ; i < nParams ; ++i)
+		nBytes += iparams[i].lenStr;
+	STATSCOUNTER_ADD(pThis->ctrBytes, pThis->mutCtrBytes, nBytes);
+}
+
+
 /* action construction finalizer
  */
 rsRetVal
 actionConstructFinalize(action_t *__restrict__ const pThis, struct nvlst *lst)
 {
 	DEFiRet;
+	int i;
 	uchar pszAName[64]; /* friendly name of our action */
+	double histLe[ACT_LATENCY_BUCKETS]; /* histogram bucket bounds, also used for batch sizes */
 
 	if(!strcmp((char*)modGetName(pThis->pMod), "builtin:omdiscard")) {
 		/* discard actions will be optimized out */
@@ -399,9 +477,9 @@ actionConstructFinalize(action_t *__restrict__ const pThis, struct nvlst *lst)
 	CHKiRet(statsobj.Construct(&pThis->statsobj));
 	CHKiRet(statsobj.SetName(pThis->statsobj, pszAName));
 
-	STATSCOUNTER_INIT(pThis->ctrProcessed, pThis->mutCtrProcessed);
+	STATSCOUNTER_SHARDED_INIT(pThis->ctrProcessed);
 	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("processed"),
-		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrProcessed));
+		ctrType_IntCtrSharded, CTR_FLAG_RESETTABLE, &pThis->ctrProcessed));
 
 	STATSCOUNTER_INIT(pThis->ctrFail, pThis->mutCtrFail);
 	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("failed"),
@@ -418,6 +496,39 @@ actionConstructFinalize(action_t *__restrict__ const pThis, struct nvlst *lst)
 	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("resumed"),
 		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrResume));
 
+	STATSCOUNTER_INIT(pThis->ctrTplRealloc, pThis->mutCtrTplRealloc);
+	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("tplbuf.reallocs"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrTplRealloc));
+
+	if(pThis->bHistogram) {
+		STATSCOUNTER_INIT(pThis->ctrBytes, pThis->mutCtrBytes);
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("bytes"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrBytes));
+		STATSCOUNTER_INIT(pThis->ctrCallTime, pThis->mutCtrCallTime);
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("call.usecs"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrCallTime));
+		STATSCOUNTER_INIT(pThis->ctrRetryTime, pThis->mutCtrRetryTime);
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("retry.usecs"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrRetryTime));
+		INIT_ATOMIC_HELPER_MUT64(pThis->mutHist);
+		for(i = 0 ; i < ACT_LATENCY_BUCKETS ; ++i) {
+			pThis->latencyHist[i] = 0;
+			histLe[i] = (double) (ACT_LATENCY_BASE << i) / 1000000.0; /* seconds */
+		}
+		CHKiRet(statsobj.AddHistogram(pThis->statsobj, UCHAR_CONSTANT("call_seconds"),
+			ACT_LATENCY_BUCKETS, latencyHistNames, histLe, CTR_FLAG_RESETTABLE,
+			pThis->latencyHist));
+		if(pThis->isTransactional) {
+			for(i = 0 ; i < ACT_BATCH_BUCKETS ; ++i) {
+				pThis->batchHist[i] = 0;
+				histLe[i] = (double) ((2 << i) - 1); /* bucket i: up to 2^(i+1)-1 msgs */
+			}
+			CHKiRet(statsobj.AddHistogram(pThis->statsobj, UCHAR_CONSTANT("batch_size"),
+				ACT_BATCH_BUCKETS, batchHistNames, histLe, CTR_FLAG_RESETTABLE,
+				pThis->batchHist));
+		}
+	}
+
 	CHKiRet(statsobj.ConstructFinalize(pThis->statsobj));
 
 	/* create our queue */
@@ -623,6 +734,9 @@ static void actionRetry(action_t * const pThis, wti_t * const pWti)
 
 /* Suspend action, this involves changing the action state as well
  * as setting the next retry time.
+ * The retry time is also handed to the global timer wheel, so that
+ * actionTryResume() need not obtain the current time on each call while
+ * we are suspended.
  * if we have more than 10 retries, we prolong the
  * retry interval. If something is really stalled, it will
  * get re-tried only very, very seldom - but that saves
@@ -642,6 +756,8 @@ actionSuspend(action_t * const pThis, wti_t * const pWti)
 	datetime.GetTime(&ttNow);
 	suspendDuration = pThis->iResumeInterval * (getActionNbrResRtry(pWti, pThis) / 10 + 1);
 	pThis->ttResumeRtry = ttNow + suspendDuration;
+	ATOMIC_STORE_0_TO_INT(&pThis->bResumeDue, &pThis->mutCAS);
+	pThis->bResumeTimer = (timerSchedule(&pThis->tmrResume, suspendDuration * 1000L) == RS_RET_OK);
 	actionSetState(pThis, pWti, ACT_STATE_SUSP);
 	pThis->ctrSuspendDuration += suspendDuration;
 	if(getActionNbrResRtry(pWti, pThis) == 0) {
@@ -682,11 +798,21 @@ actionDoRetry(action_t * const pThis, wti_t * const pWti)
 	int iRetries;
 	int iSleepPeriod;
 	int bTreatOKasSusp;
+	int bNoWait;
+	uint64_t tBegin = 0;
 	DEFiRet;
 
 	ASSERT(pThis != NULL);
 
-	iRetries = 0;
+	if(pThis->bHistogram)
+		tBegin = getMonotonicUsecs();
+	/* a shared pool thread serves other queues, too, so it does not wait
+	 * here for the action to resume. Instead the pool runs our queue again
+	 * after the retry interval (see wrkpool.c). This does not apply to
+	 * direct queues, as their batch belongs to the caller's queue.
+	 */
+	bNoWait = pWti->bSharedWrkr && pThis->pQueue->qType != QUEUETYPE_DIRECT;
+	iRetries = bNoWait ? pWti->actWrkrInfo[pThis->iActionNbr].iSharedRetries : 0;
 	while((*pWti->pbShutdownImmediate == 0) && getActionState(pWti, pThis) == ACT_STATE_RTRY) {
 		DBGPRINTF("actionDoRetry: %s enter loop, iRetries=%d\n", pThis->pszName, iRetries);
 		iRet = pThis->pMod->tryResume(pWti->actWrkrInfo[pThis->iActionNbr].actWrkrData);
@@ -714,9 +840,15 @@ actionDoRetry(action_t * const pThis, wti_t * const pWti)
 				actionSuspend(pThis, pWti);
 				if(getActionNbrResRtry(pWti, pThis) < 20)
 					incActionNbrResRtry(pWti, pThis);
+				pWti->actWrkrInfo[pThis->iActionNbr].iSharedRetries = 0;
 			} else {
 				++iRetries;
 				iSleepPeriod = pThis->iResumeInterval;
+				if(bNoWait) {
+					pWti->actWrkrInfo[pThis->iActionNbr].iSharedRetries = iRetries;
+					pWti->iSharedSuspendMs = (iSleepPeriod > 0) ? iSleepPeriod * 1000 : 1;
+					ABORT_FINALIZE(RS_RET_SUSPENDED);
+				}
 				srSleep(iSleepPeriod, 0);
 				if(*pWti->pbShutdownImmediate) {
 					ABORT_FINALIZE(RS_RET_FORCE_TERM);
@@ -729,9 +861,14 @@ actionDoRetry(action_t * const pThis, wti_t * const pWti)
 
 	if(getActionState(pWti, pThis) == ACT_STATE_RDY) {
 		setActionNbrResRtry(pWti, pThis, 0);
+		pWti->actWrkrInfo[pThis->iActionNbr].iSharedRetries = 0;
 	}
 
 finalize_it:
+	if(pThis->bHistogram) {
+		STATSCOUNTER_ADD(pThis->ctrRetryTime, pThis->mutCtrRetryTime,
+				 getMonotonicUsecs() - tBegin);
+	}
 	RETiRet;
 }
 
@@ -763,25 +900,30 @@ actionTryResume(action_t * const pThis, wti_t * const pWti)
 
 	if(getActionState(pWti, pThis) == ACT_STATE_SUSP) {
 		/* if we are suspended, we need to check if the timeout expired.
-		 * for this handling, we must always obtain a fresh timestamp. We used
-		 * to use the action timestamp, but in this case we will never reach a
-		 * point where a resumption is actually tried, because the action timestamp
-		 * is always in the past. So we can not avoid doing a fresh time() call
-		 * here. -- rgerhards, 2009-03-18
+		 * Usually the resume timer tells us. Without it, we must always
+		 * obtain a fresh timestamp. We used to use the action timestamp, but
+		 * in this case we will never reach a point where a resumption is
+		 * actually tried, because the action timestamp is always in the past.
+		 * So we can not avoid doing a fresh time() call here. -- rgerhards, 2009-03-18
 		 */
-		datetime.GetTime(&ttNow); /* cache "now" */
-		if(ttNow >= pThis->ttResumeRtry) {
-			actionSetState(pThis, pWti, ACT_STATE_RTRY); /* back to retries */
+		if(pThis->bResumeTimer) {
+			if(ATOMIC_FETCH_32BIT(&pThis->bResumeDue, &pThis->mutCAS))
+				actionSetState(pThis, pWti, ACT_STATE_RTRY); /* back to retries */
+		} else {
+			datetime.GetTime(&ttNow); /* cache "now" */
+			if(ttNow >= pThis->ttResumeRtry) {
+				actionSetState(pThis, pWti, ACT_STATE_RTRY); /* back to retries */
+			}
 		}
 	}
 
 	if(getActionState(pWti, pThis) == ACT_STATE_RTRY) {
-		if(ttNow == NO_TIME_PROVIDED) /* use cached result if we have it */
-			datetime.GetTime(&ttNow);
 		CHKiRet(actionDoRetry(pThis, pWti));
 	}
 
 	if(Debug && (getActionState(pWti, pThis) == ACT_STATE_RTRY ||getActionState(pWti, pThis) == ACT_STATE_SUSP)) {
+		if(ttNow == NO_TIME_PROVIDED) /* use cached result if we have it */
+			datetime.GetTime(&ttNow);
 		DBGPRINTF("actionTryResume: action %p state: %s, next retry (if applicable): %u [now %u]\n",
 			pThis, getActStateName(pThis, pWti), (unsigned) pThis->ttResumeRtry, (unsigned) ttNow);
 	}
@@ -865,6 +1007,97 @@ static rsRetVal actionDbgPrint(action_t *pThis)
 #endif
 
 
+/* like tplToString(), but if the template is used by more than one
+ * action, the rendered string is kept in the worker's template cache, so
+ * that the other actions processing the same message can just copy it.
+ * Failing to store the string in the cache is not an error.
+ * Reallocations of the output buffer are counted in the action's stats.
+ * The first allocation of a worker's buffer is not a reallocation, so only
+ * growth of an existing buffer is counted.
+ */
+static inline rsRetVal
+tplToStringCached(action_t *__restrict__ const pAction,
+		  struct template *__restrict__ const pTpl,
+		  wti_t *__restrict__ const pWti,
+		  msg_t *__restrict__ const pMsg,
+		  actWrkrIParams_t *__restrict__ const iparam,
+		  struct syslogTime *ttNow)
+{
+	wtiTplCacheEntry_t *pEnt;
+	const size_t lenBuf = iparam->lenBuf;
+	DEFiRet;
+
+	if(pTpl->nActRefs < 2 || pTpl->bUsesSysTime) {
+		CHKiRet(tplToString(pTpl, pMsg, iparam, ttNow));
+		FINALIZE;
+	}
+
+	if((pEnt = wtiTplCacheFind(pWti, pTpl, pMsg)) != NULL) {
+		if(pEnt->str.lenStr >= iparam->lenBuf)
+			CHKiRet(ExtendBuf(iparam, pEnt->str.lenStr + 1));
+		memcpy(iparam->param, pEnt->str.param, pEnt->str.lenStr + 1);
+		iparam->lenStr = pEnt->str.lenStr;
+		FINALIZE;
+	}
+
+	CHKiRet(tplToString(pTpl, pMsg, iparam, ttNow));
+	pEnt = &pWti->tplCache.ent[pWti->tplCache.iNext];
+	pWti->tplCache.iNext = (pWti->tplCache.iNext + 1) % WTI_TPLCACHE_SIZE;
+	pEnt->pTpl = NULL;
+	if(iparam->lenStr >= pEnt->str.lenBuf && ExtendBuf(&pEnt->str, iparam->lenStr + 1) != RS_RET_OK)
+		FINALIZE;
+	memcpy(pEnt->str.param, iparam->param, iparam->lenStr + 1);
+	pEnt->str.lenStr = iparam->lenStr;
+	pEnt->pTpl = pTpl;
+	pEnt->pMsg = pMsg;
+
+finalize_it:
+	if(lenBuf != 0 && iparam->lenBuf != lenBuf)
+		STATSCOUNTER_INC(pAction->ctrTplRealloc, pAction->mutCtrTplRealloc);
+	RETiRet;
+}
+
+
+/* render a template for a transactional action into the action's arena.
+ * The parameter then points into the arena and stays valid until the
+ * transaction is done (see actionTryCommit()). Strings kept in the
+ * template cache are copied from there.
+ */
+static inline rsRetVal
+tplToStringTx(action_t *__restrict__ const pAction,
+	      struct template *__restrict__ const pTpl,
+	      wti_t *__restrict__ const pWti,
+	      msg_t *__restrict__ const pMsg,
+	      actWrkrIParams_t *__restrict__ const iparam,
+	      struct syslogTime *ttNow)
+{
+	const actWrkrIParams_t *src = NULL;
+	wtiTplCacheEntry_t *pEnt;
+	uchar *p;
+	DEFiRet;
+
+	if(pTpl->nActRefs >= 2 && !pTpl->bUsesSysTime
+	   && (pEnt = wtiTplCacheFind(pWti, pTpl, pMsg)) != NULL)
+		src = &pEnt->str;
+	if(src == NULL) {
+		CHKiRet(tplToStringCached(pAction, pTpl, pWti, pMsg, &pWti->tplScratch, ttNow));
+		src = &pWti->tplScratch;
+	}
+	CHKmalloc(p = wtiArenaAlloc(&pWti->actWrkrInfo[pAction->iActionNbr].p.tx.arena,
+				    src->lenStr + 1));
+	if(src->param == NULL)
+		*p = '\0';
+	else
+		memcpy(p, src->param, src->lenStr + 1);
+	iparam->param = p;
+	iparam->lenStr = src->lenStr;
+	iparam->lenBuf = src->lenStr + 1;
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* prepare the calling parameters for doAction()
  * rgerhards, 2009-05-07
  */
@@ -884,15 +1117,15 @@ prepareDoActionParams(action_t * __restrict__ const pAction,
 	if(pAction->isTransactional) {
 		CHKiRet(wtiNewIParam(pWti, pAction, &iparams));
 		for(i = 0 ; i < pAction->iNumTpls ; ++i) {
-			CHKiRet(tplToString(pAction->ppTpl[i], pMsg, 
-					    &actParam(iparams, pAction->iNumTpls, 0, i),
-				            ttNow));
+			CHKiRet(tplToStringTx(pAction, pAction->ppTpl[i], pWti, pMsg,
+					      &actParam(iparams, pAction->iNumTpls, 0, i),
+					      ttNow));
 		}
 	} else {
 		for(i = 0 ; i < pAction->iNumTpls ; ++i) {
 			switch(pAction->eParamPassing) {
 			case ACT_STRING_PASSING:
-				CHKiRet(tplToString(pAction->ppTpl[i], pMsg,
+				CHKiRet(tplToStringCached(pAction, pAction->ppTpl[i], pWti, pMsg,
 					   &(pWrkrInfo->p.nontx.actParams[i]),
 					   ttNow));
 				break;
@@ -1014,6 +1247,7 @@ actionCallDoAction(action_t *__restrict__ const pThis,
 	wti_t *__restrict__ const pWti)
 {
 	uchar *param[CONF_OMOD_NUMSTRINGS_MAXSIZE];
+	uint64_t tBegin = 0;
 	int i;
 	DEFiRet;
 
@@ -1028,8 +1262,16 @@ actionCallDoAction(action_t *__restrict__ const pThis,
 		param[i] = actParam(iparams, pThis->iNumTpls, 0, i).param;
 	}
 
+	if(pThis->bHistogram) {
+		actionRecordBytes(pThis, iparams, 1);
+		tBegin = getMonotonicUsecs();
+	}
+	RSPROBE2(action__call__begin, pThis->pszName, pThis->iActionNbr);
 	iRet = pThis->pMod->mod.om.doAction(param,
 				            pWti->actWrkrInfo[pThis->iActionNbr].actWrkrData);
+	RSPROBE2(action__call__end, pThis->pszName, iRet);
+	if(pThis->bHistogram)
+		actionRecordCall(pThis, tBegin);
 	iRet = handleActionExecResult(pThis, pWti, iRet);
 	RETiRet;
 }
@@ -1041,6 +1283,7 @@ actionCallCommitTransaction(action_t * const pThis,
 	const actWrkrInfo_t *const wrkrInfo,
 	wti_t *const pWti)
 {
+	uint64_t tBegin = 0;
 	DEFiRet;
 
 	ASSERT(pThis != NULL);
@@ -1050,9 +1293,17 @@ actionCallCommitTransaction(action_t * const pThis,
 		  getActStateName(pThis, pWti), pThis->iActionNbr,
 		  wrkrInfo->p.tx.currIParam);
 
+	if(pThis->bHistogram) {
+		actionRecordBytes(pThis, wrkrInfo->p.tx.iparams, wrkrInfo->p.tx.currIParam);
+		tBegin = getMonotonicUsecs();
+	}
+	RSPROBE2(action__commit__begin, pThis->pszName, wrkrInfo->p.tx.currIParam);
 	iRet = pThis->pMod->mod.om.commitTransaction(
 		    pWti->actWrkrInfo[pThis->iActionNbr].actWrkrData,
 		    wrkrInfo->p.tx.iparams, wrkrInfo->p.tx.currIParam);
+	RSPROBE2(action__commit__end, pThis->pszName, iRet);
+	if(pThis->bHistogram)
+		actionRecordCall(pThis, tBegin);
 	iRet = handleActionExecResult(pThis, pWti, iRet);
 	RETiRet;
 }
@@ -1088,6 +1339,8 @@ doTransaction(action_t *__restrict__ const pThis, wti_t *__restrict__ const pWti
 	DEFiRet;
 
 	wrkrInfo = &(pWti->actWrkrInfo[pThis->iActionNbr]);
+	if(pThis->bHistogram && wrkrInfo->p.tx.currIParam > 0)
+		actionRecordBatch(pThis, wrkrInfo->p.tx.currIParam);
 	if(pThis->pMod->mod.om.commitTransaction != NULL) {
 		DBGPRINTF("doTransaction: have commitTransaction IF, using that, pWrkrInfo %p\n", wrkrInfo);
 		CHKiRet(actionCallCommitTransaction(pThis, wrkrInfo, pWti));
@@ -1111,13 +1364,21 @@ finalize_it:
 static rsRetVal
 actionTryCommit(action_t *__restrict__ const pThis, wti_t *__restrict__ const pWti)
 {
+	uint64_t tBegin = 0;
 	DEFiRet;
 
 	doTransaction(pThis, pWti);
 
 	CHKiRet(actionPrepare(pThis, pWti));
 	if(getActionState(pWti, pThis) == ACT_STATE_ITX) {
+		/* for modules without commitTransaction(), this is where the
+		 * batch is usually written, so it counts as a call.
+		 */
+		if(pThis->bHistogram && pThis->pMod->mod.om.commitTransaction == NULL)
+			tBegin = getMonotonicUsecs();
 		iRet = pThis->pMod->mod.om.endTransaction(pWti->actWrkrInfo[pThis->iActionNbr].actWrkrData);
+		if(tBegin != 0)
+			actionRecordCall(pThis, tBegin);
 		switch(iRet) {
 			case RS_RET_OK:
 				actionCommitted(pThis, pWti);
@@ -1148,6 +1409,7 @@ actionTryCommit(action_t *__restrict__ const pThis, wti_t *__restrict__ const pW
 
 finalize_it:
 	pWti->actWrkrInfo[pThis->iActionNbr].p.tx.currIParam = 0; /* reset to beginning */
+	wtiArenaReset(&pWti->actWrkrInfo[pThis->iActionNbr].p.tx.arena);
 	RETiRet;
 }
 
@@ -1202,6 +1464,82 @@ finalize_it:
 	RETiRet;
 }
 
+/* Commit the current transaction asynchronously: the params are handed to
+ * a slot of the worker and the module is called via commitTransactionAsync().
+ * The worker then continues with the next batch, while this one is parked
+ * until the module reports the outcome (see qqueueReapAsync()). Failures
+ * of earlier transactions are applied to the action state here, because
+ * the worker thread owns that state.
+ * Falls back to actionCommit() whenever the transaction can not be handed
+ * off, so the retry logic stays in one place.
+ */
+static rsRetVal
+actionCommitAsync(action_t *__restrict__ const pThis, wti_t *__restrict__ const pWti)
+{
+	actWrkrInfo_t *const wrkrInfo = &pWti->actWrkrInfo[pThis->iActionNbr];
+	wtiAsyncSlot_t *pSlot;
+	actWrkrIParams_t *iparams;
+	wtiArena_t arena;
+	unsigned nParams;
+	int maxIParams;
+	uint64_t tBegin = 0;
+	rsRetVal localRet;
+	DEFiRet;
+
+	if(pWti->pAsync == NULL)
+		CHKiRet(wtiAsyncConstruct(pWti, pThis->iMaxInFlight));
+	if(pWti->pAsync->failRet != RS_RET_OK) {
+		if(pWti->pAsync->failRet == RS_RET_SUSPENDED)
+			actionRetry(pThis, pWti);
+		else if(pWti->pAsync->failRet == RS_RET_DISABLE_ACTION)
+			actionDisable(pThis);
+		pWti->pAsync->failRet = RS_RET_OK;
+	}
+
+	if(wrkrInfo->p.tx.currIParam == 0 || getActionState(pWti, pThis) == ACT_STATE_SUSP)
+		FINALIZE;
+	CHKiRet(actionPrepare(pThis, pWti));
+	if(getActionState(pWti, pThis) != ACT_STATE_ITX || (pSlot = wtiAsyncGetSlot(pWti)) == NULL) {
+		iRet = actionCommit(pThis, pWti);
+		FINALIZE;
+	}
+
+	/* the slot takes over the params, we continue with its spare ones */
+	nParams = wrkrInfo->p.tx.currIParam;
+	iparams = pSlot->iparams;
+	maxIParams = pSlot->maxIParams;
+	arena = pSlot->arena;
+	pSlot->iparams = wrkrInfo->p.tx.iparams;
+	pSlot->maxIParams = wrkrInfo->p.tx.maxIParams;
+	pSlot->arena = wrkrInfo->p.tx.arena;
+	wrkrInfo->p.tx.iparams = iparams;
+	wrkrInfo->p.tx.maxIParams = maxIParams;
+	wrkrInfo->p.tx.arena = arena;
+	wrkrInfo->p.tx.currIParam = 0;
+
+	if(pThis->bHistogram) {
+		actionRecordBatch(pThis, nParams);
+		actionRecordBytes(pThis, pSlot->iparams, nParams);
+		tBegin = getMonotonicUsecs();
+	}
+	DBGPRINTF("actionCommitAsync: action %d, nMsgs %u\n", pThis->iActionNbr, nParams);
+	localRet = pThis->pMod->mod.om.commitTransactionAsync(wrkrInfo->actWrkrData,
+							      pSlot->iparams, nParams, &pSlot->tx);
+	if(pThis->bHistogram)
+		actionRecordCall(pThis, tBegin);
+	if(localRet != RS_RET_IN_FLIGHT) {
+		/* completed synchronously, the outcome is handled like an async one */
+		if(localRet == RS_RET_DEFER_COMMIT || localRet == RS_RET_PREVIOUS_COMMITTED)
+			localRet = RS_RET_OK;
+		pSlot->tx.done(&pSlot->tx, localRet);
+	}
+	actionCommitted(pThis, pWti);
+	setActionResumeInRow(pWti, pThis, 0);
+
+finalize_it:
+	RETiRet;
+}
+
 /* Commit all active transactions in *DIRECT mode* */
 void
 actionCommitAllDirect(wti_t *__restrict__ const pWti)
@@ -1240,6 +1578,7 @@ processMsgMain(action_t *__restrict__ const pAction,
 		FINALIZE;
 	}
 
+	MsgTraceStage(pMsg, TRACE_ACTION);
 	iRet = prepareDoActionParams(pAction, pWti, pMsg, ttNow);
 
 	if(pAction->isTransactional) {
@@ -1254,6 +1593,8 @@ processMsgMain(action_t *__restrict__ const pAction,
 				    pWti->actWrkrInfo[pAction->iActionNbr].p.nontx.actParams,
 				    pWti);
 	releaseDoActionParams(pAction, pWti);
+	if(pAction->eParamPassing == ACT_MSG_PASSING)
+		wtiTplCacheInvalidate(pWti); /* message modification modules may have changed it */
 finalize_it:
 	if(iRet == RS_RET_OK) {
 		if(pWti->execState.bDoAutoCommit)
@@ -1280,14 +1621,48 @@ processBatchMain(void *__restrict__ const pVoid,
 	ttNow.year = 0;
 
 	for(i = 0 ; i < batchNumMsgs(pBatch) && !*pWti->pbShutdownImmediate ; ++i) {
+		batchPrefetch(pBatch, i);
 		if(batchIsValidElem(pBatch, i)) {
 			iRet = processMsgMain(pAction, pWti, pBatch->pElem[i].pMsg, &ttNow);
+			if(pWti->iSharedSuspendMs != 0)
+				break;
 			batchSetElemState(pBatch, i, BATCH_STATE_COMM);
 		}
 	}
 
-	if(!pWti->execState.bDoAutoCommit)
-		iRet = actionCommit(pAction, pWti);
+	if(pWti->iSharedSuspendMs != 0) {
+		/* the action is suspended and the shared worker does not wait for
+		 * it (see actionDoRetry()): drop what is not yet committed, the
+		 * messages go back into the queue.
+		 */
+		if(pAction->isTransactional) {
+			pWti->actWrkrInfo[pAction->iActionNbr].p.tx.currIParam = 0;
+			wtiArenaReset(&pWti->actWrkrInfo[pAction->iActionNbr].p.tx.arena);
+		}
+	} else if(!pWti->execState.bDoAutoCommit) {
+		/* only batches of our own queue worker can be parked; shared
+		 * workers must finish each batch before they serve another queue
+		 */
+		if(pAction->pMod->mod.om.commitTransactionAsync != NULL
+		   && pAction->iMaxInFlight > 1 && pBatch == &pWti->batch
+		   && !pWti->bSharedWrkr)
+			iRet = actionCommitAsync(pAction, pWti);
+		else
+			iRet = actionCommit(pAction, pWti);
+	}
+	if(pWti->iSharedSuspendMs != 0) {
+		/* the whole batch is re-enqueued, even if the failed commit was
+		 * partly written, as we prefer duplicates over loss
+		 */
+		for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i) {
+			if(pBatch->eltState[i] == BATCH_STATE_COMM)
+				batchSetElemState(pBatch, i, BATCH_STATE_RDY);
+		}
+	}
+	if(iMsgTraceSampleRate != 0) {
+		for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i)
+			MsgTraceStage(pBatch->pElem[i].pMsg, TRACE_COMMIT);
+	}
 	RETiRet;
 }
 
@@ -1333,6 +1708,9 @@ static rsRetVal setActionQueType(void __attribute__((unused)) *pVal, uchar *pszT
 	} else if (!strcasecmp((char *) pszType, "direct")) {
 		cs.ActionQueType = QUEUETYPE_DIRECT;
 		DBGPRINTF("action queue type set to DIRECT (no queueing at all)\n");
+	} else if (!strcasecmp((char *) pszType, "lockfree")) {
+		cs.ActionQueType = QUEUETYPE_LOCKFREE;
+		DBGPRINTF("action queue type set to LOCKFREE\n");
 	} else {
 		errmsg.LogError(0, RS_RET_INVALID_PARAMS, "unknown actionqueue parameter: %s", (char *) pszType);
 		iRet = RS_RET_INVALID_PARAMS;
@@ -1357,7 +1735,7 @@ doSubmitToActionQ(action_t * const pAction, wti_t * const pWti, msg_t *pMsg)
 
 	DBGPRINTF("Called action, logging to %s\n", module.GetStateName(pAction->pMod));
 
-	STATSCOUNTER_INC(pAction->ctrProcessed, pAction->mutCtrProcessed);
+	STATSCOUNTER_SHARDED_INC(pAction->ctrProcessed);
 	if(pAction->pQueue->qType == QUEUETYPE_DIRECT) {
 		ttNow.year = 0;
 		iRet = processMsgMain(pAction, pWti, pMsg, &ttNow);
@@ -1590,6 +1968,16 @@ actionApplyCnfParam(action_t * const pAction, struct cnfparamvals * const pvals)
 			pAction->iResumeRetryCount = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "action.resumeinterval")) {
 			pAction->iResumeInterval = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "action.histogram")) {
+			pAction->bHistogram = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "action.maxinflight")) {
+			pAction->iMaxInFlight = pvals[i].val.d.n;
+			if(pAction->iMaxInFlight > WTI_ASYNC_MAXSLOTS) {
+				errmsg.LogError(0, RS_RET_PARAM_ERROR, "action.maxinflight %d is "
+					"larger than the maximum of %d, using the maximum",
+					pAction->iMaxInFlight, WTI_ASYNC_MAXSLOTS);
+				pAction->iMaxInFlight = WTI_ASYNC_MAXSLOTS;
+			}
 		} else {
 			dbgprintf("action: program error, non-handled "
 			  "param '%s'\n", pblk.descr[i].name);
@@ -1669,6 +2057,8 @@ addAction(action_t **ppAction, modInfo_t *pMod, void *pModData,
 			errmsg.LogError(0, RS_RET_NOT_FOUND, "%s", errMsg);
 			ABORT_FINALIZE(RS_RET_NOT_FOUND);
 		}
+		if(pAction->ppTpl[i] != NULL)
+			++pAction->ppTpl[i]->nActRefs;
 		/* check required template options */
 		if(   (iTplOpts & OMSR_RQD_TPL_OPT_SQL)
 		   && (pAction->ppTpl[i]->optFormatEscape == 0)) {
@@ -1768,7 +2158,7 @@ actionNewInst(struct nvlst *lst, action_t **ppAction)
 	dbgprintf("action param blk after actionNewInst:\n");
 	cnfparamsPrint(&pblk, paramvals);
 	cnfModName = (uchar*)es_str2cstr(paramvals[cnfparamGetIdx(&pblk, ("type"))].val.d.estr, NULL);
-	if((pMod = module.FindWithCnfName(loadConf, cnfModName, eMOD_OUT)) == NULL) {
+	if((pMod = module.FindOrLoadWithCnfName(loadConf, cnfModName, eMOD_OUT)) == NULL) {
 		errmsg.LogError(0, RS_RET_MOD_UNKNOWN, "module name '%s' is unknown", cnfModName);
 		ABORT_FINALIZE(RS_RET_MOD_UNKNOWN);
 	}
@@ -27,12 +27,21 @@
 
 #include "syslogd-types.h"
 #include "queue.h"
+#include "timerwheel.h"
 
 /* external data */
 extern int glbliActionResumeRetryCount;
 extern int bActionReportSuspension;
 
 
+/* the optional action histograms (action.histogram) have log2 buckets.
+ * Call latency buckets start at 125us like the queue latency histogram
+ * (see QUEUE_LATENCY_BASE), batch size buckets start at one message.
+ */
+#define ACT_LATENCY_BUCKETS 20
+#define ACT_LATENCY_BASE 125	/* usecs */
+#define ACT_BATCH_BUCKETS 14
+
 /* the following struct defines the action object data structure
  */
 struct action_s {
@@ -46,10 +55,15 @@ struct action_s {
 	sbool	bHadAutoCommit;	/* did an auto-commit happen during doAction()? */
 	sbool	bDisabled;
 	sbool	isTransactional;
+	sbool	bHistogram;	/* record call latency and batch size histograms? */
 	int	iSecsExecOnceInterval; /* if non-zero, minimum seconds to wait until action is executed again */
 	time_t	ttResumeRtry;	/* when is it time to retry the resume? */
+	rstimer_t tmrResume;	/* expires at ttResumeRtry, sets bResumeDue */
+	int	bResumeDue;	/* tmrResume expired, retry if suspended */
+	sbool	bResumeTimer;	/* tmrResume is scheduled (else check ttResumeRtry) */
 	int	iResumeInterval;/* resume interval for this action */
 	int	iResumeRetryCount;/* how often shall we retry a suspended action? (-1 --> eternal) */
+	int	iMaxInFlight;	/* max asynchronous transactions per worker (if supported by module) */
 	int	iNbrNoExec;	/* number of matches that did not yet yield to an exec */
 	int	iExecEveryNthOccur;/* execute this action only every n-th occurence (with n=0,1 -> always) */
 	int  	iExecEveryNthOccurTO;/* timeout for n-th occurence feature */
@@ -71,11 +85,19 @@ struct action_s {
 	DEF_ATOMIC_HELPER_MUT(mutCAS);
 	/* for statistics subsystem */
 	statsobj_t *statsobj;
-	STATSCOUNTER_DEF(ctrProcessed, mutCtrProcessed);
+	STATSCOUNTER_SHARDED_DEF(ctrProcessed);	/* updated by all workers */
 	STATSCOUNTER_DEF(ctrFail, mutCtrFail);
 	STATSCOUNTER_DEF(ctrSuspend, mutCtrSuspend);
 	STATSCOUNTER_DEF(ctrSuspendDuration, mutCtrSuspendDuration);
 	STATSCOUNTER_DEF(ctrResume, mutCtrResume);
+	STATSCOUNTER_DEF(ctrTplRealloc, mutCtrTplRealloc);
+	/* the following are only maintained if bHistogram is set */
+	STATSCOUNTER_DEF(ctrBytes, mutCtrBytes);
+	STATSCOUNTER_DEF(ctrCallTime, mutCtrCallTime);
+	STATSCOUNTER_DEF(ctrRetryTime, mutCtrRetryTime);
+	intctr_t latencyHist[ACT_LATENCY_BUCKETS];
+	intctr_t batchHist[ACT_BATCH_BUCKETS];
+	DEF_ATOMIC_HELPER_MUT64(mutHist); /* guards both histograms */
 };
 
 
@@ -41,6 +41,8 @@ extern int yylex(void);
 extern int yyerror(char*);
 %}
 
+%locations	/* we need the line a statement begins on for the script profiler */
+
 %union {
 	char *s;
 	long long n;
@@ -149,27 +151,40 @@ script:	  stmt				{ $$ = $1; }
 	| script stmt			{ $$ = scriptAddStmt($1, $2); }
 stmt:	  actlst			{ $$ = $1; }
 	| IF expr THEN block 		{ $$ = cnfstmtNew(S_IF);
+					  $$->lineno = @1.first_line;
 					  $$->d.s_if.expr = $2;
 					  $$->d.s_if.t_then = $4;
-					  $$->d.s_if.t_else = NULL; }
+					  $$->d.s_if.t_else = NULL;
+					  $$->d.s_if.prog = NULL; }
 	| IF expr THEN block ELSE block	{ $$ = cnfstmtNew(S_IF);
+					  $$->lineno = @1.first_line;
 					  $$->d.s_if.expr = $2;
 					  $$->d.s_if.t_then = $4;
-					  $$->d.s_if.t_else = $6; }
-	| SET VAR '=' expr ';'		{ $$ = cnfstmtNewSet($2, $4); }
-	| UNSET VAR ';'			{ $$ = cnfstmtNewUnset($2); }
-	| PRIFILT block			{ $$ = cnfstmtNewPRIFILT($1, $2); }
-	| PROPFILT block		{ $$ = cnfstmtNewPROPFILT($1, $2); }
+					  $$->d.s_if.t_else = $6;
+					  $$->d.s_if.prog = NULL; }
+	| SET VAR '=' expr ';'		{ $$ = cnfstmtSetLine(cnfstmtNewSet($2, $4),
+							      @1.first_line); }
+	| UNSET VAR ';'			{ $$ = cnfstmtSetLine(cnfstmtNewUnset($2),
+							      @1.first_line); }
+	| PRIFILT block			{ $$ = cnfstmtSetLine(cnfstmtNewPRIFILT($1, $2),
+							      @1.first_line); }
+	| PROPFILT block		{ $$ = cnfstmtSetLine(cnfstmtNewPROPFILT($1, $2),
+							      @1.first_line); }
 block:    stmt				{ $$ = $1; }
 	| '{' script '}'		{ $$ = $2; }
 actlst:	  s_act				{ $$ = $1; }
 	| actlst '&' s_act 		{ $$ = scriptAddStmt($1, $3); }
 /* s_act are actions and action-like statements */
-s_act:	  BEGIN_ACTION nvlst ENDOBJ	{ $$ = cnfstmtNewAct($2); }
-	| LEGACY_ACTION			{ $$ = cnfstmtNewLegaAct($1); }
-	| STOP				{ $$ = cnfstmtNew(S_STOP); }
-	| CALL NAME			{ $$ = cnfstmtNewCall($2); }
-	| CONTINUE			{ $$ = cnfstmtNewContinue(); }
+s_act:	  BEGIN_ACTION nvlst ENDOBJ	{ $$ = cnfstmtSetLine(cnfstmtNewAct($2),
+							      @1.first_line); }
+	| LEGACY_ACTION			{ $$ = cnfstmtSetLine(cnfstmtNewLegaAct($1),
+							      @1.first_line); }
+	| STOP				{ $$ = cnfstmtSetLine(cnfstmtNew(S_STOP),
+							      @1.first_line); }
+	| CALL NAME			{ $$ = cnfstmtSetLine(cnfstmtNewCall($2),
+							      @1.first_line); }
+	| CONTINUE			{ $$ = cnfstmtSetLine(cnfstmtNewContinue(),
+							      @1.first_line); }
 expr:	  expr AND expr			{ $$ = cnfexprNew(AND, $1, $3); }
 	| expr OR expr			{ $$ = cnfexprNew(OR, $1, $3); }
 	| NOT expr			{ $$ = cnfexprNew(NOT, NULL, $2); }
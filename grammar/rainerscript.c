@@ -44,16 +44,21 @@
 #include "queue.h"
 #include "srUtils.h"
 #include "regexp.h"
+#include "acmatch.h"
+#include "perfhash.h"
 #include "obj.h"
 #include "modules.h"
 #include "ruleset.h"
 #include "msg.h"
 #include "wti.h"
 #include "unicode-helper.h"
+#include "ratelimit.h"
 
 DEFobjCurrIf(obj)
 DEFobjCurrIf(regexp)
 
+int bScriptAdaptiveOrder = 0;
+
 struct cnfexpr* cnfexprOptimize(struct cnfexpr *expr);
 static void cnfstmtOptimizePRIFilt(struct cnfstmt *stmt);
 static void cnfarrayPrint(struct cnfarray *ar, int indent);
@@ -138,6 +143,9 @@ getFIOPName(const unsigned iFIOP)
 		case FIOP_EREREGEX:
 			pRet = "ereregex";
 			break;
+		case FIOP_PCREREGEX:
+			pRet = "pcreregex";
+			break;
 		case FIOP_ISEMPTY:
 			pRet = "isempty";
 			break;
@@ -220,6 +228,8 @@ DecodePropFilter(uchar *pline, struct cnfstmt *stmt)
 		stmt->d.s_propfilt.operation = FIOP_REGEX;
 	} else if(!rsCStrOffsetSzStrCmp(pCSCompOp, iOffset, (unsigned char*) "ereregex", 8)) {
 		stmt->d.s_propfilt.operation = FIOP_EREREGEX;
+	} else if(!rsCStrOffsetSzStrCmp(pCSCompOp, iOffset, (unsigned char*) "pcreregex", 9)) {
+		stmt->d.s_propfilt.operation = FIOP_PCREREGEX;
 	} else {
 		parser_errmsg("error: invalid compare operation '%s'",
 		           (char*) rsCStrGetSzStrNoNULL(pCSCompOp));
@@ -701,6 +711,8 @@ doGetQueueType(struct nvlst *valnode, struct cnfparamdescr *param,
 		val->val.d.n = QUEUETYPE_DISK;
 	} else if(!es_strcasebufcmp(valnode->val.d.estr, (uchar*)"direct", 6)) {
 		val->val.d.n = QUEUETYPE_DIRECT;
+	} else if(!es_strcasebufcmp(valnode->val.d.estr, (uchar*)"lockfree", 8)) {
+		val->val.d.n = QUEUETYPE_LOCKFREE;
 	} else {
 		cstr = es_str2cstr(valnode->val.d.estr, NULL);
 		parser_errmsg("param '%s': unknown queue type: '%s'",
@@ -1267,6 +1279,182 @@ varFreeMembers(struct var *r)
 	if(r->datatype == 'S') es_deleteStr(r->d.estr);
 }
 
+/* String views.
+ * Most string operations on message properties only need to look at the
+ * property, not own a copy of it. A view borrows the property buffer from
+ * the message (via MsgGetProp()), so comparisons and many functions work
+ * without creating an es_str_t for each evaluation. For non-JSON
+ * properties, psz is always '\0'-terminated. An owned copy is only
+ * created if a function returns a modified string or if the operand is
+ * not a plain property.
+ */
+struct cnfstrview {
+	uchar *psz;
+	rs_size_t len;
+	unsigned short bMustBeFreed;
+};
+
+/* check if expr is a property we can view (JSON properties are not) */
+static inline int
+isViewableVar(struct cnfexpr *__restrict__ const expr)
+{
+	const struct cnfvar *var;
+
+	if(expr->nodetype != 'V')
+		return 0;
+	var = (struct cnfvar*) expr;
+	return var->prop.id != PROP_CEE       &&
+	       var->prop.id != PROP_LOCAL_VAR &&
+	       var->prop.id != PROP_GLOBAL_VAR;
+}
+
+/* obtain a view of a property; expr must be viewable */
+static inline void
+strviewFromVar(struct cnfexpr *__restrict__ const expr, void *__restrict__ const usrptr,
+	       struct cnfstrview *__restrict__ const view)
+{
+	view->psz = MsgGetProp((msg_t*)usrptr, NULL, &((struct cnfvar*)expr)->prop,
+			       &view->len, &view->bMustBeFreed, NULL);
+}
+
+static inline void
+strviewDestruct(struct cnfstrview *__restrict__ const view)
+{
+	if(view->bMustBeFreed)
+		free(view->psz);
+}
+
+/* evaluate expr into a C string view. Properties are borrowed, anything
+ * else is evaluated and converted to a (then owned) C string.
+ */
+static uchar *
+evalCStrView(struct cnfexpr *__restrict__ const expr, void *__restrict__ const usrptr,
+	     struct cnfstrview *__restrict__ const view)
+{
+	struct var r;
+	int bMustFree;
+
+	if(isViewableVar(expr)) {
+		strviewFromVar(expr, usrptr, view);
+	} else {
+		cnfexprEval(expr, &r, usrptr);
+		view->psz = var2CString(&r, &bMustFree);
+		view->len = strlen((char*)view->psz);
+		view->bMustBeFreed = 1;
+		varFreeMembers(&r);
+	}
+	return view->psz;
+}
+
+static inline int
+strviewStartsWith(const uchar *s, const rs_size_t len, const uchar *c, const rs_size_t lenC,
+		   const int bCaseless)
+{
+	rs_size_t i;
+
+	if(len < lenC)
+		return 0;
+	if(!bCaseless)
+		return !memcmp(s, c, lenC);
+	for(i = 0 ; i < lenC ; ++i)
+		if(tolower(s[i]) != tolower(c[i]))
+			return 0;
+	return 1;
+}
+
+static inline int
+strviewContains(const uchar *s, const rs_size_t len, const uchar *c, const rs_size_t lenC,
+		 const int bCaseless)
+{
+	rs_size_t i;
+
+	if(lenC == 0)
+		return 1;
+	if(len < lenC)
+		return 0;
+	for(i = 0 ; i <= len - lenC ; ++i) {
+		if(!bCaseless) {
+			if(s[i] == c[0] && !memcmp(s + i, c, lenC))
+				return 1;
+		} else if(strviewStartsWith(s + i, lenC, c, lenC, 1)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* compare a view with a constant string */
+static inline int
+strviewStrCmp(const struct cnfstrview *const view, es_str_t *const estr, const int cmpop)
+{
+	const uchar *const c = es_getBufAddr(estr);
+	const rs_size_t lenC = es_strlen(estr);
+
+	switch(cmpop) {
+	case CMP_EQ:
+		return view->len == lenC && !memcmp(view->psz, c, lenC);
+	case CMP_NE:
+		return view->len != lenC || memcmp(view->psz, c, lenC);
+	case CMP_STARTSWITH:
+		return strviewStartsWith(view->psz, view->len, c, lenC, 0);
+	case CMP_STARTSWITHI:
+		return strviewStartsWith(view->psz, view->len, c, lenC, 1);
+	case CMP_CONTAINS:
+		return strviewContains(view->psz, view->len, c, lenC, 0);
+	case CMP_CONTAINSI:
+		return strviewContains(view->psz, view->len, c, lenC, 1);
+	default:
+		return 0;
+	}
+}
+
+/* bsearch() comparison of a view against the (sorted, see
+ * cnfexprOptimize()) array members; same order as qs_arrcmp()
+ */
+static int
+strviewArrBsearchCmp(const void *key, const void *elem)
+{
+	const struct cnfstrview *const view = (const struct cnfstrview*) key;
+	return -es_strbufcmp(*((es_str_t**)elem), view->psz, view->len);
+}
+
+static inline int
+strviewStrArrCmp(const struct cnfstrview *const view, struct cnfarray *const ar, const int cmpop)
+{
+	int i;
+
+	if(cmpop == CMP_EQ || cmpop == CMP_NE) {
+		i = bsearch(view, ar->arr, ar->nmemb, sizeof(es_str_t*), strviewArrBsearchCmp) != NULL;
+		return (cmpop == CMP_EQ) ? i : !i;
+	}
+	for(i = 0 ; i < ar->nmemb ; ++i)
+		if(strviewStrCmp(view, ar->arr[i], cmpop))
+			return 1;
+	return 0;
+}
+
+/* string comparison of a property with a constant string or array, done
+ * on a view of the property. Returns 0 if expr is not of that form, in
+ * which case the caller needs to do the regular evaluation.
+ */
+static inline int
+evalPropStrCmp(struct cnfexpr *__restrict__ const expr, void *__restrict__ const usrptr,
+	       struct var *__restrict__ const ret)
+{
+	struct cnfstrview view;
+
+	if(!isViewableVar(expr->l) || (expr->r->nodetype != 'S' && expr->r->nodetype != 'A'))
+		return 0;
+	strviewFromVar(expr->l, usrptr, &view);
+	ret->datatype = 'N';
+	if(expr->r->nodetype == 'S')
+		ret->d.n = strviewStrCmp(&view, ((struct cnfstringval*)expr->r)->estr, expr->nodetype);
+	else
+		ret->d.n = strviewStrArrCmp(&view, (struct cnfarray*) expr->r, expr->nodetype);
+	strviewDestruct(&view);
+	return 1;
+}
+
 static rsRetVal
 doExtractFieldByChar(uchar *str, uchar delim, const int matchnbr, uchar **resstr)
 {
@@ -1358,6 +1546,298 @@ finalize_it:
 	RETiRet;
 }
 
+/* ------------------------------ function result memo ------------------------------ */
+/* Configurations often call lookup(), exec_template() and the regex
+ * functions with the same arguments several times per message, e.g.
+ * lookup("assets", $fromhost-ip) all over the rule set or re_match()
+ * followed by re_extract() with the same pattern. Each thread keeps recent
+ * results in a small direct-mapped table, so repeated calls cost a hash and
+ * a compare instead of another evaluation:
+ * - lookup() results are keyed by table and key, they are valid until the
+ *   table is reloaded (lookup_t.gen).
+ * - exec_template() results are keyed by template and message, they are
+ *   valid until the message may have been modified, see
+ *   cnfexprMemoInvalidate().
+ * - regex results are keyed by pattern and input. Identical patterns share
+ *   a reRegPattern_t, regardless of the call site. Only patterns used in
+ *   more than one place are memoized.
+ * Arguments longer than FUNCMEMO_MAXKEY are not memoized.
+ */
+#define FUNCMEMO_SLOTS 256	/* must be a power of 2 */
+#define FUNCMEMO_MAXKEY 512
+#define FUNCMEMO_NMATCH 10	/* submatches kept for regex results */
+
+/* the registry of regex patterns in use by the config */
+typedef struct reRegPattern_s reRegPattern_t;
+struct reRegPattern_s {
+	es_str_t *pattern;
+	sbool bPcre;
+	sbool bExtract;		/* used by re_extract(), so submatches are needed */
+	int nRefs;		/* number of call sites */
+	reRegPattern_t *next;
+};
+static reRegPattern_t *reRegPatterns = NULL;
+
+/* funcdata of re_match() and re_extract() */
+struct funcData_regex {
+	rsregex_t re;	/* must be first, funcdata is also used as rsregex_t* */
+	reRegPattern_t *pattern;
+};
+
+typedef struct funcMemoEntry_s {
+	const void *id;		/* table, template or pattern; NULL if unused */
+	const msg_t *pMsg;	/* exec_template() only */
+	unsigned gen;		/* table generation or memo epoch */
+	uchar *key;		/* argument (not for exec_template()) */
+	int lenKey;
+	int sizeKey;
+	union {
+		es_str_t *estr;	/* lookup(), exec_template() */
+		struct {
+			int status;
+			regmatch_t pmatch[FUNCMEMO_NMATCH];
+		} re;
+	} v;
+	sbool bRegex;
+} funcMemoEntry_t;
+
+typedef struct funcMemo_s {
+	unsigned epoch;		/* incremented when messages may have been modified */
+	funcMemoEntry_t ent[FUNCMEMO_SLOTS];
+} funcMemo_t;
+static pthread_key_t keyFuncMemo;
+
+static void
+funcMemoDestruct(void *p)
+{
+	funcMemo_t *const pMemo = (funcMemo_t*) p;
+	int i;
+
+	for(i = 0 ; i < FUNCMEMO_SLOTS ; ++i) {
+		free(pMemo->ent[i].key);
+		if(!pMemo->ent[i].bRegex && pMemo->ent[i].v.estr != NULL)
+			es_deleteStr(pMemo->ent[i].v.estr);
+	}
+	free(pMemo);
+}
+
+static funcMemo_t *
+funcMemoGet(void)
+{
+	funcMemo_t *pMemo;
+
+	if((pMemo = pthread_getspecific(keyFuncMemo)) == NULL) {
+		if((pMemo = calloc(1, sizeof(funcMemo_t))) == NULL)
+			return NULL;
+		if(pthread_setspecific(keyFuncMemo, pMemo) != 0) {
+			free(pMemo);
+			return NULL;
+		}
+	}
+	return pMemo;
+}
+
+/* must be called whenever the message being processed may have been
+ * modified (or a new one is processed), done via wtiTplCacheInvalidate().
+ */
+void
+cnfexprMemoInvalidate(void)
+{
+	funcMemo_t *pMemo;
+
+	if((pMemo = pthread_getspecific(keyFuncMemo)) != NULL)
+		++pMemo->epoch;
+}
+
+static inline funcMemoEntry_t *
+funcMemoSlot(funcMemo_t *const pMemo, const void *id, const void *p2, const uchar *key, const int lenKey)
+{
+	uint32_t h = 2166136261u;
+	uintptr_t u = (uintptr_t) id ^ ((uintptr_t) p2 >> 4);
+	int i;
+
+	for(i = 0 ; i < lenKey ; ++i)
+		h = (h ^ key[i]) * 16777619u;
+	h ^= (uint32_t) (u ^ (u >> 16) ^ (u >> 32));
+	h ^= h >> 15;
+	return &pMemo->ent[h & (FUNCMEMO_SLOTS - 1)];
+}
+
+static inline int
+funcMemoKeyMatches(funcMemoEntry_t *const pEnt, const uchar *key, const int lenKey)
+{
+	return pEnt->lenKey == lenKey && (lenKey == 0 || !memcmp(pEnt->key, key, lenKey));
+}
+
+/* (re)assign an entry to a new key. Returns 0 if out of memory, the
+ * entry is then unused.
+ */
+static int
+funcMemoSetKey(funcMemoEntry_t *const pEnt, const void *id, const uchar *key, const int lenKey)
+{
+	uchar *newKey;
+
+	pEnt->id = NULL;
+	if(!pEnt->bRegex && pEnt->v.estr != NULL) {
+		es_deleteStr(pEnt->v.estr);
+		pEnt->v.estr = NULL;
+	}
+	if(lenKey > pEnt->sizeKey) {
+		if((newKey = realloc(pEnt->key, lenKey)) == NULL)
+			return 0;
+		pEnt->key = newKey;
+		pEnt->sizeKey = lenKey;
+	}
+	if(lenKey > 0)
+		memcpy(pEnt->key, key, lenKey);
+	pEnt->lenKey = lenKey;
+	pEnt->id = id;
+	return 1;
+}
+
+/* lookup() with memo, returns a new string */
+static es_str_t *
+memoLookupKey(lookup_t *const pTable, const uchar *key, const int lenKey)
+{
+	funcMemo_t *pMemo;
+	funcMemoEntry_t *pEnt;
+	unsigned gen;
+	es_str_t *estr;
+
+	if(lenKey > FUNCMEMO_MAXKEY || (pMemo = funcMemoGet()) == NULL)
+		return lookupKey_estr(pTable, (uchar*) key);
+	/* read the generation first, a reload in between only makes us miss */
+	gen = *((volatile unsigned *) &pTable->gen);
+	ATOMIC_BARRIER();
+	pEnt = funcMemoSlot(pMemo, pTable, NULL, key, lenKey);
+	if(pEnt->id == pTable && !pEnt->bRegex && pEnt->gen == gen && funcMemoKeyMatches(pEnt, key, lenKey))
+		return es_strdup(pEnt->v.estr);
+
+	estr = lookupKey_estr(pTable, (uchar*) key);
+	if(pEnt->bRegex) {
+		pEnt->bRegex = 0;
+		pEnt->v.estr = NULL;
+	}
+	if(funcMemoSetKey(pEnt, pTable, key, lenKey)) {
+		if((pEnt->v.estr = es_strdup(estr)) == NULL)
+			pEnt->id = NULL;
+		pEnt->pMsg = NULL;
+		pEnt->gen = gen;
+	}
+	return estr;
+}
+
+/* regexec() from the start of str, with memo. nmatch is what the caller
+ * needs (0 for re_match()).
+ */
+static int
+memoRegexec(struct funcData_regex *const pData, const char *str, const int lenStr,
+	    const size_t nmatch, regmatch_t pmatch[])
+{
+	funcMemo_t *pMemo;
+	funcMemoEntry_t *pEnt;
+	const size_t nmatchStore = pData->pattern->bExtract ? FUNCMEMO_NMATCH : 0;
+	regmatch_t pmatchStore[FUNCMEMO_NMATCH];
+	int status;
+
+	if(pData->pattern->nRefs < 2 || nmatch > nmatchStore || lenStr > FUNCMEMO_MAXKEY
+	   || (pMemo = funcMemoGet()) == NULL)
+		return regexp.regexec(&pData->re, str, nmatch, pmatch, 0);
+	pEnt = funcMemoSlot(pMemo, pData->pattern, NULL, (uchar*) str, lenStr);
+	if(pEnt->id == pData->pattern && pEnt->bRegex && funcMemoKeyMatches(pEnt, (uchar*) str, lenStr)) {
+		memcpy(pmatch, pEnt->v.re.pmatch, nmatch * sizeof(regmatch_t));
+		return pEnt->v.re.status;
+	}
+
+	status = regexp.regexec(&pData->re, str, nmatchStore, pmatchStore, 0);
+	memcpy(pmatch, pmatchStore, nmatch * sizeof(regmatch_t));
+	if(funcMemoSetKey(pEnt, pData->pattern, (uchar*) str, lenStr)) {
+		pEnt->bRegex = 1;
+		pEnt->v.re.status = status;
+		memcpy(pEnt->v.re.pmatch, pmatchStore, nmatchStore * sizeof(regmatch_t));
+	}
+	return status;
+}
+
+/* exec_template() with memo, returns a new string or NULL if the
+ * template could not be rendered.
+ */
+static es_str_t *
+memoExecTemplate(struct template *const pTpl, msg_t *const pMsg)
+{
+	funcMemo_t *pMemo;
+	funcMemoEntry_t *pEnt = NULL;
+	actWrkrIParams_t iparam;
+	es_str_t *estr = NULL;
+
+	if(!pTpl->bUsesSysTime && (pMemo = funcMemoGet()) != NULL) {
+		pEnt = funcMemoSlot(pMemo, pTpl, pMsg, NULL, 0);
+		if(pEnt->id == pTpl && !pEnt->bRegex && pEnt->pMsg == pMsg && pEnt->gen == pMemo->epoch)
+			return es_strdup(pEnt->v.estr);
+	}
+
+	wtiInitIParam(&iparam);
+	if(tplToString(pTpl, pMsg, &iparam, NULL) == RS_RET_OK)
+		estr = es_newStrFromCStr((char*)iparam.param, iparam.lenStr);
+	free(iparam.param);
+
+	if(pEnt != NULL && estr != NULL) {
+		if(pEnt->bRegex) {
+			pEnt->bRegex = 0;
+			pEnt->v.estr = NULL;
+		}
+		if(funcMemoSetKey(pEnt, pTpl, NULL, 0)) {
+			if((pEnt->v.estr = es_strdup(estr)) == NULL)
+				pEnt->id = NULL;
+			pEnt->pMsg = pMsg;
+			pEnt->gen = pMemo->epoch;
+		}
+	}
+	return estr;
+}
+
+/* add a use of a regex pattern to the registry */
+static reRegPattern_t *
+reRegPatternAdd(es_str_t *pattern, const sbool bPcre, const sbool bExtract)
+{
+	reRegPattern_t *pPat;
+
+	for(pPat = reRegPatterns ; pPat != NULL ; pPat = pPat->next) {
+		if(pPat->bPcre == bPcre && !es_strcmp(pPat->pattern, pattern))
+			break;
+	}
+	if(pPat == NULL) {
+		if((pPat = calloc(1, sizeof(reRegPattern_t))) == NULL)
+			return NULL;
+		if((pPat->pattern = es_strdup(pattern)) == NULL) {
+			free(pPat);
+			return NULL;
+		}
+		pPat->bPcre = bPcre;
+		pPat->next = reRegPatterns;
+		reRegPatterns = pPat;
+	}
+	++pPat->nRefs;
+	if(bExtract)
+		pPat->bExtract = 1;
+	return pPat;
+}
+
+static void
+reRegPatternRelease(reRegPattern_t *pPat)
+{
+	reRegPattern_t **ppPat;
+
+	if(pPat == NULL || --pPat->nRefs > 0)
+		return;
+	for(ppPat = &reRegPatterns ; *ppPat != pPat ; ppPat = &(*ppPat)->next)
+		/* just search */;
+	*ppPat = pPat->next;
+	es_deleteStr(pPat->pattern);
+	free(pPat);
+}
+
+
 static inline void
 doFunc_re_extract(struct cnffunc *func, struct var *ret, void* usrptr)
 {
@@ -1368,6 +1848,7 @@ doFunc_re_extract(struct cnffunc *func, struct var *ret, void* usrptr)
 	es_str_t *estr;
 	char *str;
 	struct var r[CNFFUNC_MAX_ARGS];
+	struct cnfstrview view;
 	int iLenBuf;
 	unsigned iOffs;
 	short iTry = 0;
@@ -1375,13 +1856,12 @@ doFunc_re_extract(struct cnffunc *func, struct var *ret, void* usrptr)
 	iOffs = 0;
 	sbool bHadNoMatch = 0;
 
-	cnfexprEval(func->expr[0], &r[0], usrptr);
 	/* search string is already part of the compiled regex, so we don't
 	 * need it here!
 	 */
 	cnfexprEval(func->expr[2], &r[2], usrptr);
 	cnfexprEval(func->expr[3], &r[3], usrptr);
-	str = (char*) var2CString(&r[0], &bMustFree);
+	str = (char*) evalCStrView(func->expr[0], usrptr, &view);
 	matchnbr = (short) var2Number(&r[2], NULL);
 	submatchnbr = (size_t) var2Number(&r[3], NULL);
 	if(submatchnbr >= sizeof(pmatch)/sizeof(regmatch_t)) {
@@ -1395,8 +1875,11 @@ doFunc_re_extract(struct cnffunc *func, struct var *ret, void* usrptr)
 	 */
 	while(!bFound) {
 		int iREstat;
-		iREstat = regexp.regexec(func->funcdata, (char*)(str + iOffs),
-					 submatchnbr+1, pmatch, 0);
+		if(iOffs == 0)
+			iREstat = memoRegexec(func->funcdata, str, view.len, submatchnbr+1, pmatch);
+		else
+			iREstat = regexp.regexec(func->funcdata, (char*)(str + iOffs),
+						 submatchnbr+1, pmatch, 0);
 		dbgprintf("re_extract: regexec return is %d\n", iREstat);
 		if(iREstat == 0) {
 			if(pmatch[0].rm_so == -1) {
@@ -1433,8 +1916,7 @@ doFunc_re_extract(struct cnffunc *func, struct var *ret, void* usrptr)
 	}
 
 finalize_it:
-	if(bMustFree) free(str);
-	varFreeMembers(&r[0]);
+	strviewDestruct(&view);
 	varFreeMembers(&r[2]);
 	varFreeMembers(&r[3]);
 
@@ -1462,18 +1944,9 @@ doFunc_exec_template(struct cnffunc *__restrict__ const func,
 	struct var *__restrict__ const ret,
 	msg_t *const pMsg)
 {
-	rsRetVal localRet;
-	actWrkrIParams_t iparam;
-
-	wtiInitIParam(&iparam);
-	localRet = tplToString(func->funcdata, pMsg, &iparam, NULL);
-	if(localRet == RS_RET_OK) {
-		ret->d.estr = es_newStrFromCStr((char*)iparam.param, iparam.lenStr);
-	} else {
+	if((ret->d.estr = memoExecTemplate(func->funcdata, pMsg)) == NULL)
 		ret->d.estr = es_newStrFromCStr("", 0);
-	}
 	ret->datatype = 'S';
-	free(iparam.param);
 
 	return;
 }
@@ -1497,6 +1970,7 @@ doFuncCall(struct cnffunc *__restrict__ const func, struct var *__restrict__ con
 	int delim;
 	int matchnbr;
 	struct funcData_prifilt *pPrifilt;
+	struct cnfstrview view;
 	rsRetVal localRet;
 
 	dbgprintf("rainerscript: executing function id %d\n", func->fID);
@@ -1507,6 +1981,10 @@ doFuncCall(struct cnffunc *__restrict__ const func, struct var *__restrict__ con
 			 * do one more recursive call.
 			 */
 			ret->d.n = es_strlen(((struct cnfstringval*) func->expr[0])->estr);
+		} else if(isViewableVar(func->expr[0])) {
+			strviewFromVar(func->expr[0], usrptr, &view);
+			ret->d.n = view.len;
+			strviewDestruct(&view);
 		} else {
 			cnfexprEval(func->expr[0], &r[0], usrptr);
 			estr = var2String(&r[0], &bMustFree);
@@ -1537,16 +2015,31 @@ doFuncCall(struct cnffunc *__restrict__ const func, struct var *__restrict__ con
 		free(str);
 		break;
 	case CNFFUNC_TOLOWER:
-		cnfexprEval(func->expr[0], &r[0], usrptr);
-		estr = var2String(&r[0], &bMustFree);
-		if(!bMustFree) /* let caller handle that M) */
-			estr = es_strdup(estr);
+		if(isViewableVar(func->expr[0])) {
+			/* the result is our only copy of the property */
+			strviewFromVar(func->expr[0], usrptr, &view);
+			estr = es_newStrFromCStr((char*)view.psz, view.len);
+			strviewDestruct(&view);
+		} else {
+			cnfexprEval(func->expr[0], &r[0], usrptr);
+			estr = var2String(&r[0], &bMustFree);
+			if(!bMustFree) /* let caller handle that M) */
+				estr = es_strdup(estr);
+			varFreeMembers(&r[0]);
+		}
 		es_tolower(estr);
 		ret->datatype = 'S';
 		ret->d.estr = estr;
-		varFreeMembers(&r[0]);
 		break;
 	case CNFFUNC_CSTR:
+		if(isViewableVar(func->expr[0])) {
+			/* a property already is a string, just copy it once */
+			strviewFromVar(func->expr[0], usrptr, &view);
+			ret->datatype = 'S';
+			ret->d.estr = es_newStrFromCStr((char*)view.psz, view.len);
+			strviewDestruct(&view);
+			break;
+		}
 		cnfexprEval(func->expr[0], &r[0], usrptr);
 		estr = var2String(&r[0], &bMustFree);
 		if(!bMustFree) /* let caller handle that M) */
@@ -1569,9 +2062,8 @@ doFuncCall(struct cnffunc *__restrict__ const func, struct var *__restrict__ con
 		ret->datatype = 'N';
 		break;
 	case CNFFUNC_RE_MATCH:
-		cnfexprEval(func->expr[0], &r[0], usrptr);
-		str = (char*) var2CString(&r[0], &bMustFree);
-		retval = regexp.regexec(func->funcdata, str, 0, NULL, 0);
+		str = (char*) evalCStrView(func->expr[0], usrptr, &view);
+		retval = memoRegexec(func->funcdata, str, view.len, 0, NULL);
 		if(retval == 0)
 			ret->d.n = 1;
 		else {
@@ -1581,8 +2073,7 @@ doFuncCall(struct cnffunc *__restrict__ const func, struct var *__restrict__ con
 			}
 		}
 		ret->datatype = 'N';
-		if(bMustFree) free(str);
-		varFreeMembers(&r[0]);
+		strviewDestruct(&view);
 		break;
 	case CNFFUNC_RE_EXTRACT:
 		doFunc_re_extract(func, ret, usrptr);
@@ -1591,10 +2082,9 @@ doFuncCall(struct cnffunc *__restrict__ const func, struct var *__restrict__ con
 		doFunc_exec_template(func, ret, (msg_t*) usrptr);
 		break;
 	case CNFFUNC_FIELD:
-		cnfexprEval(func->expr[0], &r[0], usrptr);
 		cnfexprEval(func->expr[1], &r[1], usrptr);
 		cnfexprEval(func->expr[2], &r[2], usrptr);
-		str = (char*) var2CString(&r[0], &bMustFree);
+		str = (char*) evalCStrView(func->expr[0], usrptr, &view);
 		matchnbr = var2Number(&r[2], NULL);
 		if(r[1].datatype == 'S') {
 			char *delimstr;
@@ -1617,8 +2107,7 @@ doFuncCall(struct cnffunc *__restrict__ const func, struct var *__restrict__ con
 					sizeof("***ERROR in field() FUNCTION***")-1);
 		}
 		ret->datatype = 'S';
-		if(bMustFree) free(str);
-		varFreeMembers(&r[0]);
+		strviewDestruct(&view);
 		varFreeMembers(&r[1]);
 		varFreeMembers(&r[2]);
 		break;
@@ -1639,11 +2128,19 @@ dbgprintf("DDDD: executing lookup\n");
 			ret->d.estr = es_newStrFromCStr("TABLE-NOT-FOUND", sizeof("TABLE-NOT-FOUND")-1);
 			break;
 		}
-		cnfexprEval(func->expr[1], &r[1], usrptr);
-		str = (char*) var2CString(&r[1], &bMustFree);
-		ret->d.estr = lookupKey_estr(func->funcdata, (uchar*)str);
-		if(bMustFree) free(str);
-		if(r[1].datatype == 'S') es_deleteStr(r[1].d.estr);
+		str = (char*) evalCStrView(func->expr[1], usrptr, &view);
+		ret->d.estr = memoLookupKey(func->funcdata, (uchar*)str, view.len);
+		strviewDestruct(&view);
+		break;
+	case CNFFUNC_RATELIMIT:
+		ret->datatype = 'N';
+		if(func->funcdata == NULL) {
+			ret->d.n = 1; /* config error was already reported, do not drop */
+			break;
+		}
+		str = (char*) evalCStrView(func->expr[0], usrptr, &view);
+		ret->d.n = ratelimitKeyedCheck(func->funcdata, (uchar*)str, view.len);
+		strviewDestruct(&view);
 		break;
 	default:
 		if(Debug) {
@@ -1728,6 +2225,106 @@ evalStrArrayCmp(es_str_t *const estr_l, struct cnfarray *__restrict__ const ar,
 	return r;
 }
 
+/* Adaptive AND/OR evaluation (see struct cnfjunct).
+ * For short-circuit evaluation, the expected cost is minimal if operands
+ * are evaluated in ascending order of cost divided by the probability that
+ * the operand decides the result (is false for AND, true for OR). We
+ * estimate both from the statistics of each operand and re-rank them every
+ * JUNCT_REORDER_INTERVAL evaluations. Only every JUNCT_TIMING_RATE-th
+ * evaluation is timed, so that the clock reads do not cost more than a
+ * good order saves. Statistics are halved after each re-ranking, so that
+ * the order follows changes in the message mix.
+ */
+#define JUNCT_TIMING_RATE 64
+#define JUNCT_REORDER_INTERVAL 8192
+
+static inline double
+junctRank(const struct cnfjuncterm *const t)
+{
+	const double prob = (t->nDecisive + 1.0) / (t->nEval + 2.0);
+	const double cost = (t->nTimed == 0) ? 0.0 : (double) t->nsTimed / t->nTimed;
+	return cost / prob;
+}
+
+static void
+junctReorder(struct cnfjunct *const j)
+{
+	double rank[CNFJUNCT_MAXTERMS];
+	int idx[CNFJUNCT_MAXTERMS];
+	unsigned order;
+	int i, k, tmp;
+
+	for(i = 0 ; i < j->nTerms ; ++i) {
+		idx[i] = (j->order >> (4 * i)) & 0x0f;
+		rank[idx[i]] = junctRank(&j->terms[idx[i]]);
+	}
+	/* insertion sort, keeps the current order for equal ranks */
+	for(i = 1 ; i < j->nTerms ; ++i) {
+		tmp = idx[i];
+		for(k = i ; k > 0 && rank[idx[k-1]] > rank[tmp] ; --k)
+			idx[k] = idx[k-1];
+		idx[k] = tmp;
+	}
+	order = 0;
+	for(i = 0 ; i < j->nTerms ; ++i)
+		order |= (unsigned) idx[i] << (4 * i);
+	if(order != j->order) {
+		*((volatile unsigned*) &j->order) = order;
+		++j->nReorders;
+		if(Debug) {
+			dbgprintf("rainerscript: new order for %s list %p:", tokenToString(j->op), j);
+			for(i = 0 ; i < j->nTerms ; ++i)
+				dbgprintf(" %d[rank %.1f]", idx[i], rank[idx[i]]);
+			dbgprintf("\n");
+		}
+	}
+	for(i = 0 ; i < j->nTerms ; ++i) {
+		j->terms[i].nEval /= 2;
+		j->terms[i].nDecisive /= 2;
+		j->terms[i].nTimed /= 2;
+		j->terms[i].nsTimed /= 2;
+	}
+}
+
+static void
+evalJunct(struct cnfjunct *__restrict__ const j, struct var *__restrict__ const ret,
+	  void *__restrict__ const usrptr)
+{
+	const unsigned order = *((volatile unsigned*) &j->order);
+	const int bDecider = (j->op == OR);
+	const unsigned long long nEval = j->nEval++;
+	const int bTimed = (nEval % JUNCT_TIMING_RATE) == 0;
+	struct cnfjuncterm *t;
+	struct var r;
+	uint64_t tBegin = 0;
+	int convok;
+	int bRes;
+	int i;
+
+	ret->datatype = 'N';
+	ret->d.n = !bDecider;
+	for(i = 0 ; i < j->nTerms ; ++i) {
+		t = j->terms + ((order >> (4 * i)) & 0x0f);
+		if(bTimed)
+			tBegin = getMonotonicNsecs();
+		cnfexprEval(t->expr, &r, usrptr);
+		bRes = var2Number(&r, &convok) != 0;
+		varFreeMembers(&r);
+		if(bTimed) {
+			t->nsTimed += getMonotonicNsecs() - tBegin;
+			++t->nTimed;
+		}
+		++t->nEval;
+		if(bRes == bDecider) {
+			++t->nDecisive;
+			ret->d.n = bDecider;
+			break;
+		}
+	}
+	if(nEval % JUNCT_REORDER_INTERVAL == JUNCT_REORDER_INTERVAL - 1)
+		junctReorder(j);
+}
+
 #define FREE_BOTH_RET \
 		varFreeMembers(&r); \
 		varFreeMembers(&l)
@@ -1790,6 +2387,8 @@ cnfexprEval(struct cnfexpr *__restrict__ const expr, struct var *__restrict__ co
 		/* this is optimized in regard to right param as a PoC for all compOps
 		 * So this is a NOT yet the copy template!
 		 */
+		if(evalPropStrCmp(expr, usrptr, ret))
+			break;
 		cnfexprEval(expr->l, &l, usrptr);
 		ret->datatype = 'N';
 		if(l.datatype == 'S') {
@@ -1855,6 +2454,8 @@ cnfexprEval(struct cnfexpr *__restrict__ const expr, struct var *__restrict__ co
 		varFreeMembers(&l);
 		break;
 	case CMP_NE:
+		if(evalPropStrCmp(expr, usrptr, ret))
+			break;
 		cnfexprEval(expr->l, &l, usrptr);
 		cnfexprEval(expr->r, &r, usrptr);
 		ret->datatype = 'N';
@@ -2026,6 +2627,8 @@ cnfexprEval(struct cnfexpr *__restrict__ const expr, struct var *__restrict__ co
 		FREE_BOTH_RET;
 		break;
 	case CMP_STARTSWITH:
+		if(evalPropStrCmp(expr, usrptr, ret))
+			break;
 		PREP_TWO_STRINGS;
 		ret->datatype = 'N';
 		if(expr->r->nodetype == 'A') {
@@ -2037,6 +2640,8 @@ cnfexprEval(struct cnfexpr *__restrict__ const expr, struct var *__restrict__ co
 		FREE_TWO_STRINGS;
 		break;
 	case CMP_STARTSWITHI:
+		if(evalPropStrCmp(expr, usrptr, ret))
+			break;
 		PREP_TWO_STRINGS;
 		ret->datatype = 'N';
 		if(expr->r->nodetype == 'A') {
@@ -2048,6 +2653,8 @@ cnfexprEval(struct cnfexpr *__restrict__ const expr, struct var *__restrict__ co
 		FREE_TWO_STRINGS;
 		break;
 	case CMP_CONTAINS:
+		if(evalPropStrCmp(expr, usrptr, ret))
+			break;
 		PREP_TWO_STRINGS;
 		ret->datatype = 'N';
 		if(expr->r->nodetype == 'A') {
@@ -2059,6 +2666,8 @@ cnfexprEval(struct cnfexpr *__restrict__ const expr, struct var *__restrict__ co
 		FREE_TWO_STRINGS;
 		break;
 	case CMP_CONTAINSI:
+		if(evalPropStrCmp(expr, usrptr, ret))
+			break;
 		PREP_TWO_STRINGS;
 		ret->datatype = 'N';
 		if(expr->r->nodetype == 'A') {
@@ -2159,6 +2768,9 @@ cnfexprEval(struct cnfexpr *__restrict__ const expr, struct var *__restrict__ co
 	case 'F':
 		doFuncCall((struct cnffunc*) expr, ret, usrptr);
 		break;
+	case 'L':
+		evalJunct((struct cnfjunct*) expr, ret, usrptr);
+		break;
 	default:
 		ret->datatype = 'N';
 		ret->d.n = 0ll;
@@ -2192,8 +2804,14 @@ cnffuncDestruct(struct cnffunc *func)
 	switch(func->fID) {
 		case CNFFUNC_RE_MATCH:
 		case CNFFUNC_RE_EXTRACT:
-			if(func->funcdata != NULL)
+			if(func->funcdata != NULL) {
 				regexp.regfree(func->funcdata);
+				reRegPatternRelease(((struct funcData_regex*) func->funcdata)->pattern);
+			}
+			break;
+		case CNFFUNC_RATELIMIT:
+			ratelimitKeyedDestruct(func->funcdata);
+			func->funcdata = NULL;
 			break;
 		default:break;
 	}
@@ -2207,6 +2825,7 @@ cnffuncDestruct(struct cnffunc *func)
 void
 cnfexprDestruct(struct cnfexpr *__restrict__ const expr)
 {
+	int i;
 
 	if(expr == NULL) {
 		/* this is valid and can happen during optimizer run! */
@@ -2256,6 +2875,10 @@ cnfexprDestruct(struct cnfexpr *__restrict__ const expr)
 	case 'A':
 		cnfarrayContentDestruct((struct cnfarray*)expr);
 		break;
+	case 'L':
+		for(i = 0 ; i < ((struct cnfjunct*)expr)->nTerms ; ++i)
+			cnfexprDestruct(((struct cnfjunct*)expr)->terms[i].expr);
+		break;
 	default:break;
 	}
 	free(expr);
@@ -2277,23 +2900,344 @@ cnfexprEvalBool(struct cnfexpr *__restrict__ const expr, void *__restrict__ cons
 	return var2Number(&ret, &convok);
 }
 
-inline static void
-doIndent(int indent)
-{
-	int i;
-	for(i = 0 ; i < indent ; ++i)
-		dbgprintf("  ");
-}
 
-static void
-pmaskPrint(uchar *pmask, int indent)
+/* check if an expression can be evaluated on an input thread, that is
+ * before the message is enqueued (see global(input.prefilter)). This is
+ * the case if it only uses constants, operators, the prifilt() function
+ * and properties that are available without further work. Variables, the
+ * other functions (which may use per-thread caches or state) and fromhost
+ * (which may need a DNS lookup) are not permitted.
+ */
+int
+cnfexprIsPrefilterSafe(struct cnfexpr *expr)
 {
+	struct cnfvar *var;
+	struct cnffunc *func;
+	struct cnfjunct *junct;
 	int i;
-	doIndent(indent);
-	dbgprintf("pmask: ");
-	for (i = 0; i <= LOG_NFACILITIES; i++)
-		if (pmask[i] == TABLE_NOPRI)
-			dbgprintf(" X ");
+
+	if(expr == NULL)
+		return 1;
+	switch(expr->nodetype) {
+	case 'N':
+	case 'S':
+	case 'A':
+		return 1;
+	case 'V':
+		var = (struct cnfvar*) expr;
+		return    var->prop.id != PROP_CEE
+		       && var->prop.id != PROP_LOCAL_VAR
+		       && var->prop.id != PROP_GLOBAL_VAR
+		       && var->prop.id != PROP_FROMHOST
+		       && var->prop.id != PROP_INVALID;
+	case 'F':
+		func = (struct cnffunc*) expr;
+		return func->fID == CNFFUNC_PRIFILT;
+	case 'L':
+		junct = (struct cnfjunct*) expr;
+		for(i = 0 ; i < junct->nTerms ; ++i)
+			if(!cnfexprIsPrefilterSafe(junct->terms[i].expr))
+				return 0;
+		return 1;
+	case CMP_EQ:
+	case CMP_NE:
+	case CMP_LE:
+	case CMP_GE:
+	case CMP_LT:
+	case CMP_GT:
+	case CMP_STARTSWITH:
+	case CMP_STARTSWITHI:
+	case CMP_CONTAINS:
+	case CMP_CONTAINSI:
+	case OR:
+	case AND:
+	case NOT:
+	case '&':
+	case '+':
+	case '-':
+	case '*':
+	case '/':
+	case '%':
+	case 'M':
+		return cnfexprIsPrefilterSafe(expr->l) && cnfexprIsPrefilterSafe(expr->r);
+	default:
+		return 0;
+	}
+}
+
+/* Compiled expressions.
+ * Conditions of if statements are compiled into a small register-based
+ * bytecode after they have been optimized. The benefit over the tree walker
+ * comes from string comparisons of message properties against constants (or
+ * constant arrays), which are the vast majority of real-world filters: they
+ * are done directly on the property buffer, without creating a struct var
+ * and a copy of the property for each comparison. Properties are loaded
+ * into registers on first use and then shared by all comparisons in the
+ * same condition. AND, OR and NOT are compiled into jumps on a boolean
+ * accumulator. Everything else is executed by the tree walker (EXPROP_TREE),
+ * so the semantics stay exactly the same. If a condition contains nothing
+ * we can do natively, it is not compiled at all.
+ */
+enum cnfexprOpcode {
+	EXPROP_TREE,	/* acc = tree walker result of d.expr */
+	EXPROP_STRCMP,	/* acc = reg[iReg] <cmpop> d.estr */
+	EXPROP_STRARR,	/* acc = reg[iReg] <cmpop> any of d.arr */
+	EXPROP_NOT,	/* acc = !acc */
+	EXPROP_JMPT,	/* if acc: goto target */
+	EXPROP_JMPF,	/* if !acc: goto target */
+	EXPROP_END
+};
+
+struct cnfexprop {
+	enum cnfexprOpcode opcode;
+	int iReg;
+	int cmpop;
+	int target;
+	union {
+		struct cnfexpr *expr;
+		es_str_t *estr;
+		struct cnfarray *arr;
+	} d;
+};
+
+#define CNFEXPRPROG_MAXREGS 8
+struct cnfexprprog {
+	struct cnfexprop *ops;
+	int nOps;
+	int maxOps;
+	int nNative;	/* number of ops not handed to the tree walker */
+	int nRegs;
+	struct cnfvar *regVar[CNFEXPRPROG_MAXREGS];
+};
+
+
+static rsRetVal
+exprprogAddOp(struct cnfexprprog *prog, enum cnfexprOpcode opcode, int *idx)
+{
+	struct cnfexprop *newops;
+	DEFiRet;
+
+	if(prog->nOps == prog->maxOps) {
+		newops = realloc(prog->ops, (prog->maxOps + 16) * sizeof(struct cnfexprop));
+		if(newops == NULL)
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		prog->ops = newops;
+		prog->maxOps += 16;
+	}
+	*idx = prog->nOps++;
+	memset(prog->ops + *idx, 0, sizeof(struct cnfexprop));
+	prog->ops[*idx].opcode = opcode;
+finalize_it:
+	RETiRet;
+}
+
+/* return the register for a property, -1 if we are out of registers.
+ * Only plain message properties go into registers, JSON properties are
+ * left to the tree walker.
+ */
+static int
+exprprogGetReg(struct cnfexprprog *prog, struct cnfvar *var)
+{
+	int i;
+
+	if(var->prop.id == PROP_CEE        ||
+	   var->prop.id == PROP_LOCAL_VAR  ||
+	   var->prop.id == PROP_GLOBAL_VAR   )
+		return -1;
+	for(i = 0 ; i < prog->nRegs ; ++i)
+		if(prog->regVar[i]->prop.id == var->prop.id)
+			return i;
+	if(prog->nRegs == CNFEXPRPROG_MAXREGS)
+		return -1;
+	prog->regVar[prog->nRegs] = var;
+	return prog->nRegs++;
+}
+
+static rsRetVal
+exprprogCompile(struct cnfexprprog *prog, struct cnfexpr *expr)
+{
+	int idx, iReg;
+	DEFiRet;
+
+	switch(expr->nodetype) {
+	case AND:
+	case OR:
+		CHKiRet(exprprogCompile(prog, expr->l));
+		CHKiRet(exprprogAddOp(prog, (expr->nodetype == AND) ? EXPROP_JMPF : EXPROP_JMPT, &idx));
+		CHKiRet(exprprogCompile(prog, expr->r));
+		prog->ops[idx].target = prog->nOps;
+		FINALIZE;
+	case NOT:
+		CHKiRet(exprprogCompile(prog, expr->r));
+		CHKiRet(exprprogAddOp(prog, EXPROP_NOT, &idx));
+		FINALIZE;
+	case CMP_EQ:
+	case CMP_NE:
+	case CMP_STARTSWITH:
+	case CMP_STARTSWITHI:
+	case CMP_CONTAINS:
+	case CMP_CONTAINSI:
+		if(expr->l->nodetype != 'V' ||
+		   (expr->r->nodetype != 'S' && expr->r->nodetype != 'A'))
+			break;
+		if((iReg = exprprogGetReg(prog, (struct cnfvar*) expr->l)) == -1)
+			break;
+		if(expr->r->nodetype == 'S') {
+			CHKiRet(exprprogAddOp(prog, EXPROP_STRCMP, &idx));
+			prog->ops[idx].d.estr = ((struct cnfstringval*) expr->r)->estr;
+		} else {
+			CHKiRet(exprprogAddOp(prog, EXPROP_STRARR, &idx));
+			prog->ops[idx].d.arr = (struct cnfarray*) expr->r;
+		}
+		prog->ops[idx].iReg = iReg;
+		prog->ops[idx].cmpop = expr->nodetype;
+		++prog->nNative;
+		FINALIZE;
+	default:
+		break;
+	}
+	CHKiRet(exprprogAddOp(prog, EXPROP_TREE, &idx));
+	prog->ops[idx].d.expr = expr;
+finalize_it:
+	RETiRet;
+}
+
+static void
+cnfexprprogDestruct(struct cnfexprprog *prog)
+{
+	if(prog == NULL)
+		return;
+	free(prog->ops);
+	free(prog);
+}
+
+/* compile an (already optimized) expression. Returns NULL if the expression
+ * is better handled by the tree walker or if we run out of memory. The
+ * program references, but does not own, the nodes of expr.
+ */
+static struct cnfexprprog *
+cnfexprCompile(struct cnfexpr *expr)
+{
+	struct cnfexprprog *prog;
+	int idx;
+	rsRetVal localRet;
+
+	if((prog = calloc(1, sizeof(struct cnfexprprog))) == NULL)
+		return NULL;
+	localRet = exprprogCompile(prog, expr);
+	if(localRet == RS_RET_OK)
+		localRet = exprprogAddOp(prog, EXPROP_END, &idx);
+	if(localRet != RS_RET_OK || prog->nNative == 0) {
+		cnfexprprogDestruct(prog);
+		return NULL;
+	}
+	DBGPRINTF("rainerscript: compiled expr %p into %d ops, %d native, %d registers\n",
+		  expr, prog->nOps, prog->nNative, prog->nRegs);
+	return prog;
+}
+
+
+/* we use computed gotos ("threaded code") where the compiler supports
+ * them, as this permits better branch prediction than a central switch.
+ */
+#if defined(__GNUC__)
+#	define EXPR_CASE(opc) lbl_##opc
+#	define EXPR_DISPATCH() goto *dispatch[op->opcode]
+#	define EXPR_LOOP_BEGIN EXPR_DISPATCH();
+#	define EXPR_LOOP_END
+#else
+#	define EXPR_CASE(opc) case opc
+#	define EXPR_DISPATCH() continue
+#	define EXPR_LOOP_BEGIN for(;;) { switch(op->opcode) {
+#	define EXPR_LOOP_END } }
+#endif
+
+/* evaluate a compiled expression as bool */
+int
+cnfexprprogEvalBool(struct cnfexprprog *prog, void *usrptr)
+{
+#if defined(__GNUC__)
+	static void *const dispatch[] = {
+		[EXPROP_TREE] = &&lbl_EXPROP_TREE,
+		[EXPROP_STRCMP] = &&lbl_EXPROP_STRCMP,
+		[EXPROP_STRARR] = &&lbl_EXPROP_STRARR,
+		[EXPROP_NOT] = &&lbl_EXPROP_NOT,
+		[EXPROP_JMPT] = &&lbl_EXPROP_JMPT,
+		[EXPROP_JMPF] = &&lbl_EXPROP_JMPF,
+		[EXPROP_END] = &&lbl_EXPROP_END
+	};
+#endif
+	struct cnfstrview regs[CNFEXPRPROG_MAXREGS];
+	unsigned loaded = 0;
+	struct cnfexprop *op = prog->ops;
+	struct var ret;
+	int convok;
+	int acc = 0;
+	int i;
+
+#	define EXPR_LOADREG(i) \
+		if(!(loaded & (1u << (i)))) { \
+			regs[i].psz = MsgGetProp((msg_t*)usrptr, NULL, &prog->regVar[i]->prop, \
+						 &regs[i].len, &regs[i].bMustBeFreed, NULL); \
+			loaded |= 1u << (i); \
+		}
+
+	EXPR_LOOP_BEGIN
+	EXPR_CASE(EXPROP_TREE):
+		cnfexprEval(op->d.expr, &ret, usrptr);
+		acc = var2Number(&ret, &convok) != 0;
+		varFreeMembers(&ret);
+		++op;
+		EXPR_DISPATCH();
+	EXPR_CASE(EXPROP_STRCMP):
+		EXPR_LOADREG(op->iReg);
+		acc = strviewStrCmp(&regs[op->iReg], op->d.estr, op->cmpop);
+		++op;
+		EXPR_DISPATCH();
+	EXPR_CASE(EXPROP_STRARR):
+		EXPR_LOADREG(op->iReg);
+		acc = strviewStrArrCmp(&regs[op->iReg], op->d.arr, op->cmpop);
+		++op;
+		EXPR_DISPATCH();
+	EXPR_CASE(EXPROP_NOT):
+		acc = !acc;
+		++op;
+		EXPR_DISPATCH();
+	EXPR_CASE(EXPROP_JMPT):
+		op = acc ? prog->ops + op->target : op + 1;
+		EXPR_DISPATCH();
+	EXPR_CASE(EXPROP_JMPF):
+		op = acc ? op + 1 : prog->ops + op->target;
+		EXPR_DISPATCH();
+	EXPR_CASE(EXPROP_END):
+		goto done;
+	EXPR_LOOP_END
+#	undef EXPR_LOADREG
+
+done:
+	for(i = 0 ; i < prog->nRegs ; ++i)
+		if((loaded & (1u << i)) && regs[i].bMustBeFreed)
+			free(regs[i].psz);
+	return acc;
+}
+
+inline static void
+doIndent(int indent)
+{
+	int i;
+	for(i = 0 ; i < indent ; ++i)
+		dbgprintf("  ");
+}
+
+static void
+pmaskPrint(uchar *pmask, int indent)
+{
+	int i;
+	doIndent(indent);
+	dbgprintf("pmask: ");
+	for (i = 0; i <= LOG_NFACILITIES; i++)
+		if (pmask[i] == TABLE_NOPRI)
+			dbgprintf(" X ");
 		else
 			dbgprintf("%2X ", pmask[i]);
 	dbgprintf("\n");
@@ -2315,6 +3259,8 @@ void
 cnfexprPrint(struct cnfexpr *expr, int indent)
 {
 	struct cnffunc *func;
+	struct cnfjunct *junct;
+	struct cnfjuncterm *term;
 	int i;
 
 	switch(expr->nodetype) {
@@ -2395,6 +3341,20 @@ cnfexprPrint(struct cnfexpr *expr, int indent)
 		dbgprintf("NOT\n");
 		cnfexprPrint(expr->r, indent+1);
 		break;
+	case 'L':
+		junct = (struct cnfjunct*) expr;
+		doIndent(indent);
+		dbgprintf("%s (adaptive, %llu evaluations, order changed %llu times)\n",
+			  tokenToString(junct->op), junct->nEval, junct->nReorders);
+		for(i = 0 ; i < junct->nTerms ; ++i) {
+			term = junct->terms + ((junct->order >> (4 * i)) & 0x0f);
+			doIndent(indent);
+			dbgprintf("operand %d: decisive %llu of %llu, avg %llu ns\n",
+				  (int) (term - junct->terms), term->nDecisive, term->nEval,
+				  term->nTimed ? term->nsTimed / term->nTimed : 0);
+			cnfexprPrint(term->expr, indent+1);
+		}
+		break;
 	case 'S':
 		doIndent(indent);
 		cstrPrint("string '", ((struct cnfstringval*)expr)->estr);
@@ -2452,6 +3412,7 @@ void
 cnfstmtPrintOnly(struct cnfstmt *stmt, int indent, sbool subtree)
 {
 	char *cstr;
+	int i;
 	switch(stmt->nodetype) {
 	case S_NOP:
 		doIndent(indent); dbgprintf("NOP\n");
@@ -2528,6 +3489,29 @@ cnfstmtPrintOnly(struct cnfstmt *stmt, int indent, sbool subtree)
 			doIndent(indent); dbgprintf("END PROPFILT\n");
 		}
 		break;
+	case S_MULTIFILT:
+		doIndent(indent); dbgprintf("MULTIFILT on '%s', %d patterns\n",
+			propIDToName(stmt->d.s_multifilt.prop->id),
+			acmatchNumPatterns(stmt->d.s_multifilt.matcher));
+		if(subtree) {
+			cnfstmtPrint(stmt->d.s_multifilt.members, indent+1);
+			doIndent(indent); dbgprintf("END MULTIFILT\n");
+		}
+		break;
+	case S_SWITCH:
+		doIndent(indent); dbgprintf("SWITCH on '%s', %d cases, %d values\n",
+			propIDToName(stmt->d.s_switch.prop->id), stmt->d.s_switch.nCases,
+			perfhashNumKeys(stmt->d.s_switch.hash));
+		if(subtree) {
+			for(i = 0 ; i < stmt->d.s_switch.nCases ; ++i)
+				cnfstmtPrintOnly(stmt->d.s_switch.cases[i], indent+1, 1);
+			if(stmt->d.s_switch.t_else != NULL) {
+				doIndent(indent); dbgprintf("ELSE\n");
+				cnfstmtPrint(stmt->d.s_switch.t_else, indent+1);
+			}
+			doIndent(indent); dbgprintf("END SWITCH\n");
+		}
+		break;
 	default:
 		dbgprintf("error: unknown stmt type %u\n",
 			(unsigned) stmt->nodetype);
@@ -2624,6 +3608,35 @@ cnfvarNew(char *name)
 	return var;
 }
 
+/* names of the config files statements were defined in. cnfcurrfn is
+ * freed when the lexer is done with a file, so we keep a copy of each name
+ * for the lifetime of the process.
+ */
+static struct cnfsrcfile {
+	struct cnfsrcfile *next;
+	char name[1];
+} *cnfsrcfiles = NULL;
+
+static const char *
+cnfstmtSrcFile(void)
+{
+	struct cnfsrcfile *f;
+	size_t len;
+
+	if(cnfcurrfn == NULL)
+		return "";
+	for(f = cnfsrcfiles ; f != NULL ; f = f->next)
+		if(!strcmp(f->name, cnfcurrfn))
+			return f->name;
+	len = strlen(cnfcurrfn);
+	if((f = malloc(sizeof(struct cnfsrcfile) + len)) == NULL)
+		return "";
+	memcpy(f->name, cnfcurrfn, len + 1);
+	f->next = cnfsrcfiles;
+	cnfsrcfiles = f;
+	return f->name;
+}
+
 struct cnfstmt *
 cnfstmtNew(unsigned s_type)
 {
@@ -2632,16 +3645,33 @@ cnfstmtNew(unsigned s_type)
 		cnfstmt->nodetype = s_type;
 		cnfstmt->printable = NULL;
 		cnfstmt->next = NULL;
+		cnfstmt->srcfile = cnfstmtSrcFile();
+		cnfstmt->lineno = yylineno;
+		cnfstmt->prof = NULL;
+		cnfstmt->nActGroup = 0;
 	}
 	return cnfstmt;
 }
 
+/* statements are created when the parser has seen all of them, so the
+ * grammar tells us the line they begin on. stmt may be NULL.
+ */
+struct cnfstmt *
+cnfstmtSetLine(struct cnfstmt *stmt, int lineno)
+{
+	if(stmt != NULL)
+		stmt->lineno = lineno;
+	return stmt;
+}
+
 void cnfstmtDestructLst(struct cnfstmt *root);
 
 /* delete a single stmt */
 static void
 cnfstmtDestruct(struct cnfstmt *stmt)
 {
+	int i;
+
 	switch(stmt->nodetype) {
 	case S_NOP:
 	case S_STOP:
@@ -2653,6 +3683,7 @@ cnfstmtDestruct(struct cnfstmt *stmt)
 		actionDestruct(stmt->d.act);
 		break;
 	case S_IF:
+		cnfexprprogDestruct(stmt->d.s_if.prog);
 		cnfexprDestruct(stmt->d.s_if.expr);
 		if(stmt->d.s_if.t_then != NULL) {
 			cnfstmtDestructLst(stmt->d.s_if.t_then);
@@ -2680,12 +3711,24 @@ cnfstmtDestruct(struct cnfstmt *stmt)
 			cstrDestruct(&stmt->d.s_propfilt.pCSCompValue);
 		cnfstmtDestructLst(stmt->d.s_propfilt.t_then);
 		break;
+	case S_MULTIFILT:
+		acmatchDestruct(&stmt->d.s_multifilt.matcher);
+		cnfstmtDestructLst(stmt->d.s_multifilt.members);
+		break;
+	case S_SWITCH:
+		perfhashDestruct(&stmt->d.s_switch.hash);
+		for(i = 0 ; i < stmt->d.s_switch.nCases ; ++i)
+			cnfstmtDestructLst(stmt->d.s_switch.cases[i]);
+		free(stmt->d.s_switch.cases);
+		cnfstmtDestructLst(stmt->d.s_switch.t_else);
+		break;
 	default:
 		dbgprintf("error: unknown stmt type during destruct %u\n",
 			(unsigned) stmt->nodetype);
 		break;
 	}
 	free(stmt->printable);
+	free(stmt->prof);
 	free(stmt);
 }
 
@@ -3154,6 +4197,115 @@ cnfexprOptimize(struct cnfexpr *expr)
 	return expr;
 }
 
+/* collect the operands of a chain of AND (or OR) nodes, in evaluation
+ * order. Returns 0 if there are more than maxTerms.
+ */
+static int
+junctCollect(struct cnfexpr *expr, const unsigned op, struct cnfexpr **terms,
+	     int *nTerms, const int maxTerms)
+{
+	if(expr->nodetype == op)
+		return junctCollect(expr->l, op, terms, nTerms, maxTerms)
+		    && junctCollect(expr->r, op, terms, nTerms, maxTerms);
+	if(*nTerms == maxTerms)
+		return 0;
+	terms[(*nTerms)++] = expr;
+	return 1;
+}
+
+static void
+junctFreeChain(struct cnfexpr *expr, const unsigned op)
+{
+	if(expr->nodetype != op)
+		return;
+	junctFreeChain(expr->l, op);
+	junctFreeChain(expr->r, op);
+	free(expr);
+}
+
+/* build an adaptive list from terms; longer lists are nested in the last
+ * term. Returns NULL if out of memory (then nothing is changed).
+ */
+static struct cnfjunct *
+junctBuild(const unsigned op, struct cnfexpr **terms, const int nTerms)
+{
+	struct cnfjunct *j;
+	int i, n;
+
+	if((j = calloc(1, sizeof(struct cnfjunct))) == NULL)
+		return NULL;
+	j->nodetype = 'L';
+	j->op = op;
+	n = (nTerms > CNFJUNCT_MAXTERMS) ? CNFJUNCT_MAXTERMS - 1 : nTerms;
+	for(i = 0 ; i < n ; ++i)
+		j->terms[i].expr = terms[i];
+	if(n < nTerms) {
+		j->terms[n].expr = (struct cnfexpr*) junctBuild(op, terms + n, nTerms - n);
+		if(j->terms[n].expr == NULL) {
+			free(j);
+			return NULL;
+		}
+		++n;
+	}
+	j->nTerms = n;
+	for(i = 0 ; i < n ; ++i)
+		j->order |= (unsigned) i << (4 * i);
+	return j;
+}
+
+/* turn the AND/OR chains of an (already optimized) expression into lists
+ * whose order is adapted at runtime. As rainerscript expressions have no
+ * side effects, the operands of AND and OR can be evaluated in any order.
+ */
+#define JUNCT_MAXCHAIN 64
+static struct cnfexpr* cnfexprMakeAdaptive(struct cnfexpr *expr);
+
+static void
+junctMakeTermsAdaptive(struct cnfjunct *j)
+{
+	int i;
+
+	for(i = 0 ; i < j->nTerms ; ++i) {
+		if(j->terms[i].expr->nodetype == 'L') /* a nested part of ourselves */
+			junctMakeTermsAdaptive((struct cnfjunct*) j->terms[i].expr);
+		else
+			j->terms[i].expr = cnfexprMakeAdaptive(j->terms[i].expr);
+	}
+}
+
+static struct cnfexpr*
+cnfexprMakeAdaptive(struct cnfexpr *expr)
+{
+	struct cnfexpr *terms[JUNCT_MAXCHAIN];
+	struct cnfjunct *j;
+	int nTerms = 0;
+
+	switch(expr->nodetype) {
+	case AND:
+	case OR:
+		if(!junctCollect(expr, expr->nodetype, terms, &nTerms, JUNCT_MAXCHAIN)) {
+			expr->l = cnfexprMakeAdaptive(expr->l);
+			expr->r = cnfexprMakeAdaptive(expr->r);
+			break;
+		}
+		if((j = junctBuild(expr->nodetype, terms, nTerms)) == NULL)
+			break;
+		/* the operands now belong to the list, free the chain only */
+		junctFreeChain(expr, j->op);
+		junctMakeTermsAdaptive(j);
+		DBGPRINTF("optimizer: %s chain %p with %d operands made adaptive\n",
+			  tokenToString(j->op), j, nTerms);
+		expr = (struct cnfexpr*) j;
+		break;
+	case NOT:
+		expr->r = cnfexprMakeAdaptive(expr->r);
+		break;
+	default:
+		break;
+	}
+	return expr;
+}
+
 /* removes NOPs from a statement list and returns the
  * first non-NOP entry.
  */
@@ -3186,6 +4338,138 @@ done:	return newRoot;
 }
 
 
+/* Hash dispatch for if/else-if chains.
+ * Chains like
+ *    if $programname == 'a' then ... else if $programname == 'b' then ...
+ * (also with arrays on the right-hand side) are evaluated one compare
+ * after the other. If there are at least SWITCH_MIN of them on the same
+ * property, we turn the chain into an S_SWITCH, which selects the branch
+ * with a single lookup in a perfect hash table. If a value occurs in
+ * multiple cases, the first one wins, just like in the chain. As
+ * cnfstmtOptimizeIf() optimizes the else branch first, we build the
+ * switch from the innermost if on and absorb it while moving outwards.
+ */
+#define SWITCH_MIN 4
+
+/* check if stmt can be a case of a switch, return its property if so */
+static msgPropDescr_t *
+switchCandidate(struct cnfstmt *stmt)
+{
+	struct cnfexpr *expr;
+	msgPropDescr_t *prop;
+
+	if(stmt->nodetype != S_IF)
+		return NULL;
+	expr = stmt->d.s_if.expr;
+	if(   expr->nodetype != CMP_EQ || expr->l->nodetype != 'V'
+	   || (expr->r->nodetype != 'S' && expr->r->nodetype != 'A'))
+		return NULL;
+	prop = &((struct cnfvar*) expr->l)->prop;
+	if(   prop->id == PROP_INVALID || prop->id == PROP_CEE
+	   || prop->id == PROP_LOCAL_VAR || prop->id == PROP_GLOBAL_VAR)
+		return NULL;
+	return prop;
+}
+
+static rsRetVal
+switchAddKeys(perfhash_t *hash, struct cnfstmt *stmt, int iCase)
+{
+	struct cnfexpr *r = stmt->d.s_if.expr->r;
+	struct cnfarray *arr;
+	int i;
+	DEFiRet;
+
+	if(r->nodetype == 'S') {
+		CHKiRet(perfhashAdd(hash, es_getBufAddr(((struct cnfstringval*) r)->estr),
+				    es_strlen(((struct cnfstringval*) r)->estr), iCase));
+	} else {
+		arr = (struct cnfarray*) r;
+		for(i = 0 ; i < arr->nmemb ; ++i)
+			CHKiRet(perfhashAdd(hash, es_getBufAddr(arr->arr[i]),
+					    es_strlen(arr->arr[i]), iCase));
+	}
+finalize_it:
+	RETiRet;
+}
+
+/* returns 1 if stmt was converted to S_SWITCH, 0 otherwise */
+static int
+cnfstmtOptimizeSwitch(struct cnfstmt *stmt)
+{
+	msgPropDescr_t *prop, *propNext;
+	struct cnfstmt *cur, *next, *inner = NULL;
+	struct cnfstmt *copy = NULL;
+	struct cnfstmt **cases = NULL;
+	perfhash_t *hash = NULL;
+	int nLinks, nCases, i;
+
+	if((prop = switchCandidate(stmt)) == NULL)
+		return 0;
+	nLinks = 1;
+	for(cur = stmt ; ; cur = next, ++nLinks) {
+		next = cur->d.s_if.t_else;
+		if(next == NULL || next->next != NULL)
+			break;
+		if(next->nodetype == S_SWITCH && next->d.s_switch.prop->id == prop->id) {
+			inner = next;
+			break;
+		}
+		if((propNext = switchCandidate(next)) == NULL || propNext->id != prop->id)
+			break;
+	}
+	nCases = nLinks + ((inner == NULL) ? 0 : inner->d.s_switch.nCases);
+	if(nCases < SWITCH_MIN)
+		return 0;
+
+	if(perfhashConstruct(&hash) != RS_RET_OK)
+		goto fail;
+	if((cases = malloc(nCases * sizeof(struct cnfstmt*))) == NULL)
+		goto fail;
+	for(i = 0, cur = stmt ; i < nLinks ; ++i, cur = cur->d.s_if.t_else) {
+		cases[i] = cur;
+		if(switchAddKeys(hash, cur, i) != RS_RET_OK)
+			goto fail;
+	}
+	for(i = nLinks ; i < nCases ; ++i) {
+		cases[i] = inner->d.s_switch.cases[i - nLinks];
+		if(switchAddKeys(hash, cases[i], i) != RS_RET_OK)
+			goto fail;
+	}
+	if(perfhashFinalize(hash) != RS_RET_OK)
+		goto fail;
+	if((copy = malloc(sizeof(struct cnfstmt))) == NULL)
+		goto fail;
+
+	/* now we can no longer fail, so re-arrange the tree */
+	memcpy(copy, stmt, sizeof(struct cnfstmt));
+	copy->next = NULL;
+	cases[0] = copy;
+	stmt->nodetype = S_SWITCH;
+	stmt->printable = NULL;
+	stmt->d.s_switch.t_else = (inner == NULL) ? cases[nLinks-1]->d.s_if.t_else
+						  : inner->d.s_switch.t_else;
+	for(i = 0 ; i < nLinks ; ++i)
+		cases[i]->d.s_if.t_else = NULL;
+	if(inner != NULL) {
+		perfhashDestruct(&inner->d.s_switch.hash);
+		free(inner->d.s_switch.cases);
+		free(inner->printable);
+		free(inner);
+	}
+	stmt->d.s_switch.hash = hash;
+	stmt->d.s_switch.nCases = nCases;
+	stmt->d.s_switch.cases = cases;
+	stmt->d.s_switch.prop = switchCandidate(copy);
+	DBGPRINTF("optimizer: changed %d IFs on property '%s' into SWITCH with %d values\n",
+		  nCases, propIDToName(prop->id), perfhashNumKeys(hash));
+	return 1;
+fail:
+	perfhashDestruct(&hash);
+	free(cases);
+	return 0;
+}
+
+
 static inline void
 cnfstmtOptimizeIf(struct cnfstmt *stmt)
 {
@@ -3195,6 +4479,8 @@ cnfstmtOptimizeIf(struct cnfstmt *stmt)
 	struct funcData_prifilt *prifilt;
 
 	expr = stmt->d.s_if.expr = cnfexprOptimize(stmt->d.s_if.expr);
+	if(bScriptAdaptiveOrder)
+		expr = stmt->d.s_if.expr = cnfexprMakeAdaptive(expr);
 	stmt->d.s_if.t_then = removeNOPs(stmt->d.s_if.t_then);
 	stmt->d.s_if.t_else = removeNOPs(stmt->d.s_if.t_else);
 	cnfstmtOptimize(stmt->d.s_if.t_then);
@@ -3221,6 +4507,9 @@ cnfstmtOptimizeIf(struct cnfstmt *stmt)
 			cnfstmtOptimizePRIFilt(stmt);
 		}
 	}
+
+	if(stmt->nodetype == S_IF && !cnfstmtOptimizeSwitch(stmt))
+		stmt->d.s_if.prog = cnfexprCompile(stmt->d.s_if.expr);
 }
 
 static inline void
@@ -3309,6 +4598,189 @@ done:
 	free(rsName);
 	return;
 }
+
+/* Multi-pattern filters.
+ * Configs often have long lists of filters like
+ *    :msg, contains, "X" action...
+ *    if $msg contains "Y" then ...
+ * each of which scans the property again. We group runs of such sibling
+ * filters on the same property (case-sensitive contains and startswith,
+ * against constants) into an S_MULTIFILT statement. It finds all matches
+ * with one pass of an Aho-Corasick automaton, and then executes the
+ * original filters' branches in order, based on these results. This is
+ * only valid if the branches of a filter cannot modify the property for
+ * the filters that follow it, so we stop a group at a filter whose
+ * branches contain calls or message modification actions.
+ */
+#define MULTIFILT_MIN 4	/* smaller groups are not worth it */
+
+/* check if stmt can be a member of a multi-pattern filter. If so, returns
+ * the property it tests and its pattern, else NULL.
+ */
+static msgPropDescr_t *
+multiFiltCandidate(struct cnfstmt *stmt, uchar **pat, size_t *lenPat, sbool *bAnchored)
+{
+	msgPropDescr_t *prop;
+	struct cnfexpr *expr;
+	es_str_t *estr;
+
+	if(stmt->nodetype == S_PROPFILT) {
+		if(   stmt->d.s_propfilt.operation != FIOP_CONTAINS
+		   && stmt->d.s_propfilt.operation != FIOP_STARTSWITH)
+			return NULL;
+		prop = &stmt->d.s_propfilt.prop;
+		*pat = rsCStrGetBufBeg(stmt->d.s_propfilt.pCSCompValue);
+		*lenPat = rsCStrLen(stmt->d.s_propfilt.pCSCompValue);
+		*bAnchored = stmt->d.s_propfilt.operation == FIOP_STARTSWITH;
+	} else if(stmt->nodetype == S_IF) {
+		expr = stmt->d.s_if.expr;
+		if(   (expr->nodetype != CMP_CONTAINS && expr->nodetype != CMP_STARTSWITH)
+		   || expr->l->nodetype != 'V' || expr->r->nodetype != 'S')
+			return NULL;
+		prop = &((struct cnfvar*) expr->l)->prop;
+		estr = ((struct cnfstringval*) expr->r)->estr;
+		*pat = es_getBufAddr(estr);
+		*lenPat = es_strlen(estr);
+		*bAnchored = expr->nodetype == CMP_STARTSWITH;
+	} else {
+		return NULL;
+	}
+	if(   prop->id == PROP_INVALID || prop->id == PROP_CEE
+	   || prop->id == PROP_LOCAL_VAR || prop->id == PROP_GLOBAL_VAR)
+		return NULL;
+	return prop;
+}
+
+/* check that a statement list cannot modify message properties */
+static int
+stmtLstIsTransparent(struct cnfstmt *root)
+{
+	struct cnfstmt *stmt;
+	int i;
+
+	for(stmt = root ; stmt != NULL ; stmt = stmt->next) {
+		switch(stmt->nodetype) {
+		case S_NOP:
+		case S_STOP:
+		case S_SET:
+		case S_UNSET:
+			break;
+		case S_ACT:
+			if(stmt->d.act->eParamPassing == ACT_MSG_PASSING)
+				return 0;
+			break;
+		case S_IF:
+			if(   !stmtLstIsTransparent(stmt->d.s_if.t_then)
+			   || !stmtLstIsTransparent(stmt->d.s_if.t_else))
+				return 0;
+			break;
+		case S_PRIFILT:
+			if(   !stmtLstIsTransparent(stmt->d.s_prifilt.t_then)
+			   || !stmtLstIsTransparent(stmt->d.s_prifilt.t_else))
+				return 0;
+			break;
+		case S_PROPFILT:
+			if(!stmtLstIsTransparent(stmt->d.s_propfilt.t_then))
+				return 0;
+			break;
+		case S_MULTIFILT:
+			if(!stmtLstIsTransparent(stmt->d.s_multifilt.members))
+				return 0;
+			break;
+		case S_SWITCH:
+			for(i = 0 ; i < stmt->d.s_switch.nCases ; ++i)
+				if(!stmtLstIsTransparent(stmt->d.s_switch.cases[i]->d.s_if.t_then))
+					return 0;
+			if(!stmtLstIsTransparent(stmt->d.s_switch.t_else))
+				return 0;
+			break;
+		default: /* S_CALL and anything we do not know */
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int
+stmtIsTransparent(struct cnfstmt *stmt)
+{
+	if(stmt->nodetype == S_PROPFILT)
+		return stmtLstIsTransparent(stmt->d.s_propfilt.t_then);
+	return    stmtLstIsTransparent(stmt->d.s_if.t_then)
+	       && stmtLstIsTransparent(stmt->d.s_if.t_else);
+}
+
+/* turn the n statements starting at first into a multi-pattern filter.
+ * The first node is re-used for the S_MULTIFILT, so that pointers to it
+ * stay valid.
+ */
+static void
+cnfstmtBuildMultiFilt(struct cnfstmt *first, int n)
+{
+	struct cnfstmt *copy, *last = NULL, *stmt;
+	acmatch_t *matcher = NULL;
+	uchar *pat;
+	size_t lenPat;
+	sbool bAnchored;
+	int i;
+
+	if(acmatchConstruct(&matcher) != RS_RET_OK)
+		return;
+	for(i = 0, stmt = first ; i < n ; ++i, stmt = stmt->next) {
+		multiFiltCandidate(stmt, &pat, &lenPat, &bAnchored);
+		if(acmatchAddPattern(matcher, pat, lenPat, bAnchored) != RS_RET_OK)
+			goto fail;
+		last = stmt;
+	}
+	if(acmatchFinalize(matcher) != RS_RET_OK)
+		goto fail;
+	if((copy = malloc(sizeof(struct cnfstmt))) == NULL)
+		goto fail;
+	memcpy(copy, first, sizeof(struct cnfstmt));
+	first->nodetype = S_MULTIFILT;
+	first->printable = NULL;
+	first->next = last->next;
+	last->next = NULL;
+	first->d.s_multifilt.matcher = matcher;
+	first->d.s_multifilt.members = copy;
+	first->d.s_multifilt.prop = multiFiltCandidate(copy, &pat, &lenPat, &bAnchored);
+	DBGPRINTF("optimizer: combined %d filters on property '%s' into MULTIFILT\n",
+		  n, propIDToName(first->d.s_multifilt.prop->id));
+	return;
+fail:
+	acmatchDestruct(&matcher);
+}
+
+static void
+cnfstmtOptimizeMultiFilt(struct cnfstmt *root)
+{
+	struct cnfstmt *stmt, *first;
+	msgPropDescr_t *prop, *propFirst;
+	uchar *pat;
+	size_t lenPat;
+	sbool bAnchored;
+	int n;
+
+	stmt = root;
+	while(stmt != NULL) {
+		if((propFirst = multiFiltCandidate(stmt, &pat, &lenPat, &bAnchored)) == NULL) {
+			stmt = stmt->next;
+			continue;
+		}
+		first = stmt;
+		n = 1;
+		while(   n < ACMATCH_MAXPATTERNS && stmtIsTransparent(stmt) && stmt->next != NULL
+		      && (prop = multiFiltCandidate(stmt->next, &pat, &lenPat, &bAnchored)) != NULL
+		      && prop->id == propFirst->id) {
+			stmt = stmt->next;
+			++n;
+		}
+		stmt = stmt->next;
+		if(n >= MULTIFILT_MIN)
+			cnfstmtBuildMultiFilt(first, n);
+	}
+}
+
 /* (recursively) optimize a statement */
 void
 cnfstmtOptimize(struct cnfstmt *root)
@@ -3351,6 +4823,7 @@ cnfstmtOptimize(struct cnfstmt *root)
 			break;
 		}
 	}
+	cnfstmtOptimizeMultiFilt(root);
 done:	return;
 }
 
@@ -3415,6 +4888,13 @@ funcName2ID(es_str_t *fname, unsigned short nParams)
 			return CNFFUNC_INVALID;
 		}
 		return CNFFUNC_RE_MATCH;
+	} else if(!es_strbufcmp(fname, (unsigned char*)"re_match_pcre", sizeof("re_match_pcre") - 1)) {
+		if(nParams != 2) {
+			parser_errmsg("number of parameters for re_match_pcre() must be two "
+				      "but is %d.", nParams);
+			return CNFFUNC_INVALID;
+		}
+		return CNFFUNC_RE_MATCH; /* initFunc_re_match() checks the name */
 	} else if(!es_strbufcmp(fname, (unsigned char*)"re_extract", sizeof("re_extract") - 1)) {
 		if(nParams != 5) {
 			parser_errmsg("number of parameters for re_extract() must be five "
@@ -3422,6 +4902,13 @@ funcName2ID(es_str_t *fname, unsigned short nParams)
 			return CNFFUNC_INVALID;
 		}
 		return CNFFUNC_RE_EXTRACT;
+	} else if(!es_strbufcmp(fname, (unsigned char*)"re_extract_pcre", sizeof("re_extract_pcre") - 1)) {
+		if(nParams != 5) {
+			parser_errmsg("number of parameters for re_extract_pcre() must be five "
+				      "but is %d.", nParams);
+			return CNFFUNC_INVALID;
+		}
+		return CNFFUNC_RE_EXTRACT; /* initFunc_re_match() checks the name */
 	} else if(!es_strbufcmp(fname, (unsigned char*)"field", sizeof("field") - 1)) {
 		if(nParams != 3) {
 			parser_errmsg("number of parameters for field() must be three "
@@ -3450,18 +4937,34 @@ funcName2ID(es_str_t *fname, unsigned short nParams)
 			return CNFFUNC_INVALID;
 		}
 		return CNFFUNC_LOOKUP;
+	} else if(!es_strbufcmp(fname, (unsigned char*)"ratelimit", sizeof("ratelimit") - 1)) {
+		if(nParams != 3 && nParams != 4) {
+			parser_errmsg("number of parameters for ratelimit() must be three "
+				      "or four but is %d.", nParams);
+			return CNFFUNC_INVALID;
+		}
+		return CNFFUNC_RATELIMIT;
 	} else {
 		return CNFFUNC_INVALID;
 	}
 }
 
 
+/* the *_pcre variants of re_match() and re_extract() use PCRE */
+static inline int
+isPcreFunc(struct cnffunc *func)
+{
+	return !es_strbufcmp(func->fname, (unsigned char*)"re_match_pcre", sizeof("re_match_pcre") - 1)
+	    || !es_strbufcmp(func->fname, (unsigned char*)"re_extract_pcre", sizeof("re_extract_pcre") - 1);
+}
+
+
 static inline rsRetVal
 initFunc_re_match(struct cnffunc *func)
 {
 	rsRetVal localRet;
 	char *regex = NULL;
-	regex_t *re;
+	struct funcData_regex *pData;
 	DEFiRet;
 
 	func->funcdata = NULL;
@@ -3470,13 +4973,15 @@ initFunc_re_match(struct cnffunc *func)
 		FINALIZE;
 	}
 
-	CHKmalloc(re = malloc(sizeof(regex_t)));
-	func->funcdata = re;
+	CHKmalloc(pData = calloc(1, sizeof(struct funcData_regex)));
+	func->funcdata = pData;
+	CHKmalloc(pData->pattern = reRegPatternAdd(((struct cnfstringval*) func->expr[1])->estr,
+						   isPcreFunc(func), func->fID == CNFFUNC_RE_EXTRACT));
 
 	regex = es_str2cstr(((struct cnfstringval*) func->expr[1])->estr, NULL);
 	
 	if((localRet = objUse(regexp, LM_REGEXP_FILENAME)) == RS_RET_OK) {
-		if(regexp.regcomp(re, (char*) regex, REG_EXTENDED) != 0) {
+		if(regexp.regcomp(&pData->re, (char*) regex, isPcreFunc(func) ? RS_REG_PCRE : REG_EXTENDED) != 0) {
 			parser_errmsg("cannot compile regex '%s'", regex);
 			ABORT_FINALIZE(RS_RET_ERR);
 		}
@@ -3563,6 +5068,38 @@ finalize_it:
 }
 
 
+static inline rsRetVal
+initFunc_ratelimit(struct cnffunc *func)
+{
+	long long rate, burst;
+	long long nSlots = 4096;
+	DEFiRet;
+
+	func->funcdata = NULL;
+	if(func->expr[1]->nodetype != 'N' || func->expr[2]->nodetype != 'N'
+	   || (func->nParams == 4 && func->expr[3]->nodetype != 'N')) {
+		parser_errmsg("ratelimit(): rate, burst and slots (params 2 to 4) "
+			      "must be constant numbers");
+		FINALIZE;
+	}
+	rate = ((struct cnfnumval*) func->expr[1])->val;
+	burst = ((struct cnfnumval*) func->expr[2])->val;
+	if(func->nParams == 4)
+		nSlots = ((struct cnfnumval*) func->expr[3])->val;
+	if(rate < 0 || rate > 4000000 || burst < 1 || burst > 4000000
+	   || nSlots < 1 || nSlots > (1 << 30)) {
+		parser_errmsg("ratelimit(): rate must be in 0..4000000, burst in 1..4000000 "
+			      "and slots in 1..%d", 1 << 30);
+		FINALIZE;
+	}
+	CHKiRet(ratelimitKeyedNew((ratelimitKeyed_t**) &func->funcdata, "ratelimit()",
+				  (unsigned) rate, (unsigned) burst, (unsigned) nSlots));
+
+finalize_it:
+	RETiRet;
+}
+
+
 struct cnffunc *
 cnffuncNew(es_str_t *fname, struct cnffparamlst* paramlst)
 {
@@ -3606,6 +5143,9 @@ cnffuncNew(es_str_t *fname, struct cnffparamlst* paramlst)
 			case CNFFUNC_EXEC_TEMPLATE:
 				initFunc_exec_template(func);
 				break;
+			case CNFFUNC_RATELIMIT:
+				initFunc_ratelimit(func);
+				break;
 			default:break;
 		}
 	}
@@ -3785,6 +5325,8 @@ initRainerscript(void)
 {
 	DEFiRet;
 	CHKiRet(objGetObjInterface(&obj));
+	if(pthread_key_create(&keyFuncMemo, funcMemoDestruct) != 0)
+		ABORT_FINALIZE(RS_RET_ERR);
 finalize_it:
 	RETiRet;
 }
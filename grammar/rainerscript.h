@@ -14,6 +14,7 @@
 	 */
 
 extern int Debug; /* 1 if in debug mode, 0 otherwise -- to be enhanced */
+extern int bScriptAdaptiveOrder; /* reorder AND/OR operands based on runtime statistics? */
 
 enum cnfobjType {
 	CNFOBJ_ACTION,
@@ -121,6 +122,7 @@ struct nvlst {
  * S - string
  * V - var
  * A - (string) array
+ * L - AND/OR list, reordered at runtime (script.adaptiveorder)
  * ... plus the S_* #define's below:
  */
 #define S_STOP 4000
@@ -132,6 +134,8 @@ struct nvlst {
 #define S_SET 4006
 #define S_UNSET 4007
 #define S_CALL 4008
+#define S_MULTIFILT 4009	/* optimizer-generated group of contains/startswith filters */
+#define S_SWITCH 4010	/* optimizer-generated hash dispatch for an if/else-if chain */
 
 enum cnfFiltType { CNFFILT_NONE, CNFFILT_PRI, CNFFILT_PROP, CNFFILT_SCRIPT };
 static inline char*
@@ -151,15 +155,31 @@ cnfFiltType2str(enum cnfFiltType filttype)
 }
 
 
+/* execution profile of a statement, only allocated if global(script.profile.file)
+ * is set. Times are inclusive, that is they contain the time spent in the
+ * statement's branches (or the called ruleset).
+ */
+struct cnfstmtprof {
+	unsigned long long nExec;	/* number of messages the stmt was executed for */
+	unsigned long long nTimed;	/* ... of which were timed */
+	unsigned long long nsTimed;	/* their total run time in ns */
+};
+
 struct cnfstmt {
 	unsigned nodetype;
 	struct cnfstmt *next;
 	uchar *printable; /* printable text for debugging */
+	const char *srcfile;	/* config file the stmt was defined in (shared, do not free) */
+	int lineno;		/* ... and its line */
+	struct cnfstmtprof *prof; /* NULL if not profiled */
+	int nActGroup;		/* S_ACT: number of actions starting here that may run in
+				 * parallel (see global(script.parallelactions)), 0 if none */
 	union {
 		struct {
 			struct cnfexpr *expr;
 			struct cnfstmt *t_then;
 			struct cnfstmt *t_else;
+			struct cnfexprprog *prog; /* compiled expr, NULL if not compiled */
 		} s_if;
 		struct {
 			uchar *varname;
@@ -180,13 +200,25 @@ struct cnfstmt {
 		} s_prifilt;
 		struct {
 			fiop_t operation;
-			regex_t *regex_cache;/* cache for compiled REs, if used */
+			struct rsregex_s *regex_cache;/* cache for compiled REs, if used */
 			struct cstr_s *pCSCompValue;/* value to "compare" against */
 			sbool isNegated;
 			msgPropDescr_t prop; /* requested property */
 			struct cnfstmt *t_then;
 			struct cnfstmt *t_else;
 		} s_propfilt;
+		struct {
+			struct acmatch_s *matcher;
+			msgPropDescr_t *prop;	/* property tested by all members */
+			struct cnfstmt *members;/* original filters, pattern i is for member i */
+		} s_multifilt;
+		struct {
+			struct perfhash_s *hash;/* maps property value to case */
+			msgPropDescr_t *prop;	/* property tested by all cases */
+			int nCases;
+			struct cnfstmt **cases;	/* original ifs, case i runs the then branch of cases[i] */
+			struct cnfstmt *t_else;	/* run if no case matches */
+		} s_switch;
 		struct action_s *act;
 	} d;
 };
@@ -238,7 +270,8 @@ enum cnffuncid {
 	CNFFUNC_FIELD,
 	CNFFUNC_PRIFILT,
 	CNFFUNC_LOOKUP,
-	CNFFUNC_EXEC_TEMPLATE
+	CNFFUNC_EXEC_TEMPLATE,
+	CNFFUNC_RATELIMIT
 };
 
 struct cnffunc {
@@ -250,6 +283,33 @@ struct cnffunc {
 	struct cnfexpr *expr[];
 };
 
+/* An AND or OR of up to CNFJUNCT_MAXTERMS operands, created by the
+ * optimizer if script.adaptiveorder is on. The evaluation order is
+ * periodically changed based on how often each operand decides the result
+ * and how long it takes to evaluate it. Statistics are updated without
+ * locking by all worker threads, so they are approximate. The order is
+ * kept in a single word (4 bits per term index, first term in the lowest
+ * bits) so that a reader always sees a complete permutation.
+ */
+#define CNFJUNCT_MAXTERMS 8
+struct cnfjuncterm {
+	struct cnfexpr *expr;
+	unsigned long long nEval;	/* number of evaluations */
+	unsigned long long nDecisive;	/* ... which decided the result */
+	unsigned long long nTimed;	/* number of timed evaluations */
+	unsigned long long nsTimed;	/* their total run time in ns */
+};
+
+struct cnfjunct {
+	unsigned nodetype; /* L */
+	unsigned op;	/* AND or OR */
+	int nTerms;
+	unsigned order;
+	unsigned long long nEval;
+	unsigned long long nReorders; /* number of times the order changed */
+	struct cnfjuncterm terms[CNFJUNCT_MAXTERMS];
+};
+
 /* future extensions
 struct x {
 	int nodetype;
@@ -312,7 +372,10 @@ void cnfobjPrint(struct cnfobj *o);
 struct cnfexpr* cnfexprNew(unsigned nodetype, struct cnfexpr *l, struct cnfexpr *r);
 void cnfexprPrint(struct cnfexpr *expr, int indent);
 void cnfexprEval(struct cnfexpr *expr, struct var *ret, void *pusr);
+void cnfexprMemoInvalidate(void);
 int cnfexprEvalBool(struct cnfexpr *expr, void *usrptr);
+int cnfexprIsPrefilterSafe(struct cnfexpr *expr);
+int cnfexprprogEvalBool(struct cnfexprprog *prog, void *usrptr);
 void cnfexprDestruct(struct cnfexpr *expr);
 struct cnfnumval* cnfnumvalNew(long long val);
 struct cnfstringval* cnfstringvalNew(es_str_t *estr);
@@ -328,6 +391,7 @@ int cnfparamvalsIsSet(struct cnfparamblk *params, struct cnfparamvals *vals);
 void varDelete(struct var *v);
 void cnfparamvalsDestruct(struct cnfparamvals *paramvals, struct cnfparamblk *blk);
 struct cnfstmt * cnfstmtNew(unsigned s_type);
+struct cnfstmt * cnfstmtSetLine(struct cnfstmt *stmt, int lineno);
 void cnfstmtPrintOnly(struct cnfstmt *stmt, int indent, sbool subtree);
 void cnfstmtPrint(struct cnfstmt *stmt, int indent);
 struct cnfstmt* scriptAddStmt(struct cnfstmt *root, struct cnfstmt *s);
@@ -34,6 +34,9 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <fnmatch.h>
+#include <poll.h>
+#include <signal.h>
+#include <limits.h>
 #ifdef HAVE_SYS_INOTIFY_H
 #include <sys/inotify.h>
 #endif
@@ -55,6 +58,7 @@
 #include "stringbuf.h"
 #include "ruleset.h"
 #include "ratelimit.h"
+#include "statsobj.h"
 
 MODULE_TYPE_INPUT	/* must be present for input modules, do not remove */
 MODULE_TYPE_NOKEEP
@@ -70,6 +74,7 @@ DEFobjCurrIf(datetime)
 DEFobjCurrIf(strm)
 DEFobjCurrIf(prop)
 DEFobjCurrIf(ruleset)
+DEFobjCurrIf(statsobj)
 
 static int bLegacyCnfModGlobalsPermitted;/* are legacy module-global config parameters permitted? */
 
@@ -96,11 +101,18 @@ typedef struct fileInfo_s {
 	int nRecords; /**< How many records did we process before persisting the stream? */
 	int iPersistStateInterval; /**< how often should state be persisted? (0=on close only) */
 	strm_t *pStrm;	/* its stream (NULL if not assigned) */
+	strm_t *pStrmRestored;	/* state store: state loaded on startup, until the file is opened */
+	sbool bLegacyState;	/* state store: state came from the per-file state file */
 	uint8_t readMode;	/* which mode to use in ReadMulteLine call? */
 	sbool escapeLF;	/* escape LF inside the MSG content? */
 	ruleset_t *pRuleset;	/* ruleset to bind listener to (use system default if unspecified) */
 	ratelimit_t *ratelimiter;
 	multi_submit_t multiSub;
+	sbool bPaused;	/* reading stopped due to backpressure, data left unread */
+	sbool bPending;	/* new data reported by inotify, protected by owning reader's mutex */
+	int iReader;	/* reader thread owning this file (if readers > 1) */
+	statsobj_t *stats;
+	int lag;	/* bytes the file size is ahead of our read position (stats) */
 } fileInfo_t;
 
 static struct configSettings_s {
@@ -150,6 +162,8 @@ struct modConfData_s {
 	int iPollInterval;	/* number of seconds to sleep when there was no file activity */
 	instanceConf_t *root, *tail;
 	uint8_t opMode;
+	int nReaders;		/* number of reader threads */
+	uchar *pszStateStore;	/* consolidated state store in work directory, NULL - per-file state files */
 	sbool configSetViaV2Method;
 };
 static modConfData_t *loadModConf = NULL;/* modConf ptr to use for the current load process */
@@ -157,8 +171,29 @@ static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current lo
 
 static int iFilPtr = 0;		/* number of files to be monitored; pointer to next free spot during config */
 static fileInfo_t *files = NULL;
+static sbool bFilesPaused = 0;	/* is there at least one file with bPaused set? */
+#define PAUSED_RETRY_INTERVAL 100	/* inotify mode: ms until paused files are retried */
 static int allocMaxFiles;	/* max file table size currently allocated */
 
+/* Reader pool. If more than one reader is configured, each file is owned by
+ * one reader thread (file index modulo number of readers), which does all
+ * reads for it. So lines of a single file are still processed in order,
+ * while different files are read concurrently. In inotify mode, the input
+ * thread only receives the events and dispatches them to the owning reader.
+ */
+typedef struct reader_s {
+	pthread_t tid;
+	pthread_mutex_t mut;
+	pthread_cond_t cond;
+	int idx;
+	sbool bPending;		/* at least one file of this reader has new data */
+	sbool bStarted;
+} reader_t;
+static reader_t *readers = NULL;
+static int nReaders = 1;	/* number of readers actually in use */
+static volatile sbool bReadersStop = 0;
+#define READER_IDLE_WAIT 1000	/* ms a reader sleeps in inotify mode without events */
+
 #if HAVE_INOTIFY_INIT
 /* support for inotify mode */
 
@@ -209,7 +244,9 @@ static prop_t *pInputName = NULL;	/* there is only one global inputName for all
 /* module-global parameters */
 static struct cnfparamdescr modpdescr[] = {
 	{ "pollinginterval", eCmdHdlrPositiveInt, 0 },
-	{ "mode", eCmdHdlrGetWord, 0 }
+	{ "mode", eCmdHdlrGetWord, 0 },
+	{ "readers", eCmdHdlrPositiveInt, 0 },
+	{ "statestore", eCmdHdlrGetWord, 0 }
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -385,11 +422,284 @@ finalize_it:
 }
 
 
-/* try to open a file. This involves checking if there is a status file and,
- * if so, reading it in. Processing continues from the last know location.
+/* Consolidated state store, enabled by module(stateStore="name").
+ * Instead of one state file per monitored file, the stream states are
+ * appended to a single file in the work directory, which is synced once
+ * per polling round or event batch (a "commit"), no matter how many files
+ * were persisted. The store is an append-only log of serialized stream
+ * objects, which identify the monitored file by its name; the last record
+ * for a file is the current one. Once the store holds considerably more
+ * records than files, it is compacted by writing the current states to a
+ * new file, which then replaces the store.
+ * Streams may only be serialized by the thread reading them, so with
+ * multiple readers each reader has its own store ("name.<reader>",
+ * reader 0 uses "name" itself). On startup, all existing stores are
+ * loaded and rewritten for the current readers. Monitored files without
+ * state in the store fall back to their old per-file state file, which is
+ * removed once the state has been written to the store.
+ */
+typedef struct stateStore_s {
+	strm_t *pStrm;	/* append stream, NULL if the store could not be opened */
+	int nRecs;	/* records in the store file */
+	int nFiles;	/* nbr of files owned by this store */
+	sbool bDirty;	/* records written but not yet synced */
+} stateStore_t;
+static stateStore_t *stateStores = NULL;
+static int nStateStores = 0;
+
+static void
+stateStoreName(int idx, uchar *pszBuf, size_t lenBuf, const char *pszSuffix)
+{
+	if(idx == 0)
+		snprintf((char*) pszBuf, lenBuf, "%s/%s%s", (char*) glbl.GetWorkDir(),
+			 (char*) runModConf->pszStateStore, pszSuffix);
+	else
+		snprintf((char*) pszBuf, lenBuf, "%s/%s.%d%s", (char*) glbl.GetWorkDir(),
+			 (char*) runModConf->pszStateStore, idx, pszSuffix);
+}
+
+/* find the monitored file a stream state belongs to. The store is usually
+ * in file table order, so we try the file after the last match first.
  */
+static int
+stateStoreFindFile(uchar *pszFName, int *piHint)
+{
+	int i;
+
+	if(pszFName == NULL)
+		return -1;
+	for(i = 0 ; i < iFilPtr ; ++i) {
+		if(!ustrcmp(files[(*piHint + i) % iFilPtr].pszFileName, pszFName)) {
+			i = (*piHint + i) % iFilPtr;
+			*piHint = i + 1;
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* load all stream states from a store into pStrmRestored of their files */
 static rsRetVal
-openFile(fileInfo_t *pThis)
+stateStoreLoad(int idx)
+{
+	strm_t *psSF = NULL;
+	strm_t *pNew;
+	uchar pszName[MAXFNAME];
+	struct stat stat_buf;
+	int iHint = 0;
+	int i;
+	int nRecs = 0;
+	DEFiRet;
+
+	stateStoreName(idx, pszName, sizeof(pszName), "");
+	if(stat((char*) pszName, &stat_buf) == -1)
+		ABORT_FINALIZE((errno == ENOENT) ? RS_RET_FILE_NOT_FOUND : RS_RET_IO_ERROR);
+
+	CHKiRet(strm.Construct(&psSF));
+	CHKiRet(strm.SettOperationsMode(psSF, STREAMMODE_READ));
+	CHKiRet(strm.SetsType(psSF, STREAMTYPE_FILE_SINGLE));
+	CHKiRet(strm.SetFName(psSF, pszName, ustrlen(pszName)));
+	CHKiRet(strm.ConstructFinalize(psSF));
+
+	/* a torn record at the end (crash while writing) ends the store */
+	while(1) {
+		pNew = NULL;
+		if(obj.Deserialize(&pNew, (uchar*) "strm", psSF, NULL, NULL) != RS_RET_OK)
+			break;
+		++nRecs;
+		if((i = stateStoreFindFile(strmGetFName(pNew), &iHint)) == -1) {
+			strm.Destruct(&pNew); /* file is no longer monitored */
+			continue;
+		}
+		if(files[i].pStrmRestored != NULL)
+			strm.Destruct(&files[i].pStrmRestored);
+		files[i].pStrmRestored = pNew;
+	}
+	DBGPRINTF("imfile: loaded %d records from state store '%s'\n", nRecs, pszName);
+
+finalize_it:
+	if(psSF != NULL)
+		strm.Destruct(&psSF);
+	RETiRet;
+}
+
+/* open the append stream of a store */
+static rsRetVal
+stateStoreOpen(int idx)
+{
+	uchar pszName[MAXFNAME];
+	DEFiRet;
+
+	stateStoreName(idx, pszName, sizeof(pszName), "");
+	CHKiRet(strm.Construct(&stateStores[idx].pStrm));
+	CHKiRet(strm.SettOperationsMode(stateStores[idx].pStrm, STREAMMODE_WRITE_APPEND));
+	CHKiRet(strm.SetsType(stateStores[idx].pStrm, STREAMTYPE_FILE_SINGLE));
+	CHKiRet(strm.SetFName(stateStores[idx].pStrm, pszName, ustrlen(pszName)));
+	CHKiRet(strm.ConstructFinalize(stateStores[idx].pStrm));
+
+finalize_it:
+	if(iRet != RS_RET_OK && stateStores[idx].pStrm != NULL)
+		strm.Destruct(&stateStores[idx].pStrm);
+	RETiRet;
+}
+
+/* write the current state of all files of a store to a new file, which
+ * then replaces the store. Must be called by the owner of the store.
+ */
+static rsRetVal
+stateStoreCompact(int idx)
+{
+	strm_t *psSF = NULL;
+	strm_t *pStrm;
+	uchar pszName[MAXFNAME];
+	uchar pszTmpName[MAXFNAME];
+	int nRecs = 0;
+	int i;
+	DEFiRet;
+
+	stateStoreName(idx, pszName, sizeof(pszName), "");
+	stateStoreName(idx, pszTmpName, sizeof(pszTmpName), ".tmp");
+	CHKiRet(strm.Construct(&psSF));
+	CHKiRet(strm.SettOperationsMode(psSF, STREAMMODE_WRITE_TRUNC));
+	CHKiRet(strm.SetsType(psSF, STREAMTYPE_FILE_SINGLE));
+	CHKiRet(strm.SetFName(psSF, pszTmpName, ustrlen(pszTmpName)));
+	CHKiRet(strm.ConstructFinalize(psSF));
+	for(i = 0 ; i < iFilPtr ; ++i) {
+		if(files[i].iReader != idx)
+			continue;
+		pStrm = (files[i].pStrm != NULL) ? files[i].pStrm : files[i].pStrmRestored;
+		if(pStrm != NULL) {
+			CHKiRet(strm.Serialize(pStrm, psSF));
+			++nRecs;
+		}
+	}
+	CHKiRet(strm.Sync(psSF));
+	CHKiRet(strm.Destruct(&psSF));
+
+	if(stateStores[idx].pStrm != NULL)
+		strm.Destruct(&stateStores[idx].pStrm);
+	if(rename((char*) pszTmpName, (char*) pszName) == -1)
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	stateStores[idx].nRecs = nRecs;
+	stateStores[idx].bDirty = 0;
+	CHKiRet(stateStoreOpen(idx));
+
+finalize_it:
+	if(psSF != NULL)
+		strm.Destruct(&psSF);
+	if(iRet != RS_RET_OK) {
+		errmsg.LogError(0, iRet, "imfile: could not write state store %s - "
+				"data may be repeated on next startup", pszName);
+		unlink((char*) pszTmpName);
+		if(stateStores[idx].pStrm == NULL)
+			stateStoreOpen(idx);
+	}
+	RETiRet;
+}
+
+/* sync the records written to a store since the last commit. Called by the
+ * owner of the store after each polling round or batch of events. The store
+ * is compacted instead if it has grown too large; this must not be done on
+ * shutdown, when the streams of the files are already gone.
+ */
+static void
+stateStoreCommit(int idx, sbool bMayCompact)
+{
+	stateStore_t *pStore;
+
+	if(stateStores == NULL)
+		return;
+	pStore = &stateStores[idx];
+	if(!pStore->bDirty || pStore->pStrm == NULL)
+		return;
+	if(bMayCompact && pStore->nRecs > 2 * pStore->nFiles + 64) {
+		stateStoreCompact(idx);
+		return;
+	}
+	if(strm.Sync(pStore->pStrm) != RS_RET_OK) {
+		errmsg.LogError(0, RS_RET_IO_ERROR, "imfile: could not sync state store %s - "
+				"data may be repeated on next startup", runModConf->pszStateStore);
+	}
+	pStore->bDirty = 0;
+}
+
+static rsRetVal readStateFile(fileInfo_t *pThis, strm_t **ppStrm);
+
+/* set up the state stores for the current readers, must be called before
+ * any file is read, after the files have been assigned to the readers.
+ */
+static rsRetVal
+stateStoreStart(void)
+{
+	uchar pszName[MAXFNAME];
+	sbool bOK = 1;
+	int idx;
+	int i;
+	DEFiRet;
+
+	if(runModConf->pszStateStore == NULL)
+		FINALIZE;
+	nStateStores = nReaders;
+	CHKmalloc(stateStores = calloc(nStateStores, sizeof(stateStore_t)));
+	for(i = 0 ; i < iFilPtr ; ++i)
+		++stateStores[files[i].iReader].nFiles;
+
+	/* stores of readers no longer configured are loaded as well */
+	for(idx = 0 ; stateStoreLoad(idx) != RS_RET_FILE_NOT_FOUND || idx < nStateStores ; ++idx)
+		;
+	/* migration from per-file state files */
+	for(i = 0 ; i < iFilPtr ; ++i) {
+		if(files[i].pStrmRestored == NULL
+		   && readStateFile(&files[i], &files[i].pStrmRestored) == RS_RET_OK)
+			files[i].bLegacyState = 1;
+	}
+
+	for(idx = 0 ; idx < nStateStores ; ++idx) {
+		if(stateStoreCompact(idx) != RS_RET_OK)
+			bOK = 0;
+	}
+	if(!bOK)
+		FINALIZE; /* keep everything, so that we retry on next startup */
+	for(idx = nStateStores ; ; ++idx) {
+		stateStoreName(idx, pszName, sizeof(pszName), "");
+		if(unlink((char*) pszName) == -1)
+			break;
+	}
+	for(i = 0 ; i < iFilPtr ; ++i) {
+		if(files[i].bLegacyState) {
+			snprintf((char*) pszName, sizeof(pszName), "%s/%s", (char*) glbl.GetWorkDir(),
+				 (char*) files[i].pszStateFile);
+			unlink((char*) pszName);
+			files[i].bLegacyState = 0;
+		}
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+/* final commit and cleanup, called after all states have been persisted */
+static void
+stateStoreStop(void)
+{
+	int idx;
+
+	if(stateStores == NULL)
+		return;
+	for(idx = 0 ; idx < nStateStores ; ++idx) {
+		stateStoreCommit(idx, 0);
+		if(stateStores[idx].pStrm != NULL)
+			strm.Destruct(&stateStores[idx].pStrm);
+	}
+	free(stateStores);
+	stateStores = NULL;
+	nStateStores = 0;
+}
+
+
+/* read a per-file state file (the only storage without a state store) */
+static rsRetVal
+readStateFile(fileInfo_t *pThis, strm_t **ppStrm)
 {
 	DEFiRet;
 	strm_t *psSF = NULL;
@@ -421,7 +731,32 @@ openFile(fileInfo_t *pThis)
 	CHKiRet(strm.ConstructFinalize(psSF));
 
 	/* read back in the object */
-	CHKiRet(obj.Deserialize(&pThis->pStrm, (uchar*) "strm", psSF, NULL, pThis));
+	CHKiRet(obj.Deserialize(ppStrm, (uchar*) "strm", psSF, NULL, pThis));
+
+finalize_it:
+	if(psSF != NULL)
+		strm.Destruct(&psSF);
+	RETiRet;
+}
+
+
+/* try to open a file. This involves checking if there is a status file and,
+ * if so, reading it in. Processing continues from the last know location.
+ */
+static rsRetVal
+openFile(fileInfo_t *pThis)
+{
+	DEFiRet;
+
+	if(runModConf->pszStateStore != NULL) {
+		/* the store has been loaded on startup */
+		if(pThis->pStrmRestored == NULL)
+			ABORT_FINALIZE(RS_RET_FILE_NOT_FOUND);
+		pThis->pStrm = pThis->pStrmRestored;
+		pThis->pStrmRestored = NULL;
+	} else {
+		CHKiRet(readStateFile(pThis, &pThis->pStrm));
+	}
 
 	strm.CheckFileChange(pThis->pStrm);
 	CHKiRet(strm.SeekCurrOffs(pThis->pStrm));
@@ -431,9 +766,6 @@ openFile(fileInfo_t *pThis)
 	 */
 
 finalize_it:
-	if(psSF != NULL)
-		strm.Destruct(&psSF);
-
 	if(iRet != RS_RET_OK) {
 		if(pThis->pStrm != NULL)
 			strm.Destruct(&pThis->pStrm);
@@ -461,6 +793,26 @@ static void pollFileCancelCleanup(void *pArg)
 }
 
 
+/* update the lag statistic, that is how far file size is ahead of
+ * the position we have read up to.
+ */
+static void
+updateLag(fileInfo_t *pThis)
+{
+	struct stat sb;
+	int64 offs;
+
+	if(pThis->pStrm == NULL || stat((char*) pThis->pszFileName, &sb) != 0)
+		return;
+	if(strm.GetCurrOffset(pThis->pStrm, &offs) != RS_RET_OK)
+		return;
+	if(sb.st_size <= offs)
+		pThis->lag = 0;
+	else
+		pThis->lag = (sb.st_size - offs > INT_MAX) ? INT_MAX : (int) (sb.st_size - offs);
+}
+
+
 /* poll a file, need to check file rollover etc. open file if not open */
 #pragma GCC diagnostic ignored "-Wempty-body"
 static rsRetVal pollFile(fileInfo_t *pThis, int *pbHadFileData)
@@ -478,9 +830,18 @@ static rsRetVal pollFile(fileInfo_t *pThis, int *pbHadFileData)
 	}
 
 	/* loop below will be exited when strmReadLine() returns EOF */
+	pThis->bPaused = 0;
 	while(glbl.GetGlobalInputTermState() == 0) {
 		if(pThis->maxLinesAtOnce != 0 && nProcessed >= pThis->maxLinesAtOnce)
 			break;
+		if(ruleset.IsBackpressured(pThis->pRuleset)) {
+			/* leave the rest in the file, we read it when the
+			 * queue has drained (next polling or retry interval).
+			 */
+			pThis->bPaused = 1;
+			bFilesPaused = 1;
+			break;
+		}
 		CHKiRet(strm.ReadLine(pThis->pStrm, &pCStr, pThis->readMode, pThis->escapeLF));
 		++nProcessed;
 		if(pbHadFileData != NULL)
@@ -488,6 +849,8 @@ static rsRetVal pollFile(fileInfo_t *pThis, int *pbHadFileData)
 		CHKiRet(enqLine(pThis, pCStr)); /* process line */
 		rsCStrDestruct(&pCStr); /* discard string (must be done by us!) */
 		if(pThis->iPersistStateInterval > 0 && pThis->nRecords++ >= pThis->iPersistStateInterval) {
+			/* the state must not advance past what is already enqueued */
+			multiSubmitFlush(&pThis->multiSub);
 			persistStrmState(pThis);
 			pThis->nRecords = 0;
 		}
@@ -495,6 +858,7 @@ static rsRetVal pollFile(fileInfo_t *pThis, int *pbHadFileData)
 
 finalize_it:
 	multiSubmitFlush(&pThis->multiSub);
+	updateLag(pThis);
 	pthread_cleanup_pop(0);
 
 	if(pCStr != NULL) {
@@ -658,6 +1022,7 @@ addListner(instanceConf_t *inst)
 	int newMax;
 	fileInfo_t *newFileTab;
 	fileInfo_t *pThis;
+	uchar statname[MAXFNAME+16];
 
 	if(iFilPtr == allocMaxFiles) {
 		newMax = 2 * allocMaxFiles;
@@ -695,6 +1060,19 @@ addListner(instanceConf_t *inst)
 	pThis->pRuleset = inst->pBindRuleset;
 	pThis->nRecords = 0;
 	pThis->pStrm = NULL;
+	pThis->pStrmRestored = NULL;
+	pThis->bLegacyState = 0;
+	pThis->bPaused = 0;
+	pThis->bPending = 0;
+	pThis->iReader = 0;
+	pThis->lag = 0;
+	CHKiRet(statsobj.Construct(&pThis->stats));
+	snprintf((char*)statname, sizeof(statname), "imfile(%s)", pThis->pszFileName);
+	statname[sizeof(statname)-1] = '\0'; /* just to be on the save side... */
+	CHKiRet(statsobj.SetName(pThis->stats, statname));
+	CHKiRet(statsobj.AddCounter(pThis->stats, UCHAR_CONSTANT("lag"),
+		ctrType_Int, CTR_FLAG_NONE, &pThis->lag));
+	CHKiRet(statsobj.ConstructFinalize(pThis->stats));
 	++iFilPtr;	/* we got a new file to monitor */
 
 	resetConfigVariables(NULL, NULL); /* values are both dummies */
@@ -765,6 +1143,8 @@ CODESTARTbeginCnfLoad
 	/* init our settings */
 	loadModConf->opMode = OPMODE_POLLING;
 	loadModConf->iPollInterval = DFLT_PollInterval;
+	loadModConf->nReaders = 1;
+	loadModConf->pszStateStore = NULL;
 	loadModConf->configSetViaV2Method = 0;
 	bLegacyCnfModGlobalsPermitted = 1;
 	/* init legacy config vars */
@@ -814,6 +1194,10 @@ CODESTARTsetModCnf
 					"mode '%s'", cstr);
 				free(cstr);
 			}
+		} else if(!strcmp(modpblk.descr[i].name, "readers")) {
+			loadModConf->nReaders = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "statestore")) {
+			loadModConf->pszStateStore = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else {
 			dbgprintf("imfile: program error, non-handled "
 			  "param '%s' in beginCnfLoad\n", modpblk.descr[i].name);
@@ -905,6 +1289,7 @@ CODESTARTfreeCnf
 		inst = inst->next;
 		free(del);
 	}
+	free(pModConf->pszStateStore);
 	free(files);
 ENDfreeCnf
 
@@ -926,12 +1311,195 @@ ENDfreeCnf
  * On spamming the main queue: keep in mind that it will automatically rate-limit
  * ourselfes if we begin to overrun it. So we really do not need to care here.
  */
+/* wait until the reader has pending work, timeout (ms) expired or the
+ * readers shall stop.
+ */
+static void
+readerWait(reader_t *pRdr, long iTimeout)
+{
+	struct timespec t;
+
+	pthread_mutex_lock(&pRdr->mut);
+	if(!pRdr->bPending && !bReadersStop) {
+		timeoutComp(&t, iTimeout);
+		pthread_cond_timedwait(&pRdr->cond, &pRdr->mut, &t);
+	}
+	pRdr->bPending = 0;
+	pthread_mutex_unlock(&pRdr->mut);
+}
+
+
+/* reader loop for polling mode, the same algorithm as doPolling(), but only
+ * for the files owned by this reader.
+ */
+static void
+readerPoll(reader_t *pRdr)
+{
+	int i;
+	int bHadFileData;
+
+	while(!bReadersStop && glbl.GetGlobalInputTermState() == 0) {
+		do {
+			bHadFileData = 0;
+			for(i = pRdr->idx ; i < iFilPtr ; i += nReaders) {
+				if(bReadersStop || glbl.GetGlobalInputTermState() == 1)
+					break;
+				pollFile(&files[i], &bHadFileData);
+			}
+		} while(iFilPtr > nReaders && bHadFileData == 1 && !bReadersStop
+			&& glbl.GetGlobalInputTermState() == 0);
+		stateStoreCommit(pRdr->idx, 1);
+		if(!bReadersStop && glbl.GetGlobalInputTermState() == 0)
+			readerWait(pRdr, runModConf->iPollInterval * 1000L);
+	}
+}
+
+
+/* reader loop for inotify mode: process the files for which the input
+ * thread dispatched events. Paused files are retried periodically.
+ */
+static void
+readerInotify(reader_t *pRdr)
+{
+	int i;
+	sbool bNew;
+	sbool bHasPaused = 0;
+
+	while(!bReadersStop && glbl.GetGlobalInputTermState() == 0) {
+		readerWait(pRdr, bHasPaused ? PAUSED_RETRY_INTERVAL : READER_IDLE_WAIT);
+		bHasPaused = 0;
+		for(i = pRdr->idx ; i < iFilPtr ; i += nReaders) {
+			if(bReadersStop || glbl.GetGlobalInputTermState() == 1)
+				break;
+			pthread_mutex_lock(&pRdr->mut);
+			bNew = files[i].bPending;
+			files[i].bPending = 0;
+			pthread_mutex_unlock(&pRdr->mut);
+			if(bNew || files[i].bPaused)
+				pollFile(&files[i], NULL);
+			if(files[i].bPaused)
+				bHasPaused = 1;
+		}
+		stateStoreCommit(pRdr->idx, 1);
+	}
+}
+
+
+static void *
+readerWrkr(void *arg)
+{
+	reader_t *const pRdr = (reader_t*) arg;
+	sigset_t sigSet;
+
+	sigfillset(&sigSet);
+	pthread_sigmask(SIG_BLOCK, &sigSet, NULL);
+	if(runModConf->opMode == OPMODE_POLLING)
+		readerPoll(pRdr);
+	else
+		readerInotify(pRdr);
+	return NULL;
+}
+
+
+/* start the reader pool. Does nothing if only a single reader is used, in
+ * which case all files are processed on the input thread as before.
+ */
+static rsRetVal
+readersStart(void)
+{
+	int i;
+	int r;
+	DEFiRet;
+
+	nReaders = (runModConf->nReaders < iFilPtr) ? runModConf->nReaders : iFilPtr;
+	if(nReaders <= 1)
+		nReaders = 1;
+	for(i = 0 ; i < iFilPtr ; ++i)
+		files[i].iReader = i % nReaders;
+	/* the stores must be loaded before any file is read */
+	CHKiRet(stateStoreStart());
+	if(nReaders == 1)
+		FINALIZE;
+	bReadersStop = 0;
+	CHKmalloc(readers = calloc(nReaders, sizeof(reader_t)));
+	for(i = 0 ; i < nReaders ; ++i) {
+		readers[i].idx = i;
+		pthread_mutex_init(&readers[i].mut, NULL);
+		pthread_cond_init(&readers[i].cond, NULL);
+		readers[i].bPending = 1; /* initial read */
+		r = pthread_create(&readers[i].tid, NULL, readerWrkr, &readers[i]);
+		if(r != 0) {
+			errmsg.LogError(r, RS_RET_ERR, "imfile: could not start reader %d, "
+					"its files will not be monitored", i);
+		} else {
+			readers[i].bStarted = 1;
+		}
+	}
+	DBGPRINTF("imfile: started %d readers\n", nReaders);
+
+finalize_it:
+	RETiRet;
+}
+
+
+static void
+readersStop(void)
+{
+	int i;
+
+	if(readers == NULL)
+		return;
+	bReadersStop = 1;
+	for(i = 0 ; i < nReaders ; ++i) {
+		pthread_mutex_lock(&readers[i].mut);
+		pthread_cond_signal(&readers[i].cond);
+		pthread_mutex_unlock(&readers[i].mut);
+	}
+	for(i = 0 ; i < nReaders ; ++i) {
+		if(readers[i].bStarted)
+			pthread_join(readers[i].tid, NULL);
+		pthread_mutex_destroy(&readers[i].mut);
+		pthread_cond_destroy(&readers[i].cond);
+	}
+	free(readers);
+	readers = NULL;
+	nReaders = 1;
+}
+
+
+/* new data is available for a file. Read it on the current thread or hand it
+ * to the reader owning the file.
+ */
+static void
+scheduleFile(int fIdx)
+{
+	reader_t *pRdr;
+
+	if(readers == NULL) {
+		pollFile(&files[fIdx], NULL);
+		return;
+	}
+	pRdr = &readers[files[fIdx].iReader];
+	pthread_mutex_lock(&pRdr->mut);
+	files[fIdx].bPending = 1;
+	pRdr->bPending = 1;
+	pthread_cond_signal(&pRdr->cond);
+	pthread_mutex_unlock(&pRdr->mut);
+}
+
+
 static rsRetVal
 doPolling(void)
 {
 	int i;
 	int bHadFileData; /* were there at least one file with data during this run? */
 	DEFiRet;
+	if(readers != NULL) {
+		/* the readers do all the work, we just wait for termination */
+		while(glbl.GetGlobalInputTermState() == 0)
+			srSleep(runModConf->iPollInterval, 10);
+		FINALIZE;
+	}
 	while(glbl.GetGlobalInputTermState() == 0) {
 		do {
 			bHadFileData = 0;
@@ -942,6 +1510,7 @@ doPolling(void)
 			}
 		} while(iFilPtr > 1 && bHadFileData == 1 && glbl.GetGlobalInputTermState() == 0);
 		  /* warning: do...while()! */
+		stateStoreCommit(0, 1);
 
 		/* Note: the additional 10ns wait is vitally important. It guards rsyslog
 		 * against totally hogging the CPU if the users selects a polling interval
@@ -952,6 +1521,7 @@ doPolling(void)
 			srSleep(runModConf->iPollInterval, 10);
 	}
 	
+finalize_it:
 	RETiRet;
 }
 
@@ -1178,7 +1748,7 @@ in_setupFileWatch(int i)
 	wdmapAdd(wd, -1, i);
 	dbgprintf("DDDD: watch %d added for file %s\n", wd, files[i].pszFileName);
 	dirsAddFile(i);
-	pollFile(&files[i], NULL);
+	scheduleFile(i);
 done:	return;
 }
 
@@ -1271,7 +1841,7 @@ static void
 in_handleFileEvent(struct inotify_event *ev, int fIdx)
 {
 	if(ev->mask & IN_MODIFY) {
-		pollFile(&files[fIdx], NULL);
+		scheduleFile(fIdx);
 	} else if(ev->mask & IN_IGNORED) {
 		in_removeFile(ev, fIdx);
 	} else {
@@ -1299,12 +1869,30 @@ in_processEvent(struct inotify_event *ev)
 done:	return;
 }
 
+/* retry files where reading was stopped due to backpressure. As inotify
+ * only notifies us of new writes, we need to do this ourselves.
+ */
+static void
+in_retryPausedFiles(void)
+{
+	int i;
+
+	bFilesPaused = 0;
+	for(i = 0 ; i < iFilPtr && glbl.GetGlobalInputTermState() == 0 ; ++i) {
+		if(files[i].bPaused)
+			pollFile(&files[i], NULL);
+	}
+}
+
+
 /* Monitor files in inotify mode */
 static rsRetVal
 do_inotify()
 {
 	char iobuf[8192];
 	struct inotify_event *ev;
+	struct pollfd pfd;
+	int r;
 	int rd;
 	int currev;
 	DEFiRet;
@@ -1316,6 +1904,17 @@ do_inotify()
 	CHKiRet(in_setupInitialWatches());
 
 	while(glbl.GetGlobalInputTermState() == 0) {
+		if(bFilesPaused && readers == NULL) { /* readers retry paused files themselves */
+			pfd.fd = ino_fd;
+			pfd.events = POLLIN;
+			r = poll(&pfd, 1, PAUSED_RETRY_INTERVAL);
+			if(r == 0) {
+				in_retryPausedFiles();
+				stateStoreCommit(0, 1);
+			}
+			if(r <= 0)
+				continue; /* also re-checks the termination state on EINTR */
+		}
 		rd = read(ino_fd, iobuf, sizeof(iobuf));
 		if(rd < 0) {
 			perror("inotify read"); exit(1);
@@ -1330,6 +1929,8 @@ do_inotify()
 			in_processEvent(ev);
 			currev += sizeof(struct inotify_event) + ev->len;
 		}
+		if(readers == NULL) /* otherwise, the readers commit their stores */
+			stateStoreCommit(0, 1);
 	}
 
 finalize_it:
@@ -1348,12 +1949,15 @@ BEGINrunInput
 CODESTARTrunInput
 	DBGPRINTF("imfile: working in %s mode\n", 
 		 (runModConf->opMode == OPMODE_POLLING) ? "polling" : "inotify");
+	CHKiRet(readersStart());
 	if(runModConf->opMode == OPMODE_POLLING)
 		iRet = doPolling();
 	else
 		iRet = do_inotify();
+	readersStop();
 
 	DBGPRINTF("imfile: terminating upon request of rsyslog core\n");
+finalize_it:
 	RETiRet;	/* use it to make sure the housekeeping is done! */
 ENDrunInput
 
@@ -1391,6 +1995,16 @@ persistStrmState(fileInfo_t *pInfo)
 
 	ASSERT(pInfo != NULL);
 
+	if(runModConf->pszStateStore != NULL) {
+		/* synced with the next commit of the store */
+		if(stateStores == NULL || stateStores[pInfo->iReader].pStrm == NULL)
+			ABORT_FINALIZE(RS_RET_FILE_NOT_FOUND);
+		CHKiRet(strm.Serialize(pInfo->pStrm, stateStores[pInfo->iReader].pStrm));
+		++stateStores[pInfo->iReader].nRecs;
+		stateStores[pInfo->iReader].bDirty = 1;
+		FINALIZE;
+	}
+
 	/* TODO: create a function persistObj in obj.c? */
 	CHKiRet(strm.Construct(&psSF));
 	lenDir = ustrlen(glbl.GetWorkDir());
@@ -1437,12 +2051,16 @@ CODESTARTafterRun
 			persistStrmState(&files[i]);
 			strm.Destruct(&(files[i].pStrm));
 		}
+		if(files[i].pStrmRestored != NULL)
+			strm.Destruct(&(files[i].pStrmRestored));
 		ratelimitDestruct(files[i].ratelimiter);
+		statsobj.Destruct(&files[i].stats);
 		free(files[i].multiSub.ppMsgs);
 		free(files[i].pszFileName);
 		free(files[i].pszTag);
 		free(files[i].pszStateFile);
 	}
+	stateStoreStop();
 
 	if(pInputName != NULL)
 		prop.Destruct(&pInputName);
@@ -1469,6 +2087,7 @@ CODESTARTmodExit
 	objRelease(errmsg, CORE_COMPONENT);
 	objRelease(prop, CORE_COMPONENT);
 	objRelease(ruleset, CORE_COMPONENT);
+	objRelease(statsobj, CORE_COMPONENT);
 ENDmodExit
 
 
@@ -1537,6 +2156,7 @@ CODEmodInit_QueryRegCFSLineHdlr
 	CHKiRet(objUse(strm, CORE_COMPONENT));
 	CHKiRet(objUse(ruleset, CORE_COMPONENT));
 	CHKiRet(objUse(prop, CORE_COMPONENT));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 
 	DBGPRINTF("imfile: version %s initializing\n", VERSION);
 	CHKiRet(omsdRegCFSLineHdlr((uchar *)"inputfilename", 0, eCmdHdlrGetWord,
@@ -49,6 +49,7 @@
 #include "srUtils.h"
 #include "unicode-helper.h"
 #include "ratelimit.h"
+#include "ruleset.h"
 
 MODULE_TYPE_INPUT
 MODULE_TYPE_NOKEEP
@@ -61,10 +62,12 @@ DEFobjCurrIf(glbl)
 DEFobjCurrIf(prop)
 DEFobjCurrIf(net)
 DEFobjCurrIf(errmsg)
+DEFobjCurrIf(ruleset)
 
 static struct configSettings_s {
 	char *stateFile;
 	int iPersistStateInterval;
+	int iPersistStateTime;	/* max seconds between state persists (0 -> count only) */
 	int ratelimitInterval;
 	int ratelimitBurst;
 	int bIgnorePrevious;
@@ -76,6 +79,7 @@ static struct cnfparamdescr modpdescr[] = {
 	{ "ratelimit.interval", eCmdHdlrInt, 0 },
 	{ "ratelimit.burst", eCmdHdlrInt, 0 },
 	{ "persiststateinterval", eCmdHdlrInt, 0 },
+	{ "persiststatetime", eCmdHdlrNonNegInt, 0 },
 	{ "ignorepreviousmessages", eCmdHdlrBinary, 0 }
 };
 static struct cnfparamblk modpblk =
@@ -94,12 +98,15 @@ static prop_t *pLocalHostIP = NULL;	/* a pseudo-constant propterty for 127.0.0.1
 static ratelimit_t *ratelimiter = NULL;
 static sd_journal *j;
 
+#define NUM_MULTISUB 1024 /* max number of messages submitted as one batch */
+
 /* enqueue the the journal message into the message queue.
  * The provided msg string is not freed - thus must be done
  * by the caller.
  */
 static rsRetVal
-enqMsg(uchar *msg, uchar *pszTag, int iFacility, int iSeverity, struct timeval *tp, struct json_object *json)
+enqMsg(uchar *msg, uchar *pszTag, int iFacility, int iSeverity, struct timeval *tp, struct json_object *json,
+	multi_submit_t *pMultiSub)
 {
 	struct syslogTime st;
 	msg_t *pMsg;
@@ -129,38 +136,47 @@ enqMsg(uchar *msg, uchar *pszTag, int iFacility, int iSeverity, struct timeval *
 		msgAddJSON(pMsg, (uchar*)"!", json);
 	}
 
-	CHKiRet(ratelimitAddMsg(ratelimiter, NULL, pMsg));
+	CHKiRet(ratelimitAddMsg(ratelimiter, pMultiSub, pMsg));
 
 finalize_it:
 	RETiRet;
 }
 
 
+/* copy the value of a journal field (after '=') into a new string */
+static inline char *
+fieldValDup(const void *get, size_t l, size_t lenName)
+{
+	return strndup((char*)get + lenName + 1, l - lenName - 1);
+}
+
+
 /* Read journal log while data are available, each read() reads one
  * record of printk buffer.
+ * All fields are enumerated only once: the ones we need for the syslog
+ * message itself are picked up while building the json object, instead
+ * of searching the entry again for each of them.
  */
 static rsRetVal
-readjournal() {
+readjournal(multi_submit_t *pMultiSub) {
 	DEFiRet;
 
 	struct timeval tv;
+	struct timeval *ptv = NULL;
 	uint64_t timestamp;
 
 	struct json_object *json = NULL;
 	int r;
 
 	/* Information from messages */
-	char *message;
-	char *sys_pid;
-	char *sys_iden;
-	char *sys_iden_help;
+	char *message = NULL;
+	char *sys_pid = NULL;
+	char *sys_iden = NULL;
+	char *sys_iden_help = NULL;
 
 	const void *get;
-	const void *pidget;
-	char *parse;
-	char *get2;
+	const char *parse;
 	size_t length;
-	size_t pidlength;
 
 	const void *equal_sign;
 	struct json_object *jval;
@@ -168,86 +184,29 @@ readjournal() {
 	char *name;
 	size_t l;
 
-	long prefixlen = 0;
+	size_t prefixlen = 0;
 
 	int priority = 0;
 	int facility = 0;
 
-	/* Get message text */
-	if (sd_journal_get_data(j, "MESSAGE", &get, &length) < 0) {
-		logmsgInternal(NO_ERRCODE, LOG_SYSLOG|LOG_INFO, (uchar *)"log message from journal doesn't have MESSAGE", 0);
-		iRet = RS_RET_OK;
-		goto ret;
-	}
-	message = strndup(get+8, length-8);
-	if (message == NULL) {
-		iRet = RS_RET_OUT_OF_MEMORY;
-		goto ret;
-	}
-
-	/* Get message priority */
-	if (sd_journal_get_data(j, "PRIORITY", &get, &length) >= 0) {
-		get2 = strndup(get, length);
-		priority = ((char *)get2)[9] - '0';
-		free (get2);
-	}
-
-	/* Get syslog facility */
+	/* Get syslog facility first, so that we can skip entries we drop
+	 * without looking at the rest.
+	 */
 	if (sd_journal_get_data(j, "SYSLOG_FACILITY", &get, &length) >= 0) {
-		get2 = strndup(get, length);
-		char f = ((char *)get2)[16];
-		if (f >= '0' && f <= '9') {
-			facility += f - '0';
+		parse = (const char *)get;
+		if (length > 16 && parse[16] >= '0' && parse[16] <= '9') {
+			facility += parse[16] - '0';
 		}
-		f = ((char *)get2)[17];
-		if (f >= '0' && f <= '9') {
+		if (length > 17 && parse[17] >= '0' && parse[17] <= '9') {
 			facility *= 10;
-			facility += (f - '0');
+			facility += (parse[17] - '0');
 		}
-		free (get2);
 	} else {
 		/* message is missing facility -> internal systemd journal msg, drop */
-		iRet = RS_RET_OK;
-		goto free_message;
-	}
-
-	/* Get message identifier, client pid and add ':' */
-	if (sd_journal_get_data(j, "SYSLOG_IDENTIFIER", &get, &length) >= 0) {
-		sys_iden = strndup(get+18, length-18);
-	} else {
-		sys_iden = strdup("journal");
-	}
-	if (sys_iden == NULL) {
-		iRet = RS_RET_OUT_OF_MEMORY;
-		goto free_message;
+		FINALIZE;
 	}
 
-	if (sd_journal_get_data(j, "SYSLOG_PID", &pidget, &pidlength) >= 0) {
-		sys_pid = strndup(pidget+11, pidlength-11);
-		if (sys_pid == NULL) {
-			iRet = RS_RET_OUT_OF_MEMORY;
-			free (sys_iden);
-			goto free_message;
-		}
-	} else {
-		sys_pid = NULL;
-	}
-
-	if (sys_pid) {
-		r = asprintf(&sys_iden_help, "%s[%s]:", sys_iden, sys_pid);
-	} else {
-		r = asprintf(&sys_iden_help, "%s:", sys_iden);
-	}
-
-	free (sys_iden);
-	free (sys_pid);
-
-	if (-1 == r) {
-		iRet = RS_RET_OUT_OF_MEMORY;
-		goto finalize_it;
-	}
-
-	json = json_object_new_object();
+	CHKmalloc(json = json_object_new_object());
 
 	SD_JOURNAL_FOREACH_DATA(j, get, l) {
 		/* locate equal sign, this is always present */
@@ -256,13 +215,30 @@ readjournal() {
 		/* ... but we know better than to trust the specs */
 		if (equal_sign == NULL) {
 			errmsg.LogError(0, RS_RET_ERR, "SD_JOURNAL_FOREACH_DATA()"
-				"returned a malformed field (has no '='): '%s'", get);
+				"returned a malformed field (has no '='): '%s'", (char*)get);
 			continue; /* skip the entry */
 		}
 
 		/* get length of journal data prefix */
 		prefixlen = ((char *)equal_sign - (char *)get);
 
+		/* pick up the properties of the syslog message. The data is only
+		 * valid until the next field is enumerated, so it must be copied.
+		 */
+		if (prefixlen == 7 && !strncmp(get, "MESSAGE", 7)) {
+			free(message);
+			CHKmalloc(message = fieldValDup(get, l, prefixlen));
+		} else if (prefixlen == 8 && !strncmp(get, "PRIORITY", 8)) {
+			if (l > 9)
+				priority = ((char *)get)[9] - '0';
+		} else if (prefixlen == 17 && !strncmp(get, "SYSLOG_IDENTIFIER", 17)) {
+			free(sys_iden);
+			CHKmalloc(sys_iden = fieldValDup(get, l, prefixlen));
+		} else if (prefixlen == 10 && !strncmp(get, "SYSLOG_PID", 10)) {
+			free(sys_pid);
+			CHKmalloc(sys_pid = fieldValDup(get, l, prefixlen));
+		}
+
 		/* translate name fields to lumberjack names */
 		parse = (char *)get;
 
@@ -321,18 +297,12 @@ readjournal() {
 			break;
 		}
 
-		if (name == NULL) {
-			iRet = RS_RET_OUT_OF_MEMORY;
-			goto ret;
-		}
-
-		prefixlen++; /* remove '=' */
+		CHKmalloc(name);
 
-		data = strndup(get + prefixlen, l - prefixlen);
+		data = fieldValDup(get, l, prefixlen);
 		if (data == NULL) {
-			iRet = RS_RET_OUT_OF_MEMORY;
 			free (name);
-			goto ret;
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 		}
 
 		/* and save them to json object */
@@ -342,55 +312,95 @@ readjournal() {
 		free (name);
 	}
 
+	if (message == NULL) {
+		logmsgInternal(NO_ERRCODE, LOG_SYSLOG|LOG_INFO, (uchar *)"log message from journal doesn't have MESSAGE", 0);
+		FINALIZE;
+	}
+
+	/* Get message identifier, client pid and add ':' */
+	if (sys_pid) {
+		r = asprintf(&sys_iden_help, "%s[%s]:", (sys_iden == NULL) ? "journal" : sys_iden, sys_pid);
+	} else {
+		r = asprintf(&sys_iden_help, "%s:", (sys_iden == NULL) ? "journal" : sys_iden);
+	}
+	if (-1 == r) {
+		sys_iden_help = NULL;
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	}
+
 	/* calculate timestamp */
 	if (sd_journal_get_realtime_usec(j, &timestamp) >= 0) {
 		tv.tv_sec = timestamp / 1000000;
 		tv.tv_usec = timestamp % 1000000;
+		ptv = &tv;
 	}
 
 	/* submit message */
-	enqMsg((uchar *)message, (uchar *) sys_iden_help, facility, priority, &tv, json);
+	enqMsg((uchar *)message, (uchar *) sys_iden_help, facility, priority, ptv, json, pMultiSub);
+	json = NULL; /* now owned by the message */
 
 finalize_it:
+	if (json != NULL)
+		json_object_put(json);
 	free(sys_iden_help);
-free_message:
+	free(sys_iden);
+	free(sys_pid);
 	free(message);
-ret:
 	RETiRet;
 }
 
 
-/* This function gets journal cursor and saves it into state file
+/* This function gets journal cursor and saves it into state file.
+ * The cursor is written to a temporary file first, which is then renamed
+ * to the state file. So a crash during the write never leaves a truncated
+ * cursor behind.
  */
 static rsRetVal
 persistJournalState () {
 	DEFiRet;
 	FILE *sf; /* state file */
 	char *cursor;
+	char *tmpFile = NULL;
 	int ret = 0;
 
 	/* On success, sd_journal_get_cursor()  returns 1 in systemd
 	   197 or older and 0 in systemd 198 or newer */
 	if ((ret = sd_journal_get_cursor(j, &cursor)) >= 0) {
-		if ((sf = fopen(cs.stateFile, "wb")) != NULL) {
+		if (asprintf(&tmpFile, "%s.tmp", cs.stateFile) == -1) {
+			free(cursor);
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
+		if ((sf = fopen(tmpFile, "wb")) != NULL) {
 			if (fprintf(sf, "%s", cursor) < 0) {
 				iRet = RS_RET_IO_ERROR;
 			}
-			fclose(sf);
-			free(cursor);
+			if (fclose(sf) != 0) {
+				iRet = RS_RET_IO_ERROR;
+			}
+			if (iRet == RS_RET_OK && rename(tmpFile, cs.stateFile) != 0) {
+				iRet = RS_RET_IO_ERROR;
+			}
+			if (iRet != RS_RET_OK) {
+				errmsg.LogError(errno, iRet, "imjournal: could not write "
+					"state file '%s'", cs.stateFile);
+				unlink(tmpFile);
+			}
 		} else {
 			char errStr[256];
 			rs_strerror_r(errno, errStr, sizeof(errStr));
 			errmsg.LogError(0, RS_RET_FOPEN_FAILURE, "fopen() failed: "
-				"'%s', path: '%s'\n", errStr, cs.stateFile);
+				"'%s', path: '%s'\n", errStr, tmpFile);
 			iRet = RS_RET_FOPEN_FAILURE;
 		}
+		free(cursor);
+		free(tmpFile);
 	} else {
 		char errStr[256];
 		rs_strerror_r(-(ret), errStr, sizeof(errStr));
 		errmsg.LogError(0, RS_RET_ERR, "sd_journal_get_cursor() failed: '%s'\n", errStr);
 		iRet = RS_RET_ERR;
 	}
+finalize_it:
 	RETiRet;
 }
 
@@ -512,8 +522,34 @@ finalize_it:
 	RETiRet;
 }
 
+/* submit the current batch and, if something was read since the last
+ * time, persist the journal position. The batch is always submitted
+ * first, so that the state never points past messages not yet enqueued.
+ */
+static void
+persistIfNeeded(multi_submit_t *pMultiSub, int *pnUnpersisted, time_t *ptLastPersist)
+{
+	multiSubmitFlush(pMultiSub);
+	if (cs.stateFile == NULL || *pnUnpersisted == 0)
+		return;
+	persistJournalState();
+	*pnUnpersisted = 0;
+	*ptLastPersist = time(NULL);
+}
+
+
 BEGINrunInput
+	msg_t *pMsgs[NUM_MULTISUB];
+	multi_submit_t multiSub;
+	int nUnpersisted = 0;	/* entries read since the state was last persisted */
+	time_t tLastPersist;
+	int r;
 CODESTARTrunInput
+	multiSub.ppMsgs = pMsgs;
+	multiSub.maxElem = NUM_MULTISUB;
+	multiSub.nElem = 0;
+	tLastPersist = time(NULL);
+
 	CHKiRet(ratelimitNew(&ratelimiter, "imjournal", NULL));
 	dbgprintf("imjournal: ratelimiting burst %d, interval %d\n", cs.ratelimitBurst,
 		  cs.ratelimitInterval);
@@ -528,7 +564,14 @@ CODESTARTrunInput
 	 * signalled to do so. This, however, is handled by the framework.
 	 */
 	while (glbl.GetGlobalInputTermState() == 0) {
-		int count = 0, r;
+		if (ruleset.IsBackpressured(NULL)) {
+			/* the journal keeps the data, so we just do not read
+			 * until the main queue has drained.
+			 */
+			persistIfNeeded(&multiSub, &nUnpersisted, &tLastPersist);
+			srSleep(0, 100000);
+			continue;
+		}
 
 		r = sd_journal_next(j);
 		if (r < 0) {
@@ -542,22 +585,23 @@ CODESTARTrunInput
 
 		if (r == 0) {
 			/* No new messages, wait for activity. */
+			persistIfNeeded(&multiSub, &nUnpersisted, &tLastPersist);
 			CHKiRet(pollJournal());
 			continue;
 		}
 
-		CHKiRet(readjournal());
+		CHKiRet(readjournal(&multiSub));
 		if (cs.stateFile) { /* can't persist without a state file */
-			/* TODO: This could use some finer metric. */
-			count++;
-			if (count == cs.iPersistStateInterval) {
-				count = 0;
-				persistJournalState();
+			nUnpersisted++;
+			if (   (cs.iPersistStateInterval > 0 && nUnpersisted >= cs.iPersistStateInterval)
+			    || (cs.iPersistStateTime > 0 && time(NULL) - tLastPersist >= cs.iPersistStateTime)) {
+				persistIfNeeded(&multiSub, &nUnpersisted, &tLastPersist);
 			}
 		}
 	}
 
 finalize_it:
+	multiSubmitFlush(&multiSub);
 ENDrunInput
 
 
@@ -566,6 +610,7 @@ CODESTARTbeginCnfLoad
 	bLegacyCnfModGlobalsPermitted = 1;
 
 	cs.iPersistStateInterval = DFLT_persiststateinterval;
+	cs.iPersistStateTime = 0;
 	cs.stateFile = NULL;
 	cs.ratelimitBurst = 20000;
 	cs.ratelimitInterval = 600;
@@ -625,6 +670,7 @@ CODESTARTmodExit
 	objRelease(datetime, CORE_COMPONENT);
 	objRelease(prop, CORE_COMPONENT);
 	objRelease(errmsg, CORE_COMPONENT);
+	objRelease(ruleset, CORE_COMPONENT);
 ENDmodExit
 
 
@@ -649,6 +695,8 @@ CODESTARTsetModCnf
 			continue;
 		if (!strcmp(modpblk.descr[i].name, "persiststateinterval")) {
 			cs.iPersistStateInterval = (int) pvals[i].val.d.n;
+		} else if (!strcmp(modpblk.descr[i].name, "persiststatetime")) {
+			cs.iPersistStateTime = (int) pvals[i].val.d.n;
 		} else if (!strcmp(modpblk.descr[i].name, "statefile")) {
 			cs.stateFile = (char *)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(modpblk.descr[i].name, "ratelimit.burst")) {
@@ -695,6 +743,7 @@ CODEmodInit_QueryRegCFSLineHdlr
 	CHKiRet(objUse(prop, CORE_COMPONENT));
 	CHKiRet(objUse(net, CORE_COMPONENT));
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
+	CHKiRet(objUse(ruleset, CORE_COMPONENT));
 
 	/* we need to create the inputName property (only once during our lifetime) */
 	CHKiRet(prop.CreateStringProp(&pInputName, UCHAR_CONSTANT("imjournal"), sizeof("imjournal") - 1));
@@ -74,6 +74,18 @@ static int bLegacyCnfModGlobalsPermitted;/* are legacy module-global config para
 static prop_t *pInputName = NULL;	/* there is only one global inputName for all messages generated by this module */
 static prop_t *pLocalHostIP = NULL;	/* a pseudo-constant propterty for 127.0.0.1 */
 
+/* module-global parameters */
+static struct cnfparamdescr modpdescr[] = {
+	{ "dedup", eCmdHdlrBinary, 0 },
+	{ "ratelimit.interval", eCmdHdlrInt, 0 },
+	{ "ratelimit.burst", eCmdHdlrInt, 0 }
+};
+static struct cnfparamblk modpblk =
+	{ CNFPARAMBLK_VERSION,
+	  sizeof(modpdescr)/sizeof(struct cnfparamdescr),
+	  modpdescr
+	};
+
 static inline void
 initConfigSettings(void)
 {
@@ -83,11 +95,13 @@ initConfigSettings(void)
 
 /* enqueue the the kernel message into the message queue.
  * The provided msg string is not freed - thus must be done
- * by the caller.
+ * by the caller. If pMultiSub is given, the message is added
+ * to that batch instead.
  * rgerhards, 2008-04-12
  */
 static rsRetVal
-enqMsg(uchar *msg, uchar* pszTag, int iFacility, int iSeverity, struct timeval *tp, struct json_object *json)
+enqMsg(uchar *msg, int lenMsg, uchar* pszTag, int iFacility, int iSeverity, struct timeval *tp,
+	struct json_object *json, multi_submit_t *pMultiSub)
 {
 	struct syslogTime st;
 	msg_t *pMsg;
@@ -104,7 +118,7 @@ enqMsg(uchar *msg, uchar* pszTag, int iFacility, int iSeverity, struct timeval *
 	}
 	MsgSetFlowControlType(pMsg, eFLOWCTL_LIGHT_DELAY);
 	MsgSetInputName(pMsg, pInputName);
-	MsgSetRawMsgWOSize(pMsg, (char*)msg);
+	MsgSetRawMsg(pMsg, (char*)msg, lenMsg);
 	MsgSetMSGoffs(pMsg, 0);	/* we do not have a header... */
 	MsgSetRcvFrom(pMsg, glbl.GetLocalHostNameProp());
 	MsgSetRcvFromIP(pMsg, pLocalHostIP);
@@ -113,7 +127,13 @@ enqMsg(uchar *msg, uchar* pszTag, int iFacility, int iSeverity, struct timeval *
 	pMsg->iFacility = iFacility;
 	pMsg->iSeverity = iSeverity;
 	pMsg->json = json;
-	CHKiRet(submitMsg(pMsg));
+	if(pMultiSub == NULL) {
+		CHKiRet(submitMsg(pMsg));
+	} else {
+		pMultiSub->ppMsgs[pMultiSub->nElem++] = pMsg;
+		if(pMultiSub->nElem == pMultiSub->maxElem)
+			CHKiRet(multiSubmitMsg2(pMultiSub));
+	}
 
 finalize_it:
 	RETiRet;
@@ -141,10 +161,12 @@ rsRetVal imkmsgLogIntMsg(int priority, char *fmt, ...)
 
 /* log a message from /dev/kmsg
  */
-rsRetVal Syslog(int priority, uchar *pMsg, struct timeval *tp, struct json_object *json)
+rsRetVal Syslog(int priority, uchar *pMsg, int lenMsg, struct timeval *tp, struct json_object *json,
+	multi_submit_t *pMultiSub)
 {
 	DEFiRet;
-	iRet = enqMsg((uchar*)pMsg, (uchar*) "kernel:", LOG_FAC(priority), LOG_PRI(priority), tp, json);
+	iRet = enqMsg((uchar*)pMsg, lenMsg, (uchar*) "kernel:", LOG_FAC(priority), LOG_PRI(priority),
+		      tp, json, pMultiSub);
 	RETiRet;
 }
 
@@ -183,6 +205,9 @@ CODESTARTbeginCnfLoad
 	pModConf->pConf = pConf;
 	/* init our settings */
 	pModConf->iFacilIntMsg = klogFacilIntMsg();
+	loadModConf->bDedup = 0;
+	loadModConf->ratelimitInterval = 0;
+	loadModConf->ratelimitBurst = 200;
 	loadModConf->configSetViaV2Method = 0;
 	bLegacyCnfModGlobalsPermitted = 1;
 	/* init legacy config vars */
@@ -190,6 +215,47 @@ CODESTARTbeginCnfLoad
 ENDbeginCnfLoad
 
 
+BEGINsetModCnf
+	struct cnfparamvals *pvals = NULL;
+	int i;
+CODESTARTsetModCnf
+	pvals = nvlstGetParams(lst, &modpblk, NULL);
+	if(pvals == NULL) {
+		errmsg.LogError(0, RS_RET_MISSING_CNFPARAMS, "error processing module "
+				"config parameters [module(...)]");
+		ABORT_FINALIZE(RS_RET_MISSING_CNFPARAMS);
+	}
+
+	if(Debug) {
+		dbgprintf("module (global) param blk for imkmsg:\n");
+		cnfparamsPrint(&modpblk, pvals);
+	}
+
+	for(i = 0 ; i < modpblk.nParams ; ++i) {
+		if(!pvals[i].bUsed)
+			continue;
+		if(!strcmp(modpblk.descr[i].name, "dedup")) {
+			loadModConf->bDedup = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "ratelimit.interval")) {
+			loadModConf->ratelimitInterval = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "ratelimit.burst")) {
+			loadModConf->ratelimitBurst = (int) pvals[i].val.d.n;
+		} else {
+			dbgprintf("imkmsg: program error, non-handled "
+			  "param '%s' in beginCnfLoad\n", modpblk.descr[i].name);
+		}
+	}
+
+	/* disable legacy module-global config directives */
+	bLegacyCnfModGlobalsPermitted = 0;
+	loadModConf->configSetViaV2Method = 1;
+
+finalize_it:
+	if(pvals != NULL)
+		cnfparamvalsDestruct(pvals, &modpblk);
+ENDsetModCnf
+
+
 BEGINendCnfLoad
 CODESTARTendCnfLoad
 	if(!loadModConf->configSetViaV2Method) {
@@ -254,6 +320,7 @@ BEGINqueryEtryPt
 CODESTARTqueryEtryPt
 CODEqueryEtryPt_STD_IMOD_QUERIES
 CODEqueryEtryPt_STD_CONF2_QUERIES
+CODEqueryEtryPt_STD_CONF2_setModCnf_QUERIES
 CODEqueryEtryPt_STD_CONF2_PREPRIVDROP_QUERIES
 ENDqueryEtryPt
 
@@ -32,6 +32,9 @@ struct modConfData_s {
 	uchar *pszPath;
 	int console_log_level;
 	sbool bPermitNonKernel;
+	sbool bDedup;		/* suppress repeated messages */
+	int ratelimitInterval;	/* per-prefix rate limit, 0 = off */
+	int ratelimitBurst;
 	sbool configSetViaV2Method;
 };
 
@@ -48,7 +51,8 @@ int klogFacilIntMsg();
 
 /* the functions below may be called by the drivers */
 rsRetVal imkmsgLogIntMsg(int priority, char *fmt, ...) __attribute__((format(printf,2, 3)));
-rsRetVal Syslog(int priority, uchar *msg, struct timeval *tp, struct json_object *json);
+rsRetVal Syslog(int priority, uchar *msg, int lenMsg, struct timeval *tp, struct json_object *json,
+	multi_submit_t *pMultiSub);
 
 /* prototypes */
 extern int klog_getMaxLine(void); /* work-around for klog drivers to get configured max line size */
@@ -33,6 +33,9 @@
 #include <string.h>
 #include <ctype.h>
 #include <sys/klog.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/time.h>
 #include <sys/sysinfo.h>
 #include <json.h>
 
@@ -48,107 +51,231 @@ static int	fklog = -1;	/* kernel log fd */
 #	define _PATH_KLOG "/dev/kmsg"
 #endif
 
-/* submit a message to imkmsg Syslog() API. In this function, we parse
- * necessary information from kernel log line, and make json string
- * from the rest.
+/* Per-prefix state for rate limiting and duplicate suppression. The
+ * prefix is the message text up to the first ':' (e.g. "e1000e" or
+ * "Out of memory"), which for most kernel messages names the driver or
+ * subsystem. Prefixes are hashed into a small fixed table; if two of
+ * them collide, the newer one takes over the slot. This is good enough
+ * for what is a protection against message storms, and it lets us drop
+ * records before anything is constructed for them.
  */
-static void
-submitSyslog(uchar *buf)
+#define KMSG_RL_SLOTS 64
+#define KMSG_RL_MAX_PREFIX 32
+#define KMSG_DEDUP_INTERVAL 5	/* max secs until repeats are reported if no ratelimit.interval */
+typedef struct kmsgLimit_s {
+	int facil;
+	int lenPrefix;
+	uchar prefix[KMSG_RL_MAX_PREFIX];
+	time_t tBegin;		/* begin of current interval */
+	unsigned nMsgs;		/* messages seen in current interval */
+	unsigned nDropped;	/* messages dropped due to rate limit in current interval */
+	uint32_t hashLast;	/* last message text, for duplicate detection */
+	int lenLast;
+	unsigned nRepeats;	/* duplicates of the last message suppressed so far */
+} kmsgLimit_t;
+static kmsgLimit_t limits[KMSG_RL_SLOTS];
+
+static inline uint32_t
+hashBuf(uint32_t hash, uchar *buf, int len)
 {
-	long offs = 0;
-	struct timeval tv;
-	struct sysinfo info;
-	unsigned long int timestamp = 0;
-	char name[1024];
-	char value[1024];
-	char msg[1024];
-	int priority = 0;
-	long int sequnum = 0;
-	struct json_object *json = NULL, *jval;
-
-	/* create new json object */
-	json = json_object_new_object();
+	int i;
+	for(i = 0 ; i < len ; ++i) {
+		hash ^= buf[i];
+		hash *= 16777619;
+	}
+	return hash;
+}
+
 
-	/* get priority */
-	for (; isdigit(*buf); buf++) {
-		priority += (priority * 10) + (*buf - '0');
+/* report what was suppressed for a slot so far */
+static void
+limitReport(kmsgLimit_t *pLim)
+{
+	if(pLim->nRepeats > 0) {
+		imkmsgLogIntMsg(LOG_WARNING, "imkmsg: last message for '%.*s' repeated %u times",
+			pLim->lenPrefix, pLim->prefix, pLim->nRepeats);
+		pLim->nRepeats = 0;
+	}
+	if(pLim->nDropped > 0) {
+		imkmsgLogIntMsg(LOG_WARNING, "imkmsg: %u messages for '%.*s' lost due to "
+			"rate-limiting", pLim->nDropped, pLim->lenPrefix, pLim->prefix);
+		pLim->nDropped = 0;
 	}
-	buf++;
+}
 
-	/* get messages sequence number and add it to json */
-	for (; isdigit(*buf); buf++) {
-		sequnum = (sequnum * 10) + (*buf - '0');
+
+/* check if a record shall be submitted. Returns 0 if it shall be dropped,
+ * because it is a duplicate of the previous message with the same prefix
+ * or exceeds the rate limit of its prefix.
+ */
+static int
+limitCheck(modConfData_t *pModConf, int facil, uchar *msg, int lenMsg, time_t now)
+{
+	kmsgLimit_t *pLim;
+	uint32_t hash;
+	uint32_t hashMsg;
+	int lenPrefix;
+	int interval;
+
+	if(!pModConf->bDedup && pModConf->ratelimitInterval == 0)
+		return 1;
+	for(lenPrefix = 0 ; lenPrefix < lenMsg && lenPrefix < KMSG_RL_MAX_PREFIX
+	    && msg[lenPrefix] != ':' ; ++lenPrefix)
+		/* just scan */;
+	if(lenPrefix == lenMsg || lenPrefix == KMSG_RL_MAX_PREFIX)
+		lenPrefix = 0; /* no prefix, all such messages share one slot */
+	hash = hashBuf(2166136261u ^ facil, msg, lenPrefix);
+	pLim = limits + (hash % KMSG_RL_SLOTS);
+
+	if(pLim->facil != facil || pLim->lenPrefix != lenPrefix
+	   || memcmp(pLim->prefix, msg, lenPrefix)) {
+		limitReport(pLim);
+		memset(pLim, 0, sizeof(kmsgLimit_t));
+		pLim->facil = facil;
+		pLim->lenPrefix = lenPrefix;
+		memcpy(pLim->prefix, msg, lenPrefix);
+		pLim->tBegin = now;
 	}
-	buf++; /* skip , */
-	jval = json_object_new_int(sequnum);
-	json_object_object_add(json, "sequnum", jval);
 
-	/* get timestamp */
-	for (; isdigit(*buf); buf++) {
-		timestamp = (timestamp * 10) + (*buf - '0');
+	interval = pModConf->ratelimitInterval ? pModConf->ratelimitInterval : KMSG_DEDUP_INTERVAL;
+	if(now >= pLim->tBegin + interval || now < pLim->tBegin) {
+		limitReport(pLim);
+		pLim->tBegin = now;
+		pLim->nMsgs = 0;
+		pLim->lenLast = -1; /* next message is never a duplicate */
 	}
 
-	while (*buf != ';') {
-		buf++; /* skip everything till the first ; */
+	if(pModConf->bDedup) {
+		hashMsg = hashBuf(2166136261u, msg, lenMsg);
+		if(hashMsg == pLim->hashLast && lenMsg == pLim->lenLast) {
+			++pLim->nRepeats;
+			return 0;
+		}
+		if(pLim->nRepeats > 0)
+			limitReport(pLim);
+		pLim->hashLast = hashMsg;
+		pLim->lenLast = lenMsg;
 	}
-	buf++; /* skip ; */
 
-	/* get message */
-	offs = 0;
-	for (; *buf != '\n' && *buf != '\0'; buf++, offs++) {
-		msg[offs] = *buf;
+	if(pModConf->ratelimitInterval > 0) {
+		if(++pLim->nMsgs > (unsigned) pModConf->ratelimitBurst) {
+			++pLim->nDropped;
+			return 0;
+		}
 	}
-	msg[offs] = '\0';
-	jval = json_object_new_string((char*)msg);
-	json_object_object_add(json, "msg", jval);
+	return 1;
+}
 
-	if (*buf != '\0') /* message has appended properties, skip \n */
-		buf++;
 
-	while (*buf) {
-		/* get name of the property */
-		buf++; /* skip ' ' */
-		offs = 0;
-		for (; *buf != '=' && *buf != ' '; buf++, offs++) {
-			name[offs] = *buf;
-		}
-		name[offs] = '\0';
-		buf++; /* skip = or ' ' */;
+/* parse a decimal number, advancing *pp */
+static inline unsigned long long
+parseNum(uchar **pp, uchar *end)
+{
+	unsigned long long n = 0;
+	uchar *p = *pp;
+
+	while(p < end && isdigit(*p))
+		n = n * 10 + (*p++ - '0');
+	if(p < end && *p == ',')
+		++p;
+	*pp = p;
+	return n;
+}
 
-		offs = 0;
-		for (; *buf != '\n' && *buf != '\0'; buf++, offs++) {
-			value[offs] = *buf;
-		}
-		value[offs] = '\0';
-		if (*buf != '\0') {
-			buf++; /* another property, skip \n */
-		}
 
-		jval = json_object_new_string((char*)value);
-		json_object_object_add(json, name, jval);
+/* submit a message to imkmsg Syslog() API. The record is
+ *   "level,sequnum,timestamp[,flags...];message\n"
+ * followed by optional " KEY=value\n" continuation lines. We parse it
+ * in a single pass, without copying; the sequence number, the message
+ * text and the key/value pairs are added as json.
+ */
+static void
+submitSyslog(modConfData_t *pModConf, uchar *buf, int lenBuf, struct timeval *tvBoot,
+	time_t now, multi_submit_t *pMultiSub)
+{
+	uchar *p = buf;
+	uchar *end = buf + lenBuf;
+	uchar *msg;
+	uchar *name;
+	uchar *val;
+	uchar c;
+	int lenMsg;
+	int lenName;
+	struct timeval tv;
+	unsigned long long timestamp;
+	int priority;
+	long int sequnum;
+	struct json_object *json, *jval;
+
+	priority = (int) parseNum(&p, end);
+	sequnum = (long int) parseNum(&p, end);
+	timestamp = parseNum(&p, end);
+	while(p < end && *p != ';')
+		++p; /* skip flags and future fields */
+	if(p == end) {
+		dbgprintf("imkmsg: malformed record, ignored\n");
+		return;
 	}
+	msg = ++p;
+	while(p < end && *p != '\n')
+		++p;
+	lenMsg = p - msg;
 
-	/* calculate timestamp */
-	sysinfo(&info);
-	gettimeofday(&tv, NULL);
-
-	/* get boot time */
-	tv.tv_sec -= info.uptime;
+	if(!limitCheck(pModConf, LOG_FAC(priority), msg, lenMsg, now))
+		return;
 
-	tv.tv_sec += timestamp / 1000000;
-	tv.tv_usec += timestamp % 1000000;
+	json = json_object_new_object();
+	jval = json_object_new_int(sequnum);
+	json_object_object_add(json, "sequnum", jval);
+	jval = json_object_new_string_len((char*)msg, lenMsg);
+	json_object_object_add(json, "msg", jval);
 
-	while (tv.tv_usec < 0) {
-		tv.tv_sec--;
-		tv.tv_usec += 1000000;
+	/* continuation lines: " KEY=value\n" */
+	while(p < end) {
+		++p; /* skip \n */
+		if(p < end && *p == ' ')
+			++p;
+		name = p;
+		while(p < end && *p != '=' && *p != '\n')
+			++p;
+		lenName = p - name;
+		if(p < end && *p == '=')
+			++p;
+		val = p;
+		while(p < end && *p != '\n')
+			++p;
+		if(lenName == 0)
+			continue;
+		jval = json_object_new_string_len((char*)val, p - val);
+		c = name[lenName];
+		name[lenName] = '\0'; /* json-c copies the name */
+		json_object_object_add(json, (char*)name, jval);
+		name[lenName] = c;
 	}
 
-	while (tv.tv_usec >= 1000000) {
+	tv.tv_sec = tvBoot->tv_sec + timestamp / 1000000;
+	tv.tv_usec = tvBoot->tv_usec + timestamp % 1000000;
+	if(tv.tv_usec >= 1000000) {
 		tv.tv_sec++;
 		tv.tv_usec -= 1000000;
 	}
 
-	Syslog(priority, (uchar *)msg, &tv, json);
+	Syslog(priority, msg, lenMsg, &tv, json, pMultiSub);
+}
+
+
+/* obtain the boot time, needed to convert the kernel timestamps, and
+ * the current time
+ */
+static void
+getBootTime(struct timeval *tvBoot, time_t *pNow)
+{
+	struct sysinfo info;
+
+	sysinfo(&info);
+	gettimeofday(tvBoot, NULL);
+	*pNow = tvBoot->tv_sec;
+	tvBoot->tv_sec -= info.uptime;
 }
 
 
@@ -160,7 +287,7 @@ klogWillRun(modConfData_t *pModConf)
 	char errmsg[2048];
 	DEFiRet;
 
-	fklog = open(_PATH_KLOG, O_RDONLY, 0);
+	fklog = open(_PATH_KLOG, O_RDONLY | O_NONBLOCK, 0);
 	if (fklog < 0) {
 		imkmsgLogIntMsg(RS_RET_ERR_OPEN_KLOG, "imkmsg: cannot open kernel log(%s): %s.",
 			_PATH_KLOG, rs_strerror_r(errno, errmsg, sizeof(errmsg)));
@@ -171,26 +298,40 @@ finalize_it:
 	RETiRet;
 }
 
-/* Read kernel log while data are available, each read() reads one
- * record of printk buffer.
+/* Wait for the kernel log to become readable and then read the records
+ * that are available, at most one batch of them, and submit them
+ * together. Each read() receives one record of the printk buffer.
  */
 static void
-readkmsg(void)
+readkmsg(modConfData_t *pModConf)
 {
 	int i;
+	int nRecs;
 	uchar pRcv[8192+1];
 	char errmsg[2048];
-
-	for (;;) {
-		dbgprintf("imkmsg waiting for kernel log line\n");
-
-		/* every read() from the opened device node receives one record of the printk buffer */
+	struct pollfd pfd;
+	struct timeval tvBoot;
+	time_t now;
+	multi_submit_t multiSub;
+	msg_t *pMsgs[CONF_NUM_MULTISUB];
+
+	dbgprintf("imkmsg waiting for kernel log line\n");
+	pfd.fd = fklog;
+	pfd.events = POLLIN;
+	if(poll(&pfd, 1, -1) < 1)
+		return; /* EINTR, our caller checks for termination */
+
+	multiSub.ppMsgs = pMsgs;
+	multiSub.maxElem = CONF_NUM_MULTISUB;
+	multiSub.nElem = 0;
+	getBootTime(&tvBoot, &now);
+	for(nRecs = 0 ; nRecs < CONF_NUM_MULTISUB ; ) {
 		i = read(fklog, pRcv, 8192);
 
 		if (i > 0) {
 			/* successful read of message of nonzero length */
 			pRcv[i] = '\0';
-		} else if (i == -EPIPE) {
+		} else if (i == -1 && errno == EPIPE) {
 			imkmsgLogIntMsg(LOG_WARNING,
 					"imkmsg: some messages in circular buffer got overwritten");
 			continue;
@@ -206,8 +347,10 @@ readkmsg(void)
 			break;
 		}
 
-		submitSyslog(pRcv);
+		submitSyslog(pModConf, pRcv, i, &tvBoot, now, &multiSub);
+		++nRecs;
 	}
+	multiSubmitFlush(&multiSub);
 }
 
 
@@ -230,10 +373,10 @@ rsRetVal klogAfterRun(modConfData_t *pModConf)
  * "message pull" mechanism.
  * rgerhards, 2008-04-09
  */
-rsRetVal klogLogKMsg(modConfData_t __attribute__((unused)) *pModConf)
+rsRetVal klogLogKMsg(modConfData_t *pModConf)
 {
 	DEFiRet;
-	readkmsg();
+	readkmsg(pModConf);
 	RETiRet;
 }
 
@@ -26,6 +26,7 @@
 #include <assert.h>
 #include <signal.h>
 #include <string.h>
+#include <ctype.h>
 #include <pthread.h>
 #include <fcntl.h>
 #include <sys/uio.h>
@@ -35,6 +36,10 @@
 #include <errno.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <poll.h>
+#include <math.h>
 
 #include "dirty.h"
 #include "cfsysline.h"
@@ -56,6 +61,8 @@ MODULE_CNFNAME("impstats")
 #define DEFAULT_STATS_PERIOD (5 * 60)
 #define DEFAULT_FACILITY 5 /* syslog */
 #define DEFAULT_SEVERITY 6 /* info */
+#define HTTP_MAX_REQ 4096	/* max size of HTTP request header we accept */
+#define HTTP_TIMEOUT 5		/* seconds a scraper may take to send its request */
 
 /* Module static data */
 DEF_IMOD_STATIC_DATA
@@ -83,9 +90,14 @@ struct modConfData_s {
 	statsFmtType_t statsFmt;
 	sbool bLogToSyslog;
 	sbool bResetCtrs;
+	sbool bDelta;			/* add per-interval deltas and rates? */
+	sbool bChangedOnly;		/* emit only counters changed since previous interval? */
 	char *logfile;
 	sbool configSetViaV2Method;
 	uchar *pszBindRuleset;		/* name of ruleset to bind to */
+	uchar *pszHttpPort;		/* port for metrics endpoint, NULL if disabled */
+	uchar *pszHttpAddr;		/* address to bind metrics endpoint to, NULL: all */
+	int sockHttp;			/* listen socket of metrics endpoint, or -1 */
 };
 static modConfData_t *loadModConf = NULL;/* modConf ptr to use for the current load process */
 static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current load process */
@@ -101,9 +113,13 @@ static struct cnfparamdescr modpdescr[] = {
 	{ "severity", eCmdHdlrInt, 0 },
 	{ "log.syslog", eCmdHdlrBinary, 0 },
 	{ "resetcounters", eCmdHdlrBinary, 0 },
+	{ "emit.delta", eCmdHdlrBinary, 0 },
+	{ "emit.changedonly", eCmdHdlrBinary, 0 },
 	{ "log.file", eCmdHdlrGetWord, 0 },
 	{ "format", eCmdHdlrGetWord, 0 },
-	{ "ruleset", eCmdHdlrString, 0 }
+	{ "ruleset", eCmdHdlrString, 0 },
+	{ "http.port", eCmdHdlrString, 0 },
+	{ "http.address", eCmdHdlrString, 0 }
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -124,6 +140,26 @@ static int st_ru_nvcsw;
 static int st_ru_nivcsw;
 static statsobj_t *statsobj_resources;
 
+/* one sample of the metrics endpoint. All samples are collected, sorted
+ * by metric family and then rendered, as the exposition formats require
+ * all samples of a family to be grouped together.
+ */
+typedef enum { promCounter, promGauge, promHistogram } promType_t;
+typedef struct promSample_s {
+	char *family;		/* sanitized metric family name */
+	char *object;		/* name of stats object, used as label */
+	promType_t type;
+	double le;		/* upper bound for histogram buckets */
+	intctr_t val;
+	int seq;		/* original position, to keep sort stable */
+} promSample_t;
+
+typedef struct promSamples_s {
+	promSample_t *samples;
+	int nSamples;
+	int maxSamples;
+} promSamples_t;
+
 BEGINmodExit
 CODESTARTmodExit
 	prop.Destruct(&pInputName);
@@ -241,11 +277,9 @@ doStatsLine(void __attribute__((unused)) *usrptr, cstr_t *cstr)
 }
 
 
-/* the function to generate the actual statistics messages
- * rgerhards, 2010-09-09
- */
+/* update our own resource usage counters */
 static inline void
-generateStatsMsgs(void)
+updateResourceCtrs(void)
 {
 	struct rusage ru;
 	int r;
@@ -263,7 +297,360 @@ generateStatsMsgs(void)
 	st_ru_oublock = ru.ru_oublock;
 	st_ru_nvcsw = ru.ru_nvcsw;
 	st_ru_nivcsw = ru.ru_nivcsw;
-	statsobj.GetAllStatsLines(doStatsLine, NULL, runModConf->statsFmt, runModConf->bResetCtrs);
+}
+
+
+/* the function to generate the actual statistics messages
+ * rgerhards, 2010-09-09
+ */
+static inline void
+generateStatsMsgs(void)
+{
+	/* if the metrics endpoint is the only consumer, there is nothing to do */
+	if(!runModConf->bLogToSyslog && runModConf->logfile == NULL && !runModConf->bResetCtrs)
+		return;
+	updateResourceCtrs();
+	statsobj.GetAllStatsLines(doStatsLine, NULL, runModConf->statsFmt,
+		(runModConf->bResetCtrs ? STATS_LINE_RESET : 0)
+		| (runModConf->bDelta ? STATS_LINE_DELTA : 0)
+		| (runModConf->bChangedOnly ? STATS_LINE_CHANGED : 0));
+}
+
+
+/* ------------------------------ metrics endpoint ------------------------------ */
+
+/* callback for statsobj, collects one counter as sample */
+static rsRetVal
+collectSample(void *usrptr, uchar *objName, ctr_t *pCtr, intctr_t val)
+{
+	promSamples_t *const pSmpls = (promSamples_t*) usrptr;
+	promSample_t *pSmpl;
+	promSample_t *newSamples;
+	uchar *name;
+	char *p;
+	DEFiRet;
+
+	if(pSmpls->nSamples == pSmpls->maxSamples) {
+		CHKmalloc(newSamples = realloc(pSmpls->samples,
+			(pSmpls->maxSamples + 256) * sizeof(promSample_t)));
+		pSmpls->samples = newSamples;
+		pSmpls->maxSamples += 256;
+	}
+	pSmpl = pSmpls->samples + pSmpls->nSamples;
+	if(pCtr->histName != NULL) {
+		name = pCtr->histName;
+		pSmpl->type = promHistogram;
+		pSmpl->le = pCtr->histLe;
+	} else {
+		name = pCtr->name;
+		pSmpl->type = (pCtr->ctrType == ctrType_Int) ? promGauge : promCounter;
+	}
+	CHKmalloc(pSmpl->family = malloc(sizeof("rsyslog_") + ustrlen(name)));
+	memcpy(pSmpl->family, "rsyslog_", sizeof("rsyslog_") - 1);
+	for(p = pSmpl->family + sizeof("rsyslog_") - 1 ; *name != '\0' ; ++name, ++p) {
+		*p = (isalnum(*name) || *name == '_') ? *name : '_';
+	}
+	*p = '\0';
+	if((pSmpl->object = strdup((char*) objName)) == NULL) {
+		free(pSmpl->family);
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	}
+	pSmpl->val = val;
+	pSmpl->seq = pSmpls->nSamples++;
+
+finalize_it:
+	RETiRet;
+}
+
+static int
+cmpSamples(const void *a, const void *b)
+{
+	const promSample_t *const s1 = (const promSample_t*) a;
+	const promSample_t *const s2 = (const promSample_t*) b;
+	int r;
+	r = strcmp(s1->family, s2->family);
+	return (r != 0) ? r : s1->seq - s2->seq;
+}
+
+/* append the object label, escaped as the exposition formats require */
+static void
+appendObjLabel(cstr_t *pcstr, char *object)
+{
+	rsCStrAppendStrWithLen(pcstr, UCHAR_CONSTANT("{object=\""), sizeof("{object=\"") - 1);
+	for( ; *object != '\0' ; ++object) {
+		if(*object == '\\' || *object == '"') {
+			cstrAppendChar(pcstr, '\\');
+			cstrAppendChar(pcstr, *object);
+		} else if(*object == '\n') {
+			rsCStrAppendStrWithLen(pcstr, UCHAR_CONSTANT("\\n"), 2);
+		} else {
+			cstrAppendChar(pcstr, *object);
+		}
+	}
+	cstrAppendChar(pcstr, '"');
+}
+
+/* render one sample line "<family><suffix>{object="..."[,le="..."]} <val>" */
+static void
+appendSample(cstr_t *pcstr, promSample_t *pSmpl, const char *suffix, sbool bLe, intctr_t val)
+{
+	char buf[64];
+	int len;
+
+	rsCStrAppendStr(pcstr, (uchar*) pSmpl->family);
+	rsCStrAppendStr(pcstr, (uchar*) suffix);
+	appendObjLabel(pcstr, pSmpl->object);
+	if(bLe) {
+		if(isinf(pSmpl->le))
+			len = snprintf(buf, sizeof(buf), ",le=\"+Inf\"");
+		else
+			len = snprintf(buf, sizeof(buf), ",le=\"%.9g\"", pSmpl->le);
+		rsCStrAppendStrWithLen(pcstr, (uchar*) buf, len);
+	}
+	if(pSmpl->type == promGauge)
+		len = snprintf(buf, sizeof(buf), "} %lld\n", (long long) (int) val);
+	else
+		len = snprintf(buf, sizeof(buf), "} %llu\n", (unsigned long long) val);
+	rsCStrAppendStrWithLen(pcstr, (uchar*) buf, len);
+}
+
+/* render all samples of one family, samples[0..n-1]. If the counter types
+ * of a family do not agree (e.g. two providers use the same counter name
+ * differently), the family is emitted as "unknown" type.
+ */
+static void
+appendFamily(cstr_t *pcstr, promSample_t *samples, int n, sbool bOpenMetrics)
+{
+	promType_t type;
+	sbool bMixed = 0;
+	intctr_t cumulative = 0;
+	int i;
+
+	type = samples[0].type;
+	for(i = 1 ; i < n ; ++i)
+		if(samples[i].type != type)
+			bMixed = 1;
+
+	rsCStrAppendStrWithLen(pcstr, UCHAR_CONSTANT("# TYPE "), sizeof("# TYPE ") - 1);
+	rsCStrAppendStr(pcstr, (uchar*) samples[0].family);
+	if(bMixed) {
+		rsCStrAppendStr(pcstr, UCHAR_CONSTANT(bOpenMetrics ? " unknown\n" : " untyped\n"));
+	} else if(type == promCounter) {
+		if(!bOpenMetrics) /* the text format names the family like the samples */
+			rsCStrAppendStr(pcstr, UCHAR_CONSTANT("_total"));
+		rsCStrAppendStr(pcstr, UCHAR_CONSTANT(" counter\n"));
+	} else if(type == promGauge) {
+		rsCStrAppendStr(pcstr, UCHAR_CONSTANT(" gauge\n"));
+	} else {
+		rsCStrAppendStr(pcstr, UCHAR_CONSTANT(" histogram\n"));
+	}
+
+	for(i = 0 ; i < n ; ++i) {
+		if(bMixed) {
+			appendSample(pcstr, samples+i, "", samples[i].type == promHistogram, samples[i].val);
+		} else if(type == promCounter) {
+			appendSample(pcstr, samples+i, "_total", 0, samples[i].val);
+		} else if(type == promGauge) {
+			appendSample(pcstr, samples+i, "", 0, samples[i].val);
+		} else {
+			/* our buckets are not cumulative, but the formats' ones are */
+			cumulative += samples[i].val;
+			appendSample(pcstr, samples+i, "_bucket", 1, cumulative);
+			if(isinf(samples[i].le)) {
+				appendSample(pcstr, samples+i, "_count", 0, cumulative);
+				cumulative = 0;
+			}
+		}
+	}
+}
+
+/* generate the metrics page from the current counter values */
+static rsRetVal
+generateMetrics(cstr_t **ppcstr, sbool bOpenMetrics)
+{
+	promSamples_t smpls = { NULL, 0, 0 };
+	cstr_t *pcstr = NULL;
+	int i, iBegin;
+	DEFiRet;
+
+	updateResourceCtrs();
+	CHKiRet(statsobj.GetAllCounters(collectSample, &smpls));
+	if(smpls.nSamples > 0)
+		qsort(smpls.samples, smpls.nSamples, sizeof(promSample_t), cmpSamples);
+
+	CHKiRet(cstrConstruct(&pcstr));
+	for(iBegin = 0 ; iBegin < smpls.nSamples ; iBegin = i) {
+		for(i = iBegin + 1 ; i < smpls.nSamples
+			&& !strcmp(smpls.samples[i].family, smpls.samples[iBegin].family) ; ++i)
+			/* just find end of family */;
+		appendFamily(pcstr, smpls.samples + iBegin, i - iBegin, bOpenMetrics);
+	}
+	if(bOpenMetrics)
+		rsCStrAppendStr(pcstr, UCHAR_CONSTANT("# EOF\n"));
+	CHKiRet(cstrFinalize(pcstr));
+	*ppcstr = pcstr;
+	pcstr = NULL;
+
+finalize_it:
+	if(pcstr != NULL)
+		rsCStrDestruct(&pcstr);
+	for(i = 0 ; i < smpls.nSamples ; ++i) {
+		free(smpls.samples[i].family);
+		free(smpls.samples[i].object);
+	}
+	free(smpls.samples);
+	RETiRet;
+}
+
+/* write all of buf to a socket, returns 0 on success */
+static int
+sendAll(int sock, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while(len > 0) {
+		n = send(sock, buf, len, MSG_NOSIGNAL);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return -1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* send a complete HTTP response and close the connection afterwards */
+static void
+sendHttpResponse(int sock, const char *status, const char *contentType, uchar *body, size_t lenBody)
+{
+	char hdr[256];
+	int lenHdr;
+
+	lenHdr = snprintf(hdr, sizeof(hdr), "HTTP/1.0 %s\r\nContent-Type: %s\r\n"
+			  "Content-Length: %llu\r\nConnection: close\r\n\r\n",
+			  status, contentType, (unsigned long long) lenBody);
+	if(sendAll(sock, hdr, lenHdr) == 0 && lenBody > 0)
+		sendAll(sock, (char*) body, lenBody);
+}
+
+/* serve a single scrape request. Only "GET /metrics" (or "/") is supported.
+ * Requests are served one at a time on the impstats thread; the socket
+ * timeouts make sure a stalled client cannot block us for long.
+ */
+static void
+serveHttp(int sockListen)
+{
+	char req[HTTP_MAX_REQ+1];
+	size_t lenReq = 0;
+	ssize_t n;
+	int sock;
+	char *path;
+	sbool bOpenMetrics;
+	cstr_t *pcstr;
+	struct timeval tv;
+
+	if((sock = accept(sockListen, NULL, NULL)) < 0) {
+		DBGPRINTF("impstats: accept for metrics endpoint failed, errno %d\n", errno);
+		return;
+	}
+	tv.tv_sec = HTTP_TIMEOUT;
+	tv.tv_usec = 0;
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	/* we only need the request header, the body (if any) is ignored */
+	req[0] = '\0';
+	while(lenReq < HTTP_MAX_REQ && strstr(req, "\r\n\r\n") == NULL) {
+		n = recv(sock, req + lenReq, HTTP_MAX_REQ - lenReq, 0);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			goto done;
+		lenReq += n;
+		req[lenReq] = '\0';
+	}
+
+	if(strncmp(req, "GET ", 4)) {
+		sendHttpResponse(sock, "405 Method Not Allowed", "text/plain", NULL, 0);
+		goto done;
+	}
+	path = req + 4;
+	if(   strncmp(path, "/metrics", 8)
+	   || (path[8] != ' ' && path[8] != '?' && path[8] != '\r')) {
+		if(strncmp(path, "/ ", 2)) {
+			sendHttpResponse(sock, "404 Not Found", "text/plain", NULL, 0);
+			goto done;
+		}
+	}
+
+	/* Prometheus asks for OpenMetrics via the Accept header, everyone else gets
+	 * the classic text format.
+	 */
+	bOpenMetrics = strstr(req, "application/openmetrics-text") != NULL;
+	if(generateMetrics(&pcstr, bOpenMetrics) != RS_RET_OK) {
+		sendHttpResponse(sock, "500 Internal Server Error", "text/plain", NULL, 0);
+		goto done;
+	}
+	sendHttpResponse(sock, "200 OK", bOpenMetrics
+			 ? "application/openmetrics-text; version=1.0.0; charset=utf-8"
+			 : "text/plain; version=0.0.4; charset=utf-8",
+			 rsCStrGetSzStrNoNULL(pcstr), cstrLen(pcstr));
+	rsCStrDestruct(&pcstr);
+
+done:
+	close(sock);
+}
+
+/* create the listen socket for the metrics endpoint */
+static rsRetVal
+createHttpListener(modConfData_t *modConf)
+{
+	struct addrinfo hints;
+	struct addrinfo *res = NULL;
+	struct addrinfo *r;
+	int sock = -1;
+	int on = 1;
+	int err;
+	DEFiRet;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_flags = AI_PASSIVE;
+	hints.ai_family = glbl.GetDefPFFamily();
+	hints.ai_socktype = SOCK_STREAM;
+	if((err = getaddrinfo((char*) modConf->pszHttpAddr, (char*) modConf->pszHttpPort,
+			      &hints, &res)) != 0) {
+		errmsg.LogError(0, RS_RET_INVALID_PORT, "impstats: could not resolve metrics "
+				"endpoint address '%s', port '%s': %s",
+				modConf->pszHttpAddr == NULL ? "*" : (char*) modConf->pszHttpAddr,
+				modConf->pszHttpPort, gai_strerror(err));
+		ABORT_FINALIZE(RS_RET_INVALID_PORT);
+	}
+
+	for(r = res ; r != NULL ; r = r->ai_next) {
+		if((sock = socket(r->ai_family, r->ai_socktype, r->ai_protocol)) < 0)
+			continue;
+		setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if(   bind(sock, r->ai_addr, r->ai_addrlen) == 0
+		   && listen(sock, 16) == 0
+		   && fcntl(sock, F_SETFL, O_NONBLOCK) == 0)
+			break;
+		close(sock);
+		sock = -1;
+	}
+	if(sock == -1) {
+		errmsg.LogError(errno, RS_RET_COULD_NOT_BIND, "impstats: could not create "
+				"metrics endpoint listener on port '%s'", modConf->pszHttpPort);
+		ABORT_FINALIZE(RS_RET_COULD_NOT_BIND);
+	}
+	fcntl(sock, F_SETFD, FD_CLOEXEC);
+	modConf->sockHttp = sock;
+	DBGPRINTF("impstats: metrics endpoint listening on port %s\n", modConf->pszHttpPort);
+
+finalize_it:
+	if(res != NULL)
+		freeaddrinfo(res);
+	RETiRet;
 }
 
 
@@ -282,6 +669,11 @@ CODESTARTbeginCnfLoad
 	loadModConf->pszBindRuleset = NULL;
 	loadModConf->bLogToSyslog = 1;
 	loadModConf->bResetCtrs = 0;
+	loadModConf->bDelta = 0;
+	loadModConf->bChangedOnly = 0;
+	loadModConf->pszHttpPort = NULL;
+	loadModConf->pszHttpAddr = NULL;
+	loadModConf->sockHttp = -1;
 	bLegacyCnfModGlobalsPermitted = 1;
 	/* init legacy config vars */
 	initConfigSettings();
@@ -318,6 +710,10 @@ CODESTARTsetModCnf
 			loadModConf->bLogToSyslog = (sbool) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "resetcounters")) {
 			loadModConf->bResetCtrs = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "emit.delta")) {
+			loadModConf->bDelta = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "emit.changedonly")) {
+			loadModConf->bChangedOnly = (sbool) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "log.file")) {
 			loadModConf->logfile = es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(modpblk.descr[i].name, "format")) {
@@ -335,6 +731,10 @@ CODESTARTsetModCnf
 			free(mode);
 		} else if(!strcmp(modpblk.descr[i].name, "ruleset")) {
 			loadModConf->pszBindRuleset = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(modpblk.descr[i].name, "http.port")) {
+			loadModConf->pszHttpPort = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(modpblk.descr[i].name, "http.address")) {
+			loadModConf->pszHttpAddr = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else {
 			dbgprintf("impstats: program error, non-handled "
 			  "param '%s' in beginCnfLoad\n", modpblk.descr[i].name);
@@ -450,6 +850,8 @@ CODESTARTfreeCnf
 	if(runModConf->logfd != -1)
 		close(runModConf->logfd);
 	free(runModConf->logfile);
+	free(runModConf->pszHttpPort);
+	free(runModConf->pszHttpAddr);
 ENDfreeCnf
 
 
@@ -461,21 +863,48 @@ CODESTARTrunInput
 	 * final set of stats counters on termination request. Depending
 	 * on configuration, they may not make it to the final destination...
 	 */
-	while(glbl.GetGlobalInputTermState() == 0) {
-		srSleep(runModConf->iStatsInterval, 0); /* seconds, micro seconds */
-		DBGPRINTF("impstats: woke up, generating messages\n");
-		generateStatsMsgs();
+	if(runModConf->sockHttp == -1) {
+		while(glbl.GetGlobalInputTermState() == 0) {
+			srSleep(runModConf->iStatsInterval, 0); /* seconds, micro seconds */
+			DBGPRINTF("impstats: woke up, generating messages\n");
+			generateStatsMsgs();
+		}
+	} else {
+		/* with the metrics endpoint, we wait for scrapes until the next interval */
+		struct pollfd pfd;
+		time_t tNext, tNow;
+		tNext = time(NULL) + runModConf->iStatsInterval;
+		pfd.fd = runModConf->sockHttp;
+		pfd.events = POLLIN;
+		while(glbl.GetGlobalInputTermState() == 0) {
+			tNow = time(NULL);
+			if(tNow >= tNext) {
+				DBGPRINTF("impstats: interval expired, generating messages\n");
+				generateStatsMsgs();
+				tNext = tNow + runModConf->iStatsInterval;
+				continue;
+			}
+			if(poll(&pfd, 1, (int) (tNext - tNow) * 1000) > 0)
+				serveHttp(runModConf->sockHttp);
+		}
 	}
 ENDrunInput
 
 
 BEGINwillRun
 CODESTARTwillRun
+	if(runModConf->pszHttpPort != NULL)
+		CHKiRet(createHttpListener(runModConf));
+finalize_it:
 ENDwillRun
 
 
 BEGINafterRun
 CODESTARTafterRun
+	if(runModConf->sockHttp != -1) {
+		close(runModConf->sockHttp);
+		runModConf->sockHttp = -1;
+	}
 ENDafterRun
 
 
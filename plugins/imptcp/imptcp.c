@@ -71,6 +71,7 @@
 #include "statsobj.h"
 #include "ratelimit.h"
 #include "net.h" /* for permittedPeers, may be removed when this is removed */
+#include "dnscache.h"
 
 /* the define is from tcpsrv.h, we need to find a new (but easier!!!) abstraction layer some time ... */
 #define TCPSRV_NO_ADDTL_DELIMITER -1 /* specifies that no additional delimiter is to be used in TCP framing */
@@ -99,6 +100,8 @@ static void * wrkr(void *myself);
 #define COMPRESS_SINGLE_MSG 1	/* old, single-message compression */
 /* all other settings are for stream-compression */
 #define COMPRESS_STREAM_ALWAYS 2
+#define ZIP_BUF_SIZE (64*1024)	/* per-session inflate output buffer */
+#define BINREC_MAX (16*1024*1024) /* sanity limit for received binary records */
 
 /* config settings */
 typedef struct configSettings_s {
@@ -123,7 +126,9 @@ struct instanceConf_s {
 	int iKeepAliveTime;
 	int bEmitMsgOnClose;
 	int bSuppOctetFram;		/* support octet-counted framing? */
+	int bSuppBinFram;		/* support binary records (from omfwd)? */
 	int iAddtlFrameDelim;
+	int maxFrameSize;		/* frames up to this size are not split (0 - max msg size) */
 	uint8_t compressionMode;
 	uchar *pszBindPort;		/* port to bind to */
 	uchar *pszBindAddr;		/* IP to bind socket to */
@@ -141,6 +146,7 @@ struct modConfData_s {
 	rsconf_t *pConf;		/* our overall config object */
 	instanceConf_t *root, *tail;
 	int wrkrMax;
+	sbool bSharded;			/* each worker has its own epoll set and sessions */
 	sbool configSetViaV2Method;
 };
 
@@ -149,7 +155,8 @@ static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current lo
 
 /* module-global parameters */
 static struct cnfparamdescr modpdescr[] = {
-	{ "threads", eCmdHdlrPositiveInt, 0 }
+	{ "threads", eCmdHdlrPositiveInt, 0 },
+	{ "threads.sharded", eCmdHdlrBinary, 0 }
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -165,6 +172,7 @@ static struct cnfparamdescr inppdescr[] = {
 	{ "ruleset", eCmdHdlrString, 0 },
 	{ "defaulttz", eCmdHdlrString, 0 },
 	{ "supportoctetcountedframing", eCmdHdlrBinary, 0 },
+	{ "supportbinaryframing", eCmdHdlrBinary, 0 },
 	{ "notifyonconnectionclose", eCmdHdlrBinary, 0 },
 	{ "compression.mode", eCmdHdlrGetWord, 0 },
 	{ "keepalive", eCmdHdlrBinary, 0 },
@@ -172,6 +180,7 @@ static struct cnfparamdescr inppdescr[] = {
 	{ "keepalive.time", eCmdHdlrInt, 0 },
 	{ "keepalive.interval", eCmdHdlrInt, 0 },
 	{ "addtlframedelimiter", eCmdHdlrInt, 0 },
+	{ "maxframesize", eCmdHdlrSize, 0 },
 	{ "ratelimit.interval", eCmdHdlrInt, 0 },
 	{ "ratelimit.burst", eCmdHdlrInt, 0 }
 };
@@ -189,6 +198,7 @@ typedef struct ptcpsrv_s ptcpsrv_t;
 typedef struct ptcplstn_s ptcplstn_t;
 typedef struct ptcpsess_s ptcpsess_t;
 typedef struct epolld_s epolld_t;
+typedef struct epollctx_s epollctx_t;
 
 /* the ptcp server (listener) object
  * Note that the object contains support for forming a linked list
@@ -199,6 +209,7 @@ struct ptcpsrv_s {
 	uchar *port;			/* Port to listen to */
 	uchar *lstnIP;			/* which IP we should listen on? */
 	int iAddtlFrameDelim;
+	int maxFrameSize;
 	int iKeepAliveIntvl;
 	int iKeepAliveProbes;
 	int iKeepAliveTime;
@@ -213,6 +224,7 @@ struct ptcpsrv_s {
 	sbool bKeepAlive;		/* support keep-alive packets */
 	sbool bEmitMsgOnClose;
 	sbool bSuppOctetFram;
+	sbool bSuppBinFram;
 	ratelimit_t *ratelimiter;
 };
 
@@ -224,24 +236,36 @@ struct ptcpsess_s {
 	ptcpsess_t *prev, *next;
 	int sock;
 	epolld_t *epd;
+	epollctx_t *pCtx;	/* epoll set we are in */
 	sbool bzInitDone; /* did we do an init of zstrm already? */
 	z_stream zstrm;	/* zip stream to use for tcp compression */
+	uchar *zipBuf;	/* inflate output buffer, allocated on first use */
 	uint8_t compressionMode;
 //--- from tcps_sess.h
 	int iMsg;		 /* index of next char to store in msg */
 	int bAtStrtOfFram;	/* are we at the very beginning of a new frame? */
 	sbool bSuppOctetFram;	/**< copy from listener, to speed up access */
+	sbool bSuppBinFram;	/**< copy from listener, to speed up access */
 	enum {
 		eAtStrtFram,
 		eInOctetCnt,
-		eInMsg
+		eInMsg,
+		eInBinRec
 	} inputState;		/* our current state */
 	int iOctetsRemain;	/* Number of Octets remaining in message */
 	TCPFRAMINGMODE eFraming;
-	uchar *pMsg;		/* message (fragment) received */
-	prop_t *peerName;	/* host name we received messages from */
+	uchar *pMsg;		/* message (fragment) received, allocated on first use */
+	msgChain_t chain;	/* data of a large frame beyond the max msg size (see maxFrameSize) */
+	uchar *pBinRec;		/* binary record (fragment) received, allocated on first use */
+	size_t lenBinRec;	/* octets of the binary record received so far */
+	size_t sizeBinRec;	/* length of the binary record, 0 while the header is incomplete */
+	size_t allocBinRec;	/* size of pBinRec */
+	prop_t *peerName;	/* host name we received messages from, NULL until first data */
 	prop_t *peerIP;
 //--- END from tcps_sess.h
+	struct sockaddr_storage addrPeer; /* for resolving peerName/peerIP */
+	sbool bPaused;		/* not read due to backpressure, on paused list */
+	ptcpsess_t *pNextPaused;/* paused list maintenance */
 };
 
 
@@ -252,11 +276,15 @@ struct ptcplstn_s {
 	ptcplstn_t *prev, *next;
 	int sock;
 	sbool bSuppOctetFram;
+	sbool bSuppBinFram;
 	epolld_t *epd;
 	statsobj_t *stats;	/* listener stats */
 	intctr_t rcvdBytes;
 	intctr_t rcvdDecompressed;
-	STATSCOUNTER_DEF(ctrSubmit, mutCtrSubmit)
+	STATSCOUNTER_SHARDED_DEF(ctrSubmit)	/* updated by all workers */
+	STATSCOUNTER_DEF(ctrPaused, mutCtrPaused)
+	STATSCOUNTER_DEF(ctrLargeMsgs, mutCtrLargeMsgs)
+	STATSCOUNTER_DEF(ctrSplitMsgs, mutCtrSplitMsgs)
 };
 
 
@@ -289,12 +317,44 @@ struct epolld_s {
 	struct epoll_event ev;
 };
 
+/* Sessions whose ruleset queue asks for backpressure are not read any
+ * longer, so that their senders are throttled via the TCP window. As
+ * the sockets are edge-triggered, such sessions are put onto the paused
+ * list and retried by the set's thread until the queue has drained.
+ */
+#define PAUSED_RETRY_INTERVAL 100	/* ms */
+/* an epoll set together with the sessions paused on it. Without
+ * threads.sharded, there is only the main one, served by the input thread
+ * and the helper pool. With it, the main set only holds the listeners and
+ * each worker serves its own set. New sessions are assigned round-robin
+ * to the workers and stay there until they are closed.
+ */
+struct epollctx_s {
+	int efd;			/* the epoll descriptor */
+	ptcpsess_t *pPausedRoot;	/* paused sessions */
+	pthread_mutex_t mutPaused;
+	pthread_t tid;			/* the shard's thread (not used for main set) */
+	int pipeWakeup[2];		/* wakes the shard for termination (not used for main set) */
+	long long unsigned numCalled;	/* how often did this shard process events */
+};
+
 
 /* global data */
 pthread_attr_t wrkrThrdAttr;	/* Attribute for session threads; read only after startup */
 static ptcpsrv_t *pSrvRoot = NULL;
-static int epollfd = -1;			/* (sole) descriptor for epoll */
+static epollctx_t mainCtx = { -1, NULL, PTHREAD_MUTEX_INITIALIZER, 0, { -1, -1 }, 0 };
+static epollctx_t shardCtx[16];		/* with threads.sharded */
+static int nShards = 0;			/* number of shards running */
+static unsigned nextShard = 0;		/* shard for the next new session */
 static int iMaxLine; /* maximum size of a single message */
+/* Closed session objects (with their epoll descriptor) are kept for
+ * reuse, so that reconnect storms do not hammer the allocator. Sessions
+ * are closed by the worker threads, so the pool needs a lock.
+ */
+#define SESS_POOL_MAX 1024
+static ptcpsess_t *pSessPool = NULL;	/* linked via next */
+static int nSessPool = 0;
+static pthread_mutex_t mutSessPool = PTHREAD_MUTEX_INITIALIZER;
 
 /* forward definitions */
 static rsRetVal resetConfigVariables(uchar __attribute__((unused)) *pp, void __attribute__((unused)) *pVal);
@@ -302,17 +362,78 @@ static rsRetVal addLstn(ptcpsrv_t *pSrv, int sock, int isIPv6);
 
 
 /* some simple constructors/destructors */
+/* get a session object, from the pool if possible. Only the epd is
+ * kept in pooled objects, everything else must be set up by the caller.
+ */
+static rsRetVal
+getPooledSess(ptcpsess_t **ppSess)
+{
+	ptcpsess_t *pSess;
+	DEFiRet;
+
+	pthread_mutex_lock(&mutSessPool);
+	if((pSess = pSessPool) != NULL) {
+		pSessPool = pSess->next;
+		--nSessPool;
+	}
+	pthread_mutex_unlock(&mutSessPool);
+	if(pSess == NULL) {
+		CHKmalloc(pSess = malloc(sizeof(ptcpsess_t)));
+		pSess->epd = NULL;
+	}
+	*ppSess = pSess;
+
+finalize_it:
+	RETiRet;
+}
+
+/* free the per-connection resources of a session and return the object
+ * to the pool (or free it, if the pool is full). The buffers are not kept,
+ * as most sessions never need them.
+ */
 static void
 destructSess(ptcpsess_t *pSess)
 {
+	if(pSess->bzInitDone)
+		inflateEnd(&pSess->zstrm);
+	free(pSess->zipBuf);
 	free(pSess->pMsg);
-	free(pSess->epd);
-	prop.Destruct(&pSess->peerName);
-	prop.Destruct(&pSess->peerIP);
-	/* TODO: make these inits compile-time switch depending: */
+	MsgChainDiscard(&pSess->chain);
+	free(pSess->pBinRec);
+	if(pSess->peerName != NULL)
+		prop.Destruct(&pSess->peerName);
+	if(pSess->peerIP != NULL)
+		prop.Destruct(&pSess->peerIP);
 	pSess->pMsg = NULL;
-	pSess->epd = NULL;
-	free(pSess);
+	pSess->pBinRec = NULL;
+	pSess->zipBuf = NULL;
+
+	pthread_mutex_lock(&mutSessPool);
+	if(nSessPool < SESS_POOL_MAX) {
+		pSess->next = pSessPool;
+		pSessPool = pSess;
+		++nSessPool;
+		pSess = NULL;
+	}
+	pthread_mutex_unlock(&mutSessPool);
+	if(pSess != NULL) {
+		free(pSess->epd);
+		free(pSess);
+	}
+}
+
+/* free all pooled session objects, done on module exit */
+static void
+freeSessPool(void)
+{
+	ptcpsess_t *pSess;
+
+	while((pSess = pSessPool) != NULL) {
+		pSessPool = pSess->next;
+		free(pSess->epd);
+		free(pSess);
+	}
+	nSessPool = 0;
 }
 
 static void
@@ -501,6 +622,18 @@ getPeerNames(prop_t **peerName, prop_t **peerIP, struct sockaddr *pAddr)
 	
 	DEFiRet;
 
+	if(glbl.GetDnscacheResolverThreads() > 0) {
+		/* do not wait for DNS inside the accept path, let the background
+		 * resolvers do it. Until they are done, the IP is used as name.
+		 */
+		iRet = dnscacheLookupNoWait((struct sockaddr_storage*) pAddr, peerName, NULL, NULL, peerIP);
+		if(iRet != RS_RET_OK) {
+			prop.Destruct(peerName);
+			prop.Destruct(peerIP);
+		}
+		FINALIZE;
+	}
+
         error = getnameinfo(pAddr, SALEN(pAddr), (char*)szIP, sizeof(szIP), NULL, 0, NI_NUMERICHOST);
 
         if(error) {
@@ -617,19 +750,27 @@ finalize_it:
 
 
 /* accept an incoming connection request
+ * The peer's names are not resolved here, this is done when the session
+ * delivers its first data (see sessGetPeerNames()), so that the accept
+ * loop is not slowed down by DNS and prop creation.
  * rgerhards, 2008-04-22
  */
 static rsRetVal
-AcceptConnReq(ptcplstn_t *pLstn, int *newSock, prop_t **peerName, prop_t **peerIP)
+AcceptConnReq(ptcplstn_t *pLstn, int *newSock, struct sockaddr_storage *pAddr)
 {
-	int sockflags;
-	struct sockaddr_storage addr;
-	socklen_t addrlen = sizeof(addr);
+	socklen_t addrlen = sizeof(struct sockaddr_storage);
 	int iNewSock = -1;
+#	if !defined(HAVE_ACCEPT4)
+	int sockflags;
+#	endif
 
 	DEFiRet;
 
-	iNewSock = accept(pLstn->sock, (struct sockaddr*) &addr, &addrlen);
+#	if defined(HAVE_ACCEPT4)
+	iNewSock = accept4(pLstn->sock, (struct sockaddr*) pAddr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#	else
+	iNewSock = accept(pLstn->sock, (struct sockaddr*) pAddr, &addrlen);
+#	endif
 	if(iNewSock < 0) {
 		if(errno == EAGAIN || errno == EWOULDBLOCK)
 			ABORT_FINALIZE(RS_RET_NO_MORE_DATA);
@@ -639,9 +780,7 @@ AcceptConnReq(ptcplstn_t *pLstn, int *newSock, prop_t **peerName, prop_t **peerI
 	if(pLstn->pSrv->bKeepAlive)
 		EnableKeepAlive(pLstn, iNewSock);/* we ignore errors, best to do! */
 
-	
-	CHKiRet(getPeerNames(peerName, peerIP, (struct sockaddr*) &addr));
-
+#	if !defined(HAVE_ACCEPT4)
 	/* set the new socket to non-blocking IO */
 	if((sockflags = fcntl(iNewSock, F_GETFL)) != -1) {
 		sockflags |= O_NONBLOCK;
@@ -654,6 +793,7 @@ AcceptConnReq(ptcplstn_t *pLstn, int *newSock, prop_t **peerName, prop_t **peerI
 		DBGPRINTF("error %d setting fcntl(O_NONBLOCK) on tcp socket %d", errno, iNewSock);
 		ABORT_FINALIZE(RS_RET_IO_ERROR);
 	}
+#	endif
 
 	*newSock = iNewSock;
 
@@ -668,6 +808,21 @@ finalize_it:
 }
 
 
+/* resolve the peer's names, if not already done. This is called when the
+ * session delivers data for the first time (or is closed with
+ * emitMsgOnClose), so sessions that never send anything do not cost a
+ * lookup.
+ */
+static inline rsRetVal
+sessGetPeerNames(ptcpsess_t *pSess)
+{
+	DEFiRet;
+	if(pSess->peerName == NULL)
+		iRet = getPeerNames(&pSess->peerName, &pSess->peerIP, (struct sockaddr*) &pSess->addrPeer);
+	RETiRet;
+}
+
+
 /* This is a helper for submitting the message to the rsyslog core.
  * It does some common processing, including resetting the various
  * state variables to a "processed" state.
@@ -680,13 +835,15 @@ finalize_it:
  * EXTRACT from tcps_sess.c
  */
 static rsRetVal
-doSubmitMsg(ptcpsess_t *pThis, struct syslogTime *stTime, time_t ttGenTime, multi_submit_t *pMultiSub)
+doSubmitMsgBuf(ptcpsess_t *pThis, uchar *pBuf, int lenBuf, msgChain_t *pChain, struct syslogTime *stTime,
+	time_t ttGenTime, multi_submit_t *pMultiSub)
 {
 	msg_t *pMsg;
 	ptcpsrv_t *pSrv;
+	rsRetVal localRet;
 	DEFiRet;
 
-	if(pThis->iMsg == 0) {
+	if(lenBuf == 0) {
 		DBGPRINTF("discarding zero-sized message\n");
 		FINALIZE;
 	}
@@ -694,7 +851,16 @@ doSubmitMsg(ptcpsess_t *pThis, struct syslogTime *stTime, time_t ttGenTime, mult
 
 	/* we now create our own message object and submit it to the queue */
 	CHKiRet(msgConstructWithTime(&pMsg, stTime, ttGenTime));
-	MsgSetRawMsg(pMsg, (char*)pThis->pMsg, pThis->iMsg);
+	if(pChain != NULL && pChain->len > 0) {
+		if((localRet = MsgSetRawMsgChain(pMsg, pBuf, lenBuf, pChain)) != RS_RET_OK) {
+			msgDestruct(&pMsg);
+			ABORT_FINALIZE(localRet);
+		}
+	} else {
+		MsgSetRawMsg(pMsg, (char*)pBuf, lenBuf);
+	}
+	if(pMsg->iLenRawMsg > iMaxLine)
+		STATSCOUNTER_INC(pThis->pLstn->ctrLargeMsgs, pThis->pLstn->mutCtrLargeMsgs);
 	MsgSetInputName(pMsg, pSrv->pInputName);
 	MsgSetFlowControlType(pMsg, eFLOWCTL_LIGHT_DELAY);
 	if(pSrv->dfltTZ != NULL)
@@ -703,7 +869,7 @@ doSubmitMsg(ptcpsess_t *pThis, struct syslogTime *stTime, time_t ttGenTime, mult
 	MsgSetRcvFrom(pMsg, pThis->peerName);
 	CHKiRet(MsgSetRcvFromIP(pMsg, pThis->peerIP));
 	MsgSetRuleset(pMsg, pSrv->pRuleset);
-	STATSCOUNTER_INC(pThis->pLstn->ctrSubmit, pThis->pLstn->mutCtrSubmit);
+	STATSCOUNTER_SHARDED_INC(pThis->pLstn->ctrSubmit);
 
 	ratelimitAddMsg(pSrv->ratelimiter, pMultiSub, pMsg);
 
@@ -711,10 +877,40 @@ finalize_it:
 	/* reset status variables */
 	pThis->bAtStrtOfFram = 1;
 	pThis->iMsg = 0;
+	if(pChain != NULL)
+		MsgChainDiscard(pChain);
 
 	RETiRet;
 }
 
+/* submit the message collected in the session buffer (and chain) */
+static inline rsRetVal
+doSubmitMsg(ptcpsess_t *pThis, struct syslogTime *stTime, time_t ttGenTime, multi_submit_t *pMultiSub)
+{
+	return doSubmitMsgBuf(pThis, pThis->pMsg, pThis->iMsg, &pThis->chain, stTime, ttGenTime, pMultiSub);
+}
+
+/* split a frame that is larger than we can keep, this is the emergency case */
+static inline rsRetVal
+doSplitMsg(ptcpsess_t *pThis, struct syslogTime *stTime, time_t ttGenTime, multi_submit_t *pMultiSub)
+{
+	DBGPRINTF("error: message received is larger than max msg size, we split it\n");
+	STATSCOUNTER_INC(pThis->pLstn->ctrSplitMsgs, pThis->pLstn->mutCtrSplitMsgs);
+	return doSubmitMsg(pThis, stTime, ttGenTime, pMultiSub);
+}
+
+/* number of octets that may still be added to the chain of the current
+ * frame, 0 if the frame must be split when the session buffer is full.
+ */
+static inline size_t
+getChainRoom(ptcpsess_t *pThis)
+{
+	const size_t maxFrame = pThis->pLstn->pSrv->maxFrameSize;
+	const size_t used = iMaxLine + pThis->chain.len;
+
+	return (maxFrame > used) ? maxFrame - used : 0;
+}
+
 
 /* process the data received. As TCP is stream based, we need to process the
  * data inside a state machine. The actual data received is passed in byte-by-byte
@@ -753,7 +949,8 @@ processDataRcvd(ptcpsess_t *pThis, char c, struct syslogTime *stTime, time_t ttG
 				DBGPRINTF("Framing Error: invalid octet count\n");
 				errmsg.LogError(0, NO_ERRCODE, "Framing Error in received TCP message: "
 					    "invalid octet count %d.", pThis->iOctetsRemain);
-			} else if(pThis->iOctetsRemain > iMaxLine) {
+			} else if(pThis->iOctetsRemain > iMaxLine
+				  && pThis->iOctetsRemain > pThis->pLstn->pSrv->maxFrameSize) {
 				/* while we can not do anything against it, we can at least log an indication
 				 * that something went wrong) -- rgerhards, 2008-03-14
 				 */
@@ -766,10 +963,9 @@ processDataRcvd(ptcpsess_t *pThis, char c, struct syslogTime *stTime, time_t ttG
 		}
 	} else {
 		assert(pThis->inputState == eInMsg);
-		if(pThis->iMsg >= iMaxLine) {
+		if(pThis->iMsg >= iMaxLine && getChainRoom(pThis) == 0) {
 			/* emergency, we now need to flush, no matter if we are at end of message or not... */
-			DBGPRINTF("error: message received is larger than max msg size, we split it\n");
-			doSubmitMsg(pThis, stTime, ttGenTime, pMultiSub);
+			doSplitMsg(pThis, stTime, ttGenTime, pMultiSub);
 			/* we might think if it is better to ignore the rest of the
 			 * message than to treat it as a new one. Maybe this is a good
 			 * candidate for a configuration parameter...
@@ -789,7 +985,11 @@ processDataRcvd(ptcpsess_t *pThis, char c, struct syslogTime *stTime, time_t ttG
 			 * we can do in light of what the engine supports. -- rgerhards, 2008-03-14
 			 */
 			if(pThis->iMsg < iMaxLine) {
+				if(pThis->pMsg == NULL)
+					CHKmalloc(pThis->pMsg = malloc(iMaxLine * sizeof(uchar)));
 				*(pThis->pMsg + pThis->iMsg++) = c;
+			} else {
+				CHKiRet(MsgChainAppend(&pThis->chain, (uchar*) &c, 1));
 			}
 		}
 
@@ -804,6 +1004,207 @@ processDataRcvd(ptcpsess_t *pThis, char c, struct syslogTime *stTime, time_t ttG
 		}
 	}
 
+finalize_it:
+	RETiRet;
+}
+
+
+/* find the next record delimiter in the len bytes at p, NULL if there is none */
+static inline char *
+findFrameDelim(char *p, const size_t len, const int iAddtlFrameDelim)
+{
+	char *pLF;
+	char *pAddtl;
+
+	pLF = memchr(p, '\n', len);
+	if(iAddtlFrameDelim == TCPSRV_NO_ADDTL_DELIMITER)
+		return pLF;
+	pAddtl = memchr(p, iAddtlFrameDelim, (pLF == NULL) ? len : (size_t) (pLF - p));
+	return (pAddtl == NULL) ? pLF : pAddtl;
+}
+
+
+/* Bulk version of processDataRcvd() for the body of a frame, to be called
+ * in state eInMsg only (and not for an invalid octet count). It consumes
+ * all data up to the end of the frame (or buffer), which is located via
+ * memchr() or the octet count. Frames completely contained in the buffer
+ * are submitted directly from it; only data that needs to wait for more
+ * input is copied to the session buffer. Splitting of oversize messages
+ * is the same as with processDataRcvd(). With maxFrameSize, data beyond the
+ * session buffer is appended to the session's chain instead, so that large
+ * frames are kept whole and are copied only once into the message.
+ */
+static rsRetVal
+processDataBulk(ptcpsess_t *pThis, char **ppData, char *pEnd, struct syslogTime *stTime, time_t ttGenTime,
+	multi_submit_t *pMultiSub)
+{
+	char *pData = *ppData;
+	char *pDelim;
+	size_t lenFrame;	/* bytes of the frame body inside this buffer */
+	size_t lenCopy;
+	sbool bEndOfFrame;
+	sbool bSubmitted = 0;
+	DEFiRet;
+
+	if(pThis->eFraming == TCP_FRAMING_OCTET_STUFFING) {
+		pDelim = findFrameDelim(pData, pEnd - pData, pThis->pLstn->pSrv->iAddtlFrameDelim);
+		bEndOfFrame = (pDelim != NULL);
+		lenFrame = bEndOfFrame ? (size_t) (pDelim - pData) : (size_t) (pEnd - pData);
+	} else {
+		lenFrame = pEnd - pData;
+		bEndOfFrame = ((size_t) pThis->iOctetsRemain <= lenFrame);
+		if(bEndOfFrame)
+			lenFrame = pThis->iOctetsRemain;
+		pThis->iOctetsRemain -= lenFrame;
+	}
+
+	while(lenFrame > 0) {
+		if(pThis->iMsg >= iMaxLine) {
+			if((lenCopy = getChainRoom(pThis)) > 0) {
+				if(lenCopy > lenFrame)
+					lenCopy = lenFrame;
+				CHKiRet(MsgChainAppend(&pThis->chain, (uchar*) pData, lenCopy));
+				pData += lenCopy;
+				lenFrame -= lenCopy;
+				continue;
+			}
+			/* emergency, we now need to flush, no matter if we are at end of message or not... */
+			doSplitMsg(pThis, stTime, ttGenTime, pMultiSub);
+		}
+		if(   pThis->iMsg == 0 && bEndOfFrame
+		   && (lenFrame <= (size_t) iMaxLine || lenFrame <= (size_t) pThis->pLstn->pSrv->maxFrameSize)) {
+			doSubmitMsgBuf(pThis, (uchar*) pData, lenFrame, NULL, stTime, ttGenTime, pMultiSub);
+			bSubmitted = 1;
+			lenCopy = lenFrame;
+		} else {
+			lenCopy = iMaxLine - pThis->iMsg;
+			if(lenCopy > lenFrame)
+				lenCopy = lenFrame;
+			if(pThis->pMsg == NULL)
+				CHKmalloc(pThis->pMsg = malloc(iMaxLine * sizeof(uchar)));
+			memcpy(pThis->pMsg + pThis->iMsg, pData, lenCopy);
+			pThis->iMsg += lenCopy;
+		}
+		pData += lenCopy;
+		lenFrame -= lenCopy;
+	}
+
+	if(bEndOfFrame) {
+		if(!bSubmitted)
+			doSubmitMsg(pThis, stTime, ttGenTime, pMultiSub);
+		if(pThis->eFraming == TCP_FRAMING_OCTET_STUFFING)
+			++pData; /* skip delimiter */
+		pThis->inputState = eAtStrtFram;
+	}
+
+finalize_it:
+	*ppData = pData;
+	RETiRet;
+}
+
+
+/* submit a binary record received from another rsyslog instance (omfwd with
+ * tcp_framing="binary"). The message object is reconstructed from the record
+ * without any parsing, so all properties are those of the original message.
+ * Only the ruleset is the one of our listener. A record with a valid header
+ * that can not be decoded is discarded.
+ */
+static rsRetVal
+doSubmitBinRec(ptcpsess_t *pThis, uchar *rec, size_t lenRec, multi_submit_t *pMultiSub)
+{
+	msg_t *pMsg;
+	ptcpsrv_t *pSrv;
+	rsRetVal localRet;
+	DEFiRet;
+
+	pSrv = pThis->pLstn->pSrv;
+	localRet = MsgDeserializeBinaryBuf(&pMsg, rec, lenRec);
+	if(localRet != RS_RET_OK) {
+		errmsg.LogError(0, localRet, "imptcp: discarding invalid binary record "
+				"of %u octets", (unsigned) lenRec);
+		FINALIZE;
+	}
+	MsgSetFlowControlType(pMsg, eFLOWCTL_LIGHT_DELAY);
+	MsgSetRuleset(pMsg, pSrv->pRuleset);
+	STATSCOUNTER_SHARDED_INC(pThis->pLstn->ctrSubmit);
+
+	ratelimitAddMsg(pSrv->ratelimiter, pMultiSub, pMsg);
+
+finalize_it:
+	RETiRet;
+}
+
+/* get the binary record length from its header. If the header is invalid,
+ * we have lost the framing and the session must be closed.
+ */
+static rsRetVal
+getBinRecLen(uchar *hdr, size_t *pLenRec)
+{
+	DEFiRet;
+
+	if(MsgBinaryRecLen(hdr, pLenRec) != RS_RET_OK || *pLenRec > BINREC_MAX) {
+		errmsg.LogError(0, RS_RET_INVALID_HEADER, "imptcp: framing error, invalid binary "
+				"record header received, closing session");
+		ABORT_FINALIZE(RS_RET_INVALID_HEADER);
+	}
+finalize_it:
+	RETiRet;
+}
+
+/* process a binary record, to be called in state eInBinRec. A record
+ * completely contained in the buffer is decoded directly from it, otherwise
+ * it is collected in the session's record buffer.
+ */
+static rsRetVal
+processBinRec(ptcpsess_t *pThis, char **ppData, char *pEnd, multi_submit_t *pMultiSub)
+{
+	uchar *pData = (uchar*) *ppData;
+	size_t lenWant;
+	size_t lenCopy;
+	size_t newSize;
+	uchar *pNew;
+	DEFiRet;
+
+	if(pThis->sizeBinRec == 0 && (size_t) ((uchar*) pEnd - pData) >= MSG_BINREC_HDRLEN) {
+		CHKiRet(getBinRecLen(pData, &pThis->sizeBinRec));
+		if((size_t) ((uchar*) pEnd - pData) >= pThis->sizeBinRec) {
+			CHKiRet(doSubmitBinRec(pThis, pData, pThis->sizeBinRec, pMultiSub));
+			pData += pThis->sizeBinRec;
+			pThis->sizeBinRec = 0;
+			pThis->inputState = eAtStrtFram;
+			FINALIZE;
+		}
+	}
+
+	while(pData < (uchar*) pEnd) {
+		lenWant = (pThis->sizeBinRec == 0) ? MSG_BINREC_HDRLEN : pThis->sizeBinRec;
+		if(pThis->allocBinRec < lenWant) {
+			newSize = (lenWant < (size_t) iMaxLine) ? (size_t) iMaxLine : lenWant;
+			CHKmalloc(pNew = realloc(pThis->pBinRec, newSize));
+			pThis->pBinRec = pNew;
+			pThis->allocBinRec = newSize;
+		}
+		lenCopy = lenWant - pThis->lenBinRec;
+		if(lenCopy > (size_t) ((uchar*) pEnd - pData))
+			lenCopy = (uchar*) pEnd - pData;
+		memcpy(pThis->pBinRec + pThis->lenBinRec, pData, lenCopy);
+		pThis->lenBinRec += lenCopy;
+		pData += lenCopy;
+		if(pThis->lenBinRec < lenWant)
+			break; /* need more data */
+		if(pThis->sizeBinRec == 0) {
+			CHKiRet(getBinRecLen(pThis->pBinRec, &pThis->sizeBinRec));
+		} else {
+			CHKiRet(doSubmitBinRec(pThis, pThis->pBinRec, pThis->lenBinRec, pMultiSub));
+			pThis->lenBinRec = 0;
+			pThis->sizeBinRec = 0;
+			pThis->inputState = eAtStrtFram;
+			break;
+		}
+	}
+
+finalize_it:
+	*ppData = (char*) pData;
 	RETiRet;
 }
 
@@ -844,8 +1245,28 @@ DataRcvdUncompressed(ptcpsess_t *pThis, char *pData, size_t iLen, struct syslogT
 	 /* We now copy the message to the session buffer. */
 	pEnd = pData + iLen; /* this is one off, which is intensional */
 
+	/* The frame body is processed in bulk, the state machine is only
+	 * needed for the frame header (octet count). Binary records carry
+	 * their length in the header and are also processed in bulk.
+	 */
 	while(pData < pEnd) {
-		CHKiRet(processDataRcvd(pThis, *pData++, stTime, ttGenTime, &multiSub));
+		if(pThis->inputState == eAtStrtFram) {
+			if(pThis->bSuppBinFram && (uchar) *pData == MSG_BINREC_MAGIC) {
+				pThis->inputState = eInBinRec;
+				pThis->eFraming = TCP_FRAMING_BINARY;
+			} else if(!(pThis->bSuppOctetFram && isdigit((int) *pData))) {
+				pThis->inputState = eInMsg;
+				pThis->eFraming = TCP_FRAMING_OCTET_STUFFING;
+			}
+		}
+		if(pThis->inputState == eInBinRec) {
+			CHKiRet(processBinRec(pThis, &pData, pEnd, &multiSub));
+		} else if(pThis->inputState == eInMsg
+		   && (pThis->eFraming == TCP_FRAMING_OCTET_STUFFING || pThis->iOctetsRemain > 0)) {
+			CHKiRet(processDataBulk(pThis, &pData, pEnd, stTime, ttGenTime, &multiSub));
+		} else {
+			CHKiRet(processDataRcvd(pThis, *pData++, stTime, ttGenTime, &multiSub));
+		}
 	}
 
 	iRet = multiSubmitFlush(&multiSub);
@@ -861,7 +1282,6 @@ DataRcvdCompressed(ptcpsess_t *pThis, char *buf, size_t len)
 	time_t ttGenTime;
 	int zRet;	/* zlib return state */
 	unsigned outavail;
-	uchar zipBuf[64*1024]; // TODO: alloc on heap, and much larger (512KiB? batch size!)
 	DEFiRet;
 	// TODO: can we do stats counters? Even if they are not 100% correct under all cases,
 	// by simply updating the input and output sizes?
@@ -872,6 +1292,8 @@ DataRcvdCompressed(ptcpsess_t *pThis, char *buf, size_t len)
 
 	if(!pThis->bzInitDone) {
 		/* allocate deflate state */
+		if(pThis->zipBuf == NULL)
+			CHKmalloc(pThis->zipBuf = malloc(ZIP_BUF_SIZE));
 		pThis->zstrm.zalloc = Z_NULL;
 		pThis->zstrm.zfree = Z_NULL;
 		pThis->zstrm.opaque = Z_NULL;
@@ -888,16 +1310,16 @@ DataRcvdCompressed(ptcpsess_t *pThis, char *buf, size_t len)
 	/* run inflate() on buffer until everything has been uncompressed */
 	do {
 		DBGPRINTF("imptcp: in inflate() loop, avail_in %d, total_in %ld\n", pThis->zstrm.avail_in, pThis->zstrm.total_in);
-		pThis->zstrm.avail_out = sizeof(zipBuf);
-		pThis->zstrm.next_out = zipBuf;
+		pThis->zstrm.avail_out = ZIP_BUF_SIZE;
+		pThis->zstrm.next_out = pThis->zipBuf;
 		zRet = inflate(&pThis->zstrm, Z_SYNC_FLUSH);    /* no bad return value */
 		//zRet = inflate(&pThis->zstrm, Z_NO_FLUSH);    /* no bad return value */
 		DBGPRINTF("after inflate, ret %d, avail_out %d\n", zRet, pThis->zstrm.avail_out);
-		outavail = sizeof(zipBuf) - pThis->zstrm.avail_out;
+		outavail = ZIP_BUF_SIZE - pThis->zstrm.avail_out;
 		if(outavail != 0) {
 			outtotal += outavail;
 			pThis->pLstn->rcvdDecompressed += outavail;
-			CHKiRet(DataRcvdUncompressed(pThis, (char*)zipBuf, outavail, &stTime, ttGenTime));
+			CHKiRet(DataRcvdUncompressed(pThis, (char*)pThis->zipBuf, outavail, &stTime, ttGenTime));
 		}
 	} while (pThis->zstrm.avail_out == 0);
 
@@ -937,22 +1359,56 @@ initConfigSettings(void)
 }
 
 
+/* create the epoll descriptor of an epoll set */
+static rsRetVal
+createEPollSet(epollctx_t *pCtx)
+{
+	DEFiRet;
+
+#	if defined(EPOLL_CLOEXEC) && defined(HAVE_EPOLL_CREATE1)
+	DBGPRINTF("imptcp uses epoll_create1()\n");
+	pCtx->efd = epoll_create1(EPOLL_CLOEXEC);
+	if(pCtx->efd < 0 && errno == ENOSYS)
+#	endif
+	{
+		DBGPRINTF("imptcp uses epoll_create()\n");
+		/* reading the docs, the number of epoll events passed to
+		 * epoll_create() seems not to be used at all in kernels. So
+		 * we just provide "a" number, happens to be 10.
+		 */
+		pCtx->efd = epoll_create(10);
+	}
+
+	if(pCtx->efd < 0) {
+		errmsg.LogError(0, RS_RET_EPOLL_CR_FAILED, "error: epoll_create() failed");
+		ABORT_FINALIZE(RS_RET_EPOLL_CR_FAILED);
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* add socket to the epoll set
  */
 static inline rsRetVal
-addEPollSock(epolld_type_t typ, void *ptr, int sock, epolld_t **pEpd)
+addEPollSock(epollctx_t *pCtx, epolld_type_t typ, void *ptr, int sock, epolld_t **pEpd)
 {
 	DEFiRet;
-	epolld_t *epd = NULL;
+	epolld_t *epd = *pEpd;
+	sbool bAlloced = 0;
 
-	CHKmalloc(epd = calloc(sizeof(epolld_t), 1));
+	if(epd == NULL) { /* pooled sessions already have one */
+		CHKmalloc(epd = calloc(sizeof(epolld_t), 1));
+		bAlloced = 1;
+	}
 	epd->typ = typ;
 	epd->ptr = ptr;
 	*pEpd = epd;
 	epd->ev.events = EPOLLIN|EPOLLET;
 	epd->ev.data.ptr = (void*) epd;
 
-	if(epoll_ctl(epollfd, EPOLL_CTL_ADD, sock, &(epd->ev)) != 0) {
+	if(epoll_ctl(pCtx->efd, EPOLL_CTL_ADD, sock, &(epd->ev)) != 0) {
 		char errStr[1024];
 		int eno = errno;
 		errmsg.LogError(0, RS_RET_EPOLL_CTL_FAILED, "os error (%d) during epoll ADD: %s",
@@ -960,11 +1416,12 @@ addEPollSock(epolld_type_t typ, void *ptr, int sock, epolld_t **pEpd)
 		ABORT_FINALIZE(RS_RET_EPOLL_CTL_FAILED);
 	}
 
-	DBGPRINTF("imptcp: added socket %d to epoll[%d] set\n", sock, epollfd);
+	DBGPRINTF("imptcp: added socket %d to epoll[%d] set\n", sock, pCtx->efd);
 
 finalize_it:
-	if(iRet != RS_RET_OK) {
+	if(iRet != RS_RET_OK && bAlloced) {
 		free(epd);
+		*pEpd = NULL;
 	}
 	RETiRet;
 }
@@ -977,13 +1434,13 @@ finalize_it:
  * event (it's simple because we have it at hand).
  */
 static inline rsRetVal
-removeEPollSock(int sock, epolld_t *epd)
+removeEPollSock(epollctx_t *pCtx, int sock, epolld_t *epd)
 {
 	DEFiRet;
 
-	DBGPRINTF("imptcp: removing socket %d from epoll[%d] set\n", sock, epollfd);
+	DBGPRINTF("imptcp: removing socket %d from epoll[%d] set\n", sock, pCtx->efd);
 
-	if(epoll_ctl(epollfd, EPOLL_CTL_DEL, sock, &(epd->ev)) != 0) {
+	if(epoll_ctl(pCtx->efd, EPOLL_CTL_DEL, sock, &(epd->ev)) != 0) {
 		char errStr[1024];
 		int eno = errno;
 		errmsg.LogError(0, RS_RET_EPOLL_CTL_FAILED, "os error (%d) during epoll DEL: %s",
@@ -1008,7 +1465,9 @@ addLstn(ptcpsrv_t *pSrv, int sock, int isIPv6)
 	CHKmalloc(pLstn = malloc(sizeof(ptcplstn_t)));
 	pLstn->pSrv = pSrv;
 	pLstn->bSuppOctetFram = pSrv->bSuppOctetFram;
+	pLstn->bSuppBinFram = pSrv->bSuppBinFram;
 	pLstn->sock = sock;
+	pLstn->epd = NULL;
 	/* support statistics gathering */
 	CHKiRet(statsobj.Construct(&(pLstn->stats)));
 	snprintf((char*)statname, sizeof(statname), "imptcp(%s/%s/%s)",
@@ -1016,11 +1475,20 @@ addLstn(ptcpsrv_t *pSrv, int sock, int isIPv6)
 		isIPv6 ? "IPv6" : "IPv4");
 	statname[sizeof(statname)-1] = '\0'; /* just to be on the save side... */
 	CHKiRet(statsobj.SetName(pLstn->stats, statname));
-	STATSCOUNTER_INIT(pLstn->ctrSubmit, pLstn->mutCtrSubmit);
+	STATSCOUNTER_SHARDED_INIT(pLstn->ctrSubmit);
 	CHKiRet(statsobj.AddCounter(pLstn->stats, UCHAR_CONSTANT("submitted"),
-		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pLstn->ctrSubmit)));
+		ctrType_IntCtrSharded, CTR_FLAG_RESETTABLE, &(pLstn->ctrSubmit)));
 	/* the following counters are not protected by mutexes; we accept
 	 * that they may not be 100% correct */
+	STATSCOUNTER_INIT(pLstn->ctrPaused, pLstn->mutCtrPaused);
+	CHKiRet(statsobj.AddCounter(pLstn->stats, UCHAR_CONSTANT("sessions.paused"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pLstn->ctrPaused)));
+	STATSCOUNTER_INIT(pLstn->ctrLargeMsgs, pLstn->mutCtrLargeMsgs);
+	CHKiRet(statsobj.AddCounter(pLstn->stats, UCHAR_CONSTANT("messages.large"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pLstn->ctrLargeMsgs)));
+	STATSCOUNTER_INIT(pLstn->ctrSplitMsgs, pLstn->mutCtrSplitMsgs);
+	CHKiRet(statsobj.AddCounter(pLstn->stats, UCHAR_CONSTANT("messages.split"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pLstn->ctrSplitMsgs)));
 	pLstn->rcvdBytes = 0,
 	pLstn->rcvdDecompressed = 0;
 	CHKiRet(statsobj.AddCounter(pLstn->stats, UCHAR_CONSTANT("bytes.received"),
@@ -1036,7 +1504,7 @@ addLstn(ptcpsrv_t *pSrv, int sock, int isIPv6)
 		pSrv->pLstn->prev = pLstn;
 	pSrv->pLstn = pLstn;
 
-	iRet = addEPollSock(epolld_lstn, pLstn, sock, &pLstn->epd);
+	iRet = addEPollSock(&mainCtx, epolld_lstn, pLstn, sock, &pLstn->epd);
 
 finalize_it:
 	RETiRet;
@@ -1046,24 +1514,36 @@ finalize_it:
 /* add a session to the server 
  */
 static rsRetVal
-addSess(ptcplstn_t *pLstn, int sock, prop_t *peerName, prop_t *peerIP)
+addSess(ptcplstn_t *pLstn, int sock, struct sockaddr_storage *pAddr)
 {
 	DEFiRet;
 	ptcpsess_t *pSess = NULL;
 	ptcpsrv_t *pSrv = pLstn->pSrv;
 
-	CHKmalloc(pSess = malloc(sizeof(ptcpsess_t)));
-	CHKmalloc(pSess->pMsg = malloc(iMaxLine * sizeof(uchar)));
+	CHKiRet(getPooledSess(&pSess));
+	pSess->pMsg = NULL;	/* allocated when a frame must be buffered */
 	pSess->pLstn = pLstn;
 	pSess->sock = sock;
 	pSess->bSuppOctetFram = pLstn->bSuppOctetFram;
+	pSess->bSuppBinFram = pLstn->bSuppBinFram;
 	pSess->inputState = eAtStrtFram;
 	pSess->iMsg = 0;
+	MsgChainInit(&pSess->chain);
+	pSess->pBinRec = NULL;
+	pSess->lenBinRec = 0;
+	pSess->sizeBinRec = 0;
+	pSess->allocBinRec = 0;
 	pSess->bzInitDone = 0;
+	pSess->zipBuf = NULL;
 	pSess->bAtStrtOfFram = 1;
-	pSess->peerName = peerName;
-	pSess->peerIP = peerIP;
+	pSess->peerName = NULL;	/* resolved on first data */
+	pSess->peerIP = NULL;
+	memcpy(&pSess->addrPeer, pAddr, sizeof(struct sockaddr_storage));
 	pSess->compressionMode = pLstn->pSrv->compressionMode;
+	pSess->bPaused = 0;
+	pSess->pNextPaused = NULL;
+	/* only the input thread accepts sessions, so nextShard needs no lock */
+	pSess->pCtx = (nShards == 0) ? &mainCtx : &shardCtx[nextShard++ % nShards];
 
 	/* add to start of server's listener list */
 	pSess->prev = NULL;
@@ -1074,7 +1554,7 @@ addSess(ptcplstn_t *pLstn, int sock, prop_t *peerName, prop_t *peerIP)
 	pSrv->pSess = pSess;
 	pthread_mutex_unlock(&pSrv->mutSessLst);
 
-	iRet = addEPollSock(epolld_sess, pSess, sock, &pSess->epd);
+	iRet = addEPollSock(pSess->pCtx, epolld_sess, pSess, sock, &pSess->epd);
 
 finalize_it:
 	RETiRet;
@@ -1090,23 +1570,25 @@ doZipFinish(ptcpsess_t *pSess)
 	DEFiRet;
 	unsigned outavail;
 	struct syslogTime stTime;
-	uchar zipBuf[32*1024]; // TODO: use "global" one from pSess
+	time_t ttGenTime;
 
 	if(!pSess->bzInitDone)
 		goto done;
 
+	datetime.getCurrTime(&stTime, &ttGenTime);
+
 	pSess->zstrm.avail_in = 0;
 	/* run inflate() on buffer until everything has been compressed */
 	do {
 		DBGPRINTF("doZipFinish: in inflate() loop, avail_in %d, total_in %ld\n", pSess->zstrm.avail_in, pSess->zstrm.total_in);
-		pSess->zstrm.avail_out = sizeof(zipBuf);
-		pSess->zstrm.next_out = zipBuf;
+		pSess->zstrm.avail_out = ZIP_BUF_SIZE;
+		pSess->zstrm.next_out = pSess->zipBuf;
 		zRet = inflate(&pSess->zstrm, Z_FINISH);    /* no bad return value */
 		DBGPRINTF("after inflate, ret %d, avail_out %d\n", zRet, pSess->zstrm.avail_out);
-		outavail = sizeof(zipBuf) - pSess->zstrm.avail_out;
+		outavail = ZIP_BUF_SIZE - pSess->zstrm.avail_out;
 		if(outavail != 0) {
 			pSess->pLstn->rcvdDecompressed += outavail;
-			CHKiRet(DataRcvdUncompressed(pSess, (char*)zipBuf, outavail, &stTime, 0)); // TODO: query time!
+			CHKiRet(DataRcvdUncompressed(pSess, (char*)pSess->zipBuf, outavail, &stTime, ttGenTime));
 		}
 	} while (pSess->zstrm.avail_out == 0);
 
@@ -1120,6 +1602,39 @@ finalize_it:
 done:	RETiRet;
 }
 
+/* put a session onto the paused list (if it is not already there) */
+static void
+pauseSess(ptcpsess_t *pSess)
+{
+	pthread_mutex_lock(&pSess->pCtx->mutPaused);
+	if(!pSess->bPaused) {
+		DBGPRINTF("imptcp: backpressure, pausing session on socket %d\n", pSess->sock);
+		pSess->bPaused = 1;
+		pSess->pNextPaused = pSess->pCtx->pPausedRoot;
+		pSess->pCtx->pPausedRoot = pSess;
+		STATSCOUNTER_INC(pSess->pLstn->ctrPaused, pSess->pLstn->mutCtrPaused);
+	}
+	pthread_mutex_unlock(&pSess->pCtx->mutPaused);
+}
+
+
+/* remove a session from the paused list, if it is on it */
+static void
+unpauseSess(ptcpsess_t *pSess)
+{
+	ptcpsess_t **ppSess;
+
+	pthread_mutex_lock(&pSess->pCtx->mutPaused);
+	if(pSess->bPaused) {
+		for(ppSess = &pSess->pCtx->pPausedRoot ; *ppSess != pSess ; ppSess = &(*ppSess)->pNextPaused)
+			/* just search */;
+		*ppSess = pSess->pNextPaused;
+		pSess->bPaused = 0;
+	}
+	pthread_mutex_unlock(&pSess->pCtx->mutPaused);
+}
+
+
 /* close/remove a session
  * NOTE: we must first remove the fd from the epoll set and then close it -- else we
  * get an error "bad file descriptor" from epoll.
@@ -1134,8 +1649,9 @@ closeSess(ptcpsess_t *pSess)
 		doZipFinish(pSess);
 
 	sock = pSess->sock;
-	CHKiRet(removeEPollSock(sock, pSess->epd));
+	CHKiRet(removeEPollSock(pSess->pCtx, sock, pSess->epd));
 	close(sock);
+	unpauseSess(pSess);
 
 	pthread_mutex_lock(&pSess->pLstn->pSrv->mutSessLst);
 	/* finally unlink session from structures */
@@ -1174,6 +1690,8 @@ createInstance(instanceConf_t **pinst)
 	inst->pszBindRuleset = NULL;
 	inst->pszInputName = NULL;
 	inst->bSuppOctetFram = 1;
+	inst->bSuppBinFram = 0;
+	inst->maxFrameSize = 0;
 	inst->bKeepAlive = 0;
 	inst->iKeepAliveIntvl = 0;
 	inst->iKeepAliveProbes = 0;
@@ -1235,6 +1753,8 @@ static rsRetVal addInstance(void __attribute__((unused)) *pVal, uchar *pNewVal)
 	}
 	inst->pBindRuleset = NULL;
 	inst->bSuppOctetFram = cs.bSuppOctetFram;
+	inst->bSuppBinFram = 0;
+	inst->maxFrameSize = 0;
 	inst->bKeepAlive = cs.bKeepAlive;
 	inst->iKeepAliveIntvl = cs.iKeepAliveTime;
 	inst->iKeepAliveProbes = cs.iKeepAliveProbes;
@@ -1259,6 +1779,7 @@ addListner(modConfData_t __attribute__((unused)) *modConf, instanceConf_t *inst)
 	pSrv->pSess = NULL;
 	pSrv->pLstn = NULL;
 	pSrv->bSuppOctetFram = inst->bSuppOctetFram;
+	pSrv->bSuppBinFram = inst->bSuppBinFram;
 	pSrv->bKeepAlive = inst->bKeepAlive;
 	pSrv->iKeepAliveIntvl = inst->iKeepAliveTime;
 	pSrv->iKeepAliveProbes = inst->iKeepAliveProbes;
@@ -1271,6 +1792,7 @@ addListner(modConfData_t __attribute__((unused)) *modConf, instanceConf_t *inst)
 	ratelimitSetThreadSafe(pSrv->ratelimiter);
 	CHKmalloc(pSrv->port = ustrdup(inst->pszBindPort));
 	pSrv->iAddtlFrameDelim = inst->iAddtlFrameDelim;
+	pSrv->maxFrameSize = inst->maxFrameSize;
 	if(inst->pszBindAddr == NULL)
 		pSrv->lstnIP = NULL;
 	else {
@@ -1374,25 +1896,25 @@ startupServers()
 }
 
 
-/* process new activity on listener. This means we need to accept a new
- * connection.
+/* process new activity on listener. This means we need to accept new
+ * connections. As the listener is edge-triggered, we accept until the
+ * backlog is empty.
  */
 static inline rsRetVal
 lstnActivity(ptcplstn_t *pLstn)
 {
 	int newSock;
-	prop_t *peerName;
-	prop_t *peerIP;
+	struct sockaddr_storage addr;
 	rsRetVal localRet;
 	DEFiRet;
 
 	DBGPRINTF("imptcp: new connection on listen socket %d\n", pLstn->sock);
 	while(glbl.GetGlobalInputTermState() == 0) {
-		localRet = AcceptConnReq(pLstn, &newSock, &peerName, &peerIP);
+		localRet = AcceptConnReq(pLstn, &newSock, &addr);
 		if(localRet == RS_RET_NO_MORE_DATA || glbl.GetGlobalInputTermState() == 1)
 			break;
 		CHKiRet(localRet);
-		CHKiRet(addSess(pLstn, newSock, peerName, peerIP));
+		CHKiRet(addSess(pLstn, newSock, &addr));
 	}
 
 finalize_it:
@@ -1410,6 +1932,7 @@ sessActivity(ptcpsess_t *pSess)
 	int lenBuf;
 	uchar *peerName;
 	int lenPeer;
+	uchar szPeer[NI_MAXHOST]; /* the session object is reused after close */
 	int remsock = 0; /* init just to keep compiler happy... :-( */
 	sbool bEmitOnClose = 0;
 	char rcvBuf[128*1024];
@@ -1418,24 +1941,38 @@ sessActivity(ptcpsess_t *pSess)
 	DBGPRINTF("imptcp: new activity on session socket %d\n", pSess->sock);
 
 	while(1) {
+		if(ruleset.IsBackpressured(pSess->pLstn->pSrv->pRuleset)) {
+			/* leave the data in the socket buffer, so the sender is
+			 * throttled by the TCP window instead of us blocking in
+			 * flow control.
+			 */
+			pauseSess(pSess);
+			break;
+		}
 		lenBuf = sizeof(rcvBuf);
 		lenRcv = recv(pSess->sock, rcvBuf, lenBuf, 0);
 
 		if(lenRcv > 0) {
 			/* have data, process it */
 			DBGPRINTF("imptcp: data(%d) on socket %d: %s\n", lenBuf, pSess->sock, rcvBuf);
+			if(sessGetPeerNames(pSess) != RS_RET_OK) {
+				DBGPRINTF("imptcp: cannot obtain peer names for socket %d - closed.\n", pSess->sock);
+				closeSess(pSess);
+				break;
+			}
 			CHKiRet(DataRcvd(pSess, rcvBuf, lenRcv));
 		} else if (lenRcv == 0) {
 			/* session was closed, do clean-up */
-			if(pSess->pLstn->pSrv->bEmitMsgOnClose) {
+			if(pSess->pLstn->pSrv->bEmitMsgOnClose && sessGetPeerNames(pSess) == RS_RET_OK) {
 				prop.GetString(pSess->peerName, &peerName, &lenPeer),
+				snprintf((char*)szPeer, sizeof(szPeer), "%s", (char*)peerName);
 				remsock = pSess->sock;
 				bEmitOnClose = 1;
 			}
 			CHKiRet(closeSess(pSess)); /* close may emit more messages in strmzip mode! */
 			if(bEmitOnClose) {
 				errmsg.LogError(0, RS_RET_PEER_CLOSED_CONN, "imptcp session %d closed by "
-					  	"remote peer %s.", remsock, peerName);
+					  	"remote peer %s.", remsock, szPeer);
 			}
 			break;
 		} else {
@@ -1527,6 +2064,31 @@ processWorkSet(int nEvents, struct epoll_event events[])
 }
 
 
+/* retry the paused sessions. They are taken off the paused list and
+ * processed as if they had new data; sessions whose queue still asks for
+ * backpressure put themselves back onto the list. Must only be called
+ * from the thread serving pCtx while no helper workers are active.
+ */
+static void
+resumePausedSess(epollctx_t *pCtx)
+{
+	ptcpsess_t *pSess, *pNext;
+
+	pthread_mutex_lock(&pCtx->mutPaused);
+	pSess = pCtx->pPausedRoot;
+	pCtx->pPausedRoot = NULL;
+	for(pNext = pSess ; pNext != NULL ; pNext = pNext->pNextPaused)
+		pNext->bPaused = 0;
+	pthread_mutex_unlock(&pCtx->mutPaused);
+
+	while(pSess != NULL && glbl.GetGlobalInputTermState() == 0) {
+		pNext = pSess->pNextPaused;
+		sessActivity(pSess);
+		pSess = pNext;
+	}
+}
+
+
 /* worker to process incoming requests
  */
 static void *
@@ -1557,6 +2119,114 @@ wrkr(void *myself)
 }
 
 
+/* worker serving a shard with threads.sharded. All activity on the
+ * shard's sessions is processed on this thread, so there is no hand-off
+ * and no contention with other workers.
+ */
+static void *
+shardWrkr(void *myself)
+{
+	epollctx_t *const pCtx = (epollctx_t*) myself;
+	struct epoll_event events[128];
+	int nEvents;
+	int timeout;
+	int i;
+	sbool bRun = 1;
+
+	while(bRun && glbl.GetGlobalInputTermState() == 0) {
+		pthread_mutex_lock(&pCtx->mutPaused);
+		timeout = (pCtx->pPausedRoot == NULL) ? -1 : PAUSED_RETRY_INTERVAL;
+		pthread_mutex_unlock(&pCtx->mutPaused);
+		nEvents = epoll_wait(pCtx->efd, events, sizeof(events)/sizeof(struct epoll_event), timeout);
+		if(nEvents > 0)
+			++pCtx->numCalled;
+		for(i = 0 ; i < nEvents && glbl.GetGlobalInputTermState() == 0 ; ++i) {
+			if(events[i].data.ptr == NULL) {
+				bRun = 0; /* wakeup pipe: we shall terminate */
+				break;
+			}
+			processWorkItem(events+i);
+		}
+		if(bRun && timeout != -1)
+			resumePausedSess(pCtx);
+	}
+
+	return NULL;
+}
+
+
+/* start the shard workers. If none can be started, we fall back to the
+ * regular worker pool.
+ */
+static void
+startShards(void)
+{
+	epollctx_t *pCtx;
+	struct epoll_event ev;
+	int i;
+
+	if(runModConf->wrkrMax > 16)
+		runModConf->wrkrMax = 16;
+	DBGPRINTF("imptcp: starting %d shard workers\n", runModConf->wrkrMax);
+	for(i = 0 ; i < runModConf->wrkrMax ; ++i) {
+		pCtx = &shardCtx[i];
+		pCtx->pPausedRoot = NULL;
+		pCtx->numCalled = 0;
+		if(createEPollSet(pCtx) != RS_RET_OK)
+			break;
+		if(pipe(pCtx->pipeWakeup) != 0) {
+			close(pCtx->efd);
+			break;
+		}
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		if(epoll_ctl(pCtx->efd, EPOLL_CTL_ADD, pCtx->pipeWakeup[0], &ev) != 0) {
+			close(pCtx->pipeWakeup[0]);
+			close(pCtx->pipeWakeup[1]);
+			close(pCtx->efd);
+			break;
+		}
+		pthread_mutex_init(&pCtx->mutPaused, NULL);
+		if(pthread_create(&pCtx->tid, &wrkrThrdAttr, shardWrkr, pCtx) != 0) {
+			pthread_mutex_destroy(&pCtx->mutPaused);
+			close(pCtx->pipeWakeup[0]);
+			close(pCtx->pipeWakeup[1]);
+			close(pCtx->efd);
+			break;
+		}
+		nShards = i + 1;
+	}
+	if(nShards == 0) {
+		errmsg.LogError(errno, RS_RET_ERR, "imptcp: could not start shard workers, "
+				"using regular worker pool");
+		startWorkerPool();
+	}
+}
+
+
+/* wake up and terminate the shard workers */
+static void
+stopShards(void)
+{
+	epollctx_t *pCtx;
+	int i;
+
+	for(i = 0 ; i < nShards ; ++i) {
+		pCtx = &shardCtx[i];
+		if(write(pCtx->pipeWakeup[1], "", 1) != 1)
+			DBGPRINTF("imptcp: could not wake up shard %d\n", i);
+		pthread_join(pCtx->tid, NULL);
+		DBGPRINTF("imptcp: info: shard %d processed events %llu times\n", i, pCtx->numCalled);
+		close(pCtx->pipeWakeup[0]);
+		close(pCtx->pipeWakeup[1]);
+		close(pCtx->efd);
+		pthread_mutex_destroy(&pCtx->mutPaused);
+	}
+	nShards = 0;
+}
+
+
 BEGINnewInpInst
 	struct cnfparamvals *pvals;
 	instanceConf_t *inst;
@@ -1589,6 +2259,10 @@ CODESTARTnewInpInst
 			inst->pszBindRuleset = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(inppblk.descr[i].name, "supportoctetcountedframing")) {
 			inst->bSuppOctetFram = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "supportbinaryframing")) {
+			inst->bSuppBinFram = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "maxframesize")) {
+			inst->maxFrameSize = (int) pvals[i].val.d.n;
 		} else if(!strcmp(inppblk.descr[i].name, "compression.mode")) {
 			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
 			if(!strcasecmp(cstr, "stream:always")) {
@@ -1637,6 +2311,7 @@ CODESTARTbeginCnfLoad
 	pModConf->pConf = pConf;
 	/* init our settings */
 	loadModConf->wrkrMax = DFLT_wrkrMax;
+	loadModConf->bSharded = 0;
 	loadModConf->configSetViaV2Method = 0;
 	bLegacyCnfModGlobalsPermitted = 1;
 	/* init legacy config vars */
@@ -1665,6 +2340,8 @@ CODESTARTsetModCnf
 			continue;
 		if(!strcmp(modpblk.descr[i].name, "threads")) {
 			loadModConf->wrkrMax = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "threads.sharded")) {
+			loadModConf->bSharded = (sbool) pvals[i].val.d.n;
 		} else {
 			dbgprintf("imptcp: program error, non-handled "
 			  "param '%s' in beginCnfLoad\n", modpblk.descr[i].name);
@@ -1730,24 +2407,8 @@ CODESTARTactivateCnfPrePrivDrop
 		ABORT_FINALIZE(RS_RET_NO_RUN);
 	}
 
-#	if defined(EPOLL_CLOEXEC) && defined(HAVE_EPOLL_CREATE1)
-	DBGPRINTF("imptcp uses epoll_create1()\n");
-	epollfd = epoll_create1(EPOLL_CLOEXEC);
-	if(epollfd < 0 && errno == ENOSYS)
-#	endif
-	{
-		DBGPRINTF("imptcp uses epoll_create()\n");
-		/* reading the docs, the number of epoll events passed to
-		 * epoll_create() seems not to be used at all in kernels. So
-		 * we just provide "a" number, happens to be 10.
-		 */
-		epollfd = epoll_create(10);
-	}
-
-	if(epollfd < 0) {
-		errmsg.LogError(0, RS_RET_EPOLL_CR_FAILED, "error: epoll_create() failed");
+	if(createEPollSet(&mainCtx) != RS_RET_OK)
 		ABORT_FINALIZE(RS_RET_NO_RUN);
-	}
 
 	/* start up servers, but do not yet read input data */
 	CHKiRet(startupServers());
@@ -1782,15 +2443,31 @@ ENDfreeCnf
  */
 BEGINrunInput
 	int nEvents;
+	int timeout;
+	int i;
 	struct epoll_event events[128];
 CODESTARTrunInput
-	startWorkerPool();
+	if(runModConf->bSharded)
+		startShards();
+	else
+		startWorkerPool();
 	DBGPRINTF("imptcp: now beginning to process input data\n");
 	while(glbl.GetGlobalInputTermState() == 0) {
+		pthread_mutex_lock(&mainCtx.mutPaused);
+		timeout = (mainCtx.pPausedRoot == NULL) ? -1 : PAUSED_RETRY_INTERVAL;
+		pthread_mutex_unlock(&mainCtx.mutPaused);
 		DBGPRINTF("imptcp going on epoll_wait\n");
-		nEvents = epoll_wait(epollfd, events, sizeof(events)/sizeof(struct epoll_event), -1);
+		nEvents = epoll_wait(mainCtx.efd, events, sizeof(events)/sizeof(struct epoll_event), timeout);
 		DBGPRINTF("imptcp: epoll returned %d events\n", nEvents);
-		processWorkSet(nEvents, events);
+		if(nShards > 0) {
+			/* only listeners here, sessions are served by the shards */
+			for(i = 0 ; i < nEvents && glbl.GetGlobalInputTermState() == 0 ; ++i)
+				processWorkItem(events+i);
+		} else {
+			processWorkSet(nEvents, events);
+		}
+		if(timeout != -1)
+			resumePausedSess(&mainCtx);
 	}
 	DBGPRINTF("imptcp: successfully terminated\n");
 	/* we stop the worker pool in AfterRun, in case we get cancelled for some reason (old Interface) */
@@ -1842,7 +2519,10 @@ shutdownSrv(ptcpsrv_t *pSrv)
 BEGINafterRun
 	ptcpsrv_t *pSrv, *srvDel;
 CODESTARTafterRun
-	stopWorkerPool();
+	if(nShards > 0)
+		stopShards();
+	else
+		stopWorkerPool();
 
 	/* we need to close everything that is still open */
 	pSrv = pSrvRoot;
@@ -1853,7 +2533,8 @@ CODESTARTafterRun
 		destructSrv(srvDel);
 	}
 
-	close(epollfd);
+	close(mainCtx.efd);
+	freeSessPool();
 ENDafterRun
 
 
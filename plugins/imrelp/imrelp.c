@@ -35,6 +35,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <signal.h>
+#include <pthread.h>
 #include <librelp.h>
 #include "rsyslog.h"
 #include "dirty.h"
@@ -48,6 +49,7 @@
 #include "ruleset.h"
 #include "glbl.h"
 #include "statsobj.h"
+#include "srUtils.h"
 
 MODULE_TYPE_INPUT
 MODULE_TYPE_NOKEEP
@@ -68,7 +70,17 @@ static rsRetVal resetConfigVariables(uchar __attribute__((unused)) *pp, void __a
 
 /* Module static data */
 /* config vars for legacy config system */
-static relpEngine_t *pRelpEngine;	/* our relp engine */
+/* RELP engines. Each engine runs its own event loop on its own thread;
+ * engine 0 runs on the input thread itself. Listeners are assigned to the
+ * engines round-robin.
+ */
+static struct relpWrkr_s {
+	relpEngine_t *pEngine;
+	pthread_t tid;
+	sbool bStarted;		/* worker thread was created */
+	volatile int bRunning;	/* worker thread still inside relpEngineRun()? */
+} *relpWrkrs = NULL;
+static int nRelpWrkrs = 0;
 static prop_t *pInputName = NULL;	/* there is only one global inputName for all messages generated by this module */
 static struct configSettings_s {
 	uchar *pszBindRuleset;		/* name of Ruleset to bind to */
@@ -104,6 +116,8 @@ struct instanceConf_s {
 	struct {
 		statsobj_t *stats;	/* listener stats */
 		STATSCOUNTER_DEF(ctrSubmit, mutCtrSubmit)
+		prop_t *pLastHostname;	/* props of the last sender, reused if */
+		prop_t *pLastIP;	/* the next message comes from the same peer */
 	} data;
 };
 
@@ -113,6 +127,7 @@ struct modConfData_s {
 	instanceConf_t *root, *tail;
 	uchar *pszBindRuleset;		/* name of Ruleset to bind to */
 	ruleset_t *pBindRuleset; /* due to librelp limitation, we need to bind all listerns to the same set */
+	int nThreads;			/* number of RELP engines (each with own thread) */
 };
 
 static modConfData_t *loadModConf = NULL;/* modConf ptr to use for the current load process */
@@ -121,6 +136,7 @@ static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current lo
 /* module-global parameters */
 static struct cnfparamdescr modpdescr[] = {
 	{ "ruleset", eCmdHdlrGetWord, 0 },
+	{ "threads", eCmdHdlrPositiveInt, 0 },
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -192,7 +208,6 @@ onAuthErr(void *pUsr, char *authinfo, char* errmesg, __attribute__((unused)) rel
 static relpRetVal
 onSyslogRcv(void *pUsr, uchar *pHostname, uchar *pIP, uchar *msg, size_t lenMsg)
 {
-	prop_t *pProp = NULL;
 	msg_t *pMsg;
 	instanceConf_t *inst = (instanceConf_t*) pUsr;
 	DEFiRet;
@@ -204,13 +219,14 @@ onSyslogRcv(void *pUsr, uchar *pHostname, uchar *pIP, uchar *msg, size_t lenMsg)
 	MsgSetRuleset(pMsg, runModConf->pBindRuleset);
 	pMsg->msgFlags  = PARSE_HOSTNAME | NEEDS_PARSING;
 
-	/* TODO: optimize this, we can store it inside the session, requires
-	 * changes to librelp --> next librelp iteration?. rgerhards, 2012-10-29
+	/* librelp does not let us store the props inside the session, so we
+	 * keep those of the last sender. A listener is only ever served by a
+	 * single engine thread, so no locking is required.
 	 */
-	MsgSetRcvFromStr(pMsg, pHostname, ustrlen(pHostname), &pProp);
-	CHKiRet(prop.Destruct(&pProp));
-	CHKiRet(MsgSetRcvFromIPStr(pMsg, pIP, ustrlen(pIP), &pProp));
-	CHKiRet(prop.Destruct(&pProp));
+	CHKiRet(prop.CreateOrReuseStringProp(&inst->data.pLastHostname, pHostname, ustrlen(pHostname)));
+	MsgSetRcvFrom(pMsg, inst->data.pLastHostname);
+	CHKiRet(prop.CreateOrReuseStringProp(&inst->data.pLastIP, pIP, ustrlen(pIP)));
+	CHKiRet(MsgSetRcvFromIP(pMsg, inst->data.pLastIP));
 	CHKiRet(submitMsg2(pMsg));
 	STATSCOUNTER_INC(inst->data.ctrSubmit, inst->data.mutCtrSubmit);
 
@@ -244,6 +260,8 @@ createInstance(instanceConf_t **pinst)
 	inst->caCertFile = NULL;
 	inst->myCertFile = NULL;
 	inst->myPrivKeyFile = NULL;
+	inst->data.pLastHostname = NULL;
+	inst->data.pLastIP = NULL;
 
 	/* node created, let's add to config */
 	if(loadModConf->tail == NULL) {
@@ -291,25 +309,41 @@ finalize_it:
 
 
 static rsRetVal
-addListner(modConfData_t __attribute__((unused)) *modConf, instanceConf_t *inst)
+createEngine(relpEngine_t **ppEngine)
+{
+	relpEngine_t *pEngine;
+	DEFiRet;
+
+	CHKiRet(relpEngineConstruct(ppEngine));
+	pEngine = *ppEngine;
+	CHKiRet(relpEngineSetDbgprint(pEngine, dbgprintf));
+	CHKiRet(relpEngineSetFamily(pEngine, glbl.GetDefPFFamily()));
+	CHKiRet(relpEngineSetEnableCmd(pEngine, (uchar*) "syslog", eRelpCmdState_Required));
+	CHKiRet(relpEngineSetSyslogRcv2(pEngine, onSyslogRcv));
+	CHKiRet(relpEngineSetOnErr(pEngine, onErr));
+	CHKiRet(relpEngineSetOnGenericErr(pEngine, onGenericErr));
+	CHKiRet(relpEngineSetOnAuthErr(pEngine, onAuthErr));
+	if (!glbl.GetDisableDNS()) {
+		CHKiRet(relpEngineSetDnsLookupMode(pEngine, 1));
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+static rsRetVal
+addListner(modConfData_t __attribute__((unused)) *modConf, instanceConf_t *inst, relpEngine_t **ppEngine)
 {
 	relpSrv_t *pSrv;
+	relpEngine_t *pRelpEngine;
 	uchar statname[64];
 	int i;
 	DEFiRet;
-	if(pRelpEngine == NULL) {
-		CHKiRet(relpEngineConstruct(&pRelpEngine));
-		CHKiRet(relpEngineSetDbgprint(pRelpEngine, dbgprintf));
-		CHKiRet(relpEngineSetFamily(pRelpEngine, glbl.GetDefPFFamily()));
-		CHKiRet(relpEngineSetEnableCmd(pRelpEngine, (uchar*) "syslog", eRelpCmdState_Required));
-		CHKiRet(relpEngineSetSyslogRcv2(pRelpEngine, onSyslogRcv));
-		CHKiRet(relpEngineSetOnErr(pRelpEngine, onErr));
-		CHKiRet(relpEngineSetOnGenericErr(pRelpEngine, onGenericErr));
-		CHKiRet(relpEngineSetOnAuthErr(pRelpEngine, onAuthErr));
-		if (!glbl.GetDisableDNS()) {
-			CHKiRet(relpEngineSetDnsLookupMode(pRelpEngine, 1));
-		}
+	if(*ppEngine == NULL) {
+		CHKiRet(createEngine(ppEngine));
 	}
+	pRelpEngine = *ppEngine;
 
 	CHKiRet(relpEngineListnerConstruct(pRelpEngine, &pSrv));
 	CHKiRet(relpSrvSetLstnPort(pSrv, inst->pszBindPort));
@@ -432,6 +466,7 @@ CODESTARTbeginCnfLoad
 	pModConf->pConf = pConf;
 	pModConf->pszBindRuleset = NULL;
 	pModConf->pBindRuleset = NULL;
+	pModConf->nThreads = 1;
 	/* init legacy config variables */
 	cs.pszBindRuleset = NULL;
 ENDbeginCnfLoad
@@ -458,6 +493,8 @@ CODESTARTsetModCnf
 			continue;
 		if(!strcmp(modpblk.descr[i].name, "ruleset")) {
 			loadModConf->pszBindRuleset = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(modpblk.descr[i].name, "threads")) {
+			loadModConf->nThreads = (int) pvals[i].val.d.n;
 		} else {
 			dbgprintf("imrelp: program error, non-handled "
 			  "param '%s' in beginCnfLoad\n", modpblk.descr[i].name);
@@ -512,12 +549,19 @@ ENDcheckCnf
 
 BEGINactivateCnfPrePrivDrop
 	instanceConf_t *inst;
+	int i;
 CODESTARTactivateCnfPrePrivDrop
 	runModConf = pModConf;
+	CHKmalloc(relpWrkrs = calloc(pModConf->nThreads, sizeof(struct relpWrkr_s)));
+	nRelpWrkrs = pModConf->nThreads;
+	i = 0;
 	for(inst = runModConf->root ; inst != NULL ; inst = inst->next) {
-		addListner(pModConf, inst);
+		addListner(pModConf, inst, &relpWrkrs[i++ % nRelpWrkrs].pEngine);
 	}
-	if(pRelpEngine == NULL)
+	/* engines without a listener are not needed */
+	if(nRelpWrkrs > i)
+		nRelpWrkrs = i;
+	if(nRelpWrkrs == 0 || relpWrkrs[0].pEngine == NULL)
 		ABORT_FINALIZE(RS_RET_NO_RUN);
 finalize_it:
 ENDactivateCnfPrePrivDrop
@@ -536,6 +580,10 @@ CODESTARTfreeCnf
 		free(inst->pristring);
 		free(inst->authmode);
 		statsobj.Destruct(&(inst->data.stats));
+		if(inst->data.pLastHostname != NULL)
+			prop.Destruct(&inst->data.pLastHostname);
+		if(inst->data.pLastIP != NULL)
+			prop.Destruct(&inst->data.pLastIP);
 		for(i = 0 ; i <  inst->permittedPeers.nmemb ; ++i) {
 			free(inst->permittedPeers.name[i]);
 		}
@@ -554,32 +602,101 @@ ENDfreeCnf
 static void
 doSIGTTIN(int __attribute__((unused)) sig)
 {
-	DBGPRINTF("imrelp: termination requested via SIGTTIN - telling RELP engine\n");
-	relpEngineSetStop(pRelpEngine);
+	int i;
+	DBGPRINTF("imrelp: termination requested via SIGTTIN - telling RELP engines\n");
+	for(i = 0 ; i < nRelpWrkrs ; ++i)
+		relpEngineSetStop(relpWrkrs[i].pEngine);
+}
+
+
+/* block all signals but SIGTTIN, which is used to stop the RELP engine */
+static void
+setEngineSigmask(void)
+{
+	sigset_t sigSet;
+
+	sigfillset(&sigSet);
+	pthread_sigmask(SIG_BLOCK, &sigSet, NULL);
+	sigemptyset(&sigSet);
+	sigaddset(&sigSet, SIGTTIN);
+	pthread_sigmask(SIG_UNBLOCK, &sigSet, NULL);
+}
+
+
+/* thread for RELP engines other than the first one */
+static void *
+engineWrkr(void *arg)
+{
+	struct relpWrkr_s *const pWrkr = (struct relpWrkr_s*) arg;
+
+	setEngineSigmask();
+	relpEngineRun(pWrkr->pEngine);
+	pWrkr->bRunning = 0;
+	return NULL;
+}
+
+
+static void
+startEngineWrkrs(void)
+{
+	int i;
+	int r;
+
+	for(i = 1 ; i < nRelpWrkrs ; ++i) {
+		relpWrkrs[i].bRunning = 1;
+		r = pthread_create(&relpWrkrs[i].tid, NULL, engineWrkr, &relpWrkrs[i]);
+		if(r == 0) {
+			relpWrkrs[i].bStarted = 1;
+		} else {
+			relpWrkrs[i].bRunning = 0;
+			errmsg.LogError(r, RS_RET_ERR, "imrelp: could not start RELP engine "
+					"thread %d, its listeners will not work", i);
+		}
+	}
+}
+
+
+/* stop the engine threads. The stop flag is already set (we come here after
+ * our own engine terminated), but a thread may just have entered its wait
+ * when the signal came in, so we re-send it until the thread terminated.
+ */
+static void
+stopEngineWrkrs(void)
+{
+	int i;
+
+	for(i = 1 ; i < nRelpWrkrs ; ++i) {
+		if(!relpWrkrs[i].bStarted)
+			continue;
+		relpEngineSetStop(relpWrkrs[i].pEngine);
+		while(relpWrkrs[i].bRunning) {
+			pthread_kill(relpWrkrs[i].tid, SIGTTIN);
+			srSleep(0, 100000);
+		}
+		pthread_join(relpWrkrs[i].tid, NULL);
+		relpWrkrs[i].bStarted = 0;
+	}
 }
 
 
 /* This function is called to gather input.
  */
 BEGINrunInput
-	sigset_t sigSet;
 	struct sigaction sigAct;
 CODESTARTrunInput
 	/* we want to support non-cancel input termination. To do so, we must signal librelp
 	 * when to stop. As we run on the same thread, we need to register as SIGTTIN handler,
 	 * which will be used to put the terminating condition into librelp.
 	 */
-	sigfillset(&sigSet);
-	pthread_sigmask(SIG_BLOCK, &sigSet, NULL);
-	sigemptyset(&sigSet);
-	sigaddset(&sigSet, SIGTTIN);
-	pthread_sigmask(SIG_UNBLOCK, &sigSet, NULL);
+	setEngineSigmask();
 	memset(&sigAct, 0, sizeof (sigAct));
 	sigemptyset(&sigAct.sa_mask);
 	sigAct.sa_handler = doSIGTTIN;
 	sigaction(SIGTTIN, &sigAct, NULL);
 
-	iRet = relpEngineRun(pRelpEngine);
+	startEngineWrkrs();
+	iRet = relpEngineRun(relpWrkrs[0].pEngine);
+	stopEngineWrkrs();
 ENDrunInput
 
 
@@ -595,9 +712,16 @@ ENDafterRun
 
 
 BEGINmodExit
+	int i;
 CODESTARTmodExit
-	if(pRelpEngine != NULL)
-		iRet = relpEngineDestruct(&pRelpEngine);
+	if(relpWrkrs != NULL) {
+		for(i = 0 ; i < nRelpWrkrs ; ++i) {
+			if(relpWrkrs[i].pEngine != NULL)
+				iRet = relpEngineDestruct(&relpWrkrs[i].pEngine);
+		}
+		free(relpWrkrs);
+		relpWrkrs = NULL;
+	}
 
 	/* global variable cleanup */
 	if(pInputName != NULL)
@@ -644,7 +768,6 @@ BEGINmodInit()
 CODESTARTmodInit
 	*ipIFVersProvided = CURR_MOD_IF_VERSION; /* we only support the current interface specification */
 CODEmodInit_QueryRegCFSLineHdlr
-	pRelpEngine = NULL;
 	/* request objects we use */
 	CHKiRet(objUse(glbl, CORE_COMPONENT));
 	CHKiRet(objUse(prop, CORE_COMPONENT));
@@ -0,0 +1,954 @@
+/* imshmring.c
+ * This input module receives messages from local producers via shared
+ * memory rings. Producers connect to a unix socket and obtain a ring of
+ * their own (see rsshmring.h for the protocol and the client library).
+ * They write messages directly into the ring, and rsyslog builds its
+ * submit batches straight from it. In contrast to imuxsock, there is no
+ * system call and kernel copy per message, and messages are not limited
+ * to the size of a datagram. A single thread serves all rings; it sleeps
+ * on an epoll set containing the listeners, the client connections and
+ * the eventfds by which the producers wake it.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of rsyslog.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "rsyslog.h"
+#include "dirty.h"
+#include "module-template.h"
+#include "unicode-helper.h"
+#include "glbl.h"
+#include "prop.h"
+#include "errmsg.h"
+#include "srUtils.h"
+#include "datetime.h"
+#include "ruleset.h"
+#include "msg.h"
+#include "statsobj.h"
+#include "ratelimit.h"
+#include "rsshmring.h"
+
+MODULE_TYPE_INPUT
+MODULE_TYPE_NOKEEP
+MODULE_CNFNAME("imshmring")
+
+/* static data */
+DEF_IMOD_STATIC_DATA
+DEFobjCurrIf(glbl)
+DEFobjCurrIf(prop)
+DEFobjCurrIf(datetime)
+DEFobjCurrIf(errmsg)
+DEFobjCurrIf(ruleset)
+DEFobjCurrIf(statsobj)
+
+#define DFLT_RINGSIZE (4*1024*1024)
+#define MIN_RINGSIZE (64*1024)
+#define MAX_RINGSIZE (1024*1024*1024)
+#define DFLT_MAXSESSIONS 200
+
+struct instanceConf_s {
+	uchar *pszSockName;		/* path of the unix socket clients connect to */
+	uchar *pszBindRuleset;		/* name of ruleset to bind to */
+	ruleset_t *pBindRuleset;	/* ruleset to bind listener to (use system default if unspecified) */
+	uchar *pszInputName;		/* value for inputname property */
+	int64 ringSize;			/* size of the ring of each client */
+	int fCreateMode;		/* mode of the socket */
+	int maxSessions;		/* max number of concurrent producers */
+	int maxSessionsPerUid;		/* max number per user, 0 - only maxSessions applies */
+	int ratelimitInterval;
+	int ratelimitBurst;
+	struct instanceConf_s *next;
+};
+
+struct modConfData_s {
+	rsconf_t *pConf;		/* our overall config object */
+	instanceConf_t *root, *tail;
+};
+
+static modConfData_t *loadModConf = NULL;/* modConf ptr to use for the current load process */
+static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current load process */
+
+/* input instance parameters */
+static struct cnfparamdescr inppdescr[] = {
+	{ "socket", eCmdHdlrString, CNFPARAM_REQUIRED },
+	{ "ruleset", eCmdHdlrString, 0 },
+	{ "name", eCmdHdlrString, 0 },
+	{ "ringsize", eCmdHdlrSize, 0 },
+	{ "filecreatemode", eCmdHdlrFileCreateMode, 0 },
+	{ "maxsessions", eCmdHdlrPositiveInt, 0 },
+	{ "maxsessions.peruid", eCmdHdlrNonNegInt, 0 },
+	{ "ratelimit.interval", eCmdHdlrInt, 0 },
+	{ "ratelimit.burst", eCmdHdlrInt, 0 }
+};
+static struct cnfparamblk inppblk =
+	{ CNFPARAMBLK_VERSION,
+	  sizeof(inppdescr)/sizeof(struct cnfparamdescr),
+	  inppdescr
+	};
+
+#include "im-helper.h" /* must be included AFTER the type definitions! */
+
+/* data elements describing our running config */
+typedef struct shmlstn_s shmlstn_t;
+typedef struct shmsess_s shmsess_t;
+typedef struct epolld_s epolld_t;
+
+typedef enum {
+	epolld_lstn, epolld_sess, epolld_evfd
+} epolld_type_t;
+
+/* what is registered with epoll: the object and which of its descriptors */
+struct epolld_s {
+	epolld_type_t typ;
+	void *ptr;
+};
+
+/* a listener, one for each input() */
+struct shmlstn_s {
+	instanceConf_t *inst;
+	int sock;
+	uint32_t ringSize;
+	uint32_t maxMsg;
+	int nSess;			/* number of open sessions */
+	prop_t *pInputName;
+	ratelimit_t *ratelimiter;
+	statsobj_t *stats;
+	STATSCOUNTER_DEF(ctrSubmit, mutCtrSubmit)
+	STATSCOUNTER_DEF(ctrSess, mutCtrSess)
+	epolld_t epd;
+	shmlstn_t *next;
+};
+
+/* a connected client and its ring */
+struct shmsess_s {
+	shmlstn_t *pLstn;
+	int sock;
+	int evfd;
+	uid_t uid;			/* user of the client process */
+	struct rsshmring_hdr *hdr;
+	uchar *data;
+	size_t lenMap;
+	uint32_t size;			/* copied from hdr, which the client can modify */
+	uint32_t tail;			/* we are the only writer of hdr->tail */
+	sbool bClose;			/* client has disconnected or misbehaved */
+	epolld_t epdSock;
+	epolld_t epdEvfd;
+	shmsess_t *prev, *next;
+};
+
+static shmlstn_t *pLstnRoot = NULL;
+static shmsess_t *pSessRoot = NULL;
+static int efd = -1;			/* our epoll set */
+static unsigned nRings = 0;		/* for unique shm names */
+static prop_t *pLocalHostIP = NULL;
+
+
+/* create input instance, set default parameters, and
+ * add it to the list of instances.
+ */
+static rsRetVal
+createInstance(instanceConf_t **pinst)
+{
+	instanceConf_t *inst;
+	DEFiRet;
+	CHKmalloc(inst = MALLOC(sizeof(instanceConf_t)));
+	inst->next = NULL;
+	inst->pszSockName = NULL;
+	inst->pszBindRuleset = NULL;
+	inst->pBindRuleset = NULL;
+	inst->pszInputName = NULL;
+	inst->ringSize = DFLT_RINGSIZE;
+	inst->fCreateMode = 0666;
+	inst->maxSessions = DFLT_MAXSESSIONS;
+	inst->maxSessionsPerUid = 0;
+	inst->ratelimitBurst = 10000; /* arbitrary high limit */
+	inst->ratelimitInterval = 0; /* off */
+
+	/* node created, let's add to config */
+	if(loadModConf->tail == NULL) {
+		loadModConf->tail = loadModConf->root = inst;
+	} else {
+		loadModConf->tail->next = inst;
+		loadModConf->tail = inst;
+	}
+
+	*pinst = inst;
+finalize_it:
+	RETiRet;
+}
+
+
+static rsRetVal
+addEpollFd(int fd, epolld_t *epd, epolld_type_t typ, void *ptr)
+{
+	struct epoll_event ev;
+	char errStr[1024];
+	DEFiRet;
+
+	epd->typ = typ;
+	epd->ptr = ptr;
+	ev.events = EPOLLIN;
+	ev.data.ptr = epd;
+	if(epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+		rs_strerror_r(errno, errStr, sizeof(errStr));
+		errmsg.LogError(0, RS_RET_EPOLL_CTL_FAILED, "imshmring: epoll_ctl failed on fd %d: %s",
+				fd, errStr);
+		ABORT_FINALIZE(RS_RET_EPOLL_CTL_FAILED);
+	}
+finalize_it:
+	RETiRet;
+}
+
+
+/* create the listen socket for an instance */
+static rsRetVal
+addListner(instanceConf_t *inst)
+{
+	shmlstn_t *pLstn;
+	struct sockaddr_un addr;
+	uchar statname[256];
+	char errStr[1024];
+	uint32_t size;
+	DEFiRet;
+
+	if(ustrlen(inst->pszSockName) >= sizeof(addr.sun_path)) {
+		errmsg.LogError(0, RS_RET_INVALID_PARAMS, "imshmring: socket name '%s' "
+				"is too long", inst->pszSockName);
+		ABORT_FINALIZE(RS_RET_INVALID_PARAMS);
+	}
+	CHKmalloc(pLstn = calloc(1, sizeof(shmlstn_t)));
+	pLstn->inst = inst;
+	pLstn->sock = -1;
+	/* we link the listener right away, so that afterRun() cleans up on error */
+	pLstn->next = pLstnRoot;
+	pLstnRoot = pLstn;
+	for(size = MIN_RINGSIZE ; size < inst->ringSize ; size *= 2)
+		/* just search */;
+	pLstn->ringSize = size;
+	pLstn->maxMsg = glbl.GetMaxLine();
+	if(pLstn->maxMsg > size / 4)
+		pLstn->maxMsg = size / 4;
+
+	CHKiRet(prop.Construct(&pLstn->pInputName));
+	CHKiRet(prop.SetString(pLstn->pInputName,
+		(inst->pszInputName == NULL) ? UCHAR_CONSTANT("imshmring") : inst->pszInputName,
+		(inst->pszInputName == NULL) ? sizeof("imshmring") - 1 : ustrlen(inst->pszInputName)));
+	CHKiRet(prop.ConstructFinalize(pLstn->pInputName));
+	CHKiRet(ratelimitNew(&pLstn->ratelimiter, "imshmring", (char*)inst->pszSockName));
+	ratelimitSetLinuxLike(pLstn->ratelimiter, inst->ratelimitInterval, inst->ratelimitBurst);
+
+	CHKiRet(statsobj.Construct(&(pLstn->stats)));
+	snprintf((char*)statname, sizeof(statname), "imshmring(%s)", inst->pszSockName);
+	statname[sizeof(statname)-1] = '\0'; /* just to be on the save side... */
+	CHKiRet(statsobj.SetName(pLstn->stats, statname));
+	STATSCOUNTER_INIT(pLstn->ctrSubmit, pLstn->mutCtrSubmit);
+	CHKiRet(statsobj.AddCounter(pLstn->stats, UCHAR_CONSTANT("submitted"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pLstn->ctrSubmit)));
+	STATSCOUNTER_INIT(pLstn->ctrSess, pLstn->mutCtrSess);
+	CHKiRet(statsobj.AddCounter(pLstn->stats, UCHAR_CONSTANT("sessions.opened"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pLstn->ctrSess)));
+	CHKiRet(statsobj.ConstructFinalize(pLstn->stats));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, (char*)inst->pszSockName);
+	unlink(addr.sun_path);	/* left over from a previous run */
+	if((pLstn->sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1
+	   || fcntl(pLstn->sock, F_SETFD, FD_CLOEXEC) == -1
+	   || fcntl(pLstn->sock, F_SETFL, O_NONBLOCK) == -1
+	   || bind(pLstn->sock, (struct sockaddr*) &addr, sizeof(addr)) == -1
+	   || chmod(addr.sun_path, inst->fCreateMode) == -1
+	   || listen(pLstn->sock, 128) == -1) {
+		rs_strerror_r(errno, errStr, sizeof(errStr));
+		errmsg.LogError(0, RS_RET_COULD_NOT_BIND, "imshmring: can not listen on "
+				"socket '%s': %s", inst->pszSockName, errStr);
+		ABORT_FINALIZE(RS_RET_COULD_NOT_BIND);
+	}
+	CHKiRet(addEpollFd(pLstn->sock, &pLstn->epd, epolld_lstn, pLstn));
+	DBGPRINTF("imshmring: listening on '%s', ring size %u\n", inst->pszSockName, size);
+
+finalize_it:
+	RETiRet;
+}
+
+
+static void
+destructSess(shmsess_t *pSess)
+{
+	if(pSess->sock != -1)
+		close(pSess->sock);	/* also removes it from the epoll set */
+	if(pSess->evfd != -1)
+		close(pSess->evfd);
+	if(pSess->hdr != NULL)
+		munmap(pSess->hdr, pSess->lenMap);
+	free(pSess);
+}
+
+
+/* create the ring of a new session. The shared memory object is
+ * unlinked right away, it is only reachable via the descriptors.
+ */
+static rsRetVal
+createRing(shmsess_t *pSess, int *pShmFd)
+{
+	char shmName[64];
+	int fd;
+	void *map;
+	DEFiRet;
+
+	snprintf(shmName, sizeof(shmName), "/rsyslog-shmring.%d.%u", (int) getpid(), nRings++);
+	if((fd = shm_open(shmName, O_RDWR | O_CREAT | O_EXCL, 0600)) == -1)
+		ABORT_FINALIZE(RS_RET_ERR);
+	shm_unlink(shmName);
+	*pShmFd = fd;
+	pSess->size = pSess->pLstn->ringSize;
+	pSess->lenMap = sizeof(struct rsshmring_hdr) + pSess->size;
+	if(ftruncate(fd, pSess->lenMap) == -1)
+		ABORT_FINALIZE(RS_RET_ERR);
+	map = mmap(NULL, pSess->lenMap, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED)
+		ABORT_FINALIZE(RS_RET_ERR);
+	pSess->hdr = (struct rsshmring_hdr*) map;
+	pSess->data = (uchar*) map + sizeof(struct rsshmring_hdr);
+	pSess->hdr->magic = RSSHMRING_MAGIC;
+	pSess->hdr->version = RSSHMRING_VERSION;
+	pSess->hdr->size = pSess->size;
+	pSess->hdr->maxMsg = pSess->pLstn->maxMsg;
+
+	if((pSess->evfd = eventfd(0, EFD_NONBLOCK)) == -1)
+		ABORT_FINALIZE(RS_RET_ERR);
+	fcntl(pSess->evfd, F_SETFD, FD_CLOEXEC);
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* hand the ring and the eventfd over to the client */
+static rsRetVal
+sendFds(shmsess_t *pSess, int shmfd)
+{
+	struct msghdr mh;
+	struct iovec iov;
+	struct cmsghdr *cm;
+	uint32_t version = RSSHMRING_VERSION;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(2 * sizeof(int))];
+	} ctl;
+	DEFiRet;
+
+	memset(&mh, 0, sizeof(mh));
+	memset(&ctl, 0, sizeof(ctl));
+	iov.iov_base = &version;
+	iov.iov_len = sizeof(version);
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = ctl.buf;
+	mh.msg_controllen = sizeof(ctl.buf);
+	cm = CMSG_FIRSTHDR(&mh);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(2 * sizeof(int));
+	memcpy(CMSG_DATA(cm), &shmfd, sizeof(int));
+	memcpy(CMSG_DATA(cm) + sizeof(int), &pSess->evfd, sizeof(int));
+	if(sendmsg(pSess->sock, &mh, MSG_NOSIGNAL) != sizeof(version))
+		ABORT_FINALIZE(RS_RET_ERR);
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* check if a client of user uid may open another session. Each session
+ * costs a ring of ringSize bytes in /dev/shm and two descriptors, so any
+ * user who can connect could otherwise exhaust them.
+ */
+static rsRetVal
+chkSessLimits(shmlstn_t *pLstn, uid_t uid)
+{
+	shmsess_t *pSess;
+	int nUid = 0;
+	DEFiRet;
+
+	if(pLstn->nSess >= pLstn->inst->maxSessions) {
+		errmsg.LogError(0, RS_RET_MAX_SESS_REACHED, "imshmring: too many sessions "
+				"on '%s' - dropping incoming request", pLstn->inst->pszSockName);
+		ABORT_FINALIZE(RS_RET_MAX_SESS_REACHED);
+	}
+	if(pLstn->inst->maxSessionsPerUid > 0) {
+		for(pSess = pSessRoot ; pSess != NULL ; pSess = pSess->next) {
+			if(pSess->pLstn == pLstn && pSess->uid == uid)
+				++nUid;
+		}
+		if(nUid >= pLstn->inst->maxSessionsPerUid) {
+			errmsg.LogError(0, RS_RET_MAX_SESS_REACHED, "imshmring: too many sessions "
+					"of uid %d on '%s' - dropping incoming request",
+					(int) uid, pLstn->inst->pszSockName);
+			ABORT_FINALIZE(RS_RET_MAX_SESS_REACHED);
+		}
+	}
+finalize_it:
+	RETiRet;
+}
+
+
+/* accept a new client and set up its ring */
+static void
+acceptSess(shmlstn_t *pLstn)
+{
+	shmsess_t *pSess = NULL;
+	int sock;
+	int shmfd = -1;
+	struct ucred cred;
+	socklen_t lenCred = sizeof(cred);
+	char errStr[1024];
+	rsRetVal iRet = RS_RET_OK;
+
+	if((sock = accept(pLstn->sock, NULL, NULL)) == -1) {
+		if(errno != EAGAIN && errno != EINTR) {
+			rs_strerror_r(errno, errStr, sizeof(errStr));
+			DBGPRINTF("imshmring: accept on '%s' failed: %s\n",
+				  pLstn->inst->pszSockName, errStr);
+		}
+		goto finalize_it;
+	}
+	if(getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &lenCred) == -1) {
+		rs_strerror_r(errno, errStr, sizeof(errStr));
+		DBGPRINTF("imshmring: can not get credentials of client on '%s': %s\n",
+			  pLstn->inst->pszSockName, errStr);
+		close(sock);
+		goto finalize_it;
+	}
+	if(chkSessLimits(pLstn, cred.uid) != RS_RET_OK) {
+		close(sock);
+		goto finalize_it;
+	}
+	fcntl(sock, F_SETFD, FD_CLOEXEC);
+	fcntl(sock, F_SETFL, O_NONBLOCK);
+	CHKmalloc(pSess = calloc(1, sizeof(shmsess_t)));
+	pSess->pLstn = pLstn;
+	pSess->sock = sock;
+	pSess->evfd = -1;
+	pSess->uid = cred.uid;
+	CHKiRet(createRing(pSess, &shmfd));
+	CHKiRet(sendFds(pSess, shmfd));
+	CHKiRet(addEpollFd(pSess->sock, &pSess->epdSock, epolld_sess, pSess));
+	CHKiRet(addEpollFd(pSess->evfd, &pSess->epdEvfd, epolld_evfd, pSess));
+	pSess->prev = NULL;
+	pSess->next = pSessRoot;
+	if(pSessRoot != NULL)
+		pSessRoot->prev = pSess;
+	pSessRoot = pSess;
+	++pLstn->nSess;
+	STATSCOUNTER_INC(pLstn->ctrSess, pLstn->mutCtrSess);
+	DBGPRINTF("imshmring: new session on '%s', fd %d\n", pLstn->inst->pszSockName, sock);
+
+finalize_it:
+	if(shmfd != -1)
+		close(shmfd);
+	if(iRet != RS_RET_OK) {
+		rs_strerror_r(errno, errStr, sizeof(errStr));
+		errmsg.LogError(0, iRet, "imshmring: can not set up ring for new client "
+				"on '%s': %s", pLstn->inst->pszSockName, errStr);
+		if(pSess != NULL)
+			destructSess(pSess);
+		else if(sock != -1)
+			close(sock);
+	}
+}
+
+
+/* submit a single message from the ring. The message is copied, so its
+ * space may be reused by the producer as soon as we update the tail.
+ */
+static inline rsRetVal
+enqMsg(shmsess_t *pSess, uchar *pBuf, int lenMsg, struct syslogTime *stTime,
+	time_t ttGenTime, multi_submit_t *pMultiSub)
+{
+	shmlstn_t *pLstn = pSess->pLstn;
+	msg_t *pMsg;
+	DEFiRet;
+
+	CHKiRet(msgConstructWithTime(&pMsg, stTime, ttGenTime));
+	MsgSetRawMsg(pMsg, (char*)pBuf, lenMsg);
+	MsgSetInputName(pMsg, pLstn->pInputName);
+	MsgSetRuleset(pMsg, pLstn->inst->pBindRuleset);
+	MsgSetFlowControlType(pMsg, eFLOWCTL_LIGHT_DELAY);
+	pMsg->msgFlags = NEEDS_PARSING;
+	MsgSetRcvFrom(pMsg, glbl.GetLocalHostNameProp());
+	CHKiRet(MsgSetRcvFromIP(pMsg, pLocalHostIP));
+	CHKiRet(ratelimitAddMsg(pLstn->ratelimiter, pMultiSub, pMsg));
+	STATSCOUNTER_INC(pLstn->ctrSubmit, pLstn->mutCtrSubmit);
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* process the messages of a ring, at most one batch of them, so that a
+ * busy client does not starve the others. The ring is shared with an
+ * untrusted process, so everything read from it is checked before use.
+ * Returns the number of messages processed in *pnMsgs.
+ */
+static rsRetVal
+processRing(shmsess_t *pSess, multi_submit_t *pMultiSub, int *pnMsgs)
+{
+	struct syslogTime stTime;
+	time_t ttGenTime;
+	uint32_t head;
+	uint32_t tail;
+	uint32_t offs;
+	uint32_t lenMsg;
+	uint32_t lenRec;
+	int nMsgs = 0;
+	DEFiRet;
+
+	tail = pSess->tail;
+	head = pSess->hdr->head;
+	/* read the records only after the head */
+	__sync_synchronize();
+	if(tail != head)
+		datetime.getCurrTime(&stTime, &ttGenTime); /* one time per batch is sufficient */
+	while(tail != head && nMsgs < pMultiSub->maxElem) {
+		if(head - tail > pSess->size)
+			ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+		offs = tail & (pSess->size - 1);
+		lenMsg = *(volatile uint32_t*) (pSess->data + offs);
+		if(lenMsg == RSSHMRING_WRAP) {
+			lenRec = pSess->size - offs;
+		} else {
+			if(lenMsg > pSess->pLstn->maxMsg)
+				ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+			lenRec = RSSHMRING_RECLEN(lenMsg);
+			if(offs + lenRec > pSess->size)
+				ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+		}
+		if(lenRec > head - tail)
+			ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+		if(lenMsg != RSSHMRING_WRAP && lenMsg > 0) {
+			CHKiRet(enqMsg(pSess, pSess->data + offs + 4, lenMsg, &stTime,
+				       ttGenTime, pMultiSub));
+			++nMsgs;
+		}
+		tail += lenRec;
+	}
+
+finalize_it:
+	if(tail != pSess->tail) {
+		/* we must be done with the records before the producer may reuse them */
+		__sync_synchronize();
+		pSess->hdr->tail = tail;
+		pSess->tail = tail;
+	}
+	if(iRet == RS_RET_INVALID_VALUE) {
+		errmsg.LogError(0, iRet, "imshmring: ring of client on '%s' is corrupt - "
+				"closing it", pSess->pLstn->inst->pszSockName);
+		pSess->bClose = 1;
+	}
+	*pnMsgs = nMsgs;
+	RETiRet;
+}
+
+
+/* process one batch of each ring. Returns the number of messages processed. */
+static int
+processRings(multi_submit_t *pMultiSub)
+{
+	shmsess_t *pSess;
+	int nMsgs;
+	int nTotal = 0;
+
+	for(pSess = pSessRoot ; pSess != NULL ; pSess = pSess->next) {
+		if(pSess->bClose)
+			continue;
+		processRing(pSess, pMultiSub, &nMsgs);
+		nTotal += nMsgs;
+		if(pMultiSub->nElem > 0)
+			multiSubmitFlush(pMultiSub);
+	}
+	return nTotal;
+}
+
+
+/* announce to the producers that we (no longer) sleep. When going to
+ * sleep, the rings are checked once more afterwards, as a producer may
+ * have published a message before it saw the flag. Returns 1 if there
+ * is data waiting (so we must not sleep), else 0.
+ */
+static int
+setWaiting(int bWaiting)
+{
+	shmsess_t *pSess;
+	int bHaveData = 0;
+
+	for(pSess = pSessRoot ; pSess != NULL ; pSess = pSess->next)
+		pSess->hdr->bWaiting = bWaiting;
+	if(!bWaiting)
+		return 0;
+	__sync_synchronize();
+	for(pSess = pSessRoot ; pSess != NULL ; pSess = pSess->next) {
+		if(!pSess->bClose && pSess->hdr->head != pSess->tail)
+			bHaveData = 1;
+	}
+	return bHaveData;
+}
+
+
+/* close the sessions whose clients have gone away. Whatever they put
+ * into their ring before is still processed.
+ */
+static void
+closeSessions(multi_submit_t *pMultiSub)
+{
+	shmsess_t *pSess;
+	shmsess_t *pNext;
+	int nMsgs;
+	int nBatches;
+
+	for(pSess = pSessRoot ; pSess != NULL ; pSess = pNext) {
+		pNext = pSess->next;
+		if(!pSess->bClose)
+			continue;
+		/* a ring can not hold more than this, and a process that still
+		 * has the ring mapped must not keep us busy forever
+		 */
+		nBatches = pSess->size / RSSHMRING_RECLEN(1) / pMultiSub->maxElem + 1;
+		do {
+			processRing(pSess, pMultiSub, &nMsgs);
+			if(pMultiSub->nElem > 0)
+				multiSubmitFlush(pMultiSub);
+		} while(nMsgs > 0 && --nBatches > 0 && glbl.GetGlobalInputTermState() == 0);
+		DBGPRINTF("imshmring: closing session fd %d\n", pSess->sock);
+		if(pSess->prev == NULL)
+			pSessRoot = pSess->next;
+		else
+			pSess->prev->next = pSess->next;
+		if(pSess->next != NULL)
+			pSess->next->prev = pSess->prev;
+		--pSess->pLstn->nSess;
+		destructSess(pSess);
+	}
+}
+
+
+static void
+processEvent(struct epoll_event *ev)
+{
+	epolld_t *epd = (epolld_t*) ev->data.ptr;
+	shmsess_t *pSess;
+	uint64_t cnt;
+	char buf[128];
+	ssize_t lenRcvd;
+
+	switch(epd->typ) {
+	case epolld_lstn:
+		acceptSess((shmlstn_t*) epd->ptr);
+		break;
+	case epolld_sess:
+		/* clients do not send anything, so this is the end of the session */
+		pSess = (shmsess_t*) epd->ptr;
+		lenRcvd = recv(pSess->sock, buf, sizeof(buf), 0);
+		if(lenRcvd == 0 || (lenRcvd == -1 && errno != EAGAIN && errno != EINTR))
+			pSess->bClose = 1;
+		break;
+	case epolld_evfd:
+		pSess = (shmsess_t*) epd->ptr;
+		if(read(pSess->evfd, &cnt, sizeof(cnt)) == -1 && errno != EAGAIN)
+			pSess->bClose = 1;
+		break;
+	default:
+		DBGPRINTF("imshmring: program error, invalid epolld type %d\n", epd->typ);
+		break;
+	}
+}
+
+
+BEGINnewInpInst
+	struct cnfparamvals *pvals;
+	instanceConf_t *inst;
+	int i;
+CODESTARTnewInpInst
+	DBGPRINTF("newInpInst (imshmring)\n");
+
+	if((pvals = nvlstGetParams(lst, &inppblk, NULL)) == NULL) {
+		ABORT_FINALIZE(RS_RET_MISSING_CNFPARAMS);
+	}
+
+	if(Debug) {
+		dbgprintf("input param blk in imshmring:\n");
+		cnfparamsPrint(&inppblk, pvals);
+	}
+
+	CHKiRet(createInstance(&inst));
+
+	for(i = 0 ; i < inppblk.nParams ; ++i) {
+		if(!pvals[i].bUsed)
+			continue;
+		if(!strcmp(inppblk.descr[i].name, "socket")) {
+			inst->pszSockName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(inppblk.descr[i].name, "ruleset")) {
+			inst->pszBindRuleset = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(inppblk.descr[i].name, "name")) {
+			inst->pszInputName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(inppblk.descr[i].name, "ringsize")) {
+			inst->ringSize = pvals[i].val.d.n;
+			if(inst->ringSize < MIN_RINGSIZE || inst->ringSize > MAX_RINGSIZE) {
+				errmsg.LogError(0, RS_RET_PARAM_ERROR, "imshmring: ringsize must "
+						"be between 64k and 1g, using default of 4m");
+				inst->ringSize = DFLT_RINGSIZE;
+			}
+		} else if(!strcmp(inppblk.descr[i].name, "filecreatemode")) {
+			inst->fCreateMode = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "maxsessions")) {
+			inst->maxSessions = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "maxsessions.peruid")) {
+			inst->maxSessionsPerUid = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.burst")) {
+			inst->ratelimitBurst = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.interval")) {
+			inst->ratelimitInterval = (int) pvals[i].val.d.n;
+		} else {
+			dbgprintf("imshmring: program error, non-handled "
+			  "param '%s'\n", inppblk.descr[i].name);
+		}
+	}
+finalize_it:
+CODE_STD_FINALIZERnewInpInst
+	cnfparamvalsDestruct(pvals, &inppblk);
+ENDnewInpInst
+
+
+BEGINbeginCnfLoad
+CODESTARTbeginCnfLoad
+	loadModConf = pModConf;
+	pModConf->pConf = pConf;
+ENDbeginCnfLoad
+
+
+BEGINendCnfLoad
+CODESTARTendCnfLoad
+	loadModConf = NULL; /* done loading */
+ENDendCnfLoad
+
+
+/* function to generate error message if framework does not find requested ruleset */
+static inline void
+std_checkRuleset_genErrMsg(__attribute__((unused)) modConfData_t *modConf, instanceConf_t *inst)
+{
+	errmsg.LogError(0, NO_ERRCODE, "imshmring: ruleset '%s' for socket %s not found - "
+			"using default ruleset instead", inst->pszBindRuleset,
+			inst->pszSockName);
+}
+BEGINcheckCnf
+	instanceConf_t *inst;
+CODESTARTcheckCnf
+	for(inst = pModConf->root ; inst != NULL ; inst = inst->next) {
+		std_checkRuleset(pModConf, inst);
+	}
+ENDcheckCnf
+
+
+/* the sockets are created before privileges are dropped, as they
+ * usually live in a system directory
+ */
+BEGINactivateCnfPrePrivDrop
+	instanceConf_t *inst;
+	char errStr[1024];
+CODESTARTactivateCnfPrePrivDrop
+	runModConf = pModConf;
+#if defined(EPOLL_CLOEXEC) && defined(HAVE_EPOLL_CREATE1)
+	efd = epoll_create1(EPOLL_CLOEXEC);
+#else
+	efd = epoll_create(10);
+#endif
+	if(efd < 0) {
+		rs_strerror_r(errno, errStr, sizeof(errStr));
+		errmsg.LogError(0, RS_RET_EPOLL_CR_FAILED, "imshmring: error creating "
+				"epoll set: %s", errStr);
+		ABORT_FINALIZE(RS_RET_NO_RUN);
+	}
+	for(inst = runModConf->root ; inst != NULL ; inst = inst->next) {
+		addListner(inst);
+	}
+	if(pLstnRoot == NULL) {
+		errmsg.LogError(0, RS_RET_NO_LSTN_DEFINED, "imshmring: no listener defined, "
+				"module can not run.");
+		ABORT_FINALIZE(RS_RET_NO_RUN);
+	}
+finalize_it:
+ENDactivateCnfPrePrivDrop
+
+
+BEGINactivateCnf
+CODESTARTactivateCnf
+	/* nothing to do, all done pre priv drop */
+ENDactivateCnf
+
+
+BEGINfreeCnf
+	instanceConf_t *inst, *del;
+CODESTARTfreeCnf
+	for(inst = pModConf->root ; inst != NULL ; ) {
+		free(inst->pszSockName);
+		free(inst->pszBindRuleset);
+		free(inst->pszInputName);
+		del = inst;
+		inst = inst->next;
+		free(del);
+	}
+ENDfreeCnf
+
+
+/* This function is called to gather input. Rings are processed as long
+ * as there is data in them. Only if all are empty, we ask the producers
+ * to wake us and go to sleep.
+ */
+BEGINrunInput
+	struct epoll_event events[128];
+	multi_submit_t multiSub;
+	msg_t *pMsgs[CONF_NUM_MULTISUB];
+	int nEvents;
+	int timeout = 0;
+	int i;
+CODESTARTrunInput
+	multiSub.ppMsgs = pMsgs;
+	multiSub.maxElem = CONF_NUM_MULTISUB;
+	multiSub.nElem = 0;
+	DBGPRINTF("imshmring: now beginning to process input data\n");
+	while(glbl.GetGlobalInputTermState() == 0) {
+		nEvents = epoll_wait(efd, events, sizeof(events)/sizeof(struct epoll_event), timeout);
+		if(timeout == -1)
+			setWaiting(0);
+		for(i = 0 ; i < nEvents && glbl.GetGlobalInputTermState() == 0 ; ++i)
+			processEvent(events+i);
+		closeSessions(&multiSub);
+		if(processRings(&multiSub) > 0)
+			timeout = 0;
+		else
+			timeout = setWaiting(1) ? 0 : -1;
+	}
+	DBGPRINTF("imshmring: successfully terminated\n");
+ENDrunInput
+
+
+/* initialize and return if will run or not */
+BEGINwillRun
+CODESTARTwillRun
+ENDwillRun
+
+
+BEGINafterRun
+	shmlstn_t *pLstn, *lstnDel;
+	shmsess_t *pSess, *sessDel;
+CODESTARTafterRun
+	/* messages still in the rings are lost; the producers see EPIPE
+	 * once their ring is full and can then reconnect
+	 */
+	for(pSess = pSessRoot ; pSess != NULL ; ) {
+		sessDel = pSess;
+		pSess = pSess->next;
+		destructSess(sessDel);
+	}
+	pSessRoot = NULL;
+	for(pLstn = pLstnRoot ; pLstn != NULL ; ) {
+		if(pLstn->sock != -1) {
+			close(pLstn->sock);
+			unlink((char*)pLstn->inst->pszSockName);
+		}
+		if(pLstn->stats != NULL)
+			statsobj.Destruct(&(pLstn->stats));
+		if(pLstn->ratelimiter != NULL)
+			ratelimitDestruct(pLstn->ratelimiter);
+		if(pLstn->pInputName != NULL)
+			prop.Destruct(&pLstn->pInputName);
+		lstnDel = pLstn;
+		pLstn = pLstn->next;
+		free(lstnDel);
+	}
+	pLstnRoot = NULL;
+	if(efd != -1) {
+		close(efd);
+		efd = -1;
+	}
+ENDafterRun
+
+
+BEGINmodExit
+CODESTARTmodExit
+	if(pLocalHostIP != NULL)
+		prop.Destruct(&pLocalHostIP);
+	/* release objects we used */
+	objRelease(glbl, CORE_COMPONENT);
+	objRelease(statsobj, CORE_COMPONENT);
+	objRelease(prop, CORE_COMPONENT);
+	objRelease(datetime, CORE_COMPONENT);
+	objRelease(errmsg, CORE_COMPONENT);
+	objRelease(ruleset, CORE_COMPONENT);
+ENDmodExit
+
+
+BEGINisCompatibleWithFeature
+CODESTARTisCompatibleWithFeature
+	if(eFeat == sFEATURENonCancelInputTermination)
+		iRet = RS_RET_OK;
+ENDisCompatibleWithFeature
+
+
+BEGINqueryEtryPt
+CODESTARTqueryEtryPt
+CODEqueryEtryPt_STD_IMOD_QUERIES
+CODEqueryEtryPt_STD_CONF2_QUERIES
+CODEqueryEtryPt_STD_CONF2_PREPRIVDROP_QUERIES
+CODEqueryEtryPt_STD_CONF2_IMOD_QUERIES
+CODEqueryEtryPt_IsCompatibleWithFeature_IF_OMOD_QUERIES
+ENDqueryEtryPt
+
+
+BEGINmodInit()
+CODESTARTmodInit
+	*ipIFVersProvided = CURR_MOD_IF_VERSION; /* we only support the current interface specification */
+CODEmodInit_QueryRegCFSLineHdlr
+	/* request objects we use */
+	CHKiRet(objUse(glbl, CORE_COMPONENT));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
+	CHKiRet(objUse(prop, CORE_COMPONENT));
+	CHKiRet(objUse(errmsg, CORE_COMPONENT));
+	CHKiRet(objUse(datetime, CORE_COMPONENT));
+	CHKiRet(objUse(ruleset, CORE_COMPONENT));
+	CHKiRet(prop.CreateStringProp(&pLocalHostIP, UCHAR_CONSTANT("127.0.0.1"), sizeof("127.0.0.1") - 1));
+ENDmodInit
+
+
+/* vim:set ai:
+ */
@@ -0,0 +1,261 @@
+/* rsshmring.c
+ * Client library for imshmring, see rsshmring.h for the protocol.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of rsyslog.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "rsshmring.h"
+
+struct rsshmring_s {
+	int sock;		/* connection to rsyslog, closed by rsyslog on shutdown */
+	int evfd;		/* eventfd to wake up rsyslog */
+	struct rsshmring_hdr *hdr;
+	unsigned char *data;	/* data area of the ring */
+	size_t lenMap;
+	uint32_t size;
+	uint32_t head;		/* we are the only writer of hdr->head */
+	uint32_t lenReserved;	/* length of the pending reservation */
+	int bReserved;
+};
+
+
+/* receive the ring and eventfd descriptors from rsyslog */
+static int
+recvFds(int sock, int *shmfd, int *evfd)
+{
+	struct msghdr mh;
+	struct iovec iov;
+	struct cmsghdr *cm;
+	uint32_t version;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(2 * sizeof(int))];
+	} ctl;
+	ssize_t lenRcvd;
+
+	memset(&mh, 0, sizeof(mh));
+	iov.iov_base = &version;
+	iov.iov_len = sizeof(version);
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = ctl.buf;
+	mh.msg_controllen = sizeof(ctl.buf);
+	do {
+		lenRcvd = recvmsg(sock, &mh, 0);
+	} while(lenRcvd == -1 && errno == EINTR);
+	if(lenRcvd != sizeof(version)) {
+		if(lenRcvd >= 0)
+			errno = EPROTO;
+		return -1;
+	}
+	cm = CMSG_FIRSTHDR(&mh);
+	if(cm == NULL || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS
+	   || cm->cmsg_len != CMSG_LEN(2 * sizeof(int))) {
+		errno = EPROTO;
+		return -1;
+	}
+	memcpy(shmfd, CMSG_DATA(cm), sizeof(int));
+	memcpy(evfd, CMSG_DATA(cm) + sizeof(int), sizeof(int));
+	fcntl(*shmfd, F_SETFD, FD_CLOEXEC);
+	fcntl(*evfd, F_SETFD, FD_CLOEXEC);
+	if(version != RSSHMRING_VERSION) {
+		close(*shmfd);
+		close(*evfd);
+		errno = EPROTONOSUPPORT;
+		return -1;
+	}
+	return 0;
+}
+
+
+rsshmring_t *
+rsshmring_open(const char *sockPath)
+{
+	rsshmring_t *ring;
+	struct sockaddr_un addr;
+	struct stat st;
+	int shmfd = -1;
+	int err;
+
+	if(strlen(sockPath) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	if((ring = calloc(1, sizeof(rsshmring_t))) == NULL)
+		return NULL;
+	ring->evfd = -1;
+	ring->hdr = MAP_FAILED;
+
+	if((ring->sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+		goto fail;
+	fcntl(ring->sock, F_SETFD, FD_CLOEXEC);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, sockPath);
+	if(connect(ring->sock, (struct sockaddr*) &addr, sizeof(addr)) == -1)
+		goto fail;
+	if(recvFds(ring->sock, &shmfd, &ring->evfd) == -1)
+		goto fail;
+
+	if(fstat(shmfd, &st) == -1)
+		goto fail;
+	if(st.st_size < (off_t) sizeof(struct rsshmring_hdr)) {
+		errno = EPROTO;
+		goto fail;
+	}
+	ring->lenMap = st.st_size;
+	ring->hdr = mmap(NULL, ring->lenMap, PROT_READ | PROT_WRITE, MAP_SHARED, shmfd, 0);
+	if(ring->hdr == MAP_FAILED)
+		goto fail;
+	close(shmfd);
+	shmfd = -1;
+
+	ring->size = ring->hdr->size;
+	if(ring->hdr->magic != RSSHMRING_MAGIC || ring->size == 0
+	   || (ring->size & (ring->size - 1)) != 0
+	   || ring->lenMap != sizeof(struct rsshmring_hdr) + ring->size) {
+		errno = EPROTO;
+		goto fail;
+	}
+	ring->data = (unsigned char*) ring->hdr + sizeof(struct rsshmring_hdr);
+	ring->head = ring->hdr->head;
+	return ring;
+
+fail:
+	err = errno;
+	if(shmfd != -1)
+		close(shmfd);
+	rsshmring_close(ring);
+	errno = err;
+	return NULL;
+}
+
+
+void
+rsshmring_close(rsshmring_t *ring)
+{
+	if(ring == NULL)
+		return;
+	if(ring->hdr != MAP_FAILED)
+		munmap(ring->hdr, ring->lenMap);
+	if(ring->evfd != -1)
+		close(ring->evfd);
+	if(ring->sock != -1)
+		close(ring->sock);
+	free(ring);
+}
+
+
+/* check if rsyslog is still there. It never sends anything after the
+ * handshake, so a readable socket means it has closed the connection.
+ */
+static int
+peerGone(rsshmring_t *ring)
+{
+	struct pollfd pfd;
+
+	pfd.fd = ring->sock;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	return poll(&pfd, 1, 0) == 1;
+}
+
+
+void *
+rsshmring_reserve(rsshmring_t *ring, size_t len)
+{
+	uint32_t lenRec;
+	uint32_t offs;
+	uint32_t lenPad;
+	uint32_t lenFree;
+
+	if(len > ring->hdr->maxMsg) {
+		errno = EMSGSIZE;
+		return NULL;
+	}
+	lenRec = RSSHMRING_RECLEN(len);
+	offs = ring->head & (ring->size - 1);
+	lenPad = (offs + lenRec > ring->size) ? ring->size - offs : 0;
+	lenFree = ring->size - (ring->head - ring->hdr->tail);
+	/* make sure the consumer is done with the space before we reuse it */
+	__sync_synchronize();
+	if(lenPad + lenRec > lenFree) {
+		errno = peerGone(ring) ? EPIPE : EAGAIN;
+		return NULL;
+	}
+	if(lenPad > 0) {
+		/* not yet visible, the consumer sees it with the next record */
+		*(uint32_t*) (ring->data + offs) = RSSHMRING_WRAP;
+		ring->head += lenPad;
+		offs = 0;
+	}
+	ring->lenReserved = len;
+	ring->bReserved = 1;
+	return ring->data + offs + 4;
+}
+
+
+int
+rsshmring_commit(rsshmring_t *ring, size_t len)
+{
+	uint64_t one = 1;
+
+	if(!ring->bReserved || len > ring->lenReserved) {
+		errno = EINVAL;
+		return -1;
+	}
+	*(uint32_t*) (ring->data + (ring->head & (ring->size - 1))) = len;
+	ring->head += RSSHMRING_RECLEN(len);
+	ring->bReserved = 0;
+	/* the record must be complete before it is published, and the
+	 * consumer's sleep flag must be read after publishing it
+	 */
+	__sync_synchronize();
+	ring->hdr->head = ring->head;
+	__sync_synchronize();
+	if(ring->hdr->bWaiting) {
+		if(write(ring->evfd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+			return -1;
+	}
+	return 0;
+}
+
+
+int
+rsshmring_send(rsshmring_t *ring, const void *msg, size_t len)
+{
+	void *buf;
+
+	if((buf = rsshmring_reserve(ring, len)) == NULL)
+		return -1;
+	memcpy(buf, msg, len);
+	return rsshmring_commit(ring, len);
+}
@@ -0,0 +1,90 @@
+/* rsshmring.h
+ * Shared memory ring protocol used by imshmring and the client API of
+ * the librsshmring library, which local producers use to submit
+ * messages to rsyslog without a system call per message.
+ *
+ * A client connects to the unix (stream) socket of an imshmring input.
+ * rsyslog then creates a ring just for this client and passes two file
+ * descriptors via SCM_RIGHTS: the shared memory holding the ring and an
+ * eventfd. The client writes messages into the ring and signals the
+ * eventfd only if rsyslog has announced that it is about to sleep. The
+ * connection stays open for the lifetime of the ring; when the client
+ * closes it, rsyslog processes the remaining messages and discards the
+ * ring. Each ring has exactly one producer and one consumer, so no locks
+ * are needed - a client handle must not be used by multiple threads at
+ * the same time.
+ *
+ * The ring starts with struct rsshmring_hdr, followed by the data area.
+ * Each record is a 32 bit length followed by the message, padded to a
+ * multiple of 4 bytes. A record never wraps; if it does not fit at the
+ * end of the data area, the producer stores RSSHMRING_WRAP as length
+ * and continues at the start. head and tail are free running counters,
+ * the offset into the data area is obtained by masking with size-1.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of rsyslog.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_RSSHMRING_H
+#define INCLUDED_RSSHMRING_H
+#include <stddef.h>
+#include <stdint.h>
+
+#define RSSHMRING_MAGIC		0x72736872	/* "rshr" */
+#define RSSHMRING_VERSION	1
+#define RSSHMRING_WRAP		0xffffffffu	/* record length: continue at start of ring */
+#define RSSHMRING_RECLEN(len)	(4 + (((len) + 3) & ~3u)) /* ring space used by a message */
+
+/* head and tail are placed in different cache lines, as they are written
+ * by different processes.
+ */
+struct rsshmring_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;		/* size of the data area, a power of 2 */
+	uint32_t maxMsg;	/* max message size accepted by the consumer */
+	char pad0[48];
+	volatile uint32_t head;	/* producer: end of published records */
+	char pad1[60];
+	volatile uint32_t tail;	/* consumer: start of unread records */
+	volatile uint32_t bWaiting; /* consumer is about to sleep, signal the eventfd */
+	char pad2[56];
+};
+
+/* client API (librsshmring) */
+typedef struct rsshmring_s rsshmring_t;
+
+/* connect to the imshmring input listening on sockPath. Returns NULL
+ * and sets errno on failure.
+ */
+rsshmring_t *rsshmring_open(const char *sockPath);
+void rsshmring_close(rsshmring_t *ring);
+
+/* reserve space for a message of len bytes and return a pointer to it,
+ * so that the message can be written in place. It becomes visible to
+ * rsyslog only after rsshmring_commit(), which may pass a smaller len
+ * than was reserved. Returns NULL with errno EAGAIN if the ring is full,
+ * EMSGSIZE if the message is too large and EPIPE if rsyslog has closed
+ * the connection (reconnect in this case).
+ */
+void *rsshmring_reserve(rsshmring_t *ring, size_t len);
+int rsshmring_commit(rsshmring_t *ring, size_t len);
+
+/* copy a message into the ring, 0 on success or -1 with errno as above */
+int rsshmring_send(rsshmring_t *ring, const void *msg, size_t len);
+
+#endif /* #ifndef INCLUDED_RSSHMRING_H */
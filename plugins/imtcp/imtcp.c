@@ -125,6 +125,8 @@ struct modConfData_s {
 	sbool bUseFlowControl; /* use flow control, what means indicate ourselfs a "light delayable" */
 	sbool bKeepAlive;
 	sbool bEmitMsgOnClose; /* emit an informational message on close by remote peer */
+	int iSessThreads; /* number of session threads (0 - none, use worker pool) */
+	int maxFrameSize; /* frames up to this size are not split (0 - max msg size) */
 	uchar *pszStrmDrvrName; /* stream driver to use */
 	uchar *pszStrmDrvrAuthMode; /* authentication mode to use */
 	struct cnfarray *permittedPeers;
@@ -148,7 +150,9 @@ static struct cnfparamdescr modpdescr[] = {
 	{ "streamdriver.authmode", eCmdHdlrString, 0 },
 	{ "streamdriver.name", eCmdHdlrString, 0 },
 	{ "permittedpeer", eCmdHdlrArray, 0 },
-	{ "keepalive", eCmdHdlrBinary, 0 }
+	{ "keepalive", eCmdHdlrBinary, 0 },
+	{ "sessionthreads", eCmdHdlrNonNegInt, 0 },
+	{ "maxframesize", eCmdHdlrSize, 0 }
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -332,6 +336,8 @@ addListner(modConfData_t *modConf, instanceConf_t *inst)
 		CHKiRet(tcpsrv.SetAddtlFrameDelim(pOurTcpsrv, modConf->iAddtlFrameDelim));
 		CHKiRet(tcpsrv.SetbDisableLFDelim(pOurTcpsrv, modConf->bDisableLFDelim));
 		CHKiRet(tcpsrv.SetNotificationOnRemoteClose(pOurTcpsrv, modConf->bEmitMsgOnClose));
+		CHKiRet(tcpsrv.SetShards(pOurTcpsrv, modConf->iSessThreads));
+		CHKiRet(tcpsrv.SetMaxFrameSize(pOurTcpsrv, modConf->maxFrameSize));
 		/* now set optional params, but only if they were actually configured */
 		if(modConf->pszStrmDrvrName != NULL) {
 			CHKiRet(tcpsrv.SetDrvrName(pOurTcpsrv, modConf->pszStrmDrvrName));
@@ -422,6 +428,8 @@ CODESTARTbeginCnfLoad
 	loadModConf->bUseFlowControl = 1;
 	loadModConf->bKeepAlive = 0;
 	loadModConf->bEmitMsgOnClose = 0;
+	loadModConf->iSessThreads = 0;
+	loadModConf->maxFrameSize = 0;
 	loadModConf->iAddtlFrameDelim = TCPSRV_NO_ADDTL_DELIMITER;
 	loadModConf->bDisableLFDelim = 0;
 	loadModConf->pszStrmDrvrName = NULL;
@@ -471,6 +479,10 @@ CODESTARTsetModCnf
 			loadModConf->iTCPLstnMax = (int) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "keepalive")) {
 			loadModConf->bKeepAlive = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "sessionthreads")) {
+			loadModConf->iSessThreads = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "maxframesize")) {
+			loadModConf->maxFrameSize = (int) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "streamdriver.mode")) {
 			loadModConf->iStrmDrvrMode = (int) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "streamdriver.authmode")) {
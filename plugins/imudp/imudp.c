@@ -39,6 +39,19 @@
 #ifdef HAVE_SCHED_H
 #	include <sched.h>
 #endif
+#ifdef HAVE_LINUX_FILTER_H
+#	include <linux/filter.h>
+#endif
+#ifdef HAVE_LINUX_IF_PACKET_H
+#	include <linux/if_packet.h>
+#	include <linux/if_ether.h>
+#	include <net/if.h>
+#	include <netinet/in.h>
+#	include <sys/mman.h>
+#	if defined(TPACKET3_HDRLEN) && defined(PACKET_FANOUT) && defined(HAVE_LINUX_FILTER_H)
+#		define USE_PKT_CAPTURE 1
+#	endif
+#endif
 #include "rsyslog.h"
 #include "dirty.h"
 #include "net.h"
@@ -62,6 +75,9 @@ MODULE_CNFNAME("imudp")
 
 /* defines */
 #define MAX_WRKR_THREADS 32
+#define CAPTURE_BLOCK_SIZE (1024 * 1024)	/* size of a packet ring block */
+#define CAPTURE_RING_DFLT (32 * 1024 * 1024)	/* default ring size per worker */
+#define CAPTURE_BLOCK_TMO 10			/* ms until a partially filled block is passed to us */
 
 /* Module static data */
 DEF_IMOD_STATIC_DATA
@@ -82,17 +98,35 @@ static struct lstn_s {
 	statsobj_t *stats;	/* listener stats */
 	ratelimit_t *ratelimiter;
 	uchar *dfltTZ;
-	STATSCOUNTER_DEF(ctrSubmit, mutCtrSubmit)
+	int iWrkr;		/* worker owning this socket (reuseport), -1: all workers */
+	sbool bRxqOvfl;		/* kernel reports drop count via SO_RXQ_OVFL */
+	STATSCOUNTER_SHARDED_DEF(ctrSubmit)	/* updated by all workers */
+	intctr_t ctrKernDrops;	/* packets dropped by the kernel, set from SO_RXQ_OVFL */
+	struct capRing_s *pRing;	/* packet ring if this is a capture listener, else NULL */
 } *lcnfRoot = NULL, *lcnfLast = NULL;
 
+/* the mmap()ed TPACKET_V3 receive ring of an AF_PACKET capture socket */
+struct capRing_s {
+	uchar *pMap;		/* the ring itself */
+	size_t lenMap;
+	unsigned nBlocks;	/* number of blocks in ring (each CAPTURE_BLOCK_SIZE) */
+	unsigned iBlock;	/* next block to process */
+};
+
 
 static int bLegacyCnfModGlobalsPermitted;/* are legacy module-global config parameters permitted? */
 static int bDoACLCheck;			/* are ACL checks neeed? Cached once immediately before listener startup */
 static int iMaxLine;			/* maximum UDP message size supported */
+static sbool bCpuSteering = 0;		/* a reuseport CPU steering filter is active */
 static time_t ttLastDiscard = 0;	/* timestamp when a message from a non-permitted sender was last discarded
 					 * This shall prevent remote DoS when the "discard on disallowed sender"
 					 * message is configured to be logged on occurance of such a case.
 					 */
+#ifdef SO_RXQ_OVFL
+#define CTL_BUF_SIZE CMSG_SPACE(sizeof(uint32_t)) /* control data per packet: drop counter */
+#else
+#define CTL_BUF_SIZE 1
+#endif
 #define BATCH_SIZE_DFLT 32		/* do not overdo, has heavy toll on memory, especially with large msgs */
 #define TIME_REQUERY_DFLT 2
 #define SCHED_PRIO_UNSET -12345678	/* a value that indicates that the scheduling priority has not been set */
@@ -117,6 +151,24 @@ struct instanceConf_s {
 	int rcvbuf;			/* 0 means: do not set, keep OS default */
 	struct instanceConf_s *next;
 	sbool bAppendPortToInpname;
+	sbool bReusePort;		/* one SO_REUSEPORT socket per worker thread */
+	sbool bCpuSteering;		/* steer packets to the worker on the receiving CPU */
+	uchar *pszCaptureIface;		/* capture via AF_PACKET on this interface (NULL: use UDP socket) */
+	int64 captureRingSize;		/* size of each worker's packet ring */
+	int captureFanout;		/* PACKET_FANOUT_xxx mode to distribute packets to workers */
+};
+
+/* Each worker caches the ACL verdicts for the senders it has seen last.
+ * The cache is direct-mapped by the source address and thus bounded.
+ * As the UDP ACL is global, a verdict is valid for all listeners; keeping
+ * the cache per worker means it is never shared between threads and so
+ * needs no locking.
+ */
+#define ACL_CACHE_SIZE 256	/* must be a power of 2 */
+struct aclCacheEntry_s {
+	uchar addr[16];		/* IPv4 or IPv6 address, network byte order */
+	sa_family_t family;	/* 0 = entry unused */
+	int verdict;		/* result of isAllowedSender2() */
 };
 
 /* The following structure controls the worker threads. Global data is
@@ -130,12 +182,16 @@ static struct wrkrInfo_s {
 	STATSCOUNTER_DEF(ctrCall_recvmmsg, mutCtrCall_recvmmsg)
 	STATSCOUNTER_DEF(ctrCall_recvmsg, mutCtrCall_recvmsg)
 	STATSCOUNTER_DEF(ctrMsgsRcvd, mutCtrMsgsRcvd)
-	uchar *pRcvBuf;		/* receive buffer (for a single packet) */
 #	ifdef HAVE_RECVMMSG
+	uchar **ppRcvBufs;	/* receive buffers, one per batch member; NULL if handed over to a msg */
 	struct sockaddr_storage *frominet;
 	struct mmsghdr *recvmsg_mmh;
 	struct iovec *recvmsg_iov;
+#	else
+	uchar *pRcvBuf;		/* receive buffer (for a single packet); NULL if handed over to a msg */
 #	endif
+	uchar *pCtlBuf;		/* control buffers for SO_RXQ_OVFL, one per batch member */
+	struct aclCacheEntry_s aclCache[ACL_CACHE_SIZE];
 } wrkrInfo[MAX_WRKR_THREADS];
 
 struct modConfData_s {
@@ -144,6 +200,8 @@ struct modConfData_s {
 	uchar *pszSchedPolicy;		/* scheduling policy string */
 	int iSchedPolicy;		/* scheduling policy as SCHED_xxx */
 	int iSchedPrio;			/* scheduling priority */
+	uchar *pszCpuSet;		/* CPUs to bind worker threads to (as configured) */
+	srCpuSet_t *pCpuSet;		/* the parsed CPU set, NULL if unbound */
 	int iTimeRequery;		/* how often is time to be queried inside tight recv loop? 0=always */
 	int batchSize;			/* max nbr of input batch --> also recvmmsg() max count */
 	int8_t wrkrMax;			/* max nbr of worker threads */
@@ -158,7 +216,8 @@ static struct cnfparamdescr modpdescr[] = {
 	{ "schedulingpriority", eCmdHdlrInt, 0 },
 	{ "batchsize", eCmdHdlrInt, 0 },
 	{ "threads", eCmdHdlrPositiveInt, 0 },
-	{ "timerequery", eCmdHdlrInt, 0 }
+	{ "timerequery", eCmdHdlrInt, 0 },
+	{ "cpuset", eCmdHdlrString, 0 }
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -176,6 +235,11 @@ static struct cnfparamdescr inppdescr[] = {
 	{ "ratelimit.interval", eCmdHdlrInt, 0 },
 	{ "ratelimit.burst", eCmdHdlrInt, 0 },
 	{ "rcvbufsize", eCmdHdlrSize, 0 },
+	{ "reuseport", eCmdHdlrBinary, 0 },
+	{ "reuseport.cpusteering", eCmdHdlrBinary, 0 },
+	{ "capture.interface", eCmdHdlrGetWord, 0 },
+	{ "capture.ringsize", eCmdHdlrSize, 0 },
+	{ "capture.fanout", eCmdHdlrGetWord, 0 },
 	{ "ruleset", eCmdHdlrString, 0 }
 };
 static struct cnfparamblk inppblk =
@@ -207,6 +271,15 @@ createInstance(instanceConf_t **pinst)
 	inst->ratelimitInterval = 0; /* off */
 	inst->rcvbuf = 0;
 	inst->dfltTZ = NULL;
+	inst->bReusePort = 0;
+	inst->bCpuSteering = 0;
+	inst->pszCaptureIface = NULL;
+	inst->captureRingSize = CAPTURE_RING_DFLT;
+#	ifdef USE_PKT_CAPTURE
+	inst->captureFanout = PACKET_FANOUT_HASH;
+#	else
+	inst->captureFanout = 0;
+#	endif
 
 	/* node created, let's add to config */
 	if(loadModConf->tail == NULL) {
@@ -251,22 +324,255 @@ finalize_it:
 }
 
 
+/* attach a classic BPF program to a reuseport group which selects the
+ * socket by the number of the CPU the packet is processed on. As socket n
+ * belongs to worker n and that worker is bound to CPUs c with
+ * c % nSocks == n, packets stay on the CPU that received them.
+ */
+static void
+attachCpuSteering(const int sock, const int nSocks)
+{
+#if defined(HAVE_LINUX_FILTER_H) && defined(SO_ATTACH_REUSEPORT_CBPF)
+	struct sock_filter code[] = {
+		{ BPF_LD  | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },	/* A = cpu */
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, nSocks },			/* A %= nSocks */
+		{ BPF_RET | BPF_A, 0, 0, 0 }					/* return A */
+	};
+	struct sock_fprog prog = { sizeof(code)/sizeof(code[0]), code };
+	char errStr[1024];
+
+	if(setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) != 0) {
+		rs_strerror_r(errno, errStr, sizeof(errStr));
+		errmsg.LogError(errno, NO_ERRCODE, "imudp: could not attach reuseport CPU steering "
+				"filter: %s - packets are distributed by flow hash", errStr);
+	} else {
+		bCpuSteering = 1;
+	}
+#else
+	(void) sock;
+	(void) nSocks;
+	errmsg.LogError(0, NO_ERRCODE, "imudp: reuseport.cpusteering is not supported "
+			"on this platform - ignored");
+#endif
+}
+
+
+#ifdef USE_PKT_CAPTURE
+/* open an AF_PACKET capture socket with a TPACKET_V3 receive ring for
+ * UDP packets to port on the configured interface. A kernel filter makes
+ * sure we only see these packets. All sockets of an instance join the
+ * same fanout group, so that the kernel distributes packets between them
+ * (and reassembles fragments before doing so).
+ */
+static rsRetVal
+openCapture(instanceConf_t *inst, const int port, const int fanoutId, int *pSock, struct capRing_s **ppRing)
+{
+	struct sock_filter code[] = {
+		{ BPF_LD  | BPF_H | BPF_ABS,  0, 0, SKF_AD_OFF + SKF_AD_PROTOCOL },
+		{ BPF_JMP | BPF_JEQ | BPF_K,  0, 4, ETH_P_IPV6 },
+		{ BPF_LD  | BPF_B | BPF_ABS,  0, 0, 6 },		/* IPv6 next header */
+		{ BPF_JMP | BPF_JEQ | BPF_K,  0, 11, IPPROTO_UDP },
+		{ BPF_LD  | BPF_H | BPF_ABS,  0, 0, 40 + 2 },		/* UDP dest port */
+		{ BPF_JMP | BPF_JEQ | BPF_K,  8, 9, port },
+		{ BPF_JMP | BPF_JEQ | BPF_K,  0, 8, ETH_P_IP },
+		{ BPF_LD  | BPF_B | BPF_ABS,  0, 0, 9 },		/* IPv4 protocol */
+		{ BPF_JMP | BPF_JEQ | BPF_K,  0, 6, IPPROTO_UDP },
+		{ BPF_LD  | BPF_H | BPF_ABS,  0, 0, 6 },		/* fragment offset */
+		{ BPF_JMP | BPF_JSET | BPF_K, 4, 0, 0x1fff },
+		{ BPF_LDX | BPF_B | BPF_MSH,  0, 0, 0 },		/* X = IPv4 header length */
+		{ BPF_LD  | BPF_H | BPF_IND,  0, 0, 2 },		/* UDP dest port */
+		{ BPF_JMP | BPF_JEQ | BPF_K,  0, 1, port },
+		{ BPF_RET | BPF_K,	      0, 0, 0x40000 },
+		{ BPF_RET | BPF_K,	      0, 0, 0 }
+	};
+	struct sock_fprog prog = { sizeof(code)/sizeof(code[0]), code };
+	struct tpacket_req3 req;
+	struct sockaddr_ll sll;
+	struct capRing_s *pRing = NULL;
+	int version = TPACKET_V3;
+	int fanout;
+	int sock;
+	char errStr[1024];
+	DEFiRet;
+
+	*pSock = -1;
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	if(strcmp((char*)inst->pszCaptureIface, "any")
+	   && (sll.sll_ifindex = if_nametoindex((char*)inst->pszCaptureIface)) == 0) {
+		errmsg.LogError(errno, RS_RET_PARAM_ERROR, "imudp: capture interface '%s' not found",
+				inst->pszCaptureIface);
+		ABORT_FINALIZE(RS_RET_PARAM_ERROR);
+	}
+
+	/* SOCK_DGRAM: data starts at the IP header, no matter what the link layer is */
+	if((sock = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_ALL))) < 0) {
+		rs_strerror_r(errno, errStr, sizeof(errStr));
+		errmsg.LogError(errno, RS_RET_COULD_NOT_BIND, "imudp: could not create capture "
+				"socket: %s", errStr);
+		ABORT_FINALIZE(RS_RET_COULD_NOT_BIND);
+	}
+	*pSock = sock;
+	CHKmalloc(pRing = calloc(1, sizeof(struct capRing_s)));
+	pRing->nBlocks = inst->captureRingSize / CAPTURE_BLOCK_SIZE;
+	if(pRing->nBlocks < 2)
+		pRing->nBlocks = 2;
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = CAPTURE_BLOCK_SIZE;
+	req.tp_block_nr = pRing->nBlocks;
+	req.tp_frame_size = TPACKET_ALIGNMENT << 7;
+	req.tp_frame_nr = (req.tp_block_size / req.tp_frame_size) * req.tp_block_nr;
+	req.tp_retire_blk_tov = CAPTURE_BLOCK_TMO;
+	pRing->lenMap = (size_t) req.tp_block_size * req.tp_block_nr;
+
+	if(   setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) != 0
+	   || setsockopt(sock, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0
+	   || setsockopt(sock, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) != 0
+	   || (pRing->pMap = mmap(NULL, pRing->lenMap, PROT_READ | PROT_WRITE, MAP_SHARED, sock, 0))
+	   	== MAP_FAILED
+	   || bind(sock, (struct sockaddr*) &sll, sizeof(sll)) != 0) {
+		rs_strerror_r(errno, errStr, sizeof(errStr));
+		errmsg.LogError(errno, RS_RET_COULD_NOT_BIND, "imudp: could not set up packet ring "
+				"on interface '%s': %s", inst->pszCaptureIface, errStr);
+		ABORT_FINALIZE(RS_RET_COULD_NOT_BIND);
+	}
+	fanout = fanoutId | ((inst->captureFanout | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+	if(setsockopt(sock, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) != 0) {
+		rs_strerror_r(errno, errStr, sizeof(errStr));
+		errmsg.LogError(errno, RS_RET_COULD_NOT_BIND, "imudp: could not join packet "
+				"fanout group on interface '%s': %s", inst->pszCaptureIface, errStr);
+		ABORT_FINALIZE(RS_RET_COULD_NOT_BIND);
+	}
+	*ppRing = pRing;
+	DBGPRINTF("imudp: capture socket %d on '%s' port %d, ring %u x %d bytes\n", sock,
+		  inst->pszCaptureIface, port, pRing->nBlocks, CAPTURE_BLOCK_SIZE);
+
+finalize_it:
+	if(iRet != RS_RET_OK) {
+		if(pRing != NULL) {
+			if(pRing->pMap != NULL && pRing->pMap != MAP_FAILED)
+				munmap(pRing->pMap, pRing->lenMap);
+			free(pRing);
+		}
+		if(*pSock != -1) {
+			close(*pSock);
+			*pSock = -1;
+		}
+	}
+	RETiRet;
+}
+#endif /* #ifdef USE_PKT_CAPTURE */
+
+
+/* add a single socket as a new listener. iWrkr is the worker that owns
+ * it (with reuseport or capture) or -1 if all workers serve it. pRing is
+ * the packet ring of a capture socket (NULL for UDP sockets). The listener
+ * owns it after the call.
+ */
+static rsRetVal
+addLstnSock(instanceConf_t *inst, const int sock, const int iWrkr, uchar *bindName, uchar *port,
+	struct capRing_s *pRing)
+{
+	struct lstn_s *newlcnfinfo;
+	uchar dispname[64], inpnameBuf[128];
+	uchar *inputname;
+	DEFiRet;
+
+	CHKmalloc(newlcnfinfo = (struct lstn_s*) calloc(1, sizeof(struct lstn_s)));
+	newlcnfinfo->next = NULL;
+	newlcnfinfo->sock = sock;
+	newlcnfinfo->iWrkr = iWrkr;
+	newlcnfinfo->pRing = pRing;
+	newlcnfinfo->pRuleset = inst->pBindRuleset;
+	newlcnfinfo->dfltTZ = inst->dfltTZ;
+	if(inst->inputname == NULL) {
+		inputname = (uchar*)"imudp";
+	} else {
+		inputname = inst->inputname;
+	}
+	if(pRing != NULL)
+		snprintf((char*)dispname, sizeof(dispname), "%s(%s:%s/w%d)", inputname,
+			 inst->pszCaptureIface, port, iWrkr);
+	else if(iWrkr == -1)
+		snprintf((char*)dispname, sizeof(dispname), "%s(%s:%s)", inputname, bindName, port);
+	else
+		snprintf((char*)dispname, sizeof(dispname), "%s(%s:%s/w%d)", inputname, bindName, port, iWrkr);
+	dispname[sizeof(dispname)-1] = '\0'; /* just to be on the save side... */
+	CHKiRet(ratelimitNew(&newlcnfinfo->ratelimiter, (char*)dispname, NULL));
+	if(inst->bAppendPortToInpname) {
+		snprintf((char*)inpnameBuf, sizeof(inpnameBuf), "%s%s",
+			inputname, port);
+		inpnameBuf[sizeof(inpnameBuf)-1] = '\0';
+		inputname = inpnameBuf;
+	}
+	CHKiRet(prop.Construct(&newlcnfinfo->pInputName));
+	CHKiRet(prop.SetString(newlcnfinfo->pInputName,
+		inputname, ustrlen(inputname)));
+	CHKiRet(prop.ConstructFinalize(newlcnfinfo->pInputName));
+	ratelimitSetLinuxLike(newlcnfinfo->ratelimiter, inst->ratelimitInterval,
+			      inst->ratelimitBurst);
+#	ifdef SO_RXQ_OVFL
+	if(pRing == NULL) {
+		int on = 1;
+		if(setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) == 0)
+			newlcnfinfo->bRxqOvfl = 1;
+		else
+			DBGPRINTF("imudp: SO_RXQ_OVFL not supported on socket %d\n", sock);
+	}
+#	endif
+	/* support statistics gathering */
+	CHKiRet(statsobj.Construct(&(newlcnfinfo->stats)));
+	CHKiRet(statsobj.SetName(newlcnfinfo->stats, dispname));
+	STATSCOUNTER_SHARDED_INIT(newlcnfinfo->ctrSubmit);
+	CHKiRet(statsobj.AddCounter(newlcnfinfo->stats, UCHAR_CONSTANT("submitted"),
+		ctrType_IntCtrSharded, CTR_FLAG_RESETTABLE, &(newlcnfinfo->ctrSubmit)));
+	if(newlcnfinfo->bRxqOvfl || pRing != NULL) {
+		CHKiRet(statsobj.AddCounter(newlcnfinfo->stats, UCHAR_CONSTANT("kernel.drops"),
+			ctrType_IntCtr, CTR_FLAG_NONE, &(newlcnfinfo->ctrKernDrops)));
+	}
+	CHKiRet(statsobj.ConstructFinalize(newlcnfinfo->stats));
+	/* link to list. Order must be preserved to take care for 
+	 * conflicting matches.
+	 */
+	if(lcnfRoot == NULL)
+		lcnfRoot = newlcnfinfo;
+	if(lcnfLast == NULL)
+		lcnfLast = newlcnfinfo;
+	else {
+		lcnfLast->next = newlcnfinfo;
+		lcnfLast = newlcnfinfo;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* This function is called when a new listener shall be added. It takes
  * the instance config description, tries to bind the socket and, if that
  * succeeds, adds it to the list of existing listen sockets.
+ * With reuseport, each worker thread gets its own set of sockets, which
+ * the kernel load-balances between.
  */
 static inline rsRetVal
 addListner(instanceConf_t *inst)
 {
 	DEFiRet;
 	uchar *bindAddr;
-	int *newSocks;
+	int *newSocks = NULL;
 	int iSrc;
-	struct lstn_s *newlcnfinfo;
+	int iWrkr;
+	int nWrkr;
 	uchar *bindName;
 	uchar *port;
-	uchar dispname[64], inpnameBuf[128];
-	uchar *inputname;
+#	ifdef USE_PKT_CAPTURE
+	static int nCaptures = 0;
+	struct capRing_s *pRing;
+	int fanoutId;
+	int sock;
+	int iPort;
+#	endif
 
 	/* check which address to bind to. We could do this more compact, but have not
 	 * done so in order to make the code more readable. -- rgerhards, 2007-12-27
@@ -282,55 +588,47 @@ addListner(instanceConf_t *inst)
 
 	DBGPRINTF("Trying to open syslog UDP ports at %s:%s.\n", bindName, inst->pszBindPort);
 
-	newSocks = net.create_udp_socket(bindAddr, port, 1, inst->rcvbuf);
-	if(newSocks != NULL) {
+	if(inst->pszCaptureIface != NULL) {
+#		ifdef USE_PKT_CAPTURE
+		/* one capture socket per worker, joined in a fanout group */
+		iPort = atoi((char*)port);
+		if(iPort <= 0 || iPort > 65535) {
+			errmsg.LogError(0, RS_RET_PARAM_ERROR, "imudp: capture requires a "
+					"numeric port, '%s' is invalid", port);
+			ABORT_FINALIZE(RS_RET_PARAM_ERROR);
+		}
+		fanoutId = (getpid() + nCaptures++) & 0xffff;
+		for(iWrkr = 0 ; iWrkr < runModConf->wrkrMax ; ++iWrkr) {
+			CHKiRet(openCapture(inst, iPort, fanoutId, &sock, &pRing));
+			if((iRet = addLstnSock(inst, sock, iWrkr, bindName, port, pRing)) != RS_RET_OK) {
+				munmap(pRing->pMap, pRing->lenMap);
+				free(pRing);
+				close(sock);
+				FINALIZE;
+			}
+		}
+#		else
+		errmsg.LogError(0, RS_RET_NOT_IMPLEMENTED, "imudp: capture.interface is not "
+				"supported on this platform - listener %s not started", port);
+		ABORT_FINALIZE(RS_RET_NOT_IMPLEMENTED);
+#		endif
+		FINALIZE;
+	}
+
+	nWrkr = inst->bReusePort ? runModConf->wrkrMax : 1;
+	for(iWrkr = 0 ; iWrkr < nWrkr ; ++iWrkr) {
+		newSocks = net.create_udp_socket(bindAddr, port, 1, inst->rcvbuf, inst->bReusePort);
+		if(newSocks == NULL)
+			break;
 		/* we now need to add the new sockets to the existing set */
-		/* ready to copy */
 		for(iSrc = 1 ; iSrc <= newSocks[0] ; ++iSrc) {
-			CHKmalloc(newlcnfinfo = (struct lstn_s*) MALLOC(sizeof(struct lstn_s)));
-			newlcnfinfo->next = NULL;
-			newlcnfinfo->sock = newSocks[iSrc];
-			newlcnfinfo->pRuleset = inst->pBindRuleset;
-			newlcnfinfo->dfltTZ = inst->dfltTZ;
-			if(inst->inputname == NULL) {
-				inputname = (uchar*)"imudp";
-			} else {
-				inputname = inst->inputname;
-			}
-			snprintf((char*)dispname, sizeof(dispname), "%s(%s:%s)", inputname, bindName, port);
-			dispname[sizeof(dispname)-1] = '\0'; /* just to be on the save side... */
-			CHKiRet(ratelimitNew(&newlcnfinfo->ratelimiter, (char*)dispname, NULL));
-			if(inst->bAppendPortToInpname) {
-				snprintf((char*)inpnameBuf, sizeof(inpnameBuf), "%s%s",
-					inputname, port);
-				inpnameBuf[sizeof(inpnameBuf)-1] = '\0';
-				inputname = inpnameBuf;
-			}
-			CHKiRet(prop.Construct(&newlcnfinfo->pInputName));
-			CHKiRet(prop.SetString(newlcnfinfo->pInputName,
-				inputname, ustrlen(inputname)));
-			CHKiRet(prop.ConstructFinalize(newlcnfinfo->pInputName));
-			ratelimitSetLinuxLike(newlcnfinfo->ratelimiter, inst->ratelimitInterval,
-					      inst->ratelimitBurst);
-			/* support statistics gathering */
-			CHKiRet(statsobj.Construct(&(newlcnfinfo->stats)));
-			CHKiRet(statsobj.SetName(newlcnfinfo->stats, dispname));
-			STATSCOUNTER_INIT(newlcnfinfo->ctrSubmit, newlcnfinfo->mutCtrSubmit);
-			CHKiRet(statsobj.AddCounter(newlcnfinfo->stats, UCHAR_CONSTANT("submitted"),
-				ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(newlcnfinfo->ctrSubmit)));
-			CHKiRet(statsobj.ConstructFinalize(newlcnfinfo->stats));
-			/* link to list. Order must be preserved to take care for 
-			 * conflicting matches.
-			 */
-			if(lcnfRoot == NULL)
-				lcnfRoot = newlcnfinfo;
-			if(lcnfLast == NULL)
-				lcnfLast = newlcnfinfo;
-			else {
-				lcnfLast->next = newlcnfinfo;
-				lcnfLast = newlcnfinfo;
-			}
+			/* the filter applies to the whole group, so setting it once is sufficient */
+			if(iWrkr == 0 && inst->bReusePort && inst->bCpuSteering)
+				attachCpuSteering(newSocks[iSrc], nWrkr);
+			CHKiRet(addLstnSock(inst, newSocks[iSrc], inst->bReusePort ? iWrkr : -1, bindName, port, NULL));
 		}
+		free(newSocks);
+		newSocks = NULL;
 	}
 
 finalize_it:
@@ -349,16 +647,84 @@ std_checkRuleset_genErrMsg(__attribute__((unused)) modConfData_t *modConf, insta
 }
 
 
+/* check if a sender is permitted to send us syslog messages. The verdict
+ * cache is consulted first, only on a miss the ACL itself is evaluated.
+ * If the sender isn't permitted, we do not further process the message
+ * but log a warning (if we are configured to do this). However, if the check
+ * would require name resolution, it is postponed to the main queue. See also
+ * my blog post at
+ * http://blog.gerhards.net/2009/11/acls-imudp-and-accepting-messages.html
+ * rgerhards, 2009-11-16
+ */
+static inline int
+checkACL(struct aclCacheEntry_s *const aclCache, struct sockaddr_storage *const frominet)
+{
+	struct aclCacheEntry_s *pEntry = NULL;
+	uchar *addr;
+	size_t lenAddr;
+	unsigned hash;
+	size_t i;
+	int verdict;
+
+	if(frominet->ss_family == AF_INET) {
+		addr = (uchar*) &((struct sockaddr_in*) frominet)->sin_addr;
+		lenAddr = 4;
+	} else if(frominet->ss_family == AF_INET6) {
+		addr = ((struct sockaddr_in6*) frominet)->sin6_addr.s6_addr;
+		lenAddr = 16;
+	} else {
+		addr = NULL;
+		lenAddr = 0;
+	}
+
+	if(addr != NULL) {
+		hash = 2166136261u;
+		for(i = 0 ; i < lenAddr ; ++i)
+			hash = (hash ^ addr[i]) * 16777619u;
+		pEntry = aclCache + (hash & (ACL_CACHE_SIZE - 1));
+		if(pEntry->family == frominet->ss_family && !memcmp(pEntry->addr, addr, lenAddr))
+			return pEntry->verdict;
+	}
+
+	verdict = net.isAllowedSender2((uchar*)"UDP", (struct sockaddr *)frominet, "", 0);
+	if(pEntry != NULL) {
+		memcpy(pEntry->addr, addr, lenAddr);
+		pEntry->family = frominet->ss_family;
+		pEntry->verdict = verdict;
+	}
+
+	if(verdict == 0) {
+		DBGPRINTF("msg is not from an allowed sender\n");
+		if(glbl.GetOption_DisallowWarning) {
+			time_t tt;
+			datetime.GetTime(&tt);
+			if(tt > ttLastDiscard + 60) {
+				ttLastDiscard = tt;
+				errmsg.LogError(0, NO_ERRCODE,
+				"UDP message from disallowed sender discarded");
+			}
+		}
+	}
+	return verdict;
+}
+
+
 /* This function processes received data. It provides unified handling
  * in cases where recvmmsg() is available and not.
+ * If ppRcvBuf is non-NULL, *ppRcvBuf is the malloc()ed buffer rcvBuf.
+ * Large packets are then not copied: the receive buffer itself becomes the
+ * message's raw buffer and *ppRcvBuf is set to NULL. The caller must then
+ * allocate a new receive buffer before the next receive.
  */
 static inline rsRetVal
-processPacket(thrdInfo_t *pThrd, struct lstn_s *lstn, struct sockaddr_storage *frominetPrev, int *pbIsPermitted,
-	uchar *rcvBuf, ssize_t lenRcvBuf, struct syslogTime *stTime, time_t ttGenTime,
-	struct sockaddr_storage *frominet, socklen_t socklen, multi_submit_t *multiSub)
+processPacket(thrdInfo_t *pThrd, struct lstn_s *lstn, struct aclCacheEntry_s *aclCache,
+	uchar *rcvBuf, uchar **ppRcvBuf, ssize_t lenRcvBuf, struct syslogTime *stTime, time_t ttGenTime,
+	struct sockaddr_storage *frominet, __attribute__((unused)) socklen_t socklen, multi_submit_t *multiSub)
 {
 	DEFiRet;
 	msg_t *pMsg;
+	uchar *pShrunk;
+	int bIsPermitted;
 
 	assert(pThrd != NULL);
 
@@ -366,55 +732,37 @@ processPacket(thrdInfo_t *pThrd, struct lstn_s *lstn, struct sockaddr_storage *f
 		FINALIZE; /* this looks a bit strange, but practice shows it happens... */
 
 	/* if we reach this point, we had a good receive and can process the packet received */
-	/* check if we have a different sender than before, if so, we need to query some new values */
 	if(bDoACLCheck) {
-		socklen = sizeof(struct sockaddr_storage);
-		if(net.CmpHost(frominet, frominetPrev, socklen) != 0) {
-			memcpy(frominetPrev, frominet, socklen); /* update cache indicator */
-			/* Here we check if a host is permitted to send us syslog messages. If it isn't,
-			 * we do not further process the message but log a warning (if we are
-			 * configured to do this). However, if the check would require name resolution,
-			 * it is postponed to the main queue. See also my blog post at
-			 * http://blog.gerhards.net/2009/11/acls-imudp-and-accepting-messages.html
-			 * rgerhards, 2009-11-16
-			 */
-			*pbIsPermitted = net.isAllowedSender2((uchar*)"UDP",
-					    (struct sockaddr *)frominet, "", 0);
-	
-			if(*pbIsPermitted == 0) {
-				DBGPRINTF("msg is not from an allowed sender\n");
-				if(glbl.GetOption_DisallowWarning) {
-					time_t tt;
-					datetime.GetTime(&tt);
-					if(tt > ttLastDiscard + 60) {
-						ttLastDiscard = tt;
-						errmsg.LogError(0, NO_ERRCODE,
-						"UDP message from disallowed sender discarded");
-					}
-				}
-			}
-		}
+		bIsPermitted = checkACL(aclCache, frominet);
 	} else {
-		*pbIsPermitted = 1; /* no check -> everything permitted */
+		bIsPermitted = 1; /* no check -> everything permitted */
 	}
 
-	DBGPRINTF("recv(%d,%d),acl:%d,msg:%.128s\n", lstn->sock, (int) lenRcvBuf, *pbIsPermitted, rcvBuf);
+	DBGPRINTF("recv(%d,%d),acl:%d,msg:%.128s\n", lstn->sock, (int) lenRcvBuf, bIsPermitted, rcvBuf);
 
-	if(*pbIsPermitted != 0)  {
+	if(bIsPermitted != 0)  {
 		/* we now create our own message object and submit it to the queue */
 		CHKiRet(msgConstructWithTime(&pMsg, stTime, ttGenTime));
-		MsgSetRawMsg(pMsg, (char*)rcvBuf, lenRcvBuf);
+		if(ppRcvBuf == NULL || lenRcvBuf < CONF_RAWMSG_BUFSIZE) {
+			MsgSetRawMsg(pMsg, (char*)rcvBuf, lenRcvBuf); /* fits into msg, copy is cheaper */
+		} else {
+			/* shrinking usually happens in place and saves lots of queue memory */
+			if((pShrunk = realloc(rcvBuf, lenRcvBuf + 1)) != NULL)
+				rcvBuf = pShrunk;
+			MsgSetRawMsgBuf(pMsg, rcvBuf, lenRcvBuf);
+			*ppRcvBuf = NULL;
+		}
 		MsgSetInputName(pMsg, lstn->pInputName);
 		MsgSetRuleset(pMsg, lstn->pRuleset);
 		MsgSetFlowControlType(pMsg, eFLOWCTL_NO_DELAY);
 		if(lstn->dfltTZ != NULL)
 			MsgSetDfltTZ(pMsg, (char*) lstn->dfltTZ);
 		pMsg->msgFlags  = NEEDS_PARSING | PARSE_HOSTNAME | NEEDS_DNSRESOL;
-		if(*pbIsPermitted == 2)
+		if(bIsPermitted == 2)
 			pMsg->msgFlags  |= NEEDS_ACLCHK_U; /* request ACL check after resolution */
 		CHKiRet(msgSetFromSockinfo(pMsg, frominet));
 		CHKiRet(ratelimitAddMsg(lstn->ratelimiter, multiSub, pMsg));
-		STATSCOUNTER_INC(lstn->ctrSubmit, lstn->mutCtrSubmit);
+		STATSCOUNTER_SHARDED_INC(lstn->ctrSubmit);
 	}
 
 finalize_it:
@@ -428,9 +776,33 @@ finalize_it:
  * just one function. Depending on whether or not we have recvmmsg(),
  * an appropriate version is compiled (as such we need to maintain both!).
  */
+/* pick up the socket's cumulative kernel drop count, which comes as
+ * control data with each packet if SO_RXQ_OVFL is enabled (and the
+ * count is non-zero).
+ */
+static inline void
+updateKernDrops(struct lstn_s *lstn, struct msghdr *mh)
+{
+#	ifdef SO_RXQ_OVFL
+	struct cmsghdr *cmsg;
+	uint32_t drops;
+
+	for(cmsg = CMSG_FIRSTHDR(mh) ; cmsg != NULL ; cmsg = CMSG_NXTHDR(mh, cmsg)) {
+		if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+			memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+			lstn->ctrKernDrops = drops;
+		}
+	}
+#	else
+	(void) lstn;
+	(void) mh;
+#	endif
+}
+
+
 #ifdef HAVE_RECVMMSG
 static inline rsRetVal
-processSocket(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, struct sockaddr_storage *frominetPrev, int *pbIsPermitted)
+processSocket(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn)
 {
 	DEFiRet;
 	int iNbrTimeUsed;
@@ -452,12 +824,18 @@ processSocket(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, struct sockaddr_sto
 		memset(pWrkr->recvmsg_iov, 0, runModConf->batchSize * sizeof(struct iovec));
 		memset(pWrkr->recvmsg_mmh, 0, runModConf->batchSize * sizeof(struct mmsghdr));
 		for(i = 0 ; i < runModConf->batchSize ; ++i) {
-			pWrkr->recvmsg_iov[i].iov_base = pWrkr->pRcvBuf+(i*(iMaxLine+1));
+			if(pWrkr->ppRcvBufs[i] == NULL)
+				CHKmalloc(pWrkr->ppRcvBufs[i] = MALLOC(iMaxLine + 1));
+			pWrkr->recvmsg_iov[i].iov_base = pWrkr->ppRcvBufs[i];
 			pWrkr->recvmsg_iov[i].iov_len = iMaxLine;
 			pWrkr->recvmsg_mmh[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage); 
 			pWrkr->recvmsg_mmh[i].msg_hdr.msg_name = &(pWrkr->frominet[i]);
 			pWrkr->recvmsg_mmh[i].msg_hdr.msg_iov = &(pWrkr->recvmsg_iov[i]);
 			pWrkr->recvmsg_mmh[i].msg_hdr.msg_iovlen = 1;
+			if(lstn->bRxqOvfl) {
+				pWrkr->recvmsg_mmh[i].msg_hdr.msg_control = pWrkr->pCtlBuf + i * CTL_BUF_SIZE;
+				pWrkr->recvmsg_mmh[i].msg_hdr.msg_controllen = CTL_BUF_SIZE;
+			}
 		}
 		nelem = recvmmsg(lstn->sock, pWrkr->recvmsg_mmh, runModConf->batchSize, 0, NULL);
 		STATSCOUNTER_INC(pWrkr->ctrCall_recvmmsg, pWrkr->mutCtrCall_recvmmsg);
@@ -486,8 +864,11 @@ processSocket(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, struct sockaddr_sto
 		}
 
 		pWrkr->ctrMsgsRcvd += nelem;
+		if(lstn->bRxqOvfl && nelem > 0) /* the count is cumulative, the last one is sufficient */
+			updateKernDrops(lstn, &(pWrkr->recvmsg_mmh[nelem-1].msg_hdr));
 		for(i = 0 ; i < nelem ; ++i) {
-			processPacket(pWrkr->pThrd, lstn, frominetPrev, pbIsPermitted, pWrkr->recvmsg_mmh[i].msg_hdr.msg_iov->iov_base,
+			processPacket(pWrkr->pThrd, lstn, pWrkr->aclCache,
+				      pWrkr->ppRcvBufs[i], &(pWrkr->ppRcvBufs[i]),
 				      pWrkr->recvmsg_mmh[i].msg_len, &stTime, ttGenTime, &(pWrkr->frominet[i]),
 				      pWrkr->recvmsg_mmh[i].msg_hdr.msg_namelen, &multiSub);
 		}
@@ -513,7 +894,7 @@ finalize_it:
  * on scheduling order. -- rgerhards, 2008-10-02
  */
 static inline rsRetVal
-processSocket(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, struct sockaddr_storage *frominetPrev, int *pbIsPermitted)
+processSocket(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn)
 {
 	int iNbrTimeUsed;
 	time_t ttGenTime;
@@ -534,6 +915,8 @@ processSocket(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, struct sockaddr_sto
 	while(1) { /* loop is terminated if we have a bad receive, done below in the body */
 		if(pWrkr->pThrd->bShallStop == RSTRUE)
 			ABORT_FINALIZE(RS_RET_FORCE_TERM);
+		if(pWrkr->pRcvBuf == NULL)
+			CHKmalloc(pWrkr->pRcvBuf = MALLOC(iMaxLine + 1));
 		memset(iov, 0, sizeof(iov));
 		iov[0].iov_base = pWrkr->pRcvBuf;
 		iov[0].iov_len = iMaxLine;
@@ -542,6 +925,10 @@ processSocket(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, struct sockaddr_sto
 		mh.msg_namelen = sizeof(struct sockaddr_storage); 
 		mh.msg_iov = iov;
 		mh.msg_iovlen = 1;
+		if(lstn->bRxqOvfl) {
+			mh.msg_control = pWrkr->pCtlBuf;
+			mh.msg_controllen = CTL_BUF_SIZE;
+		}
 		lenRcvBuf = recvmsg(lstn->sock, &mh, 0);
 		STATSCOUNTER_INC(pWrkr->ctrCall_recvmsg, pWrkr->mutCtrCall_recvmsg);
 		if(lenRcvBuf < 0) {
@@ -554,12 +941,14 @@ processSocket(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, struct sockaddr_sto
 		}
 
 		++pWrkr->ctrMsgsRcvd;
+		if(lstn->bRxqOvfl)
+			updateKernDrops(lstn, &mh);
 		if((runModConf->iTimeRequery == 0) || (iNbrTimeUsed++ % runModConf->iTimeRequery) == 0) {
 			datetime.getCurrTime(&stTime, &ttGenTime);
 		}
 
-		CHKiRet(processPacket(pWrkr->pThrd, lstn, frominetPrev, pbIsPermitted, pWrkr->pRcvBuf, lenRcvBuf, &stTime,
-			ttGenTime, &frominet, mh.msg_namelen, &multiSub));
+		CHKiRet(processPacket(pWrkr->pThrd, lstn, pWrkr->aclCache, pWrkr->pRcvBuf,
+			&(pWrkr->pRcvBuf), lenRcvBuf, &stTime, ttGenTime, &frominet, mh.msg_namelen, &multiSub));
 	}
 
 
@@ -570,6 +959,123 @@ finalize_it:
 #endif /* #ifdef HAVE_RECVMMSG */
 
 
+#ifdef USE_PKT_CAPTURE
+/* locate the UDP payload of a captured packet and fill in the sender's
+ * address. Returns 0 if the packet shall be ignored: our own outgoing
+ * packets, truncated packets and fragments.
+ */
+static inline int
+capturePayload(struct tpacket3_hdr *ppd, struct sockaddr_storage *frominet, socklen_t *pSocklen,
+	uchar **ppPayload, size_t *pLenPayload)
+{
+	struct sockaddr_ll *sll;
+	struct sockaddr_in *sin;
+	struct sockaddr_in6 *sin6;
+	uchar *pkt, *udp;
+	size_t len;
+	size_t lenUdp;
+
+	sll = (struct sockaddr_ll*) ((uchar*) ppd + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+	if(sll->sll_pkttype == PACKET_OUTGOING || ppd->tp_snaplen < ppd->tp_len)
+		return 0;
+	pkt = (uchar*) ppd + ppd->tp_net;
+	len = ppd->tp_snaplen - (ppd->tp_net - ppd->tp_mac);
+	memset(frominet, 0, sizeof(struct sockaddr_storage));
+	if(ntohs(sll->sll_protocol) == ETH_P_IP) {
+		if(len < 20 || (pkt[0] & 0x0f) < 5 || len < (size_t) (pkt[0] & 0x0f) * 4 + 8)
+			return 0;
+		if((((pkt[6] << 8) | pkt[7]) & 0x3fff) != 0)
+			return 0; /* fragment, should have been reassembled by the fanout */
+		udp = pkt + (pkt[0] & 0x0f) * 4;
+		sin = (struct sockaddr_in*) frominet;
+		sin->sin_family = AF_INET;
+		memcpy(&sin->sin_addr, pkt + 12, 4);
+		memcpy(&sin->sin_port, udp, 2);
+		*pSocklen = sizeof(struct sockaddr_in);
+	} else if(ntohs(sll->sll_protocol) == ETH_P_IPV6) {
+		if(len < 40 + 8)
+			return 0;
+		udp = pkt + 40;
+		sin6 = (struct sockaddr_in6*) frominet;
+		sin6->sin6_family = AF_INET6;
+		memcpy(&sin6->sin6_addr, pkt + 8, 16);
+		memcpy(&sin6->sin6_port, udp, 2);
+		*pSocklen = sizeof(struct sockaddr_in6);
+	} else {
+		return 0;
+	}
+	lenUdp = (udp[4] << 8) | udp[5];
+	if(lenUdp < 8 || (size_t) (udp - pkt) + lenUdp > len)
+		return 0;
+	*ppPayload = udp + 8;
+	*pLenPayload = lenUdp - 8;
+	return 1;
+}
+
+
+/* process all blocks the kernel has passed to us on a capture listener.
+ * The payload is copied into the message objects directly from the ring,
+ * then the block is returned to the kernel. As the ring is ours alone,
+ * this needs no system call at all.
+ */
+static rsRetVal
+processRing(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn)
+{
+	struct capRing_s *const pRing = lstn->pRing;
+	struct tpacket_block_desc *pbd;
+	struct tpacket3_hdr *ppd;
+	struct tpacket_stats_v3 tpstats;
+	socklen_t lenStats;
+	struct sockaddr_storage frominet;
+	socklen_t socklen;
+	uchar *pPayload;
+	size_t lenPayload;
+	time_t ttGenTime;
+	struct syslogTime stTime;
+	msg_t *pMsgs[CONF_NUM_MULTISUB];
+	multi_submit_t multiSub;
+	unsigned nPkts;
+	unsigned i;
+	DEFiRet;
+
+	multiSub.ppMsgs = pMsgs;
+	multiSub.maxElem = CONF_NUM_MULTISUB;
+	multiSub.nElem = 0;
+	while(1) {
+		if(pWrkr->pThrd->bShallStop == RSTRUE)
+			ABORT_FINALIZE(RS_RET_FORCE_TERM);
+		pbd = (struct tpacket_block_desc*) (pRing->pMap + (size_t) pRing->iBlock * CAPTURE_BLOCK_SIZE);
+		if((pbd->hdr.bh1.block_status & TP_STATUS_USER) == 0)
+			break;
+		__sync_synchronize(); /* block content is valid only after status */
+		datetime.getCurrTime(&stTime, &ttGenTime); /* one time per block is sufficient */
+		nPkts = pbd->hdr.bh1.num_pkts;
+		ppd = (struct tpacket3_hdr*) ((uchar*) pbd + pbd->hdr.bh1.offset_to_first_pkt);
+		for(i = 0 ; i < nPkts ; ++i) {
+			if(capturePayload(ppd, &frominet, &socklen, &pPayload, &lenPayload)) {
+				++pWrkr->ctrMsgsRcvd;
+				processPacket(pWrkr->pThrd, lstn, pWrkr->aclCache, pPayload, NULL,
+					      lenPayload, &stTime, ttGenTime, &frominet, socklen, &multiSub);
+			}
+			ppd = (struct tpacket3_hdr*) ((uchar*) ppd + ppd->tp_next_offset);
+		}
+		__sync_synchronize();
+		pbd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		pRing->iBlock = (pRing->iBlock + 1) % pRing->nBlocks;
+	}
+
+	/* the kernel resets the counters on each read */
+	lenStats = sizeof(tpstats);
+	if(getsockopt(lstn->sock, SOL_PACKET, PACKET_STATISTICS, &tpstats, &lenStats) == 0)
+		lstn->ctrKernDrops += tpstats.tp_drops;
+
+finalize_it:
+	multiSubmitFlush(&multiSub);
+	RETiRet;
+}
+#endif /* #ifdef USE_PKT_CAPTURE */
+
+
 /* check configured scheduling priority.
  * Precondition: iSchedPolicy must have been set
  */
@@ -704,19 +1210,14 @@ rsRetVal rcvMainLoop(struct wrkrInfo_s *pWrkr)
 	int nfds;
 	int efd;
 	int i;
-	struct sockaddr_storage frominetPrev;
-	int bIsPermitted;
 	struct epoll_event *udpEPollEvt = NULL;
 	struct epoll_event currEvt[NUM_EPOLL_EVENTS];
 	char errStr[1024];
 	struct lstn_s *lstn;
 	int nLstn;
 
-	/* start "name caching" algo by making sure the previous system indicator
-	 * is invalidated.
-	 */
-	bIsPermitted = 0;
-	memset(&frominetPrev, 0, sizeof(frominetPrev));
+	/* start "name caching" algo by making sure no stale verdicts are used */
+	memset(pWrkr->aclCache, 0, sizeof(pWrkr->aclCache));
 
 	/* count num listeners -- do it here in order to avoid inconsistency */
 	nLstn = 0;
@@ -744,7 +1245,8 @@ rsRetVal rcvMainLoop(struct wrkrInfo_s *pWrkr)
 	 */
 	i = 0;
 	for(lstn = lcnfRoot ; lstn != NULL ; lstn = lstn->next) {
-		if(lstn->sock != -1) {
+		/* reuseport sockets are served by their owning worker, only */
+		if(lstn->sock != -1 && (lstn->iWrkr == -1 || lstn->iWrkr == pWrkr->id)) {
 			udpEPollEvt[i].events = EPOLLIN | EPOLLET;
 			udpEPollEvt[i].data.ptr = lstn;
 			if(epoll_ctl(efd, EPOLL_CTL_ADD,  lstn->sock, &(udpEPollEvt[i])) < 0) {
@@ -765,7 +1267,14 @@ rsRetVal rcvMainLoop(struct wrkrInfo_s *pWrkr)
 			break; /* terminate input! */
 
 		for(i = 0 ; i < nfds ; ++i) {
-			processSocket(pWrkr, currEvt[i].data.ptr, &frominetPrev, &bIsPermitted);
+			lstn = currEvt[i].data.ptr;
+#			ifdef USE_PKT_CAPTURE
+			if(lstn->pRing != NULL) {
+				processRing(pWrkr, lstn);
+				continue;
+			}
+#			endif
+			processSocket(pWrkr, lstn);
 		}
 	}
 
@@ -777,21 +1286,16 @@ finalize_it:
 }
 #else /* #if HAVE_EPOLL_CREATE1 */
 /* this is the code for the select() interface */
-rsRetVal rcvMainLoop(thrdInfo_t *pWrkr)
+rsRetVal rcvMainLoop(struct wrkrInfo_s *pWrkr)
 {
 	DEFiRet;
 	int maxfds;
 	int nfds;
 	fd_set readfds;
-	struct sockaddr_storage frominetPrev;
-	int bIsPermitted;
 	struct lstn_s *lstn;
 
-	/* start "name caching" algo by making sure the previous system indicator
-	 * is invalidated.
-	 */
-	bIsPermitted = 0;
-	memset(&frominetPrev, 0, sizeof(frominetPrev));
+	/* start "name caching" algo by making sure no stale verdicts are used */
+	memset(pWrkr->aclCache, 0, sizeof(pWrkr->aclCache));
 	DBGPRINTF("imudp uses select()\n");
 
 	while(1) {
@@ -802,7 +1306,7 @@ rsRetVal rcvMainLoop(thrdInfo_t *pWrkr)
 
 		/* Add the UDP listen sockets to the list of read descriptors. */
 		for(lstn = lcnfRoot ; lstn != NULL ; lstn = lstn->next) {
-			if (lstn->sock != -1) {
+			if (lstn->sock != -1 && (lstn->iWrkr == -1 || lstn->iWrkr == pWrkr->id)) {
 				if(Debug)
 					net.debugListenInfo(lstn->sock, "UDP");
 				FD_SET(lstn->sock, &readfds);
@@ -824,7 +1328,12 @@ rsRetVal rcvMainLoop(thrdInfo_t *pWrkr)
 
 		for(lstn = lcnfRoot ; nfds && lstn != NULL ; lstn = lstn->next) {
 			if(FD_ISSET(lstn->sock, &readfds)) {
-		       		processSocket(pWrkr, lstn, &frominetPrev, &bIsPermitted);
+#				ifdef USE_PKT_CAPTURE
+				if(lstn->pRing != NULL)
+					processRing(pWrkr, lstn);
+				else
+#				endif
+		       		processSocket(pWrkr, lstn);
 			--nfds; /* indicate we have processed one descriptor */
 			}
 	       }
@@ -840,6 +1349,7 @@ static inline rsRetVal
 createListner(es_str_t *port, struct cnfparamvals *pvals)
 {
 	instanceConf_t *inst;
+	char *cstr;
 	int i;
 	DEFiRet;
 
@@ -866,6 +1376,29 @@ createListner(es_str_t *port, struct cnfparamvals *pvals)
 			inst->ratelimitInterval = (int) pvals[i].val.d.n;
 		} else if(!strcmp(inppblk.descr[i].name, "rcvbufsize")) {
 			inst->rcvbuf = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "reuseport")) {
+			inst->bReusePort = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "reuseport.cpusteering")) {
+			inst->bCpuSteering = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "capture.interface")) {
+			inst->pszCaptureIface = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(inppblk.descr[i].name, "capture.ringsize")) {
+			inst->captureRingSize = pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "capture.fanout")) {
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+#			ifdef USE_PKT_CAPTURE
+			if(!strcmp(cstr, "hash")) {
+				inst->captureFanout = PACKET_FANOUT_HASH;
+			} else if(!strcmp(cstr, "cpu")) {
+				inst->captureFanout = PACKET_FANOUT_CPU;
+			} else if(!strcmp(cstr, "lb")) {
+				inst->captureFanout = PACKET_FANOUT_LB;
+			} else {
+				errmsg.LogError(0, RS_RET_PARAM_ERROR, "imudp: invalid capture.fanout "
+						"mode '%s' - using 'hash'", cstr);
+			}
+#			endif
+			free(cstr);
 		} else {
 			dbgprintf("imudp: program error, non-handled "
 			  "param '%s'\n", inppblk.descr[i].name);
@@ -914,6 +1447,8 @@ CODESTARTbeginCnfLoad
 	loadModConf->iTimeRequery = TIME_REQUERY_DFLT;
 	loadModConf->iSchedPrio = SCHED_PRIO_UNSET;
 	loadModConf->pszSchedPolicy = NULL;
+	loadModConf->pszCpuSet = NULL;
+	loadModConf->pCpuSet = NULL;
 	bLegacyCnfModGlobalsPermitted = 1;
 	/* init legacy config vars */
 	cs.pszBindRuleset = NULL;
@@ -952,6 +1487,15 @@ CODESTARTsetModCnf
 			loadModConf->iSchedPrio = (int) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "schedulingpolicy")) {
 			loadModConf->pszSchedPolicy = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(modpblk.descr[i].name, "cpuset")) {
+			loadModConf->pszCpuSet = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+			if(srCpuSetConstruct(&loadModConf->pCpuSet, loadModConf->pszCpuSet) != RS_RET_OK) {
+				errmsg.LogError(0, RS_RET_PARAM_ERROR, "imudp: cpuset '%s' is invalid "
+						"or not supported on this platform - ignored",
+						loadModConf->pszCpuSet);
+				free(loadModConf->pszCpuSet);
+				loadModConf->pszCpuSet = NULL;
+			}
 		} else if(!strcmp(modpblk.descr[i].name, "threads")) {
 			wrkrMax = (int) pvals[i].val.d.n;
 			if(wrkrMax > MAX_WRKR_THREADS) {
@@ -1034,21 +1578,23 @@ ENDactivateCnfPrePrivDrop
 
 BEGINactivateCnf
 	int i;
-	int lenRcvBuf;
 CODESTARTactivateCnf
 	/* caching various settings */
 	iMaxLine = glbl.GetMaxLine();
-	lenRcvBuf = (iMaxLine + 1) * sizeof(char);
-#	ifdef HAVE_RECVMMSG
-	lenRcvBuf *= runModConf->batchSize;
-#	endif
+	/* the receive buffers themselves are allocated on first use, as the
+	 * worker may hand them over to messages.
+	 */
 	for(i = 0 ; i < runModConf->wrkrMax ; ++i) {
 #		ifdef HAVE_RECVMMSG
 		CHKmalloc(wrkrInfo[i].recvmsg_iov = MALLOC(runModConf->batchSize * sizeof(struct iovec)));
 		CHKmalloc(wrkrInfo[i].recvmsg_mmh = MALLOC(runModConf->batchSize * sizeof(struct mmsghdr)));
 		CHKmalloc(wrkrInfo[i].frominet = MALLOC(runModConf->batchSize * sizeof(struct sockaddr_storage)));
+		CHKmalloc(wrkrInfo[i].ppRcvBufs = calloc(runModConf->batchSize, sizeof(uchar*)));
+		CHKmalloc(wrkrInfo[i].pCtlBuf = MALLOC(runModConf->batchSize * CTL_BUF_SIZE));
+#		else
+		wrkrInfo[i].pRcvBuf = NULL;
+		CHKmalloc(wrkrInfo[i].pCtlBuf = MALLOC(CTL_BUF_SIZE));
 #		endif
-		CHKmalloc(wrkrInfo[i].pRcvBuf = MALLOC(lenRcvBuf));
 		wrkrInfo[i].id = i;
 	}
 finalize_it:
@@ -1063,17 +1609,45 @@ CODESTARTfreeCnf
 		free(inst->pszBindAddr);
 		free(inst->inputname);
 		free(inst->dfltTZ);
+		free(inst->pszCaptureIface);
 		del = inst;
 		inst = inst->next;
 		free(del);
 	}
+	free(pModConf->pszCpuSet);
+	if(pModConf->pCpuSet != NULL)
+		srCpuSetDestruct(&pModConf->pCpuSet);
 ENDfreeCnf
 
 
+/* get the CPU set worker iWrkr should run on if all the listeners it
+ * serves feed rulesets bound to the same CPUs (ruleset parameter cpuset),
+ * so that the input stays with the rest of the traffic class. NULL if not.
+ */
+static srCpuSet_t *
+getRulesetCpuSet(int iWrkr)
+{
+	struct lstn_s *lstn;
+	srCpuSet_t *pSet = NULL;
+	srCpuSet_t *pLstnSet;
+
+	for(lstn = lcnfRoot ; lstn != NULL ; lstn = lstn->next) {
+		if(lstn->iWrkr != -1 && lstn->iWrkr != iWrkr)
+			continue;
+		pLstnSet = ruleset.GetCpuSet(lstn->pRuleset);
+		if(pLstnSet == NULL || (pSet != NULL && pLstnSet != pSet))
+			return NULL;
+		pSet = pLstnSet;
+	}
+	return pSet;
+}
+
+
 static void *
 wrkr(void *myself)
 {
 	struct wrkrInfo_s *pWrkr = (struct wrkrInfo_s*) myself;
+	srCpuSet_t *pRulesetCpuSet;
 #	if HAVE_PRCTL && defined PR_SET_NAME
 	uchar *pszDbgHdr;
 #	endif
@@ -1098,6 +1672,28 @@ wrkr(void *myself)
 	 */
 	setSchedParams(runModConf);
 
+	/* the receive buffers are only touched from here on, so binding the
+	 * thread first also makes them local to its CPUs.
+	 */
+	if(bCpuSteering) {
+		/* the steering filter hands us packets from CPUs c with
+		 * c % wrkrMax == id, so we must run there.
+		 */
+		if(srCpuSetBindModulo(runModConf->pCpuSet, runModConf->wrkrMax, pWrkr->id) != RS_RET_OK) {
+			errmsg.LogError(errno, NO_ERRCODE, "imudp: could not bind worker thread %d "
+					"for CPU steering - ignoring", pWrkr->id);
+		}
+	} else if(runModConf->pCpuSet != NULL) {
+		if(srCpuSetBind(runModConf->pCpuSet) != RS_RET_OK) {
+			errmsg.LogError(errno, NO_ERRCODE, "imudp: could not bind worker thread to "
+					"cpuset '%s' - ignoring", runModConf->pszCpuSet);
+		}
+	} else if((pRulesetCpuSet = getRulesetCpuSet(pWrkr->id)) != NULL
+		  && srCpuSetBind(pRulesetCpuSet) != RS_RET_OK) {
+		errmsg.LogError(errno, NO_ERRCODE, "imudp: could not bind worker thread %d to "
+				"the cpuset of its ruleset - ignoring", pWrkr->id);
+	}
+
 	/* support statistics gathering */
 	statsobj.Construct(&(pWrkr->stats));
 	statsobj.SetName(pWrkr->stats, thrdName);
@@ -1156,6 +1752,9 @@ ENDwillRun
 BEGINafterRun
 	struct lstn_s *lstn, *lstnDel;
 	int i;
+#	ifdef HAVE_RECVMMSG
+	int j;
+#	endif
 CODESTARTafterRun
 	/* do cleanup here */
 	net.clearAllowedSenders((uchar*)"UDP");
@@ -1163,19 +1762,31 @@ CODESTARTafterRun
 		statsobj.Destruct(&(lstn->stats));
 		ratelimitDestruct(lstn->ratelimiter);
 		close(lstn->sock);
+#		ifdef USE_PKT_CAPTURE
+		if(lstn->pRing != NULL) {
+			munmap(lstn->pRing->pMap, lstn->pRing->lenMap);
+			free(lstn->pRing);
+		}
+#		endif
 		prop.Destruct(&lstn->pInputName);
 		lstnDel = lstn;
 		lstn = lstn->next;
 		free(lstnDel);
 	}
 	lcnfRoot = lcnfLast = NULL;
+	bCpuSteering = 0;
 	for(i = 0 ; i < runModConf->wrkrMax ; ++i) {
 #		ifdef HAVE_RECVMMSG
 		free(wrkrInfo[i].recvmsg_iov);
 		free(wrkrInfo[i].recvmsg_mmh);
 		free(wrkrInfo[i].frominet);
-#		endif
+		for(j = 0 ; j < runModConf->batchSize ; ++j)
+			free(wrkrInfo[i].ppRcvBufs[j]);
+		free(wrkrInfo[i].ppRcvBufs);
+#		else
 		free(wrkrInfo[i].pRcvBuf);
+#		endif
+		free(wrkrInfo[i].pCtlBuf);
 	}
 ENDafterRun
 
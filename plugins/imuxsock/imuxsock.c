@@ -101,7 +101,7 @@ DEFobjCurrIf(statsobj)
 
 
 statsobj_t *modStats;
-STATSCOUNTER_DEF(ctrSubmit, mutCtrSubmit)
+STATSCOUNTER_SHARDED_DEF(ctrSubmit)
 STATSCOUNTER_DEF(ctrLostRatelimit, mutCtrLostRatelimit)
 STATSCOUNTER_DEF(ctrNumRatelimiters, mutCtrNumRatelimiters)
 
@@ -137,6 +137,8 @@ typedef struct lstn_s {
 	ratelimit_t *dflt_ratelimiter;/*ratelimiter to apply if none else is to be used */
 	intTiny ratelimitSev;	/* severity level (and below) for which rate-limiting shall apply */
 	struct hashtable *ht;	/* our hashtable for rate-limiting */
+	ratelimit_t *lastRatelimiter; /* ratelimiter found by last lookup (ht entries are never removed) */
+	pid_t lastPid;		/* pid lastRatelimiter belongs to */
 	sbool bParseHost;	/* should parser parse host name?  read-only after startup */
 	sbool bCreatePath;	/* auto-creation of socket directory? */
 	sbool bUseCreds;	/* pull original creator credentials from socket */
@@ -149,6 +151,41 @@ typedef struct lstn_s {
 } lstn_t;
 static lstn_t *listeners;
 
+/* Cache for trusted properties. Obtaining them requires three /proc accesses
+ * per message, which is very costly for chatty processes. So we keep them
+ * for a short time. The cache is direct-mapped by pid; uid and gid are
+ * checked as well, which makes pid reuse within the lifetime of an entry
+ * very unlikely to go undetected.
+ */
+#define TRUSTED_CACHE_SIZE 256
+#define TRUSTED_CACHE_TTL 1	/* seconds an entry stays valid */
+typedef struct trustedProps_s {
+	pid_t pid;
+	uid_t uid;
+	gid_t gid;
+	time_t tFetched;	/* 0 -> entry unused */
+	uchar *comm;		/* NULL if property could not be obtained */
+	uchar *exe;
+	uchar *cmdline;
+	int lenComm;
+	int lenExe;
+	int lenCmdline;
+} trustedProps_t;
+static trustedProps_t trustedCache[TRUSTED_CACHE_SIZE];
+
+#ifdef HAVE_RECVMMSG
+/* receive buffers for batched reception. imuxsock is single-threaded, so
+ * one set of buffers is sufficient. They are allocated on first use.
+ */
+#define RCV_BATCH_SIZE 32
+#define RCV_AUX_SIZE 128
+static struct mmsghdr *rcvMmsgs = NULL;
+static struct iovec *rcvIovs = NULL;
+static uchar *rcvBufs = NULL;	/* RCV_BATCH_SIZE buffers of iMaxLine+1 bytes each */
+static char *rcvAux = NULL;	/* RCV_BATCH_SIZE control buffers */
+static int rcvBufLen = 0;	/* size of each buffer inside rcvBufs */
+#endif
+
 static prop_t *pLocalHostIP = NULL;	/* there is only one global IP for all internally-generated messages */
 static prop_t *pInputName = NULL;	/* our inputName currently is always "imudp", and this will hold it */
 static int startIndexUxLocalSockets; /* process fd from that index on (used to
@@ -381,7 +418,7 @@ addListner(instanceConf_t *inst)
 		CHKiRet(prop.ConstructFinalize(listeners[nfd].hostName));
 	}
 	if(inst->ratelimitInterval > 0) {
-		if((listeners[nfd].ht = create_hashtable(100, hash_from_key_fn, key_equals_fn,
+		if((listeners[nfd].ht = create_hashtable_inlinekey(100, sizeof(pid_t), hash_from_key_fn, key_equals_fn,
 			(void(*)(void*))ratelimitDestruct)) == NULL) {
 			/* in this case, we simply turn off rate-limiting */
 			DBGPRINTF("imuxsock: turning off rate limiting because we could not "
@@ -391,6 +428,7 @@ addListner(instanceConf_t *inst)
 	} else {
 		listeners[nfd].ht = NULL;
 	}
+	listeners[nfd].lastRatelimiter = NULL;
 	listeners[nfd].ratelimitInterval = inst->ratelimitInterval;
 	listeners[nfd].ratelimitBurst = inst->ratelimitBurst;
 	listeners[nfd].ratelimitSev = inst->ratelimitSeverity;
@@ -435,7 +473,9 @@ static rsRetVal discardLogSockets(void)
 		}
 		if(listeners[i].ht != NULL) {
 			hashtable_destroy(listeners[i].ht, 1); /* 1 => free all values automatically */
+			listeners[i].ht = NULL;
 		}
+		listeners[i].lastRatelimiter = NULL;
 		ratelimitDestruct(listeners[i].dflt_ratelimiter);
 	}
 
@@ -553,7 +593,6 @@ findRatelimiter(lstn_t *pLstn, struct ucred *cred, ratelimit_t **prl)
 {
 	ratelimit_t *rl;
 	int r;
-	pid_t *keybuf;
 	char pidbuf[256];
 	DEFiRet;
 
@@ -570,6 +609,12 @@ findRatelimiter(lstn_t *pLstn, struct ucred *cred, ratelimit_t **prl)
 		FINALIZE;
 	}
 
+	/* consecutive messages very often come from the same process */
+	if(pLstn->lastRatelimiter != NULL && pLstn->lastPid == cred->pid) {
+		*prl = pLstn->lastRatelimiter;
+		FINALIZE;
+	}
+
 	rl = hashtable_search(pLstn->ht, &cred->pid);
 	if(rl == NULL) {
 		/* we need to add a new ratelimiter, process not seen before! */
@@ -582,14 +627,14 @@ findRatelimiter(lstn_t *pLstn, struct ucred *cred, ratelimit_t **prl)
 		CHKiRet(ratelimitNew(&rl, "imuxsock", pidbuf));
 		ratelimitSetLinuxLike(rl, pLstn->ratelimitInterval, pLstn->ratelimitBurst);
 		ratelimitSetSeverity(rl, pLstn->ratelimitSev);
-		CHKmalloc(keybuf = malloc(sizeof(pid_t)));
-		*keybuf = cred->pid;
-		r = hashtable_insert(pLstn->ht, keybuf, rl);
+		r = hashtable_insert_copy(pLstn->ht, &cred->pid, sizeof(pid_t), rl);
 		if(r == 0)
 			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 	}
 
 	*prl = rl;
+	pLstn->lastRatelimiter = rl;
+	pLstn->lastPid = cred->pid;
 
 finalize_it:
 	if(*prl == NULL)
@@ -698,6 +743,64 @@ finalize_it:
 }
 
 
+/* free the properties held by a trusted cache entry */
+static void
+trustedPropsFree(trustedProps_t *tp)
+{
+	free(tp->comm);
+	free(tp->exe);
+	free(tp->cmdline);
+	tp->comm = tp->exe = tp->cmdline = NULL;
+	tp->tFetched = 0;
+}
+
+
+/* duplicate a property into the cache, NULL if not obtained */
+static inline uchar *
+trustedPropsDup(rsRetVal localRet, uchar *buf, int lenProp, int *pLen)
+{
+	uchar *p;
+
+	if(localRet != RS_RET_OK)
+		return NULL;
+	if((p = malloc(lenProp + 1)) != NULL) {
+		memcpy(p, buf, lenProp + 1);
+		*pLen = lenProp;
+	}
+	return p;
+}
+
+
+/* get the trusted properties for the sender, either from the cache or
+ * from the system. tt is the time the message was received.
+ */
+static trustedProps_t *
+getTrustedProps(struct ucred *cred, time_t tt)
+{
+	trustedProps_t *const tp = &trustedCache[(unsigned) cred->pid % TRUSTED_CACHE_SIZE];
+	uchar propBuf[1024];
+	int lenProp = 0;
+	rsRetVal localRet;
+
+	if(   tp->tFetched != 0 && tp->pid == cred->pid && tp->uid == cred->uid && tp->gid == cred->gid
+	   && tt >= tp->tFetched && tt - tp->tFetched < TRUSTED_CACHE_TTL)
+		return tp;
+
+	trustedPropsFree(tp);
+	localRet = getTrustedProp(cred, "comm", propBuf, sizeof(propBuf), &lenProp);
+	tp->comm = trustedPropsDup(localRet, propBuf, lenProp, &tp->lenComm);
+	localRet = getTrustedExe(cred, propBuf, sizeof(propBuf), &lenProp);
+	tp->exe = trustedPropsDup(localRet, propBuf, lenProp, &tp->lenExe);
+	localRet = getTrustedProp(cred, "cmdline", propBuf, sizeof(propBuf), &lenProp);
+	tp->cmdline = trustedPropsDup(localRet, propBuf, lenProp, &tp->lenCmdline);
+	tp->pid = cred->pid;
+	tp->uid = cred->uid;
+	tp->gid = cred->gid;
+	tp->tFetched = (tt == 0) ? 1 : tt;
+	return tp;
+}
+
+
 /* copy a trusted property in escaped mode. That is, the property can contain
  * any character and so it must be properly quoted AND escaped.
  * It is assumed the output buffer is large enough. Returns the number of
@@ -725,7 +828,8 @@ copyescaped(uchar *dstbuf, uchar *inbuf, int inlen)
  * can also mangle it if necessary.
  */
 static inline rsRetVal
-SubmitMsg(uchar *pRcv, int lenRcv, lstn_t *pLstn, struct ucred *cred, struct timeval *ts)
+SubmitMsg(uchar *pRcv, int lenRcv, lstn_t *pLstn, struct ucred *cred, struct timeval *ts,
+	  multi_submit_t *pMultiSub)
 {
 	msg_t *pMsg;
 	int lenMsg;
@@ -740,6 +844,7 @@ SubmitMsg(uchar *pRcv, int lenRcv, lstn_t *pLstn, struct ucred *cred, struct tim
 	time_t tt;
 	int lenProp;
 	ratelimit_t *ratelimiter = NULL;
+	trustedProps_t *tp;
 	uchar propBuf[1024];
 	uchar msgbuf[8192];
 	uchar *pmsgbuf;
@@ -794,6 +899,7 @@ SubmitMsg(uchar *pRcv, int lenRcv, lstn_t *pLstn, struct ucred *cred, struct tim
 		} else {
 			CHKmalloc(pmsgbuf = malloc(lenRcv+4096));
 		}
+		tp = getTrustedProps(cred, tt);
 
 		if (pLstn->bParseTrusted) {
 			json = json_object_new_object();
@@ -804,16 +910,16 @@ SubmitMsg(uchar *pRcv, int lenRcv, lstn_t *pLstn, struct ucred *cred, struct tim
 			json_object_object_add(json, "uid", jval);
 			jval = json_object_new_int(cred->gid);
 			json_object_object_add(json, "gid", jval);
-			if(getTrustedProp(cred, "comm", propBuf, sizeof(propBuf), &lenProp) == RS_RET_OK) {
-				jval = json_object_new_string((char*)propBuf);
+			if(tp->comm != NULL) {
+				jval = json_object_new_string((char*)tp->comm);
 				json_object_object_add(json, "appname", jval);
 			}
-			if(getTrustedExe(cred, propBuf, sizeof(propBuf), &lenProp) == RS_RET_OK) {
-				jval = json_object_new_string((char*)propBuf);
+			if(tp->exe != NULL) {
+				jval = json_object_new_string((char*)tp->exe);
 				json_object_object_add(json, "exe", jval);
 			}
-			if(getTrustedProp(cred, "cmdline", propBuf, sizeof(propBuf), &lenProp) == RS_RET_OK) {
-				jval = json_object_new_string((char*)propBuf);
+			if(tp->cmdline != NULL) {
+				jval = json_object_new_string((char*)tp->cmdline);
 				json_object_object_add(json, "cmd", jval);
 			}
 		} else {
@@ -826,20 +932,20 @@ SubmitMsg(uchar *pRcv, int lenRcv, lstn_t *pLstn, struct ucred *cred, struct tim
 			memcpy(pmsgbuf+toffs, propBuf, lenProp);
 			toffs = toffs + lenProp;
 	
-			if(getTrustedProp(cred, "comm", propBuf, sizeof(propBuf), &lenProp) == RS_RET_OK) {
+			if(tp->comm != NULL) {
 				memcpy(pmsgbuf+toffs, " _COMM=", 7);
-				memcpy(pmsgbuf+toffs+7, propBuf, lenProp);
-				toffs = toffs + 7 + lenProp;
+				memcpy(pmsgbuf+toffs+7, tp->comm, tp->lenComm);
+				toffs = toffs + 7 + tp->lenComm;
 			}
-			if(getTrustedExe(cred, propBuf, sizeof(propBuf), &lenProp) == RS_RET_OK) {
+			if(tp->exe != NULL) {
 				memcpy(pmsgbuf+toffs, " _EXE=", 6);
-				memcpy(pmsgbuf+toffs+6, propBuf, lenProp);
-				toffs = toffs + 6 + lenProp;
+				memcpy(pmsgbuf+toffs+6, tp->exe, tp->lenExe);
+				toffs = toffs + 6 + tp->lenExe;
 			}
-			if(getTrustedProp(cred, "cmdline", propBuf, sizeof(propBuf), &lenProp) == RS_RET_OK) {
+			if(tp->cmdline != NULL) {
 				memcpy(pmsgbuf+toffs, " _CMDLINE=", 10);
 				toffs = toffs + 10 + 
-					copyescaped(pmsgbuf+toffs+10, propBuf, lenProp);
+					copyescaped(pmsgbuf+toffs+10, tp->cmdline, tp->lenCmdline);
 			}
 
 			/* finalize string */
@@ -920,13 +1026,123 @@ SubmitMsg(uchar *pRcv, int lenRcv, lstn_t *pLstn, struct ucred *cred, struct tim
 
 	MsgSetRcvFrom(pMsg, pLstn->hostName == NULL ? glbl.GetLocalHostNameProp() : pLstn->hostName);
 	CHKiRet(MsgSetRcvFromIP(pMsg, pLocalHostIP));
-	ratelimitAddMsg(ratelimiter, NULL, pMsg);
-	STATSCOUNTER_INC(ctrSubmit, mutCtrSubmit);
+	ratelimitAddMsg(ratelimiter, pMultiSub, pMsg);
+	STATSCOUNTER_SHARDED_INC(ctrSubmit);
 finalize_it:
 	RETiRet;
 }
 
 
+/* extract the sender credentials and system timestamp from the
+ * control data of a received message.
+ */
+static inline void
+getRcvCtlData(lstn_t *pLstn, struct msghdr *msgh, struct ucred **cred, struct timeval **ts)
+{
+	struct cmsghdr *cm;
+
+	*cred = NULL;
+	*ts = NULL;
+	if(!pLstn->bUseCreds)
+		return;
+	for(cm = CMSG_FIRSTHDR(msgh); cm; cm = CMSG_NXTHDR(msgh, cm)) {
+#		if HAVE_SCM_CREDENTIALS
+		if(cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_CREDENTIALS) {
+			*cred = (struct ucred*) CMSG_DATA(cm);
+		}
+#		endif /* HAVE_SCM_CREDENTIALS */
+#		if HAVE_SO_TIMESTAMP
+		if(   pLstn->bUseSysTimeStamp 
+		   && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_TIMESTAMP) {
+			*ts = (struct timeval *)CMSG_DATA(cm);
+		}
+#		endif /* HAVE_SO_TIMESTAMP */
+	}
+}
+
+
+#ifdef HAVE_RECVMMSG
+/* This function receives data from a socket indicated to be ready
+ * to receive and submits the messages received for processing. Up to
+ * RCV_BATCH_SIZE messages are dequeued from the socket with a single
+ * recvmmsg() call and submitted to the main queue as one batch.
+ */
+static rsRetVal readSocket(lstn_t *pLstn)
+{
+	DEFiRet;
+	int nelem;
+	int i;
+	int iMaxLine;
+	struct ucred *cred;
+	struct timeval *ts;
+	msg_t *pMsgs[RCV_BATCH_SIZE];
+	multi_submit_t multiSub;
+
+	assert(pLstn->fd >= 0);
+
+	multiSub.ppMsgs = pMsgs;
+	multiSub.maxElem = RCV_BATCH_SIZE;
+	multiSub.nElem = 0;
+
+	iMaxLine = glbl.GetMaxLine();
+	if(rcvBufs == NULL || rcvBufLen != iMaxLine + 1) {
+		free(rcvBufs);
+		rcvBufLen = 0;
+		CHKmalloc(rcvBufs = malloc(RCV_BATCH_SIZE * (iMaxLine + 1)));
+		rcvBufLen = iMaxLine + 1;
+	}
+	if(rcvMmsgs == NULL) {
+		CHKmalloc(rcvMmsgs = malloc(RCV_BATCH_SIZE * sizeof(struct mmsghdr)));
+		CHKmalloc(rcvIovs = malloc(RCV_BATCH_SIZE * sizeof(struct iovec)));
+		CHKmalloc(rcvAux = malloc(RCV_BATCH_SIZE * RCV_AUX_SIZE));
+	}
+
+	memset(rcvMmsgs, 0, RCV_BATCH_SIZE * sizeof(struct mmsghdr));
+	for(i = 0 ; i < RCV_BATCH_SIZE ; ++i) {
+		rcvIovs[i].iov_base = rcvBufs + i * rcvBufLen;
+		rcvIovs[i].iov_len = iMaxLine;
+		rcvMmsgs[i].msg_hdr.msg_iov = &rcvIovs[i];
+		rcvMmsgs[i].msg_hdr.msg_iovlen = 1;
+#		if HAVE_SCM_CREDENTIALS
+		if(pLstn->bUseCreds) {
+			rcvMmsgs[i].msg_hdr.msg_control = rcvAux + i * RCV_AUX_SIZE;
+			rcvMmsgs[i].msg_hdr.msg_controllen = RCV_AUX_SIZE;
+		}
+#		endif
+	}
+	nelem = recvmmsg(pLstn->fd, rcvMmsgs, RCV_BATCH_SIZE, MSG_DONTWAIT, NULL);
+	if(nelem < 0 && errno == ENOSYS) {
+		/* some environments (e.g. older valgrind) do not support recvmmsg() */
+		nelem = recvmsg(pLstn->fd, &rcvMmsgs[0].msg_hdr, MSG_DONTWAIT);
+		if(nelem >= 0) {
+			rcvMmsgs[0].msg_len = nelem;
+			nelem = 1;
+		}
+	}
+ 
+	DBGPRINTF("Message from UNIX socket: #%d, %d in batch\n", pLstn->fd, nelem);
+	if(nelem < 0) {
+		if(errno != EINTR && errno != EAGAIN) {
+			char errStr[1024];
+			rs_strerror_r(errno, errStr, sizeof(errStr));
+			DBGPRINTF("UNIX socket error: %d = %s.\n", errno, errStr);
+			errmsg.LogError(errno, NO_ERRCODE, "imuxsock: recvfrom UNIX");
+		}
+		FINALIZE;
+	}
+
+	for(i = 0 ; i < nelem ; ++i) {
+		if(rcvMmsgs[i].msg_len == 0)
+			continue;
+		getRcvCtlData(pLstn, &rcvMmsgs[i].msg_hdr, &cred, &ts);
+		CHKiRet(SubmitMsg(rcvBufs + i * rcvBufLen, rcvMmsgs[i].msg_len, pLstn, cred, ts, &multiSub));
+	}
+
+finalize_it:
+	multiSubmitFlush(&multiSub);
+	RETiRet;
+}
+#else /* we do not have recvmmsg() */
 /* This function receives data from a socket indicated to be ready
  * to receive and submits the message received for processing.
  * rgerhards, 2007-12-20
@@ -941,7 +1157,6 @@ static rsRetVal readSocket(lstn_t *pLstn)
 	int iMaxLine;
 	struct msghdr msgh;
 	struct iovec msgiov;
-	struct cmsghdr *cm;
 	struct ucred *cred;
 	struct timeval *ts;
 	uchar bufRcv[4096+1];
@@ -983,25 +1198,8 @@ static rsRetVal readSocket(lstn_t *pLstn)
  
 	DBGPRINTF("Message from UNIX socket: #%d\n", pLstn->fd);
 	if(iRcvd > 0) {
-		cred = NULL;
-		ts = NULL;
-		if(pLstn->bUseCreds) {
-			for(cm = CMSG_FIRSTHDR(&msgh); cm; cm = CMSG_NXTHDR(&msgh, cm)) {
-#				if HAVE_SCM_CREDENTIALS
-				if(   pLstn->bUseCreds
-				   && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_CREDENTIALS) {
-					cred = (struct ucred*) CMSG_DATA(cm);
-				}
-#				endif /* HAVE_SCM_CREDENTIALS */
-#				if HAVE_SO_TIMESTAMP
-				if(   pLstn->bUseSysTimeStamp 
-				   && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_TIMESTAMP) {
-					ts = (struct timeval *)CMSG_DATA(cm);
-				}
-#				endif /* HAVE_SO_TIMESTAMP */
-			}
-		}
-		CHKiRet(SubmitMsg(pRcv, iRcvd, pLstn, cred, ts));
+		getRcvCtlData(pLstn, &msgh, &cred, &ts);
+		CHKiRet(SubmitMsg(pRcv, iRcvd, pLstn, cred, ts, NULL));
 	} else if(iRcvd < 0 && errno != EINTR && errno != EAGAIN) {
 		char errStr[1024];
 		rs_strerror_r(errno, errStr, sizeof(errStr));
@@ -1015,6 +1213,7 @@ finalize_it:
 
 	RETiRet;
 }
+#endif /* #ifdef HAVE_RECVMMSG */
 
 
 /* activate current listeners */
@@ -1045,7 +1244,8 @@ activateListeners()
 		}
 	}
 	if(runModConf->ratelimitIntervalSysSock > 0) {
-		if((listeners[0].ht = create_hashtable(100, hash_from_key_fn, key_equals_fn, NULL)) == NULL) {
+		if((listeners[0].ht = create_hashtable_inlinekey(100, sizeof(pid_t), hash_from_key_fn,
+			key_equals_fn, NULL)) == NULL) {
 			/* in this case, we simply turn of rate-limiting */
 			errmsg.LogError(0, NO_ERRCODE, "imuxsock: turning off rate limiting because we could not "
 				  "create hash table\n");
@@ -1424,6 +1624,20 @@ CODESTARTafterRun
 			}
 		}
 
+	for(i = 0 ; i < TRUSTED_CACHE_SIZE ; ++i)
+		trustedPropsFree(&trustedCache[i]);
+#	ifdef HAVE_RECVMMSG
+	free(rcvMmsgs);
+	free(rcvIovs);
+	free(rcvBufs);
+	free(rcvAux);
+	rcvMmsgs = NULL;
+	rcvIovs = NULL;
+	rcvBufs = NULL;
+	rcvAux = NULL;
+	rcvBufLen = 0;
+#	endif
+
 	discardLogSockets();
 	nfd = 1;
 ENDafterRun
@@ -1528,6 +1742,7 @@ CODEmodInit_QueryRegCFSLineHdlr
 	listeners[0].flags = IGNDATE;
 	listeners[0].sockName = UCHAR_CONSTANT(_PATH_LOG);
 	listeners[0].hostName = NULL;
+	listeners[0].lastRatelimiter = NULL;
 	listeners[0].flowCtl = eFLOWCTL_NO_DELAY;
 	listeners[0].fd = -1;
 	listeners[0].bParseHost = 0;
@@ -1538,7 +1753,7 @@ CODEmodInit_QueryRegCFSLineHdlr
 	listeners[0].bUnlink = 1;
 	listeners[0].bCreatePath = 0;
 	listeners[0].bUseSysTimeStamp = 1;
-	if((listeners[0].ht = create_hashtable(100, hash_from_key_fn, key_equals_fn,
+	if((listeners[0].ht = create_hashtable_inlinekey(100, sizeof(pid_t), hash_from_key_fn, key_equals_fn,
 		(void(*)(void*))ratelimitDestruct)) == NULL) {
 		/* in this case, we simply turn off rate-limiting */
 		DBGPRINTF("imuxsock: turning off rate limiting for system socket "
@@ -1603,9 +1818,9 @@ CODEmodInit_QueryRegCFSLineHdlr
 	/* support statistics gathering */
 	CHKiRet(statsobj.Construct(&modStats));
 	CHKiRet(statsobj.SetName(modStats, UCHAR_CONSTANT("imuxsock")));
-	STATSCOUNTER_INIT(ctrSubmit, mutCtrSubmit);
+	STATSCOUNTER_SHARDED_INIT(ctrSubmit);
 	CHKiRet(statsobj.AddCounter(modStats, UCHAR_CONSTANT("submitted"),
-		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &ctrSubmit));
+		ctrType_IntCtrSharded, CTR_FLAG_RESETTABLE, &ctrSubmit));
 	STATSCOUNTER_INIT(ctrLostRatelimit, mutCtrLostRatelimit);
 	CHKiRet(statsobj.AddCounter(modStats, UCHAR_CONSTANT("ratelimit.discarded"),
 		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &ctrLostRatelimit));
@@ -42,6 +42,7 @@
 #include "net.h"
 #include "parser.h"
 #include "prop.h"
+#include "ratelimit.h"
 #include "ruleset.h"
 #include "srUtils.h"
 #include "unicode-helper.h"
@@ -58,6 +59,11 @@ MODULE_CNFNAME("imzmq3");
 #define ACTION_CONNECT 1
 #define ACTION_BIND    2
 
+/* how the frames of a multipart message are mapped to syslog messages */
+#define MULTIPART_JOIN   0 /* one message, frames separated by a space */
+#define MULTIPART_FIELDS 1 /* last frame is the message, others go to $!zmq!frames */
+#define MULTIPART_SPLIT  2 /* one message per frame */
+
 /* Module static data */
 DEF_IMOD_STATIC_DATA
 DEFobjCurrIf(errmsg)
@@ -80,9 +86,12 @@ typedef struct _socket_action {
     int   action;
 } socket_action;
 
+struct lstn_s;
+
 typedef struct _poller_data {
-    ruleset_t*  ruleset;
-    thrdInfo_t* thread;
+    struct lstn_s*  lstn;
+    multi_submit_t* multiSub;
+    thrdInfo_t*     thread;
 } poller_data;
 
 
@@ -114,6 +123,7 @@ struct instanceConf_s {
     int                    reconnectIVLMax;
     int                    ipv4Only;
     int                    affinity;
+    int                    multipart;
     uchar*                 pszBindRuleset;
     ruleset_t*             pBindRuleset;
     struct instanceConf_s* next;
@@ -130,6 +140,10 @@ struct lstn_s {
     struct lstn_s* next;
     void* sock;
     ruleset_t* pRuleset;
+    ratelimit_t* ratelimiter;
+    int multipart;
+    char* buf;     /* assembles joined multipart messages */
+    size_t lenBuf;
 };
 
 /* ----------------------------------------------------------------------------
@@ -185,7 +199,8 @@ static struct cnfparamdescr inppdescr[] = {
     { "reconnectIVL",        eCmdHdlrInt,     0 },
     { "reconnectIVLMax",     eCmdHdlrInt,     0 },
     { "ipv4Only",            eCmdHdlrInt,     0 },
-    { "affinity",            eCmdHdlrInt,     0 }
+    { "affinity",            eCmdHdlrInt,     0 },
+    { "multipart",           eCmdHdlrGetWord, 0 }
 };
 
 static struct cnfparamblk inppblk = {
@@ -267,6 +282,7 @@ static void setDefaults(instanceConf_t* info) {
     info->reconnectIVLMax = -1;
     info->ipv4Only        = -1;
     info->affinity        = -1;
+    info->multipart       = MULTIPART_JOIN;
     info->next            = NULL;
 };
 
@@ -506,6 +522,19 @@ static rsRetVal createListener(struct cnfparamvals* pvals) {
             inst->ipv4Only = (int) pvals[i].val.d.n;
         } else if(!strcmp(inppblk.descr[i].name, "affinity")) {
             inst->affinity = (int) pvals[i].val.d.n;
+        } else if(!strcmp(inppblk.descr[i].name, "multipart")) {
+            if(!es_strconstcmp(pvals[i].val.d.estr, "join")) {
+                inst->multipart = MULTIPART_JOIN;
+            } else if(!es_strconstcmp(pvals[i].val.d.estr, "fields")) {
+                inst->multipart = MULTIPART_FIELDS;
+            } else if(!es_strconstcmp(pvals[i].val.d.estr, "split")) {
+                inst->multipart = MULTIPART_SPLIT;
+            } else {
+                char *cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+                errmsg.LogError(0, RS_RET_INVALID_PARAMS, "imzmq3: invalid "
+                                "multipart mode '%s', using 'join'", cstr);
+                free(cstr);
+            }
         } else {
             errmsg.LogError(0, NO_ERRCODE, "imzmq3: program error, non-handled "
                             "param '%s'\n", inppblk.descr[i].name);
@@ -525,10 +554,15 @@ static rsRetVal addListener(instanceConf_t* inst){
     CHKiRet(createSocket(inst, &sock));
 
     /* now create new lstn_s struct */
-    CHKmalloc(newcnfinfo=(struct lstn_s*)MALLOC(sizeof(struct lstn_s)));
+    CHKmalloc(newcnfinfo=(struct lstn_s*)calloc(1, sizeof(struct lstn_s)));
     newcnfinfo->next = NULL;
     newcnfinfo->sock = sock;
     newcnfinfo->pRuleset = inst->pBindRuleset;
+    newcnfinfo->multipart = inst->multipart;
+    if((iRet = ratelimitNew(&newcnfinfo->ratelimiter, "imzmq3", inst->description)) != RS_RET_OK) {
+        free(newcnfinfo);
+        FINALIZE;
+    }
     
     /* add this struct to the global */
     if(lcnfRoot == NULL) {
@@ -545,26 +579,109 @@ finalize_it:
     RETiRet;
 }
 
-static int handlePoll(zloop_t __attribute__((unused)) * loop, zmq_pollitem_t *poller, void* pd) {
+/* append a frame to the multipart buffer of a listener */
+static rsRetVal addToBuf(struct lstn_s* lstn, size_t* pOffs, zmq_msg_t* frame) {
+    size_t lenFrame = zmq_msg_size(frame);
+    size_t lenNeeded = *pOffs + lenFrame + 1;
+    char* newBuf;
+    DEFiRet;
+
+    if (lenNeeded > lstn->lenBuf) {
+        CHKmalloc(newBuf = realloc(lstn->buf, lenNeeded + 1024));
+        lstn->buf = newBuf;
+        lstn->lenBuf = lenNeeded + 1024;
+    }
+    if (*pOffs > 0)
+        lstn->buf[(*pOffs)++] = ' ';
+    memcpy(lstn->buf + *pOffs, zmq_msg_data(frame), lenFrame);
+    *pOffs += lenFrame;
+
+finalize_it:
+    RETiRet;
+}
+
+/* receive a message without blocking and add it to the batch. The msg_t
+ * is constructed straight from the frame data, without an intermediate
+ * string. Returns RS_RET_NO_MORE_DATA if nothing is available.
+ */
+static rsRetVal rcvMsg(struct lstn_s* lstn, multi_submit_t* pMultiSub) {
+    zmq_msg_t frame;
     msg_t* pMsg;
+    struct json_object* jFrames = NULL;
+    size_t lenJoined = 0;
+    int bJoined = 0;
+    DEFiRet;
+
+    zmq_msg_init(&frame);
+    if (zmq_msg_recv(&frame, lstn->sock, ZMQ_DONTWAIT) == -1) {
+        if (errno != EAGAIN && errno != EINTR)
+            DBGPRINTF("imzmq3: zmq_msg_recv failed: %s\n", zmq_strerror(errno));
+        ABORT_FINALIZE(RS_RET_NO_MORE_DATA);
+    }
+
+    /* all frames of a multipart message are delivered at once, so the
+     * remaining ones are available as soon as we have the first one.
+     */
+    while (lstn->multipart != MULTIPART_SPLIT && zmq_msg_more(&frame)) {
+        if (lstn->multipart == MULTIPART_JOIN) {
+            CHKiRet(addToBuf(lstn, &lenJoined, &frame));
+            bJoined = 1;
+        } else {
+            if (jFrames == NULL)
+                CHKmalloc(jFrames = json_object_new_array());
+            json_object_array_add(jFrames, json_object_new_string_len(
+                zmq_msg_data(&frame), (int) zmq_msg_size(&frame)));
+        }
+        if (zmq_msg_recv(&frame, lstn->sock, ZMQ_DONTWAIT) == -1) {
+            DBGPRINTF("imzmq3: incomplete multipart message: %s\n", zmq_strerror(errno));
+            ABORT_FINALIZE(RS_RET_ERR);
+        }
+    }
+    if (bJoined)
+        CHKiRet(addToBuf(lstn, &lenJoined, &frame));
+
+    CHKiRet(msgConstruct(&pMsg));
+    if (bJoined)
+        MsgSetRawMsg(pMsg, lstn->buf, lenJoined);
+    else
+        MsgSetRawMsg(pMsg, zmq_msg_data(&frame), zmq_msg_size(&frame));
+    MsgSetInputName(pMsg, s_namep);
+    MsgSetHOSTNAME(pMsg, glbl.GetLocalHostName(), ustrlen(glbl.GetLocalHostName()));
+    MsgSetRcvFrom(pMsg, glbl.GetLocalHostNameProp());
+    MsgSetRcvFromIP(pMsg, glbl.GetLocalHostIP());
+    MsgSetMSGoffs(pMsg, 0);
+    MsgSetFlowControlType(pMsg, eFLOWCTL_NO_DELAY);
+    MsgSetRuleset(pMsg, lstn->pRuleset);
+    pMsg->msgFlags = NEEDS_PARSING | PARSE_HOSTNAME;
+    if (jFrames != NULL) {
+        msgAddJSON(pMsg, (uchar*)"!zmq!frames", jFrames);
+        jFrames = NULL;
+    }
+    CHKiRet(ratelimitAddMsg(lstn->ratelimiter, pMultiSub, pMsg));
+
+finalize_it:
+    zmq_msg_close(&frame);
+    if (jFrames != NULL)
+        json_object_put(jFrames);
+    RETiRet;
+}
+
+static int handlePoll(zloop_t __attribute__((unused)) * loop, zmq_pollitem_t __attribute__((unused)) *poller, void* pd) {
     poller_data* pollerData = (poller_data*)pd;
+    rsRetVal localRet;
+    int i;
 
-    char* buf = zstr_recv(poller->socket);
-    if (msgConstruct(&pMsg) == RS_RET_OK) {
-        MsgSetRawMsg(pMsg, buf, strlen(buf));
-        MsgSetInputName(pMsg, s_namep);
-        MsgSetHOSTNAME(pMsg, glbl.GetLocalHostName(), ustrlen(glbl.GetLocalHostName()));
-        MsgSetRcvFrom(pMsg, glbl.GetLocalHostNameProp());
-        MsgSetRcvFromIP(pMsg, glbl.GetLocalHostIP());
-        MsgSetMSGoffs(pMsg, 0);
-        MsgSetFlowControlType(pMsg, eFLOWCTL_NO_DELAY);
-        MsgSetRuleset(pMsg, pollerData->ruleset);
-        pMsg->msgFlags = NEEDS_PARSING | PARSE_HOSTNAME;
-        submitMsg2(pMsg);
+    /* drain the socket, but at most one batch per wake-up, so that the
+     * other sockets are not starved.
+     */
+    for (i = 0; i < CONF_NUM_MULTISUB; ++i) {
+        localRet = rcvMsg(pollerData->lstn, pollerData->multiSub);
+        if (localRet == RS_RET_NO_MORE_DATA)
+            break;
+        if (localRet != RS_RET_OK)
+            DBGPRINTF("imzmq3: error %d receiving message\n", localRet);
     }
-    
-    /* gotta free the string returned from zstr_recv() */
-    free(buf);
+    multiSubmitFlush(pollerData->multiSub);
     
     if( pollerData->thread->bShallStop == TRUE) {
         /* a handler that returns -1 will terminate the 
@@ -585,6 +702,8 @@ static rsRetVal rcv_loop(thrdInfo_t* pThrd){
     zmq_pollitem_t* items = NULL;
     poller_data*    pollerData = NULL;
     struct lstn_s*  current;
+    multi_submit_t  multiSub;
+    msg_t*          pMsgs[CONF_NUM_MULTISUB];
     instanceConf_t* inst;
     DEFiRet;
 
@@ -598,6 +717,10 @@ static rsRetVal rcv_loop(thrdInfo_t* pThrd){
         ABORT_FINALIZE(RS_RET_NO_RUN);
     }
 
+    multiSub.ppMsgs = pMsgs;
+    multiSub.maxElem = CONF_NUM_MULTISUB;
+    multiSub.nElem = 0;
+
     /* count the # of items first */
     for(current=lcnfRoot;current!=NULL;current=current->next)
         n_items++;
@@ -617,8 +740,9 @@ static rsRetVal rcv_loop(thrdInfo_t* pThrd){
         items[i].events = ZMQ_POLLIN;
         
         /* now update the poller_data for this item */
-        pollerData[i].thread  = pThrd;
-        pollerData[i].ruleset = current->pRuleset;
+        pollerData[i].thread   = pThrd;
+        pollerData[i].lstn     = current;
+        pollerData[i].multiSub = &multiSub;
     }
 
     s_zloop = zloop_new();
@@ -669,8 +793,18 @@ ENDwillRun
 
 
 BEGINafterRun
+    struct lstn_s* lstn;
+    struct lstn_s* lstnDel;
 CODESTARTafterRun
-    /* do cleanup here */
+    /* do cleanup here, the sockets were destroyed together with the context */
+    for (lstn = lcnfRoot; lstn != NULL; ) {
+        lstnDel = lstn;
+        lstn = lstn->next;
+        ratelimitDestruct(lstnDel->ratelimiter);
+        free(lstnDel->buf);
+        free(lstnDel);
+    }
+    lcnfRoot = lcnfLast = NULL;
     if (s_namep != NULL)
         prop.Destruct(&s_namep);
 ENDafterRun
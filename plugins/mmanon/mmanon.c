@@ -60,21 +60,63 @@ static const uint32_t ipv4masks[33] = {
 	0x00000000
 	};
 
+/* character classes used by the address scanner. The table is
+ * filled in modInit().
+ */
+#define CC_DIGIT 0x01	/* 0-9 */
+#define CC_HEX	 0x02	/* a-f, A-F */
+#define CC_COLON 0x04	/* ':' */
+#define CC_DOT	 0x08	/* '.' */
+#define CC_ALNUM 0x10	/* any letter or digit */
+static uchar charClass[256];
+
+/* max size of a single replacement: a full IPv6 address with
+ * embedded IPv4 part is 45 chars.
+ */
+#define MAX_REPL_LEN 64
+/* number of entries (power of two!) in the per-worker hash mode cache */
+#define ANON_CACHE_SIZE 4096
+
 /* define operation modes we have */
 #define SIMPLE_MODE 0	 /* just overwrite */
 #define REWRITE_MODE 1	 /* rewrite IP address, canoninized */
+#define HASH_MODE 2	 /* replace by keyed, prefix-preserving pseudonym */
 typedef struct _instanceData {
 	char replChar;
 	int8_t mode;
+	uint64_t hashKey[2];	/* SipHash key derived from "key" parameter */
 	struct {
 		int8_t bits;
 	} ipv4;
+	struct {
+		sbool bEnable;
+		int16_t bits;
+	} ipv6;
 } instanceData;
 
+/* cache entry for hash mode, addresses are in network byte order */
+typedef struct anonCacheEntry_s {
+	uint8_t in[16];
+	uint8_t out[16];
+	uint8_t lenAddr;	/* 4 or 16, 0 if entry is unused */
+} anonCacheEntry_t;
+
 typedef struct wrkrInstanceData {
 	instanceData *pData;
+	anonCacheEntry_t *cache;	/* hash mode only */
+	uchar *outBuf;		/* for rebuilding the message if its size changes */
+	int lenOutBuf;
 } wrkrInstanceData_t;
 
+/* an IPv6 address as found inside the message */
+typedef struct ipv6addr_s {
+	uint16_t grp[8];
+	int gstart[8];		/* text start of each group */
+	int glen[8];		/* text length of each group, 0 if "::"-compressed */
+	int v4start;		/* start of embedded IPv4 part, -1 if there is none */
+	int v4ipstart[4];	/* text start of the embedded IPv4 octets */
+} ipv6addr_t;
+
 struct modConfData_s {
 	rsconf_t *pConf;	/* our overall config object */
 };
@@ -88,6 +130,9 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "mode", eCmdHdlrGetWord, 0 },
 	{ "replacementchar", eCmdHdlrGetChar, 0 },
 	{ "ipv4.bits", eCmdHdlrInt, 0 },
+	{ "ipv6.enable", eCmdHdlrBinary, 0 },
+	{ "ipv6.bits", eCmdHdlrInt, 0 },
+	{ "key", eCmdHdlrString, 0 },
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -125,6 +170,10 @@ ENDcreateInstance
 
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
+	if(pData->mode == HASH_MODE) {
+		CHKmalloc(pWrkrData->cache = calloc(ANON_CACHE_SIZE, sizeof(anonCacheEntry_t)));
+	}
+finalize_it:
 ENDcreateWrkrInstance
 
 
@@ -140,21 +189,86 @@ ENDfreeInstance
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
+	free(pWrkrData->cache);
+	free(pWrkrData->outBuf);
 ENDfreeWrkrInstance
 
 
+/* SipHash-2-4, used as keyed PRF for hash mode. Input bytes are
+ * read little-endian as the algorithm specifies, so that results
+ * are identical on all platforms.
+ */
+#define ROTL64(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND do { \
+		v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32); \
+		v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2; \
+		v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0; \
+		v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32); \
+	} while(0)
+
+static uint64_t
+sipHash(const uint64_t key[2], const uchar *in, size_t len)
+{
+	uint64_t v0 = 0x736f6d6570736575ULL ^ key[0];
+	uint64_t v1 = 0x646f72616e646f6dULL ^ key[1];
+	uint64_t v2 = 0x6c7967656e657261ULL ^ key[0];
+	uint64_t v3 = 0x7465646279746573ULL ^ key[1];
+	uint64_t b = ((uint64_t) len) << 56;
+	uint64_t m;
+	size_t i, j;
+
+	for(i = 0 ; i + 8 <= len ; i += 8) {
+		m = 0;
+		for(j = 0 ; j < 8 ; ++j)
+			m |= ((uint64_t) in[i+j]) << (8 * j);
+		v3 ^= m;
+		SIPROUND;
+		SIPROUND;
+		v0 ^= m;
+	}
+	for(j = 0 ; i + j < len ; ++j)
+		b |= ((uint64_t) in[i+j]) << (8 * j);
+	v3 ^= b;
+	SIPROUND;
+	SIPROUND;
+	v0 ^= b;
+	v2 ^= 0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+
+/* derive the 128 bit hash mode key from the user-provided string */
+static void
+setHashKey(instanceData *pData, uchar *key)
+{
+	static const uint64_t k0[2] = { 0, 0 };
+	static const uint64_t k1[2] = { 0, 1 };
+	size_t len = strlen((char*)key);
+
+	pData->hashKey[0] = sipHash(k0, key, len);
+	pData->hashKey[1] = sipHash(k1, key, len);
+}
+
+
 static inline void
 setInstParamDefaults(instanceData *pData)
 {
 	pData->mode = REWRITE_MODE;
 	pData->replChar = 'x';
 	pData->ipv4.bits = 16;
+	pData->ipv6.bEnable = 0;
+	pData->ipv6.bits = 96;
 }
 
 BEGINnewActInst
 	struct cnfparamvals *pvals;
 	int i;
 	sbool bHadBitsErr;
+	uchar *key = NULL;
 CODESTARTnewActInst
 	DBGPRINTF("newActInst (mmanon)\n");
 	if((pvals = nvlstGetParams(lst, &actpblk, NULL)) == NULL) {
@@ -176,6 +290,9 @@ CODESTARTnewActInst
 			} else if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"rewrite",
 					 sizeof("rewrite")-1)) {
 				pData->mode = REWRITE_MODE;
+			} else if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"hash",
+					 sizeof("hash")-1)) {
+				pData->mode = HASH_MODE;
 			} else {
 				char *cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
 				errmsg.LogError(0, RS_RET_INVLD_MODE,
@@ -187,12 +304,32 @@ CODESTARTnewActInst
 			pData->replChar = es_getBufAddr(pvals[i].val.d.estr)[0];
 		} else if(!strcmp(actpblk.descr[i].name, "ipv4.bits")) {
 			pData->ipv4.bits = (int8_t) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "ipv6.enable")) {
+			pData->ipv6.bEnable = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "ipv6.bits")) {
+			pData->ipv6.bits = (int16_t) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "key")) {
+			key = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else {
 			dbgprintf("mmanon: program error, non-handled "
 			  "param '%s'\n", actpblk.descr[i].name);
 		}
 	}
 
+	if(pData->mode == HASH_MODE) {
+		if(key == NULL || key[0] == '\0') {
+			errmsg.LogError(0, RS_RET_MISSING_CNFPARAMS,
+				"mmanon: hash mode requires the key parameter, "
+				"using rewrite mode instead");
+			pData->mode = REWRITE_MODE;
+		} else {
+			setHashKey(pData, key);
+		}
+	} else if(key != NULL) {
+		errmsg.LogError(0, RS_RET_PARAM_ERROR,
+			"mmanon: key parameter is only used in hash mode - ignored");
+	}
+
 	if(pData->mode == SIMPLE_MODE) {
 		bHadBitsErr = 0;
 		if(pData->ipv4.bits < 8) {
@@ -213,22 +350,47 @@ CODESTARTnewActInst
 				"mmanon: invalid number of ipv4 bits "
 				"in simple mode, corrected to %d",
 				pData->ipv4.bits);
-	} else { /* REWRITE_MODE */
+		/* for IPv6, simple mode works on 16 bit groups */
+		if(pData->ipv6.bits < 16 || pData->ipv6.bits > 128
+		   || pData->ipv6.bits % 16 != 0) {
+			if(pData->ipv6.bits < 16)
+				pData->ipv6.bits = 16;
+			else if(pData->ipv6.bits > 128)
+				pData->ipv6.bits = 128;
+			else
+				pData->ipv6.bits = (pData->ipv6.bits / 16 + 1) * 16;
+			errmsg.LogError(0, RS_RET_INVLD_ANON_BITS,
+				"mmanon: invalid number of ipv6 bits "
+				"in simple mode, corrected to %d",
+				pData->ipv6.bits);
+		}
+	} else { /* REWRITE_MODE or HASH_MODE */
 		if(pData->ipv4.bits < 1 || pData->ipv4.bits > 32) {
 			pData->ipv4.bits = 32;
 			errmsg.LogError(0, RS_RET_INVLD_ANON_BITS,
 				"mmanon: invalid number of ipv4 bits "
-				"in rewrite mode, corrected to %d",
+				"in %s mode, corrected to %d",
+				pData->mode == HASH_MODE ? "hash" : "rewrite",
 				pData->ipv4.bits);
 		}
+		if(pData->ipv6.bits < 1 || pData->ipv6.bits > 128) {
+			pData->ipv6.bits = 128;
+			errmsg.LogError(0, RS_RET_INVLD_ANON_BITS,
+				"mmanon: invalid number of ipv6 bits "
+				"in %s mode, corrected to %d",
+				pData->mode == HASH_MODE ? "hash" : "rewrite",
+				pData->ipv6.bits);
+		}
 		if(pData->replChar != 'x') {
 			errmsg.LogError(0, RS_RET_REPLCHAR_IGNORED,
 				"mmanon: replacementChar parameter is ignored "
-				"in rewrite mode");
+				"in %s mode",
+				pData->mode == HASH_MODE ? "hash" : "rewrite");
 		}
 	}
 
 CODE_STD_FINALIZERnewActInst
+	free(key);
 	cnfparamvalsDestruct(pvals, &actpblk);
 ENDnewActInst
 
@@ -243,121 +405,482 @@ CODESTARTtryResume
 ENDtryResume
 
 
+/* get an IPv4 octet. Returns a value > 255 if there is no valid
+ * octet at the current position. All digits are consumed in any case,
+ * so that the scanner does not find an address inside a longer number.
+ */
 static int
-getnum(uchar *msg, int lenMsg, int *idx)
+getOctet(uchar *msg, int lenMsg, int *idx)
 {
 	int num = 0;
 	int i = *idx;
 
-	while(i < lenMsg && msg[i] >= '0' && msg[i] <= '9') {
-		num = num * 10 + msg[i] - '0';
+	while(i < lenMsg && (charClass[msg[i]] & CC_DIGIT)) {
+		if(i - *idx < 3)
+			num = num * 10 + msg[i] - '0';
+		else
+			num = 256;
 		++i;
 	}
+	if(i == *idx)
+		num = 256;
 
 	*idx = i;
 	return num;
 }
 
 
-/* write an IP address octet to the output position */
+/* parse an IPv4 address in dotted notation. On success, 1 is returned
+ * and idx points right after the address. Otherwise, 0 is returned and
+ * idx points to where parsing stopped (which is always past *idx).
+ */
 static int
-writeOctet(uchar *msg, int idx, int *nxtidx, uint8_t octet)
+parseIPv4(uchar *msg, int lenMsg, int *idx, uint32_t *pAddr, int ipstart[4])
 {
+	int i = *idx;
+	int octet;
+	int j;
+	uint32_t addr = 0;
+	int bRet = 0;
+
+	for(j = 0 ; j < 4 ; ++j) {
+		ipstart[j] = i;
+		octet = getOctet(msg, lenMsg, &i);
+		if(octet > 255)
+			goto done;
+		addr = (addr << 8) | octet;
+		if(j < 3) {
+			if(i >= lenMsg || msg[i] != '.')
+				goto done;
+			++i;
+		}
+	}
+	*pAddr = addr;
+	bRet = 1;
+
+done:	*idx = i;
+	return bRet;
+}
+
+
+/* write an IP address octet to the output buffer, returns number of
+ * chars written.
+ */
+static int
+writeOctet(uchar *buf, uint8_t octet)
+{
+	int i = 0;
+
 	if(octet > 99) {
-		msg[idx++] = '0' + octet / 100;
+		buf[i++] = '0' + octet / 100;
 		octet = octet % 100;
-	}
-	if(octet > 9) {
-		msg[idx++] = '0' + octet / 10;
+		buf[i++] = '0' + octet / 10;
 		octet = octet % 10;
+	} else if(octet > 9) {
+		buf[i++] = '0' + octet / 10;
+		octet = octet % 10;
+	}
+	buf[i++] =  '0' + octet;
+	return i;
+}
+
+
+static int
+writeIPv4(uchar *buf, uint32_t addr)
+{
+	int i;
+
+	i = writeOctet(buf, addr >> 24);
+	buf[i++] = '.';
+	i += writeOctet(buf + i, (addr >> 16) & 0xff);
+	buf[i++] = '.';
+	i += writeOctet(buf + i, (addr >> 8) & 0xff);
+	buf[i++] = '.';
+	i += writeOctet(buf + i, addr & 0xff);
+	return i;
+}
+
+
+/* write an IPv6 address in canonical (RFC 5952) text form. If
+ * bEmbedded is set, the last 32 bits are written in dotted
+ * IPv4 notation.
+ */
+static int
+writeIPv6(uchar *buf, uint16_t grp[8], sbool bEmbedded)
+{
+	static const char hexdigit[] = "0123456789abcdef";
+	int nHex = bEmbedded ? 6 : 8;
+	int bestStart = -1;
+	int bestLen = 1;	/* only runs of two or more groups are compressed */
+	int runStart;
+	int g, shift;
+	int i = 0;
+
+	for(g = 0 ; g < nHex ; ) {
+		if(grp[g] == 0) {
+			runStart = g;
+			while(g < nHex && grp[g] == 0)
+				++g;
+			if(g - runStart > bestLen) {
+				bestStart = runStart;
+				bestLen = g - runStart;
+			}
+		} else {
+			++g;
+		}
 	}
-	msg[idx++] =  '0' + octet;
 
-	if(nxtidx != NULL) {
-		if(idx + 1 != *nxtidx) {
-			/* we got shorter, fix it! */
-			msg[idx] = '.';
-			*nxtidx = idx + 1;
+	for(g = 0 ; g < nHex ; ) {
+		if(g == bestStart) {
+			buf[i++] = ':';
+			buf[i++] = ':';
+			g += bestLen;
+			continue;
 		}
+		if(g > 0 && g != bestStart + bestLen)
+			buf[i++] = ':';
+		for(shift = 12 ; shift > 0 && (grp[g] >> shift) == 0 ; shift -= 4)
+			; /* skip leading zeros */
+		for( ; shift >= 0 ; shift -= 4)
+			buf[i++] = hexdigit[(grp[g] >> shift) & 0x0f];
+		++g;
 	}
-	return idx;
+
+	if(bEmbedded) {
+		if(bestStart + bestLen != nHex)
+			buf[i++] = ':';
+		i += writeIPv4(buf + i, ((uint32_t) grp[6] << 16) | grp[7]);
+	}
+	return i;
 }
 
-/* currently works for IPv4 only! */
-void
-anonip(instanceData *pData, uchar *msg, int *pLenMsg, int *idx)
+
+/* replace the last bits of the address by a keyed pseudonym. This is
+ * prefix-preserving in the spirit of Crypto-PAn: output bit n depends
+ * only on the input bits 0..n, so addresses sharing a prefix get
+ * pseudonyms sharing a prefix of the same length. The address is
+ * given in network byte order and modified in place.
+ */
+static void
+hashAddr(instanceData *pData, uint8_t *addr, int lenAddr, int bits)
 {
-	int i = *idx;
-	int octet;
-	uint32_t ipv4addr;
+	uchar blk[2+16];	/* address length, bit position, prefix */
+	uint8_t flip[16];
+	int nBits = lenAddr * 8;
+	int pos;
+	int j;
+
+	blk[0] = lenAddr;
+	memcpy(blk + 2, addr, lenAddr);
+	memset(flip, 0, lenAddr);
+	for(pos = nBits - bits ; pos < nBits ; ++pos)
+		blk[2 + pos / 8] &= ~(0x80 >> (pos % 8));
+
+	for(pos = nBits - bits ; pos < nBits ; ++pos) {
+		blk[1] = pos;
+		if(sipHash(pData->hashKey, blk, 2 + lenAddr) & 1)
+			flip[pos / 8] |= 0x80 >> (pos % 8);
+		/* extend the prefix by the current bit */
+		blk[2 + pos / 8] |= addr[pos / 8] & (0x80 >> (pos % 8));
+	}
+
+	for(j = 0 ; j < lenAddr ; ++j)
+		addr[j] ^= flip[j];
+}
+
+
+/* hash mode pseudonymization, with a direct-mapped per-worker cache
+ * in front of it. Addresses repeat a lot in real-world logs, and
+ * computing the pseudonym requires one PRF call per bit.
+ */
+static void
+pseudonymize(wrkrInstanceData_t *pWrkrData, uint8_t *addr, int lenAddr, int bits)
+{
+	anonCacheEntry_t *entry;
+	unsigned h = 2166136261u;
+	int j;
+
+	for(j = 0 ; j < lenAddr ; ++j)
+		h = (h ^ addr[j]) * 16777619u;
+	entry = pWrkrData->cache + (h & (ANON_CACHE_SIZE - 1));
+
+	if(entry->lenAddr == lenAddr && !memcmp(entry->in, addr, lenAddr)) {
+		memcpy(addr, entry->out, lenAddr);
+		return;
+	}
+
+	memcpy(entry->in, addr, lenAddr);
+	hashAddr(pWrkrData->pData, addr, lenAddr, bits);
+	memcpy(entry->out, addr, lenAddr);
+	entry->lenAddr = lenAddr;
+}
+
+
+static uint32_t
+hashIPv4(wrkrInstanceData_t *pWrkrData, uint32_t ipv4addr)
+{
+	uint8_t addr[4];
+
+	addr[0] = ipv4addr >> 24;
+	addr[1] = (ipv4addr >> 16) & 0xff;
+	addr[2] = (ipv4addr >> 8) & 0xff;
+	addr[3] = ipv4addr & 0xff;
+	pseudonymize(pWrkrData, addr, 4, pWrkrData->pData->ipv4.bits);
+	return ((uint32_t) addr[0] << 24) | ((uint32_t) addr[1] << 16)
+	       | ((uint32_t) addr[2] << 8) | addr[3];
+}
+
+
+/* anonymize an IPv4 address at msg[*idx]. If one is found, 1 is
+ * returned, the replacement text is stored in repl and idx points
+ * right after the address. Otherwise 0 is returned and idx is set
+ * where the scan shall continue.
+ */
+static int
+anonIPv4(wrkrInstanceData_t *pWrkrData, uchar *msg, int lenMsg, int *idx,
+	 uchar *repl, int *pLenRepl)
+{
+	instanceData *pData = pWrkrData->pData;
+	int start = *idx;
 	int ipstart[4];
+	uint32_t ipv4addr;
 	int j;
-	int endpos;
-	int lenMsg = *pLenMsg;
 
-	while(i < lenMsg && (msg[i] <= '0' || msg[i] >= '9')) {
-		++i; /* skip to first number */
+	if(!parseIPv4(msg, lenMsg, idx, &ipv4addr, ipstart))
+		return 0;
+
+	if(pData->mode == SIMPLE_MODE) {
+		*pLenRepl = *idx - start;
+		memcpy(repl, msg + start, *pLenRepl);
+		/* due to our checks, bits is 8, 16, 24 or 32 */
+		for(j = ipstart[4 - pData->ipv4.bits / 8] - start ; j < *pLenRepl ; ++j) {
+			if(repl[j] != '.')
+				repl[j] = pData->replChar;
+		}
+	} else if(pData->mode == REWRITE_MODE) {
+		*pLenRepl = writeIPv4(repl, ipv4addr & ipv4masks[pData->ipv4.bits]);
+	} else { /* HASH_MODE */
+		*pLenRepl = writeIPv4(repl, hashIPv4(pWrkrData, ipv4addr));
+	}
+	return 1;
+}
+
+
+static inline int
+hexval(uchar c)
+{
+	if(c <= '9')
+		return c - '0';
+	return (c | 0x20) - 'a' + 10;
+}
+
+
+/* parse an IPv6 address starting at msg[i], including "::" compression
+ * and an embedded IPv4 part. Returns the index right after the address
+ * or -1 if there is no (properly delimited) address.
+ */
+static int
+parseIPv6(uchar *msg, int lenMsg, int i, ipv6addr_t *a)
+{
+	uint16_t grp[8];
+	int gstart[8];
+	int glen[8];
+	int nGrp = 0;
+	int compressAt = -1;
+	int nAfter;
+	int j, g;
+	int v;
+	uint32_t ipv4addr;
+
+	a->v4start = -1;
+	if(msg[i] == ':') {
+		if(i + 1 >= lenMsg || msg[i+1] != ':')
+			return -1;
+		compressAt = 0;
+		i += 2;
+		if(i >= lenMsg || !(charClass[msg[i]] & (CC_DIGIT|CC_HEX)))
+			goto done;
+	}
+
+	while(1) {
+		if(nGrp == 8)
+			return -1;
+		v = 0;
+		for(j = i ; j < lenMsg && (charClass[msg[j]] & (CC_DIGIT|CC_HEX)) ; ++j) {
+			if(j - i == 4)
+				return -1;
+			v = v * 16 + hexval(msg[j]);
+		}
+		if(j == i)
+			return -1;
+		if(j < lenMsg && msg[j] == '.') {
+			/* this must be the embedded IPv4 part */
+			j = i;
+			if(nGrp > 6 || !parseIPv4(msg, lenMsg, &j, &ipv4addr, a->v4ipstart))
+				return -1;
+			a->v4start = i;
+			gstart[nGrp] = a->v4ipstart[0];
+			glen[nGrp] = a->v4ipstart[2] - a->v4ipstart[0] - 1;
+			grp[nGrp++] = ipv4addr >> 16;
+			gstart[nGrp] = a->v4ipstart[2];
+			glen[nGrp] = j - a->v4ipstart[2];
+			grp[nGrp++] = ipv4addr & 0xffff;
+			i = j;
+			break;
+		}
+		gstart[nGrp] = i;
+		glen[nGrp] = j - i;
+		grp[nGrp++] = v;
+		i = j;
+		if(i >= lenMsg || msg[i] != ':')
+			break;
+		if(i + 1 < lenMsg && msg[i+1] == ':') {
+			if(compressAt >= 0)
+				return -1;
+			compressAt = nGrp;
+			i += 2;
+			if(i >= lenMsg || !(charClass[msg[i]] & (CC_DIGIT|CC_HEX)))
+				break;
+		} else {
+			++i;
+		}
+	}
+
+done:
+	if(nGrp == 0 || (compressAt < 0 ? nGrp != 8 : nGrp > 7))
+		return -1;
+	if(i < lenMsg && ((charClass[msg[i]] & (CC_ALNUM|CC_COLON))
+	   || (msg[i] == '.' && i + 1 < lenMsg && (charClass[msg[i+1]] & CC_DIGIT))))
+		return -1;
+
+	/* expand to full 8 groups */
+	if(compressAt < 0)
+		compressAt = nGrp;
+	nAfter = nGrp - compressAt;
+	for(g = 0 ; g < 8 ; ++g) {
+		if(g < compressAt) {
+			j = g;
+		} else if(g >= 8 - nAfter) {
+			j = g - (8 - nGrp);
+		} else {
+			a->grp[g] = 0;
+			a->gstart[g] = 0;
+			a->glen[g] = 0;
+			continue;
+		}
+		a->grp[g] = grp[j];
+		a->gstart[g] = gstart[j];
+		a->glen[g] = glen[j];
 	}
-	if(i >= lenMsg)
-		goto done;
-	
-	/* got digit, let's see if ip */
-	ipstart[0] = i;
-	octet = getnum(msg, lenMsg, &i);
-	if(octet > 255 || msg[i] != '.') goto done;
-	ipv4addr = octet << 24;
-	++i;
-	ipstart[1] = i;
-	octet = getnum(msg, lenMsg, &i);
-	if(octet > 255 || msg[i] != '.') goto done;
-	ipv4addr |= octet << 16;
-	++i;
-	ipstart[2] = i;
-	octet = getnum(msg, lenMsg, &i);
-	if(octet > 255 || msg[i] != '.') goto done;
-	ipv4addr |= octet << 8;
-	++i;
-	ipstart[3] = i;
-	octet = getnum(msg, lenMsg, &i);
-	if(octet > 255) goto done;
-	ipv4addr |= octet;
-
-	/* OK, we now found an ip address */
+	return i;
+}
+
+
+/* anonymize an IPv6 address at msg[*idx], interface as anonIPv4() */
+static int
+anonIPv6(wrkrInstanceData_t *pWrkrData, uchar *msg, int lenMsg, int *idx,
+	 uchar *repl, int *pLenRepl)
+{
+	instanceData *pData = pWrkrData->pData;
+	ipv6addr_t a;
+	uint8_t addr[16];
+	int start = *idx;
+	int end;
+	int bits;
+	int g, j;
+
+	if((end = parseIPv6(msg, lenMsg, start, &a)) < 0)
+		return 0;
+
+	if(a.v4start >= 0 && a.grp[0] == 0 && a.grp[1] == 0 && a.grp[2] == 0
+	   && a.grp[3] == 0 && a.grp[4] == 0 && a.grp[5] == 0xffff) {
+		/* IPv4-mapped address: the IPv4 rules apply to the IPv4 part */
+		*pLenRepl = a.v4start - start;
+		memcpy(repl, msg + start, *pLenRepl);
+		j = a.v4start;
+		anonIPv4(pWrkrData, msg, end, &j, repl + *pLenRepl, &g);
+		*pLenRepl += g;
+		*idx = end;
+		return 1;
+	}
+
 	if(pData->mode == SIMPLE_MODE) {
-		if(pData->ipv4.bits == 8)
-			j = ipstart[3];
-		else if(pData->ipv4.bits == 16)
-			j = ipstart[2];
-		else if(pData->ipv4.bits == 24)
-			j = ipstart[1];
-		else /* due to our checks, this *must* be 32 */
-			j = ipstart[0];
-		while(j < i) {
-			if(msg[j] != '.')
-				msg[j] = pData->replChar;
-			++j;
+		*pLenRepl = end - start;
+		memcpy(repl, msg + start, *pLenRepl);
+		/* due to our checks, bits is a multiple of 16 */
+		for(g = 8 - pData->ipv6.bits / 16 ; g < 8 ; ++g) {
+			for(j = a.gstart[g] ; j < a.gstart[g] + a.glen[g] ; ++j) {
+				if(msg[j] != '.')
+					repl[j - start] = pData->replChar;
+			}
 		}
-	} else { /* REWRITE_MODE */
-		ipv4addr &= ipv4masks[pData->ipv4.bits];
-		if(pData->ipv4.bits > 24)
-			writeOctet(msg, ipstart[0], &(ipstart[1]), ipv4addr >> 24);
-		if(pData->ipv4.bits > 16)
-			writeOctet(msg, ipstart[1], &(ipstart[2]), (ipv4addr >> 16) & 0xff);
-		if(pData->ipv4.bits > 8)
-			writeOctet(msg, ipstart[2], &(ipstart[3]), (ipv4addr >> 8) & 0xff);
-		endpos = writeOctet(msg, ipstart[3], NULL, ipv4addr & 0xff);
-		/* if we had truncation, we need to shrink the msg */
-		dbgprintf("existing i %d, endpos %d\n", i, endpos);
-		if(i - endpos > 0) {
-			*pLenMsg = lenMsg - (i - endpos);
-			memmove(msg+endpos, msg+i, lenMsg - i + 1);
-			/* correct index for next search! */
-			i -= (i - endpos);
+	} else if(pData->mode == REWRITE_MODE) {
+		bits = pData->ipv6.bits;
+		for(g = 7 ; g >= 0 && bits > 0 ; --g) {
+			if(bits >= 16) {
+				a.grp[g] = 0;
+				bits -= 16;
+			} else {
+				a.grp[g] &= 0xffff << bits;
+				bits = 0;
+			}
 		}
+		*pLenRepl = writeIPv6(repl, a.grp, a.v4start >= 0);
+	} else { /* HASH_MODE */
+		for(g = 0 ; g < 8 ; ++g) {
+			addr[2*g] = a.grp[g] >> 8;
+			addr[2*g+1] = a.grp[g] & 0xff;
+		}
+		pseudonymize(pWrkrData, addr, 16, pData->ipv6.bits);
+		for(g = 0 ; g < 8 ; ++g)
+			a.grp[g] = (addr[2*g] << 8) | addr[2*g+1];
+		*pLenRepl = writeIPv6(repl, a.grp, a.v4start >= 0);
 	}
 
-done:	*idx = i;
-	return;
+	*idx = end;
+	return 1;
+}
+
+
+/* check for an IP address at msg[*idx], interface as anonIPv4() */
+static int
+anonip(wrkrInstanceData_t *pWrkrData, uchar *msg, int lenMsg, int *idx,
+       uchar *repl, int *pLenRepl)
+{
+	int i = *idx;
+
+	if(pWrkrData->pData->ipv6.bEnable
+	   && (i == 0 || !(charClass[msg[i-1]] & (CC_ALNUM|CC_COLON|CC_DOT)))
+	   && anonIPv6(pWrkrData, msg, lenMsg, idx, repl, pLenRepl))
+		return 1;
+	if(charClass[msg[i]] & CC_DIGIT)
+		return anonIPv4(pWrkrData, msg, lenMsg, idx, repl, pLenRepl);
+	*idx = i + 1;
+	return 0;
+}
+
+
+/* append data to the worker's output buffer */
+static rsRetVal
+addToOutBuf(wrkrInstanceData_t *pWrkrData, int *pLenOut, uchar *data, int len)
+{
+	uchar *newBuf;
+	int newSize;
+	DEFiRet;
+
+	if(*pLenOut + len > pWrkrData->lenOutBuf) {
+		newSize = pWrkrData->lenOutBuf == 0 ? 1024 : pWrkrData->lenOutBuf;
+		while(newSize < *pLenOut + len)
+			newSize *= 2;
+		CHKmalloc(newBuf = realloc(pWrkrData->outBuf, newSize));
+		pWrkrData->outBuf = newBuf;
+		pWrkrData->lenOutBuf = newSize;
+	}
+	memcpy(pWrkrData->outBuf + *pLenOut, data, len);
+	*pLenOut += len;
+
+finalize_it:
+	RETiRet;
 }
 
 
@@ -366,15 +889,43 @@ BEGINdoAction
 	uchar *msg;
 	int lenMsg;
 	int i;
+	int start;
+	int copied;	/* msg is in outBuf up to this index, 0 if outBuf unused */
+	int lenOut;
+	uchar repl[MAX_REPL_LEN];
+	int lenRepl;
+	uchar candidates;
 CODESTARTdoAction
 	pMsg = (msg_t*) ppString[0];
 	lenMsg = getMSGLen(pMsg);
 	msg = getMSG(pMsg);
-	for(i = 0 ; i < lenMsg ; ++i) {
-		anonip(pWrkrData->pData, msg, &lenMsg, &i);
+	candidates = pWrkrData->pData->ipv6.bEnable ? (CC_DIGIT|CC_HEX|CC_COLON) : CC_DIGIT;
+	copied = 0;
+	lenOut = 0;
+	i = 0;
+	while(1) {
+		/* quickly skip everything that cannot start an address */
+		while(i < lenMsg && !(charClass[msg[i]] & candidates))
+			++i;
+		if(i >= lenMsg)
+			break;
+		start = i;
+		if(!anonip(pWrkrData, msg, lenMsg, &i, repl, &lenRepl))
+			continue;
+		if(lenRepl == i - start) {
+			memcpy(msg + start, repl, lenRepl);
+		} else {
+			/* size changes, so we need to rebuild the message */
+			CHKiRet(addToOutBuf(pWrkrData, &lenOut, msg + copied, start - copied));
+			CHKiRet(addToOutBuf(pWrkrData, &lenOut, repl, lenRepl));
+			copied = i;
+		}
+	}
+	if(copied > 0) {
+		CHKiRet(addToOutBuf(pWrkrData, &lenOut, msg + copied, lenMsg - copied));
+		CHKiRet(MsgReplaceMSG(pMsg, pWrkrData->outBuf, lenOut));
 	}
-	if(lenMsg != getMSGLen(pMsg))
-		setMSGLen(pMsg, lenMsg);
+finalize_it:
 ENDdoAction
 
 
@@ -408,9 +959,22 @@ ENDqueryEtryPt
 
 
 BEGINmodInit()
+	int i;
 CODESTARTmodInit
 	*ipIFVersProvided = CURR_MOD_IF_VERSION; /* we only support the current interface specification */
 CODEmodInit_QueryRegCFSLineHdlr
 	DBGPRINTF("mmanon: module compiled with rsyslog version %s.\n", VERSION);
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
+	for(i = 0 ; i < 256 ; ++i) {
+		if(i >= '0' && i <= '9')
+			charClass[i] = CC_DIGIT | CC_ALNUM;
+		else if((i >= 'a' && i <= 'f') || (i >= 'A' && i <= 'F'))
+			charClass[i] = CC_HEX | CC_ALNUM;
+		else if((i >= 'g' && i <= 'z') || (i >= 'G' && i <= 'Z'))
+			charClass[i] = CC_ALNUM;
+		else if(i == ':')
+			charClass[i] = CC_COLON;
+		else if(i == '.')
+			charClass[i] = CC_DOT;
+	}
 ENDmodInit
@@ -38,6 +38,8 @@
 #include "module-template.h"
 #include "errmsg.h"
 #include "hashtable.h"
+#include "statsobj.h"
+#include "atomic.h"
 
 #define JSON_COUNT_NAME "!mmcount"
 #define SEVERITY_COUNT 8
@@ -48,22 +50,36 @@ MODULE_CNFNAME("mmcount")
 
 
 DEFobjCurrIf(errmsg);
+DEFobjCurrIf(statsobj)
 DEF_OMOD_STATIC_DATA
 
 /* config variables */
 
+/* the counter for one value of the key. Counters are shared by all
+ * workers and updated atomically. They are never removed while the
+ * instance exists, so workers may cache pointers to them.
+ */
+typedef struct keyCounter_s {
+	int count;
+	DEF_ATOMIC_HELPER_MUT(mut);
+} keyCounter_t;
+
 typedef struct _instanceData {
 	char *pszAppName;
 	int severity[SEVERITY_COUNT];
 	char *pszKey;
+	msgPropDescr_t *pKeyProp;	/* pszKey, as property */
 	char *pszValue;
 	int valueCounter;
-	struct hashtable *ht;
+	DEF_ATOMIC_HELPER_MUT(mutCtrs);	/* for severity[] and valueCounter */
+	struct hashtable *ht;	/* value hash -> keyCounter_t, guarded by mut */
 	pthread_mutex_t mut;
+	statsobj_t *stats;
 } instanceData;
 
 typedef struct wrkrInstanceData {
 	instanceData *pData;
+	struct hashtable *ht;	/* worker-local lookup cache for pData->ht */
 } wrkrInstanceData_t;
 
 struct modConfData_s {
@@ -110,13 +126,34 @@ CODESTARTfreeCnf
 ENDfreeCnf
 
 
+static unsigned int
+hash_from_key_fn(void *k)
+{
+	return *(unsigned int *)k;
+}
+
+static int
+key_equals_fn(void *k1, void *k2)
+{
+	return (*(unsigned int *)k1 == *(unsigned int *)k2);
+}
+
 BEGINcreateInstance
 CODESTARTcreateInstance
 	pthread_mutex_init(&pData->mut, NULL);
+	INIT_ATOMIC_HELPER_MUT(pData->mutCtrs);
 ENDcreateInstance
 
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
+	if(pData->ht != NULL) {
+		if(NULL == (pWrkrData->ht = create_hashtable_inlinekey(100, sizeof(unsigned int),
+			hash_from_key_fn, key_equals_fn, NULL))) {
+			DBGPRINTF("mmcount: error creating worker hash table!\n");
+			ABORT_FINALIZE(RS_RET_ERR);
+		}
+	}
+finalize_it:
 ENDcreateWrkrInstance
 
 
@@ -127,11 +164,26 @@ ENDisCompatibleWithFeature
 
 BEGINfreeInstance
 CODESTARTfreeInstance
+	if(pData->stats != NULL)
+		statsobj.Destruct(&pData->stats);
+	if(pData->ht != NULL)
+		hashtable_destroy(pData->ht, 1); /* also free counters */
+	if(pData->pKeyProp != NULL) {
+		msgPropDescrDestruct(pData->pKeyProp);
+		free(pData->pKeyProp);
+	}
+	free(pData->pszAppName);
+	free(pData->pszKey);
+	free(pData->pszValue);
+	pthread_mutex_destroy(&pData->mut);
+	DESTROY_ATOMIC_HELPER_MUT(pData->mutCtrs);
 ENDfreeInstance
 
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
+	if(pWrkrData->ht != NULL)
+		hashtable_destroy(pWrkrData->ht, 0); /* counters belong to pData->ht */
 ENDfreeWrkrInstance
 
 static inline void
@@ -146,18 +198,45 @@ setInstParamDefaults(instanceData *pData)
 	pData->pszValue = NULL;
 	pData->valueCounter = 0;
 	pData->ht = NULL;
+	pData->pKeyProp = NULL;
+	pData->stats = NULL;
 }
 
-static unsigned int
-hash_from_key_fn(void *k)
-{
-	return *(unsigned int *)k;
-}
 
-static int
-key_equals_fn(void *k1, void *k2)
+/* set up the stats object of the instance */
+static rsRetVal
+initStats(instanceData *pData)
 {
-	return (*(unsigned int *)k1 == *(unsigned int *)k2);
+	uchar statsName[1024];
+	uchar ctrName[32];
+	int i;
+	DEFiRet;
+
+	if(pData->pszKey == NULL)
+		snprintf((char*) statsName, sizeof(statsName), "mmcount(%s)", pData->pszAppName);
+	else if(pData->pszValue == NULL)
+		snprintf((char*) statsName, sizeof(statsName), "mmcount(%s,%s)",
+			 pData->pszAppName, pData->pszKey);
+	else
+		snprintf((char*) statsName, sizeof(statsName), "mmcount(%s,%s=%s)",
+			 pData->pszAppName, pData->pszKey, pData->pszValue);
+	CHKiRet(statsobj.Construct(&pData->stats));
+	CHKiRet(statsobj.SetName(pData->stats, statsName));
+	if(pData->pszKey == NULL) {
+		for(i = 0 ; i < SEVERITY_COUNT ; ++i) {
+			snprintf((char*) ctrName, sizeof(ctrName), "severity.%d", i);
+			CHKiRet(statsobj.AddCounter(pData->stats, ctrName, ctrType_Int,
+				CTR_FLAG_NONE, &pData->severity[i]));
+		}
+	} else if(pData->pszValue != NULL) {
+		CHKiRet(statsobj.AddCounter(pData->stats, (uchar*)"count", ctrType_Int,
+			CTR_FLAG_NONE, &pData->valueCounter));
+	}
+	/* per-value counters are added as the values show up */
+	CHKiRet(statsobj.ConstructFinalize(pData->stats));
+
+finalize_it:
+	RETiRet;
 }
 
 BEGINnewActInst
@@ -198,12 +277,20 @@ CODESTARTnewActInst
 		ABORT_FINALIZE(RS_RET_MISSING_CNFPARAMS);
 	}
 
+	if(pData->pszKey != NULL) {
+		CHKmalloc(pData->pKeyProp = calloc(1, sizeof(msgPropDescr_t)));
+		CHKiRet(msgPropDescrFill(pData->pKeyProp, (uchar*)pData->pszKey,
+			strlen(pData->pszKey)));
+	}
+
 	if(pData->pszKey != NULL && pData->pszValue == NULL) {
-		if(NULL == (pData->ht = create_hashtable(100, hash_from_key_fn, key_equals_fn, NULL))) {
+		if(NULL == (pData->ht = create_hashtable_inlinekey(100, sizeof(unsigned int),
+			hash_from_key_fn, key_equals_fn, NULL))) {
 			DBGPRINTF("mmcount: error creating hash table!\n");
 			ABORT_FINALIZE(RS_RET_ERR);
 		}
 	}
+	CHKiRet(initStats(pData));
 CODE_STD_FINALIZERnewActInst
 	cnfparamvalsDestruct(pvals, &actpblk);
 ENDnewActInst
@@ -218,41 +305,67 @@ BEGINtryResume
 CODESTARTtryResume
 ENDtryResume
 
-static int *
-getCounter(struct hashtable *ht, char *str) {
-	unsigned int key;
-	int *pCounter;
-	unsigned int *pKey;
+/* get the shared counter for a value, creating it if needed. Must be
+ * called with pData->mut locked.
+ */
+static keyCounter_t *
+getCounter(instanceData *pData, unsigned int key, char *str) {
+	keyCounter_t *pCounter;
+	uchar ctrName[256];
 
-	/* we dont store str as key, instead we store hash of the str
-	   as key to reduce memory usage */
-	key = hash_from_string(str);
-	pCounter = hashtable_search(ht, &key);
+	pCounter = hashtable_search(pData->ht, &key);
 	if(pCounter) {
 		return pCounter;
 	}
 
 	/* counter is not found for the str, so add new entry and
 	   return the counter */
-	if(NULL == (pKey = (unsigned int*)malloc(sizeof(unsigned int)))) {
-		DBGPRINTF("mmcount: memory allocation for key failed\n");
-		return NULL;
-	}
-	*pKey = key;
-
-	if(NULL == (pCounter = (int*)malloc(sizeof(int)))) {
+	if(NULL == (pCounter = (keyCounter_t*)malloc(sizeof(keyCounter_t)))) {
 		DBGPRINTF("mmcount: memory allocation for value failed\n");
-		free(pKey);
 		return NULL;
 	}
-	*pCounter = 0;
+	pCounter->count = 0;
+	INIT_ATOMIC_HELPER_MUT(pCounter->mut);
 
-	if(!hashtable_insert(ht, pKey, pCounter)) {
+	if(!hashtable_insert_copy(pData->ht, &key, sizeof(key), pCounter)) {
 		DBGPRINTF("mmcount: inserting element into hashtable failed\n");
-		free(pKey);
 		free(pCounter);
 		return NULL;
 	}
+	snprintf((char*) ctrName, sizeof(ctrName), "value.%s", str);
+	if(statsobj.AddCounter(pData->stats, ctrName, ctrType_Int, CTR_FLAG_NONE,
+			       &pCounter->count) != RS_RET_OK) {
+		DBGPRINTF("mmcount: could not add stats counter for '%s'\n", str);
+	}
+	return pCounter;
+}
+
+/* get the counter for a value. The worker's own table is tried first,
+ * so the instance-wide lock is only taken for values this worker
+ * did not see before.
+ */
+static keyCounter_t *
+getWrkrCounter(wrkrInstanceData_t *pWrkrData, char *str) {
+	instanceData *const pData = pWrkrData->pData;
+	unsigned int key;
+	keyCounter_t *pCounter;
+
+	/* we dont store str as key, instead we store hash of the str
+	   as key to reduce memory usage */
+	key = hash_from_string(str);
+	pCounter = hashtable_search(pWrkrData->ht, &key);
+	if(pCounter) {
+		return pCounter;
+	}
+
+	pthread_mutex_lock(&pData->mut);
+	pCounter = getCounter(pData, key, str);
+	pthread_mutex_unlock(&pData->mut);
+	if(pCounter == NULL)
+		return NULL;
+
+	/* if caching fails, we just do the shared lookup again next time */
+	hashtable_insert_copy(pWrkrData->ht, &key, sizeof(key), pCounter);
 	return pCounter;
 }
 
@@ -260,16 +373,14 @@ BEGINdoAction
 	msg_t *pMsg;
 	char *appname;
 	struct json_object *json = NULL;
-	es_str_t *estr = NULL;
 	struct json_object *keyjson = NULL;
 	char *pszValue;
-	int *pCounter;
+	keyCounter_t *pCounter;
 	instanceData *const pData = pWrkrData->pData;
 CODESTARTdoAction
 	pMsg = (msg_t*) ppString[0];
 	appname = getAPPNAME(pMsg, LOCK_MUTEX);
 
-	pthread_mutex_lock(&pData->mut);
 	if(0 != strcmp(appname, pData->pszAppName)) {
 		/* we are not working for this appname. nothing to do */
 		ABORT_FINALIZE(RS_RET_OK);
@@ -277,45 +388,41 @@ CODESTARTdoAction
 
 	if(!pData->pszKey) {
 		/* no key given for count, so we count severity */
-		if(pMsg->iSeverity <= SEVERITY_COUNT) {
-			pData->severity[pMsg->iSeverity]++;
-			json = json_object_new_int(pData->severity[pMsg->iSeverity]);
+		if(pMsg->iSeverity < SEVERITY_COUNT) {
+			json = json_object_new_int(ATOMIC_INC_AND_FETCH_int(
+				&pData->severity[pMsg->iSeverity], &pData->mutCtrs) + 1);
 		}
 		ABORT_FINALIZE(RS_RET_OK);
 	}
 
 	/* key is given, so get the property json */
-	estr = es_newStrFromBuf(pData->pszKey, strlen(pData->pszKey));
-	if(msgGetCEEPropJSON(pMsg, estr, &keyjson) != RS_RET_OK) {
+	if(msgGetJSONPropJSON(pMsg, pData->pKeyProp, &keyjson) != RS_RET_OK) {
 		/* key not found in the message. nothing to do */
 		ABORT_FINALIZE(RS_RET_OK);
 	}
 
 	/* key found, so get the value */
-	pszValue = (char*)json_object_get_string(keyjson);
+	if((pszValue = (char*)json_object_get_string(keyjson)) == NULL) {
+		ABORT_FINALIZE(RS_RET_OK);
+	}
 
 	if(pData->pszValue) {
 		/* value also given for count */
 		if(!strcmp(pszValue, pData->pszValue)) {
 			/* count for (value and key and appname) matched */
-			pData->valueCounter++;
-			json = json_object_new_int(pData->valueCounter);
+			json = json_object_new_int(ATOMIC_INC_AND_FETCH_int(
+				&pData->valueCounter, &pData->mutCtrs) + 1);
 		}
 		ABORT_FINALIZE(RS_RET_OK);
 	}
 
 	/* value is not given, so we count for each value of given key */
-	pCounter = getCounter(pData->ht, pszValue);
+	pCounter = getWrkrCounter(pWrkrData, pszValue);
 	if(pCounter) {
-		(*pCounter)++;
-		json = json_object_new_int(*pCounter);
+		json = json_object_new_int(ATOMIC_INC_AND_FETCH_int(&pCounter->count,
+			&pCounter->mut) + 1);
 	}
 finalize_it:
-	pthread_mutex_unlock(&pData->mut);
-	if(estr) {
-		es_deleteStr(estr);
-	}
-
 	if(json) {
 		msgAddJSON(pMsg, (uchar *)JSON_COUNT_NAME, json);
 	}
@@ -338,6 +445,7 @@ ENDparseSelectorAct
 BEGINmodExit
 CODESTARTmodExit
 	objRelease(errmsg, CORE_COMPONENT);
+	objRelease(statsobj, CORE_COMPONENT);
 ENDmodExit
 
 
@@ -357,4 +465,5 @@ CODESTARTmodInit
 CODEmodInit_QueryRegCFSLineHdlr
 	DBGPRINTF("mmcount: module compiled with rsyslog version %s.\n", VERSION);
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 ENDmodInit
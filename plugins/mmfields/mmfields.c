@@ -37,6 +37,8 @@
 #include "template.h"
 #include "module-template.h"
 #include "errmsg.h"
+#include "msg.h"
+#include "unicode-helper.h"
 
 MODULE_TYPE_OUTPUT
 MODULE_TYPE_NOKEEP
@@ -58,6 +60,11 @@ typedef struct _instanceData {
 
 typedef struct wrkrInstanceData {
 	instanceData *pData;
+	/* field names and values for compact $! variables, kept across messages */
+	uchar *buf;
+	int maxBuf;
+	msgJSONLeaf_t *pLeaves;
+	int maxLeaves;
 } wrkrInstanceData_t;
 
 struct modConfData_s {
@@ -124,6 +131,8 @@ ENDfreeInstance
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
+	free(pWrkrData->buf);
+	free(pWrkrData->pLeaves);
 ENDfreeWrkrInstance
 
 
@@ -198,9 +207,92 @@ extractField(instanceData *pData, uchar *msgtext, int lenMsg, int *curridx, ucha
 }
 
 
+/* make sure the worker buffer can hold len more bytes after lenBuf */
 static inline rsRetVal
-parse_fields(instanceData *pData, msg_t *pMsg, uchar *msgtext, int lenMsg)
+reserveBuf(wrkrInstanceData_t *pWrkrData, int lenBuf, int len)
+{
+	uchar *pNew;
+	int newMax;
+	DEFiRet;
+
+	if(lenBuf + len > pWrkrData->maxBuf) {
+		newMax = (pWrkrData->maxBuf == 0) ? 4096 : pWrkrData->maxBuf * 2;
+		while(newMax < lenBuf + len)
+			newMax *= 2;
+		CHKmalloc(pNew = realloc(pWrkrData->buf, newMax));
+		pWrkrData->buf = pNew;
+		pWrkrData->maxBuf = newMax;
+	}
+finalize_it:
+	RETiRet;
+}
+
+
+/* Store the fields as compact $! variables (global variables.compact). The
+ * separators are located with memchr() and each field is copied once into a
+ * buffer that is reused for all messages; no json-c objects are created.
+ * json-c objects are only built later if something needs the container.
+ * Returns 1 if done, 0 if the json-c path must be used.
+ */
+static inline int
+parseFieldsCompact(wrkrInstanceData_t *pWrkrData, msg_t *pMsg, uchar *msgtext, int lenMsg)
 {
+	instanceData *pData = pWrkrData->pData;
+	msgJSONLeaf_t *pNewLeaves;
+	msgJSONLeaf_t *pLeaf;
+	uchar *sep;
+	int lenRoot;
+	int lenBuf = 0;
+	int nLeaves = 0;
+	int currIdx = 0;
+	int lenField;
+
+	if(!bMsgCompactVars || pData->jsonRoot[0] != '!')
+		return 0;
+	lenRoot = (pData->jsonRoot[1] == '\0') ? 0 : ustrlen(pData->jsonRoot);
+	/* values take at most the message plus one NUL per field */
+	if(reserveBuf(pWrkrData, 0, 2 * lenMsg + 1) != RS_RET_OK)
+		return 0;
+	while(currIdx < lenMsg) {
+		if(nLeaves == pWrkrData->maxLeaves) {
+			if((pNewLeaves = realloc(pWrkrData->pLeaves, (pWrkrData->maxLeaves + 64)
+						 * sizeof(msgJSONLeaf_t))) == NULL)
+				return 0;
+			pWrkrData->pLeaves = pNewLeaves;
+			pWrkrData->maxLeaves += 64;
+		}
+		sep = memchr(msgtext + currIdx, pData->separator, lenMsg - currIdx);
+		lenField = (sep == NULL) ? lenMsg - currIdx : sep - (msgtext + currIdx);
+		pLeaf = pWrkrData->pLeaves + nLeaves++;
+		pLeaf->type = json_type_string;
+		pLeaf->offVal = lenBuf;
+		pLeaf->lenVal = lenField;
+		memcpy(pWrkrData->buf + lenBuf, msgtext + currIdx, lenField);
+		pWrkrData->buf[lenBuf + lenField] = '\0';
+		lenBuf += lenField + 1;
+		currIdx += lenField;
+		if(currIdx < lenMsg)
+			++currIdx; /* skip separator */
+	}
+
+	/* the names go behind the values: "<root>!f<n>" */
+	if(reserveBuf(pWrkrData, lenBuf, nLeaves * (lenRoot + 14)) != RS_RET_OK)
+		return 0;
+	for(pLeaf = pWrkrData->pLeaves ; pLeaf < pWrkrData->pLeaves + nLeaves ; ++pLeaf) {
+		pLeaf->offName = lenBuf;
+		memcpy(pWrkrData->buf + lenBuf, pData->jsonRoot, lenRoot);
+		pLeaf->lenName = lenRoot + snprintf((char*) pWrkrData->buf + lenBuf + lenRoot, 14,
+						    "!f%d", (int) (pLeaf - pWrkrData->pLeaves) + 1);
+		lenBuf += pLeaf->lenName + 1;
+	}
+	return msgAddJSONLeaves(pMsg, pData->jsonRoot, pWrkrData->buf, pWrkrData->pLeaves, nLeaves);
+}
+
+
+static inline rsRetVal
+parse_fields(wrkrInstanceData_t *pWrkrData, msg_t *pMsg, uchar *msgtext, int lenMsg)
+{
+	instanceData *pData = pWrkrData->pData;
 	uchar fieldbuf[32*1024];
 	uchar fieldname[512];
 	struct json_object *json;
@@ -210,6 +302,9 @@ parse_fields(instanceData *pData, msg_t *pMsg, uchar *msgtext, int lenMsg)
 	int currIdx = 0;
 	DEFiRet;
 
+	if(parseFieldsCompact(pWrkrData, pMsg, msgtext, lenMsg))
+		FINALIZE;
+
 	if(lenMsg < (int) sizeof(fieldbuf)) {
 		buf = fieldbuf;
 	} else {
@@ -218,6 +313,8 @@ parse_fields(instanceData *pData, msg_t *pMsg, uchar *msgtext, int lenMsg)
 
 	json =  json_object_new_object();
 	if(json == NULL) {
+		if(buf != fieldbuf)
+			free(buf);
 		ABORT_FINALIZE(RS_RET_ERR);
 	}
 	field = 1;
@@ -226,10 +323,12 @@ parse_fields(instanceData *pData, msg_t *pMsg, uchar *msgtext, int lenMsg)
 		DBGPRINTF("mmfields: field %d: '%s'\n", field, buf);
 		snprintf((char*)fieldname, sizeof(fieldname), "f%d", field);
 		fieldname[sizeof(fieldname)-1] = '\0';
-		jval = json_object_new_string((char*)fieldbuf);
+		jval = json_object_new_string((char*)buf);
 		json_object_object_add(json, (char*)fieldname, jval);
 		field++;
 	}
+	if(buf != fieldbuf)
+		free(buf);
  	msgAddJSON(pMsg, pData->jsonRoot, json);
 finalize_it:
 	RETiRet;
@@ -244,7 +343,7 @@ CODESTARTdoAction
 	pMsg = (msg_t*) ppString[0];
 	lenMsg = getMSGLen(pMsg);
 	msg = getMSG(pMsg);
-	CHKiRet(parse_fields(pWrkrData->pData, pMsg, msg, lenMsg));
+	CHKiRet(parse_fields(pWrkrData, pMsg, msg, lenMsg));
 finalize_it:
 ENDdoAction
 
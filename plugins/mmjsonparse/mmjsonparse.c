@@ -43,6 +43,7 @@
 #include "errmsg.h"
 #include "cfsysline.h"
 #include "dirty.h"
+#include "msg.h"
 
 MODULE_TYPE_OUTPUT
 MODULE_TYPE_NOKEEP
@@ -57,14 +58,27 @@ DEFobjCurrIf(errmsg);
  */
 DEF_OMOD_STATIC_DATA
 
+/* parser backends */
+#define JSONPARSE_JSONC 0	/* json-c tokener, builds a json-c tree */
+#define JSONPARSE_FAST 1	/* our own parser, stores compact $! variables */
+
+#define FAST_MAX_DEPTH 30	/* json-c's limit is 32, we leave deeper ones to it */
+
 typedef struct _instanceData {
-	int dummy; /* not needed, but some compilers do not support empty structs */
-	/* REMOVE dummy when real data items are to be added! */
+	int parser;		/* JSONPARSE_* */
+	sbool bLazy;		/* only keep top-level names the config references */
 } instanceData;
 
 typedef struct wrkrInstanceData {
 	instanceData *pData;
 	struct json_tokener *tokener;
+	/* state of the fast parser, kept across messages to save allocations */
+	uchar *fpBuf;		/* names and (unescaped) values */
+	int lenFpBuf;
+	int maxFpBuf;
+	msgJSONLeaf_t *fpLeaves;
+	int nFpLeaves;
+	int maxFpLeaves;
 } wrkrInstanceData_t;
 
 struct modConfData_s {
@@ -73,6 +87,17 @@ struct modConfData_s {
 static modConfData_t *loadModConf = NULL;/* modConf ptr to use for the current load process */
 static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current exec process */
 
+/* tables for module-global parameters */
+static struct cnfparamdescr actpdescr[] = {
+	{ "parser", eCmdHdlrGetWord, 0 },
+	{ "lazy", eCmdHdlrBinary, 0 }
+};
+static struct cnfparamblk actpblk =
+	{ CNFPARAMBLK_VERSION,
+	  sizeof(actpdescr)/sizeof(struct cnfparamdescr),
+	  actpdescr
+	};
+
 
 BEGINbeginCnfLoad
 CODESTARTbeginCnfLoad
@@ -127,6 +152,8 @@ BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
 	if(pWrkrData->tokener != NULL)
 		json_tokener_free(pWrkrData->tokener);
+	free(pWrkrData->fpBuf);
+	free(pWrkrData->fpLeaves);
 ENDfreeWrkrInstance
 
 
@@ -141,6 +168,461 @@ CODESTARTtryResume
 ENDtryResume
 
 
+/* ------------------------------ fast parser ------------------------------ */
+/* The fast parser handles the common case of objects that consist of
+ * strings, integers, booleans and non-empty nested objects only. Instead of
+ * building a json-c tree (one allocation per value and container), it makes
+ * a single pass over the message and collects the values together with their
+ * full $! names in a per-worker buffer. These are then stored directly as
+ * compact $! variables (global variables.compact). Whenever it encounters
+ * anything it does not handle, or that json-c may handle differently (like
+ * surrogates or other whitespace), it gives up and the json-c tokener is used,
+ * so the result does not depend on the parser. That includes invalid JSON:
+ * json-c has the final word on whether the message is accepted. All fp*()
+ * functions return 1 on success and 0 if the fast parser gives up.
+ */
+#define FAST_MAX_NAME 1023	/* same limit as for compact variables */
+
+typedef struct fastParser_s {
+	wrkrInstanceData_t *pWrkrData;
+	uchar *p;
+	uchar *pEnd;
+	sbool bLazy;
+	int lenPath;
+	uchar path[FAST_MAX_NAME + 1];	/* $! name of the current value */
+} fastParser_t;
+
+static int fpValue(fastParser_t *fp, sbool bEmit, int depth);
+
+/* make sure there is room for len more bytes in the worker buffer */
+static int
+fpReserve(wrkrInstanceData_t *pWrkrData, int len)
+{
+	uchar *pNew;
+	int newMax;
+
+	if(pWrkrData->lenFpBuf + len <= pWrkrData->maxFpBuf)
+		return 1;
+	newMax = (pWrkrData->maxFpBuf == 0) ? 4096 : pWrkrData->maxFpBuf * 2;
+	while(newMax < pWrkrData->lenFpBuf + len)
+		newMax *= 2;
+	if((pNew = realloc(pWrkrData->fpBuf, newMax)) == NULL)
+		return 0;
+	pWrkrData->fpBuf = pNew;
+	pWrkrData->maxFpBuf = newMax;
+	return 1;
+}
+
+static inline void
+fpSkipWS(fastParser_t *fp)
+{
+	while(fp->p < fp->pEnd && (*fp->p == ' ' || *fp->p == '\t' || *fp->p == '\n' || *fp->p == '\r'))
+		++fp->p;
+}
+
+/* check that a number or literal is properly terminated */
+static inline int
+fpIsDelim(fastParser_t *fp)
+{
+	return fp->p < fp->pEnd && (*fp->p == ',' || *fp->p == '}' || *fp->p == ']' || *fp->p == ' '
+				    || *fp->p == '\t' || *fp->p == '\n' || *fp->p == '\r');
+}
+
+/* record a value for the current path, value is in the buffer at offVal */
+static int
+fpAddLeaf(fastParser_t *fp, enum json_type type, int offVal, int lenVal)
+{
+	wrkrInstanceData_t *pWrkrData = fp->pWrkrData;
+	msgJSONLeaf_t *pNew;
+	msgJSONLeaf_t *pLeaf;
+	int newMax;
+
+	if(pWrkrData->nFpLeaves == pWrkrData->maxFpLeaves) {
+		newMax = (pWrkrData->maxFpLeaves == 0) ? 32 : pWrkrData->maxFpLeaves * 2;
+		if((pNew = realloc(pWrkrData->fpLeaves, newMax * sizeof(msgJSONLeaf_t))) == NULL)
+			return 0;
+		pWrkrData->fpLeaves = pNew;
+		pWrkrData->maxFpLeaves = newMax;
+	}
+	if(!fpReserve(pWrkrData, fp->lenPath + 1))
+		return 0;
+	pLeaf = pWrkrData->fpLeaves + pWrkrData->nFpLeaves++;
+	pLeaf->offName = pWrkrData->lenFpBuf;
+	pLeaf->lenName = fp->lenPath;
+	pLeaf->offVal = offVal;
+	pLeaf->lenVal = lenVal;
+	pLeaf->type = type;
+	memcpy(pWrkrData->fpBuf + pWrkrData->lenFpBuf, fp->path, fp->lenPath);
+	pWrkrData->fpBuf[pWrkrData->lenFpBuf + fp->lenPath] = '\0';
+	pWrkrData->lenFpBuf += fp->lenPath + 1;
+	return 1;
+}
+
+/* check if values were already recorded below the current path. This
+ * happens if a key is repeated in an object and both values are objects:
+ * json-c keeps only the last one, while we would merge them.
+ */
+static int
+fpPathUsed(fastParser_t *fp)
+{
+	wrkrInstanceData_t *pWrkrData = fp->pWrkrData;
+	msgJSONLeaf_t *pLeaf;
+	int i;
+
+	for(i = 0 ; i < pWrkrData->nFpLeaves ; ++i) {
+		pLeaf = pWrkrData->fpLeaves + i;
+		if(   pLeaf->lenName > fp->lenPath
+		   && pWrkrData->fpBuf[pLeaf->offName + fp->lenPath] == '!'
+		   && !memcmp(pWrkrData->fpBuf + pLeaf->offName, fp->path, fp->lenPath))
+			return 1;
+	}
+	return 0;
+}
+
+/* parse a string, fp->p is on the opening quote. If bEmit is set, the
+ * unescaped string is added to the buffer and its position returned.
+ */
+static int
+fpString(fastParser_t *fp, sbool bEmit, int *pOff, int *pLen)
+{
+	wrkrInstanceData_t *pWrkrData = fp->pWrkrData;
+	uchar *p = fp->p + 1;
+	uchar *pEnd = fp->pEnd;
+	uchar *out = NULL;
+	uchar *start = NULL;
+	unsigned u;
+	uchar c;
+	int i;
+
+	if(bEmit) {
+		/* the unescaped string can not be longer than what is left */
+		if(!fpReserve(pWrkrData, pEnd - p + 1))
+			return 0;
+		start = out = pWrkrData->fpBuf + pWrkrData->lenFpBuf;
+	}
+	while(1) {
+		if(p >= pEnd)
+			return 0;
+		c = *p;
+		if(c == '"')
+			break;
+		if(c < 0x20)
+			return 0;
+		if(c != '\\') {
+			++p;
+		} else {
+			if(p + 1 >= pEnd)
+				return 0;
+			switch(p[1]) {
+			case '"':  c = '"'; break;
+			case '\\': c = '\\'; break;
+			case '/':  c = '/'; break;
+			case 'b':  c = '\b'; break;
+			case 'f':  c = '\f'; break;
+			case 'n':  c = '\n'; break;
+			case 'r':  c = '\r'; break;
+			case 't':  c = '\t'; break;
+			case 'u':
+				if(p + 6 > pEnd)
+					return 0;
+				u = 0;
+				for(i = 2 ; i < 6 ; ++i) {
+					if(!isxdigit(p[i]))
+						return 0;
+					u = (u << 4) | (isdigit(p[i]) ? p[i] - '0' : (tolower(p[i]) - 'a' + 10));
+				}
+				/* NUL and surrogates are left to json-c */
+				if(u == 0 || (u >= 0xd800 && u <= 0xdfff))
+					return 0;
+				if(bEmit) {
+					if(u < 0x80) {
+						*out++ = u;
+					} else if(u < 0x800) {
+						*out++ = 0xc0 | (u >> 6);
+						*out++ = 0x80 | (u & 0x3f);
+					} else {
+						*out++ = 0xe0 | (u >> 12);
+						*out++ = 0x80 | ((u >> 6) & 0x3f);
+						*out++ = 0x80 | (u & 0x3f);
+					}
+				}
+				p += 6;
+				continue;
+			default:
+				return 0;
+			}
+			p += 2;
+		}
+		if(bEmit)
+			*out++ = c;
+	}
+	fp->p = p + 1;
+	if(bEmit) {
+		*out = '\0';
+		*pOff = pWrkrData->lenFpBuf;
+		*pLen = out - start;
+		pWrkrData->lenFpBuf += *pLen + 1;
+	}
+	return 1;
+}
+
+/* parse a number. Only integers that json-c stores as such can be emitted */
+static int
+fpNumber(fastParser_t *fp, sbool bEmit)
+{
+	uchar *start = fp->p;
+	uchar *p = fp->p;
+	uchar *pEnd = fp->pEnd;
+	sbool bInt = 1;
+	int lenVal;
+
+	if(*p == '-')
+		++p;
+	if(p >= pEnd || !isdigit(*p))
+		return 0;
+	if(*p == '0') {
+		++p;
+	} else {
+		while(p < pEnd && isdigit(*p))
+			++p;
+	}
+	lenVal = p - start;
+	if(p < pEnd && *p == '.') {
+		bInt = 0;
+		if(++p >= pEnd || !isdigit(*p))
+			return 0;
+		while(p < pEnd && isdigit(*p))
+			++p;
+	}
+	if(p < pEnd && (*p == 'e' || *p == 'E')) {
+		bInt = 0;
+		++p;
+		if(p < pEnd && (*p == '+' || *p == '-'))
+			++p;
+		if(p >= pEnd || !isdigit(*p))
+			return 0;
+		while(p < pEnd && isdigit(*p))
+			++p;
+	}
+	fp->p = p;
+	if(!fpIsDelim(fp))
+		return 0;
+	if(!bEmit)
+		return 1;
+#ifdef HAVE_JSON_OBJECT_NEW_INT64
+	if(lenVal > 18)
+#else /* HAVE_JSON_OBJECT_NEW_INT64 */
+	if(lenVal > 9)
+#endif /* HAVE_JSON_OBJECT_NEW_INT64 */
+		return 0;
+	/* -0 is stored as 0 by json-c, so the text would not match */
+	if(!bInt || (start[0] == '-' && start[1] == '0'))
+		return 0;
+	if(!fpReserve(fp->pWrkrData, lenVal + 1))
+		return 0;
+	memcpy(fp->pWrkrData->fpBuf + fp->pWrkrData->lenFpBuf, start, lenVal);
+	fp->pWrkrData->fpBuf[fp->pWrkrData->lenFpBuf + lenVal] = '\0';
+	fp->pWrkrData->lenFpBuf += lenVal + 1;
+	return fpAddLeaf(fp, json_type_int, fp->pWrkrData->lenFpBuf - lenVal - 1, lenVal);
+}
+
+/* parse true, false and (not emitted) null */
+static int
+fpLiteral(fastParser_t *fp, sbool bEmit)
+{
+	static uchar *lits[] = { (uchar*) "true", (uchar*) "false", (uchar*) "null" };
+	static int lenLits[] = { 4, 5, 4 };
+	int offVal;
+	int i;
+
+	for(i = 0 ; i < 3 ; ++i) {
+		if(lits[i][0] == *fp->p)
+			break;
+	}
+	if(i == 3 || fp->pEnd - fp->p < lenLits[i] || memcmp(fp->p, lits[i], lenLits[i]))
+		return 0;
+	fp->p += lenLits[i];
+	if(!fpIsDelim(fp))
+		return 0;
+	if(!bEmit)
+		return 1;
+	if(i == 2 || !fpReserve(fp->pWrkrData, lenLits[i] + 1))
+		return 0;
+	offVal = fp->pWrkrData->lenFpBuf;
+	memcpy(fp->pWrkrData->fpBuf + offVal, lits[i], lenLits[i] + 1);
+	fp->pWrkrData->lenFpBuf += lenLits[i] + 1;
+	return fpAddLeaf(fp, json_type_boolean, offVal, lenLits[i]);
+}
+
+/* parse an array; arrays can not be emitted, so this is only for skipping */
+static int
+fpArray(fastParser_t *fp, int depth)
+{
+	if(depth > FAST_MAX_DEPTH)
+		return 0;
+	++fp->p;
+	fpSkipWS(fp);
+	if(fp->p < fp->pEnd && *fp->p == ']') {
+		++fp->p;
+		return 1;
+	}
+	while(1) {
+		if(fp->p >= fp->pEnd || !fpValue(fp, 0, depth))
+			return 0;
+		fpSkipWS(fp);
+		if(fp->p >= fp->pEnd)
+			return 0;
+		if(*fp->p == ']') {
+			++fp->p;
+			return 1;
+		}
+		if(*fp->p != ',')
+			return 0;
+		++fp->p;
+		fpSkipWS(fp);
+	}
+}
+
+/* parse an object, fp->p is on the opening brace */
+static int
+fpObject(fastParser_t *fp, sbool bEmit, int depth)
+{
+	wrkrInstanceData_t *pWrkrData = fp->pWrkrData;
+	uchar *key;
+	sbool bEmitVal;
+	int lenPathSave = fp->lenPath;
+	int offKey, lenKey;
+
+	if(depth > FAST_MAX_DEPTH)
+		return 0;
+	++fp->p;
+	fpSkipWS(fp);
+	if(fp->p < fp->pEnd && *fp->p == '}') {
+		++fp->p;
+		/* empty containers can not be stored as compact variables */
+		return !bEmit;
+	}
+	while(1) {
+		if(fp->p >= fp->pEnd || *fp->p != '"')
+			return 0;
+		/* the key is only needed until it is copied to the path */
+		if(!fpString(fp, 1, &offKey, &lenKey))
+			return 0;
+		pWrkrData->lenFpBuf = offKey;
+		key = pWrkrData->fpBuf + offKey;
+		bEmitVal = bEmit;
+		if(bEmit && depth == 1 && fp->bLazy && !msgCEEIsReferenced(key, lenKey))
+			bEmitVal = 0;
+		if(bEmitVal) {
+			if(lenKey == 0 || memchr(key, '!', lenKey) != NULL
+			   || lenPathSave + 1 + lenKey > FAST_MAX_NAME)
+				return 0;
+			fp->path[lenPathSave] = '!';
+			memcpy(fp->path + lenPathSave + 1, key, lenKey);
+			fp->lenPath = lenPathSave + 1 + lenKey;
+		}
+		fpSkipWS(fp);
+		if(fp->p >= fp->pEnd || *fp->p != ':')
+			return 0;
+		++fp->p;
+		fpSkipWS(fp);
+		if(fp->p >= fp->pEnd)
+			return 0;
+		if(bEmitVal && *fp->p == '{' && fpPathUsed(fp))
+			return 0; /* repeated key, leave it to json-c */
+		if(!fpValue(fp, bEmitVal, depth))
+			return 0;
+		fp->lenPath = lenPathSave;
+		fpSkipWS(fp);
+		if(fp->p >= fp->pEnd)
+			return 0;
+		if(*fp->p == '}') {
+			++fp->p;
+			return 1;
+		}
+		if(*fp->p != ',')
+			return 0;
+		++fp->p;
+		fpSkipWS(fp);
+	}
+}
+
+/* parse any value, fp->p must be on its first character */
+static int
+fpValue(fastParser_t *fp, sbool bEmit, int depth)
+{
+	int offVal, lenVal;
+
+	switch(*fp->p) {
+	case '{':
+		return fpObject(fp, bEmit, depth + 1);
+	case '[':
+		return !bEmit && fpArray(fp, depth + 1);
+	case '"':
+		if(!fpString(fp, bEmit, &offVal, &lenVal))
+			return 0;
+		return !bEmit || fpAddLeaf(fp, json_type_string, offVal, lenVal);
+	case 't':
+	case 'f':
+	case 'n':
+		return fpLiteral(fp, bEmit);
+	default:
+		if(*fp->p == '-' || isdigit(*fp->p))
+			return fpNumber(fp, bEmit);
+		return 0;
+	}
+}
+
+/* try to parse buf with the fast parser and store the result in pMsg.
+ * Returns 1 if done, 0 if json-c must be used.
+ */
+static int
+processJSONFast(wrkrInstanceData_t *pWrkrData, msg_t *pMsg, uchar *buf, size_t lenBuf)
+{
+	fastParser_t fp;
+
+	if(!bMsgCompactVars)
+		return 0;
+	fp.pWrkrData = pWrkrData;
+	fp.p = buf;
+	fp.pEnd = buf + lenBuf;
+	fp.bLazy = pWrkrData->pData->bLazy;
+	fp.lenPath = 0;
+	pWrkrData->lenFpBuf = 0;
+	pWrkrData->nFpLeaves = 0;
+
+	fpSkipWS(&fp);
+	if(fp.p >= fp.pEnd || *fp.p != '{' || !fpObject(&fp, 1, 1) || fp.p != fp.pEnd)
+		return 0;
+	return msgAddJSONLeaves(pMsg, (uchar*) "!", pWrkrData->fpBuf, pWrkrData->fpLeaves, pWrkrData->nFpLeaves);
+}
+
+
+/* remove the top-level names that the config does not reference (lazy mode) */
+static void
+dropUnreferenced(struct json_object *json)
+{
+	struct json_object_iter it;
+	const char **keys;
+	int nKeys = 0;
+	int i;
+
+	json_object_object_foreachC(json, it)
+		++nKeys;
+	if((keys = malloc((nKeys + 1) * sizeof(char*))) == NULL)
+		return;
+	nKeys = 0;
+	json_object_object_foreachC(json, it) {
+		if(!msgCEEIsReferenced((uchar*) it.key, strlen(it.key)))
+			keys[nKeys++] = it.key;
+	}
+	/* deleting an entry only frees its own key */
+	for(i = 0 ; i < nKeys ; ++i)
+		json_object_object_del(json, keys[i]);
+	free(keys);
+}
+
+
 static rsRetVal
 processJSON(wrkrInstanceData_t *pWrkrData, msg_t *pMsg, char *buf, size_t lenBuf)
 {
@@ -150,6 +632,9 @@ processJSON(wrkrInstanceData_t *pWrkrData, msg_t *pMsg, char *buf, size_t lenBuf
 
 	assert(pWrkrData->tokener != NULL);
 	DBGPRINTF("mmjsonparse: toParse: '%s'\n", buf);
+	if(pWrkrData->pData->parser == JSONPARSE_FAST
+	   && processJSONFast(pWrkrData, pMsg, (uchar*) buf, lenBuf))
+		FINALIZE;
 	json_tokener_reset(pWrkrData->tokener);
 
 	json = json_tokener_parse_ex(pWrkrData->tokener, buf, lenBuf);
@@ -177,8 +662,10 @@ processJSON(wrkrInstanceData_t *pWrkrData, msg_t *pMsg, char *buf, size_t lenBuf
 	   || (!json_object_is_type(json, json_type_object))) {
 		ABORT_FINALIZE(RS_RET_NO_CEE_MSG);
 	}
- 
- 	msgAddJSON(pMsg, (uchar*)"!", json);
+
+	if(pWrkrData->pData->bLazy)
+		dropUnreferenced(json);
+	msgAddJSON(pMsg, (uchar*)"!", json);
 finalize_it:
 	RETiRet;
 }
@@ -222,21 +709,55 @@ finalize_it:
 	MsgSetParseSuccess(pMsg, bSuccess);
 ENDdoAction
 
+static inline void
+setInstParamDefaults(instanceData *pData)
+{
+	pData->parser = JSONPARSE_JSONC;
+	pData->bLazy = 0;
+}
+
 BEGINnewActInst
+	struct cnfparamvals *pvals;
+	char *cstr;
+	int i;
 CODESTARTnewActInst
-	/* Note: we currently do not have any parameters, so we do not need
-	 * the lst ptr. However, we will most probably need params in the 
-	 * future.
-	 */
 	DBGPRINTF("newActInst (mmjsonparse)\n");
+	if((pvals = nvlstGetParams(lst, &actpblk, NULL)) == NULL) {
+		ABORT_FINALIZE(RS_RET_MISSING_CNFPARAMS);
+	}
 
 	CODE_STD_STRING_REQUESTnewActInst(1)
 	CHKiRet(OMSRsetEntry(*ppOMSR, 0, NULL, OMSR_TPL_AS_MSG));
 	CHKiRet(createInstance(&pData));
-	/*setInstParamDefaults(pData);*/
+	setInstParamDefaults(pData);
+
+	for(i = 0 ; i < actpblk.nParams ; ++i) {
+		if(!pvals[i].bUsed)
+			continue;
+		if(!strcmp(actpblk.descr[i].name, "parser")) {
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+			if(!strcmp(cstr, "json-c")) {
+				pData->parser = JSONPARSE_JSONC;
+			} else if(!strcmp(cstr, "fast")) {
+				pData->parser = JSONPARSE_FAST;
+			} else {
+				errmsg.LogError(0, RS_RET_INVALID_PARAMS, "mmjsonparse: invalid "
+					"parser '%s', must be \"json-c\" or \"fast\"", cstr);
+				free(cstr);
+				ABORT_FINALIZE(RS_RET_INVALID_PARAMS);
+			}
+			free(cstr);
+		} else if(!strcmp(actpblk.descr[i].name, "lazy")) {
+			pData->bLazy = (int) pvals[i].val.d.n;
+		} else {
+			dbgprintf("mmjsonparse: program error, non-handled "
+			  "param '%s'\n", actpblk.descr[i].name);
+		}
+	}
 
 CODE_STD_FINALIZERnewActInst
-/*	cnfparamvalsDestruct(pvals, &actpblk);*/
+	if(pvals != NULL)
+		cnfparamvalsDestruct(pvals, &actpblk);
 ENDnewActInst
 
 BEGINparseSelectorAct
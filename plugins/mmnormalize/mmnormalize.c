@@ -35,6 +35,8 @@
 #include <signal.h>
 #include <errno.h>
 #include <unistd.h>
+#include <ctype.h>
+#include <pthread.h>
 #include <libestr.h>
 #include <json.h>
 #include <liblognorm.h>
@@ -45,6 +47,9 @@
 #include "errmsg.h"
 #include "cfsysline.h"
 #include "dirty.h"
+#include "atomic.h"
+#include "statsobj.h"
+#include "unicode-helper.h"
 
 MODULE_TYPE_OUTPUT
 MODULE_TYPE_NOKEEP
@@ -54,20 +59,40 @@ static rsRetVal resetConfigVariables(uchar __attribute__((unused)) *pp, void __a
 
 /* static data */
 DEFobjCurrIf(errmsg);
+DEFobjCurrIf(statsobj)
 
 /* internal structures
  */
 DEF_OMOD_STATIC_DATA
 
+/* match counter for a rule tag */
+typedef struct tagCtr_s {
+	char *name;
+	STATSCOUNTER_DEF(ctr, mutCtr)
+} tagCtr_t;
+
 typedef struct _instanceData {
 	sbool bUseRawMsg;	/**< use %rawmsg% instead of %msg% */
 	uchar 	*rulebase;	/**< name of rulebase to use */
-	ln_ctx ctxln;		/**< context to be used for liblognorm */
+	ln_ctx ctxln;		/**< context loaded at config time, taken over by the first worker */
+	pthread_mutex_t mutCtx;	/**< guards ctxln */
+	unsigned rbGen;		/**< rulebase generation, incremented on HUP */
+	DEF_ATOMIC_HELPER_MUT(mutRbGen);
 	char *pszPath;		/**< path of normalized data */
+	uchar **ppProgNames;	/**< only normalize messages from these programs (NULL: all) */
+	int nProgNames;
+	statsobj_t *stats;
+	STATSCOUNTER_SHARDED_DEF(ctrParsed)	/* updated by all workers */
+	STATSCOUNTER_DEF(ctrFailed, mutCtrFailed)
+	STATSCOUNTER_DEF(ctrSkipped, mutCtrSkipped)
+	tagCtr_t *pTagCtrs;	/**< per rule tag match counters */
+	int nTagCtrs;
 } instanceData;
 
 typedef struct wrkrInstanceData {
 	instanceData *pData;
+	ln_ctx ctxln;		/**< this worker's liblognorm context */
+	unsigned rbGen;		/**< generation of the rulebase in ctxln */
 } wrkrInstanceData_t;
 
 typedef struct configSettings_s {
@@ -81,7 +106,8 @@ static configSettings_t cs;
 static struct cnfparamdescr actpdescr[] = {
 	{ "rulebase", eCmdHdlrGetWord, 1 },
 	{ "path", eCmdHdlrGetWord, 0 },
-	{ "userawmsg", eCmdHdlrBinary, 0 }
+	{ "userawmsg", eCmdHdlrBinary, 0 },
+	{ "programname", eCmdHdlrArray, 0 }
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -97,24 +123,127 @@ static modConfData_t *loadModConf = NULL;/* modConf ptr to use for the current l
 static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current exec process */
 
 
-/* to be called to build the liblognorm part of the instance ONCE ALL PARAMETERS ARE CORRECT
- * (and set within pData!).
- */
+/* create a liblognorm context and load the rulebase into it */
 static rsRetVal
-buildInstance(instanceData *pData)
+loadRulebase(instanceData *pData, ln_ctx *pCtx)
 {
+	ln_ctx ctx;
 	DEFiRet;
-	if((pData->ctxln = ln_initCtx()) == NULL) {
+
+	if((ctx = ln_initCtx()) == NULL) {
 		errmsg.LogError(0, RS_RET_ERR_LIBLOGNORM_INIT, "error: could not initialize "
 				"liblognorm ctx, cannot activate action");
 		ABORT_FINALIZE(RS_RET_ERR_LIBLOGNORM_INIT);
 	}
-	if(ln_loadSamples(pData->ctxln, (char*) pData->rulebase) != 0) {
+	if(ln_loadSamples(ctx, (char*) pData->rulebase) != 0) {
 		errmsg.LogError(0, RS_RET_NO_RULEBASE, "error: normalization rulebase '%s' "
 				"could not be loaded cannot activate action", pData->rulebase);
-		ln_exitCtx(pData->ctxln);
+		ln_exitCtx(ctx);
 		ABORT_FINALIZE(RS_RET_ERR_LIBLOGNORM_SAMPDB_LOAD);
 	}
+	*pCtx = ctx;
+finalize_it:
+	RETiRet;
+}
+
+
+/* add a match counter for a rule tag, if we do not already have one */
+static rsRetVal
+addTagCtr(instanceData *pData, char *name, int lenName)
+{
+	tagCtr_t *pNew;
+	uchar ctrName[256];
+	int i;
+	DEFiRet;
+
+	if(lenName == 0 || lenName > 200)
+		FINALIZE;
+	for(i = 0 ; i < pData->nTagCtrs ; ++i) {
+		if(!strncmp(pData->pTagCtrs[i].name, name, lenName)
+		   && pData->pTagCtrs[i].name[lenName] == '\0')
+			FINALIZE;
+	}
+	CHKmalloc(pNew = realloc(pData->pTagCtrs, (pData->nTagCtrs + 1) * sizeof(tagCtr_t)));
+	pData->pTagCtrs = pNew;
+	pNew += pData->nTagCtrs;
+	CHKmalloc(pNew->name = malloc(lenName + 1));
+	memcpy(pNew->name, name, lenName);
+	pNew->name[lenName] = '\0';
+	++pData->nTagCtrs;
+	snprintf((char*) ctrName, sizeof(ctrName), "tag.%s", pNew->name);
+	STATSCOUNTER_INIT(pNew->ctr, pNew->mutCtr);
+	CHKiRet(statsobj.AddCounter(pData->stats, ctrName, ctrType_IntCtr,
+		CTR_FLAG_RESETTABLE, &pNew->ctr));
+finalize_it:
+	RETiRet;
+}
+
+
+/* collect the tags of the rulebase's rules ("rule=tag1,tag2:sample"), so that
+ * we can count how often each of them matched. liblognorm does not tell
+ * which rule matched, but its tags are added to the result as "event.tags".
+ * Tags of rules added by a later HUP are not counted.
+ */
+static rsRetVal
+setupTagCtrs(instanceData *pData)
+{
+	FILE *fp;
+	char line[4096];
+	char *p, *tag;
+	DEFiRet;
+
+	if((fp = fopen((char*) pData->rulebase, "r")) == NULL)
+		FINALIZE; /* ln_loadSamples() has already complained */
+	while(fgets(line, sizeof(line), fp) != NULL) {
+		p = line;
+		while(isspace(*p))
+			++p;
+		if(strncmp(p, "rule=", sizeof("rule=") - 1))
+			continue;
+		p += sizeof("rule=") - 1;
+		while(*p != ':' && *p != '\0') {
+			while(*p == ' ' || *p == ',')
+				++p;
+			tag = p;
+			while(*p != ',' && *p != ':' && *p != ' ' && *p != '\0')
+				++p;
+			CHKiRet(addTagCtr(pData, tag, p - tag));
+			while(*p == ' ')
+				++p;
+		}
+	}
+finalize_it:
+	if(fp != NULL)
+		fclose(fp);
+	RETiRet;
+}
+
+
+/* to be called to build the liblognorm part of the instance ONCE ALL PARAMETERS ARE CORRECT
+ * (and set within pData!). The context loaded here is used by the first worker,
+ * others load their own, so that workers never share a context.
+ */
+static rsRetVal
+buildInstance(instanceData *pData)
+{
+	uchar statsName[256];
+	DEFiRet;
+	CHKiRet(loadRulebase(pData, &pData->ctxln));
+
+	snprintf((char*) statsName, sizeof(statsName), "mmnormalize(%s)", pData->rulebase);
+	CHKiRet(statsobj.Construct(&pData->stats));
+	CHKiRet(statsobj.SetName(pData->stats, statsName));
+	STATSCOUNTER_SHARDED_INIT(pData->ctrParsed);
+	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("parsed"),
+		ctrType_IntCtrSharded, CTR_FLAG_RESETTABLE, &pData->ctrParsed));
+	STATSCOUNTER_INIT(pData->ctrFailed, pData->mutCtrFailed);
+	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("failed"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pData->ctrFailed));
+	STATSCOUNTER_INIT(pData->ctrSkipped, pData->mutCtrSkipped);
+	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("skipped"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pData->ctrSkipped));
+	CHKiRet(setupTagCtrs(pData));
+	CHKiRet(statsobj.ConstructFinalize(pData->stats));
 finalize_it:
 	RETiRet;
 }
@@ -128,11 +257,24 @@ ENDinitConfVars
 
 BEGINcreateInstance
 CODESTARTcreateInstance
+	pthread_mutex_init(&pData->mutCtx, NULL);
+	INIT_ATOMIC_HELPER_MUT(pData->mutRbGen);
 ENDcreateInstance
 
 
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
+	pWrkrData->rbGen = ATOMIC_FETCH_32BIT(&pData->rbGen, &pData->mutRbGen);
+	/* the config-time context is only current if there was no HUP yet */
+	if(pWrkrData->rbGen == 0) {
+		pthread_mutex_lock(&pData->mutCtx);
+		pWrkrData->ctxln = pData->ctxln;
+		pData->ctxln = NULL;
+		pthread_mutex_unlock(&pData->mutCtx);
+	}
+	if(pWrkrData->ctxln == NULL)
+		CHKiRet(loadRulebase(pData, &pWrkrData->ctxln));
+finalize_it:
 ENDcreateWrkrInstance
 
 
@@ -171,15 +313,29 @@ ENDisCompatibleWithFeature
 
 
 BEGINfreeInstance
+	int i;
 CODESTARTfreeInstance
 	free(pData->rulebase);
-	ln_exitCtx(pData->ctxln);
+	if(pData->ctxln != NULL)
+		ln_exitCtx(pData->ctxln);
 	free(pData->pszPath);
+	for(i = 0 ; i < pData->nProgNames ; ++i)
+		free(pData->ppProgNames[i]);
+	free(pData->ppProgNames);
+	if(pData->stats != NULL)
+		statsobj.Destruct(&pData->stats);
+	for(i = 0 ; i < pData->nTagCtrs ; ++i)
+		free(pData->pTagCtrs[i].name);
+	free(pData->pTagCtrs);
+	pthread_mutex_destroy(&pData->mutCtx);
+	DESTROY_ATOMIC_HELPER_MUT(pData->mutRbGen);
 ENDfreeInstance
 
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
+	if(pWrkrData->ctxln != NULL)
+		ln_exitCtx(pWrkrData->ctxln);
 ENDfreeWrkrInstance
 
 
@@ -193,30 +349,122 @@ BEGINtryResume
 CODESTARTtryResume
 ENDtryResume
 
+/* HUP: workers pick up the new rulebase before their next message. A
+ * message being processed at that moment finishes with the old one.
+ */
+BEGINdoHUP
+CODESTARTdoHUP
+	ATOMIC_INC(&pData->rbGen, &pData->mutRbGen);
+ENDdoHUP
+
+
+/* load the current rulebase if it changed since the worker loaded its own.
+ * If it can not be loaded, the old one is kept.
+ */
+static inline void
+checkRulebaseReload(wrkrInstanceData_t *pWrkrData)
+{
+	instanceData *pData = pWrkrData->pData;
+	unsigned rbGen;
+	ln_ctx ctx;
+
+	rbGen = ATOMIC_FETCH_32BIT(&pData->rbGen, &pData->mutRbGen);
+	if(rbGen == pWrkrData->rbGen)
+		return;
+	pWrkrData->rbGen = rbGen;
+	if(loadRulebase(pData, &ctx) != RS_RET_OK) {
+		DBGPRINTF("mmnormalize: keeping previous rulebase '%s'\n", pData->rulebase);
+		return;
+	}
+	DBGPRINTF("mmnormalize: worker reloaded rulebase '%s'\n", pData->rulebase);
+	ln_exitCtx(pWrkrData->ctxln);
+	pWrkrData->ctxln = ctx;
+}
+
+
+/* does the programname filter let pMsg through? */
+static inline int
+isProgNameWanted(instanceData *pData, msg_t *pMsg)
+{
+	uchar *progName;
+	int i;
+
+	if(pData->ppProgNames == NULL)
+		return 1;
+	progName = getProgramName(pMsg, LOCK_MUTEX);
+	for(i = 0 ; i < pData->nProgNames ; ++i) {
+		if(!ustrcmp(progName, pData->ppProgNames[i]))
+			return 1;
+	}
+	return 0;
+}
+
+
+/* count the tags of the rule that matched */
+static inline void
+countTags(instanceData *pData, struct json_object *json)
+{
+	struct json_object *tags;
+	struct json_object *tag;
+	const char *name;
+	int nTags;
+	int i, j;
+
+	if(pData->nTagCtrs == 0 || json == NULL
+	   || (tags = json_object_object_get(json, "event.tags")) == NULL
+	   || !json_object_is_type(tags, json_type_array))
+		return;
+	nTags = json_object_array_length(tags);
+	for(i = 0 ; i < nTags ; ++i) {
+		if((tag = json_object_array_get_idx(tags, i)) == NULL
+		   || (name = json_object_get_string(tag)) == NULL)
+			continue;
+		for(j = 0 ; j < pData->nTagCtrs ; ++j) {
+			if(!strcmp(pData->pTagCtrs[j].name, name)) {
+				STATSCOUNTER_INC(pData->pTagCtrs[j].ctr, pData->pTagCtrs[j].mutCtr);
+				break;
+			}
+		}
+	}
+}
+
+
 BEGINdoAction
 	msg_t *pMsg;
 	uchar *buf;
 	int len;
 	int r;
 	struct json_object *json = NULL;
+	instanceData *pData;
 CODESTARTdoAction
 	pMsg = (msg_t*) ppString[0];
-	if(pWrkrData->pData->bUseRawMsg) {
+	pData = pWrkrData->pData;
+	if(!isProgNameWanted(pData, pMsg)) {
+		STATSCOUNTER_INC(pData->ctrSkipped, pData->mutCtrSkipped);
+		MsgSetParseSuccess(pMsg, 0);
+		FINALIZE;
+	}
+	checkRulebaseReload(pWrkrData);
+	if(pData->bUseRawMsg) {
 		getRawMsg(pMsg, &buf, &len);
 	} else {
 		buf = getMSG(pMsg);
 		len = getMSGLen(pMsg);
 	}
-	r = ln_normalize(pWrkrData->pData->ctxln, (char*)buf, len, &json);
+	r = ln_normalize(pWrkrData->ctxln, (char*)buf, len, &json);
 	if(r != 0) {
 		DBGPRINTF("error %d during ln_normalize\n", r);
 		MsgSetParseSuccess(pMsg, 0);
+		STATSCOUNTER_INC(pData->ctrFailed, pData->mutCtrFailed);
 	} else {
 		MsgSetParseSuccess(pMsg, 1);
+		STATSCOUNTER_SHARDED_INC(pData->ctrParsed);
+		countTags(pData, json);
 	}
 
- 	msgAddJSON(pMsg, (uchar*)pWrkrData->pData->pszPath + 1, json);
+ 	msgAddJSON(pMsg, (uchar*)pData->pszPath + 1, json);
 
+finalize_it:
 ENDdoAction
 
 
@@ -226,11 +474,13 @@ setInstParamDefaults(instanceData *pData)
 	pData->rulebase = NULL;
 	pData->bUseRawMsg = 0;
 	pData->pszPath = strdup("$!");
+	pData->ppProgNames = NULL;
+	pData->nProgNames = 0;
 }
 
 BEGINnewActInst
 	struct cnfparamvals *pvals;
-	int i;
+	int i, j;
 	int bDestructPValsOnExit;
 	char *cstr;
 CODESTARTnewActInst
@@ -277,6 +527,13 @@ CODESTARTnewActInst
 				pData->pszPath = cstr;
 			}
 			continue;
+		} else if(!strcmp(actpblk.descr[i].name, "programname")) {
+			CHKmalloc(pData->ppProgNames = calloc(pvals[i].val.d.ar->nmemb, sizeof(uchar*)));
+			for(j = 0 ; j < pvals[i].val.d.ar->nmemb ; ++j) {
+				CHKmalloc(pData->ppProgNames[j] = (uchar*)
+					es_str2cstr(pvals[i].val.d.ar->arr[j], NULL));
+				++pData->nProgNames;
+			}
 		} else {
 			DBGPRINTF("mmnormalize: program error, non-handled "
 			  "param '%s'\n", actpblk.descr[i].name);
@@ -332,6 +589,7 @@ ENDparseSelectorAct
 BEGINmodExit
 CODESTARTmodExit
 	objRelease(errmsg, CORE_COMPONENT);
+	objRelease(statsobj, CORE_COMPONENT);
 ENDmodExit
 
 
@@ -341,6 +599,7 @@ CODEqueryEtryPt_STD_OMOD_QUERIES
 CODEqueryEtryPt_STD_OMOD8_QUERIES
 CODEqueryEtryPt_STD_CONF2_QUERIES
 CODEqueryEtryPt_STD_CONF2_OMOD_QUERIES
+CODEqueryEtryPt_doHUP
 ENDqueryEtryPt
 
 
@@ -396,6 +655,7 @@ CODEmodInit_QueryRegCFSLineHdlr
 	}
 
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 	
 	CHKiRet(omsdRegCFSLineHdlr((uchar *)"mmnormalizerulebase", 0, eCmdHdlrGetWord,
 				    setRuleBase, NULL, STD_LOADABLE_MODULE_ID));
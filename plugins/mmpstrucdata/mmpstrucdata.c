@@ -38,6 +38,8 @@
 #include "template.h"
 #include "module-template.h"
 #include "errmsg.h"
+#include "msg.h"
+#include "unicode-helper.h"
 
 MODULE_TYPE_OUTPUT
 MODULE_TYPE_NOKEEP
@@ -51,6 +53,9 @@ DEF_OMOD_STATIC_DATA
 
 typedef struct _instanceData {
 	uchar *jsonRoot;	/**< container where to store fields */
+	sbool bLazy;		/**< only materialize SD-IDs referenced by the config */
+	uchar *sdPath;		/**< $! name of the rfc5424-sd container, NULL if not in $! */
+	int lenSdPath;
 } instanceData;
 
 typedef struct wrkrInstanceData {
@@ -67,7 +72,8 @@ static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current ex
 /* tables for interfacing with the v6 config system */
 /* action (instance) parameters */
 static struct cnfparamdescr actpdescr[] = {
-	{ "jsonroot", eCmdHdlrString, 0 }
+	{ "jsonroot", eCmdHdlrString, 0 },
+	{ "lazy", eCmdHdlrBinary, 0 }
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -116,6 +122,7 @@ ENDisCompatibleWithFeature
 BEGINfreeInstance
 CODESTARTfreeInstance
 	free(pData->jsonRoot);
+	free(pData->sdPath);
 ENDfreeInstance
 
 BEGINfreeWrkrInstance
@@ -127,6 +134,8 @@ static inline void
 setInstParamDefaults(instanceData *pData)
 {
 	pData->jsonRoot = NULL;
+	pData->bLazy = 0;
+	pData->sdPath = NULL;
 }
 
 BEGINnewActInst
@@ -148,6 +157,8 @@ CODESTARTnewActInst
 			continue;
 		if(!strcmp(actpblk.descr[i].name, "jsonroot")) {
 			pData->jsonRoot = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "lazy")) {
+			pData->bLazy = (int) pvals[i].val.d.n;
 		} else {
 			dbgprintf("mmpstrucdata: program error, non-handled "
 			  "param '%s'\n", actpblk.descr[i].name);
@@ -156,6 +167,14 @@ CODESTARTnewActInst
 	if(pData->jsonRoot == NULL) {
 		CHKmalloc(pData->jsonRoot = (uchar*) strdup("!"));
 	}
+	if(pData->jsonRoot[0] == '!') {
+		/* for lazy mode, we need the $! name of our container */
+		pData->lenSdPath = ustrlen(pData->jsonRoot) + sizeof("!rfc5424-sd") - 1;
+		CHKmalloc(pData->sdPath = malloc(pData->lenSdPath + 1));
+		snprintf((char*) pData->sdPath, pData->lenSdPath + 1, "%s!rfc5424-sd",
+			 (pData->jsonRoot[1] == '\0') ? "" : (char*) pData->jsonRoot);
+		pData->lenSdPath = ustrlen(pData->sdPath);
+	}
 
 CODE_STD_FINALIZERnewActInst
 	cnfparamvalsDestruct(pvals, &actpblk);
@@ -229,6 +248,9 @@ dbgprintf("DDDD: parseSD_NAME, NAME: '%s'\n", namebuf);
 }
 
 
+/* parse a SD-PARAM and add it to jroot. If jroot is NULL, the element is not
+ * needed (lazy mode) and the param is only checked for validity.
+ */
 static inline rsRetVal
 parseSD_PARAM(instanceData *pData, uchar *sdbuf, int lenbuf, int *curridx, struct json_object *jroot)
 {
@@ -255,8 +277,10 @@ dbgprintf("DDDD: parseSD_PARAM %s\n", sdbuf+*curridx);
 	}
 	++i;
 
-	jval = json_object_new_string((char*)pVal);
-	json_object_object_add(jroot, (char*)pName, jval);
+	if(jroot != NULL) {
+		jval = json_object_new_string((char*)pVal);
+		json_object_object_add(jroot, (char*)pName, jval);
+	}
 
 	*curridx = i;
 finalize_it:
@@ -264,12 +288,28 @@ finalize_it:
 }
 
 
+/* check if the config references SD-ID sd_id (lazy mode) */
+static inline int
+isSDIDReferenced(instanceData *pData, uchar *sd_id)
+{
+	uchar path[1024];
+	int lenPath;
+
+	if(!pData->bLazy || pData->sdPath == NULL)
+		return 1;
+	lenPath = snprintf((char*) path, sizeof(path), "%s!%s", pData->sdPath, sd_id);
+	if(lenPath >= (int) sizeof(path))
+		return 1;
+	return msgCEEPathIsReferenced(path, lenPath);
+}
+
+
 static inline rsRetVal
 parseSD_ELEMENT(instanceData *pData, uchar *sdbuf, int lenbuf, int *curridx, struct json_object *jroot)
 {
 	int i;
 	uchar sd_id[33];
-	struct json_object *json;
+	struct json_object *json = NULL;
 	DEFiRet;
 dbgprintf("DDDD: parseSD_ELEMENT: %s\n", sdbuf+*curridx);
 	
@@ -280,7 +320,9 @@ dbgprintf("DDDD: parseSD_ELEMENT: %s\n", sdbuf+*curridx);
 	++i; /* eat '[' */
 
 	CHKiRet(parseSD_NAME(sdbuf, lenbuf, &i, sd_id));
-	json =  json_object_new_object();
+	/* elements nobody references are only validated */
+	if(isSDIDReferenced(pData, sd_id))
+		json =  json_object_new_object();
 
 	while(i < lenbuf) {
 		if(sdbuf[i] == ']') {
@@ -302,10 +344,13 @@ dbgprintf("DDDD: done parseSD_PARAM, in loop, i:%d, lenbuf:%d, rest: %s\n", i, l
 	}
 	++i; /* eat ']' */
 	*curridx = i;
-	json_object_object_add(jroot, (char*)sd_id, json);
-dbgprintf("DDDD: SD_ELEMENT: json: '%s'\n", json_object_get_string(json));
-dbgprintf("DDDD: SD_ELEMENT: jroot '%s'\n", json_object_get_string(json));
+	if(json != NULL) {
+		json_object_object_add(jroot, (char*)sd_id, json);
+		json = NULL;
+	}
 finalize_it:
+	if(json != NULL)
+		json_object_put(json);
 dbgprintf("DDDD: parseSD_ELEMENT iRet:%d, i:%d, *curridx:%d\n", iRet, i, *curridx);
 	RETiRet;
 }
@@ -336,19 +381,28 @@ parse_sd(instanceData *pData, msg_t *pMsg)
 #endif
 
 dbgprintf("DDDD: parse_sd\n");
+	if(pData->bLazy && pData->sdPath != NULL
+	   && !msgCEEPathIsReferenced(pData->sdPath, pData->lenSdPath)) {
+		DBGPRINTF("mmpstrucdata: structured data not referenced, not parsed\n");
+		FINALIZE;
+	}
 	json =  json_object_new_object();
 	if(json == NULL) {
 		ABORT_FINALIZE(RS_RET_ERR);
 	}
 	MsgGetStructuredData(pMsg, &sdbuf,&lenbuf);
 	while(i < lenbuf) {
-		CHKiRet(parseSD_ELEMENT(pData, sdbuf, lenbuf, &i, json));
+		if((iRet = parseSD_ELEMENT(pData, sdbuf, lenbuf, &i, json)) != RS_RET_OK) {
+			json_object_put(json);
+			FINALIZE;
+		}
 dbgprintf("DDDD: parse_sd, i:%d\n", i);
 	}
 dbgprintf("DDDD: json: '%s'\n", json_object_get_string(json));
 
 	jroot =  json_object_new_object();
 	if(jroot == NULL) {
+		json_object_put(json);
 		ABORT_FINALIZE(RS_RET_ERR);
 	}
 	json_object_object_add(jroot, "rfc5424-sd", json);
@@ -55,6 +55,10 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <openssl/hmac.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#	include <openssl/core_names.h>
+#	define USE_EVP_MAC 1	/* HMAC_CTX is deprecated as of 3.0 */
+#endif
 #include "conf.h"
 #include "syslogd-types.h"
 #include "srUtils.h"
@@ -80,6 +84,21 @@ typedef struct _instanceData {
 	const EVP_MD *algo;
 } instanceData;
 
+typedef struct wrkrInstanceData {
+	instanceData *pData;
+#ifdef USE_EVP_MAC
+	EVP_MAC_CTX *hmacCtx;	/* keyed once, reset for each message */
+#else
+	HMAC_CTX *hmacCtx;	/* keyed once, reset for each message */
+#	if OPENSSL_VERSION_NUMBER < 0x10100000L
+	HMAC_CTX hmacCtxBuf;	/* older openssl has no HMAC_CTX_new() */
+#	endif
+#endif
+	uchar *sd;		/* pre-formatted SD element, hash is filled in */
+	int lenSd;
+	int lenSdPrefix;	/* offset of hash inside sd */
+} wrkrInstanceData_t;
+
 struct modConfData_s {
 	rsconf_t *pConf;	/* our overall config object */
 };
@@ -129,6 +148,106 @@ CODESTARTcreateInstance
 ENDcreateInstance
 
 
+/* The HMAC context is keyed only once per worker. For each message,
+ * it is reset to the keyed state by initializing it with a NULL key,
+ * which is much cheaper than the one-shot HMAC() per message (that
+ * computes the key schedule every time).
+ */
+static rsRetVal
+hmacCtxInit(wrkrInstanceData_t *pWrkrData, instanceData *pData)
+{
+#ifdef USE_EVP_MAC
+	EVP_MAC *mac;
+	OSSL_PARAM params[2];
+#endif
+	DEFiRet;
+
+#ifdef USE_EVP_MAC
+	CHKmalloc(mac = EVP_MAC_fetch(NULL, "HMAC", NULL));
+	pWrkrData->hmacCtx = EVP_MAC_CTX_new(mac);
+	EVP_MAC_free(mac);
+	CHKmalloc(pWrkrData->hmacCtx);
+	params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+		(char*)EVP_MD_get0_name(pData->algo), 0);
+	params[1] = OSSL_PARAM_construct_end();
+	if(!EVP_MAC_init(pWrkrData->hmacCtx, pData->key, pData->keylen, params)) {
+#else
+#	if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	CHKmalloc(pWrkrData->hmacCtx = HMAC_CTX_new());
+#	else
+	HMAC_CTX_init(&pWrkrData->hmacCtxBuf);
+	pWrkrData->hmacCtx = &pWrkrData->hmacCtxBuf;
+#	endif
+	if(!HMAC_Init_ex(pWrkrData->hmacCtx, pData->key, pData->keylen, pData->algo, NULL)) {
+#endif
+		errmsg.LogError(0, RS_RET_CRY_INVLD_ALGO, "mmrfc5424addhmac: "
+			"could not initialize HMAC context");
+		ABORT_FINALIZE(RS_RET_CRY_INVLD_ALGO);
+	}
+finalize_it:
+	RETiRet;
+}
+
+static void
+hmacCtxFree(wrkrInstanceData_t *pWrkrData)
+{
+	if(pWrkrData->hmacCtx == NULL)
+		return;
+#ifdef USE_EVP_MAC
+	EVP_MAC_CTX_free(pWrkrData->hmacCtx);
+#elif OPENSSL_VERSION_NUMBER >= 0x10100000L
+	HMAC_CTX_free(pWrkrData->hmacCtx);
+#else
+	HMAC_CTX_cleanup(pWrkrData->hmacCtx);
+#endif
+}
+
+/* compute the HMAC of buf with the worker's pre-keyed context */
+static inline rsRetVal
+hmacCompute(wrkrInstanceData_t *pWrkrData, uchar *buf, int len,
+	    uchar *hash, unsigned int *hashlen)
+{
+#ifdef USE_EVP_MAC
+	size_t outlen;
+#endif
+	DEFiRet;
+
+#ifdef USE_EVP_MAC
+	if(   !EVP_MAC_init(pWrkrData->hmacCtx, NULL, 0, NULL)
+	   || !EVP_MAC_update(pWrkrData->hmacCtx, buf, len)
+	   || !EVP_MAC_final(pWrkrData->hmacCtx, hash, &outlen, EVP_MAX_MD_SIZE)) {
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+	*hashlen = outlen;
+#else
+	if(   !HMAC_Init_ex(pWrkrData->hmacCtx, NULL, 0, NULL, NULL)
+	   || !HMAC_Update(pWrkrData->hmacCtx, buf, len)
+	   || !HMAC_Final(pWrkrData->hmacCtx, hash, hashlen)) {
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+#endif
+finalize_it:
+	RETiRet;
+}
+
+
+BEGINcreateWrkrInstance
+	int hashlen;
+CODESTARTcreateWrkrInstance
+	pWrkrData->hmacCtx = NULL;
+	pWrkrData->sd = NULL;
+	hashlen = EVP_MD_size(pData->algo);
+	pWrkrData->lenSdPrefix = pData->sdidLen + sizeof("[ hash=\"") - 1;
+	pWrkrData->lenSd = pWrkrData->lenSdPrefix + 2 * hashlen + sizeof("\"]") - 1;
+	CHKmalloc(pWrkrData->sd = malloc(pWrkrData->lenSd + 1));
+	snprintf((char*)pWrkrData->sd, pWrkrData->lenSdPrefix + 1, "[%s hash=\"",
+		 (char*)pData->sdid);
+	memcpy(pWrkrData->sd + pWrkrData->lenSd - 2, "\"]", 3);
+	CHKiRet(hmacCtxInit(pWrkrData, pData));
+finalize_it:
+ENDcreateWrkrInstance
+
+
 BEGINisCompatibleWithFeature
 CODESTARTisCompatibleWithFeature
 ENDisCompatibleWithFeature
@@ -136,13 +255,23 @@ ENDisCompatibleWithFeature
 
 BEGINfreeInstance
 CODESTARTfreeInstance
+	free(pData->key);
+	free(pData->sdid);
 ENDfreeInstance
 
 
+BEGINfreeWrkrInstance
+CODESTARTfreeWrkrInstance
+	hmacCtxFree(pWrkrData);
+	free(pWrkrData->sd);
+ENDfreeWrkrInstance
+
+
 static inline void
 setInstParamDefaults(instanceData *pData)
 {
 	pData->key = NULL;
+	pData->sdid = NULL;
 }
 
 BEGINnewActInst
@@ -243,26 +372,28 @@ skipSDID(uchar *sdbuf, int sdlen, int *rootIdx)
 	*rootIdx = i;
 }
 
-static inline void
-getSDID(uchar *sdbuf, int sdlen, int *rootIdx, uchar *sdid)
+/* check if the SD-ID at *rootIdx is sdid and advance *rootIdx past
+ * the SD-ID name. The name is compared in place, so there is no
+ * limit on its length.
+ */
+static inline sbool
+isSDID(uchar *sdbuf, int sdlen, int *rootIdx, uchar *sdid, int sdidLen)
 {
-	int i, j;
+	int i, iBegin;
 	i = *rootIdx;
-	j = 0;
 
 	if(sdbuf[i] != '[') {
-		++i;
-		goto done;
+		*rootIdx = i + 1;
+		return 0;
 	}
 	
-	++i;
+	iBegin = ++i;
 	while(i < sdlen && sdbuf[i] != '=' && sdbuf[i] != ' '
 	                && sdbuf[i] != ']' && sdbuf[i] != '"') {
-		sdid[j++] = sdbuf[i++];
+		++i;
 	}
-done:
-	sdid[j] = '\0';
 	*rootIdx = i;
+	return i - iBegin == sdidLen && !memcmp(sdbuf + iBegin, sdid, sdidLen);
 }
 
 /* check if "our" hmac is already present */
@@ -273,7 +404,6 @@ isHmacPresent(instanceData *pData, msg_t *pMsg)
 	rs_size_t sdlen;
 	sbool found;
 	int i;
-	uchar sdid[33]; /* RFC-based size limit */
 
 	MsgGetStructuredData(pMsg, &sdbuf, &sdlen);
 	found = 0;
@@ -283,8 +413,7 @@ isHmacPresent(instanceData *pData, msg_t *pMsg)
 
 	i = 0;
 	while(i < sdlen && !found) {
-		getSDID(sdbuf, sdlen, &i, sdid);
-		if(!strcmp((char*)pData->sdid, (char*)sdid)) {
+		if(isSDID(sdbuf, sdlen, &i, pData->sdid, pData->sdidLen)) {
 			found = 1;
 			break;
 		}
@@ -296,27 +425,30 @@ done:
 }
 
 static inline rsRetVal
-hashMsg(instanceData *pData, msg_t *pMsg)
+hashMsg(wrkrInstanceData_t *pWrkrData, msg_t *pMsg)
 {
 	uchar *pRawMsg;
 	int lenRawMsg;
-	uchar *sdbuf;
-	rs_size_t sdlen;
 	unsigned int hashlen;
 	uchar hash[EVP_MAX_MD_SIZE];
-	uchar hashPrintable[2*EVP_MAX_MD_SIZE+1];
-	uchar newsd[64*1024];	/* we assume this is sufficient... */
-	int lenNewsd;
 	DEFiRet;
 
-	MsgGetStructuredData(pMsg, &sdbuf, &sdlen);
 	getRawMsg(pMsg, &pRawMsg, &lenRawMsg);
- 	HMAC(pData->algo, pData->key, pData->keylen,
-	     pRawMsg, lenRawMsg, hash, &hashlen);
-	hexify(hash, hashlen, hashPrintable);
-	lenNewsd = snprintf((char*)newsd, sizeof(newsd), "[%s hash=\"%s\"]",
-		            (char*)pData->sdid, (char*)hashPrintable);
-	MsgAddToStructuredData(pMsg, newsd, lenNewsd);
+	if(hmacCompute(pWrkrData, pRawMsg, lenRawMsg, hash, &hashlen) != RS_RET_OK) {
+		DBGPRINTF("mmrfc5424addhmac: error computing HMAC\n");
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+	if((int) (2 * hashlen) != pWrkrData->lenSd - pWrkrData->lenSdPrefix - 2) {
+		DBGPRINTF("mmrfc5424addhmac: unexpected HMAC length %u\n", hashlen);
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+	/* the hash is written right into the pre-formatted SD element, the
+	 * ending '"]' stays in place as hashlen is fixed per digest.
+	 */
+	hexify(hash, hashlen, pWrkrData->sd + pWrkrData->lenSdPrefix);
+	pWrkrData->sd[pWrkrData->lenSdPrefix + 2 * hashlen] = '"';
+	CHKiRet(MsgAddToStructuredData(pMsg, pWrkrData->sd, pWrkrData->lenSd));
+finalize_it:
 	RETiRet;
 }
 
@@ -326,8 +458,8 @@ BEGINdoAction
 CODESTARTdoAction
 	pMsg = (msg_t*) ppString[0];
 	if(   msgGetProtocolVersion(pMsg) == MSG_RFC5424_PROTOCOL
-	   && !isHmacPresent(pData, pMsg)) {
-		hashMsg(pData, pMsg);
+	   && !isHmacPresent(pWrkrData->pData, pMsg)) {
+		hashMsg(pWrkrData, pMsg);
 	} else {
 		if(Debug) {
 			uchar *pRawMsg;
@@ -363,6 +495,7 @@ ENDmodExit
 BEGINqueryEtryPt
 CODESTARTqueryEtryPt
 CODEqueryEtryPt_STD_OMOD_QUERIES
+CODEqueryEtryPt_STD_OMOD8_QUERIES
 CODEqueryEtryPt_STD_CONF2_OMOD_QUERIES
 CODEqueryEtryPt_STD_CONF2_QUERIES
 ENDqueryEtryPt
@@ -44,6 +44,7 @@
 #include "module-template.h"
 #include "errmsg.h"
 #include "hashtable.h"
+#include "atomic.h"
 
 #define JSON_VAR_NAME "$!mmsequence"
 
@@ -63,19 +64,30 @@ DEF_OMOD_STATIC_DATA
 
 /* config variables */
 
+/* a sequence counter. It is updated lock-free via compare-and-swap. Per
+ * key counters live in the global hashtable and are never removed, so
+ * instances can keep pointers to them.
+ */
+typedef struct seqCounter_s {
+	int value;
+	DEF_ATOMIC_HELPER_MUT(mut);
+} seqCounter_t;
+
 typedef struct _instanceData {
 	enum mmSequenceModes mode;
 	int valueFrom;
 	int valueTo;
 	int step;
 	unsigned int seed;
-	int value;
+	seqCounter_t instCounter;	/* for "instance" mode */
+	seqCounter_t *pCounter;		/* counter in use, for "key" mode shared */
 	char *pszKey;
 	char *pszVar;
 } instanceData;
 
 typedef struct wrkrInstanceData {
 	instanceData *pData;
+	unsigned int seed;	/* for "random" mode, rand_r() state is per worker */
 } wrkrInstanceData_t;
 
 struct modConfData_s {
@@ -104,8 +116,6 @@ static struct cnfparamblk actpblk =
 /* table for key-counter pairs */	
 static struct hashtable *ght;
 static pthread_mutex_t ght_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-static pthread_mutex_t inst_mutex = PTHREAD_MUTEX_INITIALIZER;
 	
 BEGINbeginCnfLoad
 CODESTARTbeginCnfLoad
@@ -133,10 +143,12 @@ ENDfreeCnf
 
 BEGINcreateInstance
 CODESTARTcreateInstance
+	INIT_ATOMIC_HELPER_MUT(pData->instCounter.mut);
 ENDcreateInstance
 
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
+	pWrkrData->seed = pData->seed ^ (unsigned int)(intptr_t)pWrkrData;
 ENDcreateWrkrInstance
 
 
@@ -147,6 +159,7 @@ ENDisCompatibleWithFeature
 
 BEGINfreeInstance
 CODESTARTfreeInstance
+	DESTROY_ATOMIC_HELPER_MUT(pData->instCounter.mut);
 ENDfreeInstance
 
 BEGINfreeWrkrInstance
@@ -154,6 +167,44 @@ CODESTARTfreeWrkrInstance
 ENDfreeWrkrInstance
 
 
+/* get the counter for a key, creating it if it does not yet exist.
+ * Must be called with ght_mutex locked.
+ */
+static seqCounter_t *
+getCounter(struct hashtable *ht, char *str, int initial) {
+	seqCounter_t *pCounter;
+	char *pStr;
+
+	pCounter = hashtable_search(ht, str);
+	if(pCounter) {
+		return pCounter;
+	}
+
+	/* counter is not found for the str, so add new entry and
+	   return the counter */
+	if(NULL == (pStr = strdup(str))) {
+		DBGPRINTF("mmsequence: memory allocation for key failed\n");
+		return NULL;
+	}
+
+	if(NULL == (pCounter = (seqCounter_t*)malloc(sizeof(*pCounter)))) {
+		DBGPRINTF("mmsequence: memory allocation for value failed\n");
+		free(pStr);
+		return NULL;
+	}
+	pCounter->value = initial;
+	INIT_ATOMIC_HELPER_MUT(pCounter->mut);
+
+	if(!hashtable_insert(ht, pStr, pCounter)) {
+		DBGPRINTF("mmsequence: inserting element into hashtable failed\n");
+		free(pStr);
+		free(pCounter);
+		return NULL;
+	}
+	return pCounter;
+}
+
+
 static inline void
 setInstParamDefaults(instanceData *pData)
 {
@@ -243,7 +294,8 @@ CODESTARTnewActInst
 		pData->seed = (unsigned int)(intptr_t)pData ^ (unsigned int)time(NULL);
 		break;
 	case mmSequencePerInstance:
-		pData->value = pData->valueTo;
+		pData->instCounter.value = pData->valueTo;
+		pData->pCounter = &pData->instCounter;
 		break;
 	case mmSequencePerKey:
 		if (pthread_mutex_lock(&ght_mutex)) {
@@ -257,7 +309,18 @@ CODESTARTnewActInst
 				ABORT_FINALIZE(RS_RET_ERR);
 			}
 		}
+		/* the key is fixed per instance, so we can look up its counter
+		 * right now and need not touch the hashtable while processing
+		 * messages.
+		 */
+		pData->pCounter = getCounter(ght, pData->pszKey, pData->valueTo);
 		pthread_mutex_unlock(&ght_mutex);
+		if(pData->pCounter == NULL) {
+			errmsg.LogError(0, RS_RET_OUT_OF_MEMORY,
+					"mmsequence: unable to create the counter for key '%s'",
+					pData->pszKey);
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
 		break;
 	default:
 		errmsg.LogError(0, RS_RET_INVLD_MODE,
@@ -278,37 +341,24 @@ BEGINtryResume
 CODESTARTtryResume
 ENDtryResume
 
-static int *
-getCounter(struct hashtable *ht, char *str, int initial) {
-	int *pCounter;
-	char *pStr;
-
-	pCounter = hashtable_search(ht, str);
-	if(pCounter) {
-		return pCounter;
-	}
-
-	/* counter is not found for the str, so add new entry and
-	   return the counter */
-	if(NULL == (pStr = strdup(str))) {
-		DBGPRINTF("mmsequence: memory allocation for key failed\n");
-		return NULL;
-	}
-
-	if(NULL == (pCounter = (int*)malloc(sizeof(*pCounter)))) {
-		DBGPRINTF("mmsequence: memory allocation for value failed\n");
-		free(pStr);
-		return NULL;
-	}
-	*pCounter = initial;
+/* advance a counter and return its new value. This is done lock-free,
+ * so workers do not serialize on the counter.
+ */
+static inline int
+nextValue(instanceData *pData, seqCounter_t *pCounter)
+{
+	int oldVal;
+	int newVal;
 
-	if(!hashtable_insert(ht, pStr, pCounter)) {
-		DBGPRINTF("mmsequence: inserting element into hashtable failed\n");
-		free(pStr);
-		free(pCounter);
-		return NULL;
-	}
-	return pCounter;
+	do {
+		oldVal = (int) ATOMIC_FETCH_32BIT(&pCounter->value, &pCounter->mut);
+		if(oldVal >= pData->valueTo - pData->step || oldVal < pData->valueFrom) {
+			newVal = pData->valueFrom;
+		} else {
+			newVal = oldVal + pData->step;
+		}
+	} while(!ATOMIC_CAS(&pCounter->value, oldVal, newVal, &pCounter->mut));
+	return newVal;
 }
 
 
@@ -316,7 +366,6 @@ BEGINdoAction
 	msg_t *pMsg;
 	struct json_object *json;
 	int val = 0;
-	int *pCounter;
 	instanceData *pData;
 CODESTARTdoAction
 	pData = pWrkrData->pData;
@@ -324,44 +373,12 @@ CODESTARTdoAction
 
 	switch(pData->mode) {
 	case mmSequenceRandom:
-		val = pData->valueFrom + (rand_r(&pData->seed) %
+		val = pData->valueFrom + (rand_r(&pWrkrData->seed) %
 				(pData->valueTo - pData->valueFrom));
 		break;
 	case mmSequencePerInstance:
-		if (!pthread_mutex_lock(&inst_mutex)) {
-			if (pData->value >= pData->valueTo - pData->step) {
-				pData->value = pData->valueFrom;
-			} else {
-				pData->value += pData->step;
-			}
-			val = pData->value;
-			pthread_mutex_unlock(&inst_mutex);
-		} else {
-			errmsg.LogError(0, RS_RET_ERR,
-					"mmsequence: mutex lock has failed!");
-		}
-		break;
 	case mmSequencePerKey:
-		if (!pthread_mutex_lock(&ght_mutex)) {
-			pCounter = getCounter(ght, pData->pszKey, pData->valueTo);
-			if(pCounter) {
-				if (*pCounter >= pData->valueTo - pData->step
-						|| *pCounter < pData->valueFrom ) {
-					*pCounter = pData->valueFrom;
-				} else {
-					*pCounter += pData->step;
-				}
-				val = *pCounter;
-			} else {
-				errmsg.LogError(0, RS_RET_NOT_FOUND,
-						"mmsequence: unable to fetch the counter from hash");
-			}
-			pthread_mutex_unlock(&ght_mutex);
-		} else {
-			errmsg.LogError(0, RS_RET_ERR,
-					"mmsequence: mutex lock has failed!");
-		}
-		
+		val = nextValue(pData, pData->pCounter);
 		break;
 	default:
 		errmsg.LogError(0, RS_RET_NOT_IMPLEMENTED,
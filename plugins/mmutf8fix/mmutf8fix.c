@@ -193,12 +193,28 @@ CODESTARTtryResume
 ENDtryResume
 
 
+/* helpers to check eight bytes at once, see
+ * http://graphics.stanford.edu/~seander/bithacks.html#HasLessInWord
+ * Both tell reliably if there is *any* such byte inside the word.
+ */
+#define WORD_HIGHBITS 0x8080808080808080ULL
+#define WORD_ONES     0x0101010101010101ULL
+#define wordHasLess(w, n) (((w) - WORD_ONES * (n)) & ~(w) & WORD_HIGHBITS)
+#define wordHasMore(w, n) ((((w) + WORD_ONES * (127 - (n))) | (w)) & WORD_HIGHBITS)
+
 static inline void
 doCC(instanceData *pData, uchar *msg, int lenMsg)
 {
 	int i;
+	uint64_t w;
 
-	for(i = 0 ; i < lenMsg ; ++i) {
+	/* skip what needs no replacement, eight bytes at a time */
+	for(i = 0 ; i + 8 <= lenMsg ; i += 8) {
+		memcpy(&w, msg + i, sizeof(w));
+		if(wordHasLess(w, 32) || wordHasMore(w, 126))
+			break;
+	}
+	for( ; i < lenMsg ; ++i) {
 		if(msg[i] < 32 || msg[i] > 126) {
 			msg[i] = pData->replChar;
 		}
@@ -218,16 +234,69 @@ fixInvldMBSeq(instanceData *pData, uchar *msg, int lenMsg, int strtIdx, int *end
 		msg[i] = pData->replChar;
 }
 
+/* find the first byte sequence that doUTF8() would modify. Everything
+ * before it is valid and is not touched. Returns lenMsg if the whole
+ * message is valid, which is by far the most common case. Pure ASCII
+ * runs are checked eight bytes at a time.
+ */
+static inline int
+findInvldUTF8(uchar *msg, int lenMsg)
+{
+	uint64_t w;
+	uint32_t codepoint;
+	int seqLen;
+	int i, j;
+	uchar c;
+
+	i = 0;
+	while(i < lenMsg) {
+		if(i + 8 <= lenMsg) {
+			memcpy(&w, msg + i, sizeof(w));
+			if((w & WORD_HIGHBITS) == 0) {
+				i += 8;
+				continue;
+			}
+		}
+		c = msg[i];
+		if((c & 0x80) == 0) {
+			++i;
+			continue;
+		} else if((c & 0xe0) == 0xc0) {
+			seqLen = 1;
+			codepoint = c & 0x1f;
+		} else if((c & 0xf0) == 0xe0) {
+			seqLen = 2;
+			codepoint = c & 0x0f;
+		} else if((c & 0xf8) == 0xf0) {
+			seqLen = 3;
+			codepoint = c & 0x07;
+		} else {
+			return i;
+		}
+		if(i + seqLen >= lenMsg)
+			return i;
+		for(j = 1 ; j <= seqLen ; ++j) {
+			if((msg[i+j] & 0xc0) != 0x80)
+				return i;
+			codepoint = (codepoint << 6) | (msg[i+j] & 0x3f);
+		}
+		if(codepoint > 0x10FFFF)
+			return i;
+		i += seqLen + 1;
+	}
+	return lenMsg;
+}
+
+/* fix the message, starting at a sequence boundary at msg[i] */
 static inline void
-doUTF8(instanceData *pData, uchar *msg, int lenMsg)
+doUTF8(instanceData *pData, uchar *msg, int lenMsg, int i)
 {
 	uchar c;
 	int8_t seqLen, bytesLeft = 0;
 	uint32_t codepoint;
 	int strtIdx, endIdx;
-	int i;
 
-	for(i = 0 ; i < lenMsg ; ++i) {
+	for( ; i < lenMsg ; ++i) {
 		c = msg[i];
 		if(bytesLeft) {
 			if((c & 0xc0) != 0x80) {
@@ -284,6 +353,7 @@ BEGINdoAction
 	msg_t *pMsg;
 	uchar *msg;
 	int lenMsg;
+	int i;
 CODESTARTdoAction
 	pMsg = (msg_t*) ppString[0];
 	lenMsg = getMSGLen(pMsg);
@@ -291,7 +361,9 @@ CODESTARTdoAction
 	if(pWrkrData->pData->mode == MODE_CC) {
 		doCC(pWrkrData->pData, msg, lenMsg);
 	} else {
-		doUTF8(pWrkrData->pData, msg, lenMsg);
+		i = findInvldUTF8(msg, lenMsg);
+		if(i < lenMsg)
+			doUTF8(pWrkrData->pData, msg, lenMsg, i);
 	}
 ENDdoAction
 
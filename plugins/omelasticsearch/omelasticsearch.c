@@ -37,6 +37,11 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#ifdef USE_NETZIP
+#include <zlib.h>
+#endif
 #include "cJSON/cjson.h"
 #include "conf.h"
 #include "syslogd-types.h"
@@ -62,6 +67,10 @@ STATSCOUNTER_DEF(indexSubmit, mutIndexSubmit)
 STATSCOUNTER_DEF(indexHTTPFail, mutIndexHTTPFail)
 STATSCOUNTER_DEF(indexHTTPReqFail, mutIndexHTTPReqFail)
 STATSCOUNTER_DEF(indexESFail, mutIndexESFail)
+STATSCOUNTER_DEF(indexESRetry, mutIndexESRetry)
+
+#define RETRY_BACKOFF_MS 100		/* delay before first re-submission of rejected items */
+#define RETRY_BACKOFF_MAX_MS 10000	/* upper bound for the (doubling) delay */
 
 /* REST API for elasticsearch hits this URL:
  * http://<hostName>:<restPort>/<searchIndex>/<searchType>
@@ -71,7 +80,8 @@ typedef struct _instanceData {
 	int port;
 	int fdErrFile;		/* error file fd or -1 if not open */
 	pthread_mutex_t mutErrFile;
-	uchar *server;
+	uchar **serverBaseUrls;	/* "http://host:port/" of each node */
+	int numServers;
 	uchar *uid;
 	uchar *pwd;
 	uchar *searchIndex;
@@ -87,15 +97,46 @@ typedef struct _instanceData {
 	sbool dynBulkId;
 	sbool bulkmode;
 	sbool asyncRepl;
+	sbool compress;		/* gzip request bodies? */
+	int maxInflight;	/* max number of concurrent requests per worker */
+	size_t maxBytes;	/* bulk request is sent when it reaches this size, 0 - no limit */
+	sbool retryFailures;	/* re-submit bulk items rejected with 429/503? */
+	int retryFailuresMax;	/* max number of re-submissions per request */
 } instanceData;
 
+/* an HTTP request. Each worker has maxInflight of them, which are run
+ * concurrently via the curl multi interface. The easy handles are kept
+ * for the lifetime of the worker, so connections are reused.
+ */
+typedef struct esReq_s {
+	CURL *curl;
+	sbool bBusy;		/* request is in flight */
+	es_str_t *data;		/* request body */
+	int nmsgs;		/* number of messages in request (for statistics counting) */
+	uchar *urlPath;		/* URL without the node part */
+	uchar *restURL;		/* URL currently used, for error reporting */
+	int iServer;		/* node the request is sent to */
+	int nTries;		/* number of nodes tried */
+	int nRetries;		/* number of re-submissions of rejected bulk items */
+	sbool bWaitRetry;	/* waiting for backoff to end, not handed to curl */
+	long long ttRetry;	/* time (ms) at which the request is re-submitted */
+	char *reply;
+	int replyLen;
+#	ifdef USE_NETZIP
+	Bytef *zbuf;		/* gzip'ed request body */
+	uLong sizeZbuf;
+	uLong lenZbuf;
+#	endif
+} esReq_t;
+
 typedef struct wrkrInstanceData {
 	instanceData *pData;
-	int replyLen;
-	char *reply;
-	CURL	*curlHandle;	/* libcurl session handle */
+	CURLM *curlMulti;	/* runs our requests */
+	esReq_t *reqs;		/* maxInflight requests */
+	int nBusy;		/* number of requests in flight */
+	int iNextServer;	/* node to use for the next request */
+	rsRetVal iRetReqs;	/* first error of the current transaction's requests */
 	HEADER	*postHeader;	/* json POST request info */
-	uchar *restURL;		/* last used URL for error reporting */
 	struct {
 		es_str_t *data;
 		int nmemb;	/* number of messages in batch (for statistics counting) */
@@ -108,7 +149,7 @@ typedef struct wrkrInstanceData {
 /* tables for interfacing with the v6 config system */
 /* action (instance) parameters */
 static struct cnfparamdescr actpdescr[] = {
-	{ "server", eCmdHdlrGetWord, 0 },
+	{ "server", eCmdHdlrArray, 0 },
 	{ "serverport", eCmdHdlrInt, 0 },
 	{ "uid", eCmdHdlrGetWord, 0 },
 	{ "pwd", eCmdHdlrGetWord, 0 },
@@ -125,6 +166,11 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "template", eCmdHdlrGetWord, 0 },
 	{ "dynbulkid", eCmdHdlrBinary, 0 },
 	{ "bulkid", eCmdHdlrGetWord, 0 },
+	{ "maxinflight", eCmdHdlrPositiveInt, 0 },
+	{ "maxbytes", eCmdHdlrSize, 0 },
+	{ "compression", eCmdHdlrBinary, 0 },
+	{ "retryfailures", eCmdHdlrBinary, 0 },
+	{ "retryfailures.max", eCmdHdlrNonNegInt, 0 },
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -133,6 +179,7 @@ static struct cnfparamblk actpblk =
 	};
 
 static rsRetVal curlSetup(wrkrInstanceData_t *pWrkrData, instanceData *pData);
+size_t curlResult(void *ptr, size_t size, size_t nmemb, void *userdata);
 
 BEGINcreateInstance
 CODESTARTcreateInstance
@@ -143,7 +190,13 @@ ENDcreateInstance
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
 dbgprintf("omelasticsearch: createWrkrInstance\n");
-	pWrkrData->restURL = NULL;
+	pWrkrData->curlMulti = NULL;
+	pWrkrData->reqs = NULL;
+	pWrkrData->nBusy = 0;
+	pWrkrData->iNextServer = 0;
+	pWrkrData->iRetReqs = RS_RET_OK;
+	pWrkrData->postHeader = NULL;
+	pWrkrData->batch.data = NULL;
 	if(pData->bulkmode) {
 		pWrkrData->batch.currTpl1 = NULL;
 		pWrkrData->batch.currTpl2 = NULL;
@@ -165,11 +218,14 @@ CODESTARTisCompatibleWithFeature
 ENDisCompatibleWithFeature
 
 BEGINfreeInstance
+	int i;
 CODESTARTfreeInstance
 	if(pData->fdErrFile != -1)
 		close(pData->fdErrFile);
 	pthread_mutex_destroy(&pData->mutErrFile);
-	free(pData->server);
+	for(i = 0 ; i < pData->numServers ; ++i)
+		free(pData->serverBaseUrls[i]);
+	free(pData->serverBaseUrls);
 	free(pData->uid);
 	free(pData->pwd);
 	free(pData->searchIndex);
@@ -182,23 +238,43 @@ CODESTARTfreeInstance
 ENDfreeInstance
 
 BEGINfreeWrkrInstance
+	esReq_t *req;
+	int i;
 CODESTARTfreeWrkrInstance
+	for(i = 0 ; pWrkrData->reqs != NULL && i < pWrkrData->pData->maxInflight ; ++i) {
+		req = &pWrkrData->reqs[i];
+		if(req->curl != NULL) {
+			if(req->bBusy && !req->bWaitRetry)
+				curl_multi_remove_handle(pWrkrData->curlMulti, req->curl);
+			curl_easy_cleanup(req->curl);
+		}
+		if(req->data != NULL)
+			es_deleteStr(req->data);
+		free(req->urlPath);
+		free(req->restURL);
+		free(req->reply);
+#		ifdef USE_NETZIP
+		free(req->zbuf);
+#		endif
+	}
+	free(pWrkrData->reqs);
+	if(pWrkrData->curlMulti != NULL)
+		curl_multi_cleanup(pWrkrData->curlMulti);
 	if(pWrkrData->postHeader) {
 		curl_slist_free_all(pWrkrData->postHeader);
 		pWrkrData->postHeader = NULL;
 	}
-	if(pWrkrData->curlHandle) {
-		curl_easy_cleanup(pWrkrData->curlHandle);
-		pWrkrData->curlHandle = NULL;
-	}
-	free(pWrkrData->restURL);
+	if(pWrkrData->batch.data != NULL)
+		es_deleteStr(pWrkrData->batch.data);
 ENDfreeWrkrInstance
 
 BEGINdbgPrintInstInfo
+	int i;
 CODESTARTdbgPrintInstInfo
 	dbgprintf("omelasticsearch\n");
 	dbgprintf("\ttemplate='%s'\n", pData->tplName);
-	dbgprintf("\tserver='%s'\n", pData->server);
+	for(i = 0 ; i < pData->numServers ; ++i)
+		dbgprintf("\tserver='%s'\n", pData->serverBaseUrls[i]);
 	dbgprintf("\tserverport=%d\n", pData->port);
 	dbgprintf("\tuid='%s'\n", pData->uid == NULL ? (uchar*)"(not configured)" : pData->uid);
 	dbgprintf("\tpwd=(%sconfigured)\n", pData->pwd == NULL ? "not " : "");
@@ -215,71 +291,94 @@ CODESTARTdbgPrintInstInfo
 		(uchar*)"(not configured)" : pData->errorFile);
 	dbgprintf("\tdynbulkid=%d\n", pData->dynBulkId);
 	dbgprintf("\tbulkid='%s'\n", pData->bulkId);
+	dbgprintf("\tmaxinflight=%d\n", pData->maxInflight);
+	dbgprintf("\tmaxbytes=%u\n", (unsigned) pData->maxBytes);
+	dbgprintf("\tcompression=%d\n", pData->compress);
 ENDdbgPrintInstInfo
 
 
-/* Build basic URL part, which includes hostname and port as follows:
+/* Build the base URL of a node, which includes hostname and port as follows:
  * http://hostname:port/
- * Newly creates an estr for this purpose.
+ * If the node is already given as URL, it is used as is. If it has no
+ * port, the default port is added.
  */
 static rsRetVal
-setBaseURL(instanceData *pData, es_str_t **url)
+computeBaseUrl(const char *server, const int defaultPort, uchar **ppUrl)
 {
+	es_str_t *url;
+	const char *p;
 	char portBuf[64];
 	int r;
 	DEFiRet;
 
-	*url = es_newStr(128);
-	snprintf(portBuf, sizeof(portBuf), "%d", pData->port);
-	r = es_addBuf(url, "http://", sizeof("http://")-1);
-	if(r == 0) r = es_addBuf(url, (char*)pData->server, strlen((char*)pData->server));
-	if(r == 0) r = es_addChar(url, ':');
-	if(r == 0) r = es_addBuf(url, portBuf, strlen(portBuf));
-	if(r == 0) r = es_addChar(url, '/');
+	CHKmalloc(url = es_newStr(128));
+	if(!strncmp(server, "http://", sizeof("http://")-1) || !strncmp(server, "https://", sizeof("https://")-1)) {
+		r = es_addBuf(&url, (char*)server, strlen(server));
+	} else {
+		r = es_addBuf(&url, "http://", sizeof("http://")-1);
+		if(r == 0) r = es_addBuf(&url, (char*)server, strlen(server));
+		/* IPv6 addresses need to be given in [] */
+		p = (*server == '[') ? strchr(server, ']') : server;
+		if(p != NULL && strchr(p, ':') == NULL) {
+			snprintf(portBuf, sizeof(portBuf), ":%d", defaultPort);
+			if(r == 0) r = es_addBuf(&url, portBuf, strlen(portBuf));
+		}
+	}
+	if(r == 0 && es_getBufAddr(url)[es_strlen(url)-1] != '/')
+		r = es_addChar(&url, '/');
+	if(r == 0)
+		*ppUrl = (uchar*)es_str2cstr(url, NULL);
+	es_deleteStr(url);
+	if(r != 0 || *ppUrl == NULL)
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+
+finalize_it:
 	RETiRet;
 }
 
 
+/* check if we can reach any of the nodes */
 static inline rsRetVal
 checkConn(wrkrInstanceData_t *pWrkrData)
 {
-	es_str_t *url;
-	CURL *curl = NULL;
+	instanceData *const pData = pWrkrData->pData;
+	esReq_t req;
+	CURL *curl;
 	CURLcode res;
-	char *cstr;
+	int i;
 	DEFiRet;
 
-	setBaseURL(pWrkrData->pData, &url);
-	curl = curl_easy_init();
-	if(curl == NULL) {
-		DBGPRINTF("omelasticsearch: checkConn() curl_easy_init() failed\n");
-		ABORT_FINALIZE(RS_RET_SUSPENDED);
-	}
-	/* Bodypart of request not needed, so set curl opt to nobody and httpget, otherwise lib-curl could sigsegv */
-	curl_easy_setopt(curl, CURLOPT_HTTPGET, TRUE);
-	curl_easy_setopt(curl, CURLOPT_NOBODY, TRUE); 
-	/* Only enable for debugging 
-	curl_easy_setopt(curl, CURLOPT_VERBOSE, TRUE); */
-
-	cstr = es_str2cstr(url, NULL);
-	curl_easy_setopt(curl, CURLOPT_URL, cstr);
-	free(cstr);
-
-	pWrkrData->reply = NULL;
-	pWrkrData->replyLen = 0;
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, pWrkrData);
-	res = curl_easy_perform(curl);
-	if(res != CURLE_OK) {
-		DBGPRINTF("omelasticsearch: checkConn() curl_easy_perform() "
-			  "failed: %s\n", curl_easy_strerror(res));
-		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	iRet = RS_RET_SUSPENDED;
+	for(i = 0 ; i < pData->numServers && iRet != RS_RET_OK ; ++i) {
+		curl = curl_easy_init();
+		if(curl == NULL) {
+			DBGPRINTF("omelasticsearch: checkConn() curl_easy_init() failed\n");
+			FINALIZE;
+		}
+		/* Bodypart of request not needed, so set curl opt to nobody and httpget, otherwise lib-curl could sigsegv */
+		curl_easy_setopt(curl, CURLOPT_HTTPGET, TRUE);
+		curl_easy_setopt(curl, CURLOPT_NOBODY, TRUE);
+		/* Only enable for debugging
+		curl_easy_setopt(curl, CURLOPT_VERBOSE, TRUE); */
+		curl_easy_setopt(curl, CURLOPT_URL, pData->serverBaseUrls[i]);
+
+		memset(&req, 0, sizeof(req));
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curlResult);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, &req);
+		res = curl_easy_perform(curl);
+		if(res == CURLE_OK) {
+			DBGPRINTF("omelasticsearch: checkConn() completed with success on %s\n",
+				  pData->serverBaseUrls[i]);
+			iRet = RS_RET_OK;
+		} else {
+			DBGPRINTF("omelasticsearch: checkConn() curl_easy_perform() "
+				  "failed on %s: %s\n", pData->serverBaseUrls[i], curl_easy_strerror(res));
+		}
+		free(req.reply);
+		curl_easy_cleanup(curl);
 	}
-	free(pWrkrData->reply);
-	DBGPRINTF("omelasticsearch: checkConn() completed with success\n");
 
 finalize_it:
-	if(curl != NULL)
-		curl_easy_cleanup(curl);
 	RETiRet;
 }
 
@@ -291,6 +390,16 @@ CODESTARTtryResume
 ENDtryResume
 
 
+/* number of templates per message: the message itself plus one for each
+ * dynamic property, in the order getIndexTypeAndParent() expects them
+ */
+static inline int
+getNumTpls(instanceData *pData)
+{
+	return 1 + (pData->dynSrchIdx ? 1 : 0) + (pData->dynSrchType ? 1 : 0)
+		 + (pData->dynParent ? 1 : 0) + (pData->dynBulkId ? 1 : 0);
+}
+
 /* get the current index and type for this message */
 static inline void
 getIndexTypeAndParent(instanceData *pData, uchar **tpls,
@@ -359,21 +468,19 @@ getIndexTypeAndParent(instanceData *pData, uchar **tpls,
 }
 
 
+/* build the node-independent part of the request URL */
 static rsRetVal
-setCurlURL(wrkrInstanceData_t *pWrkrData, instanceData *pData, uchar **tpls)
+buildURLPath(instanceData *pData, uchar **tpls, uchar **ppPath)
 {
-	char authBuf[1024];
 	uchar *searchIndex;
 	uchar *searchType;
 	uchar *parent;
 	uchar *bulkId;
 	es_str_t *url;
-	int rLocal;
 	int r;
 	DEFiRet;
 
-	setBaseURL(pData, &url);
-
+	CHKmalloc(url = es_newStr(128));
 	if(pData->bulkmode) {
 		r = es_addBuf(&url, "_bulk", sizeof("_bulk")-1);
 		parent = NULL;
@@ -397,25 +504,12 @@ setCurlURL(wrkrInstanceData_t *pWrkrData, instanceData *pData, uchar **tpls)
 		if(r == 0) r = es_addBuf(&url, "parent=", sizeof("parent=")-1);
 		if(r == 0) r = es_addBuf(&url, (char*)parent, ustrlen(parent));
 	}
-
-	free(pWrkrData->restURL);
-	pWrkrData->restURL = (uchar*)es_str2cstr(url, NULL);
-	curl_easy_setopt(pWrkrData->curlHandle, CURLOPT_URL, pWrkrData->restURL);
+	if(r == 0)
+		*ppPath = (uchar*)es_str2cstr(url, NULL);
 	es_deleteStr(url);
-	DBGPRINTF("omelasticsearch: using REST URL: '%s'\n", pWrkrData->restURL);
+	if(r != 0 || *ppPath == NULL)
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 
-	if(pData->uid != NULL) {
-		rLocal = snprintf(authBuf, sizeof(authBuf), "%s:%s", pData->uid,
-			         (pData->pwd == NULL) ? "" : (char*)pData->pwd);
-		if(rLocal < 1) {
-			errmsg.LogError(0, RS_RET_ERR, "omelasticsearch: snprintf failed "
-				"when trying to build auth string (return %d)\n",
-				rLocal);
-			ABORT_FINALIZE(RS_RET_ERR);
-		}
-		curl_easy_setopt(pWrkrData->curlHandle, CURLOPT_USERPWD, authBuf);
-		curl_easy_setopt(pWrkrData->curlHandle, CURLOPT_PROXYAUTH, CURLAUTH_ANY);
-	}
 finalize_it:
 	RETiRet;
 }
@@ -476,7 +570,7 @@ finalize_it:
  * needs to be closed, HUP must be sent.
  */
 static inline rsRetVal
-writeDataError(wrkrInstanceData_t *pWrkrData, instanceData *pData, cJSON **pReplyRoot, uchar *reqmsg)
+writeDataError(esReq_t *pReq, instanceData *pData, cJSON **pReplyRoot, uchar *reqmsg)
 {
 	char *rendered = NULL;
 	cJSON *errRoot;
@@ -508,7 +602,7 @@ writeDataError(wrkrInstanceData_t *pWrkrData, instanceData *pData, cJSON **pRepl
 		}
 	}
 	if((req=cJSON_CreateObject()) == NULL) ABORT_FINALIZE(RS_RET_ERR);
-	cJSON_AddItemToObject(req, "url", cJSON_CreateString((char*)pWrkrData->restURL));
+	cJSON_AddItemToObject(req, "url", cJSON_CreateString((char*)pReq->restURL));
 	cJSON_AddItemToObject(req, "postdata", cJSON_CreateString((char*)reqmsg));
 
 	if((errRoot=cJSON_CreateObject()) == NULL) ABORT_FINALIZE(RS_RET_ERR);
@@ -537,7 +631,7 @@ finalize_it:
 
 
 static inline rsRetVal
-checkResultBulkmode(wrkrInstanceData_t *pWrkrData, cJSON *root)
+checkResultBulkmode(esReq_t *req, cJSON *root)
 {
 	int i;
 	int numitems;
@@ -551,7 +645,7 @@ checkResultBulkmode(wrkrInstanceData_t *pWrkrData, cJSON *root)
 	if(items == NULL || items->type != cJSON_Array) {
 		DBGPRINTF("omelasticsearch: error in elasticsearch reply: "
 			  "bulkmode insert does not return array, reply is: %s\n",
-			  pWrkrData->reply);
+			  req->reply);
 		ABORT_FINALIZE(RS_RET_DATAFAIL);
 	}
 	numitems = cJSON_GetArraySize(items);
@@ -582,21 +676,266 @@ finalize_it:
 }
 
 
+/* skip a JSON string, *pp points to the opening quote. Returns 0 on
+ * success, -1 if the string is not terminated.
+ */
+static int
+skipJSONString(const char **pp)
+{
+	const char *p = *pp + 1;
+
+	while(*p != '"') {
+		if(*p == '\0')
+			return -1;
+		if(*p == '\\' && *++p == '\0')
+			return -1;
+		++p;
+	}
+	*pp = p + 1;
+	return 0;
+}
+
+
+/* skip a JSON value of any type, including nested objects and arrays */
+static int
+skipJSONValue(const char **pp)
+{
+	const char *p = *pp;
+	int depth = 0;
+
+	while(*p != '\0') {
+		if(*p == '"') {
+			if(skipJSONString(&p) != 0)
+				return -1;
+			if(depth == 0)
+				break;
+			continue;
+		}
+		if(*p == '{' || *p == '[') {
+			++depth;
+		} else if(*p == '}' || *p == ']') {
+			if(depth == 0)
+				break; /* end of the enclosing object */
+			if(--depth == 0) {
+				++p;
+				break;
+			}
+		} else if(*p == ',' && depth == 0) {
+			break;
+		}
+		++p;
+	}
+	if(*p == '\0')
+		return -1;
+	*pp = p;
+	return 0;
+}
+
+
+#define SKIP_WS(p) while(*(p) == ' ' || *(p) == '\t' || *(p) == '\r' || *(p) == '\n') ++(p)
+
+/* scan the top level of a bulk reply for the "errors" flag. Elasticsearch
+ * emits it before the (large) items array, so in the common case only a
+ * few bytes are looked at and the reply does not need to be parsed.
+ * Returns 0 if errors is false, 1 if it is true and -1 if the reply has
+ * no such flag (older versions) or could not be scanned.
+ */
+static int
+scanBulkErrorsFlag(const char *reply)
+{
+	const char *p = reply;
+	const char *key;
+	size_t lenKey;
+
+	if(p == NULL)
+		return -1;
+	SKIP_WS(p);
+	if(*p++ != '{')
+		return -1;
+	while(1) {
+		SKIP_WS(p);
+		if(*p != '"')
+			return -1;
+		key = p + 1;
+		if(skipJSONString(&p) != 0)
+			return -1;
+		lenKey = p - key - 1;
+		SKIP_WS(p);
+		if(*p++ != ':')
+			return -1;
+		SKIP_WS(p);
+		if(lenKey == sizeof("errors")-1 && !strncmp(key, "errors", lenKey)) {
+			if(!strncmp(p, "false", sizeof("false")-1))
+				return 0;
+			if(!strncmp(p, "true", sizeof("true")-1))
+				return 1;
+			return -1;
+		}
+		if(skipJSONValue(&p) != 0)
+			return -1;
+		SKIP_WS(p);
+		if(*p++ != ',')
+			return -1;
+	}
+}
+#undef SKIP_WS
+
+
+/* obtain the n-th item (meta data line plus document line) of a bulk
+ * request. *pOffs is the offset to search from, it is advanced past the
+ * item, so that items can be fetched in order without rescanning the
+ * request.
+ */
+static int
+getBulkItem(es_str_t *data, size_t *pOffs, const char **pItem, size_t *pLenItem)
+{
+	const char *const buf = (const char*) es_getBufAddr(data);
+	const size_t lenBuf = es_strlen(data);
+	const char *lf;
+	size_t offs = *pOffs;
+	int i;
+
+	for(i = 0 ; i < 2 ; ++i) {
+		if(offs >= lenBuf)
+			return -1;
+		if((lf = memchr(buf + offs, '\n', lenBuf - offs)) == NULL)
+			return -1;
+		offs = lf - buf + 1;
+	}
+	*pItem = buf + *pOffs;
+	*pLenItem = offs - *pOffs;
+	*pOffs = offs;
+	return 0;
+}
+
+
+/* check the items of a bulk reply that has its errors flag set. Items that
+ * were rejected because the cluster is overloaded (429, 503) are collected
+ * in *pRetry if a re-submission is still permitted, the other failures are
+ * reported via the DATAFAIL return code.
+ */
+static rsRetVal
+checkBulkItems(instanceData *pData, esReq_t *req, cJSON *root, es_str_t **pRetry, int *pnRetry)
+{
+	const sbool bRetry = pData->retryFailures && req->nRetries < pData->retryFailuresMax;
+	int i;
+	int numitems;
+	int st;
+	cJSON *items;
+	cJSON *op;
+	cJSON *status;
+	const char *item;
+	size_t lenItem;
+	size_t offs = 0;
+	int nFailed = 0;
+	DEFiRet;
+
+	items = cJSON_GetObjectItem(root, "items");
+	if(items == NULL || items->type != cJSON_Array) {
+		DBGPRINTF("omelasticsearch: error in elasticsearch reply: "
+			  "bulkmode insert does not return array, reply is: %s\n",
+			  req->reply);
+		ABORT_FINALIZE(RS_RET_DATAFAIL);
+	}
+	numitems = cJSON_GetArraySize(items);
+	for(i = 0 ; i < numitems ; ++i) {
+		op = cJSON_GetArrayItem(items, i);
+		if(op != NULL)
+			op = op->child; /* "index", "create", ... */
+		status = (op == NULL) ? NULL : cJSON_GetObjectItem(op, "status");
+		st = (status == NULL || status->type != cJSON_Number) ? 0 : status->valueint;
+		if(getBulkItem(req->data, &offs, &item, &lenItem) != 0) {
+			DBGPRINTF("omelasticsearch: error in elasticsearch reply: "
+				  "more items in reply than in request\n");
+			ABORT_FINALIZE(RS_RET_DATAFAIL);
+		}
+		if(st >= 200 && st < 300 && cJSON_GetObjectItem(op, "error") == NULL)
+			continue;
+		if(bRetry && (st == 429 || st == 503)) {
+			if(*pRetry == NULL)
+				CHKmalloc(*pRetry = es_newStr(lenItem * 2));
+			if(es_addBuf(pRetry, (char*) item, lenItem) != 0)
+				ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+			++*pnRetry;
+		} else {
+			DBGPRINTF("omelasticsearch: error in elasticsearch reply: "
+				  "item %d failed with status %d\n", i, st);
+			++nFailed;
+		}
+	}
+	if(nFailed > 0)
+		iRet = RS_RET_DATAFAIL;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* current time in milliseconds, for retry scheduling */
+static long long
+getTimeMs(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+
+/* let a request re-submit only its rejected items after a backoff delay.
+ * The request keeps its slot (and stays busy), runReqs() starts it again
+ * when the delay has expired.
+ */
+static void
+scheduleRetry(wrkrInstanceData_t *pWrkrData, esReq_t *req, es_str_t *retryData, const int nRetry)
+{
+	long long delay;
+
+	es_deleteStr(req->data);
+	req->data = retryData;
+	req->nmsgs = nRetry;
+	req->nTries = 0;
+	delay = (long long) RETRY_BACKOFF_MS << req->nRetries;
+	if(delay > RETRY_BACKOFF_MAX_MS)
+		delay = RETRY_BACKOFF_MAX_MS;
+	++req->nRetries;
+	req->ttRetry = getTimeMs() + delay;
+	req->bWaitRetry = 1;
+	req->bBusy = 1;
+	++pWrkrData->nBusy;
+	indexESRetry += nRetry;
+	DBGPRINTF("omelasticsearch: re-submitting %d rejected items in %lld ms (retry %d)\n",
+		  nRetry, delay, req->nRetries);
+}
+
+
 static inline rsRetVal
-checkResult(wrkrInstanceData_t *pWrkrData, uchar *reqmsg)
+checkResult(wrkrInstanceData_t *pWrkrData, esReq_t *req)
 {
-	cJSON *root;
+	cJSON *root = NULL;
 	cJSON *ok;
+	char *reqmsg;
+	es_str_t *retryData = NULL;
+	int nRetry = 0;
+	int errFlag = -1;
 	DEFiRet;
 
-	root = cJSON_Parse(pWrkrData->reply);
+	if(pWrkrData->pData->bulkmode) {
+		errFlag = scanBulkErrorsFlag(req->reply);
+		if(errFlag == 0)
+			FINALIZE; /* all items were accepted, no need to parse the reply */
+	}
+
+	root = cJSON_Parse(req->reply);
 	if(root == NULL) {
 		DBGPRINTF("omelasticsearch: could not parse JSON result \n");
 		ABORT_FINALIZE(RS_RET_ERR);
 	}
 
-	if(pWrkrData->pData->bulkmode) {
-		iRet = checkResultBulkmode(pWrkrData, root);
+	if(errFlag == 1) {
+		iRet = checkBulkItems(pWrkrData->pData, req, root, &retryData, &nRetry);
+	} else if(pWrkrData->pData->bulkmode) {
+		iRet = checkResultBulkmode(req, root);
 	} else {
 		ok = cJSON_GetObjectItem(root, "ok");
 		if(ok == NULL || ok->type != cJSON_True) {
@@ -609,13 +948,22 @@ checkResult(wrkrInstanceData_t *pWrkrData, uchar *reqmsg)
 	 */
 	if(iRet == RS_RET_DATAFAIL) {
 		STATSCOUNTER_INC(indexESFail, mutIndexESFail);
-		writeDataError(pWrkrData, pWrkrData->pData, &root, reqmsg);
+		if((reqmsg = es_str2cstr(req->data, NULL)) != NULL) {
+			writeDataError(req, pWrkrData->pData, &root, (uchar*) reqmsg);
+			free(reqmsg);
+		}
 		iRet = RS_RET_OK; /* we have handled the problem! */
 	}
+	if(iRet == RS_RET_OK && retryData != NULL) {
+		scheduleRetry(pWrkrData, req, retryData, nRetry);
+		retryData = NULL;
+	}
 
 finalize_it:
 	if(root != NULL)
 		cJSON_Delete(root);
+	if(retryData != NULL)
+		es_deleteStr(retryData);
 	if(iRet != RS_RET_OK) {
 		STATSCOUNTER_INC(indexESFail, mutIndexESFail);
 	}
@@ -623,111 +971,411 @@ finalize_it:
 }
 
 
+#ifdef USE_NETZIP
+/* gzip the request body */
+static rsRetVal
+gzipReq(esReq_t *req)
+{
+	z_stream zstrm;
+	uLong lenNeeded;
+	Bytef *newBuf;
+	sbool bInitDone = 0;
+	int zRet;
+	DEFiRet;
+
+	memset(&zstrm, 0, sizeof(zstrm));
+	/* windowBits 15+16 tells zlib to write a gzip header and trailer */
+	zRet = deflateInit2(&zstrm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY);
+	if(zRet != Z_OK) {
+		DBGPRINTF("omelasticsearch: error %d returned from zlib/deflateInit2()\n", zRet);
+		ABORT_FINALIZE(RS_RET_ZLIB_ERR);
+	}
+	bInitDone = 1;
+	lenNeeded = deflateBound(&zstrm, es_strlen(req->data));
+	if(lenNeeded > req->sizeZbuf) {
+		CHKmalloc(newBuf = realloc(req->zbuf, lenNeeded));
+		req->zbuf = newBuf;
+		req->sizeZbuf = lenNeeded;
+	}
+	zstrm.next_in = (Bytef*) es_getBufAddr(req->data);
+	zstrm.avail_in = es_strlen(req->data);
+	zstrm.next_out = req->zbuf;
+	zstrm.avail_out = req->sizeZbuf;
+	zRet = deflate(&zstrm, Z_FINISH);
+	if(zRet != Z_STREAM_END) {
+		DBGPRINTF("omelasticsearch: error %d returned from zlib/deflate()\n", zRet);
+		ABORT_FINALIZE(RS_RET_ZLIB_ERR);
+	}
+	req->lenZbuf = zstrm.total_out;
+
+finalize_it:
+	if(bInitDone)
+		deflateEnd(&zstrm);
+	RETiRet;
+}
+#endif
+
+
+/* send a request to its current node. The request is only handed to the
+ * multi handle, it is actually processed in runReqs().
+ */
 static rsRetVal
-curlPost(wrkrInstanceData_t *pWrkrData, uchar *message, int msglen, uchar **tpls, int nmsgs)
+startReq(wrkrInstanceData_t *pWrkrData, esReq_t *req)
 {
-	CURLcode code;
-	CURL *curl = pWrkrData->curlHandle;
+	instanceData *const pData = pWrkrData->pData;
+	const uchar *const baseUrl = pData->serverBaseUrls[req->iServer];
+	char *body;
+	long lenBody;
 	DEFiRet;
 
-	pWrkrData->reply = NULL;
-	pWrkrData->replyLen = 0;
+	free(req->reply);
+	req->reply = NULL;
+	req->replyLen = 0;
+
+	free(req->restURL);
+	CHKmalloc(req->restURL = malloc(ustrlen(baseUrl) + ustrlen(req->urlPath) + 1));
+	strcpy((char*)req->restURL, (char*)baseUrl);
+	strcat((char*)req->restURL, (char*)req->urlPath);
+	curl_easy_setopt(req->curl, CURLOPT_URL, req->restURL);
+	DBGPRINTF("omelasticsearch: using REST URL: '%s'\n", req->restURL);
+
+	body = (char*) es_getBufAddr(req->data);
+	lenBody = (long) es_strlen(req->data);
+#	ifdef USE_NETZIP
+	if(pData->compress) {
+		if(req->nTries == 0) /* do not compress again on retry */
+			CHKiRet(gzipReq(req));
+		body = (char*) req->zbuf;
+		lenBody = (long) req->lenZbuf;
+	}
+#	endif
+	curl_easy_setopt(req->curl, CURLOPT_POSTFIELDS, body);
+	curl_easy_setopt(req->curl, CURLOPT_POSTFIELDSIZE, lenBody);
+	if(curl_multi_add_handle(pWrkrData->curlMulti, req->curl) != CURLM_OK)
+		ABORT_FINALIZE(RS_RET_ERR);
+	req->bBusy = 1;
+	++pWrkrData->nBusy;
+
+finalize_it:
+	RETiRet;
+}
+
+
+static inline void
+setReqErr(wrkrInstanceData_t *pWrkrData, rsRetVal iRet)
+{
+	if(pWrkrData->iRetReqs == RS_RET_OK)
+		pWrkrData->iRetReqs = iRet;
+}
+
+
+/* handle a request that curl has finished. If the node could not be
+ * reached, the request is retried on the next node.
+ */
+static void
+finishReq(wrkrInstanceData_t *pWrkrData, esReq_t *req, CURLcode code)
+{
+	instanceData *const pData = pWrkrData->pData;
+	rsRetVal localRet;
 
-	if(pWrkrData->pData->dynSrchIdx || pWrkrData->pData->dynSrchType || pWrkrData->pData->dynParent)
-		CHKiRet(setCurlURL(pWrkrData, pWrkrData->pData, tpls));
+	curl_multi_remove_handle(pWrkrData->curlMulti, req->curl);
+	req->bBusy = 0;
+	--pWrkrData->nBusy;
 
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, pWrkrData);
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, (char *)message);
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, msglen);
-	code = curl_easy_perform(curl);
 	switch (code) {
 		case CURLE_COULDNT_RESOLVE_HOST:
 		case CURLE_COULDNT_RESOLVE_PROXY:
 		case CURLE_COULDNT_CONNECT:
 		case CURLE_WRITE_ERROR:
 			STATSCOUNTER_INC(indexHTTPReqFail, mutIndexHTTPReqFail);
-			indexHTTPFail += nmsgs;
+			if(++req->nTries < pData->numServers) {
+				req->iServer = (req->iServer + 1) % pData->numServers;
+				DBGPRINTF("omelasticsearch: failure %lld of request, retrying "
+					  "on %s\n", (long long) code, pData->serverBaseUrls[req->iServer]);
+				if((localRet = startReq(pWrkrData, req)) != RS_RET_OK)
+					setReqErr(pWrkrData, localRet);
+				return;
+			}
+			indexHTTPFail += req->nmsgs;
 			DBGPRINTF("omelasticsearch: we are suspending ourselfs due "
-				  "to failure %lld of curl_easy_perform()\n",
-				  (long long) code);
-			ABORT_FINALIZE(RS_RET_SUSPENDED);
+				  "to failure %lld of curl request\n", (long long) code);
+			setReqErr(pWrkrData, RS_RET_SUSPENDED);
+			return;
 		default:
 			break;
 	}
 
-	DBGPRINTF("omelasticsearch: pWrkrData replyLen = '%d'\n", pWrkrData->replyLen);
-	if(pWrkrData->replyLen > 0) {
-		pWrkrData->reply[pWrkrData->replyLen] = '\0'; /* Append 0 Byte if replyLen is above 0 - byte has been reserved in malloc */
+	DBGPRINTF("omelasticsearch: request replyLen = '%d'\n", req->replyLen);
+	if(req->replyLen > 0) {
+		req->reply[req->replyLen] = '\0'; /* Append 0 Byte if replyLen is above 0 - byte has been reserved in malloc */
+	}
+	DBGPRINTF("omelasticsearch: request reply: '%s'\n", req->reply);
+
+	if((localRet = checkResult(pWrkrData, req)) != RS_RET_OK)
+		setReqErr(pWrkrData, localRet);
+	free(req->reply);
+	req->reply = NULL;
+	req->replyLen = 0;
+}
+
+
+/* drop all requests in flight, used if the multi handle failed */
+static void
+abortReqs(wrkrInstanceData_t *pWrkrData)
+{
+	int i;
+
+	for(i = 0 ; i < pWrkrData->pData->maxInflight ; ++i) {
+		if(pWrkrData->reqs[i].bBusy) {
+			if(!pWrkrData->reqs[i].bWaitRetry)
+				curl_multi_remove_handle(pWrkrData->curlMulti, pWrkrData->reqs[i].curl);
+			pWrkrData->reqs[i].bBusy = 0;
+			pWrkrData->reqs[i].bWaitRetry = 0;
+		}
+	}
+	pWrkrData->nBusy = 0;
+}
+
+
+/* hand requests whose retry backoff has expired to curl again. Returns
+ * the number of ms until the next pending retry is due, or -1 if there is
+ * none.
+ */
+static int
+startDueRetries(wrkrInstanceData_t *pWrkrData)
+{
+	esReq_t *req;
+	long long now = 0;
+	long long wait = -1;
+	rsRetVal localRet;
+	int i;
+
+	for(i = 0 ; i < pWrkrData->pData->maxInflight ; ++i) {
+		req = &pWrkrData->reqs[i];
+		if(!req->bWaitRetry)
+			continue;
+		if(now == 0)
+			now = getTimeMs();
+		if(req->ttRetry > now) {
+			if(wait == -1 || req->ttRetry - now < wait)
+				wait = req->ttRetry - now;
+			continue;
+		}
+		req->bWaitRetry = 0;
+		req->bBusy = 0;
+		--pWrkrData->nBusy;
+		if((localRet = startReq(pWrkrData, req)) != RS_RET_OK)
+			setReqErr(pWrkrData, localRet);
+	}
+	return (int) wait;
+}
+
+
+/* process the requests in flight until at least one is done (bAll == 0)
+ * or all of them are done (bAll == 1). The outcome of the requests is
+ * recorded in iRetReqs.
+ */
+static rsRetVal
+runReqs(wrkrInstanceData_t *pWrkrData, const sbool bAll)
+{
+	const int nWait = bAll ? 0 : pWrkrData->nBusy - 1;
+	CURLMsg *msg;
+	char *priv;
+	int nRunning;
+	int nMsgs;
+	int waitRetry;
+	CURLMcode mcode;
+#	if LIBCURL_VERSION_NUM < 0x071c00
+	fd_set fdRead, fdWrite, fdExcep;
+	struct timeval tv;
+	int maxfd;
+#	endif
+	DEFiRet;
+
+	while(pWrkrData->nBusy > nWait) {
+		waitRetry = startDueRetries(pWrkrData);
+		mcode = curl_multi_perform(pWrkrData->curlMulti, &nRunning);
+		if(mcode != CURLM_OK && mcode != CURLM_CALL_MULTI_PERFORM) {
+			DBGPRINTF("omelasticsearch: curl_multi_perform() failed: %d\n", (int) mcode);
+			abortReqs(pWrkrData);
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		}
+		while((msg = curl_multi_info_read(pWrkrData->curlMulti, &nMsgs)) != NULL) {
+			if(msg->msg != CURLMSG_DONE)
+				continue;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &priv);
+			finishReq(pWrkrData, (esReq_t*) priv, msg->data.result);
+		}
+		if(pWrkrData->nBusy <= nWait)
+			continue;
+		if(nRunning == 0) {
+			/* a request was restarted and needs a perform call, or all
+			 * remaining ones wait for their retry backoff to expire.
+			 */
+			if(waitRetry > 0)
+				srSleep(waitRetry / 1000, (waitRetry % 1000) * 1000);
+			continue;
+		}
+		if(waitRetry == -1 || waitRetry > 1000)
+			waitRetry = 1000;
+#		if LIBCURL_VERSION_NUM >= 0x071c00
+		curl_multi_wait(pWrkrData->curlMulti, NULL, 0, waitRetry, NULL);
+#		else
+		FD_ZERO(&fdRead);
+		FD_ZERO(&fdWrite);
+		FD_ZERO(&fdExcep);
+		curl_multi_fdset(pWrkrData->curlMulti, &fdRead, &fdWrite, &fdExcep, &maxfd);
+		tv.tv_sec = 0;
+		tv.tv_usec = (waitRetry < 100 ? waitRetry : 100) * 1000;
+		select(maxfd + 1, &fdRead, &fdWrite, &fdExcep, &tv);
+#		endif
 	}
-	DBGPRINTF("omelasticsearch: pWrkrData reply: '%s'\n", pWrkrData->reply);
 
-	CHKiRet(checkResult(pWrkrData, message));
 finalize_it:
-	free(pWrkrData->reply);
 	RETiRet;
 }
 
-BEGINbeginTransaction
-CODESTARTbeginTransaction
-dbgprintf("omelasticsearch: beginTransaction, pWrkrData %p, pData %p\n", pWrkrData, pWrkrData->pData);
-	if(!pWrkrData->pData->bulkmode) {
-		FINALIZE;
+
+/* obtain a request object that is not in flight, waiting for one to
+ * finish if all are busy.
+ */
+static rsRetVal
+getFreeReq(wrkrInstanceData_t *pWrkrData, esReq_t **ppReq)
+{
+	int i;
+	DEFiRet;
+
+	if(pWrkrData->nBusy == pWrkrData->pData->maxInflight)
+		CHKiRet(runReqs(pWrkrData, 0));
+	for(i = 0 ; i < pWrkrData->pData->maxInflight ; ++i) {
+		if(!pWrkrData->reqs[i].bBusy) {
+			*ppReq = &pWrkrData->reqs[i];
+			break;
+		}
 	}
+	assert(i < pWrkrData->pData->maxInflight);
 
-	es_emptyStr(pWrkrData->batch.data);
-	pWrkrData->batch.nmemb = 0;
 finalize_it:
-ENDbeginTransaction
+	RETiRet;
+}
 
 
-BEGINdoAction
-CODESTARTdoAction
-	STATSCOUNTER_INC(indexSubmit, mutIndexSubmit);
-	if(pWrkrData->pData->bulkmode) {
-		CHKiRet(buildBatch(pWrkrData, ppString[0], ppString));
+/* submit a request for the given message. If message is NULL, the current
+ * batch is submitted instead.
+ */
+static rsRetVal
+submitReq(wrkrInstanceData_t *pWrkrData, uchar *message, uchar **tpls)
+{
+	instanceData *const pData = pWrkrData->pData;
+	esReq_t *req;
+	es_str_t *tmp;
+	DEFiRet;
+
+	CHKiRet(getFreeReq(pWrkrData, &req));
+	if(message == NULL) {
+		/* hand the batch buffer over to the request, we take the request's one */
+		tmp = req->data;
+		req->data = pWrkrData->batch.data;
+		pWrkrData->batch.data = tmp;
+		es_emptyStr(pWrkrData->batch.data);
+		req->nmsgs = pWrkrData->batch.nmemb;
+		pWrkrData->batch.nmemb = 0;
 	} else {
-		CHKiRet(curlPost(pWrkrData, ppString[0], strlen((char*)ppString[0]),
-		                 ppString, 1));
+		es_emptyStr(req->data);
+		if(es_addBuf(&req->data, (char*) message, ustrlen(message)) != 0)
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		req->nmsgs = 1;
 	}
+	free(req->urlPath);
+	req->urlPath = NULL;
+	CHKiRet(buildURLPath(pData, tpls, &req->urlPath));
+	req->iServer = pWrkrData->iNextServer;
+	pWrkrData->iNextServer = (pWrkrData->iNextServer + 1) % pData->numServers;
+	req->nTries = 0;
+	req->nRetries = 0;
+	DBGPRINTF("omelasticsearch: submitting request with %d messages, %d bytes\n",
+		  req->nmsgs, (int) es_strlen(req->data));
+	CHKiRet(startReq(pWrkrData, req));
+
 finalize_it:
-dbgprintf("omelasticsearch: result doAction: %d (bulkmode %d)\n", iRet, pWrkrData->pData->bulkmode);
-ENDdoAction
-
-
-BEGINendTransaction
-	char *cstr = NULL;
-CODESTARTendTransaction
-dbgprintf("omelasticsearch: endTransaction init\n");
-	/* End Transaction only if batch data is not empty */
-	if (pWrkrData->batch.data != NULL ) {
-		cstr = es_str2cstr(pWrkrData->batch.data, NULL);
-		dbgprintf("omelasticsearch: endTransaction, batch: '%s'\n", cstr);
-		CHKiRet(curlPost(pWrkrData, (uchar*) cstr, strlen(cstr), NULL, pWrkrData->batch.nmemb));
+	RETiRet;
+}
+
+BEGINbeginTransaction
+CODESTARTbeginTransaction
+	/* all work is done in commitTransaction() */
+ENDbeginTransaction
+
+
+/* we receive the whole batch at once. In bulk mode, it is sent in bulk
+ * requests of up to maxbytes, otherwise each message is posted on its own.
+ * Up to maxinflight requests are run concurrently. The transaction is
+ * only complete when all of them are done.
+ */
+BEGINcommitTransaction
+	instanceData *const pData = pWrkrData->pData;
+	const int nTpls = getNumTpls(pData);
+	uchar *tpls[CONF_OMOD_NUMSTRINGS_MAXSIZE];
+	rsRetVal localRet;
+	unsigned i;
+	int j;
+CODESTARTcommitTransaction
+	dbgprintf("omelasticsearch: commitTransaction, pWrkrData %p, %u messages (bulkmode %d)\n",
+		  pWrkrData, nParams, pData->bulkmode);
+	pWrkrData->iRetReqs = RS_RET_OK;
+	if(pData->bulkmode) {
+		es_emptyStr(pWrkrData->batch.data);
+		pWrkrData->batch.nmemb = 0;
+	}
+	for(i = 0 ; i < nParams ; ++i) {
+		if(pWrkrData->iRetReqs != RS_RET_OK)
+			FINALIZE; /* no need to continue, transaction has failed */
+		for(j = 0 ; j < nTpls ; ++j)
+			tpls[j] = actParam(pParams, nTpls, i, j).param;
+		STATSCOUNTER_INC(indexSubmit, mutIndexSubmit);
+		if(pData->bulkmode) {
+			iRet = buildBatch(pWrkrData, tpls[0], tpls);
+			if(iRet != RS_RET_DEFER_COMMIT)
+				FINALIZE;
+			iRet = RS_RET_OK;
+			if(pData->maxBytes > 0 && es_strlen(pWrkrData->batch.data) >= pData->maxBytes)
+				CHKiRet(submitReq(pWrkrData, NULL, NULL));
+		} else {
+			CHKiRet(submitReq(pWrkrData, tpls[0], tpls));
+		}
+	}
+
+	if(pData->bulkmode && pWrkrData->batch.nmemb > 0) {
+		CHKiRet(submitReq(pWrkrData, NULL, NULL));
 	}
-	else
-		dbgprintf("omelasticsearch: endTransaction, pWrkrData->batch.data is NULL, nothing to send. \n");
 finalize_it:
-	free(cstr);
-dbgprintf("omelasticsearch: endTransaction done with %d\n", iRet);
-ENDendTransaction
+	if(pWrkrData->nBusy > 0) {
+		localRet = runReqs(pWrkrData, 1);
+		if(iRet == RS_RET_OK)
+			iRet = localRet;
+	}
+	if(iRet == RS_RET_OK)
+		iRet = pWrkrData->iRetReqs;
+dbgprintf("omelasticsearch: commitTransaction done with %d\n", iRet);
+ENDcommitTransaction
 
 /* elasticsearch POST result string ... useful for debugging */
 size_t
 curlResult(void *ptr, size_t size, size_t nmemb, void *userdata)
 {
 	char *p = (char *)ptr;
-	wrkrInstanceData_t *pWrkrData = (wrkrInstanceData_t*) userdata;
+	esReq_t *req = (esReq_t*) userdata;
 	char *buf;
 	size_t newlen;
 
-	newlen = pWrkrData->replyLen + size*nmemb;
-	if((buf = realloc(pWrkrData->reply, newlen + 1)) == NULL) {
+	newlen = req->replyLen + size*nmemb;
+	if((buf = realloc(req->reply, newlen + 1)) == NULL) {
 		DBGPRINTF("omelasticsearch: realloc failed in curlResult\n");
 		return 0; /* abort due to failure */
 	}
-	memcpy(buf+pWrkrData->replyLen, p, size*nmemb);
-	pWrkrData->replyLen = newlen;
-	pWrkrData->reply = buf;
+	memcpy(buf+req->replyLen, p, size*nmemb);
+	req->replyLen = newlen;
+	req->reply = buf;
 	return size*nmemb;
 }
 
@@ -735,27 +1383,44 @@ curlResult(void *ptr, size_t size, size_t nmemb, void *userdata)
 static rsRetVal
 curlSetup(wrkrInstanceData_t *pWrkrData, instanceData *pData)
 {
-	HEADER *header;
-	CURL *handle;
-
-	handle = curl_easy_init();
-	if (handle == NULL) {
-		return RS_RET_OBJ_CREATION_FAILED;
-	}
-
-	header = curl_slist_append(NULL, "Content-Type: text/json; charset=utf-8");
-	curl_easy_setopt(handle, CURLOPT_HTTPHEADER, header);
+	char authBuf[1024];
+	esReq_t *req;
+	int rLocal;
+	int i;
+	DEFiRet;
 
-	curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, curlResult);
-	curl_easy_setopt(handle, CURLOPT_POST, 1);
+	pWrkrData->postHeader = curl_slist_append(NULL, "Content-Type: text/json; charset=utf-8");
+	if(pData->compress)
+		pWrkrData->postHeader = curl_slist_append(pWrkrData->postHeader, "Content-Encoding: gzip");
 
-	pWrkrData->curlHandle = handle;
-	pWrkrData->postHeader = header;
+	if(pData->uid != NULL) {
+		rLocal = snprintf(authBuf, sizeof(authBuf), "%s:%s", pData->uid,
+			         (pData->pwd == NULL) ? "" : (char*)pData->pwd);
+		if(rLocal < 1) {
+			errmsg.LogError(0, RS_RET_ERR, "omelasticsearch: snprintf failed "
+				"when trying to build auth string (return %d)\n",
+				rLocal);
+			ABORT_FINALIZE(RS_RET_ERR);
+		}
+	}
 
-	if(    pData->bulkmode
-	   || (pData->dynSrchIdx == 0 && pData->dynSrchType == 0 && pData->dynParent == 0)) {
-		/* in this case, we know no tpls are involved in the request-->NULL OK! */
-		setCurlURL(pWrkrData, pData, NULL);
+	if((pWrkrData->curlMulti = curl_multi_init()) == NULL)
+		ABORT_FINALIZE(RS_RET_OBJ_CREATION_FAILED);
+	CHKmalloc(pWrkrData->reqs = calloc(pData->maxInflight, sizeof(esReq_t)));
+	for(i = 0 ; i < pData->maxInflight ; ++i) {
+		req = &pWrkrData->reqs[i];
+		if((req->curl = curl_easy_init()) == NULL)
+			ABORT_FINALIZE(RS_RET_OBJ_CREATION_FAILED);
+		CHKmalloc(req->data = es_newStr(1024));
+		curl_easy_setopt(req->curl, CURLOPT_HTTPHEADER, pWrkrData->postHeader);
+		curl_easy_setopt(req->curl, CURLOPT_WRITEFUNCTION, curlResult);
+		curl_easy_setopt(req->curl, CURLOPT_WRITEDATA, req);
+		curl_easy_setopt(req->curl, CURLOPT_PRIVATE, req);
+		curl_easy_setopt(req->curl, CURLOPT_POST, 1);
+		if(pData->uid != NULL) {
+			curl_easy_setopt(req->curl, CURLOPT_USERPWD, authBuf);
+			curl_easy_setopt(req->curl, CURLOPT_PROXYAUTH, CURLAUTH_ANY);
+		}
 	}
 
 	if(Debug) {
@@ -764,13 +1429,15 @@ curlSetup(wrkrInstanceData_t *pWrkrData, instanceData *pData)
 		else
 			dbgprintf("omelasticsearch setup, we have a dynamic REST URL\n");
 	}
-	return RS_RET_OK;
+finalize_it:
+	RETiRet;
 }
 
 static inline void
 setInstParamDefaults(instanceData *pData)
 {
-	pData->server = NULL;
+	pData->serverBaseUrls = NULL;
+	pData->numServers = 0;
 	pData->port = 9200;
 	pData->uid = NULL;
 	pData->pwd = NULL;
@@ -787,10 +1454,17 @@ setInstParamDefaults(instanceData *pData)
 	pData->errorFile = NULL;
 	pData->dynBulkId= 0;
 	pData->bulkId = NULL;
+	pData->compress = 0;
+	pData->maxInflight = 1;
+	pData->maxBytes = 0;
+	pData->retryFailures = 0;
+	pData->retryFailuresMax = 5;
 }
 
 BEGINnewActInst
 	struct cnfparamvals *pvals;
+	struct cnfarray *servers = NULL;
+	rsRetVal localRet;
 	int i;
 	int iNumTpls;
 CODESTARTnewActInst
@@ -805,7 +1479,7 @@ CODESTARTnewActInst
 		if(!pvals[i].bUsed)
 			continue;
 		if(!strcmp(actpblk.descr[i].name, "server")) {
-			pData->server = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+			servers = pvals[i].val.d.ar;
 		} else if(!strcmp(actpblk.descr[i].name, "errorfile")) {
 			pData->errorFile = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(actpblk.descr[i].name, "serverport")) {
@@ -838,12 +1512,46 @@ CODESTARTnewActInst
 			pData->dynBulkId = pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "bulkid")) {
 			pData->bulkId = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "maxinflight")) {
+			pData->maxInflight = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "maxbytes")) {
+			pData->maxBytes = (size_t) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "compression")) {
+			pData->compress = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "retryfailures")) {
+			pData->retryFailures = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "retryfailures.max")) {
+			pData->retryFailuresMax = (int) pvals[i].val.d.n;
 		} else {
 			dbgprintf("omelasticsearch: program error, non-handled "
 			  "param '%s'\n", actpblk.descr[i].name);
 		}
 	}
 
+	if(servers == NULL) {
+		CHKmalloc(pData->serverBaseUrls = malloc(sizeof(uchar*)));
+		CHKiRet(computeBaseUrl("localhost", pData->port, &pData->serverBaseUrls[0]));
+		pData->numServers = 1;
+	} else {
+		CHKmalloc(pData->serverBaseUrls = malloc(servers->nmemb * sizeof(uchar*)));
+		for(i = 0 ; i < servers->nmemb ; ++i) {
+			char *cstr;
+			CHKmalloc(cstr = es_str2cstr(servers->arr[i], NULL));
+			localRet = computeBaseUrl(cstr, pData->port, &pData->serverBaseUrls[i]);
+			free(cstr);
+			CHKiRet(localRet);
+			++pData->numServers;
+		}
+	}
+#	ifndef USE_NETZIP
+	if(pData->compress) {
+		errmsg.LogError(0, RS_RET_CONFIG_ERROR, "omelasticsearch: compression "
+			"requested, but rsyslogd is not compiled with zlib support "
+			"- ignored");
+		pData->compress = 0;
+	}
+#	endif
+
 	if(pData->pwd != NULL && pData->uid == NULL) {
 		errmsg.LogError(0, RS_RET_UID_MISSING,
 			"omelasticsearch: password is provided, but no uid "
@@ -875,11 +1583,7 @@ CODESTARTnewActInst
 		ABORT_FINALIZE(RS_RET_CONFIG_ERROR);
 	}
 
-	iNumTpls = 1;
-	if(pData->dynSrchIdx) ++iNumTpls;
-	if(pData->dynSrchType) ++iNumTpls;
-	if(pData->dynParent) ++iNumTpls;
-	if(pData->dynBulkId) ++iNumTpls;
+	iNumTpls = getNumTpls(pData);
 	DBGPRINTF("omelasticsearch: requesting %d templates\n", iNumTpls);
 	CODE_STD_STRING_REQUESTnewActInst(iNumTpls)
 
@@ -960,8 +1664,6 @@ CODESTARTnewActInst
 		}
 	}
 
-	if(pData->server == NULL)
-		pData->server = (uchar*) strdup("localhost");
 	if(pData->searchIndex == NULL)
 		pData->searchIndex = (uchar*) strdup("system");
 	if(pData->searchType == NULL)
@@ -1002,12 +1704,10 @@ ENDmodExit
 
 BEGINqueryEtryPt
 CODESTARTqueryEtryPt
-CODEqueryEtryPt_STD_OMOD_QUERIES
+CODEqueryEtryPt_STD_OMODTX_QUERIES
 CODEqueryEtryPt_STD_OMOD8_QUERIES
-CODEqueryEtryPt_IsCompatibleWithFeature_IF_OMOD_QUERIES
 CODEqueryEtryPt_STD_CONF2_OMOD_QUERIES
 CODEqueryEtryPt_doHUP
-CODEqueryEtryPt_TXIF_OMOD_QUERIES /* we support the transactional interface! */
 ENDqueryEtryPt
 
 
@@ -1038,6 +1738,9 @@ CODEmodInit_QueryRegCFSLineHdlr
 	STATSCOUNTER_INIT(indexESFail, mutIndexESFail);
 	CHKiRet(statsobj.AddCounter(indexStats, (uchar *)"failed.es",
 		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &indexESFail));
+	STATSCOUNTER_INIT(indexESRetry, mutIndexESRetry);
+	CHKiRet(statsobj.AddCounter(indexStats, (uchar *)"retried.es",
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &indexESRetry));
 	CHKiRet(statsobj.ConstructFinalize(indexStats));
 ENDmodInit
 
@@ -49,6 +49,8 @@
 #include "hashtable.h"
 #include "hashtable_itr.h"
 
+#include "compprov.h"
+
 MODULE_TYPE_OUTPUT
 MODULE_TYPE_NOKEEP
 MODULE_CNFNAME("omhdfs")
@@ -61,17 +63,32 @@ DEFobjCurrIf(errmsg)
 /* global data */
 static struct hashtable *files;		/* holds all file objects that we know */
 
+/* flusher thread, writes out blocks that are older than their flush interval */
+static pthread_t flusherTid;
+static int bFlusherRunning = 0;
+static int bFlusherStop = 0;
+static pthread_mutex_t mutFlusher = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t condFlusher = PTHREAD_COND_INITIALIZER;
+
 typedef struct configSettings_s {
 	uchar *fileName;	
 	uchar *hdfsHost;	
 	uchar *dfltTplName;	/* default template name to use */
 	int hdfsPort;
+	int64 iBlockSize;	/* size of the write buffer of a file */
+	int iFlushInterval;	/* max seconds data stays buffered, 0 - flush each batch */
+	uchar *compressionDriver; /* compression provider, NULL - none */
+	int iZipLevel;
 } configSettings_t;
 static configSettings_t cs;
 
+#define DFLT_BLOCK_SIZE (1024 * 1024)
+
 
 BEGINinitConfVars		/* (re)set config variables to default values */
 CODESTARTinitConfVars 
+	cs.iBlockSize = DFLT_BLOCK_SIZE;
+	cs.iZipLevel = 6;
 ENDinitConfVars
 
 typedef struct {
@@ -81,16 +98,28 @@ typedef struct {
 	const char *hdfsHost;
 	tPort hdfsPort;
 	int nUsers;
-	pthread_mutex_t mut;
+	pthread_mutex_t mut;	/* guards the file handle and the buffer */
+	/* data is collected in large blocks, as each hdfsWrite() is costly */
+	uchar *ioBuf;
+	size_t lenBuf;
+	size_t sizeBuf;
+	int iFlushInterval;	/* max seconds data stays in ioBuf, 0 - flush at end of each batch */
+	time_t tFirstBuffered;	/* when the oldest data in ioBuf was added */
+	uchar *compprovNameFull; /* NULL - no compression */
+	compprov_if_t compprov;
+	void *compprovData;	/* provider instance for the current open file */
+	int iZipLevel;
 } file_t;
 
 
 typedef struct _instanceData {
 	file_t *pFile;
-	uchar ioBuf[64*1024];
-	unsigned offsBuf;
 } instanceData;
 
+typedef struct wrkrInstanceData {
+	instanceData *pData;
+} wrkrInstanceData_t;
+
 /* forward definitions (down here, need data types) */
 static inline rsRetVal fileClose(file_t *pFile);
 
@@ -148,7 +177,9 @@ finalize_it:
  * instance data, because several instances may write into the same file.
  * If so, we need to use a single object, and also synchronize their writes.
  * So we keep the file object separately, and just stick a reference into
- * the instance data.
+ * the instance data. The write buffer lives in the file object, so that all
+ * actions (and all their workers) fill the same large blocks. Different
+ * files have different mutexes and are thus written in parallel.
  */
 
 static inline rsRetVal
@@ -157,11 +188,14 @@ fileObjConstruct(file_t **ppFile)
 	file_t *pFile;
 	DEFiRet;
 
-	CHKmalloc(pFile = malloc(sizeof(file_t)));
+	CHKmalloc(pFile = calloc(1, sizeof(file_t)));
 	pFile->name = NULL;
 	pFile->hdfsHost = NULL;
 	pFile->fh = NULL;
 	pFile->nUsers = 0;
+	pFile->compprovNameFull = NULL;
+	pFile->compprovData = NULL;
+	pthread_mutex_init(&pFile->mut, NULL);
 
 	*ppFile = pFile;
 finalize_it:
@@ -171,10 +205,7 @@ finalize_it:
 static inline void
 fileObjAddUser(file_t *pFile)
 {
-	/* init mutex only when second user is added */
 	++pFile->nUsers;
-	if(pFile->nUsers == 2)
-		pthread_mutex_init(&pFile->mut, NULL);
 	DBGPRINTF("omhdfs: file %s now being used by %d actions\n", pFile->name, pFile->nUsers);
 }
 
@@ -182,17 +213,52 @@ static rsRetVal
 fileObjDestruct(file_t **ppFile)
 {
 	file_t *pFile = *ppFile;
-	if(pFile->nUsers > 1)
-		pthread_mutex_destroy(&pFile->mut);
 	fileClose(pFile);
+	pthread_mutex_destroy(&pFile->mut);
+	if(pFile->compprovNameFull != NULL) {
+		obj.ReleaseObj(__FILE__, pFile->compprovNameFull+2, pFile->compprovNameFull,
+			       (void*) &pFile->compprov);
+		free(pFile->compprovNameFull);
+	}
 	free(pFile->name);
 	free((char*)pFile->hdfsHost);
-	free(pFile->fh);
+	free(pFile->ioBuf);
+	free(pFile);
 
 	return RS_RET_OK;
 }
 
 
+/* load the compression provider for a file. The providers are the ones
+ * also used by the stream class (lmcomp_<name>).
+ */
+static rsRetVal
+fileObjSetCompression(file_t *pFile, uchar *driverName)
+{
+	uchar szDrvrName[1024];
+	DEFiRet;
+
+	if(snprintf((char*)szDrvrName, sizeof(szDrvrName), "lmcomp_%s", driverName)
+		== sizeof(szDrvrName)) {
+		errmsg.LogError(0, RS_RET_ERR, "omhdfs: compression driver "
+				"name is too long: '%s'", driverName);
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+
+	pFile->compprov.ifVersion = compprovCURR_IF_VERSION;
+	if(obj.UseObj(__FILE__, szDrvrName, szDrvrName, (void*) &pFile->compprov)
+		!= RS_RET_OK) {
+		errmsg.LogError(0, RS_RET_LOAD_ERROR, "omhdfs: could not load "
+				"compression driver '%s'", szDrvrName);
+		ABORT_FINALIZE(RS_RET_COMPPROV_ERR);
+	}
+	CHKmalloc(pFile->compprovNameFull = ustrdup(szDrvrName));
+	dbgprintf("omhdfs: file %s uses compression provider %s\n", pFile->name, szDrvrName);
+finalize_it:
+	RETiRet;
+}
+
+
 /* check, and potentially create, all names inside a path */
 static rsRetVal
 filePrepare(file_t *pFile)
@@ -239,14 +305,13 @@ fileObjDestruct4Hashtable(void *ptr)
 }
 
 
+/* open the file, must be called with the file mutex locked */
 static inline rsRetVal
-fileOpen(file_t *pFile)
+fileOpenLocked(file_t *pFile)
 {
 	DEFiRet;
 
 	assert(pFile->fh == NULL);
-	if(pFile->nUsers > 1)
-		d_pthread_mutex_lock(&pFile->mut);
 
 	DBGPRINTF("omhdfs: try to connect to HDFS at host '%s', port %d\n",
 		  pFile->hdfsHost, pFile->hdfsPort);
@@ -278,75 +343,222 @@ fileOpen(file_t *pFile)
 		ABORT_FINALIZE(RS_RET_SUSPENDED);
 	}
 
+	/* each open starts a new compressed frame, appended frames are valid */
+	if(pFile->compprovNameFull != NULL && pFile->compprovData == NULL) {
+		CHKiRet(pFile->compprov.Construct(&pFile->compprovData));
+		CHKiRet(pFile->compprov.SetLevel(pFile->compprovData, pFile->iZipLevel));
+		CHKiRet(pFile->compprov.SetWorkers(pFile->compprovData, 0));
+	}
+
 finalize_it:
-	if(pFile->nUsers > 1)
-		d_pthread_mutex_unlock(&pFile->mut);
 	RETiRet;
 }
 
 
-/* Note: lenWrite is reset to zero on successful write! */
 static inline rsRetVal
-fileWrite(file_t *pFile, uchar *buf, size_t *lenWrite)
+fileOpen(file_t *pFile)
 {
 	DEFiRet;
 
-	if(*lenWrite == 0)
+	d_pthread_mutex_lock(&pFile->mut);
+	iRet = fileOpenLocked(pFile);
+	d_pthread_mutex_unlock(&pFile->mut);
+	RETiRet;
+}
+
+
+/* do the actual hdfsWrite(), also used as write callback of the
+ * compression provider.
+ */
+static rsRetVal
+filePhysWrite(void *pUsr, uchar *buf, size_t lenWrite)
+{
+	file_t *pFile = (file_t*) pUsr;
+	tSize num_written_bytes;
+	DEFiRet;
+
+	if(lenWrite == 0)
 		FINALIZE;
 
-	if(pFile->nUsers > 1)
-		d_pthread_mutex_lock(&pFile->mut);
+	DBGPRINTF("omhdfs: writing %lu bytes to %s\n", (unsigned long) lenWrite, pFile->name);
+	num_written_bytes = hdfsWrite(pFile->fs, pFile->fh, buf, lenWrite);
+	if(num_written_bytes < 0 || (size_t) num_written_bytes != lenWrite) {
+		errmsg.LogError(errno, RS_RET_ERR_HDFS_WRITE,
+			        "omhdfs: failed to write %s, expected %lu bytes, "
+			        "written %lu\n", pFile->name, (unsigned long) lenWrite,
+				(unsigned long) num_written_bytes);
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* write a block of data to the file, compressing it if configured.
+ * Must be called with the file mutex locked. On failure, the file is
+ * closed so that the next write reopens it (and starts a new frame).
+ */
+static rsRetVal
+fileWriteBlock(file_t *pFile, uchar *buf, size_t lenWrite, int op)
+{
+	DEFiRet;
 
 	/* open file if not open. This must be done *here* and while mutex-protected
 	 * because of HUP handling (which is async to normal processing!).
 	 */
 	if(pFile->fh == NULL) {
-		fileOpen(pFile);
+		fileOpenLocked(pFile);
 		if(pFile->fh == NULL) {
 			ABORT_FINALIZE(RS_RET_SUSPENDED);
 		}
 	}
 
-dbgprintf("XXXXX: omhdfs writing %u bytes\n", *lenWrite);
-	tSize num_written_bytes = hdfsWrite(pFile->fs, pFile->fh, buf, *lenWrite);
-	if((unsigned) num_written_bytes != *lenWrite) {
-		errmsg.LogError(errno, RS_RET_ERR_HDFS_WRITE,
-			        "omhdfs: failed to write %s, expected %lu bytes, "
-			        "written %lu\n", pFile->name, (unsigned long) *lenWrite,
-				(unsigned long) num_written_bytes);
+	if(pFile->compprovData != NULL) {
+		iRet = pFile->compprov.Compress(pFile->compprovData, buf, lenWrite, op,
+						filePhysWrite, pFile);
+	} else {
+		iRet = filePhysWrite(pFile, buf, lenWrite);
+	}
+	if(iRet != RS_RET_OK) {
+		hdfsCloseFile(pFile->fs, pFile->fh);
+		pFile->fh = NULL;
+		if(pFile->compprovData != NULL)
+			pFile->compprov.Destruct(&pFile->compprovData);
 		ABORT_FINALIZE(RS_RET_SUSPENDED);
 	}
-	*lenWrite = 0;
 
 finalize_it:
 	RETiRet;
 }
 
 
+/* write out the buffered block. Must be called with the file mutex locked.
+ * On failure, the data stays in the buffer and is written on the next try.
+ */
 static inline rsRetVal
-fileClose(file_t *pFile)
+fileFlushLocked(file_t *pFile, int op)
 {
 	DEFiRet;
 
-	if(pFile->fh == NULL)
+	if(pFile->lenBuf == 0)
 		FINALIZE;
+	CHKiRet(fileWriteBlock(pFile, pFile->ioBuf, pFile->lenBuf, op));
+	pFile->lenBuf = 0;
 
-	if(pFile->nUsers > 1)
-		d_pthread_mutex_lock(&pFile->mut);
+finalize_it:
+	RETiRet;
+}
 
-	hdfsCloseFile(pFile->fs, pFile->fh);
-	pFile->fh = NULL;
 
-	if(pFile->nUsers > 1)
-		d_pthread_mutex_unlock(&pFile->mut);
+/* is the buffered data due for writing? */
+static inline int
+fileFlushDue(file_t *pFile, time_t tNow)
+{
+	return pFile->lenBuf > 0 &&
+		(pFile->iFlushInterval == 0 || tNow - pFile->tFirstBuffered >= pFile->iFlushInterval);
+}
+
+
+static inline rsRetVal
+fileClose(file_t *pFile)
+{
+	DEFiRet;
+
+	d_pthread_mutex_lock(&pFile->mut);
+	if(pFile->fh == NULL && pFile->lenBuf == 0)
+		FINALIZE;
+
+	/* persist what is still buffered and end the compressed frame */
+	if(pFile->lenBuf > 0)
+		fileFlushLocked(pFile, COMPPROV_OP_END);
+	else if(pFile->fh != NULL && pFile->compprovData != NULL)
+		fileWriteBlock(pFile, NULL, 0, COMPPROV_OP_END);
+
+	if(pFile->fh != NULL) {
+		hdfsCloseFile(pFile->fs, pFile->fh);
+		pFile->fh = NULL;
+	}
+	if(pFile->compprovData != NULL)
+		pFile->compprov.Destruct(&pFile->compprovData);
 
 finalize_it:
+	d_pthread_mutex_unlock(&pFile->mut);
 	RETiRet;
 }
 
 /* ---END FILE OBJECT---------------------------------------------------- */
 
-/* This adds data to the output buffer and performs an actual write
+
+/* background flusher: writes out buffered blocks when their flush interval
+ * has expired, even if no new messages arrive.
+ */
+static void *
+flusherThread(void __attribute__((unused)) *arg)
+{
+	struct hashtable_itr *itr;
+	struct timespec t;
+	file_t *pFile;
+	time_t tNow;
+
+	d_pthread_mutex_lock(&mutFlusher);
+	while(!bFlusherStop) {
+		timeoutComp(&t, 1000);
+		pthread_cond_timedwait(&condFlusher, &mutFlusher, &t);
+		if(bFlusherStop)
+			break;
+		if(hashtable_count(files) == 0)
+			continue;
+		time(&tNow);
+		itr = hashtable_iterator(files);
+		do {
+			pFile = (file_t *) hashtable_iterator_value(itr);
+			d_pthread_mutex_lock(&pFile->mut);
+			if(pFile->iFlushInterval > 0 && fileFlushDue(pFile, tNow)) {
+				DBGPRINTF("omhdfs: flush interval expired for %s\n", pFile->name);
+				fileFlushLocked(pFile, COMPPROV_OP_FLUSH);
+			}
+			d_pthread_mutex_unlock(&pFile->mut);
+		} while (hashtable_iterator_advance(itr));
+		free(itr);
+	}
+	d_pthread_mutex_unlock(&mutFlusher);
+	return NULL;
+}
+
+static void
+startFlusher(void)
+{
+	d_pthread_mutex_lock(&mutFlusher);
+	if(!bFlusherRunning) {
+		bFlusherStop = 0;
+		if(pthread_create(&flusherTid, NULL, flusherThread, NULL) == 0) {
+			bFlusherRunning = 1;
+		} else {
+			errmsg.LogError(errno, RS_RET_ERR, "omhdfs: could not start flusher "
+					"thread, data is only written when blocks are full");
+		}
+	}
+	d_pthread_mutex_unlock(&mutFlusher);
+}
+
+static void
+stopFlusher(void)
+{
+	d_pthread_mutex_lock(&mutFlusher);
+	if(!bFlusherRunning) {
+		d_pthread_mutex_unlock(&mutFlusher);
+		return;
+	}
+	bFlusherStop = 1;
+	pthread_cond_signal(&condFlusher);
+	d_pthread_mutex_unlock(&mutFlusher);
+	pthread_join(flusherTid, NULL);
+	bFlusherRunning = 0;
+}
+
+
+/* This adds data to the file's block buffer and performs an actual write
  * if the new data does not fit into the buffer. Note that we never write
  * partial data records. Other actions may write into the same file, and if
  * we would write partial records, data could become severely mixed up.
@@ -355,29 +567,28 @@ finalize_it:
  * write operation.
  */
 static inline rsRetVal
-addData(instanceData *pData, uchar *buf)
+addData(file_t *pFile, uchar *buf)
 {
-	unsigned len;
+	size_t len;
 	DEFiRet;
 
 	len = strlen((char*)buf);
-	if(pData->offsBuf + len < sizeof(pData->ioBuf)) {
-		/* new data fits into remaining buffer */
-		memcpy((char*) pData->ioBuf + pData->offsBuf, buf, len);
-		pData->offsBuf += len;
+	d_pthread_mutex_lock(&pFile->mut);
+	if(pFile->lenBuf + len > pFile->sizeBuf) {
+		CHKiRet(fileFlushLocked(pFile, COMPPROV_OP_CONTINUE));
+	}
+	if(len >= pFile->sizeBuf) {
+		CHKiRet(fileWriteBlock(pFile, buf, len, COMPPROV_OP_CONTINUE));
 	} else {
-dbgprintf("XXXXX: not enough room, need to flush\n");
-		CHKiRet(fileWrite(pData->pFile, pData->ioBuf, &pData->offsBuf));
-		if(len >= sizeof(pData->ioBuf)) {
-			CHKiRet(fileWrite(pData->pFile, buf, &len));
-		} else {
-			memcpy((char*) pData->ioBuf + pData->offsBuf, buf, len);
-			pData->offsBuf += len;
-		}
+		if(pFile->lenBuf == 0)
+			time(&pFile->tFirstBuffered);
+		memcpy((char*) pFile->ioBuf + pFile->lenBuf, buf, len);
+		pFile->lenBuf += len;
 	}
 
 	iRet = RS_RET_DEFER_COMMIT;
 finalize_it:
+	d_pthread_mutex_unlock(&pFile->mut);
 	RETiRet;
 }
 
@@ -387,46 +598,62 @@ CODESTARTcreateInstance
 ENDcreateInstance
 
 
+BEGINcreateWrkrInstance
+CODESTARTcreateWrkrInstance
+ENDcreateWrkrInstance
+
+
 BEGINfreeInstance
 CODESTARTfreeInstance
-	if(pData->pFile != NULL)
-		fileObjDestruct(&pData->pFile);
+	/* the file object is owned by the hashtable, as it may be shared */
 ENDfreeInstance
 
 
+BEGINfreeWrkrInstance
+CODESTARTfreeWrkrInstance
+ENDfreeWrkrInstance
+
+
 BEGINtryResume
+	file_t *pFile;
 CODESTARTtryResume
-	fileClose(pData->pFile);
-	fileOpen(pData->pFile);
-	if(pData->pFile->fh == NULL){
+	pFile = pWrkrData->pData->pFile;
+	d_pthread_mutex_lock(&pFile->mut);
+	if(pFile->fh == NULL)
+		fileOpenLocked(pFile);
+	if(pFile->fh == NULL){
 		dbgprintf("omhdfs: tried to resume file %s, but still no luck...\n",
-			  pData->pFile->name);
+			  pFile->name);
 		iRet = RS_RET_SUSPENDED;
 	}
+	d_pthread_mutex_unlock(&pFile->mut);
 ENDtryResume
 
 
 BEGINbeginTransaction
 CODESTARTbeginTransaction
-dbgprintf("omhdfs: beginTransaction\n");
 ENDbeginTransaction
 
 
 BEGINdoAction
 CODESTARTdoAction
-	DBGPRINTF("omhdfs: action to to write to %s\n", pData->pFile->name);
-	iRet = addData(pData, ppString[0]);
-dbgprintf("omhdfs: done doAction\n");
+	DBGPRINTF("omhdfs: action to to write to %s\n", pWrkrData->pData->pFile->name);
+	iRet = addData(pWrkrData->pData->pFile, ppString[0]);
 ENDdoAction
 
 
 BEGINendTransaction
+	file_t *pFile;
+	time_t tNow;
 CODESTARTendTransaction
-dbgprintf("omhdfs: endTransaction\n");
-	if(pData->offsBuf != 0) {
-		DBGPRINTF("omhdfs: data unwritten at end of transaction, persisting...\n");
-		iRet = fileWrite(pData->pFile, pData->ioBuf, &pData->offsBuf);
+	pFile = pWrkrData->pData->pFile;
+	time(&tNow);
+	d_pthread_mutex_lock(&pFile->mut);
+	if(fileFlushDue(pFile, tNow)) {
+		DBGPRINTF("omhdfs: persisting buffered data at end of transaction\n");
+		iRet = fileFlushLocked(pFile, COMPPROV_OP_FLUSH);
 	}
+	d_pthread_mutex_unlock(&pFile->mut);
 ENDendTransaction
 
 
@@ -462,6 +689,16 @@ CODESTARTparseSelectorAct
 		cs.fileName = NULL; /* re-set, data passed to file object */
 		CHKmalloc(pFile->hdfsHost = strdup((cs.hdfsHost == NULL) ? "default" : (char*) cs.hdfsHost));
 		pFile->hdfsPort = cs.hdfsPort;
+		/* buffering and compression are properties of the file; the
+		 * settings of the first action writing to it apply.
+		 */
+		pFile->sizeBuf = (cs.iBlockSize < 4096) ? 4096 : (size_t) cs.iBlockSize;
+		CHKmalloc(pFile->ioBuf = malloc(pFile->sizeBuf));
+		pFile->iFlushInterval = cs.iFlushInterval;
+		pFile->iZipLevel = cs.iZipLevel;
+		if(cs.compressionDriver != NULL) {
+			CHKiRet(fileObjSetCompression(pFile, cs.compressionDriver));
+		}
 		fileOpen(pFile);
 		if(pFile->fh == NULL){
 			errmsg.LogError(0, RS_RET_ERR_HDFS_OPEN, "omhdfs: failed to open %s - "
@@ -471,10 +708,11 @@ CODESTARTparseSelectorAct
 		r = hashtable_insert(files, keybuf, pFile);
 		if(r == 0)
 			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		if(pFile->iFlushInterval > 0)
+			startFlusher();
 	}
 	fileObjAddUser(pFile);
 	pData->pFile = pFile;
-	pData->offsBuf = 0;
 
 CODE_STD_FINALIZERparseSelectorAct
 ENDparseSelectorAct
@@ -510,12 +748,18 @@ static rsRetVal resetConfigVariables(uchar __attribute__((unused)) *pp, void __a
 	cs.fileName = NULL;
 	free(cs.dfltTplName);
 	cs.dfltTplName = NULL;
+	cs.iBlockSize = DFLT_BLOCK_SIZE;
+	cs.iFlushInterval = 0;
+	free(cs.compressionDriver);
+	cs.compressionDriver = NULL;
+	cs.iZipLevel = 6;
 	return RS_RET_OK;
 }
 
 
 BEGINmodExit
 CODESTARTmodExit
+	stopFlusher();
 	objRelease(errmsg, CORE_COMPONENT);
 	if(files != NULL)
 		hashtable_destroy(files, 1); /* 1 => free all values automatically */
@@ -525,6 +769,7 @@ ENDmodExit
 BEGINqueryEtryPt
 CODESTARTqueryEtryPt
 CODEqueryEtryPt_STD_OMOD_QUERIES
+CODEqueryEtryPt_STD_OMOD8_QUERIES
 CODEqueryEtryPt_TXIF_OMOD_QUERIES /* we support the transactional interface! */
 CODEqueryEtryPt_doHUP
 ENDqueryEtryPt
@@ -543,6 +788,10 @@ CODEmodInit_QueryRegCFSLineHdlr
 	CHKiRet(regCfSysLineHdlr((uchar *)"omhdfshost", 0, eCmdHdlrGetWord, NULL, &cs.hdfsHost, NULL));
 	CHKiRet(regCfSysLineHdlr((uchar *)"omhdfsport", 0, eCmdHdlrInt, NULL, &cs.hdfsPort, NULL));
 	CHKiRet(regCfSysLineHdlr((uchar *)"omhdfsdefaulttemplate", 0, eCmdHdlrGetWord, NULL, &cs.dfltTplName, NULL));
+	CHKiRet(regCfSysLineHdlr((uchar *)"omhdfsblocksize", 0, eCmdHdlrSize, NULL, &cs.iBlockSize, NULL));
+	CHKiRet(regCfSysLineHdlr((uchar *)"omhdfsflushinterval", 0, eCmdHdlrInt, NULL, &cs.iFlushInterval, NULL));
+	CHKiRet(regCfSysLineHdlr((uchar *)"omhdfscompressiondriver", 0, eCmdHdlrGetWord, NULL, &cs.compressionDriver, NULL));
+	CHKiRet(regCfSysLineHdlr((uchar *)"omhdfsziplevel", 0, eCmdHdlrInt, NULL, &cs.iZipLevel, NULL));
 	CHKiRet(omsdRegCFSLineHdlr((uchar *)"resetconfigvariables", 1, eCmdHdlrCustomHandler, resetConfigVariables, NULL, STD_LOADABLE_MODULE_ID));
 	DBGPRINTF("omhdfs: module compiled with rsyslog version %s.\n", VERSION);
 CODEmodInit_QueryRegCFSLineHdlr
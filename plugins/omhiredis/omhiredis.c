@@ -29,6 +29,7 @@
 #include <assert.h>
 #include <signal.h>
 #include <time.h>
+#include <stdint.h>
 #include <hiredis/hiredis.h>
 
 #include "rsyslog.h"
@@ -39,6 +40,7 @@
 #include "module-template.h"
 #include "errmsg.h"
 #include "cfsysline.h"
+#include "unicode-helper.h"
 
 MODULE_TYPE_OUTPUT
 MODULE_TYPE_NOKEEP
@@ -48,26 +50,77 @@ MODULE_CNFNAME("omhiredis")
 DEF_OMOD_STATIC_DATA
 DEFobjCurrIf(errmsg)
 
+#define HIREDIS_MODE_TEMPLATE 0	/* template renders the full redis command */
+#define HIREDIS_MODE_QUEUE 1	/* template renders a value, pushed via RPUSH */
+
+#define NUM_SLOTS 16384		/* redis cluster hash slots */
+#define MAX_PUSH_KEYS 16	/* distinct keys coalesced at a time, more cause a flush */
+#define MAX_PUSH_VALUES 1024	/* max values in a single RPUSH command */
+
 /*  our instance data.
  *  this will be accessable 
  *  via pData */
 typedef struct _instanceData {
-	uchar *server; /*  redis server address */
+	char **serverHosts; /*  redis server addresses */
+	int *serverPorts;
+	int nServers;
 	int port; /*  redis port */
 	uchar *tplName; /*  template name */
+	int mode; /*  HIREDIS_MODE_* */
+	uchar *key; /*  list key (queue mode), template name if dynaKey */
+	sbool dynaKey;
+	sbool cluster; /*  route by redis cluster hash slot */
 } instanceData;
 
+/*  a redis node. The configured servers come first, cluster
+ *  nodes learned from CLUSTER SLOTS or redirects are appended */
+typedef struct redisNode_s {
+	char *host;
+	int port;
+	redisContext *conn; /*  redis connection */
+} redisNode_t;
+
+/*  a command sent in the current batch, kept until its
+ *  reply has been read so it can be re-sent on a redirect */
+typedef struct pendCmd_s {
+	int iNode; /*  node the command was sent to */
+	char *cmd; /*  template mode: command string */
+	int argc; /*  queue mode: RPUSH key v1 v2 ... */
+	char **argv;
+	size_t *argvlen;
+	char *redirect; /*  MOVED/ASK error received, if any */
+} pendCmd_t;
+
+/*  values for a single key, collected into one RPUSH */
+typedef struct pushGroup_s {
+	int argc;
+	int maxArgs;
+	char **argv; /*  "RPUSH", key, values */
+	size_t *argvlen;
+} pushGroup_t;
+
 typedef struct wrkrInstanceData {
 	instanceData *pData;
-	redisContext *conn; /*  redis connection */
-	redisReply **replies; /* array to hold replies from redis */
-	int count; /*  count of command sent for current batch */
+	redisNode_t *nodes;
+	int nNodes;
+	int maxNodes;
+	int iActive; /*  node used if no slot owner is known */
+	int16_t *slots; /*  cluster mode: node per hash slot, -1 if unknown */
+	pendCmd_t *cmds; /*  commands of current batch */
+	int nCmds;
+	int maxCmds;
+	pushGroup_t groups[MAX_PUSH_KEYS];
+	int nGroups;
 } wrkrInstanceData_t;
 
 static struct cnfparamdescr actpdescr[] = {
-	{ "server", eCmdHdlrGetWord, 0 },
+	{ "server", eCmdHdlrArray, 0 },
 	{ "serverport", eCmdHdlrInt, 0 },
-	{ "template", eCmdHdlrGetWord, 1 }
+	{ "template", eCmdHdlrGetWord, 0 },
+	{ "mode", eCmdHdlrGetWord, 0 },
+	{ "key", eCmdHdlrGetWord, 0 },
+	{ "dynakey", eCmdHdlrBinary, 0 },
+	{ "cluster", eCmdHdlrBinary, 0 }
 };
 static struct cnfparamblk actpblk = {
 	CNFPARAMBLK_VERSION,
@@ -75,13 +128,29 @@ static struct cnfparamblk actpblk = {
 	actpdescr
 };
 
+static uint16_t crc16tab[256];
+
 BEGINcreateInstance
 CODESTARTcreateInstance
 ENDcreateInstance
 
 BEGINcreateWrkrInstance
+	int i;
 CODESTARTcreateWrkrInstance
-	pWrkrData->conn = NULL; /* Connect later */
+	/* Connect later */
+	CHKmalloc(pWrkrData->nodes = calloc(pData->nServers, sizeof(redisNode_t)));
+	pWrkrData->maxNodes = pData->nServers;
+	for(i = 0 ; i < pData->nServers ; ++i) {
+		CHKmalloc(pWrkrData->nodes[i].host = strdup(pData->serverHosts[i]));
+		pWrkrData->nodes[i].port = pData->serverPorts[i];
+		++pWrkrData->nNodes;
+	}
+	if(pData->cluster) {
+		CHKmalloc(pWrkrData->slots = malloc(NUM_SLOTS * sizeof(int16_t)));
+		for(i = 0 ; i < NUM_SLOTS ; ++i)
+			pWrkrData->slots[i] = -1;
+	}
+finalize_it:
 ENDcreateWrkrInstance
 
 BEGINisCompatibleWithFeature
@@ -90,27 +159,83 @@ CODESTARTisCompatibleWithFeature
 		iRet = RS_RET_OK;
 ENDisCompatibleWithFeature
 
-/*  called when closing */
-static void closeHiredis(wrkrInstanceData_t *pWrkrData)
+/*  close a single node's connection */
+static void closeNode(redisNode_t *node)
 {
-	if(pWrkrData->conn != NULL) {
-		redisFree(pWrkrData->conn);
-		pWrkrData->conn = NULL;
+	if(node->conn != NULL) {
+		redisFree(node->conn);
+		node->conn = NULL;
 	}
 }
 
-/*  Free our instance data.
- *  TODO: free **replies */
+/*  called when closing. Also used when a connection failed,
+ *  as the pipelines of the others are then in an unknown state */
+static void closeHiredis(wrkrInstanceData_t *pWrkrData)
+{
+	int i;
+
+	for(i = 0 ; i < pWrkrData->nNodes ; ++i)
+		closeNode(&pWrkrData->nodes[i]);
+}
+
+static void freeCmd(pendCmd_t *cmd)
+{
+	int i;
+
+	free(cmd->cmd);
+	for(i = 0 ; i < cmd->argc ; ++i)
+		free(cmd->argv[i]);
+	free(cmd->argv);
+	free(cmd->argvlen);
+	free(cmd->redirect);
+	memset(cmd, 0, sizeof(pendCmd_t));
+}
+
+static void freeGroup(pushGroup_t *grp)
+{
+	int i;
+
+	for(i = 0 ; i < grp->argc ; ++i)
+		free(grp->argv[i]);
+	free(grp->argv);
+	free(grp->argvlen);
+	memset(grp, 0, sizeof(pushGroup_t));
+}
+
+/*  discard the commands and values of the current batch */
+static void resetBatch(wrkrInstanceData_t *pWrkrData)
+{
+	int i;
+
+	for(i = 0 ; i < pWrkrData->nCmds ; ++i)
+		freeCmd(&pWrkrData->cmds[i]);
+	pWrkrData->nCmds = 0;
+	for(i = 0 ; i < pWrkrData->nGroups ; ++i)
+		freeGroup(&pWrkrData->groups[i]);
+	pWrkrData->nGroups = 0;
+}
+
+/*  Free our instance data. */
 BEGINfreeInstance
+	int i;
 CODESTARTfreeInstance
-	if (pData->server != NULL) {
-		free(pData->server);
-	}
+	for(i = 0 ; i < pData->nServers ; ++i)
+		free(pData->serverHosts[i]);
+	free(pData->serverHosts);
+	free(pData->serverPorts);
+	free(pData->key);
 ENDfreeInstance
 
 BEGINfreeWrkrInstance
+	int i;
 CODESTARTfreeWrkrInstance
 	closeHiredis(pWrkrData);
+	resetBatch(pWrkrData);
+	for(i = 0 ; i < pWrkrData->nNodes ; ++i)
+		free(pWrkrData->nodes[i].host);
+	free(pWrkrData->nodes);
+	free(pWrkrData->slots);
+	free(pWrkrData->cmds);
 ENDfreeWrkrInstance
 
 BEGINdbgPrintInstInfo
@@ -118,63 +243,495 @@ CODESTARTdbgPrintInstInfo
 	/* nothing special here */
 ENDdbgPrintInstInfo
 
-/*  establish our connection to redis */
-static rsRetVal initHiredis(wrkrInstanceData_t *pWrkrData, int bSilent)
+/*  CRC16 (XMODEM) as used for redis cluster key hashing */
+static void initCRC16(void)
 {
-	char *server;
+	unsigned i, j;
+	uint16_t crc;
+
+	for(i = 0 ; i < 256 ; ++i) {
+		crc = i << 8;
+		for(j = 0 ; j < 8 ; ++j)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		crc16tab[i] = crc;
+	}
+}
+
+/*  hash slot of a key. If the key contains a non-empty
+ *  {hash tag}, only the tag is hashed, like redis does */
+static int keySlot(const char *key, size_t len)
+{
+	size_t s, e;
+	uint16_t crc = 0;
+
+	for(s = 0 ; s < len && key[s] != '{' ; ++s)
+		;
+	if(s < len) {
+		for(e = s + 1 ; e < len && key[e] != '}' ; ++e)
+			;
+		if(e < len && e > s + 1) {
+			key += s + 1;
+			len = e - s - 1;
+		}
+	}
+	for(s = 0 ; s < len ; ++s)
+		crc = (crc << 8) ^ crc16tab[((crc >> 8) ^ (unsigned char) key[s]) & 0xff];
+	return crc & (NUM_SLOTS - 1);
+}
+
+/*  find a node by address, adding it if it is not yet known */
+static rsRetVal addNode(wrkrInstanceData_t *pWrkrData, const char *host, size_t lenHost,
+	int port, int *piNode)
+{
+	redisNode_t *newNodes;
+	redisNode_t *node;
+	int i;
 	DEFiRet;
 
-	server = (pWrkrData->pData->server == NULL) ? "127.0.0.1" : 
-			(char*) pWrkrData->pData->server;
-	DBGPRINTF("omhiredis: trying connect to '%s' at port %d\n", server, 
-			pWrkrData->pData->port);
-	
+	for(i = 0 ; i < pWrkrData->nNodes ; ++i) {
+		node = &pWrkrData->nodes[i];
+		if(node->port == port && strlen(node->host) == lenHost
+		   && !strncmp(node->host, host, lenHost)) {
+			*piNode = i;
+			FINALIZE;
+		}
+	}
+	if(pWrkrData->nNodes == INT16_MAX)
+		ABORT_FINALIZE(RS_RET_ERR);
+	if(pWrkrData->nNodes == pWrkrData->maxNodes) {
+		CHKmalloc(newNodes = realloc(pWrkrData->nodes,
+			(pWrkrData->maxNodes + 8) * sizeof(redisNode_t)));
+		pWrkrData->nodes = newNodes;
+		pWrkrData->maxNodes += 8;
+	}
+	node = &pWrkrData->nodes[pWrkrData->nNodes];
+	CHKmalloc(node->host = malloc(lenHost + 1));
+	memcpy(node->host, host, lenHost);
+	node->host[lenHost] = '\0';
+	node->port = port;
+	node->conn = NULL;
+	*piNode = pWrkrData->nNodes++;
+	DBGPRINTF("omhiredis: added cluster node %s:%d\n", node->host, port);
+
+finalize_it:
+	RETiRet;
+}
+
+/*  establish our connection to a redis node */
+static rsRetVal connectNode(wrkrInstanceData_t *pWrkrData, int iNode, int bSilent)
+{
+	redisNode_t *const node = &pWrkrData->nodes[iNode];
 	struct timeval timeout = { 1, 500000 }; /* 1.5 seconds */
-	pWrkrData->conn = redisConnectWithTimeout(server, pWrkrData->pData->port,
-			timeout);
-	if (pWrkrData->conn->err) {
+	DEFiRet;
+
+	if(node->conn != NULL)
+		FINALIZE;
+	DBGPRINTF("omhiredis: trying connect to '%s' at port %d\n", node->host, node->port);
+	node->conn = redisConnectWithTimeout(node->host, node->port, timeout);
+	if(node->conn == NULL || node->conn->err) {
+		if(!bSilent)
+			errmsg.LogError(0, RS_RET_SUSPENDED,
+				"omhiredis: can not initialize redis handle for %s:%d",
+				node->host, node->port);
+		closeNode(node);
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+finalize_it:
+	RETiRet;
+}
+
+/*  learn which node serves which hash slot. Slots not
+ *  covered by the reply keep their previous owner */
+static rsRetVal refreshSlots(wrkrInstanceData_t *pWrkrData)
+{
+	redisNode_t *const active = &pWrkrData->nodes[pWrkrData->iActive];
+	redisReply *reply;
+	redisReply *range;
+	redisReply *master;
+	long long slot;
+	size_t i;
+	int iNode;
+	DEFiRet;
+
+	reply = redisCommand(active->conn, "CLUSTER SLOTS");
+	if(reply == NULL) {
+		closeNode(active);
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+	if(reply->type != REDIS_REPLY_ARRAY) {
+		errmsg.LogError(0, RS_RET_ERR, "omhiredis: could not obtain cluster "
+			"slots from %s:%d: %s - all keys are sent to this node",
+			active->host, active->port,
+			(reply->type == REDIS_REPLY_ERROR) ? reply->str : "unexpected reply");
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+	for(i = 0 ; i < reply->elements ; ++i) {
+		range = reply->element[i];
+		if(range->type != REDIS_REPLY_ARRAY || range->elements < 3
+		   || range->element[0]->type != REDIS_REPLY_INTEGER
+		   || range->element[1]->type != REDIS_REPLY_INTEGER)
+			continue;
+		master = range->element[2];
+		if(master->type != REDIS_REPLY_ARRAY || master->elements < 2
+		   || master->element[0]->type != REDIS_REPLY_STRING
+		   || master->element[1]->type != REDIS_REPLY_INTEGER)
+			continue;
+		CHKiRet(addNode(pWrkrData, master->element[0]->str, master->element[0]->len,
+			(int) master->element[1]->integer, &iNode));
+		for(slot = range->element[0]->integer ; slot <= range->element[1]->integer ; ++slot) {
+			if(slot >= 0 && slot < NUM_SLOTS)
+				pWrkrData->slots[slot] = iNode;
+		}
+	}
+
+finalize_it:
+	if(reply != NULL)
+		freeReplyObject(reply);
+	RETiRet;
+}
+
+/*  establish our connection to redis. The first reachable
+ *  configured server is used; in cluster mode, it tells us
+ *  about the other nodes */
+static rsRetVal initHiredis(wrkrInstanceData_t *pWrkrData, int bSilent)
+{
+	int i;
+	DEFiRet;
+
+	for(i = 0 ; i < pWrkrData->pData->nServers ; ++i) {
+		if((iRet = connectNode(pWrkrData, i, 1)) == RS_RET_OK)
+			break;
+	}
+	if(iRet != RS_RET_OK) {
 		if(!bSilent)
 			errmsg.LogError(0, RS_RET_SUSPENDED,
 				"can not initialize redis handle");
 		ABORT_FINALIZE(RS_RET_SUSPENDED);
 	}
+	pWrkrData->iActive = i;
+	if(pWrkrData->pData->cluster) {
+		iRet = refreshSlots(pWrkrData);
+		if(iRet != RS_RET_SUSPENDED)
+			iRet = RS_RET_OK; /* we can still work with the node we have */
+	}
 finalize_it:
 	RETiRet;
 }
 
-rsRetVal writeHiredis(uchar *message, wrkrInstanceData_t *pWrkrData)
+/*  obtain the (connected) node that serves a key */
+static rsRetVal nodeForKey(wrkrInstanceData_t *pWrkrData, const char *key, size_t lenKey,
+	int *piNode)
 {
+	int iNode = pWrkrData->iActive;
 	DEFiRet;
 
-	/*  if we do not have a redis connection, call
-	 *  initHiredis and try to establish one */
-	if(pWrkrData->conn == NULL)
-		CHKiRet(initHiredis(pWrkrData, 0));
+	if(pWrkrData->pData->cluster && key != NULL) {
+		const int iSlotNode = pWrkrData->slots[keySlot(key, lenKey)];
+		if(iSlotNode != -1)
+			iNode = iSlotNode;
+	}
+	CHKiRet(connectNode(pWrkrData, iNode, 0));
+	*piNode = iNode;
+finalize_it:
+	RETiRet;
+}
+
+/*  append a command to the pipeline of the node serving key.
+ *  The command is owned by the batch afterwards, even on error */
+static rsRetVal sendCmd(wrkrInstanceData_t *pWrkrData, pendCmd_t *cmd, const char *key,
+	size_t lenKey)
+{
+	pendCmd_t *newCmds;
+	redisContext *conn;
+	int rc;
+	DEFiRet;
+
+	if(pWrkrData->nCmds == pWrkrData->maxCmds) {
+		CHKmalloc(newCmds = realloc(pWrkrData->cmds,
+			(pWrkrData->maxCmds + 64) * sizeof(pendCmd_t)));
+		pWrkrData->cmds = newCmds;
+		pWrkrData->maxCmds += 64;
+	}
+	CHKiRet(nodeForKey(pWrkrData, key, lenKey, &cmd->iNode));
+	conn = pWrkrData->nodes[cmd->iNode].conn;
 
 	/*  try to append the command to the pipeline. 
 	 *  REDIS_ERR reply indicates something bad
-	 *  happened, in which case abort. otherwise
-	 *  increase our current pipeline count
-	 *  by 1 and continue. */
-	int rc;
-	rc = redisAppendCommand(pWrkrData->conn, (char*)message);
+	 *  happened, in which case abort. */
+	if(cmd->cmd != NULL)
+		rc = redisAppendCommand(conn, cmd->cmd);
+	else
+		rc = redisAppendCommandArgv(conn, cmd->argc, (const char**) cmd->argv,
+			cmd->argvlen);
 	if (rc == REDIS_ERR) {
-		errmsg.LogError(0, NO_ERRCODE, "omhiredis: %s", pWrkrData->conn->errstr);
-		dbgprintf("omhiredis: %s\n", pWrkrData->conn->errstr);
+		errmsg.LogError(0, NO_ERRCODE, "omhiredis: %s", conn->errstr);
+		dbgprintf("omhiredis: %s\n", conn->errstr);
 		ABORT_FINALIZE(RS_RET_ERR);
-	} else {
-		pWrkrData->count++;
+	}
+	pWrkrData->cmds[pWrkrData->nCmds++] = *cmd;
+	memset(cmd, 0, sizeof(pendCmd_t));
+
+finalize_it:
+	if(iRet != RS_RET_OK)
+		freeCmd(cmd);
+	RETiRet;
+}
+
+/*  the key of a command is its second word */
+static void getCmdKey(const char *cmd, const char **pKey, size_t *pLenKey)
+{
+	const char *p = cmd;
+
+	while(*p == ' ')
+		++p;
+	while(*p != ' ' && *p != '\0')
+		++p;
+	while(*p == ' ')
+		++p;
+	*pKey = p;
+	while(*p != ' ' && *p != '\0')
+		++p;
+	*pLenKey = p - *pKey;
+	if(*pLenKey == 0)
+		*pKey = NULL;
+}
+
+rsRetVal writeHiredis(uchar *message, wrkrInstanceData_t *pWrkrData)
+{
+	pendCmd_t cmd;
+	const char *key = NULL;
+	size_t lenKey = 0;
+	DEFiRet;
+
+	/*  if we do not have a redis connection, call
+	 *  initHiredis and try to establish one */
+	if(pWrkrData->nodes[pWrkrData->iActive].conn == NULL)
+		CHKiRet(initHiredis(pWrkrData, 0));
+
+	memset(&cmd, 0, sizeof(cmd));
+	CHKmalloc(cmd.cmd = strdup((char*)message));
+	if(pWrkrData->pData->cluster)
+		getCmdKey(cmd.cmd, &key, &lenKey);
+	CHKiRet(sendCmd(pWrkrData, &cmd, key, lenKey));
+
+finalize_it:
+	RETiRet;
+}
+
+static rsRetVal growGroup(pushGroup_t *grp)
+{
+	const int newMax = (grp->maxArgs == 0) ? 16 : grp->maxArgs * 2;
+	char **newArgv;
+	size_t *newArgvlen;
+	DEFiRet;
+
+	CHKmalloc(newArgv = realloc(grp->argv, newMax * sizeof(char*)));
+	grp->argv = newArgv;
+	CHKmalloc(newArgvlen = realloc(grp->argvlen, newMax * sizeof(size_t)));
+	grp->argvlen = newArgvlen;
+	grp->maxArgs = newMax;
+finalize_it:
+	RETiRet;
+}
+
+/*  start a new RPUSH command for key */
+static rsRetVal initGroup(pushGroup_t *grp, const char *key, size_t lenKey)
+{
+	DEFiRet;
+
+	CHKiRet(growGroup(grp));
+	CHKmalloc(grp->argv[0] = strdup("RPUSH"));
+	grp->argvlen[0] = sizeof("RPUSH") - 1;
+	grp->argc = 1;
+	CHKmalloc(grp->argv[1] = malloc(lenKey + 1));
+	memcpy(grp->argv[1], key, lenKey + 1);
+	grp->argvlen[1] = lenKey;
+	grp->argc = 2;
+finalize_it:
+	RETiRet;
+}
+
+/*  send the values collected for a key as a single RPUSH */
+static rsRetVal flushGroup(wrkrInstanceData_t *pWrkrData, pushGroup_t *grp)
+{
+	pendCmd_t cmd;
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.argc = grp->argc;
+	cmd.argv = grp->argv;
+	cmd.argvlen = grp->argvlen;
+	memset(grp, 0, sizeof(pushGroup_t));
+	return sendCmd(pWrkrData, &cmd, cmd.argv[1], cmd.argvlen[1]);
+}
+
+static rsRetVal flushGroups(wrkrInstanceData_t *pWrkrData)
+{
+	pushGroup_t *grp;
+	int i;
+	DEFiRet;
+
+	for(i = 0 ; i < pWrkrData->nGroups ; ++i) {
+		grp = &pWrkrData->groups[i];
+		if(grp->argc > 2) {
+			CHKiRet(flushGroup(pWrkrData, grp));
+		} else {
+			freeGroup(grp);
+		}
+	}
+	pWrkrData->nGroups = 0;
+finalize_it:
+	RETiRet;
+}
+
+/*  queue mode: add a value to the RPUSH command for its key */
+static rsRetVal pushValue(wrkrInstanceData_t *pWrkrData, uchar *key, uchar *value)
+{
+	const size_t lenKey = ustrlen(key);
+	pushGroup_t *grp = NULL;
+	int i;
+	DEFiRet;
+
+	if(pWrkrData->nodes[pWrkrData->iActive].conn == NULL)
+		CHKiRet(initHiredis(pWrkrData, 0));
+
+	for(i = 0 ; i < pWrkrData->nGroups ; ++i) {
+		if(pWrkrData->groups[i].argvlen[1] == lenKey
+		   && !memcmp(pWrkrData->groups[i].argv[1], key, lenKey)) {
+			grp = &pWrkrData->groups[i];
+			break;
+		}
+	}
+	if(grp == NULL) {
+		if(pWrkrData->nGroups == MAX_PUSH_KEYS)
+			CHKiRet(flushGroups(pWrkrData));
+		grp = &pWrkrData->groups[pWrkrData->nGroups++];
+		CHKiRet(initGroup(grp, (char*) key, lenKey));
+	}
+	if(grp->argc == grp->maxArgs)
+		CHKiRet(growGroup(grp));
+	CHKmalloc(grp->argv[grp->argc] = strdup((char*) value));
+	grp->argvlen[grp->argc++] = ustrlen(value);
+	if(grp->argc == MAX_PUSH_VALUES + 2) {
+		CHKiRet(flushGroup(pWrkrData, grp));
+		CHKiRet(initGroup(grp, (char*) key, lenKey));
 	}
 
 finalize_it:
 	RETiRet;
 }
 
+/*  re-send a command that was redirected by a
+ *  "MOVED <slot> <host>:<port>" or "ASK <slot> <host>:<port>" error.
+ *  MOVED also updates our slot table, ASK is a one-time
+ *  redirect while a slot is migrated */
+static rsRetVal redirectCmd(wrkrInstanceData_t *pWrkrData, pendCmd_t *cmd, sbool *pbFailed)
+{
+	const sbool bAsk = !strncmp(cmd->redirect, "ASK ", 4);
+	const char *host;
+	const char *colon;
+	redisContext *conn;
+	redisReply *reply = NULL;
+	int slot;
+	int iNode;
+	DEFiRet;
+
+	slot = atoi(cmd->redirect + (bAsk ? 4 : 6));
+	if((host = strchr(cmd->redirect + (bAsk ? 4 : 6), ' ')) == NULL
+	   || (colon = strrchr(host, ':')) == NULL) {
+		DBGPRINTF("omhiredis: invalid redirect '%s'\n", cmd->redirect);
+		*pbFailed = 1;
+		FINALIZE;
+	}
+	++host;
+	CHKiRet(addNode(pWrkrData, host, colon - host, atoi(colon + 1), &iNode));
+	if(!bAsk && slot >= 0 && slot < NUM_SLOTS)
+		pWrkrData->slots[slot] = iNode;
+	CHKiRet(connectNode(pWrkrData, iNode, 0));
+	conn = pWrkrData->nodes[iNode].conn;
+	if(bAsk) {
+		if((reply = redisCommand(conn, "ASKING")) == NULL)
+			goto connLost;
+		freeReplyObject(reply);
+	}
+	if(cmd->cmd != NULL)
+		reply = redisCommand(conn, cmd->cmd);
+	else
+		reply = redisCommandArgv(conn, cmd->argc, (const char**) cmd->argv, cmd->argvlen);
+	if(reply == NULL)
+		goto connLost;
+	*pbFailed = (reply->type == REDIS_REPLY_ERROR);
+	freeReplyObject(reply);
+	FINALIZE;
+
+connLost:
+	closeNode(&pWrkrData->nodes[iNode]);
+	iRet = RS_RET_SUSPENDED;
+finalize_it:
+	RETiRet;
+}
+
+/*  read the replies to all commands of the batch. Commands
+ *  that were redirected by the cluster are re-sent once all
+ *  pipelines are drained */
+static rsRetVal collectReplies(wrkrInstanceData_t *pWrkrData)
+{
+	redisReply *reply;
+	redisNode_t *node;
+	pendCmd_t *cmd;
+	sbool bFailed;
+	int nRedirects = 0;
+	int nFailed = 0;
+	char lastErr[128] = "";
+	int i;
+	DEFiRet;
+
+	for(i = 0 ; i < pWrkrData->nCmds ; ++i) {
+		cmd = &pWrkrData->cmds[i];
+		node = &pWrkrData->nodes[cmd->iNode];
+		if(node->conn == NULL || redisGetReply(node->conn, (void*) &reply) != REDIS_OK) {
+			errmsg.LogError(0, RS_RET_SUSPENDED, "omhiredis: lost connection to %s:%d",
+				node->host, node->port);
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		}
+		if(reply->type == REDIS_REPLY_ERROR) {
+			if(pWrkrData->pData->cluster && (!strncmp(reply->str, "MOVED ", 6)
+			   || !strncmp(reply->str, "ASK ", 4))) {
+				cmd->redirect = strdup(reply->str);
+				++nRedirects;
+			} else {
+				DBGPRINTF("omhiredis: command failed: %s\n", reply->str);
+				snprintf(lastErr, sizeof(lastErr), "%s", reply->str);
+				++nFailed;
+			}
+		}
+		freeReplyObject(reply);
+	}
+
+	for(i = 0 ; nRedirects > 0 && i < pWrkrData->nCmds ; ++i) {
+		cmd = &pWrkrData->cmds[i];
+		if(cmd->redirect == NULL)
+			continue;
+		bFailed = 0;
+		CHKiRet(redirectCmd(pWrkrData, cmd, &bFailed));
+		if(bFailed) {
+			snprintf(lastErr, sizeof(lastErr), "redirected command failed (%s)", cmd->redirect);
+			++nFailed;
+		}
+	}
+
+	if(nFailed > 0)
+		errmsg.LogError(0, RS_RET_ERR, "omhiredis: %d of %d commands failed, last error: %s",
+			nFailed, pWrkrData->nCmds, lastErr);
+
+finalize_it:
+	RETiRet;
+}
+
 /*  called when resuming from suspended state.
  *  try to restablish our connection to redis */
 BEGINtryResume
 CODESTARTtryResume
-	if(pWrkrData->conn == NULL)
+	if(pWrkrData->nodes[pWrkrData->iActive].conn == NULL)
 		iRet = initHiredis(pWrkrData, 0);
 ENDtryResume
 
@@ -185,48 +742,79 @@ ENDtryResume
 BEGINbeginTransaction
 CODESTARTbeginTransaction
 	dbgprintf("omhiredis: beginTransaction called\n");
-	pWrkrData->count = 0;
+	resetBatch(pWrkrData);
 ENDbeginTransaction
 
-/*  call writeHiredis for this log line,
- *  which appends it as a command to the
- *  current pipeline */
+/*  append this log line to the current pipeline: as a
+ *  command of its own in template mode, as a value for
+ *  the RPUSH of its key in queue mode */
 BEGINdoAction
+	instanceData *const pData = pWrkrData->pData;
 CODESTARTdoAction
-	CHKiRet(writeHiredis(ppString[0], pWrkrData));
+	if(pData->mode == HIREDIS_MODE_QUEUE) {
+		CHKiRet(pushValue(pWrkrData, pData->dynaKey ? ppString[1] : pData->key, ppString[0]));
+	} else {
+		CHKiRet(writeHiredis(ppString[0], pWrkrData));
+	}
 	iRet = RS_RET_DEFER_COMMIT;
 finalize_it:
+	if(iRet != RS_RET_OK && iRet != RS_RET_DEFER_COMMIT) {
+		closeHiredis(pWrkrData);
+		resetBatch(pWrkrData);
+	}
 ENDdoAction
 
 /*  called when we have reached the end of a
- *  batch (queue.dequeuebatchsize).  this
- *  iterates over the replies, putting them
- *  into the pData->replies buffer. we currently
- *  don't really bother to check for errors
- *  which should be fixed */
+ *  batch (queue.dequeuebatchsize). this sends
+ *  the coalesced RPUSH commands and then reads
+ *  the replies of all commands. */
 BEGINendTransaction
 CODESTARTendTransaction
 	dbgprintf("omhiredis: endTransaction called\n");
-	int i;
-	pWrkrData->replies = malloc ( sizeof ( redisReply* ) * pWrkrData->count );
-	for ( i = 0; i < pWrkrData->count; i++ ) {
-		redisGetReply ( pWrkrData->conn, (void *)&pWrkrData->replies[i] );
-		/*  TODO: add error checking here! */
-		freeReplyObject ( pWrkrData->replies[i] );
-	}
-	free ( pWrkrData->replies );
+	if(pWrkrData->pData->mode == HIREDIS_MODE_QUEUE)
+		CHKiRet(flushGroups(pWrkrData));
+	CHKiRet(collectReplies(pWrkrData));
+finalize_it:
+	if(iRet != RS_RET_OK)
+		closeHiredis(pWrkrData);
+	resetBatch(pWrkrData);
 ENDendTransaction
 
 /*  set defaults. note server is set to NULL 
- *  and is set to a default in initHiredis if 
- *  it is still null when it's called - I should
- *  probable just set the default here instead */
+ *  and is set to a default in newActInst if 
+ *  it is still null after the config is read */
 static inline void
 setInstParamDefaults(instanceData *pData)
 {
-	pData->server = NULL;
+	pData->serverHosts = NULL;
+	pData->serverPorts = NULL;
+	pData->nServers = 0;
 	pData->port = 6379;
 	pData->tplName = NULL;
+	pData->mode = HIREDIS_MODE_TEMPLATE;
+	pData->key = NULL;
+	pData->dynaKey = 0;
+	pData->cluster = 0;
+}
+
+/*  add a server given as "host" or "host:port" */
+static rsRetVal addServer(instanceData *pData, es_str_t *estr)
+{
+	char *server;
+	char *colon;
+	DEFiRet;
+
+	CHKmalloc(server = es_str2cstr(estr, NULL));
+	pData->serverHosts[pData->nServers] = server;
+	pData->serverPorts[pData->nServers] = pData->port;
+	++pData->nServers;
+	colon = strrchr(server, ':');
+	if(colon != NULL && strchr(server, ':') == colon) { /* not a plain IPv6 address */
+		*colon = '\0';
+		pData->serverPorts[pData->nServers - 1] = atoi(colon + 1);
+	}
+finalize_it:
+	RETiRet;
 }
 
 /*  here is where the work to set up a new instance
@@ -235,6 +823,8 @@ setInstParamDefaults(instanceData *pData)
  *  actions. */
 BEGINnewActInst
 	struct cnfparamvals *pvals;
+	struct cnfarray *servers = NULL;
+	char *mode;
 	int i;
 CODESTARTnewActInst
 	if((pvals = nvlstGetParams(lst, &actpblk, NULL)) == NULL)
@@ -243,30 +833,71 @@ CODESTARTnewActInst
 	CHKiRet(createInstance(&pData));
 	setInstParamDefaults(pData);
 
-	CODE_STD_STRING_REQUESTnewActInst(1)
 	for(i = 0 ; i < actpblk.nParams ; ++i) {
 		if(!pvals[i].bUsed)
 			continue;
 	
 		if(!strcmp(actpblk.descr[i].name, "server")) {
-			pData->server = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+			servers = pvals[i].val.d.ar;
 		} else if(!strcmp(actpblk.descr[i].name, "serverport")) {
 			pData->port = (int) pvals[i].val.d.n, NULL;
 		} else if(!strcmp(actpblk.descr[i].name, "template")) {
 			pData->tplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "mode")) {
+			mode = es_str2cstr(pvals[i].val.d.estr, NULL);
+			if(mode != NULL && !strcasecmp(mode, "template")) {
+				pData->mode = HIREDIS_MODE_TEMPLATE;
+			} else if(mode != NULL && !strcasecmp(mode, "queue")) {
+				pData->mode = HIREDIS_MODE_QUEUE;
+			} else {
+				errmsg.LogError(0, RS_RET_CONFIG_ERROR, "omhiredis: invalid "
+					"mode '%s', must be 'template' or 'queue'", mode);
+				free(mode);
+				ABORT_FINALIZE(RS_RET_CONFIG_ERROR);
+			}
+			free(mode);
+		} else if(!strcmp(actpblk.descr[i].name, "key")) {
+			pData->key = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "dynakey")) {
+			pData->dynaKey = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "cluster")) {
+			pData->cluster = (sbool) pvals[i].val.d.n;
 		} else {
 			dbgprintf("omhiredis: program error, non-handled "
 				"param '%s'\n", actpblk.descr[i].name);
 		}
 	}
 
-	if(pData->tplName == NULL) {
-		dbgprintf("omhiredis: action requires a template name");
-		ABORT_FINALIZE(RS_RET_MISSING_CNFPARAMS);
+	i = (servers == NULL) ? 1 : servers->nmemb;
+	CHKmalloc(pData->serverHosts = calloc(i, sizeof(char*)));
+	CHKmalloc(pData->serverPorts = calloc(i, sizeof(int)));
+	if(servers == NULL) {
+		CHKmalloc(pData->serverHosts[0] = strdup("127.0.0.1"));
+		pData->serverPorts[0] = pData->port;
+		pData->nServers = 1;
+	} else {
+		for(i = 0 ; i < servers->nmemb ; ++i)
+			CHKiRet(addServer(pData, servers->arr[i]));
+	}
+
+	if(pData->mode == HIREDIS_MODE_TEMPLATE) {
+		if(pData->tplName == NULL) {
+			dbgprintf("omhiredis: action requires a template name");
+			ABORT_FINALIZE(RS_RET_MISSING_CNFPARAMS);
+		}
+	} else if(pData->key == NULL) {
+		errmsg.LogError(0, RS_RET_CONFIG_ERROR, "omhiredis: queue mode "
+			"requires a key - action definition invalid");
+		ABORT_FINALIZE(RS_RET_CONFIG_ERROR);
 	}
 
+	CODE_STD_STRING_REQUESTnewActInst((pData->mode == HIREDIS_MODE_QUEUE && pData->dynaKey) ? 2 : 1)
 	/* template string 0 is just a regular string */
-	OMSRsetEntry(*ppOMSR, 0,(uchar*)pData->tplName, OMSR_NO_RQD_TPL_OPTS);
+	OMSRsetEntry(*ppOMSR, 0, (pData->tplName == NULL) ? ustrdup((uchar*)"RSYSLOG_ForwardFormat")
+		: pData->tplName, OMSR_NO_RQD_TPL_OPTS);
+	/* with dynakey, string 1 is the key */
+	if(pData->mode == HIREDIS_MODE_QUEUE && pData->dynaKey)
+		CHKiRet(OMSRsetEntry(*ppOMSR, 1, ustrdup(pData->key), OMSR_NO_RQD_TPL_OPTS));
 
 CODE_STD_FINALIZERnewActInst
 	cnfparamvalsDestruct(pvals, &actpblk);
@@ -312,5 +943,6 @@ CODEmodInit_QueryRegCFSLineHdlr
 		errmsg.LogError(0, NO_ERRCODE, "omhiredis: rsyslog core does not support batching - abort");
 		ABORT_FINALIZE(RS_RET_ERR);
 	}
+	initCRC16();
 	DBGPRINTF("omhiredis: module compiled with rsyslog version %s.\n", VERSION);
 ENDmodInit
@@ -34,13 +34,22 @@
 #include <signal.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#ifdef HAVE_MEMFD_CREATE
+#include <sys/mman.h>
+#endif
 #include "conf.h"
 #include "syslogd-types.h"
 #include "srUtils.h"
 #include "template.h"
 #include "module-template.h"
 #include "errmsg.h"
-#include <systemd/sd-journal.h>
+#include "unicode-helper.h"
 
 MODULE_TYPE_OUTPUT
 MODULE_TYPE_NOKEEP
@@ -50,14 +59,32 @@ MODULE_CNFNAME("omjournal")
 DEFobjCurrIf(errmsg);
 DEF_OMOD_STATIC_DATA
 
+/* Entries are sent to journald's native protocol socket ourselves rather
+ * than via sd_journal_send(), so that a whole batch goes out with a single
+ * sendmmsg() and no printf-style formatting is needed. From the template
+ * output, iovecs are built which point right into the template buffers.
+ * Entries too large for a datagram are passed via a sealed memfd, as
+ * sd_journal_sendv() does.
+ */
+#define DFLT_SOCKET "/run/systemd/journal/socket"
+#define DFLT_TEMPLATE "RSYSLOG_omjournalDfltFormat"
+#define MAX_BATCH 64	/* max number of entries per sendmmsg() call */
+
 /* config variables */
 
 
 typedef struct _instanceData {
+	uchar *tplName;		/* name of assigned template */
+	uchar *sockName;	/* journald socket */
 } instanceData;
 
 typedef struct wrkrInstanceData {
 	instanceData *pData;
+	int sock;		/* -1 if not connected */
+	struct iovec *iov;	/* iovecs of the entries of the current batch */
+	int maxIov;
+	uint64_t lenMsg[MAX_BATCH]; /* binary MESSAGE field length, little endian */
+	int iovIdx[MAX_BATCH+1];/* start of each entry in iov */
 } wrkrInstanceData_t;
 
 struct modConfData_s {
@@ -66,6 +93,17 @@ struct modConfData_s {
 static modConfData_t *loadModConf = NULL;/* modConf ptr to use for the current load process */
 static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current exec process */
 
+/* action (instance) parameters */
+static struct cnfparamdescr actpdescr[] = {
+	{ "template", eCmdHdlrGetWord, 0 },
+	{ "socket", eCmdHdlrGetWord, 0 }
+};
+static struct cnfparamblk actpblk =
+	{ CNFPARAMBLK_VERSION,
+	  sizeof(actpdescr)/sizeof(struct cnfparamdescr),
+	  actpdescr
+	};
+
 BEGINbeginCnfLoad
 CODESTARTbeginCnfLoad
 	loadModConf = pModConf;
@@ -97,6 +135,9 @@ ENDcreateInstance
 
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
+	pWrkrData->sock = -1;
+	pWrkrData->iov = NULL;
+	pWrkrData->maxIov = 0;
 ENDcreateWrkrInstance
 
 
@@ -107,61 +148,329 @@ ENDisCompatibleWithFeature
 
 BEGINfreeInstance
 CODESTARTfreeInstance
+	free(pData->tplName);
+	free(pData->sockName);
 ENDfreeInstance
 
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
+	if(pWrkrData->sock != -1)
+		close(pWrkrData->sock);
+	free(pWrkrData->iov);
 ENDfreeWrkrInstance
 
 
+static inline void
+setInstParamDefaults(instanceData *pData)
+{
+	pData->tplName = NULL;
+	pData->sockName = NULL;
+}
+
 BEGINnewActInst
+	struct cnfparamvals *pvals;
+	int i;
 CODESTARTnewActInst
-	/* Note: we currently do not have any parameters, so we do not need
-	 * the lst ptr. However, we will most probably need params in the 
-	 * future.
-	 */
-	(void) lst; /* prevent compiler warning */
-	DBGPRINTF("newActInst (mmjournal)\n");
-	CODE_STD_STRING_REQUESTnewActInst(1)
-	CHKiRet(OMSRsetEntry(*ppOMSR, 0, NULL, OMSR_TPL_AS_MSG));
+	DBGPRINTF("newActInst (omjournal)\n");
+
+	pvals = nvlstGetParams(lst, &actpblk, NULL);
+	if(pvals == NULL) {
+		ABORT_FINALIZE(RS_RET_MISSING_CNFPARAMS);
+	}
+	if(Debug) {
+		dbgprintf("action param blk in omjournal:\n");
+		cnfparamsPrint(&actpblk, pvals);
+	}
+
 	CHKiRet(createInstance(&pData));
-	/*setInstParamDefaults(pData);*/
+	setInstParamDefaults(pData);
+
+	for(i = 0 ; i < actpblk.nParams ; ++i) {
+		if(!pvals[i].bUsed)
+			continue;
+		if(!strcmp(actpblk.descr[i].name, "template")) {
+			pData->tplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "socket")) {
+			pData->sockName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else {
+			dbgprintf("omjournal: program error, non-handled "
+			  "param '%s'\n", actpblk.descr[i].name);
+		}
+	}
+	if(pData->sockName == NULL)
+		CHKmalloc(pData->sockName = ustrdup(UCHAR_CONSTANT(DFLT_SOCKET)));
+	if(ustrlen(pData->sockName) >= sizeof(((struct sockaddr_un*)NULL)->sun_path)) {
+		errmsg.LogError(0, RS_RET_INVALID_PARAMS, "omjournal: socket name '%s' "
+				"is too long", pData->sockName);
+		ABORT_FINALIZE(RS_RET_INVALID_PARAMS);
+	}
+
+	CODE_STD_STRING_REQUESTnewActInst(1)
+	CHKiRet(OMSRsetEntry(*ppOMSR, 0, ustrdup((pData->tplName == NULL) ?
+		UCHAR_CONSTANT(DFLT_TEMPLATE) : pData->tplName), OMSR_NO_RQD_TPL_OPTS));
 CODE_STD_FINALIZERnewActInst
-/*	cnfparamvalsDestruct(pvals, &actpblk);*/
+	cnfparamvalsDestruct(pvals, &actpblk);
 ENDnewActInst
 
 
 BEGINdbgPrintInstInfo
 CODESTARTdbgPrintInstInfo
+	dbgprintf("omjournal\n");
+	dbgprintf("\ttemplate='%s'\n", (pData->tplName == NULL) ? DFLT_TEMPLATE : (char*)pData->tplName);
+	dbgprintf("\tsocket='%s'\n", pData->sockName);
 ENDdbgPrintInstInfo
 
 
+static void
+closeJournal(wrkrInstanceData_t *pWrkrData)
+{
+	if(pWrkrData->sock != -1) {
+		close(pWrkrData->sock);
+		pWrkrData->sock = -1;
+	}
+}
+
+
+static rsRetVal
+openJournal(wrkrInstanceData_t *pWrkrData)
+{
+	struct sockaddr_un addr;
+	int sndbuf = 8*1024*1024;
+	DEFiRet;
+
+	if(pWrkrData->sock != -1)
+		FINALIZE;
+	if((pWrkrData->sock = socket(AF_UNIX, SOCK_DGRAM, 0)) == -1)
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	fcntl(pWrkrData->sock, F_SETFD, FD_CLOEXEC);
+	/* large entries need a large buffer, but if it fails, they are
+	 * passed via memfd anyhow
+	 */
+	setsockopt(pWrkrData->sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, (char*)pWrkrData->pData->sockName);
+	if(connect(pWrkrData->sock, (struct sockaddr*) &addr, sizeof(addr)) == -1) {
+		DBGPRINTF("omjournal: can not connect to '%s': %d\n", addr.sun_path, errno);
+		closeJournal(pWrkrData);
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
 BEGINtryResume
 CODESTARTtryResume
+	iRet = openJournal(pWrkrData);
 ENDtryResume
 
-BEGINdoAction
-	msg_t *pMsg;
-	uchar *tag;
-	int lenTag;
-	int sev;
-	int r;
-CODESTARTdoAction
-	pMsg = (msg_t*) ppString[0];
-	MsgGetSeverity(pMsg, &sev);
-	getTAG(pMsg, &tag, &lenTag);
-	/* we can use more properties here, but let's see if there
-	 * is some real user interest. We can always add later...
-	 */
-	r = sd_journal_send("MESSAGE=%s", getMSG(pMsg),
-                "PRIORITY=%d", sev,
-		"SYSLOG_FACILITY=%d", pMsg->iFacility,
-		"SYSLOG_IDENTIFIER=%s", tag,
-                NULL);
-	/* FIXME: think about what to do with errors ;) */
-	(void) r; /* prevent compiler warning */
-ENDdoAction
+
+BEGINbeginTransaction
+CODESTARTbeginTransaction
+	iRet = openJournal(pWrkrData);
+ENDbeginTransaction
+
+
+static inline rsRetVal
+addIov(wrkrInstanceData_t *pWrkrData, int *pnIov, void *base, size_t len)
+{
+	struct iovec *newIov;
+	DEFiRet;
+
+	if(*pnIov == pWrkrData->maxIov) {
+		CHKmalloc(newIov = realloc(pWrkrData->iov, (pWrkrData->maxIov + 256)
+			* sizeof(struct iovec)));
+		pWrkrData->iov = newIov;
+		pWrkrData->maxIov += 256;
+	}
+	pWrkrData->iov[*pnIov].iov_base = base;
+	pWrkrData->iov[*pnIov].iov_len = len;
+	++(*pnIov);
+finalize_it:
+	RETiRet;
+}
+
+
+/* build the iovecs of an entry from the template output. Each line is a
+ * KEY=value field and is passed on just as journald's native protocol
+ * expects it; lines without '=' are ignored. The MESSAGE field must come
+ * last: it extends to the end of the string, and if it spans multiple
+ * lines, it is sent in the binary-safe format (name, newline, 64 bit
+ * little endian length, value, newline).
+ */
+static rsRetVal
+buildEntry(wrkrInstanceData_t *pWrkrData, actWrkrIParams_t *param, uint64_t *pLenMsg,
+	int *pnIov)
+{
+	uchar *line = param->param;
+	uchar *const end = param->param + param->lenStr;
+	uchar *lineEnd;
+	uchar *val;
+	DEFiRet;
+
+	while(line < end) {
+		if(end - line >= 8 && !memcmp(line, "MESSAGE=", 8)) {
+			val = line + 8;
+			if(memchr(val, '\n', end - val) == NULL) {
+				CHKiRet(addIov(pWrkrData, pnIov, line, end - line));
+			} else {
+				*pLenMsg = htole64(end - val);
+				CHKiRet(addIov(pWrkrData, pnIov, "MESSAGE\n", 8));
+				CHKiRet(addIov(pWrkrData, pnIov, pLenMsg, sizeof(uint64_t)));
+				CHKiRet(addIov(pWrkrData, pnIov, val, end - val));
+			}
+			CHKiRet(addIov(pWrkrData, pnIov, "\n", 1));
+			break;
+		}
+		if((lineEnd = memchr(line, '\n', end - line)) == NULL)
+			lineEnd = end;
+		if(lineEnd > line && *line != '=' && memchr(line, '=', lineEnd - line) != NULL) {
+			if(lineEnd == end) {
+				CHKiRet(addIov(pWrkrData, pnIov, line, lineEnd - line));
+				CHKiRet(addIov(pWrkrData, pnIov, "\n", 1));
+			} else {
+				CHKiRet(addIov(pWrkrData, pnIov, line, lineEnd - line + 1));
+			}
+		}
+		line = lineEnd + 1;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* send an entry that is too large for a datagram. The entry is written
+ * to a sealed memfd (or an unlinked file on tmpfs, if memfds are not
+ * available), whose descriptor is passed to journald.
+ */
+static rsRetVal
+sendLargeEntry(wrkrInstanceData_t *pWrkrData, struct msghdr *mh)
+{
+	struct msghdr fdmh;
+	struct cmsghdr *cm;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} ctl;
+	size_t lenEntry = 0;
+	size_t i;
+	int fd = -1;
+#	ifndef HAVE_MEMFD_CREATE
+	char tmpName[] = "/dev/shm/omjournal-XXXXXX";
+#	endif
+	DEFiRet;
+
+	for(i = 0 ; i < mh->msg_iovlen ; ++i)
+		lenEntry += mh->msg_iov[i].iov_len;
+#	ifdef HAVE_MEMFD_CREATE
+	fd = memfd_create("omjournal", MFD_ALLOW_SEALING | MFD_CLOEXEC);
+#	else
+	if((fd = mkstemp(tmpName)) != -1)
+		unlink(tmpName);
+#	endif
+	if(fd == -1 || writev(fd, mh->msg_iov, mh->msg_iovlen) != (ssize_t) lenEntry) {
+		DBGPRINTF("omjournal: can not write large entry to temporary file: %d\n", errno);
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+#	ifdef HAVE_MEMFD_CREATE
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#	endif
+
+	memset(&fdmh, 0, sizeof(fdmh));
+	memset(&ctl, 0, sizeof(ctl));
+	fdmh.msg_control = ctl.buf;
+	fdmh.msg_controllen = sizeof(ctl.buf);
+	cm = CMSG_FIRSTHDR(&fdmh);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+	if(sendmsg(pWrkrData->sock, &fdmh, MSG_NOSIGNAL) == -1) {
+		DBGPRINTF("omjournal: can not pass large entry to journal: %d\n", errno);
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+
+finalize_it:
+	if(fd != -1)
+		close(fd);
+	RETiRet;
+}
+
+
+/* send a batch of at most MAX_BATCH entries */
+static rsRetVal
+sendBatch(wrkrInstanceData_t *pWrkrData, actWrkrIParams_t *const pParams, const unsigned nParams)
+{
+	struct mmsghdr mmh[MAX_BATCH];
+	unsigned nEntries = 0;
+	unsigned i;
+	int nIov = 0;
+	int nSent;
+	DEFiRet;
+
+	for(i = 0 ; i < nParams ; ++i) {
+		pWrkrData->iovIdx[nEntries] = nIov;
+		CHKiRet(buildEntry(pWrkrData, &actParam(pParams, 1, i, 0),
+			&pWrkrData->lenMsg[nEntries], &nIov));
+		if(nIov > pWrkrData->iovIdx[nEntries])
+			++nEntries; /* skip entries without any field */
+	}
+	pWrkrData->iovIdx[nEntries] = nIov;
+	/* the iov array may have been moved while it was built */
+	memset(mmh, 0, sizeof(mmh));
+	for(i = 0 ; i < nEntries ; ++i) {
+		mmh[i].msg_hdr.msg_iov = pWrkrData->iov + pWrkrData->iovIdx[i];
+		mmh[i].msg_hdr.msg_iovlen = pWrkrData->iovIdx[i+1] - pWrkrData->iovIdx[i];
+	}
+
+	i = 0;
+	while(i < nEntries) {
+#		ifdef HAVE_SENDMMSG
+		nSent = sendmmsg(pWrkrData->sock, mmh + i, nEntries - i, MSG_NOSIGNAL);
+#		else
+		nSent = (sendmsg(pWrkrData->sock, &mmh[i].msg_hdr, MSG_NOSIGNAL) == -1) ? -1 : 1;
+#		endif
+		if(nSent > 0) {
+			i += nSent;
+		} else if(errno == EMSGSIZE || errno == ENOBUFS) {
+			/* entries that can not be passed via memfd are lost, there
+			 * is no point in retrying them
+			 */
+			if(sendLargeEntry(pWrkrData, &mmh[i].msg_hdr) == RS_RET_SUSPENDED)
+				ABORT_FINALIZE(RS_RET_SUSPENDED);
+			++i;
+		} else if(errno != EINTR) {
+			DBGPRINTF("omjournal: error %d sending to journal, suspending\n", errno);
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		}
+	}
+
+finalize_it:
+	if(iRet == RS_RET_SUSPENDED)
+		closeJournal(pWrkrData);
+	RETiRet;
+}
+
+
+/* the batch is sent in chunks, each one with a single system call. If
+ * journald becomes unavailable, the action is suspended and the whole
+ * transaction retried later, so entries already sent may be duplicated.
+ */
+BEGINcommitTransaction
+	unsigned i;
+	unsigned n;
+CODESTARTcommitTransaction
+	CHKiRet(openJournal(pWrkrData));
+	for(i = 0 ; i < nParams ; i += n) {
+		n = (nParams - i > MAX_BATCH) ? MAX_BATCH : nParams - i;
+		CHKiRet(sendBatch(pWrkrData, &actParam(pParams, 1, i, 0), n));
+	}
+finalize_it:
+ENDcommitTransaction
 
 
 BEGINparseSelectorAct
@@ -185,7 +494,7 @@ ENDmodExit
 
 BEGINqueryEtryPt
 CODESTARTqueryEtryPt
-CODEqueryEtryPt_STD_OMOD_QUERIES
+CODEqueryEtryPt_STD_OMODTX_QUERIES
 CODEqueryEtryPt_STD_OMOD8_QUERIES
 CODEqueryEtryPt_STD_CONF2_OMOD_QUERIES
 CODEqueryEtryPt_STD_CONF2_QUERIES
@@ -42,6 +42,7 @@
 #include <errno.h>
 #include <netdb.h>
 #include <time.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include "conf.h"
 #include "syslogd-types.h"
@@ -51,6 +52,7 @@
 #include "errmsg.h"
 #include "datetime.h"
 #include "glbl.h"
+#include "unicode-helper.h"
 
 MODULE_TYPE_OUTPUT
 MODULE_TYPE_NOKEEP
@@ -84,6 +86,18 @@ typedef struct _instanceData {
 			toRcpt_t *lstRcpt;
 			} smtp;
 	} md;	/* mode-specific data */
+	struct {	/* digest mode: messages are collected and sent as one mail */
+		int iInterval;	/* max secs a message is held back, 0 = digest mode off */
+		int iMaxMsgs;	/* max messages per digest */
+		pthread_mutex_t mut;	/* guards everything below */
+		uchar *pszSubject;	/* subject of the first message */
+		char *pBuf;	/* the digest body */
+		size_t lenBuf;
+		size_t sizeBuf;
+		int nMsgs;
+		time_t tStart;	/* when the first message was added */
+	} digest;
+	struct _instanceData *pNextDigest;	/* list of digest instances, for the flusher */
 } instanceData;
 
 typedef struct wrkrInstanceData {
@@ -93,7 +107,8 @@ typedef struct wrkrInstanceData {
 			char RcvBuf[1024]; /* buffer for receiving server responses */
 			size_t lenRcvBuf;
 			size_t iRcvBuf;	/* current index into the rcvBuf (buf empty if iRcvBuf == lenRcvBuf) */
-			int sock;	/* socket to this server (most important when we do multiple msgs per mail) */
+			int sock;	/* socket to this server, kept open between mails */
+			int bPipelining; /* server supports the PIPELINING extension */
 			} smtp;
 	} md;	/* mode-specific data */
 } wrkrInstanceData_t;
@@ -105,6 +120,8 @@ typedef struct configSettings_s {
 	uchar *pszFrom;
 	uchar *pszSubject;
 	int bEnableBody; /* should a mail body be generated? (set to 0 eg for SMS gateways) */
+	int iDigestInterval;
+	int iDigestMaxMsgs;
 } configSettings_t;
 static configSettings_t cs;
 
@@ -116,11 +133,25 @@ CODESTARTinitConfVars
 	cs.pszFrom = NULL;
 	cs.pszSubject = NULL;
 	cs.bEnableBody = 1; /* should a mail body be generated? (set to 0 eg for SMS gateways) */
+	cs.iDigestInterval = 0;
+	cs.iDigestMaxMsgs = 100;
 ENDinitConfVars
 
+/* flusher thread, sends digests whose interval has expired even if no new
+ * messages arrive
+ */
+static instanceData *lstDigest = NULL;	/* instances in digest mode */
+static pthread_t flusherTid;
+static int bFlusherRunning = 0;
+static int bFlusherStop = 0;
+static pthread_mutex_t mutFlusher = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t condFlusher = PTHREAD_COND_INITIALIZER;
+
 /* forward definitions (as few as possible) */
 static rsRetVal Send(int sock, char *msg, size_t len);
 static rsRetVal readResponse(wrkrInstanceData_t *pWrkrData, int *piState, int iExpected);
+static rsRetVal sendSMTP(wrkrInstanceData_t *pWrkrData, uchar *body, uchar *subject);
+static rsRetVal serverDisconnect(wrkrInstanceData_t *pWrkrData);
 
 
 /* helpers for handling the recipient lists */
@@ -194,6 +225,179 @@ finalize_it:
 }
 /* end helpers for handling the recipient lists */
 
+/* helpers for digest mode */
+
+/* add a message body to the digest, caller must hold the digest mutex */
+static rsRetVal
+digestAppend(instanceData *pData, uchar *body)
+{
+	size_t lenBody;
+	size_t lenNeeded;
+	char *pNewBuf;
+	DEFiRet;
+
+	lenBody = pData->bEnableBody ? ustrlen(body) : 0;
+	lenNeeded = pData->digest.lenBuf + lenBody + sizeof("\r\n");
+	if(lenNeeded > pData->digest.sizeBuf) {
+		CHKmalloc(pNewBuf = realloc(pData->digest.pBuf, lenNeeded + 4096));
+		pData->digest.pBuf = pNewBuf;
+		pData->digest.sizeBuf = lenNeeded + 4096;
+	}
+	memcpy(pData->digest.pBuf + pData->digest.lenBuf, body, lenBody);
+	pData->digest.lenBuf += lenBody;
+	if(lenBody == 0 || body[lenBody-1] != '\n') {
+		memcpy(pData->digest.pBuf + pData->digest.lenBuf, "\r\n", 2);
+		pData->digest.lenBuf += 2;
+	}
+	pData->digest.pBuf[pData->digest.lenBuf] = '\0';
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* check if the digest must be sent, caller must hold the digest mutex */
+static inline int
+digestDue(instanceData *pData, time_t tNow)
+{
+	return pData->digest.nMsgs > 0
+	       && (pData->digest.nMsgs >= pData->digest.iMaxMsgs
+	           || tNow >= pData->digest.tStart + pData->digest.iInterval
+	           || tNow < pData->digest.tStart);
+}
+
+
+/* send the digest and reset it if that succeeded. The subject is the one
+ * of the first message plus the number of additional messages. Caller must
+ * hold the digest mutex.
+ */
+static rsRetVal
+digestSend(wrkrInstanceData_t *pWrkrData)
+{
+	instanceData *pData = pWrkrData->pData;
+	char szSubject[1024];
+	DEFiRet;
+
+	if(pData->digest.nMsgs > 1) {
+		snprintf(szSubject, sizeof(szSubject), "%s (+%d more)",
+			 (char*)pData->digest.pszSubject, pData->digest.nMsgs - 1);
+	} else {
+		snprintf(szSubject, sizeof(szSubject), "%s", (char*)pData->digest.pszSubject);
+	}
+	DBGPRINTF("ommail: sending digest of %d messages\n", pData->digest.nMsgs);
+	CHKiRet(sendSMTP(pWrkrData, (uchar*)pData->digest.pBuf, (uchar*)szSubject));
+	pData->digest.nMsgs = 0;
+	pData->digest.lenBuf = 0;
+	free(pData->digest.pszSubject);
+	pData->digest.pszSubject = NULL;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* add a message to the digest. A digest that is due is sent before the new
+ * message is added, so that if this fails, the action can be retried with
+ * the very same message.
+ */
+static rsRetVal
+digestAdd(wrkrInstanceData_t *pWrkrData, uchar *body, uchar *subject)
+{
+	instanceData *pData = pWrkrData->pData;
+	time_t tNow;
+	DEFiRet;
+
+	datetime.GetTime(&tNow);
+	pthread_mutex_lock(&pData->digest.mut);
+	if(digestDue(pData, tNow))
+		CHKiRet(digestSend(pWrkrData));
+	if(pData->digest.nMsgs == 0) {
+		free(pData->digest.pszSubject);
+		CHKmalloc(pData->digest.pszSubject = ustrdup(subject));
+		pData->digest.tStart = tNow;
+	}
+	CHKiRet(digestAppend(pData, body));
+	++pData->digest.nMsgs;
+
+finalize_it:
+	pthread_mutex_unlock(&pData->digest.mut);
+	RETiRet;
+}
+
+
+/* send a digest from a non-worker thread, via a temporary connection */
+static void
+digestSendNoWrkr(instanceData *pData)
+{
+	wrkrInstanceData_t wrkr;
+
+	memset(&wrkr, 0, sizeof(wrkr));
+	wrkr.pData = pData;
+	wrkr.md.smtp.sock = -1;
+	if(digestSend(&wrkr) != RS_RET_OK) {
+		errmsg.LogError(0, RS_RET_SUSPENDED, "ommail: could not send digest of %d "
+				"messages, will retry", pData->digest.nMsgs);
+	}
+	serverDisconnect(&wrkr);
+}
+
+
+static void *
+flusherThread(void __attribute__((unused)) *arg)
+{
+	struct timespec t;
+	instanceData *pData;
+	time_t tNow;
+
+	pthread_mutex_lock(&mutFlusher);
+	while(!bFlusherStop) {
+		timeoutComp(&t, 1000);
+		pthread_cond_timedwait(&condFlusher, &mutFlusher, &t);
+		if(bFlusherStop)
+			break;
+		datetime.GetTime(&tNow);
+		for(pData = lstDigest ; pData != NULL ; pData = pData->pNextDigest) {
+			pthread_mutex_lock(&pData->digest.mut);
+			if(digestDue(pData, tNow))
+				digestSendNoWrkr(pData);
+			pthread_mutex_unlock(&pData->digest.mut);
+		}
+	}
+	pthread_mutex_unlock(&mutFlusher);
+	return NULL;
+}
+
+static void
+startFlusher(void)
+{
+	if(!bFlusherRunning) {
+		bFlusherStop = 0;
+		if(pthread_create(&flusherTid, NULL, flusherThread, NULL) == 0) {
+			bFlusherRunning = 1;
+		} else {
+			errmsg.LogError(errno, RS_RET_ERR, "ommail: could not start flusher "
+					"thread, digests are only sent when new messages arrive");
+		}
+	}
+}
+
+static void
+stopFlusher(void)
+{
+	pthread_mutex_lock(&mutFlusher);
+	if(!bFlusherRunning) {
+		pthread_mutex_unlock(&mutFlusher);
+		return;
+	}
+	bFlusherStop = 1;
+	pthread_cond_signal(&condFlusher);
+	pthread_mutex_unlock(&mutFlusher);
+	pthread_join(flusherTid, NULL);
+	bFlusherRunning = 0;
+}
+
+/* end helpers for digest mode */
+
 BEGINcreateInstance
 CODESTARTcreateInstance
 ENDcreateInstance
@@ -201,6 +405,7 @@ ENDcreateInstance
 
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
+	pWrkrData->md.smtp.sock = -1;
 ENDcreateWrkrInstance
 
 
@@ -212,7 +417,26 @@ ENDisCompatibleWithFeature
 
 
 BEGINfreeInstance
+	instanceData **ppData;
 CODESTARTfreeInstance
+	if(pData->digest.iInterval > 0) {
+		pthread_mutex_lock(&mutFlusher);
+		for(ppData = &lstDigest ; *ppData != NULL ; ppData = &(*ppData)->pNextDigest) {
+			if(*ppData == pData) {
+				*ppData = pData->pNextDigest;
+				break;
+			}
+		}
+		pthread_mutex_unlock(&mutFlusher);
+		/* try to not lose what is still pending */
+		pthread_mutex_lock(&pData->digest.mut);
+		if(pData->digest.nMsgs > 0)
+			digestSendNoWrkr(pData);
+		pthread_mutex_unlock(&pData->digest.mut);
+		pthread_mutex_destroy(&pData->digest.mut);
+		free(pData->digest.pszSubject);
+		free(pData->digest.pBuf);
+	}
 	if(pData->iMode == 0) {
 		free(pData->md.smtp.pszSrv);
 		free(pData->md.smtp.pszSrvPort);
@@ -224,6 +448,11 @@ ENDfreeInstance
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
+	if(pWrkrData->md.smtp.sock != -1) {
+		/* politely end the session we kept open, but do not wait for the reply */
+		Send(pWrkrData->md.smtp.sock, "QUIT\r\n",   sizeof("QUIT\r\n") - 1);
+		serverDisconnect(pWrkrData);
+	}
 ENDfreeWrkrInstance
 
 
@@ -372,10 +601,11 @@ Send(int sock, char *msg, size_t len)
 				dbgprintf("message not (tcp)send, errno %d", errno);
 				ABORT_FINALIZE(RS_RET_TCP_SEND_ERROR);
 			}
-		} else if(lenSend != (ssize_t) len) {
-			offsBuf += len; /* on to next round... */
 		} else {
-			FINALIZE;
+			offsBuf += lenSend;
+			if(offsBuf == len)
+				FINALIZE;
+			/* else on to next round... */
 		}
 	} while(1);
 
@@ -516,35 +746,83 @@ mkSMTPTimestamp(uchar *pszBuf, size_t lenBuf)
 }
 
 
-/* send a message via SMTP
- * rgerhards, 2008-04-04
+/* open a SMTP session: connect and introduce ourselves. We try EHLO first
+ * to learn if the server supports PIPELINING and fall back to HELO if the
+ * server does not understand it.
  */
 static rsRetVal
-sendSMTP(wrkrInstanceData_t *pWrkrData, uchar *body, uchar *subject)
+smtpOpen(wrkrInstanceData_t *pWrkrData)
 {
 	DEFiRet;
 	int iState; /* SMTP state */
-	instanceData *pData;
-	uchar szDateBuf[64];
-	
-	pData = pWrkrData->pData;
+	int bCont;
+	char buf[128];
 
+	pWrkrData->md.smtp.bPipelining = 0;
+	pWrkrData->md.smtp.iRcvBuf = 0;
+	pWrkrData->md.smtp.lenRcvBuf = 0;
 	CHKiRet(serverConnect(pWrkrData));
 	CHKiRet(readResponse(pWrkrData, &iState, 220));
 
-	CHKiRet(Send(pWrkrData->md.smtp.sock, "HELO ", 5));
+	CHKiRet(Send(pWrkrData->md.smtp.sock, "EHLO ", 5));
 	CHKiRet(Send(pWrkrData->md.smtp.sock, (char*)glbl.GetLocalHostName(), strlen((char*)glbl.GetLocalHostName())));
 	CHKiRet(Send(pWrkrData->md.smtp.sock, "\r\n", sizeof("\r\n") - 1));
-	CHKiRet(readResponse(pWrkrData, &iState, 250));
+	do {
+		CHKiRet(readResponseLn(pWrkrData, buf, sizeof(buf)));
+		if(strlen(buf) < 4)
+			break;
+		bCont = (buf[3] == '-');
+		if(!strncasecmp(buf + 4, "PIPELINING", sizeof("PIPELINING") - 1))
+			pWrkrData->md.smtp.bPipelining = 1;
+	} while(bCont);
+
+	if(strncmp(buf, "250", 3)) {
+		pWrkrData->md.smtp.bPipelining = 0;
+		CHKiRet(Send(pWrkrData->md.smtp.sock, "HELO ", 5));
+		CHKiRet(Send(pWrkrData->md.smtp.sock, (char*)glbl.GetLocalHostName(), strlen((char*)glbl.GetLocalHostName())));
+		CHKiRet(Send(pWrkrData->md.smtp.sock, "\r\n", sizeof("\r\n") - 1));
+		CHKiRet(readResponse(pWrkrData, &iState, 250));
+	}
+	DBGPRINTF("ommail: SMTP session opened, pipelining %ssupported\n",
+		  pWrkrData->md.smtp.bPipelining ? "" : "not ");
+
+finalize_it:
+	if(iRet != RS_RET_OK)
+		serverDisconnect(pWrkrData);
+	RETiRet;
+}
+
+
+/* send a single mail over an open SMTP session. With PIPELINING, the
+ * envelope commands are sent in one go and the responses read afterwards.
+ * rgerhards, 2008-04-04
+ */
+static rsRetVal
+smtpTransaction(wrkrInstanceData_t *pWrkrData, uchar *body, uchar *subject)
+{
+	DEFiRet;
+	int iState; /* SMTP state */
+	instanceData *pData;
+	toRcpt_t *pRcpt;
+	uchar szDateBuf[64];
+	
+	pData = pWrkrData->pData;
 
 	CHKiRet(Send(pWrkrData->md.smtp.sock, "MAIL FROM:<", sizeof("MAIL FROM:<") - 1));
 	CHKiRet(Send(pWrkrData->md.smtp.sock, (char*)pData->md.smtp.pszFrom, strlen((char*)pData->md.smtp.pszFrom)));
 	CHKiRet(Send(pWrkrData->md.smtp.sock, ">\r\n", sizeof(">\r\n") - 1));
-	CHKiRet(readResponse(pWrkrData, &iState, 250));
+	if(!pWrkrData->md.smtp.bPipelining)
+		CHKiRet(readResponse(pWrkrData, &iState, 250));
 
-	CHKiRet(WriteRcpts(pWrkrData, (uchar*)"RCPT TO", sizeof("RCPT TO") - 1, 250));
+	CHKiRet(WriteRcpts(pWrkrData, (uchar*)"RCPT TO", sizeof("RCPT TO") - 1,
+			   pWrkrData->md.smtp.bPipelining ? -1 : 250));
 
 	CHKiRet(Send(pWrkrData->md.smtp.sock, "DATA\r\n",   sizeof("DATA\r\n") - 1));
+	if(pWrkrData->md.smtp.bPipelining) {
+		CHKiRet(readResponse(pWrkrData, &iState, 250)); /* MAIL FROM */
+		for(pRcpt = pData->md.smtp.lstRcpt ; pRcpt != NULL ; pRcpt = pRcpt->pNext)
+			CHKiRet(readResponse(pWrkrData, &iState, 250));
+	}
 	CHKiRet(readResponse(pWrkrData, &iState, 354));
 
 	/* now come the data part */
@@ -574,13 +852,35 @@ sendSMTP(wrkrInstanceData_t *pWrkrData, uchar *body, uchar *subject)
 	CHKiRet(Send(pWrkrData->md.smtp.sock, "\r\n.\r\n",   sizeof("\r\n.\r\n") - 1));
 	CHKiRet(readResponse(pWrkrData, &iState, 250));
 
-	CHKiRet(Send(pWrkrData->md.smtp.sock, "QUIT\r\n",   sizeof("QUIT\r\n") - 1));
-	CHKiRet(readResponse(pWrkrData, &iState, 221));
+finalize_it:
+	RETiRet;
+}
+
 
-	/* we are finished, a new connection is created for each request, so let's close it now */
-	CHKiRet(serverDisconnect(pWrkrData));
+/* send a message via SMTP. The session is kept open for the next mail.
+ * If a transaction fails on a session we kept open, the server has most
+ * probably closed it meanwhile, so we retry once with a new session.
+ */
+static rsRetVal
+sendSMTP(wrkrInstanceData_t *pWrkrData, uchar *body, uchar *subject)
+{
+	int bReused;
+	DEFiRet;
+
+	bReused = (pWrkrData->md.smtp.sock != -1);
+	if(!bReused)
+		CHKiRet(smtpOpen(pWrkrData));
+	iRet = smtpTransaction(pWrkrData, body, subject);
+	if(iRet != RS_RET_OK && bReused) {
+		DBGPRINTF("ommail: transaction failed on kept-open session, reconnecting\n");
+		serverDisconnect(pWrkrData);
+		CHKiRet(smtpOpen(pWrkrData));
+		iRet = smtpTransaction(pWrkrData, body, subject);
+	}
 	
 finalize_it:
+	if(iRet != RS_RET_OK)
+		serverDisconnect(pWrkrData);
 	RETiRet;
 }
 
@@ -598,6 +898,7 @@ finalize_it:
  */
 BEGINtryResume
 CODESTARTtryResume
+	serverDisconnect(pWrkrData);
 	CHKiRet(serverConnect(pWrkrData));
 	CHKiRet(serverDisconnect(pWrkrData)); /* if we fail, we will never reach this line */
 finalize_it:
@@ -610,9 +911,15 @@ BEGINdoAction
 CODESTARTdoAction
 	DBGPRINTF(" Mail\n");
 
-	iRet = sendSMTP(pWrkrData, ppString[0],
-			 (pWrkrData->pData->bHaveSubject) ?
-			      ppString[1] : (uchar*)"message from rsyslog");
+	if(pWrkrData->pData->digest.iInterval > 0) {
+		iRet = digestAdd(pWrkrData, ppString[0],
+				 (pWrkrData->pData->bHaveSubject) ?
+				      ppString[1] : (uchar*)"message from rsyslog");
+	} else {
+		iRet = sendSMTP(pWrkrData, ppString[0],
+				 (pWrkrData->pData->bHaveSubject) ?
+				      ppString[1] : (uchar*)"message from rsyslog");
+	}
 		
 	if(iRet != RS_RET_OK) {
 		DBGPRINTF("error sending mail, suspending\n");
@@ -661,6 +968,16 @@ CODESTARTparseSelectorAct
 	if(cs.pszSrvPort != NULL)
 		pData->md.smtp.pszSrvPort = (uchar*) strdup((char*)cs.pszSrvPort);
 	pData->bEnableBody = cs.bEnableBody;
+	if(cs.iDigestInterval > 0) {
+		pData->digest.iInterval = cs.iDigestInterval;
+		pData->digest.iMaxMsgs = (cs.iDigestMaxMsgs < 1) ? 1 : cs.iDigestMaxMsgs;
+		pthread_mutex_init(&pData->digest.mut, NULL);
+		pthread_mutex_lock(&mutFlusher);
+		pData->pNextDigest = lstDigest;
+		lstDigest = pData;
+		startFlusher();
+		pthread_mutex_unlock(&mutFlusher);
+	}
 
 	/* process template */
 	CHKiRet(cflineParseTemplateName(&p, *ppOMSR, 0, OMSR_NO_RQD_TPL_OPTS, (uchar*) "RSYSLOG_FileFormat"));
@@ -689,6 +1006,7 @@ static rsRetVal freeConfigVariables(void)
 BEGINmodExit
 CODESTARTmodExit
 	/* cleanup our allocations */
+	stopFlusher();
 	freeConfigVariables();
 
 	/* release what we no longer need */
@@ -712,6 +1030,8 @@ static rsRetVal resetConfigVariables(uchar __attribute__((unused)) *pp, void __a
 {
 	DEFiRet;
 	cs.bEnableBody = 1;
+	cs.iDigestInterval = 0;
+	cs.iDigestMaxMsgs = 100;
 	iRet = freeConfigVariables();
 	RETiRet;
 }
@@ -735,6 +1055,8 @@ CODEmodInit_QueryRegCFSLineHdlr
 	CHKiRet(omsdRegCFSLineHdlr(	(uchar *)"actionmailto", 0, eCmdHdlrGetWord, addRcpt, NULL, STD_LOADABLE_MODULE_ID));
 	CHKiRet(omsdRegCFSLineHdlr(	(uchar *)"actionmailsubject", 0, eCmdHdlrGetWord, NULL, &cs.pszSubject, STD_LOADABLE_MODULE_ID));
 	CHKiRet(omsdRegCFSLineHdlr(	(uchar *)"actionmailenablebody", 0, eCmdHdlrBinary, NULL, &cs.bEnableBody, STD_LOADABLE_MODULE_ID));
+	CHKiRet(omsdRegCFSLineHdlr(	(uchar *)"actionmaildigestinterval", 0, eCmdHdlrInt, NULL, &cs.iDigestInterval, STD_LOADABLE_MODULE_ID));
+	CHKiRet(omsdRegCFSLineHdlr(	(uchar *)"actionmaildigestmaxmessages", 0, eCmdHdlrInt, NULL, &cs.iDigestMaxMsgs, STD_LOADABLE_MODULE_ID));
 	CHKiRet(omsdRegCFSLineHdlr(	(uchar *)"resetconfigvariables", 1, eCmdHdlrCustomHandler, resetConfigVariables, NULL, STD_LOADABLE_MODULE_ID));
 ENDmodInit
 
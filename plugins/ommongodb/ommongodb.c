@@ -42,6 +42,7 @@
 #include "syslogd-types.h"
 #include "srUtils.h"
 #include "template.h"
+#include "rsconf.h"
 #include "module-template.h"
 #include "datetime.h"
 #include "errmsg.h"
@@ -58,8 +59,6 @@ DEFobjCurrIf(errmsg)
 DEFobjCurrIf(datetime)
 
 typedef struct _instanceData {
-	mongo_sync_connection *conn;
-	struct json_tokener *json_tokener; /* only if (tplName != NULL) */
 	uchar *server;
 	int port;
         uchar *db;
@@ -68,11 +67,22 @@ typedef struct _instanceData {
 	uchar *pwd;
 	uchar *dbNcoll;
 	uchar *tplName;
-	int bErrMsgPermitted;	/* only one errmsg permitted per connection */
+	struct template *pTpl;	/* resolved tplName, documents are built from its entries */
+	sbool bOrdered;		/* stop a bulk insert at the first failing document? */
+	int bulkMaxDocs;	/* max documents sent in a single insert */
+	int wcW;		/* write concern: w (0 = unacknowledged) */
+	int wcWTimeout;		/* write concern: wtimeout in ms */
+	sbool wcJ;		/* write concern: wait for journal commit */
 } instanceData;
 
 typedef struct wrkrInstanceData {
 	instanceData *pData;
+	mongo_sync_connection *conn;
+	int bErrMsgPermitted;	/* only one errmsg permitted per connection */
+	bson **docs;		/* documents of the current batch, not yet sent */
+	int nDocs;
+	int maxDocs;
+	size_t lenDocs;		/* sum of the BSON sizes in docs */
 } wrkrInstanceData_t;
 
 
@@ -85,7 +95,12 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "collection", eCmdHdlrGetWord, 0 },
 	{ "uid", eCmdHdlrGetWord, 0 },
 	{ "pwd", eCmdHdlrGetWord, 0 },
-	{ "template", eCmdHdlrGetWord, 1 }
+	{ "template", eCmdHdlrGetWord, 1 },
+	{ "bulk.ordered", eCmdHdlrBinary, 0 },
+	{ "bulk.maxdocs", eCmdHdlrPositiveInt, 0 },
+	{ "writeconcern.w", eCmdHdlrNonNegInt, 0 },
+	{ "writeconcern.wtimeout", eCmdHdlrNonNegInt, 0 },
+	{ "writeconcern.j", eCmdHdlrBinary, 0 }
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -93,7 +108,8 @@ static struct cnfparamblk actpblk =
 	  actpdescr
 	};
 
-static pthread_mutex_t mutDoAct = PTHREAD_MUTEX_INITIALIZER;
+/* mongod rejects wire messages larger than 48MB; stay well below */
+#define MAX_BULK_BYTES (16 * 1024 * 1024)
 
 BEGINcreateInstance
 CODESTARTcreateInstance
@@ -101,6 +117,11 @@ ENDcreateInstance
 
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
+	pWrkrData->conn = NULL;
+	pWrkrData->docs = NULL;
+	pWrkrData->nDocs = 0;
+	pWrkrData->maxDocs = 0;
+	pWrkrData->lenDocs = 0;
 ENDcreateWrkrInstance
 
 BEGINisCompatibleWithFeature
@@ -113,20 +134,28 @@ CODESTARTisCompatibleWithFeature
 		iRet = RS_RET_OK;
 ENDisCompatibleWithFeature
 
-static void closeMongoDB(instanceData *pData)
+static void closeMongoDB(wrkrInstanceData_t *pWrkrData)
 {
-	if(pData->conn != NULL) {
-                mongo_sync_disconnect(pData->conn);
-		pData->conn = NULL;
+	if(pWrkrData->conn != NULL) {
+                mongo_sync_disconnect(pWrkrData->conn);
+		pWrkrData->conn = NULL;
 	}
 }
 
+/* drop all documents of the current batch */
+static void discardDocs(wrkrInstanceData_t *pWrkrData)
+{
+	int i;
+
+	for(i = 0 ; i < pWrkrData->nDocs ; ++i)
+		bson_free(pWrkrData->docs[i]);
+	pWrkrData->nDocs = 0;
+	pWrkrData->lenDocs = 0;
+}
+
 
 BEGINfreeInstance
 CODESTARTfreeInstance
-	closeMongoDB(pData);
-	if (pData->json_tokener != NULL)
-		json_tokener_free(pData->json_tokener);
 	free(pData->server);
 	free(pData->db);
 	free(pData->collection);
@@ -138,6 +167,9 @@ ENDfreeInstance
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
+	discardDocs(pWrkrData);
+	free(pWrkrData->docs);
+	closeMongoDB(pWrkrData);
 ENDfreeWrkrInstance
 
 
@@ -151,15 +183,16 @@ ENDdbgPrintInstInfo
 /* report error that occured during *last* operation
  */
 static void
-reportMongoError(instanceData *pData)
+reportMongoError(wrkrInstanceData_t *pWrkrData)
 {
 	char errStr[1024];
 	gchar *err;
 	int eno;
 
-	if(pData->bErrMsgPermitted) {
+	if(pWrkrData->bErrMsgPermitted) {
 		eno = errno;
-		if(mongo_sync_cmd_get_last_error(pData->conn, (gchar*)pData->db, &err) == TRUE) {
+		if(pWrkrData->conn != NULL && mongo_sync_cmd_get_last_error(pWrkrData->conn,
+			(gchar*)pWrkrData->pData->db, &err) == TRUE) {
 			errmsg.LogError(0, RS_RET_ERR, "ommongodb: error: %s", err);
 		} else {
 			DBGPRINTF("ommongodb: we had an error, but can not obtain specifics, "
@@ -167,7 +200,7 @@ reportMongoError(instanceData *pData)
 			errmsg.LogError(0, RS_RET_ERR, "ommongodb: error: %s",
 				rs_strerror_r(eno, errStr, sizeof(errStr)));
 		}
-		pData->bErrMsgPermitted = 0;
+		pWrkrData->bErrMsgPermitted = 0;
 	}
 }
 
@@ -176,18 +209,19 @@ reportMongoError(instanceData *pData)
  * MySQL connection.
  * Initially added 2004-10-28 mmeckelein
  */
-static rsRetVal initMongoDB(instanceData *pData, int bSilent)
+static rsRetVal initMongoDB(wrkrInstanceData_t *pWrkrData, int bSilent)
 {
+	instanceData *pData = pWrkrData->pData;
 	char *server;
 	DEFiRet;
 
 	server = (pData->server == NULL) ? "127.0.0.1" : (char*) pData->server;
 	DBGPRINTF("ommongodb: trying connect to '%s' at port %d\n", server, pData->port);
         
-	pData->conn = mongo_sync_connect(server, pData->port, TRUE);
-	if(pData->conn == NULL) {
+	pWrkrData->conn = mongo_sync_connect(server, pData->port, TRUE);
+	if(pWrkrData->conn == NULL) {
 		if(!bSilent) {
-			reportMongoError(pData);
+			reportMongoError(pWrkrData);
 			dbgprintf("ommongodb: can not initialize MongoDB handle");
 		}
                 ABORT_FINALIZE(RS_RET_SUSPENDED);
@@ -434,48 +468,288 @@ error:
 	return NULL;
 }
 
+/* Return a BSON document built from the template entries. Plain message
+ * properties are appended as BSON strings straight away, without going
+ * through a json-c object first; only JSON properties ($!, $., $/) are
+ * converted from their json-c representation. Templates with a subtree
+ * are a single JSON object anyhow, so these are converted as a whole.
+ */
+static bson *
+getTemplateBSON(struct template *pTpl, msg_t *pMsg)
+{
+	bson *doc = NULL;
+	struct templateEntry *pTpe;
+	struct json_object *json;
+	uchar *pVal;
+	rs_size_t propLen;
+	unsigned short bMustBeFreed;
+	gboolean ok;
+
+	if(pTpl->bHaveSubtree) {
+		if(tplToJSON(pTpl, pMsg, &json, NULL) != RS_RET_OK || json == NULL)
+			return NULL;
+		doc = BSONFromJSONObject(json);
+		json_object_put(json);
+		return doc;
+	}
+
+	doc = bson_new();
+	if(doc == NULL)
+		goto error;
+
+	for(pTpe = pTpl->pEntryRoot ; pTpe != NULL ; pTpe = pTpe->pNext) {
+		if(pTpe->fieldName == NULL)
+			continue;
+		ok = TRUE;
+		if(pTpe->eEntryType == CONSTANT) {
+			ok = bson_append_string(doc, (gchar*)pTpe->fieldName,
+						(gchar*)pTpe->data.constant.pConstant, -1);
+		} else if(pTpe->eEntryType == FIELD) {
+			if(pTpe->data.field.msgProp.id == PROP_CEE        ||
+			   pTpe->data.field.msgProp.id == PROP_LOCAL_VAR  ||
+			   pTpe->data.field.msgProp.id == PROP_GLOBAL_VAR   ) {
+				/* the json object is borrowed from the message */
+				if(msgGetJSONPropJSON(pMsg, &pTpe->data.field.msgProp, &json) == RS_RET_OK) {
+					ok = BSONAppendJSONObject(doc, (gchar*)pTpe->fieldName, json);
+				} else if(pTpe->data.field.options.bMandatory) {
+					ok = bson_append_null(doc, (gchar*)pTpe->fieldName);
+				}
+			} else {
+				pVal = (uchar*) MsgGetProp(pMsg, pTpe, &pTpe->data.field.msgProp,
+							   &propLen, &bMustBeFreed, NULL);
+				if(pTpe->data.field.options.bMandatory || propLen > 0) {
+					ok = bson_append_string(doc, (gchar*)pTpe->fieldName,
+								(gchar*)pVal, propLen);
+				}
+				if(bMustBeFreed)
+					free(pVal);
+			}
+		}
+		if(ok == FALSE)
+			goto error;
+	}
+
+	if(bson_finish(doc) == FALSE)
+		goto error;
+
+	return doc;
+
+error:
+	if(doc != NULL)
+		bson_free(doc);
+	return NULL;
+}
+
+
+/* Ask the server for the outcome of the batch just sent, using the
+ * configured write concern. This is done once per batch, not per document.
+ */
+static rsRetVal
+checkWriteConcern(wrkrInstanceData_t *pWrkrData)
+{
+	instanceData *pData = pWrkrData->pData;
+	bson *cmd = NULL;
+	bson *reply = NULL;
+	mongo_packet *p = NULL;
+	bson_cursor *c;
+	const gchar *err;
+	gboolean bTimeout = FALSE;
+	DEFiRet;
+
+	CHKmalloc(cmd = bson_new());
+	bson_append_int32(cmd, "getlasterror", 1);
+	if(pData->wcW > 0)
+		bson_append_int32(cmd, "w", pData->wcW);
+	if(pData->wcWTimeout > 0)
+		bson_append_int32(cmd, "wtimeout", pData->wcWTimeout);
+	if(pData->wcJ)
+		bson_append_boolean(cmd, "j", TRUE);
+	bson_finish(cmd);
+
+	p = mongo_sync_cmd_custom(pWrkrData->conn, (gchar*)pData->db, cmd);
+	if(p == NULL || !mongo_wire_reply_packet_get_nth_document(p, 1, &reply)) {
+		dbgprintf("ommongodb: getlasterror failed\n");
+		reportMongoError(pWrkrData);
+		closeMongoDB(pWrkrData);
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+	bson_finish(reply);
+
+	if((c = bson_find(reply, "wtimeout")) != NULL) {
+		bson_cursor_get_boolean(c, &bTimeout);
+		bson_cursor_free(c);
+	}
+	if((c = bson_find(reply, "err")) != NULL) {
+		if(bson_cursor_type(c) == BSON_TYPE_STRING && bson_cursor_get_string(c, &err)) {
+			if(bTimeout) {
+				/* data is there, but not yet where we want it - retry */
+				errmsg.LogError(0, RS_RET_SUSPENDED, "ommongodb: write concern "
+					"not satisfied within %d ms: %s", pData->wcWTimeout, err);
+				iRet = RS_RET_SUSPENDED;
+			} else {
+				errmsg.LogError(0, RS_RET_DATAFAIL, "ommongodb: insert into "
+					"%s failed: %s", pData->dbNcoll, err);
+				iRet = RS_RET_DATAFAIL;
+			}
+		}
+		bson_cursor_free(c);
+	}
+
+finalize_it:
+	if(reply != NULL)
+		bson_free(reply);
+	if(p != NULL)
+		mongo_wire_packet_free(p);
+	if(cmd != NULL)
+		bson_free(cmd);
+	RETiRet;
+}
+
+
+/* Send all documents of the current batch with a single insert. They are
+ * discarded afterwards in any case: if we fail, the core retries the whole
+ * batch and hands us the messages again.
+ */
+static rsRetVal
+insertDocs(wrkrInstanceData_t *pWrkrData)
+{
+	instanceData *pData = pWrkrData->pData;
+	mongo_packet *p = NULL;
+	const guint8 *data;
+	guint8 *body = NULL;
+	gint32 size;
+	gboolean ok;
+	DEFiRet;
+
+	if(pWrkrData->nDocs == 0)
+		FINALIZE;
+
+	if(pWrkrData->conn == NULL) {
+		CHKiRet(initMongoDB(pWrkrData, 0));
+	}
+
+	if(pData->bOrdered) {
+		ok = mongo_sync_cmd_insert_n(pWrkrData->conn, (gchar*)pData->dbNcoll,
+					     pWrkrData->nDocs, (const bson**)pWrkrData->docs);
+	} else {
+		/* libmongo-client has no interface for the ContinueOnError insert
+		 * flag, so we build the OP_INSERT packet ourselves and set it. The
+		 * flags are the first (little-endian) int32 of the message body.
+		 */
+		ok = FALSE;
+		p = mongo_wire_cmd_insert_n(mongo_connection_get_requestid(
+					(mongo_connection*)pWrkrData->conn) + 1,
+					(gchar*)pData->dbNcoll, pWrkrData->nDocs,
+					(const bson**)pWrkrData->docs);
+		if(p != NULL && (size = mongo_wire_packet_get_data(p, &data)) >= 4) {
+			CHKmalloc(body = malloc(size));
+			memcpy(body, data, size);
+			body[0] |= 0x01;
+			if(mongo_wire_packet_set_data(p, body, size))
+				ok = mongo_packet_send((mongo_connection*)pWrkrData->conn, p);
+		}
+	}
+	if(!ok) {
+		dbgprintf("ommongodb: insert error\n");
+		reportMongoError(pWrkrData);
+		closeMongoDB(pWrkrData);
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+
+	if(pData->wcW > 0 || pData->wcJ) {
+		CHKiRet(checkWriteConcern(pWrkrData));
+	}
+	pWrkrData->bErrMsgPermitted = 1;
+
+finalize_it:
+	discardDocs(pWrkrData);
+	free(body);
+	if(p != NULL)
+		mongo_wire_packet_free(p);
+	RETiRet;
+}
+
+
+/* add a document to the batch, sending the batch first if it is full.
+ * Returns RS_RET_PREVIOUS_COMMITTED in that case.
+ */
+static rsRetVal
+addDoc(wrkrInstanceData_t *pWrkrData, bson *doc)
+{
+	bson **newDocs;
+	int newMax;
+	rsRetVal iRetFlush = RS_RET_OK;
+	DEFiRet;
+
+	if(pWrkrData->nDocs > 0 &&
+	   (pWrkrData->nDocs >= pWrkrData->pData->bulkMaxDocs
+	    || pWrkrData->lenDocs + bson_size(doc) > MAX_BULK_BYTES)) {
+		CHKiRet(insertDocs(pWrkrData));
+		iRetFlush = RS_RET_PREVIOUS_COMMITTED;
+	}
+
+	if(pWrkrData->nDocs == pWrkrData->maxDocs) {
+		newMax = (pWrkrData->maxDocs == 0) ? 64 : 2 * pWrkrData->maxDocs;
+		if(newMax > pWrkrData->pData->bulkMaxDocs)
+			newMax = pWrkrData->pData->bulkMaxDocs;
+		CHKmalloc(newDocs = realloc(pWrkrData->docs, newMax * sizeof(bson*)));
+		pWrkrData->docs = newDocs;
+		pWrkrData->maxDocs = newMax;
+	}
+	pWrkrData->docs[pWrkrData->nDocs++] = doc;
+	pWrkrData->lenDocs += bson_size(doc);
+	iRet = iRetFlush;
+
+finalize_it:
+	if(iRet != RS_RET_OK && iRet != RS_RET_PREVIOUS_COMMITTED)
+		bson_free(doc);
+	RETiRet;
+}
+
 BEGINtryResume
 CODESTARTtryResume
-	if(pWrkrData->pData->conn == NULL) {
-		iRet = initMongoDB(pWrkrData->pData, 1);
+	if(pWrkrData->conn == NULL) {
+		iRet = initMongoDB(pWrkrData, 1);
 	}
 ENDtryResume
 
+BEGINbeginTransaction
+CODESTARTbeginTransaction
+	discardDocs(pWrkrData);
+ENDbeginTransaction
+
 BEGINdoAction
 	bson *doc = NULL;
 	instanceData *pData;
 CODESTARTdoAction
-	pthread_mutex_lock(&mutDoAct);
 	pData = pWrkrData->pData;
 	/* see if we are ready to proceed */
-	if(pData->conn == NULL) {
-		CHKiRet(initMongoDB(pData, 0));
+	if(pWrkrData->conn == NULL) {
+		CHKiRet(initMongoDB(pWrkrData, 0));
 	}
 
-	if(pData->tplName == NULL) {
+	if(pData->pTpl == NULL) {
 		doc = getDefaultBSON((msg_t*)ppString[0]);
 	} else {
-		doc = BSONFromJSONObject((struct json_object *)ppString[0]);
+		doc = getTemplateBSON(pData->pTpl, (msg_t*)ppString[0]);
 	}
 	if(doc == NULL) {
 		dbgprintf("ommongodb: error creating BSON doc\n");
 		/* FIXME: is this a correct return code? */
 		ABORT_FINALIZE(RS_RET_ERR);
 	}
-	if(mongo_sync_cmd_insert(pData->conn, (char*)pData->dbNcoll, doc, NULL)) {
-		pData->bErrMsgPermitted = 1;
-	} else {
-		dbgprintf("ommongodb: insert error\n");
-		reportMongoError(pData);
-		ABORT_FINALIZE(RS_RET_SUSPENDED);
-	}
+	iRet = addDoc(pWrkrData, doc);
+	if(iRet == RS_RET_OK)
+		iRet = RS_RET_DEFER_COMMIT;
 
 finalize_it:
-	pthread_mutex_unlock(&mutDoAct);
-	if(doc != NULL)
-		bson_free(doc);
 ENDdoAction
 
+BEGINendTransaction
+CODESTARTendTransaction
+	iRet = insertDocs(pWrkrData);
+ENDendTransaction
+
 
 static inline void
 setInstParamDefaults(instanceData *pData)
@@ -487,6 +761,12 @@ setInstParamDefaults(instanceData *pData)
 	pData->uid = NULL;
 	pData->pwd = NULL;
 	pData->tplName = NULL;
+	pData->pTpl = NULL;
+	pData->bOrdered = 1;
+	pData->bulkMaxDocs = 1000;
+	pData->wcW = 0;
+	pData->wcWTimeout = 0;
+	pData->wcJ = 0;
 }
 
 BEGINnewActInst
@@ -519,18 +799,35 @@ CODESTARTnewActInst
 			pData->pwd = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(actpblk.descr[i].name, "template")) {
 			pData->tplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "bulk.ordered")) {
+			pData->bOrdered = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "bulk.maxdocs")) {
+			pData->bulkMaxDocs = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "writeconcern.w")) {
+			pData->wcW = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "writeconcern.wtimeout")) {
+			pData->wcWTimeout = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "writeconcern.j")) {
+			pData->wcJ = (sbool) pvals[i].val.d.n;
 		} else {
 			dbgprintf("ommongodb: program error, non-handled "
 			  "param '%s'\n", actpblk.descr[i].name);
 		}
 	}
 
-	if(pData->tplName == NULL) {
-		CHKiRet(OMSRsetEntry(*ppOMSR, 0, NULL, OMSR_TPL_AS_MSG));
-	} else {
-		CHKiRet(OMSRsetEntry(*ppOMSR, 0, ustrdup(pData->tplName),
-				     OMSR_TPL_AS_JSON));
-		CHKmalloc(pData->json_tokener = json_tokener_new());
+	/* we always receive the message object: with a template, we build the
+	 * BSON document from its entries ourselves (see getTemplateBSON()).
+	 * Like the core, we require the template to be defined before use.
+	 */
+	CHKiRet(OMSRsetEntry(*ppOMSR, 0, NULL, OMSR_TPL_AS_MSG));
+	if(pData->tplName != NULL) {
+		pData->pTpl = tplFind(loadConf, (char*)pData->tplName,
+				      strlen((char*)pData->tplName));
+		if(pData->pTpl == NULL) {
+			errmsg.LogError(0, RS_RET_NOT_FOUND, "ommongodb: could not "
+				"find template '%s' - action disabled", pData->tplName);
+			ABORT_FINALIZE(RS_RET_NOT_FOUND);
+		}
 	}
 
 	if(pData->db == NULL)
@@ -579,6 +876,7 @@ BEGINqueryEtryPt
 CODESTARTqueryEtryPt
 CODEqueryEtryPt_STD_OMOD_QUERIES
 CODEqueryEtryPt_STD_OMOD8_QUERIES
+CODEqueryEtryPt_TXIF_OMOD_QUERIES
 CODEqueryEtryPt_STD_CONF2_OMOD_QUERIES
 ENDqueryEtryPt
 
@@ -63,12 +63,18 @@ typedef struct _instanceData {
 	uchar   *configfile;			/* MySQL Client Configuration File */
 	uchar   *configsection;		/* MySQL Client Configuration Section */
 	uchar	*tplName;			/* format template to use */
+	sbool	bBulk;				/* merge inserts into multi-row inserts? */
+	size_t	bulkMaxBytes;			/* max size of a multi-row insert */
 } instanceData;
 
 typedef struct wrkrInstanceData {
 	instanceData *pData;
 	MYSQL	*hmysql;			/* handle to MySQL */
 	unsigned uLastMySQLErrno;		/* last errno returned by MySQL or 0 if all is well */
+	uchar	*bulkBuf;			/* pending multi-row insert */
+	size_t	lenBulk;			/* its length, 0 if none pending */
+	size_t	sizeBulk;
+	size_t	lenBulkPrefix;			/* length of "INSERT ... VALUES" part */
 } wrkrInstanceData_t;
 
 typedef struct configSettings_s {
@@ -88,7 +94,9 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "serverport", eCmdHdlrInt, 0 },
 	{ "mysqlconfig.file", eCmdHdlrGetWord, 0 },
 	{ "mysqlconfig.section", eCmdHdlrGetWord, 0 },
-	{ "template", eCmdHdlrGetWord, 0 }
+	{ "template", eCmdHdlrGetWord, 0 },
+	{ "bulkmode", eCmdHdlrBinary, 0 },
+	{ "bulk.maxbytes", eCmdHdlrSize, 0 }
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -111,6 +119,9 @@ ENDcreateInstance
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
 	pWrkrData->hmysql = NULL;
+	pWrkrData->bulkBuf = NULL;
+	pWrkrData->lenBulk = 0;
+	pWrkrData->sizeBulk = 0;
 ENDcreateWrkrInstance
 
 
@@ -144,6 +155,7 @@ ENDfreeInstance
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
 	closeMySQL(pWrkrData);
+	free(pWrkrData->bulkBuf);
 ENDfreeWrkrInstance
 
 
@@ -268,6 +280,71 @@ finalize_it:
 }
 
 
+/* execute the pending multi-row insert, if there is one */
+static rsRetVal flushBulk(wrkrInstanceData_t *pWrkrData)
+{
+	DEFiRet;
+
+	if(pWrkrData->lenBulk == 0)
+		FINALIZE;
+	pWrkrData->bulkBuf[pWrkrData->lenBulk] = '\0';
+	pWrkrData->lenBulk = 0;
+	CHKiRet(writeMySQL(pWrkrData, pWrkrData->bulkBuf));
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* bulk mode: add the rows of a single-row insert to the pending multi-row
+ * insert. The pending insert is executed first if the statement is something
+ * else, goes to another table/column list or the insert would grow too
+ * large (MySQL limits statements to max_allowed_packet).
+ */
+static rsRetVal writeBulk(wrkrInstanceData_t *pWrkrData, uchar *psz)
+{
+	size_t lenPrefix;
+	size_t lenRows;
+	size_t lenNeeded;
+	uchar *rows;
+	uchar *newBuf;
+	DEFiRet;
+
+	if(splitSQLInsert(psz, 1, &lenPrefix, &rows, &lenRows) != 0) {
+		CHKiRet(flushBulk(pWrkrData));
+		CHKiRet(writeMySQL(pWrkrData, psz));
+		FINALIZE;
+	}
+
+	if(pWrkrData->lenBulk > 0 && (lenPrefix != pWrkrData->lenBulkPrefix
+	   || memcmp(pWrkrData->bulkBuf, psz, lenPrefix)
+	   || pWrkrData->lenBulk + 1 + lenRows > pWrkrData->pData->bulkMaxBytes))
+		CHKiRet(flushBulk(pWrkrData));
+
+	lenNeeded = ((pWrkrData->lenBulk == 0) ? lenPrefix : pWrkrData->lenBulk) + 1 + lenRows + 1;
+	if(lenNeeded > pWrkrData->sizeBulk) {
+		if(lenNeeded < 2 * pWrkrData->sizeBulk)
+			lenNeeded = 2 * pWrkrData->sizeBulk;
+		CHKmalloc(newBuf = realloc(pWrkrData->bulkBuf, lenNeeded));
+		pWrkrData->bulkBuf = newBuf;
+		pWrkrData->sizeBulk = lenNeeded;
+	}
+	if(pWrkrData->lenBulk == 0) {
+		memcpy(pWrkrData->bulkBuf, psz, lenPrefix);
+		pWrkrData->bulkBuf[lenPrefix] = ' ';
+		pWrkrData->lenBulk = lenPrefix + 1;
+		pWrkrData->lenBulkPrefix = lenPrefix;
+	} else {
+		pWrkrData->bulkBuf[pWrkrData->lenBulk++] = ',';
+	}
+	memcpy(pWrkrData->bulkBuf + pWrkrData->lenBulk, rows, lenRows);
+	pWrkrData->lenBulk += lenRows;
+
+finalize_it:
+	RETiRet;
+}
+
+
 BEGINtryResume
 CODESTARTtryResume
 	if(pWrkrData->hmysql == NULL) {
@@ -277,6 +354,7 @@ ENDtryResume
 
 BEGINbeginTransaction
 CODESTARTbeginTransaction
+	pWrkrData->lenBulk = 0;
 	CHKiRet(writeMySQL(pWrkrData, (uchar*)"START TRANSACTION"));
 finalize_it:
 ENDbeginTransaction
@@ -284,17 +362,23 @@ ENDbeginTransaction
 BEGINdoAction
 CODESTARTdoAction
 	dbgprintf("\n");
-	CHKiRet(writeMySQL(pWrkrData, ppString[0]));
+	if(pWrkrData->pData->bBulk) {
+		CHKiRet(writeBulk(pWrkrData, ppString[0]));
+	} else {
+		CHKiRet(writeMySQL(pWrkrData, ppString[0]));
+	}
 	iRet = RS_RET_DEFER_COMMIT;
 finalize_it:
 ENDdoAction
 
 BEGINendTransaction
 CODESTARTendTransaction
+	CHKiRet(flushBulk(pWrkrData));
 	if(mysql_commit(pWrkrData->hmysql) != 0)	{	
 		dbgprintf("mysql server error: transaction not committed\n");		
 		iRet = RS_RET_SUSPENDED;
 	}
+finalize_it:
 ENDendTransaction
 
 
@@ -305,6 +389,8 @@ setInstParamDefaults(instanceData *pData)
 	pData->configfile = NULL;
 	pData->configsection = NULL;
 	pData->tplName = NULL;
+	pData->bBulk = 0;
+	pData->bulkMaxBytes = 512 * 1024;
 }
 
 
@@ -351,6 +437,10 @@ CODESTARTnewActInst
 			pData->configsection = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(actpblk.descr[i].name, "template")) {
 			pData->tplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "bulkmode")) {
+			pData->bBulk = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "bulk.maxbytes")) {
+			pData->bulkMaxBytes = (size_t) pvals[i].val.d.n;
 		} else {
 			dbgprintf("ommysql: program error, non-handled "
 			  "param '%s'\n", actpblk.descr[i].name);
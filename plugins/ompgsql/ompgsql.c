@@ -47,42 +47,54 @@
 #include "ompgsql.h"
 #include "module-template.h"
 #include "errmsg.h"
+#include "cfsysline.h"
 
 MODULE_TYPE_OUTPUT
 MODULE_TYPE_NOKEEP
 MODULE_CNFNAME("ompgsql")
 
+static rsRetVal resetConfigVariables(uchar __attribute__((unused)) *pp, void __attribute__((unused)) *pVal);
+
 /* internal structures
  */
 DEF_OMOD_STATIC_DATA
 DEFobjCurrIf(errmsg)
 
 typedef struct _instanceData {
-	PGconn	*f_hpgsql;			/* handle to PgSQL */
 	char	f_dbsrv[MAXHOSTNAMELEN+1];	/* IP or hostname of DB server*/ 
 	char	f_dbname[_DB_MAXDBLEN+1];	/* DB name */
 	char	f_dbuid[_DB_MAXUNAMELEN+1];	/* DB user */
 	char	f_dbpwd[_DB_MAXPWDLEN+1];	/* DB user's password */
-	ConnStatusType	eLastPgSQLStatus; 	/* last status from postgres */
+	sbool	bBulk;				/* merge inserts into multi-row inserts? */
+	size_t	bulkMaxBytes;			/* max size of a multi-row insert */
 } instanceData;
 
+/* each worker has its own connection, so that its statements form a
+ * transaction of their own.
+ */
 typedef struct wrkrInstanceData {
 	instanceData *pData;
+	PGconn	*f_hpgsql;			/* handle to PgSQL */
+	ConnStatusType	eLastPgSQLStatus; 	/* last status from postgres */
+	uchar	*bulkBuf;			/* pending multi-row insert */
+	size_t	lenBulk;			/* its length, 0 if none pending */
+	size_t	sizeBulk;
+	size_t	lenBulkPrefix;			/* length of "INSERT ... VALUES" part */
 } wrkrInstanceData_t;
 
 typedef struct configSettings_s {
-	EMPTY_STRUCT
+	int bBulk;				/* $ActionPgSQLBulkMode */
+	int64 iBulkMaxBytes;			/* $ActionPgSQLBulkMaxBytes */
 } configSettings_t;
-static configSettings_t __attribute__((unused)) cs;
-
-static pthread_mutex_t mutDoAct = PTHREAD_MUTEX_INITIALIZER;
+static configSettings_t cs;
 
 BEGINinitConfVars		/* (re)set config variables to default values */
 CODESTARTinitConfVars 
+	resetConfigVariables(NULL, NULL);
 ENDinitConfVars
 
 
-static rsRetVal writePgSQL(uchar *psz, instanceData *pData);
+static rsRetVal writePgSQL(uchar *psz, wrkrInstanceData_t *pWrkrData);
 
 BEGINcreateInstance
 CODESTARTcreateInstance
@@ -90,6 +102,10 @@ ENDcreateInstance
 
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
+	pWrkrData->f_hpgsql = NULL;
+	pWrkrData->bulkBuf = NULL;
+	pWrkrData->lenBulk = 0;
+	pWrkrData->sizeBulk = 0;
 ENDcreateWrkrInstance
 
 
@@ -103,23 +119,24 @@ ENDisCompatibleWithFeature
 /* The following function is responsible for closing a
  * PgSQL connection.
  */
-static void closePgSQL(instanceData *pData)
+static void closePgSQL(wrkrInstanceData_t *pWrkrData)
 {
-	assert(pData != NULL);
+	assert(pWrkrData != NULL);
 
-	if(pData->f_hpgsql != NULL) {	/* just to be on the safe side... */
-		PQfinish(pData->f_hpgsql);
-		pData->f_hpgsql = NULL;
+	if(pWrkrData->f_hpgsql != NULL) {	/* just to be on the safe side... */
+		PQfinish(pWrkrData->f_hpgsql);
+		pWrkrData->f_hpgsql = NULL;
 	}
 }
 
 BEGINfreeInstance
 CODESTARTfreeInstance
-	closePgSQL(pData);
 ENDfreeInstance
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
+	closePgSQL(pWrkrData);
+	free(pWrkrData->bulkBuf);
 ENDfreeWrkrInstance
 
 BEGINdbgPrintInstInfo
@@ -132,26 +149,26 @@ ENDdbgPrintInstInfo
  * We check if we have a valid handle. If not, we simply
  * report an error, but can not be specific. RGerhards, 2007-01-30
  */
-static void reportDBError(instanceData *pData, int bSilent)
+static void reportDBError(wrkrInstanceData_t *pWrkrData, int bSilent)
 {
 	char errMsg[512];
 	ConnStatusType ePgSQLStatus;
 
-	assert(pData != NULL);
+	assert(pWrkrData != NULL);
 	bSilent=0;
 
 	/* output log message */
 	errno = 0;
-	if(pData->f_hpgsql == NULL) {
+	if(pWrkrData->f_hpgsql == NULL) {
 		errmsg.LogError(0, NO_ERRCODE, "unknown DB error occured - could not obtain PgSQL handle");
 	} else { /* we can ask pgsql for the error description... */
-		ePgSQLStatus = PQstatus(pData->f_hpgsql);
+		ePgSQLStatus = PQstatus(pWrkrData->f_hpgsql);
 		snprintf(errMsg, sizeof(errMsg)/sizeof(char), "db error (%d): %s\n", ePgSQLStatus,
-				PQerrorMessage(pData->f_hpgsql));
-		if(bSilent || ePgSQLStatus == pData->eLastPgSQLStatus)
+				PQerrorMessage(pWrkrData->f_hpgsql));
+		if(bSilent || ePgSQLStatus == pWrkrData->eLastPgSQLStatus)
 			dbgprintf("pgsql, DBError(silent): %s\n", errMsg);
 		else {
-			pData->eLastPgSQLStatus = ePgSQLStatus;
+			pWrkrData->eLastPgSQLStatus = ePgSQLStatus;
 			errmsg.LogError(0, NO_ERRCODE, "%s", errMsg);
 		}
 	}
@@ -163,12 +180,13 @@ static void reportDBError(instanceData *pData, int bSilent)
 /* The following function is responsible for initializing a
  * PgSQL connection.
  */
-static rsRetVal initPgSQL(instanceData *pData, int bSilent)
+static rsRetVal initPgSQL(wrkrInstanceData_t *pWrkrData, int bSilent)
 {
+	instanceData *pData;
 	DEFiRet;
 
-	assert(pData != NULL);
-	assert(pData->f_hpgsql == NULL);
+	assert(pWrkrData->f_hpgsql == NULL);
+	pData = pWrkrData->pData;
 
 	dbgprintf("host=%s dbname=%s uid=%s\n",pData->f_dbsrv,pData->f_dbname,pData->f_dbuid);
 
@@ -178,10 +196,10 @@ static rsRetVal initPgSQL(instanceData *pData, int bSilent)
 	const char *PgConnectionOptions = "-c standard_conforming_strings=on";
 
 	/* Connect to database */
-	if((pData->f_hpgsql=PQsetdbLogin(pData->f_dbsrv, NULL, PgConnectionOptions, NULL,
+	if((pWrkrData->f_hpgsql=PQsetdbLogin(pData->f_dbsrv, NULL, PgConnectionOptions, NULL,
 				pData->f_dbname, pData->f_dbuid, pData->f_dbpwd)) == NULL) {
-		reportDBError(pData, bSilent);
-		closePgSQL(pData); /* ignore any error we may get */
+		reportDBError(pWrkrData, bSilent);
+		closePgSQL(pWrkrData); /* ignore any error we may get */
 		iRet = RS_RET_SUSPENDED;
 	}
 
@@ -194,14 +212,14 @@ static rsRetVal initPgSQL(instanceData *pData, int bSilent)
  * rgerhards, 2009-04-17
  */
 static inline int
-tryExec(uchar *pszCmd, instanceData *pData)
+tryExec(uchar *pszCmd, wrkrInstanceData_t *pWrkrData)
 {
 	PGresult *pgRet;
 	ExecStatusType execState;
 	int bHadError = 0;
 
 	/* try insert */
-	pgRet = PQexec(pData->f_hpgsql, (char*)pszCmd);
+	pgRet = PQexec(pWrkrData->f_hpgsql, (char*)pszCmd);
 	execState = PQresultStatus(pgRet);
 	if(execState != PGRES_COMMAND_OK && execState != PGRES_TUPLES_OK) {
 		dbgprintf("postgres query execution failed: %s\n", PQresStatus(PQresultStatus(pgRet)));
@@ -221,44 +239,112 @@ tryExec(uchar *pszCmd, instanceData *pData)
  * before my patch. -- rgerhards, 2009-04-17
  */
 static rsRetVal
-writePgSQL(uchar *psz, instanceData *pData)
+writePgSQL(uchar *psz, wrkrInstanceData_t *pWrkrData)
 {
 	int bHadError = 0;
 	DEFiRet;
 
 	assert(psz != NULL);
-	assert(pData != NULL);
+	assert(pWrkrData != NULL);
 
 	dbgprintf("writePgSQL: %s\n", psz);
 
-	bHadError = tryExec(psz, pData); /* try insert */
+	if(pWrkrData->f_hpgsql == NULL)
+		CHKiRet(initPgSQL(pWrkrData, 0));
+
+	bHadError = tryExec(psz, pWrkrData); /* try insert */
 
-	if(bHadError || (PQstatus(pData->f_hpgsql) != CONNECTION_OK)) {
+	if(bHadError || (PQstatus(pWrkrData->f_hpgsql) != CONNECTION_OK)) {
 		/* error occured, try to re-init connection and retry */
-		closePgSQL(pData); /* close the current handle */
-		CHKiRet(initPgSQL(pData, 0)); /* try to re-open */
-		bHadError = tryExec(psz, pData); /* retry */
-		if(bHadError || (PQstatus(pData->f_hpgsql) != CONNECTION_OK)) {
+		closePgSQL(pWrkrData); /* close the current handle */
+		CHKiRet(initPgSQL(pWrkrData, 0)); /* try to re-open */
+		bHadError = tryExec(psz, pWrkrData); /* retry */
+		if(bHadError || (PQstatus(pWrkrData->f_hpgsql) != CONNECTION_OK)) {
 			/* we failed, giving up for now */
-			reportDBError(pData, 0);
-			closePgSQL(pData); /* free ressources */
+			reportDBError(pWrkrData, 0);
+			closePgSQL(pWrkrData); /* free ressources */
 			ABORT_FINALIZE(RS_RET_SUSPENDED);
 		}
 	}
 
 finalize_it:
 	if(iRet == RS_RET_OK) {
-		pData->eLastPgSQLStatus = CONNECTION_OK; /* reset error for error supression */
+		pWrkrData->eLastPgSQLStatus = CONNECTION_OK; /* reset error for error supression */
+	}
+
+	RETiRet;
+}
+
+
+/* execute the pending multi-row insert, if there is one */
+static rsRetVal flushBulk(wrkrInstanceData_t *pWrkrData)
+{
+	DEFiRet;
+
+	if(pWrkrData->lenBulk == 0)
+		FINALIZE;
+	pWrkrData->bulkBuf[pWrkrData->lenBulk] = '\0';
+	pWrkrData->lenBulk = 0;
+	CHKiRet(writePgSQL(pWrkrData->bulkBuf, pWrkrData));
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* bulk mode: add the rows of a single-row insert to the pending multi-row
+ * insert. The pending insert is executed first if the statement is something
+ * else, goes to another table/column list or the insert would grow too
+ * large. Strings are standard conforming, so backslashes are no escapes.
+ */
+static rsRetVal writeBulk(wrkrInstanceData_t *pWrkrData, uchar *psz)
+{
+	size_t lenPrefix;
+	size_t lenRows;
+	size_t lenNeeded;
+	uchar *rows;
+	uchar *newBuf;
+	DEFiRet;
+
+	if(splitSQLInsert(psz, 0, &lenPrefix, &rows, &lenRows) != 0) {
+		CHKiRet(flushBulk(pWrkrData));
+		CHKiRet(writePgSQL(psz, pWrkrData));
+		FINALIZE;
+	}
+
+	if(pWrkrData->lenBulk > 0 && (lenPrefix != pWrkrData->lenBulkPrefix
+	   || memcmp(pWrkrData->bulkBuf, psz, lenPrefix)
+	   || pWrkrData->lenBulk + 1 + lenRows > pWrkrData->pData->bulkMaxBytes))
+		CHKiRet(flushBulk(pWrkrData));
+
+	lenNeeded = ((pWrkrData->lenBulk == 0) ? lenPrefix : pWrkrData->lenBulk) + 1 + lenRows + 1;
+	if(lenNeeded > pWrkrData->sizeBulk) {
+		if(lenNeeded < 2 * pWrkrData->sizeBulk)
+			lenNeeded = 2 * pWrkrData->sizeBulk;
+		CHKmalloc(newBuf = realloc(pWrkrData->bulkBuf, lenNeeded));
+		pWrkrData->bulkBuf = newBuf;
+		pWrkrData->sizeBulk = lenNeeded;
+	}
+	if(pWrkrData->lenBulk == 0) {
+		memcpy(pWrkrData->bulkBuf, psz, lenPrefix);
+		pWrkrData->bulkBuf[lenPrefix] = ' ';
+		pWrkrData->lenBulk = lenPrefix + 1;
+		pWrkrData->lenBulkPrefix = lenPrefix;
+	} else {
+		pWrkrData->bulkBuf[pWrkrData->lenBulk++] = ',';
 	}
+	memcpy(pWrkrData->bulkBuf + pWrkrData->lenBulk, rows, lenRows);
+	pWrkrData->lenBulk += lenRows;
 
+finalize_it:
 	RETiRet;
 }
 
 
 BEGINtryResume
 CODESTARTtryResume
-	if(pWrkrData->pData->f_hpgsql == NULL) {
-		iRet = initPgSQL(pWrkrData->pData, 1);
+	if(pWrkrData->f_hpgsql == NULL) {
+		iRet = initPgSQL(pWrkrData, 1);
 		if(iRet == RS_RET_OK) {
 			/* the code above seems not to actually connect to the database. As such, we do a
 			 * dummy statement (a pointless select...) to verify the connection and return
@@ -266,7 +352,7 @@ CODESTARTtryResume
 			 * PostgreSQL expert, so any patch that does the desired result in a more
 			 * intelligent way is highly welcome. -- rgerhards, 2009-12-16
 			 */
-			iRet = writePgSQL((uchar*)"select 'a' as a", pWrkrData->pData);
+			iRet = writePgSQL((uchar*)"select 'a' as a", pWrkrData);
 		}
 
 	}
@@ -276,25 +362,31 @@ ENDtryResume
 BEGINbeginTransaction
 CODESTARTbeginTransaction
 dbgprintf("ompgsql: beginTransaction\n");
-	iRet = writePgSQL((uchar*) "begin", pWrkrData->pData); /* TODO: make user-configurable */
+	pWrkrData->lenBulk = 0;
+	/* plain BEGIN/COMMIT: the batch must be atomic, and isolation level or
+	 * similar can be set per database or role, so there is nothing to configure */
+	iRet = writePgSQL((uchar*) "begin", pWrkrData);
 ENDbeginTransaction
 
 
 BEGINdoAction
 CODESTARTdoAction
-	pthread_mutex_lock(&mutDoAct);
 	dbgprintf("\n");
-	CHKiRet(writePgSQL(ppString[0], pWrkrData->pData));
-	if(bCoreSupportsBatching)
-		iRet = RS_RET_DEFER_COMMIT;
+	if(pWrkrData->pData->bBulk) {
+		CHKiRet(writeBulk(pWrkrData, ppString[0]));
+	} else {
+		CHKiRet(writePgSQL(ppString[0], pWrkrData));
+	}
+	iRet = RS_RET_DEFER_COMMIT;
 finalize_it:
-	pthread_mutex_unlock(&mutDoAct);
 ENDdoAction
 
 
 BEGINendTransaction
 CODESTARTendTransaction
-	iRet = writePgSQL((uchar*) "commit;", pWrkrData->pData); /* TODO: make user-configurable */
+	CHKiRet(flushBulk(pWrkrData));
+	iRet = writePgSQL((uchar*) "commit;", pWrkrData);
+finalize_it:
 dbgprintf("ompgsql: endTransaction\n");
 ENDendTransaction
 
@@ -362,7 +454,9 @@ CODE_STD_STRING_REQUESTparseSelectorAct(1)
 		errmsg.LogError(0, RS_RET_INVALID_PARAMS, "Trouble with PgSQL connection properties. -PgSQL logging disabled");
 		ABORT_FINALIZE(RS_RET_INVALID_PARAMS);
 	} else {
-		CHKiRet(initPgSQL(pData, 0));
+		/* the connection is established by the worker on first use */
+		pData->bBulk = cs.bBulk;
+		pData->bulkMaxBytes = (size_t) cs.iBulkMaxBytes;
 	}
 
 CODE_STD_FINALIZERparseSelectorAct
@@ -381,6 +475,17 @@ CODEqueryEtryPt_TXIF_OMOD_QUERIES /* we support the transactional interface! */
 ENDqueryEtryPt
 
 
+/* Reset config variables for this module to default values.
+ */
+static rsRetVal resetConfigVariables(uchar __attribute__((unused)) *pp, void __attribute__((unused)) *pVal)
+{
+	DEFiRet;
+	cs.bBulk = 0;
+	cs.iBulkMaxBytes = 512 * 1024;
+	RETiRet;
+}
+
+
 BEGINmodInit()
 CODESTARTmodInit
 INITLegCnfVars
@@ -388,13 +493,17 @@ INITLegCnfVars
 CODEmodInit_QueryRegCFSLineHdlr
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
 	INITChkCoreFeature(bCoreSupportsBatching, CORE_FEATURE_BATCHING);
-
-#	warning: transaction support missing for v8
-	bCoreSupportsBatching= 0;
-	DBGPRINTF("ompgsql: transactions are not yet supported on v8\n");
+	if(!bCoreSupportsBatching) {
+		errmsg.LogError(0, NO_ERRCODE, "ompgsql: rsyslog core too old");
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
 
 	DBGPRINTF("ompgsql: module compiled with rsyslog version %s.\n", VERSION);
-	DBGPRINTF("ompgsql: %susing transactional output interface.\n", bCoreSupportsBatching ? "" : "not ");
+
+	/* register our config handlers */
+	CHKiRet(omsdRegCFSLineHdlr((uchar *)"actionpgsqlbulkmode", 0, eCmdHdlrBinary, NULL, &cs.bBulk, STD_LOADABLE_MODULE_ID));
+	CHKiRet(omsdRegCFSLineHdlr((uchar *)"actionpgsqlbulkmaxbytes", 0, eCmdHdlrSize, NULL, &cs.iBulkMaxBytes, STD_LOADABLE_MODULE_ID));
+	CHKiRet(omsdRegCFSLineHdlr((uchar *)"resetconfigvariables", 1, eCmdHdlrCustomHandler, resetConfigVariables, NULL, STD_LOADABLE_MODULE_ID));
 ENDmodInit
 /* vi:set ai:
  */
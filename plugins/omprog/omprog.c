@@ -36,6 +36,7 @@
 #include <unistd.h>
 #include <wait.h>
 #include <pthread.h>
+#include <poll.h>
 #include "conf.h"
 #include "syslogd-types.h"
 #include "srUtils.h"
@@ -53,19 +54,41 @@ MODULE_CNFNAME("omprog")
 DEF_OMOD_STATIC_DATA
 DEFobjCurrIf(errmsg)
 
+/* one instance of the external program */
+typedef struct child_s {
+	pid_t pid;			/* pid of currently running process */
+	int fdPipe;			/* file descriptor to write to */
+	int fdAck;			/* file descriptor to read acks from (-1 if not used) */
+	int bIsRunning;		/* is binary currently running? 0-no, 1-yes */
+	char ackBuf[1024];	/* partial ack line(s) read from the program */
+	int lenAckBuf;
+	pthread_mutex_t mut;	/* serializes writers (and ack readers) of this child */
+} child_t;
+
 typedef struct _instanceData {
 	uchar *szBinary;	/* name of binary to call */
 	char **aParams;		/* Optional Parameters for binary command */
 	uchar *tplName;		/* assigned output template */
-	pid_t pid;			/* pid of currently running process */
-	int fdPipe;			/* file descriptor to write to */
-	int bIsRunning;		/* is binary currently running? 0-no, 1-yes */
+	uchar *hashTplName;	/* template for hashed dispatch (NULL: round-robin) */
 	int iParams;		/* Holds the count of parameters if set*/
-	pthread_mutex_t mut;	/* make sure only one instance is active */
+	int nChildren;		/* number of program instances */
+	child_t *children;
+	sbool bConfirm;		/* program acks each line with "OK" on stdout */
+	int confirmTimeout;	/* max ms to wait for an ack */
 } instanceData;
 
+/* each worker buffers the lines of a transaction per child */
+typedef struct childBuf_s {
+	uchar *buf;
+	size_t len;
+	size_t size;
+	int nLines;
+} childBuf_t;
+
 typedef struct wrkrInstanceData {
 	instanceData *pData;
+	childBuf_t *bufs;
+	int iNextChild;		/* round-robin index */
 } wrkrInstanceData_t;
 
 typedef struct configSettings_s {
@@ -73,12 +96,23 @@ typedef struct configSettings_s {
 } configSettings_t;
 static configSettings_t cs;
 
+/* flush a child's buffer once it grows beyond this; in confirm mode, also
+ * bound the number of unacked lines so the program can never block on a
+ * full stdout pipe while we still write to it.
+ */
+#define MAX_CHILD_BUF (64 * 1024)
+#define MAX_UNACKED_LINES 1024
+
 
 /* tables for interfacing with the v6 config system */
 /* action (instance) parameters */
 static struct cnfparamdescr actpdescr[] = {
 	{ "binary", eCmdHdlrString, CNFPARAM_REQUIRED },
-	{ "template", eCmdHdlrGetWord, 0 }
+	{ "template", eCmdHdlrGetWord, 0 },
+	{ "processes", eCmdHdlrPositiveInt, 0 },
+	{ "hashtemplate", eCmdHdlrGetWord, 0 },
+	{ "confirmmessages", eCmdHdlrBinary, 0 },
+	{ "confirmtimeout", eCmdHdlrPositiveInt, 0 }
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -95,11 +129,13 @@ ENDinitConfVars
 
 BEGINcreateInstance
 CODESTARTcreateInstance
-	pthread_mutex_init(&pData->mut, NULL);
 ENDcreateInstance
 
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
+	pWrkrData->iNextChild = 0;
+	CHKmalloc(pWrkrData->bufs = calloc(pData->nChildren, sizeof(childBuf_t)));
+finalize_it:
 ENDcreateWrkrInstance
 
 
@@ -113,9 +149,21 @@ ENDisCompatibleWithFeature
 BEGINfreeInstance
 	int i;
 CODESTARTfreeInstance
-	pthread_mutex_destroy(&pData->mut);
+	if(pData->children != NULL) {
+		for(i = 0 ; i < pData->nChildren ; ++i) {
+			/* the program sees EOF and is expected to terminate */
+			if(pData->children[i].fdPipe != -1)
+				close(pData->children[i].fdPipe);
+			if(pData->children[i].fdAck != -1)
+				close(pData->children[i].fdAck);
+			pthread_mutex_destroy(&pData->children[i].mut);
+		}
+		free(pData->children);
+	}
 	if(pData->szBinary != NULL)
 		free(pData->szBinary);
+	free(pData->tplName);
+	free(pData->hashTplName);
 	if(pData->aParams != NULL) {
 		for (i = 0; i < pData->iParams; i++) {
 			free(pData->aParams[i]);
@@ -125,7 +173,13 @@ CODESTARTfreeInstance
 ENDfreeInstance
 
 BEGINfreeWrkrInstance
+	int i;
 CODESTARTfreeWrkrInstance
+	if(pWrkrData->bufs != NULL) {
+		for(i = 0 ; i < pWrkrData->pData->nChildren ; ++i)
+			free(pWrkrData->bufs[i].buf);
+		free(pWrkrData->bufs);
+	}
 ENDfreeWrkrInstance
 
 
@@ -143,7 +197,7 @@ ENDtryResume
  * after fork).
  */
 
-static void execBinary(instanceData *pData, int fdStdin)
+static void execBinary(instanceData *pData, int fdStdin, int fdStdout)
 {
 	int i, iRet;
 	struct sigaction sigAct;
@@ -160,6 +214,11 @@ static void execBinary(instanceData *pData, int fdStdin)
 		 */
 	}
 	/*fclose(stdout);*/
+	if(fdStdout != -1) {
+		if(dup2(fdStdout, STDOUT_FILENO) == -1) {
+			DBGPRINTF("omprog: dup2() for stdout failed\n");
+		}
+	}
 
 	/* we close all file handles as we fork soon
 	 * Is there a better way to do this? - mail me! rgerhards@adiscon.com
@@ -192,12 +251,14 @@ static void execBinary(instanceData *pData, int fdStdin)
 
 
 /* creates a pipe and starts program, uses pipe as stdin for program.
+ * In confirm mode, a second pipe is connected to the program's stdout.
  * rgerhards, 2009-04-01
  */
 static rsRetVal
-openPipe(instanceData *pData)
+openPipe(instanceData *pData, child_t *pChild)
 {
 	int pipefd[2];
+	int ackfd[2] = { -1, -1 };
 	pid_t cpid;
 	DEFiRet;
 
@@ -206,6 +267,11 @@ openPipe(instanceData *pData)
 	if(pipe(pipefd) == -1) {
 		ABORT_FINALIZE(RS_RET_ERR_CREAT_PIPE);
 	}
+	if(pData->bConfirm && pipe(ackfd) == -1) {
+		close(pipefd[0]);
+		close(pipefd[1]);
+		ABORT_FINALIZE(RS_RET_ERR_CREAT_PIPE);
+	}
 
 	DBGPRINTF("omprog: executing program '%s' with '%d' parameters\n", pData->szBinary, pData->iParams);
 
@@ -213,6 +279,12 @@ openPipe(instanceData *pData)
 
 	cpid = fork();
 	if(cpid == -1) {
+		close(pipefd[0]);
+		close(pipefd[1]);
+		if(ackfd[0] != -1) {
+			close(ackfd[0]);
+			close(ackfd[1]);
+		}
 		ABORT_FINALIZE(RS_RET_ERR_FORK);
 	}
 
@@ -221,15 +293,21 @@ openPipe(instanceData *pData)
 		 * exec the binary. If that fails, there is not much we can do.
 		 */
 		close(pipefd[1]);
-		execBinary(pData, pipefd[0]);
+		if(ackfd[0] != -1)
+			close(ackfd[0]);
+		execBinary(pData, pipefd[0], ackfd[1]);
 		/*NO CODE HERE - WILL NEVER BE REACHED!*/
 	}
 
 	DBGPRINTF("omprog: child has pid %d\n", (int) cpid);
-	pData->fdPipe = pipefd[1];
-	pData->pid = cpid;
+	pChild->fdPipe = pipefd[1];
+	pChild->pid = cpid;
 	close(pipefd[0]);
-	pData->bIsRunning = 1;
+	pChild->fdAck = ackfd[0];
+	if(ackfd[1] != -1)
+		close(ackfd[1]);
+	pChild->lenAckBuf = 0;
+	pChild->bIsRunning = 1;
 finalize_it:
 	RETiRet;
 }
@@ -238,7 +316,7 @@ finalize_it:
 /* clean up after a terminated child
  */
 static inline rsRetVal
-cleanup(instanceData *pData)
+cleanup(instanceData *pData, child_t *pChild)
 {
 	int status;
 	int ret;
@@ -246,9 +324,15 @@ cleanup(instanceData *pData)
 	DEFiRet;
 
 	assert(pData != NULL);
-	assert(pData->bIsRunning == 1);
-	ret = waitpid(pData->pid, &status, 0);
-	if(ret != pData->pid) {
+	assert(pChild->bIsRunning == 1);
+	close(pChild->fdPipe);
+	pChild->fdPipe = -1;
+	if(pChild->fdAck != -1) {
+		close(pChild->fdAck);
+		pChild->fdAck = -1;
+	}
+	ret = waitpid(pChild->pid, &status, 0);
+	if(ret != pChild->pid) {
 		/* if waitpid() fails, we can not do much - try to ignore it... */
 		DBGPRINTF("omprog: waitpid() returned state %d[%s], future malfunction may happen\n", ret,
 			   rs_strerror_r(errno, errStr, sizeof(errStr)));
@@ -265,7 +349,7 @@ cleanup(instanceData *pData)
 		}
 	}
 
-	pData->bIsRunning = 0;
+	pChild->bIsRunning = 0;
 	RETiRet;
 }
 
@@ -273,13 +357,13 @@ cleanup(instanceData *pData)
 /* try to restart the binary when it has stopped.
  */
 static inline rsRetVal
-tryRestart(instanceData *pData)
+tryRestart(instanceData *pData, child_t *pChild)
 {
 	DEFiRet;
 	assert(pData != NULL);
-	assert(pData->bIsRunning == 0);
+	assert(pChild->bIsRunning == 0);
 
-	iRet = openPipe(pData);
+	iRet = openPipe(pData, pChild);
 	RETiRet;
 }
 
@@ -288,30 +372,34 @@ tryRestart(instanceData *pData)
  * note that we do not try to run block-free. If the users fears something
  * may block (and this not be acceptable), the action should be run on its
  * own action queue.
+ * In confirm mode, a program that died takes its acks with it, so we do
+ * not continue on a restarted instance but have the batch retried.
  */
 static rsRetVal
-writePipe(instanceData *pData, uchar *szMsg)
+writePipe(instanceData *pData, child_t *pChild, uchar *szMsg, size_t lenWrite)
 {
-	int lenWritten;
-	int lenWrite;
-	int writeOffset;
+	ssize_t lenWritten;
+	size_t writeOffset;
 	char errStr[1024];
 	DEFiRet;
 	
 	assert(pData != NULL);
 
-	lenWrite = strlen((char*)szMsg);
 	writeOffset = 0;
 
-	do {
-		lenWritten = write(pData->fdPipe, ((char*)szMsg)+writeOffset, lenWrite);
+	while(writeOffset < lenWrite) {
+		lenWritten = write(pChild->fdPipe, ((char*)szMsg)+writeOffset, lenWrite - writeOffset);
 		if(lenWritten == -1) {
 			switch(errno) {
+			case EINTR:
+				break;
 			case EPIPE:
 				DBGPRINTF("omprog: Program '%s' terminated, trying to restart\n",
 					  pData->szBinary);
-				CHKiRet(cleanup(pData));
-				CHKiRet(tryRestart(pData));
+				CHKiRet(cleanup(pData, pChild));
+				if(pData->bConfirm)
+					ABORT_FINALIZE(RS_RET_SUSPENDED);
+				CHKiRet(tryRestart(pData, pChild));
 				break;
 			default:
 				DBGPRINTF("omprog: error %d writing to pipe: %s\n", errno,
@@ -322,39 +410,220 @@ writePipe(instanceData *pData, uchar *szMsg)
 		} else {
 			writeOffset += lenWritten;
 		}
-	} while(lenWritten != lenWrite);
+	}
+
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* read one ack per line written. The program must reply "OK" for every
+ * message it has taken over; anything else is logged and fails the batch.
+ * If no ack arrives in time, the program is considered hung and killed.
+ */
+static rsRetVal
+readAcks(instanceData *pData, child_t *pChild, int nLines)
+{
+	struct pollfd pfd;
+	ssize_t lenRead;
+	char *nl;
+	int lenLine;
+	int r;
+	DEFiRet;
+
+	while(nLines > 0) {
+		nl = memchr(pChild->ackBuf, '\n', pChild->lenAckBuf);
+		if(nl == NULL) {
+			if(pChild->lenAckBuf == (int) sizeof(pChild->ackBuf)) {
+				/* overlong line: not an "OK", keep its start for the message */
+				nl = pChild->ackBuf + sizeof(pChild->ackBuf) - 1;
+			} else {
+				pfd.fd = pChild->fdAck;
+				pfd.events = POLLIN;
+				r = poll(&pfd, 1, pData->confirmTimeout);
+				if(r == -1 && errno == EINTR)
+					continue;
+				if(r <= 0) {
+					errmsg.LogError(0, RS_RET_SUSPENDED, "omprog: program '%s' did "
+						"not confirm messages within %d ms, restarting it",
+						pData->szBinary, pData->confirmTimeout);
+					kill(pChild->pid, SIGTERM);
+					cleanup(pData, pChild);
+					ABORT_FINALIZE(RS_RET_SUSPENDED);
+				}
+				lenRead = read(pChild->fdAck, pChild->ackBuf + pChild->lenAckBuf,
+					       sizeof(pChild->ackBuf) - pChild->lenAckBuf);
+				if(lenRead <= 0) {
+					if(lenRead == -1 && errno == EINTR)
+						continue;
+					DBGPRINTF("omprog: program '%s' closed its stdout\n", pData->szBinary);
+					cleanup(pData, pChild);
+					ABORT_FINALIZE(RS_RET_SUSPENDED);
+				}
+				pChild->lenAckBuf += lenRead;
+				continue;
+			}
+		}
+
+		lenLine = nl - pChild->ackBuf;
+		if(lenLine > 0 && pChild->ackBuf[lenLine-1] == '\r')
+			--lenLine;
+		if(!(lenLine == 2 && !strncmp(pChild->ackBuf, "OK", 2))) {
+			errmsg.LogError(0, RS_RET_SUSPENDED, "omprog: program '%s' did not "
+				"accept message: %.*s", pData->szBinary, lenLine, pChild->ackBuf);
+			iRet = RS_RET_SUSPENDED;
+		}
+		pChild->lenAckBuf -= nl + 1 - pChild->ackBuf;
+		memmove(pChild->ackBuf, nl + 1, pChild->lenAckBuf);
+		--nLines;
+	}
 
+finalize_it:
+	RETiRet;
+}
 
+
+/* send the buffered lines of one child to the program */
+static rsRetVal
+flushChild(wrkrInstanceData_t *pWrkrData, int iChild)
+{
+	instanceData *pData = pWrkrData->pData;
+	child_t *pChild = &pData->children[iChild];
+	childBuf_t *pBuf = &pWrkrData->bufs[iChild];
+	DEFiRet;
+
+	if(pBuf->len == 0)
+		FINALIZE;
+
+	pthread_mutex_lock(&pChild->mut);
+	if(pChild->bIsRunning == 0) {
+		iRet = openPipe(pData, pChild);
+	}
+	if(iRet == RS_RET_OK)
+		iRet = writePipe(pData, pChild, pBuf->buf, pBuf->len);
+	if(iRet == RS_RET_OK && pData->bConfirm)
+		iRet = readAcks(pData, pChild, pBuf->nLines);
+	pthread_mutex_unlock(&pChild->mut);
+
+	pBuf->len = 0;
+	pBuf->nLines = 0;
+	if(iRet != RS_RET_OK)
+		iRet = RS_RET_SUSPENDED;
 finalize_it:
 	RETiRet;
 }
 
 
+/* select the program instance a message goes to */
+static inline int
+selectChild(wrkrInstanceData_t *pWrkrData, uchar *hashKey)
+{
+	unsigned hash = 5381;
+	int iChild;
+
+	if(pWrkrData->pData->nChildren == 1)
+		return 0;
+	if(hashKey != NULL) {
+		while(*hashKey)
+			hash = hash * 33 + *hashKey++;
+		return (int) (hash % pWrkrData->pData->nChildren);
+	}
+	iChild = pWrkrData->iNextChild;
+	if(++pWrkrData->iNextChild == pWrkrData->pData->nChildren)
+		pWrkrData->iNextChild = 0;
+	return iChild;
+}
+
+
+BEGINbeginTransaction
+	int i;
+CODESTARTbeginTransaction
+	for(i = 0 ; i < pWrkrData->pData->nChildren ; ++i) {
+		pWrkrData->bufs[i].len = 0;
+		pWrkrData->bufs[i].nLines = 0;
+	}
+ENDbeginTransaction
+
+
 BEGINdoAction
 	instanceData *pData;
+	childBuf_t *pBuf;
+	uchar *newBuf;
+	size_t lenMsg;
+	size_t newSize;
+	int iChild;
 CODESTARTdoAction
 	pData = pWrkrData->pData;
-	pthread_mutex_lock(&pData->mut);
-	if(pData->bIsRunning == 0) {
-		openPipe(pData);
+	iChild = selectChild(pWrkrData, (pData->hashTplName == NULL) ? NULL : ppString[1]);
+	pBuf = &pWrkrData->bufs[iChild];
+	lenMsg = strlen((char*)ppString[0]);
+
+	if(pBuf->len + lenMsg > pBuf->size) {
+		newSize = (pBuf->size == 0) ? 4096 : pBuf->size;
+		while(newSize < pBuf->len + lenMsg)
+			newSize *= 2;
+		CHKmalloc(newBuf = realloc(pBuf->buf, newSize));
+		pBuf->buf = newBuf;
+		pBuf->size = newSize;
 	}
-	
-	iRet = writePipe(pData, ppString[0]);
+	memcpy(pBuf->buf + pBuf->len, ppString[0], lenMsg);
+	pBuf->len += lenMsg;
+	++pBuf->nLines;
 
-	if(iRet != RS_RET_OK)
-		iRet = RS_RET_SUSPENDED;
-	pthread_mutex_unlock(&pData->mut);
+	if(pBuf->len >= MAX_CHILD_BUF || (pData->bConfirm && pBuf->nLines >= MAX_UNACKED_LINES)) {
+		CHKiRet(flushChild(pWrkrData, iChild));
+	}
+	iRet = RS_RET_DEFER_COMMIT;
+finalize_it:
 ENDdoAction
 
 
+BEGINendTransaction
+	int i;
+	rsRetVal localRet;
+CODESTARTendTransaction
+	/* flush all children, even if one fails, so no stale data is left */
+	for(i = 0 ; i < pWrkrData->pData->nChildren ; ++i) {
+		localRet = flushChild(pWrkrData, i);
+		if(localRet != RS_RET_OK)
+			iRet = localRet;
+	}
+ENDendTransaction
+
+
+/* set up the configured number of program instances; they are started
+ * on first use.
+ */
+static rsRetVal
+createChildren(instanceData *pData)
+{
+	int i;
+	DEFiRet;
+
+	CHKmalloc(pData->children = calloc(pData->nChildren, sizeof(child_t)));
+	for(i = 0 ; i < pData->nChildren ; ++i) {
+		pData->children[i].fdPipe = -1;
+		pData->children[i].fdAck = -1;
+		pData->children[i].bIsRunning = 0;
+		pthread_mutex_init(&pData->children[i].mut, NULL);
+	}
+finalize_it:
+	RETiRet;
+}
+
+
 static inline void
 setInstParamDefaults(instanceData *pData)
 {
 	pData->szBinary = NULL;
 	pData->aParams = NULL;
 	pData->iParams = 0;
-	pData->fdPipe = -1;
-	pData->bIsRunning = 0;
+	pData->nChildren = 1;
+	pData->children = NULL;
+	pData->hashTplName = NULL;
+	pData->bConfirm = 0;
+	pData->confirmTimeout = 10000;
 }
 
 BEGINnewActInst
@@ -376,7 +645,6 @@ CODESTARTnewActInst
 	CHKiRet(createInstance(&pData));
 	setInstParamDefaults(pData);
 
-	CODE_STD_STRING_REQUESTnewActInst(1)
 	for(i = 0 ; i < actpblk.nParams ; ++i) {
 		if(!pvals[i].bUsed)
 			continue;
@@ -458,14 +726,28 @@ CODESTARTnewActInst
 			}
 		} else if(!strcmp(actpblk.descr[i].name, "template")) {
 			pData->tplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "processes")) {
+			pData->nChildren = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "hashtemplate")) {
+			pData->hashTplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "confirmmessages")) {
+			pData->bConfirm = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "confirmtimeout")) {
+			pData->confirmTimeout = (int) pvals[i].val.d.n;
 		} else {
 			dbgprintf("omprog: program error, non-handled param '%s'\n", actpblk.descr[i].name);
 		}
 	}
 
+	CODE_STD_STRING_REQUESTnewActInst((pData->hashTplName == NULL) ? 1 : 2)
 	CHKiRet(OMSRsetEntry(*ppOMSR, 0, (uchar*)strdup((pData->tplName == NULL) ? 
 						"RSYSLOG_FileFormat" : (char*)pData->tplName),
 						OMSR_NO_RQD_TPL_OPTS));
+	if(pData->hashTplName != NULL) {
+		CHKiRet(OMSRsetEntry(*ppOMSR, 1, (uchar*)strdup((char*)pData->hashTplName),
+							OMSR_NO_RQD_TPL_OPTS));
+	}
+	CHKiRet(createChildren(pData));
 CODE_STD_FINALIZERnewActInst
 	cnfparamvalsDestruct(pvals, &actpblk);
 ENDnewActInst
@@ -487,6 +769,7 @@ CODE_STD_STRING_REQUESTparseSelectorAct(1)
 	}
 
 	CHKiRet(createInstance(&pData));
+	setInstParamDefaults(pData);
 
 	if(cs.szBinary == NULL) {
 		errmsg.LogError(0, RS_RET_CONF_RQRD_PARAM_MISSING,
@@ -499,6 +782,7 @@ CODE_STD_STRING_REQUESTparseSelectorAct(1)
 	if(*(p-1) == ';')
 		--p;
 	CHKiRet(cflineParseTemplateName(&p, *ppOMSR, 0, 0, (uchar*) "RSYSLOG_FileFormat"));
+	CHKiRet(createChildren(pData));
 CODE_STD_FINALIZERparseSelectorAct
 ENDparseSelectorAct
 
@@ -516,6 +800,7 @@ BEGINqueryEtryPt
 CODESTARTqueryEtryPt
 CODEqueryEtryPt_STD_OMOD_QUERIES
 CODEqueryEtryPt_STD_OMOD8_QUERIES
+CODEqueryEtryPt_TXIF_OMOD_QUERIES
 CODEqueryEtryPt_STD_CONF2_CNFNAME_QUERIES 
 CODEqueryEtryPt_STD_CONF2_OMOD_QUERIES
 ENDqueryEtryPt
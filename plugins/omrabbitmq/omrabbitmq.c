@@ -31,6 +31,8 @@
 #include <signal.h>
 #include <errno.h>
 #include <time.h>
+#include <sys/socket.h>
+#include <sys/time.h>
 #include "conf.h"
 #include "syslogd-types.h"
 #include "srUtils.h"
@@ -60,7 +62,6 @@ typedef struct _instanceData {
 	 * inside rsyslog.conf, and this is what keeps them apart. Do NOT use
 	 * static data for this!
 	 */
-	amqp_connection_state_t conn;
 	amqp_basic_properties_t props;
 	uchar *host;
 	int port;
@@ -70,8 +71,34 @@ typedef struct _instanceData {
 	uchar *exchange;
 	uchar *routing_key;
 	uchar *tplName;
+	int nChannels;		/* number of channels each worker publishes on */
+	sbool bConfirms;	/* use publisher confirms (settled on endTransaction)? */
+	int confirmTimeout;	/* max ms to wait for broker confirm frames */
 } instanceData;
 
+/* per-channel publisher confirm state. In confirm mode the broker numbers
+ * each publish on a channel, starting at 1. We keep one "pending" flag per
+ * message published inside the current transaction, indexed relative to
+ * the first delivery tag of that transaction (baseTag).
+ */
+typedef struct chanState_s {
+	amqp_channel_t id;
+	uint64_t nextTag;	/* delivery tag the next publish will receive */
+	uint64_t baseTag;	/* delivery tag of the first publish in this batch */
+	uint8_t *pending;	/* 1 while the broker has not yet confirmed the msg */
+	size_t maxPending;	/* allocated size of pending */
+	size_t iLowest;		/* all entries below this index are settled */
+	unsigned nPending;	/* number of unconfirmed messages */
+} chanState_t;
+
+typedef struct wrkrInstanceData {
+	instanceData *pData;
+	amqp_connection_state_t conn;
+	chanState_t *chans;
+	int iNextChan;		/* round-robin index for the next publish */
+	sbool bNacked;		/* broker nack'ed something in this batch */
+} wrkrInstanceData_t;
+
 
 /* tables for interfacing with the v6 config system */
 /* action (instance) parameters */
@@ -83,7 +110,10 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "password", eCmdHdlrGetWord, 0 },
 	{ "exchange", eCmdHdlrGetWord, 0 },
 	{ "routing_key", eCmdHdlrGetWord, 0 },
-	{ "template", eCmdHdlrGetWord, 0 }
+	{ "template", eCmdHdlrGetWord, 0 },
+	{ "channels", eCmdHdlrPositiveInt, 0 },
+	{ "publisher_confirms", eCmdHdlrBinary, 0 },
+	{ "confirm_timeout", eCmdHdlrPositiveInt, 0 }
 };
 static struct cnfparamblk actpblk =
 	{
@@ -171,48 +201,224 @@ cstring_bytes(const char *str)
 
 
 static void
-closeAMQPConnection(instanceData *pData)
+closeAMQPConnection(wrkrInstanceData_t *pWrkrData)
 {
-	if (pData->conn != NULL) {
-		die_on_amqp_error(amqp_channel_close(pData->conn, 1, AMQP_REPLY_SUCCESS), "amqp_channel_close");
-		die_on_amqp_error(amqp_connection_close(pData->conn, AMQP_REPLY_SUCCESS), "amqp_connection_close");
-		die_on_error(amqp_destroy_connection(pData->conn), "amqp_destroy_connection");
+	int i;
+
+	if (pWrkrData->conn != NULL) {
+		for (i = 0 ; i < pWrkrData->pData->nChannels ; ++i) {
+			die_on_amqp_error(amqp_channel_close(pWrkrData->conn, pWrkrData->chans[i].id,
+				AMQP_REPLY_SUCCESS), "amqp_channel_close");
+		}
+		die_on_amqp_error(amqp_connection_close(pWrkrData->conn, AMQP_REPLY_SUCCESS), "amqp_connection_close");
+		die_on_error(amqp_destroy_connection(pWrkrData->conn), "amqp_destroy_connection");
 
-		pData->conn = NULL;
+		pWrkrData->conn = NULL;
 	}
 }
 
 
+/* discard a connection that failed during setup; nothing can be sent
+ * over it any longer, so we do not try to close it cleanly.
+ */
+static void
+dropAMQPConnection(wrkrInstanceData_t *pWrkrData)
+{
+	amqp_destroy_connection(pWrkrData->conn);
+	pWrkrData->conn = NULL;
+}
+
+
 /*
  * Initialize RabbitMQ connection
  */
 static rsRetVal
-initRabbitMQ(instanceData *pData)
+initRabbitMQ(wrkrInstanceData_t *pWrkrData)
 {
+	instanceData *pData = pWrkrData->pData;
+	chanState_t *chan;
+	struct timeval tv;
 	int sockfd;
+	int i;
 	DEFiRet;
 
 	DBGPRINTF("omrabbitmq: trying connect to '%s' at port %d\n", pData->host, pData->port);
         
-	pData->conn = amqp_new_connection();
+	pWrkrData->conn = amqp_new_connection();
 
 	if (die_on_error(sockfd = amqp_open_socket((char*) pData->host, pData->port), "Opening socket")) {
-		pData->conn = NULL;
+		dropAMQPConnection(pWrkrData);
 		ABORT_FINALIZE(RS_RET_SUSPENDED);
 	}
 
-	amqp_set_sockfd(pData->conn, sockfd);
+	amqp_set_sockfd(pWrkrData->conn, sockfd);
 
-	if (die_on_amqp_error(amqp_login(pData->conn, (char*) pData->vhost, 0, 131072, 0, AMQP_SASL_METHOD_PLAIN, pData->user, pData->password),
+	if (die_on_amqp_error(amqp_login(pWrkrData->conn, (char*) pData->vhost, 0, 131072, 0, AMQP_SASL_METHOD_PLAIN, pData->user, pData->password),
 		"Logging in")) {
-		pData->conn = NULL;
+		dropAMQPConnection(pWrkrData);
 		ABORT_FINALIZE(RS_RET_SUSPENDED);
 	}
 
-	amqp_channel_open(pData->conn, 1);
+	for (i = 0 ; i < pData->nChannels ; ++i) {
+		chan = &pWrkrData->chans[i];
+		amqp_channel_open(pWrkrData->conn, chan->id);
+		if (die_on_amqp_error(amqp_get_rpc_reply(pWrkrData->conn), "Opening channel")) {
+			dropAMQPConnection(pWrkrData);
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		}
+		if (pData->bConfirms) {
+			amqp_confirm_select(pWrkrData->conn, chan->id);
+			if (die_on_amqp_error(amqp_get_rpc_reply(pWrkrData->conn), "Enabling publisher confirms")) {
+				dropAMQPConnection(pWrkrData);
+				ABORT_FINALIZE(RS_RET_SUSPENDED);
+			}
+		}
+		/* delivery tags restart at 1 on each new channel */
+		chan->nextTag = 1;
+		chan->baseTag = 1;
+		chan->iLowest = 0;
+		chan->nPending = 0;
+	}
 
-	if (die_on_amqp_error(amqp_get_rpc_reply(pData->conn), "Opening channel")) {
-		pData->conn = NULL;
+	if (pData->bConfirms) {
+		/* bound the wait for confirms, a broker that stops answering must
+		 * suspend the action instead of blocking the worker forever.
+		 */
+		tv.tv_sec = pData->confirmTimeout / 1000;
+		tv.tv_usec = (pData->confirmTimeout % 1000) * 1000;
+		if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0) {
+			DBGPRINTF("omrabbitmq: could not set confirm timeout, errno %d\n", errno);
+		}
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* remember that the next publish on chan awaits a confirm */
+static rsRetVal
+addPending(chanState_t *chan)
+{
+	size_t idx;
+	size_t newMax;
+	uint8_t *newPending;
+	DEFiRet;
+
+	idx = (size_t) (chan->nextTag - chan->baseTag);
+	if (idx >= chan->maxPending) {
+		newMax = (chan->maxPending == 0) ? 256 : chan->maxPending * 2;
+		CHKmalloc(newPending = realloc(chan->pending, newMax));
+		chan->pending = newPending;
+		chan->maxPending = newMax;
+	}
+	chan->pending[idx] = 1;
+	++chan->nPending;
+	++chan->nextTag;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* mark a broker ack/nack as received. With "multiple" set, the broker
+ * settles all messages up to and including tag in one frame.
+ */
+static void
+settleConfirm(chanState_t *chan, uint64_t tag, amqp_boolean_t multiple)
+{
+	size_t idx;
+	size_t nPublished;
+	size_t i;
+
+	if (tag < chan->baseTag || tag >= chan->nextTag) {
+		DBGPRINTF("omrabbitmq: ignoring confirm for tag %llu outside of batch\n",
+			(unsigned long long) tag);
+		return;
+	}
+	idx = (size_t) (tag - chan->baseTag);
+	nPublished = (size_t) (chan->nextTag - chan->baseTag);
+
+	if (multiple) {
+		for (i = chan->iLowest ; i <= idx && i < nPublished ; ++i) {
+			if (chan->pending[i]) {
+				chan->pending[i] = 0;
+				--chan->nPending;
+			}
+		}
+		if (idx + 1 > chan->iLowest)
+			chan->iLowest = idx + 1;
+	} else if (chan->pending[idx]) {
+		chan->pending[idx] = 0;
+		--chan->nPending;
+	}
+}
+
+
+/* read broker frames until every message published in the current batch
+ * has been confirmed. Frames from all channels arrive on the same socket,
+ * so a single loop settles all of them.
+ */
+static rsRetVal
+waitConfirms(wrkrInstanceData_t *pWrkrData)
+{
+	instanceData *pData = pWrkrData->pData;
+	amqp_frame_t frame;
+	chanState_t *chan;
+	unsigned nPending;
+	int i;
+	DEFiRet;
+
+	while (1) {
+		nPending = 0;
+		for (i = 0 ; i < pData->nChannels ; ++i)
+			nPending += pWrkrData->chans[i].nPending;
+		if (nPending == 0)
+			break;
+
+		if (die_on_error(amqp_simple_wait_frame(pWrkrData->conn, &frame), "waiting for publisher confirms")) {
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		}
+		if (frame.frame_type != AMQP_FRAME_METHOD)
+			continue;
+		if (frame.channel < 1 || frame.channel > pData->nChannels)
+			continue;
+		chan = &pWrkrData->chans[frame.channel - 1];
+
+		switch (frame.payload.method.id) {
+		case AMQP_BASIC_ACK_METHOD: {
+			amqp_basic_ack_t *m = (amqp_basic_ack_t *) frame.payload.method.decoded;
+			settleConfirm(chan, m->delivery_tag, m->multiple);
+			break;
+			}
+		case AMQP_BASIC_NACK_METHOD: {
+			amqp_basic_nack_t *m = (amqp_basic_nack_t *) frame.payload.method.decoded;
+			settleConfirm(chan, m->delivery_tag, m->multiple);
+			pWrkrData->bNacked = 1;
+			break;
+			}
+		case AMQP_CHANNEL_CLOSE_METHOD: {
+			amqp_channel_close_t *m = (amqp_channel_close_t *) frame.payload.method.decoded;
+			errmsg.LogError(0, RS_RET_SUSPENDED, "omrabbitmq: server closed channel %d while "
+				"waiting for confirms, error %d, message: %.*s", (int) chan->id,
+				m->reply_code, (int) m->reply_text.len, (char *) m->reply_text.bytes);
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+			}
+		case AMQP_CONNECTION_CLOSE_METHOD:
+			errmsg.LogError(0, RS_RET_SUSPENDED, "omrabbitmq: server closed connection "
+				"while waiting for confirms");
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		default:
+			break;
+		}
+	}
+
+	if (pWrkrData->bNacked) {
+		/* the broker could not take over responsibility for some messages;
+		 * we do not know which ones were lost, so retry the whole batch.
+		 */
+		errmsg.LogError(0, RS_RET_SUSPENDED, "omrabbitmq: broker rejected messages "
+			"(basic.nack), batch will be retried");
 		ABORT_FINALIZE(RS_RET_SUSPENDED);
 	}
 
@@ -226,6 +432,18 @@ CODESTARTcreateInstance
 ENDcreateInstance
 
 
+BEGINcreateWrkrInstance
+	int i;
+CODESTARTcreateWrkrInstance
+	pWrkrData->conn = NULL;
+	pWrkrData->iNextChan = 0;
+	CHKmalloc(pWrkrData->chans = calloc(pData->nChannels, sizeof(chanState_t)));
+	for(i = 0 ; i < pData->nChannels ; ++i)
+		pWrkrData->chans[i].id = (amqp_channel_t) (i + 1);
+finalize_it:
+ENDcreateWrkrInstance
+
+
 BEGINisCompatibleWithFeature
 CODESTARTisCompatibleWithFeature
 	/* use this to specify if select features are supported by this
@@ -243,7 +461,6 @@ CODESTARTfreeInstance
 	 * in instance data must be cleaned up here. Prime examples are
 	 * malloc()ed memory, file & database handles and the like.
 	 */
-	closeAMQPConnection(pData);
 	free(pData->host);
 	free(pData->vhost);
 	free(pData->user);
@@ -254,6 +471,18 @@ CODESTARTfreeInstance
 ENDfreeInstance
 
 
+BEGINfreeWrkrInstance
+	int i;
+CODESTARTfreeWrkrInstance
+	closeAMQPConnection(pWrkrData);
+	if(pWrkrData->chans != NULL) {
+		for(i = 0 ; i < pWrkrData->pData->nChannels ; ++i)
+			free(pWrkrData->chans[i].pending);
+		free(pWrkrData->chans);
+	}
+ENDfreeWrkrInstance
+
+
 BEGINdbgPrintInstInfo
 CODESTARTdbgPrintInstInfo
 	/* permits to spit out some debug info */
@@ -266,6 +495,9 @@ CODESTARTdbgPrintInstInfo
 	dbgprintf("\texchange='%s'\n", pData->exchange);
 	dbgprintf("\trouting_key='%s'\n", pData->routing_key);
 	dbgprintf("\ttemplate='%s'\n", pData->tplName);
+	dbgprintf("\tchannels=%d\n", pData->nChannels);
+	dbgprintf("\tpublisher_confirms=%d\n", pData->bConfirms);
+	dbgprintf("\tconfirm_timeout=%d\n", pData->confirmTimeout);
 ENDdbgPrintInstInfo
 
 
@@ -293,14 +525,29 @@ CODESTARTtryResume
 	 * not always be the case.
 	 */
 
-	if (pData->conn == NULL) {
-		iRet = initRabbitMQ(pData);
+	if (pWrkrData->conn == NULL) {
+		iRet = initRabbitMQ(pWrkrData);
 	}
 
 ENDtryResume
 
 
+BEGINbeginTransaction
+	int i;
+	chanState_t *chan;
+CODESTARTbeginTransaction
+	pWrkrData->bNacked = 0;
+	for(i = 0 ; i < pWrkrData->pData->nChannels ; ++i) {
+		chan = &pWrkrData->chans[i];
+		chan->baseTag = chan->nextTag;
+		chan->iLowest = 0;
+		chan->nPending = 0;
+	}
+ENDbeginTransaction
+
+
 BEGINdoAction
+	instanceData *pData = pWrkrData->pData;
 CODESTARTdoAction
 	/* this is where you receive the message and need to carry out the
 	 * action. Data is provided in ppString[i] where 0 <= i <= num of strings
@@ -313,27 +560,51 @@ CODESTARTdoAction
 	 * the next restart.
 	 */
 
+	chanState_t *chan;
 	amqp_bytes_t body_bytes;
 
-	if (pData->conn == NULL) {
-		CHKiRet(initRabbitMQ(pData));
+	if (pWrkrData->conn == NULL) {
+		CHKiRet(initRabbitMQ(pWrkrData));
 	}
 
+	chan = &pWrkrData->chans[pWrkrData->iNextChan];
+	if(++pWrkrData->iNextChan == pData->nChannels)
+		pWrkrData->iNextChan = 0;
+
+	if(pData->bConfirms)
+		CHKiRet(addPending(chan));
+
 	body_bytes = amqp_cstring_bytes((char *)ppString[0]);
 
-	if (die_on_error(amqp_basic_publish(pData->conn, 1,
+	if (die_on_error(amqp_basic_publish(pWrkrData->conn, chan->id,
 			cstring_bytes((char *) pData->exchange),
 			cstring_bytes((char *) pData->routing_key),
 			0, 0, &pData->props, body_bytes), "amqp_basic_publish")) {
-		closeAMQPConnection(pData);
+		closeAMQPConnection(pWrkrData);
 		ABORT_FINALIZE(RS_RET_SUSPENDED);
 	}
 
+	/* with confirms, the message is only safe once the broker ack'ed it,
+	 * which we check for the whole batch in endTransaction.
+	 */
+	if(pData->bConfirms)
+		iRet = RS_RET_DEFER_COMMIT;
+
 finalize_it:
 
 ENDdoAction
 
 
+BEGINendTransaction
+CODESTARTendTransaction
+	if(pWrkrData->pData->bConfirms && pWrkrData->conn != NULL) {
+		iRet = waitConfirms(pWrkrData);
+		if(iRet != RS_RET_OK)
+			closeAMQPConnection(pWrkrData);
+	}
+ENDendTransaction
+
+
 static inline void
 setInstParamDefaults(instanceData *pData)
 {
@@ -345,6 +616,9 @@ setInstParamDefaults(instanceData *pData)
 	pData->exchange = NULL;
 	pData->routing_key = NULL;
 	pData->tplName = NULL;
+	pData->nChannels = 1;
+	pData->bConfirms = 0;
+	pData->confirmTimeout = 30000;
 }
 
 
@@ -381,6 +655,12 @@ CODESTARTnewActInst
 			pData->routing_key = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if (!strcmp(actpblk.descr[i].name, "template")) {
 			pData->tplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if (!strcmp(actpblk.descr[i].name, "channels")) {
+			pData->nChannels = (int) pvals[i].val.d.n;
+		} else if (!strcmp(actpblk.descr[i].name, "publisher_confirms")) {
+			pData->bConfirms = (sbool) pvals[i].val.d.n;
+		} else if (!strcmp(actpblk.descr[i].name, "confirm_timeout")) {
+			pData->confirmTimeout = (int) pvals[i].val.d.n;
 		} else {
 			dbgprintf("omrabbitmq: program error, non-handled param '%s'\n", actpblk.descr[i].name);
 		}
@@ -454,6 +734,8 @@ ENDmodExit
 BEGINqueryEtryPt
 CODESTARTqueryEtryPt
 	CODEqueryEtryPt_STD_OMOD_QUERIES
+	CODEqueryEtryPt_STD_OMOD8_QUERIES
+	CODEqueryEtryPt_TXIF_OMOD_QUERIES
 	CODEqueryEtryPt_STD_CONF2_OMOD_QUERIES
 ENDqueryEtryPt
 
@@ -43,6 +43,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <ctype.h>
+#include <sys/time.h>
 #include <librelp.h>
 #include "conf.h"
 #include "syslogd-types.h"
@@ -53,6 +54,7 @@
 #include "errmsg.h"
 #include "debug.h"
 #include "unicode-helper.h"
+#include "statsobj.h"
 
 MODULE_TYPE_OUTPUT
 MODULE_TYPE_NOKEEP
@@ -63,9 +65,15 @@ MODULE_CNFNAME("omrelp")
 DEF_OMOD_STATIC_DATA
 DEFobjCurrIf(errmsg)
 DEFobjCurrIf(glbl)
+DEFobjCurrIf(statsobj)
 
 #define DFLT_ENABLE_TLS 0
 #define DFLT_ENABLE_TLSZIP 0
+#define MAX_CONNECTIONS 64
+#define RELP_DFLT_WINDOW 128	/* librelp's default window, used when windowSize is 0 */
+#define DFLT_WINDOW_MAX 16384	/* upper bound for window auto-tuning */
+#define AUTOTUNE_INTERVAL 10	/* seconds between window tuning decisions */
+#define WINDOW_FULL_USECS 1000	/* a send taking longer than this waited for acks */
 
 static relpEngine_t *pRelpEngine;	/* our relp engine */
 
@@ -88,14 +96,37 @@ typedef struct _instanceData {
 		int nmemb;
 		uchar **name;
 	} permittedPeers;
+	int nConns;		/**< number of parallel RELP connections per worker */
+	sbool bAutoWindow;	/**< auto-tune the window size? */
+	int sizeWindowMax;	/**< upper bound for auto-tuning */
+	statsobj_t *stats;
+	STATSCOUNTER_DEF(ctrSubmit, mutCtrSubmit)
+	STATSCOUNTER_DEF(ctrWindowFull, mutCtrWindowFull)
+	STATSCOUNTER_DEF(ctrAckWait, mutCtrAckWait)
+	int statWindowSize;	/* window size currently used (last tuned) */
+	int statRtt;		/* last measured round trip time in microseconds */
 } instanceData;
 
-typedef struct wrkrInstanceData {
-	instanceData *pData;
+/* one RELP connection. A worker may drive multiple of them in parallel,
+ * each keeping its own window, which helps on high-latency links.
+ */
+typedef struct relpConn_s {
+	relpClt_t *pRelpClt; /* relp client for this connection */
 	int bInitialConnect; /* is this the initial connection request of our module? (0-no, 1-yes) */
 	int bIsConnected; /* currently connected to server? 0 - no, 1 - yes */
-	relpClt_t *pRelpClt; /* relp client for this instance */
 	unsigned nSent; /* number msgs sent - for rebind support */
+	int sizeWindow;	/* window size used for this connection */
+	/* data for window auto-tuning */
+	time_t ttTune;	/* start of current measurement interval */
+	unsigned nTuneSent; /* msgs sent in interval */
+	unsigned nTuneFull; /* sends that had to wait for acks in interval */
+	long rttUsecs;	/* round trip estimate, taken from the RELP open handshake */
+} relpConn_t;
+
+typedef struct wrkrInstanceData {
+	instanceData *pData;
+	relpConn_t *conns;
+	int iNextConn;	/* where the next message goes to */
 } wrkrInstanceData_t;
 
 typedef struct configSettings_s {
@@ -103,7 +134,7 @@ typedef struct configSettings_s {
 } configSettings_t;
 static configSettings_t __attribute__((unused)) cs;
 
-static rsRetVal doCreateRelpClient(wrkrInstanceData_t *pWrkrData);
+static rsRetVal doCreateRelpClient(wrkrInstanceData_t *pWrkrData, relpConn_t *pConn);
 
 /* tables for interfacing with the v6 config system */
 /* action (instance) parameters */
@@ -120,6 +151,9 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "port", eCmdHdlrGetWord, 0 },
 	{ "rebindinterval", eCmdHdlrInt, 0 },
 	{ "windowsize", eCmdHdlrInt, 0 },
+	{ "windowsize.auto", eCmdHdlrBinary, 0 },
+	{ "windowsize.max", eCmdHdlrPositiveInt, 0 },
+	{ "connections", eCmdHdlrPositiveInt, 0 },
 	{ "timeout", eCmdHdlrInt, 0 },
 	{ "template", eCmdHdlrGetWord, 0 }
 };
@@ -173,51 +207,51 @@ onAuthErr(void *pUsr, char *authinfo, char* errmesg, __attribute__((unused)) rel
 }
 
 static rsRetVal
-doCreateRelpClient(wrkrInstanceData_t *pWrkrData)
+doCreateRelpClient(wrkrInstanceData_t *pWrkrData, relpConn_t *pConn)
 {
 	int i;
 	instanceData *pData;
 	DEFiRet;
 
 	pData = pWrkrData->pData;
-	if(relpEngineCltConstruct(pRelpEngine, &pWrkrData->pRelpClt) != RELP_RET_OK)
+	if(relpEngineCltConstruct(pRelpEngine, &pConn->pRelpClt) != RELP_RET_OK)
 		ABORT_FINALIZE(RS_RET_RELP_ERR);
-	if(relpCltSetTimeout(pWrkrData->pRelpClt, pData->timeout) != RELP_RET_OK)
+	if(relpCltSetTimeout(pConn->pRelpClt, pData->timeout) != RELP_RET_OK)
 		ABORT_FINALIZE(RS_RET_RELP_ERR);
-	if(relpCltSetWindowSize(pWrkrData->pRelpClt, pData->sizeWindow) != RELP_RET_OK)
+	if(relpCltSetWindowSize(pConn->pRelpClt, pConn->sizeWindow) != RELP_RET_OK)
 		ABORT_FINALIZE(RS_RET_RELP_ERR);
-	if(relpCltSetUsrPtr(pWrkrData->pRelpClt, pWrkrData) != RELP_RET_OK)
+	if(relpCltSetUsrPtr(pConn->pRelpClt, pWrkrData) != RELP_RET_OK)
 		ABORT_FINALIZE(RS_RET_RELP_ERR);
 	if(pData->bEnableTLS) {
-		if(relpCltEnableTLS(pWrkrData->pRelpClt) != RELP_RET_OK)
+		if(relpCltEnableTLS(pConn->pRelpClt) != RELP_RET_OK)
 			ABORT_FINALIZE(RS_RET_RELP_ERR);
 		if(pData->bEnableTLSZip) {
-			if(relpCltEnableTLSZip(pWrkrData->pRelpClt) != RELP_RET_OK)
+			if(relpCltEnableTLSZip(pConn->pRelpClt) != RELP_RET_OK)
 				ABORT_FINALIZE(RS_RET_RELP_ERR);
 		}
-		if(relpCltSetGnuTLSPriString(pWrkrData->pRelpClt, (char*) pData->pristring) != RELP_RET_OK)
+		if(relpCltSetGnuTLSPriString(pConn->pRelpClt, (char*) pData->pristring) != RELP_RET_OK)
 			ABORT_FINALIZE(RS_RET_RELP_ERR);
-		if(relpCltSetAuthMode(pWrkrData->pRelpClt, (char*) pData->authmode) != RELP_RET_OK) {
+		if(relpCltSetAuthMode(pConn->pRelpClt, (char*) pData->authmode) != RELP_RET_OK) {
 			errmsg.LogError(0, RS_RET_RELP_ERR,
 					"omrelp: invalid auth mode '%s'\n", pData->authmode);
 			ABORT_FINALIZE(RS_RET_RELP_ERR);
 		}
-		if(relpCltSetCACert(pWrkrData->pRelpClt, (char*) pData->caCertFile) != RELP_RET_OK)
+		if(relpCltSetCACert(pConn->pRelpClt, (char*) pData->caCertFile) != RELP_RET_OK)
 			ABORT_FINALIZE(RS_RET_RELP_ERR);
-		if(relpCltSetOwnCert(pWrkrData->pRelpClt, (char*) pData->myCertFile) != RELP_RET_OK)
+		if(relpCltSetOwnCert(pConn->pRelpClt, (char*) pData->myCertFile) != RELP_RET_OK)
 			ABORT_FINALIZE(RS_RET_RELP_ERR);
-		if(relpCltSetPrivKey(pWrkrData->pRelpClt, (char*) pData->myPrivKeyFile) != RELP_RET_OK)
+		if(relpCltSetPrivKey(pConn->pRelpClt, (char*) pData->myPrivKeyFile) != RELP_RET_OK)
 			ABORT_FINALIZE(RS_RET_RELP_ERR);
 		for(i = 0 ; i <  pData->permittedPeers.nmemb ; ++i) {
-			relpCltAddPermittedPeer(pWrkrData->pRelpClt, (char*)pData->permittedPeers.name[i]);
+			relpCltAddPermittedPeer(pConn->pRelpClt, (char*)pData->permittedPeers.name[i]);
 		}
 	}
 	if(glbl.GetSourceIPofLocalClient() == NULL) {	/* ar Do we have a client IP set? */
-		if(relpCltSetClientIP(pWrkrData->pRelpClt, glbl.GetSourceIPofLocalClient()) != RELP_RET_OK)
+		if(relpCltSetClientIP(pConn->pRelpClt, glbl.GetSourceIPofLocalClient()) != RELP_RET_OK)
 			ABORT_FINALIZE(RS_RET_RELP_ERR);
 	}
-	pWrkrData->bInitialConnect = 1;
-	pWrkrData->nSent = 0;
+	pConn->bInitialConnect = 1;
+	pConn->nSent = 0;
 finalize_it:
 	RETiRet;
 }
@@ -236,12 +270,22 @@ CODESTARTcreateInstance
 	pData->myCertFile = NULL;
 	pData->myPrivKeyFile = NULL;
 	pData->permittedPeers.nmemb = 0;
+	pData->nConns = 1;
+	pData->bAutoWindow = 0;
+	pData->sizeWindowMax = DFLT_WINDOW_MAX;
+	pData->stats = NULL;
 ENDcreateInstance
 
 BEGINcreateWrkrInstance
+	int i;
 CODESTARTcreateWrkrInstance
-	pWrkrData->pRelpClt = NULL;
-	iRet = doCreateRelpClient(pWrkrData);
+	pWrkrData->iNextConn = 0;
+	CHKmalloc(pWrkrData->conns = calloc(pData->nConns, sizeof(relpConn_t)));
+	for(i = 0 ; i < pData->nConns ; ++i) {
+		pWrkrData->conns[i].sizeWindow = pData->sizeWindow;
+		CHKiRet(doCreateRelpClient(pWrkrData, &pWrkrData->conns[i]));
+	}
+finalize_it:
 ENDcreateWrkrInstance
 
 BEGINfreeInstance
@@ -258,12 +302,18 @@ CODESTARTfreeInstance
 	for(i = 0 ; i <  pData->permittedPeers.nmemb ; ++i) {
 		free(pData->permittedPeers.name[i]);
 	}
+	if(pData->stats != NULL)
+		statsobj.Destruct(&pData->stats);
 ENDfreeInstance
 
 BEGINfreeWrkrInstance
+	int i;
 CODESTARTfreeWrkrInstance
-	if(pWrkrData->pRelpClt != NULL)
-		relpEngineCltDestruct(pRelpEngine, &pWrkrData->pRelpClt);
+	for(i = 0 ; pWrkrData->conns != NULL && i < pWrkrData->pData->nConns ; ++i) {
+		if(pWrkrData->conns[i].pRelpClt != NULL)
+			relpEngineCltDestruct(pRelpEngine, &pWrkrData->conns[i].pRelpClt);
+	}
+	free(pWrkrData->conns);
 ENDfreeWrkrInstance
 
 static inline void
@@ -283,6 +333,43 @@ setInstParamDefaults(instanceData *pData)
 	pData->myCertFile = NULL;
 	pData->myPrivKeyFile = NULL;
 	pData->permittedPeers.nmemb = 0;
+	pData->nConns = 1;
+	pData->bAutoWindow = 0;
+	pData->sizeWindowMax = DFLT_WINDOW_MAX;
+}
+
+
+/* create the per-action statistics counters */
+static rsRetVal
+initStats(instanceData *pData)
+{
+	uchar ctrName[512];
+	DEFiRet;
+
+	snprintf((char*)ctrName, sizeof(ctrName), "omrelp(%s:%s)", pData->target,
+		 (pData->port == NULL) ? "514" : (char*)pData->port);
+	ctrName[sizeof(ctrName)-1] = '\0';
+	CHKiRet(statsobj.Construct(&pData->stats));
+	CHKiRet(statsobj.SetName(pData->stats, ctrName));
+	STATSCOUNTER_INIT(pData->ctrSubmit, pData->mutCtrSubmit);
+	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("submitted"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pData->ctrSubmit));
+	STATSCOUNTER_INIT(pData->ctrWindowFull, pData->mutCtrWindowFull);
+	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("window.full"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pData->ctrWindowFull));
+	STATSCOUNTER_INIT(pData->ctrAckWait, pData->mutCtrAckWait);
+	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("ackwait.us"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pData->ctrAckWait));
+	pData->statWindowSize = (pData->sizeWindow == 0) ? RELP_DFLT_WINDOW : pData->sizeWindow;
+	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("window.size"),
+		ctrType_Int, CTR_FLAG_NONE, &pData->statWindowSize));
+	pData->statRtt = 0;
+	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("rtt.us"),
+		ctrType_Int, CTR_FLAG_NONE, &pData->statRtt));
+	CHKiRet(statsobj.ConstructFinalize(pData->stats));
+
+finalize_it:
+	RETiRet;
 }
 
 
@@ -312,6 +399,17 @@ CODESTARTnewActInst
 			pData->rebindInterval = (unsigned) pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "windowsize")) {
 			pData->sizeWindow = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "windowsize.auto")) {
+			pData->bAutoWindow = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "windowsize.max")) {
+			pData->sizeWindowMax = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "connections")) {
+			pData->nConns = (int) pvals[i].val.d.n;
+			if(pData->nConns > MAX_CONNECTIONS) {
+				errmsg.LogError(0, RS_RET_PARAM_ERROR, "omrelp: connections %d too "
+					"large, using %d", pData->nConns, MAX_CONNECTIONS);
+				pData->nConns = MAX_CONNECTIONS;
+			}
 		} else if(!strcmp(actpblk.descr[i].name, "tls")) {
 			pData->bEnableTLS = (unsigned) pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "tls.compression")) {
@@ -339,6 +437,10 @@ CODESTARTnewActInst
 		}
 	}
 	
+	if(pData->bAutoWindow && pData->sizeWindow == 0)
+		pData->sizeWindow = RELP_DFLT_WINDOW; /* we need to know where we start */
+	CHKiRet(initStats(pData));
+
 	CODE_STD_STRING_REQUESTnewActInst(1)
 
 	CHKiRet(OMSRsetEntry(*ppOMSR, 0, (uchar*)strdup((pData->tplName == NULL) ?
@@ -369,26 +471,45 @@ CODESTARTdbgPrintInstInfo
 ENDdbgPrintInstInfo
 
 
+static inline long
+usecsSince(struct timeval *tvStart)
+{
+	struct timeval tvNow;
+
+	gettimeofday(&tvNow, NULL);
+	return (tvNow.tv_sec - tvStart->tv_sec) * 1000000L + (tvNow.tv_usec - tvStart->tv_usec);
+}
+
+
 /* try to connect to server
  * rgerhards, 2008-03-21
  */
-static rsRetVal doConnect(wrkrInstanceData_t *pWrkrData)
+static rsRetVal doConnect(wrkrInstanceData_t *pWrkrData, relpConn_t *pConn)
 {
+	struct timeval tvStart;
 	DEFiRet;
 
-	if(pWrkrData->bInitialConnect) {
-		iRet = relpCltConnect(pWrkrData->pRelpClt, glbl.GetDefPFFamily(),
+	gettimeofday(&tvStart, NULL);
+	if(pConn->bInitialConnect) {
+		iRet = relpCltConnect(pConn->pRelpClt, glbl.GetDefPFFamily(),
 				      pWrkrData->pData->port, pWrkrData->pData->target);
 		if(iRet == RELP_RET_OK)
-			pWrkrData->bInitialConnect = 0;
+			pConn->bInitialConnect = 0;
 	} else {
-		iRet = relpCltReconnect(pWrkrData->pRelpClt);
+		iRet = relpCltReconnect(pConn->pRelpClt);
 	}
 
 	if(iRet == RELP_RET_OK) {
-		pWrkrData->bIsConnected = 1;
+		pConn->bIsConnected = 1;
+		/* the connect includes the TCP handshake and the RELP "open"
+		 * command/response, so it takes about two round trips.
+		 */
+		pConn->rttUsecs = usecsSince(&tvStart) / 2;
+		pWrkrData->pData->statRtt = (int) pConn->rttUsecs;
+		pConn->ttTune = time(NULL);
+		pConn->nTuneSent = pConn->nTuneFull = 0;
 	} else {
-		pWrkrData->bIsConnected = 0;
+		pConn->bIsConnected = 0;
 		iRet = RS_RET_SUSPENDED;
 	}
 
@@ -396,50 +517,106 @@ static rsRetVal doConnect(wrkrInstanceData_t *pWrkrData)
 }
 
 
+/* connect all connections which are not yet connected. We are
+ * ready if at least one of them is connected.
+ */
+static rsRetVal doConnectAll(wrkrInstanceData_t *pWrkrData)
+{
+	int i;
+	int nConnected = 0;
+	DEFiRet;
+
+	for(i = 0 ; i < pWrkrData->pData->nConns ; ++i) {
+		if(pWrkrData->conns[i].bIsConnected || doConnect(pWrkrData, &pWrkrData->conns[i]) == RS_RET_OK)
+			++nConnected;
+	}
+	if(nConnected == 0)
+		iRet = RS_RET_SUSPENDED;
+	RETiRet;
+}
+
+
 BEGINtryResume
 CODESTARTtryResume
 	if(pWrkrData->pData->bHadAuthFail) {
 		ABORT_FINALIZE(RS_RET_DISABLE_ACTION);
 	}
-	iRet = doConnect(pWrkrData);
+	iRet = doConnectAll(pWrkrData);
 finalize_it:
 ENDtryResume
 
 static inline rsRetVal
-doRebind(wrkrInstanceData_t *pWrkrData)
+doRebind(relpConn_t *pConn, wrkrInstanceData_t *pWrkrData)
 {
 	DEFiRet;
 	DBGPRINTF("omrelp: destructing relp client due to rebindInterval\n");
-	CHKiRet(relpEngineCltDestruct(pRelpEngine, &pWrkrData->pRelpClt));
-	pWrkrData->bIsConnected = 0;
-	CHKiRet(doCreateRelpClient(pWrkrData));
+	CHKiRet(relpEngineCltDestruct(pRelpEngine, &pConn->pRelpClt));
+	pConn->bIsConnected = 0;
+	CHKiRet(doCreateRelpClient(pWrkrData, pConn));
 finalize_it:
 	RETiRet;
 }
 
+
+/* Check if the window of a connection limited its throughput during the
+ * last interval. If so, the window is doubled. That is, it grows until it
+ * covers the bandwidth-delay product of the link, where sends no longer
+ * wait for acks. The new window becomes active with a new session, so we
+ * rebind the connection.
+ */
+static void
+autoTuneWindow(wrkrInstanceData_t *pWrkrData, relpConn_t *pConn)
+{
+	instanceData *const pData = pWrkrData->pData;
+	const time_t ttNow = time(NULL);
+	int newWindow;
+
+	if(ttNow - pConn->ttTune < AUTOTUNE_INTERVAL)
+		return;
+	/* window limited if more than 1% of the sends had to wait for acks */
+	if(pConn->nTuneFull * 100 > pConn->nTuneSent && pConn->sizeWindow < pData->sizeWindowMax) {
+		newWindow = pConn->sizeWindow * 2;
+		if(newWindow > pData->sizeWindowMax)
+			newWindow = pData->sizeWindowMax;
+		DBGPRINTF("omrelp: %u of %u sends waited for acks, rtt %ldus - window "
+			  "size %d -> %d\n", pConn->nTuneFull, pConn->nTuneSent,
+			  pConn->rttUsecs, pConn->sizeWindow, newWindow);
+		pConn->sizeWindow = newWindow;
+		pData->statWindowSize = newWindow;
+		doRebind(pConn, pWrkrData);
+	}
+	pConn->ttTune = ttNow;
+	pConn->nTuneSent = pConn->nTuneFull = 0;
+}
+
 BEGINbeginTransaction
+	int i;
 CODESTARTbeginTransaction
 dbgprintf("omrelp: beginTransaction\n");
-	if(!pWrkrData->bIsConnected) {
-		CHKiRet(doConnect(pWrkrData));
+	CHKiRet(doConnectAll(pWrkrData));
+	for(i = 0 ; i < pWrkrData->pData->nConns ; ++i) {
+		if(pWrkrData->conns[i].bIsConnected)
+			relpCltHintBurstBegin(pWrkrData->conns[i].pRelpClt);
 	}
-	relpCltHintBurstBegin(pWrkrData->pRelpClt);
 finalize_it:
 ENDbeginTransaction
 
+/* Messages are distributed round-robin over the connections. Order is
+ * kept within each connection, but not across them.
+ */
 BEGINdoAction
 	uchar *pMsg; /* temporary buffering */
 	size_t lenMsg;
 	relpRetVal ret;
 	instanceData *pData;
+	relpConn_t *pConn;
+	struct timeval tvStart;
+	long usecs;
+	int nTries;
 CODESTARTdoAction
 	pData = pWrkrData->pData;
 	dbgprintf(" %s:%s/RELP\n", pData->target, getRelpPt(pData));
 
-	if(!pWrkrData->bIsConnected) {
-		CHKiRet(doConnect(pWrkrData));
-	}
-
 	pMsg = ppString[0];
 	lenMsg = strlen((char*) pMsg); /* TODO: don't we get this? */
 
@@ -447,17 +624,39 @@ CODESTARTdoAction
 	if((int) lenMsg > glbl.GetMaxLine())
 		lenMsg = glbl.GetMaxLine();
 
-	/* forward */
-	ret = relpCltSendSyslog(pWrkrData->pRelpClt, (uchar*) pMsg, lenMsg);
-	if(ret != RELP_RET_OK) {
+	for(nTries = 0 ; ; ++nTries) {
+		if(nTries == pData->nConns) {
+			dbgprintf("error forwarding via relp, suspending\n");
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		}
+		pConn = &pWrkrData->conns[pWrkrData->iNextConn];
+		pWrkrData->iNextConn = (pWrkrData->iNextConn + 1) % pData->nConns;
+		if(!pConn->bIsConnected && doConnect(pWrkrData, pConn) != RS_RET_OK)
+			continue;
+
+		/* forward */
+		gettimeofday(&tvStart, NULL);
+		ret = relpCltSendSyslog(pConn->pRelpClt, (uchar*) pMsg, lenMsg);
+		if(ret == RELP_RET_OK)
+			break;
 		/* error! */
-		dbgprintf("error forwarding via relp, suspending\n");
-		ABORT_FINALIZE(RS_RET_SUSPENDED);
+		dbgprintf("error forwarding via relp, trying next connection\n");
+		pConn->bIsConnected = 0;
+	}
+
+	STATSCOUNTER_INC(pData->ctrSubmit, pData->mutCtrSubmit);
+	usecs = usecsSince(&tvStart);
+	++pConn->nTuneSent;
+	if(usecs > WINDOW_FULL_USECS) {
+		/* librelp blocks when the window is full, until acks arrive */
+		++pConn->nTuneFull;
+		STATSCOUNTER_INC(pData->ctrWindowFull, pData->mutCtrWindowFull);
+		STATSCOUNTER_ADD(pData->ctrAckWait, pData->mutCtrAckWait, usecs);
 	}
 
 	if(pData->rebindInterval != 0 &&
-	   (++pWrkrData->nSent >= pData->rebindInterval)) {
-	   	doRebind(pWrkrData);
+	   (++pConn->nSent >= pData->rebindInterval)) {
+	   	doRebind(pConn, pWrkrData);
 	}
 finalize_it:
 	if(pData->bHadAuthFail)
@@ -474,9 +673,16 @@ ENDdoAction
 
 
 BEGINendTransaction
+	int i;
 CODESTARTendTransaction
 	dbgprintf("omrelp: endTransaction\n");
-	relpCltHintBurstEnd(pWrkrData->pRelpClt);
+	for(i = 0 ; i < pWrkrData->pData->nConns ; ++i) {
+		if(!pWrkrData->conns[i].bIsConnected)
+			continue;
+		relpCltHintBurstEnd(pWrkrData->conns[i].pRelpClt);
+		if(pWrkrData->pData->bAutoWindow)
+			autoTuneWindow(pWrkrData, &pWrkrData->conns[i]);
+	}
 ENDendTransaction
 
 BEGINparseSelectorAct
@@ -566,6 +772,7 @@ CODESTARTmodExit
 	/* release what we no longer need */
 	objRelease(glbl, CORE_COMPONENT);
 	objRelease(errmsg, CORE_COMPONENT);
+	objRelease(statsobj, CORE_COMPONENT);
 ENDmodExit
 
 
@@ -596,4 +803,5 @@ CODEmodInit_QueryRegCFSLineHdlr
 	/* tell which objects we need */
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
 	CHKiRet(objUse(glbl, CORE_COMPONENT));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 ENDmodInit
@@ -80,11 +80,15 @@ typedef struct _instanceData {
 	int iSpecificType;		/* Snmp Specific Type */
 
 	uchar	*tplName;       	/* format template to use */
+	netsnmp_pdu *pduTemplate;	/* PDU with all OIDs and varbinds, built at config load and
+					 * cloned for each trap, so that only the values need to be set */
 } instanceData;
 
 typedef struct wrkrInstanceData {
 	instanceData *pData;
-	netsnmp_session *snmpsession;	/* Holds to SNMP Session, NULL if not initialized */
+	void *snmpsession;		/* single session handle, NULL if not initialized */
+	long uptimeBase;		/* uptime (centiseconds) when the session was opened... */
+	struct timeval tvUptimeBase;	/* ...and the time of day it corresponds to */
 } wrkrInstanceData_t;
 
 typedef struct configSettings_s {
@@ -176,6 +180,98 @@ CODESTARTisCompatibleWithFeature
 	/* we are not compatible with repeated msg reduction feature, so do not allow it */
 ENDisCompatibleWithFeature
 
+/* initialize the net-snmp library (only once) */
+static void
+omsnmp_initLib(void)
+{
+	static int bInitDone = 0;
+
+	if(bInitDone)
+		return;
+	putenv(strdup("POSIXLY_CORRECT=1"));
+	/* Init NetSNMP library and read in MIB database */
+	init_snmp("rsyslog");
+	bInitDone = 1;
+}
+
+
+/* Build the PDU template of an action. All OIDs are parsed here, at config
+ * load, so that sending a trap just requires to clone the template and set
+ * the uptime and message values.
+ */
+static rsRetVal
+omsnmp_buildPDUTemplate(instanceData *pData)
+{
+	netsnmp_pdu *pdu = NULL;
+	oid objid[MAX_OID_LEN];
+	size_t lenObjid = MAX_OID_LEN;
+	char *pszOID;
+	DEFiRet;
+
+	omsnmp_initLib();
+	if(pData->iSNMPVersion == SNMP_VERSION_1) {
+		CHKmalloc(pdu = snmp_pdu_create(SNMP_MSG_TRAP));
+		pszOID = pData->szEnterpriseOID == NULL ? "1.3.6.1.4.1.3.1.1" : (char*)pData->szEnterpriseOID;
+		if(!snmp_parse_oid(pszOID, objid, &lenObjid)) {
+			errmsg.LogError(0, RS_RET_CONFIG_ERROR, "omsnmp: parsing EnterpriseOID "
+					"failed '%s' with error '%s'", pszOID, snmp_api_errstring(snmp_errno));
+			ABORT_FINALIZE(RS_RET_CONFIG_ERROR);
+		}
+		CHKmalloc(pdu->enterprise = (oid *) MALLOC(lenObjid * sizeof(oid)));
+		memcpy(pdu->enterprise, objid, lenObjid * sizeof(oid));
+		pdu->enterprise_length = lenObjid;
+		pdu->trap_type = pData->iTrapType;
+		pdu->specific_type = pData->iSpecificType;
+	} else {
+		CHKmalloc(pdu = snmp_pdu_create(SNMP_MSG_TRAP2));
+		/* the uptime is the first varbind (value set per trap) */
+		snmp_add_var(pdu, objid_sysuptime, sizeof(objid_sysuptime) / sizeof(oid), 't', "0");
+		pszOID = pData->szSnmpTrapOID == NULL ? "1.3.6.1.4.1.19406.1.2.1" : (char*)pData->szSnmpTrapOID;
+		if(snmp_add_var(pdu, objid_snmptrap, sizeof(objid_snmptrap) / sizeof(oid), 'o', pszOID) != 0) {
+			errmsg.LogError(0, RS_RET_CONFIG_ERROR, "omsnmp: adding trap OID failed '%s' "
+					"with error '%s'", pszOID, snmp_api_errstring(snmp_errno));
+			ABORT_FINALIZE(RS_RET_CONFIG_ERROR);
+		}
+	}
+
+	/* the syslog message is always the last varbind (value set per trap) */
+	lenObjid = MAX_OID_LEN;
+	pszOID = pData->szSyslogMessageOID == NULL ? "1.3.6.1.4.1.19406.1.1.2.1" : (char*)pData->szSyslogMessageOID;
+	if(!snmp_parse_oid(pszOID, objid, &lenObjid)) {
+		errmsg.LogError(0, RS_RET_CONFIG_ERROR, "omsnmp: parsing SyslogMessageOID failed '%s' "
+				"with error '%s'", pszOID, snmp_api_errstring(snmp_errno));
+		ABORT_FINALIZE(RS_RET_CONFIG_ERROR);
+	}
+	if(snmp_pdu_add_variable(pdu, objid, lenObjid, ASN_OCTET_STR, (u_char*) "", 0) == NULL) {
+		errmsg.LogError(0, RS_RET_CONFIG_ERROR, "omsnmp: invalid SyslogMessageOID '%s'", pszOID);
+		ABORT_FINALIZE(RS_RET_CONFIG_ERROR);
+	}
+	pData->pduTemplate = pdu;
+	pdu = NULL;
+
+finalize_it:
+	if(pdu != NULL)
+		snmp_free_pdu(pdu);
+	RETiRet;
+}
+
+
+/* obtain the uptime for a trap. net-snmp's get_uptime() reads /proc on
+ * each call, so we do so only when the session is opened and derive the
+ * uptime from the time of day later on.
+ */
+static long
+omsnmp_getUptime(wrkrInstanceData_t *pWrkrData)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return pWrkrData->uptimeBase
+		+ (tv.tv_sec - pWrkrData->tvUptimeBase.tv_sec) * 100
+		+ (tv.tv_usec - pWrkrData->tvUptimeBase.tv_usec) / 10000;
+}
+
+
 /* Exit SNMP Session
  * alorbach, 2008-02-12
  */
@@ -187,7 +283,7 @@ omsnmp_exitSession(wrkrInstanceData_t *pWrkrData)
 	if(pWrkrData->snmpsession != NULL) {
 		DBGPRINTF("omsnmp_exitSession: Clearing Session to '%s' on Port = '%d'\n",
 			  pWrkrData->pData->szTarget, pWrkrData->pData->iPort);
-		snmp_close(pWrkrData->snmpsession);
+		snmp_sess_close(pWrkrData->snmpsession);
 		pWrkrData->snmpsession = NULL;
 	}
 
@@ -217,8 +313,6 @@ omsnmp_initSession(wrkrInstanceData_t *pWrkrData)
 
 	dbgprintf( "omsnmp_initSession: ENTER - Target = '%s' on Port = '%d'\n", pData->szTarget, pData->iPort);
 
-	putenv(strdup("POSIXLY_CORRECT=1"));
-	
 	snmp_sess_init(&session);
 	session.version = pData->iSNMPVersion;
 	session.callback = NULL; /* NOT NEEDED */
@@ -231,11 +325,17 @@ omsnmp_initSession(wrkrInstanceData_t *pWrkrData)
 		session.community_len = strlen((char*) session.community);
 	}
 
-	pWrkrData->snmpsession = snmp_open(&session);
+	/* we use the single session API, which does not need the global
+	 * session list (and its lock) of the traditional API.
+	 */
+	pWrkrData->snmpsession = snmp_sess_open(&session);
 	if (pWrkrData->snmpsession == NULL) {
 		errmsg.LogError(0, RS_RET_SUSPENDED, "omsnmp_initSession: snmp_open to host '%s' on Port '%d' failed\n", pData->szTarget, pData->iPort);
 		/* Stay suspended */
 		iRet = RS_RET_SUSPENDED;
+	} else {
+		pWrkrData->uptimeBase = get_uptime();
+		gettimeofday(&pWrkrData->tvUptimeBase, NULL);
 	}
 
 	RETiRet;
@@ -246,14 +346,10 @@ static rsRetVal omsnmp_sendsnmp(wrkrInstanceData_t *pWrkrData, uchar *psz)
 	DEFiRet;
 
 	netsnmp_pdu    *pdu = NULL;
-	oid             enterpriseoid[MAX_OID_LEN];
-	size_t          enterpriseoidlen = MAX_OID_LEN;
-	oid				oidSyslogMessage[MAX_OID_LEN];
-	size_t			oLen = MAX_OID_LEN;
-	int             status;
-	char            *trap = NULL;
-	const char		*strErr = NULL;
+	netsnmp_variable_list *var;
 	instanceData *pData;
+	int liberr, syserr;
+	char *strErr;
 
 	pData = pWrkrData->pData;
 	/* Init SNMP Session if necessary */
@@ -265,83 +361,29 @@ static rsRetVal omsnmp_sendsnmp(wrkrInstanceData_t *pWrkrData, uchar *psz)
 	ASSERT(psz != NULL);
 	dbgprintf( "omsnmp_sendsnmp: ENTER - Syslogmessage = '%s'\n", (char*)psz);
 
-	/* If SNMP Version1 is configured !*/
-	if(pWrkrData->snmpsession->version == SNMP_VERSION_1) {
-		pdu = snmp_pdu_create(SNMP_MSG_TRAP);
-
-		/* Set enterprise */
-		if(!snmp_parse_oid(pData->szEnterpriseOID == NULL ? "1.3.6.1.4.1.3.1.1" : (char*)pData->szEnterpriseOID,
-				   enterpriseoid, &enterpriseoidlen )) {
-			strErr = snmp_api_errstring(snmp_errno);
-			errmsg.LogError(0, RS_RET_DISABLE_ACTION, "omsnmp_sendsnmp: Parsing EnterpriseOID "
-					"failed '%s' with error '%s' \n", pData->szSyslogMessageOID, strErr);
-			ABORT_FINALIZE(RS_RET_DISABLE_ACTION);
-		}
-		pdu->enterprise = (oid *) MALLOC(enterpriseoidlen * sizeof(oid));
-		memcpy(pdu->enterprise, enterpriseoid, enterpriseoidlen * sizeof(oid));
-		pdu->enterprise_length = enterpriseoidlen;
-
-		/* Set Traptype */
-		pdu->trap_type = pData->iTrapType; 
-		
-		/* Set SpecificType */
-		pdu->specific_type = pData->iSpecificType;
-
-		/* Set Updtime */
-		pdu->time = get_uptime();
-	}
-	/* If SNMP Version2c is configured !*/
-	else if (pWrkrData->snmpsession->version == SNMP_VERSION_2c) 
-	{
-		long sysuptime;
-		char csysuptime[20];
-		
-		/* Create PDU */
-		pdu = snmp_pdu_create(SNMP_MSG_TRAP2);
-		
-		/* Set uptime */
-		sysuptime = get_uptime();
-		snprintf( csysuptime, sizeof(csysuptime) , "%ld", sysuptime);
-		trap = csysuptime;
-		snmp_add_var(pdu, objid_sysuptime, sizeof(objid_sysuptime) / sizeof(oid), 't', trap);
-
-		/* Now set the SyslogMessage Trap OID */
-		if ( snmp_add_var(pdu, objid_snmptrap, sizeof(objid_snmptrap) / sizeof(oid), 'o',
-			pData->szSnmpTrapOID == NULL ?  "1.3.6.1.4.1.19406.1.2.1" : (char*) pData->szSnmpTrapOID
-			) != 0) {
-			strErr = snmp_api_errstring(snmp_errno);
-			errmsg.LogError(0, RS_RET_DISABLE_ACTION, "omsnmp_sendsnmp: Adding trap OID failed '%s' with error '%s' \n", pData->szSnmpTrapOID, strErr);
-			ABORT_FINALIZE(RS_RET_DISABLE_ACTION);
-		}
-	}
-
-	/* SET TRAP PARAMETER for SyslogMessage! */
-/*	dbgprintf( "omsnmp_sendsnmp: SyslogMessage '%s'\n", psz );*/
-
-	/* First create new OID object */
-	if (snmp_parse_oid(pData->szSyslogMessageOID == NULL ?
-			    "1.3.6.1.4.1.19406.1.1.2.1" : (char*)pData->szSyslogMessageOID,
-				oidSyslogMessage, &oLen)) {
-		int iErrCode = snmp_add_var(pdu, oidSyslogMessage, oLen, 's', (char*) psz);
-		if (iErrCode) {
-			const char *str = snmp_api_errstring(iErrCode);
-			errmsg.LogError(0, RS_RET_DISABLE_ACTION,  "omsnmp_sendsnmp: Invalid SyslogMessage OID, error code '%d' - '%s'\n", iErrCode, str );
-			ABORT_FINALIZE(RS_RET_DISABLE_ACTION);
-		}
+	CHKmalloc(pdu = snmp_clone_pdu(pData->pduTemplate));
+	if(pdu->command == SNMP_MSG_TRAP) {
+		pdu->time = omsnmp_getUptime(pWrkrData);
 	} else {
-		strErr = snmp_api_errstring(snmp_errno);
-		errmsg.LogError(0, RS_RET_DISABLE_ACTION, "omsnmp_sendsnmp: Parsing SyslogMessageOID failed '%s' with error '%s' \n", pData->szSyslogMessageOID, strErr);
+		snmp_set_var_typed_integer(pdu->variables, ASN_TIMETICKS, omsnmp_getUptime(pWrkrData));
+	}
 
+	/* SET TRAP PARAMETER for SyslogMessage, the last varbind */
+	for(var = pdu->variables ; var->next_variable != NULL ; var = var->next_variable)
+		/* just search */;
+	if(snmp_set_var_value(var, psz, strlen((char*)psz)) != 0) {
+		errmsg.LogError(0, RS_RET_DISABLE_ACTION, "omsnmp_sendsnmp: cannot set SyslogMessage value\n");
 		ABORT_FINALIZE(RS_RET_DISABLE_ACTION);
 	}
 
-	/* Send the TRAP */
-	status = snmp_send(pWrkrData->snmpsession, pdu) == 0;
-	if (status)
-	{
-		/* Debug Output! */
-		int iErrorCode = pWrkrData->snmpsession->s_snmp_errno;
-		errmsg.LogError(0, RS_RET_SUSPENDED,  "omsnmp_sendsnmp: snmp_send failed error '%d', Description='%s'\n", iErrorCode*(-1), api_errors[iErrorCode*(-1)]);
+	/* Send the TRAP. Traps are not acknowledged, so this does not wait
+	 * for a response; the pdu is freed by net-snmp on success.
+	 */
+	if(snmp_sess_send(pWrkrData->snmpsession, pdu) == 0) {
+		snmp_sess_error(pWrkrData->snmpsession, &liberr, &syserr, &strErr);
+		errmsg.LogError(0, RS_RET_SUSPENDED,  "omsnmp_sendsnmp: snmp_send failed error '%d', Description='%s'\n",
+				liberr*(-1), (liberr <= 0 && liberr >= SNMPERR_MAX) ? api_errors[liberr*(-1)] : strErr);
+		free(strErr);
 
 		/* Clear Session */
 		omsnmp_exitSession(pWrkrData);
@@ -382,6 +424,8 @@ BEGINfreeInstance
 CODESTARTfreeInstance
 	free(pData->tplName);
 	free(pData->szTarget);
+	if(pData->pduTemplate != NULL)
+		snmp_free_pdu(pData->pduTemplate);
 ENDfreeInstance
 
 BEGINfreeWrkrInstance
@@ -397,6 +441,7 @@ setInstParamDefaults(instanceData *pData)
 	pData->szEnterpriseOID = NULL;
 	pData->szSnmpTrapOID = NULL;
 	pData->szSyslogMessageOID = NULL;
+	pData->pduTemplate = NULL;
 }
 
 BEGINnewActInst
@@ -449,6 +494,7 @@ CODESTARTnewActInst
 	CHKiRet(OMSRsetEntry(*ppOMSR, 0, (uchar*)strdup((pData->tplName == NULL) ? 
 						"RSYSLOG_FileFormat" : (char*)pData->tplName),
 						OMSR_NO_RQD_TPL_OPTS));
+	CHKiRet(omsnmp_buildPDUTemplate(pData));
 
 CODE_STD_FINALIZERnewActInst
 	cnfparamvalsDestruct(pvals, &actpblk);
@@ -511,8 +557,7 @@ CODE_STD_STRING_REQUESTparseSelectorAct(1)
 	/* process template */
 	CHKiRet(cflineParseTemplateName(&p, *ppOMSR, 0, OMSR_NO_RQD_TPL_OPTS, (uchar*) "RSYSLOG_TraditionalForwardFormat"));
 
-	/* Init NetSNMP library and read in MIB database */
-	init_snmp("rsyslog");
+	CHKiRet(omsnmp_buildPDUTemplate(pData));
 
 	/* Set some defaults in the NetSNMP library */
 	netsnmp_ds_set_int(NETSNMP_DS_LIBRARY_ID, NETSNMP_DS_LIB_DEFAULT_PORT, pData->iPort );
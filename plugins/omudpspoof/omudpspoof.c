@@ -98,6 +98,7 @@ typedef struct _instanceData {
 	uchar	*port;
 	uchar	*sourceTpl;
 	int	mtu;
+	int	batchSize;	/* max datagrams per sendmmsg() call, 0 = send via libnet */
 	u_short sourcePortStart;	/* for sorce port iteration */
 	u_short sourcePortEnd;
 	int	bReportLibnetInitErr; /* help prevent multiple error messages on init err */
@@ -110,10 +111,33 @@ typedef struct wrkrInstanceData {
 	int	*pSockArray;		/* sockets to use for UDP */
 	struct addrinfo *f_addr;
 	char errbuf[LIBNET_ERRBUF_SIZE];
+#	ifdef HAVE_SENDMMSG
+	/* batched raw socket sending: the IP and UDP headers are prebuilt once
+	 * per destination and only patched for each message.
+	 */
+	int	sockRaw;
+	struct sockaddr_in dstAddr;
+	struct libnet_ipv4_hdr ipTpl;
+	struct libnet_udp_hdr udpTpl;
+	u_short ipID;
+	unsigned maxPkts;	/* size of the arrays below */
+	unsigned nPkts;		/* number of packets currently queued */
+	struct mmsghdr *pktMsgs;
+	struct iovec *pktIov;	/* two per packet: headers and payload */
+	uchar *pktHdrs;		/* header space, PKT_HDR_SLOT bytes per packet */
+	uchar *payloadBuf;	/* copy of the messages of the current batch */
+	size_t offsPayload;
+#	endif
 } wrkrInstanceData_t;
 
 #define DFLT_SOURCE_PORT_START 32000
 #define DFLT_SOURCE_PORT_END   42000
+#define DFLT_BATCH_SIZE	64	/* default max number of datagrams per sendmmsg() call */
+#define MAX_UDP_PAYLOAD 65528	/* UDP limit, larger messages are truncated */
+#ifdef HAVE_SENDMMSG
+#define PKT_HDR_SLOT (LIBNET_IPV4_H + LIBNET_UDP_H)
+#define PAYLOAD_BUFSIZE (256*1024) /* messages buffered for one batch */
+#endif
 
 typedef struct configSettings_s {
 	uchar *tplName; /* name of the default template to use */
@@ -133,7 +157,8 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "sourceport.start", eCmdHdlrInt, 0 },
 	{ "sourceport.end", eCmdHdlrInt, 0 },
 	{ "mtu", eCmdHdlrInt, 0 },
-	{ "template", eCmdHdlrGetWord, 0 }
+	{ "template", eCmdHdlrGetWord, 0 },
+	{ "batchsize", eCmdHdlrInt, 0 }
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -314,14 +339,44 @@ ENDfreeCnf
 BEGINcreateInstance
 CODESTARTcreateInstance
 	pData->mtu = 1500;
+	pData->batchSize = 0;
 	pData->bReportLibnetInitErr = 1;
 ENDcreateInstance
 
 
+/* max number of bytes of the UDP datagram carried by one IP packet,
+ * this must be a multiple of 8 because of the fragment offset encoding.
+ */
+static inline unsigned
+getMaxPktLen(instanceData *pData)
+{
+	const unsigned maxPktLen = (pData->mtu - LIBNET_IPV4_H) & ~0x07;
+	return (maxPktLen < 8) ? 8 : maxPktLen;
+}
+
+
 BEGINcreateWrkrInstance
+#	ifdef HAVE_SENDMMSG
+	unsigned maxPktLen;
+#	endif
 CODESTARTcreateWrkrInstance
 	pWrkrData->libnet_handle = NULL;
 	pWrkrData->sourcePort = pData->sourcePortStart;
+#	ifdef HAVE_SENDMMSG
+	pWrkrData->sockRaw = -1;
+	if(pData->batchSize > 0) {
+		/* room for a full batch plus all fragments of one maximum-sized message */
+		maxPktLen = getMaxPktLen(pData);
+		pWrkrData->maxPkts = pData->batchSize
+			+ (MAX_UDP_PAYLOAD + LIBNET_UDP_H + maxPktLen - 1) / maxPktLen;
+		CHKmalloc(pWrkrData->pktMsgs = calloc(pWrkrData->maxPkts, sizeof(struct mmsghdr)));
+		CHKmalloc(pWrkrData->pktIov = calloc(2 * pWrkrData->maxPkts, sizeof(struct iovec)));
+		CHKmalloc(pWrkrData->pktHdrs = malloc(pWrkrData->maxPkts * PKT_HDR_SLOT));
+		CHKmalloc(pWrkrData->payloadBuf = malloc(PAYLOAD_BUFSIZE));
+		pWrkrData->ipID = (u_short) (time(NULL) ^ getpid());
+	}
+finalize_it:
+#	endif
 ENDcreateWrkrInstance
 
 BEGINisCompatibleWithFeature
@@ -345,6 +400,14 @@ CODESTARTfreeWrkrInstance
 	closeUDPSockets(pWrkrData);
 	if(pWrkrData->libnet_handle != NULL)
 		libnet_destroy(pWrkrData->libnet_handle);
+#	ifdef HAVE_SENDMMSG
+	if(pWrkrData->sockRaw != -1)
+		close(pWrkrData->sockRaw);
+	free(pWrkrData->pktMsgs);
+	free(pWrkrData->pktIov);
+	free(pWrkrData->pktHdrs);
+	free(pWrkrData->payloadBuf);
+#	endif
 ENDfreeWrkrInstance
 
 
@@ -381,10 +444,10 @@ UDPSend(wrkrInstanceData_t *pWrkrData, uchar *pszSourcename, char *msg, size_t l
 	}
 	pData = pWrkrData->pData;
 
-	if(len > 65528) {
+	if(len > MAX_UDP_PAYLOAD) {
 		DBGPRINTF("omudpspoof: msg with length %d truncated to 64k: '%.768s'\n",
 			  len, msg);
-		len = 65528;
+		len = MAX_UDP_PAYLOAD;
 	}
 
 	ip = ipo = udp = 0;
@@ -525,6 +588,266 @@ finalize_it:
 	RETiRet;
 }
 
+#ifdef HAVE_SENDMMSG
+/* one's complement sum over a memory area, as used by the internet
+ * checksums. The words are summed up in memory order, so the result
+ * is already in network byte order.
+ */
+static inline uint32_t
+cksumAdd(uint32_t sum, const uchar *p, size_t len)
+{
+	uint16_t w;
+
+	while(len > 1) {
+		memcpy(&w, p, 2);
+		sum += w;
+		p += 2;
+		len -= 2;
+	}
+	if(len == 1) {
+		w = 0;
+		memcpy(&w, p, 1);
+		sum += w;
+	}
+	return sum;
+}
+
+static inline uint16_t
+cksumFinish(uint32_t sum)
+{
+	while(sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return (uint16_t) ~sum;
+}
+
+
+/* compute the UDP checksum over pseudo header, UDP header and payload */
+static uint16_t
+udpChecksum(struct libnet_ipv4_hdr *ip, struct libnet_udp_hdr *udp, const uchar *payload, size_t len)
+{
+	uint32_t sum;
+	uint16_t cksum;
+	uint16_t proto = htons(IPPROTO_UDP);
+
+	sum = cksumAdd(0, (uchar*) &ip->ip_src, sizeof(ip->ip_src));
+	sum = cksumAdd(sum, (uchar*) &ip->ip_dst, sizeof(ip->ip_dst));
+	sum = cksumAdd(sum, (uchar*) &proto, sizeof(proto));
+	sum = cksumAdd(sum, (uchar*) &udp->uh_ulen, sizeof(udp->uh_ulen));
+	sum = cksumAdd(sum, (uchar*) udp, LIBNET_UDP_H);
+	sum = cksumAdd(sum, payload, len);
+	cksum = cksumFinish(sum);
+	return (cksum == 0) ? 0xffff : cksum;
+}
+
+
+/* open the raw socket used for batched sending. With IPPROTO_RAW, we
+ * supply the complete IP header ourselves (IP_HDRINCL is implied).
+ */
+static rsRetVal
+openRawSocket(wrkrInstanceData_t *pWrkrData)
+{
+	char errStr[1024];
+	DEFiRet;
+
+	if(pWrkrData->sockRaw != -1)
+		FINALIZE;
+	if((pWrkrData->sockRaw = socket(AF_INET, SOCK_RAW, IPPROTO_RAW)) == -1) {
+		if(pWrkrData->pData->bReportLibnetInitErr) {
+			rs_strerror_r(errno, errStr, sizeof(errStr));
+			errmsg.LogError(0, RS_RET_ERR_LIBNET_INIT, "omudpsoof: error "
+					"creating raw socket - are you running as root? %s", errStr);
+			pWrkrData->pData->bReportLibnetInitErr = 0;
+		}
+		ABORT_FINALIZE(RS_RET_ERR_LIBNET_INIT);
+	}
+finalize_it:
+	RETiRet;
+}
+
+
+/* prebuild the IP and UDP header templates for the current destination;
+ * only the fields varying per message are patched later on.
+ */
+static rsRetVal
+setupPktTemplates(wrkrInstanceData_t *pWrkrData)
+{
+	struct addrinfo *r;
+	DEFiRet;
+
+	for(r = pWrkrData->f_addr ; r != NULL && r->ai_family != AF_INET ; r = r->ai_next)
+		/* just search */;
+	if(r == NULL) {
+		errmsg.LogError(0, RS_RET_SUSPENDED, "omudpspoof: target '%s' has no IPv4 "
+				"address, can not send spoofed packets", pWrkrData->pData->host);
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+	memcpy(&pWrkrData->dstAddr, r->ai_addr, sizeof(pWrkrData->dstAddr));
+
+	memset(&pWrkrData->ipTpl, 0, sizeof(pWrkrData->ipTpl));
+	pWrkrData->ipTpl.ip_v = 4;
+	pWrkrData->ipTpl.ip_hl = LIBNET_IPV4_H >> 2;
+	pWrkrData->ipTpl.ip_ttl = 64;
+	pWrkrData->ipTpl.ip_p = IPPROTO_UDP;
+	pWrkrData->ipTpl.ip_dst = pWrkrData->dstAddr.sin_addr;
+
+	memset(&pWrkrData->udpTpl, 0, sizeof(pWrkrData->udpTpl));
+	pWrkrData->udpTpl.uh_dport = pWrkrData->dstAddr.sin_port;
+finalize_it:
+	RETiRet;
+}
+
+
+/* send all packets queued so far via sendmmsg(). As with libnet, the batch
+ * counts as sent if at least part of it could be delivered; a single packet
+ * rejected by the kernel is skipped.
+ */
+static rsRetVal
+UDPFlush(wrkrInstanceData_t *pWrkrData)
+{
+	unsigned nDone = 0;
+	unsigned nDelivered = 0;
+	int nSent;
+	int lasterrno;
+	char errStr[1024];
+	DEFiRet;
+
+	while(nDone < pWrkrData->nPkts) {
+		nSent = sendmmsg(pWrkrData->sockRaw, pWrkrData->pktMsgs + nDone,
+				 pWrkrData->nPkts - nDone, 0);
+		if(nSent > 0) {
+			nDone += nSent;
+			nDelivered += nSent;
+			continue;
+		}
+		lasterrno = errno;
+		DBGPRINTF("omudpspoof: sendmmsg() error: %d = %s\n", lasterrno,
+			  rs_strerror_r(lasterrno, errStr, sizeof(errStr)));
+		if(lasterrno == ENOSYS) {
+			/* kernel without sendmmsg(), send the rest one by one */
+			for( ; nDone < pWrkrData->nPkts ; ++nDone) {
+				if(sendmsg(pWrkrData->sockRaw, &pWrkrData->pktMsgs[nDone].msg_hdr, 0) != -1)
+					++nDelivered;
+			}
+		} else if(nDelivered == 0 && lasterrno != EMSGSIZE) {
+			errmsg.LogError(0, RS_RET_SUSPENDED, "omudpspoof: error sending to %s: %s",
+					pWrkrData->pData->host, errStr);
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		} else {
+			++nDone; /* skip the offending packet */
+		}
+	}
+
+finalize_it:
+	pWrkrData->nPkts = 0;
+	pWrkrData->offsPayload = 0;
+	RETiRet;
+}
+
+
+/* add one packet to the batch */
+static inline void
+addPkt(wrkrInstanceData_t *pWrkrData, const size_t lenHdr, uchar *payload, const size_t lenPayload)
+{
+	struct iovec *iov = &pWrkrData->pktIov[2 * pWrkrData->nPkts];
+	struct msghdr *hdr = &pWrkrData->pktMsgs[pWrkrData->nPkts].msg_hdr;
+
+	iov[0].iov_base = pWrkrData->pktHdrs + pWrkrData->nPkts * PKT_HDR_SLOT;
+	iov[0].iov_len = lenHdr;
+	iov[1].iov_base = payload;
+	iov[1].iov_len = lenPayload;
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->msg_name = &pWrkrData->dstAddr;
+	hdr->msg_namelen = sizeof(pWrkrData->dstAddr);
+	hdr->msg_iov = iov;
+	hdr->msg_iovlen = 2;
+	++pWrkrData->nPkts;
+}
+
+
+/* queue a message for batched sending. The message is split into the
+ * very same fragments the libnet path generates, but each message gets
+ * its own IP ID so that the receiver can reassemble interleaved fragments.
+ * Returns RS_RET_DEFER_COMMIT if the message is still queued, RS_RET_OK if
+ * it was sent together with the batch and RS_RET_PREVIOUS_COMMITTED if the
+ * previous messages needed to be sent to make room for it.
+ */
+static rsRetVal
+UDPQueue(wrkrInstanceData_t *pWrkrData, uchar *pszSourcename, char *msg, size_t len)
+{
+	instanceData *pData = pWrkrData->pData;
+	struct libnet_ipv4_hdr *ip;
+	struct libnet_udp_hdr *udp;
+	struct libnet_ipv4_hdr ipHdr;
+	struct libnet_udp_hdr udpHdr;
+	uchar *payload;
+	unsigned maxPktLen;
+	unsigned lenUDP;
+	unsigned dgOffs;	/* offset inside the UDP datagram, including its header */
+	unsigned pktLen;
+	sbool bFlushed = 0;
+	DEFiRet;
+
+	if(len > MAX_UDP_PAYLOAD) {
+		DBGPRINTF("omudpspoof: msg with length %d truncated to 64k: '%.768s'\n",
+			  (int) len, msg);
+		len = MAX_UDP_PAYLOAD;
+	}
+	if(pWrkrData->offsPayload + len > PAYLOAD_BUFSIZE) {
+		CHKiRet(UDPFlush(pWrkrData));
+		bFlushed = 1;
+	}
+
+	payload = pWrkrData->payloadBuf + pWrkrData->offsPayload;
+	memcpy(payload, msg, len);
+	pWrkrData->offsPayload += len;
+
+	if(pWrkrData->sourcePort++ >= pData->sourcePortEnd){
+		pWrkrData->sourcePort = pData->sourcePortStart;
+	}
+	if(++pWrkrData->ipID == 0)
+		pWrkrData->ipID = 1;
+
+	/* patch the header templates for this message */
+	lenUDP = len + LIBNET_UDP_H;
+	ipHdr = pWrkrData->ipTpl;
+	ipHdr.ip_id = htons(pWrkrData->ipID);
+	if(inet_pton(AF_INET, (char*)pszSourcename, &ipHdr.ip_src) != 1) {
+		DBGPRINTF("omudpspoof: invalid source address '%s', kernel will use "
+			  "its own\n", pszSourcename);
+		ipHdr.ip_src.s_addr = INADDR_ANY;
+	}
+	udpHdr = pWrkrData->udpTpl;
+	udpHdr.uh_sport = htons(pWrkrData->sourcePort);
+	udpHdr.uh_ulen = htons(lenUDP);
+	udpHdr.uh_sum = udpChecksum(&ipHdr, &udpHdr, payload, len);
+
+	maxPktLen = getMaxPktLen(pData);
+	for(dgOffs = 0 ; dgOffs < lenUDP ; dgOffs += pktLen) {
+		pktLen = (lenUDP - dgOffs > maxPktLen) ? maxPktLen : lenUDP - dgOffs;
+		ip = (struct libnet_ipv4_hdr*) (pWrkrData->pktHdrs + pWrkrData->nPkts * PKT_HDR_SLOT);
+		memcpy(ip, &ipHdr, LIBNET_IPV4_H);
+		ip->ip_len = htons(LIBNET_IPV4_H + pktLen);
+		ip->ip_off = htons((dgOffs / 8) | ((dgOffs + pktLen < lenUDP) ? IP_MF : 0));
+		if(dgOffs == 0) {
+			udp = (struct libnet_udp_hdr*) ((uchar*) ip + LIBNET_IPV4_H);
+			memcpy(udp, &udpHdr, LIBNET_UDP_H);
+			addPkt(pWrkrData, PKT_HDR_SLOT, payload, pktLen - LIBNET_UDP_H);
+		} else {
+			addPkt(pWrkrData, LIBNET_IPV4_H, payload + dgOffs - LIBNET_UDP_H, pktLen);
+		}
+	}
+
+	if(pWrkrData->nPkts >= (unsigned) pData->batchSize) {
+		CHKiRet(UDPFlush(pWrkrData));
+		FINALIZE;
+	}
+	iRet = bFlushed ? RS_RET_PREVIOUS_COMMITTED : RS_RET_DEFER_COMMIT;
+
+finalize_it:
+	RETiRet;
+}
+#endif /* #ifdef HAVE_SENDMMSG */
+
 
 /* try to resume connection if it is not ready
  * rgerhards, 2007-08-02
@@ -541,6 +864,11 @@ static rsRetVal doTryResume(wrkrInstanceData_t *pWrkrData)
 		FINALIZE;
 	pData = pWrkrData->pData;
 
+#	ifdef HAVE_SENDMMSG
+	if(pData->batchSize > 0) {
+		CHKiRet(openRawSocket(pWrkrData));
+	} else
+#	endif
 	if(pWrkrData->libnet_handle == NULL) {
 		/* Initialize the libnet library.  Root priviledges are required.
 		 * this initializes a IPv4 socket to use for forging UDP packets.
@@ -576,7 +904,11 @@ static rsRetVal doTryResume(wrkrInstanceData_t *pWrkrData)
 	}
 	DBGPRINTF("%s found, resuming.\n", pData->host);
 	pWrkrData->f_addr = res;
-	pWrkrData->pSockArray = net.create_udp_socket((uchar*)pData->host, NULL, 0, 0);
+#	ifdef HAVE_SENDMMSG
+	if(pData->batchSize > 0)
+		CHKiRet(setupPktTemplates(pWrkrData));
+#	endif
+	pWrkrData->pSockArray = net.create_udp_socket((uchar*)pData->host, NULL, 0, 0, 0);
 
 finalize_it:
 	if(iRet != RS_RET_OK) {
@@ -596,6 +928,15 @@ CODESTARTtryResume
 	iRet = doTryResume(pWrkrData);
 ENDtryResume
 
+BEGINbeginTransaction
+CODESTARTbeginTransaction
+#	ifdef HAVE_SENDMMSG
+	/* discard leftovers of a failed transaction, it is retried as whole */
+	pWrkrData->nPkts = 0;
+	pWrkrData->offsPayload = 0;
+#	endif
+ENDbeginTransaction
+
 BEGINdoAction
 	char *psz; /* temporary buffering */
 	unsigned l;
@@ -612,12 +953,27 @@ CODESTARTdoAction
 	if((int) l > iMaxLine)
 		l = iMaxLine;
 
+#	ifdef HAVE_SENDMMSG
+	if(pWrkrData->pData->batchSize > 0) {
+		iRet = UDPQueue(pWrkrData, ppString[1], psz, l);
+		FINALIZE;
+	}
+#	endif
 	CHKiRet(UDPSend(pWrkrData, ppString[1], psz, l));
 
 finalize_it:
 ENDdoAction
 
 
+BEGINendTransaction
+CODESTARTendTransaction
+#	ifdef HAVE_SENDMMSG
+	if(pWrkrData->nPkts != 0)
+		iRet = UDPFlush(pWrkrData);
+#	endif
+ENDendTransaction
+
+
 static inline void
 setInstParamDefaults(instanceData *pData)
 {
@@ -628,6 +984,11 @@ setInstParamDefaults(instanceData *pData)
 	pData->port = NULL;
 	pData->sourceTpl = (uchar*) strdup("RSYSLOG_omudpspoofDfltSourceTpl");
 	pData->mtu = 1500;
+#	ifdef HAVE_SENDMMSG
+	pData->batchSize = DFLT_BATCH_SIZE;
+#	else
+	pData->batchSize = 0;
+#	endif
 }
 
 BEGINnewActInst
@@ -670,6 +1031,15 @@ CODESTARTnewActInst
 			pData->mtu = pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "template")) {
 			pData->tplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "batchsize")) {
+			pData->batchSize = (pvals[i].val.d.n < 0) ? 0 : pvals[i].val.d.n;
+#			ifndef HAVE_SENDMMSG
+			if(pData->batchSize != 0) {
+				errmsg.LogError(0, RS_RET_PARAM_ERROR, "omudpspoof: batchsize is not "
+						"supported on this platform (no sendmmsg), ignored");
+				pData->batchSize = 0;
+			}
+#			endif
 		} else {
 			DBGPRINTF("omudpspoof: program error, non-handled "
 			  "param '%s'\n", actpblk.descr[i].name);
@@ -759,6 +1129,7 @@ CODEqueryEtryPt_STD_OMOD8_QUERIES
 CODEqueryEtryPt_STD_CONF2_OMOD_QUERIES
 CODEqueryEtryPt_STD_CONF2_QUERIES
 CODEqueryEtryPt_STD_CONF2_setModCnf_QUERIES
+CODEqueryEtryPt_TXIF_OMOD_QUERIES
 ENDqueryEtryPt
 
 
@@ -41,6 +41,8 @@
 #include "module-template.h"
 #include "errmsg.h"
 #include "cfsysline.h"
+#include "atomic.h"
+#include "unicode-helper.h"
 
 #include <czmq.h>
 
@@ -72,8 +74,22 @@ struct socket_action {
     int   action;
 };
 
+/* a transaction's messages, stored back to back. The frames sent to zmq
+   point into the buffer instead of being copied once more, so it is
+   only freed when zmq has released the last of them (which may happen
+   in a zmq io thread).
+*/
+typedef struct zmqBatch_s {
+    int     refCnt;
+    DEF_ATOMIC_HELPER_MUT(mutRefCnt);
+    size_t  len;
+    size_t  size;
+    char    data[];
+} zmqBatch_t;
+
 typedef struct _instanceData {
     void*   socket;
+    pthread_mutex_t mutSocket; /* zmq sockets must not be used concurrently */
 	uchar*  description;
     int     type;
     int     action;
@@ -94,9 +110,19 @@ typedef struct _instanceData {
     int     reconnectIVLMax;
     int     ipv4Only;
     int     affinity;
+    int     multipart;     /* send each transaction as one multipart message */
+    int     suspendOnHWM;  /* suspend the action while the send HWM is reached */
     uchar*  tplName;
 } instanceData;
 
+typedef struct wrkrInstanceData {
+    instanceData* pData;
+    zmqBatch_t*   batch;   /* messages of the current transaction */
+    size_t*       lens;    /* length of each message in batch */
+    int           nMsgs;
+    int           maxMsgs;
+} wrkrInstanceData_t;
+
 
 /* ----------------------------------------------------------------------------
  * Static definitions/initializations
@@ -143,6 +169,8 @@ static struct cnfparamdescr actpdescr[] = {
     { "ipv4Only",            eCmdHdlrInt,     0 },
     { "affinity",            eCmdHdlrInt,     0 },
     { "globalWorkerThreads", eCmdHdlrInt,     0 },
+    { "multipart",           eCmdHdlrBinary,  0 },
+    { "suspendOnHWM",        eCmdHdlrBinary,  0 },
     { "template",            eCmdHdlrGetWord, 1 }
 };
 
@@ -255,22 +283,110 @@ static rsRetVal initZMQ(instanceData* pData) {
     RETiRet;
 }
 
-rsRetVal writeZMQ(uchar* msg, instanceData* pData) {
+/* drop a reference to a batch buffer, freeing it with the last one.
+   This is also the free function of the frames we hand to zmq.
+*/
+static void releaseBatch(void __attribute__((unused)) *data, void* hint) {
+    zmqBatch_t* batch = (zmqBatch_t*) hint;
+    if(ATOMIC_DEC_AND_FETCH(&batch->refCnt, &batch->mutRefCnt) == 0) {
+        DESTROY_ATOMIC_HELPER_MUT(batch->mutRefCnt);
+        free(batch);
+    }
+}
+
+/* add a message to the current transaction's batch */
+static rsRetVal addToBatch(wrkrInstanceData_t* pWrkrData, uchar* msg) {
+    const size_t len = ustrlen(msg);
+    zmqBatch_t* batch = pWrkrData->batch;
+    zmqBatch_t* newBatch;
+    size_t* newLens;
+    size_t newSize;
+	DEFiRet;
+
+    if(batch == NULL || batch->len + len > batch->size) {
+        newSize = (batch == NULL) ? 16 * 1024 : 2 * batch->size;
+        if(newSize < ((batch == NULL) ? 0 : batch->len) + len)
+            newSize = ((batch == NULL) ? 0 : batch->len) + len;
+        /* the batch is not yet referenced by zmq, so we may move it */
+        CHKmalloc(newBatch = realloc(batch, sizeof(zmqBatch_t) + newSize));
+        if(batch == NULL) {
+            newBatch->refCnt = 1;
+            INIT_ATOMIC_HELPER_MUT(newBatch->mutRefCnt);
+            newBatch->len = 0;
+        }
+        newBatch->size = newSize;
+        pWrkrData->batch = batch = newBatch;
+    }
+    if(pWrkrData->nMsgs == pWrkrData->maxMsgs) {
+        CHKmalloc(newLens = realloc(pWrkrData->lens,
+                                    (pWrkrData->maxMsgs + 256) * sizeof(size_t)));
+        pWrkrData->lens = newLens;
+        pWrkrData->maxMsgs += 256;
+    }
+    memcpy(batch->data + batch->len, msg, len);
+    batch->len += len;
+    pWrkrData->lens[pWrkrData->nMsgs++] = len;
+ finalize_it:
+    RETiRet;
+}
+
+/* forget the current transaction's messages. If zmq still references
+   the buffer, it is freed when the last frame has been sent.
+*/
+static void discardBatch(wrkrInstanceData_t* pWrkrData) {
+    if(pWrkrData->batch != NULL) {
+        releaseBatch(NULL, pWrkrData->batch);
+        pWrkrData->batch = NULL;
+    }
+    pWrkrData->nMsgs = 0;
+}
+
+/* send the messages of the current transaction. Frames reference the
+   batch buffer, so zmq does not copy them again. With multipart, the
+   whole batch is a single (atomically delivered) multipart message.
+*/
+static rsRetVal sendBatch(wrkrInstanceData_t* pWrkrData) {
+    instanceData* pData = pWrkrData->pData;
+    zmqBatch_t* batch = pWrkrData->batch;
+    zmq_msg_t frame;
+    sbool bLocked = 0;
+    size_t offs = 0;
+    int flags;
+    int i;
 	DEFiRet;
 
+    if(pWrkrData->nMsgs == 0)
+        FINALIZE;
+
+    pthread_mutex_lock(&pData->mutSocket);
+    bLocked = 1;
     /* initialize if necessary */
     if(NULL == pData->socket)
-		CHKiRet(initZMQ(pData));
-    
-    /* send it */
-    int result = zstr_send(pData->socket, (char*)msg);
-    
-    /* whine if things went wrong */
-    if (result == -1) {
-        errmsg.LogError(0, NO_ERRCODE, "omzmq3: send of %s failed: %s", msg, zmq_strerror(errno));
-        ABORT_FINALIZE(RS_RET_ERR);
+        CHKiRet(initZMQ(pData));
+
+    for(i = 0 ; i < pWrkrData->nMsgs ; ++i) {
+        ATOMIC_INC(&batch->refCnt, &batch->mutRefCnt);
+        zmq_msg_init_data(&frame, batch->data + offs, pWrkrData->lens[i], releaseBatch, batch);
+        offs += pWrkrData->lens[i];
+        flags = (pData->multipart && i < pWrkrData->nMsgs - 1) ? ZMQ_SNDMORE : 0;
+        if(pData->suspendOnHWM && pData->sndTimeout == -1)
+            flags |= ZMQ_DONTWAIT;
+        if(zmq_msg_send(&frame, pData->socket, flags) == -1) {
+            zmq_msg_close(&frame);
+            /* whine if things went wrong */
+            if(errno == EAGAIN && pData->suspendOnHWM) {
+                DBGPRINTF("omzmq3: send HWM reached for %s, suspending\n", pData->description);
+                ABORT_FINALIZE(RS_RET_SUSPENDED);
+            }
+            errmsg.LogError(0, NO_ERRCODE, "omzmq3: send to %s failed: %s",
+                            pData->description, zmq_strerror(errno));
+            ABORT_FINALIZE(RS_RET_ERR);
+        }
     }
  finalize_it:
+    if(bLocked)
+        pthread_mutex_unlock(&pData->mutSocket);
+    discardBatch(pWrkrData);
     RETiRet;
 }
 
@@ -298,6 +414,8 @@ setInstParamDefaults(instanceData* pData) {
     pData->reconnectIVLMax = -1;
     pData->ipv4Only        = -1;
     pData->affinity        =  1;
+    pData->multipart       =  0;
+    pData->suspendOnHWM    =  0;
 }
 
 
@@ -307,8 +425,17 @@ setInstParamDefaults(instanceData* pData) {
 
 BEGINcreateInstance
 CODESTARTcreateInstance
+    pthread_mutex_init(&pData->mutSocket, NULL);
 ENDcreateInstance
 
+BEGINcreateWrkrInstance
+CODESTARTcreateWrkrInstance
+    pWrkrData->batch = NULL;
+    pWrkrData->lens = NULL;
+    pWrkrData->nMsgs = 0;
+    pWrkrData->maxMsgs = 0;
+ENDcreateWrkrInstance
+
 BEGINisCompatibleWithFeature
 CODESTARTisCompatibleWithFeature
 	if(eFeat == sFEATURERepeatedMsgReduction)
@@ -326,19 +453,53 @@ CODESTARTfreeInstance
 	free(pData->description);
 	free(pData->tplName);
     free(pData->identity);
+    pthread_mutex_destroy(&pData->mutSocket);
 ENDfreeInstance
 
+BEGINfreeWrkrInstance
+CODESTARTfreeWrkrInstance
+    discardBatch(pWrkrData);
+    free(pWrkrData->lens);
+ENDfreeWrkrInstance
+
+/* with suspendOnHWM, we are only resumed when the socket accepts
+   messages again.
+*/
 BEGINtryResume
+    instanceData* pData = pWrkrData->pData;
+    zmq_pollitem_t item;
 CODESTARTtryResume
-	if(NULL == pData->socket)
+    pthread_mutex_lock(&pData->mutSocket);
+	if(NULL == pData->socket) {
 		iRet = initZMQ(pData);
+    } else if(pData->suspendOnHWM) {
+        item.socket = pData->socket;
+        item.fd = 0;
+        item.events = ZMQ_POLLOUT;
+        item.revents = 0;
+        if(zmq_poll(&item, 1, 0) < 1 || !(item.revents & ZMQ_POLLOUT))
+            iRet = RS_RET_SUSPENDED;
+    }
+    pthread_mutex_unlock(&pData->mutSocket);
 ENDtryResume
 
+BEGINbeginTransaction
+CODESTARTbeginTransaction
+    discardBatch(pWrkrData);
+ENDbeginTransaction
+
 BEGINdoAction
 CODESTARTdoAction
-iRet = writeZMQ(ppString[0], pData);
+    CHKiRet(addToBatch(pWrkrData, ppString[0]));
+    iRet = RS_RET_DEFER_COMMIT;
+ finalize_it:
 ENDdoAction
 
+BEGINendTransaction
+CODESTARTendTransaction
+    iRet = sendBatch(pWrkrData);
+ENDendTransaction
+
 
 BEGINnewActInst
     struct cnfparamvals *pvals;
@@ -399,6 +560,10 @@ CODE_STD_STRING_REQUESTnewActInst(1)
             pData->affinity = (int) pvals[i].val.d.n;
         } else if (!strcmp(actpblk.descr[i].name, "globalWorkerThreads")) {
             s_workerThreads = (int) pvals[i].val.d.n;
+        } else if (!strcmp(actpblk.descr[i].name, "multipart")) {
+            pData->multipart = (int) pvals[i].val.d.n;
+        } else if (!strcmp(actpblk.descr[i].name, "suspendOnHWM")) {
+            pData->suspendOnHWM = (int) pvals[i].val.d.n;
         } else {
             errmsg.LogError(0, NO_ERRCODE, "omzmq3: program error, non-handled "
                             "param '%s'\n", actpblk.descr[i].name);
@@ -457,7 +622,9 @@ ENDmodExit
 BEGINqueryEtryPt
 CODESTARTqueryEtryPt
 CODEqueryEtryPt_STD_OMOD_QUERIES
+CODEqueryEtryPt_STD_OMOD8_QUERIES
 CODEqueryEtryPt_STD_CONF2_OMOD_QUERIES
+CODEqueryEtryPt_TXIF_OMOD_QUERIES /* supports transaction interface */
 ENDqueryEtryPt
 
 BEGINmodInit()
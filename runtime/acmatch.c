@@ -0,0 +1,226 @@
+/* acmatch.c - multi-pattern string matcher (Aho-Corasick)
+ *
+ * The automaton is built as a full DFA, so matching needs exactly one
+ * table lookup per input character. To keep the table small, input bytes
+ * are first mapped to classes: each byte that occurs in a pattern gets its
+ * own class, all other bytes share class 0 (they always lead back to the
+ * start state). States that end a pattern (directly or via a suffix) have
+ * their output chain in report[], which is 0 for all others, so the inner
+ * loop only needs a single extra test.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include "rsyslog.h"
+#include "acmatch.h"
+
+/* state numbers are 16 bit, that's plenty for filter sets and keeps the
+ * transition table cache-friendly
+ */
+#define ACMATCH_MAXSTATES 65535
+typedef uint16_t acstate_t;
+
+typedef struct acpattern_s {
+	uchar *pat;
+	size_t len;
+	sbool bAnchored;
+	int nextSame;	/* next pattern ending in the same state, -1 if none */
+} acpattern_t;
+
+struct acmatch_s {
+	acpattern_t *pats;
+	int nPats;
+	int maxPats;
+	uint64_t always[ACMATCH_WORDS];	/* empty patterns, these always match */
+	int nClasses;
+	uchar classOf[256];
+	int nStates;
+	acstate_t *delta;	/* transitions, nStates * nClasses */
+	acstate_t *fail;	/* failure links */
+	acstate_t *report;	/* nearest state (incl. self) on the fail chain that ends a pattern, 0 if none */
+	int *firstPat;		/* first pattern ending in this state, -1 if none */
+};
+
+
+rsRetVal
+acmatchConstruct(acmatch_t **ppThis)
+{
+	DEFiRet;
+	CHKmalloc(*ppThis = calloc(1, sizeof(acmatch_t)));
+finalize_it:
+	RETiRet;
+}
+
+void
+acmatchDestruct(acmatch_t **ppThis)
+{
+	acmatch_t *pThis = *ppThis;
+	int i;
+
+	if(pThis == NULL)
+		return;
+	for(i = 0 ; i < pThis->nPats ; ++i)
+		free(pThis->pats[i].pat);
+	free(pThis->pats);
+	free(pThis->delta);
+	free(pThis->fail);
+	free(pThis->report);
+	free(pThis->firstPat);
+	free(pThis);
+	*ppThis = NULL;
+}
+
+int
+acmatchNumPatterns(acmatch_t *pThis)
+{
+	return pThis->nPats;
+}
+
+rsRetVal
+acmatchAddPattern(acmatch_t *pThis, const uchar *pat, size_t lenPat, sbool bAnchored)
+{
+	acpattern_t *newpats;
+	DEFiRet;
+
+	if(pThis->nPats == ACMATCH_MAXPATTERNS)
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	if(pThis->nPats == pThis->maxPats) {
+		CHKmalloc(newpats = realloc(pThis->pats, (pThis->maxPats + 32) * sizeof(acpattern_t)));
+		pThis->pats = newpats;
+		pThis->maxPats += 32;
+	}
+	CHKmalloc(pThis->pats[pThis->nPats].pat = malloc(lenPat + 1));
+	memcpy(pThis->pats[pThis->nPats].pat, pat, lenPat);
+	pThis->pats[pThis->nPats].len = lenPat;
+	pThis->pats[pThis->nPats].bAnchored = bAnchored;
+	pThis->pats[pThis->nPats].nextSame = -1;
+	++pThis->nPats;
+finalize_it:
+	RETiRet;
+}
+
+rsRetVal
+acmatchFinalize(acmatch_t *pThis)
+{
+	size_t maxStates;
+	acstate_t *queue = NULL;
+	int qHead, qTail;
+	int i, c, s, t;
+	size_t j;
+	DEFiRet;
+
+	/* byte classes */
+	pThis->nClasses = 1;
+	maxStates = 1;
+	for(i = 0 ; i < pThis->nPats ; ++i) {
+		maxStates += pThis->pats[i].len;
+		for(j = 0 ; j < pThis->pats[i].len ; ++j) {
+			if(pThis->classOf[pThis->pats[i].pat[j]] == 0)
+				pThis->classOf[pThis->pats[i].pat[j]] = pThis->nClasses++;
+		}
+	}
+	if(maxStates > ACMATCH_MAXSTATES)
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+
+	CHKmalloc(pThis->delta = calloc(maxStates * pThis->nClasses, sizeof(acstate_t)));
+	CHKmalloc(pThis->fail = calloc(maxStates, sizeof(acstate_t)));
+	CHKmalloc(pThis->report = calloc(maxStates, sizeof(acstate_t)));
+	CHKmalloc(pThis->firstPat = malloc(maxStates * sizeof(int)));
+	CHKmalloc(queue = malloc(maxStates * sizeof(acstate_t)));
+	for(j = 0 ; j < maxStates ; ++j)
+		pThis->firstPat[j] = -1;
+
+	/* the trie; as no transition leads back to the start state yet, 0
+	 * means "no child" while we build it
+	 */
+	pThis->nStates = 1;
+	for(i = pThis->nPats - 1 ; i >= 0 ; --i) {
+		if(pThis->pats[i].len == 0) {
+			pThis->always[i / 64] |= (uint64_t) 1 << (i % 64);
+			continue;
+		}
+		s = 0;
+		for(j = 0 ; j < pThis->pats[i].len ; ++j) {
+			c = pThis->classOf[pThis->pats[i].pat[j]];
+			if(pThis->delta[s * pThis->nClasses + c] == 0)
+				pThis->delta[s * pThis->nClasses + c] = pThis->nStates++;
+			s = pThis->delta[s * pThis->nClasses + c];
+		}
+		/* we go backwards, so the chain is in ascending pattern order */
+		pThis->pats[i].nextSame = pThis->firstPat[s];
+		pThis->firstPat[s] = i;
+	}
+
+	/* failure links and DFA transitions, breadth-first */
+	qHead = qTail = 0;
+	for(c = 0 ; c < pThis->nClasses ; ++c) {
+		if((t = pThis->delta[c]) != 0) {
+			pThis->fail[t] = 0;
+			queue[qTail++] = t;
+		}
+	}
+	while(qHead < qTail) {
+		s = queue[qHead++];
+		pThis->report[s] = (pThis->firstPat[s] != -1) ? s : pThis->report[pThis->fail[s]];
+		for(c = 0 ; c < pThis->nClasses ; ++c) {
+			t = pThis->delta[s * pThis->nClasses + c];
+			if(t != 0) {
+				pThis->fail[t] = pThis->delta[pThis->fail[s] * pThis->nClasses + c];
+				queue[qTail++] = t;
+			} else {
+				pThis->delta[s * pThis->nClasses + c] =
+					pThis->delta[pThis->fail[s] * pThis->nClasses + c];
+			}
+		}
+	}
+	DBGPRINTF("acmatch %p: %d patterns, %d states, %d byte classes\n",
+		  pThis, pThis->nPats, pThis->nStates, pThis->nClasses);
+
+finalize_it:
+	free(queue);
+	RETiRet;
+}
+
+void
+acmatchExec(acmatch_t *pThis, const uchar *s, size_t len, uint64_t *matched)
+{
+	const acstate_t *const delta = pThis->delta;
+	const acstate_t *const report = pThis->report;
+	const uchar *const classOf = pThis->classOf;
+	const int nClasses = pThis->nClasses;
+	acstate_t state = 0;
+	acstate_t r;
+	size_t i;
+	int p;
+
+	memcpy(matched, pThis->always, sizeof(pThis->always));
+	for(i = 0 ; i < len ; ++i) {
+		state = delta[state * nClasses + classOf[s[i]]];
+		if(report[state] == 0)
+			continue;
+		for(r = report[state] ; r != 0 ; r = report[pThis->fail[r]]) {
+			for(p = pThis->firstPat[r] ; p != -1 ; p = pThis->pats[p].nextSame) {
+				if(!pThis->pats[p].bAnchored || pThis->pats[p].len == i + 1)
+					matched[p / 64] |= (uint64_t) 1 << (p % 64);
+			}
+		}
+	}
+}
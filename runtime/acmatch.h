@@ -0,0 +1,52 @@
+/* Definitions for the multi-pattern string matcher.
+ *
+ * This is an Aho-Corasick automaton, compiled into a DFA over byte
+ * classes. It finds which of a set of patterns occur in a string with a
+ * single pass over it. Patterns may be anchored, in which case they only
+ * match at the start of the string. It is used by the RainerScript
+ * optimizer to evaluate many "contains" and "startswith" filters on the
+ * same property at once.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_ACMATCH_H
+#define INCLUDED_ACMATCH_H
+
+#include <stdint.h>
+
+/* max number of patterns per matcher, so that callers can keep the result
+ * bitmap on the stack
+ */
+#define ACMATCH_MAXPATTERNS 512
+#define ACMATCH_WORDS ((ACMATCH_MAXPATTERNS + 63) / 64)
+#define ACMATCH_ISSET(bitmap, i) (((bitmap)[(i) / 64] >> ((i) % 64)) & 1)
+
+typedef struct acmatch_s acmatch_t;
+
+rsRetVal acmatchConstruct(acmatch_t **ppThis);
+void acmatchDestruct(acmatch_t **ppThis);
+/* add a pattern, its id is the number of patterns added before it */
+rsRetVal acmatchAddPattern(acmatch_t *pThis, const uchar *pat, size_t lenPat, sbool bAnchored);
+/* build the automaton, must be called after all patterns have been added */
+rsRetVal acmatchFinalize(acmatch_t *pThis);
+int acmatchNumPatterns(acmatch_t *pThis);
+/* set bit i of matched (ACMATCH_WORDS words) if pattern i occurs in s */
+void acmatchExec(acmatch_t *pThis, const uchar *s, size_t len, uint64_t *matched);
+
+#endif /* #ifndef INCLUDED_ACMATCH_H */
@@ -0,0 +1,212 @@
+/* actpool.c - threads for parallel actions
+ *
+ * The pool threads are started on first use, as this happens only after
+ * rsyslogd has forked into the background. Each thread has its own worker
+ * instance data (wti), so actions create separate worker instances for it,
+ * exactly as they do for additional queue worker threads. Transactions
+ * begun by a pool thread are committed at the end of each task, as the
+ * batch commit of the queue worker does not know about them.
+ *
+ * Tasks are kept in a single FIFO list. A caller first runs its first task
+ * itself, then takes back any of its tasks that are still waiting, so that
+ * a busy pool never delays processing by more than if it was not used at
+ * all.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include "rsyslog.h"
+#include "wti.h"
+#include "action.h"
+#include "actpool.h"
+
+int iActpoolWorkers = 0;
+
+/* tasks submitted by one actpoolRun() call */
+struct actpoolGroup_s {
+	int nPending;		/* tasks not yet finished by a pool thread */
+	int *pbShutdownImmediate;
+	uint8_t bDoAutoCommit;
+};
+
+static pthread_mutex_t mutPool = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t condWork = PTHREAD_COND_INITIALIZER;	/* tasks available */
+static pthread_cond_t condDone = PTHREAD_COND_INITIALIZER;	/* a task finished */
+static actpoolTask_t *pTaskRoot = NULL;
+static actpoolTask_t *pTaskLast = NULL;
+static pthread_t *thrdIDs = NULL;
+static wti_t **wrkrWti = NULL;
+static int nWorkers = 0;	/* number of threads running */
+static sbool bStarted = 0;	/* start attempted? */
+static sbool bShutdown = 0;
+
+
+static void *
+actpoolWorker(void *arg)
+{
+	wti_t *const pWti = (wti_t*) arg;
+	actpoolTask_t *pTask;
+	actpoolGroup_t *pGroup;
+
+	dbgSetThrdName((uchar*) "actpool");
+	pthread_mutex_lock(&mutPool);
+	while(1) {
+		while(pTaskRoot == NULL && !bShutdown)
+			pthread_cond_wait(&condWork, &mutPool);
+		if(pTaskRoot == NULL)
+			break; /* shutdown, and all work is done */
+		pTask = pTaskRoot;
+		if((pTaskRoot = pTask->next) == NULL)
+			pTaskLast = NULL;
+		pthread_mutex_unlock(&mutPool);
+
+		pGroup = pTask->pGroup;
+		pWti->pbShutdownImmediate = pGroup->pbShutdownImmediate;
+		pWti->execState.bPrevWasSuspended = 0;
+		pWti->execState.bDoAutoCommit = pGroup->bDoAutoCommit;
+		/* the cache may hold strings of messages modified since */
+		wtiTplCacheInvalidate(pWti);
+		pTask->pFunc(pTask->pParam, pWti);
+		actionCommitAllDirect(pWti);
+
+		pthread_mutex_lock(&mutPool);
+		/* pTask and pGroup may be gone as soon as nPending drops to 0 */
+		if(--pGroup->nPending == 0)
+			pthread_cond_broadcast(&condDone);
+	}
+	pthread_mutex_unlock(&mutPool);
+	return NULL;
+}
+
+
+/* start the pool threads, called with mutPool locked. If some cannot be
+ * started, we use those we have (possibly none).
+ */
+static void
+actpoolStart(void)
+{
+	int i;
+
+	bStarted = 1;
+	if(   (thrdIDs = calloc(iActpoolWorkers, sizeof(pthread_t))) == NULL
+	   || (wrkrWti = calloc(iActpoolWorkers, sizeof(wti_t*))) == NULL)
+		goto done;
+	for(i = 0 ; i < iActpoolWorkers ; ++i) {
+		if(wtiConstruct(&wrkrWti[i]) != RS_RET_OK)
+			break;
+		if(   wtiConstructFinalize(wrkrWti[i]) != RS_RET_OK
+		   || pthread_create(&thrdIDs[i], NULL, actpoolWorker, wrkrWti[i]) != 0) {
+			wtiDestruct(&wrkrWti[i]);
+			break;
+		}
+		++nWorkers;
+	}
+done:
+	DBGPRINTF("actpool: %d of %d threads started\n", nWorkers, iActpoolWorkers);
+}
+
+
+void
+actpoolRun(actpoolTask_t *tasks, int nTasks, wti_t *pWti)
+{
+	actpoolGroup_t group;
+	actpoolTask_t *pTask, **ppTask;
+	actpoolTask_t *pMine = NULL, **ppMineLast = &pMine;
+	sbool bQueued = 0;
+	int i;
+
+	group.nPending = 0;
+	pthread_mutex_lock(&mutPool);
+	if(!bStarted && !bShutdown && iActpoolWorkers > 0)
+		actpoolStart();
+	if(nWorkers > 0 && !bShutdown && nTasks > 1) {
+		group.pbShutdownImmediate = pWti->pbShutdownImmediate;
+		group.bDoAutoCommit = pWti->execState.bDoAutoCommit;
+		for(i = 1 ; i < nTasks ; ++i) {
+			tasks[i].pGroup = &group;
+			tasks[i].next = NULL;
+			if(pTaskLast == NULL)
+				pTaskRoot = &tasks[i];
+			else
+				pTaskLast->next = &tasks[i];
+			pTaskLast = &tasks[i];
+		}
+		group.nPending = nTasks - 1;
+		bQueued = 1;
+		pthread_cond_broadcast(&condWork);
+	}
+	pthread_mutex_unlock(&mutPool);
+
+	tasks[0].pFunc(tasks[0].pParam, pWti);
+	if(!bQueued) {
+		for(i = 1 ; i < nTasks ; ++i)
+			tasks[i].pFunc(tasks[i].pParam, pWti);
+		return;
+	}
+
+	/* take back what the pool did not yet start */
+	pthread_mutex_lock(&mutPool);
+	for(ppTask = &pTaskRoot, pTaskLast = NULL ; *ppTask != NULL ; ) {
+		pTask = *ppTask;
+		if(pTask->pGroup == &group) {
+			*ppTask = pTask->next;
+			pTask->next = NULL;
+			*ppMineLast = pTask;
+			ppMineLast = &pTask->next;
+			--group.nPending;
+		} else {
+			pTaskLast = pTask;
+			ppTask = &pTask->next;
+		}
+	}
+	pthread_mutex_unlock(&mutPool);
+
+	for(pTask = pMine ; pTask != NULL ; pTask = pTask->next)
+		pTask->pFunc(pTask->pParam, pWti);
+
+	pthread_mutex_lock(&mutPool);
+	while(group.nPending > 0)
+		pthread_cond_wait(&condDone, &mutPool);
+	pthread_mutex_unlock(&mutPool);
+}
+
+
+void
+actpoolExit(void)
+{
+	int i;
+
+	pthread_mutex_lock(&mutPool);
+	bShutdown = 1;
+	pthread_cond_broadcast(&condWork);
+	pthread_mutex_unlock(&mutPool);
+
+	for(i = 0 ; i < nWorkers ; ++i) {
+		pthread_join(thrdIDs[i], NULL);
+		wtiFreeActWrkrInstances(wrkrWti[i]);
+		wtiDestruct(&wrkrWti[i]);
+	}
+	nWorkers = 0;
+	free(thrdIDs);
+	free(wrkrWti);
+	thrdIDs = NULL;
+	wrkrWti = NULL;
+}
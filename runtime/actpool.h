@@ -0,0 +1,50 @@
+/* Definitions for the parallel action pool.
+ *
+ * A small pool of threads that executes independent actions of a ruleset
+ * in parallel for the same batch (fork-join), so that a slow action does
+ * not delay the others without the cost of a separate action queue.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_ACTPOOL_H
+#define INCLUDED_ACTPOOL_H
+
+typedef struct actpoolTask_s actpoolTask_t;
+typedef struct actpoolGroup_s actpoolGroup_t;
+
+/* one unit of work. pFunc is called with the worker instance of the
+ * thread that executes it. The other members are private to the pool.
+ */
+struct actpoolTask_s {
+	void (*pFunc)(void *pParam, wti_t *pWti);
+	void *pParam;
+	actpoolTask_t *next;
+	actpoolGroup_t *pGroup;
+};
+
+extern int iActpoolWorkers;	/* global(script.parallelactions), 0 if disabled */
+
+/* run all tasks and return when they are done. The caller executes the
+ * first one itself (with pWti) and all that no pool thread picked up.
+ */
+void actpoolRun(actpoolTask_t *tasks, int nTasks, wti_t *pWti);
+/* stop the pool threads. Tasks submitted later are run by the caller. */
+void actpoolExit(void);
+
+#endif /* #ifndef INCLUDED_ACTPOOL_H */
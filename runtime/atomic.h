@@ -48,6 +48,8 @@
 #	define ATOMIC_DEC_AND_FETCH(data, phlpmut) __sync_sub_and_fetch(data, 1)
 #	define ATOMIC_FETCH_32BIT(data, phlpmut) ((unsigned) __sync_fetch_and_and(data, 0xffffffff))
 #	define ATOMIC_STORE_1_TO_32BIT(data) __sync_lock_test_and_set(&(data), 1)
+#	define ATOMIC_STORE_0_TO_32BIT(data) __sync_lock_release(&(data))
+#	define ATOMIC_BARRIER() __sync_synchronize()
 #	define ATOMIC_STORE_0_TO_INT(data, phlpmut) __sync_fetch_and_and(data, 0)
 #	define ATOMIC_STORE_1_TO_INT(data, phlpmut) __sync_fetch_and_or(data, 1)
 #	define ATOMIC_STORE_INT_TO_INT(data, val) __sync_fetch_and_or(&(data), (val))
@@ -186,6 +188,10 @@
 #	define DESTROY_ATOMIC_HELPER_MUT(x) pthread_mutex_destroy(&(x))
 
 #	define PREFER_ATOMIC_INC(data) ((void) ++data)
+	/* without atomics, there is no portable memory barrier. Code that
+	 * relies on it must be covered by a mutex in this case.
+	 */
+#	define ATOMIC_BARRIER()
 
 #endif
 
@@ -194,8 +200,10 @@
  */
 #ifdef HAVE_ATOMIC_BUILTINS_64BIT
 #	define ATOMIC_INC_uint64(data, phlpmut) ((void) __sync_fetch_and_add(data, 1))
+#	define ATOMIC_ADD_uint64(data, phlpmut, val) ((void) __sync_fetch_and_add(data, val))
 #	define ATOMIC_DEC_unit64(data, phlpmut) ((void) __sync_sub_and_fetch(data, 1))
 #	define ATOMIC_INC_AND_FETCH_uint64(data, phlpmut) __sync_fetch_and_add(data, 1)
+#	define ATOMIC_FETCH_AND_CLEAR_uint64(data, phlpmut) __sync_fetch_and_and(data, 0)
 
 #	define DEF_ATOMIC_HELPER_MUT64(x)
 #	define INIT_ATOMIC_HELPER_MUT64(x)
@@ -211,6 +219,11 @@
 		--(*(data)); \
 		pthread_mutex_unlock(phlpmut); \
 	}
+#	define ATOMIC_ADD_uint64(data, phlpmut, val)  { \
+		pthread_mutex_lock(phlpmut); \
+		*(data) += (val); \
+		pthread_mutex_unlock(phlpmut); \
+	}
 
 	static inline unsigned
 	ATOMIC_INC_AND_FETCH_uint64(uint64 *data, pthread_mutex_t *phlpmut) {
@@ -221,6 +234,16 @@
 		return(val);
 	}
 
+	static inline uint64
+	ATOMIC_FETCH_AND_CLEAR_uint64(uint64 *data, pthread_mutex_t *phlpmut) {
+		uint64 val;
+		pthread_mutex_lock(phlpmut);
+		val = *data;
+		*data = 0;
+		pthread_mutex_unlock(phlpmut);
+		return(val);
+	}
+
 #	define DEF_ATOMIC_HELPER_MUT64(x)  pthread_mutex_t x
 #	define INIT_ATOMIC_HELPER_MUT64(x) pthread_mutex_init(&(x), NULL)
 #	define DESTROY_ATOMIC_HELPER_MUT64(x) pthread_mutex_destroy(&(x))
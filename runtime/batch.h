@@ -27,7 +27,9 @@
 #define BATCH_H_INCLUDED
 
 #include <string.h>
+#include <stddef.h>
 #include "msg.h"
+#include "srUtils.h"
 
 /* enum for batch states. Actually, we violate a layer here, in that we assume that a batch is used
  * for action processing. So far, this seems acceptable, the status is simply ignored inside the
@@ -75,6 +77,8 @@ struct batch_s {
 					 a HUGE saving, even if it doesn't look so (both profiler
 					 data as well as practical tests indicate that!).
 				*/
+	int memMode;		/* SR_HUGE_NONE - pElem and eltState are malloc()ed, else they
+				   share one srHugeAlloc() region (see batchInitHuge()) */
 };
 
 
@@ -85,6 +89,33 @@ batchNumMsgs(const batch_t * const pBatch) {
 }
 
 
+/* Software prefetch for loops that process the messages of a batch in order.
+ * The message objects are scattered over the heap, so at large batch sizes
+ * each of them is a cache miss. Called for element i, we prefetch the hot
+ * fields of the message object BATCH_PREFETCH_DIST*2 elements ahead and the
+ * raw message of the one BATCH_PREFETCH_DIST elements ahead, whose object
+ * was prefetched in an earlier iteration. The prefetch of the raw message
+ * needs its pointer, so it must not be issued before the object is in cache.
+ */
+#define BATCH_PREFETCH_DIST 4
+static inline void
+batchPrefetch(const batch_t * const pBatch, const int i) {
+#ifdef __GNUC__
+	const msg_t *pMsg;
+
+	if(i + 2 * BATCH_PREFETCH_DIST < pBatch->nElem) {
+		pMsg = pBatch->pElem[i + 2 * BATCH_PREFETCH_DIST].pMsg;
+		__builtin_prefetch(pMsg, 0, 1); /* severity, facility, flags, lengths, rawmsg ptr */
+		__builtin_prefetch((const char*) pMsg + offsetof(msg_t, pRuleset), 0, 1);
+	}
+	if(i + BATCH_PREFETCH_DIST < pBatch->nElem) {
+		pMsg = pBatch->pElem[i + BATCH_PREFETCH_DIST].pMsg;
+		__builtin_prefetch(pMsg->pszRawMsg, 0, 1);
+	}
+#endif
+}
+
+
 /* set the status of the i-th batch element. Note that once the status is
  * DISC, it will never be reset. So this function can NOT be used to initialize
  * the state table. -- rgerhards, 2010-06-10
@@ -111,8 +142,13 @@ batchIsValidElem(const batch_t * const pBatch, const int i) {
  */
 static inline void
 batchFree(batch_t * const pBatch) {
-	free(pBatch->pElem);
-	free(pBatch->eltState);
+	if(pBatch->memMode == SR_HUGE_NONE) {
+		free(pBatch->pElem);
+		free(pBatch->eltState);
+	} else {
+		srHugeFree(pBatch->pElem, (size_t) pBatch->maxElem * (sizeof(batch_obj_t)
+			   + sizeof(batch_state_t)), pBatch->memMode);
+	}
 }
 
 
@@ -124,6 +160,7 @@ static inline rsRetVal
 batchInit(batch_t *const pBatch, const int maxElem) {
 	DEFiRet;
 	pBatch->maxElem = maxElem;
+	pBatch->memMode = SR_HUGE_NONE;
 	CHKmalloc(pBatch->pElem = calloc((size_t)maxElem, sizeof(batch_obj_t)));
 	CHKmalloc(pBatch->eltState = calloc((size_t)maxElem, sizeof(batch_state_t)));
 finalize_it:
@@ -131,6 +168,34 @@ finalize_it:
 }
 
 
+/* same as batchInit(), but places both arrays into a single region that is
+ * backed by huge pages if it is large enough (see srHugeAlloc()). This is
+ * used for the batches of queues with queue.hugePages.
+ */
+static inline rsRetVal
+batchInitHuge(batch_t *const pBatch, const int maxElem) {
+	int memMode;
+	uchar *p;
+	DEFiRet;
+	pBatch->maxElem = maxElem;
+	pBatch->memMode = SR_HUGE_NONE;
+	pBatch->pElem = NULL;
+	pBatch->eltState = NULL;
+	CHKmalloc(p = srHugeAlloc((size_t)maxElem * (sizeof(batch_obj_t) + sizeof(batch_state_t)), &memMode));
+	if(memMode == SR_HUGE_NONE) {
+		/* too small for huge pages, so keep the usual layout */
+		free(p);
+		iRet = batchInit(pBatch, maxElem);
+		FINALIZE;
+	}
+	pBatch->memMode = memMode;
+	pBatch->pElem = (batch_obj_t*) p;
+	pBatch->eltState = (batch_state_t*) (p + (size_t)maxElem * sizeof(batch_obj_t));
+finalize_it:
+	RETiRet;
+}
+
+
 /* primarily a helper for debug purposes, get human-readble name of state */
 static inline char *
 batchState2String(const batch_state_t state) {
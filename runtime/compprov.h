@@ -0,0 +1,52 @@
+/* The interface definition for (file) compression providers.
+ *
+ * Compression providers are an alternative to the built-in zlib (gzip)
+ * compression of the stream class. They are loadable library modules
+ * named lmcomp_<name>. The stream class creates one instance per stream
+ * and passes it each output buffer; the provider hands the compressed data
+ * back via the provided write function.
+ *
+ * This is an interface include file. It is not associated with an object.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_COMPPROV_H
+#define INCLUDED_COMPPROV_H
+
+/* operations for Compress() */
+#define COMPPROV_OP_CONTINUE 0	/* more data follows, output may be held back */
+#define COMPPROV_OP_FLUSH 1	/* all data so far must be decompressable from the output */
+#define COMPPROV_OP_END 2	/* end frame, the next data starts a new one (e.g. on close) */
+
+/* called by the provider to write compressed data */
+typedef rsRetVal (*compprovWriteFn_t)(void *pUsr, uchar *pBuf, size_t lenBuf);
+
+/* interface */
+BEGINinterface(compprov) /* name must also be changed in ENDinterface macro! */
+	rsRetVal (*Construct)(void *ppThis);
+	rsRetVal (*Destruct)(void *ppThis);
+	/* compression level as given by zipLevel, must be called before first Compress() */
+	rsRetVal (*SetLevel)(void *pThis, int iLevel);
+	/* number of threads to use, if supported by the library (0 - none) */
+	rsRetVal (*SetWorkers)(void *pThis, int nWorkers);
+	rsRetVal (*Compress)(void *pThis, uchar *pBuf, size_t lenBuf, int op,
+			     compprovWriteFn_t fnWrite, void *pUsr);
+ENDinterface(compprov)
+#define compprovCURR_IF_VERSION 1 /* increment whenever you change the interface structure! */
+#endif /* #ifndef INCLUDED_COMPPROV_H */
@@ -29,7 +29,10 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <ctype.h>
+#include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <time.h>
 #ifdef HAVE_SYS_TIME_H
 #	include <sys/time.h>
 #endif
@@ -46,6 +49,10 @@
 DEFobjStaticHelpers
 DEFobjCurrIf(errmsg)
 
+int iTimestampResolution = 0;	/* ms, 0 = precise; set via global() */
+
+static void getCurrTimeCoarse(struct syslogTime *t, time_t *ttSeconds);
+
 /* the following table of ten powers saves us some computation */
 static const int tenPowers[6] = { 1, 10, 100, 1000, 10000, 100000 };
 
@@ -119,6 +126,10 @@ static void getCurrTime(struct syslogTime *t, time_t *ttSeconds)
 #	endif
 
 	assert(t != NULL);
+	if(iTimestampResolution != 0) {
+		getCurrTimeCoarse(t, ttSeconds);
+		return;
+	}
 #	if defined(__hpux)
 		/* TODO: check this: under HP UX, the tz information is actually valid
 		 * data. So we need to obtain and process it there.
@@ -154,6 +165,165 @@ getTime(time_t *ttSeconds)
 }
 
 
+/* Per-thread timestamp cache. At high message rates, most
+ * timestamps a thread formats are in the same second as the previous one,
+ * so we keep the last strings of each format and reuse them. Only the
+ * fractional seconds of RFC3339 timestamps differ within the same second,
+ * they are patched into the cached string. The cache key is the full
+ * syslogTime except secfrac, so it includes the UTC offset. Each format
+ * has TSCACHE_WAYS entries, so that timestamps from sources in a couple of
+ * different time zones (e.g. TIMESTAMP and the local time of reception)
+ * do not evict each other.
+ */
+enum tsCacheFmt {
+	TSCACHE_3164 = 0,
+	TSCACHE_3164_BUGGY = 1,
+	TSCACHE_MYSQL = 2,
+	TSCACHE_PGSQL = 3,
+	TSCACHE_3339 = 4,
+	TSCACHE_UNIX = 5,
+	TSCACHE_NFMTS = 6
+};
+#define TSCACHE_WAYS 2
+
+typedef struct tsCacheEntry_s {
+	sbool bValid;
+	struct syslogTime ts;	/* timestamp buf was formatted from */
+	int iRet;		/* return value of the format function */
+	int lenStr;		/* strlen(buf), not always the same as iRet */
+	char buf[33];		/* large enough for all formats */
+} tsCacheEntry_t;
+
+/* For parsing, the cache works the other way round: most timestamps a
+ * thread parses are in the same minute as the previous one. So we keep
+ * the exact characters of the last timestamp up to and including the ':'
+ * after the minute together with the values parsed from them. If the next
+ * timestamp starts with the same characters, only the seconds and what
+ * follows them need to be parsed. As the prefix is compared byte by byte,
+ * this yields exactly the result the full parser would produce.
+ */
+#define TSPARSE_MAX_PREFIX 24	/* "yyyy-mm-ddThh:mm:" or "Mmm dd yyyy hh:mm:" plus some slack */
+typedef struct tsParsePrefix_s {
+	int lenPrefix;		/* 0 if nothing cached yet */
+	int year;		/* 0 in 3164 prefixes without year */
+	int month;
+	int day;
+	int hour;
+	int minute;
+	uchar prefix[TSPARSE_MAX_PREFIX];
+} tsParsePrefix_t;
+
+typedef struct tsCache_s {
+	tsCacheEntry_t ent[TSCACHE_NFMTS][TSCACHE_WAYS];
+	uint8_t iNext[TSCACHE_NFMTS];	/* way to replace next */
+	tsParsePrefix_t parse3339;
+	tsParsePrefix_t parse3164;
+	/* syslogTime2time_t(): the last date converted and its start in seconds */
+	sbool bDayValid;
+	int dayYear;
+	int dayMonth;
+	int dayDay;
+	time_t dayStart;
+	/* getCurrTimeCoarse(): the last second obtained and its broken-down time */
+	sbool bCurrValid;
+	time_t currSecs;
+	struct syslogTime currTs;
+} tsCache_t;
+
+static pthread_key_t keyTsCache;
+
+/* get the calling thread's timestamp cache, which is allocated on first
+ * use. Returns NULL if that fails, callers must then work without cache.
+ */
+static inline tsCache_t *
+getTsCache(void)
+{
+	tsCache_t *pCache;
+
+	if((pCache = (tsCache_t*) pthread_getspecific(keyTsCache)) == NULL) {
+		if((pCache = calloc(1, sizeof(tsCache_t))) == NULL)
+			return NULL;
+		pthread_setspecific(keyTsCache, pCache);
+	}
+	return pCache;
+}
+
+
+/* getCurrTime() for global(timestamp.resolution) != 0. The clock is read
+ * from CLOCK_REALTIME_COARSE where available, which does not need to enter
+ * the kernel, and the fractional seconds are rounded down to the configured
+ * resolution. The expensive part, converting to broken-down local time, is
+ * only done once per second and thread; within the same second only secfrac
+ * of the cached result is updated. This is safe as time zone offsets only
+ * change at full seconds.
+ */
+static void
+getCurrTimeCoarse(struct syslogTime *t, time_t *ttSeconds)
+{
+	struct timespec ts;
+	struct timeval tp;
+	tsCache_t *pCache;
+	long lRes;
+
+#	ifdef CLOCK_REALTIME_COARSE
+	if(clock_gettime(CLOCK_REALTIME_COARSE, &ts) != 0)
+#	endif
+		clock_gettime(CLOCK_REALTIME, &ts);
+	tp.tv_sec = ts.tv_sec;
+	tp.tv_usec = ts.tv_nsec / 1000;
+	lRes = (iTimestampResolution >= 1000) ? 1000000 : iTimestampResolution * 1000;
+	tp.tv_usec -= tp.tv_usec % lRes;
+	if(ttSeconds != NULL)
+		*ttSeconds = tp.tv_sec;
+
+	if((pCache = getTsCache()) == NULL) {
+		timeval2syslogTime(&tp, t);
+		return;
+	}
+	if(!pCache->bCurrValid || pCache->currSecs != tp.tv_sec) {
+		timeval2syslogTime(&tp, &pCache->currTs);
+		pCache->currSecs = tp.tv_sec;
+		pCache->bCurrValid = 1;
+	}
+	memcpy(t, &pCache->currTs, sizeof(struct syslogTime));
+	t->secfrac = tp.tv_usec;
+}
+
+
+/* check if the timestamp starts with the cached prefix; if so, the parse
+ * pointer and length are advanced past it.
+ */
+static inline int
+tsParsePrefixMatch(tsParsePrefix_t *pPrefix, uchar **ppszTS, int *pLenStr)
+{
+	if(pPrefix->lenPrefix == 0 || *pLenStr < pPrefix->lenPrefix
+	   || memcmp(*ppszTS, pPrefix->prefix, pPrefix->lenPrefix))
+		return 0;
+	*ppszTS += pPrefix->lenPrefix;
+	*pLenStr -= pPrefix->lenPrefix;
+	return 1;
+}
+
+
+/* remember the prefix of a timestamp, see tsParsePrefix_t */
+static inline void
+tsParsePrefixStore(tsParsePrefix_t *pPrefix, uchar *pszStart, uchar *pszEnd,
+	int year, int month, int day, int hour, int minute)
+{
+	const int len = (int) (pszEnd - pszStart);
+
+	if(len > TSPARSE_MAX_PREFIX)
+		return;
+	memcpy(pPrefix->prefix, pszStart, len);
+	pPrefix->lenPrefix = len;
+	pPrefix->year = year;
+	pPrefix->month = month;
+	pPrefix->day = day;
+	pPrefix->hour = hour;
+	pPrefix->minute = minute;
+}
+
+
 /*******************************************************************
  * BEGIN CODE-LIBLOGGING                                           *
  *******************************************************************
@@ -226,6 +396,7 @@ ParseTIMESTAMP3339(struct syslogTime *pTime, uchar** ppszTS, int *pLenStr)
 	int OffsetMinute;	/* UTC offset in minutes */
 	int lenStr;
 	/* end variables to temporarily hold time information while we parse */
+	tsCache_t *pCache;
 	DEFiRet;
 
 	assert(pTime != NULL);
@@ -233,45 +404,57 @@ ParseTIMESTAMP3339(struct syslogTime *pTime, uchar** ppszTS, int *pLenStr)
 	assert(pszTS != NULL);
 
 	lenStr = *pLenStr;
-	year = srSLMGParseInt32(&pszTS, &lenStr);
+	pCache = getTsCache();
+	if(pCache != NULL && tsParsePrefixMatch(&pCache->parse3339, &pszTS, &lenStr)) {
+		/* same minute as the previous timestamp */
+		year = pCache->parse3339.year;
+		month = pCache->parse3339.month;
+		day = pCache->parse3339.day;
+		hour = pCache->parse3339.hour;
+		minute = pCache->parse3339.minute;
+	} else {
+		year = srSLMGParseInt32(&pszTS, &lenStr);
 
-	/* We take the liberty to accept slightly malformed timestamps e.g. in 
-	 * the format of 2003-9-1T1:0:0. This doesn't hurt on receiving. Of course,
-	 * with the current state of affairs, we would never run into this code
-	 * here because at postion 11, there is no "T" in such cases ;)
-	 */
-	if(lenStr == 0 || *pszTS++ != '-')
-		ABORT_FINALIZE(RS_RET_INVLD_TIME);
-	--lenStr;
-	month = srSLMGParseInt32(&pszTS, &lenStr);
-	if(month < 1 || month > 12)
-		ABORT_FINALIZE(RS_RET_INVLD_TIME);
+		/* We take the liberty to accept slightly malformed timestamps e.g. in 
+		 * the format of 2003-9-1T1:0:0. This doesn't hurt on receiving. Of course,
+		 * with the current state of affairs, we would never run into this code
+		 * here because at postion 11, there is no "T" in such cases ;)
+		 */
+		if(lenStr == 0 || *pszTS++ != '-')
+			ABORT_FINALIZE(RS_RET_INVLD_TIME);
+		--lenStr;
+		month = srSLMGParseInt32(&pszTS, &lenStr);
+		if(month < 1 || month > 12)
+			ABORT_FINALIZE(RS_RET_INVLD_TIME);
 
-	if(lenStr == 0 || *pszTS++ != '-')
-		ABORT_FINALIZE(RS_RET_INVLD_TIME);
-	--lenStr;
-	day = srSLMGParseInt32(&pszTS, &lenStr);
-	if(day < 1 || day > 31)
-		ABORT_FINALIZE(RS_RET_INVLD_TIME);
+		if(lenStr == 0 || *pszTS++ != '-')
+			ABORT_FINALIZE(RS_RET_INVLD_TIME);
+		--lenStr;
+		day = srSLMGParseInt32(&pszTS, &lenStr);
+		if(day < 1 || day > 31)
+			ABORT_FINALIZE(RS_RET_INVLD_TIME);
 
-	if(lenStr == 0 || *pszTS++ != 'T')
-		ABORT_FINALIZE(RS_RET_INVLD_TIME);
-	--lenStr;
+		if(lenStr == 0 || *pszTS++ != 'T')
+			ABORT_FINALIZE(RS_RET_INVLD_TIME);
+		--lenStr;
 
-	hour = srSLMGParseInt32(&pszTS, &lenStr);
-	if(hour < 0 || hour > 23)
-		ABORT_FINALIZE(RS_RET_INVLD_TIME);
+		hour = srSLMGParseInt32(&pszTS, &lenStr);
+		if(hour < 0 || hour > 23)
+			ABORT_FINALIZE(RS_RET_INVLD_TIME);
 
-	if(lenStr == 0 || *pszTS++ != ':')
-		ABORT_FINALIZE(RS_RET_INVLD_TIME);
-	--lenStr;
-	minute = srSLMGParseInt32(&pszTS, &lenStr);
-	if(minute < 0 || minute > 59)
-		ABORT_FINALIZE(RS_RET_INVLD_TIME);
+		if(lenStr == 0 || *pszTS++ != ':')
+			ABORT_FINALIZE(RS_RET_INVLD_TIME);
+		--lenStr;
+		minute = srSLMGParseInt32(&pszTS, &lenStr);
+		if(minute < 0 || minute > 59)
+			ABORT_FINALIZE(RS_RET_INVLD_TIME);
 
-	if(lenStr == 0 || *pszTS++ != ':')
-		ABORT_FINALIZE(RS_RET_INVLD_TIME);
-	--lenStr;
+		if(lenStr == 0 || *pszTS++ != ':')
+			ABORT_FINALIZE(RS_RET_INVLD_TIME);
+		--lenStr;
+		if(pCache != NULL)
+			tsParsePrefixStore(&pCache->parse3339, *ppszTS, pszTS, year, month, day, hour, minute);
+	}
 	second = srSLMGParseInt32(&pszTS, &lenStr);
 	if(second < 0 || second > 60)
 		ABORT_FINALIZE(RS_RET_INVLD_TIME);
@@ -377,6 +560,7 @@ ParseTIMESTAMP3164(struct syslogTime *pTime, uchar** ppszTS, int *pLenStr)
 	/* end variables to temporarily hold time information while we parse */
 	int lenStr;
 	uchar *pszTS;
+	tsCache_t *pCache;
 	DEFiRet;
 
 	assert(ppszTS != NULL);
@@ -386,206 +570,218 @@ ParseTIMESTAMP3164(struct syslogTime *pTime, uchar** ppszTS, int *pLenStr)
 	assert(pLenStr != NULL);
 	lenStr = *pLenStr;
 
-	/* If we look at the month (Jan, Feb, Mar, Apr, May, Jun, Jul, Aug, Sep, Oct, Nov, Dec),
-	 * we may see the following character sequences occur:
-	 *
-	 * J(an/u(n/l)), Feb, Ma(r/y), A(pr/ug), Sep, Oct, Nov, Dec
-	 *
-	 * We will use this for parsing, as it probably is the
-	 * fastest way to parse it.
-	 *
-	 * 2009-08-17: we now do case-insensitive comparisons, as some devices obviously do not
-	 * obey to the RFC-specified case. As we need to guess in any case, we can ignore case
-	 * in the first place -- rgerhards
-	 *
-	 * 2005-07-18, well sometimes it pays to be a bit more verbose, even in C...
-	 * Fixed a bug that lead to invalid detection of the data. The issue was that
-	 * we had an if(++pszTS == 'x') inside of some of the consturcts below. However,
-	 * there were also some elseifs (doing the same ++), which than obviously did not
-	 * check the orginal character but the next one. Now removed the ++ and put it
-	 * into the statements below. Was a really nasty bug... I didn't detect it before
-	 * june, when it first manifested. This also lead to invalid parsing of the rest
-	 * of the message, as the time stamp was not detected to be correct. - rgerhards
-	 */
-	if(lenStr < 3)
-		ABORT_FINALIZE(RS_RET_INVLD_TIME);
+	pCache = getTsCache();
+	if(pCache != NULL && tsParsePrefixMatch(&pCache->parse3164, &pszTS, &lenStr)) {
+		/* same minute as the previous timestamp */
+		year = pCache->parse3164.year;
+		month = pCache->parse3164.month;
+		day = pCache->parse3164.day;
+		hour = pCache->parse3164.hour;
+		minute = pCache->parse3164.minute;
+	} else {
+		/* If we look at the month (Jan, Feb, Mar, Apr, May, Jun, Jul, Aug, Sep, Oct, Nov, Dec),
+		 * we may see the following character sequences occur:
+		 *
+		 * J(an/u(n/l)), Feb, Ma(r/y), A(pr/ug), Sep, Oct, Nov, Dec
+		 *
+		 * We will use this for parsing, as it probably is the
+		 * fastest way to parse it.
+		 *
+		 * 2009-08-17: we now do case-insensitive comparisons, as some devices obviously do not
+		 * obey to the RFC-specified case. As we need to guess in any case, we can ignore case
+		 * in the first place -- rgerhards
+		 *
+		 * 2005-07-18, well sometimes it pays to be a bit more verbose, even in C...
+		 * Fixed a bug that lead to invalid detection of the data. The issue was that
+		 * we had an if(++pszTS == 'x') inside of some of the consturcts below. However,
+		 * there were also some elseifs (doing the same ++), which than obviously did not
+		 * check the orginal character but the next one. Now removed the ++ and put it
+		 * into the statements below. Was a really nasty bug... I didn't detect it before
+		 * june, when it first manifested. This also lead to invalid parsing of the rest
+		 * of the message, as the time stamp was not detected to be correct. - rgerhards
+		 */
+		if(lenStr < 3)
+			ABORT_FINALIZE(RS_RET_INVLD_TIME);
 
-	switch(*pszTS++)
-	{
-	case 'j':
-	case 'J':
-		if(*pszTS == 'a' || *pszTS == 'A') {
-			++pszTS;
-			if(*pszTS == 'n' || *pszTS == 'N') {
-				++pszTS;
-				month = 1;
-			} else
-				ABORT_FINALIZE(RS_RET_INVLD_TIME);
-		} else if(*pszTS == 'u' || *pszTS == 'U') {
-			++pszTS;
-			if(*pszTS == 'n' || *pszTS == 'N') {
+		switch(*pszTS++)
+		{
+		case 'j':
+		case 'J':
+			if(*pszTS == 'a' || *pszTS == 'A') {
 				++pszTS;
-				month = 6;
-			} else if(*pszTS == 'l' || *pszTS == 'L') {
+				if(*pszTS == 'n' || *pszTS == 'N') {
+					++pszTS;
+					month = 1;
+				} else
+					ABORT_FINALIZE(RS_RET_INVLD_TIME);
+			} else if(*pszTS == 'u' || *pszTS == 'U') {
 				++pszTS;
-				month = 7;
+				if(*pszTS == 'n' || *pszTS == 'N') {
+					++pszTS;
+					month = 6;
+				} else if(*pszTS == 'l' || *pszTS == 'L') {
+					++pszTS;
+					month = 7;
+				} else
+					ABORT_FINALIZE(RS_RET_INVLD_TIME);
 			} else
 				ABORT_FINALIZE(RS_RET_INVLD_TIME);
-		} else
-			ABORT_FINALIZE(RS_RET_INVLD_TIME);
-		break;
-	case 'f':
-	case 'F':
-		if(*pszTS == 'e' || *pszTS == 'E') {
-			++pszTS;
-			if(*pszTS == 'b' || *pszTS == 'B') {
+			break;
+		case 'f':
+		case 'F':
+			if(*pszTS == 'e' || *pszTS == 'E') {
 				++pszTS;
-				month = 2;
+				if(*pszTS == 'b' || *pszTS == 'B') {
+					++pszTS;
+					month = 2;
+				} else
+					ABORT_FINALIZE(RS_RET_INVLD_TIME);
 			} else
 				ABORT_FINALIZE(RS_RET_INVLD_TIME);
-		} else
-			ABORT_FINALIZE(RS_RET_INVLD_TIME);
-		break;
-	case 'm':
-	case 'M':
-		if(*pszTS == 'a' || *pszTS == 'A') {
-			++pszTS;
-			if(*pszTS == 'r' || *pszTS == 'R') {
-				++pszTS;
-				month = 3;
-			} else if(*pszTS == 'y' || *pszTS == 'Y') {
+			break;
+		case 'm':
+		case 'M':
+			if(*pszTS == 'a' || *pszTS == 'A') {
 				++pszTS;
-				month = 5;
+				if(*pszTS == 'r' || *pszTS == 'R') {
+					++pszTS;
+					month = 3;
+				} else if(*pszTS == 'y' || *pszTS == 'Y') {
+					++pszTS;
+					month = 5;
+				} else
+					ABORT_FINALIZE(RS_RET_INVLD_TIME);
 			} else
 				ABORT_FINALIZE(RS_RET_INVLD_TIME);
-		} else
-			ABORT_FINALIZE(RS_RET_INVLD_TIME);
-		break;
-	case 'a':
-	case 'A':
-		if(*pszTS == 'p' || *pszTS == 'P') {
-			++pszTS;
-			if(*pszTS == 'r' || *pszTS == 'R') {
+			break;
+		case 'a':
+		case 'A':
+			if(*pszTS == 'p' || *pszTS == 'P') {
 				++pszTS;
-				month = 4;
-			} else
-				ABORT_FINALIZE(RS_RET_INVLD_TIME);
-		} else if(*pszTS == 'u' || *pszTS == 'U') {
-			++pszTS;
-			if(*pszTS == 'g' || *pszTS == 'G') {
+				if(*pszTS == 'r' || *pszTS == 'R') {
+					++pszTS;
+					month = 4;
+				} else
+					ABORT_FINALIZE(RS_RET_INVLD_TIME);
+			} else if(*pszTS == 'u' || *pszTS == 'U') {
 				++pszTS;
-				month = 8;
+				if(*pszTS == 'g' || *pszTS == 'G') {
+					++pszTS;
+					month = 8;
+				} else
+					ABORT_FINALIZE(RS_RET_INVLD_TIME);
 			} else
 				ABORT_FINALIZE(RS_RET_INVLD_TIME);
-		} else
-			ABORT_FINALIZE(RS_RET_INVLD_TIME);
-		break;
-	case 's':
-	case 'S':
-		if(*pszTS == 'e' || *pszTS == 'E') {
-			++pszTS;
-			if(*pszTS == 'p' || *pszTS == 'P') {
+			break;
+		case 's':
+		case 'S':
+			if(*pszTS == 'e' || *pszTS == 'E') {
 				++pszTS;
-				month = 9;
+				if(*pszTS == 'p' || *pszTS == 'P') {
+					++pszTS;
+					month = 9;
+				} else
+					ABORT_FINALIZE(RS_RET_INVLD_TIME);
 			} else
 				ABORT_FINALIZE(RS_RET_INVLD_TIME);
-		} else
-			ABORT_FINALIZE(RS_RET_INVLD_TIME);
-		break;
-	case 'o':
-	case 'O':
-		if(*pszTS == 'c' || *pszTS == 'C') {
-			++pszTS;
-			if(*pszTS == 't' || *pszTS == 'T') {
+			break;
+		case 'o':
+		case 'O':
+			if(*pszTS == 'c' || *pszTS == 'C') {
 				++pszTS;
-				month = 10;
+				if(*pszTS == 't' || *pszTS == 'T') {
+					++pszTS;
+					month = 10;
+				} else
+					ABORT_FINALIZE(RS_RET_INVLD_TIME);
 			} else
 				ABORT_FINALIZE(RS_RET_INVLD_TIME);
-		} else
-			ABORT_FINALIZE(RS_RET_INVLD_TIME);
-		break;
-	case 'n':
-	case 'N':
-		if(*pszTS == 'o' || *pszTS == 'O') {
-			++pszTS;
-			if(*pszTS == 'v' || *pszTS == 'V') {
+			break;
+		case 'n':
+		case 'N':
+			if(*pszTS == 'o' || *pszTS == 'O') {
 				++pszTS;
-				month = 11;
+				if(*pszTS == 'v' || *pszTS == 'V') {
+					++pszTS;
+					month = 11;
+				} else
+					ABORT_FINALIZE(RS_RET_INVLD_TIME);
 			} else
 				ABORT_FINALIZE(RS_RET_INVLD_TIME);
-		} else
-			ABORT_FINALIZE(RS_RET_INVLD_TIME);
-		break;
-	case 'd':
-	case 'D':
-		if(*pszTS == 'e' || *pszTS == 'E') {
-			++pszTS;
-			if(*pszTS == 'c' || *pszTS == 'C') {
+			break;
+		case 'd':
+		case 'D':
+			if(*pszTS == 'e' || *pszTS == 'E') {
 				++pszTS;
-				month = 12;
+				if(*pszTS == 'c' || *pszTS == 'C') {
+					++pszTS;
+					month = 12;
+				} else
+					ABORT_FINALIZE(RS_RET_INVLD_TIME);
 			} else
 				ABORT_FINALIZE(RS_RET_INVLD_TIME);
-		} else
+			break;
+		default:
 			ABORT_FINALIZE(RS_RET_INVLD_TIME);
-		break;
-	default:
-		ABORT_FINALIZE(RS_RET_INVLD_TIME);
-	}
-
-	lenStr -= 3;
+		}
 
-	/* done month */
+		lenStr -= 3;
 
-	if(lenStr == 0 || *pszTS++ != ' ')
-		ABORT_FINALIZE(RS_RET_INVLD_TIME);
-	--lenStr;
+		/* done month */
 
-	/* we accept a slightly malformed timestamp when receiving. This is
-	 * we accept one-digit days
-	 */
-	if(*pszTS == ' ') {
+		if(lenStr == 0 || *pszTS++ != ' ')
+			ABORT_FINALIZE(RS_RET_INVLD_TIME);
 		--lenStr;
-		++pszTS;
-	}
 
-	day = srSLMGParseInt32(&pszTS, &lenStr);
-	if(day < 1 || day > 31)
-		ABORT_FINALIZE(RS_RET_INVLD_TIME);
-
-	if(lenStr == 0 || *pszTS++ != ' ')
-		ABORT_FINALIZE(RS_RET_INVLD_TIME);
-	--lenStr;
-
-	/* time part */
-	hour = srSLMGParseInt32(&pszTS, &lenStr);
-	if(hour > 1970 && hour < 2100) {
-		/* if so, we assume this actually is a year. This is a format found
-		 * e.g. in Cisco devices.
-		 * (if you read this 2100+ trying to fix a bug, congratulate me
-		 * to how long the code survived - me no longer ;)) -- rgerhards, 2008-11-18
+		/* we accept a slightly malformed timestamp when receiving. This is
+		 * we accept one-digit days
 		 */
-		year = hour;
+		if(*pszTS == ' ') {
+			--lenStr;
+			++pszTS;
+		}
+
+		day = srSLMGParseInt32(&pszTS, &lenStr);
+		if(day < 1 || day > 31)
+			ABORT_FINALIZE(RS_RET_INVLD_TIME);
 
-		/* re-query the hour, this time it must be valid */
 		if(lenStr == 0 || *pszTS++ != ' ')
 			ABORT_FINALIZE(RS_RET_INVLD_TIME);
 		--lenStr;
+
+		/* time part */
 		hour = srSLMGParseInt32(&pszTS, &lenStr);
-	}
+		if(hour > 1970 && hour < 2100) {
+			/* if so, we assume this actually is a year. This is a format found
+			 * e.g. in Cisco devices.
+			 * (if you read this 2100+ trying to fix a bug, congratulate me
+			 * to how long the code survived - me no longer ;)) -- rgerhards, 2008-11-18
+			 */
+			year = hour;
+
+			/* re-query the hour, this time it must be valid */
+			if(lenStr == 0 || *pszTS++ != ' ')
+				ABORT_FINALIZE(RS_RET_INVLD_TIME);
+			--lenStr;
+			hour = srSLMGParseInt32(&pszTS, &lenStr);
+		}
 
-	if(hour < 0 || hour > 23)
-		ABORT_FINALIZE(RS_RET_INVLD_TIME);
+		if(hour < 0 || hour > 23)
+			ABORT_FINALIZE(RS_RET_INVLD_TIME);
 
-	if(lenStr == 0 || *pszTS++ != ':')
-		ABORT_FINALIZE(RS_RET_INVLD_TIME);
-	--lenStr;
-	minute = srSLMGParseInt32(&pszTS, &lenStr);
-	if(minute < 0 || minute > 59)
-		ABORT_FINALIZE(RS_RET_INVLD_TIME);
+		if(lenStr == 0 || *pszTS++ != ':')
+			ABORT_FINALIZE(RS_RET_INVLD_TIME);
+		--lenStr;
+		minute = srSLMGParseInt32(&pszTS, &lenStr);
+		if(minute < 0 || minute > 59)
+			ABORT_FINALIZE(RS_RET_INVLD_TIME);
 
-	if(lenStr == 0 || *pszTS++ != ':')
-		ABORT_FINALIZE(RS_RET_INVLD_TIME);
-	--lenStr;
+		if(lenStr == 0 || *pszTS++ != ':')
+			ABORT_FINALIZE(RS_RET_INVLD_TIME);
+		--lenStr;
+		if(pCache != NULL)
+			tsParsePrefixStore(&pCache->parse3164, *ppszTS, pszTS, year, month, day, hour, minute);
+	}
 	second = srSLMGParseInt32(&pszTS, &lenStr);
 	if(second < 0 || second > 60)
 		ABORT_FINALIZE(RS_RET_INVLD_TIME);
@@ -648,7 +844,7 @@ applyDfltTZ(struct syslogTime *pTime, char *tz)
  * returns the size of the timestamp written in bytes (without
  * the string terminator). If 0 is returend, an error occured.
  */
-int formatTimestampToMySQL(struct syslogTime *ts, char* pBuf)
+static int doFormatTimestampToMySQL(struct syslogTime *ts, char* pBuf)
 {
 	/* currently we do not consider localtime/utc. This may later be
 	 * added. If so, I recommend using a property replacer option
@@ -678,7 +874,7 @@ int formatTimestampToMySQL(struct syslogTime *ts, char* pBuf)
 
 }
 
-int formatTimestampToPgSQL(struct syslogTime *ts, char *pBuf)
+static int doFormatTimestampToPgSQL(struct syslogTime *ts, char *pBuf)
 {
 	/* see note in formatTimestampToMySQL, applies here as well */
 	assert(ts != NULL);
@@ -755,7 +951,7 @@ int formatTimestampSecFrac(struct syslogTime *ts, char* pBuf)
  * returns the size of the timestamp written in bytes (without
  * the string terminator). If 0 is returend, an error occured.
  */
-int formatTimestamp3339(struct syslogTime *ts, char* pBuf)
+static int doFormatTimestamp3339(struct syslogTime *ts, char* pBuf)
 {
 	int iBuf;
 	int power;
@@ -835,7 +1031,7 @@ int formatTimestamp3339(struct syslogTime *ts, char* pBuf)
  * day character if day < 10. syslog-ng seems to do that, and some
  * parsing scripts (in migration cases) rely on that.
  */
-int formatTimestamp3164(struct syslogTime *ts, char* pBuf, int bBuggyDay)
+static int doFormatTimestamp3164(struct syslogTime *ts, char* pBuf, int bBuggyDay)
 {
 	static char* monthNames[12] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
 					"Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
@@ -865,12 +1061,12 @@ int formatTimestamp3164(struct syslogTime *ts, char* pBuf, int bBuggyDay)
 
 
 /**
- * convert syslog timestamp to time_t
+ * compute the number of seconds from the epoch to the start of the
+ * day of a syslog timestamp (ignoring its UTC offset).
  */
-time_t syslogTime2time_t(struct syslogTime *ts)
+static time_t syslogTimeDayStart(struct syslogTime *ts)
 {
 	long MonthInDays, NumberOfYears, NumberOfDays, i;
-	int utcOffset;
 	time_t TimeInUnixFormat;
 
 	/* Counting how many Days have passed since the 01.01 of the
@@ -958,6 +1154,35 @@ time_t syslogTime2time_t(struct syslogTime *ts)
 			TimeInUnixFormat += 86400;
 		}	
 	}
+	return TimeInUnixFormat;
+}
+
+
+/**
+ * convert syslog timestamp to time_t
+ * The start of the day is memoized per thread, as consecutive timestamps
+ * are almost always from the same day.
+ */
+time_t syslogTime2time_t(struct syslogTime *ts)
+{
+	int utcOffset;
+	time_t TimeInUnixFormat;
+	tsCache_t *pCache;
+
+	pCache = getTsCache();
+	if(pCache == NULL) {
+		TimeInUnixFormat = syslogTimeDayStart(ts);
+	} else {
+		if(!pCache->bDayValid || pCache->dayDay != ts->day
+		   || pCache->dayMonth != ts->month || pCache->dayYear != ts->year) {
+			pCache->dayStart = syslogTimeDayStart(ts);
+			pCache->dayYear = ts->year;
+			pCache->dayMonth = ts->month;
+			pCache->dayDay = ts->day;
+			pCache->bDayValid = 1;
+		}
+		TimeInUnixFormat = pCache->dayStart;
+	}
 
 	/*Add Hours, minutes and seconds */
 	TimeInUnixFormat += ts->hour*60*60;
@@ -982,13 +1207,122 @@ time_t syslogTime2time_t(struct syslogTime *ts)
  * Important: pBuf must point to a buffer of at least 11 bytes.
  * rgerhards, 2012-03-29
  */
-int formatTimestampUnix(struct syslogTime *ts, char *pBuf)
+static int doFormatTimestampUnix(struct syslogTime *ts, char *pBuf)
 {
 	snprintf(pBuf, 11, "%u", (unsigned) syslogTime2time_t(ts));
 	return 11;
 }
 
 
+
+
+static inline int
+tsCacheSameSecond(struct syslogTime *t1, struct syslogTime *t2)
+{
+	return    t1->second == t2->second
+	       && t1->minute == t2->minute
+	       && t1->hour == t2->hour
+	       && t1->day == t2->day
+	       && t1->month == t2->month
+	       && t1->year == t2->year
+	       && t1->secfracPrecision == t2->secfracPrecision
+	       && t1->OffsetMode == t2->OffsetMode
+	       && t1->OffsetHour == t2->OffsetHour
+	       && t1->OffsetMinute == t2->OffsetMinute
+	       && t1->timeType == t2->timeType;
+}
+
+static int
+tsCacheFormatDirect(struct syslogTime *ts, enum tsCacheFmt fmt, char *pBuf)
+{
+	switch(fmt) {
+	case TSCACHE_3164:
+		return doFormatTimestamp3164(ts, pBuf, 0);
+	case TSCACHE_3164_BUGGY:
+		return doFormatTimestamp3164(ts, pBuf, 1);
+	case TSCACHE_MYSQL:
+		return doFormatTimestampToMySQL(ts, pBuf);
+	case TSCACHE_PGSQL:
+		return doFormatTimestampToPgSQL(ts, pBuf);
+	case TSCACHE_3339:
+		return doFormatTimestamp3339(ts, pBuf);
+	case TSCACHE_UNIX:
+	default:
+		return doFormatTimestampUnix(ts, pBuf);
+	}
+}
+
+/* format ts into pBuf via the calling thread's cache. pBuf must be large
+ * enough for fmt, as for the direct format functions. Falls back to
+ * formatting directly if the cache can not be allocated.
+ */
+static int
+tsCacheFormat(struct syslogTime *ts, enum tsCacheFmt fmt, char *pBuf)
+{
+	tsCache_t *pCache;
+	tsCacheEntry_t *pEntry;
+	int secfrac;
+	int power;
+	int i;
+
+	if(fmt == TSCACHE_3339 && ts->secfracPrecision > 6) /* not seen in practice */
+		return tsCacheFormatDirect(ts, fmt, pBuf);
+	if((pCache = getTsCache()) == NULL)
+		return tsCacheFormatDirect(ts, fmt, pBuf);
+
+	for(i = 0 ; i < TSCACHE_WAYS ; ++i) {
+		pEntry = &pCache->ent[fmt][i];
+		if(pEntry->bValid && tsCacheSameSecond(&pEntry->ts, ts))
+			break;
+	}
+	if(i == TSCACHE_WAYS) {
+		pEntry = &pCache->ent[fmt][pCache->iNext[fmt]];
+		pCache->iNext[fmt] = (pCache->iNext[fmt] + 1) % TSCACHE_WAYS;
+		pEntry->iRet = tsCacheFormatDirect(ts, fmt, pEntry->buf);
+		pEntry->lenStr = strlen(pEntry->buf);
+		pEntry->ts = *ts;
+		pEntry->bValid = 1;
+	} else if(fmt == TSCACHE_3339 && ts->secfracPrecision > 0 && pEntry->ts.secfrac != ts->secfrac) {
+		/* same digits as doFormatTimestamp3339(), they start after "yyyy-mm-ddThh:mm:ss." */
+		power = tenPowers[ts->secfracPrecision - 1];
+		secfrac = ts->secfrac;
+		for(i = 20 ; power > 0 ; ++i, power /= 10) {
+			pEntry->buf[i] = secfrac / power + '0';
+			secfrac %= power;
+		}
+		pEntry->ts.secfrac = ts->secfrac;
+	}
+	memcpy(pBuf, pEntry->buf, pEntry->lenStr + 1);
+	return pEntry->iRet;
+}
+
+
+int formatTimestampToMySQL(struct syslogTime *ts, char* pBuf)
+{
+	return tsCacheFormat(ts, TSCACHE_MYSQL, pBuf);
+}
+
+int formatTimestampToPgSQL(struct syslogTime *ts, char *pBuf)
+{
+	return tsCacheFormat(ts, TSCACHE_PGSQL, pBuf);
+}
+
+int formatTimestamp3339(struct syslogTime *ts, char* pBuf)
+{
+	return tsCacheFormat(ts, TSCACHE_3339, pBuf);
+}
+
+int formatTimestamp3164(struct syslogTime *ts, char* pBuf, int bBuggyDay)
+{
+	return tsCacheFormat(ts, bBuggyDay ? TSCACHE_3164_BUGGY : TSCACHE_3164, pBuf);
+}
+
+int formatTimestampUnix(struct syslogTime *ts, char *pBuf)
+{
+	return tsCacheFormat(ts, TSCACHE_UNIX, pBuf);
+}
+
+
 /* queryInterface function
  * rgerhards, 2008-03-05
  */
@@ -1026,6 +1360,8 @@ ENDobjQueryInterface(datetime)
 BEGINAbstractObjClassInit(datetime, 1, OBJ_IS_CORE_MODULE) /* class, version */
 	/* request objects we use */
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
+	if(pthread_key_create(&keyTsCache, free) != 0)
+		ABORT_FINALIZE(RS_RET_ERR);
 ENDObjClassInit(datetime)
 
 /* vi:set ai:
@@ -62,6 +62,7 @@ ENDinterface(datetime)
 
 /* prototypes */
 PROTOTYPEObj(datetime);
+extern int iTimestampResolution;	/* global(timestamp.resolution) */
 void applyDfltTZ(struct syslogTime *pTime, char *tz);
 
 #endif /* #ifndef INCLUDED_DATETIME_H */
@@ -89,6 +89,7 @@ static int dbgPrintNameIsInList(const uchar *pName, dbgPrintName_t *pRoot);
 
 /* This lists are single-linked and members are added at the top */
 static dbgPrintName_t *printNameFileRoot = NULL;
+static dbgPrintName_t *printNameSubsysRoot = NULL;
 
 
 /* list of all known FuncDBs. We use a special list, because it must only be single-linked. As
@@ -849,6 +850,314 @@ sigsegvHdlr(int signum)
 	abort();
 }
 
+/* ------------------------- ring buffer debug output ------------------------- */
+
+/* With RSYSLOG_DEBUG="RingBuffer[=KiB]", dbgprintf() does not write the
+ * message itself. Instead, the calling thread appends it to a ring buffer
+ * of its own, which needs neither a lock nor a system call. A flusher
+ * thread drains all rings every DBG_RING_FLUSH_MS, formats the timestamp and
+ * thread id and writes the messages out. SIGUSR2 and shutdown drain the
+ * rings as well. If a ring is full, the message is dropped. The next message
+ * that fits tells how many were dropped. Each ring has exactly one producer
+ * (its thread) and one consumer (the flusher, serialized by mutRing), so the
+ * head and tail indexes only need memory barriers.
+ */
+#ifdef HAVE_ATOMIC_BUILTINS
+#define DBG_RING_FLUSH_MS 100
+#define DBG_RING_DFLT_KB 1024
+#define DBG_RING_MAXMSG (32*1024)	/* same limit as dbgprintf() itself */
+typedef struct dbgRingRec_s {
+	uint32_t len;		/* length of message text following the record */
+	uint32_t nDropped;	/* messages dropped before this one */
+	struct timespec t;	/* time of dbgprintf() call */
+} dbgRingRec_t;
+
+typedef struct dbgRing_s {
+	char *buf;
+	size_t size;		/* power of two */
+	volatile size_t head;	/* next write position, only modified by owner */
+	volatile size_t tail;	/* next read position, only modified by consumer */
+	unsigned nDropped;	/* only accessed by owner */
+	volatile int bExited;	/* owner has terminated, ring can go once drained */
+	pthread_t thrd;
+	struct dbgRing_s *pNext;
+} dbgRing_t;
+
+static size_t dbgRingSize = 0;	/* 0 means ring buffer mode is off */
+static dbgRing_t *dbgRingRoot = NULL;	/* guarded by mutRing */
+static pthread_mutex_t mutRing;
+static pthread_key_t keyRing;
+static pthread_t thrdRingFlusher;
+static int bRingFlusherRunning = 0;	/* guarded by mutRing */
+static volatile int bRingFlusherStop = 0;
+
+/* copy len bytes into or out of the ring at position pos, handling wrap-around */
+static inline void
+dbgRingCopyIn(dbgRing_t *pRing, size_t pos, const void *p, size_t len)
+{
+	const size_t offs = pos & (pRing->size - 1);
+	const size_t lenFirst = (len < pRing->size - offs) ? len : pRing->size - offs;
+	memcpy(pRing->buf + offs, p, lenFirst);
+	memcpy(pRing->buf, (const char*) p + lenFirst, len - lenFirst);
+}
+static inline void
+dbgRingCopyOut(dbgRing_t *pRing, size_t pos, void *p, size_t len)
+{
+	const size_t offs = pos & (pRing->size - 1);
+	const size_t lenFirst = (len < pRing->size - offs) ? len : pRing->size - offs;
+	memcpy(p, pRing->buf + offs, lenFirst);
+	memcpy((char*) p + lenFirst, pRing->buf, len - lenFirst);
+}
+
+/* write all pending messages of all rings and discard the rings of
+ * terminated threads. Must be called with mutRing locked.
+ */
+static void
+dbgRingDrainAll(void)
+{
+	dbgRing_t *pRing;
+	dbgRing_t **ppPrev;
+	dbgRingRec_t rec;
+	size_t tail;
+	size_t lenHdr;
+	char hdr[128];
+	char msg[DBG_RING_MAXMSG];
+	int bExited;
+
+	ppPrev = &dbgRingRoot;
+	while((pRing = *ppPrev) != NULL) {
+		bExited = pRing->bExited; /* read first, so we do not miss messages */
+		__sync_synchronize();
+		for(tail = pRing->tail ; tail != pRing->head ; ) {
+			__sync_synchronize(); /* the record is complete when we see it in head */
+			dbgRingCopyOut(pRing, tail, &rec, sizeof(rec));
+			dbgRingCopyOut(pRing, tail + sizeof(rec), msg, rec.len);
+			tail += sizeof(rec) + rec.len;
+			__sync_synchronize(); /* done reading before the space is released */
+			pRing->tail = tail;
+			if(rec.nDropped > 0) {
+				lenHdr = snprintf(hdr, sizeof(hdr), "%lx: [%u debug messages dropped, "
+					"ring buffer full]\n", (unsigned long) pRing->thrd, rec.nDropped);
+				if(stddbg != -1) if(write(stddbg, hdr, lenHdr)){};
+				if(altdbg != -1) if(write(altdbg, hdr, lenHdr)){};
+			}
+			lenHdr = 0;
+			if(bPrintTime)
+				lenHdr = snprintf(hdr, sizeof(hdr), "%4.4ld.%9.9ld:", (long) (rec.t.tv_sec % 10000),
+						  rec.t.tv_nsec);
+			lenHdr += snprintf(hdr + lenHdr, sizeof(hdr) - lenHdr, "%lx: ", (unsigned long) pRing->thrd);
+			if(stddbg != -1) {
+				if(write(stddbg, hdr, lenHdr)){};
+				if(write(stddbg, msg, rec.len)){};
+			}
+			if(altdbg != -1) {
+				if(write(altdbg, hdr, lenHdr)){};
+				if(write(altdbg, msg, rec.len)){};
+			}
+		}
+		if(bExited) {
+			if(pRing->nDropped > 0) { /* no later message will report them */
+				lenHdr = snprintf(hdr, sizeof(hdr), "%lx: [%u debug messages dropped, "
+					"ring buffer full]\n", (unsigned long) pRing->thrd, pRing->nDropped);
+				if(stddbg != -1) if(write(stddbg, hdr, lenHdr)){};
+				if(altdbg != -1) if(write(altdbg, hdr, lenHdr)){};
+			}
+			*ppPrev = pRing->pNext;
+			free(pRing->buf);
+			free(pRing);
+		} else {
+			ppPrev = &pRing->pNext;
+		}
+	}
+}
+
+static void *
+dbgRingFlusher(void __attribute__((unused)) *arg)
+{
+	struct timespec t;
+	sigset_t sigSet;
+
+	/* signals are for the "real" threads */
+	sigfillset(&sigSet);
+	pthread_sigmask(SIG_BLOCK, &sigSet, NULL);
+	t.tv_sec = 0;
+	t.tv_nsec = DBG_RING_FLUSH_MS * 1000000;
+	while(!bRingFlusherStop) {
+		nanosleep(&t, NULL);
+		pthread_mutex_lock(&mutRing);
+		dbgRingDrainAll();
+		pthread_mutex_unlock(&mutRing);
+	}
+	return NULL;
+}
+
+/* thread-specific data destructor: the ring is freed by the consumer */
+static void
+dbgRingThrdExit(void *arg)
+{
+	dbgRing_t *pRing = (dbgRing_t*) arg;
+	__sync_synchronize();
+	pRing->bExited = 1;
+}
+
+/* after fork(), only the forking thread exists in the child */
+static void
+dbgRingAtForkChild(void)
+{
+	pthread_mutex_init(&mutRing, NULL);
+	bRingFlusherRunning = 0;
+}
+
+/* get the ring of the current thread, creating it (and the flusher) if needed.
+ * Returns NULL if out of memory.
+ */
+static dbgRing_t *
+dbgRingGet(void)
+{
+	dbgRing_t *pRing;
+
+	if((pRing = pthread_getspecific(keyRing)) != NULL && bRingFlusherRunning)
+		return pRing;
+
+	pthread_mutex_lock(&mutRing);
+	if(pRing == NULL && (pRing = calloc(1, sizeof(dbgRing_t))) != NULL) {
+		if((pRing->buf = malloc(dbgRingSize)) == NULL) {
+			free(pRing);
+			pRing = NULL;
+		} else {
+			pRing->size = dbgRingSize;
+			pRing->thrd = pthread_self();
+			pRing->pNext = dbgRingRoot;
+			dbgRingRoot = pRing;
+			(void) pthread_setspecific(keyRing, pRing);
+		}
+	}
+	if(pRing != NULL && !bRingFlusherRunning && dbgRingSize != 0) {
+		bRingFlusherStop = 0;
+		if(pthread_create(&thrdRingFlusher, NULL, dbgRingFlusher, NULL) == 0)
+			bRingFlusherRunning = 1;
+	}
+	pthread_mutex_unlock(&mutRing);
+	return pRing;
+}
+
+/* append a message to the current thread's ring */
+static void
+dbgRingPut(uchar *pszObjName, char *pszMsg, size_t lenMsgIn)
+{
+	dbgRing_t *pRing;
+	dbgRingRec_t rec;
+	size_t lenObjName = 0;
+	size_t lenRec;
+	size_t head;
+	size_t lenMsg = lenMsgIn;
+
+	if((pRing = dbgRingGet()) == NULL)
+		return;
+
+	if(pszObjName != NULL)
+		lenObjName = strlen((char*) pszObjName) + 2;
+	if(lenObjName + lenMsg > DBG_RING_MAXMSG || lenObjName + lenMsg > pRing->size / 4) {
+		/* permit a reasonable number of messages in the ring */
+		lenObjName = 0;
+		if(lenMsg > DBG_RING_MAXMSG)
+			lenMsg = DBG_RING_MAXMSG;
+		if(lenMsg > pRing->size / 4)
+			lenMsg = pRing->size / 4;
+	}
+	lenRec = sizeof(rec) + lenObjName + lenMsg;
+	head = pRing->head;
+	if(lenRec > pRing->size - (head - pRing->tail)) {
+		++pRing->nDropped;
+		return;
+	}
+
+#	if _POSIX_TIMERS > 0
+	clock_gettime(CLOCK_REALTIME, &rec.t);
+#	else
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		rec.t.tv_sec = tv.tv_sec;
+		rec.t.tv_nsec = tv.tv_usec * 1000;
+	}
+#	endif
+	rec.len = lenObjName + lenMsg;
+	rec.nDropped = pRing->nDropped;
+	pRing->nDropped = 0;
+	dbgRingCopyIn(pRing, head, &rec, sizeof(rec));
+	head += sizeof(rec);
+	if(lenObjName > 0) {
+		dbgRingCopyIn(pRing, head, pszObjName, lenObjName - 2);
+		dbgRingCopyIn(pRing, head + lenObjName - 2, ": ", 2);
+		head += lenObjName;
+	}
+	dbgRingCopyIn(pRing, head, pszMsg, lenMsg);
+	__sync_synchronize(); /* the consumer must only see complete records */
+	pRing->head = head + lenMsg;
+}
+
+/* set up ring buffer mode with a per-thread ring of (at least) sizeKB KiB */
+static void
+dbgRingInit(long sizeKB)
+{
+	size_t size = 4096;
+
+	if(sizeKB <= 0)
+		sizeKB = DBG_RING_DFLT_KB;
+	while(size < (size_t) sizeKB * 1024)
+		size <<= 1;
+	pthread_mutex_init(&mutRing, NULL);
+	(void) pthread_key_create(&keyRing, dbgRingThrdExit);
+	pthread_atfork(NULL, NULL, dbgRingAtForkChild);
+	dbgRingSize = size;
+}
+
+/* drain all rings on SIGUSR2. As we may have interrupted the flusher (or
+ * a thread creating its ring), we must not wait for the mutex. If it is
+ * busy, the rings are being drained in any case.
+ */
+static void
+dbgRingFlush(void)
+{
+	if(dbgRingSize == 0)
+		return;
+	if(pthread_mutex_trylock(&mutRing) == 0) {
+		dbgRingDrainAll();
+		pthread_mutex_unlock(&mutRing);
+	}
+}
+
+/* stop the flusher and write out what is left */
+static void
+dbgRingExit(void)
+{
+	int bJoin;
+
+	if(dbgRingSize == 0)
+		return;
+	dbgRingSize = 0; /* any further output goes out directly */
+	pthread_mutex_lock(&mutRing);
+	bJoin = bRingFlusherRunning;
+	bRingFlusherRunning = 0;
+	pthread_mutex_unlock(&mutRing);
+	if(bJoin) {
+		bRingFlusherStop = 1;
+		pthread_join(thrdRingFlusher, NULL);
+	}
+	pthread_mutex_lock(&mutRing);
+	dbgRingDrainAll();
+	pthread_mutex_unlock(&mutRing);
+}
+#else /* #ifdef HAVE_ATOMIC_BUILTINS */
+static const size_t dbgRingSize = 0;
+static void dbgRingPut(uchar __attribute__((unused)) *pszObjName, char __attribute__((unused)) *pszMsg,
+	size_t __attribute__((unused)) lenMsg) { }
+static void dbgRingFlush(void) { }
+static void dbgRingExit(void) { }
+#endif /* #ifdef HAVE_ATOMIC_BUILTINS */
+
+
 /* actually write the debug message. This is a separate fuction because the cleanup_push/_pop
  * interface otherwise is unsafe to use (generates compiler warnings at least).
  * 2009-05-20 rgerhards
@@ -932,6 +1241,18 @@ do_dbgprint(uchar *pszObjName, char *pszMsg, size_t lenMsg)
 }
 
 #pragma GCC diagnostic ignored "-Wempty-body"
+/* write the debug message right away, serialized by mutdbgprint */
+static void
+dbgprintSync(uchar *pszObjName, char *pszMsg, size_t lenMsg)
+{
+	pthread_mutex_lock(&mutdbgprint);
+	pthread_cleanup_push(dbgMutexCancelCleanupHdlr, &mutdbgprint);
+
+	do_dbgprint(pszObjName, pszMsg, lenMsg);
+
+	pthread_cleanup_pop(1);
+}
+
 /* write the debug message. This is a helper to dbgprintf and dbgoprint which
  * contains common code. added 2008-09-26 rgerhards
  */
@@ -950,12 +1271,10 @@ dbgprint(obj_t *pObj, char *pszMsg, size_t lenMsg)
 		pszObjName = obj.GetName(pObj);
 	}
 
-	pthread_mutex_lock(&mutdbgprint);
-	pthread_cleanup_push(dbgMutexCancelCleanupHdlr, &mutdbgprint);
-
-	do_dbgprint(pszObjName, pszMsg, lenMsg);
-
-	pthread_cleanup_pop(1);
+	if(dbgRingSize != 0)
+		dbgRingPut(pszObjName, pszMsg, lenMsg);
+	else
+		dbgprintSync(pszObjName, pszMsg, lenMsg);
 }
 #pragma GCC diagnostic warning "-Wempty-body"
 
@@ -1190,6 +1509,7 @@ static void sigusr2Hdlr(int __attribute__((unused)) signum)
 {
 	dbgprintf("SIGUSR2 received, dumping debug information\n");
 	dbgPrintAllDebugInfo();
+	dbgRingFlush();
 }
 
 /* support system to set debug options at runtime */
@@ -1301,6 +1621,36 @@ dbgPrintNameIsInList(const uchar *pName, dbgPrintName_t *pRoot)
 }
 
 
+/* check if DBGPRINTF/DBGOPRINT output from a call site passes the
+ * subsystem filter. A subsystem is a source file, which may be given with
+ * or without the ".c". The result is cached in the site, so the filter is
+ * only evaluated on the first call (the filter is fixed at startup).
+ */
+int
+dbgSiteCheck(dbgSite_t *pSite)
+{
+	const char *pName;
+	char szName[128];
+	size_t len;
+	int bPrint;
+
+	if(printNameSubsysRoot == NULL) {
+		bPrint = 1;
+	} else {
+		pName = strrchr(pSite->file, '/');
+		pName = (pName == NULL) ? pSite->file : pName + 1;
+		bPrint = dbgPrintNameIsInList((const uchar*) pName, printNameSubsysRoot);
+		if(!bPrint && (len = strcspn(pName, ".")) < sizeof(szName)) {
+			memcpy(szName, pName, len);
+			szName[len] = '\0';
+			bPrint = dbgPrintNameIsInList((const uchar*) szName, printNameSubsysRoot);
+		}
+	}
+	pSite->state = bPrint ? DBGSITE_PRINT : DBGSITE_FILTERED;
+	return bPrint;
+}
+
+
 /* this is a special version of malloc that fills the alloced memory with
  * HIGHVALUE, as this helps to identify bugs. -- rgerhards, 2009-10-22
  */
@@ -1355,6 +1705,10 @@ dbgGetRuntimeOptions(void)
 					"Nostdoout\n"
 					"OutputTidToStderr\n"
 					"filetrace=file (may be provided multiple times)\n"
+					"subsystem=file - only print DBGPRINTF output from this source file,\n"
+					"\twith or without .c (may be provided multiple times)\n"
+					"RingBuffer[=KiB] - buffer output per thread, written by a background\n"
+					"\tthread (default 1024 KiB per thread)\n"
 					"DebugOnDemand - enables debugging on USR1, but does not turn on output\n"
 					"\nSee debug.html in your doc set or http://www.rsyslog.com for details\n");
 				exit(1);
@@ -1398,6 +1752,20 @@ dbgGetRuntimeOptions(void)
 					/* create new entry and add it to list */
 					dbgPrintNameAdd(optval, &printNameFileRoot);
 				}
+			} else if(!strcasecmp((char*)optname, "subsystem")) {
+				if(*optval == '\0') {
+					fprintf(stderr, "rsyslogd " VERSION " error: subsystem debug option requires "
+						"source file name, e.g. \"subsystem=queue\"\n");
+					exit(1);
+				}
+				dbgPrintNameAdd(optval, &printNameSubsysRoot);
+			} else if(!strcasecmp((char*)optname, "ringbuffer")) {
+#				ifdef HAVE_ATOMIC_BUILTINS
+				dbgRingInit(atol((char*)optval));
+#				else
+				fprintf(stderr, "rsyslogd " VERSION " error: RingBuffer debug option needs "
+					"atomic instructions, which this platform does not support - ignored\n");
+#				endif
 			} else {
 				fprintf(stderr, "rsyslogd " VERSION " error: invalid debug option '%s', value '%s' - ignored\n",
 					optval, optname);
@@ -1486,6 +1854,7 @@ rsRetVal dbgClassExit(void)
 	dbgFuncDBListEntry_t *pFuncDBListEtry, *pToDel;
 	pthread_key_delete(keyCallStack);
 
+	dbgRingExit();
 	if(bPrintAllDebugOnExit)
 		dbgPrintAllDebugInfo();
 
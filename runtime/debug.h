@@ -86,6 +86,16 @@ typedef struct dbgCallStack_s {
 } dbgThrdInfo_t;
 
 
+/* a DBGPRINTF/DBGOPRINT call site, caches if it passes the subsystem filter */
+typedef struct dbgSite_s {
+	const char *file;
+	int state;
+} dbgSite_t;
+#define DBGSITE_UNCHECKED 0
+#define DBGSITE_PRINT 1
+#define DBGSITE_FILTERED 2
+
+
 /* prototypes */
 rsRetVal dbgClassInit(void);
 rsRetVal dbgClassExit(void);
@@ -108,6 +118,7 @@ void dbgPrintAllDebugInfo(void);
 void *dbgmalloc(size_t size);
 void dbgOutputTID(char* name);
 int dbgGetDbglogFd(void);
+int dbgSiteCheck(dbgSite_t *pSite);
 
 /* external data */
 extern char *pszAltDbgFileName; /* if set, debug output is *also* sent to here */
@@ -118,8 +129,12 @@ extern int altdbg;	/* and the handle for alternate debug output */
 #	define DBGPRINTF(...) {}
 #	define DBGOPRINT(...) {}
 #else
-#	define DBGPRINTF(...) if(Debug) { dbgprintf(__VA_ARGS__); }
-#	define DBGOPRINT(...) if(Debug) { dbgoprint(__VA_ARGS__); }
+#	define DBGSITE_PASSES(site) \
+		((site).state == DBGSITE_PRINT || ((site).state == DBGSITE_UNCHECKED && dbgSiteCheck(&(site))))
+#	define DBGPRINTF(...) if(Debug) { static dbgSite_t dbgSite = { __FILE__, DBGSITE_UNCHECKED }; \
+		if(DBGSITE_PASSES(dbgSite)) dbgprintf(__VA_ARGS__); }
+#	define DBGOPRINT(...) if(Debug) { static dbgSite_t dbgSite = { __FILE__, DBGSITE_UNCHECKED }; \
+		if(DBGSITE_PASSES(dbgSite)) dbgoprint(__VA_ARGS__); }
 #endif
 #ifdef RTINST
 #	define BEGINfunc static dbgFuncDB_t *pdbgFuncDB; int dbgCALLStaCK_POP_POINT = dbgEntrFunc(&pdbgFuncDB, __FILE__, __func__, __LINE__);
@@ -34,6 +34,7 @@
 #include <netdb.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <time.h>
 
 #include "syslogd-types.h"
 #include "glbl.h"
@@ -46,19 +47,25 @@
 #include "dnscache.h"
 
 /* module data structures */
+#define DNSCACHE_SHARDS 16 /* must be a power of 2 */
 struct dnscache_entry_s {
 	struct sockaddr_storage addr;
 	prop_t *fqdn;
 	prop_t *fqdnLowerCase;
 	prop_t *localName; /* only local name, without domain part (if configured so) */
 	prop_t *ip;
-	struct dnscache_entry_s *next;
-	unsigned nUsed;
+	struct dnscache_entry_s *next; /* eviction list, oldest first */
+	time_t tExpire;	/* when to re-query, 0 - never */
+	sbool bNegative; /* name could not be resolved, IP is used as name */
+	sbool bRefreshing; /* a thread is currently re-querying this entry */
+	sbool bUsed; /* looked up since last eviction scan (second chance) */
 };
 typedef struct dnscache_entry_s dnscache_entry_t;
 struct dnscache_s {
 	pthread_rwlock_t rwlock;
 	struct hashtable *ht;
+	dnscache_entry_t *pRoot; /* eviction list */
+	dnscache_entry_t *pLast;
 	unsigned nEntries;
 };
 typedef struct dnscache_s dnscache_t;
@@ -69,9 +76,23 @@ DEFobjStaticHelpers
 DEFobjCurrIf(glbl)
 DEFobjCurrIf(errmsg)
 DEFobjCurrIf(prop)
-static dnscache_t dnsCache;
+static dnscache_t dnsCache[DNSCACHE_SHARDS];
 static prop_t *staticErrValue;
 
+/* background resolver pool, started on first use */
+static struct {
+	pthread_mutex_t mut;
+	pthread_cond_t cond;
+	pthread_t *tids;
+	int nThreads;
+	sbool bStarted;
+	sbool bShutdown;
+	struct sockaddr_storage *queue; /* ring buffer of addresses to resolve */
+	int maxQueue;
+	int head;
+	int nQueued;
+} resolvers;
+
 
 /* Our hash function.
  * TODO: check how well it performs on socket addresses!
@@ -118,14 +139,19 @@ entryDestruct(dnscache_entry_t *etry)
 rsRetVal
 dnscacheInit(void)
 {
+	int i;
 	DEFiRet;
-	if((dnsCache.ht = create_hashtable(100, hash_from_key_fn, key_equals_fn,
-				(void(*)(void*))entryDestruct)) == NULL) {
-		DBGPRINTF("dnscache: error creating hash table!\n");
-		ABORT_FINALIZE(RS_RET_ERR); // TODO: make this degrade, but run!
+	for(i = 0 ; i < DNSCACHE_SHARDS ; ++i) {
+		if((dnsCache[i].ht = create_hashtable(100, hash_from_key_fn, key_equals_fn,
+					(void(*)(void*))entryDestruct)) == NULL) {
+			DBGPRINTF("dnscache: error creating hash table!\n");
+			ABORT_FINALIZE(RS_RET_ERR); // TODO: make this degrade, but run!
+		}
+		dnsCache[i].pRoot = NULL;
+		dnsCache[i].pLast = NULL;
+		dnsCache[i].nEntries = 0;
+		pthread_rwlock_init(&dnsCache[i].rwlock, NULL);
 	}
-	dnsCache.nEntries = 0;
-	pthread_rwlock_init(&dnsCache.rwlock, NULL);
 	CHKiRet(objGetObjInterface(&obj)); /* this provides the root pointer for all other queries */
 	CHKiRet(objUse(glbl, CORE_COMPONENT));
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
@@ -134,18 +160,28 @@ dnscacheInit(void)
 	prop.Construct(&staticErrValue);
 	prop.SetString(staticErrValue, (uchar*)"???", 3);
 	prop.ConstructFinalize(staticErrValue);
+	pthread_mutex_init(&resolvers.mut, NULL);
+	pthread_cond_init(&resolvers.cond, NULL);
 finalize_it:
 	RETiRet;
 }
 
+static void stopResolvers(void);
+
 /* deinit function (must be called once) */
 rsRetVal
 dnscacheDeinit(void)
 {
+	int i;
 	DEFiRet;
+	stopResolvers();
+	pthread_mutex_destroy(&resolvers.mut);
+	pthread_cond_destroy(&resolvers.cond);
 	prop.Destruct(&staticErrValue);
-	hashtable_destroy(dnsCache.ht, 1); /* 1 => free all values automatically */
-	pthread_rwlock_destroy(&dnsCache.rwlock);
+	for(i = 0 ; i < DNSCACHE_SHARDS ; ++i) {
+		hashtable_destroy(dnsCache[i].ht, 1); /* 1 => free all values automatically */
+		pthread_rwlock_destroy(&dnsCache[i].rwlock);
+	}
 	objRelease(glbl, CORE_COMPONENT);
 	objRelease(errmsg, CORE_COMPONENT);
 	objRelease(prop, CORE_COMPONENT);
@@ -153,10 +189,21 @@ dnscacheDeinit(void)
 }
 
 
+/* select the shard responsible for an address. The hash table itself uses
+ * the low-order bits of the hash, so we use higher ones to keep both
+ * distributions independent.
+ */
+static inline dnscache_t*
+getShard(struct sockaddr_storage *addr)
+{
+	return &dnsCache[(hash_from_key_fn(addr) >> 16) & (DNSCACHE_SHARDS - 1)];
+}
+
+
 static inline dnscache_entry_t*
-findEntry(struct sockaddr_storage *addr)
+findEntry(dnscache_t *shard, struct sockaddr_storage *addr)
 {
-	return((dnscache_entry_t*) hashtable_search(dnsCache.ht, addr));
+	return((dnscache_entry_t*) hashtable_search(shard->ht, addr));
 }
 
 
@@ -214,7 +261,7 @@ setLocalHostName(dnscache_entry_t *etry)
 		count=0;
 		while(glbl.GetStripDomains()[count]) {
 			if(strcmp((char*)(p + 1), glbl.GetStripDomains()[count]) == 0) {
-				prop.CreateStringProp(&etry->localName, hostbuf, i);
+				prop.CreateInternedStringProp(&etry->localName, hostbuf, i);
 				goto done;
 			}
 			count++;
@@ -231,7 +278,7 @@ setLocalHostName(dnscache_entry_t *etry)
 		count=0;
 		while(glbl.GetLocalHosts()[count]) {
 			if(!strcmp((char*)fqdnLower, (char*)glbl.GetLocalHosts()[count])) {
-				prop.CreateStringProp(&etry->localName, hostbuf, i);
+				prop.CreateInternedStringProp(&etry->localName, hostbuf, i);
 				goto done;
 			}
 			count++;
@@ -328,10 +375,10 @@ resolveAddr(struct sockaddr_storage *addr, dnscache_entry_t *etry)
 				error = 1; /* that will trigger using IP address below. */
 			} else {/* we have a valid entry, so let's create the respective properties */
 				fqdnLen = strlen(fqdnBuf);
-				prop.CreateStringProp(&etry->fqdn, (uchar*)fqdnBuf, fqdnLen);
+				prop.CreateInternedStringProp(&etry->fqdn, (uchar*)fqdnBuf, fqdnLen);
 				for(i = 0 ; i < fqdnLen ; ++i)
 					fqdnBuf[i] = tolower(fqdnBuf[i]);
-				prop.CreateStringProp(&etry->fqdnLowerCase, (uchar*)fqdnBuf, fqdnLen);
+				prop.CreateInternedStringProp(&etry->fqdnLowerCase, (uchar*)fqdnBuf, fqdnLen);
 			}
 		}
 		pthread_sigmask(SIG_SETMASK, &omask, NULL);
@@ -345,10 +392,11 @@ finalize_it:
 	}
 
 	/* we need to create the inputName property (only once during our lifetime) */
-	prop.CreateStringProp(&etry->ip, (uchar*)szIP, strlen(szIP));
+	prop.CreateInternedStringProp(&etry->ip, (uchar*)szIP, strlen(szIP));
 
         if(error || glbl.GetDisableDNS()) {
                 dbgprintf("Host name for your address (%s) unknown\n", szIP);
+		etry->bNegative = !glbl.GetDisableDNS();
 		prop.AddRef(etry->ip);
 		etry->fqdn = etry->ip;
 		prop.AddRef(etry->ip);
@@ -361,49 +409,199 @@ finalize_it:
 }
 
 
-static inline rsRetVal
-addEntry(struct sockaddr_storage *addr, dnscache_entry_t **pEtry)
+/* check if an entry has expired and needs to be re-queried. If some
+ * other thread is already doing this, the current (stale) data is used
+ * in the mean time.
+ * Must be called with the shard lock held (read or write).
+ */
+static inline int
+needsRefresh(dnscache_entry_t *etry)
+{
+	return etry->tExpire != 0 && !etry->bRefreshing && time(NULL) >= etry->tExpire;
+}
+
+
+/* compute the expiry time of a freshly resolved entry */
+static inline void
+setExpiry(dnscache_entry_t *etry)
+{
+	int iExpire;
+
+	iExpire = glbl.GetDnscacheExpire();
+	if(etry->bNegative && glbl.GetDnscacheNegExpire() != 0)
+		iExpire = glbl.GetDnscacheNegExpire();
+	etry->tExpire = (iExpire == 0) ? 0 : time(NULL) + iExpire;
+}
+
+
+/* return the entry's properties to the caller. The props are refcounted,
+ * so they stay valid even if the entry is evicted or refreshed later on.
+ * Must be called with the shard lock held (read or write).
+ */
+static inline void
+getProps(dnscache_entry_t *etry, prop_t **fqdn, prop_t **fqdnLowerCase,
+	 prop_t **localName, prop_t **ip)
+{
+	prop.AddRef(etry->ip);
+	*ip = etry->ip;
+	if(fqdn != NULL) {
+		prop.AddRef(etry->fqdn);
+		*fqdn = etry->fqdn;
+	}
+	if(fqdnLowerCase != NULL) {
+		prop.AddRef(etry->fqdnLowerCase);
+		*fqdnLowerCase = etry->fqdnLowerCase;
+	}
+	if(localName != NULL) {
+		prop.AddRef(etry->localName);
+		*localName = etry->localName;
+	}
+}
+
+
+/* evict entries until the shard is within its share of dnscache.maxentries.
+ * We use a simple second-chance (CLOCK) scheme: entries that were looked up
+ * since the last scan are moved to the end of the list instead of being
+ * removed. That gives LRU-like behaviour without needing to update a list
+ * (and thus hold a write lock) on each lookup.
+ * Must be called with the shard's write lock held.
+ */
+static void
+evictEntries(dnscache_t *shard)
+{
+	unsigned maxEntries;
+	dnscache_entry_t *etry;
+
+	if(glbl.GetDnscacheMaxEntries() == 0)
+		return;
+	maxEntries = (glbl.GetDnscacheMaxEntries() + DNSCACHE_SHARDS - 1) / DNSCACHE_SHARDS;
+	while(shard->nEntries > maxEntries) {
+		etry = shard->pRoot;
+		shard->pRoot = etry->next;
+		etry->next = NULL;
+		if(shard->pRoot == NULL)
+			shard->pLast = NULL;
+		if(etry->bUsed || etry->bRefreshing) {
+			etry->bUsed = 0;
+			if(shard->pLast == NULL)
+				shard->pRoot = etry;
+			else
+				shard->pLast->next = etry;
+			shard->pLast = etry;
+			continue;
+		}
+		hashtable_remove(shard->ht, &etry->addr); /* frees the key */
+		entryDestruct(etry);
+		--shard->nEntries;
+	}
+}
+
+
+/* add a new entry or refresh an expired one. The (potentially slow) name
+ * resolution is done without holding any lock, so that one slow DNS server
+ * does not stall lookups of other addresses. If two threads miss on the
+ * same address at the same time, both resolve it and the last one wins.
+ */
+static rsRetVal
+addEntry(dnscache_t *shard, struct sockaddr_storage *addr, prop_t **fqdn,
+	 prop_t **fqdnLowerCase, prop_t **localName, prop_t **ip)
 {
-	int r;
 	struct sockaddr_storage *keybuf;
-	dnscache_entry_t *etry = NULL;
+	dnscache_entry_t *etry;
+	dnscache_entry_t *newEtry = NULL;
+	prop_t *tmp;
+	int bLocked = 0;
 	DEFiRet;
 
-	CHKmalloc(etry = MALLOC(sizeof(dnscache_entry_t)));
-	CHKiRet(resolveAddr(addr, etry));
-	memcpy(&etry->addr, addr, SALEN((struct sockaddr*) addr));
-	etry->nUsed = 0;
-	*pEtry = etry;
+	/* first check if someone else did the work while we did not hold the lock */
+	pthread_rwlock_wrlock(&shard->rwlock);
+	bLocked = 1;
+	etry = findEntry(shard, addr);
+	if(etry != NULL) {
+		if(!needsRefresh(etry)) {
+			etry->bUsed = 1;
+			getProps(etry, fqdn, fqdnLowerCase, localName, ip);
+			FINALIZE;
+		}
+		etry->bRefreshing = 1;
+	}
+	pthread_rwlock_unlock(&shard->rwlock);
+	bLocked = 0;
 
-	CHKmalloc(keybuf = malloc(sizeof(struct sockaddr_storage)));
-	memcpy(keybuf, addr, sizeof(struct sockaddr_storage));
+	CHKmalloc(newEtry = calloc(1, sizeof(dnscache_entry_t)));
+	iRet = resolveAddr(addr, newEtry);
 
-	pthread_rwlock_unlock(&dnsCache.rwlock); /* release read lock */
-	pthread_rwlock_wrlock(&dnsCache.rwlock); /* and re-aquire for writing */
-	r = hashtable_insert(dnsCache.ht, keybuf, *pEtry);
-	if(r == 0) {
-		DBGPRINTF("dnscache: inserting element failed\n");
+	pthread_rwlock_wrlock(&shard->rwlock);
+	bLocked = 1;
+	etry = findEntry(shard, addr);
+	if(iRet != RS_RET_OK) {
+		if(etry != NULL)
+			etry->bRefreshing = 0; /* try again on next lookup */
+		FINALIZE;
 	}
-	pthread_rwlock_unlock(&dnsCache.rwlock);
-	pthread_rwlock_rdlock(&dnsCache.rwlock); /* we need this again */
+	setExpiry(newEtry);
 
-finalize_it:
-	if(iRet != RS_RET_OK && etry != NULL) {
-		/* Note: sub-fields cannot be populated in this case */
-		free(etry);
+	if(etry == NULL) {
+		CHKmalloc(keybuf = malloc(sizeof(struct sockaddr_storage)));
+		memcpy(keybuf, addr, sizeof(struct sockaddr_storage));
+		memcpy(&newEtry->addr, addr, SALEN((struct sockaddr*) addr));
+		if(hashtable_insert(shard->ht, keybuf, newEtry) == 0) {
+			DBGPRINTF("dnscache: inserting element failed\n");
+			free(keybuf);
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
+		if(shard->pLast == NULL)
+			shard->pRoot = newEtry;
+		else
+			shard->pLast->next = newEtry;
+		shard->pLast = newEtry;
+		++shard->nEntries;
+		etry = newEtry;
+		newEtry = NULL;
+		getProps(etry, fqdn, fqdnLowerCase, localName, ip);
+		evictEntries(shard); /* never evicts etry, it is at the list end */
+	} else {
+		/* swap in the new data; the old props go away with newEtry */
+		tmp = etry->fqdn; etry->fqdn = newEtry->fqdn; newEtry->fqdn = tmp;
+		tmp = etry->fqdnLowerCase; etry->fqdnLowerCase = newEtry->fqdnLowerCase; newEtry->fqdnLowerCase = tmp;
+		tmp = etry->localName; etry->localName = newEtry->localName; newEtry->localName = tmp;
+		tmp = etry->ip; etry->ip = newEtry->ip; newEtry->ip = tmp;
+		etry->tExpire = newEtry->tExpire;
+		etry->bNegative = newEtry->bNegative;
+		etry->bRefreshing = 0;
+		etry->bUsed = 1;
+		getProps(etry, fqdn, fqdnLowerCase, localName, ip);
 	}
+
+finalize_it:
+	if(bLocked)
+		pthread_rwlock_unlock(&shard->rwlock);
+	if(newEtry != NULL)
+		entryDestruct(newEtry);
 	RETiRet;
 }
 
 
-/* validate if an entry is still valid and, if not, re-query it.
- * In the initial implementation, this is a dummy!
- * TODO: implement!
+/* return the same prop for all requested names (used for error and
+ * IP-only replies)
  */
-static inline rsRetVal
-validateEntry(dnscache_entry_t __attribute__((unused)) *etry, struct sockaddr_storage __attribute__((unused)) *addr)
+static void
+setSameProp(prop_t *val, prop_t **fqdn, prop_t **fqdnLowerCase, prop_t **localName, prop_t **ip)
 {
-	return RS_RET_OK;
+	prop.AddRef(val);
+	*ip = val;
+	if(fqdn != NULL) {
+		prop.AddRef(val);
+		*fqdn = val;
+	}
+	if(fqdnLowerCase != NULL) {
+		prop.AddRef(val);
+		*fqdnLowerCase = val;
+	}
+	if(localName != NULL) {
+		prop.AddRef(val);
+		*localName = val;
+	}
 }
 
 
@@ -411,55 +609,216 @@ validateEntry(dnscache_entry_t __attribute__((unused)) *etry, struct sockaddr_st
  * and IP address. If the entry is not yet inside the cache, it is added.
  * If the entry can not be resolved, an error is reported back. If fqdn
  * or fqdnLowerCase are NULL, they are not set.
+ * The common case (a valid cache hit) only takes the read lock of the
+ * address' shard.
  */
 rsRetVal
 dnscacheLookup(struct sockaddr_storage *addr, prop_t **fqdn, prop_t **fqdnLowerCase,
 	       prop_t **localName, prop_t **ip)
 {
+	dnscache_t *shard;
 	dnscache_entry_t *etry;
 	DEFiRet;
 
-	pthread_rwlock_rdlock(&dnsCache.rwlock); /* TODO: optimize this! */
-	etry = findEntry(addr);
+	shard = getShard(addr);
+	pthread_rwlock_rdlock(&shard->rwlock);
+	etry = findEntry(shard, addr);
 	dbgprintf("dnscache: entry %p found\n", etry);
-	if(etry == NULL) {
-		CHKiRet(addEntry(addr, &etry));
-	} else {
-		CHKiRet(validateEntry(etry, addr));
-	}
-	prop.AddRef(etry->ip);
-	*ip = etry->ip;
-	if(fqdn != NULL) {
-		prop.AddRef(etry->fqdn);
-		*fqdn = etry->fqdn;
-	}
-	if(fqdnLowerCase != NULL) {
-		prop.AddRef(etry->fqdnLowerCase);
-		*fqdnLowerCase = etry->fqdnLowerCase;
-	}
-	if(localName != NULL) {
-		prop.AddRef(etry->localName);
-		*localName = etry->localName;
+	if(etry != NULL && !needsRefresh(etry)) {
+		etry->bUsed = 1; /* racy, but it is only a hint for eviction */
+		getProps(etry, fqdn, fqdnLowerCase, localName, ip);
+		pthread_rwlock_unlock(&shard->rwlock);
+		FINALIZE;
 	}
+	pthread_rwlock_unlock(&shard->rwlock);
+	CHKiRet(addEntry(shard, addr, fqdn, fqdnLowerCase, localName, ip));
 
 finalize_it:
-	pthread_rwlock_unlock(&dnsCache.rwlock);
 	if(iRet != RS_RET_OK && iRet != RS_RET_ADDRESS_UNKNOWN) {
 		DBGPRINTF("dnscacheLookup failed with iRet %d\n", iRet);
-		prop.AddRef(staticErrValue);
-		*ip = staticErrValue;
-		if(fqdn != NULL) {
-			prop.AddRef(staticErrValue);
-			*fqdn = staticErrValue;
-		}
-		if(fqdnLowerCase != NULL) {
-			prop.AddRef(staticErrValue);
-			*fqdnLowerCase = staticErrValue;
-		}
-		if(localName != NULL) {
-			prop.AddRef(staticErrValue);
-			*localName = staticErrValue;
+		setSameProp(staticErrValue, fqdn, fqdnLowerCase, localName, ip);
+	}
+	RETiRet;
+}
+
+
+/* ---------- background resolution ---------- */
+
+/* worker for the resolver pool: resolve queued addresses into the cache */
+static void *
+resolverWrkr(void __attribute__((unused)) *arg)
+{
+	struct sockaddr_storage addr;
+	prop_t *ip;
+	sigset_t sigSet;
+
+	sigfillset(&sigSet);
+	pthread_sigmask(SIG_BLOCK, &sigSet, NULL);
+
+	pthread_mutex_lock(&resolvers.mut);
+	while(1) {
+		while(resolvers.nQueued == 0 && !resolvers.bShutdown)
+			pthread_cond_wait(&resolvers.cond, &resolvers.mut);
+		if(resolvers.bShutdown)
+			break;
+		memcpy(&addr, &resolvers.queue[resolvers.head], sizeof(addr));
+		resolvers.head = (resolvers.head + 1) % resolvers.maxQueue;
+		--resolvers.nQueued;
+		pthread_mutex_unlock(&resolvers.mut);
+		/* duplicates in the queue are cheap: the second one is a cache hit */
+		if(dnscacheLookup(&addr, NULL, NULL, NULL, &ip) == RS_RET_OK)
+			prop.Destruct(&ip);
+		pthread_mutex_lock(&resolvers.mut);
+	}
+	pthread_mutex_unlock(&resolvers.mut);
+	return NULL;
+}
+
+
+/* start the resolver pool. This is done on first use, because the cache
+ * is initialized before the config (and thus the number of threads) is known.
+ * Must be called with resolvers.mut locked.
+ */
+static rsRetVal
+startResolvers(void)
+{
+	int i;
+	int r;
+	DEFiRet;
+
+	resolvers.bStarted = 1; /* also on failure, we do not retry */
+	resolvers.maxQueue = glbl.GetDnscacheResolverQueueSize();
+	CHKmalloc(resolvers.queue = malloc(sizeof(struct sockaddr_storage) * resolvers.maxQueue));
+	CHKmalloc(resolvers.tids = calloc(glbl.GetDnscacheResolverThreads(), sizeof(pthread_t)));
+	for(i = 0 ; i < glbl.GetDnscacheResolverThreads() ; ++i) {
+		if((r = pthread_create(&resolvers.tids[i], NULL, resolverWrkr, NULL)) != 0) {
+			errmsg.LogError(r, RS_RET_ERR, "dnscache: could not create resolver thread, "
+				"running with %d threads", resolvers.nThreads);
+			break;
 		}
+		++resolvers.nThreads;
 	}
+	DBGPRINTF("dnscache: started %d resolver threads\n", resolvers.nThreads);
+
+finalize_it:
+	RETiRet;
+}
+
+
+static void
+stopResolvers(void)
+{
+	int i;
+
+	pthread_mutex_lock(&resolvers.mut);
+	resolvers.bShutdown = 1;
+	pthread_cond_broadcast(&resolvers.cond);
+	pthread_mutex_unlock(&resolvers.mut);
+	for(i = 0 ; i < resolvers.nThreads ; ++i)
+		pthread_join(resolvers.tids[i], NULL);
+	free(resolvers.tids);
+	free(resolvers.queue);
+	resolvers.tids = NULL;
+	resolvers.queue = NULL;
+	resolvers.nThreads = 0;
+}
+
+
+/* queue an address for background resolution. If the queue is full, the
+ * request is dropped; the address will be queued again on its next lookup.
+ * Returns 1 if the address was queued or is being resolved, 0 otherwise
+ * (no resolver threads).
+ */
+static int
+queueAddr(struct sockaddr_storage *addr)
+{
+	int bQueued = 0;
+
+	pthread_mutex_lock(&resolvers.mut);
+	if(!resolvers.bStarted && !resolvers.bShutdown)
+		startResolvers();
+	if(resolvers.nThreads == 0)
+		goto done;
+	bQueued = 1;
+	if(resolvers.nQueued < resolvers.maxQueue) {
+		memcpy(&resolvers.queue[(resolvers.head + resolvers.nQueued) % resolvers.maxQueue],
+		       addr, sizeof(struct sockaddr_storage));
+		++resolvers.nQueued;
+		pthread_cond_signal(&resolvers.cond);
+	} else {
+		DBGPRINTF("dnscache: resolver queue full, not queueing address\n");
+	}
+done:
+	pthread_mutex_unlock(&resolvers.mut);
+	return bQueued;
+}
+
+
+/* check if addr is in the cache and valid. If so, the props are returned.
+ * If the entry has expired, the stale data is returned but a refresh is
+ * queued. Returns 1 if props are returned, 0 otherwise.
+ */
+static int
+lookupCached(struct sockaddr_storage *addr, prop_t **fqdn, prop_t **fqdnLowerCase,
+	     prop_t **localName, prop_t **ip)
+{
+	dnscache_t *shard;
+	dnscache_entry_t *etry;
+	int bExpired = 0;
+
+	shard = getShard(addr);
+	pthread_rwlock_rdlock(&shard->rwlock);
+	etry = findEntry(shard, addr);
+	if(etry != NULL) {
+		etry->bUsed = 1;
+		bExpired = needsRefresh(etry);
+		getProps(etry, fqdn, fqdnLowerCase, localName, ip);
+	}
+	pthread_rwlock_unlock(&shard->rwlock);
+	if(bExpired)
+		queueAddr(addr);
+	return etry != NULL;
+}
+
+
+/* Same as dnscacheLookup(), but never waits for a DNS server. If the
+ * address is not yet in the cache, it is queued for background resolution
+ * and the textual IP address is returned for all names in the mean time
+ * (so the caller can go on with processing the message). Later lookups
+ * of that address return the real names. If no background resolver threads
+ * are configured, this is the same as dnscacheLookup() - which is also
+ * used if DNS resolution is disabled, as that does never block.
+ */
+rsRetVal
+dnscacheLookupNoWait(struct sockaddr_storage *addr, prop_t **fqdn, prop_t **fqdnLowerCase,
+		     prop_t **localName, prop_t **ip)
+{
+	char szIP[80]; /* large enough for IPv6 */
+	prop_t *ipOnly = NULL;
+	DEFiRet;
+
+	if(glbl.GetDnscacheResolverThreads() == 0 || glbl.GetDisableDNS()) {
+		iRet = dnscacheLookup(addr, fqdn, fqdnLowerCase, localName, ip);
+		FINALIZE;
+	}
+	if(lookupCached(addr, fqdn, fqdnLowerCase, localName, ip))
+		FINALIZE;
+	if(!queueAddr(addr)) { /* resolver threads could not be started */
+		iRet = dnscacheLookup(addr, fqdn, fqdnLowerCase, localName, ip);
+		FINALIZE;
+	}
+
+	if(mygetnameinfo((struct sockaddr *)addr, SALEN((struct sockaddr *)addr),
+			 szIP, sizeof(szIP), NULL, 0, NI_NUMERICHOST) != 0) {
+		DBGPRINTF("dnscache: malformed from address\n");
+		setSameProp(staticErrValue, fqdn, fqdnLowerCase, localName, ip);
+		ABORT_FINALIZE(RS_RET_INVALID_SOURCE);
+	}
+	CHKiRet(prop.CreateInternedStringProp(&ipOnly, (uchar*)szIP, strlen(szIP)));
+	DBGPRINTF("dnscache: %s not yet resolved, using IP address\n", szIP);
+	setSameProp(ipOnly, fqdn, fqdnLowerCase, localName, ip);
+	prop.Destruct(&ipOnly);
+
+finalize_it:
 	RETiRet;
 }
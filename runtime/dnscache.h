@@ -25,5 +25,6 @@
 rsRetVal dnscacheInit(void);
 rsRetVal dnscacheDeinit(void);
 rsRetVal dnscacheLookup(struct sockaddr_storage *addr, prop_t **fqdn, prop_t **fqdnLowerCase, prop_t **localName, prop_t **ip);
+rsRetVal dnscacheLookupNoWait(struct sockaddr_storage *addr, prop_t **fqdn, prop_t **fqdnLowerCase, prop_t **localName, prop_t **ip);
 
 #endif /* #ifndef INCLUDED_DNSCACHE_H */
@@ -0,0 +1,265 @@
+/* escape.c - scan kernels for escaping
+ *
+ * The string escaping functions (JSON encoding of properties, the SQL and
+ * JSON template options) spend most of their time looking for characters
+ * that need escaping, which are rare in usual log data. The kernels in
+ * this file do that scan 16 (SSE2, NEON) or 32 (AVX2) bytes at a time.
+ * The vector unit is selected at compile time, so AVX2 is only used if
+ * rsyslog is built for a CPU that has it (e.g. CFLAGS=-march=native).
+ * SSE2 is always available on x86-64. Other platforms use the plain C
+ * versions.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stddef.h>
+#if defined(__AVX2__)
+#	include <immintrin.h>
+#	define ESC_SCAN_AVX2
+#elif defined(__SSE2__)
+#	include <emmintrin.h>
+#	define ESC_SCAN_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#	include <arm_neon.h>
+#	define ESC_SCAN_NEON
+#endif
+#include "escape.h"
+
+#if defined(ESC_SCAN_AVX2)
+const char *const escScanImpl = "avx2";
+#elif defined(ESC_SCAN_SSE2)
+const char *const escScanImpl = "sse2";
+#elif defined(ESC_SCAN_NEON)
+const char *const escScanImpl = "neon";
+#else
+const char *const escScanImpl = "scalar";
+#endif
+
+
+static const char hexdigit[16] =
+	{'0', '1', '2', '3', '4', '5', '6', '7', '8',
+	 '9', 'A', 'B', 'C', 'D', 'E', 'F' };
+
+/* RFC4627-defined special sequences are used where they exist, other
+ * control characters are written as \u00XX.
+ */
+size_t
+escJSONChar(const unsigned char c, char *const pDst)
+{
+	pDst[0] = '\\';
+	switch(c) {
+	case '\"':
+		pDst[1] = '"';
+		return 2;
+	case '\\':
+		pDst[1] = '\\';
+		return 2;
+	case '\010':
+		pDst[1] = 'b';
+		return 2;
+	case '\014':
+		pDst[1] = 'f';
+		return 2;
+	case '\n':
+		pDst[1] = 'n';
+		return 2;
+	case '\r':
+		pDst[1] = 'r';
+		return 2;
+	case '\t':
+		pDst[1] = 't';
+		return 2;
+	default:
+		pDst[1] = 'u';
+		pDst[2] = '0';
+		pDst[3] = '0';
+		pDst[4] = hexdigit[c / 16];
+		pDst[5] = hexdigit[c % 16];
+		return 6;
+	}
+}
+
+
+size_t
+escScanJSONScalar(const unsigned char *p, size_t len)
+{
+	size_t i;
+
+	for(i = 0 ; i < len ; ++i) {
+		if(p[i] < 0x20 || p[i] == '"' || p[i] == '\\')
+			break;
+	}
+	return i;
+}
+
+
+size_t
+escScanCharsScalar(const unsigned char *p, size_t len, unsigned char c1, unsigned char c2)
+{
+	size_t i;
+
+	for(i = 0 ; i < len ; ++i) {
+		if(p[i] == c1 || p[i] == c2)
+			break;
+	}
+	return i;
+}
+
+
+#if defined(ESC_SCAN_AVX2)
+
+size_t
+escScanJSON(const unsigned char *p, size_t len)
+{
+	const __m256i ctl = _mm256_set1_epi8(0x1f);
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i bslash = _mm256_set1_epi8('\\');
+	__m256i v, m;
+	unsigned mask;
+	size_t i;
+
+	for(i = 0 ; i + 32 <= len ; i += 32) {
+		v = _mm256_loadu_si256((const __m256i*) (p + i));
+		/* max(v, 0x1f) == 0x1f is an unsigned v < 0x20 */
+		m = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(v, ctl), ctl),
+				    _mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+						    _mm256_cmpeq_epi8(v, bslash)));
+		mask = (unsigned) _mm256_movemask_epi8(m);
+		if(mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+	return i + escScanJSONScalar(p + i, len - i);
+}
+
+size_t
+escScanChars(const unsigned char *p, size_t len, unsigned char c1, unsigned char c2)
+{
+	const __m256i v1 = _mm256_set1_epi8((char) c1);
+	const __m256i v2 = _mm256_set1_epi8((char) c2);
+	__m256i v;
+	unsigned mask;
+	size_t i;
+
+	for(i = 0 ; i + 32 <= len ; i += 32) {
+		v = _mm256_loadu_si256((const __m256i*) (p + i));
+		mask = (unsigned) _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, v1),
+								       _mm256_cmpeq_epi8(v, v2)));
+		if(mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+	return i + escScanCharsScalar(p + i, len - i, c1, c2);
+}
+
+#elif defined(ESC_SCAN_SSE2)
+
+size_t
+escScanJSON(const unsigned char *p, size_t len)
+{
+	const __m128i ctl = _mm_set1_epi8(0x1f);
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i bslash = _mm_set1_epi8('\\');
+	__m128i v, m;
+	unsigned mask;
+	size_t i;
+
+	for(i = 0 ; i + 16 <= len ; i += 16) {
+		v = _mm_loadu_si128((const __m128i*) (p + i));
+		/* max(v, 0x1f) == 0x1f is an unsigned v < 0x20 */
+		m = _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, ctl), ctl),
+				 _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash)));
+		mask = (unsigned) _mm_movemask_epi8(m);
+		if(mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+	return i + escScanJSONScalar(p + i, len - i);
+}
+
+size_t
+escScanChars(const unsigned char *p, size_t len, unsigned char c1, unsigned char c2)
+{
+	const __m128i v1 = _mm_set1_epi8((char) c1);
+	const __m128i v2 = _mm_set1_epi8((char) c2);
+	__m128i v;
+	unsigned mask;
+	size_t i;
+
+	for(i = 0 ; i + 16 <= len ; i += 16) {
+		v = _mm_loadu_si128((const __m128i*) (p + i));
+		mask = (unsigned) _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, v1),
+								 _mm_cmpeq_epi8(v, v2)));
+		if(mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+	return i + escScanCharsScalar(p + i, len - i, c1, c2);
+}
+
+#elif defined(ESC_SCAN_NEON)
+
+/* NEON has no movemask, so we only detect a hit in a block and let the
+ * scalar code find its exact position.
+ */
+size_t
+escScanJSON(const unsigned char *p, size_t len)
+{
+	const uint8x16_t ctl = vdupq_n_u8(0x20);
+	const uint8x16_t quote = vdupq_n_u8('"');
+	const uint8x16_t bslash = vdupq_n_u8('\\');
+	uint8x16_t v, m;
+	size_t i;
+
+	for(i = 0 ; i + 16 <= len ; i += 16) {
+		v = vld1q_u8(p + i);
+		m = vorrq_u8(vcltq_u8(v, ctl), vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, bslash)));
+		if(vmaxvq_u8(m) != 0)
+			return i + escScanJSONScalar(p + i, 16);
+	}
+	return i + escScanJSONScalar(p + i, len - i);
+}
+
+size_t
+escScanChars(const unsigned char *p, size_t len, unsigned char c1, unsigned char c2)
+{
+	const uint8x16_t v1 = vdupq_n_u8(c1);
+	const uint8x16_t v2 = vdupq_n_u8(c2);
+	uint8x16_t v;
+	size_t i;
+
+	for(i = 0 ; i + 16 <= len ; i += 16) {
+		v = vld1q_u8(p + i);
+		if(vmaxvq_u8(vorrq_u8(vceqq_u8(v, v1), vceqq_u8(v, v2))) != 0)
+			return i + escScanCharsScalar(p + i, 16, c1, c2);
+	}
+	return i + escScanCharsScalar(p + i, len - i, c1, c2);
+}
+
+#else /* no vector unit */
+
+size_t
+escScanJSON(const unsigned char *p, size_t len)
+{
+	return escScanJSONScalar(p, len);
+}
+
+size_t
+escScanChars(const unsigned char *p, size_t len, unsigned char c1, unsigned char c2)
+{
+	return escScanCharsScalar(p, len, c1, c2);
+}
+
+#endif
@@ -0,0 +1,57 @@
+/* Definitions for the escape scan kernels.
+ *
+ * These functions find the first character in a buffer that needs
+ * escaping, so that callers can copy unmodified runs in one go and do
+ * not need to copy the string at all if nothing needs to be escaped.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_ESCAPE_H
+#define INCLUDED_ESCAPE_H
+
+#include <stddef.h>
+
+/* name of the scan kernel in use, for debug output and the testbench */
+extern const char *const escScanImpl;
+
+/* return the offset of the first character in p[0..len-1] that needs to be
+ * escaped in a JSON string (control characters, '"' and '\'), or len if
+ * there is none.
+ */
+size_t escScanJSON(const unsigned char *p, size_t len);
+/* return the offset of the first occurrence of c1 or c2 in p[0..len-1], or
+ * len if there is none. Pass the same character twice to look for one only.
+ */
+size_t escScanChars(const unsigned char *p, size_t len, unsigned char c1, unsigned char c2);
+
+/* maximum length of a sequence written by escJSONChar() */
+#define ESC_JSON_MAXSEQ 6
+/* write the JSON escape sequence for c, which must be a character found by
+ * escScanJSON(), to pDst (room for ESC_JSON_MAXSEQ bytes required) and
+ * return its length.
+ */
+size_t escJSONChar(const unsigned char c, char *const pDst);
+
+/* plain C versions of the above, always available (used for the vector
+ * tails and by the testbench to verify the vector kernels)
+ */
+size_t escScanJSONScalar(const unsigned char *p, size_t len);
+size_t escScanCharsScalar(const unsigned char *p, size_t len, unsigned char c1, unsigned char c2);
+
+#endif /* #ifndef INCLUDED_ESCAPE_H */
@@ -45,8 +45,17 @@
 #include "atomic.h"
 #include "errmsg.h"
 #include "action.h"
+#include "msg.h"
 #include "rainerscript.h"
+#include "ruleset.h"
+#include "actpool.h"
+#include "wrkpool.h"
+#include "uring.h"
+#include "zippool.h"
+#include "queue.h"
 #include "net.h"
+#include "parser.h"
+#include "datetime.h"
 
 /* some defaults */
 #ifndef DFLT_NETSTRM_DRVR
@@ -88,6 +97,14 @@ static uchar *pszDfltNetstrmDrvr = NULL; /* module name of default netstream dri
 static uchar *pszDfltNetstrmDrvrCAF = NULL; /* default CA file for the netstrm driver */
 static uchar *pszDfltNetstrmDrvrKeyFile = NULL; /* default key file for the netstrm driver (server) */
 static uchar *pszDfltNetstrmDrvrCertFile = NULL; /* default cert file for the netstrm driver (server) */
+static int iTlsSessCacheSize = 1024;	/* TLS session cache / client resumption entries, 0 - none */
+static int iTlsTicketKeyRotation = 3600;	/* seconds until a new TLS session ticket key is used, 0 - no tickets */
+static int bTlsKtls = 0;	/* hand TLS record processing to the kernel after the handshake? */
+static int iDnscacheExpire = 0;	/* seconds until a resolved dnscache entry is re-queried, 0 - never */
+static int iDnscacheNegExpire = 0;	/* same for failed lookups, 0 - use iDnscacheExpire */
+static int iDnscacheMaxEntries = 0;	/* max number of dnscache entries, 0 - unlimited */
+static int iDnscacheResolverThreads = 0;	/* background resolver threads, 0 - resolve synchronously */
+static int iDnscacheResolverQueueSize = 1024;	/* max number of addresses waiting for background resolution */
 static int bTerminateInputs = 0;		/* global switch that inputs shall terminate ASAP (1=> terminate) */
 pid_t glbl_ourpid;
 #ifndef HAVE_ATOMIC_BUILTINS
@@ -111,7 +128,31 @@ static struct cnfparamdescr cnfparamdescr[] = {
 	{ "defaultnetstreamdriverkeyfile", eCmdHdlrString, 0 },
 	{ "defaultnetstreamdriver", eCmdHdlrString, 0 },
 	{ "maxmessagesize", eCmdHdlrSize, 0 },
-	{ "action.reportsuspension", eCmdHdlrBinary, 0 }
+	{ "action.reportsuspension", eCmdHdlrBinary, 0 },
+	{ "variables.compact", eCmdHdlrBinary, 0 },
+	{ "script.batchexec", eCmdHdlrBinary, 0 },
+	{ "input.prefilter", eCmdHdlrBinary, 0 },
+	{ "script.adaptiveorder", eCmdHdlrBinary, 0 },
+	{ "parser.trylastsuccessful", eCmdHdlrBinary, 0 },
+	{ "script.profile.file", eCmdHdlrString, 0 },
+	{ "script.profile.samplerate", eCmdHdlrPositiveInt, 0 },
+	{ "script.parallelactions", eCmdHdlrNonNegInt, 0 },
+	{ "sharedworkers.threads", eCmdHdlrNonNegInt, 0 },
+	{ "sharedworkers.timeslice", eCmdHdlrPositiveInt, 0 },
+	{ "io.uring", eCmdHdlrBinary, 0 },
+	{ "zip.threads", eCmdHdlrNonNegInt, 0 },
+	{ "queue.memorybudget", eCmdHdlrSize, 0 },
+	{ "tls.sessioncache.size", eCmdHdlrNonNegInt, 0 },
+	{ "tls.ticketkey.rotation", eCmdHdlrNonNegInt, 0 },
+	{ "tls.ktls", eCmdHdlrBinary, 0 },
+	{ "dnscache.expire", eCmdHdlrNonNegInt, 0 },
+	{ "dnscache.negativeexpire", eCmdHdlrNonNegInt, 0 },
+	{ "dnscache.maxentries", eCmdHdlrNonNegInt, 0 },
+	{ "dnscache.resolver.threads", eCmdHdlrNonNegInt, 0 },
+	{ "dnscache.resolver.queuesize", eCmdHdlrPositiveInt, 0 },
+	{ "uuid.type", eCmdHdlrGetWord, 0 },
+	{ "trace.samplerate", eCmdHdlrNonNegInt, 0 },
+	{ "timestamp.resolution", eCmdHdlrNonNegInt, 0 }
 };
 static struct cnfparamblk paramblk =
 	{ CNFPARAMBLK_VERSION,
@@ -155,6 +196,14 @@ SIMP_PROP(Option_DisallowWarning, option_DisallowWarning, int)
 SIMP_PROP(DisableDNS, bDisableDNS, int)
 SIMP_PROP(StripDomains, StripDomains, char**)
 SIMP_PROP(LocalHosts, LocalHosts, char**)
+SIMP_PROP(TlsSessCacheSize, iTlsSessCacheSize, int)
+SIMP_PROP(TlsTicketKeyRotation, iTlsTicketKeyRotation, int)
+SIMP_PROP(TlsKtls, bTlsKtls, int)
+SIMP_PROP(DnscacheExpire, iDnscacheExpire, int)
+SIMP_PROP(DnscacheNegExpire, iDnscacheNegExpire, int)
+SIMP_PROP(DnscacheMaxEntries, iDnscacheMaxEntries, int)
+SIMP_PROP(DnscacheResolverThreads, iDnscacheResolverThreads, int)
+SIMP_PROP(DnscacheResolverQueueSize, iDnscacheResolverQueueSize, int)
 #ifdef USE_UNLIMITED_SELECT
 SIMP_PROP(FdSetSize, iFdSetSize, int)
 #endif
@@ -584,6 +633,14 @@ CODESTARTobjQueryInterface(glbl)
 	SIMP_PROP(DfltNetstrmDrvrCAF)
 	SIMP_PROP(DfltNetstrmDrvrKeyFile)
 	SIMP_PROP(DfltNetstrmDrvrCertFile)
+	SIMP_PROP(TlsSessCacheSize)
+	SIMP_PROP(TlsTicketKeyRotation)
+	SIMP_PROP(TlsKtls)
+	SIMP_PROP(DnscacheExpire)
+	SIMP_PROP(DnscacheNegExpire)
+	SIMP_PROP(DnscacheMaxEntries)
+	SIMP_PROP(DnscacheResolverThreads)
+	SIMP_PROP(DnscacheResolverQueueSize)
 #ifdef USE_UNLIMITED_SELECT
 	SIMP_PROP(FdSetSize)
 #endif
@@ -710,6 +767,72 @@ glblDoneLoadCnf(void)
 			bDropMalPTRMsgs = (int) cnfparamvals[i].val.d.n;
 		} else if(!strcmp(paramblk.descr[i].name, "action.reportsuspension")) {
 			bActionReportSuspension = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "variables.compact")) {
+			bMsgCompactVars = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "script.batchexec")) {
+			bRulesetBatchExec = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "input.prefilter")) {
+			bRulesetPrefilter = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "script.adaptiveorder")) {
+			bScriptAdaptiveOrder = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "parser.trylastsuccessful")) {
+			bParserTryLastSuccessful = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "script.profile.file")) {
+			free(pszRulesetProfileFile);
+			pszRulesetProfileFile = (uchar*)
+				es_str2cstr(cnfparamvals[i].val.d.estr, NULL);
+		} else if(!strcmp(paramblk.descr[i].name, "script.profile.samplerate")) {
+			iRulesetProfileSampleRate = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "script.parallelactions")) {
+			iActpoolWorkers = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "sharedworkers.threads")) {
+			iWrkpoolThreads = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "sharedworkers.timeslice")) {
+			iWrkpoolTimeSlice = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "io.uring")) {
+			bUringEnabled = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "zip.threads")) {
+			iZipThreads = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "queue.memorybudget")) {
+			iQueueMemBudget = cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "tls.sessioncache.size")) {
+			iTlsSessCacheSize = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "tls.ticketkey.rotation")) {
+			iTlsTicketKeyRotation = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "tls.ktls")) {
+			bTlsKtls = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "dnscache.expire")) {
+			iDnscacheExpire = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "dnscache.negativeexpire")) {
+			iDnscacheNegExpire = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "dnscache.maxentries")) {
+			iDnscacheMaxEntries = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "dnscache.resolver.threads")) {
+			iDnscacheResolverThreads = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "dnscache.resolver.queuesize")) {
+			iDnscacheResolverQueueSize = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "uuid.type")) {
+			cstr = (uchar*) es_str2cstr(cnfparamvals[i].val.d.estr, NULL);
+			if(!strcmp((char*)cstr, "libuuid")) {
+				iMsgUUIDType = MSG_UUID_LIBUUID;
+			} else if(!strcmp((char*)cstr, "v4")) {
+				iMsgUUIDType = MSG_UUID_V4;
+			} else if(!strcmp((char*)cstr, "v7")) {
+				iMsgUUIDType = MSG_UUID_V7;
+			} else {
+				errmsg.LogError(0, RS_RET_INVALID_VALUE, "uuid.type '%s' is unknown, "
+					"using 'libuuid' instead", cstr);
+			}
+			free(cstr);
+		} else if(!strcmp(paramblk.descr[i].name, "trace.samplerate")) {
+			iMsgTraceSampleRate = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "timestamp.resolution")) {
+			iTimestampResolution = (int) cnfparamvals[i].val.d.n;
+			if(iTimestampResolution > 1000) {
+				errmsg.LogError(0, RS_RET_INVALID_VALUE, "timestamp.resolution %d is larger "
+					"than one second, using 1000ms instead", iTimestampResolution);
+				iTimestampResolution = 1000;
+			}
 		} else if(!strcmp(paramblk.descr[i].name, "maxmessagesize")) {
 			iMaxLine = (int) cnfparamvals[i].val.d.n;
 		} else if(!strcmp(paramblk.descr[i].name, "debug.onshutdown")) {
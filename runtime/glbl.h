@@ -84,9 +84,21 @@ BEGINinterface(glbl) /* name must also be changed in ENDinterface macro! */
 	prop_t* (*GetLocalHostIP)(void);
 	uchar* (*GetSourceIPofLocalClient)(void);		/* [ar] */
 	rsRetVal (*SetSourceIPofLocalClient)(uchar*);		/* [ar] */
+	/* v9 - 2026-10-14 */
+	SIMP_PROP(TlsSessCacheSize, int)
+	SIMP_PROP(TlsTicketKeyRotation, int)
+	/* v10 - 2026-10-14 */
+	SIMP_PROP(TlsKtls, int)
+	/* v11 - 2026-10-14 */
+	SIMP_PROP(DnscacheExpire, int)
+	SIMP_PROP(DnscacheNegExpire, int)
+	SIMP_PROP(DnscacheMaxEntries, int)
+	/* v12 - 2026-10-14 */
+	SIMP_PROP(DnscacheResolverThreads, int)
+	SIMP_PROP(DnscacheResolverQueueSize, int)
 #undef	SIMP_PROP
 ENDinterface(glbl)
-#define glblCURR_IF_VERSION 7 /* increment whenever you change the interface structure! */
+#define glblCURR_IF_VERSION 12 /* increment whenever you change the interface structure! */
 /* version 2 had PreserveFQDN added - rgerhards, 2008-12-08 */
 
 /* the remaining prototypes */
@@ -1,61 +1,53 @@
 /* Copyright (C) 2004 Christopher Clark <firstname.lastname@cl.cam.ac.uk> */
-/* taken from http://www.cl.cam.ac.uk/~cwc22/hashtable/ */
+/* taken from http://www.cl.cam.ac.uk/~cwc22/hashtable/, changed to open addressing */
 
 #include "hashtable.h"
 #include "hashtable_private.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <math.h>
 
-/*
-Credit for primes table: Aaron Krowne
- http://br.endernet.org/~akrowne/
- http://planetmath.org/encyclopedia/GoodHashTablePrimes.html
-*/
-static const unsigned int primes[] = {
-53, 97, 193, 389,
-769, 1543, 3079, 6151,
-12289, 24593, 49157, 98317,
-196613, 393241, 786433, 1572869,
-3145739, 6291469, 12582917, 25165843,
-50331653, 100663319, 201326611, 402653189,
-805306457, 1610612741
-};
-const unsigned int prime_table_length = sizeof(primes)/sizeof(primes[0]);
-
-#define MAX_LOAD_FACTOR 65 /* to get real factor, divide by 100! */
+#define MIN_TABLE_SIZE 64
+#define MAX_TABLE_SIZE (1u << 30)
+#define MAX_LOAD_FACTOR 80 /* to get real factor, divide by 100! */
 
-/* compute max load. We use a constant factor of 0.65, but do
- * everything times 100, so that we do not need floats.
+/* compute max load. We use a constant factor of 0.80, but do
+ * everything times 100, so that we do not need floats. Robin Hood
+ * hashing keeps probe sequences short even at this load.
  */
 static inline unsigned
 getLoadLimit(unsigned size)
 {
-    return (unsigned int) ((unsigned long long) size * MAX_LOAD_FACTOR) / 100;
+    return (unsigned int) (((unsigned long long) size * MAX_LOAD_FACTOR) / 100);
 }
 
 /*****************************************************************************/
-struct hashtable *
-create_hashtable(unsigned int minsize,
-                 unsigned int (*hashf) (void*),
-                 int (*eqf) (void*,void*), void (*dest)(void*))
+static struct hashtable *
+create_table(unsigned int minsize, unsigned int keysize,
+             unsigned int (*hashf) (void*),
+             int (*eqf) (void*,void*), void (*dest)(void*))
 {
     struct hashtable *h;
-    unsigned int pindex, size = primes[0];
+    unsigned int size = MIN_TABLE_SIZE;
+    unsigned int stride;
     /* Check requested hashtable isn't too large */
-    if (minsize > (1u << 30)) return NULL;
-    /* Enforce size as prime */
-    for (pindex=0; pindex < prime_table_length; pindex++) {
-        if (primes[pindex] > minsize) { size = primes[pindex]; break; }
+    if (minsize > getLoadLimit(MAX_TABLE_SIZE)) return NULL;
+    while (getLoadLimit(size) < minsize) size <<= 1;
+    stride = sizeof(struct entry);
+    if (keysize > sizeof(void *)) {
+        stride = offsetof(struct entry, k) + keysize;
+        stride = (stride + sizeof(void *) - 1) & ~(unsigned int) (sizeof(void *) - 1);
     }
     h = (struct hashtable *)malloc(sizeof(struct hashtable));
     if (NULL == h) return NULL; /*oom*/
-    h->table = (struct entry **)malloc(sizeof(struct entry*) * size);
-    if (NULL == h->table) { free(h); return NULL; } /*oom*/
-    memset(h->table, 0, size * sizeof(struct entry *));
+    h->table = calloc(size, stride);
+    h->scratch = malloc(2 * stride);
+    if (NULL == h->table || NULL == h->scratch) {
+        free(h->table); free(h->scratch); free(h); return NULL; /*oom*/
+    }
     h->tablelength  = size;
-    h->primeindex   = pindex;
+    h->stride       = stride;
+    h->keysize      = keysize;
     h->entrycount   = 0;
     h->hashfn       = hashf;
     h->eqfn         = eqf;
@@ -64,6 +56,23 @@ create_hashtable(unsigned int minsize,
     return h;
 }
 
+struct hashtable *
+create_hashtable(unsigned int minsize,
+                 unsigned int (*hashf) (void*),
+                 int (*eqf) (void*,void*), void (*dest)(void*))
+{
+    return create_table(minsize, 0, hashf, eqf, dest);
+}
+
+struct hashtable *
+create_hashtable_inlinekey(unsigned int minsize, unsigned int keysize,
+                 unsigned int (*hashf) (void*),
+                 int (*eqf) (void*,void*), void (*dest)(void*))
+{
+    if (keysize == 0) return NULL;
+    return create_table(minsize, keysize, hashf, eqf, dest);
+}
+
 /*****************************************************************************/
 unsigned int
 hash(struct hashtable *h, void *k)
@@ -78,61 +87,61 @@ hash(struct hashtable *h, void *k)
     return i;
 }
 
+/*****************************************************************************/
+/* place the entry in h->scratch into the table, which must have a free
+ * slot. Entries closer to their home slot than the one being placed are
+ * displaced and placed further on in turn. The scratch slot is clobbered.
+ */
+static void
+place_entry(struct hashtable *h)
+{
+    struct entry *cur = h->scratch;
+    struct entry *tmp = (struct entry *) ((char *) h->scratch + h->stride);
+    struct entry *e;
+    unsigned int idx;
+
+    idx = indexFor(h->tablelength, cur->h);
+    cur->dist = 1;
+    for (;;) {
+        e = slotAt(h, idx);
+        if (e->dist == 0) {
+            memcpy(e, cur, h->stride);
+            return;
+        }
+        if (e->dist < cur->dist) {
+            memcpy(tmp, e, h->stride);
+            memcpy(e, cur, h->stride);
+            memcpy(cur, tmp, h->stride);
+        }
+        idx = indexFor(h->tablelength, idx + 1);
+        cur->dist++;
+    }
+}
+
 /*****************************************************************************/
 static int
 hashtable_expand(struct hashtable *h)
 {
     /* Double the size of the table to accomodate more entries */
-    struct entry **newtable;
+    char *oldtable = h->table;
+    unsigned int oldsize = h->tablelength;
+    unsigned int newsize, i;
     struct entry *e;
-    struct entry **pE;
-    unsigned int newsize, i, idx;
     /* Check we're not hitting max capacity */
-    if (h->primeindex == (prime_table_length - 1)) return 0;
-    newsize = primes[++(h->primeindex)];
+    if (oldsize >= MAX_TABLE_SIZE) return 0;
+    newsize = oldsize * 2;
 
-    newtable = (struct entry **)malloc(sizeof(struct entry*) * newsize);
-    if (NULL != newtable)
-    {
-        memset(newtable, 0, newsize * sizeof(struct entry *));
-        /* This algorithm is not 'stable'. ie. it reverses the list
-         * when it transfers entries between the tables */
-        for (i = 0; i < h->tablelength; i++) {
-            while (NULL != (e = h->table[i])) {
-                h->table[i] = e->next;
-                idx = indexFor(newsize,e->h);
-                e->next = newtable[idx];
-                newtable[idx] = e;
-            }
-        }
-        free(h->table);
-        h->table = newtable;
-    }
-    /* Plan B: realloc instead */
-    else 
-    {
-        newtable = (struct entry **)
-                   realloc(h->table, newsize * sizeof(struct entry *));
-        if (NULL == newtable) { (h->primeindex)--; return 0; }
-        h->table = newtable;
-        memset(newtable[h->tablelength], 0, newsize - h->tablelength);
-        for (i = 0; i < h->tablelength; i++) {
-            for (pE = &(newtable[i]), e = *pE; e != NULL; e = *pE) {
-                idx = indexFor(newsize,e->h);
-                if (idx == i)
-                {
-                    pE = &(e->next);
-                }
-                else
-                {
-                    *pE = e->next;
-                    e->next = newtable[idx];
-                    newtable[idx] = e;
-                }
-            }
+    h->table = calloc(newsize, h->stride);
+    if (NULL == h->table) { h->table = oldtable; return 0; }
+    h->tablelength = newsize;
+    for (i = 0; i < oldsize; i++) {
+        e = (struct entry *) (oldtable + (size_t) i * h->stride);
+        if (e->dist != 0) {
+            memcpy(h->scratch, e, h->stride);
+            place_entry(h);
         }
     }
-    h->tablelength = newsize;
+    free(oldtable);
     h->loadlimit   = getLoadLimit(newsize);
     return -1;
 }
@@ -144,48 +153,118 @@ hashtable_count(struct hashtable *h)
     return h->entrycount;
 }
 
+/*****************************************************************************/
+/* make room for one more entry, returns zero if there is none */
+static int
+hashtable_reserve(struct hashtable *h)
+{
+    if (h->entrycount + 1 > h->loadlimit)
+    {
+        /* If expand fails, we still try cramming just this value into
+         * the existing table -- we may not have memory for a larger table,
+         * but one more element may be ok. One slot must always stay free,
+         * so that probe sequences terminate. Next time we insert, we'll try
+         * expanding again.*/
+        if (!hashtable_expand(h) && h->entrycount + 1 >= h->tablelength)
+            return 0;
+    }
+    return -1;
+}
+
 /*****************************************************************************/
 int
 hashtable_insert(struct hashtable *h, void *k, void *v)
 {
     /* This method allows duplicate keys - but they shouldn't be used */
-    unsigned int idx;
-    struct entry *e;
-    if (++(h->entrycount) > h->loadlimit)
-    {
-        /* Ignore the return value. If expand fails, we should
-         * still try cramming just this value into the existing table
-         * -- we may not have memory for a larger table, but one more
-         * element may be ok. Next time we insert, we'll try expanding again.*/
-        hashtable_expand(h);
+    struct entry *cur = h->scratch;
+    if (h->keysize != 0) {
+        if (!hashtable_insert_copy(h, k, h->keysize, v)) return 0;
+        freekey(k); /* we own it, and keep our own copy */
+        return -1;
     }
-    e = (struct entry *)malloc(sizeof(struct entry));
-    if (NULL == e) { --(h->entrycount); return 0; } /*oom*/
-    e->h = hash(h,k);
-    idx = indexFor(h->tablelength,e->h);
-    e->k = k;
-    e->v = v;
-    e->next = h->table[idx];
-    h->table[idx] = e;
+    if (!hashtable_reserve(h)) return 0;
+    cur->h = hash(h,k);
+    cur->v = v;
+    cur->k = k;
+    place_entry(h);
+    h->entrycount++;
     return -1;
 }
 
 /*****************************************************************************/
-void * /* returns value associated with key */
-hashtable_search(struct hashtable *h, void *k)
+int
+hashtable_insert_copy(struct hashtable *h, const void *k, unsigned int keylen, void *v)
+{
+    struct entry *cur = h->scratch;
+    if (h->keysize == 0 || keylen != h->keysize) return 0;
+    if (!hashtable_reserve(h)) return 0;
+    memcpy(&cur->k, k, keylen);
+    /* hash the copy, the hash function takes a non-const key */
+    cur->h = hash(h, &cur->k);
+    cur->v = v;
+    place_entry(h);
+    h->entrycount++;
+    return -1;
+}
+
+/*****************************************************************************/
+/* find the slot holding key k. Returns 0 if not found, else the slot
+ * index is stored in *pIdx.
+ */
+int
+hashtable_find_slot(struct hashtable *h, void *k, unsigned int *pIdx)
 {
     struct entry *e;
-    unsigned int hashvalue, idx;
+    unsigned int hashvalue, idx, dist;
     hashvalue = hash(h,k);
     idx = indexFor(h->tablelength,hashvalue);
-    e = h->table[idx];
-    while (NULL != e)
+    for (dist = 1 ; ; ++dist)
     {
+        e = slotAt(h, idx);
+        /* an entry closer to its home slot than we would be (or an empty
+         * slot) means the key cannot be stored further on */
+        if (e->dist < dist) return 0;
         /* Check hash value to short circuit heavier comparison */
-        if ((hashvalue == e->h) && (h->eqfn(k, e->k))) return e->v;
-        e = e->next;
+        if ((hashvalue == e->h) && (h->eqfn(k, entryKey(h, e)))) {
+            *pIdx = idx;
+            return -1;
+        }
+        idx = indexFor(h->tablelength, idx + 1);
+    }
+}
+
+/*****************************************************************************/
+void * /* returns value associated with key */
+hashtable_search(struct hashtable *h, void *k)
+{
+    unsigned int idx;
+    if (!hashtable_find_slot(h, k, &idx)) return NULL;
+    return slotAt(h, idx)->v;
+}
+
+/*****************************************************************************/
+void
+hashtable_remove_at(struct hashtable *h, unsigned int idx)
+{
+    struct entry *e, *next;
+    unsigned int nextidx;
+
+    if (h->keysize == 0)
+        freekey(slotAt(h, idx)->k);
+    h->entrycount--;
+    for (;;) {
+        e = slotAt(h, idx);
+        nextidx = indexFor(h->tablelength, idx + 1);
+        next = slotAt(h, nextidx);
+        if (next->dist <= 1) {
+            /* next one is empty or in its home slot */
+            e->dist = 0;
+            return;
+        }
+        memcpy(e, next, h->stride);
+        e->dist--;
+        idx = nextidx;
     }
-    return NULL;
 }
 
 /*****************************************************************************/
@@ -194,32 +273,13 @@ hashtable_remove(struct hashtable *h, void *k)
 {
     /* TODO: consider compacting the table when the load factor drops enough,
      *       or provide a 'compact' method. */
-
-    struct entry *e;
-    struct entry **pE;
     void *v;
-    unsigned int hashvalue, idx;
+    unsigned int idx;
 
-    hashvalue = hash(h,k);
-    idx = indexFor(h->tablelength,hash(h,k));
-    pE = &(h->table[idx]);
-    e = *pE;
-    while (NULL != e)
-    {
-        /* Check hash value to short circuit heavier comparison */
-        if ((hashvalue == e->h) && (h->eqfn(k, e->k)))
-        {
-            *pE = e->next;
-            h->entrycount--;
-            v = e->v;
-            freekey(e->k);
-            free(e);
-            return v;
-        }
-        pE = &(e->next);
-        e = e->next;
-    }
-    return NULL;
+    if (!hashtable_find_slot(h, k, &idx)) return NULL;
+    v = slotAt(h, idx)->v;
+    hashtable_remove_at(h, idx);
+    return v;
 }
 
 /*****************************************************************************/
@@ -228,36 +288,22 @@ void
 hashtable_destroy(struct hashtable *h, int free_values)
 {
     unsigned int i;
-    struct entry *e, *f;
-    struct entry **table = h->table;
-    if (free_values)
-    {
-        for (i = 0; i < h->tablelength; i++)
-        {
-            e = table[i];
-            while (NULL != e)
-            {
-                f = e;
-		e = e->next;
-		freekey(f->k);
-		if(h->dest == NULL)
-			free(f->v);
-		else
-			h->dest(f->v);
-		free(f);
-	    }
-        }
-    }
-    else
+    struct entry *e;
+    for (i = 0; i < h->tablelength; i++)
     {
-        for (i = 0; i < h->tablelength; i++)
+        e = slotAt(h, i);
+        if (e->dist == 0) continue;
+        if (h->keysize == 0) freekey(e->k);
+        if (free_values)
         {
-            e = table[i];
-            while (NULL != e)
-            { f = e; e = e->next; freekey(f->k); free(f); }
+            if(h->dest == NULL)
+                free(e->v);
+            else
+                h->dest(e->v);
         }
     }
     free(h->table);
+    free(h->scratch);
     free(h);
 }
 
@@ -77,6 +77,31 @@ create_hashtable(unsigned int minsize,
                  unsigned int (*hashfunction) (void*),
                  int (*key_eq_fn) (void*,void*), void (*dest) (void*));
 
+/*****************************************************************************
+ * create_hashtable_inlinekey
+   
+ * @name                    create_hashtable_inlinekey
+ * @param   minsize         minimum initial size of hashtable
+ * @param   keysize         size of the keys in bytes
+ * @param   hashfunction    function for hashing keys
+ * @param   key_eq_fn       function for determining key equality
+ * @param   dest            destructor for value entries (NULL -> use free())
+ * @return                  newly created hashtable or NULL on failure
+ *
+ * Same as create_hashtable, but for small fixed-size keys (pids, integers).
+ * These are copied into the table itself, so that lookups need not follow
+ * a pointer to the key. Entries should be added with hashtable_insert_copy,
+ * so that the caller need not allocate the key. hashtable_insert works as
+ * well, it claims ownership of the key and frees it right after copying (on
+ * success only, as with create_hashtable). Pointers passed to the hash and
+ * key equality functions point into the table.
+ */
+
+struct hashtable *
+create_hashtable_inlinekey(unsigned int minsize, unsigned int keysize,
+                 unsigned int (*hashfunction) (void*),
+                 int (*key_eq_fn) (void*,void*), void (*dest) (void*));
+
 /*****************************************************************************
  * hashtable_insert
    
@@ -92,13 +117,30 @@ create_hashtable(unsigned int minsize,
  * This function does not check for repeated insertions with a duplicate key.
  * The value returned when using a duplicate key is undefined -- when
  * the hashtable changes size, the order of retrieval of duplicate key
- * entries is reversed.
+ * entries may change.
  * If in doubt, remove before insert.
  */
 
 int 
 hashtable_insert(struct hashtable *h, void *k, void *v);
 
+/*****************************************************************************
+ * hashtable_insert_copy
+   
+ * @name        hashtable_insert_copy
+ * @param   h   the hashtable to insert into, must have inline keys
+ * @param   k   the key - copied into the table, does not claim ownership
+ * @param   keylen  size of the key, must be the table's key size
+ * @param   v   the value - does not claim ownership
+ * @return      non-zero for successful insertion
+ *
+ * Same as hashtable_insert, but for tables from create_hashtable_inlinekey.
+ * The key may live on the caller's stack. Fails if keylen does not match.
+ */
+
+int 
+hashtable_insert_copy(struct hashtable *h, const void *k, unsigned int keylen, void *v);
+
 #define DEFINE_HASHTABLE_INSERT(fnname, keytype, valuetype) \
 int fnname (struct hashtable *h, keytype *k, valuetype *v) \
 { \
@@ -5,48 +5,61 @@
 #include "hashtable_itr.h"
 #include <stdlib.h> /* defines NULL */
 
+/*****************************************************************************/
+/* move to the next occupied slot, returns zero at the end of the table */
+
+static int
+next_entry(struct hashtable_itr *itr)
+{
+    struct entry *e;
+    while (itr->remaining > 0)
+    {
+        itr->index = indexFor(itr->h->tablelength, itr->index + 1);
+        itr->remaining--;
+        e = slotAt(itr->h, itr->index);
+        if (e->dist != 0)
+        {
+            itr->e = e;
+            return -1;
+        }
+    }
+    itr->e = NULL;
+    return 0;
+}
+
 /*****************************************************************************/
 /* hashtable_iterator    - iterator constructor */
 
+/* Iteration starts right after an empty slot (there always is one) and
+ * wraps around. As removal only moves entries back within a run of
+ * occupied slots, hashtable_iterator_remove() then neither skips entries
+ * nor returns them twice.
+ */
 struct hashtable_itr *
 hashtable_iterator(struct hashtable *h)
 {
-    unsigned int i, tablelength;
+    unsigned int i;
     struct hashtable_itr *itr = (struct hashtable_itr *)
         malloc(sizeof(struct hashtable_itr));
     if (NULL == itr) return NULL;
     itr->h = h;
     itr->e = NULL;
-    itr->parent = NULL;
-    tablelength = h->tablelength;
-    itr->index = tablelength;
+    itr->index = 0;
+    itr->remaining = 0;
     if (0 == h->entrycount) return itr;
 
-    for (i = 0; i < tablelength; i++)
-    {
-        if (NULL != h->table[i])
-        {
-            itr->e = h->table[i];
-            itr->index = i;
-            break;
-        }
-    }
+    for (i = 0; slotAt(h, i)->dist != 0; i++)
+        ; /* just search */
+    itr->index = i;
+    itr->remaining = h->tablelength;
+    next_entry(itr);
     return itr;
 }
 
 /*****************************************************************************/
 /* key      - return the key of the (key,value) pair at the current position */
 /* value    - return the value of the (key,value) pair at the current position */
-
-#if 0 /* these are now inline functions! */
-void *
-hashtable_iterator_key(struct hashtable_itr *i)
-{ return i->e->k; }
-
-void *
-hashtable_iterator_value(struct hashtable_itr *i)
-{ return i->e->v; }
-#endif
+/* these are inline functions, see hashtable_itr.h */
 
 /*****************************************************************************/
 /* advance - advance the iterator to the next element
@@ -55,38 +68,8 @@ hashtable_iterator_value(struct hashtable_itr *i)
 int
 hashtable_iterator_advance(struct hashtable_itr *itr)
 {
-    unsigned int j,tablelength;
-    struct entry **table;
-    struct entry *next;
     if (NULL == itr->e) return 0; /* stupidity check */
-
-    next = itr->e->next;
-    if (NULL != next)
-    {
-        itr->parent = itr->e;
-        itr->e = next;
-        return -1;
-    }
-    tablelength = itr->h->tablelength;
-    itr->parent = NULL;
-    if (tablelength <= (j = ++(itr->index)))
-    {
-        itr->e = NULL;
-        return 0;
-    }
-    table = itr->h->table;
-    while (NULL == (next = table[j]))
-    {
-        if (++j >= tablelength)
-        {
-            itr->index = tablelength;
-            itr->e = NULL;
-            return 0;
-        }
-    }
-    itr->index = j;
-    itr->e = next;
-    return -1;
+    return next_entry(itr);
 }
 
 /*****************************************************************************/
@@ -100,29 +83,14 @@ hashtable_iterator_advance(struct hashtable_itr *itr)
 int
 hashtable_iterator_remove(struct hashtable_itr *itr)
 {
-    struct entry *remember_e, *remember_parent;
-    int ret;
-
-    /* Do the removal */
-    if (NULL == (itr->parent))
+    hashtable_remove_at(itr->h, itr->index);
+    /* the next entry may have been moved into the current slot */
+    if (slotAt(itr->h, itr->index)->dist != 0 && itr->remaining > 0)
     {
-        /* element is head of a chain */
-        itr->h->table[itr->index] = itr->e->next;
-    } else {
-        /* element is mid-chain */
-        itr->parent->next = itr->e->next;
+        itr->e = slotAt(itr->h, itr->index);
+        return -1;
     }
-    /* itr->e is now outside the hashtable */
-    remember_e = itr->e;
-    itr->h->entrycount--;
-    freekey(remember_e->k);
-
-    /* Advance the iterator, correcting the parent */
-    remember_parent = itr->parent;
-    ret = hashtable_iterator_advance(itr);
-    if (itr->parent == remember_e) { itr->parent = remember_parent; }
-    free(remember_e);
-    return ret;
+    return next_entry(itr);
 }
 
 /*****************************************************************************/
@@ -130,32 +98,16 @@ int /* returns zero if not found */
 hashtable_iterator_search(struct hashtable_itr *itr,
                           struct hashtable *h, void *k)
 {
-    struct entry *e, *parent;
-    unsigned int hashvalue, index;
+    unsigned int idx;
 
-    hashvalue = hash(h,k);
-    index = indexFor(h->tablelength,hashvalue);
-
-    e = h->table[index];
-    parent = NULL;
-    while (NULL != e)
-    {
-        /* Check hash value to short circuit heavier comparison */
-        if ((hashvalue == e->h) && (h->eqfn(k, e->k)))
-        {
-            itr->index = index;
-            itr->e = e;
-            itr->parent = parent;
-            itr->h = h;
-            return -1;
-        }
-        parent = e;
-        e = e->next;
-    }
-    return 0;
+    if (!hashtable_find_slot(h, k, &idx)) return 0;
+    itr->h = h;
+    itr->index = idx;
+    itr->e = slotAt(h, idx);
+    itr->remaining = h->tablelength - 1 - idx;
+    return -1;
 }
 
-
 /*
  * Copyright (c) 2002, 2004, Christopher Clark
  * All rights reserved.
@@ -12,8 +12,8 @@ struct hashtable_itr
 {
     struct hashtable *h;
     struct entry *e;
-    struct entry *parent;
     unsigned int index;
+    unsigned int remaining; /* number of slots not yet looked at */
 };
 
 
@@ -31,7 +31,7 @@ hashtable_iterator(struct hashtable *h);
 static inline void *
 hashtable_iterator_key(struct hashtable_itr *i)
 {
-    return i->e->k;
+    return entryKey(i->h, i->e);
 }
 
 /*****************************************************************************/
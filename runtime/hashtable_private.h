@@ -3,22 +3,35 @@
 #ifndef __HASHTABLE_PRIVATE_CWC22_H__
 #define __HASHTABLE_PRIVATE_CWC22_H__
 
+#include <stddef.h>
 #include "hashtable.h"
 
 /*****************************************************************************/
+/* The table is an open-addressing table with linear probing and Robin Hood
+ * insertion: an entry being inserted takes over the slot of any entry that
+ * is closer to its home slot, which keeps probe sequences short and lets
+ * lookups stop early. Removal shifts the following entries back instead of
+ * leaving tombstones. Slots are stored inline in one array; each caches the
+ * full hash, so the key is only compared on likely matches.
+ * For tables with inline keys, the key bytes start at member k, so slots
+ * are "stride" bytes large.
+ */
 struct entry
 {
-    void *k, *v;
+    void *v;
     unsigned int h;
-    struct entry *next;
+    unsigned int dist;  /* probe distance + 1, 0 if the slot is empty */
+    void *k;            /* must be the last member, see above */
 };
 
 struct hashtable {
-    unsigned int tablelength;
-    struct entry **table;
+    unsigned int tablelength;   /* always a power of 2 */
+    char *table;
+    unsigned int stride;        /* size of one slot */
+    unsigned int keysize;       /* size of inline keys, 0 if keys are pointers */
     unsigned int entrycount;
     unsigned int loadlimit;
-    unsigned int primeindex;
+    struct entry *scratch;      /* two slots for moving entries around */
     unsigned int (*hashfn) (void *k);
     int (*eqfn) (void *k1, void *k2);
     void (*dest) (void *v); /* destructor for values, if NULL use free() */
@@ -30,25 +43,37 @@ hash(struct hashtable *h, void *k);
 
 /*****************************************************************************/
 /* indexFor */
-static inline unsigned int
-indexFor(unsigned int tablelength, unsigned int hashvalue) {
-    return (hashvalue % tablelength);
-};
-
 /* Only works if tablelength == 2^N */
-/*static inline unsigned int
+static inline unsigned int
 indexFor(unsigned int tablelength, unsigned int hashvalue)
 {
     return (hashvalue & (tablelength - 1u));
 }
-*/
+
+static inline struct entry *
+slotAt(struct hashtable *h, unsigned int idx)
+{
+    return (struct entry *) (h->table + (size_t) idx * h->stride);
+}
+
+static inline void *
+entryKey(struct hashtable *h, struct entry *e)
+{
+    return (h->keysize == 0) ? e->k : (void *) &e->k;
+}
 
 /*****************************************************************************/
 #define freekey(X) free(X)
 /*define freekey(X) ; */
 
-
 /*****************************************************************************/
+/* find the slot holding key k, returns zero if not found */
+int
+hashtable_find_slot(struct hashtable *h, void *k, unsigned int *pIdx);
+
+/* remove the entry in slot idx and shift back the ones following it */
+void
+hashtable_remove_at(struct hashtable *h, unsigned int idx);
 
 #endif /* __HASHTABLE_PRIVATE_CWC22_H__*/
 
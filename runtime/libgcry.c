@@ -20,6 +20,15 @@
  * There are some size constraints: the recordtype must be 31 bytes at
  * most and the actual value (between : and LF) must be 1023 bytes at most.
  *
+ * In the authenticated (AEAD) modes GCM and POLY1305, every buffer handed
+ * to rsgcryEncrypt() is a block of its own, encrypted with a fresh nonce
+ * and without padding. For each such block, three records are written:
+ * IV:<hex>   the nonce of the block
+ * TAG:<hex>  the authentication tag of the block
+ * END:<int>  as above
+ * Nonces are a random value per file, incremented for each block, so
+ * that they are never reused with the same key.
+ *
  * This file is part of rsyslog.
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
@@ -47,6 +56,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <string.h>
 
 #include "rsyslog.h"
 #include "srUtils.h"
@@ -82,6 +92,22 @@ finalize_it:
 	RETiRet;
 }
 
+/* writes the lowercase hex representation of buf to hex, which
+ * must be 2*len bytes long.
+ */
+static void
+toHex(uchar *buf, size_t len, char *hex)
+{
+	static const char hexchars[16] =
+	   {'0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','f'};
+	size_t i;
+
+	for(i = 0 ; i < len ; ++i) {
+		*hex++ = hexchars[buf[i]>>4];
+		*hex++ = hexchars[buf[i]&0x0f];
+	}
+}
+
 static rsRetVal
 eiOpenRead(gcryfile gf)
 {
@@ -195,8 +221,11 @@ finalize_it:
 	RETiRet;
 }
 
+/* read a record of type expRectype with a hex value of exactly lenval
+ * bytes, which are stored in val.
+ */
 static rsRetVal
-eiGetIV(gcryfile gf, uchar *iv, size_t leniv)
+eiGetHex(gcryfile gf, char *expRectype, uchar *val, size_t lenval)
 {
 	char rectype[EIF_MAX_RECTYPE_LEN+1];
 	char value[EIF_MAX_VALUE_LEN+1];
@@ -206,15 +235,15 @@ eiGetIV(gcryfile gf, uchar *iv, size_t leniv)
 	DEFiRet;
 
 	CHKiRet(eiGetRecord(gf, rectype, value));
-	if(strcmp(rectype, "IV")) {
-		DBGPRINTF("no IV record found when expected, record type "
-			"seen is '%s'\n", rectype);
+	if(strcmp(rectype, expRectype)) {
+		DBGPRINTF("no %s record found when expected, record type "
+			"seen is '%s'\n", expRectype, rectype);
 		ABORT_FINALIZE(RS_RET_ERR);
 	}
 	valueLen = strlen(value);
-	if(valueLen/2 != leniv) {
-		DBGPRINTF("length of IV is %d, expected %d\n",
-			valueLen/2, leniv);
+	if(valueLen/2 != lenval) {
+		DBGPRINTF("length of %s is %d, expected %d\n",
+			expRectype, valueLen/2, lenval);
 		ABORT_FINALIZE(RS_RET_ERR);
 	}
 
@@ -224,13 +253,13 @@ eiGetIV(gcryfile gf, uchar *iv, size_t leniv)
 		else if(value[i] >= 'a' && value[i] <= 'f')
 			nibble = value[i] - 'a' + 10;
 		else {
-			DBGPRINTF("invalid IV '%s'\n", value);
+			DBGPRINTF("invalid %s '%s'\n", expRectype, value);
 			ABORT_FINALIZE(RS_RET_ERR);
 		}
 		if(i % 2 == 0)
-			iv[j] = nibble << 4;
+			val[j] = nibble << 4;
 		else
-			iv[j++] |= nibble;
+			val[j++] |= nibble;
 	}
 finalize_it:
 	RETiRet;
@@ -288,24 +317,48 @@ finalize_it:
 static rsRetVal
 eiWriteIV(gcryfile gf, uchar *iv)
 {
-	static const char hexchars[16] =
-	   {'0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','f'};
-	unsigned iSrc, iDst;
 	char hex[4096];
 	DEFiRet;
 
-	if(gf->blkLength > sizeof(hex)/2) {
+	if(gf->ivLength > sizeof(hex)/2) {
 		DBGPRINTF("eiWriteIV: crypto block len way too large, aborting "
 			  "write");
 		ABORT_FINALIZE(RS_RET_ERR);
 	}
 
-	for(iSrc = iDst = 0 ; iSrc < gf->blkLength ; ++iSrc) {
-		hex[iDst++] = hexchars[iv[iSrc]>>4];
-		hex[iDst++] = hexchars[iv[iSrc]&0x0f];
-	}
+	toHex(iv, gf->ivLength, hex);
+	iRet = eiWriteRec(gf, "IV:", 3, hex, gf->ivLength*2);
+finalize_it:
+	RETiRet;
+}
 
-	iRet = eiWriteRec(gf, "IV:", 3, hex, gf->blkLength*2);
+/* write the records for an AEAD block ending at file offset offsEnd. They
+ * are written with a single call, so that a concurrent reader (disk queue)
+ * never sees the IV of a block without its END.
+ */
+static rsRetVal
+eiWriteAEADBlk(gcryfile gf, uchar *tag, off64_t offsEnd)
+{
+	char rec[3+RSGCRY_AEAD_NONCE_LEN*2+1 + 4+RSGCRY_AEAD_TAG_LEN*2+1 + 4+21+1];
+	size_t len;
+	ssize_t nwritten;
+	DEFiRet;
+
+	memcpy(rec, "IV:", 3);
+	len = 3;
+	toHex(gf->nonce, RSGCRY_AEAD_NONCE_LEN, rec+len);
+	len += RSGCRY_AEAD_NONCE_LEN*2;
+	memcpy(rec+len, "\nTAG:", 5);
+	len += 5;
+	toHex(tag, RSGCRY_AEAD_TAG_LEN, rec+len);
+	len += RSGCRY_AEAD_TAG_LEN*2;
+	len += snprintf(rec+len, sizeof(rec)-len, "\nEND:%lld\n", (long long) offsEnd);
+	nwritten = write(gf->fd, rec, len);
+	if(nwritten != (ssize_t) len) {
+		DBGPRINTF("eiWriteAEADBlk: error writing file, towrite %d, "
+			"nwritten %d\n", (int) len, (int) nwritten);
+		ABORT_FINALIZE(RS_RET_EI_WR_ERR);
+	}
 finalize_it:
 	RETiRet;
 }
@@ -320,7 +373,8 @@ eiClose(gcryfile gf, off64_t offsLogfile)
 	size_t len;
 	if(gf->fd == -1)
 		return;
-	if(gf->openMode == 'w') {
+	if(gf->openMode == 'w' && !gf->bAEAD) {
+		/* AEAD blocks already have their END record */
 		/* 2^64 is 20 digits, so the snprintf buffer is large enough */
 		len = snprintf(offs, sizeof(offs), "%lld", offsLogfile);
 		eiWriteRec(gf, "END:", 4, offs, len);
@@ -379,6 +433,7 @@ gcryfileConstruct(gcryctx ctx, gcryfile *pgf, uchar *logfn)
 	CHKmalloc(gf = calloc(1, sizeof(struct gcryfile_s)));
 	gf->ctx = ctx;
 	gf->fd = -1;
+	gf->logFd = -1;
 	snprintf(fn, sizeof(fn), "%s%s", logfn, ENCINFO_SUFFIX);
 	fn[MAXFNAME] = '\0'; /* be on save side */
 	gf->eiName = (uchar*) strdup(fn);
@@ -411,6 +466,9 @@ gcryfileDestruct(gcryfile gf, off64_t offsLogfile)
 		DBGPRINTF("unlink file '%s' due to bDeleteOnClose set\n", gf->eiName);
 		unlink((char*)gf->eiName);
 	}
+	if(gf->logFd != -1)
+		close(gf->logFd);
+	free(gf->aeadBuf);
 	free(gf->eiName);
 	free(gf);
 done:	return r;
@@ -494,6 +552,28 @@ finalize_it:
 	RETiRet;
 }
 
+/* check if mode and algo can be used together. Only needed for the
+ * authenticated modes, which otherwise only fail once a file is opened.
+ */
+rsRetVal
+rsgcryCheckAlgoMode(gcryctx ctx)
+{
+	DEFiRet;
+#	ifdef RSGCRY_HAVE_GCM
+	if(ctx->mode == GCRY_CIPHER_MODE_GCM && gcry_cipher_get_algo_blklen(ctx->algo) != 16) {
+		ABORT_FINALIZE(RS_RET_CRY_INVLD_MODE);
+	}
+#	endif
+#	ifdef RSGCRY_HAVE_POLY1305
+	if((ctx->mode == GCRY_CIPHER_MODE_POLY1305) != (ctx->algo == GCRY_CIPHER_CHACHA20)
+	   && ctx->mode != GCRY_CIPHER_MODE_STREAM) {
+		ABORT_FINALIZE(RS_RET_CRY_INVLD_MODE);
+	}
+#	endif
+finalize_it:
+	RETiRet;
+}
+
 rsRetVal
 rsgcrySetAlgo(gcryctx ctx, uchar *algoname)
 {
@@ -520,7 +600,7 @@ seedIV(gcryfile gf, uchar **iv)
 {
 	int fd;
 
-	*iv = malloc(gf->blkLength); /* do NOT zero-out! */
+	*iv = malloc(gf->ivLength); /* do NOT zero-out! */
 	/* if we cannot obtain data from /dev/urandom, we use whatever
 	 * is present at the current memory location as random data. Of
 	 * course, this is very weak and we should consider a different
@@ -529,7 +609,7 @@ seedIV(gcryfile gf, uchar **iv)
 	 * will always work...).  -- TODO -- rgerhards, 2013-03-06
 	 */
 	if((fd = open("/dev/urandom", O_RDONLY)) > 0) {
-		if(read(fd, *iv, gf->blkLength)) {}; /* keep compiler happy */
+		if(read(fd, *iv, gf->ivLength)) {}; /* keep compiler happy */
 		close(fd);
 	}
 }
@@ -552,8 +632,8 @@ readIV(gcryfile gf, uchar **iv)
 		}
 		CHKiRet(eiCheckFiletype(gf));
 	}
-	*iv = malloc(gf->blkLength); /* do NOT zero-out! */
-	CHKiRet(eiGetIV(gf, *iv, (size_t) gf->blkLength));
+	CHKmalloc(*iv = malloc(gf->ivLength)); /* do NOT zero-out! */
+	CHKiRet(eiGetHex(gf, "IV", *iv, gf->ivLength));
 finalize_it:
 	RETiRet;
 }
@@ -574,7 +654,8 @@ readBlkEnd(gcryfile gf)
 
 	iRet = eiGetEND(gf, &blkEnd);
 	if(iRet == RS_RET_OK) {
-		gf->bytesToBlkEnd = (ssize_t) blkEnd;
+		gf->bytesToBlkEnd = (ssize_t) (blkEnd - gf->offsBlkEnd);
+		gf->offsBlkEnd = blkEnd;
 	} else if(iRet == RS_RET_NO_DATA) {
 		gf->bytesToBlkEnd = -1;
 	} else {
@@ -586,6 +667,62 @@ finalize_it:
 }
 
 
+/* AEAD read: read the whole current block from the log file, decrypt it and
+ * check its tag. Plaintext is only handed out by rsgcryDecrypt() from the
+ * verified copy kept here, so nothing is released before authentication.
+ * Blocks are at most one write buffer in size, so this is cheap.
+ */
+static rsRetVal
+rsgcryAEADVerifyBlk(gcryfile gf)
+{
+	char logfn[MAXFNAME+1];
+	size_t lenBlk;
+	off64_t offsBlk;
+	ssize_t nRead;
+	gcry_error_t gcryError;
+	DEFiRet;
+
+	if(gf->logFd == -1) {
+		/* eiName is the log file name plus ENCINFO_SUFFIX */
+		snprintf(logfn, sizeof(logfn), "%.*s",
+			(int) (strlen((char*)gf->eiName) - sizeof(ENCINFO_SUFFIX) + 1),
+			(char*) gf->eiName);
+		if((gf->logFd = open(logfn, O_RDONLY|O_NOCTTY|O_CLOEXEC)) == -1) {
+			DBGPRINTF("libgcry: cannot open '%s' to verify block: %s\n",
+				logfn, strerror(errno));
+			ABORT_FINALIZE(RS_RET_FILE_NOT_FOUND);
+		}
+	}
+
+	lenBlk = (size_t) gf->bytesToBlkEnd;
+	offsBlk = gf->offsBlkEnd - gf->bytesToBlkEnd;
+	if(lenBlk > gf->aeadBufSize) {
+		uchar *newBuf;
+		CHKmalloc(newBuf = realloc(gf->aeadBuf, lenBlk));
+		gf->aeadBuf = newBuf;
+		gf->aeadBufSize = lenBlk;
+	}
+	nRead = pread(gf->logFd, gf->aeadBuf, lenBlk, offsBlk);
+	if(nRead != (ssize_t) lenBlk) {
+		DBGPRINTF("libgcry: short read of block at offset %lld: %lld of %lld bytes\n",
+			(long long) offsBlk, (long long) nRead, (long long) lenBlk);
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+	gcryError = gcry_cipher_decrypt(gf->chd, gf->aeadBuf, lenBlk, NULL, 0);
+	if(!gcryError)
+		gcryError = gcry_cipher_checktag(gf->chd, gf->tag, RSGCRY_AEAD_TAG_LEN);
+	if(gcryError) {
+		DBGPRINTF("libgcry: block ending at offset %lld failed "
+			"authentication: %s\n", (long long) gf->offsBlkEnd,
+			gcry_strerror(gcryError));
+		ABORT_FINALIZE(RS_RET_CRY_AUTH_FAILED);
+	}
+	gf->aeadBufIdx = 0;
+finalize_it:
+	RETiRet;
+}
+
+
 /* Read the block begin metadata and set our state variables accordingly. Can also
  * be used to init the first block in write case.
  */
@@ -611,13 +748,26 @@ rsgcryBlkBegin(gcryfile gf)
 	}
 
 	if(gf->openMode == 'r') {
-		readIV(gf, &iv);
-		readBlkEnd(gf);
+		CHKiRet(readIV(gf, &iv));
+		if(gf->bAEAD) {
+			CHKiRet(eiGetHex(gf, "TAG", gf->tag, RSGCRY_AEAD_TAG_LEN));
+		}
+		CHKiRet(readBlkEnd(gf));
+		if(gf->bAEAD && gf->bytesToBlkEnd == -1) {
+			DBGPRINTF("libgcry: AEAD block without END record\n");
+			ABORT_FINALIZE(RS_RET_ERR);
+		}
 	} else {
 		seedIV(gf, &iv);
+		if(gf->bAEAD) {
+			/* the nonce is set for each block in rsgcryEncrypt() */
+			memcpy(gf->nonce, iv, RSGCRY_AEAD_NONCE_LEN);
+			CHKiRet(eiOpenAppend(gf));
+			FINALIZE;
+		}
 	}
 
-	gcryError = gcry_cipher_setiv(gf->chd, iv, gf->blkLength);
+	gcryError = gcry_cipher_setiv(gf->chd, iv, gf->ivLength);
 	if (gcryError) {
 		DBGPRINTF("gcry_cipher_setiv failed:  %s/%s\n",
 			gcry_strsource(gcryError), gcry_strerror(gcryError));
@@ -627,6 +777,8 @@ rsgcryBlkBegin(gcryfile gf)
 	if(gf->openMode == 'w') {
 		CHKiRet(eiOpenAppend(gf));
 		CHKiRet(eiWriteIV(gf, iv));
+	} else if(gf->bAEAD) {
+		CHKiRet(rsgcryAEADVerifyBlk(gf));
 	}
 finalize_it:
 	free(iv);
@@ -642,6 +794,14 @@ rsgcryInitCrypt(gcryctx ctx, gcryfile *pgf, uchar *fname, char openMode)
 	CHKiRet(gcryfileConstruct(ctx, &gf, fname));
 	gf->openMode = openMode;
 	gf->blkLength = gcry_cipher_get_algo_blklen(ctx->algo);
+	gf->bAEAD = rsgcryModeIsAEAD(ctx->mode);
+	gf->ivLength = gf->bAEAD ? RSGCRY_AEAD_NONCE_LEN : gf->blkLength;
+	if(gf->bAEAD && openMode == 'w') {
+		/* END records are file offsets, so we need to know where we append */
+		struct stat st;
+		if(stat((char*)fname, &st) == 0)
+			gf->offsBlkEnd = st.st_size;
+	}
 	CHKiRet(rsgcryBlkBegin(gf));
 	*pgf = gf;
 finalize_it:
@@ -650,6 +810,44 @@ finalize_it:
 	RETiRet;
 }
 
+/* increment the nonce, treating its last 8 bytes as big-endian counter */
+static inline void
+nextNonce(gcryfile pF)
+{
+	int i;
+	for(i = RSGCRY_AEAD_NONCE_LEN - 1 ; i >= RSGCRY_AEAD_NONCE_LEN - 8 ; --i) {
+		if(++pF->nonce[i] != 0)
+			break;
+	}
+}
+
+/* encrypt one AEAD block, which is the whole buffer. The cipher
+ * handle is kept, only the nonce changes from block to block.
+ */
+static rsRetVal
+rsgcryEncryptAEAD(gcryfile pF, uchar *buf, size_t len)
+{
+	uchar tag[RSGCRY_AEAD_TAG_LEN];
+	gcry_error_t gcryError;
+	DEFiRet;
+
+	nextNonce(pF);
+	gcryError = gcry_cipher_setiv(pF->chd, pF->nonce, RSGCRY_AEAD_NONCE_LEN);
+	if(!gcryError)
+		gcryError = gcry_cipher_encrypt(pF->chd, buf, len, NULL, 0);
+	if(!gcryError)
+		gcryError = gcry_cipher_gettag(pF->chd, tag, sizeof(tag));
+	if(gcryError) {
+		DBGPRINTF("libgcry: AEAD encryption failed:  %s/%s\n",
+			gcry_strsource(gcryError), gcry_strerror(gcryError));
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+	pF->offsBlkEnd += len;
+	CHKiRet(eiWriteAEADBlk(pF, tag, pF->offsBlkEnd));
+finalize_it:
+	RETiRet;
+}
+
 rsRetVal
 rsgcryEncrypt(gcryfile pF, uchar *buf, size_t *len)
 {
@@ -659,6 +857,10 @@ rsgcryEncrypt(gcryfile pF, uchar *buf, size_t *len)
 	if(*len == 0)
 		FINALIZE;
 
+	if(pF->bAEAD) {
+		iRet = rsgcryEncryptAEAD(pF, buf, *len);
+		FINALIZE;
+	}
 	addPadding(pF, buf, len);
 	gcryError = gcry_cipher_encrypt(pF->chd, buf, *len, NULL, 0);
 	if(gcryError) {
@@ -671,10 +873,10 @@ finalize_it:
 	RETiRet;
 }
 
-/* TODO: handle multiple blocks
- * test-read END record; if present, store offset, else unbounded (current active block)
- * when decrypting, check if bound is reached. If yes, split into two blocks, get new IV for
- * second one.
+/* Decrypt a piece of the current block. The caller never reads across a
+ * block end (see gcryfileGetBytesLeftInBlock()). In AEAD modes the block
+ * was already verified as a whole when it was begun, so the piece is taken
+ * from the verified plaintext instead of being decrypted again.
  */
 rsRetVal
 rsgcryDecrypt(gcryfile pF, uchar *buf, size_t *len)
@@ -684,6 +886,16 @@ rsgcryDecrypt(gcryfile pF, uchar *buf, size_t *len)
 	
 	if(pF->bytesToBlkEnd != -1)
 		pF->bytesToBlkEnd -= *len;
+	if(pF->bAEAD) {
+		if(pF->bytesToBlkEnd < 0) {
+			DBGPRINTF("libgcry: read beyond end of block ending at offset %lld\n",
+				(long long) pF->offsBlkEnd);
+			ABORT_FINALIZE(RS_RET_ERR);
+		}
+		memcpy(buf, pF->aeadBuf + pF->aeadBufIdx, *len);
+		pF->aeadBufIdx += *len;
+		FINALIZE;
+	}
 	gcryError = gcry_cipher_decrypt(pF->chd, buf, *len, NULL, 0);
 	if(gcryError) {
 		DBGPRINTF("gcry_cipher_decrypt failed:  %s/%s\n",
@@ -23,6 +23,16 @@
 #include <stdint.h>
 #include <gcrypt.h>
 
+/* authenticated modes (AEAD) need a recent enough libgcrypt */
+#if GCRYPT_VERSION_NUMBER >= 0x010600
+#	define RSGCRY_HAVE_GCM 1
+#endif
+#if GCRYPT_VERSION_NUMBER >= 0x010700
+#	define RSGCRY_HAVE_POLY1305 1
+#endif
+#define RSGCRY_AEAD_NONCE_LEN 12	/* for both GCM and Poly1305 */
+#define RSGCRY_AEAD_TAG_LEN 16
+
 struct gcryctx_s {
 	uchar *key;
 	size_t keyLen;
@@ -36,8 +46,17 @@ typedef struct gcryfile_s *gcryfile;
 struct gcryfile_s {
 	gcry_cipher_hd_t chd; /* cypher handle */
 	size_t blkLength; /* size of low-level crypto block */
+	size_t ivLength; /* size of IV (nonce in AEAD modes) */
+	int8_t bAEAD; /* authenticated mode: each Encrypt() call is a block of its own */
+	uchar nonce[RSGCRY_AEAD_NONCE_LEN]; /* AEAD: nonce of current block */
+	uchar tag[RSGCRY_AEAD_TAG_LEN]; /* AEAD read: tag of current block */
+	off64_t offsBlkEnd; /* log file offset where the previous block ended */
 	uchar *eiName; /* name of .encinfo file */
 	int fd; /* descriptor of .encinfo file (-1 if not open) */
+	int logFd; /* AEAD read: descriptor of the log file itself (-1 if not open) */
+	uchar *aeadBuf; /* AEAD read: verified plaintext of current block */
+	size_t aeadBufSize; /* allocated size of aeadBuf */
+	size_t aeadBufIdx; /* next byte of aeadBuf to hand out */
 	char openMode; /* 'r': read, 'w': write */
 	gcryctx ctx;
 	uchar *readBuf;
@@ -55,6 +74,7 @@ void rsgcryExit(void);
 int rsgcrySetKey(gcryctx ctx, unsigned char *key, uint16_t keyLen);
 rsRetVal rsgcrySetMode(gcryctx ctx, uchar *algoname);
 rsRetVal rsgcrySetAlgo(gcryctx ctx, uchar *modename);
+rsRetVal rsgcryCheckAlgoMode(gcryctx ctx);
 gcryctx gcryCtxNew(void);
 void rsgcryCtxDel(gcryctx ctx);
 int gcryfileDestruct(gcryfile gf, off64_t offsLogfile);
@@ -102,6 +122,9 @@ rsgcryAlgoname2Algo(char *algoname) {
 	if(!strcmp((char*)algoname, "CAMELLIA128")) return GCRY_CIPHER_CAMELLIA128;
 	if(!strcmp((char*)algoname, "CAMELLIA192")) return GCRY_CIPHER_CAMELLIA192;
 	if(!strcmp((char*)algoname, "CAMELLIA256")) return GCRY_CIPHER_CAMELLIA256;
+#	ifdef RSGCRY_HAVE_POLY1305
+	if(!strcmp((char*)algoname, "CHACHA20")) return GCRY_CIPHER_CHACHA20;
+#	endif
 	return GCRY_CIPHER_NONE;
 }
 
@@ -115,7 +138,27 @@ rsgcryModename2Mode(char *modename) {
 	if(!strcmp((char*)modename, "CTR")) return GCRY_CIPHER_MODE_CTR;
 #	ifdef GCRY_CIPHER_MODE_AESWRAP
 	if(!strcmp((char*)modename, "AESWRAP")) return GCRY_CIPHER_MODE_AESWRAP;
+#	endif
+#	ifdef RSGCRY_HAVE_GCM
+	if(!strcmp((char*)modename, "GCM")) return GCRY_CIPHER_MODE_GCM;
+#	endif
+#	ifdef RSGCRY_HAVE_POLY1305
+	if(!strcmp((char*)modename, "POLY1305")) return GCRY_CIPHER_MODE_POLY1305;
 #	endif
 	return GCRY_CIPHER_MODE_NONE;
 }
+
+/* authenticated modes do not pad and store a nonce and tag for
+ * each block in the .encinfo file.
+ */
+static inline int
+rsgcryModeIsAEAD(int mode) {
+#	ifdef RSGCRY_HAVE_GCM
+	if(mode == GCRY_CIPHER_MODE_GCM) return 1;
+#	endif
+#	ifdef RSGCRY_HAVE_POLY1305
+	if(mode == GCRY_CIPHER_MODE_POLY1305) return 1;
+#	endif
+	return 0;
+}
 #endif  /* #ifndef INCLUDED_LIBGCRY_H */
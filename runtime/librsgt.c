@@ -17,6 +17,15 @@
  * information (most importantly last block hash) and sigblkConstruct
  * reads (or initilizes if not present) it.
  *
+ * Obtaining the timestamp for a finished block requires a round trip to
+ * the timestamping service. Unless disabled (rsgtSetAsync), this is done
+ * by a background signer thread per context, so that the writer does not
+ * wait for the service. As the block signature record must follow the
+ * block's hashes in the signature file, all TLV output produced while a
+ * block waits for its signature is held back in memory and written by
+ * the signer together with the signature. The number of blocks per file
+ * that may wait is limited; if the limit is reached, the writer waits.
+ *
  * Copyright 2013 Adiscon GmbH.
  *
  * This file is part of rsyslog.
@@ -48,6 +57,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <pthread.h>
 #define MAXFNAME 1024
 
 #include <gt_http.h>
@@ -152,21 +162,22 @@ rsgtfileConstruct(gtctx ctx)
 	gf->bKeepRecordHashes = ctx->bKeepRecordHashes;
 	gf->bKeepTreeHashes = ctx->bKeepTreeHashes;
 	gf->x_prev = NULL;
+	gf->bAsync = ctx->bAsync;
+	if(gf->bAsync) {
+		pthread_mutex_init(&gf->mutSig, NULL);
+		pthread_cond_init(&gf->cndSig, NULL);
+	}
 
 done:	return gf;
 }
 
-static inline int
-tlvbufPhysWrite(gtfile gf)
+static int
+fdWrite(gtfile gf, char *pWriteBuf, ssize_t lenBuf)
 {
-	ssize_t lenBuf;
 	ssize_t iTotalWritten;
 	ssize_t iWritten;
-	char *pWriteBuf;
 	int r = 0;
 
-	lenBuf = gf->tlvIdx;
-	pWriteBuf = gf->tlvBuf;
 	iTotalWritten = 0;
 	do {
 		iWritten = write(gf->fd, pWriteBuf, lenBuf);
@@ -187,6 +198,45 @@ tlvbufPhysWrite(gtfile gf)
 	} while(lenBuf > 0);	/* Warning: do..while()! */
 
 finalize_it:
+	return r;
+}
+
+/* keep TLV data that must be written after the signature of a
+ * still pending block.
+ */
+static int
+holdOutput(sigjob_t *job, char *buf, size_t len)
+{
+	char *newbuf;
+	size_t newsize;
+
+	if(job->lenHeld + len > job->sizeHeld) {
+		newsize = (job->sizeHeld == 0) ? 16*1024 : job->sizeHeld * 2;
+		while(newsize < job->lenHeld + len)
+			newsize *= 2;
+		if((newbuf = realloc(job->held, newsize)) == NULL)
+			return RSGTE_OOM;
+		job->held = newbuf;
+		job->sizeHeld = newsize;
+	}
+	memcpy(job->held + job->lenHeld, buf, len);
+	job->lenHeld += len;
+	return 0;
+}
+
+static inline int
+tlvbufPhysWrite(gtfile gf)
+{
+	int r;
+
+	if(gf->bAsync)
+		pthread_mutex_lock(&gf->mutSig);
+	if(gf->sigTail != NULL)
+		r = holdOutput(gf->sigTail, gf->tlvBuf, gf->tlvIdx);
+	else
+		r = fdWrite(gf, gf->tlvBuf, gf->tlvIdx);
+	if(gf->bAsync)
+		pthread_mutex_unlock(&gf->mutSig);
 	gf->tlvIdx = 0;
 	return r;
 }
@@ -496,6 +546,7 @@ seedIV(gtfile gf)
 	int fd;
 
 	hashlen = hashOutputLengthOctets(gf->hashAlg);
+	free(gf->IV);
 	gf->IV = malloc(hashlen); /* do NOT zero-out! */
 	/* if we cannot obtain data from /dev/urandom, we use whatever
 	 * is present at the current memory location as random data. Of
@@ -520,6 +571,11 @@ rsgtCtxNew(void)
 	ctx->usrptr = NULL;
 	ctx->timestamper = strdup(
 			   "http://stamper.guardtime.net/gt-signingservice");
+	ctx->bAsync = 1;
+	ctx->maxPending = 8;
+	ctx->nRetries = 3;
+	pthread_mutex_init(&ctx->mutSigner, NULL);
+	pthread_cond_init(&ctx->cndSigner, NULL);
 	return ctx;
 }
 
@@ -580,6 +636,13 @@ rsgtfileDestruct(gtfile gf)
 		r = sigblkFinish(gf);
 		if(r != 0) gf->disabled = 1;
 	}
+	if(gf->bAsync) {
+		/* all our blocks must be written before the file is closed */
+		pthread_mutex_lock(&gf->mutSig);
+		while(gf->sigHead != NULL)
+			pthread_cond_wait(&gf->cndSig, &gf->mutSig);
+		pthread_mutex_unlock(&gf->mutSig);
+	}
 	if(!gf->disabled)
 		r = tlvClose(gf);
 	free(gf->sigfilename);
@@ -587,14 +650,30 @@ rsgtfileDestruct(gtfile gf)
 	free(gf->IV);
 	free(gf->blkStrtHash);
 	rsgtimprintDel(gf->x_prev);
+	if(gf->bAsync) {
+		pthread_mutex_destroy(&gf->mutSig);
+		pthread_cond_destroy(&gf->cndSig);
+	}
 	free(gf);
 done:	return r;
 }
 
+/* the caller must have destructed all files of this context, so
+ * the signer has nothing left to do.
+ */
 void
 rsgtCtxDel(gtctx ctx)
 {
 	if(ctx != NULL) {
+		if(ctx->bSignerRunning) {
+			pthread_mutex_lock(&ctx->mutSigner);
+			ctx->bStopSigner = 1;
+			pthread_cond_signal(&ctx->cndSigner);
+			pthread_mutex_unlock(&ctx->mutSigner);
+			pthread_join(ctx->signer, NULL);
+		}
+		pthread_mutex_destroy(&ctx->mutSigner);
+		pthread_cond_destroy(&ctx->cndSigner);
 		free(ctx->timestamper);
 		free(ctx);
 	}
@@ -777,11 +856,13 @@ done:
 	return ret;
 }
 
+/* obtain the DER-encoded timestamp for hash. The result must be freed
+ * via GT_free(). Errors are reported only if bReportErr is set.
+ */
 static int
-timestampIt(gtfile gf, GTDataHash *hash)
+getTimestamp(gtfile gf, GTDataHash *hash, unsigned char **der, size_t *lenDer,
+	     int bReportErr)
 {
-	unsigned char *der = NULL;
-	size_t lenDer;
 	int r = GT_OK;
 	int ret = 0;
 	GTTimestamp *timestamp = NULL;
@@ -790,28 +871,251 @@ timestampIt(gtfile gf, GTDataHash *hash)
 	r = GTHTTP_createTimestampHash(hash, gf->ctx->timestamper, &timestamp);
 
 	if(r != GT_OK) {
-		reportGTAPIErr(gf->ctx, gf, "GTHTTP_createTimestampHash", r);
+		if(bReportErr)
+			reportGTAPIErr(gf->ctx, gf, "GTHTTP_createTimestampHash", r);
 		ret = 1;
 		goto done;
 	}
 
 	/* Encode timestamp. */
-	r = GTTimestamp_getDEREncoded(timestamp, &der, &lenDer);
+	r = GTTimestamp_getDEREncoded(timestamp, der, lenDer);
 	if(r != GT_OK) {
-		reportGTAPIErr(gf->ctx, gf, "GTTimestamp_getDEREncoded", r);
+		if(bReportErr)
+			reportGTAPIErr(gf->ctx, gf, "GTTimestamp_getDEREncoded", r);
 		ret = 1;
 		goto done;
 	}
 
+done:
+	GTTimestamp_free(timestamp);
+	return ret;
+}
+
+static int
+timestampIt(gtfile gf, GTDataHash *hash)
+{
+	unsigned char *der = NULL;
+	size_t lenDer;
+	int ret;
+
+	if((ret = getTimestamp(gf, hash, &der, &lenDer, 1)) != 0)
+		goto done;
 	tlvWriteBlockSig(gf, der, lenDer);
 
 done:
 	GT_free(der);
-	GTTimestamp_free(timestamp);
 	return ret;
 }
 
 
+/* ---------- background signer ---------- */
+
+static void
+sigjobDestruct(sigjob_t *job)
+{
+	if(job->root != NULL)
+		GTDataHash_free(job->root);
+	GT_free(job->der);
+	free(job->IV);
+	free(job->blkStrtHash);
+	free(job->held);
+	free(job);
+}
+
+/* write the block-sig record of job. As tlvWriteBlockSig() takes the
+ * block parameters from a gtfile, we use a scratch one that writes
+ * directly to the signature file. Must be called with mutSig locked.
+ */
+static int
+sigjobWriteBlockSig(sigjob_t *job)
+{
+	struct gtfile_s sgf;
+	int r;
+
+	memset(&sgf, 0, sizeof(sgf));
+	sgf.hashAlg = job->gf->hashAlg;
+	sgf.sigfilename = job->gf->sigfilename;
+	sgf.fd = job->gf->fd;
+	sgf.ctx = job->gf->ctx;
+	sgf.IV = job->IV;
+	sgf.blkStrtHash = job->blkStrtHash;
+	sgf.lenBlkStrtHash = job->lenBlkStrtHash;
+	sgf.nRecords = job->nRecords;
+	r = tlvWriteBlockSig(&sgf, job->der, job->lenDer);
+	if(r == 0)
+		r = tlvFlush(&sgf);
+	return r;
+}
+
+/* obtain the timestamp, retrying with increasing delay if the
+ * service does not respond.
+ */
+static void
+sigjobSign(sigjob_t *job)
+{
+	gtfile gf = job->gf;
+	unsigned i;
+	unsigned delay = 1;
+	uint8_t bDisabled;
+
+	for(i = 0 ; ; ++i) {
+		pthread_mutex_lock(&gf->mutSig);
+		bDisabled = gf->disabled;
+		pthread_mutex_unlock(&gf->mutSig);
+		if(bDisabled) {
+			job->state = SIGJOB_FAILED;
+			break;
+		}
+		if(getTimestamp(gf, job->root, &job->der, &job->lenDer,
+				i == gf->ctx->nRetries) == 0) {
+			job->state = SIGJOB_DONE;
+			break;
+		}
+		if(i == gf->ctx->nRetries) {
+			job->state = SIGJOB_FAILED;
+			break;
+		}
+		sleep(delay);
+		if(delay < 32)
+			delay *= 2;
+	}
+	GTDataHash_free(job->root);
+	job->root = NULL;
+}
+
+/* write all finished blocks at the head of the file's list, in order.
+ * If a block could not be signed, signatures for this file are disabled,
+ * just like in the synchronous case.
+ */
+static void
+sigjobDrain(gtfile gf)
+{
+	sigjob_t *job;
+	int r;
+
+	pthread_mutex_lock(&gf->mutSig);
+	while((job = gf->sigHead) != NULL && job->state != SIGJOB_PENDING) {
+		if(!gf->disabled) {
+			if(job->state == SIGJOB_FAILED) {
+				gf->disabled = 1;
+			} else {
+				r = sigjobWriteBlockSig(job);
+				if(r == 0 && job->lenHeld > 0)
+					r = fdWrite(gf, job->held, job->lenHeld);
+				if(r != 0)
+					gf->disabled = 1;
+			}
+		}
+		gf->sigHead = job->next;
+		if(gf->sigHead == NULL)
+			gf->sigTail = NULL;
+		--gf->nPending;
+		sigjobDestruct(job);
+	}
+	pthread_cond_broadcast(&gf->cndSig);
+	pthread_mutex_unlock(&gf->mutSig);
+}
+
+static void *
+signerThread(void *arg)
+{
+	gtctx ctx = (gtctx) arg;
+	sigjob_t *job;
+
+	pthread_mutex_lock(&ctx->mutSigner);
+	while(1) {
+		while(ctx->jobRoot == NULL && !ctx->bStopSigner)
+			pthread_cond_wait(&ctx->cndSigner, &ctx->mutSigner);
+		if(ctx->jobRoot == NULL)
+			break; /* stop requested and nothing left to do */
+		job = ctx->jobRoot;
+		ctx->jobRoot = job->nextQueued;
+		if(ctx->jobRoot == NULL)
+			ctx->jobLast = NULL;
+		pthread_mutex_unlock(&ctx->mutSigner);
+		sigjobSign(job);
+		sigjobDrain(job->gf); /* job may be gone after this */
+		pthread_mutex_lock(&ctx->mutSigner);
+	}
+	pthread_mutex_unlock(&ctx->mutSigner);
+	return NULL;
+}
+
+/* hand a finished block over to the signer. Takes ownership of root. */
+static int
+sigjobSubmit(gtfile gf, GTDataHash *root)
+{
+	gtctx ctx = gf->ctx;
+	sigjob_t *job;
+	int r = 0;
+
+	if((job = calloc(1, sizeof(sigjob_t))) == NULL) {
+		GTDataHash_free(root);
+		r = RSGTE_OOM;
+		goto done;
+	}
+	job->gf = gf;
+	job->root = root;
+	job->IV = gf->IV; /* sigblkInit() creates a new one for the next block */
+	gf->IV = NULL;
+	job->nRecords = gf->nRecords;
+	job->lenBlkStrtHash = gf->lenBlkStrtHash;
+	if((job->blkStrtHash = malloc(gf->lenBlkStrtHash)) == NULL) {
+		r = RSGTE_OOM;
+		goto done;
+	}
+	memcpy(job->blkStrtHash, gf->blkStrtHash, gf->lenBlkStrtHash);
+	job->state = SIGJOB_PENDING;
+
+	/* this block's hashes must go before its signature */
+	if((r = tlvFlush(gf)) != 0)
+		goto done;
+
+	pthread_mutex_lock(&ctx->mutSigner);
+	if(!ctx->bSignerRunning) {
+		if(pthread_create(&ctx->signer, NULL, signerThread, ctx) != 0) {
+			pthread_mutex_unlock(&ctx->mutSigner);
+			reportErr(ctx, "cannot start signer thread");
+			r = 1;
+			goto done;
+		}
+		ctx->bSignerRunning = 1;
+	}
+	pthread_mutex_unlock(&ctx->mutSigner);
+
+	pthread_mutex_lock(&gf->mutSig);
+	while(gf->nPending >= ctx->maxPending && !gf->disabled)
+		pthread_cond_wait(&gf->cndSig, &gf->mutSig);
+	if(gf->disabled) {
+		pthread_mutex_unlock(&gf->mutSig);
+		r = 1;
+		goto done;
+	}
+	if(gf->sigTail == NULL)
+		gf->sigHead = job;
+	else
+		gf->sigTail->next = job;
+	gf->sigTail = job;
+	++gf->nPending;
+	pthread_mutex_unlock(&gf->mutSig);
+
+	pthread_mutex_lock(&ctx->mutSigner);
+	if(ctx->jobLast == NULL)
+		ctx->jobRoot = job;
+	else
+		ctx->jobLast->nextQueued = job;
+	ctx->jobLast = job;
+	pthread_cond_signal(&ctx->cndSigner);
+	pthread_mutex_unlock(&ctx->mutSigner);
+	job = NULL;
+
+done:
+	if(job != NULL)
+		sigjobDestruct(job);
+	return r;
+}
+
+
 int
 sigblkFinish(gtfile gf)
 {
@@ -836,9 +1140,13 @@ sigblkFinish(gtfile gf)
 			if(ret != 0) goto done; /* checks hash_node() result! */
 		}
 	}
-	if((ret = timestampIt(gf, root)) != 0) goto done;
+	if(gf->bAsync) {
+		if((ret = sigjobSubmit(gf, root)) != 0) goto done;
+	} else {
+		if((ret = timestampIt(gf, root)) != 0) goto done;
+		GTDataHash_free(root);
+	}
 
-	GTDataHash_free(root);
 	free(gf->blkStrtHash);
 	gf->lenBlkStrtHash = gf->x_prev->len;
 	gf->blkStrtHash = malloc(gf->lenBlkStrtHash);
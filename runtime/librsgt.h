@@ -20,6 +20,7 @@
  */
 #ifndef INCLUDED_LIBRSGT_H
 #define INCLUDED_LIBRSGT_H
+#include <pthread.h>
 #include <gt_base.h>
 
 /* Max number of roots inside the forest. This permits blocks of up to
@@ -30,6 +31,8 @@
 #define MAX_ROOTS 64
 #define LOGSIGHDR "LOGSIG10"
 
+typedef struct sigjob_s sigjob_t;
+
 /* context for gt calls. This primarily serves as a container for the
  * config settings. The actual file-specific data is kept in gtfile.
  */
@@ -41,6 +44,16 @@ struct gtctx_s {
 	char *timestamper;
 	void (*errFunc)(void *, unsigned char*);
 	void *usrptr; /* for error function */
+	/* background signer; shared by all files of this context */
+	uint8_t bAsync;		/* sign blocks in the background? */
+	unsigned maxPending;	/* max blocks per file waiting for their signature */
+	unsigned nRetries;	/* timestamp requests retried this often before giving up */
+	uint8_t bSignerRunning;
+	uint8_t bStopSigner;
+	pthread_t signer;
+	pthread_mutex_t mutSigner;
+	pthread_cond_t cndSigner;
+	sigjob_t *jobRoot, *jobLast; /* queue of blocks to be signed */
 };
 typedef struct gtctx_s *gtctx;
 typedef struct gtfile_s *gtfile;
@@ -79,6 +92,34 @@ struct gtfile_s {
 	char	tlvBuf[4096];
 	int	tlvIdx; /* current index into tlvBuf */
 	gtctx ctx;
+	/* async signing: while a block waits for its signature, everything
+	 * written to the TLV file after it is held back in the job. mutSig
+	 * protects the list and the TLV file descriptor.
+	 */
+	uint8_t bAsync;
+	unsigned nPending;
+	sigjob_t *sigHead, *sigTail; /* blocks not yet written, in file order */
+	pthread_mutex_t mutSig;
+	pthread_cond_t cndSig;
+};
+
+/* a block waiting for (or having received) its signature */
+struct sigjob_s {
+	gtfile gf;
+	GTDataHash *root;	/* hash to be timestamped */
+	/* block parameters, as needed for the block-sig record */
+	uint8_t *IV;
+	unsigned char *blkStrtHash;
+	uint16_t lenBlkStrtHash;
+	uint64_t nRecords;
+	enum { SIGJOB_PENDING, SIGJOB_DONE, SIGJOB_FAILED } state;
+	unsigned char *der;	/* the timestamp, once obtained */
+	size_t lenDer;
+	char *held;		/* TLV data following this block */
+	size_t lenHeld;
+	size_t sizeHeld;
+	sigjob_t *next;		/* next job of the same file */
+	sigjob_t *nextQueued;	/* next job in signer queue */
 };
 
 struct tlvrecord_s {
@@ -349,6 +390,21 @@ rsgtSetKeepTreeHashes(gtctx ctx, int val)
 {
 	ctx->bKeepTreeHashes = val;
 }
+static inline void
+rsgtSetAsync(gtctx ctx, int val)
+{
+	ctx->bAsync = val;
+}
+static inline void
+rsgtSetAsyncMaxPending(gtctx ctx, unsigned val)
+{
+	ctx->maxPending = val;
+}
+static inline void
+rsgtSetAsyncRetries(gtctx ctx, unsigned val)
+{
+	ctx->nRetries = val;
+}
 
 int rsgtSetHashFunction(gtctx ctx, char *algName);
 int rsgtInit(char *usragent);
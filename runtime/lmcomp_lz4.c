@@ -0,0 +1,190 @@
+/* lmcomp_lz4.c
+ *
+ * An implementation of the compprov interface for LZ4, using the LZ4 frame
+ * format. The output file is a regular .lz4 file, readable with lz4 -d.
+ * zipLevel values below 3 select the fast LZ4 mode, higher values LZ4HC
+ * with that level. A flush writes out the current block; the frame is only
+ * ended when the file is closed (or, with veryRobustZip, after each write).
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include "rsyslog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "module-template.h"
+#include "obj.h"
+#include "compprov.h"
+#include "lmcomp_lz4.h"
+
+MODULE_TYPE_LIB
+MODULE_TYPE_NOKEEP
+
+#define LZ4_CHUNK (64 * 1024) /* max input per LZ4F_compressUpdate() call */
+#define LZ4_HDR_MAX 19	/* LZ4F_HEADER_SIZE_MAX, not defined by older versions */
+
+/* static data */
+DEFobjStaticHelpers
+
+
+/* Standard-Constructor
+ */
+BEGINobjConstruct(lmcomp_lz4)
+	memset(&pThis->prefs, 0, sizeof(pThis->prefs));
+	pThis->prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+ENDobjConstruct(lmcomp_lz4)
+
+
+/* destructor for the lmcomp_lz4 object */
+BEGINobjDestruct(lmcomp_lz4) /* be sure to specify the object type also in END and CODESTART macros! */
+CODESTARTobjDestruct(lmcomp_lz4)
+	if(pThis->cctx != NULL)
+		LZ4F_freeCompressionContext(pThis->cctx);
+	free(pThis->pOut);
+ENDobjDestruct(lmcomp_lz4)
+
+
+static rsRetVal
+SetLevel(void *pT, int iLevel)
+{
+	lmcomp_lz4_t *const pThis = (lmcomp_lz4_t*) pT;
+	pThis->prefs.compressionLevel = (iLevel < 3) ? 0 : iLevel;
+	return RS_RET_OK;
+}
+
+
+/* the LZ4 library is single-threaded */
+static rsRetVal
+SetWorkers(void __attribute__((unused)) *pT, int __attribute__((unused)) nWorkers)
+{
+	return RS_RET_OK;
+}
+
+
+/* check the result of an LZ4F call and write the output it produced */
+static inline rsRetVal
+writeResult(lmcomp_lz4_t *const pThis, const size_t r, compprovWriteFn_t fnWrite, void *pUsr)
+{
+	DEFiRet;
+
+	if(LZ4F_isError(r)) {
+		DBGPRINTF("lmcomp_lz4: compression failed: %s\n", LZ4F_getErrorName(r));
+		pThis->bInFrame = 0; /* start over with a new frame */
+		ABORT_FINALIZE(RS_RET_COMPPROV_ERR);
+	}
+	if(r > 0)
+		CHKiRet(fnWrite(pUsr, pThis->pOut, r));
+
+finalize_it:
+	RETiRet;
+}
+
+
+static rsRetVal
+Compress(void *pT, uchar *pBuf, size_t lenBuf, int op, compprovWriteFn_t fnWrite, void *pUsr)
+{
+	lmcomp_lz4_t *const pThis = (lmcomp_lz4_t*) pT;
+	size_t lenChunk;
+	DEFiRet;
+
+	if(lenBuf == 0 && !pThis->bInFrame)
+		FINALIZE; /* nothing to flush or end */
+	if(pThis->cctx == NULL) {
+		if(LZ4F_isError(LZ4F_createCompressionContext(&pThis->cctx, LZ4F_VERSION))) {
+			pThis->cctx = NULL;
+			ABORT_FINALIZE(RS_RET_COMPPROV_ERR);
+		}
+		/* large enough for any single call we do, including flush and end */
+		pThis->sizeOut = LZ4F_compressBound(LZ4_CHUNK, &pThis->prefs) + LZ4_HDR_MAX;
+		CHKmalloc(pThis->pOut = malloc(pThis->sizeOut));
+	}
+
+	if(!pThis->bInFrame) {
+		CHKiRet(writeResult(pThis, LZ4F_compressBegin(pThis->cctx, pThis->pOut, pThis->sizeOut,
+			&pThis->prefs), fnWrite, pUsr));
+		pThis->bInFrame = 1;
+	}
+	while(lenBuf > 0) {
+		lenChunk = (lenBuf > LZ4_CHUNK) ? LZ4_CHUNK : lenBuf;
+		CHKiRet(writeResult(pThis, LZ4F_compressUpdate(pThis->cctx, pThis->pOut, pThis->sizeOut,
+			pBuf, lenChunk, NULL), fnWrite, pUsr));
+		pBuf += lenChunk;
+		lenBuf -= lenChunk;
+	}
+	if(op == COMPPROV_OP_FLUSH) {
+		CHKiRet(writeResult(pThis, LZ4F_flush(pThis->cctx, pThis->pOut, pThis->sizeOut, NULL),
+			fnWrite, pUsr));
+	} else if(op == COMPPROV_OP_END) {
+		CHKiRet(writeResult(pThis, LZ4F_compressEnd(pThis->cctx, pThis->pOut, pThis->sizeOut, NULL),
+			fnWrite, pUsr));
+		pThis->bInFrame = 0;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+BEGINobjQueryInterface(lmcomp_lz4)
+CODESTARTobjQueryInterface(lmcomp_lz4)
+	 if(pIf->ifVersion != compprovCURR_IF_VERSION) {/* check for current version, increment on each change */
+		ABORT_FINALIZE(RS_RET_INTERFACE_NOT_SUPPORTED);
+	}
+	pIf->Construct = (rsRetVal(*)(void*)) lmcomp_lz4Construct;
+	pIf->Destruct = (rsRetVal(*)(void*)) lmcomp_lz4Destruct;
+	pIf->SetLevel = SetLevel;
+	pIf->SetWorkers = SetWorkers;
+	pIf->Compress = Compress;
+finalize_it:
+ENDobjQueryInterface(lmcomp_lz4)
+
+
+BEGINObjClassExit(lmcomp_lz4, OBJ_IS_LOADABLE_MODULE) /* CHANGE class also in END MACRO! */
+CODESTARTObjClassExit(lmcomp_lz4)
+ENDObjClassExit(lmcomp_lz4)
+
+
+BEGINObjClassInit(lmcomp_lz4, 1, OBJ_IS_LOADABLE_MODULE) /* class, version */
+	/* request objects we use */
+ENDObjClassInit(lmcomp_lz4)
+
+
+/* --------------- here now comes the plumbing that makes as a library module --------------- */
+
+
+BEGINmodExit
+CODESTARTmodExit
+	lmcomp_lz4ClassExit();
+ENDmodExit
+
+
+BEGINqueryEtryPt
+CODESTARTqueryEtryPt
+CODEqueryEtryPt_STD_LIB_QUERIES
+ENDqueryEtryPt
+
+
+BEGINmodInit()
+CODESTARTmodInit
+	*ipIFVersProvided = CURR_MOD_IF_VERSION; /* we only support the current interface specification */
+	/* Initialize all classes that are in our module - this includes ourselfs */
+	CHKiRet(lmcomp_lz4ClassInit(pModInfo));
+ENDmodInit
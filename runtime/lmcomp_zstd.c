@@ -0,0 +1,198 @@
+/* lmcomp_zstd.c
+ *
+ * An implementation of the compprov interface for zstd. The output file is
+ * a regular zstd file, readable with zstd -d/zstdcat. A flush ends the
+ * current zstd block, so that all data written so far can be decompressed;
+ * the frame is only ended when the file is closed (or, with veryRobustZip,
+ * after each write).
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include "rsyslog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "module-template.h"
+#include "obj.h"
+#include "compprov.h"
+#include "lmcomp_zstd.h"
+
+MODULE_TYPE_LIB
+MODULE_TYPE_NOKEEP
+
+/* static data */
+DEFobjStaticHelpers
+
+
+/* Standard-Constructor
+ */
+BEGINobjConstruct(lmcomp_zstd)
+	pThis->iLevel = ZSTD_CLEVEL_DEFAULT;
+ENDobjConstruct(lmcomp_zstd)
+
+
+/* destructor for the lmcomp_zstd object */
+BEGINobjDestruct(lmcomp_zstd) /* be sure to specify the object type also in END and CODESTART macros! */
+CODESTARTobjDestruct(lmcomp_zstd)
+	if(pThis->cctx != NULL)
+		ZSTD_freeCCtx(pThis->cctx);
+	free(pThis->pOut);
+ENDobjDestruct(lmcomp_zstd)
+
+
+static rsRetVal
+SetLevel(void *pT, int iLevel)
+{
+	lmcomp_zstd_t *const pThis = (lmcomp_zstd_t*) pT;
+	pThis->iLevel = iLevel;
+	return RS_RET_OK;
+}
+
+
+static rsRetVal
+SetWorkers(void *pT, int nWorkers)
+{
+	lmcomp_zstd_t *const pThis = (lmcomp_zstd_t*) pT;
+	pThis->nWorkers = nWorkers;
+	return RS_RET_OK;
+}
+
+
+static rsRetVal
+initCctx(lmcomp_zstd_t *const pThis)
+{
+	size_t r;
+	DEFiRet;
+
+	CHKmalloc(pThis->pOut = malloc(ZSTD_CStreamOutSize()));
+	pThis->sizeOut = ZSTD_CStreamOutSize();
+	CHKmalloc(pThis->cctx = ZSTD_createCCtx());
+	r = ZSTD_CCtx_setParameter(pThis->cctx, ZSTD_c_compressionLevel, pThis->iLevel);
+	if(ZSTD_isError(r)) {
+		DBGPRINTF("lmcomp_zstd: invalid level %d: %s\n", pThis->iLevel, ZSTD_getErrorName(r));
+		ABORT_FINALIZE(RS_RET_COMPPROV_ERR);
+	}
+	ZSTD_CCtx_setParameter(pThis->cctx, ZSTD_c_checksumFlag, 1);
+	if(pThis->nWorkers > 0) {
+		/* fails if libzstd was built without multithreading, which is fine */
+		r = ZSTD_CCtx_setParameter(pThis->cctx, ZSTD_c_nbWorkers, pThis->nWorkers);
+		if(ZSTD_isError(r))
+			DBGPRINTF("lmcomp_zstd: no multithreading support: %s\n", ZSTD_getErrorName(r));
+	}
+
+finalize_it:
+	if(iRet != RS_RET_OK) {
+		free(pThis->pOut);
+		pThis->pOut = NULL;
+		if(pThis->cctx != NULL) {
+			ZSTD_freeCCtx(pThis->cctx);
+			pThis->cctx = NULL;
+		}
+	}
+	RETiRet;
+}
+
+
+static rsRetVal
+Compress(void *pT, uchar *pBuf, size_t lenBuf, int op, compprovWriteFn_t fnWrite, void *pUsr)
+{
+	lmcomp_zstd_t *const pThis = (lmcomp_zstd_t*) pT;
+	ZSTD_inBuffer in;
+	ZSTD_outBuffer out;
+	ZSTD_EndDirective mode;
+	size_t remaining;
+	DEFiRet;
+
+	if(lenBuf == 0 && !pThis->bInFrame)
+		FINALIZE; /* nothing to flush or end */
+	if(pThis->cctx == NULL)
+		CHKiRet(initCctx(pThis));
+
+	mode = (op == COMPPROV_OP_END) ? ZSTD_e_end : ((op == COMPPROV_OP_FLUSH) ? ZSTD_e_flush : ZSTD_e_continue);
+	in.src = pBuf;
+	in.size = lenBuf;
+	in.pos = 0;
+	do {
+		out.dst = pThis->pOut;
+		out.size = pThis->sizeOut;
+		out.pos = 0;
+		remaining = ZSTD_compressStream2(pThis->cctx, &out, &in, mode);
+		if(ZSTD_isError(remaining)) {
+			DBGPRINTF("lmcomp_zstd: compression failed: %s\n", ZSTD_getErrorName(remaining));
+			ZSTD_CCtx_reset(pThis->cctx, ZSTD_reset_session_only);
+			pThis->bInFrame = 0;
+			ABORT_FINALIZE(RS_RET_COMPPROV_ERR);
+		}
+		if(out.pos > 0)
+			CHKiRet(fnWrite(pUsr, pThis->pOut, out.pos));
+	} while((mode == ZSTD_e_continue) ? (in.pos < in.size) : (remaining != 0));
+	pThis->bInFrame = (op != COMPPROV_OP_END);
+
+finalize_it:
+	RETiRet;
+}
+
+
+BEGINobjQueryInterface(lmcomp_zstd)
+CODESTARTobjQueryInterface(lmcomp_zstd)
+	 if(pIf->ifVersion != compprovCURR_IF_VERSION) {/* check for current version, increment on each change */
+		ABORT_FINALIZE(RS_RET_INTERFACE_NOT_SUPPORTED);
+	}
+	pIf->Construct = (rsRetVal(*)(void*)) lmcomp_zstdConstruct;
+	pIf->Destruct = (rsRetVal(*)(void*)) lmcomp_zstdDestruct;
+	pIf->SetLevel = SetLevel;
+	pIf->SetWorkers = SetWorkers;
+	pIf->Compress = Compress;
+finalize_it:
+ENDobjQueryInterface(lmcomp_zstd)
+
+
+BEGINObjClassExit(lmcomp_zstd, OBJ_IS_LOADABLE_MODULE) /* CHANGE class also in END MACRO! */
+CODESTARTObjClassExit(lmcomp_zstd)
+ENDObjClassExit(lmcomp_zstd)
+
+
+BEGINObjClassInit(lmcomp_zstd, 1, OBJ_IS_LOADABLE_MODULE) /* class, version */
+	/* request objects we use */
+ENDObjClassInit(lmcomp_zstd)
+
+
+/* --------------- here now comes the plumbing that makes as a library module --------------- */
+
+
+BEGINmodExit
+CODESTARTmodExit
+	lmcomp_zstdClassExit();
+ENDmodExit
+
+
+BEGINqueryEtryPt
+CODESTARTqueryEtryPt
+CODEqueryEtryPt_STD_LIB_QUERIES
+ENDqueryEtryPt
+
+
+BEGINmodInit()
+CODESTARTmodInit
+	*ipIFVersProvided = CURR_MOD_IF_VERSION; /* we only support the current interface specification */
+	/* Initialize all classes that are in our module - this includes ourselfs */
+	CHKiRet(lmcomp_zstdClassInit(pModInfo));
+ENDmodInit
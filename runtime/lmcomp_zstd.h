@@ -0,0 +1,45 @@
+/* An implementation of the compression provider interface for zstd.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_LMCOMP_ZSTD_H
+#define INCLUDED_LMCOMP_ZSTD_H
+#include <zstd.h>
+#include "compprov.h"
+
+/* interface is defined in compprov.h, we just implement it! */
+#define lmcomp_zstdCURR_IF_VERSION compprovCURR_IF_VERSION
+typedef compprov_if_t lmcomp_zstd_if_t;
+
+/* the lmcomp_zstd object */
+struct lmcomp_zstd_s {
+	BEGINobjInstance; /* Data to implement generic object - MUST be the first data element! */
+	ZSTD_CCtx *cctx;	/* created on first use */
+	int iLevel;
+	int nWorkers;
+	sbool bInFrame;	/* frame started, not yet ended */
+	uchar *pOut;
+	size_t sizeOut;
+};
+typedef struct lmcomp_zstd_s lmcomp_zstd_t;
+
+/* prototypes */
+PROTOTYPEObj(lmcomp_zstd);
+
+#endif /* #ifndef INCLUDED_LMCOMP_ZSTD_H */
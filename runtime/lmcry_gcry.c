@@ -161,6 +161,12 @@ SetCnfParam(void *pT, struct nvlst *lst, int paramType)
 			FINALIZE;
 		}
 	}
+	if(rsgcryCheckAlgoMode(pThis->ctx) != RS_RET_OK) {
+		errmsg.LogError(0, RS_RET_CRY_INVLD_MODE, "cry.mode and cry.algo can not be "
+			"used together (GCM requires a cipher with 128 bit blocks, POLY1305 "
+			"requires CHACHA20)");
+		ABORT_FINALIZE(RS_RET_CRY_INVLD_MODE);
+	}
 	/* note: key must be set AFTER algo/mode is set (as it depends on them) */
 	if(nKeys != 1) {
 		errmsg.LogError(0, RS_RET_INVALID_PARAMS, "excactly one of the following "
@@ -47,7 +47,10 @@ static struct cnfparamdescr cnfpdescr[] = {
 	{ "sig.timestampservice", eCmdHdlrGetWord, 0 },
 	{ "sig.block.sizelimit", eCmdHdlrSize, 0 },
 	{ "sig.keeprecordhashes", eCmdHdlrBinary, 0 },
-	{ "sig.keeptreehashes", eCmdHdlrBinary, 0 }
+	{ "sig.keeptreehashes", eCmdHdlrBinary, 0 },
+	{ "sig.async", eCmdHdlrBinary, 0 },
+	{ "sig.async.maxpending", eCmdHdlrPositiveInt, 0 },
+	{ "sig.async.retries", eCmdHdlrNonNegInt, 0 }
 };
 static struct cnfparamblk pblk =
 	{ CNFPARAMBLK_VERSION,
@@ -119,6 +122,12 @@ SetCnfParam(void *pT, struct nvlst *lst)
 			rsgtSetKeepRecordHashes(pThis->ctx, pvals[i].val.d.n);
 		} else if(!strcmp(pblk.descr[i].name, "sig.keeptreehashes")) {
 			rsgtSetKeepTreeHashes(pThis->ctx, pvals[i].val.d.n);
+		} else if(!strcmp(pblk.descr[i].name, "sig.async")) {
+			rsgtSetAsync(pThis->ctx, pvals[i].val.d.n);
+		} else if(!strcmp(pblk.descr[i].name, "sig.async.maxpending")) {
+			rsgtSetAsyncMaxPending(pThis->ctx, pvals[i].val.d.n);
+		} else if(!strcmp(pblk.descr[i].name, "sig.async.retries")) {
+			rsgtSetAsyncRetries(pThis->ctx, pvals[i].val.d.n);
 		} else {
 			DBGPRINTF("lmsig_gt: program error, non-handled "
 			  "param '%s'\n", pblk.descr[i].name);
@@ -25,7 +25,13 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <json/json.h>
 #include <json/json.h>
 #include <assert.h>
@@ -34,10 +40,12 @@
 #include "srUtils.h"
 #include "errmsg.h"
 #include "lookup.h"
+#include "perfhash.h"
 #include "msg.h"
 #include "rsconf.h"
 #include "dirty.h"
 #include "unicode-helper.h"
+#include "atomic.h"
 
 /* definitions for objects we access */
 DEFobjStaticHelpers
@@ -45,13 +53,16 @@ DEFobjCurrIf(errmsg)
 DEFobjCurrIf(glbl)
 
 /* forward definitions */
-static rsRetVal lookupReadFile(lookup_t *pThis);
+static void lookupDataDestruct(lookup_data_t *pData);
+static rsRetVal lookupReadFile(lookup_t *pThis, lookup_data_t **ppData);
 
 /* static data */
 /* tables for interfacing with the v6 config system (as far as we need to) */
 static struct cnfparamdescr modpdescr[] = {
 	{ "name", eCmdHdlrString, CNFPARAM_REQUIRED },
-	{ "file", eCmdHdlrString, CNFPARAM_REQUIRED }
+	{ "file", eCmdHdlrString, CNFPARAM_REQUIRED },
+	{ "cachedirectory", eCmdHdlrString, 0 },
+	{ "reloadonhup", eCmdHdlrBinary, 0 }
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -60,6 +71,149 @@ static struct cnfparamblk modpblk =
 	};
 
 
+/* Readers do not lock tables. On reload, the new table is built off to
+ * the side and published by replacing the data pointer of the table. The
+ * old data is freed once no reader can still use it (deferred reclamation
+ * based on epochs, much like RCU): each thread that does lookups has a
+ * reader record, in which it notes the current global epoch while it
+ * accesses a table, and 0 otherwise. After publishing, the reloader starts
+ * a new epoch and waits until no reader is still in an older one. Readers
+ * only write to their own record, so lookups from many workers do not
+ * contend for anything. Reader records are created on the first lookup of
+ * a thread and recycled when the thread terminates.
+ * Without atomic instructions, we fall back to a read-write lock.
+ */
+#ifdef HAVE_ATOMIC_BUILTINS
+typedef struct lookup_reader_s lookup_reader_t;
+struct lookup_reader_s {
+	volatile unsigned epoch;	/* epoch in which we read, 0 if none */
+	sbool bInUse;			/* owned by a thread? */
+	lookup_reader_t *next;
+};
+
+static unsigned lookupEpoch = 1;
+static lookup_reader_t *lookupReaders = NULL;	/* never shrinks */
+static pthread_mutex_t mutLookupReaders = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t keyLookupReader;
+
+static void
+lookupReaderRelease(void *arg)
+{
+	lookup_reader_t *const rdr = (lookup_reader_t*) arg;
+
+	pthread_mutex_lock(&mutLookupReaders);
+	rdr->epoch = 0;
+	rdr->bInUse = 0;
+	pthread_mutex_unlock(&mutLookupReaders);
+}
+
+/* get the reader record of the current thread, NULL if out of memory */
+static lookup_reader_t *
+lookupGetReader(void)
+{
+	lookup_reader_t *rdr;
+
+	if((rdr = pthread_getspecific(keyLookupReader)) != NULL)
+		return rdr;
+	pthread_mutex_lock(&mutLookupReaders);
+	for(rdr = lookupReaders ; rdr != NULL && rdr->bInUse ; rdr = rdr->next)
+		/* search free record */;
+	if(rdr == NULL && (rdr = calloc(1, sizeof(lookup_reader_t))) != NULL) {
+		rdr->next = lookupReaders;
+		lookupReaders = rdr;
+	}
+	if(rdr != NULL)
+		rdr->bInUse = 1;
+	pthread_mutex_unlock(&mutLookupReaders);
+	if(rdr != NULL)
+		pthread_setspecific(keyLookupReader, rdr);
+	return rdr;
+}
+
+/* obtain the current table data for reading; lookupReadEnd() must be called
+ * when done with it.
+ */
+static inline lookup_data_t *
+lookupReadBegin(lookup_t *pThis, lookup_reader_t **ppRdr)
+{
+	lookup_reader_t *const rdr = lookupGetReader();
+
+	if(rdr == NULL) { /* very unlikely, but we must not crash */
+		*ppRdr = NULL;
+		return NULL;
+	}
+	rdr->epoch = *((volatile unsigned*) &lookupEpoch);
+	ATOMIC_BARRIER(); /* the epoch must be visible before we read the pointer */
+	*ppRdr = rdr;
+	return *((lookup_data_t *volatile *) &pThis->data);
+}
+
+static inline void
+lookupReadEnd(lookup_t __attribute__((unused)) *pThis, lookup_reader_t *rdr)
+{
+	if(rdr == NULL)
+		return;
+	ATOMIC_BARRIER(); /* all reads of the table must be done */
+	rdr->epoch = 0;
+}
+
+/* replace the table data with pNew and free the old data as soon as no
+ * reader can use it any longer. Must only be called by one thread at a time.
+ */
+static void
+lookupPublish(lookup_t *pThis, lookup_data_t *pNew)
+{
+	lookup_data_t *pOld;
+	lookup_reader_t *rdr;
+	unsigned epoch, rdrEpoch;
+
+	pOld = pThis->data;
+	*((lookup_data_t *volatile *) &pThis->data) = pNew;
+	ATOMIC_INC(&pThis->gen, NULL); /* only after the new data is visible */
+	epoch = ATOMIC_INC_AND_FETCH_unsigned(&lookupEpoch, NULL) + 1;
+	if(epoch == 0) /* 0 means "not reading", skip it on wrap */
+		epoch = ATOMIC_INC_AND_FETCH_unsigned(&lookupEpoch, NULL) + 1;
+
+	/* wait until all readers left the epochs in which pOld was visible */
+	pthread_mutex_lock(&mutLookupReaders);
+	for(rdr = lookupReaders ; rdr != NULL ; rdr = rdr->next) {
+		while((rdrEpoch = rdr->epoch) != 0 && (int) (rdrEpoch - epoch) < 0)
+			srSleep(0, 100);
+	}
+	pthread_mutex_unlock(&mutLookupReaders);
+	lookupDataDestruct(pOld);
+}
+#else /* #ifdef HAVE_ATOMIC_BUILTINS */
+typedef void lookup_reader_t;
+
+static inline lookup_data_t *
+lookupReadBegin(lookup_t *pThis, lookup_reader_t __attribute__((unused)) **ppRdr)
+{
+	pthread_rwlock_rdlock(&pThis->rwlock);
+	return pThis->data;
+}
+
+static inline void
+lookupReadEnd(lookup_t *pThis, lookup_reader_t __attribute__((unused)) *rdr)
+{
+	pthread_rwlock_unlock(&pThis->rwlock);
+}
+
+static void
+lookupPublish(lookup_t *pThis, lookup_data_t *pNew)
+{
+	lookup_data_t *pOld;
+
+	pthread_rwlock_wrlock(&pThis->rwlock);
+	pOld = pThis->data;
+	pThis->data = pNew;
+	++pThis->gen;
+	pthread_rwlock_unlock(&pThis->rwlock);
+	lookupDataDestruct(pOld);
+}
+#endif /* #ifdef HAVE_ATOMIC_BUILTINS */
+
+
 /* create a new lookup table object AND include it in our list of
  * lookup tables.
  */
@@ -69,15 +223,16 @@ lookupNew(lookup_t **ppThis)
 	lookup_t *pThis = NULL;
 	DEFiRet;
 
-	CHKmalloc(pThis = malloc(sizeof(lookup_t)));
+	CHKmalloc(pThis = calloc(1, sizeof(lookup_t)));
+#ifndef HAVE_ATOMIC_BUILTINS
 	pthread_rwlock_init(&pThis->rwlock, NULL);
-	pThis->name = NULL;
+#endif
+	pThis->reloadOnHUP = 1;
 
 	if(loadConf->lu_tabs.root == NULL) {
 		loadConf->lu_tabs.root = pThis;
-		pThis->next = NULL;
 	} else {
-		pThis->next = loadConf->lu_tabs.last;
+		loadConf->lu_tabs.last->next = pThis;
 	}
 	loadConf->lu_tabs.last = pThis;
 
@@ -88,11 +243,74 @@ finalize_it:
 	}
 	RETiRet;
 }
+
+static void
+lookupCidrDestruct(lookup_cidr_node_t *node)
+{
+	if(node == NULL)
+		return;
+	lookupCidrDestruct(node->child[0]);
+	lookupCidrDestruct(node->child[1]);
+	free(node->val);
+	free(node);
+}
+
+/* free a table's data */
+static void
+lookupDataDestruct(lookup_data_t *pData)
+{
+	uint32_t i;
+
+	if(pData == NULL)
+		return;
+	if(pData->map != NULL) {
+		munmap((void*) pData->map, pData->mapLen);
+		goto done;
+	}
+	switch(pData->type) {
+	case LOOKUP_TYPE_STRING:
+		if(pData->d.strtab == NULL)
+			break;
+		for(i = 0 ; i < pData->nmemb ; ++i) {
+			free(pData->d.strtab[i].key), /* we don't care about exec order of frees */
+			free(pData->d.strtab[i].val);
+		}
+		free(pData->d.strtab);
+		break;
+	case LOOKUP_TYPE_HASH:
+		perfhashDestruct(&pData->d.hashtab.hash);
+		if(pData->d.hashtab.vals == NULL)
+			break;
+		for(i = 0 ; i < pData->nmemb ; ++i)
+			free(pData->d.hashtab.vals[i]);
+		free(pData->d.hashtab.vals);
+		break;
+	case LOOKUP_TYPE_ARRAY:
+		if(pData->d.arr.vals == NULL)
+			break;
+		for(i = 0 ; i < pData->nmemb ; ++i)
+			free(pData->d.arr.vals[i]);
+		free(pData->d.arr.vals);
+		break;
+	case LOOKUP_TYPE_CIDR:
+		lookupCidrDestruct(pData->d.cidr);
+		break;
+	}
+done:
+	free(pData->nomatch);
+	free(pData);
+}
+
 void
 lookupDestruct(lookup_t *pThis)
 {
+	lookupDataDestruct(pThis->data);
+#ifndef HAVE_ATOMIC_BUILTINS
 	pthread_rwlock_destroy(&pThis->rwlock);
+#endif
 	free(pThis->name);
+	free(pThis->filename);
+	free(pThis->cachedir);
 	free(pThis);
 }
 
@@ -121,44 +339,766 @@ bs_arrcmp_strtab(const void *s1, const void *s2)
 	return strcmp((char*)s1, (char*)((lookup_string_tab_etry_t*)s2)->key);
 }
 
-rsRetVal
-lookupBuildTable(lookup_t *pThis, struct json_object *jroot)
+/* the string table is sorted and then searched with bsearch() */
+static rsRetVal
+lookupBuildStringTable(lookup_t __attribute__((unused)) *pThis, lookup_data_t *pData, struct json_object *jtab)
 {
-	//struct json_object *jversion, *jnomatch, *jtype, *jtab;
-	struct json_object *jtab;
 	struct json_object *jrow, *jindex, *jvalue;
 	uint32_t i;
-	uint32_t maxStrSize;
 	DEFiRet;
 
-#if 0 // enable when we continue to work on this module
-	jversion = json_object_object_get(jroot, "version");
-	jnomatch = json_object_object_get(jroot, "nomatch");
-	jtype = json_object_object_get(jroot, "type");
-#endif
-	jtab = json_object_object_get(jroot, "table");
-	pThis->nmemb = json_object_array_length(jtab);
-	CHKmalloc(pThis->d.strtab = malloc(pThis->nmemb * sizeof(lookup_string_tab_etry_t)));
+	CHKmalloc(pData->d.strtab = calloc(pData->nmemb + 1, sizeof(lookup_string_tab_etry_t)));
+	for(i = 0 ; i < pData->nmemb ; ++i) {
+		jrow = json_object_array_get_idx(jtab, i);
+		jindex = json_object_object_get(jrow, "index");
+		jvalue = json_object_object_get(jrow, "value");
+		CHKmalloc(pData->d.strtab[i].key = (uchar*) strdup(json_object_get_string(jindex)));
+		CHKmalloc(pData->d.strtab[i].val = (uchar*) strdup(json_object_get_string(jvalue)));
+	}
+	qsort(pData->d.strtab, pData->nmemb, sizeof(lookup_string_tab_etry_t), qs_arrcmp_strtab);
+
+finalize_it:
+	RETiRet;
+}
+
+/* the hash table maps each key to the index of its value. The value of the
+ * first entry is used if an index appears more than once.
+ */
+static rsRetVal
+lookupBuildHashTable(lookup_t *pThis, lookup_data_t *pData, struct json_object *jtab)
+{
+	struct json_object *jrow, *jindex, *jvalue;
+	const char *key;
+	uint32_t i;
+	DEFiRet;
+
+	CHKiRet(perfhashConstruct(&pData->d.hashtab.hash));
+	CHKmalloc(pData->d.hashtab.vals = calloc(pData->nmemb + 1, sizeof(uchar*)));
+	for(i = 0 ; i < pData->nmemb ; ++i) {
+		jrow = json_object_array_get_idx(jtab, i);
+		jindex = json_object_object_get(jrow, "index");
+		jvalue = json_object_object_get(jrow, "value");
+		key = json_object_get_string(jindex);
+		CHKmalloc(pData->d.hashtab.vals[i] = (uchar*) strdup(json_object_get_string(jvalue)));
+		CHKiRet(perfhashAdd(pData->d.hashtab.hash, (uchar*) key, strlen(key), (int) i));
+	}
+	if((iRet = perfhashFinalize(pData->d.hashtab.hash)) != RS_RET_OK) {
+		errmsg.LogError(0, iRet, "lookup table '%s': could not build hash table",
+			pThis->name);
+		FINALIZE;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+/* parse an array table index or key, which must be a (complete) integer
+ * number. Returns 0 if it is none.
+ */
+static int
+lookupParseInt(const char *str, long long *n)
+{
+	char *end;
+
+	if(*str == '\0')
+		return 0;
+	errno = 0;
+	*n = strtoll(str, &end, 10);
+	return *end == '\0' && errno == 0;
+}
 
-	maxStrSize = 0;
-	for(i = 0 ; i < pThis->nmemb ; ++i) {
+/* array tables are indexed directly by the key minus the lowest index.
+ * Gaps in the index are permitted, but must not make up most of the
+ * table (see LOOKUP_ARRAY_MAXSPAN).
+ */
+static rsRetVal
+lookupBuildArrayTable(lookup_t *pThis, lookup_data_t *pData, struct json_object *jtab)
+{
+	struct json_object *jrow, *jindex, *jvalue;
+	long long *idx = NULL;
+	long long first, last, span;
+	uint32_t i, n;
+	DEFiRet;
+
+	n = pData->nmemb;
+	CHKmalloc(idx = malloc((n + 1) * sizeof(long long)));
+	first = last = 0;
+	for(i = 0 ; i < n ; ++i) {
 		jrow = json_object_array_get_idx(jtab, i);
 		jindex = json_object_object_get(jrow, "index");
+		if(!lookupParseInt(json_object_get_string(jindex), &idx[i])) {
+			errmsg.LogError(0, RS_RET_INVALID_VALUE, "lookup table '%s': index '%s' "
+				"of array table is not an integer", pThis->name,
+				json_object_get_string(jindex));
+			ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+		}
+		if(i == 0 || idx[i] < first)
+			first = idx[i];
+		if(i == 0 || idx[i] > last)
+			last = idx[i];
+	}
+	span = (n == 0) ? 0 : last - first + 1;
+	if(span < 0 || span > LOOKUP_ARRAY_MAXSPAN(n)) {
+		errmsg.LogError(0, RS_RET_INVALID_VALUE, "lookup table '%s': index range "
+			"%lld..%lld is too sparse for an array table, use type \"hash\" "
+			"instead", pThis->name, first, last);
+		ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+	}
+
+	pData->d.arr.first = first;
+	pData->nmemb = (uint32_t) span;
+	CHKmalloc(pData->d.arr.vals = calloc(span + 1, sizeof(uchar*)));
+	for(i = 0 ; i < n ; ++i) {
+		if(pData->d.arr.vals[idx[i] - first] != NULL)
+			continue; /* duplicate, first one wins */
+		jrow = json_object_array_get_idx(jtab, i);
 		jvalue = json_object_object_get(jrow, "value");
-		CHKmalloc(pThis->d.strtab[i].key = (uchar*) strdup(json_object_get_string(jindex)));
-		CHKmalloc(pThis->d.strtab[i].val = (uchar*) strdup(json_object_get_string(jvalue)));
-		maxStrSize += ustrlen(pThis->d.strtab[i].val);
+		CHKmalloc(pData->d.arr.vals[idx[i] - first] =
+			(uchar*) strdup(json_object_get_string(jvalue)));
 	}
 
-	qsort(pThis->d.strtab, pThis->nmemb, sizeof(lookup_string_tab_etry_t), qs_arrcmp_strtab);
-dbgprintf("DDDD: table loaded (max size %u):\n", maxStrSize);
-for(i = 0 ; i < pThis->nmemb ; ++i)
-  dbgprintf("key: '%s', val: '%s'\n", pThis->d.strtab[i].key, pThis->d.strtab[i].val);
+finalize_it:
+	free(idx);
+	RETiRet;
+}
+
+static inline int
+cidrBit(const uint8_t *addr, const int bit)
+{
+	return (addr[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+/* number of leading bits in which a and b are equal, at most maxLen */
+static int
+cidrCommonLen(const uint8_t *a, const uint8_t *b, const int maxLen)
+{
+	int i, bit;
+	uint8_t x;
+
+	for(i = 0 ; i * 8 < maxLen ; ++i) {
+		if((x = a[i] ^ b[i]) != 0)
+			break;
+	}
+	bit = i * 8;
+	if(bit < maxLen)
+		for(x = a[i] ^ b[i] ; bit < maxLen && !(x & 0x80) ; x <<= 1)
+			++bit;
+	return (bit < maxLen) ? bit : maxLen;
+}
+
+/* parse an address with optional "/prefixlen" into IPv6 (IPv4-mapped for
+ * IPv4) form. If prefixLen is NULL, no prefix length is permitted. Returns
+ * 0 if str is not valid.
+ */
+static int
+cidrParse(const char *str, uint8_t *addr, int *prefixLen)
+{
+	char buf[INET6_ADDRSTRLEN + 8];
+	struct in_addr in4;
+	char *slash;
+	long long len = -1;
+	int maxLen;
 
+	if(strlen(str) >= sizeof(buf))
+		return 0;
+	strcpy(buf, str);
+	if((slash = strchr(buf, '/')) != NULL) {
+		if(prefixLen == NULL || !lookupParseInt(slash + 1, &len))
+			return 0;
+		*slash = '\0';
+	}
+	if(inet_pton(AF_INET, buf, &in4) == 1) {
+		memset(addr, 0, 10);
+		addr[10] = addr[11] = 0xff;
+		memcpy(addr + 12, &in4, 4);
+		maxLen = 32;
+	} else if(inet_pton(AF_INET6, buf, addr) == 1) {
+		maxLen = 128;
+	} else {
+		return 0;
+	}
+	if(prefixLen != NULL) {
+		if(len == -1)
+			len = maxLen;
+		if(len < 0 || len > maxLen)
+			return 0;
+		*prefixLen = (int) len + 128 - maxLen;
+	}
+	return 1;
+}
+
+static rsRetVal
+cidrNewNode(const uint8_t *addr, const int prefixLen, uchar *val, lookup_cidr_node_t **ppNode)
+{
+	lookup_cidr_node_t *node;
+	int i;
+	DEFiRet;
+
+	CHKmalloc(node = calloc(1, sizeof(lookup_cidr_node_t)));
+	memcpy(node->addr, addr, 16);
+	for(i = prefixLen ; i < 128 ; ++i) /* clear host part */
+		node->addr[i >> 3] &= ~(0x80 >> (i & 7));
+	node->prefixLen = (uint8_t) prefixLen;
+	node->val = val;
+	*ppNode = node;
+finalize_it:
+	RETiRet;
+}
+
+/* insert a network into the trie. The value is handed over to the trie,
+ * except if the network is already present (then the first value is kept
+ * and val is NOT consumed, *pbUsed tells the caller).
+ */
+static rsRetVal
+cidrInsert(lookup_cidr_node_t **ppRoot, const uint8_t *addr, const int prefixLen, uchar *val,
+	   sbool *pbUsed)
+{
+	lookup_cidr_node_t **pp = ppRoot;
+	lookup_cidr_node_t *node, *newNode, *branch;
+	int common;
+	DEFiRet;
+
+	*pbUsed = 0;
+	while((node = *pp) != NULL) {
+		common = cidrCommonLen(node->addr, addr,
+				       (node->prefixLen < prefixLen) ? node->prefixLen : prefixLen);
+		if(common == node->prefixLen) {
+			if(prefixLen == node->prefixLen) {
+				if(node->val == NULL) {
+					node->val = val;
+					*pbUsed = 1;
+				}
+				FINALIZE;
+			}
+			pp = &node->child[cidrBit(addr, node->prefixLen)];
+			continue;
+		}
+		/* node must move below a new node at the common prefix */
+		CHKiRet(cidrNewNode(addr, prefixLen, val, &newNode));
+		if(common == prefixLen) {
+			newNode->child[cidrBit(node->addr, prefixLen)] = node;
+			*pp = newNode;
+		} else {
+			if(cidrNewNode(addr, common, NULL, &branch) != RS_RET_OK) {
+				free(newNode);
+				ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+			}
+			branch->child[cidrBit(node->addr, common)] = node;
+			branch->child[cidrBit(addr, common)] = newNode;
+			*pp = branch;
+		}
+		*pbUsed = 1;
+		FINALIZE;
+	}
+	CHKiRet(cidrNewNode(addr, prefixLen, val, pp));
+	*pbUsed = 1;
 finalize_it:
 	RETiRet;
 }
 
+/* longest prefix match, returns NULL if no network matches */
+static uchar *
+cidrLookup(lookup_cidr_node_t *node, const uint8_t *addr)
+{
+	uchar *best = NULL;
+
+	while(node != NULL && cidrCommonLen(node->addr, addr, node->prefixLen) == node->prefixLen) {
+		if(node->val != NULL)
+			best = node->val;
+		if(node->prefixLen == 128)
+			break;
+		node = node->child[cidrBit(addr, node->prefixLen)];
+	}
+	return best;
+}
+
+static rsRetVal
+lookupBuildCidrTable(lookup_t *pThis, lookup_data_t *pData, struct json_object *jtab)
+{
+	struct json_object *jrow, *jindex, *jvalue;
+	uint8_t addr[16];
+	int prefixLen;
+	uchar *val;
+	sbool bUsed;
+	uint32_t i;
+	DEFiRet;
+
+	for(i = 0 ; i < pData->nmemb ; ++i) {
+		jrow = json_object_array_get_idx(jtab, i);
+		jindex = json_object_object_get(jrow, "index");
+		jvalue = json_object_object_get(jrow, "value");
+		if(!cidrParse(json_object_get_string(jindex), addr, &prefixLen)) {
+			errmsg.LogError(0, RS_RET_INVALID_VALUE, "lookup table '%s': index '%s' "
+				"of cidr table is no valid network", pThis->name,
+				json_object_get_string(jindex));
+			ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+		}
+		CHKmalloc(val = (uchar*) strdup(json_object_get_string(jvalue)));
+		iRet = cidrInsert(&pData->d.cidr, addr, prefixLen, val, &bUsed);
+		if(!bUsed)
+			free(val);
+		CHKiRet(iRet);
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+/* build a new table from the parsed table file. pThis is only used for
+ * error messages, the table is returned in *ppData.
+ */
+static rsRetVal
+lookupBuildTable(lookup_t *pThis, struct json_object *jroot, lookup_data_t **ppData)
+{
+	struct json_object *jnomatch, *jtype, *jtab;
+	lookup_data_t *pData = NULL;
+	const char *type;
+	DEFiRet;
+
+	CHKmalloc(pData = calloc(1, sizeof(lookup_data_t)));
+	jnomatch = json_object_object_get(jroot, "nomatch");
+	jtype = json_object_object_get(jroot, "type");
+	jtab = json_object_object_get(jroot, "table");
+	type = (jtype == NULL) ? "string" : json_object_get_string(jtype);
+	if(!strcmp(type, "string")) {
+		pData->type = LOOKUP_TYPE_STRING;
+	} else if(!strcmp(type, "hash")) {
+		pData->type = LOOKUP_TYPE_HASH;
+	} else if(!strcmp(type, "array")) {
+		pData->type = LOOKUP_TYPE_ARRAY;
+	} else if(!strcmp(type, "cidr")) {
+		pData->type = LOOKUP_TYPE_CIDR;
+	} else {
+		errmsg.LogError(0, RS_RET_INVALID_VALUE, "lookup table '%s': invalid "
+			"type '%s'", pThis->name, type);
+		ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+	}
+	CHKmalloc(pData->nomatch = (uchar*)
+		strdup((jnomatch == NULL) ? "" : json_object_get_string(jnomatch)));
+	pData->nmemb = (jtab == NULL) ? 0 : json_object_array_length(jtab);
+
+	switch(pData->type) {
+	case LOOKUP_TYPE_STRING:
+		CHKiRet(lookupBuildStringTable(pThis, pData, jtab));
+		break;
+	case LOOKUP_TYPE_HASH:
+		CHKiRet(lookupBuildHashTable(pThis, pData, jtab));
+		break;
+	case LOOKUP_TYPE_ARRAY:
+		CHKiRet(lookupBuildArrayTable(pThis, pData, jtab));
+		break;
+	case LOOKUP_TYPE_CIDR:
+		CHKiRet(lookupBuildCidrTable(pThis, pData, jtab));
+		break;
+	}
+	DBGPRINTF("lookup table '%s' of type %s built, %u entries\n", pThis->name, type,
+		  pData->nmemb);
+
+	*ppData = pData;
+
+finalize_it:
+	if(iRet != RS_RET_OK)
+		lookupDataDestruct(pData);
+	RETiRet;
+}
+
+
+/* Compiled table cache. If a table has a cache directory, the table built
+ * from the JSON file is also saved there in binary form, together with a
+ * hash of the JSON file. When the table is loaded again and the JSON file
+ * is unchanged, the binary form is used instead of parsing the JSON and
+ * building the table, which is much faster for large tables (most
+ * notably, the seeds of a perfect hash table need not be searched again).
+ * The format is native-endian and bound to this version of rsyslog; if a
+ * cache file does not match for any reason, it is silently rebuilt.
+ */
+#define LKC_MAGIC "RSLKC01\n"
+#define LKC_NOSTR 0xffffffffu	/* string length of array table holes */
+#define LKC_CIDR_END 0xff	/* prefix length that ends the cidr node list */
+
+typedef struct lkc_hdr_s {
+	char magic[8];
+	uint32_t hdrSize;	/* catches differing struct layouts */
+	uint32_t type;
+	uint32_t nmemb;
+	uint32_t reserved;
+	uint64_t srcHash;	/* hash and size of the JSON file */
+	uint64_t srcLen;
+	int64_t first;		/* array tables only */
+	uint64_t bodyLen;
+	uint64_t bodyHash;
+} lkc_hdr_t;
+
+typedef struct lkc_writer_s {	/* the body is built in memory */
+	uchar *buf;
+	size_t len;
+	size_t size;
+	sbool bErr;
+} lkc_writer_t;
+
+typedef struct lkc_reader_s {
+	const uchar *p;
+	size_t left;
+} lkc_reader_t;
+
+/* a word-wise variant of FNV-1a, as cache files and table files may be
+ * large. Only used to detect changes, not for hash tables.
+ */
+static uint64_t
+lkcHash(const uchar *buf, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ull;
+	uint64_t w;
+	size_t i;
+
+	for(i = 0 ; i + sizeof(w) <= len ; i += sizeof(w)) {
+		memcpy(&w, buf + i, sizeof(w));
+		h = (h ^ w) * 0x100000001b3ull;
+		h ^= h >> 32;
+	}
+	for( ; i < len ; ++i)
+		h = (h ^ buf[i]) * 0x100000001b3ull;
+	return h ^ (h >> 29);
+}
+
+/* build the cache file name, which is derived from the table name */
+static rsRetVal
+lkcFileName(lookup_t *pThis, char *fn, size_t lenFn)
+{
+	const uchar *c;
+	size_t i;
+	DEFiRet;
+
+	i = snprintf(fn, lenFn, "%s/", (char*) pThis->cachedir);
+	if(i >= lenFn)
+		ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+	for(c = pThis->name ; *c != '\0' && i < lenFn ; ++c, ++i)
+		fn[i] = (isalnum(*c) || *c == '-' || *c == '.') ? *c : '_';
+	if(i + sizeof(".lkc") > lenFn)
+		ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+	memcpy(fn + i, ".lkc", sizeof(".lkc"));
+finalize_it:
+	RETiRet;
+}
+
+/* reserve len bytes at the end of the body, NULL if out of memory */
+static uchar *
+lkcReserve(lkc_writer_t *w, size_t len)
+{
+	uchar *newbuf;
+	size_t newsize;
+
+	if(w->bErr)
+		return NULL;
+	if(w->len + len > w->size) {
+		for(newsize = (w->size == 0) ? 65536 : w->size ; newsize < w->len + len ; newsize *= 2)
+			/* just search */;
+		if((newbuf = realloc(w->buf, newsize)) == NULL) {
+			w->bErr = 1;
+			return NULL;
+		}
+		w->buf = newbuf;
+		w->size = newsize;
+	}
+	w->len += len;
+	return w->buf + w->len - len;
+}
+
+static void
+lkcPut(lkc_writer_t *w, const void *p, size_t len)
+{
+	uchar *dst;
+
+	if((dst = lkcReserve(w, len)) != NULL)
+		memcpy(dst, p, len);
+}
+
+static void
+lkcPutStr(lkc_writer_t *w, const uchar *str)
+{
+	uint32_t len = (str == NULL) ? LKC_NOSTR : (uint32_t) ustrlen(str);
+
+	lkcPut(w, &len, sizeof(len));
+	if(str != NULL)
+		lkcPut(w, str, len);
+}
+
+/* networks are saved in preorder, reinserting them gives the same trie */
+static void
+lkcPutCidr(lkc_writer_t *w, lookup_cidr_node_t *node)
+{
+	if(node == NULL)
+		return;
+	if(node->val != NULL) {
+		lkcPut(w, &node->prefixLen, 1);
+		lkcPut(w, node->addr, 16);
+		lkcPutStr(w, node->val);
+	}
+	lkcPutCidr(w, node->child[0]);
+	lkcPutCidr(w, node->child[1]);
+}
+
+/* save the table, errors are reported but not fatal */
+static void
+lookupCacheWrite(lookup_t *pThis, lookup_data_t *pData, uint64_t srcHash, uint64_t srcLen)
+{
+	char fn[4096];
+	char tmpfn[4096+32];
+	char errStr[1024];
+	lkc_writer_t w;
+	lkc_hdr_t hdr;
+	uchar *phbuf;
+	uint64_t phLen;
+	uint8_t end = LKC_CIDR_END;
+	uint32_t i;
+	FILE *fp;
+	int eno;
+	sbool bErr;
+
+	if(lkcFileName(pThis, fn, sizeof(fn)) != RS_RET_OK)
+		return;
+	memset(&w, 0, sizeof(w));
+	lkcPutStr(&w, pData->nomatch);
+	switch(pData->type) {
+	case LOOKUP_TYPE_STRING:
+		for(i = 0 ; i < pData->nmemb ; ++i) {
+			lkcPutStr(&w, pData->d.strtab[i].key);
+			lkcPutStr(&w, pData->d.strtab[i].val);
+		}
+		break;
+	case LOOKUP_TYPE_HASH:
+		for(i = 0 ; i < pData->nmemb ; ++i)
+			lkcPutStr(&w, pData->d.hashtab.vals[i]);
+		phLen = perfhashSerializedSize(pData->d.hashtab.hash);
+		lkcPut(&w, &phLen, sizeof(phLen));
+		if((phbuf = lkcReserve(&w, phLen)) != NULL)
+			perfhashSerialize(pData->d.hashtab.hash, phbuf);
+		break;
+	case LOOKUP_TYPE_ARRAY:
+		for(i = 0 ; i < pData->nmemb ; ++i)
+			lkcPutStr(&w, pData->d.arr.vals[i]);
+		break;
+	case LOOKUP_TYPE_CIDR:
+		lkcPutCidr(&w, pData->d.cidr);
+		lkcPut(&w, &end, 1);
+		break;
+	}
+	if(w.bErr) {
+		errmsg.LogError(0, RS_RET_OUT_OF_MEMORY, "lookup table '%s': out of memory "
+			"while writing cache file '%s'", pThis->name, fn);
+		goto done;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, LKC_MAGIC, sizeof(hdr.magic));
+	hdr.hdrSize = sizeof(hdr);
+	hdr.type = pData->type;
+	hdr.nmemb = pData->nmemb;
+	hdr.srcHash = srcHash;
+	hdr.srcLen = srcLen;
+	if(pData->type == LOOKUP_TYPE_ARRAY)
+		hdr.first = pData->d.arr.first;
+	hdr.bodyLen = w.len;
+	hdr.bodyHash = lkcHash(w.buf, w.len);
+
+	/* write to a temporary file first, so a concurrent load never sees a
+	 * partial file
+	 */
+	snprintf(tmpfn, sizeof(tmpfn), "%s.tmp.%d", fn, (int) getpid());
+	if((fp = fopen(tmpfn, "w")) == NULL) {
+		errmsg.LogError(0, RS_RET_FOPEN_FAILURE, "lookup table '%s': cannot create "
+			"cache file '%s': %s", pThis->name, tmpfn,
+			rs_strerror_r(errno, errStr, sizeof(errStr)));
+		goto done;
+	}
+	bErr = fwrite(&hdr, sizeof(hdr), 1, fp) != 1 || fwrite(w.buf, 1, w.len, fp) != w.len;
+	eno = errno;
+	if(fclose(fp) != 0 && !bErr) {
+		bErr = 1;
+		eno = errno;
+	}
+	if(!bErr && rename(tmpfn, fn) != 0) {
+		bErr = 1;
+		eno = errno;
+	}
+	if(bErr) {
+		errmsg.LogError(0, RS_RET_IO_ERROR, "lookup table '%s': cannot write "
+			"cache file '%s': %s", pThis->name, fn,
+			rs_strerror_r(eno, errStr, sizeof(errStr)));
+		unlink(tmpfn);
+		goto done;
+	}
+	DBGPRINTF("lookup table '%s': saved to cache file '%s'\n", pThis->name, fn);
+done:
+	free(w.buf);
+}
+
+static inline int
+lkcGet(lkc_reader_t *r, void *p, size_t len)
+{
+	if(r->left < len)
+		return 0;
+	memcpy(p, r->p, len);
+	r->p += len;
+	r->left -= len;
+	return 1;
+}
+
+/* read a string into a new buffer. *pStr is NULL for holes, which are
+ * only valid if bHoleOK is set.
+ */
+static rsRetVal
+lkcGetStr(lkc_reader_t *r, uchar **pStr, sbool bHoleOK)
+{
+	uint32_t len;
+	DEFiRet;
+
+	*pStr = NULL;
+	if(!lkcGet(r, &len, sizeof(len)))
+		ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+	if(len == LKC_NOSTR) {
+		if(!bHoleOK)
+			ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+		FINALIZE;
+	}
+	if(len > r->left)
+		ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+	CHKmalloc(*pStr = malloc(len + 1));
+	lkcGet(r, *pStr, len);
+	(*pStr)[len] = '\0';
+finalize_it:
+	RETiRet;
+}
+
+static rsRetVal
+lkcGetCidr(lkc_reader_t *r, lookup_data_t *pData)
+{
+	uint8_t prefixLen;
+	uint8_t addr[16];
+	uchar *val;
+	sbool bUsed;
+	DEFiRet;
+
+	while(1) {
+		if(!lkcGet(r, &prefixLen, 1))
+			ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+		if(prefixLen == LKC_CIDR_END)
+			break;
+		if(prefixLen > 128 || !lkcGet(r, addr, 16))
+			ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+		CHKiRet(lkcGetStr(r, &val, 0));
+		iRet = cidrInsert(&pData->d.cidr, addr, prefixLen, val, &bUsed);
+		if(!bUsed)
+			free(val);
+		CHKiRet(iRet);
+	}
+finalize_it:
+	RETiRet;
+}
+
+static rsRetVal
+lkcGetBody(lkc_reader_t *r, lookup_data_t *pData)
+{
+	uint64_t phLen;
+	uint32_t i;
+	DEFiRet;
+
+	CHKiRet(lkcGetStr(r, &pData->nomatch, 0));
+	/* each entry takes at least 4 bytes, this bounds our allocations */
+	if(pData->nmemb > r->left / sizeof(uint32_t))
+		ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+	switch(pData->type) {
+	case LOOKUP_TYPE_STRING:
+		CHKmalloc(pData->d.strtab = calloc(pData->nmemb + 1, sizeof(lookup_string_tab_etry_t)));
+		for(i = 0 ; i < pData->nmemb ; ++i) {
+			CHKiRet(lkcGetStr(r, &pData->d.strtab[i].key, 0));
+			CHKiRet(lkcGetStr(r, &pData->d.strtab[i].val, 0));
+		}
+		break;
+	case LOOKUP_TYPE_HASH:
+		CHKmalloc(pData->d.hashtab.vals = calloc(pData->nmemb + 1, sizeof(uchar*)));
+		for(i = 0 ; i < pData->nmemb ; ++i)
+			CHKiRet(lkcGetStr(r, &pData->d.hashtab.vals[i], 0));
+		if(!lkcGet(r, &phLen, sizeof(phLen)) || phLen > r->left)
+			ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+		CHKiRet(perfhashDeserialize(&pData->d.hashtab.hash, r->p, phLen, (int) pData->nmemb));
+		r->p += phLen;
+		r->left -= phLen;
+		break;
+	case LOOKUP_TYPE_ARRAY:
+		CHKmalloc(pData->d.arr.vals = calloc(pData->nmemb + 1, sizeof(uchar*)));
+		for(i = 0 ; i < pData->nmemb ; ++i)
+			CHKiRet(lkcGetStr(r, &pData->d.arr.vals[i], 1));
+		break;
+	case LOOKUP_TYPE_CIDR:
+		CHKiRet(lkcGetCidr(r, pData));
+		break;
+	default:
+		ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+	}
+	if(r->left != 0)
+		ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+finalize_it:
+	RETiRet;
+}
+
+/* load the table from the cache, if the cache file matches the JSON file.
+ * Returns RS_RET_NOT_FOUND if it does not.
+ */
+static rsRetVal
+lookupCacheLoad(lookup_t *pThis, uint64_t srcHash, uint64_t srcLen, lookup_data_t **ppData)
+{
+	char fn[4096];
+	lookup_data_t *pData = NULL;
+	uchar *buf = NULL;
+	lkc_reader_t r;
+	lkc_hdr_t hdr;
+	struct stat sb;
+	ssize_t nread;
+	int fd = -1;
+	DEFiRet;
+
+	CHKiRet(lkcFileName(pThis, fn, sizeof(fn)));
+	if((fd = open(fn, O_RDONLY)) == -1 || fstat(fd, &sb) == -1
+	   || sb.st_size < (off_t) sizeof(hdr))
+		ABORT_FINALIZE(RS_RET_NOT_FOUND);
+	CHKmalloc(buf = malloc(sb.st_size));
+	nread = read(fd, buf, sb.st_size);
+	if(nread != (ssize_t) sb.st_size)
+		ABORT_FINALIZE(RS_RET_NOT_FOUND);
+	memcpy(&hdr, buf, sizeof(hdr));
+	if(   memcmp(hdr.magic, LKC_MAGIC, sizeof(hdr.magic))
+	   || hdr.hdrSize != sizeof(hdr)
+	   || hdr.srcHash != srcHash || hdr.srcLen != srcLen
+	   || hdr.bodyLen != (uint64_t) sb.st_size - sizeof(hdr)
+	   || hdr.bodyHash != lkcHash(buf + sizeof(hdr), hdr.bodyLen))
+		ABORT_FINALIZE(RS_RET_NOT_FOUND);
+
+	CHKmalloc(pData = calloc(1, sizeof(lookup_data_t)));
+	pData->type = (uint8_t) hdr.type;
+	pData->nmemb = hdr.nmemb;
+	if(hdr.type == LOOKUP_TYPE_ARRAY)
+		pData->d.arr.first = hdr.first;
+	r.p = buf + sizeof(hdr);
+	r.left = hdr.bodyLen;
+	if(hdr.type > LOOKUP_TYPE_CIDR || lkcGetBody(&r, pData) != RS_RET_OK)
+		ABORT_FINALIZE(RS_RET_NOT_FOUND);
+	DBGPRINTF("lookup table '%s' loaded from cache file '%s', %u entries\n",
+		  pThis->name, fn, pData->nmemb);
+	*ppData = pData;
+
+finalize_it:
+	if(fd != -1)
+		close(fd);
+	free(buf);
+	if(iRet != RS_RET_OK) {
+		if(iRet == RS_RET_NOT_FOUND)
+			DBGPRINTF("lookup table '%s': no valid cache file '%s'\n", pThis->name, fn);
+		lookupDataDestruct(pData);
+	}
+	RETiRet;
+}
+
 
 /* find a lookup table. This is a naive O(n) algo, but this really
  * doesn't matter as it is called only a few times during config
@@ -178,38 +1118,28 @@ lookupFindTable(uchar *name)
 }
 
 
-/* this reloads a lookup table. This is done while the engine is running,
- * as such the function must ensure proper locking and proper order of
- * operations (so that nothing can interfere). If the table cannot be loaded,
- * the old table is continued to be used.
+/* this reloads a lookup table. This is done while the engine is running.
+ * The new table is completely built before it replaces the current one,
+ * so lookups continue to use the old table in the meantime. If the table
+ * cannot be loaded, the old table is continued to be used. If the binary
+ * table file did not change since it was last mapped, nothing is done.
  */
 static rsRetVal
 lookupReload(lookup_t *pThis)
 {
-	uint32_t i;
-	lookup_t newlu; /* dummy to be able to use support functions without 
-	                   affecting current settings. */
+	lookup_data_t *pNew;
 	DEFiRet;
 	
 	DBGPRINTF("reload requested for lookup table '%s'\n", pThis->name);
-	memset(&newlu, 0, sizeof(newlu));
-	CHKmalloc(newlu.name = ustrdup(pThis->name));
-	CHKmalloc(newlu.filename = ustrdup(pThis->filename));
-	CHKiRet(lookupReadFile(&newlu));
-	/* all went well, copy over data members */
-	pthread_rwlock_wrlock(&pThis->rwlock);
-	for(i = 0 ; i < pThis->nmemb ; ++i) {
-		free(pThis->d.strtab[i].key), /* we don't care about exec order of frees */
-		free(pThis->d.strtab[i].val);
+	CHKiRet(lookupReadFile(pThis, &pNew));
+	if(pNew == NULL) {
+		DBGPRINTF("lookup table '%s' unchanged, not reloaded\n", pThis->name);
+		FINALIZE;
 	}
-	free(pThis->d.strtab);
-	pThis->d.strtab = newlu.d.strtab; /* hand table AND ALL STRINGS over! */
-	pthread_rwlock_unlock(&pThis->rwlock);
+	lookupPublish(pThis, pNew);
 	errmsg.LogError(0, RS_RET_OK, "lookup table '%s' reloaded from file '%s'",
 			pThis->name, pThis->filename);
 finalize_it:
-	free(newlu.name);
-	free(newlu.filename);
 	RETiRet;
 }
 
@@ -220,75 +1150,219 @@ lookupDoHUP()
 {
 	lookup_t *lu;
 	for(lu = loadConf->lu_tabs.root ; lu != NULL ; lu = lu->next) {
-		lookupReload(lu);
+		if(lu->reloadOnHUP)
+			lookupReload(lu);
 	}
 }
 
 
-/* returns either a pointer to the value (read only!) or NULL
- * if either the key could not be found or an error occured.
- * Note that an estr_t object is returned. The caller is 
- * responsible for freeing it.
+/* binary search in a mmap()ed string table */
+static const uchar *
+lkbLookupString(lookup_data_t *pData, const uchar *key)
+{
+	const uint64_t *const idx = pData->d.bin;
+	uint32_t lo = 0, hi = pData->nmemb, mid;
+	int c;
+
+	while(lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		c = ustrcmp(key, pData->map + idx[2 * mid]);
+		if(c == 0)
+			return pData->map + idx[2 * mid + 1];
+		if(c < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return NULL;
+}
+
+/* returns the value for key (or the nomatch value, if the key could not
+ * be found) as a new estr_t object. The caller is responsible for
+ * freeing it.
  */
 es_str_t *
 lookupKey_estr(lookup_t *pThis, uchar *key)
 {
 	lookup_string_tab_etry_t *etry;
-	char *r;
+	uint8_t addr[16];
+	long long n;
+	int i;
+	char *r = NULL;
 	es_str_t *estr;
+	lookup_data_t *pData;
+	lookup_reader_t *rdr;
 
-	pthread_rwlock_rdlock(&pThis->rwlock);
-	etry = bsearch(key, pThis->d.strtab, pThis->nmemb, sizeof(lookup_string_tab_etry_t), bs_arrcmp_strtab);
-	if(etry == NULL) {
-		r = ""; // TODO: use set default 
-	} else {
-		r = (char*)etry->val;
+	if((pData = lookupReadBegin(pThis, &rdr)) == NULL) {
+		lookupReadEnd(pThis, rdr);
+		return es_newStrFromCStr("", 0);
 	}
+	switch(pData->type) {
+	case LOOKUP_TYPE_STRING:
+		if(pData->map != NULL) {
+			r = (char*)lkbLookupString(pData, key);
+			break;
+		}
+		etry = bsearch(key, pData->d.strtab, pData->nmemb, sizeof(lookup_string_tab_etry_t),
+			       bs_arrcmp_strtab);
+		if(etry != NULL)
+			r = (char*)etry->val;
+		break;
+	case LOOKUP_TYPE_HASH:
+		if((i = perfhashLookup(pData->d.hashtab.hash, key, ustrlen(key))) != -1)
+			r = (char*)pData->d.hashtab.vals[i];
+		break;
+	case LOOKUP_TYPE_ARRAY:
+		if(lookupParseInt((char*)key, &n) && n >= pData->d.arr.first
+		   && n - pData->d.arr.first < (long long) pData->nmemb) {
+			if(pData->map == NULL)
+				r = (char*)pData->d.arr.vals[n - pData->d.arr.first];
+			else if(pData->d.bin[n - pData->d.arr.first] != 0)
+				r = (char*)pData->map + pData->d.bin[n - pData->d.arr.first];
+		}
+		break;
+	case LOOKUP_TYPE_CIDR:
+		if(cidrParse((char*)key, addr, NULL))
+			r = (char*)cidrLookup(pData->d.cidr, addr);
+		break;
+	}
+	if(r == NULL)
+		r = (pData->nomatch == NULL) ? "" : (char*)pData->nomatch;
 	estr = es_newStrFromCStr(r, strlen(r));
-	pthread_rwlock_unlock(&pThis->rwlock);
+	lookupReadEnd(pThis, rdr);
 	return estr;
 }
 
 
+/* map a binary table file (see lookup.h). The index is checked, so that a
+ * damaged file cannot make lookups access memory outside the mapping; the
+ * strings themselves are not looked at, this is what makes loading fast.
+ */
+static rsRetVal
+lookupMapFile(lookup_t *pThis, int fd, struct stat *sb, lookup_data_t **ppData)
+{
+	lookup_data_t *pData = NULL;
+	void *map;
+	lkb_hdr_t hdr;
+	uint64_t nOffs, i, offs;
+	char errStr[1024];
+	DEFiRet;
+
+	if((map = mmap(NULL, sb->st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		errmsg.LogError(0, RS_RET_IO_ERROR, "lookup table file '%s' could not be "
+			"mapped: %s", pThis->filename, rs_strerror_r(errno, errStr, sizeof(errStr)));
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+	CHKmalloc(pData = calloc(1, sizeof(lookup_data_t)));
+	pData->map = map;
+	pData->mapLen = sb->st_size;
+
+	memcpy(&hdr, map, sizeof(hdr));
+	nOffs = (hdr.type == LOOKUP_TYPE_STRING) ? 2 * (uint64_t) hdr.nmemb : hdr.nmemb;
+	if(   memcmp(hdr.magic, LKB_MAGIC, sizeof(hdr.magic))
+	   || hdr.hdrSize != sizeof(hdr)
+	   || (hdr.type != LOOKUP_TYPE_STRING && hdr.type != LOOKUP_TYPE_ARRAY)
+	   || hdr.fileLen != (uint64_t) sb->st_size
+	   || hdr.index < sizeof(hdr) || hdr.index % sizeof(uint64_t) != 0
+	   || hdr.strings > hdr.fileLen
+	   || hdr.index > hdr.strings
+	   || (hdr.strings - hdr.index) / sizeof(uint64_t) < nOffs
+	   || hdr.nomatch < hdr.strings || hdr.nomatch >= hdr.fileLen
+	   || pData->map[hdr.fileLen - 1] != '\0')
+		goto invalid;
+	pData->d.bin = (const uint64_t*) (pData->map + hdr.index);
+	for(i = 0 ; i < nOffs ; ++i) {
+		offs = pData->d.bin[i];
+		if((offs < hdr.strings || offs >= hdr.fileLen)
+		   && !(offs == 0 && hdr.type == LOOKUP_TYPE_ARRAY))
+			goto invalid;
+	}
+
+	pData->type = (uint8_t) hdr.type;
+	pData->nmemb = hdr.nmemb;
+	if(hdr.type == LOOKUP_TYPE_ARRAY)
+		pData->d.arr.first = hdr.first;
+	CHKmalloc(pData->nomatch = (uchar*) strdup((char*) pData->map + hdr.nomatch));
+	pData->mapDev = sb->st_dev;
+	pData->mapIno = sb->st_ino;
+	pData->mapMtime = sb->st_mtime;
+	DBGPRINTF("lookup table '%s' mapped from binary file '%s', %u entries\n",
+		  pThis->name, pThis->filename, pData->nmemb);
+	*ppData = pData;
+	FINALIZE;
+
+invalid:
+	errmsg.LogError(0, RS_RET_INVALID_VALUE, "lookup table file '%s' is not a valid "
+		"binary table file for this system", pThis->filename);
+	iRet = RS_RET_INVALID_VALUE;
+
+finalize_it:
+	if(iRet != RS_RET_OK) {
+		if(pData != NULL)
+			lookupDataDestruct(pData);
+		else if(map != MAP_FAILED)
+			munmap(map, sb->st_size);
+	}
+	RETiRet;
+}
+
+
 /* note: widely-deployed json_c 0.9 does NOT support incremental
  * parsing. In order to keep compatible with e.g. Ubuntu 12.04LTS,
  * we read the file into one big memory buffer and parse it at once.
  * While this is not very elegant, it will not pose any real issue
  * for "reasonable" lookup tables (and "unreasonably" large ones
  * will probably have other issues as well...).
+ * Binary table files are detected by their magic and mmap()ed instead.
+ * If a binary table file is already mapped and did not change, *ppData
+ * is set to NULL.
  */
 static rsRetVal
-lookupReadFile(lookup_t *pThis)
+lookupReadFile(lookup_t *pThis, lookup_data_t **ppData)
 {
 	struct json_tokener *tokener = NULL;
 	struct json_object *json = NULL;
 	int eno = errno;
 	char errStr[1024];
 	char *iobuf = NULL;
-	int fd;
+	char magic[sizeof(LKB_MAGIC) - 1];
+	int fd = -1;
 	ssize_t nread;
 	struct stat sb;
+	uint64_t srcHash = 0;
+	lookup_data_t *pCurr = pThis->data;
 	DEFiRet;
 
 
-	if(stat((char*)pThis->filename, &sb) == -1) {
+	if((fd = open((const char*) pThis->filename, O_RDONLY)) == -1) {
 		eno = errno;
 		errmsg.LogError(0, RS_RET_FILE_NOT_FOUND,
-			"lookup table file '%s' stat failed: %s",
+			"lookup table file '%s' could not be opened: %s",
 			pThis->filename, rs_strerror_r(eno, errStr, sizeof(errStr)));
 		ABORT_FINALIZE(RS_RET_FILE_NOT_FOUND);
 	}
-
-	CHKmalloc(iobuf = malloc(sb.st_size));
-
-	if((fd = open((const char*) pThis->filename, O_RDONLY)) == -1) {
+	if(fstat(fd, &sb) == -1) {
 		eno = errno;
 		errmsg.LogError(0, RS_RET_FILE_NOT_FOUND,
-			"lookup table file '%s' could not be opened: %s",
+			"lookup table file '%s' stat failed: %s",
 			pThis->filename, rs_strerror_r(eno, errStr, sizeof(errStr)));
 		ABORT_FINALIZE(RS_RET_FILE_NOT_FOUND);
 	}
 
+	if(sb.st_size >= (off_t) sizeof(lkb_hdr_t)
+	   && pread(fd, magic, sizeof(magic), 0) == (ssize_t) sizeof(magic)
+	   && !memcmp(magic, LKB_MAGIC, sizeof(magic))) {
+		if(pCurr != NULL && pCurr->map != NULL && pCurr->mapDev == sb.st_dev
+		   && pCurr->mapIno == sb.st_ino && pCurr->mapLen == (size_t) sb.st_size
+		   && pCurr->mapMtime == sb.st_mtime) {
+			*ppData = NULL;
+			FINALIZE;
+		}
+		CHKiRet(lookupMapFile(pThis, fd, &sb, ppData));
+		FINALIZE;
+	}
+
+	CHKmalloc(iobuf = malloc(sb.st_size));
 	tokener = json_tokener_new();
 	nread = read(fd, iobuf, sb.st_size);
 	if(nread != (ssize_t) sb.st_size) {
@@ -299,6 +1373,12 @@ lookupReadFile(lookup_t *pThis)
 		ABORT_FINALIZE(RS_RET_READ_ERR);
 	}
 
+	if(pThis->cachedir != NULL) {
+		srcHash = lkcHash((uchar*) iobuf, sb.st_size);
+		if(lookupCacheLoad(pThis, srcHash, sb.st_size, ppData) == RS_RET_OK)
+			FINALIZE;
+	}
+
 	json = json_tokener_parse_ex(tokener, iobuf, sb.st_size);
 	if(json == NULL) {
 		errmsg.LogError(0, RS_RET_JSON_PARSE_ERR,
@@ -310,9 +1390,13 @@ lookupReadFile(lookup_t *pThis)
 	iobuf = NULL; /* make sure no double-free */
 
 	/* got json object, now populate our own in-memory structure */
-	CHKiRet(lookupBuildTable(pThis, json));
+	CHKiRet(lookupBuildTable(pThis, json, ppData));
+	if(pThis->cachedir != NULL)
+		lookupCacheWrite(pThis, *ppData, srcHash, sb.st_size);
 
 finalize_it:
+	if(fd != -1)
+		close(fd);
 	free(iobuf);
 	if(tokener != NULL)
 		json_tokener_free(tokener);
@@ -346,12 +1430,16 @@ lookupProcessCnf(struct cnfobj *o)
 			CHKmalloc(lu->filename = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL));
 		} else if(!strcmp(modpblk.descr[i].name, "name")) {
 			CHKmalloc(lu->name = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL));
+		} else if(!strcmp(modpblk.descr[i].name, "cachedirectory")) {
+			CHKmalloc(lu->cachedir = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL));
+		} else if(!strcmp(modpblk.descr[i].name, "reloadonhup")) {
+			lu->reloadOnHUP = (sbool) pvals[i].val.d.n;
 		} else {
 			dbgprintf("lookup_table: program error, non-handled "
 			  "param '%s'\n", modpblk.descr[i].name);
 		}
 	}
-	CHKiRet(lookupReadFile(lu));
+	CHKiRet(lookupReadFile(lu, &lu->data));
 	DBGPRINTF("lookup table '%s' loaded from file '%s'\n", lu->name, lu->filename);
 
 finalize_it:
@@ -362,6 +1450,17 @@ finalize_it:
 void
 lookupClassExit(void)
 {
+#ifdef HAVE_ATOMIC_BUILTINS
+	lookup_reader_t *rdr, *del;
+
+	pthread_key_delete(keyLookupReader);
+	for(rdr = lookupReaders ; rdr != NULL ; ) {
+		del = rdr;
+		rdr = rdr->next;
+		free(del);
+	}
+	lookupReaders = NULL;
+#endif
 	objRelease(glbl, CORE_COMPONENT);
 	objRelease(errmsg, CORE_COMPONENT);
 }
@@ -373,6 +1472,9 @@ lookupClassInit(void)
 	CHKiRet(objGetObjInterface(&obj));
 	CHKiRet(objUse(glbl, CORE_COMPONENT));
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
+#ifdef HAVE_ATOMIC_BUILTINS
+	pthread_key_create(&keyLookupReader, lookupReaderRelease);
+#endif
 finalize_it:
 	RETiRet;
 }
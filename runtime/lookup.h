@@ -20,7 +20,9 @@
  */
 #ifndef INCLUDED_LOOKUP_H
 #define INCLUDED_LOOKUP_H
+#include <sys/types.h>
 #include <libestr.h>
+#include "perfhash.h"
 
 struct lookup_tables_s {
 	lookup_t *root;	/* the root of the template list */
@@ -32,15 +34,88 @@ struct lookup_string_tab_etry_s {
 	uchar *val;
 };
 
-/* a single lookup table */
-struct lookup_s {
-	pthread_rwlock_t rwlock;	/* protect us in case of dynamic reloads */
-	uchar *name;
-	uchar *filename;
+/* table types, selected by "type" in the table file */
+#define LOOKUP_TYPE_STRING 0	/* sorted strings, binary search */
+#define LOOKUP_TYPE_HASH 1	/* strings, (perfect) hash table */
+#define LOOKUP_TYPE_ARRAY 2	/* integer keys, direct indexing */
+#define LOOKUP_TYPE_CIDR 3	/* IPv4/IPv6 networks, longest prefix match */
+
+/* max index range of an array table with nmemb entries */
+#define LOOKUP_ARRAY_MAXSPAN(nmemb) (4 * (long long) (nmemb) + 1024)
+
+/* node of the path-compressed binary (Patricia) trie for CIDR tables.
+ * IPv4 networks are stored as IPv4-mapped IPv6 networks.
+ */
+typedef struct lookup_cidr_node_s lookup_cidr_node_t;
+struct lookup_cidr_node_s {
+	uint8_t addr[16];	/* network address, bits beyond prefixLen are zero */
+	uint8_t prefixLen;
+	uchar *val;		/* NULL for pure branching nodes */
+	lookup_cidr_node_t *child[2];
+};
+
+/* Binary table files, created by rslookuputil from the JSON form. They
+ * are mmap()ed read-only and used in place, so loading them is fast, no
+ * memory besides the page cache is needed and all processes using a table
+ * share it. Only "string" and "array" tables are supported. The format is
+ * native-endian. All offsets are relative to the start of the file.
+ * The index follows the header; for string tables, it consists of nmemb
+ * (key, value) pairs of string offsets, sorted by key (strcmp() order),
+ * for array tables of nmemb value offsets (0 for holes). It is followed by
+ * the string area, which holds NUL-terminated strings and ends with a NUL.
+ * Files must be replaced via rename(), never modified in place, while
+ * rsyslog uses them.
+ */
+#define LKB_MAGIC "RSLKB01\n"
+typedef struct lkb_hdr_s {
+	char magic[8];
+	uint32_t hdrSize;	/* catches differing struct layouts */
+	uint32_t type;
+	uint32_t nmemb;
+	uint32_t reserved;
+	int64_t first;		/* array tables only: index of entry 0 */
+	uint64_t nomatch;	/* offset of the nomatch string */
+	uint64_t index;
+	uint64_t strings;
+	uint64_t fileLen;
+} lkb_hdr_t;
+
+/* the data of a lookup table, replaced as a whole on reload */
+struct lookup_data_s {
+	uint8_t type;
 	uint32_t nmemb;
+	uchar *nomatch;
+	const uchar *map;	/* mmap()ed binary table file, NULL if built in memory */
+	size_t mapLen;
+	dev_t mapDev;		/* identity of the mapped file, to detect changes */
+	ino_t mapIno;
+	time_t mapMtime;
 	union {
 		lookup_string_tab_etry_t *strtab;
+		struct {
+			perfhash_t *hash;	/* key -> index into vals */
+			uchar **vals;
+		} hashtab;
+		struct {
+			long long first;	/* index of vals[0] */
+			uchar **vals;		/* NULL for holes */
+		} arr;
+		lookup_cidr_node_t *cidr;
+		const uint64_t *bin;	/* binary table files: the index */
 	} d;
+};
+
+/* a single lookup table */
+struct lookup_s {
+	lookup_data_t *data;	/* current table, readers do not lock it */
+#ifndef HAVE_ATOMIC_BUILTINS
+	pthread_rwlock_t rwlock;	/* protects data if we have no atomic instructions */
+#endif
+	uchar *name;
+	uchar *filename;
+	uchar *cachedir;	/* directory for the compiled table, NULL if none */
+	sbool reloadOnHUP;
+	unsigned gen;		/* incremented after each reload, for result caches */
 	lookup_t *next;
 };
 
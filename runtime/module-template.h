@@ -260,6 +260,25 @@ static rsRetVal commitTransaction(wrkrInstanceData_t __attribute__((unused)) *co
 	RETiRet;\
 }
 
+/* commitTransactionAsync()
+ * Optional asynchronous version of commitTransaction(). It may return
+ * RS_RET_IN_FLIGHT, in which case the transaction is completed later by
+ * calling pTx->done(), see actAsyncTx_t. Any other return value is handled
+ * as if it had been returned by commitTransaction(). Must be announced via
+ * CODEqueryEtryPt_OMODTX_ASYNC_QUERIES and requires commitTransaction(),
+ * which is still used where the engine needs a synchronous commit.
+ */
+#define BEGINcommitTransactionAsync \
+static rsRetVal commitTransactionAsync(wrkrInstanceData_t __attribute__((unused)) *const pWrkrData, actWrkrIParams_t *const pParams, const unsigned nParams, actAsyncTx_t *const pTx)\
+{\
+	DEFiRet;
+
+#define CODESTARTcommitTransactionAsync /* currently empty, but may be extended */
+
+#define ENDcommitTransactionAsync \
+	RETiRet;\
+}
+
 /* endTransaction()
  * introduced in v4.3.3 -- rgerhards, 2009-04-27
  */
@@ -550,6 +569,14 @@ static rsRetVal queryEtryPt(uchar *name, rsRetVal (**pEtryPoint)())\
 		*pEtryPoint = freeWrkrInstance;\
 	}
 
+/* the following must be used in addition to CODEqueryEtryPt_STD_OMODTX_QUERIES
+ * by modules that support commitTransactionAsync()
+ */
+#define CODEqueryEtryPt_OMODTX_ASYNC_QUERIES \
+	else if(!strcmp((char*) name, "commitTransactionAsync")) {\
+		*pEtryPoint = commitTransactionAsync;\
+	}
+
 /* the following definition is queryEtryPt block that must be added
  * if an output module supports the transactional interface.
  * rgerhards, 2009-04-27
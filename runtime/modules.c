@@ -713,6 +713,16 @@ doModInit(rsRetVal (*modInit)(int, int*, rsRetVal(**)(), rsRetVal(*)(), modInfo_
 				}
 			}
 
+			/* optional, only used together with commitTransaction() */
+			localRet = (*pNew->modQueryEtryPt)((uchar*)"commitTransactionAsync",
+				   &pNew->mod.om.commitTransactionAsync);
+			if(localRet == RS_RET_MODULE_ENTRY_POINT_NOT_FOUND
+			   || pNew->mod.om.commitTransaction == NULL) {
+				pNew->mod.om.commitTransactionAsync = NULL;
+			} else if(localRet != RS_RET_OK) {
+				ABORT_FINALIZE(localRet);
+			}
+
 
 			localRet = (*pNew->modQueryEtryPt)((uchar*)"endTransaction",
 				   &pNew->mod.om.endTransaction);
@@ -1046,9 +1056,12 @@ findModule(uchar *pModName, int iModNameLen, modInfo_t **pMod)
  * configuration. We could also think if it would be useful to add only certain types
  * of modules, but the current implementation at least looks simpler.
  * Note: pvals = NULL means legacy config system
+ * rqtdType is the module type the caller expects. If the module turns out to be
+ * of some other type, it is loaded but not tied to the config. eMOD_ANY
+ * permits all types.
  */
 static rsRetVal
-Load(uchar *pModName, sbool bConfLoad, struct nvlst *lst)
+doLoad(uchar *pModName, sbool bConfLoad, struct nvlst *lst, eModType_t rqtdType)
 {
 	size_t iPathLen, iModNameLen;
 	int bHasExtension;
@@ -1089,6 +1102,11 @@ Load(uchar *pModName, sbool bConfLoad, struct nvlst *lst)
 	CHKiRet(findModule(pModName, iModNameLen, &pModInfo));
 	if(pModInfo != NULL) {
 		DBGPRINTF("Module '%s' already loaded\n", pModName);
+		if(bConfLoad && rqtdType != eMOD_ANY && pModInfo->eType != rqtdType) {
+			DBGPRINTF("module '%s' is of type %d, not %d as requested\n",
+				  pModName, pModInfo->eType, rqtdType);
+			ABORT_FINALIZE(RS_RET_MOD_UNKNOWN);
+		}
 		if(bConfLoad) {
 			localRet = readyModForCnf(pModInfo, &pNew, &pLast);
 			if(pModInfo->setModCnf != NULL && localRet == RS_RET_OK) {
@@ -1223,6 +1241,16 @@ Load(uchar *pModName, sbool bConfLoad, struct nvlst *lst)
 		ABORT_FINALIZE(RS_RET_MODULE_LOAD_ERR_INIT_FAILED);
 	}
 
+	if(bConfLoad && rqtdType != eMOD_ANY && pModInfo->eType != rqtdType) {
+		/* keep it loaded (like modules loaded for internal reasons), but do
+		 * not activate it - else e.g. an input module would be started
+		 * when its name was given as type of an action.
+		 */
+		DBGPRINTF("module '%s' is of type %d, not %d as requested\n",
+			  pModName, pModInfo->eType, rqtdType);
+		ABORT_FINALIZE(RS_RET_MOD_UNKNOWN);
+	}
+
 	if(bConfLoad) {
 		readyModForCnf(pModInfo, &pNew, &pLast);
 		if(pModInfo->setModCnf != NULL) {
@@ -1248,6 +1276,38 @@ finalize_it:
 	RETiRet;
 }
 
+static rsRetVal
+Load(uchar *pModName, sbool bConfLoad, struct nvlst *lst)
+{
+	return doLoad(pModName, bConfLoad, lst, eMOD_ANY);
+}
+
+
+/* Like FindWithCnfName(), but if the module is not yet part of the config,
+ * try to load it. This is used for action() and input() statements, so that
+ * a module is loaded on its first use and configs do not need to load
+ * modules up front "just in case". As module parameters can only be given
+ * via module(), modules loaded this way use their defaults. Note that the
+ * module is always loaded into the config currently being loaded, so cnf
+ * must be loadConf.
+ */
+static modInfo_t *
+FindOrLoadWithCnfName(rsconf_t *cnf, uchar *name, eModType_t rqtdType)
+{
+	modInfo_t *pMod;
+
+	if((pMod = FindWithCnfName(cnf, name, rqtdType)) != NULL)
+		goto done;
+	/* the type is a module name, not a path */
+	if(*name == '\0' || *name == '.' || strchr((char*)name, '/') != NULL)
+		goto done;
+	DBGPRINTF("module '%s' not yet loaded, loading it on first use\n", name);
+	if(doLoad(name, 1, NULL, rqtdType) != RS_RET_OK)
+		goto done;
+	pMod = FindWithCnfName(cnf, name, rqtdType);
+done:	return pMod;
+}
+
 
 /* the v6+ way of loading modules: process a "module(...)" directive.
  * rgerhards, 2012-06-20
@@ -1401,6 +1461,7 @@ CODESTARTobjQueryInterface(module)
 	pIf->GetStateName = modGetStateName;
 	pIf->PrintList = modPrintList;
 	pIf->FindWithCnfName = FindWithCnfName;
+	pIf->FindOrLoadWithCnfName = FindOrLoadWithCnfName;
 	pIf->UnloadAndDestructAll = modUnloadAndDestructAll;
 	pIf->doModInit = doModInit;
 	pIf->SetModDir = SetModDir;
@@ -135,6 +135,8 @@ struct modInfo_s {
 			 */
 			rsRetVal (*beginTransaction)(void*);
 			rsRetVal (*commitTransaction)(void *const, actWrkrIParams_t *const, const unsigned);
+			rsRetVal (*commitTransactionAsync)(void *const, actWrkrIParams_t *const, const unsigned,
+							   actAsyncTx_t *const);
 			rsRetVal (*doAction)(uchar**, void*);
 			rsRetVal (*endTransaction)(void*);
 			rsRetVal (*parseSelectorAct)(uchar**, void**,omodStringRequest_t**);
@@ -176,8 +178,9 @@ BEGINinterface(module) /* name must also be changed in ENDinterface macro! */
 	rsRetVal (*Load)(uchar *name, sbool bConfLoad, struct nvlst *lst);
 	rsRetVal (*SetModDir)(uchar *name);
 	modInfo_t *(*FindWithCnfName)(rsconf_t *cnf, uchar *name, eModType_t rqtdType); /* added v3, 2011-07-19 */
+	modInfo_t *(*FindOrLoadWithCnfName)(rsconf_t *cnf, uchar *name, eModType_t rqtdType); /* v5 added */
 ENDinterface(module)
-#define moduleCURR_IF_VERSION 4 /* increment whenever you change the interface structure! */
+#define moduleCURR_IF_VERSION 5 /* increment whenever you change the interface structure! */
 /* Changes: 
  * v2 
  * - added param bCondLoad to Load call - 2011-04-27
@@ -185,6 +188,8 @@ ENDinterface(module)
  * v3 (see above)
  * v4
  * - added third parameter to Load() - 2012-06-20
+ * v5
+ * - added FindOrLoadWithCnfName()
  */
 
 /* prototypes */
@@ -35,6 +35,7 @@
 #include <string.h>
 #include <assert.h>
 #include <ctype.h>
+#include <sched.h>
 #include <sys/socket.h>
 #if HAVE_SYSINFO_UPTIME
 #include <sys/sysinfo.h>
@@ -63,9 +64,12 @@
 #include "ruleset.h"
 #include "prop.h"
 #include "net.h"
+#include "dnscache.h"
 #include "var.h"
 #include "rsconf.h"
 #include "parserif.h"
+#include "statsobj.h"
+#include "escape.h"
 
 /* TODO: move the global variable root to the config object - had no time to to it
  * right now before vacation -- rgerhards, 2013-07-22
@@ -79,8 +83,9 @@ DEFobjCurrIf(datetime)
 DEFobjCurrIf(glbl)
 DEFobjCurrIf(regexp)
 DEFobjCurrIf(prop)
-DEFobjCurrIf(net)
 DEFobjCurrIf(var)
+DEFobjCurrIf(strm)
+DEFobjCurrIf(statsobj)
 
 static char *two_digits[100] = {
 	"00", "01", "02", "03", "04", "05", "06", "07", "08", "09",
@@ -291,9 +296,6 @@ static struct {
 	{ UCHAR_CONSTANT("190"), 5},
 	{ UCHAR_CONSTANT("191"), 5}
 	};
-static char hexdigit[16] =
-	{'0', '1', '2', '3', '4', '5', '6', '7', '8',
-	 '9', 'A', 'B', 'C', 'D', 'E', 'F' };
 
 /*syslog facility names (as of RFC5424) */
 static char *syslog_fac_names[24] = { "kern", "user", "mail", "daemon", "auth", "syslog", "lpr",
@@ -326,10 +328,42 @@ static pthread_mutex_t mutTrimCtr;	 /* mutex to handle malloc trim */
 static int getAPPNAMELen(msg_t * const pM, sbool bLockMutex);
 static rsRetVal jsonPathFindParent(struct json_object *jroot, uchar *name, uchar *leaf, struct json_object **parent, int bCreate);
 static uchar * jsonPathGetLeaf(uchar *name, int lenName);
+static struct json_object *jsonPropFind(struct json_object *jroot, msgPropDescr_t *pProp);
 static struct json_object *jsonDeepCopy(struct json_object *src);
 
 
-/* the locking and unlocking implementations: */
+/* the locking and unlocking implementations:
+ * The message lock only guards the computation of lazily generated properties
+ * (formatted timestamps, emulated TAG, APP-NAME and PROCID, DNS resolution
+ * and the like) as well as modifications of the JSON trees. Lazy properties
+ * are published via a pointer (or length) that is set only after the value
+ * is complete, so that readers check this without the lock and need to take
+ * it only the first time a property is requested. As the lock is held just
+ * for a few hundred instructions and is rarely contended, we use a simple
+ * spin lock if we have atomics, which saves the (much larger) pthread mutex
+ * inside each message and the library calls.
+ */
+#ifdef HAVE_ATOMIC_BUILTINS
+#define MSG_LOCK_SPINS 100	/* spins before we yield the CPU */
+static inline void
+MsgLock(msg_t *pThis)
+{
+	int nSpins = 0;
+	/* DEV debug only! dbgprintf("MsgLock(0x%lx)\n", (unsigned long) pThis); */
+	while(ATOMIC_STORE_1_TO_32BIT(pThis->iLock)) {
+		if(++nSpins == MSG_LOCK_SPINS) {
+			sched_yield();
+			nSpins = 0;
+		}
+	}
+}
+static inline void
+MsgUnlock(msg_t *pThis)
+{
+	/* DEV debug only! dbgprintf("MsgUnlock(0x%lx)\n", (unsigned long) pThis); */
+	ATOMIC_STORE_0_TO_32BIT(pThis->iLock);
+}
+#else
 static inline void
 MsgLock(msg_t *pThis)
 {
@@ -342,6 +376,7 @@ MsgUnlock(msg_t *pThis)
 	/* DEV debug only! dbgprintf("MsgUnlock(0x%lx)\n", (unsigned long) pThis); */
 	pthread_mutex_unlock(&pThis->mut);
 }
+#endif
 
 
 /* set RcvFromIP name in msg object WITHOUT calling AddRef.
@@ -366,12 +401,14 @@ void MsgSetRcvFromWithoutAddRef(msg_t *pThis, prop_t *new)
 	if(pThis->msgFlags & NEEDS_DNSRESOL) {
 		if(pThis->rcvFrom.pfrominet != NULL)
 			free(pThis->rcvFrom.pfrominet);
+		pThis->rcvFrom.pRcvFrom = new;
+		ATOMIC_BARRIER(); /* the flag is checked without lock, see resolveDNS() */
 		pThis->msgFlags &= ~NEEDS_DNSRESOL;
 	} else {
 		if(pThis->rcvFrom.pRcvFrom != NULL)
 			prop.Destruct(&pThis->rcvFrom.pRcvFrom);
+		pThis->rcvFrom.pRcvFrom = new;
 	}
-	pThis->rcvFrom.pRcvFrom = new;
 }
 
 
@@ -385,35 +422,41 @@ MsgSetRulesetByName(msg_t * const pMsg, cstr_t *rulesetName)
 }
 
 /* do a DNS reverse resolution, if not already done, reflect status
+ * The lookup itself is done without holding the message lock, as it may
+ * take considerable time. If some other thread resolved the name in the
+ * mean time, we discard our result.
  * rgerhards, 2009-11-16
  */
 static inline rsRetVal
 resolveDNS(msg_t * const pMsg) {
 	rsRetVal localRet;
-	prop_t *propFromHost = NULL;
 	prop_t *ip;
 	prop_t *localName;
+	struct sockaddr_storage frominet;
 	DEFiRet;
 
+	if(!(pMsg->msgFlags & NEEDS_DNSRESOL))
+		return RS_RET_OK; /* the usual case, already resolved */
+
 	MsgLock(pMsg);
-	CHKiRet(objUse(net, CORE_COMPONENT));
 	if(pMsg->msgFlags & NEEDS_DNSRESOL) {
-		localRet = net.cvthname(pMsg->rcvFrom.pfrominet, &localName, NULL, &ip);
+		memcpy(&frominet, pMsg->rcvFrom.pfrominet, sizeof(frominet));
+		MsgUnlock(pMsg);
+		/* does not block if background resolvers are configured */
+		localRet = dnscacheLookupNoWait(&frominet, NULL, NULL, &localName, &ip);
+		MsgLock(pMsg);
 		if(localRet == RS_RET_OK) {
-			/* we pass down the props, so no need for AddRef */
-			MsgSetRcvFromWithoutAddRef(pMsg, localName);
-			MsgSetRcvFromIPWithoutAddRef(pMsg, ip);
+			if(pMsg->msgFlags & NEEDS_DNSRESOL) {
+				/* we pass down the props, so no need for AddRef */
+				MsgSetRcvFromIPWithoutAddRef(pMsg, ip);
+				MsgSetRcvFromWithoutAddRef(pMsg, localName);
+			} else {
+				prop.Destruct(&localName);
+				prop.Destruct(&ip);
+			}
 		}
 	}
-finalize_it:
-	if(iRet != RS_RET_OK) {
-		/* best we can do: remove property */
-		MsgSetRcvFromStr(pMsg, UCHAR_CONSTANT(""), 0, &propFromHost);
-		prop.Destruct(&propFromHost);
-	}
 	MsgUnlock(pMsg);
-	if(propFromHost != NULL)
-		prop.Destruct(&propFromHost);
 	RETiRet;
 }
 
@@ -636,629 +679,2222 @@ uchar *propIDToName(propid_t propID)
 }
 
 
-/* This is common code for all Constructors. It is defined in an
- * inline'able function so that we can save a function call in the
- * actual constructors (otherwise, the msgConstruct would need
- * to call msgConstructWithTime(), which would require a
- * function call). Now, both can use this inline function. This
- * enables us to be optimal, but still have the code just once.
- * the new object or NULL if no such object could be allocated.
- * An object constructed via this function should only be destroyed
- * via "msgDestruct()". This constructor does not query system time
- * itself but rather uses a user-supplied value. This enables the caller
- * to do some tricks to save processing time (done, for example, in the
- * udp input).
- * NOTE: this constructor does NOT call calloc(), as we have many bytes
- * inside the structure which do not need to be cleared. bzero() will
- * heavily thrash the cache, so we do the init manually (which also
- * is the right thing to do with pointers, as they are not neccessarily
- * a binary 0 on all machines [but today almost always...]).
- * rgerhards, 2008-10-06
+/* ------------------------------ msg_t object cache ------------------------------ */
+/* Messages are constructed and destructed at a very high rate, and usually by
+ * different threads: an input creates them, queue workers destroy them. To keep
+ * malloc() out of this path, each thread that constructs messages has a cache of
+ * unused msg_t objects. A message remembers the cache it came from and goes back
+ * to it on destruct. The owner thread uses its free list without any locking;
+ * other threads push freed objects onto a lock-free stack, which the owner takes
+ * over as a whole when its free list runs empty. Each cache holds at most
+ * MSG_CACHE_MAX objects on either list, anything beyond is free()d. Caches are never destructed: if a thread
+ * terminates, its cache is handed over to the next thread that needs one.
+ * The cache needs atomic instructions, without them plain malloc() is used.
  */
-static inline rsRetVal msgBaseConstruct(msg_t **ppThis)
+#ifdef HAVE_ATOMIC_BUILTINS
+#define MSG_CACHE_MAX 1024
+
+typedef struct msgCache_s msgCache_t;
+struct msgCache_s {
+	msg_t *pFree;		/* unused objects, owner thread only */
+	int nFree;
+	msg_t *pReturned;	/* objects freed by other threads (lock-free stack) */
+	int nReturned;		/* size of pReturned, may be slightly too large */
+	sbool bOwned;		/* does a thread use this cache? (guarded by mutMsgCaches) */
+	msgCache_t *pNext;	/* list of all caches (guarded by mutMsgCaches) */
+	/* statistics, updated by the owner thread only */
+	uint64 nHits;		/* constructs served from the cache */
+	uint64 nMisses;		/* constructs that needed malloc() */
+	uint64 nReleased;	/* surplus objects free()d */
+};
+
+static pthread_key_t keyMsgCache;
+static pthread_mutex_t mutMsgCaches = PTHREAD_MUTEX_INITIALIZER;
+static msgCache_t *pMsgCaches = NULL;
+static statsobj_t *msgCacheStats;
+static intctr_t ctrCaches;
+static intctr_t ctrCached;
+static intctr_t ctrHits;
+static intctr_t ctrMisses;
+static intctr_t ctrReleased;
+
+
+/* called on thread termination, makes the cache available to other threads */
+static void
+msgCacheDisown(void *pUsr)
 {
-	DEFiRet;
+	msgCache_t *pCache = (msgCache_t*) pUsr;
+
+	pthread_mutex_lock(&mutMsgCaches);
+	pCache->bOwned = 0;
+	pthread_mutex_unlock(&mutMsgCaches);
+}
+
+
+/* get the calling thread's cache, adopt or create one if it has none.
+ * Returns NULL if we are out of memory.
+ */
+static msgCache_t *
+msgCacheGet(void)
+{
+	msgCache_t *pCache;
+
+	if((pCache = (msgCache_t*) pthread_getspecific(keyMsgCache)) != NULL)
+		return pCache;
+
+	pthread_mutex_lock(&mutMsgCaches);
+	for(pCache = pMsgCaches ; pCache != NULL && pCache->bOwned ; pCache = pCache->pNext)
+		/* just search */;
+	if(pCache == NULL && (pCache = calloc(1, sizeof(msgCache_t))) != NULL) {
+		pCache->pNext = pMsgCaches;
+		pMsgCaches = pCache;
+	}
+	if(pCache != NULL) {
+		pCache->bOwned = 1;
+		pthread_setspecific(keyMsgCache, pCache);
+	}
+	pthread_mutex_unlock(&mutMsgCaches);
+	return pCache;
+}
+
+
+static inline void
+msgCacheReleaseObj(msgCache_t *pCache, msg_t *pM)
+{
+	free(pM);
+	if(pCache != NULL)
+		++pCache->nReleased;
+}
+
+
+/* move all objects that other threads have returned to the free list */
+static void
+msgCacheTakeReturned(msgCache_t *pCache)
+{
+	msg_t *pList;
+	msg_t *pM;
+	int n = 0;
+
+	do {
+		pList = pCache->pReturned;
+	} while(!ATOMIC_CAS(&pCache->pReturned, pList, NULL, NULL));
+
+	while(pList != NULL) {
+		pM = pList;
+		pList = pM->cache.pNextFree;
+		++n;
+		if(pCache->nFree < MSG_CACHE_MAX) {
+			pM->cache.pNextFree = pCache->pFree;
+			pCache->pFree = pM;
+			++pCache->nFree;
+		} else {
+			msgCacheReleaseObj(pCache, pM);
+		}
+	}
+	ATOMIC_SUB(&pCache->nReturned, n, NULL);
+}
+
+
+/* get a msg_t object. Only the cache link is initialized. */
+static inline msg_t *
+msgCacheAlloc(void)
+{
+	msgCache_t *pCache;
 	msg_t *pM;
 
-	assert(ppThis != NULL);
-	CHKmalloc(pM = MALLOC(sizeof(msg_t)));
-	objConstructSetObjInfo(pM); /* intialize object helper entities */
+	pCache = msgCacheGet();
+	if(pCache != NULL) {
+		if(pCache->pFree == NULL && pCache->pReturned != NULL)
+			msgCacheTakeReturned(pCache);
+		if((pM = pCache->pFree) != NULL) {
+			pCache->pFree = pM->cache.pNextFree;
+			--pCache->nFree;
+			++pCache->nHits;
+			pM->cache.pCache = pCache;
+			return pM;
+		}
+		++pCache->nMisses;
+	}
 
-	/* initialize members in ORDER they appear in structure (think "cache line"!) */
-	pM->flowCtlType = 0;
-	pM->bParseSuccess = 0;
-	pM->iRefCount = 1;
-	pM->iSeverity = -1;
-	pM->iFacility = -1;
-	pM->iLenPROGNAME = -1;
-	pM->offAfterPRI = 0;
-	pM->offMSG = -1;
-	pM->iProtocolVersion = 0;
-	pM->msgFlags = 0;
-	pM->iLenRawMsg = 0;
-	pM->iLenMSG = 0;
-	pM->iLenTAG = 0;
-	pM->iLenHOSTNAME = 0;
-	pM->pszRawMsg = NULL;
-	pM->pszHOSTNAME = NULL;
-	pM->pszRcvdAt3164 = NULL;
-	pM->pszRcvdAt3339 = NULL;
-	pM->pszRcvdAt_MySQL = NULL;
-        pM->pszRcvdAt_PgSQL = NULL;
-	pM->pszTIMESTAMP3164 = NULL;
-	pM->pszTIMESTAMP3339 = NULL;
-	pM->pszTIMESTAMP_MySQL = NULL;
-        pM->pszTIMESTAMP_PgSQL = NULL;
-	pM->pszStrucData = NULL;
-	pM->pCSAPPNAME = NULL;
-	pM->pCSPROCID = NULL;
-	pM->pCSMSGID = NULL;
-	pM->pInputName = NULL;
-	pM->pRcvFromIP = NULL;
-	pM->rcvFrom.pRcvFrom = NULL;
-	pM->pRuleset = NULL;
-	pM->json = NULL;
-	pM->localvars = NULL;
-	pM->dfltTZ[0] = '\0';
-	memset(&pM->tRcvdAt, 0, sizeof(pM->tRcvdAt));
-	memset(&pM->tTIMESTAMP, 0, sizeof(pM->tTIMESTAMP));
-	pM->TAG.pszTAG = NULL;
-	pM->pszTimestamp3164[0] = '\0';
-	pM->pszTimestamp3339[0] = '\0';
-	pM->pszTIMESTAMP_SecFrac[0] = '\0';
-	pM->pszRcvdAt_SecFrac[0] = '\0';
-	pM->pszTIMESTAMP_Unix[0] = '\0';
-	pM->pszRcvdAt_Unix[0] = '\0';
-	pM->pszUUID = NULL;
-	pthread_mutex_init(&pM->mut, NULL);
+	if((pM = MALLOC(sizeof(msg_t))) == NULL)
+		return NULL;
+	pM->cache.pCache = pCache;
+	return pM;
+}
 
-	/* DEV debugging only! dbgprintf("msgConstruct\t0x%x, ref 1\n", (int)pM);*/
 
-	*ppThis = pM;
+/* give a no longer used msg_t object back to its cache. May be called
+ * by any thread.
+ */
+static inline void
+msgCacheFree(msg_t *pM)
+{
+	msgCache_t *pCache = pM->cache.pCache;
+	msg_t *pHead;
+
+	if(pCache == NULL) {
+		msgCacheReleaseObj(NULL, pM);
+	} else if(pCache == (msgCache_t*) pthread_getspecific(keyMsgCache)) {
+		if(pCache->nFree < MSG_CACHE_MAX) {
+			pM->cache.pNextFree = pCache->pFree;
+			pCache->pFree = pM;
+			++pCache->nFree;
+		} else {
+			msgCacheReleaseObj(pCache, pM);
+		}
+	} else if(ATOMIC_INC_AND_FETCH_int(&pCache->nReturned, NULL) >= MSG_CACHE_MAX) {
+		/* the owner seems not to need that many, avoid hoarding memory */
+		ATOMIC_DEC(&pCache->nReturned, NULL);
+		msgCacheReleaseObj(NULL, pM);
+	} else {
+		do {
+			pHead = pCache->pReturned;
+			pM->cache.pNextFree = pHead;
+		} while(!ATOMIC_CAS(&pCache->pReturned, pHead, pM, NULL));
+	}
+}
+
+
+/* statsobj read notifier: sum up the (unsynchronized) per-cache statistics */
+static void
+msgCacheReadStats(statsobj_t __attribute__((unused)) *pStats, void __attribute__((unused)) *pUsr)
+{
+	msgCache_t *pCache;
+
+	ctrCaches = ctrCached = ctrHits = ctrMisses = ctrReleased = 0;
+	pthread_mutex_lock(&mutMsgCaches);
+	for(pCache = pMsgCaches ; pCache != NULL ; pCache = pCache->pNext) {
+		++ctrCaches;
+		ctrCached += pCache->nFree + pCache->nReturned;
+		ctrHits += pCache->nHits;
+		ctrMisses += pCache->nMisses;
+		ctrReleased += pCache->nReleased;
+	}
+	pthread_mutex_unlock(&mutMsgCaches);
+}
+
+
+static rsRetVal
+msgCacheInit(void)
+{
+	DEFiRet;
+
+	if(pthread_key_create(&keyMsgCache, msgCacheDisown) != 0)
+		ABORT_FINALIZE(RS_RET_ERR);
+
+	CHKiRet(statsobj.Construct(&msgCacheStats));
+	CHKiRet(statsobj.SetName(msgCacheStats, (uchar *)"msgcache"));
+	CHKiRet(statsobj.AddCounter(msgCacheStats, UCHAR_CONSTANT("caches"),
+		ctrType_IntCtr, CTR_FLAG_NONE, &ctrCaches));
+	CHKiRet(statsobj.AddCounter(msgCacheStats, UCHAR_CONSTANT("cached"),
+		ctrType_IntCtr, CTR_FLAG_NONE, &ctrCached));
+	CHKiRet(statsobj.AddCounter(msgCacheStats, UCHAR_CONSTANT("hits"),
+		ctrType_IntCtr, CTR_FLAG_NONE, &ctrHits));
+	CHKiRet(statsobj.AddCounter(msgCacheStats, UCHAR_CONSTANT("misses"),
+		ctrType_IntCtr, CTR_FLAG_NONE, &ctrMisses));
+	CHKiRet(statsobj.AddCounter(msgCacheStats, UCHAR_CONSTANT("released"),
+		ctrType_IntCtr, CTR_FLAG_NONE, &ctrReleased));
+	CHKiRet(statsobj.SetReadNotifier(msgCacheStats, msgCacheReadStats, NULL));
+	CHKiRet(statsobj.ConstructFinalize(msgCacheStats));
 
 finalize_it:
 	RETiRet;
 }
+#endif /* #ifdef HAVE_ATOMIC_BUILTINS */
 
 
-/* "Constructor" for a msg "object". Returns a pointer to
- * the new object or NULL if no such object could be allocated.
- * An object constructed via this function should only be destroyed
- * via "msgDestruct()". This constructor does not query system time
- * itself but rather uses a user-supplied value. This enables the caller
- * to do some tricks to save processing time (done, for example, in the
- * udp input).
- * rgerhards, 2008-10-06
+/* ------------------------------ message tracing ------------------------------ */
+/* Every iMsgTraceSampleRate-th submitted message carries a msgTrace_t, into
+ * which each processing stage writes its (monotonic) timestamp. When the
+ * message is destructed, the time spent between consecutive stages is added
+ * to the "message-trace" statistics. Messages not sampled only pay for the
+ * NULL check in MsgTraceStage().
  */
-rsRetVal msgConstructWithTime(msg_t **ppThis, struct syslogTime *stTime, time_t ttGenTime)
+int iMsgTraceSampleRate = 0;	/* trace every n-th message, 0 = off; set via global() */
+static unsigned iTraceSampleCtr = 0;
+DEF_ATOMIC_HELPER_MUT(mutTraceSampleCtr);
+DEF_ATOMIC_HELPER_MUT64(mutTraceStats);
+static statsobj_t *msgTraceStats;
+static intctr_t ctrTraceSampled;
+static intctr_t ctrTraceUsecs[TRACE_NSTAGES];
+static intctr_t ctrTraceCount[TRACE_NSTAGES];
+static const char *traceStageNames[TRACE_NSTAGES] = {
+	"submit", "mainq.dequeue", "parse", "ruleset", "actionq.dequeue", "action", "commit" };
+
+/* called on submission: decide if pMsg is to be traced and, if so, record
+ * the submit stage. Failing to allocate the trace just means pMsg is not traced.
+ */
+void
+MsgTraceSample(msg_t *pMsg)
+{
+	unsigned n;
+
+	if(iMsgTraceSampleRate == 0 || pMsg->pTrace != NULL)
+		return;
+	n = ATOMIC_INC_AND_FETCH_unsigned(&iTraceSampleCtr, &mutTraceSampleCtr);
+	if(n % iMsgTraceSampleRate != 0)
+		return;
+	if((pMsg->pTrace = calloc(1, sizeof(msgTrace_t))) == NULL)
+		return;
+	pMsg->pTrace->t[TRACE_SUBMIT] = getMonotonicUsecs();
+}
+
+
+/* record a stage; only the first one to reach it counts. Note that two
+ * actions may race here, but both timestamps are equally valid then.
+ */
+void
+msgTraceStamp(msg_t *pMsg, msgTraceStage_t stage)
+{
+	if(pMsg->pTrace->t[stage] == 0)
+		pMsg->pTrace->t[stage] = getMonotonicUsecs();
+}
+
+
+/* account the trace of a message being destructed and free it. Each stage
+ * is accounted as the time since the previous stage that was reached
+ * (stages may be skipped, e.g. if an action has no queue of its own).
+ */
+static void
+msgTraceFinalize(msg_t *pM)
+{
+	msgTrace_t *pTrace = pM->pTrace;
+	uint64_t prev;
+	int i;
+
+	ATOMIC_INC_uint64(&ctrTraceSampled, &mutTraceStats);
+	prev = pTrace->t[TRACE_SUBMIT];
+	for(i = TRACE_SUBMIT + 1 ; i < TRACE_NSTAGES ; ++i) {
+		if(pTrace->t[i] == 0)
+			continue;
+		ATOMIC_ADD_uint64(&ctrTraceUsecs[i], &mutTraceStats, (pTrace->t[i] > prev) ? pTrace->t[i] - prev : 0);
+		ATOMIC_INC_uint64(&ctrTraceCount[i], &mutTraceStats);
+		if(pTrace->t[i] > prev)
+			prev = pTrace->t[i];
+	}
+	free(pTrace);
+	pM->pTrace = NULL;
+}
+
+
+static rsRetVal
+msgTraceInit(void)
 {
+	uchar ctrName[64];
+	int i;
 	DEFiRet;
 
-	CHKiRet(msgBaseConstruct(ppThis));
-	(*ppThis)->ttGenTime = ttGenTime;
-	memcpy(&(*ppThis)->tRcvdAt, stTime, sizeof(struct syslogTime));
-	memcpy(&(*ppThis)->tTIMESTAMP, stTime, sizeof(struct syslogTime));
+	INIT_ATOMIC_HELPER_MUT(mutTraceSampleCtr);
+	INIT_ATOMIC_HELPER_MUT64(mutTraceStats);
+	CHKiRet(statsobj.Construct(&msgTraceStats));
+	CHKiRet(statsobj.SetName(msgTraceStats, (uchar *)"message-trace"));
+	CHKiRet(statsobj.AddCounter(msgTraceStats, UCHAR_CONSTANT("sampled"),
+		ctrType_IntCtr, CTR_FLAG_NONE, &ctrTraceSampled));
+	for(i = TRACE_SUBMIT + 1 ; i < TRACE_NSTAGES ; ++i) {
+		snprintf((char*)ctrName, sizeof(ctrName), "%s.usecs", traceStageNames[i]);
+		CHKiRet(statsobj.AddCounter(msgTraceStats, ctrName,
+			ctrType_IntCtr, CTR_FLAG_NONE, &ctrTraceUsecs[i]));
+		snprintf((char*)ctrName, sizeof(ctrName), "%s.count", traceStageNames[i]);
+		CHKiRet(statsobj.AddCounter(msgTraceStats, ctrName,
+			ctrType_IntCtr, CTR_FLAG_NONE, &ctrTraceCount[i]));
+	}
+	CHKiRet(statsobj.ConstructFinalize(msgTraceStats));
 
 finalize_it:
 	RETiRet;
 }
 
 
-/* "Constructor" for a msg "object". Returns a pointer to
- * the new object or NULL if no such object could be allocated.
- * An object constructed via this function should only be destroyed
- * via "msgDestruct()". This constructor, for historical reasons,
- * also sets the two timestamps to the current time.
+/* ------------------------------ copy-on-write JSON ------------------------------ */
+/* MsgDup() does not copy the JSON trees (json and localvars) of a message but
+ * lets the duplicate share them. All messages sharing the trees point to the
+ * same msgJSONShare_t, which counts them. The trees are read-only as long as
+ * they are shared: a message which needs to modify them first makes its own
+ * copy (or takes over the originals if it is the last one holding them).
+ * Sharing and unsharing are done under the lock of the message in question,
+ * so they are serialized with modifications of its trees. Without atomic
+ * instructions, the trees are always copied.
  */
-rsRetVal msgConstruct(msg_t **ppThis)
+#ifdef HAVE_ATOMIC_BUILTINS
+typedef struct msgJSONShare_s msgJSONShare_t;
+struct msgJSONShare_s {
+	int nRefs;	/* number of messages sharing the trees */
+};
+
+
+/* drop pM's reference to its JSON trees, free them if it was the last one */
+static inline void
+msgReleaseJSON(msg_t * const pM)
 {
-	DEFiRet;
+	if(pM->pJSONShare != NULL) {
+		if(ATOMIC_DEC_AND_FETCH(&pM->pJSONShare->nRefs, NULL) > 0)
+			goto done;
+		free(pM->pJSONShare);
+	}
+	if(pM->json != NULL)
+		json_object_put(pM->json);
+	if(pM->localvars != NULL)
+		json_object_put(pM->localvars);
+done:
+	pM->pJSONShare = NULL;
+	pM->json = NULL;
+	pM->localvars = NULL;
+}
 
-	CHKiRet(msgBaseConstruct(ppThis));
-	/* we initialize both timestamps to contain the current time, so that they
-	 * are consistent. Also, this saves us from doing any further time calls just
-	 * to obtain a timestamp. The memcpy() should not really make a difference,
-	 * especially as I think there is no codepath currently where it would not be
-	 * required (after I have cleaned up the pathes ;)). -- rgerhards, 2008-10-02
-	 */
-	datetime.getCurrTime(&((*ppThis)->tRcvdAt), &((*ppThis)->ttGenTime));
-	memcpy(&(*ppThis)->tTIMESTAMP, &(*ppThis)->tRcvdAt, sizeof(struct syslogTime));
 
+/* let pNew share the JSON trees of pOld. pOld must be locked. */
+static inline rsRetVal
+msgShareJSON(msg_t * const pOld, msg_t * const pNew)
+{
+	DEFiRet;
+	if(pOld->pJSONShare == NULL) {
+		CHKmalloc(pOld->pJSONShare = malloc(sizeof(msgJSONShare_t)));
+		pOld->pJSONShare->nRefs = 1;
+	}
+	ATOMIC_INC(&pOld->pJSONShare->nRefs, NULL);
+	pNew->pJSONShare = pOld->pJSONShare;
+	pNew->json = pOld->json;
+	pNew->localvars = pOld->localvars;
 finalize_it:
 	RETiRet;
 }
 
 
-/* Special msg constructor, to be used when an object is deserialized.
- * we do only the base init as we know the properties will be set in
- * any case by the deserializer. We still do the "inexpensive" inits
- * just to be on the safe side. The whole process needs to be
- * refactored together with the msg serialization subsystem.
+/* make sure pM's JSON trees are not shared, so that they can be modified.
+ * pM must be locked.
  */
-rsRetVal
-msgConstructForDeserializer(msg_t **ppThis)
+static rsRetVal
+msgUnshareJSON(msg_t * const pM)
 {
-	return msgBaseConstruct(ppThis);
+	struct json_object *json = NULL;
+	struct json_object *localvars = NULL;
+	DEFiRet;
+
+	if(pM->pJSONShare == NULL)
+		FINALIZE;
+	if(ATOMIC_FETCH_32BIT(&pM->pJSONShare->nRefs, NULL) == 1) {
+		/* nobody else left, no one can join without locking pM */
+		free(pM->pJSONShare);
+		pM->pJSONShare = NULL;
+		FINALIZE;
+	}
+	if(pM->json != NULL)
+		CHKmalloc(json = jsonDeepCopy(pM->json));
+	if(pM->localvars != NULL)
+		CHKmalloc(localvars = jsonDeepCopy(pM->localvars));
+	msgReleaseJSON(pM);
+	pM->json = json;
+	pM->localvars = localvars;
+	json = localvars = NULL;
+
+finalize_it:
+	if(json != NULL)
+		json_object_put(json);
+	if(localvars != NULL)
+		json_object_put(localvars);
+	RETiRet;
+}
+#endif /* #ifdef HAVE_ATOMIC_BUILTINS */
+
+
+/* ------------------------------ compact $! variables ------------------------------ */
+/* With global(variables.compact="on"), $! variables are not stored in a json-c
+ * tree (which needs one object per value plus one object and hash table per
+ * container) as long as they consist of strings, numbers and booleans only.
+ * Instead, each message has a msgVars_t: an array of entries with the full
+ * path name (like "!usr!msgnum") and the value in string form, with all names
+ * and values kept in a single buffer. Values are replaced in place, so the
+ * order in which variables were first set is preserved.
+ * The json-c tree is only built if it is really needed: when the whole tree
+ * or a container is requested, on unset, for serialization and if a value
+ * is set that can not be represented. Then, the entries are retired. They are
+ * no longer used, but stay allocated until the message is destructed.
+ * A message may already be shared with action queues while a later "set"
+ * statement still adds to it, and adding may realloc() the entries and the
+ * buffer. So both writers and readers access them with the message locked;
+ * only the pVars pointer and bRetired are checked without lock.
+ * Native json-c objects for single values (e.g. for RainerScript) are
+ * created on demand and kept with their entry.
+ */
+#define MSG_VARS_MAXNAME 1023	/* same limit as jsonPathFindNext() */
+
+typedef struct msgVarEntry_s {
+	unsigned hash;		/* of the name */
+	int offName;		/* name and value are stored in pBuf, NUL-terminated */
+	int lenName;
+	int offVal;
+	int lenVal;
+	enum json_type type;	/* json_type_string, _int or _boolean */
+	struct json_object *json; /* value as json-c object, created on demand */
+} msgVarEntry_t;
+
+typedef struct msgVars_s msgVars_t;
+struct msgVars_s {
+	sbool bRetired;		/* converted to json-c, entries are no longer valid */
+	int nEntries;
+	int maxEntries;
+	msgVarEntry_t *pEntries;
+	uchar *pBuf;
+	int lenBuf;
+	int maxBuf;
+};
+
+int bMsgCompactVars = 0;	/* use msgVars_t? set via global() */
+
+static inline unsigned
+msgVarsHash(const uchar *name, int len)
+{
+	unsigned hash = 2166136261u; /* FNV-1a */
+	int i;
+	for(i = 0 ; i < len ; ++i)
+		hash = (hash ^ name[i]) * 16777619u;
+	return hash;
 }
 
+#define msgVarsName(pVars, pEntry) ((pVars)->pBuf + (pEntry)->offName)
+#define msgVarsVal(pVars, pEntry) ((pVars)->pBuf + (pEntry)->offVal)
 
-/* some free handlers for (slightly) complicated cases... All of them may be called
- * with an empty element.
+/* returns the active compact variables of pM, or NULL if there are none */
+static inline msgVars_t *
+msgVarsActive(msg_t * const pM)
+{
+	msgVars_t *pVars = pM->pVars;
+	return (pVars == NULL || pVars->bRetired) ? NULL : pVars;
+}
+
+
+/* find the entry for name and check how other entries relate to it:
+ * *pbAncestor is set if a value exists at a path which is a prefix of name
+ * (e.g. "!a" for "!a!b"), *pbChildren if name is a container of existing
+ * values. Either pointer may be NULL if the caller is not interested.
+ * hash must be msgVarsHash(name, len); it is precomputed for properties.
  */
-static inline void freeTAG(msg_t *pThis)
+static msgVarEntry_t *
+msgVarsFindHashed(msgVars_t *pVars, const uchar *name, int len, unsigned hash,
+		  sbool *pbAncestor, sbool *pbChildren)
 {
-	if(pThis->iLenTAG >= CONF_TAG_BUFSIZE)
-		free(pThis->TAG.pszTAG);
+	msgVarEntry_t *pEntry;
+	msgVarEntry_t *pFound = NULL;
+	const uchar *pszEntry;
+	int i;
+
+	if(pbAncestor != NULL)
+		*pbAncestor = 0;
+	if(pbChildren != NULL)
+		*pbChildren = 0;
+	if(pVars == NULL)
+		return NULL;
+	for(i = 0 ; i < pVars->nEntries ; ++i) {
+		pEntry = pVars->pEntries + i;
+		pszEntry = msgVarsName(pVars, pEntry);
+		if(pEntry->lenName == len) {
+			if(pEntry->hash == hash && !memcmp(pszEntry, name, len))
+				pFound = pEntry;
+		} else if(pEntry->lenName < len) {
+			if(pbAncestor != NULL && name[pEntry->lenName] == '!'
+			   && !memcmp(pszEntry, name, pEntry->lenName))
+				*pbAncestor = 1;
+		} else {
+			if(pbChildren != NULL && pszEntry[len] == '!' && !memcmp(pszEntry, name, len))
+				*pbChildren = 1;
+		}
+	}
+	return pFound;
 }
-static inline void freeHOSTNAME(msg_t *pThis)
+#define msgVarsFind(pVars, name, len, pbAncestor, pbChildren) \
+	msgVarsFindHashed((pVars), (name), (len), msgVarsHash((name), (len)), (pbAncestor), (pbChildren))
+
+
+/* check if a json-c value can be stored as compact variable at name,
+ * which has length len (not counting children names yet)
+ */
+static int
+msgVarsCanStore(struct json_object *json, int len)
 {
-	if(pThis->iLenHOSTNAME >= CONF_HOSTNAME_BUFSIZE)
-		free(pThis->pszHOSTNAME);
+	struct json_object_iter it;
+	int bHaveChild = 0;
+
+	switch(json_object_get_type(json)) {
+	case json_type_string:
+	case json_type_int:
+	case json_type_boolean:
+		return 1;
+	case json_type_object:
+		json_object_object_foreachC(json, it) {
+			if(it.key[0] == '\0' || strchr(it.key, '!') != NULL
+			   || len + 1 + (int) strlen(it.key) > MSG_VARS_MAXNAME
+			   || !msgVarsCanStore(it.val, len + 1 + (int) strlen(it.key)))
+				return 0;
+			bHaveChild = 1;
+		}
+		return bHaveChild; /* empty containers can not be represented */
+	default:
+		return 0;
+	}
 }
 
 
-BEGINobjDestruct(msg) /* be sure to specify the object type also in END and CODESTART macros! */
-	int currRefCount;
-#	if HAVE_MALLOC_TRIM
-	int currCnt;
-#	endif
-CODESTARTobjDestruct(msg)
-	/* DEV Debugging only ! dbgprintf("msgDestruct\t0x%lx, Ref now: %d\n", (unsigned long)pThis, pThis->iRefCount - 1); */
-#	ifdef HAVE_ATOMIC_BUILTINS
-		currRefCount = ATOMIC_DEC_AND_FETCH(&pThis->iRefCount, NULL);
-#	else
-		MsgLock(pThis);
-		currRefCount = --pThis->iRefCount;
-# 	endif
-	if(currRefCount == 0)
-	{
-		/* DEV Debugging Only! dbgprintf("msgDestruct\t0x%lx, RefCount now 0, doing DESTROY\n", (unsigned long)pThis); */
-		if(pThis->pszRawMsg != pThis->szRawMsg)
-			free(pThis->pszRawMsg);
-		freeTAG(pThis);
-		freeHOSTNAME(pThis);
-		if(pThis->pInputName != NULL)
-			prop.Destruct(&pThis->pInputName);
-		if((pThis->msgFlags & NEEDS_DNSRESOL) == 0) {
-			if(pThis->rcvFrom.pRcvFrom != NULL)
-				prop.Destruct(&pThis->rcvFrom.pRcvFrom);
+/* append a string to the buffer, returns its offset via pOff */
+static rsRetVal
+msgVarsAppendStr(msgVars_t *pVars, const uchar *psz, int len, int *pOff)
+{
+	uchar *pNewBuf;
+	int newMax;
+	DEFiRet;
+
+	if(pVars->lenBuf + len + 1 > pVars->maxBuf) {
+		newMax = (pVars->maxBuf == 0) ? 256 : pVars->maxBuf * 2;
+		while(newMax < pVars->lenBuf + len + 1)
+			newMax *= 2;
+		CHKmalloc(pNewBuf = realloc(pVars->pBuf, newMax));
+		pVars->pBuf = pNewBuf;
+		pVars->maxBuf = newMax;
+	}
+	memcpy(pVars->pBuf + pVars->lenBuf, psz, len);
+	pVars->pBuf[pVars->lenBuf + len] = '\0';
+	*pOff = pVars->lenBuf;
+	pVars->lenBuf += len + 1;
+finalize_it:
+	RETiRet;
+}
+
+
+/* store a single value, replacing an existing one of the same name */
+static rsRetVal
+msgVarsStore(msgVars_t *pVars, const uchar *name, int lenName, enum json_type type,
+	     const uchar *val, int lenVal)
+{
+	msgVarEntry_t *pEntry;
+	msgVarEntry_t *pNewEntries;
+	int offVal;
+	DEFiRet;
+
+	if((pEntry = msgVarsFind(pVars, name, lenName, NULL, NULL)) != NULL) {
+		CHKiRet(msgVarsAppendStr(pVars, val, lenVal, &offVal));
+		/* the old value is lost in the buffer, but this is rare enough */
+		pEntry->offVal = offVal;
+		pEntry->lenVal = lenVal;
+		pEntry->type = type;
+		if(pEntry->json != NULL) {
+			json_object_put(pEntry->json);
+			pEntry->json = NULL;
+		}
+		FINALIZE;
+	}
+
+	if(pVars->nEntries == pVars->maxEntries) {
+		CHKmalloc(pNewEntries = realloc(pVars->pEntries,
+			(pVars->maxEntries == 0 ? 8 : pVars->maxEntries * 2) * sizeof(msgVarEntry_t)));
+		pVars->pEntries = pNewEntries;
+		pVars->maxEntries = (pVars->maxEntries == 0) ? 8 : pVars->maxEntries * 2;
+	}
+	pEntry = pVars->pEntries + pVars->nEntries;
+	CHKiRet(msgVarsAppendStr(pVars, name, lenName, &pEntry->offName));
+	CHKiRet(msgVarsAppendStr(pVars, val, lenVal, &pEntry->offVal));
+	pEntry->hash = msgVarsHash(name, lenName);
+	pEntry->lenName = lenName;
+	pEntry->lenVal = lenVal;
+	pEntry->type = type;
+	pEntry->json = NULL;
+	++pVars->nEntries;
+finalize_it:
+	RETiRet;
+}
+
+
+/* store a json-c value (which must have passed msgVarsCanStore()) at name,
+ * which is kept in a buffer of MSG_VARS_MAXNAME+1 bytes, as children names
+ * are built in it.
+ */
+static rsRetVal
+msgVarsStoreJSON(msgVars_t *pVars, uchar *name, int lenName, struct json_object *json)
+{
+	struct json_object_iter it;
+	char numBuf[32];
+	const char *psz;
+	int lenKey;
+	DEFiRet;
+
+	switch(json_object_get_type(json)) {
+	case json_type_string:
+		psz = json_object_get_string(json);
+		CHKiRet(msgVarsStore(pVars, name, lenName, json_type_string, (uchar*) psz, strlen(psz)));
+		break;
+	case json_type_int:
+#ifdef HAVE_JSON_OBJECT_NEW_INT64
+		snprintf(numBuf, sizeof(numBuf), "%lld", (long long) json_object_get_int64(json));
+#else /* HAVE_JSON_OBJECT_NEW_INT64 */
+		snprintf(numBuf, sizeof(numBuf), "%d", json_object_get_int(json));
+#endif /* HAVE_JSON_OBJECT_NEW_INT64 */
+		CHKiRet(msgVarsStore(pVars, name, lenName, json_type_int, (uchar*) numBuf, strlen(numBuf)));
+		break;
+	case json_type_boolean:
+		psz = json_object_get_boolean(json) ? "true" : "false";
+		CHKiRet(msgVarsStore(pVars, name, lenName, json_type_boolean, (uchar*) psz, strlen(psz)));
+		break;
+	case json_type_object:
+		json_object_object_foreachC(json, it) {
+			lenKey = strlen(it.key);
+			name[lenName] = '!';
+			memcpy(name + lenName + 1, it.key, lenKey);
+			name[lenName + 1 + lenKey] = '\0';
+			CHKiRet(msgVarsStoreJSON(pVars, name, lenName + 1 + lenKey, it.val));
+		}
+		name[lenName] = '\0';
+		break;
+	default:
+		ABORT_FINALIZE(RS_RET_INVLD_SETOP);
+	}
+finalize_it:
+	RETiRet;
+}
+
+
+/* can compact variables be used for pM (which must be locked)? */
+static inline int
+msgVarsUsable(msg_t * const pM)
+{
+	return bMsgCompactVars && pM->json == NULL
+	       && (pM->pVars == NULL || !pM->pVars->bRetired);
+}
+
+
+/* check if a value can be stored at (non-root) name without conflicting with
+ * existing values. Conflicts have the more complex json-c semantics, so we
+ * leave them to it.
+ */
+static int
+msgVarsNameUsable(msgVars_t *pVars, uchar *name, int lenName, sbool bObject)
+{
+	msgVarEntry_t *pEntry;
+	sbool bAncestor, bChildren;
+	int i;
+
+	if(lenName < 2 || lenName > MSG_VARS_MAXNAME || name[lenName-1] == '!')
+		return 0;
+	for(i = 1 ; i < lenName ; ++i)
+		if(name[i] == '!' && name[i-1] == '!')
+			return 0; /* empty path element */
+	pEntry = msgVarsFind(pVars, name, lenName, &bAncestor, &bChildren);
+	return !(bAncestor || bChildren || (pEntry != NULL && bObject));
+}
+
+
+/* get pM's compact variables, create them if there are none yet */
+static inline msgVars_t *
+msgVarsGet(msg_t * const pM)
+{
+	if(pM->pVars == NULL)
+		pM->pVars = calloc(1, sizeof(msgVars_t));
+	return pM->pVars;
+}
+
+
+/* try to add a $! variable (as done by msgAddJSON()) as compact variable.
+ * Returns 1 if done, in which case json has been consumed. If 0 is returned,
+ * the variable needs to go into the json-c tree. pM must be locked.
+ */
+static int
+msgVarsAdd(msg_t * const pM, uchar *name, struct json_object *json)
+{
+	struct json_object_iter it;
+	msgVars_t *pVars;
+	uchar nameBuf[MSG_VARS_MAXNAME + 1];
+	int lenName;
+	int lenKey;
+	sbool bChildren;
+	msgVarEntry_t *pEntry;
+	rsRetVal localRet;
+
+	if(!msgVarsUsable(pM) || json == NULL)
+		return 0;
+	lenName = ustrlen(name);
+	if(lenName > MSG_VARS_MAXNAME || !msgVarsCanStore(json, lenName))
+		return 0;
+
+	if(lenName == 1) {
+		/* full tree: merge, which replaces the top-level names */
+		if(json_object_get_type(json) != json_type_object)
+			return 0;
+		json_object_object_foreachC(json, it) {
+			lenKey = strlen(it.key);
+			nameBuf[0] = '!';
+			memcpy(nameBuf + 1, it.key, lenKey);
+			pEntry = msgVarsFind(pM->pVars, nameBuf, lenKey + 1, NULL, &bChildren);
+			if(bChildren || (pEntry != NULL && json_object_get_type(it.val) == json_type_object))
+				return 0;
+		}
+		nameBuf[0] = '\0';
+		lenName = 0;
+	} else {
+		if(!msgVarsNameUsable(pM->pVars, name, lenName,
+				      json_object_get_type(json) == json_type_object))
+			return 0;
+		memcpy(nameBuf, name, lenName + 1);
+	}
+
+	if((pVars = msgVarsGet(pM)) == NULL)
+		return 0;
+	localRet = msgVarsStoreJSON(pVars, nameBuf, lenName, json);
+	if(localRet != RS_RET_OK) {
+		/* we may have lost part of the values, but that is all we can do */
+		DBGPRINTF("msgVarsAdd: error %d storing '%s'\n", localRet, name);
+	}
+	json_object_put(json);
+	return 1;
+}
+
+
+/* try to set a single $! variable without creating a json-c object at all.
+ * Returns 1 if done and 0 if the caller needs to go the json-c route.
+ */
+static int
+msgVarsSet(msg_t * const pM, uchar *name, enum json_type type, uchar *val, int lenVal)
+{
+	msgVars_t *pVars;
+	int bDone = 0;
+
+	MsgLock(pM);
+	if(msgVarsUsable(pM) && msgVarsNameUsable(pM->pVars, name, ustrlen(name), 0)
+	   && (pVars = msgVarsGet(pM)) != NULL
+	   && msgVarsStore(pVars, name, ustrlen(name), type, val, lenVal) == RS_RET_OK)
+		bDone = 1;
+	MsgUnlock(pM);
+	return bDone;
+}
+
+
+/* check if the existing compact variables leave room for values below name
+ * without any of them being replaced or merged (json-c semantics would apply).
+ */
+static inline int
+msgVarsIsFree(msgVars_t *pVars, uchar *name, int lenName)
+{
+	sbool bAncestor, bChildren;
+
+	return msgVarsFind(pVars, name, lenName, &bAncestor, &bChildren) == NULL
+	       && !bAncestor && !bChildren;
+}
+
+
+/* add a number of scalar $! values, as produced by a parser that does not
+ * build a json-c tree (mmjsonparse, mmfields), as compact variables. This
+ * is what msgAddJSON(pM, root, obj) does for an object which contains just
+ * these values, with root being "!" or a container like "!a". pLeaves[i]
+ * names and values are in pBuf; names are full paths like "!a!b". This is
+ * only done if the values do not replace or merge with existing ones (for
+ * "!" this is checked per top-level name). Returns 1 if done and 0 if
+ * nothing was stored, in which case the caller must build a json-c tree
+ * and use msgAddJSON().
+ */
+int
+msgAddJSONLeaves(msg_t * const pM, uchar *root, uchar *pBuf, msgJSONLeaf_t *pLeaves, int nLeaves)
+{
+	msgVars_t *pVars;
+	msgJSONLeaf_t *pLeaf;
+	uchar *name;
+	int lenRoot;
+	int lenTop;
+	int nOrig, lenOrig;
+	int i;
+	int bDone = 0;
+
+	if(!bMsgCompactVars || nLeaves == 0 || root[0] != '!')
+		return 0;
+	lenRoot = ustrlen(root);
+	for(i = 0 ; i < nLeaves ; ++i) {
+		if(pLeaves[i].lenName > MSG_VARS_MAXNAME)
+			return 0;
+	}
+
+	MsgLock(pM);
+	if(!msgVarsUsable(pM) || (pVars = msgVarsGet(pM)) == NULL)
+		goto done;
+	if(pVars->nEntries > 0) {
+		if(lenRoot > 1) {
+			if(!msgVarsIsFree(pVars, root, lenRoot))
+				goto done;
 		} else {
-			free(pThis->rcvFrom.pfrominet);
+			for(i = 0 ; i < nLeaves ; ++i) {
+				name = pBuf + pLeaves[i].offName;
+				for(lenTop = 1 ; lenTop < pLeaves[i].lenName && name[lenTop] != '!' ; ++lenTop)
+					/* just search */;
+				if(!msgVarsIsFree(pVars, name, lenTop))
+					goto done;
+			}
 		}
-		if(pThis->pRcvFromIP != NULL)
-			prop.Destruct(&pThis->pRcvFromIP);
-		free(pThis->pszRcvdAt3164);
-		free(pThis->pszRcvdAt3339);
-		free(pThis->pszRcvdAt_MySQL);
-		free(pThis->pszRcvdAt_PgSQL);
-		free(pThis->pszTIMESTAMP_MySQL);
-		free(pThis->pszTIMESTAMP_PgSQL);
-		free(pThis->pszStrucData);
-		if(pThis->iLenPROGNAME >= CONF_PROGNAME_BUFSIZE)
-			free(pThis->PROGNAME.ptr);
-		if(pThis->pCSAPPNAME != NULL)
-			rsCStrDestruct(&pThis->pCSAPPNAME);
-		if(pThis->pCSPROCID != NULL)
-			rsCStrDestruct(&pThis->pCSPROCID);
-		if(pThis->pCSMSGID != NULL)
-			rsCStrDestruct(&pThis->pCSMSGID);
-		if(pThis->json != NULL)
-			json_object_put(pThis->json);
-		if(pThis->localvars != NULL)
-			json_object_put(pThis->localvars);
-		if(pThis->pszUUID != NULL)
-			free(pThis->pszUUID);
-#	ifndef HAVE_ATOMIC_BUILTINS
-		MsgUnlock(pThis);
-# 	endif
-		pthread_mutex_destroy(&pThis->mut);
-		/* now we need to do our own optimization. Testing has shown that at least the glibc
-		 * malloc() subsystem returns memory to the OS far too late in our case. So we need
-		 * to help it a bit, by calling malloc_trim(), which will tell the alloc subsystem
-		 * to consolidate and return to the OS. We keep 128K for our use, as a safeguard
-		 * to too-frequent reallocs. But more importantly, we call this hook only every
-		 * 100,000 messages (which is an approximation, as we do not work with atomic
-		 * operations on the counter. --- rgerhards, 2009-06-22.
+	}
+	nOrig = pVars->nEntries;
+	lenOrig = pVars->lenBuf;
+	for(i = 0 ; i < nLeaves ; ++i) {
+		pLeaf = pLeaves + i;
+		/* duplicate names in the input are fine (last one wins, as with
+		 * json-c), but a name that conflicts with one of a different
+		 * nesting level is not.
 		 */
-#		if HAVE_MALLOC_TRIM
-		{	/* standard C requires a new block for a new variable definition!
-			 * To simplify matters, we use modulo arithmetic and live with the fact
-			 * that we trim too often when the counter wraps.
-			 */
-			static unsigned iTrimCtr = 1;
-			currCnt = ATOMIC_INC_AND_FETCH_unsigned(&iTrimCtr, &mutTrimCtr);
-			if(currCnt % 100000 == 0) {
-				malloc_trim(128*1024);
+		if(!msgVarsNameUsable(pVars, pBuf + pLeaf->offName, pLeaf->lenName, 0)
+		   || msgVarsStore(pVars, pBuf + pLeaf->offName, pLeaf->lenName, pLeaf->type,
+				   pBuf + pLeaf->offVal, pLeaf->lenVal) != RS_RET_OK) {
+			/* nobody could see the new entries without the lock, and
+			 * existing ones were not touched, so we can simply drop them */
+			for(i = nOrig ; i < pVars->nEntries ; ++i) {
+				if(pVars->pEntries[i].json != NULL)
+					json_object_put(pVars->pEntries[i].json);
 			}
+			pVars->nEntries = nOrig;
+			pVars->lenBuf = lenOrig;
+			goto done;
 		}
-#		endif
+	}
+	++pM->jsonGen;
+	bDone = 1;
+done:
+	MsgUnlock(pM);
+	return bDone;
+}
+
+
+/* create a json-c object for the value of a compact variable */
+static struct json_object *
+msgVarsNewJSON(msgVars_t *pVars, msgVarEntry_t *pEntry)
+{
+	const char *psz = (char*) msgVarsVal(pVars, pEntry);
+
+	switch(pEntry->type) {
+	case json_type_int:
+#ifdef HAVE_JSON_OBJECT_NEW_INT64
+		return json_object_new_int64(strtoll(psz, NULL, 10));
+#else /* HAVE_JSON_OBJECT_NEW_INT64 */
+		return json_object_new_int(atoi(psz));
+#endif /* HAVE_JSON_OBJECT_NEW_INT64 */
+	case json_type_boolean:
+		return json_object_new_boolean(psz[0] == 't');
+	default:
+		return json_object_new_string_len(psz, pEntry->lenVal);
+	}
+}
+
+
+/* build the json-c tree from the compact variables and retire them.
+ * pM must be locked.
+ */
+static rsRetVal
+msgVarsToJSONLocked(msg_t * const pM)
+{
+	msgVars_t *pVars;
+	msgVarEntry_t *pEntry;
+	struct json_object *json = NULL;
+	struct json_object *parent;
+	struct json_object *val;
+	uchar *name;
+	uchar *leaf;
+	int i;
+	DEFiRet;
+
+	if((pVars = msgVarsActive(pM)) == NULL)
+		FINALIZE;
+	if(pVars->nEntries > 0) {
+		CHKmalloc(json = json_object_new_object());
+		for(i = 0 ; i < pVars->nEntries ; ++i) {
+			pEntry = pVars->pEntries + i;
+			val = (pEntry->json == NULL) ? msgVarsNewJSON(pVars, pEntry)
+						     : json_object_get(pEntry->json);
+			CHKmalloc(val);
+			name = msgVarsName(pVars, pEntry);
+			leaf = jsonPathGetLeaf(name, pEntry->lenName);
+			CHKiRet(jsonPathFindParent(json, name, leaf, &parent, 1));
+			json_object_object_add(parent, (char*)leaf, val);
+		}
+	}
+	ATOMIC_BARRIER(); /* readers check the tree without lock */
+	pM->json = json;
+	json = NULL;
+	pVars->bRetired = 1;
+
+finalize_it:
+	if(json != NULL)
+		json_object_put(json);
+	RETiRet;
+}
+
+
+/* make sure the $! variables are in pM->json. Must be called before the
+ * tree is accessed directly.
+ */
+rsRetVal
+msgVarsToJSON(msg_t * const pM)
+{
+	DEFiRet;
+	if(msgVarsActive(pM) != NULL) {
+		MsgLock(pM);
+		iRet = msgVarsToJSONLocked(pM);
+		MsgUnlock(pM);
+	}
+	RETiRet;
+}
+
+
+/* look up property pProp. Returns the entry (or NULL if it does not exist).
+ * If the name is a container, we can not provide the value and build the
+ * json-c tree instead, which is indicated by *pbConverted. pM must be
+ * locked, and the entry may only be used until it is unlocked.
+ */
+static msgVarEntry_t *
+msgVarsLookup(msg_t * const pM, msgVars_t *pVars, msgPropDescr_t *pProp, sbool *pbConverted)
+{
+	msgVarEntry_t *pEntry;
+	sbool bChildren;
+
+	*pbConverted = 0;
+	if(pProp->nameLen == 1) {
+		pEntry = NULL;
+		bChildren = 1;
 	} else {
-#	ifndef HAVE_ATOMIC_BUILTINS
-		MsgUnlock(pThis);
-# 	endif
-		pThis = NULL; /* tell framework not to destructing the object! */
+		pEntry = msgVarsFindHashed(pVars, pProp->name, pProp->nameLen, pProp->hash,
+					   NULL, &bChildren);
 	}
-ENDobjDestruct(msg)
+	if(pEntry == NULL && bChildren) {
+		msgVarsToJSONLocked(pM);
+		*pbConverted = 1;
+	}
+	return pEntry;
+}
 
 
-/* The macros below are used in MsgDup(). I use macros
- * to keep the fuction code somewhat more readyble. It is my
- * replacement for inline functions in CPP
+/* copy the compact variables of pOld to pNew (for MsgDup()), which is
+ * cheap due to their flat structure. pOld must be locked.
  */
-#define tmpCOPYSZ(name) \
-	if(pOld->psz##name != NULL) { \
-		if((pNew->psz##name = srUtilStrDup(pOld->psz##name, pOld->iLen##name)) == NULL) {\
-			msgDestruct(&pNew);\
-			return NULL;\
-		}\
-		pNew->iLen##name = pOld->iLen##name;\
+static rsRetVal
+msgVarsDup(msg_t * const pOld, msg_t * const pNew)
+{
+	msgVars_t *pVars;
+	msgVars_t *pOldVars;
+	int i;
+	DEFiRet;
+
+	if((pOldVars = msgVarsActive(pOld)) == NULL)
+		FINALIZE;
+	CHKmalloc(pVars = calloc(1, sizeof(msgVars_t)));
+	pNew->pVars = pVars;
+	if(pOldVars->nEntries > 0) {
+		CHKmalloc(pVars->pEntries = malloc(pOldVars->nEntries * sizeof(msgVarEntry_t)));
+		memcpy(pVars->pEntries, pOldVars->pEntries, pOldVars->nEntries * sizeof(msgVarEntry_t));
+		pVars->nEntries = pVars->maxEntries = pOldVars->nEntries;
+		for(i = 0 ; i < pVars->nEntries ; ++i)
+			pVars->pEntries[i].json = NULL;
+	}
+	if(pOldVars->lenBuf > 0) {
+		CHKmalloc(pVars->pBuf = malloc(pOldVars->lenBuf));
+		memcpy(pVars->pBuf, pOldVars->pBuf, pOldVars->lenBuf);
+		pVars->lenBuf = pVars->maxBuf = pOldVars->lenBuf;
 	}
+finalize_it:
+	if(iRet != RS_RET_OK && pNew->pVars != NULL) {
+		/* do not leave half-copied entries behind */
+		pNew->pVars->nEntries = 0;
+	}
+	RETiRet;
+}
+
+
+static void
+msgVarsDestruct(msg_t * const pM)
+{
+	msgVars_t *pVars = pM->pVars;
+	int i;
+
+	if(pVars == NULL)
+		return;
+	for(i = 0 ; i < pVars->nEntries ; ++i)
+		if(pVars->pEntries[i].json != NULL)
+			json_object_put(pVars->pEntries[i].json);
+	free(pVars->pEntries);
+	free(pVars->pBuf);
+	free(pVars);
+	pM->pVars = NULL;
+}
+
+
+/* This is common code for all Constructors. It is defined in an
+ * inline'able function so that we can save a function call in the
+ * actual constructors (otherwise, the msgConstruct would need
+ * to call msgConstructWithTime(), which would require a
+ * function call). Now, both can use this inline function. This
+ * enables us to be optimal, but still have the code just once.
+ * the new object or NULL if no such object could be allocated.
+ * An object constructed via this function should only be destroyed
+ * via "msgDestruct()". This constructor does not query system time
+ * itself but rather uses a user-supplied value. This enables the caller
+ * to do some tricks to save processing time (done, for example, in the
+ * udp input).
+ * NOTE: this constructor does NOT call calloc(), as we have many bytes
+ * inside the structure which do not need to be cleared. bzero() will
+ * heavily thrash the cache, so we do the init manually (which also
+ * is the right thing to do with pointers, as they are not neccessarily
+ * a binary 0 on all machines [but today almost always...]).
+ * rgerhards, 2008-10-06
+ */
+static inline rsRetVal msgBaseConstruct(msg_t **ppThis)
+{
+	DEFiRet;
+	msg_t *pM;
+
+	assert(ppThis != NULL);
+#	ifdef HAVE_ATOMIC_BUILTINS
+	CHKmalloc(pM = msgCacheAlloc());
+#	else
+	CHKmalloc(pM = MALLOC(sizeof(msg_t)));
+#	endif
+	objConstructSetObjInfo(pM); /* intialize object helper entities */
+
+	/* initialize members in ORDER they appear in structure (think "cache line"!) */
+	pM->flowCtlType = 0;
+	pM->bParseSuccess = 0;
+	pM->iRefCount = 1;
+	pM->iSeverity = -1;
+	pM->iFacility = -1;
+	pM->iLenPROGNAME = -1;
+	pM->offAfterPRI = 0;
+	pM->offMSG = -1;
+	pM->iProtocolVersion = 0;
+	pM->msgFlags = 0;
+	pM->iLenRawMsg = 0;
+	pM->iLenMSG = 0;
+	pM->iLenTAG = 0;
+	pM->iLenHOSTNAME = 0;
+	pM->iQueueBytes = 0;
+	pM->pszRawMsg = NULL;
+	pM->pszHOSTNAME = NULL;
+	pM->pTimeStrs = NULL;
+	pM->pszStrucData = NULL;
+	pM->pCSAPPNAME = NULL;
+	pM->pCSPROCID = NULL;
+	pM->pCSMSGID = NULL;
+	pM->pInputName = NULL;
+	pM->pRcvFromIP = NULL;
+	pM->rcvFrom.pRcvFrom = NULL;
+	pM->pRuleset = NULL;
+	pM->json = NULL;
+	pM->localvars = NULL;
+	pM->pJSONShare = NULL;
+	pM->pVars = NULL;
+	pM->pszJSONStr = NULL;
+	pM->jsonGen = 0;
+	pM->dfltTZ[0] = '\0';
+	memset(&pM->tRcvdAt, 0, sizeof(pM->tRcvdAt));
+	memset(&pM->tTIMESTAMP, 0, sizeof(pM->tTIMESTAMP));
+	pM->TAG.pszTAG = NULL;
+	pM->pszUUID = NULL;
+	pM->pTrace = NULL;
+#	ifdef HAVE_ATOMIC_BUILTINS
+	pM->iLock = 0;
+#	else
+	pthread_mutex_init(&pM->mut, NULL);
+#	endif
+
+	/* DEV debugging only! dbgprintf("msgConstruct\t0x%x, ref 1\n", (int)pM);*/
+
+	*ppThis = pM;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* "Constructor" for a msg "object". Returns a pointer to
+ * the new object or NULL if no such object could be allocated.
+ * An object constructed via this function should only be destroyed
+ * via "msgDestruct()". This constructor does not query system time
+ * itself but rather uses a user-supplied value. This enables the caller
+ * to do some tricks to save processing time (done, for example, in the
+ * udp input).
+ * rgerhards, 2008-10-06
+ */
+rsRetVal msgConstructWithTime(msg_t **ppThis, struct syslogTime *stTime, time_t ttGenTime)
+{
+	DEFiRet;
+
+	CHKiRet(msgBaseConstruct(ppThis));
+	(*ppThis)->ttGenTime = ttGenTime;
+	memcpy(&(*ppThis)->tRcvdAt, stTime, sizeof(struct syslogTime));
+	memcpy(&(*ppThis)->tTIMESTAMP, stTime, sizeof(struct syslogTime));
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* "Constructor" for a msg "object". Returns a pointer to
+ * the new object or NULL if no such object could be allocated.
+ * An object constructed via this function should only be destroyed
+ * via "msgDestruct()". This constructor, for historical reasons,
+ * also sets the two timestamps to the current time.
+ */
+rsRetVal msgConstruct(msg_t **ppThis)
+{
+	DEFiRet;
+
+	CHKiRet(msgBaseConstruct(ppThis));
+	/* we initialize both timestamps to contain the current time, so that they
+	 * are consistent. Also, this saves us from doing any further time calls just
+	 * to obtain a timestamp. The memcpy() should not really make a difference,
+	 * especially as I think there is no codepath currently where it would not be
+	 * required (after I have cleaned up the pathes ;)). -- rgerhards, 2008-10-02
+	 */
+	datetime.getCurrTime(&((*ppThis)->tRcvdAt), &((*ppThis)->ttGenTime));
+	memcpy(&(*ppThis)->tTIMESTAMP, &(*ppThis)->tRcvdAt, sizeof(struct syslogTime));
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* Special msg constructor, to be used when an object is deserialized.
+ * we do only the base init as we know the properties will be set in
+ * any case by the deserializer. We still do the "inexpensive" inits
+ * just to be on the safe side. The whole process needs to be
+ * refactored together with the msg serialization subsystem.
+ */
+rsRetVal
+msgConstructForDeserializer(msg_t **ppThis)
+{
+	return msgBaseConstruct(ppThis);
+}
+
+
+/* some free handlers for (slightly) complicated cases... All of them may be called
+ * with an empty element.
+ */
+static inline void freeTAG(msg_t *pThis)
+{
+	if(pThis->iLenTAG >= CONF_TAG_BUFSIZE)
+		free(pThis->TAG.pszTAG);
+}
+static inline void freeHOSTNAME(msg_t *pThis)
+{
+	if(pThis->iLenHOSTNAME >= CONF_HOSTNAME_BUFSIZE)
+		free(pThis->pszHOSTNAME);
+}
+
+
+BEGINobjDestruct(msg) /* be sure to specify the object type also in END and CODESTART macros! */
+	int currRefCount;
+#	if HAVE_MALLOC_TRIM
+	int currCnt;
+#	endif
+CODESTARTobjDestruct(msg)
+	/* DEV Debugging only ! dbgprintf("msgDestruct\t0x%lx, Ref now: %d\n", (unsigned long)pThis, pThis->iRefCount - 1); */
+#	ifdef HAVE_ATOMIC_BUILTINS
+		currRefCount = ATOMIC_DEC_AND_FETCH(&pThis->iRefCount, NULL);
+#	else
+		MsgLock(pThis);
+		currRefCount = --pThis->iRefCount;
+# 	endif
+	if(currRefCount == 0)
+	{
+		/* DEV Debugging Only! dbgprintf("msgDestruct\t0x%lx, RefCount now 0, doing DESTROY\n", (unsigned long)pThis); */
+		if(pThis->pszRawMsg != pThis->szRawMsg)
+			free(pThis->pszRawMsg);
+		freeTAG(pThis);
+		freeHOSTNAME(pThis);
+		if(pThis->pInputName != NULL)
+			prop.Destruct(&pThis->pInputName);
+		if((pThis->msgFlags & NEEDS_DNSRESOL) == 0) {
+			if(pThis->rcvFrom.pRcvFrom != NULL)
+				prop.Destruct(&pThis->rcvFrom.pRcvFrom);
+		} else {
+			free(pThis->rcvFrom.pfrominet);
+		}
+		if(pThis->pRcvFromIP != NULL)
+			prop.Destruct(&pThis->pRcvFromIP);
+		free(pThis->pTimeStrs);
+		free(pThis->pszStrucData);
+		if(pThis->iLenPROGNAME >= CONF_PROGNAME_BUFSIZE)
+			free(pThis->PROGNAME.ptr);
+		if(pThis->pCSAPPNAME != NULL)
+			rsCStrDestruct(&pThis->pCSAPPNAME);
+		if(pThis->pCSPROCID != NULL)
+			rsCStrDestruct(&pThis->pCSPROCID);
+		if(pThis->pCSMSGID != NULL)
+			rsCStrDestruct(&pThis->pCSMSGID);
+		msgVarsDestruct(pThis);
+		free(pThis->pszJSONStr);
+#	ifdef HAVE_ATOMIC_BUILTINS
+		msgReleaseJSON(pThis);
+#	else
+		if(pThis->json != NULL)
+			json_object_put(pThis->json);
+		if(pThis->localvars != NULL)
+			json_object_put(pThis->localvars);
+#	endif
+		if(pThis->pszUUID != NULL)
+			free(pThis->pszUUID);
+		if(pThis->pTrace != NULL)
+			msgTraceFinalize(pThis);
+#	ifdef HAVE_ATOMIC_BUILTINS
+		obj.DestructObjSelf((obj_t*) pThis);
+		msgCacheFree(pThis);
+#	else
+		MsgUnlock(pThis);
+		pthread_mutex_destroy(&pThis->mut);
+# 	endif
+		/* now we need to do our own optimization. Testing has shown that at least the glibc
+		 * malloc() subsystem returns memory to the OS far too late in our case. So we need
+		 * to help it a bit, by calling malloc_trim(), which will tell the alloc subsystem
+		 * to consolidate and return to the OS. We keep 128K for our use, as a safeguard
+		 * to too-frequent reallocs. But more importantly, we call this hook only every
+		 * 100,000 messages (which is an approximation, as we do not work with atomic
+		 * operations on the counter. --- rgerhards, 2009-06-22.
+		 */
+#		if HAVE_MALLOC_TRIM
+		{	/* standard C requires a new block for a new variable definition!
+			 * To simplify matters, we use modulo arithmetic and live with the fact
+			 * that we trim too often when the counter wraps.
+			 */
+			static unsigned iTrimCtr = 1;
+			currCnt = ATOMIC_INC_AND_FETCH_unsigned(&iTrimCtr, &mutTrimCtr);
+			if(currCnt % 100000 == 0) {
+				malloc_trim(128*1024);
+			}
+		}
+#		endif
+#	ifdef HAVE_ATOMIC_BUILTINS
+		pThis = NULL; /* already back in the cache, the framework must not free it */
+#	endif
+	} else {
+#	ifndef HAVE_ATOMIC_BUILTINS
+		MsgUnlock(pThis);
+# 	endif
+		pThis = NULL; /* tell framework not to destructing the object! */
+	}
+ENDobjDestruct(msg)
+
+
+/* The macros below are used in MsgDup(). I use macros
+ * to keep the fuction code somewhat more readyble. It is my
+ * replacement for inline functions in CPP
+ */
+#define tmpCOPYSZ(name) \
+	if(pOld->psz##name != NULL) { \
+		if((pNew->psz##name = srUtilStrDup(pOld->psz##name, pOld->iLen##name)) == NULL) {\
+			msgDestruct(&pNew);\
+			return NULL;\
+		}\
+		pNew->iLen##name = pOld->iLen##name;\
+	}
+
+/* copy the CStr objects.
+ * if the old value is NULL, we do not need to do anything because we
+ * initialized the new value to NULL via calloc().
+ */
+#define tmpCOPYCSTR(name) \
+	if(pOld->pCS##name != NULL) {\
+		cstrConstructInPlace(&pNew->cs##name);\
+		pNew->pCS##name = &pNew->cs##name;\
+		if(rsCStrSetSzStrWithLen(pNew->pCS##name, pOld->pCS##name->pBuf,\
+					 pOld->pCS##name->iStrLen) != RS_RET_OK) {\
+			msgDestruct(&pNew);\
+			return NULL;\
+		}\
+	}
+/* Constructs a message object by duplicating another one.
+ * Returns NULL if duplication failed. We do not need to lock the
+ * message object here, because a fully-created msg object is never
+ * allowed to be manipulated. For this, MsgDup() must be used, so MsgDup()
+ * can never run into a situation where the message object is being
+ * modified while its content is copied - it's forbidden by definition.
+ * rgerhards, 2007-07-10
+ */
+msg_t* MsgDup(msg_t* pOld)
+{
+	msg_t* pNew;
+	rsRetVal localRet;
+
+	assert(pOld != NULL);
+
+	BEGINfunc
+	if(msgConstructWithTime(&pNew, &pOld->tTIMESTAMP, pOld->ttGenTime) != RS_RET_OK) {
+		return NULL;
+	}
+
+	/* now copy the message properties */
+	pNew->iRefCount = 1;
+	pNew->iSeverity = pOld->iSeverity;
+	pNew->iFacility = pOld->iFacility;
+	pNew->msgFlags = pOld->msgFlags;
+	pNew->iProtocolVersion = pOld->iProtocolVersion;
+	pNew->ttGenTime = pOld->ttGenTime;
+	pNew->offMSG = pOld->offMSG;
+	pNew->iLenRawMsg = pOld->iLenRawMsg;
+	pNew->iLenMSG = pOld->iLenMSG;
+	pNew->iLenTAG = pOld->iLenTAG;
+	pNew->iLenHOSTNAME = pOld->iLenHOSTNAME;
+	if((pOld->msgFlags & NEEDS_DNSRESOL)) {
+			localRet = msgSetFromSockinfo(pNew, pOld->rcvFrom.pfrominet);
+			if(localRet != RS_RET_OK) {
+				/* if something fails, we accept loss of this property, it is
+				 * better than losing the whole message.
+				 */
+				pNew->msgFlags &= ~NEEDS_DNSRESOL;
+				pNew->rcvFrom.pRcvFrom = NULL; /* make sure no dangling values */
+			}
+	} else {
+		if(pOld->rcvFrom.pRcvFrom != NULL) {
+			pNew->rcvFrom.pRcvFrom = pOld->rcvFrom.pRcvFrom;
+			prop.AddRef(pNew->rcvFrom.pRcvFrom);
+		}
+	}
+	if(pOld->pRcvFromIP != NULL) {
+		pNew->pRcvFromIP = pOld->pRcvFromIP;
+		prop.AddRef(pNew->pRcvFromIP);
+	}
+	if(pOld->pInputName != NULL) {
+		pNew->pInputName = pOld->pInputName;
+		prop.AddRef(pNew->pInputName);
+	}
+	if(pOld->iLenTAG > 0) {
+		if(pOld->iLenTAG < CONF_TAG_BUFSIZE) {
+			memcpy(pNew->TAG.szBuf, pOld->TAG.szBuf, pOld->iLenTAG + 1);
+		} else {
+			if((pNew->TAG.pszTAG = srUtilStrDup(pOld->TAG.pszTAG, pOld->iLenTAG)) == NULL) {
+				msgDestruct(&pNew);
+				return NULL;
+			}
+			pNew->iLenTAG = pOld->iLenTAG;
+		}
+	}
+	if(pOld->iLenRawMsg < CONF_RAWMSG_BUFSIZE) {
+		memcpy(pNew->szRawMsg, pOld->szRawMsg, pOld->iLenRawMsg + 1);
+		pNew->pszRawMsg = pNew->szRawMsg;
+	} else {
+		tmpCOPYSZ(RawMsg);
+	}
+	if(pOld->pszHOSTNAME == NULL) {
+		pNew->pszHOSTNAME = NULL;
+	} else {
+		if(pOld->iLenHOSTNAME < CONF_HOSTNAME_BUFSIZE) {
+			memcpy(pNew->szHOSTNAME, pOld->szHOSTNAME, pOld->iLenHOSTNAME + 1);
+			pNew->pszHOSTNAME = pNew->szHOSTNAME;
+		} else {
+			tmpCOPYSZ(HOSTNAME);
+		}
+	}
+	if(pOld->pszStrucData == NULL) {
+		pNew->pszStrucData = NULL;
+	} else {
+		pNew->pszStrucData = (uchar*)strdup((char*)pOld->pszStrucData);
+		pNew->lenStrucData = pOld->lenStrucData;
+	}
+
+	tmpCOPYCSTR(APPNAME);
+	tmpCOPYCSTR(PROCID);
+	tmpCOPYCSTR(MSGID);
+
+	if(msgVarsActive(pOld) != NULL) {
+		MsgLock(pOld);
+		localRet = msgVarsDup(pOld, pNew);
+		MsgUnlock(pOld);
+		if(localRet != RS_RET_OK)
+			DBGPRINTF("MsgDup: could not copy compact variables, error %d\n", localRet);
+	}
+#	ifdef HAVE_ATOMIC_BUILTINS
+	if(pOld->json != NULL || pOld->localvars != NULL) {
+		/* if we can not share, we continue without the trees, much as
+		 * with failed copies below.
+		 */
+		MsgLock(pOld);
+		localRet = msgShareJSON(pOld, pNew);
+		MsgUnlock(pOld);
+		if(localRet != RS_RET_OK)
+			DBGPRINTF("MsgDup: could not share JSON trees, error %d\n", localRet);
+	}
+#	else
+	if(pOld->json != NULL)
+		pNew->json = jsonDeepCopy(pOld->json);
+	if(pOld->localvars != NULL)
+		pNew->localvars = jsonDeepCopy(pOld->localvars);
+#	endif
+
+	/* we do not copy all other cache properties, as we do not even know
+	 * if they are needed once again. So we let them re-create if needed.
+	 */
+
+	ENDfunc
+	return pNew;
+}
+#undef tmpCOPYSZ
+#undef tmpCOPYCSTR
+
+
+/* This method serializes a message object. That means the whole
+ * object is modified into text form. That text form is suitable for
+ * later reconstruction of the object by calling MsgDeSerialize().
+ * The most common use case for this method is the creation of an
+ * on-disk representation of the message object.
+ * We do not serialize the cache properties. We re-create them when needed.
+ * This saves us a lot of memory. Performance is no concern, as serializing
+ * is a so slow operation that recration of the caches does not count. Also,
+ * we do not serialize --currently none--, as this is only a helper variable
+ * during msg construction - and never again used later.
+ * rgerhards, 2008-01-03
+ */
+static rsRetVal MsgSerialize(msg_t *pThis, strm_t *pStrm)
+{
+	uchar *psz;
+	int len;
+	DEFiRet;
+
+	assert(pThis != NULL);
+	assert(pStrm != NULL);
+
+	/* then serialize elements */
+	CHKiRet(obj.BeginSerialize(pStrm, (obj_t*) pThis));
+	objSerializeSCALAR(pStrm, iProtocolVersion, SHORT);
+	objSerializeSCALAR(pStrm, iSeverity, SHORT);
+	objSerializeSCALAR(pStrm, iFacility, SHORT);
+	objSerializeSCALAR(pStrm, msgFlags, INT);
+	objSerializeSCALAR(pStrm, ttGenTime, INT);
+	objSerializeSCALAR(pStrm, tRcvdAt, SYSLOGTIME);
+	objSerializeSCALAR(pStrm, tTIMESTAMP, SYSLOGTIME);
+
+	CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("pszTAG"), PROPTYPE_PSZ, (void*)
+		((pThis->iLenTAG < CONF_TAG_BUFSIZE) ? pThis->TAG.szBuf : pThis->TAG.pszTAG)));
+
+	objSerializePTR(pStrm, pszRawMsg, PSZ);
+	objSerializePTR(pStrm, pszHOSTNAME, PSZ);
+	getInputName(pThis, &psz, &len);
+	CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("pszInputName"), PROPTYPE_PSZ, (void*) psz));
+	psz = getRcvFrom(pThis); 
+	CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("pszRcvFrom"), PROPTYPE_PSZ, (void*) psz));
+	psz = getRcvFromIP(pThis); 
+	CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("pszRcvFromIP"), PROPTYPE_PSZ, (void*) psz));
+	psz = pThis->pszStrucData; 
+	CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("pszRcvStrucData"), PROPTYPE_PSZ, (void*) psz));
+	msgVarsToJSON(pThis);
+	if(pThis->json != NULL) {
+		psz = (uchar*) json_object_get_string(pThis->json);
+		CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("json"), PROPTYPE_PSZ, (void*) psz));
+	}
+	if(pThis->localvars != NULL) {
+		psz = (uchar*) json_object_get_string(pThis->localvars);
+		CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("localvars"), PROPTYPE_PSZ, (void*) psz));
+	}
+
+	objSerializePTR(pStrm, pCSAPPNAME, CSTR);
+	objSerializePTR(pStrm, pCSPROCID, CSTR);
+	objSerializePTR(pStrm, pCSMSGID, CSTR);
+	
+	objSerializePTR(pStrm, pszUUID, PSZ);
+
+	if(pThis->pRuleset != NULL) {
+		rulesetGetName(pThis->pRuleset);
+		CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("pszRuleset"), PROPTYPE_PSZ,
+			rulesetGetName(pThis->pRuleset)));
+	}
+
+	/* offset must be serialized after pszRawMsg, because we need that to obtain the correct
+	 * MSG size.
+	 */
+	objSerializeSCALAR(pStrm, offMSG, SHORT);
+
+	CHKiRet(obj.EndSerialize(pStrm));
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* This is a helper for MsgDeserialize that re-inits the var object. This
+ * whole construct should be replaced, var is really ready to be retired.
+ * But as an interim help during refactoring let's introduce this function
+ * here (and thus NOT as method of var object!). -- rgerhads, 2012-11-06
+ */
+static inline void
+reinitVar(var_t *pVar)
+{
+	rsCStrDestruct(&pVar->pcsName); /* no longer needed */
+	if(pVar->varType == VARTYPE_STR) {
+		if(pVar->val.pStr != NULL)
+			rsCStrDestruct(&pVar->val.pStr);
+	}
+}
+/* deserialize the message again 
+ * we deserialize the properties in the same order that we serialized them. Except
+ * for some checks to cover downlevel version, we do not need to do all these
+ * CPU intense name checkings.
+ */
+#define isProp(name) !rsCStrSzStrCmp(pVar->pcsName, (uchar*) name, sizeof(name) - 1)
+rsRetVal
+MsgDeserialize(msg_t * const pMsg, strm_t *pStrm)
+{
+	prop_t *myProp;
+	prop_t *propRcvFrom = NULL;
+	prop_t *propRcvFromIP = NULL;
+	struct json_tokener *tokener;
+	var_t *pVar = NULL;
+	DEFiRet;
+
+	ISOBJ_TYPE_assert(pStrm, strm);
+
+	CHKiRet(var.Construct(&pVar));
+	CHKiRet(var.ConstructFinalize(pVar));
+
+	CHKiRet(objDeserializeProperty(pVar, pStrm));
+	if(isProp("iProtocolVersion")) {
+		setProtocolVersion(pMsg, pVar->val.num);
+		reinitVar(pVar);
+		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	}
+	if(isProp("iSeverity")) {
+		pMsg->iSeverity = pVar->val.num;
+		reinitVar(pVar);
+		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	}
+	if(isProp("iFacility")) {
+		pMsg->iFacility = pVar->val.num;
+		reinitVar(pVar);
+		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	}
+	if(isProp("msgFlags")) {
+		pMsg->msgFlags = pVar->val.num;
+		reinitVar(pVar);
+		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	}
+	if(isProp("ttGenTime")) {
+		pMsg->ttGenTime = pVar->val.num;
+		reinitVar(pVar);
+		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	}
+	if(isProp("tRcvdAt")) {
+		memcpy(&pMsg->tRcvdAt, &pVar->val.vSyslogTime, sizeof(struct syslogTime));
+		reinitVar(pVar);
+		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	}
+	if(isProp("tTIMESTAMP")) {
+		memcpy(&pMsg->tTIMESTAMP, &pVar->val.vSyslogTime, sizeof(struct syslogTime));
+		reinitVar(pVar);
+		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	}
+	if(isProp("pszTAG")) {
+		MsgSetTAG(pMsg, rsCStrGetSzStrNoNULL(pVar->val.pStr), cstrLen(pVar->val.pStr));
+		reinitVar(pVar);
+		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	}
+	if(isProp("pszRawMsg")) {
+		MsgSetRawMsg(pMsg, (char*) rsCStrGetSzStrNoNULL(pVar->val.pStr), cstrLen(pVar->val.pStr));
+		reinitVar(pVar);
+		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	}
+	if(isProp("pszHOSTNAME")) {
+		MsgSetHOSTNAME(pMsg, rsCStrGetSzStrNoNULL(pVar->val.pStr), rsCStrLen(pVar->val.pStr));
+		reinitVar(pVar);
+		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	}
+	if(isProp("pszInputName")) {
+		/* we need to create a property */ 
+		CHKiRet(prop.Construct(&myProp));
+		CHKiRet(prop.SetString(myProp, rsCStrGetSzStrNoNULL(pVar->val.pStr), rsCStrLen(pVar->val.pStr)));
+		CHKiRet(prop.ConstructFinalize(myProp));
+		MsgSetInputName(pMsg, myProp);
+		prop.Destruct(&myProp);
+		reinitVar(pVar);
+		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	}
+	if(isProp("pszRcvFrom")) {
+		MsgSetRcvFromStr(pMsg, rsCStrGetSzStrNoNULL(pVar->val.pStr), rsCStrLen(pVar->val.pStr), &propRcvFrom);
+		prop.Destruct(&propRcvFrom);
+		reinitVar(pVar);
+		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	}
+	if(isProp("pszRcvFromIP")) {
+		MsgSetRcvFromIPStr(pMsg, rsCStrGetSzStrNoNULL(pVar->val.pStr), rsCStrLen(pVar->val.pStr), &propRcvFromIP);
+		prop.Destruct(&propRcvFromIP);
+		reinitVar(pVar);
+		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	}
+	if(isProp("json")) {
+		tokener = json_tokener_new();
+		pMsg->json = json_tokener_parse_ex(tokener, (char*)rsCStrGetSzStrNoNULL(pVar->val.pStr),
+					     cstrLen(pVar->val.pStr));
+		json_tokener_free(tokener);
+		reinitVar(pVar);
+		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	}
+	if(isProp("localvars")) {
+		tokener = json_tokener_new();
+		pMsg->localvars = json_tokener_parse_ex(tokener, (char*)rsCStrGetSzStrNoNULL(pVar->val.pStr),
+						        cstrLen(pVar->val.pStr));
+		json_tokener_free(tokener);
+		reinitVar(pVar);
+		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	}
+	if(isProp("pszStrucData")) {
+		MsgSetStructuredData(pMsg, (char*) rsCStrGetSzStrNoNULL(pVar->val.pStr));
+		reinitVar(pVar);
+		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	}
+	if(isProp("pCSAPPNAME")) {
+		MsgSetAPPNAME(pMsg, (char*) rsCStrGetSzStrNoNULL(pVar->val.pStr));
+		reinitVar(pVar);
+		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	}
+	if(isProp("pCSPROCID")) {
+		MsgSetPROCID(pMsg, (char*) rsCStrGetSzStrNoNULL(pVar->val.pStr));
+		reinitVar(pVar);
+		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	}
+	if(isProp("pCSMSGID")) {
+		MsgSetMSGID(pMsg, (char*) rsCStrGetSzStrNoNULL(pVar->val.pStr));
+		reinitVar(pVar);
+		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	}
+	if(isProp("pszUUID")) {
+		pMsg->pszUUID = ustrdup(rsCStrGetSzStrNoNULL(pVar->val.pStr));
+		reinitVar(pVar);
+		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	}
+	if(isProp("pszRuleset")) {
+		MsgSetRulesetByName(pMsg, pVar->val.pStr);
+		reinitVar(pVar);
+		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	}
+	/* "offMSG" must always be our last field, so we use this as an
+	 * indicator if the sequence is correct. This is a bit questionable,
+	 * but on the other hand it works decently AND we will probably replace
+	 * the whole persisted format soon in any case. -- rgerhards, 2012-11-06
+	 */
+	if(!isProp("offMSG"))
+		ABORT_FINALIZE(RS_RET_DS_PROP_SEQ_ERR);
+	MsgSetMSGoffs(pMsg, pVar->val.num);
+finalize_it:
+	if(pVar != NULL)
+		var.Destruct(&pVar);
+	RETiRet;
+}
+#undef isProp
+
 
-/* copy the CStr objects.
- * if the old value is NULL, we do not need to do anything because we
- * initialized the new value to NULL via calloc().
- */
-#define tmpCOPYCSTR(name) \
-	if(pOld->pCS##name != NULL) {\
-		if(rsCStrConstructFromCStr(&(pNew->pCS##name), pOld->pCS##name) != RS_RET_OK) {\
-			msgDestruct(&pNew);\
-			return NULL;\
-		}\
-	}
-/* Constructs a message object by duplicating another one.
- * Returns NULL if duplication failed. We do not need to lock the
- * message object here, because a fully-created msg object is never
- * allowed to be manipulated. For this, MsgDup() must be used, so MsgDup()
- * can never run into a situation where the message object is being
- * modified while its content is copied - it's forbidden by definition.
- * rgerhards, 2007-07-10
+/* ------------------------------ binary record format ------------------------------ */
+/* The binary record format is used by disk queues and for relaying messages
+ * between rsyslog instances (omfwd tcp_framing="binary"). It is much cheaper
+ * to write and parse than the property-based serializer above, which is still
+ * used for reading queue files created by previous versions.
+ * A record looks as follows (multi-octet integers are little endian):
+ *   MSG_BINREC_MAGIC  1 octet, never '<', so it can be told apart from old records
+ *   version           1 octet, currently MSG_BINREC_VERSION
+ *   payload length    4 octets
+ *   payload           the fields, in the order used by MsgSerializeBinary()
+ *   '\n'              1 octet trailer, permits to re-sync after damaged records
+ * Strings are stored as 4 octet length plus data plus a terminating '\0' (not
+ * included in the length), so that they can be used directly from the record
+ * buffer. A length of BINREC_NOSTR means the property is not present.
  */
-msg_t* MsgDup(msg_t* pOld)
-{
-	msg_t* pNew;
-	rsRetVal localRet;
+#define BINREC_NOSTR 0xffffffffu
+#define BINREC_HDRLEN MSG_BINREC_HDRLEN
+#define BINREC_MAXLEN (256 * 1024 * 1024) /* sanity limit for damaged records */
 
-	assert(pOld != NULL);
+/* growable buffer for building a record. Most messages fit into the
+ * in-object buffer, so we usually do not need any malloc.
+ */
+typedef struct binrec_s {
+	uchar *buf;
+	size_t len;
+	size_t size;
+	uchar fixbuf[4096];
+} binrec_t;
 
-	BEGINfunc
-	if(msgConstructWithTime(&pNew, &pOld->tTIMESTAMP, pOld->ttGenTime) != RS_RET_OK) {
-		return NULL;
-	}
+static inline rsRetVal
+binrecNeed(binrec_t *r, size_t need)
+{
+	uchar *newbuf;
+	size_t newsize;
+	DEFiRet;
 
-	/* now copy the message properties */
-	pNew->iRefCount = 1;
-	pNew->iSeverity = pOld->iSeverity;
-	pNew->iFacility = pOld->iFacility;
-	pNew->msgFlags = pOld->msgFlags;
-	pNew->iProtocolVersion = pOld->iProtocolVersion;
-	pNew->ttGenTime = pOld->ttGenTime;
-	pNew->offMSG = pOld->offMSG;
-	pNew->iLenRawMsg = pOld->iLenRawMsg;
-	pNew->iLenMSG = pOld->iLenMSG;
-	pNew->iLenTAG = pOld->iLenTAG;
-	pNew->iLenHOSTNAME = pOld->iLenHOSTNAME;
-	if((pOld->msgFlags & NEEDS_DNSRESOL)) {
-			localRet = msgSetFromSockinfo(pNew, pOld->rcvFrom.pfrominet);
-			if(localRet != RS_RET_OK) {
-				/* if something fails, we accept loss of this property, it is
-				 * better than losing the whole message.
-				 */
-				pNew->msgFlags &= ~NEEDS_DNSRESOL;
-				pNew->rcvFrom.pRcvFrom = NULL; /* make sure no dangling values */
-			}
-	} else {
-		if(pOld->rcvFrom.pRcvFrom != NULL) {
-			pNew->rcvFrom.pRcvFrom = pOld->rcvFrom.pRcvFrom;
-			prop.AddRef(pNew->rcvFrom.pRcvFrom);
-		}
-	}
-	if(pOld->pRcvFromIP != NULL) {
-		pNew->pRcvFromIP = pOld->pRcvFromIP;
-		prop.AddRef(pNew->pRcvFromIP);
-	}
-	if(pOld->pInputName != NULL) {
-		pNew->pInputName = pOld->pInputName;
-		prop.AddRef(pNew->pInputName);
-	}
-	if(pOld->iLenTAG > 0) {
-		if(pOld->iLenTAG < CONF_TAG_BUFSIZE) {
-			memcpy(pNew->TAG.szBuf, pOld->TAG.szBuf, pOld->iLenTAG + 1);
-		} else {
-			if((pNew->TAG.pszTAG = srUtilStrDup(pOld->TAG.pszTAG, pOld->iLenTAG)) == NULL) {
-				msgDestruct(&pNew);
-				return NULL;
-			}
-			pNew->iLenTAG = pOld->iLenTAG;
-		}
-	}
-	if(pOld->iLenRawMsg < CONF_RAWMSG_BUFSIZE) {
-		memcpy(pNew->szRawMsg, pOld->szRawMsg, pOld->iLenRawMsg + 1);
-		pNew->pszRawMsg = pNew->szRawMsg;
+	if(r->len + need <= r->size)
+		FINALIZE;
+	newsize = (r->size == 0) ? sizeof(r->fixbuf) : 2 * r->size;
+	while(newsize < r->len + need)
+		newsize *= 2;
+	if(r->buf == r->fixbuf) {
+		CHKmalloc(newbuf = malloc(newsize));
+		memcpy(newbuf, r->buf, r->len);
 	} else {
-		tmpCOPYSZ(RawMsg);
+		CHKmalloc(newbuf = realloc(r->buf, newsize));
 	}
-	if(pOld->pszHOSTNAME == NULL) {
-		pNew->pszHOSTNAME = NULL;
-	} else {
-		if(pOld->iLenHOSTNAME < CONF_HOSTNAME_BUFSIZE) {
-			memcpy(pNew->szHOSTNAME, pOld->szHOSTNAME, pOld->iLenHOSTNAME + 1);
-			pNew->pszHOSTNAME = pNew->szHOSTNAME;
-		} else {
-			tmpCOPYSZ(HOSTNAME);
-		}
+	r->buf = newbuf;
+	r->size = newsize;
+finalize_it:
+	RETiRet;
+}
+
+static inline void
+binrecPutUInt(binrec_t *r, uint64_t val, int nOctets)
+{
+	int i;
+	for(i = 0 ; i < nOctets ; ++i) {
+		r->buf[r->len++] = (uchar) (val & 0xff);
+		val >>= 8;
 	}
-	if(pOld->pszStrucData == NULL) {
-		pNew->pszStrucData = NULL;
+}
+
+static inline rsRetVal
+binrecAddUInt(binrec_t *r, uint64_t val, int nOctets)
+{
+	DEFiRet;
+	CHKiRet(binrecNeed(r, nOctets));
+	binrecPutUInt(r, val, nOctets);
+finalize_it:
+	RETiRet;
+}
+
+static rsRetVal
+binrecAddStr(binrec_t *r, uchar *psz, size_t len)
+{
+	DEFiRet;
+	if(psz == NULL) {
+		CHKiRet(binrecAddUInt(r, BINREC_NOSTR, 4));
 	} else {
-		pNew->pszStrucData = (uchar*)strdup((char*)pOld->pszStrucData);
-		pNew->lenStrucData = pOld->lenStrucData;
+		CHKiRet(binrecNeed(r, 4 + len + 1));
+		binrecPutUInt(r, len, 4);
+		memcpy(r->buf + r->len, psz, len);
+		r->len += len;
+		r->buf[r->len++] = '\0';
 	}
+finalize_it:
+	RETiRet;
+}
 
-	tmpCOPYCSTR(APPNAME);
-	tmpCOPYCSTR(PROCID);
-	tmpCOPYCSTR(MSGID);
-
-	if(pOld->json != NULL)
-		pNew->json = jsonDeepCopy(pOld->json);
-	if(pOld->localvars != NULL)
-		pNew->localvars = jsonDeepCopy(pOld->localvars);
+static inline rsRetVal
+binrecAddSz(binrec_t *r, uchar *psz)
+{
+	return binrecAddStr(r, psz, (psz == NULL) ? 0 : ustrlen(psz));
+}
 
-	/* we do not copy all other cache properties, as we do not even know
-	 * if they are needed once again. So we let them re-create if needed.
-	 */
+static inline rsRetVal
+binrecAddCStr(binrec_t *r, cstr_t *pCStr)
+{
+	if(pCStr == NULL)
+		return binrecAddStr(r, NULL, 0);
+	return binrecAddStr(r, rsCStrGetSzStrNoNULL(pCStr), cstrLen(pCStr));
+}
 
-	ENDfunc
-	return pNew;
+static rsRetVal
+binrecAddTime(binrec_t *r, struct syslogTime *t)
+{
+	DEFiRet;
+	CHKiRet(binrecNeed(r, 16));
+	binrecPutUInt(r, (uchar) t->timeType, 1);
+	binrecPutUInt(r, (uchar) t->month, 1);
+	binrecPutUInt(r, (uchar) t->day, 1);
+	binrecPutUInt(r, (uchar) t->hour, 1);
+	binrecPutUInt(r, (uchar) t->minute, 1);
+	binrecPutUInt(r, (uchar) t->second, 1);
+	binrecPutUInt(r, (uchar) t->secfracPrecision, 1);
+	binrecPutUInt(r, (uchar) t->OffsetMinute, 1);
+	binrecPutUInt(r, (uchar) t->OffsetHour, 1);
+	binrecPutUInt(r, (uchar) t->OffsetMode, 1);
+	binrecPutUInt(r, (uint16_t) t->year, 2);
+	binrecPutUInt(r, (uint32_t) t->secfrac, 4);
+finalize_it:
+	RETiRet;
 }
-#undef tmpCOPYSZ
-#undef tmpCOPYCSTR
 
 
-/* This method serializes a message object. That means the whole
- * object is modified into text form. That text form is suitable for
- * later reconstruction of the object by calling MsgDeSerialize().
- * The most common use case for this method is the creation of an
- * on-disk representation of the message object.
- * We do not serialize the cache properties. We re-create them when needed.
- * This saves us a lot of memory. Performance is no concern, as serializing
- * is a so slow operation that recration of the caches does not count. Also,
- * we do not serialize --currently none--, as this is only a helper variable
- * during msg construction - and never again used later.
- * rgerhards, 2008-01-03
+/* build the complete binary record for a message in r, see above for the
+ * format description. As with MsgSerialize(), cache properties are not
+ * persisted.
  */
-static rsRetVal MsgSerialize(msg_t *pThis, strm_t *pStrm)
+static rsRetVal
+binrecBuild(msg_t *pThis, binrec_t *r)
 {
 	uchar *psz;
 	int len;
 	DEFiRet;
 
+	r->len = 0;
+	CHKiRet(binrecNeed(r, BINREC_HDRLEN + 20)); /* header and fixed-size fields */
+	r->len = BINREC_HDRLEN; /* header is filled in when the length is known */
+
+	binrecPutUInt(r, (uint16_t) pThis->iProtocolVersion, 2);
+	binrecPutUInt(r, (uint16_t) pThis->iSeverity, 2);
+	binrecPutUInt(r, (uint16_t) pThis->iFacility, 2);
+	binrecPutUInt(r, (uint32_t) pThis->msgFlags, 4);
+	binrecPutUInt(r, (uint64_t) pThis->ttGenTime, 8);
+	binrecPutUInt(r, (uint16_t) pThis->offMSG, 2);
+	CHKiRet(binrecAddTime(r, &pThis->tRcvdAt));
+	CHKiRet(binrecAddTime(r, &pThis->tTIMESTAMP));
+
+	CHKiRet(binrecAddStr(r, (pThis->iLenTAG < CONF_TAG_BUFSIZE) ? pThis->TAG.szBuf : pThis->TAG.pszTAG,
+			     pThis->iLenTAG));
+	CHKiRet(binrecAddStr(r, pThis->pszRawMsg, pThis->iLenRawMsg));
+	CHKiRet(binrecAddStr(r, pThis->pszHOSTNAME, pThis->iLenHOSTNAME));
+	getInputName(pThis, &psz, &len);
+	CHKiRet(binrecAddStr(r, psz, len));
+	CHKiRet(binrecAddSz(r, getRcvFrom(pThis)));
+	CHKiRet(binrecAddSz(r, getRcvFromIP(pThis)));
+	CHKiRet(binrecAddSz(r, pThis->pszStrucData));
+	msgVarsToJSON(pThis);
+	CHKiRet(binrecAddSz(r, (pThis->json == NULL) ? NULL
+			    : (uchar*) json_object_get_string(pThis->json)));
+	CHKiRet(binrecAddSz(r, (pThis->localvars == NULL) ? NULL
+			    : (uchar*) json_object_get_string(pThis->localvars)));
+	CHKiRet(binrecAddCStr(r, pThis->pCSAPPNAME));
+	CHKiRet(binrecAddCStr(r, pThis->pCSPROCID));
+	CHKiRet(binrecAddCStr(r, pThis->pCSMSGID));
+	CHKiRet(binrecAddSz(r, pThis->pszUUID));
+	CHKiRet(binrecAddSz(r, (pThis->pRuleset == NULL) ? NULL : rulesetGetName(pThis->pRuleset)));
+	CHKiRet(binrecAddUInt(r, '\n', 1));
+
+	/* now we know the size and can fill in the header */
+	len = r->len;
+	r->len = 0;
+	binrecPutUInt(r, MSG_BINREC_MAGIC, 1);
+	binrecPutUInt(r, MSG_BINREC_VERSION, 1);
+	binrecPutUInt(r, len - BINREC_HDRLEN - 1, 4);
+	r->len = len;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* serialize a message object in binary record format to a stream */
+rsRetVal
+MsgSerializeBinary(msg_t *pThis, strm_t *pStrm)
+{
+	binrec_t rec;
+	DEFiRet;
+
 	assert(pThis != NULL);
 	assert(pStrm != NULL);
 
-	/* then serialize elements */
-	CHKiRet(obj.BeginSerialize(pStrm, (obj_t*) pThis));
-	objSerializeSCALAR(pStrm, iProtocolVersion, SHORT);
-	objSerializeSCALAR(pStrm, iSeverity, SHORT);
-	objSerializeSCALAR(pStrm, iFacility, SHORT);
-	objSerializeSCALAR(pStrm, msgFlags, INT);
-	objSerializeSCALAR(pStrm, ttGenTime, INT);
-	objSerializeSCALAR(pStrm, tRcvdAt, SYSLOGTIME);
-	objSerializeSCALAR(pStrm, tTIMESTAMP, SYSLOGTIME);
+	rec.buf = rec.fixbuf;
+	rec.size = sizeof(rec.fixbuf);
+	CHKiRet(binrecBuild(pThis, &rec));
+	CHKiRet(strm.RecordBegin(pStrm));
+	CHKiRet(strm.Write(pStrm, rec.buf, rec.len));
+	CHKiRet(strm.RecordEnd(pStrm));
 
-	CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("pszTAG"), PROPTYPE_PSZ, (void*)
-		((pThis->iLenTAG < CONF_TAG_BUFSIZE) ? pThis->TAG.szBuf : pThis->TAG.pszTAG)));
+finalize_it:
+	if(rec.buf != rec.fixbuf)
+		free(rec.buf);
+	RETiRet;
+}
 
-	objSerializePTR(pStrm, pszRawMsg, PSZ);
-	objSerializePTR(pStrm, pszHOSTNAME, PSZ);
-	getInputName(pThis, &psz, &len);
-	CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("pszInputName"), PROPTYPE_PSZ, (void*) psz));
-	psz = getRcvFrom(pThis); 
-	CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("pszRcvFrom"), PROPTYPE_PSZ, (void*) psz));
-	psz = getRcvFromIP(pThis); 
-	CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("pszRcvFromIP"), PROPTYPE_PSZ, (void*) psz));
-	psz = pThis->pszStrucData; 
-	CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("pszRcvStrucData"), PROPTYPE_PSZ, (void*) psz));
-	if(pThis->json != NULL) {
-		psz = (uchar*) json_object_get_string(pThis->json);
-		CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("json"), PROPTYPE_PSZ, (void*) psz));
-	}
-	if(pThis->localvars != NULL) {
-		psz = (uchar*) json_object_get_string(pThis->localvars);
-		CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("localvars"), PROPTYPE_PSZ, (void*) psz));
-	}
 
-	objSerializePTR(pStrm, pCSAPPNAME, CSTR);
-	objSerializePTR(pStrm, pCSPROCID, CSTR);
-	objSerializePTR(pStrm, pCSMSGID, CSTR);
-	
-	objSerializePTR(pStrm, pszUUID, PSZ);
+/* serialize a message object in binary record format to a memory buffer,
+ * e.g. for sending it to another rsyslog instance. *ppBuf is a malloc()ed
+ * buffer of *pLenBuf octets (or NULL and 0) owned by the caller, which is
+ * grown as needed. The record length is returned in *pLenRec. The buffer
+ * is always one octet larger than the record, so that the caller can
+ * terminate it if it needs to.
+ */
+rsRetVal
+MsgSerializeBinaryBuf(msg_t *pThis, uchar **ppBuf, size_t *pLenBuf, size_t *pLenRec)
+{
+	binrec_t rec;
+	DEFiRet;
 
-	if(pThis->pRuleset != NULL) {
-		rulesetGetName(pThis->pRuleset);
-		CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("pszRuleset"), PROPTYPE_PSZ,
-			rulesetGetName(pThis->pRuleset)));
+	assert(pThis != NULL);
+
+	rec.buf = *ppBuf;
+	rec.size = *pLenBuf;
+	if(rec.buf == NULL)
+		rec.size = 0; /* make sure binrecNeed() does not use fixbuf */
+	iRet = binrecBuild(pThis, &rec);
+	if(iRet == RS_RET_OK)
+		iRet = binrecNeed(&rec, 1);
+	/* the buffer may have been moved, even on error */
+	*ppBuf = rec.buf;
+	*pLenBuf = rec.size;
+	*pLenRec = rec.len;
+	RETiRet;
+}
+
+
+/* cursor for parsing binary records */
+typedef struct binrecCursor_s {
+	uchar *p;
+	size_t left;
+} binrecCursor_t;
+
+static inline rsRetVal
+binrecGetUInt(binrecCursor_t *c, uint64_t *pVal, int nOctets)
+{
+	uint64_t val = 0;
+	int i;
+
+	if(c->left < (size_t) nOctets)
+		return RS_RET_QUEUE_REC_INVLD;
+	for(i = nOctets - 1 ; i >= 0 ; --i)
+		val = (val << 8) | c->p[i];
+	c->p += nOctets;
+	c->left -= nOctets;
+	*pVal = val;
+	return RS_RET_OK;
+}
+
+/* get a string. *ppsz is set to NULL if the property is not present. The
+ * string points into the record buffer.
+ */
+static rsRetVal
+binrecGetStr(binrecCursor_t *c, uchar **ppsz, size_t *pLen)
+{
+	uint64_t len;
+	DEFiRet;
+
+	CHKiRet(binrecGetUInt(c, &len, 4));
+	if(len == BINREC_NOSTR) {
+		*ppsz = NULL;
+		*pLen = 0;
+		FINALIZE;
 	}
+	if(len >= c->left || c->p[len] != '\0')
+		ABORT_FINALIZE(RS_RET_QUEUE_REC_INVLD);
+	*ppsz = c->p;
+	*pLen = len;
+	c->p += len + 1;
+	c->left -= len + 1;
+finalize_it:
+	RETiRet;
+}
 
-	/* offset must be serialized after pszRawMsg, because we need that to obtain the correct
-	 * MSG size.
-	 */
-	objSerializeSCALAR(pStrm, offMSG, SHORT);
+static rsRetVal
+binrecGetTime(binrecCursor_t *c, struct syslogTime *t)
+{
+	DEFiRet;
 
-	CHKiRet(obj.EndSerialize(pStrm));
+	if(c->left < 16)
+		ABORT_FINALIZE(RS_RET_QUEUE_REC_INVLD);
+	t->timeType = c->p[0];
+	t->month = c->p[1];
+	t->day = c->p[2];
+	t->hour = c->p[3];
+	t->minute = c->p[4];
+	t->second = c->p[5];
+	t->secfracPrecision = c->p[6];
+	t->OffsetMinute = c->p[7];
+	t->OffsetHour = c->p[8];
+	t->OffsetMode = c->p[9];
+	t->year = (short) (c->p[10] | (c->p[11] << 8));
+	t->secfrac = (int) ((uint32_t) c->p[12] | ((uint32_t) c->p[13] << 8)
+			    | ((uint32_t) c->p[14] << 16) | ((uint32_t) c->p[15] << 24));
+	c->p += 16;
+	c->left -= 16;
+finalize_it:
+	RETiRet;
+}
+
+/* parse a JSON property */
+static inline struct json_object *
+binrecJSON(uchar *psz, size_t len)
+{
+	struct json_tokener *tokener;
+	struct json_object *json;
+
+	if(psz == NULL)
+		return NULL;
+	tokener = json_tokener_new();
+	json = json_tokener_parse_ex(tokener, (char*) psz, len);
+	json_tokener_free(tokener);
+	return json;
+}
+
+
+/* get the payload length from the header octets following the magic */
+static inline rsRetVal
+binrecPayloadLen(uchar *hdr, size_t *pLen)
+{
+	size_t len;
+	DEFiRet;
 
+	if(hdr[0] != MSG_BINREC_VERSION)
+		ABORT_FINALIZE(RS_RET_INVALID_HEADER_VERS);
+	len = (size_t) hdr[1] | ((size_t) hdr[2] << 8) | ((size_t) hdr[3] << 16) | ((size_t) hdr[4] << 24);
+	if(len > BINREC_MAXLEN)
+		ABORT_FINALIZE(RS_RET_QUEUE_REC_INVLD);
+	*pLen = len;
 finalize_it:
 	RETiRet;
 }
 
 
-/* This is a helper for MsgDeserialize that re-inits the var object. This
- * whole construct should be replaced, var is really ready to be retired.
- * But as an interim help during refactoring let's introduce this function
- * here (and thus NOT as method of var object!). -- rgerhads, 2012-11-06
- */
-static inline void
-reinitVar(var_t *pVar)
-{
-	rsCStrDestruct(&pVar->pcsName); /* no longer needed */
-	if(pVar->varType == VARTYPE_STR) {
-		if(pVar->val.pStr != NULL)
-			rsCStrDestruct(&pVar->val.pStr);
-	}
-}
-/* deserialize the message again 
- * we deserialize the properties in the same order that we serialized them. Except
- * for some checks to cover downlevel version, we do not need to do all these
- * CPU intense name checkings.
+/* create a message object from the payload of a binary record. The
+ * payload must be followed by the trailer, which is already checked.
  */
-#define isProp(name) !rsCStrSzStrCmp(pVar->pcsName, (uchar*) name, sizeof(name) - 1)
-rsRetVal
-MsgDeserialize(msg_t * const pMsg, strm_t *pStrm)
+static rsRetVal
+binrecParse(uchar *buf, size_t lenPayload, msg_t **ppMsg)
 {
+	binrecCursor_t c;
+	uint64_t val;
+	uint64_t offMSG;
+	uchar *psz;
+	size_t len;
 	prop_t *myProp;
 	prop_t *propRcvFrom = NULL;
 	prop_t *propRcvFromIP = NULL;
-	struct json_tokener *tokener;
-	var_t *pVar = NULL;
+	uchar *pszRuleset;
+	msg_t *pMsg = NULL;
 	DEFiRet;
 
-	ISOBJ_TYPE_assert(pStrm, strm);
-
-	CHKiRet(var.Construct(&pVar));
-	CHKiRet(var.ConstructFinalize(pVar));
-
-	CHKiRet(objDeserializeProperty(pVar, pStrm));
-	if(isProp("iProtocolVersion")) {
-		setProtocolVersion(pMsg, pVar->val.num);
-		reinitVar(pVar);
-		CHKiRet(objDeserializeProperty(pVar, pStrm));
-	}
-	if(isProp("iSeverity")) {
-		pMsg->iSeverity = pVar->val.num;
-		reinitVar(pVar);
-		CHKiRet(objDeserializeProperty(pVar, pStrm));
-	}
-	if(isProp("iFacility")) {
-		pMsg->iFacility = pVar->val.num;
-		reinitVar(pVar);
-		CHKiRet(objDeserializeProperty(pVar, pStrm));
-	}
-	if(isProp("msgFlags")) {
-		pMsg->msgFlags = pVar->val.num;
-		reinitVar(pVar);
-		CHKiRet(objDeserializeProperty(pVar, pStrm));
-	}
-	if(isProp("ttGenTime")) {
-		pMsg->ttGenTime = pVar->val.num;
-		reinitVar(pVar);
-		CHKiRet(objDeserializeProperty(pVar, pStrm));
-	}
-	if(isProp("tRcvdAt")) {
-		memcpy(&pMsg->tRcvdAt, &pVar->val.vSyslogTime, sizeof(struct syslogTime));
-		reinitVar(pVar);
-		CHKiRet(objDeserializeProperty(pVar, pStrm));
-	}
-	if(isProp("tTIMESTAMP")) {
-		memcpy(&pMsg->tTIMESTAMP, &pVar->val.vSyslogTime, sizeof(struct syslogTime));
-		reinitVar(pVar);
-		CHKiRet(objDeserializeProperty(pVar, pStrm));
-	}
-	if(isProp("pszTAG")) {
-		MsgSetTAG(pMsg, rsCStrGetSzStrNoNULL(pVar->val.pStr), cstrLen(pVar->val.pStr));
-		reinitVar(pVar);
-		CHKiRet(objDeserializeProperty(pVar, pStrm));
-	}
-	if(isProp("pszRawMsg")) {
-		MsgSetRawMsg(pMsg, (char*) rsCStrGetSzStrNoNULL(pVar->val.pStr), cstrLen(pVar->val.pStr));
-		reinitVar(pVar);
-		CHKiRet(objDeserializeProperty(pVar, pStrm));
-	}
-	if(isProp("pszHOSTNAME")) {
-		MsgSetHOSTNAME(pMsg, rsCStrGetSzStrNoNULL(pVar->val.pStr), rsCStrLen(pVar->val.pStr));
-		reinitVar(pVar);
-		CHKiRet(objDeserializeProperty(pVar, pStrm));
-	}
-	if(isProp("pszInputName")) {
-		/* we need to create a property */ 
+	c.p = buf;
+	c.left = lenPayload;
+
+	CHKiRet(msgConstructForDeserializer(&pMsg));
+	CHKiRet(binrecGetUInt(&c, &val, 2));
+	setProtocolVersion(pMsg, (short) val);
+	CHKiRet(binrecGetUInt(&c, &val, 2));
+	pMsg->iSeverity = (short) val;
+	CHKiRet(binrecGetUInt(&c, &val, 2));
+	pMsg->iFacility = (short) val;
+	CHKiRet(binrecGetUInt(&c, &val, 4));
+	pMsg->msgFlags = (int) val;
+	CHKiRet(binrecGetUInt(&c, &val, 8));
+	pMsg->ttGenTime = (time_t) val;
+	CHKiRet(binrecGetUInt(&c, &offMSG, 2));
+	CHKiRet(binrecGetTime(&c, &pMsg->tRcvdAt));
+	CHKiRet(binrecGetTime(&c, &pMsg->tTIMESTAMP));
+
+	CHKiRet(binrecGetStr(&c, &psz, &len));
+	if(psz != NULL)
+		MsgSetTAG(pMsg, psz, len);
+	CHKiRet(binrecGetStr(&c, &psz, &len));
+	if(psz != NULL)
+		MsgSetRawMsg(pMsg, (char*) psz, len);
+	CHKiRet(binrecGetStr(&c, &psz, &len));
+	if(psz != NULL)
+		MsgSetHOSTNAME(pMsg, psz, len);
+	CHKiRet(binrecGetStr(&c, &psz, &len));
+	if(psz != NULL) {
 		CHKiRet(prop.Construct(&myProp));
-		CHKiRet(prop.SetString(myProp, rsCStrGetSzStrNoNULL(pVar->val.pStr), rsCStrLen(pVar->val.pStr)));
+		CHKiRet(prop.SetString(myProp, psz, len));
 		CHKiRet(prop.ConstructFinalize(myProp));
 		MsgSetInputName(pMsg, myProp);
 		prop.Destruct(&myProp);
-		reinitVar(pVar);
-		CHKiRet(objDeserializeProperty(pVar, pStrm));
 	}
-	if(isProp("pszRcvFrom")) {
-		MsgSetRcvFromStr(pMsg, rsCStrGetSzStrNoNULL(pVar->val.pStr), rsCStrLen(pVar->val.pStr), &propRcvFrom);
+	CHKiRet(binrecGetStr(&c, &psz, &len));
+	if(psz != NULL) {
+		MsgSetRcvFromStr(pMsg, psz, len, &propRcvFrom);
 		prop.Destruct(&propRcvFrom);
-		reinitVar(pVar);
-		CHKiRet(objDeserializeProperty(pVar, pStrm));
 	}
-	if(isProp("pszRcvFromIP")) {
-		MsgSetRcvFromIPStr(pMsg, rsCStrGetSzStrNoNULL(pVar->val.pStr), rsCStrLen(pVar->val.pStr), &propRcvFromIP);
+	CHKiRet(binrecGetStr(&c, &psz, &len));
+	if(psz != NULL) {
+		MsgSetRcvFromIPStr(pMsg, psz, len, &propRcvFromIP);
 		prop.Destruct(&propRcvFromIP);
-		reinitVar(pVar);
-		CHKiRet(objDeserializeProperty(pVar, pStrm));
-	}
-	if(isProp("json")) {
-		tokener = json_tokener_new();
-		pMsg->json = json_tokener_parse_ex(tokener, (char*)rsCStrGetSzStrNoNULL(pVar->val.pStr),
-					     cstrLen(pVar->val.pStr));
-		json_tokener_free(tokener);
-		reinitVar(pVar);
-		CHKiRet(objDeserializeProperty(pVar, pStrm));
-	}
-	if(isProp("localvars")) {
-		tokener = json_tokener_new();
-		pMsg->localvars = json_tokener_parse_ex(tokener, (char*)rsCStrGetSzStrNoNULL(pVar->val.pStr),
-						        cstrLen(pVar->val.pStr));
-		json_tokener_free(tokener);
-		reinitVar(pVar);
-		CHKiRet(objDeserializeProperty(pVar, pStrm));
 	}
-	if(isProp("pszStrucData")) {
-		MsgSetStructuredData(pMsg, (char*) rsCStrGetSzStrNoNULL(pVar->val.pStr));
-		reinitVar(pVar);
-		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	CHKiRet(binrecGetStr(&c, &psz, &len));
+	if(psz != NULL) {
+		MsgSetStructuredData(pMsg, (char*) psz);
 	}
-	if(isProp("pCSAPPNAME")) {
-		MsgSetAPPNAME(pMsg, (char*) rsCStrGetSzStrNoNULL(pVar->val.pStr));
-		reinitVar(pVar);
-		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	CHKiRet(binrecGetStr(&c, &psz, &len));
+	pMsg->json = binrecJSON(psz, len);
+	CHKiRet(binrecGetStr(&c, &psz, &len));
+	pMsg->localvars = binrecJSON(psz, len);
+	CHKiRet(binrecGetStr(&c, &psz, &len));
+	if(psz != NULL) {
+		MsgSetAPPNAME(pMsg, (char*) psz);
 	}
-	if(isProp("pCSPROCID")) {
-		MsgSetPROCID(pMsg, (char*) rsCStrGetSzStrNoNULL(pVar->val.pStr));
-		reinitVar(pVar);
-		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	CHKiRet(binrecGetStr(&c, &psz, &len));
+	if(psz != NULL) {
+		MsgSetPROCID(pMsg, (char*) psz);
 	}
-	if(isProp("pCSMSGID")) {
-		MsgSetMSGID(pMsg, (char*) rsCStrGetSzStrNoNULL(pVar->val.pStr));
-		reinitVar(pVar);
-		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	CHKiRet(binrecGetStr(&c, &psz, &len));
+	if(psz != NULL) {
+		MsgSetMSGID(pMsg, (char*) psz);
 	}
-	if(isProp("pszUUID")) {
-		pMsg->pszUUID = ustrdup(rsCStrGetSzStrNoNULL(pVar->val.pStr));
-		reinitVar(pVar);
-		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	CHKiRet(binrecGetStr(&c, &psz, &len));
+	if(psz != NULL) {
+		CHKmalloc(pMsg->pszUUID = ustrdup(psz));
 	}
-	if(isProp("pszRuleset")) {
-		MsgSetRulesetByName(pMsg, pVar->val.pStr);
-		reinitVar(pVar);
-		CHKiRet(objDeserializeProperty(pVar, pStrm));
+	CHKiRet(binrecGetStr(&c, &pszRuleset, &len));
+	if(pszRuleset != NULL) {
+		rulesetGetRuleset(runConf, &(pMsg->pRuleset), pszRuleset);
 	}
-	/* "offMSG" must always be our last field, so we use this as an
-	 * indicator if the sequence is correct. This is a bit questionable,
-	 * but on the other hand it works decently AND we will probably replace
-	 * the whole persisted format soon in any case. -- rgerhards, 2012-11-06
-	 */
-	if(!isProp("offMSG"))
-		ABORT_FINALIZE(RS_RET_DS_PROP_SEQ_ERR);
-	MsgSetMSGoffs(pMsg, pVar->val.num);
+
+	/* as with the old format, the offset must be set after the raw message */
+	MsgSetMSGoffs(pMsg, (short) offMSG);
+	*ppMsg = pMsg;
+	pMsg = NULL;
+
+finalize_it:
+	if(pMsg != NULL)
+		msgDestruct(&pMsg);
+	RETiRet;
+}
+
+
+/* deserialize a message that was written by MsgSerializeBinary(). The caller
+ * must already have read the magic octet, which it uses to detect the record
+ * format. On success, a new message object is returned in *ppMsg.
+ */
+rsRetVal
+MsgDeserializeBinary(msg_t **ppMsg, strm_t *pStrm)
+{
+	uchar hdr[BINREC_HDRLEN - 1];
+	uchar fixbuf[4096];
+	uchar *buf = fixbuf;
+	size_t lenRec;
+	DEFiRet;
+
+	ISOBJ_TYPE_assert(pStrm, strm);
+
+	CHKiRet(strm.Read(pStrm, hdr, sizeof(hdr)));
+	CHKiRet(binrecPayloadLen(hdr, &lenRec));
+	++lenRec; /* trailer */
+	if(lenRec > sizeof(fixbuf))
+		CHKmalloc(buf = malloc(lenRec));
+	CHKiRet(strm.Read(pStrm, buf, lenRec));
+	if(buf[lenRec - 1] != '\n')
+		ABORT_FINALIZE(RS_RET_INVALID_TRAILER);
+	CHKiRet(binrecParse(buf, lenRec - 1, ppMsg));
+
+finalize_it:
+	if(buf != fixbuf)
+		free(buf);
+	RETiRet;
+}
+
+
+/* get the total length of a binary record from its first MSG_BINREC_HDRLEN
+ * octets, so that a receiver knows how much data it needs to collect.
+ */
+rsRetVal
+MsgBinaryRecLen(uchar *hdr, size_t *pLenRec)
+{
+	size_t len;
+	DEFiRet;
+
+	if(hdr[0] != MSG_BINREC_MAGIC)
+		ABORT_FINALIZE(RS_RET_INVALID_HEADER);
+	CHKiRet(binrecPayloadLen(hdr + 1, &len));
+	*pLenRec = BINREC_HDRLEN + len + 1;
+finalize_it:
+	RETiRet;
+}
+
+
+/* deserialize a complete binary record (including header and trailer) of
+ * lenRec octets from a memory buffer, e.g. one received from another
+ * rsyslog instance. The buffer must stay valid during the call only.
+ */
+rsRetVal
+MsgDeserializeBinaryBuf(msg_t **ppMsg, uchar *rec, size_t lenRec)
+{
+	size_t lenExpected;
+	DEFiRet;
+
+	if(lenRec < BINREC_HDRLEN + 1)
+		ABORT_FINALIZE(RS_RET_QUEUE_REC_INVLD);
+	CHKiRet(MsgBinaryRecLen(rec, &lenExpected));
+	if(lenExpected != lenRec)
+		ABORT_FINALIZE(RS_RET_QUEUE_REC_INVLD);
+	if(rec[lenRec - 1] != '\n')
+		ABORT_FINALIZE(RS_RET_INVALID_TRAILER);
+	CHKiRet(binrecParse(rec + BINREC_HDRLEN, lenRec - BINREC_HDRLEN - 1, ppMsg));
+
 finalize_it:
-	if(pVar != NULL)
-		var.Destruct(&pVar);
 	RETiRet;
 }
-#undef isProp
 
 
 /* Increment reference count - see description of the "msg"
@@ -1298,6 +2934,7 @@ static rsRetVal aquirePROCIDFromTAG(msg_t * const pM)
 {
 	register int i;
 	uchar *pszTag;
+	cstr_t *pCSPROCID = NULL;
 	DEFiRet;
 
 	assert(pM != NULL);
@@ -1320,9 +2957,10 @@ static rsRetVal aquirePROCIDFromTAG(msg_t * const pM)
 	++i; /* skip '[' */
 
 	/* now obtain the PROCID string... */
-	CHKiRet(cstrConstruct(&pM->pCSPROCID));
+	pCSPROCID = &pM->csPROCID;
+	cstrConstructInPlace(pCSPROCID);
 	while((i < pM->iLenTAG) && (pszTag[i] != ']')) {
-		CHKiRet(cstrAppendChar(pM->pCSPROCID, pszTag[i]));
+		CHKiRet(cstrAppendChar(pCSPROCID, pszTag[i]));
 		++i;
 	}
 
@@ -1332,14 +2970,20 @@ static rsRetVal aquirePROCIDFromTAG(msg_t * const pM)
 		 * the buffer and simply return. Note that this is NOT an error
 		 * case!
 		 */
-		cstrDestruct(&pM->pCSPROCID);
 		FINALIZE;
 	}
 
-	/* OK, finaally we could obtain a PROCID. So let's use it ;) */
-	CHKiRet(cstrFinalize(pM->pCSPROCID));
+	/* OK, finaally we could obtain a PROCID. So let's use it ;)
+	 * It is published only when complete, as readers check it without lock.
+	 */
+	CHKiRet(cstrFinalize(pCSPROCID));
+	ATOMIC_BARRIER();
+	pM->pCSPROCID = pCSPROCID;
+	pCSPROCID = NULL;
 
 finalize_it:
+	if(pCSPROCID != NULL)
+		cstrDestruct(&pCSPROCID);
 	RETiRet;
 }
 
@@ -1381,6 +3025,7 @@ aquireProgramName(msg_t * const pM)
 	}
 	memcpy((char*)pszProgName, (char*)pszTag, i);
 	pszProgName[i] = '\0';
+	ATOMIC_BARRIER(); /* iLenPROGNAME is checked without lock */
 	pM->iLenPROGNAME = i;
 finalize_it:
 	RETiRet;
@@ -1406,34 +3051,127 @@ char *getProtocolVersionString(msg_t * const pM)
 	return(pM->iProtocolVersion ? "1" : "0");
 }
 
+int iMsgUUIDType = MSG_UUID_LIBUUID;
+
 #ifdef USE_LIBUUID
 /* note: libuuid seems not to be thread-safe, so we need
  * to get some safeguards in place.
  */
+static pthread_mutex_t mutUUID = PTHREAD_MUTEX_INITIALIZER;
+
+/* Per-thread generator for v4 and v7 UUIDs, a xorshift128+ PRNG. It is
+ * seeded from libuuid once per thread, after that UUIDs are generated
+ * without any locking or system calls.
+ */
+typedef struct uuidGen_s {
+	uint64_t s[2];
+} uuidGen_t;
+static pthread_key_t keyUUIDGen;
+
+static inline uint64_t
+uuidGenNext(uuidGen_t *pGen)
+{
+	uint64_t s1 = pGen->s[0];
+	const uint64_t s0 = pGen->s[1];
+
+	pGen->s[0] = s0;
+	s1 ^= s1 << 23;
+	pGen->s[1] = s1 ^ s0 ^ (s1 >> 17) ^ (s0 >> 26);
+	return pGen->s[1] + s0;
+}
+
+/* get the calling thread's generator, NULL if we are out of memory */
+static uuidGen_t *
+uuidGenGet(void)
+{
+	uuidGen_t *pGen;
+	uuid_t seed;
+
+	if((pGen = (uuidGen_t*) pthread_getspecific(keyUUIDGen)) != NULL)
+		return pGen;
+	if((pGen = malloc(sizeof(uuidGen_t))) == NULL)
+		return NULL;
+	pthread_mutex_lock(&mutUUID);
+	uuid_generate(seed);
+	pthread_mutex_unlock(&mutUUID);
+	memcpy(pGen->s, seed, sizeof(pGen->s));
+	if(pGen->s[0] == 0 && pGen->s[1] == 0) /* the all-zero state must be avoided */
+		pGen->s[1] = 1;
+	pthread_setspecific(keyUUIDGen, pGen);
+	return pGen;
+}
+
+/* generate a version 4 or 7 UUID. Returns 0 if this is not possible, in
+ * which case the caller should use libuuid.
+ */
+static int
+uuidGenerateFast(msg_t * const pM, uuid_t uuid)
+{
+	uuidGen_t *pGen;
+	uint64_t r[2];
+	uint64_t ms;
+	int prec;
+	int i;
+
+	if((pGen = uuidGenGet()) == NULL)
+		return 0;
+	r[0] = uuidGenNext(pGen);
+	r[1] = uuidGenNext(pGen);
+	memcpy(uuid, r, sizeof(uuid_t));
+	if(iMsgUUIDType == MSG_UUID_V7) {
+		/* 48 bit Unix time in ms, big endian. We use the reception time,
+		 * so UUIDs are ordered like the messages were received.
+		 */
+		ms = (uint64_t) pM->ttGenTime * 1000;
+		prec = pM->tRcvdAt.secfracPrecision;
+		if(prec > 3) {
+			for(i = prec, r[0] = pM->tRcvdAt.secfrac ; i > 3 ; --i)
+				r[0] /= 10;
+			ms += r[0];
+		} else if(prec > 0) {
+			for(i = prec, r[0] = pM->tRcvdAt.secfrac ; i < 3 ; ++i)
+				r[0] *= 10;
+			ms += r[0];
+		}
+		for(i = 5 ; i >= 0 ; --i, ms >>= 8)
+			uuid[i] = ms & 0xff;
+		uuid[6] = (uuid[6] & 0x0f) | 0x70;
+	} else {
+		uuid[6] = (uuid[6] & 0x0f) | 0x40;
+	}
+	uuid[8] = (uuid[8] & 0x3f) | 0x80; /* RFC 4122 variant */
+	return 1;
+}
+
 static void msgSetUUID(msg_t * const pM)
 {
 	size_t lenRes = sizeof(uuid_t) * 2 + 1;
 	char hex_char [] = "0123456789ABCDEF";
 	unsigned int byte_nbr;
 	uuid_t uuid;
-	static pthread_mutex_t mutUUID = PTHREAD_MUTEX_INITIALIZER;
+	uchar *pszUUID;
 
 	dbgprintf("[MsgSetUUID] START\n");
 	assert(pM != NULL);
 
-	if((pM->pszUUID = (uchar*) MALLOC(lenRes)) == NULL) {
+	if((pszUUID = (uchar*) MALLOC(lenRes)) == NULL) {
 		pM->pszUUID = (uchar *)"";
 	} else {
-		pthread_mutex_lock(&mutUUID);
-		uuid_generate(uuid);
-		pthread_mutex_unlock(&mutUUID);
+		if(iMsgUUIDType == MSG_UUID_LIBUUID || !uuidGenerateFast(pM, uuid)) {
+			pthread_mutex_lock(&mutUUID);
+			uuid_generate(uuid);
+			pthread_mutex_unlock(&mutUUID);
+		}
 		for (byte_nbr = 0; byte_nbr < sizeof (uuid_t); byte_nbr++) {
-			pM->pszUUID[byte_nbr * 2 + 0] = hex_char[uuid [byte_nbr] >> 4];
-			pM->pszUUID[byte_nbr * 2 + 1] = hex_char[uuid [byte_nbr] & 15];
+			pszUUID[byte_nbr * 2 + 0] = hex_char[uuid [byte_nbr] >> 4];
+			pszUUID[byte_nbr * 2 + 1] = hex_char[uuid [byte_nbr] & 15];
 		}
 
-		dbgprintf("[MsgSetUUID] UUID : %s LEN: %d \n", pM->pszUUID, (int)lenRes);
-		pM->pszUUID[lenRes] = '\0';
+		pszUUID[lenRes - 1] = '\0';
+		dbgprintf("[MsgSetUUID] UUID : %s LEN: %d \n", pszUUID, (int)lenRes);
+		/* readers check pszUUID without the lock, so it must be complete */
+		ATOMIC_BARRIER();
+		pM->pszUUID = pszUUID;
 	}
 	dbgprintf("[MsgSetUUID] END\n");
 }
@@ -1534,6 +3272,42 @@ getPRI(msg_t * const pM)
 }
 
 
+/* Helper for the lazily formatted timestamps below: if the string for
+ * property field is not yet set, format it into its buffer via fmt (which
+ * writes to pszLazyBuf) and publish the result. The msgTimeStrs_s structure
+ * is created on first use, and the pointers are set only after the data
+ * they point to is complete, so they can be checked without holding the lock.
+ */
+#define LAZY_FMT_TIMESTAMP(field, fmt) \
+	if(pM->pTimeStrs == NULL || pM->pTimeStrs->psz##field == NULL) { \
+		char *pszLazyBuf; \
+		MsgLock(pM); \
+		if(msgGetTimeStrs(pM) != NULL && pM->pTimeStrs->psz##field == NULL) { \
+			pszLazyBuf = pM->pTimeStrs->sz##field; \
+			fmt; \
+			ATOMIC_BARRIER(); \
+			pM->pTimeStrs->psz##field = pszLazyBuf; \
+		} \
+		MsgUnlock(pM); \
+	} \
+	return((pM->pTimeStrs == NULL || pM->pTimeStrs->psz##field == NULL) \
+	       ? "" : pM->pTimeStrs->psz##field)
+
+/* get the formatted timestamp strings of pM, create them if needed.
+ * pM must be locked.
+ */
+static inline struct msgTimeStrs_s *
+msgGetTimeStrs(msg_t * const pM)
+{
+	struct msgTimeStrs_s *pTimeStrs;
+
+	if(pM->pTimeStrs == NULL && (pTimeStrs = calloc(1, sizeof(struct msgTimeStrs_s))) != NULL) {
+		ATOMIC_BARRIER();
+		pM->pTimeStrs = pTimeStrs;
+	}
+	return pM->pTimeStrs;
+}
+
 char *
 getTimeReported(msg_t * const pM, enum tplFormatTypes eFmt)
 {
@@ -1545,61 +3319,24 @@ getTimeReported(msg_t * const pM, enum tplFormatTypes eFmt)
 	case tplFmtDefault:
 	case tplFmtRFC3164Date:
 	case tplFmtRFC3164BuggyDate:
-		MsgLock(pM);
-		if(pM->pszTIMESTAMP3164 == NULL) {
-			pM->pszTIMESTAMP3164 = pM->pszTimestamp3164;
-			datetime.formatTimestamp3164(&pM->tTIMESTAMP, pM->pszTIMESTAMP3164,
-						     (eFmt == tplFmtRFC3164BuggyDate));
-		}
-		MsgUnlock(pM);
-		return(pM->pszTIMESTAMP3164);
+		LAZY_FMT_TIMESTAMP(TIMESTAMP3164,
+			datetime.formatTimestamp3164(&pM->tTIMESTAMP, pszLazyBuf,
+						     eFmt == tplFmtRFC3164BuggyDate));
 	case tplFmtMySQLDate:
-		MsgLock(pM);
-		if(pM->pszTIMESTAMP_MySQL == NULL) {
-			if((pM->pszTIMESTAMP_MySQL = MALLOC(15)) == NULL) {
-				MsgUnlock(pM);
-				return "";
-			}
-			datetime.formatTimestampToMySQL(&pM->tTIMESTAMP, pM->pszTIMESTAMP_MySQL);
-		}
-		MsgUnlock(pM);
-		return(pM->pszTIMESTAMP_MySQL);
-        case tplFmtPgSQLDate:
-                MsgLock(pM);
-                if(pM->pszTIMESTAMP_PgSQL == NULL) {
-                        if((pM->pszTIMESTAMP_PgSQL = MALLOC(21)) == NULL) {
-                                MsgUnlock(pM);
-                                return "";
-                        }
-                        datetime.formatTimestampToPgSQL(&pM->tTIMESTAMP, pM->pszTIMESTAMP_PgSQL);
-                }
-                MsgUnlock(pM);
-                return(pM->pszTIMESTAMP_PgSQL);
+		LAZY_FMT_TIMESTAMP(TIMESTAMP_MySQL,
+			datetime.formatTimestampToMySQL(&pM->tTIMESTAMP, pszLazyBuf));
+	case tplFmtPgSQLDate:
+		LAZY_FMT_TIMESTAMP(TIMESTAMP_PgSQL,
+			datetime.formatTimestampToPgSQL(&pM->tTIMESTAMP, pszLazyBuf));
 	case tplFmtRFC3339Date:
-		MsgLock(pM);
-		if(pM->pszTIMESTAMP3339 == NULL) {
-			pM->pszTIMESTAMP3339 = pM->pszTimestamp3339;
-			datetime.formatTimestamp3339(&pM->tTIMESTAMP, pM->pszTIMESTAMP3339);
-		}
-		MsgUnlock(pM);
-		return(pM->pszTIMESTAMP3339);
+		LAZY_FMT_TIMESTAMP(TIMESTAMP3339,
+			datetime.formatTimestamp3339(&pM->tTIMESTAMP, pszLazyBuf));
 	case tplFmtUnixDate:
-		MsgLock(pM);
-		if(pM->pszTIMESTAMP_Unix[0] == '\0') {
-			datetime.formatTimestampUnix(&pM->tTIMESTAMP, pM->pszTIMESTAMP_Unix);
-		}
-		MsgUnlock(pM);
-		return(pM->pszTIMESTAMP_Unix);
+		LAZY_FMT_TIMESTAMP(TIMESTAMP_Unix,
+			datetime.formatTimestampUnix(&pM->tTIMESTAMP, pszLazyBuf));
 	case tplFmtSecFrac:
-		if(pM->pszTIMESTAMP_SecFrac[0] == '\0') {
-			MsgLock(pM);
-			/* re-check, may have changed while we did not hold lock */
-			if(pM->pszTIMESTAMP_SecFrac[0] == '\0') {
-				datetime.formatTimestampSecFrac(&pM->tTIMESTAMP, pM->pszTIMESTAMP_SecFrac);
-			}
-			MsgUnlock(pM);
-		}
-		return(pM->pszTIMESTAMP_SecFrac);
+		LAZY_FMT_TIMESTAMP(TIMESTAMP_SecFrac,
+			datetime.formatTimestampSecFrac(&pM->tTIMESTAMP, pszLazyBuf));
 	}
 	ENDfunc
 	return "INVALID eFmt OPTION!";
@@ -1613,83 +3350,33 @@ static char *getTimeGenerated(msg_t * const pM, enum tplFormatTypes eFmt)
 
 	switch(eFmt) {
 	case tplFmtDefault:
-		MsgLock(pM);
-		if(pM->pszRcvdAt3164 == NULL) {
-			if((pM->pszRcvdAt3164 = MALLOC(16)) == NULL) {
-				MsgUnlock(pM);
-				return "";
-			}
-			datetime.formatTimestamp3164(&pM->tRcvdAt, pM->pszRcvdAt3164, 0);
-		}
-		MsgUnlock(pM);
-		return(pM->pszRcvdAt3164);
+		LAZY_FMT_TIMESTAMP(RcvdAt3164,
+			datetime.formatTimestamp3164(&pM->tRcvdAt, pszLazyBuf, 0));
 	case tplFmtMySQLDate:
-		MsgLock(pM);
-		if(pM->pszRcvdAt_MySQL == NULL) {
-			if((pM->pszRcvdAt_MySQL = MALLOC(15)) == NULL) {
-				MsgUnlock(pM);
-				return "";
-			}
-			datetime.formatTimestampToMySQL(&pM->tRcvdAt, pM->pszRcvdAt_MySQL);
-		}
-		MsgUnlock(pM);
-		return(pM->pszRcvdAt_MySQL);
-        case tplFmtPgSQLDate:
-                MsgLock(pM);
-                if(pM->pszRcvdAt_PgSQL == NULL) {
-                        if((pM->pszRcvdAt_PgSQL = MALLOC(21)) == NULL) {
-                                MsgUnlock(pM);
-                                return "";
-                        }
-                        datetime.formatTimestampToPgSQL(&pM->tRcvdAt, pM->pszRcvdAt_PgSQL);
-                }
-                MsgUnlock(pM);
-                return(pM->pszRcvdAt_PgSQL);
+		LAZY_FMT_TIMESTAMP(RcvdAt_MySQL,
+			datetime.formatTimestampToMySQL(&pM->tRcvdAt, pszLazyBuf));
+	case tplFmtPgSQLDate:
+		LAZY_FMT_TIMESTAMP(RcvdAt_PgSQL,
+			datetime.formatTimestampToPgSQL(&pM->tRcvdAt, pszLazyBuf));
 	case tplFmtRFC3164Date:
 	case tplFmtRFC3164BuggyDate:
-		MsgLock(pM);
-		if(pM->pszRcvdAt3164 == NULL) {
-			if((pM->pszRcvdAt3164 = MALLOC(16)) == NULL) {
-					MsgUnlock(pM);
-					return "";
-				}
-			datetime.formatTimestamp3164(&pM->tRcvdAt, pM->pszRcvdAt3164,
-						     (eFmt == tplFmtRFC3164BuggyDate));
-		}
-		MsgUnlock(pM);
-		return(pM->pszRcvdAt3164);
+		LAZY_FMT_TIMESTAMP(RcvdAt3164,
+			datetime.formatTimestamp3164(&pM->tRcvdAt, pszLazyBuf,
+						     eFmt == tplFmtRFC3164BuggyDate));
 	case tplFmtRFC3339Date:
-		MsgLock(pM);
-		if(pM->pszRcvdAt3339 == NULL) {
-			if((pM->pszRcvdAt3339 = MALLOC(33)) == NULL) {
-				MsgUnlock(pM);
-				return "";
-			}
-			datetime.formatTimestamp3339(&pM->tRcvdAt, pM->pszRcvdAt3339);
-		}
-		MsgUnlock(pM);
-		return(pM->pszRcvdAt3339);
-	case tplFmtUnixDate:
-		MsgLock(pM);
-		if(pM->pszRcvdAt_Unix[0] == '\0') {
-			datetime.formatTimestampUnix(&pM->tRcvdAt, pM->pszRcvdAt_Unix);
-		}
-		MsgUnlock(pM);
-		return(pM->pszRcvdAt_Unix);
+		LAZY_FMT_TIMESTAMP(RcvdAt3339,
+			datetime.formatTimestamp3339(&pM->tRcvdAt, pszLazyBuf));
+	case tplFmtUnixDate:
+		LAZY_FMT_TIMESTAMP(RcvdAt_Unix,
+			datetime.formatTimestampUnix(&pM->tRcvdAt, pszLazyBuf));
 	case tplFmtSecFrac:
-		if(pM->pszRcvdAt_SecFrac[0] == '\0') {
-			MsgLock(pM);
-			/* re-check, may have changed while we did not hold lock */
-			if(pM->pszRcvdAt_SecFrac[0] == '\0') {
-				datetime.formatTimestampSecFrac(&pM->tRcvdAt, pM->pszRcvdAt_SecFrac);
-			}
-			MsgUnlock(pM);
-		}
-		return(pM->pszRcvdAt_SecFrac);
+		LAZY_FMT_TIMESTAMP(RcvdAt_SecFrac,
+			datetime.formatTimestampSecFrac(&pM->tRcvdAt, pszLazyBuf));
 	}
 	ENDfunc
 	return "INVALID eFmt OPTION!";
 }
+#undef LAZY_FMT_TIMESTAMP
 
 
 static inline char *getSeverity(msg_t * const pM)
@@ -1796,14 +3483,35 @@ MsgSetAfterPRIOffs(msg_t * const pMsg, short offs)
  */
 rsRetVal MsgSetAPPNAME(msg_t * const pMsg, char* pszAPPNAME)
 {
+	return MsgSetAPPNAMEWithLen(pMsg, (uchar*) pszAPPNAME,
+				    (pszAPPNAME == NULL) ? 0 : strlen(pszAPPNAME));
+}
+
+
+/* set APP-NAME from a buffer that need not be \0-terminated, e.g.
+ * directly from inside the raw message. The same locking rules as for
+ * MsgSetAPPNAME() apply.
+ */
+rsRetVal MsgSetAPPNAMEWithLen(msg_t * const pMsg, uchar *pszAPPNAME, size_t lenAPPNAME)
+{
+	cstr_t *pCSAPPNAME;
 	DEFiRet;
 	assert(pMsg != NULL);
 	if(pMsg->pCSAPPNAME == NULL) {
-		/* we need to obtain the object first */
-		CHKiRet(rsCStrConstruct(&pMsg->pCSAPPNAME));
+		/* we need to obtain the object first. An emulated APPNAME is
+		 * checked without lock, so we publish it only when complete.
+		 */
+		pCSAPPNAME = &pMsg->csAPPNAME;
+		cstrConstructInPlace(pCSAPPNAME);
+		if((iRet = rsCStrSetSzStrWithLen(pCSAPPNAME, pszAPPNAME, lenAPPNAME)) != RS_RET_OK) {
+			rsCStrDestruct(&pCSAPPNAME);
+			FINALIZE;
+		}
+		ATOMIC_BARRIER();
+		pMsg->pCSAPPNAME = pCSAPPNAME;
+	} else {
+		iRet = rsCStrSetSzStrWithLen(pMsg->pCSAPPNAME, pszAPPNAME, lenAPPNAME);
 	}
-	/* if we reach this point, we have the object */
-	iRet = rsCStrSetSzStr(pMsg->pCSAPPNAME, (uchar*) pszAPPNAME);
 
 finalize_it:
 	RETiRet;
@@ -1813,15 +3521,24 @@ finalize_it:
 /* rgerhards 2004-11-24: set PROCID in msg object
  */
 rsRetVal MsgSetPROCID(msg_t * const pMsg, char* pszPROCID)
+{
+	return MsgSetPROCIDWithLen(pMsg, (uchar*) pszPROCID,
+				   (pszPROCID == NULL) ? 0 : strlen(pszPROCID));
+}
+
+
+/* set PROCID from a buffer that need not be \0-terminated */
+rsRetVal MsgSetPROCIDWithLen(msg_t * const pMsg, uchar *pszPROCID, size_t lenPROCID)
 {
 	DEFiRet;
 	ISOBJ_TYPE_assert(pMsg, msg);
 	if(pMsg->pCSPROCID == NULL) {
 		/* we need to obtain the object first */
-		CHKiRet(cstrConstruct(&pMsg->pCSPROCID));
+		cstrConstructInPlace(&pMsg->csPROCID);
+		pMsg->pCSPROCID = &pMsg->csPROCID;
 	}
 	/* if we reach this point, we have the object */
-	CHKiRet(rsCStrSetSzStr(pMsg->pCSPROCID, (uchar*) pszPROCID));
+	CHKiRet(rsCStrSetSzStrWithLen(pMsg->pCSPROCID, pszPROCID, lenPROCID));
 	CHKiRet(cstrFinalize(pMsg->pCSPROCID));
 
 finalize_it:
@@ -1835,7 +3552,7 @@ finalize_it:
  */
 static inline void preparePROCID(msg_t * const pM, sbool bLockMutex)
 {
-	if(pM->pCSPROCID == NULL) {
+	if(pM->pCSPROCID == NULL && msgGetProtocolVersion(pM) == 0) {
 		if(bLockMutex == LOCK_MUTEX)
 			MsgLock(pM);
 		/* re-query, things may have changed in the mean time... */
@@ -1866,15 +3583,11 @@ char *getPROCID(msg_t * const pM, sbool bLockMutex)
 	uchar *pszRet;
 
 	ISOBJ_TYPE_assert(pM, msg);
-	if(bLockMutex == LOCK_MUTEX)
-		MsgLock(pM);
-	preparePROCID(pM, MUTEX_ALREADY_LOCKED);
+	preparePROCID(pM, bLockMutex);
 	if(pM->pCSPROCID == NULL)
 		pszRet = UCHAR_CONSTANT("-");
 	else 
 		pszRet = rsCStrGetSzStrNoNULL(pM->pCSPROCID);
-	if(bLockMutex == LOCK_MUTEX)
-		MsgUnlock(pM);
 	return (char*) pszRet;
 }
 
@@ -1882,15 +3595,24 @@ char *getPROCID(msg_t * const pM, sbool bLockMutex)
 /* rgerhards 2004-11-24: set MSGID in msg object
  */
 rsRetVal MsgSetMSGID(msg_t * const pMsg, char* pszMSGID)
+{
+	return MsgSetMSGIDWithLen(pMsg, (uchar*) pszMSGID,
+				  (pszMSGID == NULL) ? 0 : strlen(pszMSGID));
+}
+
+
+/* set MSGID from a buffer that need not be \0-terminated */
+rsRetVal MsgSetMSGIDWithLen(msg_t * const pMsg, uchar *pszMSGID, size_t lenMSGID)
 {
 	DEFiRet;
 	ISOBJ_TYPE_assert(pMsg, msg);
 	if(pMsg->pCSMSGID == NULL) {
 		/* we need to obtain the object first */
-		CHKiRet(rsCStrConstruct(&pMsg->pCSMSGID));
+		cstrConstructInPlace(&pMsg->csMSGID);
+		pMsg->pCSMSGID = &pMsg->csMSGID;
 	}
 	/* if we reach this point, we have the object */
-	iRet = rsCStrSetSzStr(pMsg->pCSMSGID, (uchar*) pszMSGID);
+	CHKiRet(rsCStrSetSzStrWithLen(pMsg->pCSMSGID, pszMSGID, lenMSGID));
 
 finalize_it:
 	RETiRet;
@@ -1906,7 +3628,7 @@ static inline char *getParseSuccess(msg_t * const pM)
 }
 
 
-/* al, 2011-07-26: LockMsg to avoid race conditions
+/* MSGID is only set by the parser, so no lock is needed to read it.
  */
 static inline char *getMSGID(msg_t * const pM)
 {
@@ -1914,10 +3636,7 @@ static inline char *getMSGID(msg_t * const pM)
 		return "-"; 
 	}
 	else {
-		MsgLock(pM);
-		char* pszreturn = (char*) rsCStrGetSzStrNoNULL(pM->pCSMSGID);
-		MsgUnlock(pM);
-		return pszreturn; 
+		return (char*) rsCStrGetSzStrNoNULL(pM->pCSMSGID);
 	}
 }
 
@@ -1944,26 +3663,29 @@ void MsgSetRuleset(msg_t * const pMsg, ruleset_t *pRuleset)
 void MsgSetTAG(msg_t * const pMsg, uchar* pszBuf, size_t lenBuf)
 {
 	uchar *pBuf;
+	int lenTAG;
 	assert(pMsg != NULL);
 
 	freeTAG(pMsg);
 
-	pMsg->iLenTAG = lenBuf;
-	if(pMsg->iLenTAG < CONF_TAG_BUFSIZE) {
+	lenTAG = lenBuf;
+	if(lenTAG < CONF_TAG_BUFSIZE) {
 		/* small enough: use fixed buffer (faster!) */
 		pBuf = pMsg->TAG.szBuf;
 	} else {
-		if((pBuf = (uchar*) MALLOC(pMsg->iLenTAG + 1)) == NULL) {
+		if((pBuf = (uchar*) MALLOC(lenTAG + 1)) == NULL) {
 			/* truncate message, better than completely loosing it... */
 			pBuf = pMsg->TAG.szBuf;
-			pMsg->iLenTAG = CONF_TAG_BUFSIZE - 1;
+			lenTAG = CONF_TAG_BUFSIZE - 1;
 		} else {
 			pMsg->TAG.pszTAG = pBuf;
 		}
 	}
 
-	memcpy(pBuf, pszBuf, pMsg->iLenTAG);
-	pBuf[pMsg->iLenTAG] = '\0'; /* this also works with truncation! */
+	memcpy(pBuf, pszBuf, lenTAG);
+	pBuf[lenTAG] = '\0'; /* this also works with truncation! */
+	ATOMIC_BARRIER(); /* an emulated TAG is checked without lock, see getTAG() */
+	pMsg->iLenTAG = lenTAG;
 }
 
 
@@ -2085,12 +3807,21 @@ uchar *getRcvFrom(msg_t * const pM)
 /* rgerhards 2004-11-24: set STRUCTURED DATA in msg object
  */
 rsRetVal MsgSetStructuredData(msg_t * const pMsg, char* pszStrucData)
+{
+	return MsgSetStructuredDataWithLen(pMsg, (uchar*) pszStrucData, strlen(pszStrucData));
+}
+
+
+/* set STRUCTURED-DATA from a buffer that need not be \0-terminated */
+rsRetVal MsgSetStructuredDataWithLen(msg_t * const pMsg, uchar *pszStrucData, size_t lenStrucData)
 {
 	DEFiRet;
 	ISOBJ_TYPE_assert(pMsg, msg);
 	free(pMsg->pszStrucData);
-	CHKmalloc(pMsg->pszStrucData = (uchar*)strdup(pszStrucData));
-	pMsg->lenStrucData = strlen(pszStrucData);
+	CHKmalloc(pMsg->pszStrucData = (uchar*)MALLOC(lenStrucData + 1));
+	memcpy(pMsg->pszStrucData, pszStrucData, lenStrucData);
+	pMsg->pszStrucData[lenStrucData] = '\0';
+	pMsg->lenStrucData = lenStrucData;
 finalize_it:
 	RETiRet;
 }
@@ -2100,7 +3831,7 @@ finalize_it:
 void
 MsgGetStructuredData(msg_t * const pM, uchar **pBuf, rs_size_t *len)
 {
-	MsgLock(pM);
+	/* only set by parsers, so no lock is needed */
 	if(pM->pszStrucData == NULL) {
 		*pBuf = UCHAR_CONSTANT("-"),
 		*len = 1;
@@ -2108,7 +3839,6 @@ MsgGetStructuredData(msg_t * const pM, uchar **pBuf, rs_size_t *len)
 		*pBuf = pM->pszStrucData,
 		*len = pM->lenStrucData;
 	}
-	MsgUnlock(pM);
 }
 
 /* get the "programname" as sz string
@@ -2157,7 +3887,7 @@ static void tryEmulateAPPNAME(msg_t * const pM)
  */
 static inline void prepareAPPNAME(msg_t * const pM, sbool bLockMutex)
 {
-	if(pM->pCSAPPNAME == NULL) {
+	if(pM->pCSAPPNAME == NULL && msgGetProtocolVersion(pM) == 0) {
 		if(bLockMutex == LOCK_MUTEX)
 			MsgLock(pM);
 
@@ -2177,15 +3907,11 @@ char *getAPPNAME(msg_t * const pM, sbool bLockMutex)
 	uchar *pszRet;
 
 	assert(pM != NULL);
-	if(bLockMutex == LOCK_MUTEX)
-		MsgLock(pM);
-	prepareAPPNAME(pM, MUTEX_ALREADY_LOCKED);
+	prepareAPPNAME(pM, bLockMutex);
 	if(pM->pCSAPPNAME == NULL)
 		pszRet = UCHAR_CONSTANT("");
 	else 
 		pszRet = rsCStrGetSzStrNoNULL(pM->pCSAPPNAME);
-	if(bLockMutex == LOCK_MUTEX)
-		MsgUnlock(pM);
 	return (char*)pszRet;
 }
 
@@ -2427,6 +4153,147 @@ void MsgSetRawMsg(msg_t *pThis, char* pszRawMsg, size_t lenMsg)
 }
 
 
+/* set raw message in message object by handing over a buffer, which
+ * avoids copying large messages. pBuf must have been allocated by
+ * malloc() and be at least lenMsg+1 bytes large. The message object owns
+ * it after the call, so the caller must no longer touch it. Messages that
+ * fit into the fixed buffer are copied there and pBuf is freed.
+ */
+void MsgSetRawMsgBuf(msg_t *pThis, uchar *pBuf, size_t lenMsg)
+{
+	assert(pThis != NULL);
+	if(lenMsg < CONF_RAWMSG_BUFSIZE) {
+		MsgSetRawMsg(pThis, (char*) pBuf, lenMsg);
+		free(pBuf);
+		return;
+	}
+	if(pThis->pszRawMsg != pThis->szRawMsg)
+		free(pThis->pszRawMsg);
+	pThis->pszRawMsg = pBuf;
+	pThis->iLenRawMsg = lenMsg;
+	pThis->pszRawMsg[lenMsg] = '\0';
+}
+
+
+/* segments of a msgChain_t. Small appends are combined into segments of at
+ * least MSGCHAIN_SEGSIZE octets, so a frame received in many small reads
+ * does not cause many small allocations.
+ */
+#define MSGCHAIN_SEGSIZE (16 * 1024)
+struct msgChainSeg_s {
+	msgChainSeg_t *pNext;
+	size_t len;		/* octets used */
+	size_t size;		/* octets available in data */
+	uchar data[];
+};
+
+void
+MsgChainInit(msgChain_t *pChain)
+{
+	pChain->pRoot = NULL;
+	pChain->pLast = NULL;
+	pChain->len = 0;
+}
+
+/* append len octets to the chain. The data is copied. */
+rsRetVal
+MsgChainAppend(msgChain_t *pChain, uchar *pData, size_t len)
+{
+	msgChainSeg_t *pSeg = pChain->pLast;
+	size_t lenCopy;
+	DEFiRet;
+
+	if(pSeg != NULL) {
+		lenCopy = pSeg->size - pSeg->len;
+		if(lenCopy > len)
+			lenCopy = len;
+		memcpy(pSeg->data + pSeg->len, pData, lenCopy);
+		pSeg->len += lenCopy;
+		pChain->len += lenCopy;
+		pData += lenCopy;
+		len -= lenCopy;
+	}
+	if(len > 0) {
+		CHKmalloc(pSeg = malloc(sizeof(msgChainSeg_t) + ((len < MSGCHAIN_SEGSIZE) ? MSGCHAIN_SEGSIZE : len)));
+		pSeg->pNext = NULL;
+		pSeg->size = (len < MSGCHAIN_SEGSIZE) ? MSGCHAIN_SEGSIZE : len;
+		memcpy(pSeg->data, pData, len);
+		pSeg->len = len;
+		if(pChain->pLast == NULL)
+			pChain->pRoot = pSeg;
+		else
+			pChain->pLast->pNext = pSeg;
+		pChain->pLast = pSeg;
+		pChain->len += len;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+/* free all segments, the chain is empty afterwards */
+void
+MsgChainDiscard(msgChain_t *pChain)
+{
+	msgChainSeg_t *pSeg;
+	msgChainSeg_t *pDel;
+
+	for(pSeg = pChain->pRoot ; pSeg != NULL ; ) {
+		pDel = pSeg;
+		pSeg = pSeg->pNext;
+		free(pDel);
+	}
+	MsgChainInit(pChain);
+}
+
+/* copy lenHead octets at pHead followed by the chain content into a single,
+ * newly allocated buffer (with room for a terminating '\0'). The chain is
+ * discarded in any case.
+ */
+rsRetVal
+MsgChainGather(uchar *pHead, size_t lenHead, msgChain_t *pChain, uchar **ppBuf)
+{
+	msgChainSeg_t *pSeg;
+	uchar *pBuf;
+	size_t i;
+	DEFiRet;
+
+	CHKmalloc(pBuf = malloc(lenHead + pChain->len + 1));
+	memcpy(pBuf, pHead, lenHead);
+	i = lenHead;
+	for(pSeg = pChain->pRoot ; pSeg != NULL ; pSeg = pSeg->pNext) {
+		memcpy(pBuf + i, pSeg->data, pSeg->len);
+		i += pSeg->len;
+	}
+	pBuf[i] = '\0';
+	*ppBuf = pBuf;
+
+finalize_it:
+	MsgChainDiscard(pChain);
+	RETiRet;
+}
+
+/* set the raw message from lenHead octets at pHead followed by the content
+ * of the chain. The final buffer is allocated once with the full size and
+ * handed over to the message object, so there is a single copy and no
+ * reallocation, no matter in how many pieces the frame was received. The
+ * chain is empty afterwards.
+ */
+rsRetVal
+MsgSetRawMsgChain(msg_t *pThis, uchar *pHead, size_t lenHead, msgChain_t *pChain)
+{
+	size_t lenMsg = lenHead + pChain->len;
+	uchar *pBuf;
+	DEFiRet;
+
+	CHKiRet(MsgChainGather(pHead, lenHead, pChain, &pBuf));
+	MsgSetRawMsgBuf(pThis, pBuf, lenMsg);
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* set raw message in message object. Size of message is not provided. This
  * function should only be used when it is unavoidable (and over time we should
  * try to remove it altogether).
@@ -2522,14 +4389,51 @@ static uchar *getNOW(eNOWType eNow, struct syslogTime *t)
 #undef tmpBUFSIZE /* clean up */
 
 
+/* get the serialized $! tree (pM->json must not be NULL). Outputs often
+ * use it several times per message, so it is kept until the tree is
+ * modified, which is detected via jsonGen. As the message is shared by
+ * the workers of several action queues, the cached string may be
+ * replaced while a caller still uses it, so the caller receives a copy,
+ * which it must free. That still saves the serialization. Returns NULL
+ * if out of memory. All this is done under the message lock, as json-c
+ * keeps the buffer for serialization inside the object, so it can not be
+ * done concurrently for the same tree anyhow.
+ */
+static uchar *
+msgGetJSONStr(msg_t * const pM, rs_size_t *pLen)
+{
+	const char *psz;
+	uchar *pszRet = NULL;
+
+	MsgLock(pM);
+	if(pM->pszJSONStr == NULL || pM->jsonStrGen != pM->jsonGen) {
+		free(pM->pszJSONStr);
+		psz = json_object_get_string(pM->json);
+		pM->lenJSONStr = strlen(psz);
+		if((pM->pszJSONStr = malloc(pM->lenJSONStr + 1)) == NULL)
+			goto done;
+		memcpy(pM->pszJSONStr, psz, pM->lenJSONStr + 1);
+		pM->jsonStrGen = pM->jsonGen;
+	}
+	if((pszRet = malloc(pM->lenJSONStr + 1)) == NULL)
+		goto done;
+	memcpy(pszRet, pM->pszJSONStr, pM->lenJSONStr + 1);
+	*pLen = pM->lenJSONStr;
+done:
+	MsgUnlock(pM);
+	return pszRet;
+}
+
+
 /* Get a JSON-Property as string value  (used for various types of JSON-based vars) */
 rsRetVal
 getJSONPropVal(msg_t * const pMsg, msgPropDescr_t *pProp, uchar **pRes, rs_size_t *buflen, unsigned short *pbMustBeFreed)
 {
-	uchar *leaf;
 	struct json_object *jroot;
-	struct json_object *parent;
 	struct json_object *field;
+	msgVars_t *pVars;
+	msgVarEntry_t *pEntry;
+	sbool bConverted;
 	DEFiRet;
 
 	if(*pbMustBeFreed)
@@ -2537,6 +4441,26 @@ getJSONPropVal(msg_t * const pMsg, msgPropDescr_t *pProp, uchar **pRes, rs_size_
 	*pRes = NULL;
 
 	if(pProp->id == PROP_CEE) {
+		if(msgVarsActive(pMsg) != NULL) {
+			MsgLock(pMsg);
+			if((pVars = msgVarsActive(pMsg)) == NULL) {
+				pEntry = NULL; /* converted by another thread meanwhile */
+				bConverted = 1;
+			} else if((pEntry = msgVarsLookup(pMsg, pVars, pProp, &bConverted)) != NULL
+				  && (*pRes = malloc(pEntry->lenVal + 1)) != NULL) {
+				memcpy(*pRes, msgVarsVal(pVars, pEntry), pEntry->lenVal + 1);
+				*buflen = pEntry->lenVal;
+				*pbMustBeFreed = 1;
+			}
+			MsgUnlock(pMsg);
+			if(pEntry != NULL) {
+				if(*pRes == NULL)
+					ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+				FINALIZE;
+			}
+			if(!bConverted)
+				FINALIZE;
+		}
 		jroot = pMsg->json;
 	} else if(pProp->id == PROP_LOCAL_VAR) {
 		jroot = pMsg->localvars;
@@ -2550,13 +4474,13 @@ getJSONPropVal(msg_t * const pMsg, msgPropDescr_t *pProp, uchar **pRes, rs_size_
 	}
 	if(jroot == NULL) goto finalize_it;
 
-	if(!strcmp((char*)pProp->name, "!")) {
-		field = jroot;
-	} else {
-		leaf = jsonPathGetLeaf(pProp->name, pProp->nameLen);
-		CHKiRet(jsonPathFindParent(jroot, pProp->name, leaf, &parent, 1));
-		field = json_object_object_get(parent, (char*)leaf);
+	if(pProp->id == PROP_CEE && pProp->nameLen == 1) {
+		/* the whole tree, same as $!all-json */
+		CHKmalloc(*pRes = msgGetJSONStr(pMsg, buflen));
+		*pbMustBeFreed = 1;
+		FINALIZE;
 	}
+	field = jsonPropFind(jroot, pProp);
 	if(field != NULL) {
 		*pRes = (uchar*) strdup(json_object_get_string(field));
 		*buflen = (int) ustrlen(*pRes);
@@ -2580,11 +4504,35 @@ rsRetVal
 msgGetJSONPropJSON(msg_t * const pMsg, msgPropDescr_t *pProp, struct json_object **pjson)
 {
 	struct json_object *jroot;
-	uchar *leaf;
-	struct json_object *parent;
+	struct json_object *json;
+	msgVars_t *pVars;
+	msgVarEntry_t *pEntry;
+	sbool bConverted;
 	DEFiRet;
 
 	if(pProp->id == PROP_CEE) {
+		if(msgVarsActive(pMsg) != NULL) {
+			json = NULL;
+			MsgLock(pMsg);
+			if((pVars = msgVarsActive(pMsg)) == NULL) {
+				pEntry = NULL; /* converted by another thread meanwhile */
+				bConverted = 1;
+			} else if((pEntry = msgVarsLookup(pMsg, pVars, pProp, &bConverted)) != NULL) {
+				/* the caller borrows the object, so we keep it with the entry */
+				if(pEntry->json == NULL)
+					pEntry->json = msgVarsNewJSON(pVars, pEntry);
+				json = pEntry->json;
+			}
+			MsgUnlock(pMsg);
+			if(pEntry != NULL) {
+				if(json == NULL)
+					ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+				*pjson = json;
+				FINALIZE;
+			}
+			if(!bConverted)
+				ABORT_FINALIZE(RS_RET_NOT_FOUND);
+		}
 		jroot = pMsg->json;
 	} else if(pProp->id == PROP_LOCAL_VAR) {
 		jroot = pMsg->localvars;
@@ -2602,13 +4550,7 @@ msgGetJSONPropJSON(msg_t * const pMsg, msgPropDescr_t *pProp, struct json_object
 		ABORT_FINALIZE(RS_RET_NOT_FOUND);
 	}
 
-	if(!strcmp((char*)pProp->name, "!")) {
-		*pjson = jroot;
-		FINALIZE;
-	}
-	leaf = jsonPathGetLeaf(pProp->name, pProp->nameLen);
-	CHKiRet(jsonPathFindParent(jroot, pProp->name, leaf, &parent, 1));
-	*pjson = json_object_object_get(parent, (char*)leaf);
+	*pjson = jsonPropFind(jroot, pProp);
 	if(*pjson == NULL) {
 		ABORT_FINALIZE(RS_RET_NOT_FOUND);
 	}
@@ -2622,77 +4564,36 @@ finalize_it:
 
 /* Encode a JSON value and add it to provided string. Note that 
  * the string object may be NULL. In this case, it is created
- * if and only if escaping is needed.
+ * if and only if escaping is needed. Runs of characters that need no
+ * escaping are found by escScanJSON() and copied as a whole.
  */
 static rsRetVal
 jsonAddVal(uchar *pSrc, unsigned buflen, es_str_t **dst)
 {
-	unsigned char c;
 	es_size_t i;
-	char numbuf[4];
-	int j;
+	es_size_t iRun;
+	char escSeq[ESC_JSON_MAXSEQ];
 	DEFiRet;
 
 	for(i = 0 ; i < buflen ; ++i) {
-		c = pSrc[i];
-		if(   (c >= 0x23 && c <= 0x5b)
-		   || (c >= 0x5d /* && c <= 0x10FFFF*/)
-		   || c == 0x20 || c == 0x21) {
-			/* no need to escape */
-			if(*dst != NULL)
-				es_addChar(dst, c);
-		} else {
-			if(*dst == NULL) {
-				if(i == 0) {
-					/* we hope we have only few escapes... */
-					*dst = es_newStr(buflen+10);
-				} else {
-					*dst = es_newStrFromBuf((char*)pSrc, i);
-				}
-				if(*dst == NULL) {
-					ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
-				}
+		iRun = i;
+		i += escScanJSON(pSrc + i, buflen - i);
+		if(*dst != NULL && i > iRun)
+			es_addBuf(dst, (char*)pSrc + iRun, i - iRun);
+		if(i == buflen)
+			break;
+		if(*dst == NULL) {
+			if(i == 0) {
+				/* we hope we have only few escapes... */
+				*dst = es_newStr(buflen+10);
+			} else {
+				*dst = es_newStrFromBuf((char*)pSrc, i);
 			}
-			/* we must escape, try RFC4627-defined special sequences first */
-			switch(c) {
-			case '\0':
-				es_addBuf(dst, "\\u0000", 6);
-				break;
-			case '\"':
-				es_addBuf(dst, "\\\"", 2);
-				break;
-			case '/':
-				es_addBuf(dst, "\\/", 2);
-				break;
-			case '\\':
-				es_addBuf(dst, "\\\\", 2);
-				break;
-			case '\010':
-				es_addBuf(dst, "\\b", 2);
-				break;
-			case '\014':
-				es_addBuf(dst, "\\f", 2);
-				break;
-			case '\n':
-				es_addBuf(dst, "\\n", 2);
-				break;
-			case '\r':
-				es_addBuf(dst, "\\r", 2);
-				break;
-			case '\t':
-				es_addBuf(dst, "\\t", 2);
-				break;
-			default:
-				/* TODO : proper Unicode encoding (see header comment) */
-				for(j = 0 ; j < 4 ; ++j) {
-					numbuf[3-j] = hexdigit[c % 16];
-					c = c / 16;
-				}
-				es_addBuf(dst, "\\u", 2);
-				es_addBuf(dst, numbuf, 4);
-				break;
+			if(*dst == NULL) {
+				ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 			}
 		}
+		es_addBuf(dst, escSeq, escJSONChar(pSrc[i], escSeq));
 	}
 finalize_it:
 	RETiRet;
@@ -2819,9 +4720,11 @@ finalize_it:
 #define RET_OUT_OF_MEMORY { *pbMustBeFreed = 0;\
 	*pPropLen = sizeof("**OUT OF MEMORY**") - 1; \
 	return(UCHAR_CONSTANT("**OUT OF MEMORY**"));}
-uchar *MsgGetProp(msg_t *__restrict__ const pMsg, struct templateEntry *__restrict__ const pTpe,
-                 msgPropDescr_t *pProp, rs_size_t *__restrict__ const pPropLen,
-		 unsigned short *__restrict__ const pbMustBeFreed, struct syslogTime * const ttNow)
+static uchar *
+msgGetProp(msg_t *__restrict__ const pMsg, struct templateEntry *__restrict__ const pTpe,
+           msgPropDescr_t *pProp, rs_size_t *__restrict__ const pPropLen,
+	   unsigned short *__restrict__ const pbMustBeFreed, struct syslogTime * const ttNow,
+	   const int bApplyOpts)
 {
 	uchar *pRes; /* result pointer */
 	rs_size_t bufLen = -1; /* length of string or -1, if not known */
@@ -3003,14 +4906,17 @@ uchar *MsgGetProp(msg_t *__restrict__ const pMsg, struct templateEntry *__restri
 			pRes = glbl.GetLocalHostName();
 			break;
 		case PROP_CEE_ALL_JSON:
+			msgVarsToJSON(pMsg);
+			if(*pbMustBeFreed == 1)
+				free(pRes);
+			*pbMustBeFreed = 0;
 			if(pMsg->json == NULL) {
-				if(*pbMustBeFreed == 1)
-					free(pRes);
 				pRes = (uchar*) "{}";
 				bufLen = 2;
-				*pbMustBeFreed = 0;
 			} else {
-				pRes = (uchar*)strdup(json_object_get_string(pMsg->json));
+				if((pRes = msgGetJSONStr(pMsg, &bufLen)) == NULL) {
+					RET_OUT_OF_MEMORY;
+				}
 				*pbMustBeFreed = 1;
 			}
 			break;
@@ -3085,7 +4991,7 @@ uchar *MsgGetProp(msg_t *__restrict__ const pMsg, struct templateEntry *__restri
 	}
 
 	/* If we did not receive a template pointer, we are already done... */
-	if(pTpe == NULL || !pTpe->bComplexProcessing) {
+	if(pTpe == NULL || !pTpe->bComplexProcessing || !bApplyOpts) {
 		*pPropLen = (bufLen == -1) ? ustrlen(pRes) : bufLen;
 		return pRes;
 	}
@@ -3685,6 +5591,25 @@ uchar *MsgGetProp(msg_t *__restrict__ const pMsg, struct templateEntry *__restri
 	return(pRes);
 }
 
+uchar *MsgGetProp(msg_t *__restrict__ const pMsg, struct templateEntry *__restrict__ const pTpe,
+                 msgPropDescr_t *pProp, rs_size_t *__restrict__ const pPropLen,
+		 unsigned short *__restrict__ const pbMustBeFreed, struct syslogTime * const ttNow)
+{
+	return msgGetProp(pMsg, pTpe, pProp, pPropLen, pbMustBeFreed, ttNow, 1);
+}
+
+
+/* like MsgGetProp(), but the field options of pTpe are not applied. Only
+ * its date format is used. This is for callers which do the formatting
+ * themselves (see tplRenderJSON()).
+ */
+uchar *MsgGetPropRaw(msg_t *__restrict__ const pMsg, struct templateEntry *__restrict__ const pTpe,
+                    msgPropDescr_t *pProp, rs_size_t *__restrict__ const pPropLen,
+		    unsigned short *__restrict__ const pbMustBeFreed, struct syslogTime * const ttNow)
+{
+	return msgGetProp(pMsg, pTpe, pProp, pPropLen, pbMustBeFreed, ttNow, 0);
+}
+
 
 /* This function can be used as a generic way to set properties.
  * We have to handle a lot of legacy, so our return value is not always
@@ -3844,8 +5769,9 @@ jsonPathFindParent(struct json_object *jroot, uchar *name, uchar *leaf, struct j
 	namestart = name;
 	*parent = jroot;
 	while(name < leaf-1) {
-		jsonPathFindNext(*parent, namestart, &name, leaf, parent, bCreate);
+		CHKiRet(jsonPathFindNext(*parent, namestart, &name, leaf, parent, bCreate));
 	}
+finalize_it:
 	RETiRet;
 }
 
@@ -3869,31 +5795,40 @@ DBGPRINTF("AAAA jsonMerge adds '%s'\n", it.key);
 	RETiRet;
 }
 
-/* find a JSON structure element (field or container doesn't matter).  */
-rsRetVal
-jsonFind(struct json_object *jroot, msgPropDescr_t *pProp, struct json_object **jsonres)
+/* find the element for property pProp in jroot without creating any
+ * containers (the tree may be shared). Returns NULL if it does not exist.
+ * Uses the pre-split path if available, so nothing needs to be parsed.
+ */
+static struct json_object *
+jsonPropFind(struct json_object *jroot, msgPropDescr_t *pProp)
 {
-	uchar *leaf;
-	struct json_object *parent;
 	struct json_object *field;
-	DEFiRet;
-
-	if(jroot == NULL) {
-		field = NULL;
-		goto finalize_it;
-	}
+	uchar *leaf;
+	int i;
 
-	if(!strcmp((char*)pProp->name, "!")) {
-		field = jroot;
-	} else {
+	if(jroot == NULL)
+		return NULL;
+	if(pProp->pPath == NULL) {
+		if(!strcmp((char*)pProp->name, "!"))
+			return jroot;
 		leaf = jsonPathGetLeaf(pProp->name, pProp->nameLen);
-		CHKiRet(jsonPathFindParent(jroot, pProp->name, leaf, &parent, 0));
-		field = json_object_object_get(parent, (char*)leaf);
+		if(jsonPathFindParent(jroot, pProp->name, leaf, &field, 0) != RS_RET_OK)
+			return NULL;
+		return json_object_object_get(field, (char*)leaf);
 	}
-	*jsonres = field;
+	field = jroot;
+	for(i = 0 ; i < pProp->nPath && field != NULL ; ++i)
+		field = json_object_object_get(field, pProp->pPath[i]);
+	return field;
+}
 
-finalize_it:
-	RETiRet;
+
+/* find a JSON structure element (field or container doesn't matter).  */
+rsRetVal
+jsonFind(struct json_object *jroot, msgPropDescr_t *pProp, struct json_object **jsonres)
+{
+	*jsonres = jsonPropFind(jroot, pProp);
+	return RS_RET_OK;
 }
 
 rsRetVal
@@ -3906,6 +5841,22 @@ msgAddJSON(msg_t * const pM, uchar *name, struct json_object *json)
 	DEFiRet;
 
 	MsgLock(pM);
+	if(name[0] == '!')
+		++pM->jsonGen;
+#	ifdef HAVE_ATOMIC_BUILTINS
+	if(name[0] != '/' && (iRet = msgUnshareJSON(pM)) != RS_RET_OK) {
+		json_object_put(json);
+		FINALIZE;
+	}
+#	endif
+	if(name[0] == '!') {
+		if(msgVarsAdd(pM, name, json))
+			FINALIZE;
+		if((iRet = msgVarsToJSONLocked(pM)) != RS_RET_OK) {
+			json_object_put(json);
+			FINALIZE;
+		}
+	}
 	if(name[0] == '!') {
 		pjroot = &pM->json;
 	} else if(name[0] == '.') {
@@ -3981,6 +5932,14 @@ msgDelJSON(msg_t * const pM, uchar *name)
 
 dbgprintf("AAAA: unset variable '%s'\n", name);
 	MsgLock(pM);
+	if(name[0] == '!')
+		++pM->jsonGen;
+#	ifdef HAVE_ATOMIC_BUILTINS
+	if(name[0] != '/')
+		CHKiRet(msgUnshareJSON(pM));
+#	endif
+	if(name[0] == '!')
+		CHKiRet(msgVarsToJSONLocked(pM));
 
 	if(name[0] == '!') {
 		jroot = &pM->json;
@@ -4086,14 +6045,26 @@ msgSetJSONFromVar(msg_t * const pMsg, uchar *varname, struct var *v)
 {
 	struct json_object *json = NULL;
 	char *cstr;
+	char numbuf[32];
+	int len;
 	DEFiRet;
 	switch(v->datatype) {
 	case 'S':/* string */
 		cstr = es_str2cstr(v->d.estr, NULL);
+		if(varname[0] == '!' && bMsgCompactVars
+		   && msgVarsSet(pMsg, varname, json_type_string, (uchar*)cstr, strlen(cstr))) {
+			free(cstr);
+			FINALIZE;
+		}
 		json = json_object_new_string(cstr);
 		free(cstr);
 		break;
 	case 'N':/* number (integer) */
+		if(varname[0] == '!' && bMsgCompactVars) {
+			len = snprintf(numbuf, sizeof(numbuf), "%lld", (long long) v->d.n);
+			if(msgVarsSet(pMsg, varname, json_type_int, (uchar*)numbuf, len))
+				FINALIZE;
+		}
 #ifdef HAVE_JSON_OBJECT_NEW_INT64
 		json = json_object_new_int64(v->d.n);
 #else /* HAVE_JSON_OBJECT_NEW_INT64 */
@@ -4134,6 +6105,142 @@ finalize_it:
 }
 
 
+/* precompute the lookup data for JSON property pProp (name must already
+ * be normalized). The path is split with the same rules as
+ * jsonPathFindNext(): empty elements are skipped, except for the leaf.
+ * The element pointer array and the strings are a single allocation.
+ * If that fails, pPath stays NULL and the name is parsed on each lookup.
+ */
+static void
+msgPropDescrSplitPath(msgPropDescr_t *pProp)
+{
+	char *buf;
+	char *elt;
+	int maxPath;
+	int i;
+
+	pProp->hash = msgVarsHash(pProp->name, pProp->nameLen);
+	pProp->nPath = 0;
+	pProp->pPath = NULL;
+	maxPath = 0;
+	for(i = 0 ; i < pProp->nameLen ; ++i)
+		if(pProp->name[i] == '!')
+			++maxPath;
+	if(pProp->nameLen == 1) /* root */
+		maxPath = 0;
+	if((pProp->pPath = malloc(maxPath * sizeof(char*) + pProp->nameLen)) == NULL)
+		return;
+	buf = (char*) (pProp->pPath + maxPath);
+	memcpy(buf, pProp->name + 1, pProp->nameLen - 1);
+	buf[pProp->nameLen - 1] = '\0';
+	elt = buf;
+	for(i = 0 ; maxPath > 0 ; ++i) {
+		if(buf[i] == '!' || buf[i] == '\0') {
+			if(buf[i] == '\0' || &buf[i] != elt) /* leaf or non-empty */
+				pProp->pPath[pProp->nPath++] = elt;
+			if(buf[i] == '\0')
+				break;
+			buf[i] = '\0';
+			elt = buf + i + 1;
+		}
+	}
+}
+
+
+/* The $! names referenced by the configuration, for modules that only
+ * materialize what is actually used (lazy modes of mmjsonparse and
+ * mmpstrucdata). They are recorded while the config is loaded and read-only
+ * afterwards. Names are stored normalized, as "!a!b" without empty path
+ * elements. Any reference to the full tree makes everything referenced.
+ */
+static sbool bCEERootReferenced = 0;
+static uchar **ppCEEReferenced = NULL;
+static int nCEEReferenced = 0;
+
+static void
+msgCEENoteReference(msgPropDescr_t *pProp)
+{
+	uchar **ppNew;
+	uchar *name;
+	int i;
+
+	if(pProp->id == PROP_CEE_ALL_JSON
+	   || (pProp->id == PROP_CEE && (pProp->pPath == NULL || pProp->nPath == 0))) {
+		bCEERootReferenced = 1;
+		return;
+	}
+	if(pProp->id != PROP_CEE || bCEERootReferenced)
+		return;
+	if((name = malloc(pProp->nameLen + 1)) == NULL) {
+		bCEERootReferenced = 1; /* we must not lose a reference */
+		return;
+	}
+	name[0] = '\0';
+	for(i = 0 ; i < pProp->nPath ; ++i) {
+		strcat((char*) name, "!");
+		strcat((char*) name, pProp->pPath[i]);
+	}
+	for(i = 0 ; i < nCEEReferenced ; ++i) {
+		if(!ustrcmp(ppCEEReferenced[i], name)) {
+			free(name);
+			return;
+		}
+	}
+	if((ppNew = realloc(ppCEEReferenced, (nCEEReferenced + 1) * sizeof(uchar*))) == NULL) {
+		free(name);
+		bCEERootReferenced = 1;
+		return;
+	}
+	ppCEEReferenced = ppNew;
+	ppCEEReferenced[nCEEReferenced++] = name;
+}
+
+
+/* check if the configuration references the $! variable path (a normalized
+ * name like "!a!b", not NUL-terminated) or anything below or above it.
+ */
+int
+msgCEEPathIsReferenced(uchar *path, int lenPath)
+{
+	uchar *ref;
+	int lenRef;
+	int i;
+
+	if(bCEERootReferenced)
+		return 1;
+	for(i = 0 ; i < nCEEReferenced ; ++i) {
+		ref = ppCEEReferenced[i];
+		lenRef = ustrlen(ref);
+		if(lenRef <= lenPath) {
+			if(!memcmp(ref, path, lenRef) && (lenRef == lenPath || path[lenRef] == '!'))
+				return 1;
+		} else {
+			if(!memcmp(ref, path, lenPath) && ref[lenPath] == '!')
+				return 1;
+		}
+	}
+	return 0;
+}
+
+
+/* check if the configuration references the top-level $! variable name
+ * (without the '!', not NUL-terminated) or anything below it.
+ */
+int
+msgCEEIsReferenced(uchar *name, int lenName)
+{
+	uchar path[1024];
+
+	if(bCEERootReferenced)
+		return 1;
+	if(lenName + 1 >= (int) sizeof(path))
+		return 1; /* better safe than sorry */
+	path[0] = '!';
+	memcpy(path + 1, name, lenName);
+	return msgCEEPathIsReferenced(path, lenName + 1);
+}
+
+
 /* Fill a message propert description. Space must already be alloced
  * by the caller. This is for efficiency, as we expect this to happen
  * as part of a larger structure alloc.
@@ -4159,8 +6266,10 @@ msgPropDescrFill(msgPropDescr_t *pProp, uchar *name, int nameLen)
 		/* we patch the root name, so that support functions do not need to
 		 * check for different root chars. */
 		pProp->name[0] = '!';
+		msgPropDescrSplitPath(pProp);
 	}
 	pProp->id = id;
+	msgCEENoteReference(pProp);
 finalize_it:
 	RETiRet;
 }
@@ -4171,8 +6280,10 @@ msgPropDescrDestruct(msgPropDescr_t *pProp)
 	if(pProp != NULL) {
 		if(pProp->id == PROP_CEE ||
 		   pProp->id == PROP_LOCAL_VAR ||
-		   pProp->id == PROP_GLOBAL_VAR)
+		   pProp->id == PROP_GLOBAL_VAR) {
 			free(pProp->name);
+			free(pProp->pPath);
+		}
 	}
 }
 
@@ -4192,6 +6303,8 @@ BEGINObjClassInit(msg, 1, OBJ_IS_CORE_MODULE)
 	CHKiRet(objUse(glbl, CORE_COMPONENT));
 	CHKiRet(objUse(prop, CORE_COMPONENT));
 	CHKiRet(objUse(var, CORE_COMPONENT));
+	CHKiRet(objUse(strm, CORE_COMPONENT));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 
 	/* set our own handlers */
 	OBJSetMethodHandler(objMethod_SERIALIZE, MsgSerialize);
@@ -4199,6 +6312,14 @@ BEGINObjClassInit(msg, 1, OBJ_IS_CORE_MODULE)
 #	if HAVE_MALLOC_TRIM
 	INIT_ATOMIC_HELPER_MUT(mutTrimCtr);
 #	endif
+#	ifdef HAVE_ATOMIC_BUILTINS
+	CHKiRet(msgCacheInit());
+#	endif
+	CHKiRet(msgTraceInit());
+#	ifdef USE_LIBUUID
+	if(pthread_key_create(&keyUUIDGen, free) != 0)
+		ABORT_FINALIZE(RS_RET_ERR);
+#	endif
 ENDObjClassInit(msg)
 /* vim:set ai:
  */
@@ -61,8 +61,16 @@ struct msg {
 	BEGINobjInstance;	/* Data to implement generic object - MUST be the first data element! */
 	flowControl_t flowCtlType; /**< type of flow control we can apply, for enqueueing, needs not to be persisted because
 				        once data has entered the queue, this property is no longer needed. */
+#ifdef HAVE_ATOMIC_BUILTINS
+	int	iLock;		/* spin lock for lazily computed properties, see MsgLock() */
+#else
 	pthread_mutex_t mut;
+#endif
 	int	iRefCount;	/* reference counter (0 = unused) */
+	union {
+		struct msgCache_s *pCache; /* thread cache the object goes back to on destruct, NULL if none */
+		struct msg *pNextFree;	/* link in a cache's free list while the object is unused */
+	} cache;
 	sbool	bParseSuccess;	/* set to reflect state of last executed higher level parser */
 	short	iSeverity;	/* the severity 0..7 */
 	short	iFacility;	/* Facility code 0 .. 23*/
@@ -75,17 +83,11 @@ struct msg {
 	int	iLenTAG;	/* Length of the TAG part */
 	int	iLenHOSTNAME;	/* Length of HOSTNAME */
 	int	iLenPROGNAME;	/* Length of PROGNAME (-1 = not yet set) */
+	int	iQueueBytes;	/* size accounted for in queue byte counters, 0 - not yet computed */
 	uchar	*pszRawMsg;	/* message as it was received on the wire. This is important in case we
 				 * need to preserve cryptographic verifiers.  */
 	uchar	*pszHOSTNAME;	/* HOSTNAME from syslog message */
-	char *pszRcvdAt3164;	/* time as RFC3164 formatted string (always 15 charcters) */
-	char *pszRcvdAt3339;	/* time as RFC3164 formatted string (32 charcters at most) */
-	char *pszRcvdAt_MySQL;	/* rcvdAt as MySQL formatted string (always 14 charcters) */
-        char *pszRcvdAt_PgSQL;  /* rcvdAt as PgSQL formatted string (always 21 characters) */
-	char *pszTIMESTAMP3164;	/* TIMESTAMP as RFC3164 formatted string (always 15 charcters) */
-	char *pszTIMESTAMP3339;	/* TIMESTAMP as RFC3339 formatted string (32 charcters at most) */
-	char *pszTIMESTAMP_MySQL;/* TIMESTAMP as MySQL formatted string (always 14 charcters) */
-        char *pszTIMESTAMP_PgSQL;/* TIMESTAMP as PgSQL formatted string (always 21 characters) */
+	struct msgTimeStrs_s *pTimeStrs; /* formatted timestamps, allocated on first use */
 	uchar *pszStrucData;    /* STRUCTURED-DATA */
 	uint16_t lenStrucData;	/* (cached) length of STRUCTURED-DATA */
 	cstr_t *pCSAPPNAME;	/* APP-NAME */
@@ -110,6 +112,12 @@ struct msg {
 	struct syslogTime tTIMESTAMP;/* (parsed) value of the timestamp */
 	struct json_object *json;
 	struct json_object *localvars;
+	struct msgJSONShare_s *pJSONShare; /* if set, json and localvars are shared with other messages (copy-on-write) */
+	struct msgVars_s *pVars;	/* compact $! variables, used instead of json if enabled, see msgVarsAdd(); guarded by MsgLock() */
+	uchar *pszJSONStr;	/* cached serialization of json, see msgGetJSONStr() */
+	int lenJSONStr;
+	unsigned jsonGen;	/* incremented on every modification of json */
+	unsigned jsonStrGen;	/* value of jsonGen when pszJSONStr was created */
 	/* some fixed-size buffers to save malloc()/free() for frequently used fields (from the default templates) */
 	uchar szRawMsg[CONF_RAWMSG_BUFSIZE];	/* most messages are small, and these are stored here (without malloc/free!) */
 	uchar szHOSTNAME[CONF_HOSTNAME_BUFSIZE];
@@ -121,17 +129,65 @@ struct msg {
 		uchar	*pszTAG;	/* pointer to tag value */
 		uchar	szBuf[CONF_TAG_BUFSIZE];
 	} TAG;
-	char pszTimestamp3164[CONST_LEN_TIMESTAMP_3164 + 1];
-	char pszTimestamp3339[CONST_LEN_TIMESTAMP_3339 + 1];
-	char pszTIMESTAMP_SecFrac[7]; /* Note: a pointer is 64 bits/8 char, so this is actually fewer than a pointer! */
-	char pszRcvdAt_SecFrac[7];	     /* same as above. Both are fractional seconds for their respective timestamp */
-	char pszTIMESTAMP_Unix[12]; /* almost as small as a pointer! */
-	char pszRcvdAt_Unix[12];
+	cstr_t csAPPNAME;	/* storage for pCSAPPNAME, pCSPROCID and pCSMSGID, which point */
+	cstr_t csPROCID;	/* here once set, see cstrConstructInPlace() */
+	cstr_t csMSGID;
 	char dfltTZ[8];	    /* 7 chars max, less overhead than ptr! */
 	uchar *pszUUID; /* The message's UUID */
+	struct msgTrace_s *pTrace; /* per-stage timestamps if this message is sampled for tracing, else NULL */
+};
+
+
+/* The formatted timestamp strings of a message. These are only needed by
+ * outputs (usually after the message has left the queue), so they are kept
+ * out of struct msg, which keeps queued messages small. The structure is
+ * allocated with the first formatted timestamp. Each psz pointer is NULL
+ * until the string is formatted and then points to its sz buffer.
+ */
+struct msgTimeStrs_s {
+	char *pszRcvdAt3164;	/* time as RFC3164 formatted string (always 15 charcters) */
+	char *pszRcvdAt3339;	/* time as RFC3164 formatted string (32 charcters at most) */
+	char *pszRcvdAt_MySQL;	/* rcvdAt as MySQL formatted string (always 14 charcters) */
+	char *pszRcvdAt_PgSQL;  /* rcvdAt as PgSQL formatted string (always 21 characters) */
+	char *pszRcvdAt_SecFrac;/* rcvdAt fractional seconds */
+	char *pszRcvdAt_Unix;	/* rcvdAt as Unix timestamp */
+	char *pszTIMESTAMP3164;	/* TIMESTAMP as RFC3164 formatted string (always 15 charcters) */
+	char *pszTIMESTAMP3339;	/* TIMESTAMP as RFC3339 formatted string (32 charcters at most) */
+	char *pszTIMESTAMP_MySQL;/* TIMESTAMP as MySQL formatted string (always 14 charcters) */
+	char *pszTIMESTAMP_PgSQL;/* TIMESTAMP as PgSQL formatted string (always 21 characters) */
+	char *pszTIMESTAMP_SecFrac;/* TIMESTAMP fractional seconds */
+	char *pszTIMESTAMP_Unix;/* TIMESTAMP as Unix timestamp */
+	char szRcvdAt3164[CONST_LEN_TIMESTAMP_3164 + 1];
+	char szRcvdAt3339[CONST_LEN_TIMESTAMP_3339 + 1];
+	char szRcvdAt_MySQL[15];
+	char szRcvdAt_PgSQL[21];
+	char szRcvdAt_SecFrac[7];
+	char szRcvdAt_Unix[12];
+	char szTIMESTAMP3164[CONST_LEN_TIMESTAMP_3164 + 1];
+	char szTIMESTAMP3339[CONST_LEN_TIMESTAMP_3339 + 1];
+	char szTIMESTAMP_MySQL[15];
+	char szTIMESTAMP_PgSQL[21];
+	char szTIMESTAMP_SecFrac[7];
+	char szTIMESTAMP_Unix[12];
 };
 
 
+/* binary record format for disk queues, see MsgSerializeBinary() */
+#define MSG_BINREC_MAGIC 0xb5	/* first octet of a binary record, never '<' */
+#define MSG_BINREC_VERSION 1
+#define MSG_BINREC_HDRLEN 6	/* magic, version and payload length */
+
+/* chain of received data segments. The TCP inputs use it to assemble frames
+ * that are larger than the max message size, so that the frame is copied only
+ * once into the final raw message (see MsgSetRawMsgChain()).
+ */
+typedef struct msgChainSeg_s msgChainSeg_t;
+typedef struct msgChain_s {
+	msgChainSeg_t *pRoot;
+	msgChainSeg_t *pLast;
+	size_t len;		/* total nbr of octets in the chain */
+} msgChain_t;
+
 /* message flags (msgFlags), not an enum for historical reasons
  */
 #define NOFLAG		0x000	/* no flag is set (to be used when a flag must be specified and none is required) */
@@ -149,6 +205,45 @@ struct msg {
 #define MSG_LEGACY_PROTOCOL 0
 #define MSG_RFC5424_PROTOCOL 1
 
+extern int bMsgCompactVars;	/* global(variables.compact) */
+
+/* a scalar $! value to be stored via msgAddJSONLeaves(); name (a full path
+ * like "!a!b") and value are inside a buffer owned by the caller */
+typedef struct msgJSONLeaf_s {
+	int offName;
+	int lenName;
+	int offVal;
+	int lenVal;
+	enum json_type type;	/* json_type_string, _int or _boolean */
+} msgJSONLeaf_t;
+
+/* UUID generators for the uuid property, set via global(uuid.type) */
+#define MSG_UUID_LIBUUID 0	/* libuuid's uuid_generate() (serialized by a mutex) */
+#define MSG_UUID_V4 1		/* random (version 4) from a per-thread generator */
+#define MSG_UUID_V7 2		/* time-ordered (version 7) from reception time and per-thread generator */
+extern int iMsgUUIDType;
+
+/* processing stages recorded for traced messages, in the order a message
+ * passes them. For messages processed by multiple actions, the first action
+ * reaching a stage sets its timestamp.
+ */
+typedef enum msgTraceStage_e {
+	TRACE_SUBMIT = 0,	/* submitted to the main queue */
+	TRACE_MAINQ_DEQ,	/* dequeued by a main queue worker */
+	TRACE_PARSE,		/* parsing finished */
+	TRACE_RULESET,		/* ruleset evaluation started */
+	TRACE_ACTQ_DEQ,		/* dequeued by an action queue worker */
+	TRACE_ACTION,		/* handed to the output module */
+	TRACE_COMMIT,		/* output module committed the message */
+	TRACE_NSTAGES
+} msgTraceStage_t;
+
+typedef struct msgTrace_s {
+	uint64_t t[TRACE_NSTAGES];	/* monotonic usecs, 0 = stage not (yet) reached */
+} msgTrace_t;
+
+extern int iMsgTraceSampleRate;	/* global(trace.samplerate) */
+
 /* function prototypes
  */
 PROTOTYPEObjClassInit(msg);
@@ -163,13 +258,17 @@ void setProtocolVersion(msg_t *pM, int iNewVersion);
 void MsgSetInputName(msg_t *pMsg, prop_t*);
 void MsgSetDfltTZ(msg_t *pThis, char *tz);
 rsRetVal MsgSetAPPNAME(msg_t *pMsg, char* pszAPPNAME);
+rsRetVal MsgSetAPPNAMEWithLen(msg_t *pMsg, uchar *pszAPPNAME, size_t lenAPPNAME);
 rsRetVal MsgSetPROCID(msg_t *pMsg, char* pszPROCID);
+rsRetVal MsgSetPROCIDWithLen(msg_t *pMsg, uchar *pszPROCID, size_t lenPROCID);
 rsRetVal MsgSetMSGID(msg_t *pMsg, char* pszMSGID);
+rsRetVal MsgSetMSGIDWithLen(msg_t *pMsg, uchar *pszMSGID, size_t lenMSGID);
 void MsgSetParseSuccess(msg_t *pMsg, int bSuccess);
 void MsgSetTAG(msg_t *pMsg, uchar* pszBuf, size_t lenBuf);
 void MsgSetRuleset(msg_t *pMsg, ruleset_t*);
 rsRetVal MsgSetFlowControlType(msg_t *pMsg, flowControl_t eFlowCtl);
 rsRetVal MsgSetStructuredData(msg_t *pMsg, char* pszStrucData);
+rsRetVal MsgSetStructuredDataWithLen(msg_t *pMsg, uchar *pszStrucData, size_t lenStrucData);
 rsRetVal MsgAddToStructuredData(msg_t *pMsg, uchar *toadd, rs_size_t len);
 void MsgGetStructuredData(msg_t *pM, uchar **pBuf, rs_size_t *len);
 rsRetVal msgSetFromSockinfo(msg_t *pThis, struct sockaddr_storage *sa);
@@ -182,17 +281,36 @@ rsRetVal MsgSetAfterPRIOffs(msg_t *pMsg, short offs);
 void MsgSetMSGoffs(msg_t *pMsg, short offs);
 void MsgSetRawMsgWOSize(msg_t *pMsg, char* pszRawMsg);
 void MsgSetRawMsg(msg_t *pMsg, char* pszRawMsg, size_t lenMsg);
+void MsgSetRawMsgBuf(msg_t *pMsg, uchar *pBuf, size_t lenMsg);
+void MsgChainInit(msgChain_t *pChain);
+rsRetVal MsgChainAppend(msgChain_t *pChain, uchar *pData, size_t len);
+void MsgChainDiscard(msgChain_t *pChain);
+rsRetVal MsgChainGather(uchar *pHead, size_t lenHead, msgChain_t *pChain, uchar **ppBuf);
+rsRetVal MsgSetRawMsgChain(msg_t *pMsg, uchar *pHead, size_t lenHead, msgChain_t *pChain);
 rsRetVal MsgReplaceMSG(msg_t *pThis, uchar* pszMSG, int lenMSG);
 uchar *MsgGetProp(msg_t *pMsg, struct templateEntry *pTpe, msgPropDescr_t *pProp,
 		  rs_size_t *pPropLen, unsigned short *pbMustBeFreed, struct syslogTime *ttNow);
+uchar *MsgGetPropRaw(msg_t *pMsg, struct templateEntry *pTpe, msgPropDescr_t *pProp,
+		  rs_size_t *pPropLen, unsigned short *pbMustBeFreed, struct syslogTime *ttNow);
 uchar *getRcvFrom(msg_t *pM);
 void getTAG(msg_t *pM, uchar **ppBuf, int *piLen);
 char *getTimeReported(msg_t *pM, enum tplFormatTypes eFmt);
 char *getPRI(msg_t *pMsg);
 void getRawMsg(msg_t *pM, uchar **pBuf, int *piLen);
 rsRetVal msgAddJSON(msg_t *pM, uchar *name, struct json_object *json);
+rsRetVal msgVarsToJSON(msg_t *pM);
+int msgAddJSONLeaves(msg_t *pM, uchar *root, uchar *pBuf, msgJSONLeaf_t *pLeaves, int nLeaves);
+int msgCEEIsReferenced(uchar *name, int lenName);
+int msgCEEPathIsReferenced(uchar *path, int lenPath);
 rsRetVal MsgGetSeverity(msg_t *pThis, int *piSeverity);
 rsRetVal MsgDeserialize(msg_t *pMsg, strm_t *pStrm);
+rsRetVal MsgSerializeBinary(msg_t *pThis, strm_t *pStrm);
+rsRetVal MsgDeserializeBinary(msg_t **ppMsg, strm_t *pStrm);
+rsRetVal MsgSerializeBinaryBuf(msg_t *pThis, uchar **ppBuf, size_t *pLenBuf, size_t *pLenRec);
+rsRetVal MsgDeserializeBinaryBuf(msg_t **ppMsg, uchar *rec, size_t lenRec);
+rsRetVal MsgBinaryRecLen(uchar *hdr, size_t *pLenRec);
+void MsgTraceSample(msg_t *pMsg);
+void msgTraceStamp(msg_t *pMsg, msgTraceStage_t stage);
 
 /* TODO: remove these five (so far used in action.c) */
 uchar *getMSG(msg_t *pM);
@@ -246,6 +364,17 @@ MsgSetRawMsgSize(msg_t *pMsg, size_t newLen)
 }
 
 
+/* record that a traced message reached a processing stage. This is a no-op
+ * for the (vast majority of) messages not sampled for tracing.
+ */
+static inline void
+MsgTraceStage(msg_t *pMsg, msgTraceStage_t stage)
+{
+	if(pMsg->pTrace != NULL)
+		msgTraceStamp(pMsg, stage);
+}
+
+
 /* get the ruleset that is associated with the ruleset.
  * May be NULL. -- rgerhards, 2009-10-27
  */
@@ -100,6 +100,11 @@ static struct AllowedSenders *pLastAllowedSenders_TCP = NULL; /* element in the
 struct AllowedSenders *pAllowedSenders_GSS = NULL;
 static struct AllowedSenders *pLastAllowedSenders_GSS = NULL;
 #endif
+static struct aclTrie_s aclTrie_UDP;	/* prefix tries for the lists above */
+static struct aclTrie_s aclTrie_TCP;
+#ifdef USE_GSSAPI
+static struct aclTrie_s aclTrie_GSS;
+#endif
 
 int     ACLAddHostnameOnFail = 0; /* add hostname to acl when DNS resolving has failed */
 int     ACLDontResolve = 0;       /* add hostname to acl instead of resolving it to IP(s) */
@@ -538,6 +543,80 @@ mygetnameinfo(const struct sockaddr *sa, socklen_t salen,
 }
 
 
+/* obtain the prefix trie belonging to an allowed sender list type.
+ * Returns NULL for an invalid type.
+ */
+static inline struct aclTrie_s *
+getAclTrie(uchar *pszType)
+{
+	if(!strcmp((char*)pszType, "UDP"))
+		return &aclTrie_UDP;
+	else if(!strcmp((char*)pszType, "TCP"))
+		return &aclTrie_TCP;
+#ifdef USE_GSSAPI
+	else if(!strcmp((char*)pszType, "GSS"))
+		return &aclTrie_GSS;
+#endif
+	return NULL;
+}
+
+
+/* add a network of the given length to a prefix trie. addr points to
+ * the address in network byte order. Networks are only ever added, so
+ * it does not matter if a longer prefix below an already-permitted node
+ * is added - it is simply never reached.
+ */
+static rsRetVal
+aclTrieAdd(struct aclTrieNode_s **ppRoot, uchar *addr, int bits)
+{
+	struct aclTrieNode_s **ppNode = ppRoot;
+	int i;
+	DEFiRet;
+
+	for(i = 0 ; ; ++i) {
+		if(*ppNode == NULL)
+			CHKmalloc(*ppNode = calloc(1, sizeof(struct aclTrieNode_s)));
+		if(i == bits || (*ppNode)->bPermitted)
+			break;
+		ppNode = &(*ppNode)->child[(addr[i / 8] >> (7 - i % 8)) & 1];
+	}
+	(*ppNode)->bPermitted = 1;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* check if addr (network byte order, nBits long) is inside one of the
+ * networks in the trie.
+ */
+static inline int
+aclTrieMatch(struct aclTrieNode_s *pNode, const uchar *addr, int nBits)
+{
+	int i;
+
+	for(i = 0 ; pNode != NULL ; ++i) {
+		if(pNode->bPermitted)
+			return 1;
+		if(i == nBits)
+			break;
+		pNode = pNode->child[(addr[i / 8] >> (7 - i % 8)) & 1];
+	}
+	return 0;
+}
+
+
+static void
+aclTrieFree(struct aclTrieNode_s *pNode)
+{
+	if(pNode == NULL)
+		return;
+	aclTrieFree(pNode->child[0]);
+	aclTrieFree(pNode->child[1]);
+	free(pNode);
+}
+
+
 /* This function adds an allowed sender entry to the ACL linked list.
  * In any case, a single entry is added. If an error occurs, the
  * function does its error reporting itself. All validity checks
@@ -546,9 +625,10 @@ mygetnameinfo(const struct sockaddr *sa, socklen_t salen,
  * rgerhards, 2007-07-17
  */
 static rsRetVal AddAllowedSenderEntry(struct AllowedSenders **ppRoot, struct AllowedSenders **ppLast,
-		     		      struct NetAddr *iAllow, uint8_t iSignificantBits)
+				      struct aclTrie_s *pTrie, struct NetAddr *iAllow, uint8_t iSignificantBits)
 {
 	struct AllowedSenders *pEntry = NULL;
+	rsRetVal localRet;
 
 	assert(ppRoot != NULL);
 	assert(ppLast != NULL);
@@ -561,6 +641,25 @@ static rsRetVal AddAllowedSenderEntry(struct AllowedSenders **ppRoot, struct All
 	memcpy(&(pEntry->allowedSender), iAllow, sizeof (struct NetAddr));
 	pEntry->pNext = NULL;
 	pEntry->SignificantBits = iSignificantBits;
+
+	/* IP-based entries also go into the trie, everything else needs
+	 * to be checked individually.
+	 */
+	localRet = RS_RET_NOENTRY;
+	if(!F_ISSET(iAllow->flags, ADDR_NAME)) {
+		if(iAllow->addr.NetAddr->sa_family == AF_INET) {
+			localRet = aclTrieAdd(&pTrie->root4,
+				(uchar*) &SIN(iAllow->addr.NetAddr)->sin_addr.s_addr, iSignificantBits);
+		} else if(iAllow->addr.NetAddr->sa_family == AF_INET6
+			  && SIN6(iAllow->addr.NetAddr)->sin6_scope_id == 0) {
+			localRet = aclTrieAdd(&pTrie->root6,
+				SIN6(iAllow->addr.NetAddr)->sin6_addr.s6_addr, iSignificantBits);
+		}
+	}
+	if(localRet == RS_RET_OK)
+		pEntry->bInTrie = 1;
+	else
+		++pTrie->nListOnly;
 	
 	/* enqueue */
 	if(*ppRoot == NULL) {
@@ -583,9 +682,15 @@ clearAllowedSenders(uchar *pszType)
 {
 	struct AllowedSenders *pPrev;
 	struct AllowedSenders *pCurr = NULL;
+	struct aclTrie_s *pTrie;
 
 	if(setAllowRoot(&pCurr, pszType) != RS_RET_OK)
 		return;	/* if something went wrong, so let's leave */
+
+	pTrie = getAclTrie(pszType);
+	aclTrieFree(pTrie->root4);
+	aclTrieFree(pTrie->root6);
+	memset(pTrie, 0, sizeof(struct aclTrie_s));
 	
 	while(pCurr != NULL) {
 		pPrev = pCurr;
@@ -616,7 +721,7 @@ clearAllowedSenders(uchar *pszType)
  * added (all addresses from that host).
  */
 static rsRetVal AddAllowedSender(struct AllowedSenders **ppRoot, struct AllowedSenders **ppLast,
-		     		 struct NetAddr *iAllow, uint8_t iSignificantBits)
+				 struct aclTrie_s *pTrie, struct NetAddr *iAllow, uint8_t iSignificantBits)
 {
 	DEFiRet;
 
@@ -665,7 +770,7 @@ static rsRetVal AddAllowedSender(struct AllowedSenders **ppRoot, struct AllowedS
 			ABORT_FINALIZE(RS_RET_ERR);
 		}
 		/* OK, entry constructed, now lets add it to the ACL list */
-		iRet = AddAllowedSenderEntry(ppRoot, ppLast, iAllow, iSignificantBits);
+		iRet = AddAllowedSenderEntry(ppRoot, ppLast, pTrie, iAllow, iSignificantBits);
 	} else {
 		/* we need to process a hostname ACL */
 		if(glbl.GetDisableDNS()) {
@@ -694,7 +799,7 @@ static rsRetVal AddAllowedSender(struct AllowedSenders **ppRoot, struct AllowedS
 				
 				if (ACLAddHostnameOnFail) {
 				        errmsg.LogError(0, NO_ERRCODE, "Adding hostname \"%s\" to ACL as a wildcard entry.", iAllow->addr.HostWildcard);
-				        iRet = AddAllowedSenderEntry(ppRoot, ppLast, iAllow, iSignificantBits);
+				        iRet = AddAllowedSenderEntry(ppRoot, ppLast, pTrie, iAllow, iSignificantBits);
 					FINALIZE;
 				} else {
 				        errmsg.LogError(0, NO_ERRCODE, "Hostname \"%s\" WON\'T be added to ACL.", iAllow->addr.HostWildcard);
@@ -712,7 +817,7 @@ static rsRetVal AddAllowedSender(struct AllowedSenders **ppRoot, struct AllowedS
 					}
 					memcpy(allowIP.addr.NetAddr, res->ai_addr, res->ai_addrlen);
 					
-					if((iRet = AddAllowedSenderEntry(ppRoot, ppLast, &allowIP, iSignificantBits))
+					if((iRet = AddAllowedSenderEntry(ppRoot, ppLast, pTrie, &allowIP, iSignificantBits))
 						!= RS_RET_OK)
 						FINALIZE;
 					break;
@@ -735,7 +840,7 @@ static rsRetVal AddAllowedSender(struct AllowedSenders **ppRoot, struct AllowedS
 							&(SIN6(res->ai_addr)->sin6_addr.s6_addr32[3]),
 							sizeof (in_addr_t));
 
-						if((iRet = AddAllowedSenderEntry(ppRoot, ppLast, &allowIP,
+						if((iRet = AddAllowedSenderEntry(ppRoot, ppLast, pTrie, &allowIP,
 								iSignificantBits))
 							!= RS_RET_OK)
 							FINALIZE;
@@ -749,7 +854,7 @@ static rsRetVal AddAllowedSender(struct AllowedSenders **ppRoot, struct AllowedS
 						}
 						memcpy(allowIP.addr.NetAddr, res->ai_addr, res->ai_addrlen);
 						
-						if((iRet = AddAllowedSenderEntry(ppRoot, ppLast, &allowIP,
+						if((iRet = AddAllowedSenderEntry(ppRoot, ppLast, pTrie, &allowIP,
 								iSignificantBits))
 							!= RS_RET_OK)
 							FINALIZE;
@@ -763,7 +868,7 @@ static rsRetVal AddAllowedSender(struct AllowedSenders **ppRoot, struct AllowedS
 			 * For this, we already have everything ready and just need
 			 * to pass it along...
 			 */
-			iRet =  AddAllowedSenderEntry(ppRoot, ppLast, iAllow, iSignificantBits);
+			iRet =  AddAllowedSenderEntry(ppRoot, ppLast, pTrie, iAllow, iSignificantBits);
 		}
 	}
 
@@ -833,6 +938,7 @@ rsRetVal addAllowedSenderLine(char* pName, uchar** ppRestOfConfLine)
 {
 	struct AllowedSenders **ppRoot;
 	struct AllowedSenders **ppLast;
+	struct aclTrie_s *pTrie;
 	rsParsObj *pPars;
 	rsRetVal iRet;
 	struct NetAddr *uIP = NULL;
@@ -845,13 +951,16 @@ rsRetVal addAllowedSenderLine(char* pName, uchar** ppRestOfConfLine)
 	if(!strcasecmp(pName, "udp")) {
 		ppRoot = &pAllowedSenders_UDP;
 		ppLast = &pLastAllowedSenders_UDP;
+		pTrie = &aclTrie_UDP;
 	} else if(!strcasecmp(pName, "tcp")) {
 		ppRoot = &pAllowedSenders_TCP;
 		ppLast = &pLastAllowedSenders_TCP;
+		pTrie = &aclTrie_TCP;
 #ifdef USE_GSSAPI
 	} else if(!strcasecmp(pName, "gss")) {
 		ppRoot = &pAllowedSenders_GSS;
 		ppLast = &pLastAllowedSenders_GSS;
+		pTrie = &aclTrie_GSS;
 #endif
 	} else {
 		errmsg.LogError(0, RS_RET_ERR, "Invalid protocol '%s' in allowed sender "
@@ -879,7 +988,7 @@ rsRetVal addAllowedSenderLine(char* pName, uchar** ppRestOfConfLine)
 			rsParsDestruct(pPars);
 			return(iRet);
 		}
-		if((iRet = AddAllowedSender(ppRoot, ppLast, uIP, iBits)) != RS_RET_OK) {
+		if((iRet = AddAllowedSender(ppRoot, ppLast, pTrie, uIP, iBits)) != RS_RET_OK) {
 		        if(iRet == RS_RET_NOENTRY) {
 			        errmsg.LogError(0, iRet, "Error %d adding allowed sender entry "
 					    "- ignoring.", iRet);
@@ -991,6 +1100,7 @@ static int isAllowedSender2(uchar *pszType, struct sockaddr *pFrom, const char *
 {
 	struct AllowedSenders *pAllow;
 	struct AllowedSenders *pAllowRoot = NULL;
+	struct aclTrie_s *pTrie;
 	int bNeededDNS = 0;	/* partial check because we could not resolve DNS? */
 	int ret;
 
@@ -1001,14 +1111,31 @@ static int isAllowedSender2(uchar *pszType, struct sockaddr *pFrom, const char *
 
 	if(pAllowRoot == NULL)
 		return 1; /* checking disabled, everything is valid! */
+
+	/* first check the IP-based entries via the trie */
+	pTrie = getAclTrie(pszType);
+	if(pFrom->sa_family == AF_INET) {
+		if(aclTrieMatch(pTrie->root4, (uchar*) &SIN(pFrom)->sin_addr.s_addr, 32))
+			return 1;
+	} else if(pFrom->sa_family == AF_INET6) {
+		if(aclTrieMatch(pTrie->root6, SIN6(pFrom)->sin6_addr.s6_addr, 128))
+			return 1;
+		if(IN6_IS_ADDR_V4MAPPED(&SIN6(pFrom)->sin6_addr)
+		   && aclTrieMatch(pTrie->root4, (uchar*) &SIN6(pFrom)->sin6_addr.s6_addr32[3], 32))
+			return 1;
+	}
+	if(pTrie->nListOnly == 0)
+		return 0;
 	
-	/* now we loop through the list of allowed senders. As soon as
+	/* now we loop through the list of remaining allowed senders. As soon as
 	 * we find a match, we return back (indicating allowed). We loop
 	 * until we are out of allowed senders. If so, we fall through the
 	 * loop and the function's terminal return statement will indicate
 	 * that the sender is disallowed.
 	 */
 	for(pAllow = pAllowRoot ; pAllow != NULL ; pAllow = pAllow->pNext) {
+		if(pAllow->bInTrie)
+			continue;
 		ret = MaskCmp (&(pAllow->allowedSender), pAllow->SignificantBits, pFrom, pszFromHost, bChkDNS);
 		if(ret == 1)
 			return 1;
@@ -1190,8 +1317,11 @@ void closeUDPListenSockets(int *pSockArr)
  * bIsServer indicates if a server socket should be created
  * 1 - server, 0 - client
  * param rcvbuf indicates desired rcvbuf size; 0 means OS default
+ * if bReusePort is set, SO_REUSEPORT is set, so that several sockets can
+ * be bound to the same address and the kernel distributes packets among
+ * them (where not supported, the option is ignored)
  */
-int *create_udp_socket(uchar *hostname, uchar *pszPort, int bIsServer, int rcvbuf)
+int *create_udp_socket(uchar *hostname, uchar *pszPort, int bIsServer, int rcvbuf, int bReusePort)
 {
         struct addrinfo hints, *res, *r;
         int error, maxs, *s, *socks, on = 1;
@@ -1265,6 +1395,16 @@ int *create_udp_socket(uchar *hostname, uchar *pszPort, int bIsServer, int rcvbu
 			*s = -1;
 			continue;
 		}
+#		ifdef SO_REUSEPORT
+		if(bReusePort && setsockopt(*s, SOL_SOCKET, SO_REUSEPORT, (char *) &on, sizeof(on)) < 0) {
+			errmsg.LogError(errno, NO_ERRCODE, "setsockopt(REUSEPORT)");
+			close(*s);
+			*s = -1;
+			continue;
+		}
+#		else
+		(void) bReusePort;
+#		endif
 
 		/* We need to enable BSD compatibility. Otherwise an attacker
 		 * could flood our log files by sending us tons of ICMP errors.
@@ -29,7 +29,8 @@
 
 typedef enum _TCPFRAMINGMODE {
 		TCP_FRAMING_OCTET_STUFFING = 0, /* traditional LF-delimited */
-		TCP_FRAMING_OCTET_COUNTING = 1  /* -transport-tls like octet count */
+		TCP_FRAMING_OCTET_COUNTING = 1, /* -transport-tls like octet count */
+		TCP_FRAMING_BINARY = 2		/* self-delimiting binary message records */
 	} TCPFRAMINGMODE;
 
 #define   F_SET(where, flag) (where)|=(flag)
@@ -87,9 +88,27 @@ static inline size_t SALEN(struct sockaddr *sa) {
 struct AllowedSenders {
 	struct NetAddr allowedSender; /* ip address allowed */
 	uint8_t SignificantBits;      /* defines how many bits should be discarded (eqiv to mask) */
+	sbool bInTrie;                /* entry is also contained in the ACL's prefix trie */
 	struct AllowedSenders *pNext;
 };
 
+/* The IP-based entries of an allowed sender list are additionally compiled
+ * into a binary prefix trie (one per address family), so that checking a
+ * sender does not need to walk the whole list. Only entries that cannot be
+ * represented in the trie (hostname wildcards, IPv6 with scope id) are still
+ * checked one by one.
+ */
+struct aclTrieNode_s {
+	struct aclTrieNode_s *child[2];
+	sbool bPermitted;	/* a permitted network ends at this node */
+};
+
+struct aclTrie_s {
+	struct aclTrieNode_s *root4;
+	struct aclTrieNode_s *root6;
+	int nListOnly;		/* nbr of list entries not contained in the trie */
+};
+
 
 /* this structure is a helper to implement wildcards in permittedPeers_t. It specifies
  * the domain component and the matching mode.
@@ -137,7 +156,7 @@ BEGINinterface(net) /* name must also be changed in ENDinterface macro! */
 	void (*PrintAllowedSenders)(int iListToPrint);
 	void (*clearAllowedSenders)(uchar*);
 	void (*debugListenInfo)(int fd, char *type);
-	int *(*create_udp_socket)(uchar *hostname, uchar *LogPort, int bIsServer, int rcvbuf);
+	int *(*create_udp_socket)(uchar *hostname, uchar *LogPort, int bIsServer, int rcvbuf, int bReusePort);
 	void (*closeUDPListenSockets)(int *finet);
 	int (*isAllowedSender)(uchar *pszType, struct sockaddr *pFrom, const char *pszFromHost); /* deprecated! */
 	rsRetVal (*getLocalHostname)(uchar**);
@@ -157,8 +176,9 @@ BEGINinterface(net) /* name must also be changed in ENDinterface macro! */
 	int    *pACLAddHostnameOnFail; /* add hostname to acl when DNS resolving has failed */
 	int    *pACLDontResolve;       /* add hostname to acl instead of resolving it to IP(s) */
 	/* v8 cvthname() signature change -- rgerhards, 2013-01-18 */
+	/* v9 create_udp_socket() got bReusePort parameter -- 2026-10-14 */
 ENDinterface(net)
-#define netCURR_IF_VERSION 8 /* increment whenever you change the interface structure! */
+#define netCURR_IF_VERSION 9 /* increment whenever you change the interface structure! */
 
 /* prototypes */
 PROTOTYPEObj(net);
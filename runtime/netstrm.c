@@ -235,6 +235,28 @@ Send(netstrm_t *pThis, uchar *pBuf, ssize_t *pLenBuf)
 	RETiRet;
 }
 
+/* gathering version of Send(). bMore tells the driver that more data
+ * will follow soon, so it does not need to push out a partial segment.
+ */
+static rsRetVal
+SendV(netstrm_t *pThis, struct iovec *iov, int iovcnt, ssize_t *pLenBuf, int bMore)
+{
+	DEFiRet;
+	ISOBJ_TYPE_assert(pThis, netstrm);
+	iRet = pThis->Drvr.SendV(pThis->pDrvrData, iov, iovcnt, pLenBuf, bMore);
+	RETiRet;
+}
+
+/* get the size of the send buffer (as far as the driver knows it) */
+static rsRetVal
+GetSndBufSize(netstrm_t *pThis, int *pSize)
+{
+	DEFiRet;
+	ISOBJ_TYPE_assert(pThis, netstrm);
+	iRet = pThis->Drvr.GetSndBufSize(pThis->pDrvrData, pSize);
+	RETiRet;
+}
+
 /* Enable Keep-Alive handling for those drivers that support it.
  * rgerhards, 2009-06-02
  */
@@ -353,6 +375,8 @@ CODESTARTobjQueryInterface(netstrm)
 	pIf->CheckConnection = CheckConnection;
 	pIf->GetSock = GetSock;
 	pIf->EnableKeepAlive = EnableKeepAlive;
+	pIf->SendV = SendV;
+	pIf->GetSndBufSize = GetSndBufSize;
 finalize_it:
 ENDobjQueryInterface(netstrm)
 
@@ -26,6 +26,7 @@
 #define INCLUDED_NSD_H
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 /**
  * The following structure is a set of descriptors that need to be processed.
@@ -79,12 +80,16 @@ BEGINinterface(nsd) /* name must also be changed in ENDinterface macro! */
 	 */
 	/* v5 */
 	rsRetVal (*EnableKeepAlive)(nsd_t *pThis);
+	/* v8 */
+	rsRetVal (*SendV)(nsd_t *pThis, struct iovec *iov, int iovcnt, ssize_t *pLenBuf, int bMore);
+	rsRetVal (*GetSndBufSize)(nsd_t *pThis, int *pSize);
 ENDinterface(nsd)
-#define nsdCURR_IF_VERSION 7 /* increment whenever you change the interface structure! */
+#define nsdCURR_IF_VERSION 8 /* increment whenever you change the interface structure! */
 /* interface version 4 added GetRemAddr()
  * interface version 5 added EnableKeepAlive() -- rgerhards, 2009-06-02
  * interface version 6 changed return of CheckConnection from void to rsRetVal -- alorbach, 2012-09-06
  * interface version 7 changed signature ofGetRempoteIP() -- rgerhards, 2013-01-21
+ * interface version 8 added SendV() and GetSndBufSize() -- 2026-10-14
  */
 
 /* interface  for the select call */
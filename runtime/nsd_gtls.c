@@ -37,6 +37,20 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <time.h>
+#if defined(HAVE_LINUX_TLS_H) && GNUTLS_VERSION_NUMBER >= 0x030400
+#	define USE_KTLS 1
+#	include <sys/socket.h>
+#	include <netinet/in.h>
+#	include <netinet/tcp.h>
+#	include <linux/tls.h>
+#	ifndef SOL_TLS
+#		define SOL_TLS 282
+#	endif
+#	ifndef TCP_ULP
+#		define TCP_ULP 31
+#	endif
+#endif
 
 #include "rsyslog.h"
 #include "syslogd-types.h"
@@ -47,6 +61,8 @@
 #include "errmsg.h"
 #include "net.h"
 #include "datetime.h"
+#include "statsobj.h"
+#include "unicode-helper.h"
 #include "nsd_ptcp.h"
 #include "nsdsel_gtls.h"
 #include "nsd_gtls.h"
@@ -68,6 +84,7 @@ DEFobjCurrIf(glbl)
 DEFobjCurrIf(net)
 DEFobjCurrIf(datetime)
 DEFobjCurrIf(nsd_ptcp)
+DEFobjCurrIf(statsobj)
 
 static int bGlblSrvrInitDone = 0;	/**< 0 - server global init not yet done, 1 - already done */
 
@@ -494,6 +511,220 @@ uchar *gtlsStrerror(int error)
 }
 
 
+/* ------------------------------ kernel TLS ------------------------------ */
+/* With global(tls.ktls="on"), the record layer is handed to the kernel once
+ * the handshake is done: we pass the current keys and sequence numbers to
+ * the socket and then use plain send()/recvmsg() on it, so that encryption
+ * is done by the kernel (or the NIC, if it supports TLS offload). This is
+ * only possible for the ciphers the kernel supports. If anything is not
+ * supported, the direction concerned simply stays with GnuTLS.
+ * Limitations: TLS 1.3 key updates by the peer cannot be handled and
+ * terminate the connection; post-handshake messages received via the kernel
+ * are discarded. As TLS 1.3 session tickets are such messages, clients that
+ * resume sessions (tls.sessioncache.size > 0) keep receiving via GnuTLS.
+ */
+#ifdef USE_KTLS
+#define TLS_RECTYPE_ALERT 21
+#define TLS_RECTYPE_HANDSHAKE 22
+#define TLS_RECTYPE_DATA 23
+#define TLS_HANDSHAKE_KEY_UPDATE 24
+
+/* pass the state of one direction to the kernel, returns 1 on success */
+static int
+ktlsSetState(nsd_gtls_t *pThis, const int sock, const int bRead, const int version)
+{
+	union {
+		struct tls12_crypto_info_aes_gcm_128 aes128;
+#		ifdef TLS_CIPHER_AES_GCM_256
+		struct tls12_crypto_info_aes_gcm_256 aes256;
+#		endif
+#		ifdef TLS_CIPHER_CHACHA20_POLY1305
+		struct tls12_crypto_info_chacha20_poly1305 chacha;
+#		endif
+	} ci;
+	socklen_t lenCi;
+	gnutls_datum_t macKey, iv, cipherKey;
+	unsigned char seq[8];
+	const int bTls13 = (version == TLS_1_3_VERSION);
+	int r;
+
+	if(gnutls_record_get_state(pThis->sess, bRead, &macKey, &iv, &cipherKey, seq) != 0)
+		return 0;
+	memset(&ci, 0, sizeof(ci));
+
+/* the 4 byte implicit nonce is the salt; the explicit part is the sequence
+ * number with TLS 1.2 and the rest of the IV with TLS 1.3.
+ */
+#define KTLS_SET_AES_GCM(member, ciphertype) \
+	if(cipherKey.size != sizeof(ci.member.key) || iv.size < (bTls13 ? 12u : 4u)) \
+		return 0; \
+	ci.member.info.version = version; \
+	ci.member.info.cipher_type = ciphertype; \
+	memcpy(ci.member.salt, iv.data, 4); \
+	memcpy(ci.member.iv, bTls13 ? iv.data + 4 : seq, 8); \
+	memcpy(ci.member.key, cipherKey.data, cipherKey.size); \
+	memcpy(ci.member.rec_seq, seq, 8); \
+	lenCi = sizeof(ci.member);
+
+	switch(gnutls_cipher_get(pThis->sess)) {
+	case GNUTLS_CIPHER_AES_128_GCM:
+		KTLS_SET_AES_GCM(aes128, TLS_CIPHER_AES_GCM_128)
+		break;
+#	ifdef TLS_CIPHER_AES_GCM_256
+	case GNUTLS_CIPHER_AES_256_GCM:
+		KTLS_SET_AES_GCM(aes256, TLS_CIPHER_AES_GCM_256)
+		break;
+#	endif
+#	ifdef TLS_CIPHER_CHACHA20_POLY1305
+	case GNUTLS_CIPHER_CHACHA20_POLY1305:
+		if(cipherKey.size != sizeof(ci.chacha.key) || iv.size != sizeof(ci.chacha.iv))
+			return 0;
+		ci.chacha.info.version = version;
+		ci.chacha.info.cipher_type = TLS_CIPHER_CHACHA20_POLY1305;
+		memcpy(ci.chacha.iv, iv.data, iv.size);
+		memcpy(ci.chacha.key, cipherKey.data, cipherKey.size);
+		memcpy(ci.chacha.rec_seq, seq, 8);
+		lenCi = sizeof(ci.chacha);
+		break;
+#	endif
+	default:
+		dbgprintf("kTLS: cipher not supported by kernel TLS\n");
+		return 0;
+	}
+#undef KTLS_SET_AES_GCM
+
+	r = setsockopt(sock, SOL_TLS, bRead ? TLS_RX : TLS_TX, &ci, lenCi);
+	memset(&ci, 0, sizeof(ci)); /* do not leave keys on the stack */
+	if(r != 0) {
+		dbgprintf("kTLS: setting %s state failed, errno %d\n", bRead ? "RX" : "TX", errno);
+		return 0;
+	}
+	return 1;
+}
+
+
+/* try to hand the session over to kernel TLS, called after the handshake */
+static void
+ktlsEnable(nsd_gtls_t *pThis)
+{
+	const int sock = ((nsd_ptcp_t*) (pThis->pTcp))->sock;
+	int version;
+
+	if(!glbl.GetTlsKtls())
+		return;
+	switch(gnutls_protocol_get_version(pThis->sess)) {
+	case GNUTLS_TLS1_2:
+		version = TLS_1_2_VERSION;
+		break;
+#	ifdef TLS_1_3_VERSION
+	case GNUTLS_TLS1_3:
+		version = TLS_1_3_VERSION;
+		break;
+#	endif
+	default:
+		return;
+	}
+	if(setsockopt(sock, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) != 0) {
+		dbgprintf("kTLS: not available, errno %d\n", errno);
+		return;
+	}
+	pThis->bKtlsTx = ktlsSetState(pThis, sock, 0, version);
+	/* data GnuTLS has already received must be read via GnuTLS. A TLS 1.3
+	 * client needs GnuTLS to receive the session ticket for resumption.
+	 */
+	if(   gnutls_record_check_pending(pThis->sess) == 0
+	   && !(pThis->bIsInitiator && version != TLS_1_2_VERSION && glbl.GetTlsSessCacheSize() > 0))
+		pThis->bKtlsRx = ktlsSetState(pThis, sock, 1, version);
+	dbgprintf("kTLS: nsd %p uses kernel TLS for%s%s\n", pThis,
+		  pThis->bKtlsTx ? " send" : "", pThis->bKtlsRx ? " receive" : "");
+}
+
+
+/* receive a record via kernel TLS into our receive buffer. Records other than
+ * application data are handled here.
+ */
+static rsRetVal
+ktlsRecordRecv(nsd_gtls_t *pThis)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char cmsgBuf[CMSG_SPACE(sizeof(unsigned char))];
+	unsigned char recType;
+	ssize_t lenRcvd;
+	DEFiRet;
+
+	while(1) {
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = pThis->pszRcvBuf;
+		iov.iov_len = NSD_GTLS_MAX_RCVBUF;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = cmsgBuf;
+		msg.msg_controllen = sizeof(cmsgBuf);
+		lenRcvd = recvmsg(((nsd_ptcp_t*) (pThis->pTcp))->sock, &msg, MSG_DONTWAIT);
+		if(lenRcvd < 0) {
+			if(errno == EAGAIN || errno == EINTR) {
+				pThis->rtryCall = gtlsRtry_recv;
+				ABORT_FINALIZE(RS_RET_RETRY);
+			}
+			dbgprintf("kTLS: recvmsg failed, errno %d\n", errno);
+			ABORT_FINALIZE(RS_RET_RCV_ERR);
+		}
+		recType = TLS_RECTYPE_DATA;
+		cmsg = CMSG_FIRSTHDR(&msg);
+		if(cmsg != NULL && cmsg->cmsg_level == SOL_TLS && cmsg->cmsg_type == TLS_GET_RECORD_TYPE)
+			recType = *CMSG_DATA(cmsg);
+		if(recType == TLS_RECTYPE_DATA) {
+			break;
+		} else if(recType == TLS_RECTYPE_ALERT) {
+			dbgprintf("kTLS: alert received, closing session\n");
+			lenRcvd = 0;
+			break;
+		} else if(recType == TLS_RECTYPE_HANDSHAKE && lenRcvd > 0
+			  && (unsigned char) pThis->pszRcvBuf[0] == TLS_HANDSHAKE_KEY_UPDATE) {
+			errmsg.LogError(0, RS_RET_GNUTLS_ERR, "kernel TLS session %p received a key "
+					"update, which is not supported - closing it", pThis);
+			ABORT_FINALIZE(RS_RET_GNUTLS_ERR);
+		}
+		dbgprintf("kTLS: discarding record of type %d\n", recType);
+	}
+	pThis->lenRcvBuf = lenRcvd;
+	pThis->ptrRcvBuf = 0;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* end a kernel TLS session: send close_notify ourselves, GnuTLS can not */
+static void
+ktlsSendCloseNotify(nsd_gtls_t *pThis)
+{
+	unsigned char alert[2] = { 1, 0 }; /* warning, close_notify */
+	char cmsgBuf[CMSG_SPACE(sizeof(unsigned char))];
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = alert;
+	iov.iov_len = sizeof(alert);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgBuf;
+	msg.msg_controllen = sizeof(cmsgBuf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_TLS;
+	cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned char));
+	*CMSG_DATA(cmsg) = TLS_RECTYPE_ALERT;
+	if(sendmsg(((nsd_ptcp_t*) (pThis->pTcp))->sock, &msg, MSG_DONTWAIT) < 0)
+		dbgprintf("kTLS: sending close_notify failed, errno %d\n", errno);
+}
+#endif /* #ifdef USE_KTLS */
+
+
 /* try to receive a record from the remote peer. This works with
  * our own abstraction and handles local buffering and EAGAIN.
  * See details on local buffering in Rcv(9 header-comment.
@@ -509,6 +740,12 @@ gtlsRecordRecv(nsd_gtls_t *pThis)
 	DEFiRet;
 
 	ISOBJ_TYPE_assert(pThis, nsd_gtls);
+#	ifdef USE_KTLS
+	if(pThis->bKtlsRx) {
+		iRet = ktlsRecordRecv(pThis);
+		FINALIZE;
+	}
+#	endif
 	lenRcvd = gnutls_record_recv(pThis->sess, pThis->pszRcvBuf, NSD_GTLS_MAX_RCVBUF);
 	if(lenRcvd >= 0) {
 		pThis->lenRcvBuf = lenRcvd;
@@ -523,7 +760,7 @@ gtlsRecordRecv(nsd_gtls_t *pThis)
 	}
 
 finalize_it:
-	dbgprintf("gtlsRecordRecv return. nsd %p, iRet %d, lenRcvd %d, lenRcvBuf %d, ptrRcvBuf %d\n", pThis, iRet, (int) lenRcvd, pThis->lenRcvBuf, pThis->ptrRcvBuf);
+	dbgprintf("gtlsRecordRecv return. nsd %p, iRet %d, lenRcvBuf %d, ptrRcvBuf %d\n", pThis, iRet, pThis->lenRcvBuf, pThis->ptrRcvBuf);
 	RETiRet;
 }
 
@@ -617,6 +854,335 @@ finalize_it:
 	RETiRet;
 }
 
+
+
+/* ------------------------------ session resumption ------------------------------ */
+/* Reconnecting peers can resume their previous TLS session instead of doing
+ * a full handshake. As a server, we support both session tickets (with a key
+ * that is replaced every tls.ticketkey.rotation seconds) and a session cache
+ * of tls.sessioncache.size entries for clients that do not support tickets.
+ * As a client, we keep the session data of the last connection to each
+ * host:port and offer it on the next connect.
+ */
+#define GTLS_SESS_CACHE_EXPIRE 3600	/* GnuTLS' default session lifetime */
+#define GTLS_SESS_ID_MAX 32		/* max TLS session ID size */
+
+typedef struct gtlsSessCacheEntry_s {
+	uchar key[GTLS_SESS_ID_MAX];
+	unsigned lenKey;		/* 0 - entry unused */
+	gnutls_datum_t data;
+	time_t tStored;
+} gtlsSessCacheEntry_t;
+
+typedef struct gtlsResumeData_s {
+	uchar *pszKey;			/* host:port */
+	gnutls_datum_t data;
+	struct gtlsResumeData_s *pNext;
+} gtlsResumeData_t;
+
+static pthread_mutex_t mutResume = PTHREAD_MUTEX_INITIALIZER;	/* guards all of the below */
+static gtlsSessCacheEntry_t *pSessCache = NULL;	/* server session cache, direct-mapped */
+static int sizeSessCache = 0;
+static gtlsResumeData_t *pResumeRoot = NULL;	/* client session data */
+static int nResumeData = 0;
+#if GNUTLS_VERSION_NUMBER >= 0x020a00
+static gnutls_datum_t ticketKey[2];		/* current and previous ticket key */
+static int iCurrTicketKey = 0;
+static time_t tTicketKeyCreated = 0;
+#endif
+
+static statsobj_t *gtlsStats = NULL;
+STATSCOUNTER_DEF(ctrSrvHandshakes, mutCtrSrvHandshakes)
+STATSCOUNTER_DEF(ctrSrvResumed, mutCtrSrvResumed)
+STATSCOUNTER_DEF(ctrClntHandshakes, mutCtrClntHandshakes)
+STATSCOUNTER_DEF(ctrClntResumed, mutCtrClntResumed)
+
+
+#if GNUTLS_VERSION_NUMBER >= 0x020a00
+/* return the ticket key to use for a new server session, generating a new
+ * one if the current one is due for rotation. The previous key is kept for
+ * another rotation period, as a session may still refer to it (GnuTLS
+ * copies it only in more recent versions).
+ */
+static gnutls_datum_t *
+gtlsGetTicketKey(void)
+{
+	gnutls_datum_t *pKey = NULL;
+	time_t tNow;
+	int iNew;
+
+	time(&tNow);
+	pthread_mutex_lock(&mutResume);
+	if(   ticketKey[iCurrTicketKey].data == NULL
+	   || tNow - tTicketKeyCreated >= glbl.GetTlsTicketKeyRotation()) {
+		iNew = 1 - iCurrTicketKey;
+		if(ticketKey[iNew].data != NULL) {
+			gnutls_free(ticketKey[iNew].data);
+			ticketKey[iNew].data = NULL;
+		}
+		if(gnutls_session_ticket_key_generate(&ticketKey[iNew]) == 0) {
+			iCurrTicketKey = iNew;
+			tTicketKeyCreated = tNow;
+			dbgprintf("GnuTLS: new session ticket key generated\n");
+		}
+	}
+	if(ticketKey[iCurrTicketKey].data != NULL)
+		pKey = &ticketKey[iCurrTicketKey];
+	pthread_mutex_unlock(&mutResume);
+	return pKey;
+}
+#endif
+
+
+/* hash a session ID to its slot in the session cache, must be called with
+ * sizeSessCache > 0.
+ */
+static inline gtlsSessCacheEntry_t *
+gtlsSessCacheSlot(const gnutls_datum_t *pKey)
+{
+	unsigned hash = 2166136261u; /* FNV-1a */
+	unsigned i;
+
+	for(i = 0 ; i < pKey->size ; ++i)
+		hash = (hash ^ pKey->data[i]) * 16777619u;
+	return pSessCache + (hash % (unsigned) sizeSessCache);
+}
+
+
+/* GnuTLS session db callbacks for the server session cache */
+static int
+gtlsSessCacheStore(void __attribute__((unused)) *ptr, gnutls_datum_t key, gnutls_datum_t data)
+{
+	gtlsSessCacheEntry_t *pEntry;
+	uchar *pData;
+
+	if(key.size > GTLS_SESS_ID_MAX || sizeSessCache == 0)
+		return -1;
+	if((pData = malloc(data.size)) == NULL)
+		return -1;
+	memcpy(pData, data.data, data.size);
+
+	pthread_mutex_lock(&mutResume);
+	pEntry = gtlsSessCacheSlot(&key);
+	free(pEntry->data.data); /* an older session is evicted */
+	memcpy(pEntry->key, key.data, key.size);
+	pEntry->lenKey = key.size;
+	pEntry->data.data = pData;
+	pEntry->data.size = data.size;
+	time(&pEntry->tStored);
+	pthread_mutex_unlock(&mutResume);
+	return 0;
+}
+
+static gnutls_datum_t
+gtlsSessCacheRetrieve(void __attribute__((unused)) *ptr, gnutls_datum_t key)
+{
+	gtlsSessCacheEntry_t *pEntry;
+	gnutls_datum_t res = { NULL, 0 };
+
+	if(key.size > GTLS_SESS_ID_MAX || sizeSessCache == 0)
+		return res;
+
+	pthread_mutex_lock(&mutResume);
+	pEntry = gtlsSessCacheSlot(&key);
+	if(   pEntry->lenKey == key.size && !memcmp(pEntry->key, key.data, key.size)
+	   && time(NULL) - pEntry->tStored < GTLS_SESS_CACHE_EXPIRE) {
+		/* GnuTLS frees the returned data with gnutls_free() */
+		if((res.data = gnutls_malloc(pEntry->data.size)) != NULL) {
+			memcpy(res.data, pEntry->data.data, pEntry->data.size);
+			res.size = pEntry->data.size;
+		}
+	}
+	pthread_mutex_unlock(&mutResume);
+	return res;
+}
+
+static int
+gtlsSessCacheRemove(void __attribute__((unused)) *ptr, gnutls_datum_t key)
+{
+	gtlsSessCacheEntry_t *pEntry;
+	int r = -1;
+
+	if(key.size > GTLS_SESS_ID_MAX || sizeSessCache == 0)
+		return -1;
+
+	pthread_mutex_lock(&mutResume);
+	pEntry = gtlsSessCacheSlot(&key);
+	if(pEntry->lenKey == key.size && !memcmp(pEntry->key, key.data, key.size)) {
+		free(pEntry->data.data);
+		pEntry->data.data = NULL;
+		pEntry->lenKey = 0;
+		r = 0;
+	}
+	pthread_mutex_unlock(&mutResume);
+	return r;
+}
+
+
+/* enable session resumption for a new server session */
+static void
+gtlsEnableResumeSrv(gnutls_session_t session)
+{
+#	if GNUTLS_VERSION_NUMBER >= 0x020a00
+	gnutls_datum_t *pKey;
+
+	if(glbl.GetTlsTicketKeyRotation() > 0 && (pKey = gtlsGetTicketKey()) != NULL)
+		gnutls_session_ticket_enable_server(session, pKey);
+#	endif
+	if(sizeSessCache > 0) {
+		gnutls_db_set_retrieve_function(session, gtlsSessCacheRetrieve);
+		gnutls_db_set_store_function(session, gtlsSessCacheStore);
+		gnutls_db_set_remove_function(session, gtlsSessCacheRemove);
+		gnutls_db_set_ptr(session, NULL);
+	}
+}
+
+
+/* offer the session data of our last connection to the same peer
+ * (if any) on a new client session.
+ */
+static void
+gtlsSetResumeData(nsd_gtls_t *pThis)
+{
+	gtlsResumeData_t *pRes;
+
+	pthread_mutex_lock(&mutResume);
+	for(pRes = pResumeRoot ; pRes != NULL ; pRes = pRes->pNext) {
+		if(!strcmp((char*) pRes->pszKey, (char*) pThis->pszResumeKey)) {
+			gnutls_session_set_data(pThis->sess, pRes->data.data, pRes->data.size);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&mutResume);
+}
+
+
+/* remember the data of the current client session for resuming it later.
+ * We are called after the handshake and once more before the session ends,
+ * because with TLS 1.3 the session ticket arrives only after the handshake.
+ */
+static void
+gtlsSaveResumeData(nsd_gtls_t *pThis)
+{
+	gtlsResumeData_t *pRes;
+	gnutls_datum_t data;
+
+	if(pThis->pszResumeKey == NULL || gnutls_session_get_data2(pThis->sess, &data) != 0)
+		return;
+
+	pthread_mutex_lock(&mutResume);
+	for(pRes = pResumeRoot ; pRes != NULL ; pRes = pRes->pNext) {
+		if(!strcmp((char*) pRes->pszKey, (char*) pThis->pszResumeKey))
+			break;
+	}
+	if(pRes == NULL && nResumeData < glbl.GetTlsSessCacheSize()) {
+		if((pRes = calloc(1, sizeof(gtlsResumeData_t))) != NULL) {
+			if((pRes->pszKey = (uchar*) strdup((char*) pThis->pszResumeKey)) == NULL) {
+				free(pRes);
+				pRes = NULL;
+			} else {
+				pRes->pNext = pResumeRoot;
+				pResumeRoot = pRes;
+				++nResumeData;
+			}
+		}
+	}
+	if(pRes != NULL) {
+		gnutls_free(pRes->data.data);
+		pRes->data = data;
+		data.data = NULL;
+	}
+	pthread_mutex_unlock(&mutResume);
+	gnutls_free(data.data);
+}
+
+
+/* account for a completed handshake. Called by nsdsel_gtls, too. */
+void
+gtlsHandshakeDone(nsd_gtls_t *pThis)
+{
+	const int bResumed = gnutls_session_is_resumed(pThis->sess);
+
+	dbgprintf("GnuTLS handshake done, session %sresumed\n", bResumed ? "" : "not ");
+	if(pThis->bIsInitiator) {
+		STATSCOUNTER_INC(ctrClntHandshakes, mutCtrClntHandshakes);
+		if(bResumed) {
+			STATSCOUNTER_INC(ctrClntResumed, mutCtrClntResumed);
+		}
+		gtlsSaveResumeData(pThis);
+	} else {
+		STATSCOUNTER_INC(ctrSrvHandshakes, mutCtrSrvHandshakes);
+		if(bResumed) {
+			STATSCOUNTER_INC(ctrSrvResumed, mutCtrSrvResumed);
+		}
+	}
+#	ifdef USE_KTLS
+	ktlsEnable(pThis);
+#	endif
+}
+
+
+/* set up session resumption and its statistics */
+static rsRetVal
+gtlsResumeInit(void)
+{
+	DEFiRet;
+
+	sizeSessCache = glbl.GetTlsSessCacheSize();
+	if(sizeSessCache > 0)
+		CHKmalloc(pSessCache = calloc(sizeSessCache, sizeof(gtlsSessCacheEntry_t)));
+
+	CHKiRet(statsobj.Construct(&gtlsStats));
+	CHKiRet(statsobj.SetName(gtlsStats, UCHAR_CONSTANT("nsd_gtls")));
+	STATSCOUNTER_INIT(ctrSrvHandshakes, mutCtrSrvHandshakes);
+	CHKiRet(statsobj.AddCounter(gtlsStats, UCHAR_CONSTANT("server.handshakes"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &ctrSrvHandshakes));
+	STATSCOUNTER_INIT(ctrSrvResumed, mutCtrSrvResumed);
+	CHKiRet(statsobj.AddCounter(gtlsStats, UCHAR_CONSTANT("server.resumed"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &ctrSrvResumed));
+	STATSCOUNTER_INIT(ctrClntHandshakes, mutCtrClntHandshakes);
+	CHKiRet(statsobj.AddCounter(gtlsStats, UCHAR_CONSTANT("client.handshakes"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &ctrClntHandshakes));
+	STATSCOUNTER_INIT(ctrClntResumed, mutCtrClntResumed);
+	CHKiRet(statsobj.AddCounter(gtlsStats, UCHAR_CONSTANT("client.resumed"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &ctrClntResumed));
+	CHKiRet(statsobj.ConstructFinalize(gtlsStats));
+
+finalize_it:
+	RETiRet;
+}
+
+
+static void
+gtlsResumeExit(void)
+{
+	gtlsResumeData_t *pRes;
+	int i;
+
+	if(gtlsStats != NULL)
+		statsobj.Destruct(&gtlsStats);
+	for(i = 0 ; i < sizeSessCache ; ++i)
+		free(pSessCache[i].data.data);
+	free(pSessCache);
+	pSessCache = NULL;
+	sizeSessCache = 0;
+	while(pResumeRoot != NULL) {
+		pRes = pResumeRoot;
+		pResumeRoot = pRes->pNext;
+		free(pRes->pszKey);
+		gnutls_free(pRes->data.data);
+		free(pRes);
+	}
+#	if GNUTLS_VERSION_NUMBER >= 0x020a00
+	for(i = 0 ; i < 2 ; ++i) {
+		if(ticketKey[i].data != NULL) {
+			gnutls_free(ticketKey[i].data);
+			ticketKey[i].data = NULL;
+		}
+	}
+#	endif
+}
+
 static rsRetVal
 gtlsInitSession(nsd_gtls_t *pThis)
 {
@@ -634,6 +1200,7 @@ gtlsInitSession(nsd_gtls_t *pThis)
 
 	/* request client certificate if any.  */
 	gnutls_certificate_server_set_request( session, GNUTLS_CERT_REQUEST);
+	gtlsEnableResumeSrv(session);
 
 	pThis->sess = session;
 
@@ -1119,9 +1686,16 @@ gtlsEndSess(nsd_gtls_t *pThis)
 
 	if(pThis->bHaveSess) {
 		if(pThis->bIsInitiator) {
-			gnuRet = gnutls_bye(pThis->sess, GNUTLS_SHUT_RDWR);
-			while(gnuRet == GNUTLS_E_INTERRUPTED || gnuRet == GNUTLS_E_AGAIN) {
+			gtlsSaveResumeData(pThis);
+			if(pThis->bKtlsTx) {
+#				ifdef USE_KTLS
+				ktlsSendCloseNotify(pThis);
+#				endif
+			} else {
 				gnuRet = gnutls_bye(pThis->sess, GNUTLS_SHUT_RDWR);
+				while(gnuRet == GNUTLS_E_INTERRUPTED || gnuRet == GNUTLS_E_AGAIN) {
+					gnuRet = gnutls_bye(pThis->sess, GNUTLS_SHUT_RDWR);
+				}
 			}
 		}
 		gnutls_deinit(pThis->sess);
@@ -1170,6 +1744,7 @@ CODESTARTobjDestruct(nsd_gtls)
 	if(pThis->pszConnectHost != NULL) {
 		free(pThis->pszConnectHost);
 	}
+	free(pThis->pszResumeKey);
 
 	if(pThis->pszRcvBuf == NULL) {
 		free(pThis->pszRcvBuf);
@@ -1424,6 +1999,7 @@ AcceptConnReq(nsd_t *pNsd, nsd_t **ppNew)
 		pNew->rtryCall = gtlsRtry_handshake;
 		dbgprintf("GnuTLS handshake does not complete immediately - setting to retry (this is OK and normal)\n");
 	} else if(gnuRet == 0) {
+		gtlsHandshakeDone(pNew);
 		/* we got a handshake, now check authorization */
 		CHKiRet(gtlsChkPeerAuth(pNew));
 	} else {
@@ -1561,6 +2137,12 @@ Send(nsd_t *pNsd, uchar *pBuf, ssize_t *pLenBuf)
 	}
 
 	/* in TLS mode now */
+#	ifdef USE_KTLS
+	if(pThis->bKtlsTx) {
+		CHKiRet(nsd_ptcp.Send(pThis->pTcp, pBuf, pLenBuf));
+		FINALIZE;
+	}
+#	endif
 	while(1) { /* loop broken inside */
 		iSent = gnutls_record_send(pThis->sess, pBuf, *pLenBuf);
 		if(iSent >= 0) {
@@ -1578,6 +2160,55 @@ finalize_it:
 	RETiRet;
 }
 
+/* gathering send. In plain tcp and kTLS mode, this is passed down to
+ * the ptcp driver. Otherwise, the buffers are handed to GnuTLS one after
+ * the other, what at least saves the caller from copying them together.
+ */
+static rsRetVal
+SendV(nsd_t *pNsd, struct iovec *iov, int iovcnt, ssize_t *pLenBuf, int bMore)
+{
+	nsd_gtls_t *pThis = (nsd_gtls_t*) pNsd;
+	ssize_t lenSent = 0;
+	ssize_t lenBuf;
+	int i;
+	DEFiRet;
+	ISOBJ_TYPE_assert(pThis, nsd_gtls);
+
+	if(pThis->bAbortConn)
+		ABORT_FINALIZE(RS_RET_CONNECTION_ABORTREQ);
+
+	if(pThis->iMode == 0
+#	ifdef USE_KTLS
+	   || pThis->bKtlsTx
+#	endif
+	) {
+		CHKiRet(nsd_ptcp.SendV(pThis->pTcp, iov, iovcnt, pLenBuf, bMore));
+		FINALIZE;
+	}
+
+	for(i = 0 ; i < iovcnt ; ++i) {
+		lenBuf = iov[i].iov_len;
+		CHKiRet(Send(pNsd, iov[i].iov_base, &lenBuf));
+		lenSent += lenBuf;
+		if(lenBuf != (ssize_t) iov[i].iov_len)
+			break; /* partial write, caller needs to retry */
+	}
+	*pLenBuf = lenSent;
+
+finalize_it:
+	RETiRet;
+}
+
+
+static rsRetVal
+GetSndBufSize(nsd_t *pNsd, int *pSize)
+{
+	nsd_gtls_t *pThis = (nsd_gtls_t*) pNsd;
+	ISOBJ_TYPE_assert(pThis, nsd_gtls);
+	return nsd_ptcp.GetSndBufSize(pThis->pTcp, pSize);
+}
+
+
 /* Enable KEEPALIVE handling on the socket.
  * rgerhards, 2009-06-02
  */
@@ -1647,9 +2278,16 @@ Connect(nsd_t *pNsd, int family, uchar *port, uchar *host)
 	 */
 	CHKmalloc(pThis->pszConnectHost = (uchar*)strdup((char*)host));
 
+	if(glbl.GetTlsSessCacheSize() > 0) {
+		CHKmalloc(pThis->pszResumeKey = malloc(strlen((char*)host) + strlen((char*)port) + 2));
+		sprintf((char*)pThis->pszResumeKey, "%s:%s", host, port);
+		gtlsSetResumeData(pThis);
+	}
+
 	/* and perform the handshake */
 	CHKgnutls(gnutls_handshake(pThis->sess));
 	dbgprintf("GnuTLS handshake succeeded\n");
+	gtlsHandshakeDone(pThis);
 
 	/* now check if the remote peer is permitted to talk to us - ideally, we 
 	 * should do this during the handshake, but GnuTLS does not yet provide 
@@ -1698,6 +2336,8 @@ CODESTARTobjQueryInterface(nsd_gtls)
 	pIf->GetRemoteIP = GetRemoteIP;
 	pIf->GetRemAddr = GetRemAddr;
 	pIf->EnableKeepAlive = EnableKeepAlive;
+	pIf->SendV = SendV;
+	pIf->GetSndBufSize = GetSndBufSize;
 finalize_it:
 ENDobjQueryInterface(nsd_gtls)
 
@@ -1706,6 +2346,7 @@ ENDobjQueryInterface(nsd_gtls)
  */
 BEGINObjClassExit(nsd_gtls, OBJ_IS_LOADABLE_MODULE) /* CHANGE class also in END MACRO! */
 CODESTARTObjClassExit(nsd_gtls)
+	gtlsResumeExit();
 	gtlsGlblExit();	/* shut down GnuTLS */
 
 	/* release objects we no longer need */
@@ -1713,6 +2354,7 @@ CODESTARTObjClassExit(nsd_gtls)
 	objRelease(net, LM_NET_FILENAME);
 	objRelease(glbl, CORE_COMPONENT);
 	objRelease(datetime, CORE_COMPONENT);
+	objRelease(statsobj, CORE_COMPONENT);
 	objRelease(errmsg, CORE_COMPONENT);
 ENDObjClassExit(nsd_gtls)
 
@@ -1728,9 +2370,11 @@ BEGINObjClassInit(nsd_gtls, 1, OBJ_IS_LOADABLE_MODULE) /* class, version */
 	CHKiRet(objUse(glbl, CORE_COMPONENT));
 	CHKiRet(objUse(net, LM_NET_FILENAME));
 	CHKiRet(objUse(nsd_ptcp, LM_NSD_PTCP_FILENAME));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 
 	/* now do global TLS init stuff */
 	CHKiRet(gtlsGlblInit());
+	CHKiRet(gtlsResumeInit());
 ENDObjClassInit(nsd_gtls)
 
 
@@ -63,6 +63,9 @@ struct nsd_gtls_s {
 	char *pszRcvBuf;
 	int lenRcvBuf;		/**< -1: empty, 0: connection closed, 1..NSD_GTLS_MAX_RCVBUF-1: data of that size present */
 	int ptrRcvBuf;		/**< offset for next recv operation if 0 < lenRcvBuf < NSD_GTLS_MAX_RCVBUF */
+	uchar *pszResumeKey;	/**< "host:port" for client session resumption, NULL if not used */
+	sbool bKtlsTx;		/**< sending is done by kernel TLS */
+	sbool bKtlsRx;		/**< receiving is done by kernel TLS */
 };
 
 /* interface is defined in nsd.h, we just implement it! */
@@ -74,6 +77,7 @@ PROTOTYPEObj(nsd_gtls);
 uchar *gtlsStrerror(int error);
 rsRetVal gtlsChkPeerAuth(nsd_gtls_t *pThis);
 rsRetVal gtlsRecordRecv(nsd_gtls_t *pThis);
+void gtlsHandshakeDone(nsd_gtls_t *pThis);
 static inline rsRetVal gtlsHasRcvInBuffer(nsd_gtls_t *pThis) {
 	/* we have a valid receive buffer one such is allocated and 
 	 * NOT exhausted!
@@ -258,7 +258,7 @@ FillRemHost(nsd_ptcp_t *pThis, struct sockaddr_storage *pAddr)
 	ISOBJ_TYPE_assert(pThis, nsd_ptcp);
 	assert(pAddr != NULL);
 
-	CHKiRet(dnscacheLookup(pAddr, &fqdn, NULL, NULL, &pThis->remoteIP));
+	CHKiRet(dnscacheLookupNoWait(pAddr, &fqdn, NULL, NULL, &pThis->remoteIP));
 
 	/* We now have the names, so now let's allocate memory and store them permanently.
 	 * (side note: we may hold on to these values for quite a while, thus we trim their
@@ -586,6 +586,68 @@ finalize_it:
 }
 
 
+/* gathering send, see Send() for the semantics. If bMore is set, the
+ * kernel is told that more data follows (MSG_MORE), so that small writes
+ * inside a transaction are combined into full segments.
+ */
+static rsRetVal
+SendV(nsd_t *pNsd, struct iovec *iov, int iovcnt, ssize_t *pLenBuf, int bMore)
+{
+	nsd_ptcp_t *pThis = (nsd_ptcp_t*) pNsd;
+	struct msghdr mh;
+	ssize_t written;
+	int flags = 0;
+	DEFiRet;
+	ISOBJ_TYPE_assert(pThis, nsd_ptcp);
+
+#	ifdef MSG_MORE
+	if(bMore)
+		flags |= MSG_MORE;
+#	endif
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = iov;
+	mh.msg_iovlen = iovcnt;
+	written = sendmsg(pThis->sock, &mh, flags);
+
+	if(written == -1) {
+		switch(errno) {
+			case EAGAIN:
+			case EINTR:
+				/* this is fine, just retry... */
+				written = 0;
+				break;
+			default:
+				ABORT_FINALIZE(RS_RET_IO_ERROR);
+				break;
+		}
+	}
+
+	*pLenBuf = written;
+finalize_it:
+	RETiRet;
+}
+
+
+/* get the socket's send buffer size */
+static rsRetVal
+GetSndBufSize(nsd_t *pNsd, int *pSize)
+{
+	nsd_ptcp_t *pThis = (nsd_ptcp_t*) pNsd;
+	socklen_t optlen;
+	DEFiRet;
+	ISOBJ_TYPE_assert(pThis, nsd_ptcp);
+
+	optlen = sizeof(*pSize);
+	if(getsockopt(pThis->sock, SOL_SOCKET, SO_SNDBUF, pSize, &optlen) != 0) {
+		dbgprintf("nsd_ptcp: could not obtain SO_SNDBUF, errno %d\n", errno);
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* Enable KEEPALIVE handling on the socket.
  * rgerhards, 2009-06-02
  */
@@ -754,6 +816,8 @@ CODESTARTobjQueryInterface(nsd_ptcp)
 	pIf->GetRemoteIP = GetRemoteIP;
 	pIf->CheckConnection = CheckConnection;
 	pIf->EnableKeepAlive = EnableKeepAlive;
+	pIf->SendV = SendV;
+	pIf->GetSndBufSize = GetSndBufSize;
 finalize_it:
 ENDobjQueryInterface(nsd_ptcp)
 
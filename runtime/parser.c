@@ -25,10 +25,13 @@
  * A copy of the LGPL can be found in the file "COPYING.LESSER" in this distribution.
  */
 #include "config.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
 #include <assert.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 #ifdef USE_NETZIP
 #include <zlib.h>
 #endif
@@ -44,9 +47,14 @@
 #include "unicode-helper.h"
 #include "dirty.h"
 #include "cfsysline.h"
+#include "prop.h"
+#include "statsobj.h"
+#include "probes.h"
 
 /* some defines */
 #define DEFUPRI		(LOG_USER|LOG_NOTICE)
+#define PARSER_CACHE_SIZE 4096	/* must be a power of two */
+#define PARSER_IDX_MASK 0xff	/* low bits of a cache entry: list index + 1 */
 
 /* definitions for objects we access */
 DEFobjStaticHelpers
@@ -54,9 +62,18 @@ DEFobjCurrIf(glbl)
 DEFobjCurrIf(errmsg)
 DEFobjCurrIf(datetime)
 DEFobjCurrIf(ruleset)
+DEFobjCurrIf(statsobj)
 
 /* static data */
 
+/* cache of the parser that last succeeded, keyed by parser list, input and
+ * sender. Each entry holds the upper bits of the key together with the index
+ * of the parser inside its list. Access is deliberately unsynchronized: an
+ * entry is a single word, and a stale or foreign one just means we try a
+ * different parser first.
+ */
+static unsigned parserCache[PARSER_CACHE_SIZE];
+
 /* config data */
 static uchar cCCEscapeChar = '#';/* character to be used to start an escape sequence for control chars */
 static int bEscapeCCOnRcv = 1; /* escape control characters on reception: 0 - no, 1 - yes */
@@ -64,6 +81,7 @@ static int bSpaceLFOnRcv = 0; /* replace newlines with spaces on reception: 0 -
 static int bEscape8BitChars = 0; /* escape characters > 127 on reception: 0 - no, 1 - yes */
 static int bEscapeTab = 1;	/* escape tab control character when doing CC escapes: 0 - no, 1 - yes */
 static int bDropTrailingLF = 1; /* drop trailing LF's on reception? */
+int bParserTryLastSuccessful = 0; /* global(parser.trylastsuccessful) */
 
 /* This is the list of all parsers known to us.
  * This is also used to unload all modules on shutdown.
@@ -205,9 +223,24 @@ ENDobjConstruct(parser)
  */
 rsRetVal parserConstructFinalize(parser_t *pThis)
 {
+	uchar statsName[128];
 	DEFiRet;
 
 	ISOBJ_TYPE_assert(pThis, parser);
+
+	/* counters are named after the parser, e.g. "parser.rsyslog.rfc3164" */
+	snprintf((char*) statsName, sizeof(statsName), "parser.%s",
+		 (pThis->pName == NULL) ? "unnamed" : (char*) pThis->pName);
+	CHKiRet(statsobj.Construct(&pThis->stats));
+	CHKiRet(statsobj.SetName(pThis->stats, statsName));
+	STATSCOUNTER_SHARDED_INIT(pThis->ctrAttempts);
+	CHKiRet(statsobj.AddCounter(pThis->stats, UCHAR_CONSTANT("attempts"),
+		ctrType_IntCtrSharded, CTR_FLAG_RESETTABLE, &pThis->ctrAttempts));
+	STATSCOUNTER_SHARDED_INIT(pThis->ctrParsed);
+	CHKiRet(statsobj.AddCounter(pThis->stats, UCHAR_CONSTANT("parsed"),
+		ctrType_IntCtrSharded, CTR_FLAG_RESETTABLE, &pThis->ctrParsed));
+	CHKiRet(statsobj.ConstructFinalize(pThis->stats));
+
 	CHKiRet(AddParserToList(&pParsLstRoot, pThis));
 	DBGPRINTF("Parser '%s' added to list of available parsers.\n", pThis->pName);
 
@@ -218,20 +251,72 @@ finalize_it:
 BEGINobjDestruct(parser) /* be sure to specify the object type also in END and CODESTART macros! */
 CODESTARTobjDestruct(parser)
 	DBGPRINTF("destructing parser '%s'\n", pThis->pName);
+	if(pThis->stats != NULL)
+		statsobj.Destruct(&pThis->stats);
 	free(pThis->pName);
 ENDobjDestruct(parser)
 
 
+#ifdef USE_NETZIP
+/* per-thread state for uncompressing messages. Keeping the zlib stream
+ * and its output buffer around avoids setting up a new inflate state
+ * (including its 32KiB window) and allocating a max-size buffer for
+ * each compressed message.
+ */
+typedef struct inflateThrd_s {
+	z_stream zstrm;
+	uchar *buf;
+	size_t lenBuf;
+} inflateThrd_t;
+static pthread_key_t keyInflateThrd;
+
+static void
+inflateThrdDestruct(void *arg)
+{
+	inflateThrd_t *pThrd = (inflateThrd_t*) arg;
+
+	inflateEnd(&pThrd->zstrm);
+	free(pThrd->buf);
+	free(pThrd);
+}
+
+/* get the calling thread's inflate state, which is created on first
+ * use. Returns NULL if that fails.
+ */
+static inline inflateThrd_t *
+getInflateThrd(void)
+{
+	inflateThrd_t *pThrd;
+
+	if((pThrd = (inflateThrd_t*) pthread_getspecific(keyInflateThrd)) == NULL) {
+		if((pThrd = calloc(1, sizeof(inflateThrd_t))) == NULL)
+			return NULL;
+		if(inflateInit(&pThrd->zstrm) != Z_OK) {
+			free(pThrd);
+			return NULL;
+		}
+		pthread_setspecific(keyInflateThrd, pThrd);
+	}
+	return pThrd;
+}
+#endif /* #ifdef USE_NETZIP */
+
+
 /* uncompress a received message if it is compressed.
  * pMsg->pszRawMsg buffer is updated.
  * rgerhards, 2008-10-09
+ * The message is now inflated in a streaming fashion into a per-thread
+ * buffer which only grows as far as needed.
  */
 static inline rsRetVal uncompressMessage(msg_t *pMsg)
 {
 	DEFiRet;
 #	ifdef USE_NETZIP
-	uchar *deflateBuf = NULL;
-	uLongf iLenDefBuf;
+	inflateThrd_t *pThrd;
+	uchar *newBuf;
+	size_t maxLen;
+	size_t newLen;
+	size_t lenOut;
 	uchar *pszMsg;
 	size_t lenMsg;
 	
@@ -251,11 +336,39 @@ static inline rsRetVal uncompressMessage(msg_t *pMsg)
 		 * feature.
 		 */
 		int ret;
-		iLenDefBuf = glbl.GetMaxLine();
-		CHKmalloc(deflateBuf = MALLOC(sizeof(uchar) * (iLenDefBuf + 1)));
-		ret = uncompress((uchar *) deflateBuf, &iLenDefBuf, (uchar *) pszMsg+1, lenMsg-1);
+		CHKmalloc(pThrd = getInflateThrd());
+		maxLen = glbl.GetMaxLine();
+		inflateReset(&pThrd->zstrm);
+		pThrd->zstrm.next_in = (Bytef*) pszMsg + 1;
+		pThrd->zstrm.avail_in = lenMsg - 1;
+		lenOut = 0;
+		while(1) {
+			if(lenOut >= maxLen) {
+				ret = Z_BUF_ERROR; /* too large */
+				break;
+			}
+			if(lenOut == pThrd->lenBuf) {
+				newLen = (pThrd->lenBuf == 0) ? 4096 : pThrd->lenBuf * 2;
+				if(newLen > maxLen)
+					newLen = maxLen;
+				CHKmalloc(newBuf = realloc(pThrd->buf, newLen));
+				pThrd->buf = newBuf;
+				pThrd->lenBuf = newLen;
+			}
+			pThrd->zstrm.next_out = pThrd->buf + lenOut;
+			pThrd->zstrm.avail_out = ((pThrd->lenBuf < maxLen) ? pThrd->lenBuf : maxLen) - lenOut;
+			ret = inflate(&pThrd->zstrm, Z_FINISH);
+			lenOut = pThrd->zstrm.next_out - pThrd->buf;
+			if(ret == Z_STREAM_END) {
+				ret = Z_OK;
+				break;
+			}
+			/* Z_BUF_ERROR with output space left means truncated input */
+			if(ret != Z_OK && !(ret == Z_BUF_ERROR && pThrd->zstrm.avail_out == 0))
+				break;
+		}
 		DBGPRINTF("Compressed message uncompressed with status %d, length: new %ld, old %d.\n",
-		        ret, (long) iLenDefBuf, (int) (lenMsg-1));
+		        ret, (long) lenOut, (int) (lenMsg-1));
 		/* Now check if the uncompression worked. If not, there is not much we can do. In
 		 * that case, we log an error message but ignore the message itself. Storing the
 		 * compressed text is dangerous, as it contains control characters. So we do
@@ -270,11 +383,9 @@ static inline rsRetVal uncompressMessage(msg_t *pMsg)
 				    "Message ignored.", ret);
 			FINALIZE; /* unconditional exit, nothing left to do... */
 		}
-		MsgSetRawMsg(pMsg, (char*)deflateBuf, iLenDefBuf);
+		MsgSetRawMsg(pMsg, (char*)pThrd->buf, lenOut);
 	}
 finalize_it:
-	if(deflateBuf != NULL)
-		free(deflateBuf);
 
 #	else /* ifdef USE_NETZIP */
 
@@ -294,6 +405,98 @@ finalize_it:
 }
 
 
+/* check if any byte inside an eight-byte word is a control character
+ * (below 32), see
+ * http://graphics.stanford.edu/~seander/bithacks.html#HasLessInWord
+ */
+#define WORD_HIGHBITS 0x8080808080808080ULL
+#define wordHasCC(w) (((w) - 0x2020202020202020ULL) & ~(w) & WORD_HIGHBITS)
+
+/* find the first byte that requires the message to be sanitized, returns
+ * lenMsg if there is none. Eight bytes are checked at once, which is fast
+ * as the vast majority of messages contains no control characters at all.
+ * If configured, LF is replaced by space on the fly.
+ */
+static inline size_t
+findSanitizeStart(uchar *pszMsg, size_t lenMsg)
+{
+	const uint64_t mask8Bit = bEscape8BitChars ? WORD_HIGHBITS : 0;
+	uint64_t w;
+	size_t i;
+	size_t iEnd;
+
+	i = 0;
+	while(i < lenMsg) {
+		if(i + sizeof(w) <= lenMsg) {
+			memcpy(&w, pszMsg + i, sizeof(w));
+			if(!wordHasCC(w) && !(w & mask8Bit)) {
+				i += sizeof(w);
+				continue;
+			}
+			iEnd = i + sizeof(w);
+		} else {
+			iEnd = lenMsg;
+		}
+		for( ; i < iEnd ; ++i) {
+			if(pszMsg[i] < 32) {
+				if(bSpaceLFOnRcv && pszMsg[i] == '\n')
+					pszMsg[i] = ' ';
+				else if(pszMsg[i] == '\0' || bEscapeCCOnRcv)
+					return i;
+			} else if(pszMsg[i] > 127 && bEscape8BitChars) {
+				return i;
+			}
+		}
+	}
+	return lenMsg;
+}
+
+/* size of a byte after sanitization: 4 if escaped, 0 if dropped */
+static inline int
+sanitizedLen(uchar c)
+{
+	if(c < 32) {
+		if(c == '\n' && bSpaceLFOnRcv)
+			return 1;
+		if(c == '\t' && !bEscapeTab)
+			return 1;
+		/* note: \0 must always be escaped, the rest of the code currently
+		 * can not handle it! -- rgerhards, 2009-08-26
+		 */
+		return (c == '\0' || bEscapeCCOnRcv) ? 4 : 0;
+	} else if(c > 127 && bEscape8BitChars) {
+		return 4;
+	}
+	return 1;
+}
+
+/* write the sanitized form of c to pDst, returns the number of
+ * bytes written (see sanitizedLen()).
+ */
+static inline int
+writeSanitized(uchar *pDst, uchar c)
+{
+	int len;
+
+	len = sanitizedLen(c);
+	if(len == 4) {
+		/* we are configured to escape control characters. Please note
+		 * that this most probably break non-western character sets like
+		 * Japanese, Korean or Chinese. rgerhards, 2007-07-17
+		 * The same is true for 8-bit chars, which probably breaks
+		 * European languages. -- rgerhards, 2010-01-27
+		 */
+		pDst[0] = cCCEscapeChar;
+		pDst[1] = '0' + ((c & 0300) >> 6);
+		pDst[2] = '0' + ((c & 0070) >> 3);
+		pDst[3] = '0' + ((c & 0007));
+	} else if(len == 1) {
+		pDst[0] = (c == '\n' && bSpaceLFOnRcv) ? ' ' : c;
+	}
+	return len;
+}
+
+
 /* sanitize a received message
  * if a message gets to large during sanitization, it is truncated. This is
  * as specified in the upcoming syslog RFC series.
@@ -319,7 +522,12 @@ SanitizeMsg(msg_t *pMsg)
 	size_t iDst;
 	size_t iMaxLine;
 	size_t maxDest;
+	size_t iFirst;
+	size_t iSrcEnd;
+	size_t lenNew;
+	int lenSan;
 	sbool bUpdatedLen = RSFALSE;
+	sbool bDropped = RSFALSE;
 	uchar szSanBuf[32*1024]; /* buffer used for sanitizing a string */
 
 	assert(pMsg != NULL);
@@ -343,7 +551,7 @@ SanitizeMsg(msg_t *pMsg)
 	 * compatible to recent IETF developments, we allow the user to
 	 * turn on/off this handling.  rgerhards, 2007-07-23
 	 */
-	if(bDropTrailingLF && pszMsg[lenMsg-1] == '\n') {
+	if(bDropTrailingLF && lenMsg > 0 && pszMsg[lenMsg-1] == '\n') {
 		DBGPRINTF("dropped LF at very end of message (DropTrailingLF is set)\n");
 		lenMsg--;
 		pszMsg[lenMsg] = '\0';
@@ -360,78 +568,63 @@ SanitizeMsg(msg_t *pMsg)
 	 * that actually use it, because we may call the sanitizer without actual
 	 * need below (but it then still will work perfectly well!). -- rgerhards, 2009-11-27
 	 */
-	int bNeedSanitize = 0;
-	for(iSrc = 0 ; iSrc < lenMsg ; iSrc++) {
-		if(pszMsg[iSrc] < 32) {
-			if(bSpaceLFOnRcv && pszMsg[iSrc] == '\n')
-				pszMsg[iSrc] = ' ';
-			else if(pszMsg[iSrc] == '\0' || bEscapeCCOnRcv) {
-				bNeedSanitize = 1;
-				if (!bSpaceLFOnRcv)
-					break;
-			}
-		} else if(pszMsg[iSrc] > 127 && bEscape8BitChars) {
-			bNeedSanitize = 1;
-			break;
-		}
-	}
-
-	if(!bNeedSanitize) {
+	iSrc = findSanitizeStart(pszMsg, lenMsg);
+	if(iSrc == lenMsg) {
 		if(bUpdatedLen == RSTRUE)
 			MsgSetRawMsgSize(pMsg, lenMsg);
 		FINALIZE;
 	}
 
-	/* now copy over the message and sanitize it. Note that up to iSrc-1 there was
-	 * obviously no need to sanitize, so we can go over that quickly...
+	/* now compute the size of the sanitized message. Up to iSrc there is
+	 * no need to sanitize. We stop where the max message size would be
+	 * exceeded, leaving some space if the last char must be escaped.
 	 */
 	iMaxLine = glbl.GetMaxLine();
 	maxDest = lenMsg * 4; /* message can grow at most four-fold */
 	if(maxDest > iMaxLine)
 		maxDest = iMaxLine;	/* but not more than the max size! */
-	if(maxDest < sizeof(szSanBuf))
-		pDst = szSanBuf;
-	else 
-		CHKmalloc(pDst = MALLOC(sizeof(uchar) * (iMaxLine + 1)));
-	if(iSrc > 0) {
-		iSrc--; /* go back to where everything is OK */
-		memcpy(pDst, pszMsg, iSrc); /* fast copy known good */
-	}
+	iFirst = iSrc;
 	iDst = iSrc;
-	while(iSrc < lenMsg && iDst < maxDest - 3) { /* leave some space if last char must be escaped */
-		if((pszMsg[iSrc] < 32) && (pszMsg[iSrc] != '\t' || bEscapeTab)) {
-			/* note: \0 must always be escaped, the rest of the code currently
-			 * can not handle it! -- rgerhards, 2009-08-26
-			 */
-			if(pszMsg[iSrc] == '\0' || bEscapeCCOnRcv) {
-				/* we are configured to escape control characters. Please note
-				 * that this most probably break non-western character sets like
-				 * Japanese, Korean or Chinese. rgerhards, 2007-07-17
-				 */
-				pDst[iDst++] = cCCEscapeChar;
-				pDst[iDst++] = '0' + ((pszMsg[iSrc] & 0300) >> 6);
-				pDst[iDst++] = '0' + ((pszMsg[iSrc] & 0070) >> 3);
-				pDst[iDst++] = '0' + ((pszMsg[iSrc] & 0007));
-			}
-		} else if(pszMsg[iSrc] > 127 && bEscape8BitChars) {
-			/* In this case, we also do the conversion. Note that this most
-			 * probably breaks European languages. -- rgerhards, 2010-01-27
-			 */
-			pDst[iDst++] = cCCEscapeChar;
-			pDst[iDst++] = '0' + ((pszMsg[iSrc] & 0300) >> 6);
-			pDst[iDst++] = '0' + ((pszMsg[iSrc] & 0070) >> 3);
-			pDst[iDst++] = '0' + ((pszMsg[iSrc] & 0007));
-		} else {
-			pDst[iDst++] = pszMsg[iSrc];
-		}
+	while(iSrc < lenMsg && iDst < maxDest - 3) {
+		lenSan = sanitizedLen(pszMsg[iSrc]);
+		if(lenSan == 0)
+			bDropped = RSTRUE;
+		iDst += lenSan;
 		++iSrc;
 	}
-	pDst[iDst] = '\0';
+	iSrcEnd = iSrc;
+	lenNew = iDst;
 
-	MsgSetRawMsg(pMsg, (char*)pDst, iDst); /* save sanitized string */
+	if(pszMsg == pMsg->szRawMsg && lenNew < CONF_RAWMSG_BUFSIZE && !bDropped) {
+		/* the result fits into the message's fixed buffer: rewrite in
+		 * place, from the end, so that nothing unprocessed is overwritten
+		 * (every byte occupies at least one byte after sanitization).
+		 */
+		while(iSrc > iFirst) {
+			--iSrc;
+			iDst -= sanitizedLen(pszMsg[iSrc]);
+			writeSanitized(pszMsg + iDst, pszMsg[iSrc]);
+		}
+		pszMsg[lenNew] = '\0';
+		pMsg->iLenRawMsg = lenNew;
+		FINALIZE;
+	}
+
+	if(lenNew < sizeof(szSanBuf))
+		pDst = szSanBuf;
+	else
+		CHKmalloc(pDst = MALLOC(sizeof(uchar) * (lenNew + 1)));
+	memcpy(pDst, pszMsg, iFirst); /* fast copy known good */
+	iDst = iFirst;
+	for(iSrc = iFirst ; iSrc < iSrcEnd ; ++iSrc)
+		iDst += writeSanitized(pDst + iDst, pszMsg[iSrc]);
+	pDst[iDst] = '\0';
 
-	if(pDst != szSanBuf)
-		free(pDst);
+	if(pDst == szSanBuf) {
+		MsgSetRawMsg(pMsg, (char*)pDst, iDst); /* save sanitized string */
+	} else {
+		MsgSetRawMsgBuf(pMsg, pDst, iDst); /* hand over, no need to copy */
+	}
 
 finalize_it:
 	RETiRet;
@@ -479,9 +672,89 @@ ParsePRI(msg_t *pMsg)
 }
 
 
+/* compute the key for the last-successful-parser cache. It covers the parser
+ * list, the input the message came from and, if known, the sending host, so
+ * that a single listener with differently-formatted senders does not keep
+ * overwriting its own entry. Returns 0 if the key has no bits left above the
+ * index mask (the caller then does not use the cache).
+ */
+static unsigned
+getParserCacheKey(parserList_t *pParserList, msg_t *pMsg)
+{
+	struct sockaddr_storage *pAddr;
+	uchar *p = NULL;
+	int len = 0;
+	unsigned key = 5381;
+
+	key = ((key << 5) + key) ^ (unsigned) ((uintptr_t) pParserList >> 4);
+	key = ((key << 5) + key) ^ (unsigned) ((uintptr_t) pMsg->pInputName >> 4);
+	if(pMsg->msgFlags & NEEDS_DNSRESOL) {
+		pAddr = pMsg->rcvFrom.pfrominet;
+		if(pAddr != NULL && pAddr->ss_family == AF_INET) {
+			p = (uchar*) &((struct sockaddr_in*) pAddr)->sin_addr;
+			len = sizeof(struct in_addr);
+		} else if(pAddr != NULL && pAddr->ss_family == AF_INET6) {
+			p = (uchar*) &((struct sockaddr_in6*) pAddr)->sin6_addr;
+			len = sizeof(struct in6_addr);
+		}
+	} else if(pMsg->pRcvFromIP != NULL) {
+		p = propGetSzStr(pMsg->pRcvFromIP);
+		len = pMsg->pRcvFromIP->len;
+	}
+	while(len-- > 0)
+		key = ((key << 5) + key) ^ *p++;
+	return (key & ~PARSER_IDX_MASK) ? key : (key | (PARSER_IDX_MASK + 1));
+}
+
+
+/* find the parser list entry with the given index, or NULL if the list is
+ * shorter than that (the cache entry then belongs to a different list).
+ */
+static inline parserList_t *
+getParserByIdx(parserList_t *pParserList, int idx)
+{
+	while(pParserList != NULL && idx-- > 0)
+		pParserList = pParserList->pNext;
+	return pParserList;
+}
+
+
+/* call a single parser, doing message sanitization and PRI parsing first if
+ * the parser requires it and it has not yet been done for this message. The
+ * parser's own result is returned in *pParseRet, iRet only reflects failures
+ * of the preparation steps.
+ */
+static inline rsRetVal
+callParser(parser_t *pParser, msg_t *pMsg, sbool *pbIsSanitized, sbool *pbPRIisParsed,
+	   rsRetVal *pParseRet)
+{
+	DEFiRet;
+
+	if(pParser->bDoSanitazion && *pbIsSanitized == RSFALSE) {
+		CHKiRet(SanitizeMsg(pMsg));
+		if(pParser->bDoPRIParsing && *pbPRIisParsed == RSFALSE) {
+			CHKiRet(ParsePRI(pMsg));
+			*pbPRIisParsed = RSTRUE;
+		}
+		*pbIsSanitized = RSTRUE;
+	}
+	STATSCOUNTER_SHARDED_INC(pParser->ctrAttempts);
+	*pParseRet = pParser->pModule->mod.pm.parse(pMsg);
+	DBGPRINTF("Parser '%s' returned %d\n", pParser->pName, *pParseRet);
+	if(*pParseRet == RS_RET_OK)
+		STATSCOUNTER_SHARDED_INC(pParser->ctrParsed);
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* Parse a received message. The object's rawmsg property is taken and
  * parsed according to the relevant standards. This can later be
  * extended to support configured parsers.
+ * If parser.trylastsuccessful is on, the parser that succeeded last for the
+ * same input and sender is tried first. Only if it fails, the list is walked
+ * in configured order (skipping the one already tried).
  * rgerhards, 2008-10-09
  */
 static rsRetVal
@@ -489,12 +762,17 @@ ParseMsg(msg_t *pMsg)
 {
 	rsRetVal localRet = RS_RET_ERR;
 	parserList_t *pParserList;
-	parser_t *pParser;
+	parserList_t *pTried = NULL;
 	sbool bIsSanitized;
 	sbool bPRIisParsed;
+	unsigned cacheKey = 0;
+	unsigned cacheEntry;
+	unsigned *pCacheSlot = NULL;
+	int idx;
 	static int iErrMsgRateLimiter = 0;
 	DEFiRet;
 
+	RSPROBE2(parse__begin, pMsg, pMsg->iLenRawMsg);
 	if(pMsg->iLenRawMsg == 0)
 		ABORT_FINALIZE(RS_RET_EMPTY_MSG);
 
@@ -523,21 +801,38 @@ ParseMsg(msg_t *pMsg)
 
 	bIsSanitized = RSFALSE;
 	bPRIisParsed = RSFALSE;
-	while(pParserList != NULL) {
-		pParser = pParserList->pParser;
-		if(pParser->bDoSanitazion && bIsSanitized == RSFALSE) {
-			CHKiRet(SanitizeMsg(pMsg));
-			if(pParser->bDoPRIParsing && bPRIisParsed == RSFALSE) {
-				CHKiRet(ParsePRI(pMsg));
-				bPRIisParsed = RSTRUE;
+
+	/* a single-entry list has nothing to gain from the cache */
+	if(bParserTryLastSuccessful && pParserList != NULL && pParserList->pNext != NULL) {
+		cacheKey = getParserCacheKey(pParserList, pMsg);
+		pCacheSlot = &parserCache[(cacheKey >> 8) & (PARSER_CACHE_SIZE - 1)];
+		cacheEntry = *pCacheSlot;
+		if(cacheEntry != 0 && (cacheEntry & ~PARSER_IDX_MASK) == (cacheKey & ~PARSER_IDX_MASK)) {
+			pTried = getParserByIdx(pParserList, (int) (cacheEntry & PARSER_IDX_MASK) - 1);
+			if(pTried != NULL) {
+				CHKiRet(callParser(pTried->pParser, pMsg, &bIsSanitized,
+					&bPRIisParsed, &localRet));
+				if(localRet != RS_RET_COULD_NOT_PARSE)
+					pParserList = NULL; /* done, either way */
 			}
-			bIsSanitized = RSTRUE;
 		}
-		localRet = pParser->pModule->mod.pm.parse(pMsg);
-		DBGPRINTF("Parser '%s' returned %d\n", pParser->pName, localRet);
-		if(localRet != RS_RET_COULD_NOT_PARSE)
-			break;
+	}
+
+	idx = 0;
+	while(pParserList != NULL) {
+		if(pParserList != pTried) {
+			CHKiRet(callParser(pParserList->pParser, pMsg, &bIsSanitized,
+				&bPRIisParsed, &localRet));
+			if(localRet != RS_RET_COULD_NOT_PARSE)
+				break;
+		}
 		pParserList = pParserList->pNext;
+		++idx;
+	}
+
+	if(pCacheSlot != NULL && localRet == RS_RET_OK && pParserList != NULL
+	   && idx < PARSER_IDX_MASK) {
+		*pCacheSlot = (cacheKey & ~PARSER_IDX_MASK) | (unsigned) (idx + 1);
 	}
 
 	/* We need to log a warning message and drop the message if we did not find a parser.
@@ -557,8 +852,10 @@ ParseMsg(msg_t *pMsg)
 
 	/* "finalize" message object */
 	pMsg->msgFlags &= ~NEEDS_PARSING; /* this message is now parsed */
+	MsgTraceStage(pMsg, TRACE_PARSE);
 
 finalize_it:
+	RSPROBE2(parse__end, pMsg, iRet);
 	RETiRet;
 }
 
@@ -698,6 +995,7 @@ BEGINObjClassExit(parser, OBJ_IS_CORE_MODULE) /* class, version */
 	destroyMasterParserList();
 	objRelease(glbl, CORE_COMPONENT);
 	objRelease(errmsg, CORE_COMPONENT);
+	objRelease(statsobj, CORE_COMPONENT);
 	objRelease(datetime, CORE_COMPONENT);
 	objRelease(ruleset, CORE_COMPONENT);
 ENDObjClassExit(parser)
@@ -713,6 +1011,11 @@ BEGINObjClassInit(parser, 1, OBJ_IS_CORE_MODULE) /* class, version */
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
 	CHKiRet(objUse(datetime, CORE_COMPONENT));
 	CHKiRet(objUse(ruleset, CORE_COMPONENT));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
+#	ifdef USE_NETZIP
+	if(pthread_key_create(&keyInflateThrd, inflateThrdDestruct) != 0)
+		ABORT_FINALIZE(RS_RET_ERR);
+#	endif
 
 	CHKiRet(regCfSysLineHdlr((uchar *)"controlcharacterescapeprefix", 0, eCmdHdlrGetChar, NULL, &cCCEscapeChar, NULL));
 	CHKiRet(regCfSysLineHdlr((uchar *)"droptrailinglfonreception", 0, eCmdHdlrBinary, NULL, &bDropTrailingLF, NULL));
@@ -21,6 +21,7 @@
 #ifndef INCLUDED_PARSER_H
 #define INCLUDED_PARSER_H
 
+#include "statsobj.h"
 
 /* we create a small helper object, a list of parsers, that we can use to
  * build a chain of them whereever this is needed (initially thought to be
@@ -39,6 +40,9 @@ struct parser_s {
 	modInfo_t *pModule;	/* pointer to parser's module */
 	sbool bDoSanitazion;	/* do standard message sanitazion before calling parser? */
 	sbool bDoPRIParsing;	/* do standard PRI parsing before calling parser? */
+	statsobj_t *stats;	/* per-parser statistics */
+	STATSCOUNTER_SHARDED_DEF(ctrAttempts)	/* updated by all input threads */
+	STATSCOUNTER_SHARDED_DEF(ctrParsed)
 };
 
 /* interfaces */
@@ -63,6 +67,7 @@ ENDinterface(parser)
 #define parserCURR_IF_VERSION 1 /* increment whenever you change the interface above! */
 
 void printParserList(parserList_t *pList);
+extern int bParserTryLastSuccessful;	/* global(parser.trylastsuccessful) */
 
 /* prototypes */
 PROTOTYPEObj(parser);
@@ -0,0 +1,439 @@
+/* perfhash.c - perfect hash table of strings
+ *
+ * We use the "hash and displace" method: keys are first distributed over
+ * buckets (about four keys per bucket). Then, starting with the largest
+ * bucket, we search a seed for each bucket that sends all its keys to
+ * still unused slots of the table, which has twice as many slots as keys.
+ * A lookup thus needs one hash of the key, the bucket's seed, one slot and
+ * a compare with the key found there. All keys are hashed once with a
+ * 64-bit hash; the bucket and the slot are derived from that.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "rsyslog.h"
+#include "perfhash.h"
+
+#define PERFHASH_MAXSEED 65536	/* seeds tried per bucket before we grow the table */
+
+typedef struct phkey_s {
+	uchar *key;
+	size_t len;
+	int value;
+	int order;	/* position in which the key was added */
+	uint64_t hash;
+} phkey_t;
+
+struct perfhash_s {
+	phkey_t *keys;
+	int nKeys;
+	int maxKeys;
+	uint32_t bucketMask;
+	uint32_t slotMask;
+	uint32_t *seeds;	/* per bucket */
+	int *slots;		/* index into keys, -1 if unused */
+};
+
+
+/* the splitmix64 finalizer, spreads all input bits over the result */
+static inline uint64_t
+phMix(uint64_t h)
+{
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ull;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebull;
+	h ^= h >> 31;
+	return h;
+}
+
+static inline uint64_t
+phHash(const uchar *key, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ull;	/* FNV-1a */
+	size_t i;
+
+	for(i = 0 ; i < len ; ++i) {
+		h ^= key[i];
+		h *= 0x100000001b3ull;
+	}
+	return phMix(h);
+}
+
+static inline uint32_t
+phSlot(uint64_t h, uint32_t seed, uint32_t slotMask)
+{
+	return (uint32_t) phMix(h + seed * 0x9e3779b97f4a7c15ull) & slotMask;
+}
+
+static inline uint32_t
+phBucket(uint64_t h, uint32_t bucketMask)
+{
+	return (uint32_t) (h >> 32) & bucketMask;
+}
+
+
+rsRetVal
+perfhashConstruct(perfhash_t **ppThis)
+{
+	DEFiRet;
+	CHKmalloc(*ppThis = calloc(1, sizeof(perfhash_t)));
+finalize_it:
+	RETiRet;
+}
+
+void
+perfhashDestruct(perfhash_t **ppThis)
+{
+	perfhash_t *pThis = *ppThis;
+	int i;
+
+	if(pThis == NULL)
+		return;
+	for(i = 0 ; i < pThis->nKeys ; ++i)
+		free(pThis->keys[i].key);
+	free(pThis->keys);
+	free(pThis->seeds);
+	free(pThis->slots);
+	free(pThis);
+	*ppThis = NULL;
+}
+
+int
+perfhashNumKeys(perfhash_t *pThis)
+{
+	return pThis->nKeys;
+}
+
+rsRetVal
+perfhashAdd(perfhash_t *pThis, const uchar *key, size_t lenKey, int value)
+{
+	phkey_t *newkeys;
+	int newMax;
+	DEFiRet;
+
+	if(pThis->nKeys == pThis->maxKeys) {
+		/* grow geometrically, lookup tables may add millions of keys */
+		newMax = (pThis->maxKeys == 0) ? 64 : pThis->maxKeys * 2;
+		CHKmalloc(newkeys = realloc(pThis->keys, newMax * sizeof(phkey_t)));
+		pThis->keys = newkeys;
+		pThis->maxKeys = newMax;
+	}
+	CHKmalloc(pThis->keys[pThis->nKeys].key = malloc(lenKey + 1));
+	memcpy(pThis->keys[pThis->nKeys].key, key, lenKey);
+	pThis->keys[pThis->nKeys].len = lenKey;
+	pThis->keys[pThis->nKeys].value = value;
+	pThis->keys[pThis->nKeys].order = pThis->nKeys;
+	pThis->keys[pThis->nKeys].hash = phHash(key, lenKey);
+	++pThis->nKeys;
+finalize_it:
+	RETiRet;
+}
+
+/* sort keys by hash, equal keys by the order they were added */
+static int
+phKeyCmp(const void *a, const void *b)
+{
+	const phkey_t *ka = (const phkey_t*) a;
+	const phkey_t *kb = (const phkey_t*) b;
+	int r;
+
+	if(ka->hash != kb->hash)
+		return (ka->hash < kb->hash) ? -1 : 1;
+	if(ka->len != kb->len)
+		return (ka->len < kb->len) ? -1 : 1;
+	if((r = memcmp(ka->key, kb->key, ka->len)) != 0)
+		return r;
+	return ka->order - kb->order;
+}
+
+/* remove duplicate keys, keeping the one added first. Fails if two
+ * different keys have the same hash, as no seed could separate them.
+ */
+static rsRetVal
+phRemoveDuplicates(perfhash_t *pThis)
+{
+	int i, j;
+	DEFiRet;
+
+	qsort(pThis->keys, pThis->nKeys, sizeof(phkey_t), phKeyCmp);
+	for(i = 0, j = 0 ; i < pThis->nKeys ; ++i) {
+		if(j > 0 && pThis->keys[j-1].hash == pThis->keys[i].hash) {
+			if(   pThis->keys[j-1].len != pThis->keys[i].len
+			   || memcmp(pThis->keys[j-1].key, pThis->keys[i].key, pThis->keys[i].len))
+				ABORT_FINALIZE(RS_RET_ERR);
+			free(pThis->keys[i].key);
+			continue;
+		}
+		pThis->keys[j++] = pThis->keys[i];
+	}
+finalize_it:
+	if(iRet != RS_RET_OK) { /* keep the table consistent for destruct */
+		for( ; i < pThis->nKeys ; ++i)
+			pThis->keys[j++] = pThis->keys[i];
+	}
+	pThis->nKeys = j;
+	RETiRet;
+}
+
+/* bucket sizes, for sorting buckets by size (largest first) */
+typedef struct phbucket_s {
+	uint32_t bucket;
+	int nKeys;
+	int firstKey;	/* keys of a bucket are consecutive in the bucket-sorted index */
+} phbucket_t;
+
+static int
+phBucketCmp(const void *a, const void *b)
+{
+	return ((const phbucket_t*) b)->nKeys - ((const phbucket_t*) a)->nKeys;
+}
+
+/* try to place all keys with slotMask, returns RS_RET_ERR if some bucket
+ * could not be placed.
+ */
+static rsRetVal
+phPlace(perfhash_t *pThis, phbucket_t *buckets, int *keyIdx, uint32_t *bucketSlots)
+{
+	uint32_t nBuckets = pThis->bucketMask + 1;
+	uint32_t b, seed, slot;
+	int i, k;
+	DEFiRet;
+
+	for(slot = 0 ; slot <= pThis->slotMask ; ++slot)
+		pThis->slots[slot] = -1;
+	for(b = 0 ; b < nBuckets && buckets[b].nKeys > 0 ; ++b) {
+		for(seed = 0 ; seed < PERFHASH_MAXSEED ; ++seed) {
+			for(i = 0 ; i < buckets[b].nKeys ; ++i) {
+				k = keyIdx[buckets[b].firstKey + i];
+				slot = phSlot(pThis->keys[k].hash, seed, pThis->slotMask);
+				if(pThis->slots[slot] != -1)
+					break;
+				pThis->slots[slot] = k; /* tentatively */
+				bucketSlots[i] = slot;
+			}
+			if(i == buckets[b].nKeys)
+				break; /* all placed */
+			while(i-- > 0) /* undo */
+				pThis->slots[bucketSlots[i]] = -1;
+		}
+		if(seed == PERFHASH_MAXSEED)
+			ABORT_FINALIZE(RS_RET_ERR);
+		pThis->seeds[buckets[b].bucket] = seed;
+	}
+finalize_it:
+	RETiRet;
+}
+
+rsRetVal
+perfhashFinalize(perfhash_t *pThis)
+{
+	phbucket_t *buckets = NULL;
+	int *keyIdx = NULL;
+	uint32_t *bucketSlots = NULL;
+	uint32_t nBuckets, nSlots, b;
+	int i, maxBucket;
+	rsRetVal localRet;
+	DEFiRet;
+
+	CHKiRet(phRemoveDuplicates(pThis));
+	for(nBuckets = 1 ; nBuckets * 4 < (uint32_t) pThis->nKeys ; nBuckets *= 2)
+		/* just search */;
+	for(nSlots = 8 ; nSlots < (uint32_t) pThis->nKeys * 2 ; nSlots *= 2)
+		/* just search */;
+	pThis->bucketMask = nBuckets - 1;
+	CHKmalloc(pThis->seeds = calloc(nBuckets, sizeof(uint32_t)));
+	CHKmalloc(buckets = calloc(nBuckets, sizeof(phbucket_t)));
+	CHKmalloc(keyIdx = malloc((pThis->nKeys + 1) * sizeof(int)));
+
+	/* group keys by bucket (counting sort) */
+	for(b = 0 ; b < nBuckets ; ++b)
+		buckets[b].bucket = b;
+	for(i = 0 ; i < pThis->nKeys ; ++i)
+		++buckets[phBucket(pThis->keys[i].hash, pThis->bucketMask)].nKeys;
+	maxBucket = 0;
+	for(b = 0, i = 0 ; b < nBuckets ; ++b) {
+		buckets[b].firstKey = i;
+		i += buckets[b].nKeys;
+		if(buckets[b].nKeys > maxBucket)
+			maxBucket = buckets[b].nKeys;
+		buckets[b].nKeys = 0;
+	}
+	for(i = 0 ; i < pThis->nKeys ; ++i) {
+		b = phBucket(pThis->keys[i].hash, pThis->bucketMask);
+		keyIdx[buckets[b].firstKey + buckets[b].nKeys++] = i;
+	}
+	qsort(buckets, nBuckets, sizeof(phbucket_t), phBucketCmp);
+	CHKmalloc(bucketSlots = malloc((maxBucket + 1) * sizeof(uint32_t)));
+
+	/* place buckets, grow the table if that does not work out */
+	do {
+		pThis->slotMask = nSlots - 1;
+		free(pThis->slots);
+		CHKmalloc(pThis->slots = malloc(nSlots * sizeof(int)));
+		localRet = phPlace(pThis, buckets, keyIdx, bucketSlots);
+		nSlots *= 2;
+	} while(localRet != RS_RET_OK && nSlots <= (uint32_t) pThis->nKeys * 32);
+	if(localRet != RS_RET_OK)
+		ABORT_FINALIZE(localRet);
+	DBGPRINTF("perfhash %p: %d keys, %u buckets, %u slots\n",
+		  pThis, pThis->nKeys, nBuckets, pThis->slotMask + 1);
+
+finalize_it:
+	free(buckets);
+	free(keyIdx);
+	free(bucketSlots);
+	RETiRet;
+}
+
+int
+perfhashLookup(perfhash_t *pThis, const uchar *key, size_t lenKey)
+{
+	const uint64_t h = phHash(key, lenKey);
+	const int k = pThis->slots[phSlot(h, pThis->seeds[phBucket(h, pThis->bucketMask)],
+					  pThis->slotMask)];
+
+	if(k == -1 || pThis->keys[k].len != lenKey || memcmp(pThis->keys[k].key, key, lenKey))
+		return -1;
+	return pThis->keys[k].value;
+}
+
+
+/* serialized form: nKeys, bucketMask, slotMask, the seeds, the slots and,
+ * for each key, its value, length and bytes. Key hashes are recomputed on
+ * load, so a damaged file cannot make lookups return wrong keys.
+ */
+size_t
+perfhashSerializedSize(perfhash_t *pThis)
+{
+	size_t len;
+	int i;
+
+	len = 3 * sizeof(uint32_t) + (pThis->bucketMask + 1) * sizeof(uint32_t)
+	      + (pThis->slotMask + 1) * sizeof(int32_t);
+	for(i = 0 ; i < pThis->nKeys ; ++i)
+		len += sizeof(int32_t) + sizeof(uint32_t) + pThis->keys[i].len;
+	return len;
+}
+
+static inline uchar *
+phPut(uchar *buf, const void *p, size_t len)
+{
+	memcpy(buf, p, len);
+	return buf + len;
+}
+
+void
+perfhashSerialize(perfhash_t *pThis, uchar *buf)
+{
+	uint32_t u;
+	int32_t v;
+	uint32_t slot;
+	int i;
+
+	u = (uint32_t) pThis->nKeys;
+	buf = phPut(buf, &u, sizeof(u));
+	buf = phPut(buf, &pThis->bucketMask, sizeof(uint32_t));
+	buf = phPut(buf, &pThis->slotMask, sizeof(uint32_t));
+	buf = phPut(buf, pThis->seeds, (pThis->bucketMask + 1) * sizeof(uint32_t));
+	for(slot = 0 ; slot <= pThis->slotMask ; ++slot) {
+		v = pThis->slots[slot];
+		buf = phPut(buf, &v, sizeof(v));
+	}
+	for(i = 0 ; i < pThis->nKeys ; ++i) {
+		v = pThis->keys[i].value;
+		u = (uint32_t) pThis->keys[i].len;
+		buf = phPut(buf, &v, sizeof(v));
+		buf = phPut(buf, &u, sizeof(u));
+		buf = phPut(buf, pThis->keys[i].key, pThis->keys[i].len);
+	}
+}
+
+/* copy len bytes from *pbuf to p if that many are left */
+static inline int
+phGet(const uchar **pbuf, size_t *pleft, void *p, size_t len)
+{
+	if(*pleft < len)
+		return 0;
+	memcpy(p, *pbuf, len);
+	*pbuf += len;
+	*pleft -= len;
+	return 1;
+}
+
+rsRetVal
+perfhashDeserialize(perfhash_t **ppThis, const uchar *buf, size_t len, int maxValue)
+{
+	perfhash_t *pThis = NULL;
+	uint32_t nKeys, u, slot;
+	int32_t v;
+	int i;
+	DEFiRet;
+
+	CHKiRet(perfhashConstruct(&pThis));
+	if(   !phGet(&buf, &len, &nKeys, sizeof(nKeys))
+	   || !phGet(&buf, &len, &pThis->bucketMask, sizeof(uint32_t))
+	   || !phGet(&buf, &len, &pThis->slotMask, sizeof(uint32_t))
+	   || (pThis->bucketMask & (pThis->bucketMask + 1)) != 0
+	   || (pThis->slotMask & (pThis->slotMask + 1)) != 0
+	   || pThis->bucketMask == UINT32_MAX || pThis->slotMask == UINT32_MAX
+	   || nKeys > len / (sizeof(int32_t) + sizeof(uint32_t))
+	   || nKeys > (uint32_t) maxValue
+	   || (pThis->bucketMask + 1) > len / sizeof(uint32_t)
+	   || (pThis->slotMask + 1) > len / sizeof(int32_t))
+		ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+
+	CHKmalloc(pThis->seeds = malloc((pThis->bucketMask + 1) * sizeof(uint32_t)));
+	CHKmalloc(pThis->slots = malloc((pThis->slotMask + 1) * sizeof(int)));
+	if(!phGet(&buf, &len, pThis->seeds, (pThis->bucketMask + 1) * sizeof(uint32_t)))
+		ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+	for(slot = 0 ; slot <= pThis->slotMask ; ++slot) {
+		if(!phGet(&buf, &len, &v, sizeof(v)) || v < -1 || v >= (int32_t) nKeys)
+			ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+		pThis->slots[slot] = v;
+	}
+	if(nKeys > 0) {
+		CHKmalloc(pThis->keys = malloc(nKeys * sizeof(phkey_t)));
+		pThis->maxKeys = (int) nKeys;
+	}
+	for(i = 0 ; i < (int) nKeys ; ++i) {
+		if(   !phGet(&buf, &len, &v, sizeof(v))
+		   || !phGet(&buf, &len, &u, sizeof(u))
+		   || v < 0 || v >= maxValue || u > len)
+			ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+		CHKmalloc(pThis->keys[i].key = malloc(u + 1));
+		phGet(&buf, &len, pThis->keys[i].key, u);
+		pThis->keys[i].len = u;
+		pThis->keys[i].value = v;
+		pThis->keys[i].order = i;
+		pThis->keys[i].hash = phHash(pThis->keys[i].key, u);
+		pThis->nKeys = i + 1;
+	}
+	if(len != 0)
+		ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+	*ppThis = pThis;
+
+finalize_it:
+	if(iRet != RS_RET_OK)
+		perfhashDestruct(&pThis);
+	RETiRet;
+}
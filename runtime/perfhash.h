@@ -0,0 +1,52 @@
+/* Definitions for the perfect hash table of strings.
+ *
+ * A static set of strings, each mapped to an integer value, that is
+ * looked up with exactly one probe. It is built once (at config load) with
+ * the "hash and displace" method and used by the RainerScript optimizer
+ * to select the branch of long if/else-if chains comparing a property
+ * against constants.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_PERFHASH_H
+#define INCLUDED_PERFHASH_H
+
+typedef struct perfhash_s perfhash_t;
+
+rsRetVal perfhashConstruct(perfhash_t **ppThis);
+void perfhashDestruct(perfhash_t **ppThis);
+/* add a key; if the same key is added more than once, the first value is kept */
+rsRetVal perfhashAdd(perfhash_t *pThis, const uchar *key, size_t lenKey, int value);
+/* build the table, must be called after all keys have been added */
+rsRetVal perfhashFinalize(perfhash_t *pThis);
+int perfhashNumKeys(perfhash_t *pThis);
+/* return the value for key, -1 if it is not in the table */
+int perfhashLookup(perfhash_t *pThis, const uchar *key, size_t lenKey);
+/* save a finalized table to buf, which must have room for
+ * perfhashSerializedSize() bytes. The format is native-endian and only
+ * meant to be read back by the same build.
+ */
+size_t perfhashSerializedSize(perfhash_t *pThis);
+void perfhashSerialize(perfhash_t *pThis, uchar *buf);
+/* restore a finalized table saved by perfhashSerialize(). Fails with
+ * RS_RET_INVALID_VALUE if buf is malformed or a value is not in 0..maxValue-1.
+ */
+rsRetVal perfhashDeserialize(perfhash_t **ppThis, const uchar *buf, size_t len, int maxValue);
+
+#endif /* #ifndef INCLUDED_PERFHASH_H */
@@ -0,0 +1,59 @@
+/* Static (USDT) tracepoints for production diagnosis.
+ *
+ * If rsyslog is configured with --enable-usdt, the probes below are
+ * compiled in via systemtap's <sys/sdt.h>. A probe that is not attached
+ * costs just a nop instruction, so they can be placed on hot paths.
+ * Tools like bpftrace, perf or systemtap can attach to them on a live
+ * system, e.g.
+ *   bpftrace -e 'usdt:/usr/sbin/rsyslogd:rsyslog:queue__dequeue
+ *                { @[str(arg0)] = hist(arg1); }'
+ * Note that probe arguments are evaluated even if no tool is attached,
+ * so only pass values that are already at hand (no function calls).
+ * Without --enable-usdt, the macros expand to nothing.
+ *
+ * Available probes (provider "rsyslog"):
+ *   queue__enqueue(char *queue, msg_t *msg, int size)
+ *   queue__dequeue(char *queue, int nDequeued, int sizeRemaining)
+ *   batch__start(batch_t *batch, int nElem)
+ *   batch__end(batch_t *batch, int nElem)
+ *   parse__begin(msg_t *msg, int lenRawMsg)
+ *   parse__end(msg_t *msg, int iRet)
+ *   action__call__begin(char *action, int actionNbr)
+ *   action__call__end(char *action, int iRet)
+ *   action__commit__begin(char *action, int nMsgs)
+ *   action__commit__end(char *action, int iRet)
+ *   stream__write(char *file, size_t len)
+ *   stream__flush(char *file, size_t len)
+ * The queue, action and file names may be NULL.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_PROBES_H
+#define INCLUDED_PROBES_H
+
+#ifdef ENABLE_USDT
+#	include <sys/sdt.h>
+#	define RSPROBE2(name, a1, a2) DTRACE_PROBE2(rsyslog, name, a1, a2)
+#	define RSPROBE3(name, a1, a2, a3) DTRACE_PROBE3(rsyslog, name, a1, a2, a3)
+#else
+#	define RSPROBE2(name, a1, a2)
+#	define RSPROBE3(name, a1, a2, a3)
+#endif
+
+#endif /* #ifndef INCLUDED_PROBES_H */
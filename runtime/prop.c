@@ -35,6 +35,7 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "rsyslog.h"
 #include "obj.h"
@@ -46,6 +47,26 @@
 /* static data */
 DEFobjStaticHelpers
 
+/* The interning table. Frequently changing string props like hostnames
+ * and sender IPs are kept here, so that all users of the same string share
+ * a single prop object and can compare it by pointer. The table is
+ * set-associative and of fixed size: a string hashes to a set of
+ * INTERN_WAYS slots. Each slot holds one reference to its prop. If a set is
+ * full, a prop that is referenced by the table only is evicted; if there
+ * is none, the new prop is simply not interned. Sets are protected by a
+ * small number of striped mutexes.
+ */
+#define INTERN_SETS 16384	/* must be a power of 2 */
+#define INTERN_WAYS 4
+#define INTERN_LOCKS 64		/* must be a power of 2 */
+struct internSlot_s {
+	unsigned hash;
+	prop_t *pProp;
+};
+static struct internSlot_s *internTab = NULL;
+static pthread_mutex_t internMut[INTERN_LOCKS];
+static pthread_once_t internOnce = PTHREAD_ONCE_INIT;
+
 
 /* Standard-Constructor
  */
@@ -151,6 +172,80 @@ static rsRetVal CreateStringProp(prop_t **ppThis, uchar* psz, int len)
 	RETiRet;
 }
 
+static void
+internInit(void)
+{
+	int i;
+	for(i = 0 ; i < INTERN_LOCKS ; ++i)
+		pthread_mutex_init(&internMut[i], NULL);
+	internTab = calloc(INTERN_SETS * INTERN_WAYS, sizeof(struct internSlot_s));
+	if(internTab == NULL)
+		DBGPRINTF("prop: could not allocate interning table, props will not be shared\n");
+}
+
+
+/* obtain a prop for the given string from the interning table, creating it
+ * if it is not yet present. Equal strings always yield the same prop as
+ * long as it is interned. As with CreateStringProp(), the caller receives a
+ * reference it must release via Destruct().
+ */
+static rsRetVal
+CreateInternedStringProp(prop_t **ppThis, uchar *psz, int len)
+{
+	struct internSlot_s *set;
+	struct internSlot_s *pFree = NULL;
+	pthread_mutex_t *mut;
+	prop_t *pProp;
+	unsigned hash;
+	int i;
+	DEFiRet;
+
+	pthread_once(&internOnce, internInit);
+	if(internTab == NULL) {
+		CHKiRet(CreateStringProp(ppThis, psz, len));
+		FINALIZE;
+	}
+
+	hash = 2166136261u;
+	for(i = 0 ; i < len ; ++i)
+		hash = (hash ^ psz[i]) * 16777619u;
+	set = internTab + (hash & (INTERN_SETS - 1)) * INTERN_WAYS;
+	mut = &internMut[hash & (INTERN_LOCKS - 1)];
+
+	pthread_mutex_lock(mut);
+	for(i = 0 ; i < INTERN_WAYS ; ++i) {
+		pProp = set[i].pProp;
+		if(pProp == NULL) {
+			if(pFree == NULL)
+				pFree = set + i;
+		} else if(set[i].hash == hash && pProp->len == len
+			  && !memcmp(propGetSzStr(pProp), psz, len)) {
+			AddRef(pProp);
+			*ppThis = pProp;
+			pthread_mutex_unlock(mut);
+			FINALIZE;
+		} else if(pFree == NULL
+			  && ATOMIC_FETCH_32BIT(&pProp->iRefCount, &pProp->mutRefCount) == 1) {
+			/* only we hold it - as any new reference would need to be
+			 * obtained via this set's lock, we can safely evict it.
+			 */
+			propDestruct(&set[i].pProp);
+			pFree = set + i;
+		}
+	}
+	iRet = CreateStringProp(ppThis, psz, len);
+	if(iRet == RS_RET_OK && pFree != NULL) {
+		AddRef(*ppThis);
+		pFree->hash = hash;
+		pFree->pProp = *ppThis;
+	}
+	pthread_mutex_unlock(mut);
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* another one-stop function, quite useful: it takes a property pointer and
  * a string. If the string is already contained in the property, nothing happens.
  * If the string is different (or the pointer NULL), the current property
@@ -170,14 +265,16 @@ rsRetVal CreateOrReuseStringProp(prop_t **ppThis, uchar *psz, int len)
 
 	if(*ppThis == NULL) {
 		/* we need to create a property */ 
-		CHKiRet(CreateStringProp(ppThis, psz, len));
+		CHKiRet(CreateInternedStringProp(ppThis, psz, len));
 	} else {
 		/* already exists, check if we can re-use it */
 		GetString(*ppThis, &pszPrev, &lenPrev);
 		if(len != lenPrev || ustrcmp(psz, pszPrev)) {
-			/* different, need to discard old & create new one */
+			/* different, need to discard old & obtain new one. As the
+			 * sender is likely to be seen again, the interned one is used.
+			 */
 			propDestruct(ppThis);
-			CHKiRet(CreateStringProp(ppThis, psz, len));
+			CHKiRet(CreateInternedStringProp(ppThis, psz, len));
 		} /* else we can re-use the existing one! */
 	}
 
@@ -217,6 +314,7 @@ CODESTARTobjQueryInterface(prop)
 	pIf->AddRef = AddRef;
 	pIf->CreateStringProp = CreateStringProp;
 	pIf->CreateOrReuseStringProp = CreateOrReuseStringProp;
+	pIf->CreateInternedStringProp = CreateInternedStringProp;
 
 finalize_it:
 ENDobjQueryInterface(prop)
@@ -226,6 +324,14 @@ ENDobjQueryInterface(prop)
  * rgerhards, 2009-04-06
  */
 BEGINObjClassExit(prop, OBJ_IS_CORE_MODULE) /* class, version */
+	int i;
+	if(internTab != NULL) {
+		for(i = 0 ; i < INTERN_SETS * INTERN_WAYS ; ++i)
+			if(internTab[i].pProp != NULL)
+				propDestruct(&internTab[i].pProp);
+		free(internTab);
+		internTab = NULL;
+	}
 //	objRelease(errmsg, CORE_COMPONENT);
 ENDObjClassExit(prop)
 
@@ -48,8 +48,10 @@ BEGINinterface(prop) /* name must also be changed in ENDinterface macro! */
 	rsRetVal (*AddRef)(prop_t *pThis);
 	rsRetVal (*CreateStringProp)(prop_t **ppThis, uchar* psz, int len);
 	rsRetVal (*CreateOrReuseStringProp)(prop_t **ppThis, uchar *psz, int len);
+	/* v2 - interned string props */
+	rsRetVal (*CreateInternedStringProp)(prop_t **ppThis, uchar *psz, int len);
 ENDinterface(prop)
-#define propCURR_IF_VERSION 1 /* increment whenever you change the interface structure! */
+#define propCURR_IF_VERSION 2 /* increment whenever you change the interface structure! */
 
 
 /* get classic c-style string */
@@ -60,10 +60,9 @@
 #include "unicode-helper.h"
 #include "statsobj.h"
 #include "parserif.h"
+#include "probes.h"
 
-#ifdef OS_SOLARIS
-#	include <sched.h>
-#endif
+#include <sched.h>
 
 /* static data */
 DEFobjStaticHelpers
@@ -73,6 +72,16 @@ DEFobjCurrIf(errmsg)
 DEFobjCurrIf(datetime)
 DEFobjCurrIf(statsobj)
 
+/* thread-specific shard sequence number, see getShard() */
+static pthread_key_t keyShardThrd;
+static pthread_mutex_t mutShardThrd = PTHREAD_MUTEX_INITIALIZER;
+static intptr_t nShardThrds = 0;
+
+/* memory budget for all memory queues, see queue.h */
+int64 iQueueMemBudget = 0;
+static int64 iQueueMemBytes = 0;	/* bytes currently held by all memory queues */
+DEF_ATOMIC_HELPER_MUT64(mutQueueMemBytes);
+
 /* forward-definitions */
 static inline rsRetVal doEnqSingleObj(qqueue_t *pThis, flowControl_t flowCtlType, msg_t *pMsg);
 static rsRetVal qqueueChkPersist(qqueue_t *pThis, int nUpdates);
@@ -83,10 +92,16 @@ static rsRetVal ConsumerDA(qqueue_t *pThis, wti_t *pWti);
 static rsRetVal batchProcessed(qqueue_t *pThis, wti_t *pWti);
 static rsRetVal qqueueMultiEnqObjNonDirect(qqueue_t *pThis, multi_submit_t *pMultiSub);
 static rsRetVal qqueueMultiEnqObjDirect(qqueue_t *pThis, multi_submit_t *pMultiSub);
+static rsRetVal qqueueMultiEnqObjSharded(qqueue_t *pThis, multi_submit_t *pMultiSub);
 static rsRetVal qAddDirect(qqueue_t *pThis, msg_t *pMsg);
 static rsRetVal qDestructDirect(qqueue_t __attribute__((unused)) *pThis);
 static rsRetVal qConstructDirect(qqueue_t __attribute__((unused)) *pThis);
 static rsRetVal qDestructDisk(qqueue_t *pThis);
+static rsRetVal qDiskStartReadAhead(qqueue_t *pThis);
+static void qDiskStopReadAhead(qqueue_t *pThis);
+#ifdef HAVE_ATOMIC_BUILTINS
+static rsRetVal qqueueMultiEnqObjLockFree(qqueue_t *pThis, multi_submit_t *pMultiSub);
+#endif
 rsRetVal qqueueSetSpoolDir(qqueue_t *pThis, uchar *pszSpoolDir, int lenSpoolDir);
 
 /* some constants for queuePersist () */
@@ -99,6 +114,8 @@ static struct cnfparamdescr cnfpdescr[] = {
 	{ "queue.spooldirectory", eCmdHdlrGetWord, 0 },
 	{ "queue.size", eCmdHdlrSize, 0 },
 	{ "queue.dequeuebatchsize", eCmdHdlrInt, 0 },
+	{ "queue.mindequeuebatchsize", eCmdHdlrInt, 0 },
+	{ "queue.dequeuebatchtarget", eCmdHdlrInt, 0 },
 	{ "queue.maxdiskspace", eCmdHdlrSize, 0 },
 	{ "queue.highwatermark", eCmdHdlrInt, 0 },
 	{ "queue.lowwatermark", eCmdHdlrInt, 0 },
@@ -106,15 +123,35 @@ static struct cnfparamdescr cnfpdescr[] = {
 	{ "queue.lightdelaymark", eCmdHdlrInt, 0 },
 	{ "queue.discardmark", eCmdHdlrInt, 0 },
 	{ "queue.discardseverity", eCmdHdlrFacility, 0 },
+	{ "queue.maxbytes", eCmdHdlrSize, 0 },
+	{ "queue.highwatermarkbytes", eCmdHdlrSize, 0 },
+	{ "queue.lowwatermarkbytes", eCmdHdlrSize, 0 },
+	{ "queue.discardmarkbytes", eCmdHdlrSize, 0 },
 	{ "queue.checkpointinterval", eCmdHdlrInt, 0 },
+	{ "queue.checkpointlog", eCmdHdlrBinary, 0 },
 	{ "queue.syncqueuefiles", eCmdHdlrBinary, 0 },
+	{ "queue.groupcommit.maxdelay", eCmdHdlrInt, 0 },
+	{ "queue.groupcommit.maxbytes", eCmdHdlrSize, 0 },
+	{ "queue.mmap", eCmdHdlrBinary, 0 },
+	{ "queue.ziplevel", eCmdHdlrInt, 0 },
 	{ "queue.type", eCmdHdlrQueueType, 0 },
 	{ "queue.workerthreads", eCmdHdlrInt, 0 },
+	{ "queue.shards", eCmdHdlrPositiveInt, 0 },
+	{ "queue.partitionkey", eCmdHdlrString, 0 },
+	{ "queue.lanes", eCmdHdlrArray, 0 },
+	{ "queue.laneweights", eCmdHdlrArray, 0 },
 	{ "queue.timeoutshutdown", eCmdHdlrInt, 0 },
 	{ "queue.timeoutactioncompletion", eCmdHdlrInt, 0 },
 	{ "queue.timeoutenqueue", eCmdHdlrInt, 0 },
 	{ "queue.timeoutworkerthreadshutdown", eCmdHdlrInt, 0 },
 	{ "queue.workerthreadminimummessages", eCmdHdlrInt, 0 },
+	{ "queue.workerlatencytarget", eCmdHdlrInt, 0 },
+	{ "queue.spinwait", eCmdHdlrNonNegInt, 0 },
+	{ "queue.readahead", eCmdHdlrNonNegInt, 0 },
+	{ "queue.latencyhistogram", eCmdHdlrBinary, 0 },
+	{ "queue.hugepages", eCmdHdlrBinary, 0 },
+	{ "queue.cpuset", eCmdHdlrString, 0 },
+	{ "queue.sharedworkers", eCmdHdlrBinary, 0 },
 	{ "queue.maxfilesize", eCmdHdlrSize, 0 },
 	{ "queue.saveonshutdown", eCmdHdlrBinary, 0 },
 	{ "queue.dequeueslowdown", eCmdHdlrInt, 0 },
@@ -244,6 +281,9 @@ getQueueTypeName(queueType_t t)
 	case QUEUETYPE_DIRECT: 
 		r = "Direct";
 		break;
+	case QUEUETYPE_LOCKFREE: 
+		r = "LockFree";
+		break;
 	default:
 		r = "invalid/unknown queue mode";
 		break;
@@ -259,6 +299,8 @@ qqueueDbgPrint(qqueue_t *pThis)
 		(pThis->pszFilePrefix == NULL) ? "[NONE]" : (char*)pThis->pszFilePrefix);
 	dbgoprint((obj_t*) pThis, "queue.size: %d\n", pThis->iMaxQueueSize);
 	dbgoprint((obj_t*) pThis, "queue.dequeuebatchsize: %d\n", pThis->iDeqBatchSize);
+	dbgoprint((obj_t*) pThis, "queue.mindequeuebatchsize: %d\n", pThis->iMinDeqBatchSize);
+	dbgoprint((obj_t*) pThis, "queue.dequeuebatchtarget: %d\n", pThis->iDeqBatchTarget);
 	dbgoprint((obj_t*) pThis, "queue.maxdiskspace: %lld\n", pThis->sizeOnDiskMax);
 	dbgoprint((obj_t*) pThis, "queue.highwatermark: %d\n", pThis->iHighWtrMrk);
 	dbgoprint((obj_t*) pThis, "queue.lowwatermark: %d\n", pThis->iLowWtrMrk);
@@ -266,15 +308,36 @@ qqueueDbgPrint(qqueue_t *pThis)
 	dbgoprint((obj_t*) pThis, "queue.lightdelaymark: %d\n", pThis->iLightDlyMrk);
 	dbgoprint((obj_t*) pThis, "queue.discardmark: %d\n", pThis->iDiscardMrk);
 	dbgoprint((obj_t*) pThis, "queue.discardseverity: %d\n", pThis->iDiscardSeverity);
+	dbgoprint((obj_t*) pThis, "queue.maxbytes: %lld\n", pThis->iMaxQueueBytes);
+	dbgoprint((obj_t*) pThis, "queue.highwatermarkbytes: %lld\n", pThis->iHighWtrMrkBytes);
+	dbgoprint((obj_t*) pThis, "queue.lowwatermarkbytes: %lld\n", pThis->iLowWtrMrkBytes);
+	dbgoprint((obj_t*) pThis, "queue.discardmarkbytes: %lld\n", pThis->iDiscardMrkBytes);
 	dbgoprint((obj_t*) pThis, "queue.checkpointinterval: %d\n", pThis->iPersistUpdCnt);
+	dbgoprint((obj_t*) pThis, "queue.checkpointlog: %d\n", pThis->bCheckpointLog);
 	dbgoprint((obj_t*) pThis, "queue.syncqueuefiles: %d\n", pThis->bSyncQueueFiles);
+	dbgoprint((obj_t*) pThis, "queue.groupcommit.maxdelay: %d\n", pThis->iGrpCommitDelay);
+	dbgoprint((obj_t*) pThis, "queue.groupcommit.maxbytes: %lld\n", pThis->iGrpCommitBytes);
+	dbgoprint((obj_t*) pThis, "queue.mmap: %d\n", pThis->bMmapFiles);
+	dbgoprint((obj_t*) pThis, "queue.ziplevel: %d\n", pThis->iZipLevel);
 	dbgoprint((obj_t*) pThis, "queue.type: %d [%s]\n", pThis->qType, getQueueTypeName(pThis->qType));
 	dbgoprint((obj_t*) pThis, "queue.workerthreads: %d\n", pThis->iNumWorkerThreads);
+	dbgoprint((obj_t*) pThis, "queue.shards: %d\n", pThis->nShards);
+	dbgoprint((obj_t*) pThis, "queue.partitionkey: '%s'\n",
+		  (pThis->pszPartKey == NULL) ? "[NONE]" : (char*)pThis->pszPartKey);
+	dbgoprint((obj_t*) pThis, "queue.lanes: %d\n", pThis->nLanes);
 	dbgoprint((obj_t*) pThis, "queue.timeoutshutdown: %d\n", pThis->toQShutdown);
 	dbgoprint((obj_t*) pThis, "queue.timeoutactioncompletion: %d\n", pThis->toActShutdown);
 	dbgoprint((obj_t*) pThis, "queue.timeoutenqueue: %d\n", pThis->toEnq);
 	dbgoprint((obj_t*) pThis, "queue.timeoutworkerthreadshutdown: %d\n", pThis->toWrkShutdown);
 	dbgoprint((obj_t*) pThis, "queue.workerthreadminimummessages: %d\n", pThis->iMinMsgsPerWrkr);
+	dbgoprint((obj_t*) pThis, "queue.workerlatencytarget: %d\n", pThis->iWrkLatencyTarget);
+	dbgoprint((obj_t*) pThis, "queue.spinwait: %d\n", pThis->iSpinWait);
+	dbgoprint((obj_t*) pThis, "queue.readahead: %d\n", pThis->iReadAhead);
+	dbgoprint((obj_t*) pThis, "queue.latencyhistogram: %d\n", pThis->bLatencyHist);
+	dbgoprint((obj_t*) pThis, "queue.hugepages: %d\n", pThis->bHugePages);
+	dbgoprint((obj_t*) pThis, "queue.cpuset: '%s'\n",
+		  (pThis->pszCpuSet == NULL) ? "[NONE]" : (char*)pThis->pszCpuSet);
+	dbgoprint((obj_t*) pThis, "queue.sharedworkers: %d\n", pThis->bSharedWrkrs);
 	dbgoprint((obj_t*) pThis, "queue.maxfilesize: %lld\n", pThis->iMaxFileSize);
 	dbgoprint((obj_t*) pThis, "queue.saveonshutdown: %d\n", pThis->bSaveOnShutdown);
 	dbgoprint((obj_t*) pThis, "queue.dequeueslowdown: %d\n", pThis->iDeqSlowdown);
@@ -305,6 +368,101 @@ getLogicalQueueSize(qqueue_t *pThis)
 }
 
 
+/* the size a message is accounted with in the queue byte counters. It is
+ * fixed when the message is enqueued for the first time, so that exactly
+ * the same amount is subtracted on dequeue, even if the message was modified
+ * in between (it may be in several action queues at the same time).
+ * The size is an estimate: it covers the object and the raw message, which
+ * dominates the size for all but the smallest messages.
+ */
+static inline int
+qqueueMsgBytes(msg_t *pMsg)
+{
+	if(pMsg->iQueueBytes == 0)
+		pMsg->iQueueBytes = sizeof(msg_t) + pMsg->iLenRawMsg;
+	return pMsg->iQueueBytes;
+}
+
+
+/* does this queue hold messages in memory (and thus account for their bytes)? */
+static inline int
+qqueueIsMemQueue(qqueue_t *pThis)
+{
+	return pThis->qType != QUEUETYPE_DIRECT && pThis->qType != QUEUETYPE_DISK;
+}
+
+
+/* add (or, if negative, subtract) nBytes to the queue's and the global
+ * byte counters.
+ */
+static inline void
+qqueueAccountBytes(qqueue_t *pThis, int64 nBytes)
+{
+	ATOMIC_ADD_uint64(&pThis->iQueueBytes, &pThis->mutQueueBytes, nBytes);
+	if(pThis->pShardParent != NULL)
+		ATOMIC_ADD_uint64(&pThis->pShardParent->iQueueBytes, &pThis->pShardParent->mutQueueBytes, nBytes);
+	ATOMIC_ADD_uint64(&iQueueMemBytes, &mutQueueMemBytes, nBytes);
+}
+
+
+/* is the global memory budget exhausted? No lock is needed, being off
+ * by a few messages does not matter.
+ */
+static inline int
+qqueueOverMemBudget(void)
+{
+	return iQueueMemBudget > 0 && iQueueMemBytes >= iQueueMemBudget;
+}
+
+
+/* has the queue reached its high water mark, either by number of messages
+ * or by bytes? For DA queues, an exhausted memory budget counts as such, so
+ * that they take load off memory before anything else happens.
+ */
+static inline int
+qqueueAboveHighWtrMrk(qqueue_t *pThis, int iQueueSize)
+{
+	return iQueueSize >= pThis->iHighWtrMrk
+	    || (pThis->iHighWtrMrkBytes > 0 && pThis->iQueueBytes >= pThis->iHighWtrMrkBytes)
+	    || (pThis->pShardParent != NULL && pThis->pShardParent->iQueueSize >= pThis->iHighWtrMrk)
+	    || qqueueOverMemBudget();
+}
+
+
+/* has the queue reached its byte limit? */
+static inline int
+qqueueBytesFull(qqueue_t *pThis)
+{
+	return pThis->iMaxQueueBytes > 0 && pThis->iQueueBytes >= pThis->iMaxQueueBytes;
+}
+
+
+/* for a shard: has the sharded queue as a whole reached its size or byte
+ * limit? Each shard may use the full limits on its own, so this is what
+ * actually bounds the messages held by all shards together.
+ */
+static inline int
+qqueueShardsFull(qqueue_t *pThis)
+{
+	qqueue_t *const pParent = pThis->pShardParent;
+
+	return pParent != NULL
+	    && (   (pParent->iMaxQueueSize > 0 && pParent->iQueueSize >= pParent->iMaxQueueSize)
+	        || qqueueBytesFull(pParent));
+}
+
+
+/* account for messages added to (nMsgs > 0) or removed from a shard in the
+ * sharded queue's size.
+ */
+static inline void
+qqueueShardAccount(qqueue_t *pThis, int nMsgs)
+{
+	if(pThis->pShardParent != NULL)
+		ATOMIC_SUB(&pThis->pShardParent->iQueueSize, -nMsgs, &pThis->pShardParent->mutQueueSize);
+}
+
+
 
 /* This function drains the queue in cases where this needs to be done. The most probable
  * reason is a HUP which needs to discard data (because the queue is configured to be lossy).
@@ -330,6 +488,8 @@ static inline void queueDrain(qqueue_t *pThis)
 		}
 		pThis->qDel(pThis);
 	}
+	/* the drained messages no longer count against the memory budget */
+	qqueueAccountBytes(pThis, -pThis->iQueueBytes);
 	ENDfunc
 }
 
@@ -337,6 +497,97 @@ static inline void queueDrain(qqueue_t *pThis)
 /* --------------- code for disk-assisted (DA) queue modes -------------------- */
 
 
+/* latency-driven worker scaling. Instead of starting workers based on the
+ * queue size alone, we periodically estimate the enqueue-to-dequeue latency
+ * from the queue depth and the dequeue rate seen in the last interval
+ * (Little's law) and compute the worker utilization from the time spent
+ * in the consumer. If the latency is above the target, more workers are
+ * requested, roughly in proportion to how far we are off (but at most
+ * twice as many at once). Workers are given up only after latency and
+ * utilization have been low for several intervals in a row, so that
+ * bursty traffic does not cause thread churn. Surplus workers are simply
+ * no longer woken up and terminate on their idle timeout.
+ * The interval is the latency target itself (but at least 10ms).
+ * Must be called with the queue mutex locked.
+ */
+#define WRKSCALE_MIN_INTERVAL	10000	/* usecs */
+#define WRKSCALE_DOWN_INTERVALS	5	/* nbr of low intervals before a worker is given up */
+static void
+qqueueEvalWrkScaling(qqueue_t *pThis)
+{
+	uint64_t tNow;
+	uint64_t usInterval;
+	uint64_t usTarget;
+	uint64_t usElapsed;
+	uint64_t usLatency;
+	int iQueueSize;
+	int nCurWrkrs;
+	int iNewTarget;
+	int bLowUtil;
+
+	usTarget = (uint64_t) pThis->iWrkLatencyTarget * 1000;
+	usInterval = (usTarget < WRKSCALE_MIN_INTERVAL) ? WRKSCALE_MIN_INTERVAL : usTarget;
+	tNow = getMonotonicUsecs();
+	usElapsed = tNow - pThis->tWrkEval;
+	if(usElapsed < usInterval)
+		return;
+
+	iQueueSize = getLogicalQueueSize(pThis);
+	if(pThis->nWrkDeq == 0 && pThis->usWrkBusy == 0) {
+		/* the workers did not run at all, so there is nothing to judge */
+		goto newInterval;
+	}
+	if(pThis->nWrkDeq == 0) {
+		/* busy, but not a single message done: we lag at least this much */
+		usLatency = usElapsed;
+	} else {
+		usLatency = (uint64_t) iQueueSize * usElapsed / pThis->nWrkDeq;
+	}
+	pThis->iWrkLatencyEst = (int) (usLatency / 1000);
+
+	nCurWrkrs = ATOMIC_FETCH_32BIT(&pThis->pWtpReg->iCurNumWrkThrd, &pThis->pWtpReg->mutCurNumWrkThrd);
+	if(nCurWrkrs < 1)
+		nCurWrkrs = 1;
+	bLowUtil = pThis->usWrkBusy < usElapsed * nCurWrkrs / 2;
+
+	iNewTarget = pThis->iWrkTarget;
+	if(usLatency > usTarget) {
+		pThis->nWrkLowIntervals = 0;
+		iNewTarget = (int) ((pThis->iWrkTarget * usLatency + usTarget - 1) / usTarget);
+		if(iNewTarget > 2 * pThis->iWrkTarget)
+			iNewTarget = 2 * pThis->iWrkTarget;
+	} else if(usLatency < usTarget / 2 && bLowUtil) {
+		if(++pThis->nWrkLowIntervals >= WRKSCALE_DOWN_INTERVALS) {
+			pThis->nWrkLowIntervals = 0;
+			--iNewTarget;
+		}
+	} else {
+		pThis->nWrkLowIntervals = 0;
+	}
+
+	if(iNewTarget > pThis->iNumWorkerThreads)
+		iNewTarget = pThis->iNumWorkerThreads;
+	if(iNewTarget < 1)
+		iNewTarget = 1;
+	if(iNewTarget != pThis->iWrkTarget) {
+		DBGOPRINT((obj_t*) pThis, "worker scaling: est. latency %dms, utilization %s, "
+			  "workers %d -> %d\n", pThis->iWrkLatencyEst, bLowUtil ? "low" : "high",
+			  pThis->iWrkTarget, iNewTarget);
+		if(iNewTarget > pThis->iWrkTarget) {
+			STATSCOUNTER_INC(pThis->ctrWrkScaleUp, pThis->mutCtrWrkScaleUp);
+		} else {
+			STATSCOUNTER_INC(pThis->ctrWrkScaleDown, pThis->mutCtrWrkScaleDown);
+		}
+		pThis->iWrkTarget = iNewTarget;
+	}
+
+newInterval:
+	pThis->tWrkEval = tNow;
+	pThis->nWrkDeq = 0;
+	pThis->usWrkBusy = 0;
+}
+
+
 /* returns the number of workers that should be advised at
  * this point in time. The mutex must be locked when
  * ths function is called. -- rgerhards, 2008-01-25
@@ -350,7 +601,7 @@ qqueueAdviseMaxWorkers(qqueue_t *pThis)
 	ISOBJ_TYPE_assert(pThis, qqueue);
 
 	if(!pThis->bEnqOnly) {
-		if(pThis->bIsDA && getLogicalQueueSize(pThis) >= pThis->iHighWtrMrk) {
+		if(pThis->bIsDA && qqueueAboveHighWtrMrk(pThis, getLogicalQueueSize(pThis))) {
 			DBGOPRINT((obj_t*) pThis, "(re)activating DA worker\n");
 			wtpAdviseMaxWorkers(pThis->pWtpDA, 1); /* disk queues have always one worker */
 		}
@@ -358,6 +609,9 @@ qqueueAdviseMaxWorkers(qqueue_t *pThis)
 			iMaxWorkers = 0;
 		} else if(pThis->qType == QUEUETYPE_DISK || pThis->iMinMsgsPerWrkr == 0) {
 			iMaxWorkers = 1;
+		} else if(pThis->iWrkLatencyTarget > 0) {
+			qqueueEvalWrkScaling(pThis);
+			iMaxWorkers = pThis->iWrkTarget;
 		} else {
 			iMaxWorkers = getLogicalQueueSize(pThis) / pThis->iMinMsgsPerWrkr + 1;
 		}
@@ -422,7 +676,13 @@ StartDA(qqueue_t *pThis)
 	CHKiRet(qqueueSetFilePrefix(pThis->pqDA, pThis->pszFilePrefix, pThis->lenFilePrefix));
 	CHKiRet(qqueueSetSpoolDir(pThis->pqDA, pThis->pszSpoolDir, pThis->lenSpoolDir));
 	CHKiRet(qqueueSetiPersistUpdCnt(pThis->pqDA, pThis->iPersistUpdCnt));
+	CHKiRet(qqueueSetbCheckpointLog(pThis->pqDA, pThis->bCheckpointLog));
 	CHKiRet(qqueueSetbSyncQueueFiles(pThis->pqDA, pThis->bSyncQueueFiles));
+	CHKiRet(qqueueSetiGrpCommitDelay(pThis->pqDA, pThis->iGrpCommitDelay));
+	CHKiRet(qqueueSetiGrpCommitBytes(pThis->pqDA, pThis->iGrpCommitBytes));
+	CHKiRet(qqueueSetbMmapFiles(pThis->pqDA, pThis->bMmapFiles));
+	CHKiRet(qqueueSetiZipLevel(pThis->pqDA, pThis->iZipLevel));
+	CHKiRet(qqueueSetiReadAhead(pThis->pqDA, pThis->iReadAhead));
 	CHKiRet(qqueueSettoActShutdown(pThis->pqDA, pThis->toActShutdown));
 	CHKiRet(qqueueSettoEnq(pThis->pqDA, pThis->toEnq));
 	CHKiRet(qqueueSetiDeqtWinFromHr(pThis->pqDA, pThis->iDeqtWinFromHr));
@@ -430,6 +690,8 @@ StartDA(qqueue_t *pThis)
 	CHKiRet(qqueueSettoQShutdown(pThis->pqDA, pThis->toQShutdown));
 	CHKiRet(qqueueSetiHighWtrMrk(pThis->pqDA, 0));
 	CHKiRet(qqueueSetiDiscardMrk(pThis->pqDA, 0));
+	if(pThis->pszCpuSet != NULL)
+		CHKmalloc(pThis->pqDA->pszCpuSet = ustrdup(pThis->pszCpuSet));
 
 	iRet = qqueueStart(pThis->pqDA);
 	/* file not found is expected, that means it is no previous QIF available */
@@ -489,6 +751,7 @@ InitDA(qqueue_t *pThis, int bLockMutex)
 	CHKiRet(wtpSetiNumWorkerThreads	(pThis->pWtpDA, 1));
 	CHKiRet(wtpSettoWrkShutdown	(pThis->pWtpDA, pThis->toWrkShutdown));
 	CHKiRet(wtpSetpUsr		(pThis->pWtpDA, pThis));
+	CHKiRet(wtpSetpCpuSet		(pThis->pWtpDA, pThis->pCpuSet));
 	CHKiRet(wtpConstructFinalize	(pThis->pWtpDA));
 	/* if we reach this point, we have a "good" DA worker pool */
 
@@ -513,6 +776,48 @@ finalize_it:
  */
 
 /* -------------------- fixed array -------------------- */
+/* allocate (zeroed) storage for an in-memory queue. With queue.hugePages,
+ * large arrays are backed by huge pages if the system provides them, as
+ * enqueue and dequeue otherwise cause a lot of TLB misses for queues of
+ * millions of elements. What we actually got is shown in the stats.
+ */
+static void *
+qqueueAllocStorage(qqueue_t *pThis, size_t size, int *pMode)
+{
+	void *p;
+
+	if(!pThis->bHugePages) {
+		*pMode = SR_HUGE_NONE;
+		return calloc(1, size);
+	}
+	if((p = srHugeAlloc(size, pMode)) == NULL)
+		return NULL;
+	if(*pMode == SR_HUGE_TLB) {
+		pThis->ctrHugeTLB += size;
+	} else if(*pMode == SR_HUGE_THP) {
+		pThis->ctrHugeTHP += size;
+	} else if(*pMode == SR_HUGE_MAPPED) {
+		errmsg.LogError(0, NO_ERRCODE, "queue \"%s\": huge pages are not available, "
+				"using regular pages", obj.GetName((obj_t*) pThis));
+	}
+	DBGOPRINT((obj_t*) pThis, "allocated %llu bytes of storage, memory mode %d\n",
+		  (unsigned long long) size, *pMode);
+	return p;
+}
+
+static void
+qqueueFreeStorage(qqueue_t *pThis, void *p, size_t size, int mode)
+{
+	if(p == NULL)
+		return;
+	if(mode == SR_HUGE_TLB)
+		pThis->ctrHugeTLB -= size;
+	else if(mode == SR_HUGE_THP)
+		pThis->ctrHugeTHP -= size;
+	srHugeFree(p, size, mode);
+}
+
+
 static rsRetVal qConstructFixedArray(qqueue_t *pThis)
 {
 	DEFiRet;
@@ -522,8 +827,11 @@ static rsRetVal qConstructFixedArray(qqueue_t *pThis)
 	if(pThis->iMaxQueueSize == 0)
 		ABORT_FINALIZE(RS_RET_QSIZE_ZERO);
 
-	if((pThis->tVars.farray.pBuf = MALLOC(sizeof(void *) * pThis->iMaxQueueSize)) == NULL) {
-		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	CHKmalloc(pThis->tVars.farray.pBuf = qqueueAllocStorage(pThis, sizeof(void *) * pThis->iMaxQueueSize,
+							       &pThis->tVars.farray.memModeBuf));
+	if(pThis->bLatencyHist) {
+		CHKmalloc(pThis->tVars.farray.pEnqTime = qqueueAllocStorage(pThis,
+			  sizeof(uint64_t) * pThis->iMaxQueueSize, &pThis->tVars.farray.memModeEnqTime));
 	}
 
 	pThis->tVars.farray.deqhead = 0;
@@ -544,7 +852,10 @@ static rsRetVal qDestructFixedArray(qqueue_t *pThis)
 	ASSERT(pThis != NULL);
 
 	queueDrain(pThis); /* discard any remaining queue entries */
-	free(pThis->tVars.farray.pBuf);
+	qqueueFreeStorage(pThis, pThis->tVars.farray.pBuf, sizeof(void *) * pThis->iMaxQueueSize,
+			  pThis->tVars.farray.memModeBuf);
+	qqueueFreeStorage(pThis, pThis->tVars.farray.pEnqTime, sizeof(uint64_t) * pThis->iMaxQueueSize,
+			  pThis->tVars.farray.memModeEnqTime);
 
 	RETiRet;
 }
@@ -556,6 +867,8 @@ static rsRetVal qAddFixedArray(qqueue_t *pThis, msg_t* in)
 
 	ASSERT(pThis != NULL);
 	pThis->tVars.farray.pBuf[pThis->tVars.farray.tail] = in;
+	if(pThis->tVars.farray.pEnqTime != NULL)
+		pThis->tVars.farray.pEnqTime[pThis->tVars.farray.tail] = pThis->tEnqCurr;
 	pThis->tVars.farray.tail++;
 	if (pThis->tVars.farray.tail == pThis->iMaxQueueSize)
 		pThis->tVars.farray.tail = 0;
@@ -570,6 +883,8 @@ static rsRetVal qDeqFixedArray(qqueue_t *pThis, msg_t **out)
 
 	ASSERT(pThis != NULL);
 	*out = (void*) pThis->tVars.farray.pBuf[pThis->tVars.farray.deqhead];
+	if(pThis->tVars.farray.pEnqTime != NULL)
+		pThis->tDeqEnq = pThis->tVars.farray.pEnqTime[pThis->tVars.farray.deqhead];
 
 	pThis->tVars.farray.deqhead++;
 	if (pThis->tVars.farray.deqhead == pThis->iMaxQueueSize)
@@ -593,6 +908,191 @@ static rsRetVal qDelFixedArray(qqueue_t *pThis)
 }
 
 
+/* -------------------- lock-free ring -------------------- */
+/* This is a bounded multi-producer/multi-consumer ring, based on the well-known
+ * algorithm by Dmitry Vyukov. Each cell carries a sequence number. A producer
+ * may only write into a cell whose sequence equals the position it claimed, and
+ * a consumer may only read a cell whose sequence is one above its position.
+ * The positions themselves are claimed via CAS. As such, enqueueing does not
+ * require the queue mutex, which is the whole point of this queue type: on
+ * systems with many input threads, the mutex was the top contention point.
+ * Consumers still run under the queue mutex (the worker thread pool framework
+ * requires this), but the ring itself does not depend on that.
+ * Note that the ring is sized to the next power of two above the max queue size.
+ * The queue size limits are still enforced via iQueueSize, so the extra space
+ * is only used as a safety margin for concurrent producers.
+ */
+#ifdef HAVE_ATOMIC_BUILTINS
+static rsRetVal qConstructLockFree(qqueue_t *pThis)
+{
+	unsigned long nCells;
+	unsigned long i;
+	DEFiRet;
+
+	ASSERT(pThis != NULL);
+
+	if(pThis->iMaxQueueSize == 0)
+		ABORT_FINALIZE(RS_RET_QSIZE_ZERO);
+
+	for(nCells = 2 ; nCells < (unsigned long) pThis->iMaxQueueSize ; nCells <<= 1)
+		/*JUST SEARCH*/;
+
+	CHKmalloc(pThis->tVars.lockfree.cells = qqueueAllocStorage(pThis, sizeof(qLfCell_t) * nCells,
+								  &pThis->tVars.lockfree.memMode));
+	for(i = 0 ; i < nCells ; ++i) {
+		pThis->tVars.lockfree.cells[i].seq = i;
+		pThis->tVars.lockfree.cells[i].pMsg = NULL;
+		pThis->tVars.lockfree.cells[i].tEnq = 0;
+	}
+	pThis->tVars.lockfree.mask = nCells - 1;
+	pThis->tVars.lockfree.enqPos = 0;
+	pThis->tVars.lockfree.deqPos = 0;
+	pThis->tVars.lockfree.nReady = 0;
+
+	qqueueChkIsDA(pThis);
+
+finalize_it:
+	RETiRet;
+}
+
+
+static rsRetVal qDestructLockFree(qqueue_t *pThis)
+{
+	DEFiRet;
+	
+	ASSERT(pThis != NULL);
+
+	queueDrain(pThis); /* discard any remaining queue entries */
+	qqueueFreeStorage(pThis, pThis->tVars.lockfree.cells,
+			  sizeof(qLfCell_t) * (pThis->tVars.lockfree.mask + 1), pThis->tVars.lockfree.memMode);
+
+	RETiRet;
+}
+
+
+/* try to put a message into the ring. Returns RS_RET_QUEUE_FULL if no cell
+ * is free. This function does NOT require the queue mutex. *pPrevReady
+ * receives the number of ready cells before this one was published, which
+ * the caller needs to decide if workers must be awoken. tEnq is stored for
+ * the latency histogram.
+ */
+static inline rsRetVal
+qLfPush(qqueue_t *pThis, msg_t *pMsg, uint64_t tEnq, int *pPrevReady)
+{
+	qLfCell_t *cell;
+	unsigned long pos;
+	unsigned long seq;
+	long diff;
+	DEFiRet;
+
+	pos = pThis->tVars.lockfree.enqPos;
+	while(1) {
+		cell = &pThis->tVars.lockfree.cells[pos & pThis->tVars.lockfree.mask];
+		seq = __sync_fetch_and_add(&cell->seq, 0);
+		diff = (long) seq - (long) pos;
+		if(diff == 0) {
+			if(__sync_bool_compare_and_swap(&pThis->tVars.lockfree.enqPos, pos, pos + 1))
+				break;
+			pos = pThis->tVars.lockfree.enqPos;
+		} else if(diff < 0) {
+			ABORT_FINALIZE(RS_RET_QUEUE_FULL);
+		} else {
+			pos = pThis->tVars.lockfree.enqPos;
+		}
+	}
+
+	cell->pMsg = pMsg;
+	cell->tEnq = tEnq;
+	__sync_synchronize(); /* msg must be visible before the cell is published */
+	cell->seq = pos + 1;
+	*pPrevReady = ATOMIC_INC_AND_FETCH_int(&pThis->tVars.lockfree.nReady, NULL);
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* This is called with the queue mutex locked (via qqueueAdd()), so we can
+ * wait for room with the usual notFull condition if the ring is (very
+ * rarely) full because lock-free producers raced for the last cells.
+ */
+static rsRetVal qAddLockFree(qqueue_t *pThis, msg_t* pMsg)
+{
+	struct timespec t;
+	int prevReady;
+	DEFiRet;
+
+	ASSERT(pThis != NULL);
+	while(qLfPush(pThis, pMsg, pThis->tEnqCurr, &prevReady) == RS_RET_QUEUE_FULL) {
+		timeoutComp(&t, pThis->toEnq);
+		if(pThis->toEnq == 0 || pThis->bEnqOnly
+		   || pthread_cond_timedwait(&pThis->notFull, pThis->mut, &t) != 0) {
+			DBGOPRINT((obj_t*) pThis, "qAddLockFree: ring full, dropping message!\n");
+			STATSCOUNTER_INC(pThis->ctrFDscrd, pThis->mutCtrFDscrd);
+			msgDestruct(&pMsg);
+			ABORT_FINALIZE(RS_RET_QUEUE_FULL);
+		}
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* Dequeue the next element. We are only called when the logical queue size
+ * is above zero. As the size is incremented only after a cell has been
+ * published, this means the cell at our position has at least been claimed
+ * by a producer. That producer may still be in the (very short) process of
+ * publishing it, in which case we yield and retry. Note that producers can
+ * not be cancelled or block between claiming and publishing a cell.
+ */
+static rsRetVal qDeqLockFree(qqueue_t *pThis, msg_t **out)
+{
+	qLfCell_t *cell;
+	unsigned long pos;
+	unsigned long seq;
+	long diff;
+	DEFiRet;
+
+	ASSERT(pThis != NULL);
+	pos = pThis->tVars.lockfree.deqPos;
+	while(1) {
+		cell = &pThis->tVars.lockfree.cells[pos & pThis->tVars.lockfree.mask];
+		seq = __sync_fetch_and_add(&cell->seq, 0);
+		diff = (long) seq - (long) (pos + 1);
+		if(diff == 0) {
+			if(__sync_bool_compare_and_swap(&pThis->tVars.lockfree.deqPos, pos, pos + 1))
+				break;
+			pos = pThis->tVars.lockfree.deqPos;
+		} else if(diff < 0) {
+			sched_yield(); /* producer has not yet published */
+			pos = pThis->tVars.lockfree.deqPos;
+		} else {
+			pos = pThis->tVars.lockfree.deqPos;
+		}
+	}
+
+	*out = cell->pMsg;
+	pThis->tDeqEnq = cell->tEnq;
+	cell->pMsg = NULL;
+	__sync_synchronize();
+	cell->seq = pos + pThis->tVars.lockfree.mask + 1; /* cell free for next round */
+	ATOMIC_DEC(&pThis->tVars.lockfree.nReady, NULL);
+
+	RETiRet;
+}
+
+
+/* the cell is already released when it is dequeued, as the message pointer is
+ * now held in the batch. So there is nothing left to do on delete.
+ */
+static rsRetVal qDelLockFree(qqueue_t __attribute__((unused)) *pThis)
+{
+	return RS_RET_OK;
+}
+#endif /* #ifdef HAVE_ATOMIC_BUILTINS */
+
+
 /* -------------------- linked list  -------------------- */
 
 
@@ -634,6 +1134,7 @@ static rsRetVal qAddLinkedList(qqueue_t *pThis, msg_t* pMsg)
 
 	pEntry->pNext = NULL;
 	pEntry->pMsg = pMsg;
+	pEntry->tEnq = pThis->tEnqCurr;
 
 	if(pThis->tVars.linklist.pDelRoot == NULL) {
 		pThis->tVars.linklist.pDelRoot = pThis->tVars.linklist.pDeqRoot = pThis->tVars.linklist.pLast = pEntry;
@@ -658,6 +1159,7 @@ static rsRetVal qDeqLinkedList(qqueue_t *pThis, msg_t **ppMsg)
 
 	pEntry = pThis->tVars.linklist.pDeqRoot;
 	*ppMsg = pEntry->pMsg;
+	pThis->tDeqEnq = pEntry->tEnq;
 	pThis->tVars.linklist.pDeqRoot = pEntry->pNext;
 
 	RETiRet;
@@ -683,6 +1185,143 @@ static rsRetVal qDelLinkedList(qqueue_t *pThis)
 }
 
 
+/* -------------------- priority lanes  -------------------- */
+
+
+/* A queue with priority lanes keeps one linked list per lane. Messages are
+ * routed to a lane by their severity. The dequeuer serves the lanes in weighted
+ * round-robin fashion: up to laneWeight[i] messages are taken from lane i, then
+ * it moves on to the next non-empty lane. So a lane of critical messages is
+ * served again after at most the sum of the other lanes' weights, no matter how
+ * many messages are queued in them. As deletion must happen in dequeue order,
+ * dequeued entries are moved to a separate list, from which qDelLanes() removes
+ * them.
+ * All functions are called with the queue mutex locked.
+ */
+static rsRetVal qConstructLanes(qqueue_t *pThis)
+{
+	DEFiRet;
+
+	ASSERT(pThis != NULL);
+
+	memset(&pThis->tVars.lanes, 0, sizeof(pThis->tVars.lanes));
+
+	qqueueChkIsDA(pThis);
+
+	RETiRet;
+}
+
+
+static rsRetVal qDestructLanes(qqueue_t *pThis)
+{
+	DEFiRet;
+
+	queueDrain(pThis); /* discard any remaining queue entries */
+
+	RETiRet;
+}
+
+
+static rsRetVal qAddLanes(qqueue_t *pThis, msg_t* pMsg)
+{
+	qLinkedList_t *pEntry;
+	int iLane;
+	DEFiRet;
+
+	CHKmalloc((pEntry = (qLinkedList_t*) MALLOC(sizeof(qLinkedList_t))));
+
+	pEntry->pNext = NULL;
+	pEntry->pMsg = pMsg;
+	pEntry->tEnq = pThis->tEnqCurr;
+
+	/* messages without a valid severity go to the lowest priority lane */
+	if(pMsg->iSeverity >= 0 && pMsg->iSeverity < 8)
+		iLane = pThis->laneOfSev[pMsg->iSeverity];
+	else
+		iLane = pThis->nLanes - 1;
+
+	if(pThis->tVars.lanes.pLast[iLane] == NULL) {
+		pThis->tVars.lanes.pDeqRoot[iLane] = pEntry;
+	} else {
+		pThis->tVars.lanes.pLast[iLane]->pNext = pEntry;
+	}
+	pThis->tVars.lanes.pLast[iLane] = pEntry;
+
+finalize_it:
+	RETiRet;
+}
+
+
+static rsRetVal qDeqLanes(qqueue_t *pThis, msg_t **ppMsg)
+{
+	qLinkedList_t *pEntry;
+	int iLane;
+	int i;
+	DEFiRet;
+
+	iLane = pThis->tVars.lanes.iCurrLane;
+	if(pThis->tVars.lanes.pDeqRoot[iLane] == NULL
+	   || pThis->tVars.lanes.nCurrLane >= pThis->laneWeight[iLane]) {
+		/* turn is over, move on to the next non-empty lane (which may
+		 * be the current one again if all others are empty)
+		 */
+		for(i = 0 ; i < pThis->nLanes ; ++i) {
+			iLane = (iLane + 1) % pThis->nLanes;
+			if(pThis->tVars.lanes.pDeqRoot[iLane] != NULL)
+				break;
+		}
+		pThis->tVars.lanes.iCurrLane = iLane;
+		pThis->tVars.lanes.nCurrLane = 0;
+	}
+
+	pEntry = pThis->tVars.lanes.pDeqRoot[iLane];
+	if(pEntry == NULL) {
+		/* can only happen during queueDrain(), when dequeued messages are still present */
+		*ppMsg = NULL;
+		FINALIZE;
+	}
+
+	pThis->tVars.lanes.pDeqRoot[iLane] = pEntry->pNext;
+	if(pEntry->pNext == NULL)
+		pThis->tVars.lanes.pLast[iLane] = NULL;
+	++pThis->tVars.lanes.nCurrLane;
+
+	pEntry->pNext = NULL;
+	if(pThis->tVars.lanes.pDelLast == NULL) {
+		pThis->tVars.lanes.pDelRoot = pEntry;
+	} else {
+		pThis->tVars.lanes.pDelLast->pNext = pEntry;
+	}
+	pThis->tVars.lanes.pDelLast = pEntry;
+
+	*ppMsg = pEntry->pMsg;
+	pThis->tDeqEnq = pEntry->tEnq;
+
+finalize_it:
+	RETiRet;
+}
+
+
+static rsRetVal qDelLanes(qqueue_t *pThis)
+{
+	qLinkedList_t *pEntry;
+	DEFiRet;
+
+	pEntry = pThis->tVars.lanes.pDelRoot;
+	if(pEntry == NULL)
+		FINALIZE; /* see qDeqLanes() */
+
+	pThis->tVars.lanes.pDelRoot = pEntry->pNext;
+	if(pEntry->pNext == NULL)
+		pThis->tVars.lanes.pDelLast = NULL;
+
+	free(pEntry);
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* -------------------- disk  -------------------- */
 
 
@@ -743,6 +1382,177 @@ finalize_it:
 }
 
 
+/* Checkpoint log for disk queues, enabled by queue.checkpointLog.
+ * Rewriting the .qi file for each checkpoint is expensive, so with the log
+ * a checkpoint just appends a fixed-size record with the queue size and the
+ * write and delete positions to the .qi.log file. When loading, the last
+ * valid record of the log is applied on top of the .qi file, which holds
+ * everything else. The log is compacted by a full write of the .qi file,
+ * which happens after QUEUE_CKPLOG_MAX_RECS checkpoints and whenever the
+ * .qi file is written for other reasons (e.g. on shutdown). The log is
+ * always discarded *before* the .qi file is written, so that it can never be
+ * applied to a newer .qi file. A torn record at the end of the log does not
+ * pass the check and is ignored.
+ */
+#define QUEUE_CKPLOG_MAX_RECS 4096
+#define QUEUE_CKPLOG_MAGIC 0x716b7031	/* "qkp1" */
+typedef struct qCkpRec_s {
+	uint32_t magic;
+	int32_t iQueueSize;
+	int64 sizeOnDisk;
+	int32_t wrFNum;
+	int32_t delFNum;
+	int64 wrOffs;
+	int64 wrHintPhys;
+	int64 wrHintLog;
+	int64 delOffs;
+	int64 delHintPhys;
+	int64 delHintLog;
+	uint32_t pad;
+	uint32_t csum;		/* must be last */
+} qCkpRec_t;
+
+/* FNV-1a over the record, excluding the checksum itself */
+static uint32_t
+qqueueCkpRecSum(qCkpRec_t *pRec)
+{
+	uchar *p = (uchar*) pRec;
+	uint32_t h = 2166136261u;
+	size_t i;
+
+	for(i = 0 ; i < offsetof(qCkpRec_t, csum) ; ++i) {
+		h ^= p[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/* remove the checkpoint log, must be done before the .qi file is written */
+static rsRetVal
+qqueueCkpLogDiscard(qqueue_t *pThis)
+{
+	char errStr[1024];
+	DEFiRet;
+
+	if(pThis->fdCkpLog != -1) {
+		close(pThis->fdCkpLog);
+		pThis->fdCkpLog = -1;
+	}
+	pThis->nCkpLogRecs = 0;
+	pThis->bCkpLogUnsynced = 0;
+	if(pThis->pszCkpLogNam != NULL && unlink((char*) pThis->pszCkpLogNam) == -1 && errno != ENOENT) {
+		rs_strerror_r(errno, errStr, sizeof(errStr));
+		errmsg.LogError(0, RS_RET_IO_ERROR, "queue \"%s\": can not remove checkpoint log "
+				"'%s': %s", obj.GetName((obj_t*) pThis), pThis->pszCkpLogNam, errStr);
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+/* append the current positions to the checkpoint log. On error, the caller
+ * writes the full .qi file instead.
+ */
+static rsRetVal
+qqueueCkpLogAppend(qqueue_t *pThis)
+{
+	qCkpRec_t rec;
+	ssize_t lenWritten;
+	DEFiRet;
+
+	if(pThis->tVars.disk.pWrite == NULL || pThis->tVars.disk.pReadDel == NULL)
+		ABORT_FINALIZE(RS_RET_ERR);
+	if(pThis->fdCkpLog == -1) {
+		pThis->fdCkpLog = open((char*) pThis->pszCkpLogNam,
+				       O_WRONLY|O_CREAT|O_APPEND|O_NOCTTY|O_CLOEXEC, S_IRUSR|S_IWUSR);
+		if(pThis->fdCkpLog == -1)
+			ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+
+	memset(&rec, 0, sizeof(rec));
+	rec.magic = QUEUE_CKPLOG_MAGIC;
+	rec.iQueueSize = pThis->iQueueSize;
+	rec.sizeOnDisk = pThis->tVars.disk.sizeOnDisk;
+	rec.wrFNum = strmGetCurrFileNum(pThis->tVars.disk.pWrite);
+	strm.GetCurrOffset(pThis->tVars.disk.pWrite, &rec.wrOffs);
+	strm.GetSeekHint(pThis->tVars.disk.pWrite, &rec.wrHintPhys, &rec.wrHintLog);
+	rec.delFNum = strmGetCurrFileNum(pThis->tVars.disk.pReadDel);
+	strm.GetCurrOffset(pThis->tVars.disk.pReadDel, &rec.delOffs);
+	strm.GetSeekHint(pThis->tVars.disk.pReadDel, &rec.delHintPhys, &rec.delHintLog);
+	rec.csum = qqueueCkpRecSum(&rec);
+
+	do {
+		lenWritten = write(pThis->fdCkpLog, &rec, sizeof(rec));
+	} while(lenWritten == -1 && errno == EINTR);
+	if(lenWritten != (ssize_t) sizeof(rec)) {
+		/* a partial record is ignored when loading, but nothing must follow it */
+		DBGOPRINT((obj_t*) pThis, "error writing checkpoint log, errno %d\n", errno);
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+	++pThis->nCkpLogRecs;
+
+	if(pThis->bSyncQueueFiles) {
+		if(pThis->bGrpCommit) {
+			pThis->bCkpLogUnsynced = 1; /* synced with the next group commit */
+		} else if(fdatasync(pThis->fdCkpLog) == -1) {
+			ABORT_FINALIZE(RS_RET_IO_ERROR);
+		}
+	}
+
+finalize_it:
+	if(iRet != RS_RET_OK) {
+		/* make sure the next checkpoint does not append to a broken log */
+		pThis->nCkpLogRecs = QUEUE_CKPLOG_MAX_RECS;
+	}
+	RETiRet;
+}
+
+/* apply the last valid record of the checkpoint log (if any) to the
+ * queue state just loaded from the .qi file.
+ */
+static rsRetVal
+qqueueCkpLogLoad(qqueue_t *pThis)
+{
+	qCkpRec_t rec;
+	qCkpRec_t last;
+	int bHaveRec = 0;
+	int fd;
+	ssize_t lenRead;
+	DEFiRet;
+
+	if((fd = open((char*) pThis->pszCkpLogNam, O_RDONLY|O_NOCTTY|O_CLOEXEC)) == -1)
+		FINALIZE; /* no log, the .qi file is current */
+
+	while((lenRead = read(fd, &rec, sizeof(rec))) == (ssize_t) sizeof(rec)) {
+		if(rec.magic != QUEUE_CKPLOG_MAGIC || rec.csum != qqueueCkpRecSum(&rec))
+			break;
+		last = rec;
+		bHaveRec = 1;
+	}
+	close(fd);
+
+	if(bHaveRec) {
+		DBGOPRINT((obj_t*) pThis, "applying checkpoint log: size %d, write %d/%lld, "
+			  "delete %d/%lld\n", last.iQueueSize, last.wrFNum, (long long) last.wrOffs,
+			  last.delFNum, (long long) last.delOffs);
+		pThis->iQueueSize = last.iQueueSize;
+		pThis->tVars.disk.sizeOnDisk = last.sizeOnDisk;
+		strmSetCurrPos(pThis->tVars.disk.pWrite, last.wrFNum, last.wrOffs);
+		CHKiRet(strm.SetSeekHint(pThis->tVars.disk.pWrite, last.wrHintPhys, last.wrHintLog));
+		strmSetCurrPos(pThis->tVars.disk.pReadDel, last.delFNum, last.delOffs);
+		CHKiRet(strm.SetSeekHint(pThis->tVars.disk.pReadDel, last.delHintPhys, last.delHintLog));
+	}
+	/* the log may end with a torn record, so we do not append to it, the
+	 * next checkpoint writes the .qi file and starts a new log
+	 */
+	pThis->nCkpLogRecs = QUEUE_CKPLOG_MAX_RECS;
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* The method loads the persistent queue information.
  * rgerhards, 2008-01-11
  */
@@ -782,6 +1592,8 @@ qqueueTryLoadPersistedInfo(qqueue_t *pThis)
 			       (rsRetVal(*)(obj_t*,void*))qqueueLoadPersStrmInfoFixup, pThis));
 	CHKiRet(obj.Deserialize(&pThis->tVars.disk.pReadDel, (uchar*) "strm", psQIF,
 			       (rsRetVal(*)(obj_t*,void*))qqueueLoadPersStrmInfoFixup, pThis));
+	/* checkpoints written after the .qi file, if any */
+	CHKiRet(qqueueCkpLogLoad(pThis));
 	/* create a duplicate for the read "pointer". */
 	CHKiRet(strm.Dup(pThis->tVars.disk.pReadDel, &pThis->tVars.disk.pReadDeq));
 	CHKiRet(strm.SetbDeleteOnClose(pThis->tVars.disk.pReadDeq, 0)); /* deq must NOT delete the files! */
@@ -795,9 +1607,15 @@ qqueueTryLoadPersistedInfo(qqueue_t *pThis)
 		CHKiRet(strm.Setcryprov(pThis->tVars.disk.pReadDel, &pThis->cryprov));
 		CHKiRet(strm.SetcryprovData(pThis->tVars.disk.pReadDel, pThis->cryprovData));
 	}
+	/* mmap mode is not persisted, it always reflects the current config */
+	CHKiRet(strm.SetbMmap(pThis->tVars.disk.pWrite, pThis->bMmapFiles));
+	CHKiRet(strm.SetbMmap(pThis->tVars.disk.pReadDeq, pThis->bMmapFiles));
 
+	/* pReadDel never reads, it just needs the offset (and deletes files by name),
+	 * so there is no need to position it. This matters for zipped and encrypted
+	 * files, where positioning a reader means reading the file up to the offset.
+	 */
 	CHKiRet(strm.SeekCurrOffs(pThis->tVars.disk.pWrite));
-	CHKiRet(strm.SeekCurrOffs(pThis->tVars.disk.pReadDel));
 	CHKiRet(strm.SeekCurrOffs(pThis->tVars.disk.pReadDeq));
 
 	/* OK, we could successfully read the file, so we now can request that it be
@@ -839,11 +1657,31 @@ static rsRetVal qConstructDisk(qqueue_t *pThis)
 	else if(iRet != RS_RET_FILE_NOT_FOUND)
 			FINALIZE;
 
+	/* group commit is only meaningful if we sync at all. If it is active, the
+	 * write stream does not sync itself, this is done by qqueueGroupCommit().
+	 */
+	pThis->bGrpCommit = pThis->bSyncQueueFiles
+			    && (pThis->iGrpCommitDelay > 0 || pThis->iGrpCommitBytes > 0);
+
+	if(pThis->iZipLevel < 0 || pThis->iZipLevel > 9) {
+		errmsg.LogError(0, RS_RET_CONF_PARSE_WARNING, "queue \"%s\": queue.ziplevel "
+				"must be in the range 0..9, but is %d - compression disabled",
+				obj.GetName((obj_t*) pThis), pThis->iZipLevel);
+		pThis->iZipLevel = 0;
+	}
+	if(pThis->iZipLevel != 0 && pThis->useCryprov) {
+		errmsg.LogError(0, RS_RET_CONF_PARSE_WARNING, "queue \"%s\": queue.ziplevel "
+				"can not be used together with queue.cry.provider - compression "
+				"disabled", obj.GetName((obj_t*) pThis));
+		pThis->iZipLevel = 0;
+	}
+
 	if(bRestarted == 1) {
 		;
 	} else {
 		CHKiRet(strm.Construct(&pThis->tVars.disk.pWrite));
-		CHKiRet(strm.SetbSync(pThis->tVars.disk.pWrite, pThis->bSyncQueueFiles));
+		CHKiRet(strm.SetbSync(pThis->tVars.disk.pWrite, pThis->bSyncQueueFiles && !pThis->bGrpCommit));
+		CHKiRet(strm.SetbDeferSync(pThis->tVars.disk.pWrite, pThis->bGrpCommit));
 		CHKiRet(strm.SetDir(pThis->tVars.disk.pWrite, pThis->pszSpoolDir, pThis->lenSpoolDir));
 		CHKiRet(strm.SetiMaxFiles(pThis->tVars.disk.pWrite, 10000000));
 		CHKiRet(strm.SettOperationsMode(pThis->tVars.disk.pWrite, STREAMMODE_WRITE));
@@ -852,6 +1690,11 @@ static rsRetVal qConstructDisk(qqueue_t *pThis)
 			CHKiRet(strm.Setcryprov(pThis->tVars.disk.pWrite, &pThis->cryprov));
 			CHKiRet(strm.SetcryprovData(pThis->tVars.disk.pWrite, pThis->cryprovData));
 		}
+		/* the compression level is persisted with the streams, as it also tells
+		 * how existing files must be read. So it only changes for a new queue.
+		 */
+		CHKiRet(strm.SetiZipLevel(pThis->tVars.disk.pWrite, pThis->iZipLevel));
+		CHKiRet(strm.SetbMmap(pThis->tVars.disk.pWrite, pThis->bMmapFiles));
 		CHKiRet(strm.ConstructFinalize(pThis->tVars.disk.pWrite));
 
 		CHKiRet(strm.Construct(&pThis->tVars.disk.pReadDeq));
@@ -864,6 +1707,8 @@ static rsRetVal qConstructDisk(qqueue_t *pThis)
 			CHKiRet(strm.Setcryprov(pThis->tVars.disk.pReadDeq, &pThis->cryprov));
 			CHKiRet(strm.SetcryprovData(pThis->tVars.disk.pReadDeq, pThis->cryprovData));
 		}
+		CHKiRet(strm.SetiZipLevel(pThis->tVars.disk.pReadDeq, pThis->iZipLevel));
+		CHKiRet(strm.SetbMmap(pThis->tVars.disk.pReadDeq, pThis->bMmapFiles));
 		CHKiRet(strm.ConstructFinalize(pThis->tVars.disk.pReadDeq));
 
 		CHKiRet(strm.Construct(&pThis->tVars.disk.pReadDel));
@@ -877,6 +1722,7 @@ static rsRetVal qConstructDisk(qqueue_t *pThis)
 			CHKiRet(strm.Setcryprov(pThis->tVars.disk.pReadDel, &pThis->cryprov));
 			CHKiRet(strm.SetcryprovData(pThis->tVars.disk.pReadDel, pThis->cryprovData));
 		}
+		CHKiRet(strm.SetiZipLevel(pThis->tVars.disk.pReadDel, pThis->iZipLevel));
 		CHKiRet(strm.ConstructFinalize(pThis->tVars.disk.pReadDel));
 
 		CHKiRet(strm.SetFName(pThis->tVars.disk.pWrite,   pThis->pszFilePrefix, pThis->lenFilePrefix));
@@ -892,6 +1738,11 @@ static rsRetVal qConstructDisk(qqueue_t *pThis)
 	CHKiRet(strm.SetiMaxFileSize(pThis->tVars.disk.pWrite, pThis->iMaxFileSize));
 	CHKiRet(strm.SetiMaxFileSize(pThis->tVars.disk.pReadDeq, pThis->iMaxFileSize));
 	CHKiRet(strm.SetiMaxFileSize(pThis->tVars.disk.pReadDel, pThis->iMaxFileSize));
+	CHKiRet(strm.SetbSync(pThis->tVars.disk.pWrite, pThis->bSyncQueueFiles && !pThis->bGrpCommit));
+	CHKiRet(strm.SetbDeferSync(pThis->tVars.disk.pWrite, pThis->bGrpCommit));
+
+	if(pThis->iReadAhead > 0)
+		CHKiRet(qDiskStartReadAhead(pThis));
 
 finalize_it:
 	RETiRet;
@@ -904,7 +1755,11 @@ static rsRetVal qDestructDisk(qqueue_t *pThis)
 	
 	ASSERT(pThis != NULL);
 
+	qDiskStopReadAhead(pThis);
 	free(pThis->pszQIFNam);
+	if(pThis->fdCkpLog != -1)
+		close(pThis->fdCkpLog);
+	free(pThis->pszCkpLogNam);
 	if(pThis->tVars.disk.pWrite != NULL)
 		strm.Destruct(&pThis->tVars.disk.pWrite);
 	if(pThis->tVars.disk.pReadDeq != NULL)
@@ -923,11 +1778,18 @@ static rsRetVal qAddDisk(qqueue_t *pThis, msg_t* pMsg)
 	ASSERT(pThis != NULL);
 
 	CHKiRet(strm.SetWCntr(pThis->tVars.disk.pWrite, &nWriteCount));
-	CHKiRet((objSerialize(pMsg))(pMsg, pThis->tVars.disk.pWrite));
+	CHKiRet(MsgSerializeBinary(pMsg, pThis->tVars.disk.pWrite));
 	CHKiRet(strm.Flush(pThis->tVars.disk.pWrite));
 	CHKiRet(strm.SetWCntr(pThis->tVars.disk.pWrite, NULL)); /* no more counting for now... */
 
 	pThis->tVars.disk.sizeOnDisk += nWriteCount;
+	if(pThis->bGrpCommit) {
+		pThis->tVars.disk.bytesUnsynced += nWriteCount;
+		++pThis->tVars.disk.writeGen;
+		/* tell a waiting group leader if the group is complete */
+		if(pThis->iGrpCommitBytes > 0 && pThis->tVars.disk.bytesUnsynced >= pThis->iGrpCommitBytes)
+			pthread_cond_broadcast(&pThis->condGrpCommit);
+	}
 
 	/* we have enqueued the user element to disk. So we now need to destruct
 	 * the in-memory representation. The instance will be re-created upon
@@ -943,11 +1805,389 @@ finalize_it:
 }
 
 
+/* group commit: a producer announces that it is about to add data to the
+ * queue. Called before the queue mutex is acquired, so that a group leader
+ * knows that it is worth waiting.
+ */
+static inline void
+qqueueGrpCommitAnnounce(qqueue_t *pThis)
+{
+	if(pThis->bGrpCommit && pThis->pqParent == NULL)
+		ATOMIC_INC(&pThis->nGrpCommitPending, &pThis->mutGrpCommitPending);
+}
+
+/* group commit: a producer announced via qqueueGrpCommitAnnounce() has
+ * added its data. If it was the last one, a waiting group leader can sync
+ * right away. Must be called with the queue mutex locked.
+ */
+static inline void
+qqueueGrpCommitAdded(qqueue_t *pThis)
+{
+	if(!pThis->bGrpCommit || pThis->pqParent != NULL)
+		return;
+	if(   ATOMIC_DEC_AND_FETCH(&pThis->nGrpCommitPending, &pThis->mutGrpCommitPending) == 0
+	   && pThis->tVars.disk.bSyncActive)
+		pthread_cond_broadcast(&pThis->condGrpCommit);
+}
+
+
+/* sync the queue file and the checkpoint log for the group commit. The
+ * sync is done on duplicates of the file descriptors, without the queue
+ * mutex, so that other producers can add data to the next group and
+ * dequeuers keep running meanwhile. If the file is rotated during that
+ * time, the stream syncs the old file before it closes it. Memory-mapped
+ * queue files are synced with the mutex held, as their mapping is owned by
+ * the stream. Must be called with the queue mutex locked.
+ */
+static rsRetVal
+qqueueGroupCommitSync(qqueue_t *pThis)
+{
+	int fd;
+	int fdDir;
+	int fdCkpLog = -1;
+	DEFiRet;
+
+	CHKiRet(strm.Flush(pThis->tVars.disk.pWrite));
+	if(!strmDupFdForSync(pThis->tVars.disk.pWrite, &fd, &fdDir)) {
+		CHKiRet(strm.Sync(pThis->tVars.disk.pWrite));
+		if(pThis->bCkpLogUnsynced && fdatasync(pThis->fdCkpLog) == 0)
+			pThis->bCkpLogUnsynced = 0;
+		FINALIZE;
+	}
+	if(pThis->bCkpLogUnsynced && (fdCkpLog = dup(pThis->fdCkpLog)) != -1)
+		pThis->bCkpLogUnsynced = 0;
+
+	d_pthread_mutex_unlock(pThis->mut);
+	if(fd != -1) {
+		if(fdatasync(fd) != 0)
+			DBGOPRINT((obj_t*) pThis, "group commit: sync failed with error %d - ignoring\n", errno);
+		close(fd);
+	}
+	if(fdDir != -1) {
+		fsync(fdDir);
+		close(fdDir);
+	}
+	if(fdCkpLog != -1) {
+		fdatasync(fdCkpLog);
+		close(fdCkpLog);
+	}
+	d_pthread_mutex_lock(pThis->mut);
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* group commit: wait until everything the caller has written to the queue
+ * file is synced to disk. The first caller that needs a sync becomes the
+ * group leader. As long as other producers announced that they are about to
+ * add data, it waits for them, but no longer than queue.groupcommit.maxdelay
+ * ms and only until queue.groupcommit.maxbytes are unsynced. Then it does a
+ * single sync for the whole group. All others just wait until a sync
+ * covering their data is done. If bMayWait is 0, the leader syncs without
+ * waiting for more data. For the disk part of DA queues, the DA worker syncs
+ * each batch directly, see qqueueSpillBatch().
+ * Must be called with the queue mutex locked.
+ */
+static rsRetVal
+qqueueGroupCommit(qqueue_t *pThis, int bMayWait)
+{
+	struct timespec t;
+	unsigned myGen;
+	unsigned syncGen;
+	DEFiRet;
+
+	myGen = pThis->tVars.disk.writeGen;
+	while((int) (pThis->tVars.disk.syncGen - myGen) < 0) {
+		if(pThis->tVars.disk.bSyncActive) {
+			/* some other thread leads the group, it will sync for us as well */
+			pthread_cond_wait(&pThis->condGrpCommit, pThis->mut);
+			continue;
+		}
+		pThis->tVars.disk.bSyncActive = 1;
+		if(bMayWait && pThis->iGrpCommitDelay > 0) {
+			timeoutComp(&t, pThis->iGrpCommitDelay);
+			while(   ATOMIC_FETCH_32BIT(&pThis->nGrpCommitPending, &pThis->mutGrpCommitPending) > 0
+			      && (   pThis->iGrpCommitBytes == 0
+				  || pThis->tVars.disk.bytesUnsynced < pThis->iGrpCommitBytes)) {
+				if(pthread_cond_timedwait(&pThis->condGrpCommit, pThis->mut, &t) == ETIMEDOUT)
+					break;
+			}
+		}
+		syncGen = pThis->tVars.disk.writeGen;
+		DBGOPRINT((obj_t*) pThis, "group commit: syncing %lld bytes\n",
+			  pThis->tVars.disk.bytesUnsynced);
+		/* data added while we sync is not covered and counts for the next group */
+		pThis->tVars.disk.bytesUnsynced = 0;
+		iRet = qqueueGroupCommitSync(pThis);
+		pThis->tVars.disk.bSyncActive = 0;
+		if(iRet == RS_RET_OK)
+			pThis->tVars.disk.syncGen = syncGen;
+		pthread_cond_broadcast(&pThis->condGrpCommit);
+		if(iRet != RS_RET_OK)
+			FINALIZE;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* we write binary records, but queue files from previous versions contain
+ * records in the property-based format. Both can be told apart by their
+ * first octet, so we support both formats, even mixed inside the same file.
+ * If the record start is damaged, we skip to the next line that looks like
+ * a record begin of either format.
+ */
+static rsRetVal qDiskReadMsg(qqueue_t *pThis, msg_t **ppMsg)
+{
+	strm_t *pStrm = pThis->tVars.disk.pReadDeq;
+	uchar c;
+	uchar cPrev;
+	DEFiRet;
+
+	CHKiRet(strm.ReadChar(pStrm, &c));
+	if(c != MSG_BINREC_MAGIC && c != '<') {
+		DBGOPRINT((obj_t*) pThis, "invalid record begin 0x%2.2x in queue file - "
+			  "trying to recover\n", c);
+		do {
+			cPrev = c;
+			CHKiRet(strm.ReadChar(pStrm, &c));
+		} while(cPrev != '\n' || (c != MSG_BINREC_MAGIC && c != '<'));
+	}
+
+	if(c == MSG_BINREC_MAGIC) {
+		iRet = MsgDeserializeBinary(ppMsg, pStrm);
+	} else {
+		CHKiRet(strm.UnreadChar(pStrm, c));
+		iRet = objDeserializeWithMethods(ppMsg, (uchar*) "msg", 3, pStrm, NULL,
+			NULL, msgConstructForDeserializer, NULL, MsgDeserialize);
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* Disk queue read-ahead, enabled by queue.readAhead.
+ * A background thread reads and deserializes the next records into a ring
+ * buffer of up to nMax messages, so that the consumer does not need to wait
+ * for the disk while it drains a backlog. The thread reads only records
+ * that are already counted in the queue size, just like the consumer would.
+ * For each message, the read position after it is kept, as the file deleter
+ * needs the position after the last *dequeued* message (see
+ * DequeueConsumableElements()). So the persisted queue state, which
+ * describes the delete position, is not affected: messages that were read
+ * ahead but not processed are simply read again after a restart.
+ * Everything except the ring slots the thread currently fills is guarded
+ * by the queue mutex.
+ */
+#define READAHEAD_CHUNK 32	/* max nbr of msgs read before they are handed to the consumer */
+typedef struct qDiskReadAheadElt_s {
+	msg_t *pMsg;
+	rsRetVal iRet;		/* result of reading the msg */
+	int64 offs;		/* read position after the msg */
+	int64 hintPhys;
+	int64 hintLog;
+	int fileNum;
+} qDiskReadAheadElt_t;
+
+struct qDiskReadAhead_s {
+	pthread_t thrdID;
+	pthread_cond_t condWork;	/* signalled to the thread: room in buffer, more to read or stop */
+	pthread_cond_t condReady;	/* signalled by the thread: more msgs staged */
+	qDiskReadAheadElt_t *elts;	/* the ring buffer */
+	qDiskReadAheadElt_t last;	/* positions after the msg dequeued last */
+	int nMax;
+	int head;		/* next staged msg */
+	int nStaged;		/* nbr of staged msgs */
+	sbool bIdle;		/* thread waits for condWork */
+	sbool bStop;		/* thread must terminate */
+};
+
+/* get the read position after the last dequeued message */
+static void
+qDiskGetDeqPos(qqueue_t *pThis, int64 *pOffs, int64 *pHintPhys, int64 *pHintLog, int *pFileNum)
+{
+	struct qDiskReadAhead_s *pRA = pThis->tVars.disk.pReadAhead;
+
+	if(pRA == NULL) {
+		strm.GetCurrOffset(pThis->tVars.disk.pReadDeq, pOffs);
+		strm.GetSeekHint(pThis->tVars.disk.pReadDeq, pHintPhys, pHintLog);
+		*pFileNum = strmGetCurrFileNum(pThis->tVars.disk.pReadDeq);
+	} else {
+		*pOffs = pRA->last.offs;
+		*pHintPhys = pRA->last.hintPhys;
+		*pHintLog = pRA->last.hintLog;
+		*pFileNum = pRA->last.fileNum;
+	}
+}
+
+static int
+qDiskGetDeqFileNum(qqueue_t *pThis)
+{
+	struct qDiskReadAhead_s *pRA = pThis->tVars.disk.pReadAhead;
+
+	return (pRA == NULL) ? strmGetCurrFileNum(pThis->tVars.disk.pReadDeq) : pRA->last.fileNum;
+}
+
+/* read one message into a ring slot, along with the position after it */
+static void
+qDiskReadAheadOne(qqueue_t *pThis, qDiskReadAheadElt_t *pElt)
+{
+	pElt->pMsg = NULL;
+	pElt->iRet = qDiskReadMsg(pThis, &pElt->pMsg);
+	strm.GetCurrOffset(pThis->tVars.disk.pReadDeq, &pElt->offs);
+	strm.GetSeekHint(pThis->tVars.disk.pReadDeq, &pElt->hintPhys, &pElt->hintLog);
+	pElt->fileNum = strmGetCurrFileNum(pThis->tVars.disk.pReadDeq);
+}
+
+static void *
+qDiskReadAheadThrd(void *arg)
+{
+	qqueue_t *pThis = (qqueue_t*) arg;
+	struct qDiskReadAhead_s *pRA = pThis->tVars.disk.pReadAhead;
+	sigset_t sigSet;
+	int nAvail;
+	int iTail;
+	int n, i;
+
+	sigfillset(&sigSet);
+	pthread_sigmask(SIG_BLOCK, &sigSet, NULL);
+	dbgSetThrdName((uchar*) "queue read-ahead");
+
+	d_pthread_mutex_lock(pThis->mut);
+	while(!pRA->bStop) {
+		/* records counted in the queue size but not yet read by us */
+		nAvail = getLogicalQueueSize(pThis) - pRA->nStaged;
+		n = pRA->nMax - pRA->nStaged;
+		if(n > nAvail)
+			n = nAvail;
+		if(n <= 0) {
+			pRA->bIdle = 1;
+			pthread_cond_wait(&pRA->condWork, pThis->mut);
+			pRA->bIdle = 0;
+			continue;
+		}
+		if(n > READAHEAD_CHUNK)
+			n = READAHEAD_CHUNK;
+		iTail = (pRA->head + pRA->nStaged) % pRA->nMax;
+		d_pthread_mutex_unlock(pThis->mut);
+		/* the consumer does not touch slots that are not yet staged */
+		for(i = 0 ; i < n ; ++i)
+			qDiskReadAheadOne(pThis, &pRA->elts[(iTail + i) % pRA->nMax]);
+		d_pthread_mutex_lock(pThis->mut);
+		pRA->nStaged += n;
+		pthread_cond_signal(&pRA->condReady);
+	}
+	d_pthread_mutex_unlock(pThis->mut);
+	return NULL;
+}
+
+/* start the read-ahead thread. The queue must not yet be in use. If the
+ * thread can not be created, we continue to read synchronously.
+ */
+static rsRetVal
+qDiskStartReadAhead(qqueue_t *pThis)
+{
+	struct qDiskReadAhead_s *pRA;
+	int r;
+	DEFiRet;
+
+	CHKmalloc(pRA = calloc(1, sizeof(struct qDiskReadAhead_s)));
+	if((pRA->elts = calloc(pThis->iReadAhead, sizeof(qDiskReadAheadElt_t))) == NULL) {
+		free(pRA);
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	}
+	pRA->nMax = pThis->iReadAhead;
+	pthread_cond_init(&pRA->condWork, NULL);
+	pthread_cond_init(&pRA->condReady, NULL);
+	/* nothing dequeued yet, so the last position is the current one */
+	qDiskGetDeqPos(pThis, &pRA->last.offs, &pRA->last.hintPhys, &pRA->last.hintLog,
+		       &pRA->last.fileNum);
+	pThis->tVars.disk.pReadAhead = pRA;
+	if((r = pthread_create(&pRA->thrdID, NULL, qDiskReadAheadThrd, pThis)) != 0) {
+		pThis->tVars.disk.pReadAhead = NULL;
+		pthread_cond_destroy(&pRA->condWork);
+		pthread_cond_destroy(&pRA->condReady);
+		free(pRA->elts);
+		free(pRA);
+		errmsg.LogError(r, RS_RET_ERR, "queue \"%s\": read-ahead thread could not be "
+				"started, reading synchronously", obj.GetName((obj_t*) pThis));
+		FINALIZE;
+	}
+	DBGOPRINT((obj_t*) pThis, "read-ahead of %d messages started\n", pRA->nMax);
+
+finalize_it:
+	RETiRet;
+}
+
+/* stop the read-ahead thread and discard the messages read ahead - they
+ * are still on disk. Must be called without the queue mutex and after the
+ * consumer has terminated. Does nothing if there is no read-ahead.
+ */
+static void
+qDiskStopReadAhead(qqueue_t *pThis)
+{
+	struct qDiskReadAhead_s *pRA = pThis->tVars.disk.pReadAhead;
+	qDiskReadAheadElt_t *pElt;
+	int i;
+
+	if(pRA == NULL)
+		return;
+	d_pthread_mutex_lock(pThis->mut);
+	pRA->bStop = 1;
+	pthread_cond_signal(&pRA->condWork);
+	d_pthread_mutex_unlock(pThis->mut);
+	pthread_join(pRA->thrdID, NULL);
+
+	for(i = 0 ; i < pRA->nStaged ; ++i) {
+		pElt = &pRA->elts[(pRA->head + i) % pRA->nMax];
+		if(pElt->pMsg != NULL)
+			msgDestruct(&pElt->pMsg);
+	}
+	pthread_cond_destroy(&pRA->condWork);
+	pthread_cond_destroy(&pRA->condReady);
+	free(pRA->elts);
+	free(pRA);
+	pThis->tVars.disk.pReadAhead = NULL;
+}
+
+/* dequeue a message from a disk queue, called with the queue mutex locked.
+ * With read-ahead, we take the next staged message and wait for the
+ * read-ahead thread if there is none yet.
+ */
 static rsRetVal qDeqDisk(qqueue_t *pThis, msg_t **ppMsg)
 {
+	struct qDiskReadAhead_s *pRA = pThis->tVars.disk.pReadAhead;
+	qDiskReadAheadElt_t *pElt;
 	DEFiRet;
-	iRet = objDeserializeWithMethods(ppMsg, (uchar*) "msg", 3, pThis->tVars.disk.pReadDeq, NULL,
-		NULL, msgConstructForDeserializer, NULL, MsgDeserialize);
+
+	if(pRA == NULL) {
+		iRet = qDiskReadMsg(pThis, ppMsg);
+		FINALIZE;
+	}
+
+	while(pRA->nStaged == 0) {
+		if(pRA->bIdle)
+			pthread_cond_signal(&pRA->condWork);
+		pthread_cond_wait(&pRA->condReady, pThis->mut);
+	}
+	pElt = &pRA->elts[pRA->head];
+	*ppMsg = pElt->pMsg;
+	iRet = pElt->iRet;
+	pElt->pMsg = NULL;
+	pRA->last = *pElt;
+	pRA->head = (pRA->head + 1) % pRA->nMax;
+	--pRA->nStaged;
+	/* wake the thread once there is a good amount of room and something to
+	 * read. Our msg still counts in the queue size at this point.
+	 */
+	if(   pRA->bIdle && pRA->nStaged <= pRA->nMax / 2
+	   && getLogicalQueueSize(pThis) - 1 > pRA->nStaged)
+		pthread_cond_signal(&pRA->condWork);
+
+finalize_it:
 	RETiRet;
 }
 
@@ -991,26 +2231,256 @@ static rsRetVal qAddDirectWithWti(qqueue_t *pThis, msg_t* pMsg, wti_t *pWti)
 	iRet = pThis->pConsumer(pThis->pAction, &singleBatch, pWti);
 	msgDestruct(&pMsg);
 
-	RETiRet;
+	RETiRet;
+}
+
+/* this is called if we do not have a pWti. This currently only happens
+ * when we are called from a main queue in direct mode. If so, we need
+ * to obtain a dummy pWti.
+ */
+static rsRetVal
+qAddDirect(qqueue_t *pThis, msg_t* pMsg)
+{
+	wti_t *pWti;
+	DEFiRet;
+
+	pWti = wtiGetDummy();
+	pWti->pbShutdownImmediate = &pThis->bShutdownImmediate;
+	iRet = qAddDirectWithWti(pThis, pMsg, pWti);
+	RETiRet;
+}
+
+
+/* -------------------- sharded queues -------------------- */
+
+/* A sharded queue is split into nShards independent sub-queues, each one
+ * with its own mutex, storage and worker thread pool. The parent queue
+ * itself holds no messages, it just routes them to the shards. Each
+ * producer thread is bound to a single shard, so producers no longer
+ * contend for the same mutex, while messages from one producer still
+ * stay in order. Shard workers only process their own shard.
+ * As a single busy producer fills a single shard, every shard may use the
+ * full size limits of the queue. The parent's iQueueSize and iQueueBytes
+ * count the messages of all shards and bound them together, see
+ * qqueueShardsFull(). The worker threads, however, are divided among the
+ * shards, so that queue.workerThreads keeps its meaning (but each shard
+ * needs at least one).
+ */
+
+/* get the shard the current thread shall submit to. Each thread obtains
+ * a sequence number the first time it submits to any sharded queue. That
+ * number is kept in thread-specific storage and spreads producers evenly
+ * over the shards.
+ */
+static inline qqueue_t *
+getShard(qqueue_t *pThis)
+{
+	intptr_t idx;
+
+	idx = (intptr_t) pthread_getspecific(keyShardThrd);
+	if(idx == 0) {
+		pthread_mutex_lock(&mutShardThrd);
+		idx = ++nShardThrds;
+		pthread_mutex_unlock(&mutShardThrd);
+		pthread_setspecific(keyShardThrd, (void*) idx);
+	}
+	return pThis->pShards[(idx - 1) % pThis->nShards];
+}
+
+/* keyed partitions: if queue.partitionkey is set, messages are not routed
+ * by producer but by the FNV-1a hash of the key property. There is one
+ * worker per shard, so all messages with the same key are processed in
+ * the order they were enqueued, while different keys are processed in
+ * parallel. Returns the index of the shard for the message.
+ */
+static inline int
+getPartition(qqueue_t *pThis, msg_t *pMsg)
+{
+	uchar *pszKey;
+	rs_size_t lenKey;
+	unsigned short bMustBeFreed = 0;
+	unsigned hash = 2166136261u;
+	int i;
+
+	pszKey = MsgGetProp(pMsg, NULL, pThis->pPartKey, &lenKey, &bMustBeFreed, NULL);
+	for(i = 0 ; i < lenKey ; ++i)
+		hash = (hash ^ pszKey[i]) * 16777619u;
+	if(bMustBeFreed)
+		free(pszKey);
+	return hash % pThis->nShards;
 }
 
-/* this is called if we do not have a pWti. This currently only happens
- * when we are called from a main queue in direct mode. If so, we need
- * to obtain a dummy pWti.
+
+/* construct and start the shards. Each shard inherits all parameters of
+ * the parent, including its limits, and gets its part of the worker
+ * threads. Keyed partitions have a single worker per shard, as this is
+ * what keeps their order. If the parent is disk-assisted, each shard gets
+ * its own queue files.
  */
-static rsRetVal
-qAddDirect(qqueue_t *pThis, msg_t* pMsg)
+static rsRetVal qConstructSharded(qqueue_t *pThis)
 {
-	wti_t *pWti;
+	qqueue_t *pShard;
+	uchar pszBuf[128];
+	size_t lenBuf;
+	int nWrkr;
+	int i;
 	DEFiRet;
 
-	pWti = wtiGetDummy();
-	pWti->pbShutdownImmediate = &pThis->bShutdownImmediate;
-	iRet = qAddDirectWithWti(pThis, pMsg, pWti);
+	CHKmalloc(pThis->pShards = calloc(pThis->nShards, sizeof(qqueue_t*)));
+	for(i = 0 ; i < pThis->nShards ; ++i) {
+		if(pThis->pPartKey != NULL) {
+			nWrkr = 1;
+		} else {
+			nWrkr = pThis->iNumWorkerThreads / pThis->nShards
+				+ (i < pThis->iNumWorkerThreads % pThis->nShards);
+			if(nWrkr < 1)
+				nWrkr = 1;
+		}
+		CHKiRet(qqueueConstruct(&pShard, pThis->qType, nWrkr,
+			pThis->iMaxQueueSize, pThis->pConsumer));
+		pThis->pShards[i] = pShard;
+		lenBuf = snprintf((char*)pszBuf, sizeof(pszBuf), "%s[shard%d]",
+				  obj.GetName((obj_t*) pThis), i);
+		CHKiRet(obj.SetName((obj_t*) pShard, pszBuf));
+		pShard->bIsShard = 1;
+		pShard->pShardParent = pThis;
+		pShard->pAction = pThis->pAction;
+		pShard->iDeqBatchSize = pThis->iDeqBatchSize;
+		pShard->iMinDeqBatchSize = pThis->iMinDeqBatchSize;
+		pShard->iDeqBatchTarget = pThis->iDeqBatchTarget;
+		pShard->iHighWtrMrk = pThis->iHighWtrMrk;
+		pShard->iLowWtrMrk = pThis->iLowWtrMrk;
+		pShard->iFullDlyMrk = pThis->iFullDlyMrk;
+		pShard->iLightDlyMrk = pThis->iLightDlyMrk;
+		pShard->iDiscardMrk = pThis->iDiscardMrk;
+		pShard->iMaxQueueBytes = pThis->iMaxQueueBytes;
+		pShard->iHighWtrMrkBytes = pThis->iHighWtrMrkBytes;
+		pShard->iLowWtrMrkBytes = pThis->iLowWtrMrkBytes;
+		pShard->iDiscardMrkBytes = pThis->iDiscardMrkBytes;
+		pShard->iDiscardSeverity = pThis->iDiscardSeverity;
+		pShard->nLanes = pThis->nLanes;
+		memcpy(pShard->laneOfSev, pThis->laneOfSev, sizeof(pThis->laneOfSev));
+		memcpy(pShard->laneWeight, pThis->laneWeight, sizeof(pThis->laneWeight));
+		pShard->iMinMsgsPerWrkr = pThis->iMinMsgsPerWrkr;
+		pShard->iWrkLatencyTarget = pThis->iWrkLatencyTarget;
+		pShard->iSpinWait = pThis->iSpinWait;
+		pShard->iReadAhead = pThis->iReadAhead;
+		pShard->bLatencyHist = pThis->bLatencyHist;
+		pShard->bHugePages = pThis->bHugePages;
+		if(pThis->pszCpuSet != NULL)
+			CHKmalloc(pShard->pszCpuSet = ustrdup(pThis->pszCpuSet));
+		pShard->bSharedWrkrs = pThis->bSharedWrkrs;
+		pShard->iPersistUpdCnt = pThis->iPersistUpdCnt;
+		pShard->bCheckpointLog = pThis->bCheckpointLog;
+		pShard->bSyncQueueFiles = pThis->bSyncQueueFiles;
+		pShard->iGrpCommitDelay = pThis->iGrpCommitDelay;
+		pShard->iGrpCommitBytes = pThis->iGrpCommitBytes;
+		pShard->bMmapFiles = pThis->bMmapFiles;
+		pShard->iZipLevel = pThis->iZipLevel;
+		pShard->toQShutdown = pThis->toQShutdown;
+		pShard->toActShutdown = pThis->toActShutdown;
+		pShard->toEnq = pThis->toEnq;
+		pShard->toWrkShutdown = pThis->toWrkShutdown;
+		pShard->iMaxFileSize = pThis->iMaxFileSize;
+		pShard->sizeOnDiskMax = pThis->sizeOnDiskMax;
+		pShard->bSaveOnShutdown = pThis->bSaveOnShutdown;
+		pShard->iDeqSlowdown = pThis->iDeqSlowdown;
+		pShard->iDeqtWinFromHr = pThis->iDeqtWinFromHr;
+		pShard->iDeqtWinToHr = pThis->iDeqtWinToHr;
+		CHKiRet(qqueueSetSpoolDir(pShard, pThis->pszSpoolDir, pThis->lenSpoolDir));
+		if(pThis->pszFilePrefix != NULL) {
+			lenBuf = snprintf((char*)pszBuf, sizeof(pszBuf), "%s.shard%d",
+					  (char*) pThis->pszFilePrefix, i);
+			CHKiRet(qqueueSetFilePrefix(pShard, pszBuf, lenBuf));
+		}
+		CHKiRet(qqueueStart(pShard));
+	}
+
+finalize_it:
 	RETiRet;
 }
 
 
+/* destruct the shards. This is called early during queue destruction, as
+ * the shards hold all messages and must be shut down before anything else.
+ * So it may be called more than once.
+ */
+static rsRetVal qDestructSharded(qqueue_t *pThis)
+{
+	int i;
+
+	if(pThis->pShards == NULL)
+		return RS_RET_OK;
+
+	for(i = 0 ; i < pThis->nShards ; ++i) {
+		if(pThis->pShards[i] != NULL)
+			qqueueDestruct(&pThis->pShards[i]);
+	}
+	free(pThis->pShards);
+	pThis->pShards = NULL;
+	pThis->iQueueSize = 0;
+	pThis->iQueueBytes = 0;
+	return RS_RET_OK;
+}
+
+
+/* update the parent's counters from its shards. This is the statsobj
+ * read notifier of sharded queues, so they show up as a single queue.
+ * Resettable counters are moved over to the parent, so that resetting
+ * works as usual.
+ */
+static void
+qqueueReadShardStats(statsobj_t __attribute__((unused)) *pStats, void *pUsr)
+{
+	qqueue_t *pThis = (qqueue_t*) pUsr;
+	qqueue_t *pShard;
+	int iMaxqsize = 0;
+	int iWrkTarget = 0;
+	int iWrkLatencyEst = 0;
+	int iDeqBatchCurr = 0;
+	intctr_t ctrHugeTLB = 0;
+	intctr_t ctrHugeTHP = 0;
+	int i, j;
+
+	for(i = 0 ; i < pThis->nShards ; ++i) {
+		pShard = pThis->pShards[i];
+		ctrHugeTLB += pShard->ctrHugeTLB;
+		ctrHugeTHP += pShard->ctrHugeTHP;
+		iMaxqsize += pShard->ctrMaxqsize;
+		iWrkTarget += pShard->iWrkTarget;
+		if(pShard->iWrkLatencyEst > iWrkLatencyEst)
+			iWrkLatencyEst = pShard->iWrkLatencyEst;
+		if(pShard->iDeqBatchCurr > iDeqBatchCurr)
+			iDeqBatchCurr = pShard->iDeqBatchCurr;
+		pThis->ctrWrkScaleUp += ATOMIC_FETCH_AND_CLEAR_uint64(&pShard->ctrWrkScaleUp,
+							&pShard->mutCtrWrkScaleUp);
+		pThis->ctrWrkScaleDown += ATOMIC_FETCH_AND_CLEAR_uint64(&pShard->ctrWrkScaleDown,
+							&pShard->mutCtrWrkScaleDown);
+		pThis->ctrEnqueued += ATOMIC_FETCH_AND_CLEAR_uint64(&pShard->ctrEnqueued,
+							&pShard->mutCtrEnqueued);
+		pThis->ctrFull += ATOMIC_FETCH_AND_CLEAR_uint64(&pShard->ctrFull, &pShard->mutCtrFull);
+		pThis->ctrFDscrd += ATOMIC_FETCH_AND_CLEAR_uint64(&pShard->ctrFDscrd,
+							&pShard->mutCtrFDscrd);
+		pThis->ctrNFDscrd += ATOMIC_FETCH_AND_CLEAR_uint64(&pShard->ctrNFDscrd,
+							&pShard->mutCtrNFDscrd);
+		if(pThis->bLatencyHist) {
+			for(j = 0 ; j < QUEUE_LATENCY_BUCKETS ; ++j) {
+				pThis->latencyHist[j] += ATOMIC_FETCH_AND_CLEAR_uint64(&pShard->latencyHist[j],
+								&pShard->mutLatencyHist);
+			}
+		}
+	}
+	/* iQueueSize and iQueueBytes are kept up to date by the shards */
+	/* each shard's maximum is kept individually, so this is an upper bound */
+	pThis->ctrMaxqsize = iMaxqsize;
+	pThis->iWrkTarget = iWrkTarget;
+	pThis->iWrkLatencyEst = iWrkLatencyEst;
+	pThis->iDeqBatchCurr = iDeqBatchCurr; /* the parent does not dequeue itself */
+	pThis->ctrHugeTLB = ctrHugeTLB;
+	pThis->ctrHugeTHP = ctrHugeTHP;
+}
+
+
 /* --------------- end type-specific handlers -------------------- */
 
 
@@ -1022,14 +2492,22 @@ qAddDirect(qqueue_t *pThis, msg_t* pMsg)
 static rsRetVal
 qqueueAdd(qqueue_t *pThis, msg_t *pMsg)
 {
+	int nBytes = 0;
 	DEFiRet;
 
 	ASSERT(pThis != NULL);
 
+	/* consumers may dequeue the message as soon as it is added */
+	if(qqueueIsMemQueue(pThis))
+		nBytes = qqueueMsgBytes(pMsg);
 	CHKiRet(pThis->qAdd(pThis, pMsg));
 
 	if(pThis->qType != QUEUETYPE_DIRECT) {
+		if(nBytes != 0)
+			qqueueAccountBytes(pThis, nBytes);
 		ATOMIC_INC(&pThis->iQueueSize, &pThis->mutQueueSize);
+		qqueueShardAccount(pThis, 1);
+		RSPROBE3(queue__enqueue, ((obj_t*) pThis)->pszName, pMsg, pThis->iQueueSize);
 		DBGOPRINT((obj_t*) pThis, "qqueueAdd: entry added, size now log %d, phys %d entries\n",
 			  getLogicalQueueSize(pThis), getPhysicalQueueSize(pThis));
 	}
@@ -1055,6 +2533,8 @@ qqueueDeq(qqueue_t *pThis, msg_t **ppMsg)
 	 */
 	iRet = pThis->qDeq(pThis, ppMsg);
 	ATOMIC_INC(&pThis->nLogDeq, &pThis->mutLogDeq);
+	if(*ppMsg != NULL && qqueueIsMemQueue(pThis))
+		qqueueAccountBytes(pThis, -qqueueMsgBytes(*ppMsg));
 
 //	DBGOPRINT((obj_t*) pThis, "entry deleted, size now log %d, phys %d entries\n",
 //		  getLogicalQueueSize(pThis), getPhysicalQueueSize(pThis));
@@ -1335,15 +2815,21 @@ rsRetVal qqueueConstruct(qqueue_t **ppThis, queueType_t qType, int iWorkerThread
 	pThis->iMaxQueueSize = iMaxQueueSize;
 	pThis->pConsumer = pConsumer;
 	pThis->iNumWorkerThreads = iWorkerThreads;
+	pThis->nShards = 1;
+	pThis->nLanes = 1;
 	pThis->iDeqtWinToHr = 25; /* disable time-windowed dequeuing by default */
 	pThis->iDeqBatchSize = 8; /* conservative default, should still provide good performance */
+	pThis->iDeqBatchTarget = 100;
 
 	pThis->pszFilePrefix = NULL;
 	pThis->qType = qType;
 
 
 	INIT_ATOMIC_HELPER_MUT(pThis->mutQueueSize);
+	INIT_ATOMIC_HELPER_MUT(pThis->mutGrpCommitPending);
 	INIT_ATOMIC_HELPER_MUT(pThis->mutLogDeq);
+	INIT_ATOMIC_HELPER_MUT64(pThis->mutQueueBytes);
+	INIT_ATOMIC_HELPER_MUT(pThis->mutBackpressure);
 
 finalize_it:
 	OBJCONSTRUCT_CHECK_SUCCESS_AND_CLEANUP
@@ -1369,19 +2855,34 @@ qqueueSetDefaultsActionQueue(qqueue_t *pThis)
 	pThis->iDiscardMrk = -1;		/* begin to discard messages */
 	pThis->iDiscardSeverity = 8;		/* turn off */
 	pThis->iNumWorkerThreads = 1;		/* number of worker threads for the mm queue above */
+	pThis->nShards = 1;			/* do not split the queue */
+	pThis->nLanes = 1;			/* no priority lanes */
 	pThis->iMaxFileSize = 1024*1024;
 	pThis->iPersistUpdCnt = 0;		/* persist queue info every n updates */
+	pThis->bCheckpointLog = 0;		/* rewrite the .qi file for checkpoints */
+	pThis->fdCkpLog = -1;
 	pThis->bSyncQueueFiles = 0;
+	pThis->iGrpCommitDelay = 0;		/* group commit: do not wait for more data */
+	pThis->iGrpCommitBytes = 0;		/* group commit: no byte limit */
+	pThis->bMmapFiles = 0;			/* use read()/write() for queue files */
+	pThis->iZipLevel = 0;			/* do not compress queue files */
 	pThis->toQShutdown = 0;			/* queue shutdown */ 
 	pThis->toActShutdown = 1000;		/* action shutdown (in phase 2) */ 
 	pThis->toEnq = 2000;			/* timeout for queue enque */ 
 	pThis->toWrkShutdown = 60000;		/* timeout for worker thread shutdown */
 	pThis->iMinMsgsPerWrkr = -1;		/* minimum messages per worker needed to start a new one */
+	pThis->iWrkLatencyTarget = 0;		/* scale workers by queue size, not latency */
+	pThis->iSpinWait = 0;			/* idle workers block immediately */
+	pThis->iReadAhead = 0;			/* disk queues read synchronously */
+	pThis->bLatencyHist = 0;		/* no latency histogram */
+	pThis->bHugePages = 0;		/* regular pages for queue storage */
 	pThis->bSaveOnShutdown = 1;		/* save queue on shutdown (when DA enabled)? */
 	pThis->sizeOnDiskMax = 0;		/* unlimited */
 	pThis->iDeqSlowdown = 0;
 	pThis->iDeqtWinFromHr = 0;
 	pThis->iDeqtWinToHr = 25;		 /* disable time-windowed dequeuing by default */
+	pThis->iMinDeqBatchSize = 0;		/* fixed batch size */
+	pThis->iDeqBatchTarget = 100;		/* adaptive batching: 100ms per batch */
 }
 
 
@@ -1399,19 +2900,34 @@ qqueueSetDefaultsRulesetQueue(qqueue_t *pThis)
 	pThis->iDiscardMrk = -1;		/* begin to discard messages */
 	pThis->iDiscardSeverity = 8;		/* turn off */
 	pThis->iNumWorkerThreads = 1;		/* number of worker threads for the mm queue above */
+	pThis->nShards = 1;			/* do not split the queue */
+	pThis->nLanes = 1;			/* no priority lanes */
 	pThis->iMaxFileSize = 16*1024*1024;
 	pThis->iPersistUpdCnt = 0;		/* persist queue info every n updates */
+	pThis->bCheckpointLog = 0;		/* rewrite the .qi file for checkpoints */
+	pThis->fdCkpLog = -1;
 	pThis->bSyncQueueFiles = 0;
+	pThis->iGrpCommitDelay = 0;		/* group commit: do not wait for more data */
+	pThis->iGrpCommitBytes = 0;		/* group commit: no byte limit */
+	pThis->bMmapFiles = 0;			/* use read()/write() for queue files */
+	pThis->iZipLevel = 0;			/* do not compress queue files */
 	pThis->toQShutdown = 1500;			/* queue shutdown */ 
 	pThis->toActShutdown = 1000;		/* action shutdown (in phase 2) */ 
 	pThis->toEnq = 2000;			/* timeout for queue enque */ 
 	pThis->toWrkShutdown = 60000;		/* timeout for worker thread shutdown */
 	pThis->iMinMsgsPerWrkr = -1;		/* minimum messages per worker needed to start a new one */
+	pThis->iWrkLatencyTarget = 0;		/* scale workers by queue size, not latency */
+	pThis->iSpinWait = 0;			/* idle workers block immediately */
+	pThis->iReadAhead = 0;			/* disk queues read synchronously */
+	pThis->bLatencyHist = 0;		/* no latency histogram */
+	pThis->bHugePages = 0;		/* regular pages for queue storage */
 	pThis->bSaveOnShutdown = 1;		/* save queue on shutdown (when DA enabled)? */
 	pThis->sizeOnDiskMax = 0;		/* unlimited */
 	pThis->iDeqSlowdown = 0;
 	pThis->iDeqtWinFromHr = 0;
 	pThis->iDeqtWinToHr = 25;		 /* disable time-windowed dequeuing by default */
+	pThis->iMinDeqBatchSize = 0;		/* fixed batch size */
+	pThis->iDeqBatchTarget = 100;		/* adaptive batching: 100ms per batch */
 }
 
 
@@ -1426,6 +2942,8 @@ qqueueSetDefaultsRulesetQueue(qqueue_t *pThis)
  * deadlocks!
  * If the message is discarded, it can no longer be processed by the caller. So be sure to check
  * the return state!
+ * The discard mark may also be given in bytes. Non-DA memory queues also discard if the
+ * global memory budget is exhausted, DA queues spill to disk in that case.
  * rgerhards, 2008-01-24
  */
 static int qqueueChkDiscardMsg(qqueue_t *pThis, int iQueueSize, msg_t *pMsg)
@@ -1436,7 +2954,9 @@ static int qqueueChkDiscardMsg(qqueue_t *pThis, int iQueueSize, msg_t *pMsg)
 
 	ISOBJ_TYPE_assert(pThis, qqueue);
 
-	if(pThis->iDiscardMrk > 0 && iQueueSize >= pThis->iDiscardMrk) {
+	if(   (pThis->iDiscardMrk > 0 && iQueueSize >= pThis->iDiscardMrk)
+	   || (pThis->iDiscardMrkBytes > 0 && pThis->iQueueBytes >= pThis->iDiscardMrkBytes)
+	   || (!pThis->bIsDA && qqueueIsMemQueue(pThis) && qqueueOverMemBudget())) {
 		iRetLocal = MsgGetSeverity(pMsg, &iSeverity);
 		if(iRetLocal == RS_RET_OK && iSeverity >= pThis->iDiscardSeverity) {
 			DBGOPRINT((obj_t*) pThis, "queue nearly full (%d entries), discarded severity %d message\n",
@@ -1470,6 +2990,9 @@ DoDeleteBatchFromQStore(qqueue_t *pThis, int nElem)
 	if(pThis->qType == QUEUETYPE_DISK) {
 		strmMultiFileSeek(pThis->tVars.disk.pReadDel, pThis->tVars.disk.deqFileNumOut,
 				  pThis->tVars.disk.deqOffs, &bytesDel);
+		/* pReadDel is persisted, so it must know how the dequeue stream can be restored */
+		strm.SetSeekHint(pThis->tVars.disk.pReadDel, pThis->tVars.disk.deqHintPhys,
+				 pThis->tVars.disk.deqHintLog);
 		/* We need to correct the on-disk file size. This time it is a bit tricky:
 		 * we free disk space only upon file deletion. So we need to keep track of what we
 		 * have read until we get an out-offset that is lower than the in-offset (which
@@ -1491,6 +3014,7 @@ DoDeleteBatchFromQStore(qqueue_t *pThis, int nElem)
 
 	/* iQueueSize is not decremented by qDel(), so we need to do it ourselves */
 	ATOMIC_SUB(&pThis->iQueueSize, nElem, &pThis->mutQueueSize);
+	qqueueShardAccount(pThis, -nElem);
 	ATOMIC_SUB(&pThis->nLogDeq, nElem, &pThis->mutLogDeq);
 	DBGPRINTF("doDeleteBatch: delete batch from store, new sizes: log %d, phys %d\n",
 		  getLogicalQueueSize(pThis), getPhysicalQueueSize(pThis));
@@ -1581,6 +3105,132 @@ DeleteProcessedBatch(qqueue_t *pThis, batch_t *pBatch)
 }
 
 
+/* give up on the asynchronous transactions of a worker that are still in
+ * flight, which is done on immediate shutdown. Their messages are put back
+ * into the queue, so that they are handled like all other unprocessed ones
+ * (e.g. saved to disk). A module may still deliver them, so this may cause
+ * duplicates, but not loss. The slots stay reserved, as the module may call
+ * done() for them until its worker instance is freed. Returns the number
+ * of elements deleted. Must be called with the queue mutex locked.
+ */
+static int
+qqueueAbandonAsync(qqueue_t *pThis, wti_t *pWti)
+{
+	wtiAsync_t *const pAsync = pWti->pAsync;
+	wtiAsyncSlot_t *pSlot;
+	int nDeleted = 0;
+	int i, j;
+
+	for(i = 0 ; i < pAsync->nSlots ; ++i) {
+		pSlot = &pAsync->slots[i];
+		if(!pSlot->bParked)
+			continue;
+		DBGOPRINT((obj_t*) pThis, "abandoning asynchronous transaction, "
+			  "re-enqueueing %d messages\n", pSlot->batch.nElem);
+		for(j = 0 ; j < pSlot->batch.nElem ; ++j) {
+			if(pSlot->batch.eltState[j] == BATCH_STATE_COMM)
+				pSlot->batch.eltState[j] = BATCH_STATE_RDY;
+		}
+		nDeleted += pSlot->batch.nElemDeq;
+		DeleteProcessedBatch(pThis, &pSlot->batch);
+		wtiAsyncAbandon(pWti, pSlot);
+	}
+	return nDeleted;
+}
+
+
+/* delete the parked batches of a worker whose asynchronous transactions are
+ * done (see wtiAsyncPark()). If a transaction failed, its messages are
+ * re-enqueued by DeleteProcessedBatch() and the action is told about the
+ * failure when it commits the next time. Returns the number of elements
+ * deleted. If bWait is set, waits until a slot is free and, if the queue
+ * is empty or bWaitAll is set, until all transactions are done, so that
+ * an idle worker does not hold on to messages. The wait ends when the queue
+ * is told to shut down immediately, which happens once the shutdown timeout
+ * has expired; then the remaining transactions are abandoned. Must be
+ * called with the queue mutex locked, which is released while waiting.
+ */
+static int
+qqueueReapAsync(qqueue_t *pThis, wti_t *pWti, int bWait, int bWaitAll)
+{
+	wtiAsync_t *const pAsync = pWti->pAsync;
+	wtiAsyncSlot_t *pSlot;
+	struct timespec t;
+	int nDeleted = 0;
+	int i, j;
+
+	wtiAsyncPark(pWti);
+	while(1) {
+		for(i = 0 ; i < pAsync->nSlots ; ++i) {
+			pSlot = &pAsync->slots[i];
+			if(!pSlot->bParked || !wtiAsyncIsDone(pSlot))
+				continue;
+			if(pSlot->result != RS_RET_OK) {
+				DBGOPRINT((obj_t*) pThis, "asynchronous transaction failed with %d, "
+					  "re-enqueueing %d messages\n", pSlot->result, pSlot->batch.nElem);
+				if(pSlot->result == RS_RET_SUSPENDED) {
+					for(j = 0 ; j < pSlot->batch.nElem ; ++j) {
+						if(pSlot->batch.eltState[j] == BATCH_STATE_COMM)
+							pSlot->batch.eltState[j] = BATCH_STATE_RDY;
+					}
+				}
+				pAsync->failRet = pSlot->result;
+			}
+			nDeleted += pSlot->batch.nElemDeq;
+			DeleteProcessedBatch(pThis, &pSlot->batch);
+			wtiAsyncRelease(pWti, pSlot);
+		}
+		if(!bWait || pAsync->nInUse == pAsync->nAbandoned)
+			break;
+		if(pAsync->nInUse < pAsync->nSlots && !bWaitAll && getLogicalQueueSize(pThis) > 0)
+			break;
+		if(pThis->bShutdownImmediate) {
+			nDeleted += qqueueAbandonAsync(pThis, pWti);
+			break;
+		}
+		/* the shutdown flag is not signalled, so we check it regularly */
+		d_pthread_mutex_unlock(pThis->mut);
+		timeoutComp(&t, WTI_ASYNC_POLL_MS);
+		wtiAsyncWait(pWti, &t);
+		d_pthread_mutex_lock(pThis->mut);
+	}
+	return nDeleted;
+}
+
+
+/* impstats names of the latency histogram buckets, see QUEUE_LATENCY_BASE */
+static const char *latencyHistNames[QUEUE_LATENCY_BUCKETS] = {
+	"latency.lt125us", "latency.lt250us", "latency.lt500us", "latency.lt1ms",
+	"latency.lt2ms", "latency.lt4ms", "latency.lt8ms", "latency.lt16ms",
+	"latency.lt32ms", "latency.lt64ms", "latency.lt128ms", "latency.lt256ms",
+	"latency.lt512ms", "latency.lt1024ms", "latency.lt2048ms", "latency.lt4096ms",
+	"latency.lt8192ms", "latency.lt16384ms", "latency.lt32768ms", "latency.ge32768ms"
+};
+
+/* record the time a message spent in the queue. This is called for each
+ * dequeued message, so it must be cheap: the current time is obtained only
+ * once per batch by the caller, and the bucket is just the position of the
+ * highest bit. The buckets are updated atomically, as impstats resets them
+ * without holding the queue mutex.
+ */
+static inline void
+qqueueRecordLatency(qqueue_t *pThis, uint64_t tDeq, uint64_t tEnq)
+{
+	uint64_t units;
+	int bucket;
+
+	if(tDeq <= tEnq) {
+		/* enqueued lock-free after our batch started */
+		bucket = 0;
+	} else {
+		units = (tDeq - tEnq) / QUEUE_LATENCY_BASE;
+		for(bucket = 0 ; units != 0 && bucket < QUEUE_LATENCY_BUCKETS - 1 ; ++bucket)
+			units >>= 1;
+	}
+	STATSCOUNTER_INC(pThis->latencyHist[bucket], pThis->mutLatencyHist);
+}
+
+
 /* dequeue as many user pointers as are available, until we hit the configured
  * upper limit of pointers. Note that this function also deletes all processed
  * objects from the previous batch. However, it is perfectly valid that the
@@ -1597,19 +3247,25 @@ DequeueConsumableElements(qqueue_t *pThis, wti_t *pWti, int *piRemainingQueueSiz
 	int nDiscarded;
 	int nDeleted;
 	int iQueueSize;
+	uint64_t tDeq;
 	msg_t *pMsg;
 	rsRetVal localRet;
 	DEFiRet;
 
-	nDeleted = pWti->batch.nElemDeq;
+	nDeleted = (pWti->pAsync == NULL) ? 0 : qqueueReapAsync(pThis, pWti, 1, 0);
+	nDeleted += pWti->batch.nElemDeq;
 	DeleteProcessedBatch(pThis, &pWti->batch);
 
 	nDequeued = nDiscarded = 0;
 	if(pThis->qType == QUEUETYPE_DISK) {
-		pThis->tVars.disk.deqFileNumIn = strmGetCurrFileNum(pThis->tVars.disk.pReadDeq);
+		pThis->tVars.disk.deqFileNumIn = qDiskGetDeqFileNum(pThis);
 	}
-	while((iQueueSize = getLogicalQueueSize(pThis)) > 0 && nDequeued < pThis->iDeqBatchSize) {
+	tDeq = (pThis->bLatencyHist && GatherStats) ? getMonotonicUsecs() : 0;
+	while((iQueueSize = getLogicalQueueSize(pThis)) > 0 && nDequeued < pThis->iDeqBatchCurr) {
+		pThis->tDeqEnq = 0;
 		CHKiRet(qqueueDeq(pThis, &pMsg));
+		if(tDeq != 0 && pThis->tDeqEnq != 0)
+			qqueueRecordLatency(pThis, tDeq, pThis->tDeqEnq);
 
 		/* check if we should discard this element */
 		localRet = qqueueChkDiscardMsg(pThis, pThis->iQueueSize, pMsg);
@@ -1621,23 +3277,26 @@ DequeueConsumableElements(qqueue_t *pThis, wti_t *pWti, int *piRemainingQueueSiz
 		}
 
 		/* all well, use this element */
+		MsgTraceStage(pMsg, (pThis->pAction == NULL) ? TRACE_MAINQ_DEQ : TRACE_ACTQ_DEQ);
 		pWti->batch.pElem[nDequeued].pMsg = pMsg;
 		pWti->batch.eltState[nDequeued] = BATCH_STATE_RDY;
 		++nDequeued;
 	}
 
 	if(pThis->qType == QUEUETYPE_DISK) {
-		strm.GetCurrOffset(pThis->tVars.disk.pReadDeq, &pThis->tVars.disk.deqOffs);
-		pThis->tVars.disk.deqFileNumOut = strmGetCurrFileNum(pThis->tVars.disk.pReadDeq);
+		qDiskGetDeqPos(pThis, &pThis->tVars.disk.deqOffs, &pThis->tVars.disk.deqHintPhys,
+			       &pThis->tVars.disk.deqHintLog, &pThis->tVars.disk.deqFileNumOut);
 	}
 
 	/* it is sufficient to persist only when the bulk of work is done */
 	qqueueChkPersist(pThis, nDequeued+nDiscarded+nDeleted);
+	pThis->nWrkDeq += nDequeued + nDiscarded;
 
 	pWti->batch.nElem = nDequeued;
 	pWti->batch.nElemDeq = nDequeued + nDiscarded;
 	pWti->batch.deqID = getNextDeqID(pThis);
 	*piRemainingQueueSize = iQueueSize;
+	RSPROBE3(queue__dequeue, ((obj_t*) pThis)->pszName, nDequeued, iQueueSize);
 finalize_it:
 	RETiRet;
 }
@@ -1829,6 +3488,8 @@ batchProcessed(qqueue_t *pThis, wti_t *pWti)
 	int iCancelStateSave;
 	/* at this spot, we must not be cancelled */
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &iCancelStateSave);
+	if(pWti->pAsync != NULL)
+		qqueueChkPersist(pThis, qqueueReapAsync(pThis, pWti, 1, 1));
 	DeleteProcessedBatch(pThis, &pWti->batch);
 	qqueueChkPersist(pThis, pWti->batch.nElemDeq);
 	pthread_setcancelstate(iCancelStateSave, NULL);
@@ -1837,6 +3498,42 @@ batchProcessed(qqueue_t *pThis, wti_t *pWti)
 }
 
 
+/* adaptive batching: adjust the dequeue batch size based on how long the
+ * consumer took for the last batch and on the current queue depth. If a
+ * batch takes longer than the target time, the batch size is halved, as
+ * messages at the end of the batch (and the commit) are delayed too much.
+ * If full batches are processed fast enough while there is a backlog, the
+ * size is doubled, because larger batches mean fewer commits. Without a
+ * backlog, the size slowly decays, so that a burst starts with small,
+ * low-latency batches. The size always stays between the configured bounds.
+ * Must be called with the queue mutex locked.
+ */
+static inline void
+qqueueAdaptDeqBatchSize(qqueue_t *pThis, int nElem, uint64_t usecs)
+{
+	int iNew = pThis->iDeqBatchCurr;
+
+	if(usecs > (uint64_t) pThis->iDeqBatchTarget * 1000) {
+		iNew /= 2;
+	} else if(nElem >= pThis->iDeqBatchCurr && getLogicalQueueSize(pThis) >= pThis->iDeqBatchCurr) {
+		iNew *= 2;
+	} else if(nElem < pThis->iDeqBatchCurr / 2) {
+		iNew -= iNew / 8;
+	}
+
+	if(iNew < pThis->iMinDeqBatchSize)
+		iNew = pThis->iMinDeqBatchSize;
+	else if(iNew > pThis->iDeqBatchSize)
+		iNew = pThis->iDeqBatchSize;
+
+	if(iNew != pThis->iDeqBatchCurr) {
+		DBGOPRINT((obj_t*) pThis, "adaptive batching: batch of %d took %lluus, batch size now %d\n",
+			  nElem, (long long unsigned) usecs, iNew);
+		pThis->iDeqBatchCurr = iNew;
+	}
+}
+
+
 /* This is the queue consumer in the regular (non-DA) case. It is 
  * protected by the queue mutex, but MUST release it as soon as possible.
  * rgerhards, 2008-01-21
@@ -1846,6 +3543,8 @@ ConsumerReg(qqueue_t *pThis, wti_t *pWti)
 {
 	int iCancelStateSave;
 	int bNeedReLock = 0;	/**< do we need to lock the mutex again? */
+	uint64_t tBatchStart = 0;
+	uint64_t usBatch;
 	DEFiRet;
 
 	ISOBJ_TYPE_assert(pThis, qqueue);
@@ -1873,6 +3572,8 @@ ConsumerReg(qqueue_t *pThis, wti_t *pWti)
 
 
 	pWti->pbShutdownImmediate = &pThis->bShutdownImmediate;
+	if(pThis->iMinDeqBatchSize > 0 || pThis->iWrkLatencyTarget > 0)
+		tBatchStart = getMonotonicUsecs();
 	CHKiRet(pThis->pConsumer(pThis->pAction, &pWti->batch, pWti));
 
 	/* we now need to check if we should deliberately delay processing a bit
@@ -1896,15 +3597,136 @@ finalize_it:
 	if(bNeedReLock)
 		d_pthread_mutex_lock(pThis->mut);
 
+	if(tBatchStart != 0) {
+		usBatch = getMonotonicUsecs() - tBatchStart;
+		pThis->usWrkBusy += usBatch;
+		if(pThis->iMinDeqBatchSize > 0)
+			qqueueAdaptDeqBatchSize(pThis, pWti->batch.nElem, usBatch);
+	}
+
+	RETiRet;
+}
+
+
+/* DA spill: wait until the disk queue has space for another batch. This is
+ * the basic flow control of doEnqSingleObj(), but done once per batch. As the
+ * size of the batch on disk is not known in advance, the queue may grow by up
+ * to one batch beyond queue.maxdiskspace.
+ * Must be called with the queue mutex locked.
+ */
+static rsRetVal
+qqueueSpillWaitSpace(qqueue_t *pqDA)
+{
+	struct timespec t;
+	DEFiRet;
+
+	while(pqDA->sizeOnDiskMax != 0 && pqDA->tVars.disk.sizeOnDisk > pqDA->sizeOnDiskMax) {
+		STATSCOUNTER_INC(pqDA->ctrFull, pqDA->mutCtrFull);
+		if(pqDA->toEnq == 0 || pqDA->bEnqOnly) {
+			DBGOPRINT((obj_t*) pqDA, "spill: queue FULL - configured for immediate discarding "
+				  "sizeOnDisk=%lld sizeOnDiskMax=%lld\n", pqDA->tVars.disk.sizeOnDisk,
+				  pqDA->sizeOnDiskMax);
+			ABORT_FINALIZE(RS_RET_QUEUE_FULL);
+		}
+		if(glbl.GetGlobalInputTermState()) {
+			DBGOPRINT((obj_t*) pqDA, "spill: queue FULL, discard due to FORCE_TERM.\n");
+			ABORT_FINALIZE(RS_RET_FORCE_TERM);
+		}
+		DBGOPRINT((obj_t*) pqDA, "spill: queue FULL - waiting %dms to drain.\n", pqDA->toEnq);
+		timeoutComp(&t, pqDA->toEnq);
+		if(pthread_cond_timedwait(&pqDA->notFull, pqDA->mut, &t) != 0) {
+			DBGOPRINT((obj_t*) pqDA, "spill: cond timeout, dropping batch!\n");
+			ABORT_FINALIZE(RS_RET_QUEUE_FULL);
+		}
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* DA spill: write a batch to the disk queue. The DA worker is the only
+ * thread that ever writes to the disk queue, so the write stream can be used
+ * without the queue mutex, which is shared with the memory queue. The disk
+ * queue's reader does not touch the new records before they are published
+ * by qqueueSpillPublish(), as it only reads entries it has been told about by
+ * the queue size. While the write is in progress, checkpoints are deferred,
+ * because the write stream state is not consistent (see qqueueChkPersist()).
+ * The whole batch is flushed (and synced, if configured) at once.
+ * *pnSpilled receives the number of messages written.
+ * Must be called WITHOUT the queue mutex, but bSpillActive must have been set.
+ */
+static rsRetVal
+qqueueSpillBatch(qqueue_t *pThis, wti_t *pWti, int *pnSpilled, number_t *pnWritten)
+{
+	strm_t *pWrite = pThis->pqDA->tVars.disk.pWrite;
+	int iCancelStateSave;
+	int i;
+	DEFiRet;
+
+	*pnSpilled = 0;
+	*pnWritten = 0;
+	CHKiRet(strm.SetWCntr(pWrite, pnWritten));
+
+	/* at this spot, we may be cancelled */
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &iCancelStateSave);
+	for(i = 0 ; i < pWti->batch.nElem && !pThis->bShutdownImmediate ; i++) {
+		iRet = MsgSerializeBinary(pWti->batch.pElem[i].pMsg, pWrite);
+		if(iRet != RS_RET_OK) {
+			DBGOPRINT((obj_t*) pThis, "spill: serializing item (%d) failed with error %d\n", i, iRet);
+			break;
+		}
+		pWti->batch.eltState[i] = BATCH_STATE_COMM; /* commited to other queue! */
+		++*pnSpilled;
+	}
+	/* but now cancellation is no longer permitted */
+	pthread_setcancelstate(iCancelStateSave, NULL);
+
+	/* the batch is committed as a whole, the first error matters most */
+	if(iRet == RS_RET_OK)
+		iRet = strm.Flush(pWrite);
+	else
+		strm.Flush(pWrite);
+	if(iRet == RS_RET_OK && pThis->pqDA->bGrpCommit)
+		iRet = strm.Sync(pWrite);
+	strm.SetWCntr(pWrite, NULL);
+
+finalize_it:
 	RETiRet;
 }
 
 
+/* DA spill: make a written batch visible to the disk queue.
+ * Must be called with the queue mutex locked.
+ */
+static void
+qqueueSpillPublish(qqueue_t *pqDA, int nSpilled, number_t nWritten)
+{
+	int i;
+
+	for(i = 0 ; i < nSpilled ; ++i) {
+		STATSCOUNTER_INC(pqDA->ctrEnqueued, pqDA->mutCtrEnqueued);
+		ATOMIC_INC(&pqDA->iQueueSize, &pqDA->mutQueueSize);
+	}
+	STATSCOUNTER_SETMAX_NOMUT(pqDA->ctrMaxqsize, pqDA->iQueueSize);
+	pqDA->tVars.disk.sizeOnDisk += nWritten;
+	pqDA->tVars.disk.bSpillActive = 0;
+	DBGOPRINT((obj_t*) pqDA, "spill: %d entries with %lld octets written, queue disk size now "
+		  "%lld octets\n", nSpilled, (long long) nWritten, pqDA->tVars.disk.sizeOnDisk);
+
+	qqueueChkPersist(pqDA, nSpilled);
+	qqueueAdviseMaxWorkers(pqDA);
+}
+
+
 /* This is a special consumer to feed the disk-queue in disk-assisted mode.
  * When active, our own queue more or less acts as a memory buffer to the disk.
  * So this consumer just needs to drain the memory queue and submit entries
  * to the disk queue. The disk queue will then call the actual consumer from
  * the app point of view (we chain two queues here).
+ * Whole batches are written to the disk queue without holding the queue
+ * mutex (see qqueueSpillBatch()), so enqueuers to the memory queue never
+ * need to wait for disk i/o.
  * When this method is entered, the mutex is always locked and needs to be unlocked
  * as part of the processing.
  * rgerhards, 2008-01-14
@@ -1912,43 +3734,39 @@ finalize_it:
 static rsRetVal
 ConsumerDA(qqueue_t *pThis, wti_t *pWti)
 {
+	qqueue_t *pqDA;
 	int i;
-	int iCancelStateSave;
-	int bNeedReLock = 0;	/**< do we need to lock the mutex again? */
+	int nSpilled;
+	number_t nWritten;
 	DEFiRet;
 
 	ISOBJ_TYPE_assert(pThis, qqueue);
 	ISOBJ_TYPE_assert(pWti, wti);
 
 	CHKiRet(DequeueForConsumer(pThis, pWti));
+	pqDA = pThis->pqDA;
+
+	iRet = qqueueSpillWaitSpace(pqDA);
+	if(iRet != RS_RET_OK) {
+		/* the batch is lost, like individual messages were in this case */
+		for(i = 0 ; i < pWti->batch.nElem ; i++) {
+			STATSCOUNTER_INC(pqDA->ctrFDscrd, pqDA->mutCtrFDscrd);
+			pWti->batch.eltState[i] = BATCH_STATE_COMM;
+		}
+		FINALIZE;
+	}
 
 	/* we now have a non-idle batch of work, so we can release the queue mutex and process it */
+	pqDA->tVars.disk.bSpillActive = 1;
 	d_pthread_mutex_unlock(pThis->mut);
-	bNeedReLock = 1;
 
-	/* at this spot, we may be cancelled */
-	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &iCancelStateSave);
-
-	/* iterate over returned results and enqueue them in DA queue */
-	for(i = 0 ; i < pWti->batch.nElem && !pThis->bShutdownImmediate ; i++) {
-		iRet = qqueueEnqMsg(pThis->pqDA, eFLOWCTL_NO_DELAY, MsgAddRef(pWti->batch.pElem[i].pMsg));
-		if(iRet != RS_RET_OK) {
-			if(iRet == RS_RET_ERR_QUEUE_EMERGENCY) {
-				/* Queue emergency error occured */
-				DBGOPRINT((obj_t*) pThis, "ConsumerDA:qqueueEnqMsg caught RS_RET_ERR_QUEUE_EMERGENCY, aborting loop.\n");
-				FINALIZE;
-			} else {
-				DBGOPRINT((obj_t*) pThis, "ConsumerDA:qqueueEnqMsg item (%d) returned with error state: '%d'\n", i, iRet);
-			}
-		}
-		pWti->batch.eltState[i] = BATCH_STATE_COMM; /* commited to other queue! */
-	}
+	iRet = qqueueSpillBatch(pThis, pWti, &nSpilled, &nWritten);
 
-	/* but now cancellation is no longer permitted */
-	pthread_setcancelstate(iCancelStateSave, NULL);
+	d_pthread_mutex_lock(pThis->mut);
+	qqueueSpillPublish(pqDA, nSpilled, nWritten);
 
 finalize_it:
-	/*	Check the last return state of qqueueEnqMsg. If an error was returned, we acknowledge it only.
+	/*	Check the last return state of the spill. If an error was returned, we acknowledge it only.
 	*	Unless the error code is RS_RET_ERR_QUEUE_EMERGENCY, we reset the return state to RS_RET_OK.  
 	*	Otherwise the Caller functions would run into an infinite Loop trying to enqueue the 
 	*	same messages over and over again. 
@@ -1970,73 +3788,169 @@ finalize_it:
 	if(	iRet != RS_RET_OK && 
 		iRet != RS_RET_ERR_QUEUE_EMERGENCY && 
 		iRet < 0) {
-		DBGOPRINT((obj_t*) pThis, "ConsumerDA:qqueueEnqMsg Resetting iRet from %d back to RS_RET_OK\n", iRet);
+		DBGOPRINT((obj_t*) pThis, "ConsumerDA: Resetting iRet from %d back to RS_RET_OK\n", iRet);
 		iRet = RS_RET_OK;
 	} else {
-		DBGOPRINT((obj_t*) pThis, "ConsumerDA:qqueueEnqMsg returns with iRet %d\n", iRet);
+		DBGOPRINT((obj_t*) pThis, "ConsumerDA: returns with iRet %d\n", iRet);
 	}
 
-	/* now we are done, but potentially need to re-aquire the mutex */
-	if(bNeedReLock)
-		d_pthread_mutex_lock(pThis->mut);
+	RETiRet;
+}
+
+
+/* must only be called when the queue mutex is locked, else results
+ * are not stable!
+ */
+static rsRetVal
+qqueueChkStopWrkrDA(qqueue_t *pThis)
+{
+	DEFiRet;
+
+	/*DBGPRINTF("XXXX: chkStopWrkrDA called, low watermark %d, log Size %d, phys Size %d, bEnqOnly %d\n",
+	pThis->iLowWtrMrk, getLogicalQueueSize(pThis), getPhysicalQueueSize(pThis), pThis->bEnqOnly);*/
+	if(pThis->bEnqOnly) {
+		iRet = RS_RET_TERMINATE_WHEN_IDLE;
+	}
+	/* with an exhausted memory budget, we keep spilling as long as there is something */
+	if(   getPhysicalQueueSize(pThis) <= pThis->iLowWtrMrk
+	   && (pThis->iLowWtrMrkBytes == 0 || pThis->iQueueBytes <= pThis->iLowWtrMrkBytes)
+	   && (!qqueueOverMemBudget() || getLogicalQueueSize(pThis) == 0)) {
+		iRet = RS_RET_TERMINATE_NOW;
+	}
+
+	RETiRet;
+}
+
+
+/* must only be called when the queue mutex is locked, else results
+ * are not stable!
+ * If we are a child, we have done our duty when the queue is empty. In that case,
+ * we can terminate. Version for the regular worker thread.
+ */
+static rsRetVal
+ChkStopWrkrReg(qqueue_t *pThis)
+{
+	DEFiRet;
+	/*DBGPRINTF("XXXX: chkStopWrkrReg called, low watermark %d, log Size %d, phys Size %d, bEnqOnly %d\n",
+	pThis->iLowWtrMrk, getLogicalQueueSize(pThis), getPhysicalQueueSize(pThis), pThis->bEnqOnly);*/
+	if(pThis->bEnqOnly) {
+		iRet = RS_RET_TERMINATE_NOW;
+	} else if(pThis->pqParent != NULL) {
+		iRet = RS_RET_TERMINATE_WHEN_IDLE;
+	}
+
+	RETiRet;
+}
+
 
+/* return the configured "deq max at once" interval
+ * rgerhards, 2009-04-22
+ */
+static rsRetVal
+GetDeqBatchSize(qqueue_t *pThis, int *pVal)
+{
+	DEFiRet;
+	assert(pVal != NULL);
+	*pVal = pThis->iDeqBatchSize;
+if(pThis->pqParent != NULL) // TODO: check why we actually do this!
+	*pVal = 16;
 	RETiRet;
 }
 
 
-/* must only be called when the queue mutex is locked, else results
- * are not stable!
- */
-static rsRetVal
-qqueueChkStopWrkrDA(qqueue_t *pThis)
-{
-	DEFiRet;
+/* set up the stats counters and register them with the stats subsystem */
+static rsRetVal
+qqueueConstructStats(qqueue_t *pThis)
+{
+	uchar *qName;
+	double latencyLe[QUEUE_LATENCY_BUCKETS];
+	int i;
+	DEFiRet;
+
+	STATSCOUNTER_INIT(pThis->ctrEnqueued, pThis->mutCtrEnqueued);
+	STATSCOUNTER_INIT(pThis->ctrFull, pThis->mutCtrFull);
+	STATSCOUNTER_INIT(pThis->ctrFDscrd, pThis->mutCtrFDscrd);
+	STATSCOUNTER_INIT(pThis->ctrNFDscrd, pThis->mutCtrNFDscrd);
+	STATSCOUNTER_INIT(pThis->ctrWrkScaleUp, pThis->mutCtrWrkScaleUp);
+	STATSCOUNTER_INIT(pThis->ctrWrkScaleDown, pThis->mutCtrWrkScaleDown);
+	STATSCOUNTER_INIT(pThis->ctrBackpressure, pThis->mutCtrBackpressure);
+	pThis->ctrMaxqsize = 0; /* no mutex needed, thus no init call */
+	INIT_ATOMIC_HELPER_MUT64(pThis->mutLatencyHist);
+	for(i = 0 ; i < QUEUE_LATENCY_BUCKETS ; ++i)
+		pThis->latencyHist[i] = 0;
+
+	/* shards are reported via their parent queue */
+	if(pThis->bIsShard)
+		FINALIZE;
+
+	qName = obj.GetName((obj_t*)pThis);
+	CHKiRet(statsobj.Construct(&pThis->statsobj));
+	CHKiRet(statsobj.SetName(pThis->statsobj, qName));
+	/* we need to save the queue size, as the stats module initializes it to 0! */
+	/* iQueueSize is a dual-use counter: no init, no mutex! */
+	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("size"),
+		ctrType_Int, CTR_FLAG_NONE, &pThis->iQueueSize));
+	if(qqueueIsMemQueue(pThis)) {
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("bytes"),
+			ctrType_IntCtr, CTR_FLAG_NONE, &pThis->iQueueBytes));
+	}
+
+	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("enqueued"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrEnqueued));
+
+	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("full"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrFull));
+
+	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("discarded.full"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrFDscrd));
+	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("discarded.nf"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrNFDscrd));
+
+	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("maxqsize"),
+		ctrType_Int, CTR_FLAG_NONE, &pThis->ctrMaxqsize));
+
+	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("backpressure"),
+		ctrType_Int, CTR_FLAG_NONE, &pThis->bBackpressure));
+	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("backpressure.events"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrBackpressure));
 
-	/*DBGPRINTF("XXXX: chkStopWrkrDA called, low watermark %d, log Size %d, phys Size %d, bEnqOnly %d\n",
-	pThis->iLowWtrMrk, getLogicalQueueSize(pThis), getPhysicalQueueSize(pThis), pThis->bEnqOnly);*/
-	if(pThis->bEnqOnly) {
-		iRet = RS_RET_TERMINATE_WHEN_IDLE;
-	}
-	if(getPhysicalQueueSize(pThis) <= pThis->iLowWtrMrk) {
-		iRet = RS_RET_TERMINATE_NOW;
+	if(pThis->iMinDeqBatchSize > 0) {
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("dequeue.batchsize"),
+			ctrType_Int, CTR_FLAG_NONE, &pThis->iDeqBatchCurr));
 	}
 
-	RETiRet;
-}
+	if(pThis->iWrkLatencyTarget > 0) {
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("workers.target"),
+			ctrType_Int, CTR_FLAG_NONE, &pThis->iWrkTarget));
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("workers.estlatency"),
+			ctrType_Int, CTR_FLAG_NONE, &pThis->iWrkLatencyEst));
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("workers.scaleup"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrWrkScaleUp));
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("workers.scaledown"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrWrkScaleDown));
+	}
 
+	if(pThis->bHugePages) {
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("hugepages.reserved"),
+			ctrType_IntCtr, CTR_FLAG_NONE, &pThis->ctrHugeTLB));
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("hugepages.transparent"),
+			ctrType_IntCtr, CTR_FLAG_NONE, &pThis->ctrHugeTHP));
+	}
 
-/* must only be called when the queue mutex is locked, else results
- * are not stable!
- * If we are a child, we have done our duty when the queue is empty. In that case,
- * we can terminate. Version for the regular worker thread.
- */
-static rsRetVal
-ChkStopWrkrReg(qqueue_t *pThis)
-{
-	DEFiRet;
-	/*DBGPRINTF("XXXX: chkStopWrkrReg called, low watermark %d, log Size %d, phys Size %d, bEnqOnly %d\n",
-	pThis->iLowWtrMrk, getLogicalQueueSize(pThis), getPhysicalQueueSize(pThis), pThis->bEnqOnly);*/
-	if(pThis->bEnqOnly) {
-		iRet = RS_RET_TERMINATE_NOW;
-	} else if(pThis->pqParent != NULL) {
-		iRet = RS_RET_TERMINATE_WHEN_IDLE;
+	if(pThis->bLatencyHist) {
+		for(i = 0 ; i < QUEUE_LATENCY_BUCKETS ; ++i) /* bucket bounds in seconds */
+			latencyLe[i] = (double) (QUEUE_LATENCY_BASE << i) / 1000000.0;
+		CHKiRet(statsobj.AddHistogram(pThis->statsobj, UCHAR_CONSTANT("latency_seconds"),
+			QUEUE_LATENCY_BUCKETS, latencyHistNames, latencyLe, CTR_FLAG_RESETTABLE,
+			pThis->latencyHist));
 	}
 
-	RETiRet;
-}
+	if(pThis->pShards != NULL)
+		CHKiRet(statsobj.SetReadNotifier(pThis->statsobj, qqueueReadShardStats, pThis));
 
+	CHKiRet(statsobj.ConstructFinalize(pThis->statsobj));
 
-/* return the configured "deq max at once" interval
- * rgerhards, 2009-04-22
- */
-static rsRetVal
-GetDeqBatchSize(qqueue_t *pThis, int *pVal)
-{
-	DEFiRet;
-	assert(pVal != NULL);
-	*pVal = pThis->iDeqBatchSize;
-if(pThis->pqParent != NULL) // TODO: check why we actually do this!
-	*pVal = 16;
+finalize_it:
 	RETiRet;
 }
 
@@ -2052,7 +3966,6 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 	uchar pszQIFNam[MAXFNAME];
 	int wrk;
 	int goodval; /* a "good value" to use for comparisons (different objects) */
-	uchar *qName;
 	size_t lenBuf;
 
 	ASSERT(pThis != NULL);
@@ -2067,6 +3980,38 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 		pThis->lenSpoolDir = ustrlen(pThis->pszSpoolDir);
 	}
+	if(pThis->pPartKey != NULL) {
+		if(pThis->qType == QUEUETYPE_DIRECT || pThis->qType == QUEUETYPE_DISK) {
+			errmsg.LogError(0, RS_RET_CONF_PARSE_WARNING, "queue \"%s\": "
+					"queue.partitionkey is only supported for in-memory "
+					"queues - ignored", obj.GetName((obj_t*) pThis));
+			msgPropDescrDestruct(pThis->pPartKey);
+			free(pThis->pPartKey);
+			pThis->pPartKey = NULL;
+		} else {
+			/* one partition per worker, unless told otherwise. Each
+			 * partition must have exactly one worker to keep order.
+			 */
+			if(pThis->nShards == 1)
+				pThis->nShards = pThis->iNumWorkerThreads;
+			pThis->iNumWorkerThreads = pThis->nShards;
+		}
+	}
+	if(pThis->nShards > 1
+	   && (pThis->qType == QUEUETYPE_DIRECT || pThis->qType == QUEUETYPE_DISK)) {
+		errmsg.LogError(0, RS_RET_CONF_PARSE_WARNING, "queue \"%s\": queue.shards "
+				"is only supported for in-memory queues - ignored",
+				obj.GetName((obj_t*) pThis));
+		pThis->nShards = 1;
+	}
+	if(pThis->nLanes > 1
+	   && pThis->qType != QUEUETYPE_FIXED_ARRAY && pThis->qType != QUEUETYPE_LINKEDLIST) {
+		errmsg.LogError(0, RS_RET_CONF_PARSE_WARNING, "queue \"%s\": queue.lanes "
+				"is only supported for FixedArray and LinkedList queues - ignored",
+				obj.GetName((obj_t*) pThis));
+		pThis->nLanes = 1;
+	}
+
 	/* set type-specific handlers and other very type-specific things
 	 * (we can not totally hide it...)
 	 */
@@ -2100,9 +4045,33 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 			pThis->lenQIFNam = snprintf((char*)pszQIFNam, sizeof(pszQIFNam) / sizeof(uchar),
 				"%s/%s.qi", (char*) pThis->pszSpoolDir, (char*)pThis->pszFilePrefix);
 			pThis->pszQIFNam = ustrdup(pszQIFNam);
+			snprintf((char*)pszQIFNam, sizeof(pszQIFNam) / sizeof(uchar), "%s.log",
+				(char*) pThis->pszQIFNam);
+			pThis->pszCkpLogNam = ustrdup(pszQIFNam);
 			DBGOPRINT((obj_t*) pThis, ".qi file name is '%s', len %d\n", pThis->pszQIFNam,
 				(int) pThis->lenQIFNam);
 			break;
+		case QUEUETYPE_LOCKFREE:
+#ifdef HAVE_ATOMIC_BUILTINS
+			pThis->qConstruct = qConstructLockFree;
+			pThis->qDestruct = qDestructLockFree;
+			pThis->qAdd = qAddLockFree;
+			pThis->qDeq = qDeqLockFree;
+			pThis->qDel = qDelLockFree;
+			pThis->MultiEnq = qqueueMultiEnqObjLockFree;
+#else
+			errmsg.LogError(0, RS_RET_OK_WARN, "queue \"%s\": lock-free queue mode "
+				"requires atomic instructions, which are not available on this "
+				"platform - using FixedArray mode instead", obj.GetName((obj_t*) pThis));
+			pThis->qType = QUEUETYPE_FIXED_ARRAY;
+			pThis->qConstruct = qConstructFixedArray;
+			pThis->qDestruct = qDestructFixedArray;
+			pThis->qAdd = qAddFixedArray;
+			pThis->qDeq = qDeqFixedArray;
+			pThis->qDel = qDelFixedArray;
+			pThis->MultiEnq = qqueueMultiEnqObjNonDirect;
+#endif
+			break;
 		case QUEUETYPE_DIRECT:
 			pThis->qConstruct = qConstructDirect;
 			pThis->qDestruct = qDestructDirect;
@@ -2116,8 +4085,28 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 			break;
 	}
 
+	if(pThis->nShards > 1) {
+		/* storage and workers are provided by the shards, see qConstructSharded() */
+		pThis->qConstruct = qConstructSharded;
+		pThis->qDestruct = qDestructSharded;
+		pThis->qAdd = NULL;
+		pThis->qDeq = NULL;
+		pThis->qDel = NULL;
+		pThis->MultiEnq = qqueueMultiEnqObjSharded;
+	} else if(pThis->nLanes > 1) {
+		/* lanes need dynamic storage per lane, so a FixedArray queue
+		 * behaves like a LinkedList one in this case.
+		 */
+		pThis->qConstruct = qConstructLanes;
+		pThis->qDestruct = qDestructLanes;
+		pThis->qAdd = qAddLanes;
+		pThis->qDeq = qDeqLanes;
+		pThis->qDel = qDelLanes;
+	}
+
 	if(pThis->iMaxQueueSize < 100
-	   && (pThis->qType == QUEUETYPE_LINKEDLIST || pThis->qType == QUEUETYPE_FIXED_ARRAY)) {
+	   && (pThis->qType == QUEUETYPE_LINKEDLIST || pThis->qType == QUEUETYPE_FIXED_ARRAY
+	       || pThis->qType == QUEUETYPE_LOCKFREE)) {
 		errmsg.LogError(0, RS_RET_OK_WARN, "Note: queue.size=\"%d\" is very "
 			"low and can lead to unpredictable results. See also "
 			"http://www.rsyslog.com/lower-bound-for-queue-sizes/",
@@ -2214,9 +4203,36 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 		}
 	}
 
+	/* the byte based marks default to the same percentages of queue.maxBytes as
+	 * the message based ones. Without queue.maxBytes, they are only active if
+	 * they are set explicitely.
+	 */
+	if(pThis->iMaxQueueBytes > 0) {
+		if(pThis->iHighWtrMrkBytes <= 0 || pThis->iHighWtrMrkBytes > pThis->iMaxQueueBytes)
+			pThis->iHighWtrMrkBytes = (pThis->iMaxQueueBytes / 100) * 90;
+		if(pThis->iLowWtrMrkBytes <= 0 || pThis->iLowWtrMrkBytes > pThis->iMaxQueueBytes)
+			pThis->iLowWtrMrkBytes = (pThis->iMaxQueueBytes / 100) * 70;
+		if(pThis->iDiscardMrkBytes <= 0 || pThis->iDiscardMrkBytes > pThis->iMaxQueueBytes)
+			pThis->iDiscardMrkBytes = (pThis->iMaxQueueBytes / 100) * 98;
+	}
+	/* DA mode would otherwise be stopped as soon as it was started */
+	if(   pThis->iHighWtrMrkBytes > 0
+	   && (pThis->iLowWtrMrkBytes <= 0 || pThis->iLowWtrMrkBytes > pThis->iHighWtrMrkBytes)) {
+		pThis->iLowWtrMrkBytes = (pThis->iHighWtrMrkBytes / 100) * 70;
+	}
+
 	if(pThis->iMaxQueueSize > 0 && pThis->iDeqBatchSize > pThis->iMaxQueueSize) {
 		pThis->iDeqBatchSize = pThis->iMaxQueueSize;
 	}
+	if(pThis->iMinDeqBatchSize > pThis->iDeqBatchSize) {
+		pThis->iMinDeqBatchSize = pThis->iDeqBatchSize;
+	}
+	if(pThis->iDeqBatchTarget < 1) {
+		pThis->iDeqBatchTarget = 100;
+	}
+	pThis->iDeqBatchCurr = pThis->iDeqBatchSize;
+	pThis->iWrkTarget = 1;
+	pThis->tWrkEval = getMonotonicUsecs();
 
 	/* finalize some initializations that could not yet be done because it is
 	 * influenced by properties which might have been set after queueConstruct ()
@@ -2234,10 +4250,15 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 	pthread_cond_init (&pThis->notFull, NULL);
 	pthread_cond_init (&pThis->belowFullDlyWtrMrk, NULL);
 	pthread_cond_init (&pThis->belowLightDlyWtrMrk, NULL);
+	pthread_cond_init (&pThis->condGrpCommit, NULL);
 
 	/* call type-specific constructor */
 	CHKiRet(pThis->qConstruct(pThis)); /* this also sets bIsDA */
 
+	/* shards and DA queues inherit only the CPU list from their parent */
+	if(pThis->pszCpuSet != NULL && pThis->pCpuSet == NULL)
+		CHKiRet(srCpuSetConstruct(&pThis->pCpuSet, pThis->pszCpuSet));
+
 	/* re-adjust some params if required */
 	if(pThis->bIsDA) {
 		/* if we are in DA mode, we must make sure full delayable messages do not
@@ -2263,6 +4284,20 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 	if(pThis->qType == QUEUETYPE_DIRECT)
 		FINALIZE;	/* with direct queues, we are already finished... */
 
+	if(pThis->pShards != NULL) {
+		/* a sharded queue has no workers of its own, only the summary stats */
+		CHKiRet(qqueueConstructStats(pThis));
+		FINALIZE;
+	}
+
+	/* a shared worker must not be held up by a single queue */
+	if(pThis->bSharedWrkrs && (pThis->iDeqSlowdown != 0 || pThis->iDeqtWinToHr != 25)) {
+		errmsg.LogError(0, RS_RET_PARAM_ERROR, "queue %s: queue.sharedWorkers can not be "
+				"used together with queue.dequeueSlowdown or a dequeue time "
+				"window, using dedicated workers", obj.GetName((obj_t*) pThis));
+		pThis->bSharedWrkrs = 0;
+	}
+
 	/* create worker thread pools for regular and DA operation.
 	 */
 	lenBuf = snprintf((char*)pszBuf, sizeof(pszBuf), "%s:Reg", obj.GetName((obj_t*) pThis));
@@ -2277,6 +4312,10 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 	CHKiRet(wtpSetiNumWorkerThreads	(pThis->pWtpReg, pThis->iNumWorkerThreads));
 	CHKiRet(wtpSettoWrkShutdown	(pThis->pWtpReg, pThis->toWrkShutdown));
 	CHKiRet(wtpSetpUsr		(pThis->pWtpReg, pThis));
+	CHKiRet(wtpSetpCpuSet		(pThis->pWtpReg, pThis->pCpuSet));
+	CHKiRet(wtpSetbShared		(pThis->pWtpReg, pThis->bSharedWrkrs));
+	CHKiRet(wtpSetiSpinMax		(pThis->pWtpReg, pThis->iSpinWait));
+	CHKiRet(wtpSetbHugePages	(pThis->pWtpReg, pThis->bHugePages));
 	CHKiRet(wtpConstructFinalize	(pThis->pWtpReg));
 
 	/* set up DA system if we have a disk-assisted queue */
@@ -2290,35 +4329,7 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 	 */
 	qqueueAdviseMaxWorkers(pThis);
 
-	/* support statistics gathering */
-	qName = obj.GetName((obj_t*)pThis);
-	CHKiRet(statsobj.Construct(&pThis->statsobj));
-	CHKiRet(statsobj.SetName(pThis->statsobj, qName));
-	/* we need to save the queue size, as the stats module initializes it to 0! */
-	/* iQueueSize is a dual-use counter: no init, no mutex! */
-	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("size"),
-		ctrType_Int, CTR_FLAG_NONE, &pThis->iQueueSize));
-
-	STATSCOUNTER_INIT(pThis->ctrEnqueued, pThis->mutCtrEnqueued);
-	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("enqueued"),
-		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrEnqueued));
-
-	STATSCOUNTER_INIT(pThis->ctrFull, pThis->mutCtrFull);
-	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("full"),
-		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrFull));
-
-	STATSCOUNTER_INIT(pThis->ctrFDscrd, pThis->mutCtrFDscrd);
-	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("discarded.full"),
-		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrFDscrd));
-	STATSCOUNTER_INIT(pThis->ctrNFDscrd, pThis->mutCtrNFDscrd);
-	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("discarded.nf"),
-		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrNFDscrd));
-
-	pThis->ctrMaxqsize = 0; /* no mutex needed, thus no init call */
-	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("maxqsize"),
-		ctrType_Int, CTR_FLAG_NONE, &pThis->ctrMaxqsize));
-
-	CHKiRet(statsobj.ConstructFinalize(pThis->statsobj));
+	CHKiRet(qqueueConstructStats(pThis));
 
 finalize_it:
 	RETiRet;
@@ -2354,6 +4365,7 @@ static rsRetVal qqueuePersist(qqueue_t *pThis, int bIsCheckpoint)
 	DBGOPRINT((obj_t*) pThis, "persisting queue to disk, %d entries...\n", getPhysicalQueueSize(pThis));
 
 	if((bIsCheckpoint != QUEUE_CHECKPOINT) && (getPhysicalQueueSize(pThis) == 0)) {
+		CHKiRet(qqueueCkpLogDiscard(pThis));
 		if(pThis->bNeedDelQIF) {
 			unlink((char*)pThis->pszQIFNam);
 			pThis->bNeedDelQIF = 0;
@@ -2364,6 +4376,15 @@ static rsRetVal qqueuePersist(qqueue_t *pThis, int bIsCheckpoint)
 		FINALIZE; /* nothing left to do, so be happy */
 	}
 
+	/* a checkpoint just needs to record the positions if there already is a .qi file */
+	if(   bIsCheckpoint == QUEUE_CHECKPOINT && pThis->bCheckpointLog && pThis->bNeedDelQIF
+	   && pThis->nCkpLogRecs < QUEUE_CKPLOG_MAX_RECS) {
+		if(qqueueCkpLogAppend(pThis) == RS_RET_OK)
+			FINALIZE;
+		DBGOPRINT((obj_t*) pThis, "checkpoint log failed, writing .qi file instead\n");
+	}
+	CHKiRet(qqueueCkpLogDiscard(pThis));
+
 	CHKiRet(strm.Construct(&psQIF));
 	CHKiRet(strm.SettOperationsMode(psQIF, STREAMMODE_WRITE_TRUNC));
 	CHKiRet(strm.SetbSync(psQIF, pThis->bSyncQueueFiles));
@@ -2426,7 +4447,9 @@ static rsRetVal qqueueChkPersist(qqueue_t *pThis, int nUpdates)
 		FINALIZE;
 
 	pThis->iUpdsSincePersist += nUpdates;
-	if(pThis->iPersistUpdCnt && pThis->iUpdsSincePersist >= pThis->iPersistUpdCnt) {
+	/* while the DA worker writes a batch, the next persist is deferred until it is done */
+	if(pThis->iPersistUpdCnt && pThis->iUpdsSincePersist >= pThis->iPersistUpdCnt
+	   && !pThis->tVars.disk.bSpillActive) {
 		qqueuePersist(pThis, QUEUE_CHECKPOINT);
 		pThis->iUpdsSincePersist = 0;
 	}
@@ -2479,6 +4502,9 @@ DoSaveOnShutdown(qqueue_t *pThis)
 /* destructor for the queue object */
 BEGINobjDestruct(qqueue) /* be sure to specify the object type also in END and CODESTART macros! */
 CODESTARTobjDestruct(qqueue)
+	/* shards must go first, they hold all the messages (also if start failed) */
+	qDestructSharded(pThis);
+
 	if(pThis->bQueueStarted) {
 		/* shut down all workers
 		 * We do not need to shutdown workers when we are in enqueue-only mode or we are a
@@ -2518,6 +4544,9 @@ CODESTARTobjDestruct(qqueue)
 		if(pThis->pqDA != NULL) {
 			qqueueDestruct(&pThis->pqDA);
 		}
+		/* the read-ahead thread needs the mutex, which we destroy below */
+		if(pThis->qType == QUEUETYPE_DISK)
+			qDiskStopReadAhead(pThis);
 
 		/* persist the queue (we always do that - queuePersits() does cleanup if the queue is empty)
 		 * This handler is most important for disk queues, it will finally persist the necessary
@@ -2540,9 +4569,13 @@ CODESTARTobjDestruct(qqueue)
 		pthread_cond_destroy(&pThis->notFull);
 		pthread_cond_destroy(&pThis->belowFullDlyWtrMrk);
 		pthread_cond_destroy(&pThis->belowLightDlyWtrMrk);
+		pthread_cond_destroy(&pThis->condGrpCommit);
 
 		DESTROY_ATOMIC_HELPER_MUT(pThis->mutQueueSize);
+		DESTROY_ATOMIC_HELPER_MUT(pThis->mutGrpCommitPending);
 		DESTROY_ATOMIC_HELPER_MUT(pThis->mutLogDeq);
+		DESTROY_ATOMIC_HELPER_MUT64(pThis->mutQueueBytes);
+		DESTROY_ATOMIC_HELPER_MUT(pThis->mutBackpressure);
 
 		/* type-specific destructor */
 		iRet = pThis->qDestruct(pThis);
@@ -2550,6 +4583,14 @@ CODESTARTobjDestruct(qqueue)
 
 	free(pThis->pszFilePrefix);
 	free(pThis->pszSpoolDir);
+	free(pThis->pszCpuSet);
+	free(pThis->pszPartKey);
+	if(pThis->pPartKey != NULL) {
+		msgPropDescrDestruct(pThis->pPartKey);
+		free(pThis->pPartKey);
+	}
+	if(pThis->pCpuSet != NULL)
+		srCpuSetDestruct(&pThis->pCpuSet);
 	if(pThis->useCryprov) {
 		pThis->cryprov.Destruct(&pThis->cryprovData);
 		obj.ReleaseObj(__FILE__, pThis->cryprovNameFull+2, pThis->cryprovNameFull,
@@ -2628,6 +4669,34 @@ finalize_it:
 }
 
 
+/* wait until the queue is no longer full or the timeout tAbs expires. Must
+ * be called with the queue mutex locked. A shard may also be full because
+ * the sharded queue as a whole is. Room made by other shards does not
+ * signal our notFull condition, so in that case we re-check periodically.
+ * Returns 0 if woken up or there is room, ETIMEDOUT otherwise.
+ */
+static int
+qqueueWaitNotFull(qqueue_t *pThis, struct timespec *tAbs)
+{
+	struct timespec t;
+	int bLast;
+	int r;
+
+	if(pThis->pShardParent == NULL)
+		return pthread_cond_timedwait(&pThis->notFull, pThis->mut, tAbs);
+
+	do {
+		timeoutComp(&t, 10);
+		bLast = t.tv_sec > tAbs->tv_sec
+			|| (t.tv_sec == tAbs->tv_sec && t.tv_nsec >= tAbs->tv_nsec);
+		r = pthread_cond_timedwait(&pThis->notFull, pThis->mut, bLast ? tAbs : &t);
+		if(r == 0 || !qqueueShardsFull(pThis))
+			return 0;
+	} while(!bLast);
+	return r;
+}
+
+
 /* enqueue a single data object.
  * Note that the queue mutex MUST already be locked when this function is called.
  * rgerhards, 2009-06-16
@@ -2713,12 +4782,15 @@ doEnqSingleObj(qqueue_t *pThis, flowControl_t flowCtlType, msg_t *pMsg)
 	 * the queue to become ready or drop the new message. -- rgerhards, 2008-03-14
 	 */
 	while(   (pThis->iMaxQueueSize > 0 && pThis->iQueueSize >= pThis->iMaxQueueSize)
+	      || qqueueBytesFull(pThis)
+	      || qqueueShardsFull(pThis)
 	      || ((pThis->qType == QUEUETYPE_DISK || pThis->bIsDA) && pThis->sizeOnDiskMax != 0
 	      	  && pThis->tVars.disk.sizeOnDisk > pThis->sizeOnDiskMax)) {
 		STATSCOUNTER_INC(pThis->ctrFull, pThis->mutCtrFull);
 		if(pThis->toEnq == 0 || pThis->bEnqOnly) {
 			DBGOPRINT((obj_t*) pThis, "doEnqSingleObject: queue FULL - configured for immediate discarding QueueSize=%d "
-				"MaxQueueSize=%d sizeOnDisk=%lld sizeOnDiskMax=%lld\n", pThis->iQueueSize, pThis->iMaxQueueSize,
+				"MaxQueueSize=%d QueueBytes=%lld MaxQueueBytes=%lld sizeOnDisk=%lld sizeOnDiskMax=%lld\n",
+				pThis->iQueueSize, pThis->iMaxQueueSize, pThis->iQueueBytes, pThis->iMaxQueueBytes,
 				pThis->tVars.disk.sizeOnDisk, pThis->sizeOnDiskMax); 
 			STATSCOUNTER_INC(pThis->ctrFDscrd, pThis->mutCtrFDscrd);
 			msgDestruct(&pMsg);
@@ -2730,7 +4802,7 @@ doEnqSingleObj(qqueue_t *pThis, flowControl_t flowCtlType, msg_t *pMsg)
 				ABORT_FINALIZE(RS_RET_FORCE_TERM);
 			}
 			timeoutComp(&t, pThis->toEnq);
-			if(pthread_cond_timedwait(&pThis->notFull, pThis->mut, &t) != 0) {
+			if(qqueueWaitNotFull(pThis, &t) != 0) {
 				DBGOPRINT((obj_t*) pThis, "doEnqSingleObject: cond timeout, dropping message!\n");
 				STATSCOUNTER_INC(pThis->ctrFDscrd, pThis->mutCtrFDscrd);
 				msgDestruct(&pMsg);
@@ -2741,6 +4813,8 @@ doEnqSingleObj(qqueue_t *pThis, flowControl_t flowCtlType, msg_t *pMsg)
 	}
 
 	/* and finally enqueue the message */
+	if(pThis->bLatencyHist && GatherStats)
+		pThis->tEnqCurr = getMonotonicUsecs();
 	CHKiRet(qqueueAdd(pThis, pMsg));
 	STATSCOUNTER_SETMAX_NOMUT(pThis->ctrMaxqsize, pThis->iQueueSize);
 
@@ -2772,13 +4846,20 @@ qqueueMultiEnqObjNonDirect(qqueue_t *pThis, multi_submit_t *pMultiSub)
 	assert(pMultiSub != NULL);
 
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &iCancelStateSave);
+	qqueueGrpCommitAnnounce(pThis);
 	d_pthread_mutex_lock(pThis->mut);
 	for(i = 0 ; i < pMultiSub->nElem ; ++i) {
 		localRet = doEnqSingleObj(pThis, pMultiSub->ppMsgs[i]->flowCtlType, (void*)pMultiSub->ppMsgs[i]);
-		if(localRet != RS_RET_OK && localRet != RS_RET_QUEUE_FULL)
-			ABORT_FINALIZE(localRet);
+		if(localRet != RS_RET_OK && localRet != RS_RET_QUEUE_FULL) {
+			iRet = localRet;
+			break;
+		}
 	}
+	qqueueGrpCommitAdded(pThis);
+	CHKiRet(iRet);
 	qqueueChkPersist(pThis, pMultiSub->nElem);
+	if(pThis->bGrpCommit && pThis->pqParent == NULL)
+		CHKiRet(qqueueGroupCommit(pThis, 1));
 
 finalize_it:
 	/* make sure at least one worker is running. */
@@ -2791,6 +4872,111 @@ finalize_it:
 	RETiRet;
 }
 
+#ifdef HAVE_ATOMIC_BUILTINS
+/* enqueue a single object into a lock-free queue WITHOUT holding the queue
+ * mutex. We can do so as long as the queue is below the mark where flow
+ * control may need to block the caller. If it is above that mark (or the ring
+ * is out of cells), we fall back to the regular, mutex-protected
+ * doEnqSingleObj(), which handles all the flow control and waiting.
+ * *pbNeedAdvise is set if worker threads must be advised, which needs the
+ * mutex and is done by the caller once for the whole batch. This is required
+ * if the queue was empty before (workers may sleep), when the number of
+ * messages justifies an additional worker or when DA mode must be activated.
+ */
+static inline rsRetVal
+doEnqSingleObjLockFree(qqueue_t *pThis, flowControl_t flowCtlType, msg_t *pMsg, int *pbNeedAdvise)
+{
+	int iQueueSize;
+	int iLimit;
+	int prevReady;
+	int nBytes;
+	uint64_t tEnq;
+	DEFiRet;
+
+	if(flowCtlType == eFLOWCTL_FULL_DELAY)
+		iLimit = pThis->iFullDlyMrk;
+	else if(flowCtlType == eFLOWCTL_LIGHT_DELAY)
+		iLimit = pThis->iLightDlyMrk;
+	else
+		iLimit = pThis->iMaxQueueSize;
+
+	iQueueSize = pThis->iQueueSize;
+	if(iQueueSize >= iLimit || qqueueBytesFull(pThis) || qqueueShardsFull(pThis))
+		goto slowpath;
+
+	STATSCOUNTER_INC(pThis->ctrEnqueued, pThis->mutCtrEnqueued);
+	CHKiRet(qqueueChkDiscardMsg(pThis, iQueueSize, pMsg));
+	tEnq = (pThis->bLatencyHist && GatherStats) ? getMonotonicUsecs() : 0;
+	nBytes = qqueueMsgBytes(pMsg);
+	if(qLfPush(pThis, pMsg, tEnq, &prevReady) != RS_RET_OK) {
+		/* ring is out of cells, so we need to wait for room */
+		d_pthread_mutex_lock(pThis->mut);
+		pThis->tEnqCurr = tEnq;
+		iRet = qqueueAdd(pThis, pMsg);
+		d_pthread_mutex_unlock(pThis->mut);
+		*pbNeedAdvise = 1;
+		FINALIZE;
+	}
+
+	qqueueAccountBytes(pThis, nBytes);
+	iQueueSize = ATOMIC_INC_AND_FETCH_int(&pThis->iQueueSize, &pThis->mutQueueSize) + 1;
+	qqueueShardAccount(pThis, 1);
+	STATSCOUNTER_SETMAX_NOMUT(pThis->ctrMaxqsize, iQueueSize);
+	if(   prevReady == 0
+	   || (pThis->bIsDA && qqueueAboveHighWtrMrk(pThis, iQueueSize))
+	   || (pThis->iNumWorkerThreads > 1 && pThis->iMinMsgsPerWrkr > 0
+	       && (prevReady + 1) % pThis->iMinMsgsPerWrkr == 0)) {
+		*pbNeedAdvise = 1;
+	}
+	FINALIZE;
+
+slowpath:
+	d_pthread_mutex_lock(pThis->mut);
+	iRet = doEnqSingleObj(pThis, flowCtlType, pMsg);
+	d_pthread_mutex_unlock(pThis->mut);
+	*pbNeedAdvise = 1;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* multi-enqueue for lock-free queues. Note that we take the mutex only
+ * if it is actually required (see doEnqSingleObjLockFree()).
+ */
+static rsRetVal
+qqueueMultiEnqObjLockFree(qqueue_t *pThis, multi_submit_t *pMultiSub)
+{
+	int iCancelStateSave;
+	int bNeedAdvise = 0;
+	int i;
+	rsRetVal localRet;
+	DEFiRet;
+
+	ISOBJ_TYPE_assert(pThis, qqueue);
+	assert(pMultiSub != NULL);
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &iCancelStateSave);
+	for(i = 0 ; i < pMultiSub->nElem ; ++i) {
+		localRet = doEnqSingleObjLockFree(pThis, pMultiSub->ppMsgs[i]->flowCtlType,
+						  (void*)pMultiSub->ppMsgs[i], &bNeedAdvise);
+		if(localRet != RS_RET_OK && localRet != RS_RET_QUEUE_FULL)
+			ABORT_FINALIZE(localRet);
+	}
+
+finalize_it:
+	if(bNeedAdvise) {
+		d_pthread_mutex_lock(pThis->mut);
+		qqueueAdviseMaxWorkers(pThis);
+		d_pthread_mutex_unlock(pThis->mut);
+		DBGOPRINT((obj_t*) pThis, "MultiEnqObjLockFree advised worker start\n");
+	}
+	pthread_setcancelstate(iCancelStateSave, NULL);
+
+	RETiRet;
+}
+#endif /* #ifdef HAVE_ATOMIC_BUILTINS */
+
 /* now, the same function, but for direct mode */
 static rsRetVal
 qqueueMultiEnqObjDirect(qqueue_t *pThis, multi_submit_t *pMultiSub)
@@ -2809,9 +4995,116 @@ qqueueMultiEnqObjDirect(qqueue_t *pThis, multi_submit_t *pMultiSub)
 finalize_it:
 	RETiRet;
 }
+
+/* keyed partitions: split the batch into one sub-batch per shard, keeping
+ * the order of the messages, and pass each one on to its shard.
+ */
+static rsRetVal
+qqueueMultiEnqObjPartitioned(qqueue_t *pThis, multi_submit_t *pMultiSub)
+{
+	multi_submit_t subBatch;
+	msg_t **ppMsgs = NULL;
+	int *pPart = NULL;
+	int *pEnd;
+	int begin;
+	int i;
+	rsRetVal localRet;
+	DEFiRet;
+
+	CHKmalloc(ppMsgs = malloc(pMultiSub->nElem * sizeof(msg_t*)));
+	CHKmalloc(pPart = calloc(pMultiSub->nElem + pThis->nShards + 1, sizeof(int)));
+	pEnd = pPart + pMultiSub->nElem;
+
+	/* counting sort by partition: pEnd[p+1] counts the messages of
+	 * partition p, then becomes the start of p after summing up, and
+	 * finally its end once all messages have been placed.
+	 */
+	for(i = 0 ; i < pMultiSub->nElem ; ++i) {
+		pPart[i] = getPartition(pThis, pMultiSub->ppMsgs[i]);
+		++pEnd[pPart[i] + 1];
+	}
+	for(i = 1 ; i <= pThis->nShards ; ++i)
+		pEnd[i] += pEnd[i - 1];
+	for(i = 0 ; i < pMultiSub->nElem ; ++i)
+		ppMsgs[pEnd[pPart[i]]++] = pMultiSub->ppMsgs[i];
+
+	begin = 0;
+	for(i = 0 ; i < pThis->nShards ; ++i) {
+		if(pEnd[i] == begin)
+			continue;
+		subBatch.ppMsgs = ppMsgs + begin;
+		subBatch.nElem = subBatch.maxElem = pEnd[i] - begin;
+		localRet = pThis->pShards[i]->MultiEnq(pThis->pShards[i], &subBatch);
+		if(localRet != RS_RET_OK && iRet == RS_RET_OK)
+			iRet = localRet;
+		begin = pEnd[i];
+	}
+
+finalize_it:
+	free(ppMsgs);
+	free(pPart);
+	RETiRet;
+}
+
+/* and the version for sharded queues, which just passes the batch on to
+ * the shard of the current thread.
+ */
+static rsRetVal
+qqueueMultiEnqObjSharded(qqueue_t *pThis, multi_submit_t *pMultiSub)
+{
+	qqueue_t *pShard;
+	DEFiRet;
+
+	ISOBJ_TYPE_assert(pThis, qqueue);
+	if(pThis->pPartKey != NULL) {
+		iRet = qqueueMultiEnqObjPartitioned(pThis, pMultiSub);
+		FINALIZE;
+	}
+	pShard = getShard(pThis);
+	iRet = pShard->MultiEnq(pShard, pMultiSub);
+finalize_it:
+	RETiRet;
+}
 /* ------------------------------ END multi-enqueue functions ------------------------------ */
 
 
+/* check if the queue asks its producers to back off. This is the case
+ * once the queue has reached its full delay mark, and it remains so until
+ * it has drained below the light delay mark. Inputs that can stop reading
+ * (e.g. pause a TCP session or a file) call this before reading more data,
+ * instead of being blocked by flow control in the enqueue path.
+ * The queue size is read without the mutex, so the result is a hint only.
+ * Returns 1 if the producer shall back off, 0 otherwise.
+ */
+int
+qqueueChkBackpressure(qqueue_t *pThis)
+{
+	int iQueueSize;
+
+	if(pThis->qType == QUEUETYPE_DIRECT)
+		return 0;
+
+	/* for sharded queues, this is the size of all shards together */
+	iQueueSize = ATOMIC_FETCH_32BIT(&pThis->iQueueSize, &pThis->mutQueueSize);
+
+	if(ATOMIC_FETCH_32BIT(&pThis->bBackpressure, &pThis->mutBackpressure)) {
+		if(iQueueSize < pThis->iLightDlyMrk
+		   && ATOMIC_CAS(&pThis->bBackpressure, 1, 0, &pThis->mutBackpressure)) {
+			DBGOPRINT((obj_t*) pThis, "backpressure released, queue size %d\n", iQueueSize);
+			return 0;
+		}
+	} else {
+		if(iQueueSize < pThis->iFullDlyMrk)
+			return 0;
+		if(ATOMIC_CAS(&pThis->bBackpressure, 0, 1, &pThis->mutBackpressure)) {
+			STATSCOUNTER_INC(pThis->ctrBackpressure, pThis->mutCtrBackpressure);
+			DBGOPRINT((obj_t*) pThis, "backpressure asserted, queue size %d\n", iQueueSize);
+		}
+	}
+	return ATOMIC_FETCH_32BIT(&pThis->bBackpressure, &pThis->mutBackpressure);
+}
+
+
 /* enqueue a new user data element 
  * Enqueues the new element and awakes worker thread.
  */
@@ -2823,14 +5116,45 @@ qqueueEnqMsg(qqueue_t *pThis, flowControl_t flowCtlType, msg_t *pMsg)
 
 	ISOBJ_TYPE_assert(pThis, qqueue);
 
+	if(pThis->pShards != NULL) {
+		if(pThis->pPartKey != NULL)
+			iRet = qqueueEnqMsg(pThis->pShards[getPartition(pThis, pMsg)],
+					    flowCtlType, pMsg);
+		else
+			iRet = qqueueEnqMsg(getShard(pThis), flowCtlType, pMsg);
+		RETiRet;
+	}
+
+#ifdef HAVE_ATOMIC_BUILTINS
+	if(pThis->qType == QUEUETYPE_LOCKFREE) {
+		int bNeedAdvise = 0;
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &iCancelStateSave);
+		iRet = doEnqSingleObjLockFree(pThis, flowCtlType, pMsg, &bNeedAdvise);
+		if(bNeedAdvise) {
+			d_pthread_mutex_lock(pThis->mut);
+			qqueueAdviseMaxWorkers(pThis);
+			d_pthread_mutex_unlock(pThis->mut);
+		}
+		pthread_setcancelstate(iCancelStateSave, NULL);
+		RETiRet;
+	}
+#endif
+
 	if(pThis->qType != QUEUETYPE_DIRECT) {
 		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &iCancelStateSave);
+		qqueueGrpCommitAnnounce(pThis);
 		d_pthread_mutex_lock(pThis->mut);
 	}
 
-	CHKiRet(doEnqSingleObj(pThis, flowCtlType, pMsg));
+	iRet = doEnqSingleObj(pThis, flowCtlType, pMsg);
+	if(pThis->qType != QUEUETYPE_DIRECT)
+		qqueueGrpCommitAdded(pThis);
+	CHKiRet(iRet);
 
 	qqueueChkPersist(pThis, 1);
+	/* DA queues are committed once per batch by ConsumerDA() */
+	if(pThis->bGrpCommit && pThis->pqParent == NULL)
+		CHKiRet(qqueueGroupCommit(pThis, 1));
 
 finalize_it:
 	if(pThis->qType != QUEUETYPE_DIRECT) {
@@ -2908,6 +5232,74 @@ finalize_it:
 	RETiRet;
 }
 
+
+/* set up the priority lanes from queue.lanes and queue.laneweights.
+ * queue.lanes lists the highest severity of each lane but the last one, in
+ * ascending order, e.g. ["crit", "warning"] creates three lanes: 0..2, 3..4 and
+ * 5..7. If no weights are given, they halve from lane to lane, starting at 8.
+ * On error, the queue is left without lanes.
+ */
+static void
+qqueueCnfLanes(qqueue_t *pThis, struct cnfarray *arLanes, struct cnfarray *arWeights)
+{
+	int sevMax[QUEUE_MAX_LANES];
+	int nLanes;
+	int i;
+	int iSev;
+	uchar *cstr;
+
+	if(arLanes->nmemb >= QUEUE_MAX_LANES) {
+		errmsg.LogError(0, RS_RET_CONF_PARSE_WARNING, "queue \"%s\": queue.lanes "
+				"has %d entries, but at most %d are possible - lanes disabled",
+				obj.GetName((obj_t*) pThis), arLanes->nmemb, QUEUE_MAX_LANES - 1);
+		return;
+	}
+	for(i = 0 ; i < arLanes->nmemb ; ++i) {
+		cstr = (uchar*) es_str2cstr(arLanes->arr[i], NULL);
+		sevMax[i] = decodeSyslogName(cstr, syslogPriNames);
+		if(sevMax[i] < 0 || sevMax[i] > 6 || (i > 0 && sevMax[i] <= sevMax[i-1])) {
+			errmsg.LogError(0, RS_RET_CONF_PARSE_WARNING, "queue \"%s\": queue.lanes "
+					"entry '%s' is invalid, entries must be severities below 7 "
+					"in ascending order - lanes disabled",
+					obj.GetName((obj_t*) pThis), cstr);
+			free(cstr);
+			return;
+		}
+		free(cstr);
+	}
+	nLanes = arLanes->nmemb + 1;
+	sevMax[nLanes - 1] = 7;
+
+	if(arWeights != NULL && arWeights->nmemb != nLanes) {
+		errmsg.LogError(0, RS_RET_CONF_PARSE_WARNING, "queue \"%s\": queue.laneweights "
+				"has %d entries, but there are %d lanes - using default weights",
+				obj.GetName((obj_t*) pThis), arWeights->nmemb, nLanes);
+		arWeights = NULL;
+	}
+	for(i = 0 ; i < nLanes ; ++i) {
+		pThis->laneWeight[i] = (i < 3) ? 8 >> i : 1;
+		if(arWeights != NULL) {
+			cstr = (uchar*) es_str2cstr(arWeights->arr[i], NULL);
+			if(atoi((char*) cstr) > 0) {
+				pThis->laneWeight[i] = atoi((char*) cstr);
+			} else {
+				errmsg.LogError(0, RS_RET_CONF_PARSE_WARNING, "queue \"%s\": "
+						"queue.laneweights entry '%s' is invalid, must be a "
+						"positive number - using %d", obj.GetName((obj_t*) pThis),
+						cstr, pThis->laneWeight[i]);
+			}
+			free(cstr);
+		}
+	}
+
+	for(iSev = 0, i = 0 ; iSev < 8 ; ++iSev) {
+		if(iSev > sevMax[i])
+			++i;
+		pThis->laneOfSev[iSev] = i;
+	}
+	pThis->nLanes = nLanes;
+}
+
 /* apply all params from param block to queue. Must be called before
  * finalizing. This supports the v6 config system. Defaults were already
  * set during queue creation. The pvals object is destructed by this
@@ -2917,7 +5309,10 @@ rsRetVal
 qqueueApplyCnfParam(qqueue_t *pThis, struct nvlst *lst)
 {
 	int i;
+	struct cnfarray *arLanes = NULL;
+	struct cnfarray *arWeights = NULL;
 	struct cnfparamvals *pvals;
+	rsRetVal localRet;
 
 	pvals = nvlstGetParams(lst, &pblk, NULL);
 	if(Debug) {
@@ -2946,6 +5341,10 @@ qqueueApplyCnfParam(qqueue_t *pThis, struct nvlst *lst)
 			pThis->iMaxQueueSize = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.dequeuebatchsize")) {
 			pThis->iDeqBatchSize = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.mindequeuebatchsize")) {
+			pThis->iMinDeqBatchSize = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.dequeuebatchtarget")) {
+			pThis->iDeqBatchTarget = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.maxdiskspace")) {
 			pThis->sizeOnDiskMax = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.highwatermark")) {
@@ -2960,14 +5359,40 @@ qqueueApplyCnfParam(qqueue_t *pThis, struct nvlst *lst)
 			pThis->iDiscardMrk = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.discardseverity")) {
 			pThis->iDiscardSeverity = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.maxbytes")) {
+			pThis->iMaxQueueBytes = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.highwatermarkbytes")) {
+			pThis->iHighWtrMrkBytes = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.lowwatermarkbytes")) {
+			pThis->iLowWtrMrkBytes = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.discardmarkbytes")) {
+			pThis->iDiscardMrkBytes = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.checkpointinterval")) {
 			pThis->iPersistUpdCnt = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.checkpointlog")) {
+			pThis->bCheckpointLog = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.syncqueuefiles")) {
 			pThis->bSyncQueueFiles = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.groupcommit.maxdelay")) {
+			pThis->iGrpCommitDelay = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.groupcommit.maxbytes")) {
+			pThis->iGrpCommitBytes = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.mmap")) {
+			pThis->bMmapFiles = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.ziplevel")) {
+			pThis->iZipLevel = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.type")) {
 			pThis->qType = (queueType_t) pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.workerthreads")) {
 			pThis->iNumWorkerThreads = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.shards")) {
+			pThis->nShards = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.partitionkey")) {
+			pThis->pszPartKey = (uchar*) es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(pblk.descr[i].name, "queue.lanes")) {
+			arLanes = pvals[i].val.d.ar;
+		} else if(!strcmp(pblk.descr[i].name, "queue.laneweights")) {
+			arWeights = pvals[i].val.d.ar;
 		} else if(!strcmp(pblk.descr[i].name, "queue.timeoutshutdown")) {
 			pThis->toQShutdown = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.timeoutactioncompletion")) {
@@ -2978,6 +5403,31 @@ qqueueApplyCnfParam(qqueue_t *pThis, struct nvlst *lst)
 			pThis->toWrkShutdown = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.workerthreadminimummessages")) {
 			pThis->iMinMsgsPerWrkr = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.workerlatencytarget")) {
+			pThis->iWrkLatencyTarget = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.spinwait")) {
+			pThis->iSpinWait = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.readahead")) {
+			pThis->iReadAhead = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.latencyhistogram")) {
+			pThis->bLatencyHist = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.hugepages")) {
+			pThis->bHugePages = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.sharedworkers")) {
+			pThis->bSharedWrkrs = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.cpuset")) {
+			pThis->pszCpuSet = (uchar*) es_str2cstr(pvals[i].val.d.estr, NULL);
+			localRet = srCpuSetConstruct(&pThis->pCpuSet, pThis->pszCpuSet);
+			if(localRet != RS_RET_OK) {
+				if(localRet == RS_RET_NOT_IMPLEMENTED)
+					parser_errmsg("queue.cpuset: binding threads to CPUs is not "
+						      "supported on this platform, ignored");
+				else
+					parser_errmsg("queue.cpuset: invalid CPU list '%s', ignored",
+						      pThis->pszCpuSet);
+				free(pThis->pszCpuSet);
+				pThis->pszCpuSet = NULL;
+			}
 		} else if(!strcmp(pblk.descr[i].name, "queue.maxfilesize")) {
 			pThis->iMaxFileSize = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.saveonshutdown")) {
@@ -2993,6 +5443,11 @@ qqueueApplyCnfParam(qqueue_t *pThis, struct nvlst *lst)
 			  "param '%s'\n", pblk.descr[i].name);
 		}
 	}
+	if(pThis->nShards > 1 && pThis->nShards > pThis->iMaxQueueSize) {
+		parser_errmsg("queue.shards=%d is larger than queue.size=%d, queue "
+			      "is not sharded", pThis->nShards, pThis->iMaxQueueSize);
+		pThis->nShards = 1;
+	}
 	if(pThis->qType == QUEUETYPE_DISK) {
 		if(pThis->pszFilePrefix == NULL) {
 			errmsg.LogError(0, RS_RET_QUEUE_DISK_NO_FN, "error on queue '%s', disk mode selected, but "
@@ -3014,6 +5469,25 @@ qqueueApplyCnfParam(qqueue_t *pThis, struct nvlst *lst)
 		initCryprov(pThis, lst);
 	}
 
+	if(arLanes != NULL) {
+		qqueueCnfLanes(pThis, arLanes, arWeights);
+	} else if(arWeights != NULL) {
+		errmsg.LogError(0, RS_RET_CONF_PARSE_WARNING, "queue \"%s\": queue.laneweights "
+				"has no effect without queue.lanes", obj.GetName((obj_t*) pThis));
+	}
+
+	if(pThis->pszPartKey != NULL) {
+		/* msgPropDescrFill() emits the error message for invalid names */
+		if((pThis->pPartKey = calloc(1, sizeof(msgPropDescr_t))) == NULL
+		   || msgPropDescrFill(pThis->pPartKey, pThis->pszPartKey,
+				       ustrlen(pThis->pszPartKey)) != RS_RET_OK) {
+			free(pThis->pPartKey);
+			pThis->pPartKey = NULL;
+			free(pThis->pszPartKey);
+			pThis->pszPartKey = NULL;
+		}
+	}
+
 	cnfparamvalsDestruct(pvals, &pblk);
 	return RS_RET_OK;
 }
@@ -3021,7 +5495,12 @@ qqueueApplyCnfParam(qqueue_t *pThis, struct nvlst *lst)
 
 /* some simple object access methods */
 DEFpropSetMeth(qqueue, bSyncQueueFiles, int)
+DEFpropSetMeth(qqueue, iGrpCommitDelay, int)
+DEFpropSetMeth(qqueue, iGrpCommitBytes, int64)
+DEFpropSetMeth(qqueue, bMmapFiles, int)
+DEFpropSetMeth(qqueue, iZipLevel, int)
 DEFpropSetMeth(qqueue, iPersistUpdCnt, int)
+DEFpropSetMeth(qqueue, bCheckpointLog, int)
 DEFpropSetMeth(qqueue, iDeqtWinFromHr, int)
 DEFpropSetMeth(qqueue, iDeqtWinToHr, int)
 DEFpropSetMeth(qqueue, toQShutdown, long)
@@ -3037,10 +5516,15 @@ DEFpropSetMeth(qqueue, iLightDlyMrk, int)
 DEFpropSetMeth(qqueue, bIsDA, int)
 DEFpropSetMeth(qqueue, iNumWorkerThreads, int)
 DEFpropSetMeth(qqueue, iMinMsgsPerWrkr, int)
+DEFpropSetMeth(qqueue, iWrkLatencyTarget, int)
+DEFpropSetMeth(qqueue, iReadAhead, int)
+DEFpropSetMeth(qqueue, bLatencyHist, int)
 DEFpropSetMeth(qqueue, bSaveOnShutdown, int)
 DEFpropSetMeth(qqueue, pAction, action_t*)
 DEFpropSetMeth(qqueue, iDeqSlowdown, int)
 DEFpropSetMeth(qqueue, iDeqBatchSize, int)
+DEFpropSetMeth(qqueue, iMinDeqBatchSize, int)
+DEFpropSetMeth(qqueue, iDeqBatchTarget, int)
 DEFpropSetMeth(qqueue, sizeOnDiskMax, int64)
 
 
@@ -3086,6 +5570,9 @@ BEGINObjClassInit(qqueue, 1, OBJ_IS_CORE_MODULE)
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
 	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 
+	pthread_key_create(&keyShardThrd, NULL);
+	INIT_ATOMIC_HELPER_MUT64(mutQueueMemBytes);
+
 	/* now set our own handlers */
 	OBJSetMethodHandler(objMethod_SETPROPERTY, qqueueSetProperty);
 ENDObjClassInit(qqueue)
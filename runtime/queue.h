@@ -46,16 +46,39 @@ typedef enum {
 	QUEUETYPE_FIXED_ARRAY = 0,/* a simple queue made out of a fixed (initially malloced) array fast but memoryhog */
 	QUEUETYPE_LINKEDLIST = 1, /* linked list used as buffer, lower fixed memory overhead but slower */
 	QUEUETYPE_DISK = 2, 	  /* disk files used as buffer */
-	QUEUETYPE_DIRECT = 3 	  /* no queuing happens, consumer is directly called */
+	QUEUETYPE_DIRECT = 3, 	  /* no queuing happens, consumer is directly called */
+	QUEUETYPE_LOCKFREE = 4	  /* fixed array used as bounded MPMC ring, enqueue does not need the queue mutex */
 } queueType_t;
 
 /* list member definition for linked list types of queues: */
 typedef struct qLinkedList_S {
 	struct qLinkedList_S *pNext;
 	msg_t *pMsg;
+	uint64_t tEnq;	/* enqueue time (monotonic usecs) for the latency histogram, 0 if not recorded */
 } qLinkedList_t;
 
 
+/* cell of the lock-free ring. The sequence number tells producers and consumers
+ * if the cell is ready for them (see qAddLockFree() for details).
+ */
+typedef struct qLfCell_s {
+	unsigned long seq;
+	msg_t *pMsg;
+	uint64_t tEnq;	/* enqueue time, see qLinkedList_t */
+} qLfCell_t;
+
+
+/* the latency histogram has log2 buckets. The first boundary is 125us, so
+ * that from 1ms onwards all boundaries are full milliseconds. The last
+ * bucket collects all latencies of 32768ms and above.
+ */
+#define QUEUE_LATENCY_BUCKETS 20
+#define QUEUE_LATENCY_BASE 125	/* usecs */
+
+/* priority lanes are selected by severity, so there can be at most one per severity */
+#define QUEUE_MAX_LANES 8
+
+
 /* the queue object */
 struct queue_s {
 	BEGINobjInstance;
@@ -67,20 +90,41 @@ struct queue_s {
 	sbool	bQueueStarted;	/* has queueStart() been called on this queue? 1-yes, 0-no */
 	int	iQueueSize;	/* Current number of elements in the queue */
 	int	iMaxQueueSize;	/* how large can the queue grow? */
+	int64	iQueueBytes;	/* current size of the (not yet dequeued) messages in bytes, memory queues only */
+	int64	iMaxQueueBytes;	/* how large can the queue grow in bytes? 0 - no limit */
 	int 	iNumWorkerThreads;/* number of worker threads to use */
 	int 	iCurNumWrkThrd;/* current number of active worker threads */
 	int	iMinMsgsPerWrkr;/* minimum nbr of msgs per worker thread, if more, a new worker is started until max wrkrs */
+	int	iWrkLatencyTarget;/* worker scaling: target enqueue-to-dequeue latency (ms), 0 - scale by queue size */
+	int	iSpinWait;	/* max time (usecs) idle workers spin before they block, 0 - do not spin */
+	int	iReadAhead;	/* disk queues: nbr of msgs read ahead by a background thread, 0 - none */
+	int	iWrkTarget;	/* worker scaling: nbr of workers currently desired */
+	int	iWrkLatencyEst;	/* worker scaling: latency (ms) estimated at last evaluation */
+	int	nWrkLowIntervals;/* worker scaling: consecutive intervals with low latency and utilization */
+	uint64_t tWrkEval;	/* worker scaling: time of last evaluation (monotonic usecs) */
+	uint64_t nWrkDeq;	/* worker scaling: nbr of messages dequeued since last evaluation */
+	uint64_t usWrkBusy;	/* worker scaling: consumer busy time since last evaluation */
 	wtp_t	*pWtpDA;
 	wtp_t	*pWtpReg;
 	action_t *pAction;	/* for action queues, ptr to action object; for main queues unused */
 	int	iUpdsSincePersist;/* nbr of queue updates since the last persist call */
 	int	iPersistUpdCnt;	/* persits queue info after this nbr of updates - 0 -> persist only on shutdown */
+	sbool	bCheckpointLog;	/* append checkpoints to a log instead of rewriting the .qi file? */
 	sbool	bSyncQueueFiles;/* if working with files, sync them after each write? */
+	int	iGrpCommitDelay;/* group commit: max ms to wait for more data before syncing (0 - do not wait) */
+	int64	iGrpCommitBytes;/* group commit: sync as soon as this many bytes are unsynced (0 - no limit) */
+	sbool	bGrpCommit;	/* sync queue files in groups instead of after each write? */
+	int	nGrpCommitPending;/* group commit: producers about to add data, see qqueueGroupCommit() */
+	sbool	bMmapFiles;	/* use memory-mapped, preallocated queue file segments? */
+	int	iZipLevel;	/* zlib compression level for queue files, 0 - no compression */
 	int	iHighWtrMrk;	/* high water mark for disk-assisted memory queues */
 	int	iLowWtrMrk;	/* low water mark for disk-assisted memory queues */
 	int	iDiscardMrk;	/* if the queue is above this mark, low-severity messages are discarded */
 	int	iFullDlyMrk;	/* if the queue is above this mark, FULL_DELAYable message are put on hold */
 	int	iLightDlyMrk;	/* if the queue is above this mark, LIGHT_DELAYable message are put on hold */
+	int64	iHighWtrMrkBytes;/* high water mark in bytes (0 - none), see iHighWtrMrk */
+	int64	iLowWtrMrkBytes;/* low water mark in bytes (0 - none), see iLowWtrMrk */
+	int64	iDiscardMrkBytes;/* discard mark in bytes (0 - none), see iDiscardMrk */
 	int	iDiscardSeverity;/* messages of this severity above are discarded on too-full queue */
 	sbool	bNeedDelQIF;	/* does the QIF file need to be deleted when queue becomes empty? */
 	int	toQShutdown;	/* timeout for regular queue shutdown in ms */
@@ -89,6 +133,18 @@ struct queue_s {
 	toDeleteLst_t *toDeleteLst;/* this queue's to-delete list */
 	int	toEnq;		/* enqueue timeout */
 	int	iDeqBatchSize;	/* max number of elements that shall be dequeued at once */
+	int	iMinDeqBatchSize;/* adaptive batching: lower bound for the batch size, 0 - not adaptive */
+	int	iDeqBatchTarget;/* adaptive batching: target time (ms) for processing one batch */
+	int	iDeqBatchCurr;	/* batch size currently in use (iDeqBatchSize if not adaptive) */
+	sbool	bLatencyHist;	/* record enqueue-to-dequeue latency histogram? */
+	sbool	bHugePages;	/* back the queue storage and worker batches by huge pages, if possible */
+	uchar	*pszCpuSet;	/* CPU list to bind workers to, as configured (NULL - unbound) */
+	srCpuSet_t *pCpuSet;	/* the parsed CPU set, shared with our worker thread pools */
+	sbool	bSharedWrkrs;	/* use the shared worker pool instead of own worker threads? */
+	uint64_t tEnqCurr;	/* latency histogram: enqueue time of the message currently being added */
+	uint64_t tDeqEnq;	/* latency histogram: enqueue time of the message just dequeued, 0 if unknown */
+	intctr_t latencyHist[QUEUE_LATENCY_BUCKETS];
+	DEF_ATOMIC_HELPER_MUT64(mutLatencyHist); /* guards all latencyHist buckets */
 	/* rate limiting settings (will be expanded) */
 	int	iDeqSlowdown; /* slow down dequeue by specified nbr of microseconds */
 	/* end rate limiting */
@@ -124,6 +180,7 @@ struct queue_s {
 	pthread_cond_t notFull;
 	pthread_cond_t belowFullDlyWtrMrk; /* below eFLOWCTL_FULL_DELAY watermark */
 	pthread_cond_t belowLightDlyWtrMrk; /* below eFLOWCTL_FULL_DELAY watermark */
+	pthread_cond_t condGrpCommit;	/* group commit: a sync was done or the group is full */
 	int bThrdStateChanged;		/* at least one thread state has changed if 1 */
 	/* end sync variables */
 	/* the following variables are always present, because they
@@ -137,6 +194,10 @@ struct queue_s {
 	size_t lenFilePrefix;
 	uchar *pszQIFNam;	/* full .qi file name, based on parts above */
 	size_t lenQIFNam;
+	uchar *pszCkpLogNam;	/* checkpoint log, .qi file name plus ".log" */
+	int fdCkpLog;		/* checkpoint log, -1 if not open */
+	int nCkpLogRecs;	/* nbr of records in checkpoint log since the .qi file was written */
+	sbool bCkpLogUnsynced;	/* checkpoint log needs to be synced with the next group commit */
 	int iNumberFiles;	/* how many files make up the queue? */
 	int64 iMaxFileSize;	/* max size for a single queue file */
 	int64 sizeOnDiskMax;    /* maximum size on disk allowed */
@@ -146,26 +207,63 @@ struct queue_s {
 	struct queue_s *pqDA;	/* queue for disk-assisted modes */
 	struct queue_s *pqParent;/* pointer to the parent (if this is a child queue) */
 	int	bDAEnqOnly;	/* EnqOnly setting for DA queue */
+	int	nShards;	/* number of sub-queues this queue is split into (1 = not sharded) */
+	struct queue_s **pShards;/* the sub-queues, NULL if not sharded */
+	sbool	bIsShard;	/* is this queue a shard of some other queue? */
+	struct queue_s *pShardParent;/* the sharded queue this shard belongs to, NULL if none */
+	uchar	*pszPartKey;	/* keyed partitions: name of the property messages are routed by */
+	msgPropDescr_t *pPartKey;/* keyed partitions: that property, NULL if not partitioned */
+	int	nLanes;		/* number of priority lanes (1 = no lanes) */
+	uchar	laneOfSev[8];	/* priority lanes: lane index for each severity */
+	int	laneWeight[QUEUE_MAX_LANES]; /* priority lanes: max nbr of msgs dequeued from a lane per turn */
 	/* now follow queueing mode specific data elements */
 	//union {			/* different data elements based on queue type (qType) */
 	struct {			/* different data elements based on queue type (qType) */
 		struct {
 			long deqhead, head, tail;
 			void** pBuf;		/* the queued user data structure */
+			uint64_t *pEnqTime;	/* enqueue times, parallel to pBuf (only with latency histogram) */
+			int memModeBuf;		/* how pBuf and pEnqTime were allocated (SR_HUGE_*) */
+			int memModeEnqTime;
 		} farray;
+		struct {
+			qLfCell_t *cells;	/* the ring itself, size is a power of two */
+			unsigned long mask;	/* ring size - 1 */
+			int memMode;		/* how the ring was allocated (SR_HUGE_*) */
+			unsigned long enqPos;	/* next cell to be claimed by a producer */
+			char pad[64];		/* keep producer and consumer positions in different cache lines */
+			unsigned long deqPos;	/* next cell to be read by a consumer */
+			int nReady;		/* nbr of cells published but not yet dequeued */
+		} lockfree;
 		struct {
 			qLinkedList_t *pDeqRoot;
 			qLinkedList_t *pDelRoot;
 			qLinkedList_t *pLast;
 		} linklist;
+		struct {
+			qLinkedList_t *pDeqRoot[QUEUE_MAX_LANES]; /* per lane, not yet dequeued */
+			qLinkedList_t *pLast[QUEUE_MAX_LANES];
+			qLinkedList_t *pDelRoot; /* dequeued, not yet deleted (in dequeue order) */
+			qLinkedList_t *pDelLast;
+			int iCurrLane;	/* lane currently being served */
+			int nCurrLane;	/* nbr of msgs dequeued from it during this turn */
+		} lanes;
 		struct {
 			int64 sizeOnDisk; /* current amount of disk space used */
 			int64 deqOffs; /* offset after dequeue batch - used for file deleter */
+			int64 deqHintPhys; /* seek hint for deqOffs, handed to the file deleter */
+			int64 deqHintLog;
 			int deqFileNumIn; /* same for the circular file numbers, mainly for  */
 			int deqFileNumOut;/* deleting finished files */
 			strm_t *pWrite;   /* current file to be written */
 			strm_t *pReadDeq; /* current file for dequeueing */
 			strm_t *pReadDel; /* current file for deleting */
+			int64 bytesUnsynced; /* group commit: bytes written since the last sync */
+			unsigned writeGen; /* group commit: incremented on each write */
+			unsigned syncGen;  /* group commit: writeGen covered by the last sync */
+			sbool bSyncActive; /* group commit: is there a group leader? */
+			sbool bSpillActive; /* DA worker writes to pWrite without the queue mutex */
+			struct qDiskReadAhead_s *pReadAhead; /* NULL if queue.readahead is not used */
 		} disk;
 	} tVars;
 	sbool	useCryprov;	/* quicker than checkig ptr (1 vs 8 bytes!) */
@@ -174,14 +272,23 @@ struct queue_s {
 	void *cryprovData; /* opaque data ptr for provider use */
 	uchar 	*cryprovNameFull;/* full internal crypto provider name */
 	DEF_ATOMIC_HELPER_MUT(mutQueueSize);
+	DEF_ATOMIC_HELPER_MUT(mutGrpCommitPending);
 	DEF_ATOMIC_HELPER_MUT(mutLogDeq);
+	DEF_ATOMIC_HELPER_MUT64(mutQueueBytes);
+	int	bBackpressure;	/* producers asked to back off? see qqueueChkBackpressure() */
+	DEF_ATOMIC_HELPER_MUT(mutBackpressure);
 	/* for statistics subsystem */
 	statsobj_t *statsobj;
 	STATSCOUNTER_DEF(ctrEnqueued, mutCtrEnqueued);
 	STATSCOUNTER_DEF(ctrFull, mutCtrFull);
 	STATSCOUNTER_DEF(ctrFDscrd, mutCtrFDscrd);
 	STATSCOUNTER_DEF(ctrNFDscrd, mutCtrNFDscrd);
+	STATSCOUNTER_DEF(ctrWrkScaleUp, mutCtrWrkScaleUp);
+	STATSCOUNTER_DEF(ctrWrkScaleDown, mutCtrWrkScaleDown);
+	STATSCOUNTER_DEF(ctrBackpressure, mutCtrBackpressure);
 	int ctrMaxqsize; /* NOT guarded by a mutex */
+	intctr_t ctrHugeTLB;	/* bytes of queue storage in reserved huge pages (queue.hugePages) */
+	intctr_t ctrHugeTHP;	/* bytes of queue storage with transparent huge pages requested */
 };
 
 
@@ -192,9 +299,16 @@ struct queue_s {
  */
 #define QUEUE_TIMEOUT_ETERNAL 24 * 60 * 60 * 1000
 
+/* process-wide budget for the messages held in all memory queues, in bytes.
+ * If it is exceeded, DA queues start spilling to disk and other queues
+ * discard messages as configured by queue.discardSeverity.
+ */
+extern int64 iQueueMemBudget;	/* global(queue.memorybudget), 0 - no budget */
+
 /* prototypes */
 rsRetVal qqueueDestruct(qqueue_t **ppThis);
 rsRetVal qqueueEnqMsg(qqueue_t *pThis, flowControl_t flwCtlType, msg_t *pMsg);
+int qqueueChkBackpressure(qqueue_t *pThis);
 rsRetVal qqueueStart(qqueue_t *pThis);
 rsRetVal qqueueSetMaxFileSize(qqueue_t *pThis, size_t iMaxFileSize);
 rsRetVal qqueueSetFilePrefix(qqueue_t *pThis, uchar *pszPrefix, size_t iLenPrefix);
@@ -208,7 +322,11 @@ void qqueueDbgPrint(qqueue_t *pThis);
 
 PROTOTYPEObjClassInit(qqueue);
 PROTOTYPEpropSetMeth(qqueue, iPersistUpdCnt, int);
+PROTOTYPEpropSetMeth(qqueue, bCheckpointLog, int);
 PROTOTYPEpropSetMeth(qqueue, bSyncQueueFiles, int);
+PROTOTYPEpropSetMeth(qqueue, iGrpCommitDelay, int);
+PROTOTYPEpropSetMeth(qqueue, iGrpCommitBytes, int64);
+PROTOTYPEpropSetMeth(qqueue, bMmapFiles, int);
 PROTOTYPEpropSetMeth(qqueue, iDeqtWinFromHr, int);
 PROTOTYPEpropSetMeth(qqueue, iDeqtWinToHr, int);
 PROTOTYPEpropSetMeth(qqueue, toQShutdown, long);
@@ -221,12 +339,18 @@ PROTOTYPEpropSetMeth(qqueue, iLowWtrMrk, int);
 PROTOTYPEpropSetMeth(qqueue, iDiscardMrk, int);
 PROTOTYPEpropSetMeth(qqueue, iDiscardSeverity, int);
 PROTOTYPEpropSetMeth(qqueue, iMinMsgsPerWrkr, int);
+PROTOTYPEpropSetMeth(qqueue, iWrkLatencyTarget, int);
+PROTOTYPEpropSetMeth(qqueue, iReadAhead, int);
+PROTOTYPEpropSetMeth(qqueue, bLatencyHist, int);
+PROTOTYPEpropSetMeth(qqueue, iZipLevel, int);
 PROTOTYPEpropSetMeth(qqueue, iNumWorkerThreads, int);
 PROTOTYPEpropSetMeth(qqueue, bSaveOnShutdown, int);
 PROTOTYPEpropSetMeth(qqueue, pAction, action_t*);
 PROTOTYPEpropSetMeth(qqueue, iDeqSlowdown, int);
 PROTOTYPEpropSetMeth(qqueue, sizeOnDiskMax, int64);
 PROTOTYPEpropSetMeth(qqueue, iDeqBatchSize, int);
+PROTOTYPEpropSetMeth(qqueue, iMinDeqBatchSize, int);
+PROTOTYPEpropSetMeth(qqueue, iDeqBatchTarget, int);
 #define qqueueGetID(pThis) ((unsigned long) pThis)
 
 #endif /* #ifndef QUEUE_H_INCLUDED */
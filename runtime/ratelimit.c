@@ -34,6 +34,8 @@
 #include "msg.h"
 #include "rsconf.h"
 #include "dirty.h"
+#include "srUtils.h"
+#include "ruleset.h"
 
 /* definitions for objects we access */
 DEFobjStaticHelpers
@@ -41,6 +43,7 @@ DEFobjCurrIf(errmsg)
 DEFobjCurrIf(glbl)
 DEFobjCurrIf(datetime)
 DEFobjCurrIf(parser)
+DEFobjCurrIf(statsobj)
 
 /* static data */
 
@@ -219,6 +222,14 @@ ratelimitMsg(ratelimit_t *ratelimit, msg_t *pMsg, msg_t **ppRepMsg)
 			ABORT_FINALIZE(RS_RET_DISCARDMSG);
 		}
 	}
+	/* the ratelimit above still applies to messages discarded here, just as
+	 * if they were discarded by the ruleset
+	 */
+	if(ratelimit->stats != NULL && rulesetPrefilterDiscards(pMsg)) {
+		STATSCOUNTER_INC(ratelimit->ctrPrefiltered, ratelimit->mutCtrPrefiltered);
+		msgDestruct(&pMsg);
+		ABORT_FINALIZE(RS_RET_DISCARDMSG);
+	}
 	if(ratelimit->bReduceRepeatMsgs) {
 		CHKiRet(doLastMessageRepeatedNTimes(ratelimit, pMsg, ppRepMsg));
 	}
@@ -301,6 +312,16 @@ ratelimitNew(ratelimit_t **ppThis, char *modname, char *dynname)
 	}
 	/* pThis->severity == 0 - all messages are ratelimited */
 	pThis->bReduceRepeatMsgs = loadConf->globals.bReduceRepeatMsgs;
+	if(bRulesetPrefilter) {
+		snprintf(namebuf, sizeof(namebuf), "%s prefilter", pThis->name);
+		namebuf[sizeof(namebuf)-1] = '\0';
+		STATSCOUNTER_INIT(pThis->ctrPrefiltered, pThis->mutCtrPrefiltered);
+		CHKiRet(statsobj.Construct(&pThis->stats));
+		CHKiRet(statsobj.SetName(pThis->stats, (uchar*) namebuf));
+		CHKiRet(statsobj.AddCounter(pThis->stats, UCHAR_CONSTANT("discarded"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrPrefiltered));
+		CHKiRet(statsobj.ConstructFinalize(pThis->stats));
+	}
 	*ppThis = pThis;
 finalize_it:
 	RETiRet;
@@ -360,15 +381,210 @@ ratelimitDestruct(ratelimit_t *ratelimit)
 		msgDestruct(&ratelimit->pMsg);
 	}
 	tellLostCnt(ratelimit);
+	if(ratelimit->stats != NULL) {
+		statsobj.Destruct(&ratelimit->stats);
+		DESTROY_ATOMIC_HELPER_MUT64(ratelimit->mutCtrPrefiltered);
+	}
 	if(ratelimit->bThreadSafe)
 		pthread_mutex_destroy(&ratelimit->mut);
 	free(ratelimit->name);
 	free(ratelimit);
 }
 
+/* The keyed token-bucket ratelimiter. A bucket's state is packed into a
+ * single 64 bit word, so that it can be updated by a CAS loop without
+ * any lock: the upper 32 bits hold the time of the last refill (in ms
+ * relative to table creation), the lower 32 bits the fill level in
+ * milli-tokens. A state of 0 means "fresh", that is a full bucket. Keys
+ * are identified by a 64 bit hash only; a collision merely lets two keys
+ * share a bucket. Each key may live in one of KEYED_PROBE consecutive
+ * slots. If all of them are in use by other keys, the one whose bucket
+ * has been refilled completely (i.e. its sender was quiet long enough)
+ * is taken over. If there is none, the key is accounted against the
+ * shared overflow bucket, so a flood of new keys cannot push established
+ * senders out of the table.
+ */
+#define KEYED_PROBE 4
+
+#ifdef HAVE_ATOMIC_BUILTINS_64BIT
+#	define KEYED_LOAD(pThis, p) __sync_fetch_and_add((p), 0)
+#	define KEYED_CAS(pThis, p, oldVal, newVal) __sync_bool_compare_and_swap((p), (oldVal), (newVal))
+#else
+static inline uint64
+keyedLoad(ratelimitKeyed_t *pThis, uint64 *p)
+{
+	uint64 v;
+	pthread_mutex_lock(&pThis->mut);
+	v = *p;
+	pthread_mutex_unlock(&pThis->mut);
+	return v;
+}
+static inline int
+keyedCAS(ratelimitKeyed_t *pThis, uint64 *p, uint64 oldVal, uint64 newVal)
+{
+	int r = 0;
+	pthread_mutex_lock(&pThis->mut);
+	if(*p == oldVal) {
+		*p = newVal;
+		r = 1;
+	}
+	pthread_mutex_unlock(&pThis->mut);
+	return r;
+}
+#	define KEYED_LOAD(pThis, p) keyedLoad((pThis), (p))
+#	define KEYED_CAS(pThis, p, oldVal, newVal) keyedCAS((pThis), (p), (oldVal), (newVal))
+#endif
+
+/* FNV-1a, never returns 0 as that marks an unused slot */
+static inline uint64
+keyedHash(uchar *key, size_t lenKey)
+{
+	uint64 h = 14695981039346656037ULL;
+	size_t i;
+	for(i = 0 ; i < lenKey ; ++i) {
+		h ^= key[i];
+		h *= 1099511628211ULL;
+	}
+	return (h == 0) ? 1 : h;
+}
+
+/* compute the fill level (in milli-tokens) of a bucket at time now */
+static inline uint64
+keyedLevel(ratelimitKeyed_t *pThis, uint64 state, unsigned now)
+{
+	uint64 level;
+	const uint64 full = (uint64) pThis->burst * 1000;
+	if(state == 0)
+		return full;
+	level = (state & 0xffffffff) + (uint64)(unsigned)(now - (unsigned)(state >> 32)) * pThis->rate;
+	return (level > full) ? full : level;
+}
+
+/* find the slot for the given hash, claiming one if needed */
+static inline struct ratelimitKeyedSlot_s *
+keyedFindSlot(ratelimitKeyed_t *pThis, uint64 hash, unsigned now)
+{
+	struct ratelimitKeyedSlot_s *slot;
+	uint64 cur;
+	unsigned i;
+	unsigned idx = (unsigned) hash & pThis->mask;
+
+	for(i = 0 ; i < KEYED_PROBE ; ++i) {
+		slot = pThis->slots + ((idx + i) & pThis->mask);
+		cur = KEYED_LOAD(pThis, &slot->hash);
+		if(cur == hash)
+			return slot;
+		if(cur == 0 && KEYED_CAS(pThis, &slot->hash, 0, hash)) {
+			return slot; /* state is still 0 = full */
+		}
+		if(KEYED_LOAD(pThis, &slot->hash) == hash)
+			return slot; /* someone else claimed it for us */
+	}
+	/* no free slot, try to take over an idle one */
+	for(i = 0 ; i < KEYED_PROBE ; ++i) {
+		slot = pThis->slots + ((idx + i) & pThis->mask);
+		cur = KEYED_LOAD(pThis, &slot->hash);
+		if(keyedLevel(pThis, KEYED_LOAD(pThis, &slot->state), now) == (uint64) pThis->burst * 1000
+		   && KEYED_CAS(pThis, &slot->hash, cur, hash)) {
+			return slot; /* bucket is full, so it is as good as a fresh one */
+		}
+	}
+	return &pThis->overflow;
+}
+
+
+/* check if a message with the given key is within the limit. Returns 1 if
+ * so (and consumes a token), 0 if the message should be discarded. This
+ * can be called concurrently from any number of threads.
+ */
+int
+ratelimitKeyedCheck(ratelimitKeyed_t *pThis, uchar *key, size_t lenKey)
+{
+	struct ratelimitKeyedSlot_s *slot;
+	uint64 state, level;
+	unsigned now;
+
+	/* + 1 so that a valid state is never 0 */
+	now = (unsigned) ((getMonotonicUsecs() - pThis->tStart) / 1000) + 1;
+	slot = keyedFindSlot(pThis, keyedHash(key, lenKey), now);
+	do {
+		state = KEYED_LOAD(pThis, &slot->state);
+		level = keyedLevel(pThis, state, now);
+		if(level < 1000) {
+			ATOMIC_INC(&pThis->nDropped, &pThis->mutDropped);
+			return 0;
+		}
+		level -= 1000;
+	} while(!KEYED_CAS(pThis, &slot->state, state, ((uint64) now << 32) | level));
+	return 1;
+}
+
+
+/* create a keyed ratelimiter. rate is the number of messages per second
+ * each key may emit on average, burst the number it may emit at once.
+ * nSlots is the max number of keys tracked individually; it is rounded
+ * up to a power of two.
+ */
+rsRetVal
+ratelimitKeyedNew(ratelimitKeyed_t **ppThis, char *name, unsigned rate, unsigned burst,
+	unsigned nSlots)
+{
+	ratelimitKeyed_t *pThis = NULL;
+	unsigned size;
+	DEFiRet;
+
+	if(burst == 0 || burst > 4000000) {
+		errmsg.LogError(0, RS_RET_INVALID_VALUE, "ratelimiter '%s': burst %u is "
+			"invalid, must be in the range 1..4000000", name, burst);
+		ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+	}
+	for(size = KEYED_PROBE ; size < nSlots && size < (1u << 30) ; size <<= 1)
+		/* just count */;
+	CHKmalloc(pThis = calloc(1, sizeof(ratelimitKeyed_t)));
+	CHKmalloc(pThis->slots = calloc(size, sizeof(struct ratelimitKeyedSlot_s)));
+	CHKmalloc(pThis->name = strdup(name));
+	pThis->rate = rate;
+	pThis->burst = burst;
+	pThis->mask = size - 1;
+	pThis->tStart = getMonotonicUsecs();
+#	ifndef HAVE_ATOMIC_BUILTINS_64BIT
+	pthread_mutex_init(&pThis->mut, NULL);
+#	endif
+	INIT_ATOMIC_HELPER_MUT(pThis->mutDropped);
+	*ppThis = pThis;
+	pThis = NULL;
+
+finalize_it:
+	if(pThis != NULL) {
+		free(pThis->slots);
+		free(pThis);
+	}
+	RETiRet;
+}
+
+
+void
+ratelimitKeyedDestruct(ratelimitKeyed_t *pThis)
+{
+	if(pThis == NULL)
+		return;
+	if(pThis->nDropped > 0) {
+		DBGPRINTF("ratelimiter '%s': %u messages discarded due to rate-limiting\n",
+			  pThis->name, pThis->nDropped);
+	}
+#	ifndef HAVE_ATOMIC_BUILTINS_64BIT
+	pthread_mutex_destroy(&pThis->mut);
+#	endif
+	DESTROY_ATOMIC_HELPER_MUT(pThis->mutDropped);
+	free(pThis->slots);
+	free(pThis->name);
+	free(pThis);
+}
+
 void
 ratelimitModExit(void)
 {
+	objRelease(statsobj, CORE_COMPONENT);
 	objRelease(datetime, CORE_COMPONENT);
 	objRelease(glbl, CORE_COMPONENT);
 	objRelease(errmsg, CORE_COMPONENT);
@@ -384,6 +600,7 @@ ratelimitModInit(void)
 	CHKiRet(objUse(datetime, CORE_COMPONENT));
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
 	CHKiRet(objUse(parser, CORE_COMPONENT));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 finalize_it:
 	RETiRet;
 }
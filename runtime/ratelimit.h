@@ -20,6 +20,8 @@
  */
 #ifndef INCLUDED_RATELIMIT_H
 #define INCLUDED_RATELIMIT_H
+#include "atomic.h"
+#include "statsobj.h"
 
 struct ratelimit_s {
 	char *name;	/**< rate limiter name, e.g. for user messages */
@@ -37,6 +39,34 @@ struct ratelimit_s {
 	sbool bThreadSafe;	/**< do we need to operate in Thread-Safe mode? */
 	sbool bNoTimeCache;	/**< if we shall not used cached reception time */
 	pthread_mutex_t mut;	/**< mutex if thread-safe operation desired */
+	/* input prefilter, see global(input.prefilter) */
+	statsobj_t *stats;	/**< NULL if prefiltering is not enabled */
+	STATSCOUNTER_DEF(ctrPrefiltered, mutCtrPrefiltered);
+};
+
+/* keyed token-bucket ratelimiter. Each key (e.g. a sender address or
+ * program name) gets its own bucket inside a fixed-size table, so the
+ * memory use is bounded no matter how many different keys show up. Keys
+ * for which no slot is available share a single overflow bucket.
+ */
+struct ratelimitKeyedSlot_s {
+	uint64 hash;	/**< hash of the key owning this slot, 0 if unused */
+	uint64 state;	/**< last refill (ms, upper 32 bits) | milli-tokens (lower 32 bits) */
+};
+
+struct ratelimitKeyed_s {
+	char *name;	/**< rate limiter name, for the drop report */
+	unsigned rate;	/**< tokens refilled per second */
+	unsigned burst;	/**< bucket size */
+	unsigned mask;	/**< table size - 1 (size is a power of two) */
+	uint64 tStart;	/**< monotonic base time (usecs) of the table */
+	unsigned nDropped; /**< nbr of msgs rejected */
+	struct ratelimitKeyedSlot_s overflow;
+	struct ratelimitKeyedSlot_s *slots;
+#ifndef HAVE_ATOMIC_BUILTINS_64BIT
+	pthread_mutex_t mut;
+#endif
+	DEF_ATOMIC_HELPER_MUT(mutDropped);
 };
 
 /* prototypes */
@@ -49,6 +79,10 @@ rsRetVal ratelimitMsg(ratelimit_t *ratelimit, msg_t *pMsg, msg_t **ppRep);
 rsRetVal ratelimitAddMsg(ratelimit_t *ratelimit, multi_submit_t *pMultiSub, msg_t *pMsg);
 void ratelimitDestruct(ratelimit_t *pThis);
 int ratelimitChecked(ratelimit_t *ratelimit);
+rsRetVal ratelimitKeyedNew(ratelimitKeyed_t **ppThis, char *name, unsigned rate,
+	unsigned burst, unsigned nSlots);
+int ratelimitKeyedCheck(ratelimitKeyed_t *pThis, uchar *key, size_t lenKey);
+void ratelimitKeyedDestruct(ratelimitKeyed_t *pThis);
 rsRetVal ratelimitModInit(void);
 void ratelimitModExit(void);
 
@@ -25,7 +25,12 @@
 #include "config.h"
 #include <regex.h>
 #include <string.h>
+#include <stdlib.h>
 #include <assert.h>
+#ifdef HAVE_PCRE2
+#	define PCRE2_CODE_UNIT_WIDTH 8
+#	include <pcre2.h>
+#endif
 
 #include "rsyslog.h"
 #include "module-template.h"
@@ -33,15 +38,223 @@
 #include "regexp.h"
 
 MODULE_TYPE_LIB
+#ifdef HAVE_PCRE2
+/* threads keep per-thread data with a destructor in this module */
+MODULE_TYPE_KEEP
+#else
 MODULE_TYPE_NOKEEP
+#endif
 
 /* static data */
 DEFobjStaticHelpers
 
+/* pcreErr value if PCRE was requested but is not available */
+#define PCRE_ERR_NOT_SUPPORTED -1
+
+#ifdef HAVE_PCRE2
+/* Match data and JIT stack are needed for each match, but can not be
+ * shared between threads. So each thread has its own set, which is
+ * grown as needed for the expression with the most captures. The
+ * compiled expressions themselves are read-only when matching and are
+ * shared by all threads.
+ */
+#define PCRE_JIT_STACK_MIN (32 * 1024)
+#define PCRE_JIT_STACK_MAX (512 * 1024)
+typedef struct pcreThrdData_s {
+	pcre2_match_data *md;
+	unsigned nMatch;		/* number of pairs md was created for */
+	pcre2_match_context *mctx;
+	pcre2_jit_stack *jitStack;
+} pcreThrdData_t;
+static pthread_key_t keyPcreThrd;
+
+static void
+pcreThrdDataDestruct(void *p)
+{
+	pcreThrdData_t *const pThrd = (pcreThrdData_t*) p;
+
+	pcre2_match_data_free(pThrd->md);
+	pcre2_match_context_free(pThrd->mctx);
+	pcre2_jit_stack_free(pThrd->jitStack);
+	free(pThrd);
+}
+
+
+/* get the calling thread's match data, large enough for preg */
+static pcreThrdData_t *
+pcreGetThrdData(const rsregex_t *const preg)
+{
+	pcreThrdData_t *pThrd;
+
+	if((pThrd = pthread_getspecific(keyPcreThrd)) == NULL) {
+		if((pThrd = calloc(1, sizeof(pcreThrdData_t))) == NULL)
+			return NULL;
+		pThrd->mctx = pcre2_match_context_create(NULL);
+		pThrd->jitStack = pcre2_jit_stack_create(PCRE_JIT_STACK_MIN, PCRE_JIT_STACK_MAX, NULL);
+		if(pThrd->mctx == NULL || pThrd->jitStack == NULL
+		   || pthread_setspecific(keyPcreThrd, pThrd) != 0) {
+			pcreThrdDataDestruct(pThrd);
+			return NULL;
+		}
+		pcre2_jit_stack_assign(pThrd->mctx, NULL, pThrd->jitStack);
+	}
+
+	if(pThrd->nMatch < preg->nMatch) {
+		pcre2_match_data_free(pThrd->md);
+		if((pThrd->md = pcre2_match_data_create(preg->nMatch, NULL)) == NULL) {
+			pThrd->nMatch = 0;
+			return NULL;
+		}
+		pThrd->nMatch = preg->nMatch;
+	}
+	return pThrd;
+}
+#endif /* #ifdef HAVE_PCRE2 */
+
 
 /* ------------------------------ methods ------------------------------ */
 
 
+/* compile regex into preg. Works like POSIX regcomp(), but compiles a PCRE
+ * instead if RS_REG_PCRE is set in cflags.
+ */
+static int
+rsregcomp(rsregex_t *preg, const char *regex, int cflags)
+{
+#ifdef HAVE_PCRE2
+	uint32_t options = 0;
+	uint32_t nCaptures;
+	PCRE2_SIZE errOffs;
+	int jitRet;
+#endif
+
+	memset(preg, 0, sizeof(rsregex_t));
+	preg->cflags = cflags;
+	if(!(cflags & RS_REG_PCRE))
+		return regcomp(&preg->posix, regex, cflags);
+
+#ifdef HAVE_PCRE2
+	if(cflags & REG_ICASE)
+		options |= PCRE2_CASELESS;
+	if(cflags & REG_NEWLINE)
+		options |= PCRE2_MULTILINE;
+	preg->pcre = pcre2_compile((PCRE2_SPTR) regex, PCRE2_ZERO_TERMINATED, options,
+				   &preg->pcreErr, &errOffs, NULL);
+	if(preg->pcre == NULL) {
+		DBGPRINTF("regexp: PCRE '%s' does not compile at offset %u, error %d\n",
+			  regex, (unsigned) errOffs, preg->pcreErr);
+		return REG_BADPAT;
+	}
+	pcre2_pattern_info(preg->pcre, PCRE2_INFO_CAPTURECOUNT, &nCaptures);
+	preg->nMatch = nCaptures + 1;
+	/* without JIT, matching falls back to the (slower) interpreter */
+	if((jitRet = pcre2_jit_compile(preg->pcre, PCRE2_JIT_COMPLETE)) != 0)
+		DBGPRINTF("regexp: PCRE '%s' is not JIT-compiled, error %d\n", regex, jitRet);
+	return 0;
+#else
+	preg->pcreErr = PCRE_ERR_NOT_SUPPORTED;
+	return REG_BADPAT;
+#endif
+}
+
+
+/* match string against preg, like POSIX regexec(). For PCRE expressions,
+ * pmatch entries for unset or non-existing groups are set to -1.
+ */
+static int
+rsregexec(const rsregex_t *preg, const char *string, size_t nmatch, regmatch_t pmatch[], int eflags)
+{
+#ifdef HAVE_PCRE2
+	pcreThrdData_t *pThrd;
+	PCRE2_SIZE *ovector;
+	uint32_t options = 0;
+	size_t i;
+	int rc;
+#endif
+
+	if(!(preg->cflags & RS_REG_PCRE))
+		return regexec(&preg->posix, string, nmatch, pmatch, eflags);
+
+#ifdef HAVE_PCRE2
+	if(preg->pcre == NULL)
+		return REG_BADPAT; /* compile failed */
+	if((pThrd = pcreGetThrdData(preg)) == NULL)
+		return REG_ESPACE;
+	if(eflags & REG_NOTBOL)
+		options |= PCRE2_NOTBOL;
+	if(eflags & REG_NOTEOL)
+		options |= PCRE2_NOTEOL;
+	rc = pcre2_match(preg->pcre, (PCRE2_SPTR) string, PCRE2_ZERO_TERMINATED, 0, options,
+			 pThrd->md, pThrd->mctx);
+	if(rc < 0) {
+		if(rc == PCRE2_ERROR_NOMATCH)
+			return REG_NOMATCH;
+		DBGPRINTF("regexp: pcre2_match() error %d\n", rc);
+		return REG_ESPACE;
+	}
+
+	if(preg->cflags & REG_NOSUB)
+		nmatch = 0;
+	ovector = pcre2_get_ovector_pointer(pThrd->md);
+	for(i = 0 ; i < nmatch ; ++i) {
+		if(i < (size_t) rc && ovector[2*i] != PCRE2_UNSET) {
+			pmatch[i].rm_so = (regoff_t) ovector[2*i];
+			pmatch[i].rm_eo = (regoff_t) ovector[2*i+1];
+		} else {
+			pmatch[i].rm_so = pmatch[i].rm_eo = -1;
+		}
+	}
+	return 0;
+#else
+	return REG_BADPAT;
+#endif
+}
+
+
+static size_t
+rsregerror(int errcode, const rsregex_t *preg, char *errbuf, size_t errbuf_size)
+{
+	const char *msg;
+	size_t len;
+
+	if(preg == NULL || preg->pcreErr == 0)
+		return regerror(errcode, (preg == NULL) ? NULL : &preg->posix, errbuf, errbuf_size);
+
+	if(preg->pcreErr == PCRE_ERR_NOT_SUPPORTED) {
+		msg = "PCRE support is not compiled in";
+	} else {
+#ifdef HAVE_PCRE2
+		/* pcre2_get_error_message() truncates on its own */
+		if(errbuf_size > 0)
+			pcre2_get_error_message(preg->pcreErr, (PCRE2_UCHAR*) errbuf, errbuf_size);
+		return errbuf_size; /* we do not know the untruncated size */
+#else
+		msg = "unknown PCRE error";
+#endif
+	}
+	len = strlen(msg) + 1;
+	if(errbuf_size > 0) {
+		strncpy(errbuf, msg, errbuf_size - 1);
+		errbuf[errbuf_size - 1] = '\0';
+	}
+	return len;
+}
+
+
+static void
+rsregfree(rsregex_t *preg)
+{
+	if(!(preg->cflags & RS_REG_PCRE)) {
+		regfree(&preg->posix);
+		return;
+	}
+#ifdef HAVE_PCRE2
+	pcre2_code_free(preg->pcre);
+	preg->pcre = NULL;
+#endif
+}
+
+
 
 /* queryInterface function
  * rgerhards, 2008-03-05
@@ -57,10 +270,10 @@ CODESTARTobjQueryInterface(regexp)
 	 * work here (if we can support an older interface version - that,
 	 * of course, also affects the "if" above).
 	 */
-	pIf->regcomp = regcomp;
-	pIf->regexec = regexec;
-	pIf->regerror = regerror;
-	pIf->regfree = regfree;
+	pIf->regcomp = rsregcomp;
+	pIf->regexec = rsregexec;
+	pIf->regerror = rsregerror;
+	pIf->regfree = rsregfree;
 finalize_it:
 ENDobjQueryInterface(regexp)
 
@@ -73,6 +286,10 @@ BEGINAbstractObjClassInit(regexp, 1, OBJ_IS_LOADABLE_MODULE) /* class, version *
 	/* request objects we use */
 
 	/* set our own handlers */
+#ifdef HAVE_PCRE2
+	if(pthread_key_create(&keyPcreThrd, pcreThrdDataDestruct) != 0)
+		ABORT_FINALIZE(RS_RET_ERR);
+#endif
 ENDObjClassInit(regexp)
 
 
@@ -25,14 +25,35 @@
 
 #include <regex.h>
 
+/* cflags bit for regcomp(): compile a PCRE (Perl-compatible) expression
+ * instead of a POSIX one. Such expressions are JIT-compiled if possible.
+ * Requires rsyslog to be built with --enable-pcre, otherwise regcomp()
+ * fails with REG_BADPAT. REG_ICASE and REG_NEWLINE are honored, REG_EXTENDED
+ * is ignored.
+ */
+#define RS_REG_PCRE 0x10000
+
+/* a compiled regular expression. It is used with the functions below just
+ * like a regex_t with the POSIX ones, and behaves the same way no matter
+ * which engine compiled it.
+ */
+typedef struct rsregex_s {
+	regex_t posix;
+	void *pcre;		/* compiled PCRE2 code, NULL for POSIX expressions */
+	int cflags;
+	int pcreErr;		/* PCRE2 error code if compile failed, for regerror() */
+	unsigned nMatch;	/* number of PCRE2 match pairs (captures + 1) */
+} rsregex_t;
+
 /* interfaces */
 BEGINinterface(regexp) /* name must also be changed in ENDinterface macro! */
-	int (*regcomp)(regex_t *preg, const char *regex, int cflags);
-	int (*regexec)(const regex_t *preg, const char *string, size_t nmatch, regmatch_t pmatch[], int eflags);
-	size_t (*regerror)(int errcode, const regex_t *preg, char *errbuf, size_t errbuf_size);
-	void (*regfree)(regex_t *preg);
+	int (*regcomp)(rsregex_t *preg, const char *regex, int cflags);
+	int (*regexec)(const rsregex_t *preg, const char *string, size_t nmatch, regmatch_t pmatch[], int eflags);
+	size_t (*regerror)(int errcode, const rsregex_t *preg, char *errbuf, size_t errbuf_size);
+	void (*regfree)(rsregex_t *preg);
 ENDinterface(regexp)
-#define regexpCURR_IF_VERSION 1 /* increment whenever you change the interface structure! */
+#define regexpCURR_IF_VERSION 2 /* increment whenever you change the interface structure! */
+/* version 2, 2026-10-14: rsregex_t instead of regex_t, added PCRE support */
 
 
 /* prototypes */
@@ -58,6 +58,7 @@
 #include "smtradfile.h"
 #include "smfwd.h"
 #include "smtradfwd.h"
+#include "smbinfwd.h"
 #include "parser.h"
 #include "outchannel.h"
 #include "threads.h"
@@ -89,11 +90,13 @@ static uchar template_TraditionalFileFormat[] = "=RSYSLOG_TraditionalFileFormat"
 static uchar template_FileFormat[] = "=RSYSLOG_FileFormat";
 static uchar template_ForwardFormat[] = "=RSYSLOG_ForwardFormat";
 static uchar template_TraditionalForwardFormat[] = "=RSYSLOG_TraditionalForwardFormat";
+static uchar template_BinaryForwardFormat[] = "=RSYSLOG_BinaryForwardFormat";
 static uchar template_WallFmt[] = "\"\r\n\7Message from syslogd@%HOSTNAME% at %timegenerated% ...\r\n %syslogtag%%msg%\n\r\"";
 static uchar template_StdUsrMsgFmt[] = "\" %syslogtag%%msg%\n\r\"";
 static uchar template_StdDBFmt[] = "\"insert into SystemEvents (Message, Facility, FromHost, Priority, DeviceReportedTime, ReceivedAt, InfoUnitID, SysLogTag) values ('%msg%', %syslogfacility%, '%HOSTNAME%', %syslogpriority%, '%timereported:::date-mysql%', '%timegenerated:::date-mysql%', %iut%, '%syslogtag%')\",SQL";
 static uchar template_StdPgSQLFmt[] = "\"insert into SystemEvents (Message, Facility, FromHost, Priority, DeviceReportedTime, ReceivedAt, InfoUnitID, SysLogTag) values ('%msg%', %syslogfacility%, '%HOSTNAME%', %syslogpriority%, '%timereported:::date-pgsql%', '%timegenerated:::date-pgsql%', %iut%, '%syslogtag%')\",STDSQL";
 static uchar template_spoofadr[] = "\"%fromhost-ip%\"";
+static uchar template_omjournalDfltFormat[] = "\"PRIORITY=%syslogseverity%\nSYSLOG_FACILITY=%syslogfacility%\nSYSLOG_IDENTIFIER=%syslogtag%\nMESSAGE=%msg%\"";
 static uchar template_SysklogdFileFormat[] = "\"%TIMESTAMP% %HOSTNAME% %syslogtag%%msg:::sp-if-no-1st-sp%%msg%\n\"";
 static uchar template_StdJSONFmt[] = "\"{\\\"message\\\":\\\"%msg:::json%\\\",\\\"fromhost\\\":\\\"%HOSTNAME:::json%\\\",\\\"facility\\\":\\\"%syslogfacility-text%\\\",\\\"priority\\\":\\\"%syslogpriority-text%\\\",\\\"timereported\\\":\\\"%timereported:::date-rfc3339%\\\",\\\"timegenerated\\\":\\\"%timegenerated:::date-rfc3339%\\\"}\"";
 /* end templates */
@@ -272,7 +275,7 @@ inputProcessCnf(struct cnfobj *o)
 	cnfparamsPrint(&inppblk, pvals);
 	typeIdx = cnfparamGetIdx(&inppblk, "type");
 	cnfModName = (uchar*)es_str2cstr(pvals[typeIdx].val.d.estr, NULL);
-	if((pMod = module.FindWithCnfName(loadConf, cnfModName, eMOD_IN)) == NULL) {
+	if((pMod = module.FindOrLoadWithCnfName(loadConf, cnfModName, eMOD_IN)) == NULL) {
 		errmsg.LogError(0, RS_RET_MOD_UNKNOWN, "input module name '%s' is unknown", cnfModName);
 		ABORT_FINALIZE(RS_RET_MOD_UNKNOWN);
 	}
@@ -837,6 +840,9 @@ static rsRetVal setMainMsgQueType(void __attribute__((unused)) *pVal, uchar *psz
 	} else if (!strcasecmp((char *) pszType, "direct")) {
 		loadConf->globals.mainQ.MainMsgQueType = QUEUETYPE_DIRECT;
 		DBGPRINTF("main message queue type set to DIRECT (no queueing at all)\n");
+	} else if (!strcasecmp((char *) pszType, "lockfree")) {
+		loadConf->globals.mainQ.MainMsgQueType = QUEUETYPE_LOCKFREE;
+		DBGPRINTF("main message queue type set to LOCKFREE\n");
 	} else {
 		errmsg.LogError(0, RS_RET_INVALID_PARAMS, "unknown mainmessagequeuetype parameter: %s", (char *) pszType);
 		iRet = RS_RET_INVALID_PARAMS;
@@ -983,6 +989,7 @@ loadBuildInModules()
 	CHKiRet(regBuildInModule(modInitsmtradfile, UCHAR_CONSTANT("builtin:smtradfile"), NULL));
 	CHKiRet(regBuildInModule(modInitsmfwd, UCHAR_CONSTANT("builtin:smfwd"), NULL));
 	CHKiRet(regBuildInModule(modInitsmtradfwd, UCHAR_CONSTANT("builtin:smtradfwd"), NULL));
+	CHKiRet(regBuildInModule(modInitsmbinfwd, UCHAR_CONSTANT("builtin:smbinfwd"), NULL));
 
 finalize_it:
 	if(iRet != RS_RET_OK) {
@@ -1138,6 +1145,8 @@ initLegacyConf(void)
 	tplAddLine(ourConf, "RSYSLOG_ForwardFormat", &pTmp);
 	pTmp = template_TraditionalForwardFormat;
 	tplAddLine(ourConf, "RSYSLOG_TraditionalForwardFormat", &pTmp);
+	pTmp = template_BinaryForwardFormat;
+	tplAddLine(ourConf, "RSYSLOG_BinaryForwardFormat", &pTmp);
 	pTmp = template_StdUsrMsgFmt;
 	tplAddLine(ourConf, " StdUsrMsgFmt", &pTmp);
 	pTmp = template_StdDBFmt;
@@ -1148,6 +1157,8 @@ initLegacyConf(void)
         tplAddLine(ourConf, " StdPgSQLFmt", &pTmp);
         pTmp = template_StdJSONFmt;
         tplAddLine(ourConf, " StdJSONFmt", &pTmp);
+        pTmp = template_omjournalDfltFormat;
+        tplAddLine(ourConf, "RSYSLOG_omjournalDfltFormat", &pTmp);
         pTmp = template_spoofadr;
         tplLastStaticInit(ourConf, tplAddLine(ourConf, "RSYSLOG_omudpspoofDfltSourceTpl", &pTmp));
 
@@ -1227,9 +1238,12 @@ ourConf = loadConf; // TODO: remove, once ourConf is gone!
 	}
 	tellLexEndParsing();
 	DBGPRINTF("Number of actions in this configuration: %d\n", iActionNbr);
+	/* the optimizer depends on some global() settings, so these must be
+	 * activated first
+	 */
+	tellCoreConfigLoadDone();
 	rulesetOptimizeAll(loadConf);
 
-	tellCoreConfigLoadDone();
 	tellModulesConfigLoadDone();
 
 	tellModulesCheckConfig();
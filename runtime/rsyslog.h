@@ -44,7 +44,9 @@
  */
 #define CONF_TAG_MAXSIZE		512	/* a value that is deemed far too large for any valid TAG */
 #define CONF_HOSTNAME_MAXSIZE		512	/* a value that is deemed far too large for any valid HOSTNAME */
+#ifndef CONF_RAWMSG_BUFSIZE	/* can be set via ./configure --with-msg-rawbufsize */
 #define CONF_RAWMSG_BUFSIZE		101
+#endif
 #define CONF_TAG_BUFSIZE		32
 #define CONF_PROGNAME_BUFSIZE		16
 #define CONF_HOSTNAME_BUFSIZE		32
@@ -387,6 +389,10 @@ enum rsRetVal_				/** return value. All methods return this if not specified oth
 
 	/* up to 2400 reserved for 7.5 & 7.6 */
 	RS_RET_INVLD_OMOD = -2400, /**< invalid output module, does not provide proper interfaces */
+	RS_RET_QUEUE_REC_INVLD = -2401, /**< invalid binary record in disk queue file */
+	RS_RET_IN_FLIGHT = -2402, /**< output plugin status: transaction accepted, result is reported later (an OK state!) */
+	RS_RET_COMPPROV_ERR = -2403, /**< error in compression provider */
+	RS_RET_CRY_AUTH_FAILED = -2404, /**< authenticated cipher mode: data does not match its tag */
 
 	/* RainerScript error messages (range 1000.. 1999) */
 	RS_RET_SYSVAR_NOT_FOUND = 1001, /**< system variable could not be found (maybe misspelled) */
@@ -507,6 +513,18 @@ struct __attribute__ ((__packed__)) actWrkrIParams {
  */
 #define actParam(param, nActTpls, iMsg, iTpl) (param[(iMsg*nActTpls)+iTpl])
 
+/* handle of an asynchronous transaction, passed to commitTransactionAsync().
+ * If that entry point returns RS_RET_IN_FLIGHT, the module must call
+ * pTx->done(pTx, iRet) exactly once when the transaction is finished, where
+ * iRet is what commitTransaction() would have returned. This may be done from
+ * any thread. The params passed stay valid until done() is called.
+ *
+ * WARNING: THIS STRUCTURE IS PART OF THE ***OUTPUT MODULE INTERFACE***
+ */
+struct actAsyncTx_s {
+	void (*done)(actAsyncTx_t *pTx, rsRetVal iRet);
+};
+
 /* for the time being, we do our own portability handling here. It
  * looks like autotools either does not yet support checks for it, or
  * I wasn't smart enough to find them ;) rgerhards, 2007-07-18
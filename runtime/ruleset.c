@@ -33,6 +33,8 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
+#include <string.h>
 
 #include "rsyslog.h"
 #include "obj.h"
@@ -49,17 +51,30 @@
 #include "srUtils.h"
 #include "modules.h"
 #include "wti.h"
+#include "acmatch.h"
+#include "perfhash.h"
+#include "actpool.h"
+#include "probes.h"
+#include "statsobj.h"
 #include "dirty.h" /* for main ruleset queue creation */
 
 /* static data */
 DEFobjStaticHelpers
 DEFobjCurrIf(errmsg)
 DEFobjCurrIf(parser)
+DEFobjCurrIf(statsobj)
+
+int bRulesetBatchExec = 0;	/* execute batch-safe rulesets batch-wise? set via global() */
+int bRulesetPrefilter = 0;	/* discard by leading stop filters on the input thread? set via global() */
+uchar *pszRulesetProfileFile = NULL;	/* script profile report, NULL if not profiling */
+int iRulesetProfileSampleRate = 64;	/* time one in this many executions */
+static int iProfileShift;		/* log2 of the sample rate (rounded up) */
 
 /* tables for interfacing with the v6 config system (as far as we need to) */
 static struct cnfparamdescr rspdescr[] = {
 	{ "name", eCmdHdlrString, CNFPARAM_REQUIRED },
-	{ "parser", eCmdHdlrArray, 0 }
+	{ "parser", eCmdHdlrArray, 0 },
+	{ "cpuset", eCmdHdlrString, 0 }
 };
 static struct cnfparamblk rspblk =
 	{ CNFPARAMBLK_VERSION,
@@ -70,6 +85,7 @@ static struct cnfparamblk rspblk =
 /* forward definitions */
 static rsRetVal processBatch(batch_t *pBatch, wti_t *pWti);
 static rsRetVal scriptExec(struct cnfstmt *root, msg_t *pMsg, wti_t *pWti);
+static rsRetVal scriptExecBatch(struct cnfstmt *root, batch_t *pBatch, sbool *active, wti_t *pWti);
 
 
 /* ---------- linked-list key handling functions (ruleset) ---------- */
@@ -90,6 +106,7 @@ static void
 scriptIterateAllActions(struct cnfstmt *root, rsRetVal (*pFunc)(void*, void*), void* pParam)
 {
 	struct cnfstmt *stmt;
+	int i;
 	for(stmt = root ; stmt != NULL ; stmt = stmt->next) {
 		switch(stmt->nodetype) {
 		case S_NOP:
@@ -120,6 +137,18 @@ scriptIterateAllActions(struct cnfstmt *root, rsRetVal (*pFunc)(void*, void*), v
 			scriptIterateAllActions(stmt->d.s_propfilt.t_then,
 						pFunc, pParam);
 			break;
+		case S_MULTIFILT:
+			scriptIterateAllActions(stmt->d.s_multifilt.members,
+						pFunc, pParam);
+			break;
+		case S_SWITCH:
+			for(i = 0 ; i < stmt->d.s_switch.nCases ; ++i)
+				scriptIterateAllActions(stmt->d.s_switch.cases[i],
+							pFunc, pParam);
+			if(stmt->d.s_switch.t_else != NULL)
+				scriptIterateAllActions(stmt->d.s_switch.t_else,
+							pFunc, pParam);
+			break;
 		default:
 			dbgprintf("error: unknown stmt type %u during iterateAll\n",
 				(unsigned) stmt->nodetype);
@@ -246,11 +275,9 @@ finalize_it:
 }
 
 static rsRetVal
-execIf(struct cnfstmt *stmt, msg_t *pMsg, wti_t *pWti)
+execIfBranch(struct cnfstmt *stmt, sbool bRet, msg_t *pMsg, wti_t *pWti)
 {
-	sbool bRet;
 	DEFiRet;
-	bRet = cnfexprEvalBool(stmt->d.s_if.expr, pMsg);
 	DBGPRINTF("if condition result is %d\n", bRet);
 	if(bRet) {
 		if(stmt->d.s_if.t_then != NULL)
@@ -264,16 +291,33 @@ finalize_it:
 }
 
 static rsRetVal
-execPRIFILT(struct cnfstmt *stmt, msg_t *pMsg, wti_t *pWti)
+execIf(struct cnfstmt *stmt, msg_t *pMsg, wti_t *pWti)
+{
+	sbool bRet;
+	if(stmt->d.s_if.prog != NULL)
+		bRet = cnfexprprogEvalBool(stmt->d.s_if.prog, pMsg);
+	else
+		bRet = cnfexprEvalBool(stmt->d.s_if.expr, pMsg);
+	return execIfBranch(stmt, bRet, pMsg, pWti);
+}
+
+static inline int
+evalPRIFILT(struct cnfstmt *stmt, msg_t *pMsg)
 {
-	int bRet;
-	DEFiRet;
 	if( (stmt->d.s_prifilt.pmask[pMsg->iFacility] == TABLE_NOPRI) ||
 	   ((stmt->d.s_prifilt.pmask[pMsg->iFacility]
 		    & (1<<pMsg->iSeverity)) == 0) )
-		bRet = 0;
+		return 0;
 	else
-		bRet = 1;
+		return 1;
+}
+
+static rsRetVal
+execPRIFILT(struct cnfstmt *stmt, msg_t *pMsg, wti_t *pWti)
+{
+	int bRet;
+	DEFiRet;
+	bRet = evalPRIFILT(stmt, pMsg);
 
 	DBGPRINTF("PRIFILT condition result is %d\n", bRet);
 	if(bRet) {
@@ -333,6 +377,11 @@ evalPROPFILT(struct cnfstmt *stmt, msg_t *pMsg)
 				  (unsigned char*) pszPropVal, 1, &stmt->d.s_propfilt.regex_cache) == RS_RET_OK)
 			bRet = 1;
 		break;
+	case FIOP_PCREREGEX:
+		if(rsCStrSzStrMatchRegex(stmt->d.s_propfilt.pCSCompValue,
+				  (unsigned char*) pszPropVal, 2, &stmt->d.s_propfilt.regex_cache) == RS_RET_OK)
+			bRet = 1;
+		break;
 	default:
 		/* here, it handles NOP (for performance reasons) */
 		assert(stmt->d.s_propfilt.operation == FIOP_NOP);
@@ -393,6 +442,117 @@ finalize_it:
 	RETiRet;
 }
 
+/* find all patterns of a multi-pattern filter in the message */
+static void
+evalMULTIFILT(struct cnfstmt *stmt, msg_t *pMsg, uint64_t *matched)
+{
+	unsigned short pbMustBeFreed;
+	uchar *pszPropVal;
+	rs_size_t propLen;
+
+	pszPropVal = MsgGetProp(pMsg, NULL, stmt->d.s_multifilt.prop,
+				&propLen, &pbMustBeFreed, NULL);
+	acmatchExec(stmt->d.s_multifilt.matcher, pszPropVal, propLen, matched);
+	if(pbMustBeFreed)
+		free(pszPropVal);
+}
+
+/* result of member filter i of a multi-pattern filter */
+static inline sbool
+multiFiltResult(struct cnfstmt *member, uint64_t *matched, int i)
+{
+	sbool bRet = ACMATCH_ISSET(matched, i);
+	if(member->nodetype == S_PROPFILT && member->d.s_propfilt.isNegated)
+		bRet = !bRet;
+	return bRet;
+}
+
+static rsRetVal
+execMULTIFILT(struct cnfstmt *stmt, msg_t *pMsg, wti_t *pWti)
+{
+	uint64_t matched[ACMATCH_WORDS];
+	struct cnfstmt *member;
+	sbool bRet;
+	int i;
+	DEFiRet;
+
+	evalMULTIFILT(stmt, pMsg, matched);
+	for(member = stmt->d.s_multifilt.members, i = 0 ; member != NULL ; member = member->next, ++i) {
+		if(Debug) {
+			cnfstmtPrintOnly(member, 2, 0);
+		}
+		bRet = multiFiltResult(member, matched, i);
+		if(member->nodetype == S_IF) {
+			CHKiRet(execIfBranch(member, bRet, pMsg, pWti));
+		} else {
+			DBGPRINTF("PROPFILT condition result is %d\n", bRet);
+			if(bRet)
+				CHKiRet(scriptExec(member->d.s_propfilt.t_then, pMsg, pWti));
+		}
+	}
+finalize_it:
+	RETiRet;
+}
+
+/* return the case selected by a switch, -1 if none */
+static int
+evalSWITCH(struct cnfstmt *stmt, msg_t *pMsg)
+{
+	unsigned short pbMustBeFreed;
+	uchar *pszPropVal;
+	rs_size_t propLen;
+	int iCase;
+
+	pszPropVal = MsgGetProp(pMsg, NULL, stmt->d.s_switch.prop,
+				&propLen, &pbMustBeFreed, NULL);
+	iCase = perfhashLookup(stmt->d.s_switch.hash, pszPropVal, propLen);
+	if(pbMustBeFreed)
+		free(pszPropVal);
+	return iCase;
+}
+
+static rsRetVal
+execSWITCH(struct cnfstmt *stmt, msg_t *pMsg, wti_t *pWti)
+{
+	int iCase;
+	DEFiRet;
+
+	iCase = evalSWITCH(stmt, pMsg);
+	DBGPRINTF("SWITCH selected case %d\n", iCase);
+	if(iCase != -1) {
+		CHKiRet(scriptExec(stmt->d.s_switch.cases[iCase]->d.s_if.t_then, pMsg, pWti));
+	} else if(stmt->d.s_switch.t_else != NULL) {
+		CHKiRet(scriptExec(stmt->d.s_switch.t_else, pMsg, pWti));
+	}
+finalize_it:
+	RETiRet;
+}
+
+/* Script profiler, enabled by global(script.profile.file).
+ * Each statement counts the messages it is executed for, and one in
+ * iRulesetProfileSampleRate executions is timed, so that the overhead of
+ * reading the clock is only paid for a small part of the messages. The
+ * counters are updated without synchronization, so with several worker
+ * threads some updates may get lost. That's fine for a profile and much
+ * cheaper than atomic instructions. Returns the start time if this
+ * execution is to be timed, 0 otherwise.
+ */
+static inline uint64_t
+profileBegin(struct cnfstmtprof *prof, int n)
+{
+	const unsigned long long nPrev = prof->nExec;
+
+	prof->nExec += n;
+	return ((nPrev >> iProfileShift) == (prof->nExec >> iProfileShift)) ? 0 : getMonotonicNsecs();
+}
+
+static inline void
+profileEnd(struct cnfstmtprof *prof, int n, uint64_t tBegin)
+{
+	prof->nsTimed += getMonotonicNsecs() - tBegin;
+	prof->nTimed += n;
+}
+
 /* The rainerscript execution engine. It is debatable if that would be better
  * contained in grammer/rainerscript.c, HOWEVER, that file focusses primarily
  * on the parsing and object creation part. So as an actual executor, it is
@@ -403,6 +563,7 @@ static rsRetVal
 scriptExec(struct cnfstmt *root, msg_t *pMsg, wti_t *pWti)
 {
 	struct cnfstmt *stmt;
+	uint64_t tBegin;
 	DEFiRet;
 
 	for(stmt = root ; stmt != NULL ; stmt = stmt->next) {
@@ -414,6 +575,7 @@ scriptExec(struct cnfstmt *root, msg_t *pMsg, wti_t *pWti)
 		if(Debug) {
 			cnfstmtPrintOnly(stmt, 2, 0);
 		}
+		tBegin = (stmt->prof == NULL) ? 0 : profileBegin(stmt->prof, 1);
 		switch(stmt->nodetype) {
 		case S_NOP:
 			break;
@@ -424,9 +586,11 @@ scriptExec(struct cnfstmt *root, msg_t *pMsg, wti_t *pWti)
 			CHKiRet(execAct(stmt, pMsg, pWti));
 			break;
 		case S_SET:
+			wtiTplCacheInvalidate(pWti);
 			CHKiRet(execSet(stmt, pMsg));
 			break;
 		case S_UNSET:
+			wtiTplCacheInvalidate(pWti);
 			CHKiRet(execUnset(stmt, pMsg));
 			break;
 		case S_CALL:
@@ -441,16 +605,482 @@ scriptExec(struct cnfstmt *root, msg_t *pMsg, wti_t *pWti)
 		case S_PROPFILT:
 			CHKiRet(execPROPFILT(stmt, pMsg, pWti));
 			break;
+		case S_MULTIFILT:
+			CHKiRet(execMULTIFILT(stmt, pMsg, pWti));
+			break;
+		case S_SWITCH:
+			CHKiRet(execSWITCH(stmt, pMsg, pWti));
+			break;
+		default:
+			dbgprintf("error: unknown stmt type %u during exec\n",
+				(unsigned) stmt->nodetype);
+			break;
+		}
+		if(tBegin != 0)
+			profileEnd(stmt->prof, 1, tBegin);
+	}
+finalize_it:
+	RETiRet;
+}
+
+
+/* Batch execution engine.
+ * Instead of running the whole script for one message after the other,
+ * each statement is executed for all messages of the batch before moving
+ * on to the next one. Which messages a statement applies to is kept in
+ * the "active" array (one entry per batch element). Filters split it into
+ * a "then" and an "else" set, and a message that hits "stop" is removed
+ * from it. This saves the per-message dispatch over the statement tree
+ * and keeps the code of each statement hot while the batch is processed.
+ * As actions now see all messages for one statement before the next
+ * statement is executed, the order in which *different* actions see the
+ * messages changes (each action still receives them in order). So this
+ * mode must be enabled by the user and is only used for scripts where it
+ * does not change any other semantics, see scriptIsBatchSafe().
+ */
+static inline sbool *
+newActive(batch_t *pBatch, int nSets)
+{
+	return calloc(batchNumMsgs(pBatch) * nSets, sizeof(sbool));
+}
+
+static inline ruleset_t *
+batchElemRuleset(batch_t *pBatch, int i)
+{
+	msg_t *pMsg = pBatch->pElem[i].pMsg;
+	return (pMsg->pRuleset == NULL) ? ourConf->rulesets.pDflt : pMsg->pRuleset;
+}
+
+static rsRetVal
+execIfBatch(struct cnfstmt *stmt, batch_t *pBatch, sbool *active, wti_t *pWti)
+{
+	sbool *thenAct, *elseAct;
+	int i;
+	int nThen = 0, nElse = 0;
+	DEFiRet;
+
+	CHKmalloc(thenAct = newActive(pBatch, 2));
+	elseAct = thenAct + batchNumMsgs(pBatch);
+	for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i) {
+		if(!active[i])
+			continue;
+		if(stmt->d.s_if.prog != NULL ? cnfexprprogEvalBool(stmt->d.s_if.prog, pBatch->pElem[i].pMsg)
+					     : cnfexprEvalBool(stmt->d.s_if.expr, pBatch->pElem[i].pMsg)) {
+			thenAct[i] = 1;
+			++nThen;
+		} else {
+			elseAct[i] = 1;
+			++nElse;
+		}
+	}
+	DBGPRINTF("if condition result: %d then, %d else\n", nThen, nElse);
+	if(nThen > 0 && stmt->d.s_if.t_then != NULL)
+		CHKiRet(scriptExecBatch(stmt->d.s_if.t_then, pBatch, thenAct, pWti));
+	if(nElse > 0 && stmt->d.s_if.t_else != NULL)
+		CHKiRet(scriptExecBatch(stmt->d.s_if.t_else, pBatch, elseAct, pWti));
+	/* messages stopped in one of the branches are no longer active */
+	for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i)
+		if(active[i])
+			active[i] = thenAct[i] | elseAct[i];
+finalize_it:
+	free(thenAct);
+	RETiRet;
+}
+
+static rsRetVal
+execPRIFILTBatch(struct cnfstmt *stmt, batch_t *pBatch, sbool *active, wti_t *pWti)
+{
+	sbool *thenAct, *elseAct;
+	msg_t *pMsg;
+	int i;
+	DEFiRet;
+
+	CHKmalloc(thenAct = newActive(pBatch, 2));
+	elseAct = thenAct + batchNumMsgs(pBatch);
+	for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i) {
+		pMsg = pBatch->pElem[i].pMsg;
+		thenAct[i] = active[i] & ((stmt->d.s_prifilt.pmask[pMsg->iFacility] & (1<<pMsg->iSeverity)) != 0);
+		elseAct[i] = active[i] & !thenAct[i];
+	}
+	if(stmt->d.s_prifilt.t_then != NULL)
+		CHKiRet(scriptExecBatch(stmt->d.s_prifilt.t_then, pBatch, thenAct, pWti));
+	if(stmt->d.s_prifilt.t_else != NULL)
+		CHKiRet(scriptExecBatch(stmt->d.s_prifilt.t_else, pBatch, elseAct, pWti));
+	for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i)
+		active[i] = thenAct[i] | elseAct[i];
+finalize_it:
+	free(thenAct);
+	RETiRet;
+}
+
+static rsRetVal
+execPROPFILTBatch(struct cnfstmt *stmt, batch_t *pBatch, sbool *active, wti_t *pWti)
+{
+	sbool *thenAct;
+	int i;
+	DEFiRet;
+
+	CHKmalloc(thenAct = newActive(pBatch, 1));
+	for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i) {
+		if(active[i] && evalPROPFILT(stmt, pBatch->pElem[i].pMsg)) {
+			thenAct[i] = 1;
+			active[i] = 0; /* re-activated below if not stopped */
+		}
+	}
+	CHKiRet(scriptExecBatch(stmt->d.s_propfilt.t_then, pBatch, thenAct, pWti));
+	for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i)
+		active[i] |= thenAct[i];
+finalize_it:
+	free(thenAct);
+	RETiRet;
+}
+
+/* the member filters only need the automaton run once per message, so we
+ * keep the results for the whole batch
+ */
+static rsRetVal
+execMULTIFILTBatch(struct cnfstmt *stmt, batch_t *pBatch, sbool *active, wti_t *pWti)
+{
+	uint64_t *matched = NULL;
+	sbool *thenAct = NULL, *elseAct;
+	struct cnfstmt *member;
+	sbool bRet;
+	int i, k;
+	DEFiRet;
+
+	CHKmalloc(matched = malloc(batchNumMsgs(pBatch) * ACMATCH_WORDS * sizeof(uint64_t)));
+	CHKmalloc(thenAct = newActive(pBatch, 2));
+	elseAct = thenAct + batchNumMsgs(pBatch);
+	for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i)
+		if(active[i])
+			evalMULTIFILT(stmt, pBatch->pElem[i].pMsg, matched + i * ACMATCH_WORDS);
+	for(member = stmt->d.s_multifilt.members, k = 0 ; member != NULL ; member = member->next, ++k) {
+		for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i) {
+			bRet = active[i] && multiFiltResult(member, matched + i * ACMATCH_WORDS, k);
+			thenAct[i] = bRet;
+			elseAct[i] = active[i] && !bRet;
+		}
+		if(member->nodetype == S_IF) {
+			if(member->d.s_if.t_then != NULL)
+				CHKiRet(scriptExecBatch(member->d.s_if.t_then, pBatch, thenAct, pWti));
+			if(member->d.s_if.t_else != NULL)
+				CHKiRet(scriptExecBatch(member->d.s_if.t_else, pBatch, elseAct, pWti));
+		} else {
+			CHKiRet(scriptExecBatch(member->d.s_propfilt.t_then, pBatch, thenAct, pWti));
+		}
+		for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i)
+			active[i] = thenAct[i] | elseAct[i];
+	}
+finalize_it:
+	free(matched);
+	free(thenAct);
+	RETiRet;
+}
+
+/* messages are grouped by the case they select, and each group runs
+ * through its branch in one go
+ */
+static rsRetVal
+execSWITCHBatch(struct cnfstmt *stmt, batch_t *pBatch, sbool *active, wti_t *pWti)
+{
+	int *sel = NULL;
+	sbool *caseAct = NULL;
+	struct cnfstmt *branch;
+	int i, j, iCase;
+	DEFiRet;
+
+	CHKmalloc(sel = malloc(batchNumMsgs(pBatch) * sizeof(int)));
+	CHKmalloc(caseAct = newActive(pBatch, 1));
+	for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i)
+		sel[i] = active[i] ? evalSWITCH(stmt, pBatch->pElem[i].pMsg) : -2;
+	for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i) {
+		if(sel[i] == -2)
+			continue;
+		iCase = sel[i];
+		for(j = i ; j < batchNumMsgs(pBatch) ; ++j) {
+			if(sel[j] == iCase) {
+				caseAct[j] = 1;
+				active[j] = 0; /* re-activated below if not stopped */
+				sel[j] = -2;
+			}
+		}
+		branch = (iCase == -1) ? stmt->d.s_switch.t_else : stmt->d.s_switch.cases[iCase]->d.s_if.t_then;
+		CHKiRet(scriptExecBatch(branch, pBatch, caseAct, pWti));
+		for(j = i ; j < batchNumMsgs(pBatch) ; ++j) {
+			active[j] |= caseAct[j];
+			caseAct[j] = 0;
+		}
+	}
+finalize_it:
+	free(sel);
+	free(caseAct);
+	RETiRet;
+}
+
+/* Parallel action groups (global(script.parallelactions)). Consecutive
+ * actions that do not depend on each other are handed to the actpool,
+ * each one for all active messages of the batch, and joined before the
+ * next statement is executed. The actions of a group must run in the
+ * worker's context (direct queue), must not modify the message or discard
+ * it and must not depend on the state of the previous action, see
+ * actIsParallelSafe(). Such actions never change the active set.
+ */
+#define ACTGROUP_MAX 16	/* max number of actions run in parallel */
+
+struct actGroupTask {
+	struct cnfstmt *stmt;
+	batch_t *pBatch;
+	sbool *active;
+	int nActive;
+};
+
+static void
+execActGroupTask(void *pParam, wti_t *pWti)
+{
+	struct actGroupTask *const t = (struct actGroupTask*) pParam;
+	uint64_t tBegin;
+	int i;
+
+	tBegin = (t->stmt->prof == NULL) ? 0 : profileBegin(t->stmt->prof, t->nActive);
+	for(i = 0 ; i < batchNumMsgs(t->pBatch) ; ++i) {
+		if(t->active[i])
+			execAct(t->stmt, t->pBatch->pElem[i].pMsg, pWti);
+	}
+	if(tBegin != 0)
+		profileEnd(t->stmt->prof, t->nActive, tBegin);
+}
+
+static void
+execActGroupBatch(struct cnfstmt *stmt, batch_t *pBatch, sbool *active, wti_t *pWti)
+{
+	struct actGroupTask t[ACTGROUP_MAX];
+	actpoolTask_t tasks[ACTGROUP_MAX];
+	const int nTasks = stmt->nActGroup;
+	int nActive = 0;
+	int i;
+
+	for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i)
+		nActive += active[i];
+	if(nActive == 0)
+		return;
+	for(i = 0 ; i < nTasks ; ++i, stmt = stmt->next) {
+		t[i].stmt = stmt;
+		t[i].pBatch = pBatch;
+		t[i].active = active;
+		t[i].nActive = nActive;
+		tasks[i].pFunc = execActGroupTask;
+		tasks[i].pParam = &t[i];
+	}
+	DBGPRINTF("executing %d actions in parallel\n", nTasks);
+	actpoolRun(tasks, nTasks, pWti);
+}
+
+/* execute a script for all active messages of a batch. On return, active
+ * has been cleared for all messages whose processing was stopped.
+ */
+static rsRetVal
+scriptExecBatch(struct cnfstmt *root, batch_t *pBatch, sbool *active, wti_t *pWti)
+{
+	struct cnfstmt *stmt;
+	msg_t *pMsg;
+	uint64_t tBegin;
+	int nActive = 0;
+	int i;
+	DEFiRet;
+
+	for(stmt = root ; stmt != NULL ; stmt = stmt->next) {
+		if(*pWti->pbShutdownImmediate) {
+			DBGPRINTF("scriptExecBatch: ShutdownImmediate set, "
+				  "force terminating\n");
+			ABORT_FINALIZE(RS_RET_FORCE_TERM);
+		}
+		if(Debug) {
+			cnfstmtPrintOnly(stmt, 2, 0);
+		}
+		if(stmt->nActGroup > 1) {
+			execActGroupBatch(stmt, pBatch, active, pWti);
+			for(i = 1 ; i < stmt->nActGroup ; ++i)
+				stmt = stmt->next;
+			continue;
+		}
+		tBegin = 0;
+		if(stmt->prof != NULL) {
+			for(i = 0, nActive = 0 ; i < batchNumMsgs(pBatch) ; ++i)
+				nActive += active[i];
+			tBegin = profileBegin(stmt->prof, nActive);
+		}
+		switch(stmt->nodetype) {
+		case S_NOP:
+			break;
+		case S_STOP:
+			memset(active, 0, batchNumMsgs(pBatch) * sizeof(sbool));
+			FINALIZE;
+		case S_ACT:
+			for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i) {
+				if(active[i] && execAct(stmt, pBatch->pElem[i].pMsg, pWti)
+								== RS_RET_DISCARDMSG)
+					active[i] = 0;
+			}
+			break;
+		case S_SET:
+		case S_UNSET:
+			wtiTplCacheInvalidate(pWti);
+			for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i) {
+				if(!active[i])
+					continue;
+				pMsg = pBatch->pElem[i].pMsg;
+				if(stmt->nodetype == S_SET)
+					execSet(stmt, pMsg);
+				else
+					execUnset(stmt, pMsg);
+			}
+			break;
+		case S_CALL:
+			if(stmt->d.s_call.ruleset == NULL) {
+				CHKiRet(scriptExecBatch(stmt->d.s_call.stmt, pBatch, active, pWti));
+			} else {
+				for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i)
+					if(active[i])
+						execCall(stmt, pBatch->pElem[i].pMsg, pWti);
+			}
+			break;
+		case S_IF:
+			CHKiRet(execIfBatch(stmt, pBatch, active, pWti));
+			break;
+		case S_PRIFILT:
+			CHKiRet(execPRIFILTBatch(stmt, pBatch, active, pWti));
+			break;
+		case S_PROPFILT:
+			CHKiRet(execPROPFILTBatch(stmt, pBatch, active, pWti));
+			break;
+		case S_MULTIFILT:
+			CHKiRet(execMULTIFILTBatch(stmt, pBatch, active, pWti));
+			break;
+		case S_SWITCH:
+			CHKiRet(execSWITCHBatch(stmt, pBatch, active, pWti));
+			break;
 		default:
 			dbgprintf("error: unknown stmt type %u during exec\n",
 				(unsigned) stmt->nodetype);
 			break;
 		}
+		if(tBegin != 0)
+			profileEnd(stmt->prof, nActive, tBegin);
 	}
 finalize_it:
 	RETiRet;
 }
 
+/* check if a script can be executed batch-wise without a change in
+ * semantics other than the order of messages between different actions.
+ * This is not the case if global variables are modified (later messages
+ * would see them too early) or if an action depends on the state of the
+ * previous one. depth guards against recursive calls.
+ */
+static int
+scriptIsBatchSafe(struct cnfstmt *root, int depth)
+{
+	struct cnfstmt *stmt;
+	int i;
+
+	if(depth > 100)
+		return 0;
+	for(stmt = root ; stmt != NULL ; stmt = stmt->next) {
+		switch(stmt->nodetype) {
+		case S_SET:
+			if(stmt->d.s_set.varname[0] == '/')
+				return 0;
+			break;
+		case S_UNSET:
+			if(stmt->d.s_unset.varname[0] == '/')
+				return 0;
+			break;
+		case S_ACT:
+			if(stmt->d.act->bExecWhenPrevSusp)
+				return 0;
+			break;
+		case S_CALL:
+			if(stmt->d.s_call.ruleset == NULL
+			   && !scriptIsBatchSafe(stmt->d.s_call.stmt, depth + 1))
+				return 0;
+			break;
+		case S_IF:
+			if(   !scriptIsBatchSafe(stmt->d.s_if.t_then, depth)
+			   || !scriptIsBatchSafe(stmt->d.s_if.t_else, depth))
+				return 0;
+			break;
+		case S_PRIFILT:
+			if(   !scriptIsBatchSafe(stmt->d.s_prifilt.t_then, depth)
+			   || !scriptIsBatchSafe(stmt->d.s_prifilt.t_else, depth))
+				return 0;
+			break;
+		case S_PROPFILT:
+			if(!scriptIsBatchSafe(stmt->d.s_propfilt.t_then, depth))
+				return 0;
+			break;
+		case S_MULTIFILT:
+			if(!scriptIsBatchSafe(stmt->d.s_multifilt.members, depth))
+				return 0;
+			break;
+		case S_SWITCH:
+			for(i = 0 ; i < stmt->d.s_switch.nCases ; ++i)
+				if(!scriptIsBatchSafe(stmt->d.s_switch.cases[i], depth))
+					return 0;
+			if(!scriptIsBatchSafe(stmt->d.s_switch.t_else, depth))
+				return 0;
+			break;
+		default:
+			break;
+		}
+	}
+	return 1;
+}
+
+
+/* Process (consume) a batch of messages in batch execution mode. Messages
+ * bound to the same ruleset are processed together. The rulesets are looked
+ * up once into a compact side table, so that the scans for messages of the
+ * same ruleset do not need to touch the message objects again.
+ * done[i] is set for the messages whose ruleset has been fully executed,
+ * also if an error occurs for a later ruleset.
+ */
+static rsRetVal
+processBatchBatchExec(batch_t *pBatch, wti_t *pWti, sbool *done)
+{
+	sbool *active = NULL;
+	ruleset_t **rulesets = NULL;
+	ruleset_t *pRuleset;
+	int i, j;
+	DEFiRet;
+
+	CHKmalloc(active = newActive(pBatch, 1));
+	CHKmalloc(rulesets = malloc(batchNumMsgs(pBatch) * sizeof(ruleset_t*)));
+	for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i) {
+		batchPrefetch(pBatch, i);
+		rulesets[i] = batchElemRuleset(pBatch, i);
+	}
+	for(i = 0 ; i < batchNumMsgs(pBatch) && !*(pWti->pbShutdownImmediate) ; ++i) {
+		if(done[i])
+			continue;
+		pRuleset = rulesets[i];
+		if(!pRuleset->bBatchExec)
+			continue;
+		for(j = i ; j < batchNumMsgs(pBatch) ; ++j)
+			active[j] = !done[j] && rulesets[j] == pRuleset;
+		DBGPRINTF("processBATCH: executing ruleset '%s' for batch, starting at msg %d\n",
+			  pRuleset->pszName, i);
+		CHKiRet(scriptExecBatch(pRuleset->root, pBatch, active, pWti));
+		for(j = i ; j < batchNumMsgs(pBatch) ; ++j)
+			if(rulesets[j] == pRuleset)
+				done[j] = 1;
+		memset(active, 0, batchNumMsgs(pBatch) * sizeof(sbool));
+	}
+finalize_it:
+	free(rulesets);
+	free(active);
+	RETiRet;
+}
+
 
 /* Process (consume) a batch of messages. Calls the actions configured.
  * This is called by MAIN queues.
@@ -461,17 +1091,38 @@ processBatch(batch_t *pBatch, wti_t *pWti)
 	int i;
 	msg_t *pMsg;
 	ruleset_t *pRuleset;
+	sbool *done = NULL;
 	DEFiRet;
 
 	DBGPRINTF("processBATCH: batch of %d elements must be processed\n", pBatch->nElem);
+	RSPROBE2(batch__start, pBatch, pBatch->nElem);
 
 	wtiResetExecState(pWti, pBatch);
 
+	if(iMsgTraceSampleRate != 0) {
+		for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i)
+			MsgTraceStage(pBatch->pElem[i].pMsg, TRACE_RULESET);
+	}
+
 	/* execution phase */
+	if(bRulesetBatchExec && batchNumMsgs(pBatch) > 1) {
+		/* if that fails, we simply fall back to per-message execution
+		 * for the messages that are not yet done
+		 */
+		if((done = newActive(pBatch, 1)) != NULL
+		   && processBatchBatchExec(pBatch, pWti, done) != RS_RET_OK)
+			DBGPRINTF("processBATCH: batch execution failed, continuing per message\n");
+	}
 	for(i = 0 ; i < batchNumMsgs(pBatch) && !*(pWti->pbShutdownImmediate) ; ++i) {
+		if(done != NULL && done[i]) {
+			batchSetElemState(pBatch, i, BATCH_STATE_COMM);
+			continue;
+		}
+		batchPrefetch(pBatch, i);
 		pMsg = pBatch->pElem[i].pMsg;
 		DBGPRINTF("processBATCH: next msg %d: %.128s\n", i, pMsg->pszRawMsg);
 		pRuleset = (pMsg->pRuleset == NULL) ? ourConf->rulesets.pDflt : pMsg->pRuleset;
+		wtiTplCacheInvalidate(pWti);
 		scriptExec(pRuleset->root, pMsg, pWti);
 		// TODO: think if we need a return state of scriptExec - most probably
 		// the answer is "no", as we need to process the batch in any case!
@@ -479,11 +1130,24 @@ processBatch(batch_t *pBatch, wti_t *pWti)
 		batchSetElemState(pBatch, i, BATCH_STATE_COMM);
 	}
 
+	free(done);
+
 	/* commit phase */
 	dbgprintf("END batch execution phase, entering to commit phase\n");
 	actionCommitAllDirect(pWti);
+	if(iMsgTraceSampleRate != 0) {
+		/* only messages handed to a direct action are done; for
+		 * queued actions, the action queue records the commit
+		 */
+		for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i) {
+			pMsg = pBatch->pElem[i].pMsg;
+			if(pMsg->pTrace != NULL && pMsg->pTrace->t[TRACE_ACTION] != 0)
+				MsgTraceStage(pMsg, TRACE_COMMIT);
+		}
+	}
 
 	DBGPRINTF("processBATCH: batch of %d elements has been processed\n", pBatch->nElem);
+	RSPROBE2(batch__end, pBatch, pBatch->nElem);
 	RETiRet;
 }
 
@@ -548,6 +1212,34 @@ GetRulesetQueue(ruleset_t *pThis)
 }
 
 
+/* get the CPU set of the ruleset's traffic class, see rulesetSetCpuSet().
+ * Inputs whose threads feed just this ruleset should bind to it. pThis may
+ * be NULL for the default ruleset. Returns NULL if the ruleset is unbound.
+ */
+static srCpuSet_t*
+GetCpuSet(ruleset_t *pThis)
+{
+	if(pThis == NULL)
+		pThis = ourConf->rulesets.pDflt;
+	return (pThis == NULL) ? NULL : pThis->pCpuSet;
+}
+
+
+/* check if the queue a ruleset submits to asks inputs to back off, see
+ * qqueueChkBackpressure(). pThis may be NULL for the default ruleset.
+ * Inputs that can stop reading call this instead of relying on enqueue
+ * flow control to block them.
+ */
+static int
+IsBackpressured(ruleset_t *pThis)
+{
+	qqueue_t *pQueue;
+
+	pQueue = (pThis == NULL || pThis->pQueue == NULL) ? pMsgQueue : pThis->pQueue;
+	return (pQueue == NULL) ? 0 : qqueueChkBackpressure(pQueue);
+}
+
+
 /* Find the ruleset with the given name and return a pointer to its object.
  */
 rsRetVal
@@ -643,6 +1335,11 @@ CODESTARTobjDestruct(ruleset)
 	if(pThis->pParserLst != NULL) {
 		parser.DestructParserList(&pThis->pParserLst);
 	}
+	if(pThis->stats != NULL)
+		statsobj.Destruct(&pThis->stats);
+	if(pThis->pCpuSet != NULL)
+		srCpuSetDestruct(&pThis->pCpuSet);
+	free(pThis->pszCpuSet);
 	free(pThis->pszName);
 	cnfstmtDestructLst(pThis->root);
 ENDobjDestruct(ruleset)
@@ -727,6 +1424,278 @@ DEFFUNC_llExecFunc(doRulesetOptimizeAll)
 	rulesetOptimize((ruleset_t*) pData);
 	return RS_RET_OK;
 }
+/* helper for rulsetOptimizeAll(), checks if a ruleset can be executed
+ * batch-wise. Must be called after all rulesets are optimized, as only then
+ * calls are resolved.
+ */
+DEFFUNC_llExecFunc(doRulesetCheckBatchExec)
+{
+	ruleset_t *pRuleset = (ruleset_t*) pData;
+	pRuleset->bBatchExec = bRulesetBatchExec && scriptIsBatchSafe(pRuleset->root, 0);
+	DBGPRINTF("ruleset '%s': batch execution %s\n", pRuleset->pszName,
+		  pRuleset->bBatchExec ? "enabled" : "disabled");
+	if(bRulesetBatchExec && !pRuleset->bBatchExec)
+		errmsg.LogError(0, RS_RET_OK, "ruleset '%s' modifies global variables or uses "
+			"action.execOnlyWhenPreviousIsSuspended and is executed per message",
+			pRuleset->pszName);
+	return RS_RET_OK;
+}
+
+/* Input prefilter, enabled by global(input.prefilter).
+ * Filters at the start of a ruleset that do nothing but "stop" cannot
+ * have any effect other than discarding the message. If their conditions
+ * only depend on the message itself, they can as well be evaluated on the
+ * input thread, right after parsing (see ratelimitMsg()), which saves
+ * enqueueing and dequeueing the message. The statements themselves stay
+ * in the script, so messages that do not pass through a ratelimiter are
+ * still filtered as before.
+ */
+static inline int
+stmtIsStopOnly(struct cnfstmt *stmt)
+{
+	return stmt != NULL && stmt->nodetype == S_STOP && stmt->next == NULL;
+}
+
+static inline int
+propIsPrefilterSafe(msgPropDescr_t *prop)
+{
+	return    prop->id != PROP_INVALID
+	       && prop->id != PROP_CEE
+	       && prop->id != PROP_LOCAL_VAR
+	       && prop->id != PROP_GLOBAL_VAR
+	       && prop->id != PROP_FROMHOST;
+}
+
+static int
+stmtIsPrefilter(struct cnfstmt *stmt)
+{
+	struct cnfstmt *member;
+
+	switch(stmt->nodetype) {
+	case S_PRIFILT:
+		return stmtIsStopOnly(stmt->d.s_prifilt.t_then) && stmt->d.s_prifilt.t_else == NULL;
+	case S_PROPFILT:
+		/* regex filters compile their expression on first use */
+		return    stmtIsStopOnly(stmt->d.s_propfilt.t_then)
+		       && propIsPrefilterSafe(&stmt->d.s_propfilt.prop)
+		       && (   stmt->d.s_propfilt.operation == FIOP_CONTAINS
+			   || stmt->d.s_propfilt.operation == FIOP_ISEQUAL
+			   || stmt->d.s_propfilt.operation == FIOP_STARTSWITH
+			   || stmt->d.s_propfilt.operation == FIOP_ISEMPTY);
+	case S_IF:
+		return    stmtIsStopOnly(stmt->d.s_if.t_then) && stmt->d.s_if.t_else == NULL
+		       && cnfexprIsPrefilterSafe(stmt->d.s_if.expr);
+	case S_MULTIFILT:
+		if(!propIsPrefilterSafe(stmt->d.s_multifilt.prop))
+			return 0;
+		for(member = stmt->d.s_multifilt.members ; member != NULL ; member = member->next)
+			if(!stmtIsPrefilter(member))
+				return 0;
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static int
+prefilterMatches(struct cnfstmt *stmt, msg_t *pMsg)
+{
+	uint64_t matched[ACMATCH_WORDS];
+	struct cnfstmt *member;
+	int i;
+
+	switch(stmt->nodetype) {
+	case S_PRIFILT:
+		return evalPRIFILT(stmt, pMsg);
+	case S_PROPFILT:
+		return evalPROPFILT(stmt, pMsg);
+	case S_IF:
+		if(stmt->d.s_if.prog != NULL)
+			return cnfexprprogEvalBool(stmt->d.s_if.prog, pMsg);
+		return cnfexprEvalBool(stmt->d.s_if.expr, pMsg);
+	case S_MULTIFILT:
+		evalMULTIFILT(stmt, pMsg, matched);
+		for(member = stmt->d.s_multifilt.members, i = 0 ; member != NULL ; member = member->next, ++i)
+			if(multiFiltResult(member, matched, i))
+				return 1;
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+/* check if a (parsed) message would be discarded by the prefilter of its
+ * ruleset. Returns 1 if so, 0 otherwise.
+ */
+int
+rulesetPrefilterDiscards(msg_t *pMsg)
+{
+	ruleset_t *pRuleset;
+	struct cnfstmt *stmt;
+	int i;
+
+	if(ourConf == NULL)
+		return 0;
+	pRuleset = (pMsg->pRuleset == NULL) ? ourConf->rulesets.pDflt : pMsg->pRuleset;
+	if(pRuleset == NULL)
+		return 0;
+	for(stmt = pRuleset->root, i = 0 ; i < pRuleset->nPrefilter ; stmt = stmt->next, ++i) {
+		if(prefilterMatches(stmt, pMsg)) {
+			DBGPRINTF("message discarded by prefilter %d of ruleset '%s'\n",
+				  i, pRuleset->pszName);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* helper for rulsetOptimizeAll(), finds the prefilter of a ruleset */
+DEFFUNC_llExecFunc(doRulesetFindPrefilter)
+{
+	ruleset_t *pRuleset = (ruleset_t*) pData;
+	struct cnfstmt *stmt;
+
+	pRuleset->nPrefilter = 0;
+	for(stmt = pRuleset->root ; stmt != NULL && stmtIsPrefilter(stmt) ; stmt = stmt->next)
+		++pRuleset->nPrefilter;
+	DBGPRINTF("ruleset '%s': %d statement(s) evaluated on the input thread\n",
+		  pRuleset->pszName, pRuleset->nPrefilter);
+	return RS_RET_OK;
+}
+
+/* check if an action can be part of a parallel action group */
+static int
+actIsParallelSafe(struct cnfstmt *stmt)
+{
+	action_t *pAction;
+
+	if(stmt->nodetype != S_ACT)
+		return 0;
+	pAction = stmt->d.act;
+	return    pAction->pQueue->qType == QUEUETYPE_DIRECT
+	       && pAction->eParamPassing != ACT_MSG_PASSING
+	       && !pAction->bExecWhenPrevSusp
+	       && strcmp((char*) modGetName(pAction->pMod), "builtin:omdiscard");
+}
+
+/* find the parallel action groups of a script */
+static void
+scriptMarkActGroups(struct cnfstmt *root)
+{
+	struct cnfstmt *stmt, *member, *last;
+	int n, i;
+
+	for(stmt = root ; stmt != NULL ; stmt = stmt->next) {
+		if(actIsParallelSafe(stmt)) {
+			last = stmt;
+			for(n = 1 ; n < ACTGROUP_MAX && last->next != NULL && actIsParallelSafe(last->next) ; ++n)
+				last = last->next;
+			if(n > 1) {
+				DBGPRINTF("actions %d to %d are executed in parallel\n",
+					  stmt->d.act->iActionNbr, last->d.act->iActionNbr);
+				stmt->nActGroup = n;
+				stmt = last;
+			}
+			continue;
+		}
+		switch(stmt->nodetype) {
+		case S_IF:
+			scriptMarkActGroups(stmt->d.s_if.t_then);
+			scriptMarkActGroups(stmt->d.s_if.t_else);
+			break;
+		case S_PRIFILT:
+			scriptMarkActGroups(stmt->d.s_prifilt.t_then);
+			scriptMarkActGroups(stmt->d.s_prifilt.t_else);
+			break;
+		case S_PROPFILT:
+			scriptMarkActGroups(stmt->d.s_propfilt.t_then);
+			break;
+		case S_MULTIFILT:
+			for(member = stmt->d.s_multifilt.members ; member != NULL ; member = member->next) {
+				if(member->nodetype == S_IF) {
+					scriptMarkActGroups(member->d.s_if.t_then);
+					scriptMarkActGroups(member->d.s_if.t_else);
+				} else {
+					scriptMarkActGroups(member->d.s_propfilt.t_then);
+				}
+			}
+			break;
+		case S_SWITCH:
+			for(i = 0 ; i < stmt->d.s_switch.nCases ; ++i)
+				scriptMarkActGroups(stmt->d.s_switch.cases[i]->d.s_if.t_then);
+			scriptMarkActGroups(stmt->d.s_switch.t_else);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/* helper for rulsetOptimizeAll(), finds the parallel action groups of a ruleset */
+DEFFUNC_llExecFunc(doRulesetMarkActGroups)
+{
+	scriptMarkActGroups(((ruleset_t*) pData)->root);
+	return RS_RET_OK;
+}
+
+/* allocate the profile counters for all statements executed for a script.
+ * The members of multi-pattern filters and switches are not executed
+ * themselves, only their branches.
+ */
+static rsRetVal
+scriptProfileInit(struct cnfstmt *root)
+{
+	struct cnfstmt *stmt, *member;
+	int i;
+	DEFiRet;
+
+	for(stmt = root ; stmt != NULL ; stmt = stmt->next) {
+		CHKmalloc(stmt->prof = calloc(1, sizeof(struct cnfstmtprof)));
+		switch(stmt->nodetype) {
+		case S_IF:
+			CHKiRet(scriptProfileInit(stmt->d.s_if.t_then));
+			CHKiRet(scriptProfileInit(stmt->d.s_if.t_else));
+			break;
+		case S_PRIFILT:
+			CHKiRet(scriptProfileInit(stmt->d.s_prifilt.t_then));
+			CHKiRet(scriptProfileInit(stmt->d.s_prifilt.t_else));
+			break;
+		case S_PROPFILT:
+			CHKiRet(scriptProfileInit(stmt->d.s_propfilt.t_then));
+			break;
+		case S_MULTIFILT:
+			for(member = stmt->d.s_multifilt.members ; member != NULL ; member = member->next) {
+				if(member->nodetype == S_IF) {
+					CHKiRet(scriptProfileInit(member->d.s_if.t_then));
+					CHKiRet(scriptProfileInit(member->d.s_if.t_else));
+				} else {
+					CHKiRet(scriptProfileInit(member->d.s_propfilt.t_then));
+				}
+			}
+			break;
+		case S_SWITCH:
+			for(i = 0 ; i < stmt->d.s_switch.nCases ; ++i)
+				CHKiRet(scriptProfileInit(stmt->d.s_switch.cases[i]->d.s_if.t_then));
+			CHKiRet(scriptProfileInit(stmt->d.s_switch.t_else));
+			break;
+		default:
+			break;
+		}
+	}
+finalize_it:
+	RETiRet;
+}
+
+/* helper for rulsetOptimizeAll(), enables profiling for a single ruleset */
+DEFFUNC_llExecFunc(doRulesetProfileInit)
+{
+	ruleset_t *pRuleset = (ruleset_t*) pData;
+	if(scriptProfileInit(pRuleset->root) != RS_RET_OK)
+		errmsg.LogError(0, RS_RET_OUT_OF_MEMORY, "out of memory, ruleset '%s' is "
+			"only partially profiled", pRuleset->pszName);
+	return RS_RET_OK;
+}
+
 /* optimize all rulesets
  */
 rsRetVal
@@ -735,11 +1704,159 @@ rulesetOptimizeAll(rsconf_t *conf)
 	DEFiRet;
 	dbgprintf("begin ruleset optimization phase\n");
 	llExecFunc(&(conf->rulesets.llRulesets), doRulesetOptimizeAll, NULL);
+	llExecFunc(&(conf->rulesets.llRulesets), doRulesetCheckBatchExec, NULL);
+	if(bRulesetPrefilter)
+		llExecFunc(&(conf->rulesets.llRulesets), doRulesetFindPrefilter, NULL);
+	if(iActpoolWorkers > 0) {
+		if(bRulesetBatchExec) {
+			llExecFunc(&(conf->rulesets.llRulesets), doRulesetMarkActGroups, NULL);
+		} else {
+			errmsg.LogError(0, RS_RET_OK, "global(script.parallelactions) requires "
+				"script.batchexec=\"on\", ignored");
+			iActpoolWorkers = 0;
+		}
+	}
+	if(pszRulesetProfileFile != NULL) {
+		for(iProfileShift = 0 ; (1 << iProfileShift) < iRulesetProfileSampleRate ; ++iProfileShift)
+			/* just count */;
+		DBGPRINTF("script profiling enabled, timing 1 in %d executions\n", 1 << iProfileShift);
+		llExecFunc(&(conf->rulesets.llRulesets), doRulesetProfileInit, NULL);
+	}
 	dbgprintf("ruleset optimization phase finished.\n");
 	RETiRet;
 }
 
 
+/* write the profile of a statement list to the report, in script order */
+static void
+scriptProfileWrite(FILE *fp, struct cnfstmt *root, int indent)
+{
+	struct cnfstmt *stmt, *member;
+	struct cnfstmtprof *prof;
+	char descr[128];
+	unsigned long long nsAvg;
+	int i;
+
+	for(stmt = root ; stmt != NULL ; stmt = stmt->next) {
+		if((prof = stmt->prof) == NULL)
+			continue;
+		switch(stmt->nodetype) {
+		case S_NOP:
+			strcpy(descr, "continue");
+			break;
+		case S_STOP:
+			strcpy(descr, "stop");
+			break;
+		case S_ACT:
+			if(stmt->d.act->pszName == NULL)
+				snprintf(descr, sizeof(descr), "action %d (%s)", stmt->d.act->iActionNbr,
+					 modGetName(stmt->d.act->pMod));
+			else
+				snprintf(descr, sizeof(descr), "action '%s' (%s)", stmt->d.act->pszName,
+					 modGetName(stmt->d.act->pMod));
+			break;
+		case S_SET:
+			snprintf(descr, sizeof(descr), "set %s", stmt->d.s_set.varname);
+			break;
+		case S_UNSET:
+			snprintf(descr, sizeof(descr), "unset %s", stmt->d.s_unset.varname);
+			break;
+		case S_CALL:
+			snprintf(descr, sizeof(descr), "call %.*s", (int) es_strlen(stmt->d.s_call.name),
+				 (char*) es_getBufAddr(stmt->d.s_call.name));
+			break;
+		case S_IF:
+			strcpy(descr, "if");
+			break;
+		case S_PRIFILT:
+			strcpy(descr, "priority filter");
+			break;
+		case S_PROPFILT:
+			strcpy(descr, "property filter");
+			break;
+		case S_MULTIFILT:
+			strcpy(descr, "property filter group");
+			break;
+		case S_SWITCH:
+			strcpy(descr, "if/else if chain");
+			break;
+		default:
+			strcpy(descr, "unknown");
+			break;
+		}
+		nsAvg = (prof->nTimed == 0) ? 0 : prof->nsTimed / prof->nTimed;
+		fprintf(fp, "%s:%d: %*s%s: executions=%llu timed=%llu avgns=%llu esttotalms=%llu\n",
+			stmt->srcfile, stmt->lineno, 2 * indent, "", descr, prof->nExec,
+			prof->nTimed, nsAvg, nsAvg * prof->nExec / 1000000);
+		switch(stmt->nodetype) {
+		case S_IF:
+			scriptProfileWrite(fp, stmt->d.s_if.t_then, indent + 1);
+			scriptProfileWrite(fp, stmt->d.s_if.t_else, indent + 1);
+			break;
+		case S_PRIFILT:
+			scriptProfileWrite(fp, stmt->d.s_prifilt.t_then, indent + 1);
+			scriptProfileWrite(fp, stmt->d.s_prifilt.t_else, indent + 1);
+			break;
+		case S_PROPFILT:
+			scriptProfileWrite(fp, stmt->d.s_propfilt.t_then, indent + 1);
+			break;
+		case S_MULTIFILT:
+			for(member = stmt->d.s_multifilt.members ; member != NULL ; member = member->next) {
+				if(member->nodetype == S_IF) {
+					scriptProfileWrite(fp, member->d.s_if.t_then, indent + 1);
+					scriptProfileWrite(fp, member->d.s_if.t_else, indent + 1);
+				} else {
+					scriptProfileWrite(fp, member->d.s_propfilt.t_then, indent + 1);
+				}
+			}
+			break;
+		case S_SWITCH:
+			for(i = 0 ; i < stmt->d.s_switch.nCases ; ++i)
+				scriptProfileWrite(fp, stmt->d.s_switch.cases[i]->d.s_if.t_then, indent + 1);
+			scriptProfileWrite(fp, stmt->d.s_switch.t_else, indent + 1);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/* helper for rulesetProfileWrite(), writes the profile of a single ruleset */
+DEFFUNC_llExecFunc(doRulesetProfileWrite)
+{
+	ruleset_t *pRuleset = (ruleset_t*) pData;
+	FILE *fp = (FILE*) pParam;
+
+	fprintf(fp, "ruleset '%s'\n", pRuleset->pszName);
+	scriptProfileWrite(fp, pRuleset->root, 1);
+	return RS_RET_OK;
+}
+
+/* Write the script profile report (if profiling is enabled). This is done
+ * on HUP and on shutdown. The file is rewritten each time, the counters are
+ * not reset. Times are estimated from the sampled executions.
+ */
+rsRetVal
+rulesetProfileWrite(rsconf_t *conf)
+{
+	FILE *fp;
+	DEFiRet;
+
+	if(pszRulesetProfileFile == NULL)
+		FINALIZE;
+	if((fp = fopen((char*) pszRulesetProfileFile, "w")) == NULL) {
+		errmsg.LogError(errno, RS_RET_FOPEN_FAILURE, "script profile file '%s' "
+			"could not be written", pszRulesetProfileFile);
+		ABORT_FINALIZE(RS_RET_FOPEN_FAILURE);
+	}
+	fprintf(fp, "# rsyslog script profile, 1 in %d executions timed\n", 1 << iProfileShift);
+	llExecFunc(&(conf->rulesets.llRulesets), doRulesetProfileWrite, fp);
+	fclose(fp);
+finalize_it:
+	RETiRet;
+}
+
+
 /* Create a ruleset-specific "main" queue for this ruleset. If one is already
  * defined, an error message is emitted but nothing else is done.
  * Note: we use the main message queue parameters for queue creation and access
@@ -782,6 +1899,74 @@ rulesetCreateQueue(void __attribute__((unused)) *pVal, int *pNewVal)
 	return doRulesetCreateQueue(ourConf, pNewVal);
 }
 
+/* helper for rulesetSetCpuSet(), binds an action queue to the ruleset's
+ * CPUs unless it has its own queue.cpuset.
+ */
+static rsRetVal
+rulesetSetActionCpuSet(void *pData, void *pParam)
+{
+	action_t *pAction = (action_t*) pData;
+	ruleset_t *pRuleset = (ruleset_t*) pParam;
+	DEFiRet;
+
+	if(pAction->pQueue != NULL && pAction->pQueue->pszCpuSet == NULL) {
+		CHKmalloc(pAction->pQueue->pszCpuSet = ustrdup(pRuleset->pszCpuSet));
+	}
+finalize_it:
+	RETiRet;
+}
+
+/* Bind the ruleset's traffic class to a set of CPUs (ruleset parameter
+ * "cpuset"), so that its input, ruleset queue and action queues share an
+ * L3 cache or NUMA node. The workers of the ruleset queue and of the
+ * queues of its actions are bound to the CPUs, unless they have their own
+ * queue.cpuset; inputs find the set via GetCpuSet(). The mapping is shown
+ * in the stats object "ruleset(<name>)".
+ */
+static rsRetVal
+rulesetSetCpuSet(ruleset_t *pRuleset, uchar *pszCpuSet)
+{
+	uchar ctrName[512];
+	rsRetVal localRet;
+	DEFiRet;
+
+	localRet = srCpuSetConstruct(&pRuleset->pCpuSet, pszCpuSet);
+	if(localRet == RS_RET_NOT_IMPLEMENTED) {
+		errmsg.LogError(0, localRet, "ruleset '%s': binding threads to CPUs is not "
+				"supported on this platform, cpuset ignored", pRuleset->pszName);
+		FINALIZE;
+	} else if(localRet != RS_RET_OK) {
+		errmsg.LogError(0, RS_RET_INVALID_VALUE, "ruleset '%s': invalid cpuset '%s', ignored",
+				pRuleset->pszName, pszCpuSet);
+		FINALIZE;
+	}
+	CHKmalloc(pRuleset->pszCpuSet = ustrdup(pszCpuSet));
+
+	if(pRuleset->pQueue != NULL) {
+		if(pRuleset->pQueue->pszCpuSet == NULL)
+			CHKmalloc(pRuleset->pQueue->pszCpuSet = ustrdup(pszCpuSet));
+		pRuleset->nWorkers = pRuleset->pQueue->iNumWorkerThreads;
+	}
+	scriptIterateAllActions(pRuleset->root, rulesetSetActionCpuSet, pRuleset);
+
+	/* the mapping does not change at runtime, so the counters are constant */
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
+	pRuleset->nCpus = srCpuSetCount(pRuleset->pCpuSet, &pRuleset->cpuMask);
+	snprintf((char*) ctrName, sizeof(ctrName), "ruleset(%s)", pRuleset->pszName);
+	CHKiRet(statsobj.Construct(&pRuleset->stats));
+	CHKiRet(statsobj.SetName(pRuleset->stats, ctrName));
+	CHKiRet(statsobj.AddCounter(pRuleset->stats, UCHAR_CONSTANT("cpus"),
+		ctrType_Int, CTR_FLAG_NONE, &pRuleset->nCpus));
+	CHKiRet(statsobj.AddCounter(pRuleset->stats, UCHAR_CONSTANT("cpumask"),
+		ctrType_IntCtr, CTR_FLAG_NONE, &pRuleset->cpuMask));
+	CHKiRet(statsobj.AddCounter(pRuleset->stats, UCHAR_CONSTANT("queue.workerthreads"),
+		ctrType_Int, CTR_FLAG_NONE, &pRuleset->nWorkers));
+	CHKiRet(statsobj.ConstructFinalize(pRuleset->stats));
+
+finalize_it:
+	RETiRet;
+}
+
 /* Add a ruleset specific parser to the ruleset. Note that adding the first
  * parser automatically disables the default parsers. If they are needed as well,
  * the must be added via explicit config directives.
@@ -833,7 +2018,8 @@ rulesetProcessCnf(struct cnfobj *o)
 	rsRetVal localRet;
 	uchar *rsName = NULL;
 	uchar *parserName;
-	int nameIdx, parserIdx;
+	uchar *cpuSet;
+	int nameIdx, parserIdx, cpuSetIdx;
 	ruleset_t *pRuleset;
 	struct cnfarray *ar;
 	int i;
@@ -863,7 +2049,7 @@ rulesetProcessCnf(struct cnfobj *o)
 	CHKiRet(rulesetConstructFinalize(loadConf, pRuleset));
 	addScript(pRuleset, o->script);
 
-	/* we have only two params, so we do NOT do the usual param loop */
+	/* we have only a few params, so we do NOT do the usual param loop */
 	parserIdx = cnfparamGetIdx(&rspblk, "parser");
 	if(parserIdx != -1  && pvals[parserIdx].bUsed) {
 		ar = pvals[parserIdx].val.d.ar;
@@ -881,6 +2067,15 @@ rulesetProcessCnf(struct cnfobj *o)
 		CHKiRet(createMainQueue(&pRuleset->pQueue, rsname, o->nvlst));
 	}
 
+	/* must be done after the queue and actions exist */
+	cpuSetIdx = cnfparamGetIdx(&rspblk, "cpuset");
+	if(cpuSetIdx != -1 && pvals[cpuSetIdx].bUsed) {
+		cpuSet = (uchar*)es_str2cstr(pvals[cpuSetIdx].val.d.estr, NULL);
+		localRet = rulesetSetCpuSet(pRuleset, cpuSet);
+		free(cpuSet);
+		CHKiRet(localRet);
+	}
+
 finalize_it:
 	free(rsName);
 	cnfparamvalsDestruct(pvals, &rspblk);
@@ -918,7 +2113,9 @@ CODESTARTobjQueryInterface(ruleset)
 	pIf->SetDefaultRuleset = SetDefaultRuleset;
 	pIf->SetCurrRuleset = SetCurrRuleset;
 	pIf->GetRulesetQueue = GetRulesetQueue;
+	pIf->IsBackpressured = IsBackpressured;
 	pIf->GetParserList = GetParserList;
+	pIf->GetCpuSet = GetCpuSet;
 finalize_it:
 ENDobjQueryInterface(ruleset)
 
@@ -929,6 +2126,7 @@ ENDobjQueryInterface(ruleset)
 BEGINObjClassExit(ruleset, OBJ_IS_CORE_MODULE) /* class, version */
 	objRelease(errmsg, CORE_COMPONENT);
 	objRelease(parser, CORE_COMPONENT);
+	objRelease(statsobj, CORE_COMPONENT);
 ENDObjClassExit(ruleset)
 
 
@@ -35,6 +35,14 @@ struct ruleset_s {
 	struct cnfstmt *root;
 	struct cnfstmt *last;
 	parserList_t *pParserLst;/* list of parsers to use for this ruleset */
+	sbool bBatchExec;	/* execute statements for the whole batch at once? */
+	int nPrefilter;		/* number of leading statements evaluated on the input thread */
+	uchar *pszCpuSet;	/* CPUs of the ruleset's traffic class (as configured), NULL - unbound */
+	srCpuSet_t *pCpuSet;	/* the parsed CPU set */
+	statsobj_t *stats;	/* CPU mapping, only if bound */
+	int nCpus;		/* for stats: number of CPUs in pCpuSet */
+	uint64 cpuMask;		/* for stats: CPUs 0..63 in pCpuSet */
+	int nWorkers;		/* for stats: worker threads of the ruleset queue */
 };
 
 /* interfaces */
@@ -65,8 +73,12 @@ BEGINinterface(ruleset) /* name must also be changed in ENDinterface macro! */
 	/*TODO:REMOVE*/rsRetVal (*IterateAllActions)(rsconf_t *conf, rsRetVal (*pFunc)(void*, void*), void* pParam);
 	void (*AddScript)(ruleset_t *pThis, struct cnfstmt *script);
 	/* v8: changed processBatch interface */
+	/* v9: added IsBackpressured() */
+	int (*IsBackpressured)(ruleset_t*);
+	/* v10: added GetCpuSet() */
+	srCpuSet_t* (*GetCpuSet)(ruleset_t*);
 ENDinterface(ruleset)
-#define rulesetCURR_IF_VERSION 8 /* increment whenever you change the interface structure! */
+#define rulesetCURR_IF_VERSION 10 /* increment whenever you change the interface structure! */
 
 
 /* prototypes */
@@ -104,8 +116,15 @@ rulesetHasQueue(ruleset_t *pRuleset)
  */
 rsRetVal rulesetGetRuleset(rsconf_t *conf, ruleset_t **ppRuleset, uchar *pszName);
 rsRetVal rulesetOptimizeAll(rsconf_t *conf);
+rsRetVal rulesetProfileWrite(rsconf_t *conf);
 rsRetVal rulesetProcessCnf(struct cnfobj *o);
 rsRetVal activateRulesetQueues(void);
+int rulesetPrefilterDiscards(msg_t *pMsg);
+
+extern int bRulesetBatchExec;	/* global(script.batchexec) */
+extern int bRulesetPrefilter;	/* global(input.prefilter) */
+extern uchar *pszRulesetProfileFile;	/* global(script.profile.file) */
+extern int iRulesetProfileSampleRate;	/* global(script.profile.samplerate) */
 
 /* Set a current rule set to already-known pointer */
 static inline void
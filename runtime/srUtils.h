@@ -85,6 +85,8 @@ rsRetVal genFileName(uchar **ppName, uchar *pDirName, size_t lenDirName, uchar *
 int getNumberDigits(long lNum);
 rsRetVal timeoutComp(struct timespec *pt, long iTimeout);
 long timeoutVal(struct timespec *pt);
+uint64_t getMonotonicUsecs(void);
+uint64_t getMonotonicNsecs(void);
 void mutexCancelCleanup(void *arg);
 void srSleep(int iSeconds, int iuSeconds);
 char *rs_strerror_r(int errnum, char *buf, size_t buflen);
@@ -92,6 +94,28 @@ int decodeSyslogName(uchar *name, syslogName_t *codetab);
 int getSubString(uchar **ppSrc,  char *pDst, size_t DstSize, char cSep);
 rsRetVal getFileSize(uchar *pszName, off_t *pSize);
 int containsGlobWildcard(char *str);
+int splitSQLInsert(uchar *stmt, int bBackslashEsc, size_t *pLenPrefix, uchar **ppRows, size_t *pLenRows);
+
+/* CPU sets for binding threads (e.g. queue.cpuset). The set is built from
+ * a list like "0-3,8,10-11". Binding is only supported if the platform
+ * provides pthread_setaffinity_np().
+ */
+rsRetVal srCpuSetConstruct(srCpuSet_t **ppSet, const uchar *pszList);
+void srCpuSetDestruct(srCpuSet_t **ppSet);
+rsRetVal srCpuSetBind(const srCpuSet_t *pSet);
+rsRetVal srCpuSetBindModulo(const srCpuSet_t *pSet, int n, int i);
+int srCpuSetCount(const srCpuSet_t *pSet, uint64 *pMask);
+
+/* memory backed by huge pages, for large arrays that are accessed all over
+ * (e.g. queue storage), where TLB misses hurt. See srHugeAlloc() for the modes.
+ */
+#define SR_HUGE_PAGE_SIZE (2*1024*1024) /* smaller allocations do not use huge pages */
+#define SR_HUGE_NONE	0	/* plain heap memory */
+#define SR_HUGE_MAPPED	1	/* anonymous mapping, without huge pages */
+#define SR_HUGE_THP	2	/* anonymous mapping, transparent huge pages requested */
+#define SR_HUGE_TLB	3	/* reserved huge pages (MAP_HUGETLB) */
+void *srHugeAlloc(size_t size, int *pMode);
+void srHugeFree(void *p, size_t size, int mode);
 
 /* mutex operations */
 /* some useful constants */
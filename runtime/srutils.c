@@ -40,7 +40,12 @@
 #include <signal.h>
 #include <assert.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
 #include <ctype.h>
+#include <pthread.h>
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+#	include <sched.h>
+#endif
 #include "srUtils.h"
 #include "obj.h"
 
@@ -463,6 +468,44 @@ timeoutVal(struct timespec *pt)
 }
 
 
+/* obtain a timestamp in microseconds from a monotonic clock (if the platform
+ * has one). This is meant for measuring durations, the value has no meaning
+ * otherwise.
+ */
+uint64_t
+getMonotonicUsecs(void)
+{
+#	if defined(_POSIX_MONOTONIC_CLOCK) && _POSIX_MONOTONIC_CLOCK >= 0
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+#	else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+#	endif
+}
+
+
+/* same as getMonotonicUsecs(), but in nanoseconds, for measuring very
+ * short durations. The resolution is only microseconds on platforms
+ * without a monotonic clock.
+ */
+uint64_t
+getMonotonicNsecs(void)
+{
+#	if defined(_POSIX_MONOTONIC_CLOCK) && _POSIX_MONOTONIC_CLOCK >= 0
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+#	else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t) tv.tv_sec * 1000000000 + (uint64_t) tv.tv_usec * 1000;
+#	endif
+}
+
+
 /* cancellation cleanup handler - frees provided mutex
  * rgerhards, 2008-01-14
  */
@@ -494,6 +537,249 @@ srSleep(int iSeconds, int iuSeconds)
 }
 
 
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+struct srCpuSet_s {
+	cpu_set_t set;
+};
+#endif
+
+/* parse a CPU list ("0-3,8") into a new CPU set. Returns
+ * RS_RET_INVALID_VALUE if the list is malformed and RS_RET_NOT_IMPLEMENTED
+ * if threads can not be bound on this platform.
+ */
+rsRetVal
+srCpuSetConstruct(srCpuSet_t **ppSet, const uchar *pszList)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	srCpuSet_t *pSet = NULL;
+	const char *p = (const char*) pszList;
+	char *pEnd;
+	long lo, hi;
+	DEFiRet;
+
+	CHKmalloc(pSet = calloc(1, sizeof(srCpuSet_t)));
+	CPU_ZERO(&pSet->set);
+	do {
+		while(isspace((unsigned char) *p))
+			++p;
+		lo = strtol(p, &pEnd, 10);
+		if(pEnd == p || lo < 0)
+			ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+		hi = lo;
+		p = pEnd;
+		if(*p == '-') {
+			++p;
+			hi = strtol(p, &pEnd, 10);
+			if(pEnd == p || hi < lo)
+				ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+			p = pEnd;
+		}
+		if(hi >= CPU_SETSIZE)
+			ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+		for( ; lo <= hi ; ++lo)
+			CPU_SET(lo, &pSet->set);
+		while(isspace((unsigned char) *p))
+			++p;
+	} while(*p++ == ',');
+	if(p[-1] != '\0')
+		ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+	*ppSet = pSet;
+
+finalize_it:
+	if(iRet != RS_RET_OK)
+		free(pSet);
+	RETiRet;
+#else
+	(void) pszList;
+	*ppSet = NULL;
+	return RS_RET_NOT_IMPLEMENTED;
+#endif
+}
+
+
+void
+srCpuSetDestruct(srCpuSet_t **ppSet)
+{
+	free(*ppSet);
+	*ppSet = NULL;
+}
+
+
+/* bind the calling thread to the CPUs of the set */
+rsRetVal
+srCpuSetBind(const srCpuSet_t *pSet)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	int err;
+
+	err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &pSet->set);
+	if(err != 0) {
+		errno = err;
+		return RS_RET_ERR;
+	}
+	return RS_RET_OK;
+#else
+	(void) pSet;
+	return RS_RET_NOT_IMPLEMENTED;
+#endif
+}
+
+
+/* bind the calling thread to the CPUs c of the set (of all CPUs if pSet is
+ * NULL) for which c % n == i. This pins worker i of n to the CPUs whose
+ * packets are steered to it (see imudp). If the set holds no such CPU, the
+ * thread is bound to the whole set.
+ */
+rsRetVal
+srCpuSetBindModulo(const srCpuSet_t *pSet, int n, int i)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	cpu_set_t set;
+	int nCpus;
+	int err;
+	int c;
+
+	CPU_ZERO(&set);
+	nCpus = 0;
+	for(c = i ; c < CPU_SETSIZE ; c += n) {
+		if(pSet == NULL || CPU_ISSET(c, &pSet->set)) {
+			CPU_SET(c, &set);
+			++nCpus;
+		}
+	}
+	if(nCpus == 0)
+		return (pSet == NULL) ? RS_RET_OK : srCpuSetBind(pSet);
+	err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+	if(err != 0) {
+		errno = err;
+		return RS_RET_ERR;
+	}
+	return RS_RET_OK;
+#else
+	(void) pSet;
+	(void) n;
+	(void) i;
+	return RS_RET_NOT_IMPLEMENTED;
+#endif
+}
+
+
+/* get the number of CPUs in the set and, in *pMask, which of the CPUs 0..63
+ * it holds (for display, e.g. in stats).
+ */
+int
+srCpuSetCount(const srCpuSet_t *pSet, uint64 *pMask)
+{
+	int n = 0;
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	int c;
+
+	*pMask = 0;
+	for(c = 0 ; c < CPU_SETSIZE ; ++c) {
+		if(CPU_ISSET(c, &pSet->set)) {
+			++n;
+			if(c < 64)
+				*pMask |= (uint64) 1 << c;
+		}
+	}
+#else
+	(void) pSet;
+	*pMask = 0;
+#endif
+	return n;
+}
+
+
+/* get the default huge page size, as the length of huge page mappings must
+ * be a multiple of it. We read it only once; if it can not be obtained, we
+ * assume the 2MB pages of most platforms. A race on the first call is
+ * harmless, as all threads compute the same value.
+ */
+static size_t
+srHugePageSize(void)
+{
+	static size_t pageSize = 0;
+	FILE *fp;
+	char ln[128];
+	unsigned long kb;
+
+	if(pageSize != 0)
+		return pageSize;
+	kb = 0;
+	if((fp = fopen("/proc/meminfo", "r")) != NULL) {
+		while(fgets(ln, sizeof(ln), fp) != NULL) {
+			if(sscanf(ln, "Hugepagesize: %lu kB", &kb) == 1)
+				break;
+		}
+		fclose(fp);
+	}
+	pageSize = (kb == 0) ? SR_HUGE_PAGE_SIZE : (size_t) kb * 1024;
+	return pageSize;
+}
+
+/* allocate zero-initialized memory, backed by huge pages if possible. We
+ * first try reserved huge pages (MAP_HUGETLB) and then ask for transparent
+ * huge pages. Memory smaller than a huge page is simply calloc()ed. *pMode
+ * receives how the memory was obtained (SR_HUGE_*) and must be passed to
+ * srHugeFree(), along with the size. Returns NULL if out of memory.
+ */
+void *
+srHugeAlloc(size_t size, int *pMode)
+{
+	void *p;
+	size_t len;
+
+	*pMode = SR_HUGE_NONE;
+	if(size < SR_HUGE_PAGE_SIZE)
+		return calloc(1, size);
+	len = (size + SR_HUGE_PAGE_SIZE - 1) & ~((size_t) SR_HUGE_PAGE_SIZE - 1);
+
+#	ifdef MAP_HUGETLB
+	{
+		const size_t pageSize = srHugePageSize();
+		const size_t lenHuge = (size + pageSize - 1) / pageSize * pageSize;
+		p = mmap(NULL, lenHuge, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+		if(p != MAP_FAILED) {
+			*pMode = SR_HUGE_TLB;
+			return p;
+		}
+	}
+#	endif
+
+	p = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED)
+		return calloc(1, size);
+	*pMode = SR_HUGE_MAPPED;
+#	ifdef MADV_HUGEPAGE
+	if(madvise(p, len, MADV_HUGEPAGE) == 0)
+		*pMode = SR_HUGE_THP;
+#	endif
+	return p;
+}
+
+/* free memory obtained from srHugeAlloc() */
+void
+srHugeFree(void *p, size_t size, int mode)
+{
+	size_t pageSize;
+
+	if(p == NULL)
+		return;
+	switch(mode) {
+	case SR_HUGE_NONE:
+		free(p);
+		break;
+	case SR_HUGE_TLB:
+		pageSize = srHugePageSize();
+		munmap(p, (size + pageSize - 1) / pageSize * pageSize);
+		break;
+	default:
+		munmap(p, (size + SR_HUGE_PAGE_SIZE - 1) & ~((size_t) SR_HUGE_PAGE_SIZE - 1));
+		break;
+	}
+}
+
+
 /* From varmojfekoj's mail on why he provided rs_strerror_r():
  * There are two problems with strerror_r():
  * I see you've rewritten some of the code which calls it to use only
@@ -655,5 +941,78 @@ containsGlobWildcard(char *str)
 	return 0;
 }
 
+
+/* Split a single-row SQL "INSERT ... VALUES (...)" statement into the part
+ * up to and including VALUES and its row list, so that consecutive inserts
+ * with the same prefix can be merged into one multi-row insert. Trailing
+ * blanks and semicolons are not part of the row list. bBackslashEsc tells
+ * if a backslash escapes the next character inside a string literal, which
+ * is not the case for standard conforming SQL strings.
+ * Returns 0 if the statement can be merged, -1 otherwise.
+ */
+int
+splitSQLInsert(uchar *stmt, int bBackslashEsc, size_t *pLenPrefix, uchar **ppRows, size_t *pLenRows)
+{
+	uchar *p = stmt;
+	uchar *rows;
+	uchar *end;
+	int bInQuote = 0;
+	int depth = 0;
+
+	while(isspace(*p))
+		++p;
+	if(strncasecmp((char*)p, "insert", 6) || !isspace(p[6]))
+		return -1;
+	for(p += 6 ; *p != '\0' ; ++p) {
+		if(*p == '\'') {
+			bInQuote = !bInQuote;
+		} else if(bInQuote) {
+			if(bBackslashEsc && *p == '\\' && p[1] != '\0')
+				++p;
+		} else if(!strncasecmp((char*)p, "values", 6) && !isalnum(p[-1]) && p[-1] != '_'
+			  && (isspace(p[6]) || p[6] == '(')) {
+			break;
+		}
+	}
+	if(*p == '\0')
+		return -1;
+	p += 6;
+	*pLenPrefix = p - stmt;
+	while(isspace(*p))
+		++p;
+	rows = p;
+	end = p + strlen((char*)p);
+	while(end > rows && (isspace(end[-1]) || end[-1] == ';'))
+		--end;
+
+	/* only parenthesized rows, separated by commas, may follow. Anything
+	 * else (ON DUPLICATE KEY, RETURNING, a second statement...) would be
+	 * broken by appending more rows.
+	 */
+	bInQuote = 0;
+	for(p = rows ; p < end ; ++p) {
+		if(bInQuote) {
+			if(*p == '\'')
+				bInQuote = 0;
+			else if(bBackslashEsc && *p == '\\' && p + 1 < end)
+				++p;
+		} else if(*p == '\'') {
+			bInQuote = 1;
+		} else if(*p == '(') {
+			++depth;
+		} else if(*p == ')') {
+			if(--depth < 0)
+				return -1;
+		} else if(depth == 0 && *p != ',' && !isspace(*p)) {
+			return -1;
+		}
+	}
+	if(bInQuote || depth != 0 || end == rows || *rows != '(')
+		return -1;
+	*ppRows = rows;
+	*pLenRows = end - rows;
+	return 0;
+}
+
 /* vim:set ai:
  */
@@ -29,6 +29,7 @@
 #include <pthread.h>
 #include <errno.h>
 #include <assert.h>
+#include <math.h>
 
 #include "rsyslog.h"
 #include "unicode-helper.h"
@@ -40,6 +41,7 @@
 
 /* externally-visiable data (see statsobj.h for explanation) */
 int GatherStats = 0;
+pthread_key_t keyStatsShard;
 
 /* static data */
 DEFobjStaticHelpers
@@ -51,6 +53,7 @@ static statsobj_t *objRoot = NULL;
 static statsobj_t *objLast = NULL;
 
 static pthread_mutex_t mutStats;
+static unsigned nextStatsShard = 0;	/* next shard to assign, guarded by mutStats */
 
 /* ------------------------------ statsobj linked list maintenance  ------------------------------ */
 
@@ -97,6 +100,34 @@ addCtrToList(statsobj_t *pThis, ctr_t *pCtr)
 	pthread_mutex_unlock(&pThis->mutCtr);
 }
 
+/* ------------------------------ sharded counters  ------------------------------ */
+
+/* assign a counter shard to the calling thread. This is called only once
+ * per thread, on its first update of a sharded counter.
+ */
+unsigned
+statsShardAssign(void)
+{
+	unsigned idx;
+
+	pthread_mutex_lock(&mutStats);
+	idx = nextStatsShard;
+	nextStatsShard = (nextStatsShard + 1) % STATS_NSHARDS;
+	pthread_mutex_unlock(&mutStats);
+	pthread_setspecific(keyStatsShard, (void*) (uintptr_t) (idx + 1));
+	return idx;
+}
+
+static inline intctr_t
+sumShardedCtr(statsShardedCtr_t *pCtr)
+{
+	intctr_t sum = 0;
+	int i;
+	for(i = 0 ; i < STATS_NSHARDS ; ++i)
+		sum += pCtr->shard[i].s.val;
+	return sum;
+}
+
 /* ------------------------------ methods ------------------------------ */
 
 
@@ -106,6 +137,7 @@ BEGINobjConstruct(statsobj) /* be sure to specify the object type also in END ma
 	pthread_mutex_init(&pThis->mutCtr, NULL);
 	pThis->ctrLast = NULL;
 	pThis->ctrRoot = NULL;
+	pThis->read_notifier = NULL;
 ENDobjConstruct(statsobj)
 
 
@@ -116,6 +148,7 @@ statsobjConstructFinalize(statsobj_t *pThis)
 {
 	DEFiRet;
 	ISOBJ_TYPE_assert(pThis, statsobj);
+	pThis->tPrevLine = getMonotonicUsecs();
 	addToObjList(pThis);
 	RETiRet;
 }
@@ -134,6 +167,19 @@ finalize_it:
 }
 
 
+/* set a read notifier. It is called immediately before the object's stats
+ * line is generated and permits counter providers to update counters that
+ * must be computed (e.g. aggregated from other objects) before output.
+ */
+static rsRetVal
+setReadNotifier(statsobj_t *pThis, statsobj_read_notifier_t notifier, void *ctx)
+{
+	pThis->read_notifier = notifier;
+	pThis->read_notifier_ctx = ctx;
+	return RS_RET_OK;
+}
+
+
 /* add a counter to an object
  * ctrName is duplicated, caller must free it if requried
  * NOTE: The counter is READ-ONLY and MUST NOT be modified (most
@@ -150,6 +196,8 @@ addCounter(statsobj_t *pThis, uchar *ctrName, statsCtrType_t ctrType, int8_t fla
 	CHKmalloc(ctr = malloc(sizeof(ctr_t)));
 	ctr->next = NULL;
 	ctr->prev = NULL;
+	ctr->histName = NULL;
+	ctr->prevVal = 0;
 	CHKmalloc(ctr->name = ustrdup(ctrName));
 	ctr->flags = flags;
 	ctr->ctrType = ctrType;
@@ -160,6 +208,9 @@ addCounter(statsobj_t *pThis, uchar *ctrName, statsCtrType_t ctrType, int8_t fla
 	case ctrType_Int:
 		ctr->val.pInt = (int*) pCtr;
 		break;
+	case ctrType_IntCtrSharded:
+		ctr->val.pShardedCtr = (statsShardedCtr_t*) pCtr;
+		break;
 	}
 	addCtrToList(pThis, ctr);
 
@@ -167,9 +218,51 @@ finalize_it:
 	RETiRet;
 }
 
-static inline void
+/* add a histogram to an object. The buckets are regular counters named
+ * bucketNames[], so they show up in the stats lines just like before.
+ * In addition, each of them knows which histogram it belongs to and its
+ * upper bound le[], which permits exporters to render them as a single
+ * histogram. le[] must be ascending; the last bucket is always taken to
+ * be unbounded, so its le[] entry is ignored.
+ */
+static rsRetVal
+addHistogram(statsobj_t *pThis, uchar *histName, int nBuckets, const char **bucketNames,
+	     const double *le, int8_t flags, intctr_t *pBuckets)
+{
+	int i;
+	DEFiRet;
+
+	for(i = 0 ; i < nBuckets ; ++i) {
+		CHKiRet(addCounter(pThis, (uchar*) bucketNames[i], ctrType_IntCtr, flags, &pBuckets[i]));
+		/* the counter just added is the last one, so we can still access it */
+		CHKmalloc(pThis->ctrLast->histName = ustrdup(histName));
+		pThis->ctrLast->histLe = (i == nBuckets - 1) ? HUGE_VAL : le[i];
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+/* read the current value of a counter */
+static inline intctr_t
+getCtrVal(ctr_t *pCtr)
+{
+	switch(pCtr->ctrType) {
+	case ctrType_IntCtr:
+		return *(pCtr->val.pIntCtr);
+	case ctrType_Int:
+		return (intctr_t) *(pCtr->val.pInt);
+	case ctrType_IntCtrSharded:
+	default:
+		return sumShardedCtr(pCtr->val.pShardedCtr);
+	}
+}
+
+/* returns 1 if the counter was reset, 0 otherwise */
+static inline int
 resetResettableCtr(ctr_t *pCtr, int8_t bResetCtrs)
 {
+	int i;
 	if(bResetCtrs && (pCtr->flags & CTR_FLAG_RESETTABLE)) {
 		switch(pCtr->ctrType) {
 		case ctrType_IntCtr:
@@ -178,16 +271,95 @@ resetResettableCtr(ctr_t *pCtr, int8_t bResetCtrs)
 		case ctrType_Int:
 			*(pCtr->val.pInt) = 0;
 			break;
+		case ctrType_IntCtrSharded:
+			for(i = 0 ; i < STATS_NSHARDS ; ++i)
+				pCtr->val.pShardedCtr->shard[i].s.val = 0;
+			break;
 		}
+		return 1;
+	}
+	return 0;
+}
+
+/* add a single "name<suffix>=value" field to a stats line, or
+ * "name<suffix>":value if bJSON is set. *pnFields counts the fields already
+ * on the line, so that JSON fields can be properly separated.
+ */
+static void
+appendField(cstr_t *pcstr, int bJSON, int *pnFields, uchar *name, const char *suffix, const char *val)
+{
+	if(bJSON) {
+		if(*pnFields > 0)
+			cstrAppendChar(pcstr, ',');
+		cstrAppendChar(pcstr, '"');
+		rsCStrAppendStr(pcstr, name);
+		rsCStrAppendStr(pcstr, (uchar*) suffix);
+		rsCStrAppendStrWithLen(pcstr, UCHAR_CONSTANT("\":"), 2);
+		rsCStrAppendStr(pcstr, (uchar*) val);
+	} else {
+		rsCStrAppendStr(pcstr, name);
+		rsCStrAppendStr(pcstr, (uchar*) suffix);
+		cstrAppendChar(pcstr, '=');
+		rsCStrAppendStr(pcstr, (uchar*) val);
+		cstrAppendChar(pcstr, ' ');
 	}
+	++*pnFields;
 }
 
-/* get all the object's countes together as CEE. */
+/* add the object's counters to a stats line. Each counter's value is
+ * remembered, so that the next line can contain the per-interval delta
+ * (and rate) and leave out unchanged counters, if so requested via the
+ * STATS_LINE_* flags. Deltas are not meaningful for gauges (ctrType_Int),
+ * so these only have their value. A counter lower than in the previous
+ * line has been reset in the mean time; then its full value is the delta.
+ * Returns the number of counters added.
+ */
+static int
+appendCounters(statsobj_t *pThis, cstr_t *pcstr, int bJSON, int *pnFields, int8_t flags)
+{
+	ctr_t *pCtr;
+	intctr_t val;
+	intctr_t delta;
+	uint64_t tNow;
+	double secs;
+	char buf[64];
+	int nCtrs = 0;
+
+	tNow = getMonotonicUsecs();
+	secs = (tNow > pThis->tPrevLine) ? (tNow - pThis->tPrevLine) / 1000000.0 : 0.0;
+	pthread_mutex_lock(&pThis->mutCtr);
+	for(pCtr = pThis->ctrRoot ; pCtr != NULL ; pCtr = pCtr->next) {
+		val = getCtrVal(pCtr);
+		if(!(flags & STATS_LINE_CHANGED) || val != pCtr->prevVal) {
+			if(pCtr->ctrType == ctrType_Int)
+				snprintf(buf, sizeof(buf), "%d", (int) val);
+			else
+				snprintf(buf, sizeof(buf), "%llu", (unsigned long long) val);
+			appendField(pcstr, bJSON, pnFields, pCtr->name, "", buf);
+			if((flags & STATS_LINE_DELTA) && pCtr->ctrType != ctrType_Int) {
+				delta = (val >= pCtr->prevVal) ? val - pCtr->prevVal : val;
+				snprintf(buf, sizeof(buf), "%llu", (unsigned long long) delta);
+				appendField(pcstr, bJSON, pnFields, pCtr->name, ".delta", buf);
+				snprintf(buf, sizeof(buf), "%.2f", (secs > 0.0) ? delta / secs : 0.0);
+				appendField(pcstr, bJSON, pnFields, pCtr->name, ".rate", buf);
+			}
+			++nCtrs;
+		}
+		pCtr->prevVal = resetResettableCtr(pCtr, flags & STATS_LINE_RESET) ? 0 : val;
+	}
+	pthread_mutex_unlock(&pThis->mutCtr);
+	pThis->tPrevLine = tNow;
+	return nCtrs;
+}
+
+/* get all the object's countes together as CEE. If only changed counters
+ * are requested and there are none, *ppcstr is set to NULL.
+ */
 static rsRetVal
-getStatsLineCEE(statsobj_t *pThis, cstr_t **ppcstr, int cee_cookie, int8_t bResetCtrs)
+getStatsLineCEE(statsobj_t *pThis, cstr_t **ppcstr, int cee_cookie, int8_t flags)
 {
 	cstr_t *pcstr;
-	ctr_t *pCtr;
+	int nFields = 0;
 	DEFiRet;
 
 	CHKiRet(cstrConstruct(&pcstr));
@@ -203,31 +375,15 @@ getStatsLineCEE(statsobj_t *pThis, cstr_t **ppcstr, int cee_cookie, int8_t bRese
 	rsCStrAppendStrWithLen(pcstr, UCHAR_CONSTANT("\""), 1);
 	rsCStrAppendStr(pcstr, pThis->name);
 	rsCStrAppendStrWithLen(pcstr, UCHAR_CONSTANT("\""), 1);
-	rsCStrAppendStrWithLen(pcstr, UCHAR_CONSTANT(","), 1);
+	nFields = 1;
 
 	/* now add all counters to this line */
-	pthread_mutex_lock(&pThis->mutCtr);
-	for(pCtr = pThis->ctrRoot ; pCtr != NULL ; pCtr = pCtr->next) {
-		rsCStrAppendStrWithLen(pcstr, UCHAR_CONSTANT("\""), 1);
-		rsCStrAppendStr(pcstr, pCtr->name);
-		rsCStrAppendStrWithLen(pcstr, UCHAR_CONSTANT("\""), 1);
-		cstrAppendChar(pcstr, ':');
-		switch(pCtr->ctrType) {
-		case ctrType_IntCtr:
-			rsCStrAppendInt(pcstr, *(pCtr->val.pIntCtr)); // TODO: OK?????
-			break;
-		case ctrType_Int:
-			rsCStrAppendInt(pcstr, *(pCtr->val.pInt));
-			break;
-		}
-		if (pCtr->next != NULL) {
-			cstrAppendChar(pcstr, ',');
-		} else {
-			cstrAppendChar(pcstr, '}');
-		}
-		resetResettableCtr(pCtr, bResetCtrs);
+	if(appendCounters(pThis, pcstr, 1, &nFields, flags) == 0 && (flags & STATS_LINE_CHANGED)) {
+		rsCStrDestruct(&pcstr);
+		*ppcstr = NULL;
+		FINALIZE;
 	}
-	pthread_mutex_unlock(&pThis->mutCtr);
+	cstrAppendChar(pcstr, '}');
 
 	CHKiRet(cstrFinalize(pcstr));
 	*ppcstr = pcstr;
@@ -237,12 +393,14 @@ finalize_it:
 }
 
 /* get all the object's countes together with object name as one line.
+ * If only changed counters are requested and there are none, *ppcstr is
+ * set to NULL.
  */
 static rsRetVal
-getStatsLine(statsobj_t *pThis, cstr_t **ppcstr, int8_t bResetCtrs)
+getStatsLine(statsobj_t *pThis, cstr_t **ppcstr, int8_t flags)
 {
 	cstr_t *pcstr;
-	ctr_t *pCtr;
+	int nFields = 0;
 	DEFiRet;
 
 	CHKiRet(cstrConstruct(&pcstr));
@@ -250,22 +408,11 @@ getStatsLine(statsobj_t *pThis, cstr_t **ppcstr, int8_t bResetCtrs)
 	rsCStrAppendStrWithLen(pcstr, UCHAR_CONSTANT(": "), 2);
 
 	/* now add all counters to this line */
-	pthread_mutex_lock(&pThis->mutCtr);
-	for(pCtr = pThis->ctrRoot ; pCtr != NULL ; pCtr = pCtr->next) {
-		rsCStrAppendStr(pcstr, pCtr->name);
-		cstrAppendChar(pcstr, '=');
-		switch(pCtr->ctrType) {
-		case ctrType_IntCtr:
-			rsCStrAppendInt(pcstr, *(pCtr->val.pIntCtr)); // TODO: OK?????
-			break;
-		case ctrType_Int:
-			rsCStrAppendInt(pcstr, *(pCtr->val.pInt));
-			break;
-		}
-		cstrAppendChar(pcstr, ' ');
-		resetResettableCtr(pCtr, bResetCtrs);
+	if(appendCounters(pThis, pcstr, 0, &nFields, flags) == 0 && (flags & STATS_LINE_CHANGED)) {
+		rsCStrDestruct(&pcstr);
+		*ppcstr = NULL;
+		FINALIZE;
 	}
-	pthread_mutex_unlock(&pThis->mutCtr);
 
 	CHKiRet(cstrFinalize(pcstr));
 	*ppcstr = pcstr;
@@ -279,27 +426,34 @@ finalize_it:
  * a callback must be provided. This module than iterates over all objects and
  * submits each stats line to the callback. The callback has two parameters:
  * the first one is a caller-provided void*, the second one the cstr_t with the
- * line. If the callback reports an error, processing is stopped.
+ * line. If the callback reports an error, processing is stopped. flags are
+ * a combination of STATS_LINE_*. Note that the previous values needed for
+ * deltas are kept in the counters, so only a single caller should request
+ * STATS_LINE_DELTA or STATS_LINE_CHANGED.
  */
 static rsRetVal
-getAllStatsLines(rsRetVal(*cb)(void*, cstr_t*), void *usrptr, statsFmtType_t fmt, int8_t bResetCtrs)
+getAllStatsLines(rsRetVal(*cb)(void*, cstr_t*), void *usrptr, statsFmtType_t fmt, int8_t flags)
 {
 	statsobj_t *o;
 	cstr_t *cstr;
 	DEFiRet;
 
 	for(o = objRoot ; o != NULL ; o = o->next) {
+		if(o->read_notifier != NULL)
+			o->read_notifier(o, o->read_notifier_ctx);
 		switch(fmt) {
 		case statsFmt_Legacy:
-			CHKiRet(getStatsLine(o, &cstr, bResetCtrs));
+			CHKiRet(getStatsLine(o, &cstr, flags));
 			break;
 		case statsFmt_CEE:
-			CHKiRet(getStatsLineCEE(o, &cstr, 1, bResetCtrs));
+			CHKiRet(getStatsLineCEE(o, &cstr, 1, flags));
 			break;
 		case statsFmt_JSON:
-			CHKiRet(getStatsLineCEE(o, &cstr, 0, bResetCtrs));
+			CHKiRet(getStatsLineCEE(o, &cstr, 0, flags));
 			break;
 		}
+		if(cstr == NULL)
+			continue; /* nothing changed */
 		CHKiRet(cb(usrptr, cstr));
 		rsCStrDestruct(&cstr);
 	}
@@ -309,6 +463,39 @@ finalize_it:
 }
 
 
+/* call cb for each counter of all objects, which permits callers to generate
+ * their own formats without going through the stats lines. The callback gets
+ * the caller-provided void*, the object name, the counter and its current
+ * value. If the callback reports an error, processing is stopped. The
+ * counter must not be modified or retained by the callback.
+ */
+static rsRetVal
+getAllCounters(rsRetVal(*cb)(void*, uchar*, ctr_t*, intctr_t), void *usrptr)
+{
+	statsobj_t *o;
+	ctr_t *pCtr;
+	intctr_t val;
+	DEFiRet;
+
+	for(o = objRoot ; o != NULL ; o = o->next) {
+		if(o->read_notifier != NULL)
+			o->read_notifier(o, o->read_notifier_ctx);
+		pthread_mutex_lock(&o->mutCtr);
+		for(pCtr = o->ctrRoot ; pCtr != NULL ; pCtr = pCtr->next) {
+			val = getCtrVal(pCtr);
+			if((iRet = cb(usrptr, o->name, pCtr, val)) != RS_RET_OK)
+				break;
+		}
+		pthread_mutex_unlock(&o->mutCtr);
+		if(iRet != RS_RET_OK)
+			FINALIZE;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* Enable statistics gathering. currently there is no function to disable it
  * again, as this is right now not needed.
  */
@@ -332,6 +519,7 @@ CODESTARTobjDestruct(statsobj)
 		ctrToDel = ctr;
 		ctr = ctr->next;
 		free(ctrToDel->name);
+		free(ctrToDel->histName);
 		free(ctrToDel);
 	}
 
@@ -365,10 +553,13 @@ CODESTARTobjQueryInterface(statsobj)
 	pIf->Destruct = statsobjDestruct;
 	pIf->DebugPrint = statsobjDebugPrint;
 	pIf->SetName = setName;
+	pIf->SetReadNotifier = setReadNotifier;
 	//pIf->GetStatsLine = getStatsLine;
 	pIf->GetAllStatsLines = getAllStatsLines;
 	pIf->AddCounter = addCounter;
 	pIf->EnableStats = enableStats;
+	pIf->AddHistogram = addHistogram;
+	pIf->GetAllCounters = getAllCounters;
 finalize_it:
 ENDobjQueryInterface(statsobj)
 
@@ -385,6 +576,7 @@ BEGINAbstractObjClassInit(statsobj, 1, OBJ_IS_CORE_MODULE) /* class, version */
 
 	/* init other data items */
 	pthread_mutex_init(&mutStats, NULL);
+	pthread_key_create(&keyStatsShard, NULL);
 
 ENDObjClassInit(statsobj)
 
@@ -393,4 +585,5 @@ ENDObjClassInit(statsobj)
 BEGINObjClassExit(statsobj, OBJ_IS_CORE_MODULE) /* class, version */
 	/* release objects we no longer need */
 	pthread_mutex_destroy(&mutStats);
+	pthread_key_delete(keyStatsShard);
 ENDObjClassExit(statsobj)
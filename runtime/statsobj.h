@@ -21,6 +21,8 @@
 #ifndef INCLUDED_STATSOBJ_H
 #define INCLUDED_STATSOBJ_H
 
+#include <pthread.h>
+#include <stdint.h>
 #include "atomic.h"
 
 /* The following data item is somewhat dirty, in that it does not follow
@@ -37,10 +39,47 @@ extern int GatherStats;
  */
 typedef uint64 intctr_t;
 
+/* sharded counters
+ * Counters updated by many threads at high rates suffer from cache line
+ * contention, even with atomic instructions (and without 64 bit atomics,
+ * from the helper mutex). A sharded counter spreads the updates over
+ * STATS_NSHARDS cache lines, with each thread using one of them. The
+ * stats subsystem sums up the shards when the counter is read.
+ * Sharded counters are registered as ctrType_IntCtrSharded and MUST only
+ * be modified via the STATSCOUNTER_SHARDED_* macros.
+ */
+#define STATS_NSHARDS 16
+typedef union statsShard_u {
+	struct {
+		intctr_t val;
+		DEF_ATOMIC_HELPER_MUT64(mut);
+	} s;
+	char pad[64];	/* one shard per cache line */
+} statsShard_t;
+
+typedef struct statsShardedCtr_s {
+	statsShard_t shard[STATS_NSHARDS];
+} statsShardedCtr_t;
+
+/* threads are assigned shards round-robin on first use. The shard
+ * index is kept in thread-specific data, much like GatherStats below,
+ * it is accessed directly for speed.
+ */
+extern pthread_key_t keyStatsShard;
+unsigned statsShardAssign(void);
+
+static inline unsigned
+statsShardIdx(void)
+{
+	const uintptr_t idx = (uintptr_t) pthread_getspecific(keyStatsShard);
+	return (idx != 0) ? (unsigned) (idx - 1) : statsShardAssign();
+}
+
 /* counter types */
 typedef enum statsCtrType_e {
 	ctrType_IntCtr,
-	ctrType_Int
+	ctrType_Int,
+	ctrType_IntCtrSharded
 } statsCtrType_t;
 
 /* stats line format types */
@@ -54,6 +93,11 @@ typedef enum statsFmtType_e {
 #define CTR_FLAG_NONE 0
 #define CTR_FLAG_RESETTABLE 1
 
+/* stats line flags, for GetAllStatsLines() */
+#define STATS_LINE_RESET 1	/* reset resettable counters after reading them */
+#define STATS_LINE_DELTA 2	/* add .delta and .rate fields since the previous stats line */
+#define STATS_LINE_CHANGED 4	/* only include counters changed since the previous stats line */
+
 /* helper entity, the counter */
 typedef struct ctr_s {
 	uchar *name;
@@ -61,11 +105,18 @@ typedef struct ctr_s {
 	union {
 		intctr_t *pIntCtr;
 		int *pInt;
+		statsShardedCtr_t *pShardedCtr;
 	} val;
 	int8_t flags;
+	uchar *histName;	/* name of histogram this is a bucket of, NULL if none */
+	double histLe;		/* upper bound (inclusive) of histogram bucket */
+	intctr_t prevVal;	/* value in previous stats line (after reset, if any) */
 	struct ctr_s *next, *prev;
 } ctr_t;
 
+/* read notifier, called before the stats line of an object is generated */
+typedef void (*statsobj_read_notifier_t)(statsobj_t *, void *);
+
 /* the statsobj object */
 struct statsobj_s {
 	BEGINobjInstance;		/* Data to implement generic object - MUST be the first data element! */
@@ -73,6 +124,9 @@ struct statsobj_s {
 	pthread_mutex_t mutCtr;		/* to guard counter linked-list ops */
 	ctr_t *ctrRoot;			/* doubly-linked list of statsobj counters */
 	ctr_t *ctrLast;
+	statsobj_read_notifier_t read_notifier;
+	void *read_notifier_ctx;
+	uint64_t tPrevLine;		/* monotonic time of previous stats line (or of creation) */
 	/* used to link ourselves together */
 	statsobj_t *prev;
 	statsobj_t *next;
@@ -86,17 +140,25 @@ BEGINinterface(statsobj) /* name must also be changed in ENDinterface macro! */
 	rsRetVal (*ConstructFinalize)(statsobj_t *pThis);
 	rsRetVal (*Destruct)(statsobj_t **ppThis);
 	rsRetVal (*SetName)(statsobj_t *pThis, uchar *name);
+	rsRetVal (*SetReadNotifier)(statsobj_t *pThis, statsobj_read_notifier_t notifier, void *ctx);
 	//rsRetVal (*GetStatsLine)(statsobj_t *pThis, cstr_t **ppcstr);
-	rsRetVal (*GetAllStatsLines)(rsRetVal(*cb)(void*, cstr_t*), void *usrptr, statsFmtType_t fmt, int8_t bResetCtr);
+	rsRetVal (*GetAllStatsLines)(rsRetVal(*cb)(void*, cstr_t*), void *usrptr, statsFmtType_t fmt, int8_t flags);
 	rsRetVal (*AddCounter)(statsobj_t *pThis, uchar *ctrName, statsCtrType_t ctrType, int8_t flags, void *pCtr);
 	rsRetVal (*EnableStats)(void);
+	rsRetVal (*AddHistogram)(statsobj_t *pThis, uchar *histName, int nBuckets, const char **bucketNames,
+				 const double *le, int8_t flags, intctr_t *pBuckets);
+	rsRetVal (*GetAllCounters)(rsRetVal(*cb)(void*, uchar*, ctr_t*, intctr_t), void *usrptr);
 ENDinterface(statsobj)
-#define statsobjCURR_IF_VERSION 11 /* increment whenever you change the interface structure! */
+#define statsobjCURR_IF_VERSION 14 /* increment whenever you change the interface structure! */
 /* Changes
  * v2-v9 rserved for future use in "older" version branches
  * v10, 2012-04-01: GetAllStatsLines got fmt parameter
  * v11, 2013-09-07: - add "flags" to AddCounter API
  *                  - GetAllStatsLines got parameter telling if ctrs shall be reset
+ * v12, 2026-10-14: added SetReadNotifier
+ * v13, 2026-10-14: added AddHistogram and GetAllCounters
+ * v14, 2026-10-14: GetAllStatsLines takes STATS_LINE_* flags (STATS_LINE_RESET
+ *                  is the former reset parameter)
  */
 
 
@@ -149,10 +211,31 @@ PROTOTYPEObj(statsobj);
 	if(GatherStats) \
 		ATOMIC_INC_uint64(&ctr, &mut);
 
+#define STATSCOUNTER_ADD(ctr, mut, val) \
+	if(GatherStats) \
+		ATOMIC_ADD_uint64(&ctr, &mut, val);
+
 #define STATSCOUNTER_DEC(ctr, mut) \
 	if(GatherStats) \
 		ATOMIC_DEC_uint64(&ctr, mut);
 
+#define STATSCOUNTER_SHARDED_DEF(ctr) \
+	statsShardedCtr_t ctr;
+
+#define STATSCOUNTER_SHARDED_INIT(ctr) { \
+		int iShard_; \
+		for(iShard_ = 0 ; iShard_ < STATS_NSHARDS ; ++iShard_) { \
+			INIT_ATOMIC_HELPER_MUT64((ctr).shard[iShard_].s.mut); \
+			(ctr).shard[iShard_].s.val = 0; \
+		} \
+	}
+
+#define STATSCOUNTER_SHARDED_INC(ctr) \
+	if(GatherStats) { \
+		statsShard_t *const pShard_ = &(ctr).shard[statsShardIdx()]; \
+		ATOMIC_INC_uint64(&pShard_->s.val, &pShard_->s.mut); \
+	}
+
 /* the next macro works only if the variable is already guarded
  * by mutex (or the users risks a wrong result). It is assumed 
  * that there are not concurrent operations that modify the counter.
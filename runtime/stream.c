@@ -47,7 +47,10 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>	 /* required for HP UX */
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <errno.h>
+#include <time.h>
 #include <pthread.h>
 
 #include "rsyslog.h"
@@ -58,6 +61,10 @@
 #include "unicode-helper.h"
 #include "module-template.h"
 #include "cryprov.h"
+#include "compprov.h"
+#include "uring.h"
+#include "zippool.h"
+#include "probes.h"
 #if HAVE_SYS_PRCTL_H
 #  include <sys/prctl.h>
 #endif
@@ -80,9 +87,16 @@ static rsRetVal strmWrite(strm_t *__restrict__ const pThis, const uchar *__restr
 static rsRetVal strmCloseFile(strm_t *pThis);
 static void *asyncWriterThread(void *pPtr);
 static rsRetVal doZipWrite(strm_t *pThis, uchar *pBuf, size_t lenBuf, int bFlush);
+static rsRetVal doZipWriteParallel(strm_t *pThis, uchar *pBuf, size_t lenBuf, int bFlush);
 static rsRetVal doZipFinish(strm_t *pThis);
+static rsRetVal strmZipDrain(strm_t *pThis);
 static rsRetVal strmPhysWrite(strm_t *pThis, uchar *pBuf, size_t lenBuf);
 static rsRetVal strmSeekCurrOffs(strm_t *pThis);
+static rsRetVal syncFile(strm_t *pThis);
+static rsRetVal strmMmapOpen(strm_t *pThis);
+static void strmMmapClose(strm_t *pThis);
+static rsRetVal strmHandleEOF(strm_t *pThis);
+static rsRetVal strmCheckNextOutputFile(strm_t *pThis);
 
 
 /* methods */
@@ -159,6 +173,78 @@ finalize_it:
 }
 
 
+/* rotate the (closed) file pszCurrFName by renaming it, as configured by
+ * iSizeLimitRotate. This is just a couple of rename() calls, so it can be
+ * done inline without stalling the writer. The next write creates a new
+ * file under the original name. If a size limit command is set, it is
+ * started afterwards but not waited for. If it has no argument of its own,
+ * it receives the name of the rotated file.
+ */
+static rsRetVal
+rotateSizeLimitFile(strm_t *pThis, uchar *pszCurrFName)
+{
+	uchar oldName[MAXFNAME];
+	uchar newName[MAXFNAME];
+	uchar *pCmd = NULL;
+	uchar *p;
+	time_t tt;
+	struct tm tm;
+	int i;
+	DEFiRet;
+
+	if(pThis->iSizeLimitRotate == STRM_ROTATE_NUMBERED) {
+		for(i = pThis->iSizeLimitKeep - 1 ; i > 0 ; --i) {
+			snprintf((char*)oldName, sizeof(oldName), "%s.%d", pszCurrFName, i);
+			snprintf((char*)newName, sizeof(newName), "%s.%d", pszCurrFName, i + 1);
+			if(rename((char*)oldName, (char*)newName) != 0 && errno != ENOENT)
+				DBGPRINTF("strm %p: could not rename '%s' to '%s', errno %d\n",
+					  pThis, oldName, newName, errno);
+		}
+		snprintf((char*)newName, sizeof(newName), "%s.1", pszCurrFName);
+	} else {
+		tt = time(NULL);
+		localtime_r(&tt, &tm);
+		i = snprintf((char*)newName, sizeof(newName), "%s.", pszCurrFName);
+		strftime((char*)newName + i, sizeof(newName) - i, "%Y%m%d-%H%M%S", &tm);
+		/* do not overwrite a file rotated within the same second */
+		for(i = 1 ; access((char*)newName, F_OK) == 0 ; ++i) {
+			snprintf((char*)oldName, sizeof(oldName), "%s.%d", newName, i);
+			if(access((char*)oldName, F_OK) != 0) {
+				memcpy(newName, oldName, sizeof(newName));
+				break;
+			}
+		}
+	}
+
+	if(rename((char*)pszCurrFName, (char*)newName) != 0) {
+		char errStr[1024];
+		rs_strerror_r(errno, errStr, sizeof(errStr));
+		DBGPRINTF("strm %p: could not rotate file '%s' to '%s': %s\n",
+			  pThis, pszCurrFName, newName, errStr);
+		pThis->bDisabled = 1;
+		ABORT_FINALIZE(RS_RET_SIZELIMITCMD_DIDNT_RESOLVE);
+	}
+	DBGPRINTF("strm %p: size limit reached, rotated '%s' to '%s'\n", pThis, pszCurrFName, newName);
+
+	if(pThis->pszSizeLimitCmd != NULL) {
+		CHKmalloc(pCmd = ustrdup(pThis->pszSizeLimitCmd));
+		for(p = pCmd ; *p && *p != ' ' ; ++p) {
+			/* JUST SKIP */
+		}
+		if(*p == ' ') {
+			*p = '\0';
+			execProg(pCmd, 0, p+1);
+		} else {
+			execProg(pCmd, 0, newName);
+		}
+	}
+
+finalize_it:
+	free(pCmd);
+	RETiRet;
+}
+
+
 /* Check if the file has grown beyond the configured omfile iSizeLimit
  * and, if so, initiate processing.
  */
@@ -178,7 +264,11 @@ doSizeLimitProcessing(strm_t *pThis)
 		 */
 		CHKmalloc(pszCurrFName = ustrdup(pThis->pszCurrFName));
 		CHKiRet(strmCloseFile(pThis));
-		CHKiRet(resolveFileSizeLimit(pThis, pszCurrFName));
+		if(pThis->iSizeLimitRotate == STRM_ROTATE_COMMAND) {
+			CHKiRet(resolveFileSizeLimit(pThis, pszCurrFName));
+		} else {
+			CHKiRet(rotateSizeLimitFile(pThis, pszCurrFName));
+		}
 	}
 
 finalize_it:
@@ -193,10 +283,13 @@ finalize_it:
  * strm instance object.
  */
 
-/* do the physical open() call on a file.
+/* do the physical open() call on a file. If pFileSize is not NULL, it
+ * receives the size of the opened file. We obtain everything we need to
+ * know about the file with a single fstat(), because the open is repeated
+ * whenever a caller closes idle files to save descriptors (see Close()).
  */
 static rsRetVal
-doPhysOpen(strm_t *pThis)
+doPhysOpen(strm_t *pThis, off_t *pFileSize)
 {
 	int iFlags = 0;
 	struct stat statOpen;
@@ -209,7 +302,8 @@ doPhysOpen(strm_t *pThis)
 			iFlags = O_CLOEXEC | O_NOCTTY | O_RDONLY;
 			break;
 		case STREAMMODE_WRITE:	/* legacy mode used inside queue engine */
-			iFlags = O_CLOEXEC | O_NOCTTY | O_WRONLY | O_CREAT;
+			/* a writable mapping requires the file to be opened for reading as well */
+			iFlags = O_CLOEXEC | O_NOCTTY | (pThis->bMmap ? O_RDWR : O_WRONLY) | O_CREAT;
 			break;
 		case STREAMMODE_WRITE_TRUNC:
 			iFlags = O_CLOEXEC | O_NOCTTY | O_WRONLY | O_CREAT | O_TRUNC;
@@ -239,15 +333,17 @@ doPhysOpen(strm_t *pThis)
 			ABORT_FINALIZE(RS_RET_IO_ERROR);
 	}
 
-	if(pThis->tOperationsMode == STREAMMODE_READ) {
-		if(fstat(pThis->fd, &statOpen) == -1) {
-			DBGPRINTF("Error: cannot obtain inode# for file %s\n", pThis->pszCurrFName);
-			ABORT_FINALIZE(RS_RET_IO_ERROR);
-		}
-		pThis->inode = statOpen.st_ino;
+	if(fstat(pThis->fd, &statOpen) == -1) {
+		DBGPRINTF("Error: cannot obtain inode# for file %s\n", pThis->pszCurrFName);
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
 	}
+	if(pThis->tOperationsMode == STREAMMODE_READ)
+		pThis->inode = statOpen.st_ino;
+	if(pFileSize != NULL)
+		*pFileSize = statOpen.st_size;
 
-	if(!ustrcmp(pThis->pszCurrFName, UCHAR_CONSTANT(_PATH_CONSOLE)) || isatty(pThis->fd)) {
+	if(   !ustrcmp(pThis->pszCurrFName, UCHAR_CONSTANT(_PATH_CONSOLE))
+	   || (S_ISCHR(statOpen.st_mode) && isatty(pThis->fd))) {
 		DBGPRINTF("file %d is a tty-type file\n", pThis->fd);
 		pThis->bIsTTY = 1;
 	} else {
@@ -265,6 +361,134 @@ finalize_it:
 }
 
 
+/* File space preallocation. Files that grow by many small appends tend to
+ * fragment, and each append that needs a new extent causes a metadata
+ * update. If iPreallocSize is set, we allocate space ahead of the writes in
+ * chunks of that size. FALLOC_FL_KEEP_SIZE keeps the file size as is, so
+ * appending and readers are not affected. Chunks never reach beyond the
+ * size at which the file is rotated. When the file is closed, the space
+ * beyond its end is released again. If the file system does not support
+ * preallocation, it is turned off for the stream.
+ */
+static void
+strmPrealloc(strm_t *pThis, size_t lenBuf)
+{
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+	int64 iEnd;
+	int64 iStart;
+	int64 iLimit;
+
+	if(pThis->iCurrOffs + (int64) lenBuf <= pThis->iPreallocEnd)
+		return;
+	iEnd = ((pThis->iCurrOffs + lenBuf + pThis->iPreallocSize - 1) / pThis->iPreallocSize)
+		* pThis->iPreallocSize;
+	iLimit = (pThis->sType == STREAMTYPE_FILE_CIRCULAR) ? pThis->iMaxFileSize : pThis->iSizeLimit;
+	if(iLimit > 0 && iEnd > iLimit)
+		iEnd = (iLimit > pThis->iCurrOffs + (int64) lenBuf) ? iLimit : pThis->iCurrOffs + (int64) lenBuf;
+	iStart = (pThis->iPreallocEnd > pThis->iCurrOffs) ? pThis->iPreallocEnd : pThis->iCurrOffs;
+	if(fallocate(pThis->fd, FALLOC_FL_KEEP_SIZE, iStart, iEnd - iStart) != 0) {
+		DBGOPRINT((obj_t*) pThis, "file %d: fallocate failed with error %d, preallocation "
+			  "turned off\n", pThis->fd, errno);
+		pThis->iPreallocSize = 0;
+		return;
+	}
+	pThis->iPreallocEnd = iEnd;
+#else
+	(void) lenBuf;
+	pThis->iPreallocSize = 0;
+#endif
+}
+
+
+/* release preallocated space beyond the end of the file, called on close */
+static void
+strmPreallocRelease(strm_t *pThis)
+{
+	struct stat statFile;
+
+	/* the file size may be larger than our offset if someone else
+	 * appends to the file, so we must not truncate to iCurrOffs.
+	 */
+	if(fstat(pThis->fd, &statFile) == 0 && statFile.st_size < pThis->iPreallocEnd) {
+		if(ftruncate(pThis->fd, statFile.st_size) != 0) {
+			DBGOPRINT((obj_t*) pThis, "file %d: releasing preallocated space failed "
+				  "with error %d - ignored\n", pThis->fd, errno);
+		}
+	}
+	pThis->iPreallocEnd = 0;
+}
+
+
+/* O_DIRECT output mode (bDirectIO). Output files that are only archived
+ * gain nothing from the page cache, but their writeback evicts data that
+ * is actually needed. In this mode, whole blocks are written via a second,
+ * O_DIRECT descriptor of the file, from an aligned staging buffer. A
+ * partial block at the end of a write is written through the normal
+ * descriptor, so the file always holds everything written so far (at the
+ * cost of one cached page per file), and it is kept in the staging buffer,
+ * to be rewritten in full by the next direct write. This is also how we
+ * start on an existing file whose size is not block-aligned. Only plain
+ * single files are supported; if the file system does not support O_DIRECT,
+ * we silently use the normal descriptor.
+ */
+#define STRM_DIRECTIO_ALIGN 4096
+
+static void
+strmDirectClose(strm_t *pThis)
+{
+	if(pThis->fdDirect != -1) {
+		close(pThis->fdDirect);
+		pThis->fdDirect = -1;
+	}
+	pThis->lenDirBuf = 0;
+}
+
+
+/* called after the file has been opened and iCurrOffs is set. Errors are
+ * not fatal, they just make us use buffered writes.
+ */
+static void
+strmDirectOpen(strm_t *pThis)
+{
+#ifdef O_DIRECT
+	size_t lenTail;
+	ssize_t lenRead;
+
+	if(pThis->sType != STREAMTYPE_FILE_SINGLE || pThis->bIsTTY || pThis->pMmap != NULL
+	   || pThis->tOperationsMode == STREAMMODE_READ)
+		return;
+	if(pThis->pDirBuf == NULL) {
+		pThis->sizeDirBuf = (pThis->sIOBufSize + 2 * STRM_DIRECTIO_ALIGN - 1)
+				    & ~((size_t) STRM_DIRECTIO_ALIGN - 1);
+		if(posix_memalign((void**) &pThis->pDirBuf, STRM_DIRECTIO_ALIGN, pThis->sizeDirBuf) != 0) {
+			pThis->pDirBuf = NULL;
+			return;
+		}
+	}
+	/* we need to read back the tail of a non-aligned file */
+	pThis->fdDirect = open((char*)pThis->pszCurrFName, O_RDWR | O_DIRECT | O_CLOEXEC | O_NOCTTY | O_LARGEFILE);
+	if(pThis->fdDirect == -1) {
+		DBGOPRINT((obj_t*) pThis, "file '%s': cannot open with O_DIRECT, error %d - using "
+			  "buffered writes\n", pThis->pszCurrFName, errno);
+		return;
+	}
+	pThis->iDirOffs = pThis->iCurrOffs & ~((int64) STRM_DIRECTIO_ALIGN - 1);
+	lenTail = pThis->iCurrOffs - pThis->iDirOffs;
+	pThis->lenDirBuf = 0;
+	if(lenTail > 0) {
+		lenRead = pread(pThis->fdDirect, pThis->pDirBuf, STRM_DIRECTIO_ALIGN, pThis->iDirOffs);
+		if(lenRead < (ssize_t) lenTail) {
+			DBGOPRINT((obj_t*) pThis, "file '%s': cannot read partial last block, error %d - "
+				  "using buffered writes\n", pThis->pszCurrFName, errno);
+			strmDirectClose(pThis);
+			return;
+		}
+		pThis->lenDirBuf = lenTail;
+	}
+#endif
+}
+
+
 static rsRetVal
 strmSetCurrFName(strm_t *pThis)
 {
@@ -319,12 +543,15 @@ finalize_it:
  */
 static rsRetVal strmOpenFile(strm_t *pThis)
 {
+	off_t offset;
 	DEFiRet;
 
 	ASSERT(pThis != NULL);
 
 	if(pThis->fd != -1)
 		ABORT_FINALIZE(RS_RET_OK);
+	/* the name of a previously closed file is still set, see Close() */
+	free(pThis->pszCurrFName);
 	pThis->pszCurrFName = NULL; /* used to prevent mem leak in case of error */
 
 	if(pThis->pszFName == NULL)
@@ -332,15 +559,24 @@ static rsRetVal strmOpenFile(strm_t *pThis)
 
 	CHKiRet(strmSetCurrFName(pThis));
 	
-	CHKiRet(doPhysOpen(pThis));
+	CHKiRet(doPhysOpen(pThis, &offset));
 
 	pThis->iCurrOffs = 0;
+	pThis->iZipPhysOffs = 0;
+	pThis->iHintPhys = 0;
+	pThis->iHintLog = 0;
 	if(pThis->tOperationsMode == STREAMMODE_WRITE_APPEND) {
 		/* we need to obtain the current offset */
-		off_t offset;
-		CHKiRet(getFileSize(pThis->pszCurrFName, &offset));
 		pThis->iCurrOffs = offset;
 	}
+	pThis->iPreallocEnd = 0;
+	if(pThis->bIsTTY || pThis->sType == STREAMTYPE_NAMED_PIPE || pThis->bMmap)
+		pThis->iPreallocSize = 0; /* mmap segments are allocated in full */
+	if(pThis->bDirectIO)
+		strmDirectOpen(pThis);
+
+	if(pThis->bMmap)
+		CHKiRet(strmMmapOpen(pThis));
 
 	DBGOPRINT((obj_t*) pThis, "opened file '%s' for %s as %d\n", pThis->pszCurrFName,
 		  (pThis->tOperationsMode == STREAMMODE_READ) ? "READ" : "WRITE", pThis->fd);
@@ -404,6 +640,12 @@ static rsRetVal strmCloseFile(strm_t *pThis)
 		if(pThis->bAsyncWrite) {
 			strmWaitAsyncWriterDone(pThis);
 		}
+		/* with deferred sync, the caller syncs only at its commit points. The
+		 * tail of the file must nevertheless be on disk before we move on.
+		 */
+		if(pThis->bDeferSync && pThis->fd != -1) {
+			syncFile(pThis);
+		}
 	}
 
 	/* if we have a signature provider, we must make sure that the crypto
@@ -416,6 +658,10 @@ static rsRetVal strmCloseFile(strm_t *pThis)
 	 * against this. -- rgerhards, 2010-03-19
 	 */
 	if(pThis->fd != -1) {
+		strmMmapClose(pThis);
+		if(pThis->iPreallocEnd > 0)
+			strmPreallocRelease(pThis);
+		strmDirectClose(pThis);
 		currOffs = lseek64(pThis->fd, 0, SEEK_CUR);
 		close(pThis->fd);
 		pThis->fd = -1;
@@ -426,6 +672,11 @@ static rsRetVal strmCloseFile(strm_t *pThis)
 		}
 	}
 
+	if(pThis->tOperationsMode == STREAMMODE_READ && pThis->bzInitDone) {
+		zlibw.InflateEnd(&pThis->zstrm);
+		pThis->bzInitDone = 0;
+	}
+
 	if(pThis->fdDir != -1) {
 		/* close associated directory handle, if it is open */
 		close(pThis->fdDir);
@@ -457,6 +708,255 @@ finalize_it:
 }
 
 
+/* memory-mapped segment support
+ * In mmap mode, the files of a circular stream are segments which are
+ * preallocated to the max file size and mapped into memory. A write is a
+ * memcpy() into the mapping and reads are done in place. The last octets of
+ * an open segment are a trailer that records how much of the segment contains
+ * valid data, so readers (and a restart after a crash) know where the data ends
+ * without scanning the preallocated space. When a segment is closed, it is
+ * truncated to its data length, so closed segments are regular stream files.
+ */
+#define STRM_SEG_MAGIC "rsqseg01"
+
+typedef struct strmSegTrailer_s {
+	uint64_t dataLen;	/* nbr of valid data octets in this segment */
+	char magic[8];		/* STRM_SEG_MAGIC, not NUL-terminated */
+} strmSegTrailer_t;
+
+
+/* obtain the data length of a file of the given size. This is the file
+ * size for regular files and the length recorded in the trailer for
+ * segments that are (or were, in case of a crash) open in mmap mode.
+ */
+static int64
+getSegDataLen(int fd, off64_t fileSize)
+{
+	strmSegTrailer_t trailer;
+
+	if(fileSize < (off64_t) sizeof(trailer))
+		return fileSize;
+	if(pread(fd, &trailer, sizeof(trailer), fileSize - sizeof(trailer)) != sizeof(trailer))
+		return fileSize;
+	if(memcmp(trailer.magic, STRM_SEG_MAGIC, sizeof(trailer.magic))
+	   || trailer.dataLen > (uint64_t) fileSize - sizeof(trailer))
+		return fileSize;
+	return (int64) trailer.dataLen;
+}
+
+
+static inline strmSegTrailer_t *
+getSegTrailer(strm_t *pThis)
+{
+	return (strmSegTrailer_t*) (pThis->pMmap + pThis->lenMmap - sizeof(strmSegTrailer_t));
+}
+
+
+/* remove the mapping of the current file (if there is one). In read mode,
+ * the IO buffer points into the mapping and is switched back to the real one.
+ */
+static void
+strmMmapUnmap(strm_t *pThis)
+{
+	if(pThis->pMmap == NULL)
+		return;
+	munmap(pThis->pMmap, pThis->lenMmap);
+	pThis->pMmap = NULL;
+	pThis->lenMmap = 0;
+	if(pThis->pIOBufSave != NULL) {
+		pThis->pIOBuf = pThis->pIOBufSave;
+		pThis->pIOBufSave = NULL;
+		pThis->iBufPtr = 0;
+		pThis->iBufPtrMax = 0;
+	}
+}
+
+
+/* map the first lenMap octets of the current file, replacing any previous mapping */
+static rsRetVal
+strmMmapMap(strm_t *pThis, size_t lenMap)
+{
+	void *pMap;
+	DEFiRet;
+
+	strmMmapUnmap(pThis);
+	pMap = mmap(NULL, lenMap,
+		    (pThis->tOperationsMode == STREAMMODE_READ) ? PROT_READ : PROT_READ | PROT_WRITE,
+		    MAP_SHARED, pThis->fd, 0);
+	if(pMap == MAP_FAILED) {
+		char errStr[1024];
+		rs_strerror_r(errno, errStr, sizeof(errStr));
+		DBGOPRINT((obj_t*) pThis, "mmap of %llu octets of file %d failed: %s\n",
+			  (long long unsigned) lenMap, pThis->fd, errStr);
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+	pThis->pMmap = pMap;
+	pThis->lenMmap = lenMap;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* size the current segment so that it can hold at least lenData octets,
+ * (re)map it and write a trailer recording dataLen valid octets. The disk
+ * space is preallocated if the platform supports it, so that running out of
+ * disk space is reported here and not by a SIGBUS while writing to the mapping.
+ */
+static rsRetVal
+strmMmapExtend(strm_t *pThis, int64 lenData, int64 dataLen)
+{
+	int64 lenFile;
+	long lenPage;
+	strmSegTrailer_t *pTrailer;
+	DEFiRet;
+
+	lenPage = sysconf(_SC_PAGESIZE);
+	if(lenPage <= 0)
+		lenPage = 4096;
+	lenFile = lenData + sizeof(strmSegTrailer_t);
+	lenFile = ((lenFile + lenPage - 1) / lenPage) * lenPage;
+#ifdef HAVE_POSIX_FALLOCATE
+	if(posix_fallocate(pThis->fd, 0, lenFile) != 0) {
+#else
+	if(ftruncate(pThis->fd, lenFile) != 0) {
+#endif
+		DBGOPRINT((obj_t*) pThis, "could not preallocate %lld octets for file %d\n",
+			  (long long) lenFile, pThis->fd);
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+	CHKiRet(strmMmapMap(pThis, (size_t) lenFile));
+	pTrailer = getSegTrailer(pThis);
+	pTrailer->dataLen = dataLen;
+	memcpy(pTrailer->magic, STRM_SEG_MAGIC, sizeof(pTrailer->magic));
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* set up mmap mode for a freshly opened file. Read streams map the file
+ * lazily in strmMmapReadBuf(). For write streams, we preallocate and map the
+ * segment. If the file already exists (restart), we first cut off any trailer
+ * (which may be left over from a crash) so that only one trailer exists.
+ */
+static rsRetVal
+strmMmapOpen(strm_t *pThis)
+{
+	struct stat statFile;
+	int64 dataLen;
+	DEFiRet;
+
+	if(pThis->tOperationsMode == STREAMMODE_READ)
+		FINALIZE;
+
+	if(fstat(pThis->fd, &statFile) == -1)
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	dataLen = getSegDataLen(pThis->fd, statFile.st_size);
+	if(dataLen != statFile.st_size && ftruncate(pThis->fd, dataLen) != 0)
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	CHKiRet(strmMmapExtend(pThis, (dataLen > pThis->iMaxFileSize) ? dataLen : pThis->iMaxFileSize,
+			       dataLen));
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* end mmap mode for the current file, which is about to be closed. A write
+ * segment is truncated to its data length, which also removes the trailer.
+ * The caller is responsible for syncing the data before, if required.
+ */
+static void
+strmMmapClose(strm_t *pThis)
+{
+	int64 dataLen;
+
+	if(pThis->pMmap == NULL)
+		return;
+	if(pThis->tOperationsMode == STREAMMODE_READ) {
+		strmMmapUnmap(pThis);
+		return;
+	}
+	dataLen = (int64) getSegTrailer(pThis)->dataLen;
+	strmMmapUnmap(pThis);
+	if(ftruncate(pThis->fd, dataLen) != 0) {
+		DBGOPRINT((obj_t*) pThis, "could not truncate segment %d to %lld octets - "
+			  "trailer remains\n", pThis->fd, (long long) dataLen);
+	}
+}
+
+
+/* "read" the next buffer in mmap mode. We do not copy anything but make the
+ * IO buffer point to the unread data inside the mapping. If the writer has
+ * extended the file in the mean time, it is re-mapped.
+ */
+static rsRetVal
+strmMmapReadBuf(strm_t *pThis)
+{
+	struct stat statFile;
+	int64 dataLen;
+	DEFiRet;
+
+	while(1) {
+		CHKiRet(strmOpenFile(pThis));
+		if(fstat(pThis->fd, &statFile) == -1)
+			ABORT_FINALIZE(RS_RET_IO_ERROR);
+		dataLen = getSegDataLen(pThis->fd, statFile.st_size);
+		if(pThis->iCurrOffs < dataLen)
+			break;
+		DBGOPRINT((obj_t*) pThis, "file %d EOF at %lld (mmap)\n", pThis->fd, (long long) dataLen);
+		CHKiRet(strmHandleEOF(pThis));
+	}
+
+	if((size_t) statFile.st_size != pThis->lenMmap)
+		CHKiRet(strmMmapMap(pThis, (size_t) statFile.st_size));
+	if(pThis->pIOBufSave == NULL)
+		pThis->pIOBufSave = pThis->pIOBuf;
+	pThis->pIOBuf = pThis->pMmap + pThis->iCurrOffs;
+	pThis->iBufPtrMax = dataLen - pThis->iCurrOffs;
+	pThis->iBufPtr = 0;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* write in mmap mode. The data is copied directly into the mapping, the
+ * IO buffer is not used. If a record does not fit into the segment (it
+ * may grow slightly beyond the max file size), the segment is extended.
+ */
+static rsRetVal
+strmMmapWrite(strm_t *pThis, const uchar *pBuf, size_t lenBuf)
+{
+	DEFiRet;
+
+	if(pThis->fd == -1)
+		CHKiRet(strmOpenFile(pThis));
+	if(pThis->iCurrOffs + (int64) lenBuf > (int64) (pThis->lenMmap - sizeof(strmSegTrailer_t))) {
+		CHKiRet(strmMmapExtend(pThis, pThis->iCurrOffs + lenBuf, pThis->iCurrOffs));
+	}
+
+	memcpy(pThis->pMmap + pThis->iCurrOffs, pBuf, lenBuf);
+	pThis->iCurrOffs += lenBuf;
+	getSegTrailer(pThis)->dataLen = pThis->iCurrOffs;
+	if(pThis->pUsrWCntr != NULL)
+		*pThis->pUsrWCntr += lenBuf;
+
+	if(pThis->bSync) {
+		CHKiRet(syncFile(pThis));
+	}
+	/* records are never split between segments, RecordEnd() does the check for them */
+	if(!pThis->bInRecord) {
+		CHKiRet(strmCheckNextOutputFile(pThis));
+	}
+
+finalize_it:
+	RETiRet;
+}
+/* end memory-mapped segment support */
+
+
 /* switch to next strm file
  * This method must only be called if we are in a multi-file mode!
  */
@@ -554,6 +1054,129 @@ finalize_it:
 	RETiRet;
 }
 
+/* zip read support
+ * Compressed files consist of one or more gzip members. The writer does a
+ * sync flush after each record, so everything that has been flushed can
+ * be inflated even while the member is still being written. A new member
+ * is started when the writer reopens the file, e.g. after a restart. If
+ * rsyslog was aborted, the previous member is not finished. In that case,
+ * inflate() runs into the header of the new member, which can never be
+ * valid deflate data, and we resync on it. This also skips remains of an
+ * old trailer that was partly overwritten by the new header.
+ * The writer also starts a new member after STRM_ZIP_MEMBER_SIZE octets of
+ * uncompressed data. The start of the member we are in is the seek hint, so
+ * positioning a reader on restart needs to inflate at most that much.
+ */
+#define STRM_ZIP_MEMBER_SIZE (128 * 1024)
+#define STRM_ZIP_DICTSIZE 32768 /* deflate window, dictionary size for parallel zip */
+static inline void
+strmZipResync(strm_t *pThis)
+{
+	uchar *p = pThis->zstrm.next_in;
+	uInt n = pThis->zstrm.avail_in;
+
+	DBGOPRINT((obj_t*) pThis, "corrupt zip data in file %d, searching next gzip member\n",
+		  pThis->fd);
+	while(n >= 3 && !(p[0] == 0x1f && p[1] == 0x8b && p[2] == Z_DEFLATED)) {
+		++p;
+		--n;
+	}
+	if(n < 3)
+		n = 0; /* no member start in this buffer (we accept to miss one that spans buffers) */
+	pThis->zstrm.next_in = p;
+	pThis->zstrm.avail_in = n;
+	zlibw.InflateReset(&pThis->zstrm);
+}
+
+
+/* a new gzip member begins at the current input position. Members can be
+ * inflated on their own, so we remember where it is as the seek hint. lenOut is
+ * the size of the buffer that is just being returned, which ends at the member
+ * boundary (the previous buffer has been fully consumed at this point).
+ */
+static inline void
+strmZipSetHint(strm_t *pThis, size_t lenOut)
+{
+	pThis->iHintPhys = pThis->iZipPhysOffs - pThis->zstrm.avail_in;
+	pThis->iHintLog = pThis->iCurrOffs + lenOut;
+}
+
+
+/* read the next buffer of uncompressed data. Note that iCurrOffs is the offset
+ * into the uncompressed data in this case, so seeking requires a skip read
+ * (which starts at the seek hint, if there is one).
+ */
+static rsRetVal
+strmZipReadBuf(strm_t *pThis)
+{
+	int zRet;
+	long iLenRead;
+	size_t lenOut;
+	DEFiRet;
+
+	while(1) {
+		CHKiRet(strmOpenFile(pThis));
+		if(!pThis->bzInitDone) {
+			pThis->zstrm.zalloc = Z_NULL;
+			pThis->zstrm.zfree = Z_NULL;
+			pThis->zstrm.opaque = Z_NULL;
+			pThis->zstrm.next_in = Z_NULL;
+			pThis->zstrm.avail_in = 0;
+			zRet = zlibw.InflateInit2(&pThis->zstrm, 31); /* 31: gzip format, 32k window */
+			if(zRet != Z_OK) {
+				DBGPRINTF("error %d returned from zlib/inflateInit2()\n", zRet);
+				ABORT_FINALIZE(RS_RET_ZLIB_ERR);
+			}
+			pThis->zstrm.avail_out = pThis->sIOBufSize;
+			pThis->bzInitDone = RSTRUE;
+		}
+
+		/* if the last call filled the whole buffer, inflate may hold more
+		 * output, so we must not read (and possibly hit EOF) before we got it.
+		 */
+		if(pThis->zstrm.avail_in == 0 && pThis->zstrm.avail_out != 0) {
+			iLenRead = read(pThis->fd, pThis->pZipBuf, pThis->sIOBufSize);
+			DBGOPRINT((obj_t*) pThis, "file %d read %ld zipped bytes\n", pThis->fd, iLenRead);
+			if(iLenRead == 0) {
+				CHKiRet(strmHandleEOF(pThis));
+				continue;
+			} else if(iLenRead < 0) {
+				ABORT_FINALIZE(RS_RET_IO_ERROR);
+			}
+			pThis->zstrm.next_in = pThis->pZipBuf;
+			pThis->zstrm.avail_in = iLenRead;
+			pThis->iZipPhysOffs += iLenRead;
+		}
+
+		pThis->zstrm.next_out = pThis->pIOBuf;
+		pThis->zstrm.avail_out = pThis->sIOBufSize;
+		zRet = zlibw.Inflate(&pThis->zstrm, Z_SYNC_FLUSH);
+		lenOut = pThis->sIOBufSize - pThis->zstrm.avail_out;
+		if(zRet == Z_STREAM_END) {
+			/* another member may follow */
+			zlibw.InflateReset(&pThis->zstrm);
+			strmZipSetHint(pThis, lenOut);
+		} else if(zRet == Z_DATA_ERROR) {
+			strmZipResync(pThis);
+			if(pThis->zstrm.avail_in > 0)
+				strmZipSetHint(pThis, lenOut);
+		} else if(zRet != Z_OK && zRet != Z_BUF_ERROR) {
+			DBGPRINTF("error %d returned from zlib/inflate()\n", zRet);
+			ABORT_FINALIZE(RS_RET_ZLIB_ERR);
+		}
+		if(lenOut > 0) {
+			pThis->iBufPtrMax = lenOut;
+			break;
+		}
+	}
+	pThis->iBufPtr = 0;
+
+finalize_it:
+	RETiRet;
+}
+/* end zip read support */
+
+
 /* read the next buffer from disk
  * rgerhards, 2008-02-13
  */
@@ -568,6 +1191,16 @@ strmReadBuf(strm_t *pThis, int *padBytes)
 	ssize_t bytesLeft;
 
 	ISOBJ_TYPE_assert(pThis, strm);
+	if(pThis->bMmap) {
+		*padBytes = 0;
+		iRet = strmMmapReadBuf(pThis);
+		FINALIZE;
+	}
+	if(pThis->iZipLevel) {
+		*padBytes = 0;
+		iRet = strmZipReadBuf(pThis);
+		FINALIZE;
+	}
 	/* We need to try read at least twice because we may run into EOF and need to switch files. */
 	bRun = 1;
 	while(bRun) {
@@ -597,7 +1230,8 @@ strmReadBuf(strm_t *pThis, int *padBytes)
 			/* here we place our crypto interface */
 			if(pThis->cryprov != NULL) {
 				actualDataLen = iLenRead;
-				pThis->cryprov->Decrypt(pThis->cryprovFileData, pThis->pIOBuf, &actualDataLen);
+				CHKiRet(pThis->cryprov->Decrypt(pThis->cryprovFileData,
+					pThis->pIOBuf, &actualDataLen));
 				*padBytes = iLenRead - actualDataLen;
 				iLenRead = actualDataLen;
 				DBGOPRINT((obj_t*) pThis, "encrypted file %d pad bytes %d, actual "
@@ -656,6 +1290,48 @@ finalize_it:
 }
 
 
+/* read exactly lenBuf octets from the stream into the caller-provided buffer.
+ * This is much faster than calling strmReadChar() for each octet and is meant
+ * for reading binary records whose length is already known. Like strmReadChar(),
+ * it transparently switches to the next file in circular mode.
+ */
+static rsRetVal strmRead(strm_t *pThis, uchar *pBuf, size_t lenBuf)
+{
+	int padBytes;
+	size_t iAvail;
+	DEFiRet;
+
+	ASSERT(pThis != NULL);
+	ASSERT(pBuf != NULL);
+
+	if(lenBuf > 0 && pThis->iUngetC != -1) {
+		*pBuf++ = pThis->iUngetC;
+		++pThis->iCurrOffs;
+		pThis->iUngetC = -1;
+		--lenBuf;
+	}
+
+	while(lenBuf > 0) {
+		if(pThis->iBufPtr >= pThis->iBufPtrMax) {
+			padBytes = 0;
+			CHKiRet(strmReadBuf(pThis, &padBytes));
+			pThis->iCurrOffs += padBytes;
+		}
+		iAvail = pThis->iBufPtrMax - pThis->iBufPtr;
+		if(iAvail > lenBuf)
+			iAvail = lenBuf;
+		memcpy(pBuf, pThis->pIOBuf + pThis->iBufPtr, iAvail);
+		pThis->iBufPtr += iAvail;
+		pThis->iCurrOffs += iAvail;
+		pBuf += iAvail;
+		lenBuf -= iAvail;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* unget a single character just like ungetc(). As with that call, there is only a single
  * character buffering capability.
  * rgerhards, 2008-01-07
@@ -673,6 +1349,68 @@ static rsRetVal strmUnreadChar(strm_t *pThis, uchar c)
 	return RS_RET_OK;
 }
 
+/* read a single line (mode 0 of strmReadLine). Instead of going through
+ * strmReadChar() for each octet, we search the current buffer for the LF
+ * and append everything up to it in one step. An unread character, if any,
+ * is always processed first.
+ */
+static rsRetVal
+strmReadLineSingle(strm_t *pThis, cstr_t *pCStr)
+{
+	uchar c;
+	uchar *pStart;
+	uchar *pLF;
+	size_t iAvail;
+	size_t lenChunk;
+	int padBytes;
+	rsRetVal localRet;
+	DEFiRet;
+
+	/* append previous message to current message if necessary */
+	if(pThis->prevLineSegment != NULL) {
+		CHKiRet(cstrAppendCStr(pCStr, pThis->prevLineSegment));
+		cstrDestruct(&pThis->prevLineSegment);
+	}
+
+	if(pThis->iUngetC != -1) {
+		CHKiRet(strmReadChar(pThis, &c));
+		if(c == '\n')
+			FINALIZE;
+		CHKiRet(cstrAppendChar(pCStr, c));
+	}
+
+	while(1) {
+		if(pThis->iBufPtr >= pThis->iBufPtrMax) {
+			padBytes = 0;
+			localRet = strmReadBuf(pThis, &padBytes);
+			if(localRet == RS_RET_EOF && rsCStrLen(pCStr) > 0) {
+				/* end of file reached without \n, keep data for the next call */
+				CHKiRet(rsCStrConstructFromCStr(&pThis->prevLineSegment, pCStr));
+			}
+			CHKiRet(localRet);
+			pThis->iCurrOffs += padBytes;
+		}
+		pStart = pThis->pIOBuf + pThis->iBufPtr;
+		iAvail = pThis->iBufPtrMax - pThis->iBufPtr;
+		pLF = memchr(pStart, '\n', iAvail);
+		lenChunk = (pLF == NULL) ? iAvail : (size_t) (pLF - pStart);
+		if(lenChunk > 0)
+			CHKiRet(rsCStrAppendStrWithLen(pCStr, pStart, lenChunk));
+		pThis->iBufPtr += lenChunk;
+		pThis->iCurrOffs += lenChunk;
+		if(pLF != NULL) {
+			/* consume the LF itself */
+			++pThis->iBufPtr;
+			++pThis->iCurrOffs;
+			break;
+		}
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* read a 'paragraph' from a strm file.
  * A paragraph may be terminated by a LF, by a LFLF, or by LF<not whitespace> depending on the option set.
  * The termination LF characters are read, but are
@@ -689,7 +1427,6 @@ strmReadLine(strm_t *pThis, cstr_t **ppCStr, uint8_t mode, sbool bEscapeLF)
          */
         uchar c;
 	uchar finished;
-	rsRetVal readCharRet;
 	sbool bPrevWasNL;
         DEFiRet;
 
@@ -697,24 +1434,15 @@ strmReadLine(strm_t *pThis, cstr_t **ppCStr, uint8_t mode, sbool bEscapeLF)
         ASSERT(ppCStr != NULL);
 
         CHKiRet(cstrConstruct(ppCStr));
-        CHKiRet(strmReadChar(pThis, &c));
 
         if(mode == 0) {
-		/* append previous message to current message if necessary */
-		if(pThis->prevLineSegment != NULL) {
-			CHKiRet(cstrAppendCStr(*ppCStr, pThis->prevLineSegment));
-			cstrDestruct(&pThis->prevLineSegment);
-		}
-		while(c != '\n') {
-                	CHKiRet(cstrAppendChar(*ppCStr, c));
-                	readCharRet = strmReadChar(pThis, &c);
-                	if(readCharRet == RS_RET_EOF) {/* end of file reached without \n? */
-				CHKiRet(rsCStrConstructFromCStr(&pThis->prevLineSegment, *ppCStr));
-                	}
-                	CHKiRet(readCharRet);
-        	}
+		CHKiRet(strmReadLineSingle(pThis, *ppCStr));
         	CHKiRet(cstrFinalize(*ppCStr));
-	} else if(mode == 1) {
+		FINALIZE;
+	}
+
+        CHKiRet(strmReadChar(pThis, &c));
+	if(mode == 1) {
 		finished=0;
 		bPrevWasNL = 0;
 		while(finished == 0){
@@ -801,11 +1529,13 @@ BEGINobjConstruct(strm) /* be sure to specify the object type also in END macro!
 	pThis->iCurrFNum = 1;
 	pThis->fd = -1;
 	pThis->fdDir = -1;
+	pThis->fdDirect = -1;
 	pThis->iUngetC = -1;
 	pThis->bVeryReliableZip = 0;
 	pThis->sType = STREAMTYPE_FILE_SINGLE;
 	pThis->sIOBufSize = glblGetIOBufSize();
 	pThis->tOpenMode = 0600;
+	pThis->iSizeLimitKeep = 5;
 	pThis->prevLineSegment = NULL;
 ENDobjConstruct(strm)
 
@@ -822,9 +1552,23 @@ static rsRetVal strmConstructFinalize(strm_t *pThis)
 	ASSERT(pThis != NULL);
 
 	pThis->iBufPtrMax = 0; /* results in immediate read request */
-	if(pThis->iZipLevel) { /* do we need a zip buf? */
+	if(pThis->iZipLevel && pThis->compprov != NULL) {
+		/* providers only support writing */
+		if(pThis->tOperationsMode == STREAMMODE_READ) {
+			DBGPRINTF("stream: compression provider can not be used for reading\n");
+			ABORT_FINALIZE(RS_RET_NOT_IMPLEMENTED);
+		}
+		CHKiRet(pThis->compprov->Construct(&pThis->compprovData));
+		CHKiRet(pThis->compprov->SetLevel(pThis->compprovData, pThis->iZipLevel));
+		CHKiRet(pThis->compprov->SetWorkers(pThis->compprovData, iZipThreads));
+	} else if(pThis->iZipLevel) { /* do we need a zip buf? */
 		localRet = objUse(zlibw, LM_ZLIBW_FILENAME);
-		if(localRet != RS_RET_OK) {
+		if(localRet != RS_RET_OK && pThis->tOperationsMode == STREAMMODE_READ) {
+			/* we can not read compressed data as if it were plain */
+			DBGPRINTF("stream was requested to read zipped data, but zlibw module "
+				  "unavailable (%d)\n", localRet);
+			ABORT_FINALIZE(localRet);
+		} else if(localRet != RS_RET_OK) {
 			pThis->iZipLevel = 0;
 			DBGPRINTF("stream was requested with zip mode, but zlibw module unavailable (%d) - using "
 				  "without zip\n", localRet);
@@ -834,11 +1578,23 @@ static rsRetVal strmConstructFinalize(strm_t *pThis)
 			 * We add another 128 bytes to take care of the gzip header and "all eventualities".
 			 */
 			CHKmalloc(pThis->pZipBuf = (Bytef*) MALLOC(sizeof(uchar) * (pThis->sIOBufSize + 128)));
+			if(   iZipThreads > 0 && pThis->tOperationsMode != STREAMMODE_READ
+			   && pThis->sType != STREAMTYPE_FILE_CIRCULAR) {
+				/* one more job than threads, so that all threads can work
+				 * on this stream while we queue the next block. Job buffers
+				 * are allocated on first use. Circular files (queues) are
+				 * zipped inline, as they start a new member from time to
+				 * time for positioning readers (see strmFlush()).
+				 */
+				pThis->nZipJobs = iZipThreads + 1;
+				CHKmalloc(pThis->zipJobs = calloc(pThis->nZipJobs, sizeof(zipjob_t)));
+				CHKmalloc(pThis->pZipDict = MALLOC(STRM_ZIP_DICTSIZE));
+			}
 		}
 	}
 
 	/* if we are set to sync, we must obtain a file handle to the directory for fsync() purposes */
-	if(pThis->bSync && !pThis->bIsTTY) {
+	if((pThis->bSync || pThis->bDeferSync) && !pThis->bIsTTY) {
 		pThis->fdDir = open((char*)pThis->pszDir, O_RDONLY | O_CLOEXEC | O_NOCTTY);
 		if(pThis->fdDir == -1) {
 			char errStr[1024];
@@ -935,6 +1691,21 @@ CODESTARTobjDestruct(strm)
 	 */
 	free(pThis->pszDir);
 	free(pThis->pZipBuf);
+	free(pThis->pDirBuf);
+	if(pThis->zipJobs != NULL) {
+		/* after an error, jobs may still be in the pool */
+		for( ; pThis->iZipJobDeq != pThis->iZipJobEnq ; ++pThis->iZipJobDeq)
+			zippoolWait(&pThis->zipJobs[pThis->iZipJobDeq % pThis->nZipJobs]);
+		for(i = 0 ; i < (int) pThis->nZipJobs ; ++i) {
+			free(pThis->zipJobs[i].pIn);
+			free(pThis->zipJobs[i].pDict);
+			free(pThis->zipJobs[i].pOut);
+		}
+		free(pThis->zipJobs);
+	}
+	free(pThis->pZipDict);
+	if(pThis->compprovData != NULL)
+		pThis->compprov->Destruct(&pThis->compprovData);
 	free(pThis->pszCurrFName);
 	free(pThis->pszFName);
 	pThis->bStopWriter = 2; /* RG: use as flag for destruction */
@@ -982,7 +1753,7 @@ tryTTYRecover(strm_t *pThis, int err)
 	ISOBJ_TYPE_assert(pThis, strm);
 	if(err == ERR_TTYHUP) {
 		close(pThis->fd);
-		CHKiRet(doPhysOpen(pThis));
+		CHKiRet(doPhysOpen(pThis, NULL));
 	}
 
 finalize_it:
@@ -1046,6 +1817,81 @@ finalize_it:
 
 
 
+/* like doWriteCall(), but for a vector of buffers. writev() may do partial
+ * writes, in which case we continue with the rest of the vector. Note that
+ * *pLenTotal must be the total size of the buffers on entry and contains
+ * the number of bytes actually written on exit.
+ */
+static rsRetVal
+doWritevCall(strm_t *pThis, const struct iovec *const iov, const int iovcnt, size_t *pLenTotal)
+{
+	struct iovec iovBuf[STRM_WRITEV_MAX];
+	int iIov;	/* next entry of iov[] to put into iovBuf[] */
+	int nBuf;	/* number of unwritten entries in iovBuf[] */
+	int iBuf;	/* first unwritten entry in iovBuf[] */
+	ssize_t iWritten;
+	size_t iTotalWritten;
+	DEFiRet;
+	ISOBJ_TYPE_assert(pThis, strm);
+
+	iTotalWritten = 0;
+	iIov = 0;
+	nBuf = 0;
+	iBuf = 0;
+	while(iIov < iovcnt || nBuf > 0) {
+		if(nBuf == 0) {
+			iBuf = 0;
+			for( ; iIov < iovcnt && nBuf < STRM_WRITEV_MAX ; ++iIov) {
+				if(iov[iIov].iov_len > 0)
+					iovBuf[nBuf++] = iov[iIov];
+			}
+			if(nBuf == 0)
+				break;
+		}
+		iWritten = writev(pThis->fd, iovBuf + iBuf, nBuf);
+		if(iWritten < 0) {
+			char errStr[1024];
+			int err = errno;
+			iWritten = 0; /* we have written NO bytes! */
+			rs_strerror_r(err, errStr, sizeof(errStr));
+			DBGPRINTF("log file (%d) writev error %d: %s\n", pThis->fd, err, errStr);
+			if(err == EINTR) {
+				/*NO ERROR, just continue */;
+			} else if(pThis->bIsTTY) {
+				CHKiRet(tryTTYRecover(pThis, err));
+			} else {
+				ABORT_FINALIZE(RS_RET_IO_ERROR);
+			}
+		}
+		iTotalWritten += iWritten;
+		/* skip what was written, the last entry may be partially done */
+		while(nBuf > 0 && (size_t) iWritten >= iovBuf[iBuf].iov_len) {
+			iWritten -= iovBuf[iBuf].iov_len;
+			++iBuf;
+			--nBuf;
+		}
+		if(nBuf > 0) {
+			iovBuf[iBuf].iov_base = (char*) iovBuf[iBuf].iov_base + iWritten;
+			iovBuf[iBuf].iov_len -= iWritten;
+		}
+	}
+
+	DBGOPRINT((obj_t*) pThis, "file %d writev wrote %lld bytes\n", pThis->fd, (long long) iTotalWritten);
+
+finalize_it:
+	*pLenTotal = iTotalWritten;
+	RETiRet;
+}
+
+
+/* write function for compression providers: hands back compressed data */
+static rsRetVal
+strmCompprovWrite(void *pUsr, uchar *pBuf, size_t lenBuf)
+{
+	return strmPhysWrite((strm_t*) pUsr, pBuf, lenBuf);
+}
+
+
 /* write memory buffer to a stream object.
  */
 static inline rsRetVal
@@ -1055,7 +1901,14 @@ doWriteInternal(strm_t *pThis, uchar *pBuf, size_t lenBuf, int bFlush)
 
 	ASSERT(pThis != NULL);
 
-	if(pThis->iZipLevel) {
+	if(pThis->compprovData != NULL) {
+		CHKiRet(pThis->compprov->Compress(pThis->compprovData, pBuf, lenBuf,
+			pThis->bVeryReliableZip ? COMPPROV_OP_END
+				: (bFlush ? COMPPROV_OP_FLUSH : COMPPROV_OP_CONTINUE),
+			strmCompprovWrite, pThis));
+	} else if(pThis->zipJobs != NULL) {
+		CHKiRet(doZipWriteParallel(pThis, pBuf, lenBuf, bFlush));
+	} else if(pThis->iZipLevel) {
 		CHKiRet(doZipWrite(pThis, pBuf, lenBuf, bFlush));
 	} else {
 		/* write without zipping */
@@ -1194,6 +2047,14 @@ asyncWriterThread(void *pPtr)
 		doWriteInternal(pThis, pThis->asyncBuf[iDeq].pBuf, pThis->asyncBuf[iDeq].lenBuf, 0); // TODO: flush state
 		// TODO: error check????? 2009-07-06
 		d_pthread_mutex_lock(&pThis->mut);
+		if(pThis->iCnt == 1 && pThis->iZipJobDeq != pThis->iZipJobEnq) {
+			/* nothing more to compress, so write out what the zip pool has.
+			 * We still count as busy, so nobody else touches the jobs.
+			 */
+			d_pthread_mutex_unlock(&pThis->mut);
+			strmZipDrain(pThis);
+			d_pthread_mutex_lock(&pThis->mut);
+		}
 
 		--pThis->iCnt;
 		if(pThis->iCnt < STREAM_ASYNC_NUMBUFS) {
@@ -1202,54 +2063,169 @@ asyncWriterThread(void *pPtr)
 				pthread_cond_broadcast(&pThis->isEmpty);
 		}
 	}
-	d_pthread_mutex_unlock(&pThis->mut);
+	d_pthread_mutex_unlock(&pThis->mut);
+
+finalize_it:
+	ENDfunc
+	return NULL; /* to keep pthreads happy */
+}
+
+
+/* sync the file to disk, so that any unwritten data is persisted. This
+ * also syncs the directory and thus makes sure that the file survives
+ * fatal failure. Note that we do NOT return an error status if the
+ * sync fails. Doing so would probably cause more trouble than it
+ * is worth (read: data loss may occur where we otherwise might not
+ * have it). -- rgerhards, 2009-06-08
+ */
+#undef SYNCCALL
+#if HAVE_FDATASYNC
+#	define SYNCCALL(x) fdatasync(x)
+#else
+#	define SYNCCALL(x) fsync(x)
+#endif
+static rsRetVal
+syncFile(strm_t *pThis)
+{
+	int ret;
+	DEFiRet;
+
+	if(pThis->bIsTTY)
+		FINALIZE; /* TTYs can not be synced */
+
+	DBGPRINTF("syncing file %d\n", pThis->fd);
+	if(pThis->pMmap != NULL && pThis->tOperationsMode != STREAMMODE_READ) {
+		if(msync(pThis->pMmap, pThis->lenMmap, MS_SYNC) != 0) {
+			DBGPRINTF("msync failed for file %d with error %d - ignoring\n", pThis->fd, errno);
+		}
+	}
+	ret = SYNCCALL(pThis->fd);
+	if(ret != 0) {
+		char errStr[1024];
+		int err = errno;
+		rs_strerror_r(err, errStr, sizeof(errStr));
+		DBGPRINTF("sync failed for file %d with error (%d): %s - ignoring\n",
+			   pThis->fd, err, errStr);
+	}
+	
+	if(pThis->fdDir != -1) {
+		ret = fsync(pThis->fdDir);
+	}
+
+finalize_it:
+	RETiRet;
+}
+#undef SYNCCALL
+
+/* bookkeeping after iWritten bytes have been physically written to the
+ * output file (by strmPhysWrite() or strmWritev()). bSynced tells if the
+ * file was already synced together with the write.
+ */
+static rsRetVal
+strmPhysWriteDone(strm_t *pThis, size_t iWritten, int bSynced)
+{
+	DEFiRet;
+
+	RSPROBE2(stream__write, pThis->pszCurrFName, iWritten);
+	pThis->iCurrOffs += iWritten;
+	/* update user counter, if provided */
+	if(pThis->pUsrWCntr != NULL)
+		*pThis->pUsrWCntr += iWritten;
+
+	if(pThis->bSync && !bSynced) {
+		CHKiRet(syncFile(pThis));
+	}
+
+	if(pThis->sType == STREAMTYPE_FILE_CIRCULAR) {
+		/* in zip mode, we are called from inside the deflate loop, so we must
+		 * not switch files here. strmFlush() does this at record boundaries.
+		 */
+		if(!pThis->iZipLevel)
+			CHKiRet(strmCheckNextOutputFile(pThis));
+	} else if(pThis->iSizeLimit != 0) {
+		CHKiRet(doSizeLimitProcessing(pThis));
+	}
 
 finalize_it:
-	ENDfunc
-	return NULL; /* to keep pthreads happy */
+	RETiRet;
 }
 
 
-/* sync the file to disk, so that any unwritten data is persisted. This
- * also syncs the directory and thus makes sure that the file survives
- * fatal failure. Note that we do NOT return an error status if the
- * sync fails. Doing so would probably cause more trouble than it
- * is worth (read: data loss may occur where we otherwise might not
- * have it). -- rgerhards, 2009-06-08
+/* write in O_DIRECT mode, see strmDirectOpen(). The data is appended to
+ * the staging buffer, whose whole blocks are written at iDirOffs. Then the
+ * remaining partial block is written via the normal descriptor, as far as
+ * it is not yet in the file. If the file system rejects the direct write,
+ * we switch to buffered writes for the rest of the file.
  */
-#undef SYNCCALL
-#if HAVE_FDATASYNC
-#	define SYNCCALL(x) fdatasync(x)
-#else
-#	define SYNCCALL(x) fsync(x)
-#endif
 static rsRetVal
-syncFile(strm_t *pThis)
+strmPhysWriteDirect(strm_t *pThis, uchar *pBuf, size_t lenBuf)
 {
-	int ret;
+	int64 iEOF;
+	size_t lenCopy;
+	size_t lenAligned;
+	size_t lenDone;
+	size_t lenWrite;
+	ssize_t iWritten;
 	DEFiRet;
 
-	if(pThis->bIsTTY)
-		FINALIZE; /* TTYs can not be synced */
-
-	DBGPRINTF("syncing file %d\n", pThis->fd);
-	ret = SYNCCALL(pThis->fd);
-	if(ret != 0) {
-		char errStr[1024];
-		int err = errno;
-		rs_strerror_r(err, errStr, sizeof(errStr));
-		DBGPRINTF("sync failed for file %d with error (%d): %s - ignoring\n",
-			   pThis->fd, err, errStr);
+	iEOF = pThis->iCurrOffs; /* everything written before is in the file */
+	while(lenBuf > 0) {
+		lenCopy = pThis->sizeDirBuf - pThis->lenDirBuf;
+		if(lenCopy > lenBuf)
+			lenCopy = lenBuf;
+		memcpy(pThis->pDirBuf + pThis->lenDirBuf, pBuf, lenCopy);
+		pThis->lenDirBuf += lenCopy;
+		lenAligned = pThis->lenDirBuf & ~((size_t) STRM_DIRECTIO_ALIGN - 1);
+		for(lenDone = 0 ; lenDone < lenAligned ; lenDone += iWritten) {
+			iWritten = pwrite(pThis->fdDirect, pThis->pDirBuf + lenDone, lenAligned - lenDone,
+					  pThis->iDirOffs + lenDone);
+			if(iWritten < 0) {
+				if(errno == EINTR) {
+					iWritten = 0;
+					continue;
+				}
+				pThis->lenDirBuf -= lenCopy;
+				if(errno == EINVAL) {
+					DBGOPRINT((obj_t*) pThis, "file %d: O_DIRECT write not supported, "
+						  "using buffered writes\n", pThis->fd);
+					/* write what is not yet in the file: the rest of the
+					 * staging buffer, then the rest of the caller's data */
+					lenDone = iEOF - pThis->iDirOffs;
+					if(lenDone < pThis->lenDirBuf) {
+						lenWrite = pThis->lenDirBuf - lenDone;
+						CHKiRet(doWriteCall(pThis, pThis->pDirBuf + lenDone, &lenWrite));
+						lenDone = 0;
+					} else {
+						lenDone -= pThis->lenDirBuf;
+					}
+					strmDirectClose(pThis);
+					lenWrite = lenBuf - lenDone;
+					CHKiRet(doWriteCall(pThis, pBuf + lenDone, &lenWrite));
+					FINALIZE;
+				}
+				DBGOPRINT((obj_t*) pThis, "file %d: O_DIRECT write error %d\n", pThis->fd, errno);
+				ABORT_FINALIZE(RS_RET_IO_ERROR);
+			}
+			if(pThis->iDirOffs + (int64) (lenDone + iWritten) > iEOF)
+				iEOF = pThis->iDirOffs + lenDone + iWritten;
+		}
+		pBuf += lenCopy;
+		lenBuf -= lenCopy;
+		pThis->iDirOffs += lenAligned;
+		pThis->lenDirBuf -= lenAligned;
+		memmove(pThis->pDirBuf, pThis->pDirBuf + lenAligned, pThis->lenDirBuf);
 	}
-	
-	if(pThis->fdDir != -1) {
-		ret = fsync(pThis->fdDir);
+
+	/* the partial last block */
+	if(pThis->iDirOffs + (int64) pThis->lenDirBuf > iEOF) {
+		lenWrite = pThis->iDirOffs + pThis->lenDirBuf - iEOF;
+		CHKiRet(doWriteCall(pThis, pThis->pDirBuf + (iEOF - pThis->iDirOffs), &lenWrite));
 	}
 
 finalize_it:
 	RETiRet;
 }
-#undef SYNCCALL
+
 
 /* physically write to the output file. the provided data is ready for
  * writing (e.g. zipped if we are requested to do that).
@@ -1261,6 +2237,8 @@ static rsRetVal
 strmPhysWrite(strm_t *pThis, uchar *pBuf, size_t lenBuf)
 {
 	size_t iWritten;
+	int bSynced = 0;
+	rsRetVal localRet;
 	DEFiRet;
 	ISOBJ_TYPE_assert(pThis, strm);
 
@@ -1270,27 +2248,36 @@ strmPhysWrite(strm_t *pThis, uchar *pBuf, size_t lenBuf)
 
 	/* here we place our crypto interface */
 	if(pThis->cryprov != NULL) {
-		pThis->cryprov->Encrypt(pThis->cryprovFileData, pBuf, &lenBuf);
+		CHKiRet(pThis->cryprov->Encrypt(pThis->cryprovFileData, pBuf, &lenBuf));
 	}
 	/* end crypto */
 
-	iWritten = lenBuf;
-	CHKiRet(doWriteCall(pThis, pBuf, &iWritten));
-
-	pThis->iCurrOffs += iWritten;
-	/* update user counter, if provided */
-	if(pThis->pUsrWCntr != NULL)
-		*pThis->pUsrWCntr += iWritten;
-
-	if(pThis->bSync) {
-		CHKiRet(syncFile(pThis));
+	if(pThis->iPreallocSize > 0)
+		strmPrealloc(pThis, lenBuf);
+
+	localRet = RS_RET_NOT_IMPLEMENTED;
+	if(pThis->fdDirect != -1) {
+		CHKiRet(strmPhysWriteDirect(pThis, pBuf, lenBuf));
+		iWritten = lenBuf;
+		localRet = RS_RET_OK;
+	} else if(bUringEnabled && !pThis->bIsTTY && pThis->pMmap == NULL) {
+		/* write and sync with a single system call */
+		localRet = uringWrite(pThis->fd, pBuf, lenBuf, pThis->bSync, pThis->fdDir,
+				      &iWritten, &bSynced);
+		if(localRet == RS_RET_IO_ERROR) {
+			char errStr[1024];
+			int err = errno;
+			rs_strerror_r(err, errStr, sizeof(errStr));
+			DBGPRINTF("log file (%d) write error %d: %s\n", pThis->fd, err, errStr);
+			ABORT_FINALIZE(RS_RET_IO_ERROR);
+		}
 	}
-
-	if(pThis->sType == STREAMTYPE_FILE_CIRCULAR) {
-		CHKiRet(strmCheckNextOutputFile(pThis));
-	} else if(pThis->iSizeLimit != 0) {
-		CHKiRet(doSizeLimitProcessing(pThis));
+	if(localRet == RS_RET_NOT_IMPLEMENTED) {
+		/* no io_uring for this stream or thread */
+		iWritten = lenBuf;
+		CHKiRet(doWriteCall(pThis, pBuf, &iWritten));
 	}
+	CHKiRet(strmPhysWriteDone(pThis, iWritten, bSynced));
 
 finalize_it:
 	RETiRet;
@@ -1356,6 +2343,182 @@ finalize_it:
 
 
 
+/* Parallel zip mode (global zip.threads). Each output buffer is copied
+ * into a job and compressed by the zip pool, while the writer continues.
+ * The compressed blocks are written in submission order. Unless in very
+ * reliable mode, the blocks are raw deflate data ending on a byte boundary
+ * (Z_SYNC_FLUSH), so their concatenation is valid deflate data. We write
+ * the gzip header before the first block and, when the member is finished,
+ * an empty final block and the trailer with the combined crc32. The tail of
+ * the previous block is used as preset dictionary, so the compression ratio
+ * is almost the same as with inline compression. In very reliable mode,
+ * each block is a complete gzip member, just as doZipWrite() does it.
+ */
+
+/* the work function, called on a zip pool thread */
+static void
+strmZipJob(zipjob_t *pJob)
+{
+	z_stream zstrm;
+	uchar *pNew;
+	int zRet;
+
+	pJob->iRet = RS_RET_OK;
+	pJob->lenOut = 0;
+	memset(&zstrm, 0, sizeof(zstrm));
+	zRet = zlibw.DeflateInit2(&zstrm, pJob->iLevel, Z_DEFLATED, pJob->bGzipMember ? 31 : -15,
+				  9, Z_DEFAULT_STRATEGY);
+	if(zRet != Z_OK) {
+		DBGPRINTF("error %d returned from zlib/deflateInit2()\n", zRet);
+		pJob->iRet = RS_RET_ZLIB_ERR;
+		return;
+	}
+	if(!pJob->bGzipMember) {
+		pJob->crc = zlibw.Crc32(zlibw.Crc32(0, Z_NULL, 0), pJob->pIn, pJob->lenIn);
+		if(pJob->lenDict > 0)
+			zlibw.DeflateSetDictionary(&zstrm, pJob->pDict, pJob->lenDict);
+	}
+
+	zstrm.next_in = pJob->pIn;
+	zstrm.avail_in = pJob->lenIn;
+	do {
+		if(pJob->lenOut == pJob->sizeOut) {
+			/* very rare, only for incompressible data */
+			if((pNew = realloc(pJob->pOut, pJob->sizeOut * 2)) == NULL) {
+				pJob->iRet = RS_RET_OUT_OF_MEMORY;
+				break;
+			}
+			pJob->pOut = pNew;
+			pJob->sizeOut *= 2;
+		}
+		zstrm.next_out = pJob->pOut + pJob->lenOut;
+		zstrm.avail_out = pJob->sizeOut - pJob->lenOut;
+		zRet = zlibw.Deflate(&zstrm, pJob->bGzipMember ? Z_FINISH : Z_SYNC_FLUSH);
+		pJob->lenOut = pJob->sizeOut - zstrm.avail_out;
+	} while(zstrm.avail_out == 0);
+	zlibw.DeflateEnd(&zstrm);
+}
+
+
+/* write the oldest job's output (waiting for it if necessary). The job is
+ * taken off the ring before it is written, because the write may cause the
+ * file to be closed (size limit), which drains the remaining jobs.
+ */
+static rsRetVal
+strmZipWriteJob(strm_t *pThis)
+{
+	static const uchar gzipHdr[10] = { 0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0, 0, 3 /* unix */ };
+	zipjob_t *pJob;
+	DEFiRet;
+
+	pJob = &pThis->zipJobs[pThis->iZipJobDeq % pThis->nZipJobs];
+	zippoolWait(pJob);
+	++pThis->iZipJobDeq;
+	CHKiRet(pJob->iRet);
+	if(!pJob->bGzipMember) {
+		if(!pThis->bZipMember) {
+			CHKiRet(strmPhysWrite(pThis, (uchar*) gzipHdr, sizeof(gzipHdr)));
+			pThis->bZipMember = 1;
+			pThis->zipCrc = zlibw.Crc32(0, Z_NULL, 0);
+			pThis->zipLenIn = 0;
+		}
+		pThis->zipCrc = zlibw.Crc32Combine(pThis->zipCrc, pJob->crc, pJob->lenIn);
+		pThis->zipLenIn += pJob->lenIn;
+	}
+	if(pJob->lenOut > 0)
+		CHKiRet(strmPhysWrite(pThis, pJob->pOut, pJob->lenOut));
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* write all jobs submitted so far */
+static rsRetVal
+strmZipDrain(strm_t *pThis)
+{
+	DEFiRet;
+
+	while(pThis->iZipJobDeq != pThis->iZipJobEnq)
+		CHKiRet(strmZipWriteJob(pThis));
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* write all pending data and finish the current gzip member */
+static rsRetVal
+strmZipFinishMember(strm_t *pThis)
+{
+	uchar trailer[10];
+	int i;
+	DEFiRet;
+
+	CHKiRet(strmZipDrain(pThis));
+	if(pThis->bZipMember) {
+		trailer[0] = 0x03; /* empty final block with fixed codes */
+		trailer[1] = 0x00;
+		for(i = 0 ; i < 4 ; ++i) {
+			trailer[2+i] = (pThis->zipCrc >> (8 * i)) & 0xff;
+			trailer[6+i] = (pThis->zipLenIn >> (8 * i)) & 0xff;
+		}
+		pThis->bZipMember = 0;
+		pThis->lenZipDict = 0; /* a new member starts without history */
+		CHKiRet(strmPhysWrite(pThis, trailer, sizeof(trailer)));
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+static rsRetVal
+doZipWriteParallel(strm_t *pThis, uchar *pBuf, size_t lenBuf, int bFlush)
+{
+	zipjob_t *pJob;
+	DEFiRet;
+
+	if(lenBuf > 0) {
+		if(pThis->iZipJobEnq - pThis->iZipJobDeq == pThis->nZipJobs)
+			CHKiRet(strmZipWriteJob(pThis)); /* all jobs busy, make room */
+		pJob = &pThis->zipJobs[pThis->iZipJobEnq % pThis->nZipJobs];
+		if(pJob->sizeIn < lenBuf) {
+			free(pJob->pIn);
+			pJob->sizeIn = 0;
+			CHKmalloc(pJob->pIn = MALLOC(lenBuf));
+			pJob->sizeIn = lenBuf;
+		}
+		if(pJob->pOut == NULL) {
+			CHKmalloc(pJob->pOut = MALLOC(pThis->sIOBufSize + 128));
+			pJob->sizeOut = pThis->sIOBufSize + 128;
+		}
+		memcpy(pJob->pIn, pBuf, lenBuf);
+		pJob->lenIn = lenBuf;
+		pJob->iLevel = pThis->iZipLevel;
+		pJob->bGzipMember = pThis->bVeryReliableZip;
+		pJob->lenDict = 0;
+		if(!pThis->bVeryReliableZip) {
+			if(pJob->pDict == NULL)
+				CHKmalloc(pJob->pDict = MALLOC(STRM_ZIP_DICTSIZE));
+			memcpy(pJob->pDict, pThis->pZipDict, pThis->lenZipDict);
+			pJob->lenDict = pThis->lenZipDict;
+			pThis->lenZipDict = (lenBuf < STRM_ZIP_DICTSIZE) ? lenBuf : STRM_ZIP_DICTSIZE;
+			memcpy(pThis->pZipDict, pBuf + lenBuf - pThis->lenZipDict, pThis->lenZipDict);
+		}
+		pJob->fnDo = strmZipJob;
+		zippoolSubmit(pJob);
+		++pThis->iZipJobEnq;
+	}
+
+	if(bFlush)
+		CHKiRet(strmZipDrain(pThis));
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* finish zlib buffer, to be called before closing the ZIP file (if
  * running in stream mode).
  */
@@ -1367,6 +2530,15 @@ doZipFinish(strm_t *pThis)
 	unsigned outavail;
 	assert(pThis != NULL);
 
+	if(pThis->compprovData != NULL) {
+		iRet = pThis->compprov->Compress(pThis->compprovData, NULL, 0, COMPPROV_OP_END,
+						 strmCompprovWrite, pThis);
+		goto done;
+	}
+	if(pThis->zipJobs != NULL) {
+		iRet = strmZipFinishMember(pThis);
+		goto done;
+	}
 	if(!pThis->bzInitDone)
 		goto done;
 
@@ -1408,8 +2580,16 @@ strmFlushInternal(strm_t *pThis, int bFlushZip)
 		  (pThis->pszFName == NULL) ? "N/A" : (char*)pThis->pszFName,
 		  (long) pThis->iBufPtr, (pThis->iBufPtr == 0) ? " (no need to flush)" : "");
 
+	RSPROBE2(stream__flush, pThis->pszCurrFName, pThis->iBufPtr);
 	if(pThis->tOperationsMode != STREAMMODE_READ && pThis->iBufPtr > 0) {
 		iRet = strmSchedWrite(pThis, pThis->pIOBuf, pThis->iBufPtr, bFlushZip);
+	} else if(bFlushZip && (   pThis->bzInitDone || pThis->iZipJobDeq != pThis->iZipJobEnq
+				|| pThis->compprovData != NULL)
+		  && !pThis->bAsyncWrite && pThis->tOperationsMode != STREAMMODE_READ) {
+		/* the buffer ended exactly at a flush point, but the compressor
+		 * may still hold data of it (readers of queue files need it).
+		 */
+		iRet = doWriteInternal(pThis, pThis->pIOBuf, 0, 1);
 	}
 
 	RETiRet;
@@ -1432,6 +2612,77 @@ strmFlush(strm_t *pThis)
 	if(pThis->bAsyncWrite)
 		d_pthread_mutex_lock(&pThis->mut);
 	CHKiRet(strmFlushInternal(pThis, 1));
+	if(pThis->iZipLevel && pThis->sType == STREAMTYPE_FILE_CIRCULAR && !pThis->bInRecord) {
+		/* start a new gzip member from time to time, so that a reader can
+		 * be positioned without inflating the file from its beginning.
+		 */
+		if(pThis->bzInitDone && pThis->zstrm.total_in >= STRM_ZIP_MEMBER_SIZE) {
+			CHKiRet(doZipFinish(pThis));
+		}
+		CHKiRet(strmCheckNextOutputFile(pThis));
+	}
+
+finalize_it:
+	if(pThis->bAsyncWrite)
+		d_pthread_mutex_unlock(&pThis->mut);
+
+	RETiRet;
+}
+
+
+/* flush the stream output buffer and sync the file to disk. This is meant
+ * for streams with bDeferSync set, where the caller decides when data must
+ * be durable (e.g. the disk queue's group commit). It can be used with any
+ * write stream, though.
+ */
+static rsRetVal
+strmSync(strm_t *pThis)
+{
+	DEFiRet;
+
+	ASSERT(pThis != NULL);
+
+	if(pThis->bAsyncWrite)
+		d_pthread_mutex_lock(&pThis->mut);
+	CHKiRet(strmFlushInternal(pThis, 1));
+	strmWaitAsyncWriterDone(pThis);
+	if(pThis->fd != -1)
+		CHKiRet(syncFile(pThis));
+
+finalize_it:
+	if(pThis->bAsyncWrite)
+		d_pthread_mutex_unlock(&pThis->mut);
+
+	RETiRet;
+}
+
+
+/* flush the stream output buffer and initiate writeback of the file data,
+ * without waiting for it to complete. A Sync() that follows then mostly
+ * waits for I/O which is already in flight. This permits to sync a set of
+ * files with overlapping I/O: call SyncStart() for each of them, then
+ * Sync() for each. Where sync_file_range() is not available, this is
+ * just a flush.
+ */
+static rsRetVal
+strmSyncStart(strm_t *pThis)
+{
+	DEFiRet;
+
+	ASSERT(pThis != NULL);
+
+	if(pThis->bAsyncWrite)
+		d_pthread_mutex_lock(&pThis->mut);
+	CHKiRet(strmFlushInternal(pThis, 1));
+	strmWaitAsyncWriterDone(pThis);
+#ifdef HAVE_SYNC_FILE_RANGE
+	if(pThis->fd != -1 && !pThis->bIsTTY && pThis->pMmap == NULL) {
+		if(sync_file_range(pThis->fd, 0, 0, SYNC_FILE_RANGE_WRITE) != 0) {
+			DBGPRINTF("sync_file_range failed for file %d with error %d - ignoring\n",
+				  pThis->fd, errno);
+		}
+	}
+#endif
 
 finalize_it:
 	if(pThis->bAsyncWrite)
@@ -1441,6 +2692,30 @@ finalize_it:
 }
 
 
+/* close the stream's file, but keep the stream itself. All buffered data is
+ * written (and synced, in deferred sync mode). The next write reopens the
+ * file, which is much cheaper than constructing a new stream, as buffers,
+ * the async writer and compression state are retained. This permits callers
+ * to bound the number of open files they keep.
+ */
+static rsRetVal
+strmClose(strm_t *pThis)
+{
+	DEFiRet;
+
+	ASSERT(pThis != NULL);
+
+	if(pThis->bAsyncWrite)
+		d_pthread_mutex_lock(&pThis->mut);
+	if(pThis->fd != -1)
+		iRet = strmCloseFile(pThis);
+	if(pThis->bAsyncWrite)
+		d_pthread_mutex_unlock(&pThis->mut);
+
+	RETiRet;
+}
+
+
 /* seek a stream to a specific location. Pending writes are flushed, read data
  * is invalidated.
  * rgerhards, 2008-01-12
@@ -1465,6 +2740,8 @@ static rsRetVal strmSeek(strm_t *pThis, off64_t offs)
 	}
 	pThis->iCurrOffs = offs; /* we are now at *this* offset */
 	pThis->iBufPtr = 0; /* buffer invalidated */
+	if(pThis->bMmap)
+		pThis->iBufPtrMax = 0; /* the buffer is a window into the mapping in read mode */
 
 finalize_it:
 	RETiRet;
@@ -1528,21 +2805,41 @@ finalize_it:
 static rsRetVal strmSeekCurrOffs(strm_t *pThis)
 {
 	off64_t targetOffs;
+	off64_t hintPhys;
+	off64_t hintLog;
 	uchar c;
 	DEFiRet;
 
 	ISOBJ_TYPE_assert(pThis, strm);
 
-	if(pThis->cryprov == NULL || pThis->tOperationsMode != STREAMMODE_READ) {
+	if(   (pThis->cryprov == NULL && !pThis->iZipLevel)
+	   || pThis->tOperationsMode != STREAMMODE_READ) {
 		iRet = strmSeek(pThis, pThis->iCurrOffs);
 		FINALIZE;
 	}
 
-	/* As the cryprov may use CBC or similiar things, we need to read skip data */
+	/* As the cryprov may use CBC or similiar things, we need to read skip data.
+	 * The same applies to compressed files, where read offsets are offsets
+	 * into the uncompressed data.
+	 */
 	targetOffs = pThis->iCurrOffs;
 	pThis->iCurrOffs = 0;
-	DBGOPRINT((obj_t*) pThis, "encrypted, doing skip read of %lld bytes\n",
-		(long long) targetOffs);
+	if(pThis->iZipLevel && pThis->iHintLog > 0 && pThis->iHintLog <= targetOffs) {
+		/* start inflating at the gzip member the target is in */
+		hintPhys = pThis->iHintPhys;
+		hintLog = pThis->iHintLog;
+		CHKiRet(strmOpenFile(pThis));
+		if(lseek64(pThis->fd, hintPhys, SEEK_SET) != hintPhys) {
+			DBGOPRINT((obj_t*) pThis, "error seeking to zip member at %lld\n",
+				  (long long) hintPhys);
+			ABORT_FINALIZE(RS_RET_IO_ERROR);
+		}
+		pThis->iZipPhysOffs = pThis->iHintPhys = hintPhys;
+		pThis->iCurrOffs = pThis->iHintLog = hintLog;
+	}
+	DBGOPRINT((obj_t*) pThis, "%s, doing skip read of %lld bytes\n",
+		(pThis->cryprov == NULL) ? "compressed" : "encrypted",
+		(long long) (targetOffs - pThis->iCurrOffs));
 	while(targetOffs != pThis->iCurrOffs) {
 		CHKiRet(strmReadChar(pThis, &c));
 	}
@@ -1565,6 +2862,11 @@ static rsRetVal strmWriteChar(strm_t *__restrict__ const pThis, const uchar c)
 	if(pThis->bDisabled)
 		ABORT_FINALIZE(RS_RET_STREAM_DISABLED);
 
+	if(pThis->bMmap) {
+		iRet = strmMmapWrite(pThis, &c, 1);
+		FINALIZE;
+	}
+
 	/* if the buffer is full, we need to flush before we can write */
 	if(pThis->iBufPtr == pThis->sIOBufSize) {
 		CHKiRet(strmFlushInternal(pThis, 0));
@@ -1631,6 +2933,11 @@ strmWrite(strm_t *__restrict__ const pThis, const uchar *__restrict__ const pBuf
 	if(pThis->bDisabled)
 		ABORT_FINALIZE(RS_RET_STREAM_DISABLED);
 
+	if(pThis->bMmap) {
+		iRet = strmMmapWrite(pThis, pBuf, lenBuf);
+		FINALIZE;
+	}
+
 	if(pThis->bAsyncWrite)
 		d_pthread_mutex_lock(&pThis->mut);
 
@@ -1671,6 +2978,53 @@ finalize_it:
 }
 
 
+/* write a vector of buffers to the stream. This is equivalent to calling
+ * strmWrite() for each of them. However, if the data is larger than the
+ * stream's IO buffer, it is written directly from the caller's buffers with
+ * writev() instead of being copied into the IO buffer first (after the
+ * current buffer contents have been written). This is not possible for
+ * zipped, encrypted, mmaped, async and O_DIRECT streams, which always use
+ * the buffered path.
+ */
+static rsRetVal
+strmWritev(strm_t *__restrict__ const pThis, const struct iovec *const iov, const int iovcnt)
+{
+	size_t lenTotal;
+	size_t iWritten;
+	int i;
+	DEFiRet;
+
+	ASSERT(pThis != NULL);
+	if(pThis->bDisabled)
+		ABORT_FINALIZE(RS_RET_STREAM_DISABLED);
+
+	lenTotal = 0;
+	for(i = 0 ; i < iovcnt ; ++i)
+		lenTotal += iov[i].iov_len;
+
+	if(   lenTotal < pThis->sIOBufSize || pThis->iZipLevel || pThis->cryprov != NULL
+	   || pThis->bMmap || pThis->bAsyncWrite || pThis->fdDirect != -1) {
+		for(i = 0 ; i < iovcnt ; ++i) {
+			if(iov[i].iov_len > 0)
+				CHKiRet(strmWrite(pThis, iov[i].iov_base, iov[i].iov_len));
+		}
+		FINALIZE;
+	}
+
+	CHKiRet(strmFlushInternal(pThis, 0));
+	if(pThis->fd == -1)
+		CHKiRet(strmOpenFile(pThis));
+	if(pThis->iPreallocSize > 0)
+		strmPrealloc(pThis, lenTotal);
+	iWritten = lenTotal;
+	CHKiRet(doWritevCall(pThis, iov, iovcnt, &iWritten));
+	CHKiRet(strmPhysWriteDone(pThis, iWritten, 0));
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* property set methods */
 /* simple ones first */
 DEFpropSetMeth(strm, iMaxFileSize, int64)
@@ -1681,12 +3035,18 @@ DEFpropSetMeth(strm, sType, strmType_t)
 DEFpropSetMeth(strm, iZipLevel, int)
 DEFpropSetMeth(strm, bVeryReliableZip, int)
 DEFpropSetMeth(strm, bSync, int)
+DEFpropSetMeth(strm, bDeferSync, int)
 DEFpropSetMeth(strm, sIOBufSize, size_t)
 DEFpropSetMeth(strm, iSizeLimit, off_t)
 DEFpropSetMeth(strm, iFlushInterval, int)
 DEFpropSetMeth(strm, pszSizeLimitCmd, uchar*)
+DEFpropSetMeth(strm, iSizeLimitRotate, int)
+DEFpropSetMeth(strm, iSizeLimitKeep, int)
 DEFpropSetMeth(strm, cryprov, cryprov_if_t*)
 DEFpropSetMeth(strm, cryprovData, void*)
+DEFpropSetMeth(strm, compprov, compprov_if_t*)
+DEFpropSetMeth(strm, iPreallocSize, int64)
+DEFpropSetMeth(strm, bDirectIO, int)
 
 static rsRetVal strmSetbDeleteOnClose(strm_t *pThis, int val)
 {
@@ -1697,6 +3057,21 @@ static rsRetVal strmSetbDeleteOnClose(strm_t *pThis, int val)
 	return RS_RET_OK;
 }
 
+/* mmap mode is only supported for plain circular files (as used by the
+ * queue). For anything else, the request is ignored. Must be called before
+ * the file is opened.
+ */
+static rsRetVal strmSetbMmap(strm_t *pThis, int val)
+{
+	if(val && (pThis->sType != STREAMTYPE_FILE_CIRCULAR || pThis->iZipLevel
+		   || pThis->cryprov != NULL || pThis->iFlushInterval != 0)) {
+		DBGOPRINT((obj_t*) pThis, "mmap mode not supported for this stream, ignored\n");
+		val = 0;
+	}
+	pThis->bMmap = val;
+	return RS_RET_OK;
+}
+
 static rsRetVal strmSetiMaxFiles(strm_t *pThis, int iNewVal)
 {
 	pThis->iMaxFiles = iNewVal;
@@ -1845,6 +3220,13 @@ static rsRetVal strmSerialize(strm_t *pThis, strm_t *pStrm)
 	l = pThis->inode;
 	objSerializeSCALAR_VAR(pStrm, inode, INT64, l);
 
+	/* only written if set, so that state files of other users do not change */
+	if(pThis->iZipLevel) {
+		objSerializeSCALAR(pStrm, iZipLevel, INT);
+		objSerializeSCALAR(pStrm, iHintPhys, INT64);
+		objSerializeSCALAR(pStrm, iHintLog, INT64);
+	}
+
 	objSerializePTR(pStrm, prevLineSegment, PSZ);
 
 	CHKiRet(obj.EndSerialize(pStrm));
@@ -1884,6 +3266,9 @@ strmDup(strm_t *pThis, strm_t **ppNew)
 	pNew->iFileNumDigits = pThis->iFileNumDigits;
 	pNew->bDeleteOnClose = pThis->bDeleteOnClose;
 	pNew->iCurrOffs = pThis->iCurrOffs;
+	pNew->iZipLevel = pThis->iZipLevel;
+	pNew->iHintPhys = pThis->iHintPhys;
+	pNew->iHintLog = pThis->iHintLog;
 	
 	*ppNew = pNew;
 	pNew = NULL;
@@ -1954,6 +3339,12 @@ static rsRetVal strmSetProperty(strm_t *pThis, var_t *pProp)
 		CHKiRet(strmSetiFileNumDigits(pThis, pProp->val.num));
  	} else if(isProp("bDeleteOnClose")) {
 		CHKiRet(strmSetbDeleteOnClose(pThis, pProp->val.num));
+ 	} else if(isProp("iZipLevel")) {
+		CHKiRet(strmSetiZipLevel(pThis, pProp->val.num));
+ 	} else if(isProp("iHintPhys")) {
+		pThis->iHintPhys = pProp->val.num;
+ 	} else if(isProp("iHintLog")) {
+		pThis->iHintLog = pProp->val.num;
  	} else if(isProp("prevLineSegment")) {
 		CHKiRet(rsCStrConstructFromCStr(&pThis->prevLineSegment, pProp->val.pStr));
 	}
@@ -1982,6 +3373,31 @@ strmGetCurrOffset(strm_t *pThis, int64 *pOffs)
 }
 
 
+/* the seek hint is a position in the current file from which reading can begin
+ * (in zip mode, the start of a gzip member). It is valid for all offsets at or
+ * behind it in the same file. The queue hands it from the dequeue stream to the
+ * delete stream, which is the one that is persisted. Both are 0 if there is
+ * no hint (reading must start at the beginning of the file).
+ */
+static rsRetVal
+strmGetSeekHint(strm_t *pThis, int64 *pPhys, int64 *pLog)
+{
+	ISOBJ_TYPE_assert(pThis, strm);
+	*pPhys = pThis->iHintPhys;
+	*pLog = pThis->iHintLog;
+	return RS_RET_OK;
+}
+
+static rsRetVal
+strmSetSeekHint(strm_t *pThis, int64 phys, int64 log)
+{
+	ISOBJ_TYPE_assert(pThis, strm);
+	pThis->iHintPhys = phys;
+	pThis->iHintLog = log;
+	return RS_RET_OK;
+}
+
+
 /* queryInterface function
  * rgerhards, 2008-02-29
  */
@@ -2000,15 +3416,19 @@ CODESTARTobjQueryInterface(strm)
 	pIf->ConstructFinalize = strmConstructFinalize;
 	pIf->Destruct = strmDestruct;
 	pIf->ReadChar = strmReadChar;
+	pIf->Read = strmRead;
 	pIf->UnreadChar = strmUnreadChar;
 	pIf->ReadLine = strmReadLine;
 	pIf->SeekCurrOffs = strmSeekCurrOffs;
 	pIf->Write = strmWrite;
+	pIf->Writev = strmWritev;
 	pIf->WriteChar = strmWriteChar;
 	pIf->WriteLong = strmWriteLong;
 	pIf->SetFName = strmSetFName;
 	pIf->SetDir = strmSetDir;
 	pIf->Flush = strmFlush;
+	pIf->Sync = strmSync;
+	pIf->SyncStart = strmSyncStart;
 	pIf->RecordBegin = strmRecordBegin;
 	pIf->RecordEnd = strmRecordEnd;
 	pIf->Serialize = strmSerialize;
@@ -2027,12 +3447,22 @@ CODESTARTobjQueryInterface(strm)
 	pIf->SetiZipLevel = strmSetiZipLevel;
 	pIf->SetbVeryReliableZip = strmSetbVeryReliableZip;
 	pIf->SetbSync = strmSetbSync;
+	pIf->SetbDeferSync = strmSetbDeferSync;
+	pIf->SetbMmap = strmSetbMmap;
+	pIf->GetSeekHint = strmGetSeekHint;
+	pIf->SetSeekHint = strmSetSeekHint;
 	pIf->SetsIOBufSize = strmSetsIOBufSize;
 	pIf->SetiSizeLimit = strmSetiSizeLimit;
 	pIf->SetiFlushInterval = strmSetiFlushInterval;
 	pIf->SetpszSizeLimitCmd = strmSetpszSizeLimitCmd;
+	pIf->SetiSizeLimitRotate = strmSetiSizeLimitRotate;
+	pIf->SetiSizeLimitKeep = strmSetiSizeLimitKeep;
 	pIf->Setcryprov = strmSetcryprov;
 	pIf->SetcryprovData = strmSetcryprovData;
+	pIf->Setcompprov = strmSetcompprov;
+	pIf->SetiPreallocSize = strmSetiPreallocSize;
+	pIf->SetbDirectIO = strmSetbDirectIO;
+	pIf->Close = strmClose;
 finalize_it:
 ENDobjQueryInterface(strm)
 
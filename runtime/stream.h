@@ -67,11 +67,13 @@
 
 #include <pthread.h>
 #include <stdint.h>
+#include <sys/uio.h>
 #include "obj-types.h"
 #include "glbl.h"
 #include "stream.h"
 #include "zlibw.h"
 #include "cryprov.h"
+#include "compprov.h"
 
 /* stream types */
 typedef enum {
@@ -81,6 +83,13 @@ typedef enum {
 	STREAMTYPE_NAMED_PIPE = 3	/**< file is a named pipe (so far, tested for output only) */
 } strmType_t;
 
+/* what to do when the size limit (iSizeLimit) is reached */
+typedef enum {
+	STRM_ROTATE_COMMAND = 0,	/**< run pszSizeLimitCmd and wait for it (legacy) */
+	STRM_ROTATE_NUMBERED = 1,	/**< rename to name.1, shifting older files up */
+	STRM_ROTATE_TIMESTAMP = 2	/**< rename to name.YYYYMMDD-HHMMSS */
+} strmRotateMode_t;
+
 typedef enum {				/* when extending, do NOT change existing modes! */
 	STREAMMMODE_INVALID = 0,
 	STREAMMODE_READ = 1,
@@ -90,6 +99,7 @@ typedef enum {				/* when extending, do NOT change existing modes! */
 } strmMode_t;
 
 #define STREAM_ASYNC_NUMBUFS 2 /* must be a power of 2 -- TODO: make configurable */
+#define STRM_WRITEV_MAX 64 /* max number of buffers passed to a single writev() call */
 /* The strm_t data structure */
 typedef struct strm_s {
 	BEGINobjInstance;	/* Data to implement generic object - MUST be the first data element! */
@@ -109,6 +119,11 @@ typedef struct strm_s {
 	/* dynamic properties, valid only during file open, not to be persistet */
 	sbool bDisabled; /* should file no longer be written to? (currently set only if omfile file size limit fails) */
 	sbool bSync;	/* sync this file after every write? */
+	sbool bDeferSync;	/* sync only on Sync() calls and before the file is closed (group commit) */
+	sbool bMmap;	/* use memory-mapped, preallocated segment files (circular streams only) */
+	uchar *pMmap;	/* mapping of the current file in mmap mode, NULL if none */
+	size_t lenMmap;	/* length of that mapping */
+	uchar *pIOBufSave;	/* mmap read mode: the real IO buffer while pIOBuf points into the mapping */
 	size_t sIOBufSize;/* size of IO buffer */
 	uchar *pszDir; /* Directory */
 	int lenDir;
@@ -123,6 +138,19 @@ typedef struct strm_s {
 	sbool bInRecord;	/* if 1, indicates that we are currently writing a not-yet complete record */
 	int iZipLevel;	/* zip level (0..9). If 0, zip is completely disabled */
 	Bytef *pZipBuf;
+	int64 iZipPhysOffs;	/* zip read mode: physical offset of the next read() */
+	int64 iHintPhys;	/* seek hint: physical offset of the current gzip member */
+	int64 iHintLog;		/* seek hint: offset of that member in uncompressed data */
+	/* support for compression via the zip pool (global zip.threads) */
+	struct zipjob_s *zipJobs;	/* ring of compression jobs, NULL - compress inline */
+	unsigned nZipJobs;	/* size of the ring */
+	unsigned iZipJobEnq;	/* next job to submit (counts up, modulo nZipJobs is the index) */
+	unsigned iZipJobDeq;	/* next job to write */
+	sbool bZipMember;	/* gzip header written, member not yet finished */
+	uLong zipCrc;		/* crc32 of the current member's data */
+	uLong zipLenIn;		/* size of the current member's data (mod 2^32, as in gzip) */
+	uchar *pZipDict;	/* tail of the last block submitted, dictionary for the next one */
+	unsigned lenZipDict;
 	/* support for async flush procesing */
 	sbool bAsyncWrite;	/* do asynchronous writes (always if a flush interval is given) */
 	sbool bStopWriter;	/* shall writer thread terminate? */
@@ -139,6 +167,8 @@ typedef struct strm_s {
 	cryprov_if_t *cryprov;  /* ptr to crypto provider; NULL = do not encrypt */
 	void	*cryprovData;	/* opaque data ptr for provider use */
 	void 	*cryprovFileData;/* opaque data ptr for file instance */
+	compprov_if_t *compprov; /* ptr to compression provider; NULL = zlib (if iZipLevel) */
+	void	*compprovData;	/* opaque data ptr, provider instance for this stream */
 	short iCnt;	/* current nbr of elements in buffer */
 	z_stream zstrm;	/* zip stream to use */
 	struct {
@@ -148,7 +178,17 @@ typedef struct strm_s {
 	pthread_t writerThreadID;
 	/* support for omfile size-limiting commands, special counters, NOT persisted! */
 	off_t	iSizeLimit;	/* file size limit, 0 = no limit */
+	int64	iPreallocSize;	/* allocate file space in chunks of this size, 0 = off */
+	int64	iPreallocEnd;	/* file space is allocated up to this offset */
+	sbool	bDirectIO;	/* write aligned blocks with O_DIRECT, bypassing the page cache */
+	int	fdDirect;	/* O_DIRECT descriptor of the current file, -1 if not in use */
+	uchar	*pDirBuf;	/* aligned staging buffer for O_DIRECT writes */
+	size_t	sizeDirBuf;	/* its size (a multiple of STRM_DIRECTIO_ALIGN) */
+	size_t	lenDirBuf;	/* data in pDirBuf, always less than one block between writes */
+	int64	iDirOffs;	/* file offset of pDirBuf[0], always aligned */
 	uchar	*pszSizeLimitCmd;	/* command to carry out when size limit is reached */
+	int	iSizeLimitRotate;	/* strmRotateMode_t: how to handle the size limit */
+	int	iSizeLimitKeep;		/* nbr of rotated files to keep (numbered mode) */
 	sbool	bIsTTY;		/* is this a tty file? */
 	cstr_t *prevLineSegment; /* for ReadLine, previous, unwritten part of file */
 } strm_t;
@@ -162,6 +202,7 @@ BEGINinterface(strm) /* name must also be changed in ENDinterface macro! */
 	rsRetVal (*SetFileName)(strm_t *pThis, uchar *pszName, size_t iLenName);
 	rsRetVal (*ReadChar)(strm_t *pThis, uchar *pC);
 	rsRetVal (*UnreadChar)(strm_t *pThis, uchar c);
+	rsRetVal (*Read)(strm_t *pThis, uchar *pBuf, size_t lenBuf);
 	rsRetVal (*SeekCurrOffs)(strm_t *pThis);
 	rsRetVal (*Write)(strm_t *const pThis, const uchar *const pBuf, size_t lenBuf);
 	rsRetVal (*WriteChar)(strm_t *pThis, uchar c);
@@ -197,15 +238,82 @@ BEGINinterface(strm) /* name must also be changed in ENDinterface macro! */
 	/* v9 added  2013-04-04 */
 	INTERFACEpropSetMeth(strm, cryprov, cryprov_if_t*);
 	INTERFACEpropSetMeth(strm, cryprovData, void*);
+	/* v12 added  2026-10-14 */
+	rsRetVal (*Sync)(strm_t *pThis);
+	INTERFACEpropSetMeth(strm, bDeferSync, int);
+	/* v13 added  2026-10-14 */
+	INTERFACEpropSetMeth(strm, bMmap, int);
+	/* v14 added  2026-10-14 */
+	rsRetVal (*GetSeekHint)(strm_t *pThis, int64 *pPhys, int64 *pLog);
+	rsRetVal (*SetSeekHint)(strm_t *pThis, int64 phys, int64 log);
+	/* v15 added  2026-10-14 */
+	rsRetVal (*Writev)(strm_t *const pThis, const struct iovec *const iov, const int iovcnt);
+	/* v16 added  2026-10-14 */
+	rsRetVal (*SyncStart)(strm_t *pThis);
+	/* v17 added  2026-10-14 */
+	INTERFACEpropSetMeth(strm, compprov, compprov_if_t*);
+	/* v18 added  2026-10-14 */
+	INTERFACEpropSetMeth(strm, iPreallocSize, int64);
+	/* v19 added  2026-10-14 */
+	INTERFACEpropSetMeth(strm, bDirectIO, int);
+	/* v20 added  2026-10-14 */
+	rsRetVal (*Close)(strm_t *pThis);
+	/* v21 added  2026-10-14 */
+	INTERFACEpropSetMeth(strm, iSizeLimitRotate, int);
+	INTERFACEpropSetMeth(strm, iSizeLimitKeep, int);
 ENDinterface(strm)
-#define strmCURR_IF_VERSION 10 /* increment whenever you change the interface structure! */
+#define strmCURR_IF_VERSION 21 /* increment whenever you change the interface structure! */
 /* V10, 2013-09-10: added new parameter bEscapeLF, changed mode to uint8_t (rgerhards) */
+/* V11, 2026-10-14: added Read() for binary records */
+/* V12, 2026-10-14: added Sync() and bDeferSync for group commit */
+/* V13, 2026-10-14: added bMmap for memory-mapped queue segments */
+/* V14, 2026-10-14: added Get/SetSeekHint() for fast positioning in zipped files */
+/* V15, 2026-10-14: added Writev() for writing without copying to the IO buffer */
+/* V16, 2026-10-14: added SyncStart() for syncing several files with overlapping I/O */
+/* V17, 2026-10-14: added compprov for compression providers other than zlib */
+/* V18, 2026-10-14: added iPreallocSize for preallocating file space */
+/* V19, 2026-10-14: added bDirectIO for O_DIRECT output files */
+/* V20, 2026-10-14: added Close() to close the file but keep the stream */
+/* V21, 2026-10-14: added iSizeLimitRotate/Keep for built-in size limit rotation */
 
 static inline int
 strmGetCurrFileNum(strm_t *pStrm) {
 	return pStrm->iCurrFNum;
 }
 
+static inline uchar *
+strmGetFName(strm_t *pStrm) {
+	return pStrm->pszFName;
+}
+
+/* set file number and offset of a stream that is not yet opened, e.g.
+ * right after deserializing it (it is positioned by SeekCurrOffs())
+ */
+static inline void
+strmSetCurrPos(strm_t *pStrm, int fileNum, int64 offs) {
+	pStrm->iCurrFNum = fileNum;
+	pStrm->iCurrOffs = offs;
+}
+
+/* get a duplicate of the file descriptor of a write stream and of its
+ * directory (or -1 if not open), so that the caller can sync the file without
+ * holding a lock that guards the stream. Memory-mapped streams need msync()
+ * and streams with an async writer must wait for it, so for them 0 is
+ * returned and the caller must use strm.Sync() instead.
+ */
+static inline int
+strmDupFdForSync(strm_t *pStrm, int *pFd, int *pFdDir) {
+	*pFd = *pFdDir = -1;
+	if(pStrm->pMmap != NULL || pStrm->bAsyncWrite)
+		return 0;
+	if(pStrm->fd != -1 && !pStrm->bIsTTY) {
+		*pFd = dup(pStrm->fd);
+		if(pStrm->fdDir != -1)
+			*pFdDir = dup(pStrm->fdDir);
+	}
+	return 1;
+}
+
 /* prototypes */
 PROTOTYPEObjClassInit(strm);
 rsRetVal strmMultiFileSeek(strm_t *pThis, int fileNum, off64_t offs, off64_t *bytesDel);
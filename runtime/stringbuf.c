@@ -51,6 +51,35 @@ uchar*  rsCStrGetSzStr(cstr_t *pThis);
 DEFobjCurrIf(obj)
 DEFobjCurrIf(regexp)
 
+/* obtain a buffer of at least iSize bytes for an object that currently
+ * has none. Small sizes are served from the object's inline buffer.
+ */
+static inline rsRetVal
+cstrAllocBuf(cstr_t *pThis, size_t iSize)
+{
+	if(iSize <= CSTR_INLINE_SIZE) {
+		pThis->pBuf = pThis->szInline;
+		pThis->iBufSize = CSTR_INLINE_SIZE;
+		return RS_RET_OK;
+	}
+	if((pThis->pBuf = (uchar*) MALLOC(sizeof(uchar) * iSize)) == NULL)
+		return RS_RET_OUT_OF_MEMORY;
+	pThis->iBufSize = iSize;
+	return RS_RET_OK;
+}
+
+
+/* free the string buffers, but not the object itself */
+static inline void
+cstrFreeBufs(cstr_t *pThis)
+{
+	if(pThis->pszBuf != pThis->pBuf)
+		free(pThis->pszBuf);
+	if(pThis->pBuf != pThis->szInline)
+		free(pThis->pBuf);
+}
+
+
 /* ################################################################# *
  * public members                                                    *
  * ################################################################# */
@@ -77,6 +106,20 @@ finalize_it:
 }
 
 
+/* construct an object in storage provided by the caller, e.g. inside
+ * another object, so that no allocation is needed for it. The storage
+ * must stay valid until rsCStrDestruct() is called, which then only frees
+ * the string buffers. Objects constructed this way cannot be passed to
+ * cstrConvSzStrAndDestruct().
+ */
+void cstrConstructInPlace(cstr_t *pThis)
+{
+	memset(pThis, 0, sizeof(cstr_t));
+	rsSETOBJTYPE(pThis, OIDrsCStr);
+	pThis->bInPlace = 1;
+}
+
+
 /* construct from sz string
  * rgerhards 2005-09-15
  */
@@ -89,8 +132,8 @@ rsRetVal rsCStrConstructFromszStr(cstr_t **ppThis, uchar *sz)
 
 	CHKiRet(rsCStrConstruct(&pThis));
 
-	pThis->iBufSize = pThis->iStrLen = strlen((char *) sz);
-	if((pThis->pBuf = (uchar*) MALLOC(sizeof(uchar) * pThis->iStrLen)) == NULL) {
+	pThis->iStrLen = strlen((char *) sz);
+	if(cstrAllocBuf(pThis, pThis->iStrLen + 1) != RS_RET_OK) {
 		RSFREEOBJ(pThis);
 		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 	}
@@ -126,9 +169,9 @@ static rsRetVal rsCStrConstructFromszStrv(cstr_t **ppThis, char *fmt, va_list ap
 
 	CHKiRet(rsCStrConstruct(&pThis));
 
-	pThis->iBufSize = pThis->iStrLen = len;
+	pThis->iStrLen = len;
 	len++; /* account for the \0 written by vsnprintf */
-	if((pThis->pBuf = (uchar*) MALLOC(sizeof(uchar) * len)) == NULL) {
+	if(cstrAllocBuf(pThis, len) != RS_RET_OK) {
 		RSFREEOBJ(pThis);
 		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 	}
@@ -167,8 +210,8 @@ rsRetVal cstrConstructFromESStr(cstr_t **ppThis, es_str_t *str)
 
 	CHKiRet(rsCStrConstruct(&pThis));
 
-	pThis->iBufSize = pThis->iStrLen = es_strlen(str);
-	if((pThis->pBuf = (uchar*) MALLOC(sizeof(uchar) * pThis->iStrLen)) == NULL) {
+	pThis->iStrLen = es_strlen(str);
+	if(cstrAllocBuf(pThis, pThis->iStrLen + 1) != RS_RET_OK) {
 		RSFREEOBJ(pThis);
 		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 	}
@@ -196,8 +239,8 @@ rsRetVal rsCStrConstructFromCStr(cstr_t **ppThis, cstr_t *pFrom)
 
 	CHKiRet(rsCStrConstruct(&pThis));
 
-	pThis->iBufSize = pThis->iStrLen = pFrom->iStrLen;
-	if((pThis->pBuf = (uchar*) MALLOC(sizeof(uchar) * pThis->iStrLen)) == NULL) {
+	pThis->iStrLen = pFrom->iStrLen;
+	if(cstrAllocBuf(pThis, pThis->iStrLen + 1) != RS_RET_OK) {
 		RSFREEOBJ(pThis);
 		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 	}
@@ -215,9 +258,9 @@ void rsCStrDestruct(cstr_t **ppThis)
 {
 	cstr_t *pThis = *ppThis;
 
-	free(pThis->pBuf);
-	free(pThis->pszBuf);
-	RSFREEOBJ(pThis);
+	cstrFreeBufs(pThis);
+	if(!pThis->bInPlace)
+		RSFREEOBJ(pThis);
 	*ppThis = NULL;
 }
 
@@ -229,6 +272,8 @@ void rsCStrDestruct(cstr_t **ppThis)
  * some more characters may be added after these.
  * rgerhards, 2008-01-07
  * changed to utilized realloc() -- rgerhards, 2009-06-16
+ * Small strings are first kept in the object's inline buffer; once they
+ * outgrow it, they are moved to the heap.
  */
 rsRetVal
 rsCStrExtendBuf(cstr_t *pThis, size_t iMinNeeded)
@@ -237,6 +282,12 @@ rsCStrExtendBuf(cstr_t *pThis, size_t iMinNeeded)
 	size_t iNewSize;
 	DEFiRet;
 
+	if(pThis->pBuf == NULL && iMinNeeded <= CSTR_INLINE_SIZE) {
+		pThis->pBuf = pThis->szInline;
+		pThis->iBufSize = CSTR_INLINE_SIZE;
+		FINALIZE;
+	}
+
 	/* first compute the new size needed */
 	if(iMinNeeded > RS_STRINGBUF_ALLOC_INCREMENT) {
 		/* we allocate "n" ALLOC_INCREMENTs. Usually, that should
@@ -252,7 +303,14 @@ rsCStrExtendBuf(cstr_t *pThis, size_t iMinNeeded)
 	iNewSize += pThis->iBufSize; /* add current size */
 
 	/* DEV debugging only: dbgprintf("extending string buffer, old %d, new %d\n", pThis->iBufSize, iNewSize); */
-	CHKmalloc(pNewBuf = (uchar*) realloc(pThis->pBuf, iNewSize * sizeof(uchar)));
+	if(pThis->pBuf == pThis->szInline) {
+		CHKmalloc(pNewBuf = (uchar*) MALLOC(iNewSize * sizeof(uchar)));
+		memcpy(pNewBuf, pThis->pBuf, pThis->iStrLen);
+	} else {
+		CHKmalloc(pNewBuf = (uchar*) realloc(pThis->pBuf, iNewSize * sizeof(uchar)));
+	}
+	if(pThis->pszBuf == pThis->pBuf)
+		pThis->pszBuf = NULL; /* will be re-created from the new buffer */
 	pThis->iBufSize = iNewSize;
 	pThis->pBuf = pNewBuf;
 
@@ -350,24 +408,35 @@ finalize_it:
  * rgerhards, 2005-10-18
  */
 rsRetVal rsCStrSetSzStr(cstr_t *pThis, uchar *pszNew)
+{
+	return rsCStrSetSzStrWithLen(pThis, pszNew, (pszNew == NULL) ? 0 : strlen((char*)pszNew));
+}
+
+
+/* Sets the string object to the first iStrLen characters of the
+ * provided buffer, which need not be \0-terminated. This permits
+ * callers to set a value directly from inside a larger buffer without
+ * copying it first. A NULL pointer creates an empty string, as with
+ * rsCStrSetSzStr().
+ */
+rsRetVal rsCStrSetSzStrWithLen(cstr_t *pThis, uchar *pszNew, size_t iStrLen)
 {
 	rsCHECKVALIDOBJECT(pThis, OIDrsCStr);
 
-	free(pThis->pBuf);
-	free(pThis->pszBuf);
+	cstrFreeBufs(pThis);
+	pThis->pszBuf = NULL;
 	if(pszNew == NULL) {
 		pThis->iStrLen = 0;
 		pThis->iBufSize = 0;
 		pThis->pBuf = NULL;
-		pThis->pszBuf = NULL;
 	} else {
-		pThis->iStrLen = strlen((char*)pszNew);
-		pThis->iBufSize = pThis->iStrLen;
-		pThis->pszBuf = NULL;
+		pThis->iStrLen = iStrLen;
 
-		/* now save the new value */
-		if((pThis->pBuf = (uchar*) MALLOC(sizeof(uchar) * pThis->iStrLen)) == NULL) {
-			RSFREEOBJ(pThis);
+		/* now save the new value, with room for the \0 of cstrFinalize() */
+		if(cstrAllocBuf(pThis, pThis->iStrLen + 1) != RS_RET_OK) {
+			pThis->iStrLen = 0;
+			pThis->iBufSize = 0;
+			pThis->pBuf = NULL;
 			return RS_RET_OUT_OF_MEMORY;
 		}
 
@@ -404,6 +473,8 @@ uchar*  rsCStrGetSzStrNoNULL(cstr_t *pThis)
  * is a feature, not a bug. If you need non-NULL in any case, use
  * rsCStrGetSzStrNoNULL() instead.
  * rgerhards, 2005-09-15
+ * If the string contains no \0 and there is room for the terminator, the
+ * string buffer itself is returned, so that no copy is needed.
  */
 uchar*  rsCStrGetSzStr(cstr_t *pThis)
 {
@@ -411,7 +482,20 @@ uchar*  rsCStrGetSzStr(cstr_t *pThis)
 
 	rsCHECKVALIDOBJECT(pThis, OIDrsCStr);
 
-	if(pThis->pBuf != NULL)
+	if(pThis->pBuf != NULL) {
+		if(pThis->pszBuf == pThis->pBuf) {
+			/* content may have been appended since, so terminate again */
+			if(pThis->iStrLen < pThis->iBufSize) {
+				pThis->pBuf[pThis->iStrLen] = '\0';
+				return pThis->pszBuf;
+			}
+			pThis->pszBuf = NULL;
+		}
+		if(pThis->pszBuf == NULL && pThis->iStrLen < pThis->iBufSize
+		   && memchr(pThis->pBuf, '\0', pThis->iStrLen) == NULL) {
+			pThis->pBuf[pThis->iStrLen] = '\0';
+			pThis->pszBuf = pThis->pBuf;
+		}
 		if(pThis->pszBuf == NULL) {
 			/* we do not yet have a usable sz version - so create it... */
 			if((pThis->pszBuf = MALLOC((pThis->iStrLen + 1) * sizeof(uchar))) == NULL) {
@@ -436,6 +520,7 @@ uchar*  rsCStrGetSzStr(cstr_t *pThis)
 				pThis->pszBuf[i] = '\0';
 			}
 		}
+	}
 
 	return(pThis->pszBuf);
 }
@@ -465,6 +550,7 @@ rsRetVal cstrConvSzStrAndDestruct(cstr_t *pThis, uchar **ppSz, int bRetNULL)
 	rsCHECKVALIDOBJECT(pThis, OIDrsCStr);
 	assert(ppSz != NULL);
 	assert(bRetNULL == 0 || bRetNULL == 1);
+	assert(!pThis->bInPlace);
 
 	if(pThis->pBuf == NULL) {
 		if(bRetNULL == 0) {
@@ -473,6 +559,11 @@ rsRetVal cstrConvSzStrAndDestruct(cstr_t *pThis, uchar **ppSz, int bRetNULL)
 		} else {
 			pRetBuf = NULL;
 		}
+	} else if(pThis->pBuf == pThis->szInline) {
+		/* the inline buffer goes away with the object, so copy it */
+		CHKmalloc(pRetBuf = MALLOC(pThis->iStrLen + 1));
+		memcpy(pRetBuf, pThis->pBuf, pThis->iStrLen);
+		pRetBuf[pThis->iStrLen] = '\0';
 	} else
 		pRetBuf = pThis->pBuf;
 	
@@ -692,14 +783,15 @@ int rsCStrCaseInsensitveStartsWithSzStr(cstr_t *pCS1, uchar *psz, size_t iLenSz)
  * rgerhards, 2007-07-16: bug is no real bug, because rsyslogd ensures there
  * never is a \0 *inside* a property string.
  * Note that the function returns -1 if regexp functionality is not available.
- * rgerhards: 2009-03-04: ERE support added, via parameter iType: 0 - BRE, 1 - ERE
+ * rgerhards: 2009-03-04: ERE support added, via parameter iType: 0 - BRE, 1 - ERE, 2 - PCRE
  * Arnaud Cornet/rgerhards: 2009-04-02: performance improvement by caching compiled regex
  * If a caller does not need the cached version, it must still provide memory for it
  * and must call rsCStrRegexDestruct() afterwards.
  */
 rsRetVal rsCStrSzStrMatchRegex(cstr_t *pCS1, uchar *psz, int iType, void *rc)
 {
-	regex_t **cache = (regex_t**) rc;
+	rsregex_t **cache = (rsregex_t**) rc;
+	int iOptions;
 	int ret;
 	DEFiRet;
 
@@ -709,8 +801,9 @@ rsRetVal rsCStrSzStrMatchRegex(cstr_t *pCS1, uchar *psz, int iType, void *rc)
 
 	if(objUse(regexp, LM_REGEXP_FILENAME) == RS_RET_OK) {
 		if (*cache == NULL) {
-			*cache = calloc(sizeof(regex_t), 1);
-			regexp.regcomp(*cache, (char*) rsCStrGetSzStr(pCS1), (iType == 1 ? REG_EXTENDED : 0) | REG_NOSUB);
+			*cache = calloc(sizeof(rsregex_t), 1);
+			iOptions = (iType == 2) ? RS_REG_PCRE : (iType == 1) ? REG_EXTENDED : 0;
+			regexp.regcomp(*cache, (char*) rsCStrGetSzStr(pCS1), iOptions | REG_NOSUB);
 		}
 		ret = regexp.regexec(*cache, (char*) psz, 0, NULL, 0);
 		if(ret != 0)
@@ -730,7 +823,7 @@ finalize_it:
  */
 void rsCStrRegexDestruct(void *rc)
 {
-	regex_t **cache = rc;
+	rsregex_t **cache = rc;
 	
 	assert(cache != NULL);
 	assert(*cache != NULL);
@@ -35,6 +35,12 @@
 #include <assert.h>
 #include <libestr.h>
 
+/* Size of the buffer inside the object. Strings that fit into it (including
+ * the \0 terminator) need no separate allocation. This covers most APP-NAME,
+ * PROCID and MSGID values.
+ */
+#define CSTR_INLINE_SIZE 32
+
 /** 
  * The dynamic string buffer object.
  */
@@ -44,9 +50,12 @@ typedef struct cstr_s
 	rsObjID OID;		/**< object ID */
 #endif
 	uchar *pBuf;		/**< pointer to the string buffer, may be NULL if string is empty */
-	uchar *pszBuf;		/**< pointer to the sz version of the string (after it has been created )*/
+	uchar *pszBuf;		/**< pointer to the sz version of the string (after it has been created ),
+				     the same as pBuf if that could be used directly */
 	size_t iBufSize;	/**< current maximum size of the string buffer */
 	size_t iStrLen;		/**< length of the string in characters. */
+	sbool bInPlace;		/**< object storage is owned by the caller, see cstrConstructInPlace() */
+	uchar szInline[CSTR_INLINE_SIZE]; /**< pBuf points here while the string is small */
 } cstr_t;
 
 
@@ -54,6 +63,7 @@ typedef struct cstr_s
  * Construct a rsCStr object.
  */
 rsRetVal cstrConstruct(cstr_t **ppThis);
+void cstrConstructInPlace(cstr_t *pThis);
 #define rsCStrConstruct(x) cstrConstruct((x))
 rsRetVal cstrConstructFromESStr(cstr_t **ppThis, es_str_t *str);
 rsRetVal rsCStrConstructFromszStr(cstr_t **ppThis, uchar *sz);
@@ -191,6 +201,7 @@ rsRetVal strExit(void); /* TODO: remove once we have a real object interface! */
 uchar* __attribute__((deprecated)) rsCStrGetSzStr(cstr_t *pThis);
 uchar*  rsCStrGetSzStrNoNULL(cstr_t *pThis);
 rsRetVal rsCStrSetSzStr(cstr_t *pThis, uchar *pszNew);
+rsRetVal rsCStrSetSzStrWithLen(cstr_t *pThis, uchar *pszNew, size_t iStrLen);
 int rsCStrCStrCmp(cstr_t *pCS1, cstr_t *pCS2);
 int rsCStrSzStrCmp(cstr_t *pCS1, uchar *psz, size_t iLenSz);
 int rsCStrOffsetSzStrCmp(cstr_t *pCS1, size_t iOffset, uchar *psz, size_t iLenSz);
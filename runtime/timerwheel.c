@@ -0,0 +1,241 @@
+/* timerwheel.c - a global hashed timer wheel
+ *
+ * Timers are kept in TMRWHEEL_SLOTS doubly-linked lists, indexed by their
+ * expiry tick modulo the number of slots. Scheduling and cancelling are
+ * O(1). A single thread sleeps until the next slot that holds a timer due
+ * in the current revolution of the wheel (or without timeout if no timer is
+ * pending) and then runs the callbacks of all expired timers. Timers due
+ * in later revolutions simply stay in their slot.
+ *
+ * The thread is started on first use, as this happens only after rsyslogd
+ * has forked into the background. It runs until rsyslogd terminates.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#if HAVE_SYS_PRCTL_H
+#  include <sys/prctl.h>
+#endif
+#include "rsyslog.h"
+#include "srUtils.h"
+#include "timerwheel.h"
+
+#define TMRWHEEL_TICK_MS 100	/* resolution of the timers */
+#define TMRWHEEL_SLOTS 256	/* so one revolution is 25.6 seconds */
+
+static pthread_mutex_t mutWheel = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t condWheel = PTHREAD_COND_INITIALIZER;	/* timer added */
+static pthread_cond_t condDone = PTHREAD_COND_INITIALIZER;	/* callback done */
+static rstimer_t *slots[TMRWHEEL_SLOTS];
+static uint64_t usecStart;	/* monotonic time of tick 0 */
+static uint64_t tickDone = 0;	/* all ticks up to and including this are processed */
+static int nPending = 0;	/* number of timers in the wheel */
+static rstimer_t *pRunning = NULL; /* timer whose callback is currently running */
+static sbool bStarted = 0;	/* start attempted? */
+static sbool bRunning = 0;	/* timer thread is running */
+
+
+static inline uint64_t
+currTick(void)
+{
+	return (getMonotonicUsecs() - usecStart) / (TMRWHEEL_TICK_MS * 1000);
+}
+
+
+/* the following two must be called with mutWheel locked */
+static inline void
+timerLink(rstimer_t *const pTmr)
+{
+	rstimer_t **ppRoot = &slots[pTmr->tickExpire % TMRWHEEL_SLOTS];
+
+	pTmr->pPrev = NULL;
+	if((pTmr->pNext = *ppRoot) != NULL)
+		pTmr->pNext->pPrev = pTmr;
+	*ppRoot = pTmr;
+	pTmr->bPending = 1;
+	++nPending;
+}
+
+static inline void
+timerUnlink(rstimer_t *const pTmr)
+{
+	if(pTmr->pPrev == NULL)
+		slots[pTmr->tickExpire % TMRWHEEL_SLOTS] = pTmr->pNext;
+	else
+		pTmr->pPrev->pNext = pTmr->pNext;
+	if(pTmr->pNext != NULL)
+		pTmr->pNext->pPrev = pTmr->pPrev;
+	pTmr->bPending = 0;
+	--nPending;
+}
+
+
+/* run the callbacks of all expired timers in one slot, called with
+ * mutWheel locked. The lock is released while a callback runs, so we
+ * start over at the slot's head after each one.
+ */
+static void
+processSlot(rstimer_t **const ppRoot, const uint64_t tickNow)
+{
+	rstimer_t *pTmr;
+
+	pTmr = *ppRoot;
+	while(pTmr != NULL) {
+		if(pTmr->tickExpire > tickNow) {
+			pTmr = pTmr->pNext;
+			continue;
+		}
+		timerUnlink(pTmr);
+		pRunning = pTmr;
+		pthread_mutex_unlock(&mutWheel);
+		pTmr->fnExpired(pTmr->pUsr);
+		pthread_mutex_lock(&mutWheel);
+		pRunning = NULL;
+		pthread_cond_broadcast(&condDone);
+		pTmr = *ppRoot;
+	}
+}
+
+
+/* number of ticks from tickDone until the next slot that holds a timer
+ * which expires in the current revolution, a full revolution if none.
+ */
+static uint64_t
+ticksToNext(void)
+{
+	rstimer_t *pTmr;
+	uint64_t i;
+
+	for(i = 1 ; i < TMRWHEEL_SLOTS ; ++i) {
+		for(pTmr = slots[(tickDone + i) % TMRWHEEL_SLOTS] ; pTmr != NULL ; pTmr = pTmr->pNext) {
+			if(pTmr->tickExpire <= tickDone + i)
+				return i;
+		}
+	}
+	return TMRWHEEL_SLOTS;
+}
+
+
+static void *
+timerwheelThread(void __attribute__((unused)) *arg)
+{
+	struct timespec t;
+	uint64_t tickNow;
+	sigset_t sigSet;
+
+	sigfillset(&sigSet);
+	pthread_sigmask(SIG_BLOCK, &sigSet, NULL);
+#	if HAVE_PRCTL && defined PR_SET_NAME
+	if(prctl(PR_SET_NAME, "rs:timer", 0, 0, 0) != 0) {
+		DBGPRINTF("prctl failed, not setting thread name for the timer wheel\n");
+	}
+#	endif
+
+	pthread_mutex_lock(&mutWheel);
+	while(1) {
+		tickNow = currTick();
+		/* after a long sleep, one pass over all slots is sufficient */
+		if(tickNow - tickDone > TMRWHEEL_SLOTS)
+			tickDone = tickNow - TMRWHEEL_SLOTS;
+		while(tickDone < tickNow) {
+			++tickDone;
+			processSlot(&slots[tickDone % TMRWHEEL_SLOTS], tickNow);
+		}
+		if(nPending == 0) {
+			pthread_cond_wait(&condWheel, &mutWheel);
+		} else {
+			timeoutComp(&t, (long) ticksToNext() * TMRWHEEL_TICK_MS);
+			pthread_cond_timedwait(&condWheel, &mutWheel, &t);
+		}
+	}
+	/*NOTREACHED*/
+	return NULL;
+}
+
+
+/* start the timer thread, called with mutWheel locked */
+static void
+timerwheelStart(void)
+{
+	pthread_attr_t attr;
+	pthread_t tid;
+
+	bStarted = 1;
+	usecStart = getMonotonicUsecs();
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if(pthread_create(&tid, &attr, timerwheelThread, NULL) == 0)
+		bRunning = 1;
+	pthread_attr_destroy(&attr);
+	DBGPRINTF("timerwheel: timer thread %sstarted\n", bRunning ? "" : "could not be ");
+}
+
+
+void
+timerInit(rstimer_t *const pTmr, void (*fnExpired)(void *pUsr), void *const pUsr)
+{
+	pTmr->pNext = pTmr->pPrev = NULL;
+	pTmr->tickExpire = 0;
+	pTmr->fnExpired = fnExpired;
+	pTmr->pUsr = pUsr;
+	pTmr->bPending = 0;
+}
+
+
+rsRetVal
+timerSchedule(rstimer_t *const pTmr, const long iMs)
+{
+	uint64_t nTicks;
+	DEFiRet;
+
+	pthread_mutex_lock(&mutWheel);
+	if(!bStarted)
+		timerwheelStart();
+	if(!bRunning)
+		ABORT_FINALIZE(RS_RET_ERR);
+	if(pTmr->bPending)
+		timerUnlink(pTmr);
+	nTicks = (iMs <= 0) ? 1 : (iMs + TMRWHEEL_TICK_MS - 1) / TMRWHEEL_TICK_MS;
+	pTmr->tickExpire = currTick() + nTicks;
+	timerLink(pTmr);
+	/* the thread may sleep longer than until our expiry */
+	pthread_cond_signal(&condWheel);
+
+finalize_it:
+	pthread_mutex_unlock(&mutWheel);
+	RETiRet;
+}
+
+
+void
+timerCancel(rstimer_t *const pTmr)
+{
+	pthread_mutex_lock(&mutWheel);
+	if(pTmr->bPending)
+		timerUnlink(pTmr);
+	while(pRunning == pTmr)
+		pthread_cond_wait(&condDone, &mutWheel);
+	pthread_mutex_unlock(&mutWheel);
+}
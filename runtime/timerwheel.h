@@ -0,0 +1,52 @@
+/* Definitions for the global timer wheel.
+ *
+ * Subsystems that need to do something at a later time, but do not want to
+ * check a timestamp on each call into them, embed an rstimer_t and
+ * schedule it. A single thread runs the callbacks when timers expire.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_TIMERWHEEL_H
+#define INCLUDED_TIMERWHEEL_H
+
+/* a timer. All members are owned by the wheel, initialize it with
+ * timerInit() before first use.
+ */
+typedef struct rstimer_s rstimer_t;
+struct rstimer_s {
+	rstimer_t *pNext;	/* links in the wheel slot, if pending */
+	rstimer_t *pPrev;
+	uint64_t tickExpire;	/* tick at which the timer fires */
+	void (*fnExpired)(void *pUsr);	/* called on the timer thread */
+	void *pUsr;
+	sbool bPending;
+};
+
+void timerInit(rstimer_t *pTmr, void (*fnExpired)(void *pUsr), void *pUsr);
+/* (re-)schedule pTmr to expire in iMs milliseconds. Fails only if the
+ * timer thread could not be started; callers must then check for expiry
+ * themselves.
+ */
+rsRetVal timerSchedule(rstimer_t *pTmr, long iMs);
+/* cancel pTmr if it is pending. When this returns, its callback is not
+ * running and will not be called, so pUsr may be destroyed.
+ */
+void timerCancel(rstimer_t *pTmr);
+
+#endif /* #ifndef INCLUDED_TIMERWHEEL_H */
@@ -98,9 +98,11 @@ typedef struct outchannels_s outchannels_t;
 typedef struct modConfData_s modConfData_t;
 typedef struct instanceConf_s instanceConf_t;
 typedef struct ratelimit_s ratelimit_t;
+typedef struct ratelimitKeyed_s ratelimitKeyed_t;
 typedef struct lookup_string_tab_etry_s lookup_string_tab_etry_t;
 typedef struct lookup_tables_s lookup_tables_t;
 typedef struct lookup_s lookup_t;
+typedef struct lookup_data_s lookup_data_t;
 typedef struct action_s action_t;
 typedef int rs_size_t; /* we do never need more than 2Gig strings, signed permits to
 			* use -1 as a special flag. */
@@ -110,6 +112,8 @@ typedef uint64 qDeqID;	/* queue Dequeue order ID. 32 bits is considered dangerou
 typedef struct tcpLstnPortList_s tcpLstnPortList_t; // TODO: rename?
 typedef struct strmLstnPortList_s strmLstnPortList_t; // TODO: rename?
 typedef struct actWrkrIParams actWrkrIParams_t;
+typedef struct actAsyncTx_s actAsyncTx_t;
+typedef struct srCpuSet_s srCpuSet_t;
 
 /* under Solaris (actually only SPARC), we need to redefine some types
  * to be void, so that we get void* pointers. Otherwise, we will see
@@ -154,7 +158,8 @@ typedef enum {
 	FIOP_STARTSWITH = 3,	/* starts with a string? */
 	FIOP_REGEX = 4,		/* matches a (BRE) regular expression? */
 	FIOP_EREREGEX = 5,	/* matches a ERE regular expression? */
-	FIOP_ISEMPTY = 6	/* string empty <=> strlen(s) == 0 ?*/
+	FIOP_ISEMPTY = 6,	/* string empty <=> strlen(s) == 0 ?*/
+	FIOP_PCREREGEX = 7	/* matches a PCRE regular expression? */
 } fiop_t;
 
 #ifndef HAVE_LSEEK64
@@ -263,6 +268,11 @@ struct msgPropDescr_s {
 	propid_t id;
 	uchar *name;		/* name and lenName are only set for dynamic */
 	int nameLen;		/* properties (JSON) */
+	/* the following are precomputed from name at config load, so
+	 * that JSON lookups do not need to parse it for each message */
+	unsigned hash;		/* hash of name, for compact $! variables */
+	int nPath;		/* number of path elements, 0 for the root */
+	char **pPath;		/* path elements, last one is the leaf; NULL if not available */
 };
 
 #endif /* multi-include protection */
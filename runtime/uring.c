@@ -0,0 +1,304 @@
+/* uring.c - io_uring write backend for file streams
+ *
+ * Each thread that writes to streams gets its own small ring, created on
+ * first use, which it uses for all streams it writes to (e.g. all dynafiles
+ * of an action worker). A write is submitted as an IORING_OP_WRITE at the
+ * current file position, so that it behaves exactly like write() (including
+ * O_APPEND). If the stream is to be synced, an fdatasync() of the file and
+ * an fsync() of the directory are linked to it. The whole chain is
+ * submitted and waited for with a single io_uring_enter() call.
+ *
+ * Per-thread rings need no locking and keep the strict ordering the stream
+ * layer requires (zipping, crypto and file rotation all work on the data
+ * before or after the physical write, which stays synchronous to the
+ * calling thread).
+ *
+ * We use the raw system calls, so that no additional library is needed.
+ * If the kernel does not provide io_uring (or it is disabled), the calling
+ * thread falls back to regular write() calls.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#ifdef HAVE_LINUX_IO_URING_H
+#	include <sys/mman.h>
+#	include <sys/syscall.h>
+#	include <linux/io_uring.h>
+#endif
+#include "rsyslog.h"
+#include "uring.h"
+
+int bUringEnabled = 0;
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+
+#define URING_ENTRIES 4	/* we never have more than 3 requests in flight */
+
+typedef struct uring_s {
+	int fd;
+	unsigned *sqTail;
+	unsigned *sqMask;
+	unsigned *sqArray;
+	unsigned *cqHead;
+	unsigned *cqTail;
+	unsigned *cqMask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *pSqRing;
+	size_t lenSqRing;
+	void *pCqRing;		/* same as pSqRing with IORING_FEAT_SINGLE_MMAP */
+	size_t lenCqRing;
+	size_t lenSqes;
+} uring_t;
+
+static pthread_key_t keyRing;
+static pthread_once_t onceRing = PTHREAD_ONCE_INIT;
+static uring_t ringUnavail;	/* marks threads where setup failed */
+
+static void
+uringDestruct(void *pArg)
+{
+	uring_t *const pRing = (uring_t*) pArg;
+
+	if(pRing == &ringUnavail)
+		return;
+	munmap(pRing->sqes, pRing->lenSqes);
+	if(pRing->pCqRing != pRing->pSqRing)
+		munmap(pRing->pCqRing, pRing->lenCqRing);
+	munmap(pRing->pSqRing, pRing->lenSqRing);
+	close(pRing->fd);
+	free(pRing);
+}
+
+static void
+uringKeyInit(void)
+{
+	pthread_key_create(&keyRing, uringDestruct);
+}
+
+
+/* set up a ring for the calling thread, returns NULL on failure */
+static uring_t *
+uringConstruct(void)
+{
+	struct io_uring_params p;
+	uring_t *pRing;
+	uchar *pSq, *pCq;
+
+	if((pRing = calloc(1, sizeof(uring_t))) == NULL)
+		return NULL;
+	memset(&p, 0, sizeof(p));
+	pRing->fd = (int) syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if(pRing->fd < 0) {
+		DBGPRINTF("io_uring_setup failed with errno %d, using write()\n", errno);
+		free(pRing);
+		return NULL;
+	}
+
+	pRing->lenSqRing = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	pRing->lenCqRing = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP) {
+		if(pRing->lenCqRing > pRing->lenSqRing)
+			pRing->lenSqRing = pRing->lenCqRing;
+		pRing->lenCqRing = pRing->lenSqRing;
+	}
+	pSq = mmap(NULL, pRing->lenSqRing, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		   pRing->fd, IORING_OFF_SQ_RING);
+	if(pSq == MAP_FAILED)
+		goto fail_close;
+	if(p.features & IORING_FEAT_SINGLE_MMAP) {
+		pCq = pSq;
+	} else {
+		pCq = mmap(NULL, pRing->lenCqRing, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			   pRing->fd, IORING_OFF_CQ_RING);
+		if(pCq == MAP_FAILED)
+			goto fail_sq;
+	}
+	pRing->lenSqes = p.sq_entries * sizeof(struct io_uring_sqe);
+	pRing->sqes = mmap(NULL, pRing->lenSqes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			   pRing->fd, IORING_OFF_SQES);
+	if(pRing->sqes == MAP_FAILED)
+		goto fail_cq;
+
+	pRing->pSqRing = pSq;
+	pRing->pCqRing = pCq;
+	pRing->sqTail = (unsigned*) (pSq + p.sq_off.tail);
+	pRing->sqMask = (unsigned*) (pSq + p.sq_off.ring_mask);
+	pRing->sqArray = (unsigned*) (pSq + p.sq_off.array);
+	pRing->cqHead = (unsigned*) (pCq + p.cq_off.head);
+	pRing->cqTail = (unsigned*) (pCq + p.cq_off.tail);
+	pRing->cqMask = (unsigned*) (pCq + p.cq_off.ring_mask);
+	pRing->cqes = (struct io_uring_cqe*) (pCq + p.cq_off.cqes);
+	DBGPRINTF("io_uring set up for thread, fd %d\n", pRing->fd);
+	return pRing;
+
+fail_cq:
+	if(pCq != pSq)
+		munmap(pCq, pRing->lenCqRing);
+fail_sq:
+	munmap(pSq, pRing->lenSqRing);
+fail_close:
+	DBGPRINTF("io_uring mmap failed with errno %d, using write()\n", errno);
+	close(pRing->fd);
+	free(pRing);
+	return NULL;
+}
+
+
+/* get the calling thread's ring, NULL if none is available */
+static inline uring_t *
+uringGet(void)
+{
+	uring_t *pRing;
+
+	pthread_once(&onceRing, uringKeyInit);
+	pRing = pthread_getspecific(keyRing);
+	if(pRing == NULL) {
+		pRing = uringConstruct();
+		pthread_setspecific(keyRing, (pRing == NULL) ? &ringUnavail : pRing);
+	}
+	return (pRing == &ringUnavail) ? NULL : pRing;
+}
+
+
+/* add a request to the submission queue, the caller fills it in */
+static inline struct io_uring_sqe *
+uringPrepSqe(uring_t *const pRing, const unsigned i)
+{
+	const unsigned tail = *pRing->sqTail + i;
+	const unsigned idx = tail & *pRing->sqMask;
+	struct io_uring_sqe *const sqe = &pRing->sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	pRing->sqArray[idx] = idx;
+	sqe->user_data = i;
+	return sqe;
+}
+
+
+rsRetVal
+uringWrite(int fd, const uchar *pBuf, size_t lenBuf, int bSync, int fdDir,
+	   size_t *pWritten, int *pbSynced)
+{
+	uring_t *pRing;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	int res[3];
+	unsigned nReq;
+	unsigned head;
+	unsigned i;
+	int r;
+	DEFiRet;
+
+	*pWritten = 0;
+	*pbSynced = 0;
+	if((pRing = uringGet()) == NULL)
+		ABORT_FINALIZE(RS_RET_NOT_IMPLEMENTED);
+
+	while(lenBuf > 0) {
+		sqe = uringPrepSqe(pRing, 0);
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->fd = fd;
+		sqe->addr = (unsigned long) pBuf;
+		sqe->len = (lenBuf > 0x7ffff000) ? 0x7ffff000 : lenBuf;
+		sqe->off = (__u64) -1; /* current file position, like write() */
+		nReq = 1;
+		if(bSync) {
+			sqe->flags |= IOSQE_IO_LINK;
+			sqe = uringPrepSqe(pRing, nReq++);
+			sqe->opcode = IORING_OP_FSYNC;
+			sqe->fd = fd;
+			sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+			if(fdDir != -1) {
+				sqe->flags |= IOSQE_IO_LINK;
+				sqe = uringPrepSqe(pRing, nReq++);
+				sqe->opcode = IORING_OP_FSYNC;
+				sqe->fd = fdDir;
+			}
+		}
+		__atomic_store_n(pRing->sqTail, *pRing->sqTail + nReq, __ATOMIC_RELEASE);
+
+		do {
+			r = (int) syscall(__NR_io_uring_enter, pRing->fd, nReq, nReq,
+					  IORING_ENTER_GETEVENTS, NULL, 0);
+		} while(r < 0 && errno == EINTR);
+		if(r < 0) {
+			/* the ring is unusable, let this thread fall back to write() */
+			DBGPRINTF("io_uring_enter failed with errno %d, using write()\n", errno);
+			uringDestruct(pRing);
+			pthread_setspecific(keyRing, &ringUnavail);
+			ABORT_FINALIZE(RS_RET_NOT_IMPLEMENTED);
+		}
+
+		/* each request completes, cancelled ones with -ECANCELED */
+		res[1] = res[2] = -ECANCELED;
+		for(i = 0 ; i < nReq ; ++i) {
+			head = *pRing->cqHead;
+			while(head == __atomic_load_n(pRing->cqTail, __ATOMIC_ACQUIRE)) {
+				/* not all completions posted yet, wait for them */
+				syscall(__NR_io_uring_enter, pRing->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+			}
+			cqe = &pRing->cqes[head & *pRing->cqMask];
+			res[cqe->user_data] = cqe->res;
+			__atomic_store_n(pRing->cqHead, head + 1, __ATOMIC_RELEASE);
+		}
+
+		if(res[0] < 0) {
+			if(res[0] == -EINTR || res[0] == -EAGAIN)
+				continue;
+			errno = -res[0];
+			ABORT_FINALIZE(RS_RET_IO_ERROR);
+		} else if(res[0] == 0) {
+			errno = EIO; /* no progress, do not loop forever */
+			ABORT_FINALIZE(RS_RET_IO_ERROR);
+		}
+		*pWritten += res[0];
+		pBuf += res[0];
+		lenBuf -= res[0];
+		if(bSync && lenBuf == 0) {
+			/* like syncFile(), we do not fail because of a failed sync */
+			if(res[1] < 0 && res[1] != -ECANCELED)
+				DBGPRINTF("io_uring fdatasync failed for file %d with error %d - ignoring\n",
+					  fd, -res[1]);
+			*pbSynced = (res[1] != -ECANCELED);
+		}
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+#else /* no io_uring */
+
+rsRetVal
+uringWrite(int __attribute__((unused)) fd, const uchar __attribute__((unused)) *pBuf,
+	   size_t __attribute__((unused)) lenBuf, int __attribute__((unused)) bSync,
+	   int __attribute__((unused)) fdDir, size_t *pWritten, int *pbSynced)
+{
+	*pWritten = 0;
+	*pbSynced = 0;
+	return RS_RET_NOT_IMPLEMENTED;
+}
+
+#endif
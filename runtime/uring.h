@@ -0,0 +1,44 @@
+/* Definitions for the io_uring write backend.
+ *
+ * If enabled via global(io.uring="on"), file streams submit their writes
+ * (and, if they are to be synced, the fdatasync of the file and the fsync
+ * of its directory) as one chain of linked io_uring requests. This needs
+ * a single system call instead of up to three per write.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_URING_H
+#define INCLUDED_URING_H
+
+#include <sys/types.h>
+
+extern int bUringEnabled;	/* global(io.uring) */
+
+/* write lenBuf bytes from pBuf to fd at its current file position. If
+ * bSync is set, the file data is synced afterwards and, if fdDir is not
+ * -1, the directory, too. On return, *pWritten contains the number of
+ * bytes written and *pbSynced tells if the sync was done.
+ * Returns RS_RET_NOT_IMPLEMENTED if io_uring is not available to the
+ * calling thread; the caller must then use write(). Write errors are
+ * returned as RS_RET_IO_ERROR with errno set.
+ */
+rsRetVal uringWrite(int fd, const uchar *pBuf, size_t lenBuf, int bSync, int fdDir,
+		    size_t *pWritten, int *pbSynced);
+
+#endif /* #ifndef INCLUDED_URING_H */
@@ -0,0 +1,489 @@
+/* wrkpool.c - the shared queue worker pool
+ *
+ * With many action queues, each running its own worker threads, most of
+ * these threads are idle most of the time. Queues configured with
+ * queue.sharedWorkers="on" instead use the threads of this pool, which is
+ * sized to the number of CPUs by default.
+ *
+ * The worker thread pool (wtp) of such a queue has no threads of its own.
+ * When the queue advises workers, its wtp is put on a FIFO run list. An
+ * idle pool thread takes the first wtp from the list and processes batches
+ * for it, exactly like a dedicated worker would (via pfDoWork), deleting
+ * each batch from the queue when it is done. After a time slice
+ * (global(sharedWorkers.timeSlice)), the wtp is appended to the end of the
+ * list again if there may be more work, so that busy queues take turns
+ * with all others. A wtp stays on the list while fewer pool threads than
+ * desired work on it, so a queue may be served by several threads in
+ * parallel, but never by more than queue.workerThreads.
+ *
+ * A pool thread must not wait for a suspended action to resume, as this
+ * would stall all other queues. Instead, actionDoRetry() sets the wti's
+ * iSharedSuspendMs, the unprocessed part of the batch is put back into the
+ * queue and the wtp is moved to the delay list. It goes back to the run
+ * list when the retry interval is over.
+ *
+ * A pool thread that finds the queue idle releases the user mutex before
+ * it takes the pool mutex to drop the wtp. A message enqueued in between
+ * is advised while the thread still counts as active, so wrkpoolAdvise()
+ * sets bSharedPending instead of putting the wtp on the run list, and the
+ * thread then keeps the wtp instead of dropping it.
+ *
+ * The iCurNumWrkThrd counter of a shared wtp is the number of pool threads
+ * working on it plus one if it is on the run or delay list. This keeps the regular
+ * shutdown code (wtpShutdownAll) working unchanged. Pool threads are never
+ * cancelled, as they serve other queues as well. Instead, cancellation
+ * waits for the batch in progress, which ends quickly as the queue is in
+ * immediate shutdown at that point.
+ *
+ * Each pool thread has its own wti, so actions create worker instances for
+ * it as for any queue worker. When a shared wtp is destructed, the pool
+ * threads release all their worker instances, because the actions may be
+ * destructed next (they are created again on demand).
+ *
+ * The pool threads are started on first use, as this happens only after
+ * rsyslogd has forked into the background. They are joined by
+ * wrkpoolExit() when rsyslogd terminates.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#if HAVE_SYS_PRCTL_H
+#  include <sys/prctl.h>
+#endif
+#include "rsyslog.h"
+#include "atomic.h"
+#include "batch.h"
+#include "srUtils.h"
+#include "wtp.h"
+#include "wti.h"
+#include "wrkpool.h"
+
+int iWrkpoolThreads = 0;
+int iWrkpoolTimeSlice = 10;
+
+typedef struct wrkpoolThrd_s {
+	pthread_t tid;
+	wti_t *pWti;
+	unsigned flushGen;	/* last flush request done by this thread */
+} wrkpoolThrd_t;
+
+static pthread_mutex_t mutPool = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t condWork = PTHREAD_COND_INITIALIZER;	/* wtp runnable or flush requested */
+static pthread_cond_t condDone = PTHREAD_COND_INITIALIZER;	/* batch or flush done */
+static wtp_t *pRunRoot = NULL;
+static wtp_t *pRunLast = NULL;
+static wtp_t *pDelayRoot = NULL;	/* wtps waiting for an action's retry interval (unordered) */
+static wrkpoolThrd_t *thrds = NULL;
+static int nWorkers = 0;	/* number of threads running */
+static sbool bStarted = 0;	/* start attempted? */
+static sbool bShutdown = 0;	/* set by wrkpoolExit() */
+static unsigned flushGen = 0;	/* current flush request */
+
+
+/* bSharedQueued and nSharedWant are read by wrkpoolAdvise() without the
+ * pool mutex, so they are written atomically (but still with mutPool
+ * locked, so there is no concurrent writer).
+ */
+static inline void
+wrkpoolSetQueued(wtp_t *const pWtp, const int bQueued)
+{
+	if(bQueued) {
+		ATOMIC_STORE_1_TO_INT(&pWtp->bSharedQueued, &pWtp->mutCurNumWrkThrd);
+	} else {
+		ATOMIC_STORE_0_TO_INT(&pWtp->bSharedQueued, &pWtp->mutCurNumWrkThrd);
+	}
+}
+
+static inline void
+wrkpoolSetWant(wtp_t *const pWtp, const int nWant)
+{
+	(void) ATOMIC_CAS(&pWtp->nSharedWant, pWtp->nSharedWant, nWant, &pWtp->mutCurNumWrkThrd);
+}
+
+
+/* update the wtp's worker count and notify wtpShutdownAll() if it drops
+ * to zero. Called with mutPool locked.
+ */
+static void
+wrkpoolUpdCount(wtp_t *const pWtp)
+{
+	const int n = pWtp->nSharedActive + pWtp->bSharedQueued;
+
+	pthread_mutex_lock(&pWtp->mutWtp);
+	pWtp->iCurNumWrkThrd = n;
+	if(n == 0)
+		pthread_cond_broadcast(&pWtp->condThrdTrm);
+	pthread_mutex_unlock(&pWtp->mutWtp);
+}
+
+
+/* append pWtp to the run list, called with mutPool locked */
+static void
+wrkpoolEnqueue(wtp_t *const pWtp)
+{
+	pWtp->pSharedNext = NULL;
+	if(pRunLast == NULL)
+		pRunRoot = pWtp;
+	else
+		pRunLast->pSharedNext = pWtp;
+	pRunLast = pWtp;
+	pWtp->bSharedPending = 0;
+	wrkpoolSetQueued(pWtp, 1);
+	pthread_cond_signal(&condWork);
+}
+
+
+/* put pWtp on the delay list until iDelayMs have passed. It counts as
+ * queued meanwhile, so wrkpoolAdvise() does not put it on the run list.
+ * Called with mutPool locked.
+ */
+static void
+wrkpoolDelay(wtp_t *const pWtp, const int iDelayMs)
+{
+	pWtp->tSharedDue = getMonotonicUsecs() + (uint64_t) iDelayMs * 1000;
+	pWtp->pSharedNext = pDelayRoot;
+	pDelayRoot = pWtp;
+	wrkpoolSetQueued(pWtp, 1);
+}
+
+
+/* move the wtps whose delay is over to the run list. Returns the number
+ * of microseconds until the next one is due, 0 if none is delayed. Called
+ * with mutPool locked.
+ */
+static uint64_t
+wrkpoolWakeDelayed(void)
+{
+	wtp_t **ppWtp;
+	wtp_t *pWtp;
+	uint64_t tNow;
+	uint64_t tNext = 0;
+
+	if(pDelayRoot == NULL)
+		return 0;
+	tNow = getMonotonicUsecs();
+	for(ppWtp = &pDelayRoot ; *ppWtp != NULL ; ) {
+		pWtp = *ppWtp;
+		if(pWtp->tSharedDue <= tNow || bShutdown) {
+			*ppWtp = pWtp->pSharedNext;
+			pWtp->tSharedDue = 0;
+			wrkpoolEnqueue(pWtp);
+		} else {
+			if(tNext == 0 || pWtp->tSharedDue - tNow < tNext)
+				tNext = pWtp->tSharedDue - tNow;
+			ppWtp = &pWtp->pSharedNext;
+		}
+	}
+	return tNext;
+}
+
+
+/* remove pWtp from the run or delay list (if it is on one), called with
+ * mutPool locked
+ */
+static void
+wrkpoolUnlink(wtp_t *const pWtp)
+{
+	wtp_t **ppWtp;
+
+	if(!pWtp->bSharedQueued)
+		return;
+	if(pWtp->tSharedDue != 0) {
+		for(ppWtp = &pDelayRoot ; *ppWtp != pWtp ; ppWtp = &(*ppWtp)->pSharedNext)
+			/* just search */;
+		*ppWtp = pWtp->pSharedNext;
+		pWtp->tSharedDue = 0;
+	} else {
+		for(ppWtp = &pRunRoot, pRunLast = NULL ; *ppWtp != NULL ; ) {
+			if(*ppWtp == pWtp) {
+				*ppWtp = pWtp->pSharedNext;
+			} else {
+				pRunLast = *ppWtp;
+				ppWtp = &(*ppWtp)->pSharedNext;
+			}
+		}
+	}
+	wrkpoolSetQueued(pWtp, 0);
+}
+
+
+/* process one batch for pWtp. Returns 1 if there may be more work. If an
+ * action of the queue is suspended, pWti->iSharedSuspendMs is set on return.
+ */
+static int
+wrkpoolRunBatch(wti_t *const pWti, wtp_t *const pWtp)
+{
+	batch_t batch;
+	int iDeqBatchSize;
+	rsRetVal localRet;
+	int bMore = 0;
+
+	/* the batch must be large enough for every queue we serve */
+	if(   pWtp->pfGetDeqBatchSize(pWtp->pUsr, &iDeqBatchSize) != RS_RET_OK
+	   || iDeqBatchSize < 1)
+		iDeqBatchSize = 1;
+	if(iDeqBatchSize > pWti->batch.maxElem) {
+		batch.pElem = NULL;
+		batch.eltState = NULL;
+		batch.memMode = SR_HUGE_NONE;
+		if(batchInit(&batch, iDeqBatchSize) != RS_RET_OK) {
+			batchFree(&batch);
+			return 0;
+		}
+		batchFree(&pWti->batch);
+		pWti->batch = batch;
+	}
+
+	pWti->iSharedSuspendMs = 0;
+	d_pthread_mutex_lock(pWtp->pmutUsr);
+	if(pWtp->pfRateLimiter != NULL)
+		pWtp->pfRateLimiter(pWtp->pUsr);
+	if(wtpChkStopWrkr(pWtp, MUTEX_ALREADY_LOCKED) != RS_RET_TERMINATE_NOW) {
+		localRet = pWtp->pfDoWork(pWtp->pUsr, pWti);
+		/* the batch belongs to this queue, so we must delete it now */
+		pWtp->pfObjProcessed(pWtp->pUsr, pWti);
+		bMore = (localRet != RS_RET_IDLE && localRet != RS_RET_ERR_QUEUE_EMERGENCY);
+	}
+	d_pthread_mutex_unlock(pWtp->pmutUsr);
+
+	return bMore;
+}
+
+
+static void *
+wrkpoolWorker(void *arg)
+{
+	wrkpoolThrd_t *const pThrd = (wrkpoolThrd_t*) arg;
+	wti_t *const pWti = pThrd->pWti;
+	wtp_t *pWtp;
+	sigset_t sigSet;
+	struct timespec t;
+	uint64_t tEnd;
+	uint64_t tNext;
+	int bMore;
+#	if HAVE_PRCTL && defined PR_SET_NAME
+	char thrdName[32];
+#	endif
+
+	sigfillset(&sigSet);
+	pthread_sigmask(SIG_BLOCK, &sigSet, NULL);
+#	if HAVE_PRCTL && defined PR_SET_NAME
+	snprintf(thrdName, sizeof(thrdName), "rs:shared/%d", (int) (pThrd - thrds));
+	if(prctl(PR_SET_NAME, thrdName, 0, 0, 0) != 0) {
+		DBGPRINTF("prctl failed, not setting thread name for '%s'\n", thrdName);
+	}
+#	endif
+	dbgSetThrdName(pWti->pszDbgHdr);
+
+	pthread_mutex_lock(&mutPool);
+	while(!bShutdown) {
+		if(pThrd->flushGen != flushGen) {
+			pthread_mutex_unlock(&mutPool);
+			wtiFreeActWrkrInstances(pWti);
+			pthread_mutex_lock(&mutPool);
+			pThrd->flushGen = flushGen;
+			pthread_cond_broadcast(&condDone);
+			continue;
+		}
+		tNext = wrkpoolWakeDelayed();
+		if(pRunRoot == NULL) {
+			if(tNext == 0) {
+				pthread_cond_wait(&condWork, &mutPool);
+			} else {
+				timeoutComp(&t, (long) (tNext / 1000) + 1);
+				pthread_cond_timedwait(&condWork, &mutPool, &t);
+			}
+			continue;
+		}
+		pWtp = pRunRoot;
+		if((pRunRoot = pWtp->pSharedNext) == NULL)
+			pRunLast = NULL;
+		wrkpoolSetQueued(pWtp, 0);
+		++pWtp->nSharedActive;
+		/* let another thread join in if the queue asks for it */
+		if(pWtp->nSharedActive < pWtp->nSharedWant)
+			wrkpoolEnqueue(pWtp);
+		pthread_mutex_unlock(&mutPool);
+
+		tEnd = getMonotonicUsecs() + (uint64_t) iWrkpoolTimeSlice * 1000;
+		do {
+			bMore = wrkpoolRunBatch(pWti, pWtp);
+		} while(   bMore && pWti->iSharedSuspendMs == 0
+			&& !bShutdown && getMonotonicUsecs() < tEnd);
+
+		pthread_mutex_lock(&mutPool);
+		--pWtp->nSharedActive;
+		if(pWti->iSharedSuspendMs != 0) {
+			/* no thread should work on the queue until the retry
+			 * interval is over, but others may still be busy with it
+			 */
+			wrkpoolUnlink(pWtp);
+			wrkpoolDelay(pWtp, pWti->iSharedSuspendMs);
+		} else if(!bMore && !pWtp->bSharedPending) {
+			wrkpoolSetWant(pWtp, 0);
+		} else {
+			/* more work, or new messages since our last batch */
+			pWtp->bSharedPending = 0;
+			if(!pWtp->bSharedQueued)
+				wrkpoolEnqueue(pWtp);
+		}
+		/* pWtp may be destructed as soon as the count is updated */
+		wrkpoolUpdCount(pWtp);
+		pthread_cond_broadcast(&condDone);
+	}
+	pthread_mutex_unlock(&mutPool);
+	return NULL;
+}
+
+
+/* start the pool threads, called with mutPool locked. If some cannot be
+ * started, we use those we have.
+ */
+static void
+wrkpoolStart(void)
+{
+	uchar pszBuf[32];
+	size_t lenBuf;
+	int n;
+	int i;
+
+	bStarted = 1;
+	n = iWrkpoolThreads;
+	if(n == 0)
+		n = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if(n < 1)
+		n = 1;
+	if((thrds = calloc(n, sizeof(wrkpoolThrd_t))) == NULL)
+		goto done;
+	for(i = 0 ; i < n ; ++i) {
+		if(wtiConstruct(&thrds[i].pWti) != RS_RET_OK)
+			break;
+		lenBuf = snprintf((char*)pszBuf, sizeof(pszBuf), "shared/w%d", i);
+		thrds[i].pWti->bSharedWrkr = 1;
+		thrds[i].flushGen = flushGen;
+		if(   wtiSetDbgHdr(thrds[i].pWti, pszBuf, lenBuf) != RS_RET_OK
+		   || wtiConstructFinalize(thrds[i].pWti) != RS_RET_OK
+		   || pthread_create(&thrds[i].tid, NULL, wrkpoolWorker, &thrds[i]) != 0) {
+			wtiDestruct(&thrds[i].pWti);
+			break;
+		}
+		++nWorkers;
+	}
+done:
+	DBGPRINTF("wrkpool: %d of %d shared worker threads started\n", nWorkers, n);
+}
+
+
+void
+wrkpoolAdvise(wtp_t *const pWtp, int nMaxWrkr)
+{
+	if(nMaxWrkr > pWtp->iNumWorkerThreads)
+		nMaxWrkr = pWtp->iNumWorkerThreads;
+	if(nMaxWrkr < 1)
+		return;
+	/* this is called for each enqueue, so avoid the pool mutex if
+	 * there is nothing to change. If the wtp is on the run list, the
+	 * thread that takes it will pick up the new messages, as it needs
+	 * the user mutex, which our caller holds.
+	 */
+	if(   ATOMIC_FETCH_32BIT(&pWtp->bSharedQueued, &pWtp->mutCurNumWrkThrd)
+	   && nMaxWrkr <= (int) ATOMIC_FETCH_32BIT(&pWtp->nSharedWant, &pWtp->mutCurNumWrkThrd))
+		return;
+
+	pthread_mutex_lock(&mutPool);
+	if(!bStarted)
+		wrkpoolStart();
+	if(nMaxWrkr > pWtp->nSharedWant)
+		wrkpoolSetWant(pWtp, nMaxWrkr);
+	if(!pWtp->bSharedQueued) {
+		if(pWtp->nSharedActive < pWtp->nSharedWant) {
+			wrkpoolEnqueue(pWtp);
+			wrkpoolUpdCount(pWtp);
+		} else {
+			/* an active thread may already have found the queue
+			 * idle, it must not drop the wtp now
+			 */
+			pWtp->bSharedPending = 1;
+		}
+	}
+	pthread_mutex_unlock(&mutPool);
+}
+
+
+void
+wrkpoolCancel(wtp_t *const pWtp)
+{
+	pthread_mutex_lock(&mutPool);
+	wrkpoolUnlink(pWtp);
+	while(pWtp->nSharedActive > 0)
+		pthread_cond_wait(&condDone, &mutPool);
+	wrkpoolSetWant(pWtp, 0);
+	pWtp->bSharedPending = 0;
+	wrkpoolUpdCount(pWtp);
+	pthread_mutex_unlock(&mutPool);
+}
+
+
+void
+wrkpoolRelease(wtp_t *const pWtp)
+{
+	int i;
+
+	pthread_mutex_lock(&mutPool);
+	wrkpoolUnlink(pWtp);
+	while(pWtp->nSharedActive > 0)
+		pthread_cond_wait(&condDone, &mutPool);
+	if(nWorkers > 0) {
+		++flushGen;
+		pthread_cond_broadcast(&condWork);
+		for(i = 0 ; i < nWorkers ; ) {
+			if(thrds[i].flushGen == flushGen)
+				++i;
+			else
+				pthread_cond_wait(&condDone, &mutPool);
+		}
+	}
+	pthread_mutex_unlock(&mutPool);
+}
+
+
+void
+wrkpoolExit(void)
+{
+	int i;
+
+	pthread_mutex_lock(&mutPool);
+	bShutdown = 1;
+	pthread_cond_broadcast(&condWork);
+	pthread_mutex_unlock(&mutPool);
+
+	for(i = 0 ; i < nWorkers ; ++i) {
+		pthread_join(thrds[i].tid, NULL);
+		wtiFreeActWrkrInstances(thrds[i].pWti);
+		wtiDestruct(&thrds[i].pWti);
+	}
+	nWorkers = 0;
+	free(thrds);
+	thrds = NULL;
+}
@@ -0,0 +1,47 @@
+/* Definitions for the shared queue worker pool.
+ *
+ * Queues with queue.sharedWorkers="on" do not run worker threads of their
+ * own. Instead, their worker thread pool (wtp) is scheduled on a global
+ * pool of threads, which serve all these queues one batch at a time.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_WRKPOOL_H
+#define INCLUDED_WRKPOOL_H
+
+extern int iWrkpoolThreads;	/* global(sharedWorkers.threads), 0 - one per CPU */
+extern int iWrkpoolTimeSlice;	/* global(sharedWorkers.timeSlice), ms */
+
+/* ask for up to nMaxWrkr pool threads (at most the wtp's iNumWorkerThreads)
+ * to work on pWtp. Must be called with the wtp's user mutex locked.
+ */
+void wrkpoolAdvise(wtp_t *pWtp, int nMaxWrkr);
+/* take pWtp off the run list and wait until no pool thread works on it */
+void wrkpoolCancel(wtp_t *pWtp);
+/* called when a shared wtp is destructed: makes sure no pool thread
+ * references it any longer and that the pool threads release their
+ * action worker instances, as the actions may be destructed next.
+ */
+void wrkpoolRelease(wtp_t *pWtp);
+/* stop and join the pool threads, called when rsyslogd terminates, after
+ * all queues have been destructed
+ */
+void wrkpoolExit(void);
+
+#endif /* #ifndef INCLUDED_WRKPOOL_H */
@@ -36,6 +36,8 @@
 #include <signal.h>
 #include <pthread.h>
 #include <errno.h>
+#include <limits.h>
+#include <sched.h>
 
 #include "rsyslog.h"
 #include "stringbuf.h"
@@ -171,9 +173,23 @@ wtiCancelThrd(wti_t *pThis)
 
 /* Destructor */
 BEGINobjDestruct(wti) /* be sure to specify the object type also in END and CODESTART macros! */
+	int i;
 CODESTARTobjDestruct(wti)
 	/* actual destruction */
 	batchFree(&pThis->batch);
+	for(i = 0 ; i < WTI_TPLCACHE_SIZE ; ++i)
+		free(pThis->tplCache.ent[i].str.param);
+	free(pThis->tplScratch.param);
+	if(pThis->pAsync != NULL) {
+		for(i = 0 ; i < pThis->pAsync->nSlots ; ++i) {
+			batchFree(&pThis->pAsync->slots[i].batch);
+			free(pThis->pAsync->slots[i].iparams);
+			wtiArenaFree(&pThis->pAsync->slots[i].arena);
+		}
+		pthread_mutex_destroy(&pThis->pAsync->mut);
+		pthread_cond_destroy(&pThis->pAsync->condDone);
+		free(pThis->pAsync);
+	}
 	free(pThis->actWrkrInfo);
 	pthread_cond_destroy(&pThis->pcondBusy);
 	DESTROY_ATOMIC_HELPER_MUT(pThis->mutIsRunning);
@@ -216,13 +232,47 @@ wtiConstructFinalize(wti_t *pThis)
 
 	/* we now alloc the array for user pointers. We obtain the max from the queue itself. */
 	CHKiRet(pThis->pWtp->pfGetDeqBatchSize(pThis->pWtp->pUsr, &iDeqBatchSize));
-	CHKiRet(batchInit(&pThis->batch, iDeqBatchSize));
+	if(pThis->pWtp->bHugePages) {
+		CHKiRet(batchInitHuge(&pThis->batch, iDeqBatchSize));
+		DBGPRINTF("%s: batch of %d elements, memory mode %d\n", wtiGetDbgHdr(pThis),
+			  iDeqBatchSize, pThis->batch.memMode);
+	} else {
+		CHKiRet(batchInit(&pThis->batch, iDeqBatchSize));
+	}
 
 finalize_it:
 	RETiRet;
 }
 
 
+/* re-allocate the (empty) batch from the calling worker thread. The batch
+ * is allocated by the main thread during construction. If the worker is bound
+ * to specific CPUs, allocating (and thus first touching) it again from the
+ * worker places it in memory local to these CPUs. If the allocation fails,
+ * we simply keep the old batch.
+ */
+void
+wtiLocalizeBatch(wti_t * const pThis)
+{
+	batch_t batch;
+
+	if(pThis->batch.nElem != 0)
+		return;
+	batch.pElem = NULL;
+	batch.eltState = NULL;
+	batch.memMode = SR_HUGE_NONE;
+	if(((pThis->batch.memMode == SR_HUGE_NONE) ? batchInit(&batch, pThis->batch.maxElem)
+	     : batchInitHuge(&batch, pThis->batch.maxElem)) != RS_RET_OK) {
+		batchFree(&batch);
+		return;
+	}
+	batchFree(&pThis->batch);
+	pThis->batch.pElem = batch.pElem;
+	pThis->batch.eltState = batch.eltState;
+	pThis->batch.memMode = batch.memMode;
+}
+
+
 /* cancellation cleanup handler for queueWorker ()
  * Most importantly, it must bring back the batch into a consistent state.
  * Keep in mind that cancellation is disabled if we run into
@@ -248,6 +298,76 @@ wtiWorkerCancelCleanup(void *arg)
 }
 
 
+#ifdef HAVE_ATOMIC_BUILTINS
+/* Spin phase of idle processing, enabled by queue.spinWait. If messages
+ * arrive in bursts with short pauses, blocking on the condition variable
+ * costs a futex wakeup for each burst, both for the producer and for us.
+ * So we first wait for the work generation of the pool to change, with
+ * exponential backoff from a few pause instructions up to yielding the
+ * CPU. Producers do not signal a spinning worker (see
+ * wtpAdviseMaxWorkers()). How long we spin depends on the idle periods
+ * seen recently: twice their average, but at most iSpinMax usecs. If the
+ * pauses are longer than that, we do not spin at all. Both the flag and
+ * the final check of the generation are done with the mutex locked, so no
+ * wakeup can be missed. Returns 1 if there is new work.
+ */
+#define SPIN_BACKOFF_MAX 1024	/* pause instructions before we start to yield */
+static int
+idleSpin(wti_t *pThis, wtp_t *pWtp, uint64_t tBegin)
+{
+	uint64_t tSpin;
+	unsigned gen;
+	unsigned nBackoff;
+	unsigned i;
+
+	tSpin = 2 * (uint64_t) pThis->iIdleAvg;
+	if(tSpin > (uint64_t) pWtp->iSpinMax)
+		return 0;
+	if(tSpin < 10)
+		tSpin = 10;	/* we have no (good) estimate yet */
+	gen = ATOMIC_FETCH_32BIT(&pWtp->iWorkGen, NULL);
+	ATOMIC_STORE_1_TO_INT(&pThis->bSpinning, NULL);
+	d_pthread_mutex_unlock(pWtp->pmutUsr);
+	nBackoff = 1;
+	while(ATOMIC_FETCH_32BIT(&pWtp->iWorkGen, NULL) == gen
+	      && getMonotonicUsecs() - tBegin < tSpin) {
+		if(nBackoff < SPIN_BACKOFF_MAX) {
+			for(i = 0 ; i < nBackoff ; ++i) {
+#				if defined(__i386__) || defined(__x86_64__)
+				__asm__ __volatile__("pause");
+#				else
+				__asm__ __volatile__("" ::: "memory");
+#				endif
+			}
+			nBackoff *= 2;
+		} else {
+			sched_yield();
+		}
+	}
+	d_pthread_mutex_lock(pWtp->pmutUsr);
+	ATOMIC_STORE_0_TO_INT(&pThis->bSpinning, NULL);
+	return ATOMIC_FETCH_32BIT(&pWtp->iWorkGen, NULL) != gen;
+}
+#else
+/* without atomics, producers cannot check if we spin, so we always block */
+static inline int
+idleSpin(wti_t __attribute__((unused)) *pThis, wtp_t __attribute__((unused)) *pWtp,
+	 uint64_t __attribute__((unused)) tBegin)
+{
+	return 0;
+}
+#endif
+
+/* update the average idle period of a worker, from 1/8 of the new value */
+static inline void
+wtiIdleAvgUpdate(wti_t *pThis, uint64_t tBegin)
+{
+	uint64_t tIdle = getMonotonicUsecs() - tBegin;
+	if(tIdle > UINT_MAX / 8)
+		tIdle = UINT_MAX / 8;
+	pThis->iIdleAvg = (pThis->iIdleAvg * 7 + (unsigned) tIdle) / 8;
+}
+
 /* wait for queue to become non-empty or timeout
  * helper to wtiWorker. Note the the predicate is
  * re-tested by the caller, so it is OK to NOT do it here.
@@ -257,11 +377,16 @@ static inline void
 doIdleProcessing(wti_t *pThis, wtp_t *pWtp, int *pbInactivityTOOccured)
 {
 	struct timespec t;
+	uint64_t tBegin = 0;
 
 	BEGINfunc
 	DBGPRINTF("%s: worker IDLE, waiting for work.\n", wtiGetDbgHdr(pThis));
 
-	if(pThis->bAlwaysRunning) {
+	if(pWtp->iSpinMax > 0)
+		tBegin = getMonotonicUsecs();
+	if(pWtp->iSpinMax > 0 && idleSpin(pThis, pWtp, tBegin)) {
+		DBGOPRINT((obj_t*) pThis, "worker found work while spinning\n");
+	} else if(pThis->bAlwaysRunning) {
 		/* never shut down any started worker */
 		d_pthread_cond_wait(&pThis->pcondBusy, pWtp->pmutUsr);
 	} else {
@@ -271,11 +396,283 @@ doIdleProcessing(wti_t *pThis, wtp_t *pWtp, int *pbInactivityTOOccured)
 			*pbInactivityTOOccured = 1; /* indicate we had a timeout */
 		}
 	}
+	if(pWtp->iSpinMax > 0)
+		wtiIdleAvgUpdate(pThis, tBegin);
 	DBGOPRINT((obj_t*) pThis, "worker awoke from idle processing\n");
 	ENDfunc
 }
 
 
+/* get len bytes from the arena, NULL if out of memory. The space stays
+ * valid until the arena is reset. A chunk that is too small is skipped for
+ * the rest of the transaction.
+ */
+uchar *
+wtiArenaAlloc(wtiArena_t *__restrict__ const pArena, const size_t len)
+{
+	wtiArenaChunk_t *c, *prev = NULL;
+	uchar *p;
+
+	if(len > WTI_ARENA_MAXSMALL) {
+		if((c = malloc(sizeof(wtiArenaChunk_t) + len)) == NULL)
+			return NULL;
+		c->size = c->used = len;
+		c->next = pArena->large;
+		pArena->large = c;
+		return (uchar*) (c + 1);
+	}
+
+	if((c = pArena->curr) == NULL && (c = pArena->root) != NULL)
+		c->used = 0; /* first use after reset */
+	while(c != NULL && c->size - c->used < len) {
+		prev = c;
+		if((c = c->next) != NULL)
+			c->used = 0;
+	}
+	if(c == NULL) {
+		if((c = malloc(sizeof(wtiArenaChunk_t) + WTI_ARENA_CHUNKSIZE)) == NULL)
+			return NULL;
+		c->next = NULL;
+		c->size = WTI_ARENA_CHUNKSIZE;
+		c->used = 0;
+		if(prev == NULL)
+			pArena->root = c;
+		else
+			prev->next = c;
+	}
+	pArena->curr = c;
+	p = (uchar*) (c + 1) + c->used;
+	c->used += len;
+	return p;
+}
+
+static void
+wtiArenaFreeList(wtiArenaChunk_t *c)
+{
+	wtiArenaChunk_t *del;
+
+	while(c != NULL) {
+		del = c;
+		c = c->next;
+		free(del);
+	}
+}
+
+void
+wtiArenaFreeLarge(wtiArena_t *__restrict__ const pArena)
+{
+	wtiArenaFreeList(pArena->large);
+	pArena->large = NULL;
+}
+
+void
+wtiArenaFree(wtiArena_t *__restrict__ const pArena)
+{
+	wtiArenaFreeList(pArena->root);
+	wtiArenaFreeLarge(pArena);
+	pArena->root = NULL;
+	pArena->curr = NULL;
+}
+
+
+/* the done() callback of asynchronous transactions, may be called by
+ * any thread.
+ */
+static void
+wtiAsyncDone(actAsyncTx_t *pTx, rsRetVal iRet)
+{
+	wtiAsyncSlot_t *const pSlot = (wtiAsyncSlot_t*) pTx;
+	wtiAsync_t *const pAsync = pSlot->pAsync;
+
+	pthread_mutex_lock(&pAsync->mut);
+	pSlot->result = iRet;
+	pSlot->bDone = 1;
+	pthread_cond_broadcast(&pAsync->condDone);
+	pthread_mutex_unlock(&pAsync->mut);
+}
+
+
+/* enable asynchronous transactions for this worker. The slots' batches
+ * are allocated on first use.
+ */
+rsRetVal
+wtiAsyncConstruct(wti_t * const pThis, int nSlots)
+{
+	wtiAsync_t *pAsync;
+	int i;
+	DEFiRet;
+
+	if(nSlots > WTI_ASYNC_MAXSLOTS)
+		nSlots = WTI_ASYNC_MAXSLOTS;
+	CHKmalloc(pAsync = calloc(1, sizeof(wtiAsync_t)));
+	pthread_mutex_init(&pAsync->mut, NULL);
+	pthread_cond_init(&pAsync->condDone, NULL);
+	pAsync->nSlots = nSlots;
+	pAsync->failRet = RS_RET_OK;
+	for(i = 0 ; i < nSlots ; ++i) {
+		pAsync->slots[i].tx.done = wtiAsyncDone;
+		pAsync->slots[i].pAsync = pAsync;
+	}
+	pThis->pAsync = pAsync;
+finalize_it:
+	RETiRet;
+}
+
+
+/* obtain a free slot for the current batch. Returns NULL if there is none
+ * (or the batch storage could not be allocated), in which case the caller
+ * must commit synchronously. The queue makes sure there is a free slot
+ * before it dequeues a batch.
+ */
+wtiAsyncSlot_t *
+wtiAsyncGetSlot(wti_t * const pThis)
+{
+	wtiAsync_t *const pAsync = pThis->pAsync;
+	wtiAsyncSlot_t *pSlot;
+	int i;
+
+	if(pAsync->pCurr != NULL)
+		return NULL;	/* only one transaction per batch */
+	for(i = 0 ; i < pAsync->nSlots ; ++i) {
+		pSlot = &pAsync->slots[i];
+		if(pSlot->bInUse)
+			continue;
+		if(pSlot->batch.pElem == NULL
+		   && batchInit(&pSlot->batch, pThis->batch.maxElem) != RS_RET_OK) {
+			batchFree(&pSlot->batch);
+			pSlot->batch.pElem = NULL;
+			pSlot->batch.eltState = NULL;
+			return NULL;
+		}
+		pSlot->bInUse = 1;
+		pSlot->bParked = 0;
+		pSlot->bDone = 0;
+		++pAsync->nInUse;
+		pAsync->pCurr = pSlot;
+		return pSlot;
+	}
+	return NULL;
+}
+
+
+/* park the current batch in its slot if it has a transaction in flight. The
+ * worker continues with the slot's (empty) batch storage. Must be called
+ * before the worker's batch is deleted.
+ */
+void
+wtiAsyncPark(wti_t * const pThis)
+{
+	wtiAsyncSlot_t *pSlot;
+	batch_t tmp;
+
+	if(pThis->pAsync == NULL || (pSlot = pThis->pAsync->pCurr) == NULL)
+		return;
+	tmp = pSlot->batch;
+	pSlot->batch = pThis->batch;
+	pThis->batch = tmp;
+	pThis->batch.nElem = pThis->batch.nElemDeq = 0;
+	pSlot->bParked = 1;
+	pThis->pAsync->pCurr = NULL;
+}
+
+
+/* return a slot whose batch has been deleted */
+void
+wtiAsyncRelease(wti_t * const pThis, wtiAsyncSlot_t * const pSlot)
+{
+	wtiArenaReset(&pSlot->arena);
+	pSlot->bInUse = 0;
+	pSlot->bParked = 0;
+	--pThis->pAsync->nInUse;
+}
+
+
+/* give up waiting for a slot's transaction. Its batch must have been
+ * deleted. The slot is not reused, as the module may still call done().
+ */
+void
+wtiAsyncAbandon(wti_t * const pThis, wtiAsyncSlot_t * const pSlot)
+{
+	pSlot->bParked = 0;
+	pSlot->bAbandoned = 1;
+	++pThis->pAsync->nAbandoned;
+}
+
+
+int
+wtiAsyncIsDone(wtiAsyncSlot_t * const pSlot)
+{
+	int bDone;
+
+	pthread_mutex_lock(&pSlot->pAsync->mut);
+	bDone = pSlot->bDone;
+	pthread_mutex_unlock(&pSlot->pAsync->mut);
+	return bDone;
+}
+
+
+/* wait until at least one parked transaction is done, but not beyond
+ * *pTimeout. Returns RS_RET_TIMED_OUT if none is done by then. The wait is
+ * not a cancellation point, so that the mutex is never left locked.
+ */
+rsRetVal
+wtiAsyncWait(wti_t * const pThis, const struct timespec * const pTimeout)
+{
+	wtiAsync_t *const pAsync = pThis->pAsync;
+	int iCancelStateSave;
+	int i;
+	DEFiRet;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &iCancelStateSave);
+	pthread_mutex_lock(&pAsync->mut);
+	while(1) {
+		for(i = 0 ; i < pAsync->nSlots ; ++i) {
+			if(pAsync->slots[i].bParked && pAsync->slots[i].bDone)
+				goto done;
+		}
+		if(pthread_cond_timedwait(&pAsync->condDone, &pAsync->mut, pTimeout) == ETIMEDOUT) {
+			iRet = RS_RET_TIMED_OUT;
+			break;
+		}
+	}
+done:
+	pthread_mutex_unlock(&pAsync->mut);
+	pthread_setcancelstate(iCancelStateSave, NULL);
+	RETiRet;
+}
+
+
+/* free the action worker instances this worker thread has created. Must
+ * only be called when the thread no longer processes messages.
+ */
+void
+wtiFreeActWrkrInstances(wti_t *__restrict__ const pThis)
+{
+	const action_t *__restrict__ pAction;
+	actWrkrInfo_t *__restrict__ wrkrInfo;
+	int i;
+
+	DBGPRINTF("DDDD: wti %p: worker cleanup action instances\n", pThis);
+	for(i = 0 ; i < iActionNbr ; ++i) {
+		wrkrInfo = &(pThis->actWrkrInfo[i]);
+		dbgprintf("wti %p, action %d, ptr %p\n", pThis, i, wrkrInfo->actWrkrData);
+		if(wrkrInfo->actWrkrData != NULL) {
+			pAction = wrkrInfo->pAction;
+			pAction->pMod->mod.om.freeWrkrInstance(wrkrInfo->actWrkrData);
+			if(pAction->isTransactional) {
+				/* the strings are owned by the arena */
+				wtiArenaFree(&wrkrInfo->p.tx.arena);
+				free(wrkrInfo->p.tx.iparams);
+				wrkrInfo->p.tx.iparams = NULL;
+				wrkrInfo->p.tx.currIParam = 0;
+				wrkrInfo->p.tx.maxIParams = 0;
+			}
+			wrkrInfo->actWrkrData = NULL; /* re-init for next activation */
+		}
+	}
+}
+
+
 /* generic worker thread framework. Note that we prohibit cancellation
  * during almost all times, because it can have very undesired side effects.
  * However, we may need to cancel a thread if the consumer blocks for too
@@ -287,13 +684,10 @@ rsRetVal
 wtiWorker(wti_t *__restrict__ const pThis)
 {
 	wtp_t *__restrict__ const pWtp = pThis->pWtp; /* our worker thread pool -- shortcut */
-	const action_t *__restrict__ pAction;
 	int bInactivityTOOccured = 0;
 	rsRetVal localRet;
 	rsRetVal terminateRet;
-	actWrkrInfo_t *__restrict__ wrkrInfo;
 	int iCancelStateSave;
-	int i, j, k;
 	DEFiRet;
 
 	dbgSetThrdName(pThis->pszDbgHdr);
@@ -350,29 +744,7 @@ wtiWorker(wti_t *__restrict__ const pThis)
 
 	d_pthread_mutex_unlock(pWtp->pmutUsr);
 
-	DBGPRINTF("DDDD: wti %p: worker cleanup action instances\n", pThis);
-	for(i = 0 ; i < iActionNbr ; ++i) {
-		wrkrInfo = &(pThis->actWrkrInfo[i]);
-		dbgprintf("wti %p, action %d, ptr %p\n", pThis, i, wrkrInfo->actWrkrData);
-		if(wrkrInfo->actWrkrData != NULL) {
-			pAction = wrkrInfo->pAction;
-			pAction->pMod->mod.om.freeWrkrInstance(wrkrInfo->actWrkrData);
-			if(pAction->isTransactional) {
-				/* free iparam "cache" - we need to go through to max! */
-				for(j = 0 ; j < wrkrInfo->p.tx.maxIParams ; ++j) {
-					for(k = 0 ; k < pAction->iNumTpls ; ++k) {
-						free(actParam(wrkrInfo->p.tx.iparams,
-							      pAction->iNumTpls, j, k).param);
-					}
-				}
-				free(wrkrInfo->p.tx.iparams);
-				wrkrInfo->p.tx.iparams = NULL;
-				wrkrInfo->p.tx.currIParam = 0;
-				wrkrInfo->p.tx.maxIParams = 0;
-			}
-			wrkrInfo->actWrkrData = NULL; /* re-init for next activation */
-		}
-	}
+	wtiFreeActWrkrInstances(pThis);
 
 	/* indicate termination */
 	pthread_cleanup_pop(0); /* remove cleanup handler */
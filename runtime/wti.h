@@ -27,6 +27,7 @@
 #include "obj.h"
 #include "batch.h"
 #include "action.h"
+#include "atomic.h"
 
 
 #define ACT_STATE_RDY  0	/* action ready, waiting for new transaction */
@@ -36,12 +37,34 @@
 #define ACT_STATE_SUSP 4	/* suspended due to failure (return fail until timeout expired) */
 /* note: 3 bit bit field --> highest value is 7! */
 
+/* arena for the rendered parameters of a transaction. Strings are appended
+ * to a list of chunks, which is kept when the arena is reset after commit,
+ * so that steady-state operation needs no malloc() or free() per message.
+ * Strings above WTI_ARENA_MAXSMALL bytes get a chunk of their own, which is
+ * freed on reset, so that rare large messages do not bloat the list.
+ */
+#define WTI_ARENA_CHUNKSIZE (64 * 1024)
+#define WTI_ARENA_MAXSMALL (WTI_ARENA_CHUNKSIZE / 4)
+typedef struct wtiArenaChunk_s wtiArenaChunk_t;
+struct wtiArenaChunk_s {
+	wtiArenaChunk_t *next;
+	size_t size;	/* usable bytes, which follow the header */
+	size_t used;
+};
+typedef struct wtiArena_s {
+	wtiArenaChunk_t *root;
+	wtiArenaChunk_t *curr;	/* chunk being filled, NULL after reset */
+	wtiArenaChunk_t *large;	/* chunks of large strings */
+} wtiArena_t;
+
 typedef struct actWrkrInfo {
 	action_t *pAction;
 	void *actWrkrData;
 	uint16_t uResumeOKinRow;/* number of times in a row that resume said OK with an
 				   immediate failure following */
 	int	iNbrResRtry;	/* number of retries since last suspend */
+	int	iSharedRetries;	/* retries so far on a shared worker, which does not
+				   wait in actionDoRetry() */
 	struct {
 		unsigned actState : 3;
 	} flags;
@@ -50,6 +73,7 @@ typedef struct actWrkrInfo {
 			actWrkrIParams_t *iparams;/* dynamically sized array for transactional outputs */
 			int currIParam;
 			int maxIParams;	/* current max */
+			wtiArena_t arena; /* holds the strings iparams point to */
 		} tx;
 		struct {
 			actWrkrIParams_t actParams[CONF_OMOD_NUMSTRINGS_MAXSIZE];
@@ -57,12 +81,58 @@ typedef struct actWrkrInfo {
 	} p; /* short name for "parameters" */
 } actWrkrInfo_t;
 
+/* cache of strings rendered for the current message, so that actions
+ * using the same template do not need to render it again. Entries are
+ * only valid while the message is not modified, see wtiTplCacheInvalidate().
+ */
+/* asynchronous transactions, see actionCommitAsync(). A worker may have
+ * up to nSlots transactions in flight. The batch a transaction was built
+ * from is parked in its slot when the worker dequeues the next one, and is
+ * only deleted from the queue after the transaction is done.
+ */
+#define WTI_ASYNC_MAXSLOTS 16
+#define WTI_ASYNC_POLL_MS 100	/* max time between checks for shutdown while waiting */
+typedef struct wtiAsync_s wtiAsync_t;
+typedef struct wtiAsyncSlot_s {
+	actAsyncTx_t tx;	/* handle passed to the module, must be first */
+	wtiAsync_t *pAsync;	/* owner, for the done() callback */
+	batch_t batch;		/* the parked batch */
+	actWrkrIParams_t *iparams; /* params of the transaction ... */
+	int maxIParams;
+	wtiArena_t arena;	/* ... and the strings they point to */
+	rsRetVal result;	/* outcome, valid once bDone is set */
+	sbool bInUse;
+	sbool bParked;		/* batch has been moved into the slot */
+	sbool bAbandoned;	/* given up on shutdown, see qqueueAbandonAsync() */
+	sbool bDone;		/* guarded by pAsync->mut */
+} wtiAsyncSlot_t;
+struct wtiAsync_s {
+	pthread_mutex_t mut;
+	pthread_cond_t condDone;/* signalled when a transaction is done */
+	int nSlots;
+	int nInUse;
+	int nAbandoned;		/* slots in use, but no longer waited for */
+	wtiAsyncSlot_t *pCurr;	/* slot of the current batch (to be parked) */
+	rsRetVal failRet;	/* failure of a reaped transaction, not yet seen by the action */
+	wtiAsyncSlot_t slots[WTI_ASYNC_MAXSLOTS];
+};
+
+#define WTI_TPLCACHE_SIZE 4
+typedef struct wtiTplCacheEntry_s {
+	struct template *pTpl;	/* NULL if entry is unused */
+	msg_t *pMsg;
+	actWrkrIParams_t str;	/* the rendered string, buffer is owned by the cache */
+} wtiTplCacheEntry_t;
+
 /* the worker thread instance class */
 struct wti_s {
 	BEGINobjInstance;
 	pthread_t thrdID; 	/* thread ID */
 	int bIsRunning;	/* is this thread currently running? (must be int for atomic op!) */
 	sbool bAlwaysRunning;	/* should this thread always run? */
+	sbool bSharedWrkr;	/* thread of the shared worker pool (wrkpool.c)? */
+	int iSharedSuspendMs;	/* shared worker: an action is suspended, run the queue
+				   again after this many ms (see actionDoRetry()) */
 	int *pbShutdownImmediate;/* end processing of this batch immediately if set to 1 */
 	wtp_t *pWtp; /* my worker thread pool (important if only the work thread instance is passed! */
 	batch_t batch; /* pointer to an object array meaningful for current user
@@ -71,6 +141,8 @@ struct wti_s {
 	actWrkrInfo_t *actWrkrInfo; /* *array* of action wrkr infos for all actions
 				      (sized for max nbr of actions in config!) */
 	pthread_cond_t pcondBusy; /* condition to wake up the worker, protected by pmutUsr in wtp */
+	int bSpinning;		/* spinning for new work, need not be signalled (int for atomic op) */
+	unsigned iIdleAvg;	/* moving average of idle periods (usecs), limits the spin phase */
 	DEF_ATOMIC_HELPER_MUT(mutIsRunning);
 	struct {
 		uint8_t bPrevWasSuspended;
@@ -79,14 +151,32 @@ struct wti_s {
 					* also be added as a user-selectable option (not implemented yet)
 					*/
 	} execState;	/* state for the execution engine */
+	struct {
+		wtiTplCacheEntry_t ent[WTI_TPLCACHE_SIZE];
+		int iNext;	/* next entry to replace (round-robin) */
+	} tplCache;
+	actWrkrIParams_t tplScratch; /* render buffer for transactional actions */
+	wtiAsync_t *pAsync;	/* asynchronous transactions, NULL if not used */
 };
 
 
 /* prototypes */
 rsRetVal wtiConstruct(wti_t **ppThis);
 rsRetVal wtiConstructFinalize(wti_t * const pThis);
+void wtiLocalizeBatch(wti_t * const pThis);
 rsRetVal wtiDestruct(wti_t **ppThis);
 rsRetVal wtiWorker(wti_t * const pThis);
+void wtiFreeActWrkrInstances(wti_t * const pThis);
+uchar *wtiArenaAlloc(wtiArena_t * const pArena, const size_t len);
+void wtiArenaFree(wtiArena_t * const pArena);
+void wtiArenaFreeLarge(wtiArena_t * const pArena);
+rsRetVal wtiAsyncConstruct(wti_t * const pThis, int nSlots);
+wtiAsyncSlot_t *wtiAsyncGetSlot(wti_t * const pThis);
+void wtiAsyncPark(wti_t * const pThis);
+void wtiAsyncRelease(wti_t * const pThis, wtiAsyncSlot_t * const pSlot);
+void wtiAsyncAbandon(wti_t * const pThis, wtiAsyncSlot_t * const pSlot);
+int wtiAsyncIsDone(wtiAsyncSlot_t * const pSlot);
+rsRetVal wtiAsyncWait(wti_t * const pThis, const struct timespec * const pTimeout);
 rsRetVal wtiSetDbgHdr(wti_t * const pThis, uchar *pszMsg, size_t lenMsg);
 rsRetVal wtiCancelThrd(wti_t * const pThis);
 rsRetVal wtiSetAlwaysRunning(wti_t * const pThis);
@@ -98,6 +188,17 @@ PROTOTYPEObjClassInit(wti);
 PROTOTYPEpropSetMeth(wti, pszDbgHdr, uchar*);
 PROTOTYPEpropSetMeth(wti, pWtp, wtp_t*);
 
+/* is the worker spinning for work (and thus needs no wakeup)? */
+static inline int
+wtiIsSpinning(wti_t * const pThis)
+{
+#ifdef HAVE_ATOMIC_BUILTINS
+	return ATOMIC_FETCH_32BIT(&pThis->bSpinning, NULL);
+#else
+	return 0;
+#endif
+}
+
 static inline uint8_t
 getActionStateByNbr(wti_t * const pWti, const int iActNbr)
 {
@@ -191,9 +292,43 @@ wtiInitIParam(actWrkrIParams_t *piparams)
 	memset(piparams, 0, sizeof(actWrkrIParams_t));
 }
 
+/* must be called whenever the current message may have been modified
+ * (or a new message is processed), drops all cached template strings
+ * and the exec_template() results of the script function memo.
+ * The buffers are kept for reuse.
+ */
+static inline void
+wtiTplCacheInvalidate(wti_t * const pWti)
+{
+	int i;
+	for(i = 0 ; i < WTI_TPLCACHE_SIZE ; ++i)
+		pWti->tplCache.ent[i].pTpl = NULL;
+	cnfexprMemoInvalidate();
+}
+
+static inline wtiTplCacheEntry_t *
+wtiTplCacheFind(wti_t * const pWti, struct template * const pTpl, msg_t * const pMsg)
+{
+	int i;
+	for(i = 0 ; i < WTI_TPLCACHE_SIZE ; ++i)
+		if(pWti->tplCache.ent[i].pTpl == pTpl && pWti->tplCache.ent[i].pMsg == pMsg)
+			return &pWti->tplCache.ent[i];
+	return NULL;
+}
+
+/* make all space of the arena available again, chunks are kept */
+static inline void
+wtiArenaReset(wtiArena_t * const pArena)
+{
+	pArena->curr = NULL;
+	if(pArena->large != NULL)
+		wtiArenaFreeLarge(pArena);
+}
+
 static inline void
 wtiResetExecState(wti_t * const pWti, batch_t * const pBatch)
 {
+	wtiTplCacheInvalidate(pWti);
 	pWti->execState.bPrevWasSuspended = 0;
 	pWti->execState.bDoAutoCommit = (batchNumMsgs(pBatch) == 1);
 }
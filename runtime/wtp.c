@@ -57,6 +57,7 @@
 #include "obj.h"
 #include "unicode-helper.h"
 #include "glbl.h"
+#include "wrkpool.h"
 
 /* static data */
 DEFobjStaticHelpers
@@ -122,8 +123,10 @@ wtpConstructFinalize(wtp_t *pThis)
 
 	ISOBJ_TYPE_assert(pThis, wtp);
 
-	DBGPRINTF("%s: finalizing construction of worker thread pool (numworkerThreads %d)\n",
-		  wtpGetDbgHdr(pThis), pThis->iNumWorkerThreads);
+	DBGPRINTF("%s: finalizing construction of worker thread pool (numworkerThreads %d%s)\n",
+		  wtpGetDbgHdr(pThis), pThis->iNumWorkerThreads, pThis->bShared ? ", shared" : "");
+	if(pThis->bShared)
+		FINALIZE; /* workers are provided by the shared pool */
 	/* alloc and construct workers - this can only be done in finalizer as we previously do
 	 * not know the max number of workers
 	 */
@@ -148,8 +151,10 @@ finalize_it:
 BEGINobjDestruct(wtp) /* be sure to specify the object type also in END and CODESTART macros! */
 	int i;
 CODESTARTobjDestruct(wtp)
+	if(pThis->bShared)
+		wrkpoolRelease(pThis);
 	/* destruct workers */
-	for(i = 0 ; i < pThis->iNumWorkerThreads ; ++i)
+	for(i = 0 ; pThis->pWrkr != NULL && i < pThis->iNumWorkerThreads ; ++i)
 		wtiDestruct(&pThis->pWrkr[i]);
 
 	free(pThis->pWrkr);
@@ -235,10 +240,18 @@ wtpShutdownAll(wtp_t *pThis, wtpState_t tShutdownCmd, struct timespec *ptTimeout
 	/* lock mutex to prevent races (may otherwise happen during idle processing and such...) */
 	d_pthread_mutex_lock(pThis->pmutUsr);
 	wtpSetState(pThis, tShutdownCmd);
-	/* awake workers in retry loop */
-	for(i = 0 ; i < pThis->iNumWorkerThreads ; ++i) {
-		pthread_cond_signal(&pThis->pWrkr[i]->pcondBusy);
-		wtiWakeupThrd(pThis->pWrkr[i]);
+#ifdef HAVE_ATOMIC_BUILTINS
+	ATOMIC_INC(&pThis->iWorkGen, NULL); /* end spin phases, see doIdleProcessing() */
+#endif
+	if(pThis->bShared) {
+		/* make sure a pool thread sees the new state */
+		wrkpoolAdvise(pThis, 1);
+	} else {
+		/* awake workers in retry loop */
+		for(i = 0 ; i < pThis->iNumWorkerThreads ; ++i) {
+			pthread_cond_signal(&pThis->pWrkr[i]->pcondBusy);
+			wtiWakeupThrd(pThis->pWrkr[i]);
+		}
 	}
 	d_pthread_mutex_unlock(pThis->pmutUsr);
 
@@ -257,7 +270,7 @@ wtpShutdownAll(wtp_t *pThis, wtpState_t tShutdownCmd, struct timespec *ptTimeout
 		}
 
 		/* awake workers in retry loop */
-		for(i = 0 ; i < pThis->iNumWorkerThreads ; ++i) {
+		for(i = 0 ; !pThis->bShared && i < pThis->iNumWorkerThreads ; ++i) {
 			wtiWakeupThrd(pThis->pWrkr[i]);
 		}
 
@@ -283,11 +296,18 @@ wtpCancelAll(wtp_t *pThis)
 
 	ISOBJ_TYPE_assert(pThis, wtp);
 
+	if(pThis->bShared) {
+		/* pool threads can not be cancelled, so we wait for them */
+		wrkpoolCancel(pThis);
+		FINALIZE;
+	}
+
 	/* go through all workers and cancel those that are active */
 	for(i = 0 ; i < pThis->iNumWorkerThreads ; ++i) {
 		wtiCancelThrd(pThis->pWrkr[i]);
 	}
 
+finalize_it:
 	RETiRet;
 }
 
@@ -386,6 +406,18 @@ wtpWorker(void *arg) /* the arg is actually a wti object, even though we are in
 	dbgOutputTID((char*)thrdName);
 #	endif
 
+	if(pThis->pCpuSet != NULL) {
+		if(srCpuSetBind(pThis->pCpuSet) == RS_RET_OK) {
+			/* re-create the batch from this thread, so that it is
+			 * allocated local to the CPUs we now run on.
+			 */
+			wtiLocalizeBatch(pWti);
+		} else {
+			DBGPRINTF("%s: could not bind worker to CPU set: %s\n",
+				  wtpGetDbgHdr(pThis), strerror(errno));
+		}
+	}
+
 	pthread_cleanup_push(wtpWrkrExecCancelCleanup, pWti);
 	wtiWorker(pWti);
 	pthread_cleanup_pop(0);
@@ -464,9 +496,20 @@ wtpAdviseMaxWorkers(wtp_t *pThis, int nMaxWrkr)
 	if(nMaxWrkr == 0)
 		FINALIZE;
 
+	if(pThis->bShared) {
+		wrkpoolAdvise(pThis, nMaxWrkr);
+		FINALIZE;
+	}
+
 	if(nMaxWrkr > pThis->iNumWorkerThreads) /* limit to configured maximum */
 		nMaxWrkr = pThis->iNumWorkerThreads;
 
+#ifdef HAVE_ATOMIC_BUILTINS
+	/* tell spinning workers there is something to do, see doIdleProcessing() */
+	if(pThis->iSpinMax > 0)
+		ATOMIC_INC(&pThis->iWorkGen, NULL);
+#endif
+
 	nMissing = nMaxWrkr - ATOMIC_FETCH_32BIT(&pThis->iCurNumWrkThrd, &pThis->mutCurNumWrkThrd);
 
 	if(nMissing > 0) {
@@ -480,7 +523,9 @@ wtpAdviseMaxWorkers(wtp_t *pThis, int nMaxWrkr)
 		/* we have needed number of workers, but they may be sleeping */
 		for(i = 0, nRunning = 0; i < pThis->iNumWorkerThreads && nRunning < nMaxWrkr; ++i) {
 			if (wtiGetState(pThis->pWrkr[i]) != WRKTHRD_STOPPED) {
-				pthread_cond_signal(&pThis->pWrkr[i]->pcondBusy);
+				/* a spinning worker sees the new work generation by itself */
+				if(!wtiIsSpinning(pThis->pWrkr[i]))
+					pthread_cond_signal(&pThis->pWrkr[i]->pcondBusy);
 				nRunning++;
 			}
 		}
@@ -497,6 +542,10 @@ DEFpropSetMeth(wtp, toWrkShutdown, long)
 DEFpropSetMeth(wtp, wtpState, wtpState_t)
 DEFpropSetMeth(wtp, iNumWorkerThreads, int)
 DEFpropSetMeth(wtp, pUsr, void*)
+DEFpropSetMeth(wtp, pCpuSet, srCpuSet_t*)
+DEFpropSetMeth(wtp, bShared, int)
+DEFpropSetMeth(wtp, iSpinMax, int)
+DEFpropSetMeth(wtp, bHugePages, int)
 DEFpropSetMethPTR(wtp, pmutUsr, pthread_mutex_t)
 DEFpropSetMethFP(wtp, pfChkStopWrkr, rsRetVal(*pVal)(void*, int))
 DEFpropSetMethFP(wtp, pfRateLimiter, rsRetVal(*pVal)(void*))
@@ -63,6 +63,18 @@ struct wtp_s {
 	rsRetVal (*pfDoWork)(void *pUsr, void *pWti);
 	/* end user objects */
 	uchar *pszDbgHdr;	/* header string for debug messages */
+	srCpuSet_t *pCpuSet;	/* CPUs to bind workers to, NULL if unbound (owned by user object) */
+	sbool bShared;		/* no threads of our own, use the shared pool (wrkpool.c) */
+	int	iSpinMax;	/* max time (usecs) an idle worker spins before blocking, 0 - never spin */
+	sbool	bHugePages;	/* back the workers' batches by huge pages, if large enough */
+	unsigned iWorkGen;	/* incremented whenever work is advised, watched by spinning workers */
+	/* the following are guarded by the shared pool's mutex */
+	int nSharedWant;	/* number of pool threads we could currently use */
+	int nSharedActive;	/* number of pool threads working for us */
+	int bSharedQueued;	/* on the pool's run or delay list? (int for atomic read) */
+	sbool bSharedPending;	/* advised while all wanted pool threads were busy */
+	uint64_t tSharedDue;	/* on the delay list until then (monotonic usecs), 0 - not delayed */
+	wtp_t *pSharedNext;	/* next on the run or delay list */
 	DEF_ATOMIC_HELPER_MUT(mutCurNumWrkThrd);
 	DEF_ATOMIC_HELPER_MUT(mutWtpState);
 };
@@ -92,6 +104,10 @@ PROTOTYPEpropSetMeth(wtp, toWrkShutdown, long);
 PROTOTYPEpropSetMeth(wtp, wtpState, wtpState_t);
 PROTOTYPEpropSetMeth(wtp, iMaxWorkerThreads, int);
 PROTOTYPEpropSetMeth(wtp, pUsr, void*);
+PROTOTYPEpropSetMeth(wtp, pCpuSet, srCpuSet_t*);
+PROTOTYPEpropSetMeth(wtp, bShared, int);
+PROTOTYPEpropSetMeth(wtp, iSpinMax, int);
+PROTOTYPEpropSetMeth(wtp, bHugePages, int);
 PROTOTYPEpropSetMeth(wtp, iNumWorkerThreads, int);
 PROTOTYPEpropSetMethPTR(wtp, pmutUsr, pthread_mutex_t);
 
@@ -0,0 +1,150 @@
+/* zippool.c - a pool of threads for compressing output streams
+ *
+ * Zip compression is by far the most expensive part of writing zipped
+ * files, and a single thread can not keep up with fast inputs. With
+ * global(zip.threads) set, the stream class submits each buffer as a job
+ * to this pool and continues to fill the next buffer (see
+ * doZipWriteParallel() in stream.c). The pool itself knows nothing
+ * about compression, it just runs the jobs' work functions in FIFO order.
+ *
+ * The pool threads are started on first use, as this happens only after
+ * rsyslogd has forked into the background. They run until rsyslogd
+ * terminates.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#if HAVE_SYS_PRCTL_H
+#  include <sys/prctl.h>
+#endif
+#include "rsyslog.h"
+#include "zippool.h"
+
+int iZipThreads = 0;
+
+static pthread_mutex_t mutPool = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t condWork = PTHREAD_COND_INITIALIZER;	/* job submitted */
+static pthread_cond_t condDone = PTHREAD_COND_INITIALIZER;	/* job done */
+static zipjob_t *pJobRoot = NULL;
+static zipjob_t *pJobLast = NULL;
+static int nWorkers = 0;	/* number of threads running */
+static sbool bStarted = 0;	/* start attempted? */
+
+
+static void *
+zippoolWorker(void *arg)
+{
+	zipjob_t *pJob;
+	sigset_t sigSet;
+#	if HAVE_PRCTL && defined PR_SET_NAME
+	char thrdName[32];
+#	endif
+
+	sigfillset(&sigSet);
+	pthread_sigmask(SIG_BLOCK, &sigSet, NULL);
+#	if HAVE_PRCTL && defined PR_SET_NAME
+	snprintf(thrdName, sizeof(thrdName), "rs:zip/%d", (int) (intptr_t) arg);
+	if(prctl(PR_SET_NAME, thrdName, 0, 0, 0) != 0) {
+		DBGPRINTF("prctl failed, not setting thread name for '%s'\n", thrdName);
+	}
+#	endif
+
+	pthread_mutex_lock(&mutPool);
+	while(1) {
+		if(pJobRoot == NULL) {
+			pthread_cond_wait(&condWork, &mutPool);
+			continue;
+		}
+		pJob = pJobRoot;
+		if((pJobRoot = pJob->pNext) == NULL)
+			pJobLast = NULL;
+		pthread_mutex_unlock(&mutPool);
+
+		pJob->fnDo(pJob);
+
+		pthread_mutex_lock(&mutPool);
+		pJob->bDone = 1;
+		pthread_cond_broadcast(&condDone);
+	}
+	/*NOTREACHED*/
+	return NULL;
+}
+
+
+/* start the pool threads, called with mutPool locked. If some cannot be
+ * started, we use those we have.
+ */
+static void
+zippoolStart(void)
+{
+	pthread_attr_t attr;
+	pthread_t tid;
+	int i;
+
+	bStarted = 1;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	for(i = 0 ; i < iZipThreads ; ++i) {
+		if(pthread_create(&tid, &attr, zippoolWorker, (void*) (intptr_t) i) != 0)
+			break;
+		++nWorkers;
+	}
+	pthread_attr_destroy(&attr);
+	DBGPRINTF("zippool: %d of %d compression threads started\n", nWorkers, iZipThreads);
+}
+
+
+void
+zippoolSubmit(zipjob_t *const pJob)
+{
+	pJob->bDone = 0;
+	pJob->pNext = NULL;
+	pthread_mutex_lock(&mutPool);
+	if(!bStarted)
+		zippoolStart();
+	if(nWorkers == 0) {
+		pthread_mutex_unlock(&mutPool);
+		pJob->fnDo(pJob);
+		pJob->bDone = 1;
+		return;
+	}
+	if(pJobLast == NULL)
+		pJobRoot = pJob;
+	else
+		pJobLast->pNext = pJob;
+	pJobLast = pJob;
+	pthread_cond_signal(&condWork);
+	pthread_mutex_unlock(&mutPool);
+}
+
+
+void
+zippoolWait(zipjob_t *const pJob)
+{
+	pthread_mutex_lock(&mutPool);
+	while(!pJob->bDone)
+		pthread_cond_wait(&condDone, &mutPool);
+	pthread_mutex_unlock(&mutPool);
+}
@@ -0,0 +1,60 @@
+/* Definitions for the compression worker pool.
+ *
+ * If global(zip.threads) is set, zipped file streams do not compress on
+ * the writing thread. Instead, they hand each output buffer to a global
+ * pool of threads and write the compressed blocks in order once they are
+ * done. So a single stream can use several CPUs for compression.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_ZIPPOOL_H
+#define INCLUDED_ZIPPOOL_H
+
+extern int iZipThreads;	/* global(zip.threads), 0 - compress on the writing thread */
+
+/* a compression job. The pool only uses fnDo, bDone and pNext, the other
+ * members belong to the submitter and its work function.
+ */
+typedef struct zipjob_s zipjob_t;
+struct zipjob_s {
+	void (*fnDo)(zipjob_t *pJob);	/* does the work, called on a pool thread */
+	sbool bDone;		/* fnDo has completed (guarded by the pool) */
+	zipjob_t *pNext;	/* pool's work list */
+	uchar *pIn;		/* data to compress */
+	size_t lenIn;
+	size_t sizeIn;		/* allocated size of pIn */
+	uchar *pDict;		/* preset dictionary, 32K max */
+	unsigned lenDict;
+	uchar *pOut;		/* compressed data (may be realloc()ed by fnDo) */
+	size_t lenOut;
+	size_t sizeOut;		/* allocated size of pOut */
+	int iLevel;		/* zip level */
+	sbool bGzipMember;	/* create a complete gzip member instead of a raw deflate block */
+	unsigned long crc;	/* crc32 of the input data (raw blocks only) */
+	rsRetVal iRet;		/* result of fnDo */
+};
+
+/* hand pJob to the pool. If no pool thread is available, the job is
+ * carried out by the calling thread before this function returns.
+ */
+void zippoolSubmit(zipjob_t *pJob);
+/* wait until pJob, which must have been submitted, is done */
+void zippoolWait(zipjob_t *pJob);
+
+#endif /* #ifndef INCLUDED_ZIPPOOL_H */
@@ -65,6 +65,41 @@ static int myDeflate(z_streamp strm, int flush)
 	return deflate(strm, flush);
 }
 
+static int myInflateInit2(z_streamp strm, int windowBits)
+{
+	return inflateInit2(strm, windowBits);
+}
+
+static int myInflate(z_streamp strm, int flush)
+{
+	return inflate(strm, flush);
+}
+
+static int myInflateReset(z_streamp strm)
+{
+	return inflateReset(strm);
+}
+
+static int myInflateEnd(z_streamp strm)
+{
+	return inflateEnd(strm);
+}
+
+static int myDeflateSetDictionary(z_streamp strm, const Bytef *dictionary, uInt dictLength)
+{
+	return deflateSetDictionary(strm, dictionary, dictLength);
+}
+
+static uLong myCrc32(uLong crc, const Bytef *buf, uInt len)
+{
+	return crc32(crc, buf, len);
+}
+
+static uLong myCrc32Combine(uLong crc1, uLong crc2, z_off_t len2)
+{
+	return crc32_combine(crc1, crc2, len2);
+}
+
 
 /* queryInterface function
  * rgerhards, 2008-03-05
@@ -84,6 +119,13 @@ CODESTARTobjQueryInterface(zlibw)
 	pIf->DeflateInit2 = myDeflateInit2;
 	pIf->Deflate     = myDeflate;
 	pIf->DeflateEnd  = myDeflateEnd;
+	pIf->InflateInit2 = myInflateInit2;
+	pIf->Inflate     = myInflate;
+	pIf->InflateReset = myInflateReset;
+	pIf->InflateEnd  = myInflateEnd;
+	pIf->DeflateSetDictionary = myDeflateSetDictionary;
+	pIf->Crc32       = myCrc32;
+	pIf->Crc32Combine = myCrc32Combine;
 finalize_it:
 ENDobjQueryInterface(zlibw)
 
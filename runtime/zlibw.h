@@ -31,8 +31,17 @@ BEGINinterface(zlibw) /* name must also be changed in ENDinterface macro! */
 	int (*DeflateInit2)(z_streamp strm, int level, int method, int windowBits, int memLevel, int strategy);
 	int (*Deflate)(z_streamp strm, int);
 	int (*DeflateEnd)(z_streamp strm);
+	/* v2, 2026-10-14: inflate support, needed to read compressed queue files */
+	int (*InflateInit2)(z_streamp strm, int windowBits);
+	int (*Inflate)(z_streamp strm, int);
+	int (*InflateReset)(z_streamp strm);
+	int (*InflateEnd)(z_streamp strm);
+	/* v3, 2026-10-14: needed to concatenate independently compressed blocks */
+	int (*DeflateSetDictionary)(z_streamp strm, const Bytef *dictionary, uInt dictLength);
+	uLong (*Crc32)(uLong crc, const Bytef *buf, uInt len);
+	uLong (*Crc32Combine)(uLong crc1, uLong crc2, z_off_t len2);
 ENDinterface(zlibw)
-#define zlibwCURR_IF_VERSION 1 /* increment whenever you change the interface structure! */
+#define zlibwCURR_IF_VERSION 3 /* increment whenever you change the interface structure! */
 
 
 /* prototypes */
@@ -160,7 +160,9 @@ TCPSendBldFrame(tcpclt_t *pThis, char **pmsg, size_t *plen, int *pbMustBeFreed)
 	 */
 
 	/* Build frame based on selected framing */
-	if(framingToUse == TCP_FRAMING_OCTET_STUFFING) {
+	if(framingToUse == TCP_FRAMING_BINARY) {
+		/* binary records carry their own length, nothing to do */
+	} else if(framingToUse == TCP_FRAMING_OCTET_STUFFING) {
 		if((*(msg+len-1) != '\n')) {
 			/* in the malloc below, we need to add 2 to the length. The
 			 * reason is that we a) add one character and b) len does
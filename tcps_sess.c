@@ -71,6 +71,7 @@ BEGINobjConstruct(tcps_sess) /* be sure to specify the object type also in END m
 		pThis->iMsg = 0; /* just make sure... */
 		pThis->bAtStrtOfFram = 1; /* indicate frame header expected */
 		pThis->eFraming = TCP_FRAMING_OCTET_STUFFING; /* just make sure... */
+		MsgChainInit(&pThis->chain);
 		/* now allocate the message reception buffer */
 		CHKmalloc(pThis->pMsg = (uchar*) MALLOC(sizeof(uchar) * iMaxLine + 1));
 finalize_it:
@@ -109,6 +110,7 @@ CODESTARTobjDestruct(tcps_sess)
 	if(pThis->fromHostIP != NULL)
 		CHKiRet(prop.Destruct(&pThis->fromHostIP));
 	free(pThis->pMsg);
+	MsgChainDiscard(&pThis->chain);
 ENDobjDestruct(tcps_sess)
 
 
@@ -232,26 +234,46 @@ SetOnMsgReceive(tcps_sess_t *pThis, rsRetVal (*OnMsgReceive)(tcps_sess_t*, uchar
  * rgerhards, 2009-04-23
  */
 static rsRetVal
-defaultDoSubmitMessage(tcps_sess_t *pThis, struct syslogTime *stTime, time_t ttGenTime, multi_submit_t *pMultiSub)
+doSubmitMessageBuf(tcps_sess_t *pThis, uchar *pBuf, int lenBuf, msgChain_t *pChain, struct syslogTime *stTime,
+	time_t ttGenTime, multi_submit_t *pMultiSub)
 {
 	msg_t *pMsg;
+	uchar *pFrame;
+	rsRetVal localRet;
 	DEFiRet;
 
 	ISOBJ_TYPE_assert(pThis, tcps_sess);
 	
-	if(pThis->iMsg == 0) {
+	if(lenBuf == 0) {
 		DBGPRINTF("discarding zero-sized message\n");
 		FINALIZE;
 	}
 
 	if(pThis->DoSubmitMessage != NULL) {
-		pThis->DoSubmitMessage(pThis, pThis->pMsg, pThis->iMsg);
+		if(pChain != NULL && pChain->len > 0) {
+			/* the callback needs the frame in one piece */
+			lenBuf += pChain->len;
+			CHKiRet(MsgChainGather(pBuf, lenBuf - pChain->len, pChain, &pFrame));
+			pThis->DoSubmitMessage(pThis, pFrame, lenBuf);
+			free(pFrame);
+		} else {
+			pThis->DoSubmitMessage(pThis, pBuf, lenBuf);
+		}
 		FINALIZE;
 	}
 
 	/* we now create our own message object and submit it to the queue */
 	CHKiRet(msgConstructWithTime(&pMsg, stTime, ttGenTime));
-	MsgSetRawMsg(pMsg, (char*)pThis->pMsg, pThis->iMsg);
+	if(pChain != NULL && pChain->len > 0) {
+		if((localRet = MsgSetRawMsgChain(pMsg, pBuf, lenBuf, pChain)) != RS_RET_OK) {
+			msgDestruct(&pMsg);
+			ABORT_FINALIZE(localRet);
+		}
+	} else {
+		MsgSetRawMsg(pMsg, (char*)pBuf, lenBuf);
+	}
+	if(pMsg->iLenRawMsg > iMaxLine)
+		STATSCOUNTER_INC(pThis->pLstnInfo->ctrLargeMsgs, pThis->pLstnInfo->mutCtrLargeMsgs);
 	MsgSetInputName(pMsg, pThis->pLstnInfo->pInputName);
 	if(pThis->pLstnInfo->dfltTZ != NULL)
 		MsgSetDfltTZ(pMsg, (char*) pThis->pLstnInfo->dfltTZ);
@@ -262,17 +284,47 @@ defaultDoSubmitMessage(tcps_sess_t *pThis, struct syslogTime *stTime, time_t ttG
 	CHKiRet(MsgSetRcvFromIP(pMsg, pThis->fromHostIP));
 	MsgSetRuleset(pMsg, pThis->pLstnInfo->pRuleset);
 
-	STATSCOUNTER_INC(pThis->pLstnInfo->ctrSubmit, pThis->pLstnInfo->mutCtrSubmit);
+	STATSCOUNTER_SHARDED_INC(pThis->pLstnInfo->ctrSubmit);
 	ratelimitAddMsg(pThis->pLstnInfo->ratelimiter, pMultiSub, pMsg);
 
 finalize_it:
 	/* reset status variables */
 	pThis->bAtStrtOfFram = 1;
 	pThis->iMsg = 0;
+	if(pChain != NULL)
+		MsgChainDiscard(pChain);
 
 	RETiRet;
 }
 
+/* submit the message collected in the session buffer (and chain) */
+static inline rsRetVal
+defaultDoSubmitMessage(tcps_sess_t *pThis, struct syslogTime *stTime, time_t ttGenTime, multi_submit_t *pMultiSub)
+{
+	return doSubmitMessageBuf(pThis, pThis->pMsg, pThis->iMsg, &pThis->chain, stTime, ttGenTime, pMultiSub);
+}
+
+/* split a frame that is larger than we can keep, this is the emergency case */
+static inline rsRetVal
+doSplitMessage(tcps_sess_t *pThis, struct syslogTime *stTime, time_t ttGenTime, multi_submit_t *pMultiSub)
+{
+	DBGPRINTF("error: message received is larger than max msg size, we split it\n");
+	STATSCOUNTER_INC(pThis->pLstnInfo->ctrSplitMsgs, pThis->pLstnInfo->mutCtrSplitMsgs);
+	return defaultDoSubmitMessage(pThis, stTime, ttGenTime, pMultiSub);
+}
+
+/* number of octets that may still be added to the chain of the current
+ * frame, 0 if the frame must be split when the session buffer is full.
+ */
+static inline size_t
+getChainRoom(tcps_sess_t *pThis)
+{
+	const size_t maxFrame = pThis->pSrv->maxFrameSize;
+	const size_t used = iMaxLine + pThis->chain.len;
+
+	return (maxFrame > used) ? maxFrame - used : 0;
+}
+
 
 
 /* This should be called before a normal (non forced) close
@@ -384,7 +436,7 @@ processDataRcvd(tcps_sess_t *pThis, char c, struct syslogTime *stTime, time_t tt
 				DBGPRINTF("Framing Error: invalid octet count\n");
 				errmsg.LogError(0, NO_ERRCODE, "Framing Error in received TCP message: "
 					    "invalid octet count %d.", pThis->iOctetsRemain);
-			} else if(pThis->iOctetsRemain > iMaxLine) {
+			} else if(pThis->iOctetsRemain > iMaxLine && pThis->iOctetsRemain > pThis->pSrv->maxFrameSize) {
 				/* while we can not do anything against it, we can at least log an indication
 				 * that something went wrong) -- rgerhards, 2008-03-14
 				 */
@@ -397,10 +449,9 @@ processDataRcvd(tcps_sess_t *pThis, char c, struct syslogTime *stTime, time_t tt
 		}
 	} else {
 		assert(pThis->inputState == eInMsg);
-		if(pThis->iMsg >= iMaxLine) {
+		if(pThis->iMsg >= iMaxLine && getChainRoom(pThis) == 0) {
 			/* emergency, we now need to flush, no matter if we are at end of message or not... */
-			DBGPRINTF("error: message received is larger than max msg size, we split it\n");
-			defaultDoSubmitMessage(pThis, stTime, ttGenTime, pMultiSub);
+			doSplitMessage(pThis, stTime, ttGenTime, pMultiSub);
 			/* we might think if it is better to ignore the rest of the
 			 * message than to treat it as a new one. Maybe this is a good
 			 * candidate for a configuration parameter...
@@ -420,6 +471,8 @@ processDataRcvd(tcps_sess_t *pThis, char c, struct syslogTime *stTime, time_t tt
 			 */
 			if(pThis->iMsg < iMaxLine) {
 				*(pThis->pMsg + pThis->iMsg++) = c;
+			} else {
+				CHKiRet(MsgChainAppend(&pThis->chain, (uchar*) &c, 1));
 			}
 		}
 
@@ -434,6 +487,100 @@ processDataRcvd(tcps_sess_t *pThis, char c, struct syslogTime *stTime, time_t tt
 		}
 	}
 
+finalize_it:
+	RETiRet;
+}
+
+
+/* find the next record delimiter in the len bytes at p, NULL if there is none */
+static inline char *
+findFrameDelim(tcps_sess_t *pThis, char *p, const size_t len)
+{
+	char *pLF = NULL;
+	char *pAddtl;
+
+	if(!pThis->pSrv->bDisableLFDelim)
+		pLF = memchr(p, '\n', len);
+	if(pThis->pSrv->addtlFrameDelim == TCPSRV_NO_ADDTL_DELIMITER)
+		return pLF;
+	pAddtl = memchr(p, pThis->pSrv->addtlFrameDelim, (pLF == NULL) ? len : (size_t) (pLF - p));
+	return (pAddtl == NULL) ? pLF : pAddtl;
+}
+
+
+/* Bulk version of processDataRcvd() for the body of a frame, to be called
+ * in state eInMsg only (and not for an invalid octet count). It consumes
+ * all data up to the end of the frame (or buffer), which is located via
+ * memchr() or the octet count. Frames completely contained in the buffer
+ * are submitted directly from it; only data that needs to wait for more
+ * input is copied to the session buffer. Splitting of oversize messages
+ * is the same as with processDataRcvd(). With maxFrameSize, data beyond the
+ * session buffer is appended to the session's chain instead, so that large
+ * frames are kept whole and are copied only once into the message.
+ */
+static rsRetVal
+processDataBulk(tcps_sess_t *pThis, char **ppData, char *pEnd, struct syslogTime *stTime, time_t ttGenTime,
+	multi_submit_t *pMultiSub)
+{
+	char *pData = *ppData;
+	char *pDelim;
+	size_t lenFrame;	/* bytes of the frame body inside this buffer */
+	size_t lenCopy;
+	sbool bEndOfFrame;
+	sbool bSubmitted = 0;
+	DEFiRet;
+
+	if(pThis->eFraming == TCP_FRAMING_OCTET_STUFFING) {
+		pDelim = findFrameDelim(pThis, pData, pEnd - pData);
+		bEndOfFrame = (pDelim != NULL);
+		lenFrame = bEndOfFrame ? (size_t) (pDelim - pData) : (size_t) (pEnd - pData);
+	} else {
+		lenFrame = pEnd - pData;
+		bEndOfFrame = ((size_t) pThis->iOctetsRemain <= lenFrame);
+		if(bEndOfFrame)
+			lenFrame = pThis->iOctetsRemain;
+		pThis->iOctetsRemain -= lenFrame;
+	}
+
+	while(lenFrame > 0) {
+		if(pThis->iMsg >= iMaxLine) {
+			if((lenCopy = getChainRoom(pThis)) > 0) {
+				if(lenCopy > lenFrame)
+					lenCopy = lenFrame;
+				CHKiRet(MsgChainAppend(&pThis->chain, (uchar*) pData, lenCopy));
+				pData += lenCopy;
+				lenFrame -= lenCopy;
+				continue;
+			}
+			/* emergency, we now need to flush, no matter if we are at end of message or not... */
+			doSplitMessage(pThis, stTime, ttGenTime, pMultiSub);
+		}
+		if(   pThis->iMsg == 0 && bEndOfFrame
+		   && (lenFrame <= (size_t) iMaxLine || lenFrame <= (size_t) pThis->pSrv->maxFrameSize)) {
+			doSubmitMessageBuf(pThis, (uchar*) pData, lenFrame, NULL, stTime, ttGenTime, pMultiSub);
+			bSubmitted = 1;
+			lenCopy = lenFrame;
+		} else {
+			lenCopy = iMaxLine - pThis->iMsg;
+			if(lenCopy > lenFrame)
+				lenCopy = lenFrame;
+			memcpy(pThis->pMsg + pThis->iMsg, pData, lenCopy);
+			pThis->iMsg += lenCopy;
+		}
+		pData += lenCopy;
+		lenFrame -= lenCopy;
+	}
+
+	if(bEndOfFrame) {
+		if(!bSubmitted)
+			defaultDoSubmitMessage(pThis, stTime, ttGenTime, pMultiSub);
+		if(pThis->eFraming == TCP_FRAMING_OCTET_STUFFING)
+			++pData; /* skip delimiter */
+		pThis->inputState = eAtStrtFram;
+	}
+
+finalize_it:
+	*ppData = pData;
 	RETiRet;
 }
 
@@ -476,8 +623,20 @@ DataRcvd(tcps_sess_t *pThis, char *pData, size_t iLen)
 	 /* We now copy the message to the session buffer. */
 	pEnd = pData + iLen; /* this is one off, which is intensional */
 
+	/* The frame body is processed in bulk, the state machine is only
+	 * needed for the frame header (octet count).
+	 */
 	while(pData < pEnd) {
-		CHKiRet(processDataRcvd(pThis, *pData++, &stTime, ttGenTime, &multiSub));
+		if(pThis->inputState == eAtStrtFram && !(pThis->bSuppOctetFram && *pData >= '0' && *pData <= '9')) {
+			pThis->inputState = eInMsg;
+			pThis->eFraming = TCP_FRAMING_OCTET_STUFFING;
+		}
+		if(pThis->inputState == eInMsg
+		   && (pThis->eFraming == TCP_FRAMING_OCTET_STUFFING || pThis->iOctetsRemain > 0)) {
+			CHKiRet(processDataBulk(pThis, &pData, pEnd, &stTime, ttGenTime, &multiSub));
+		} else {
+			CHKiRet(processDataRcvd(pThis, *pData++, &stTime, ttGenTime, &multiSub));
+		}
 	}
 	iRet = multiSubmitFlush(&multiSub);
 
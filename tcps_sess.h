@@ -24,6 +24,7 @@
 
 #include "obj.h"
 #include "prop.h"
+#include "msg.h"
 
 /* a forward-definition, we are somewhat cyclic */
 struct tcpsrv_s;
@@ -45,6 +46,7 @@ struct tcps_sess_s {
 	int iOctetsRemain;	/* Number of Octets remaining in message */
 	TCPFRAMINGMODE eFraming;
 	uchar *pMsg;		/* message (fragment) received */
+	msgChain_t chain;	/* data of a large frame beyond the max msg size (see maxFrameSize) */
 	prop_t *fromHost;	/* host name we received messages from */
 	prop_t *fromHostIP;
 	void *pUsr;		/* a user-pointer */
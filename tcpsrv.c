@@ -51,6 +51,7 @@
 #include <netinet/in.h>
 #include <netdb.h>
 #include <pthread.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #if HAVE_FCNTL_H
@@ -156,9 +157,15 @@ addNewLstnPort(tcpsrv_t *pThis, uchar *pszPort, int bSuppOctetFram)
 	CHKiRet(ratelimitNew(&pEntry->ratelimiter, "tcperver", NULL));
 	ratelimitSetLinuxLike(pEntry->ratelimiter, pThis->ratelimitInterval, pThis->ratelimitBurst);
 	ratelimitSetThreadSafe(pEntry->ratelimiter);
-	STATSCOUNTER_INIT(pEntry->ctrSubmit, pEntry->mutCtrSubmit);
+	STATSCOUNTER_SHARDED_INIT(pEntry->ctrSubmit);
 	CHKiRet(statsobj.AddCounter(pEntry->stats, UCHAR_CONSTANT("submitted"),
-		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pEntry->ctrSubmit)));
+		ctrType_IntCtrSharded, CTR_FLAG_RESETTABLE, &(pEntry->ctrSubmit)));
+	STATSCOUNTER_INIT(pEntry->ctrLargeMsgs, pEntry->mutCtrLargeMsgs);
+	CHKiRet(statsobj.AddCounter(pEntry->stats, UCHAR_CONSTANT("messages.large"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pEntry->ctrLargeMsgs)));
+	STATSCOUNTER_INIT(pEntry->ctrSplitMsgs, pEntry->mutCtrSplitMsgs);
+	CHKiRet(statsobj.AddCounter(pEntry->stats, UCHAR_CONSTANT("messages.split"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pEntry->ctrSplitMsgs)));
 	CHKiRet(statsobj.ConstructFinalize(pEntry->stats));
 
 finalize_it:
@@ -599,6 +606,13 @@ processWorksetItem(tcpsrv_t *pThis, nspoll_t *pPoll, int idx, void *pUsr)
 		DBGPRINTF("New connect on NSD %p.\n", pThis->ppLstn[idx]);
 		iRet = SessAccept(pThis, pThis->ppLstnPort[idx], &pNewSess, pThis->ppLstn[idx]);
 		if(iRet == RS_RET_OK) {
+			if(pPoll != NULL && pThis->nShardsRunning > 0) {
+				/* the session is owned by a session thread from now on. Note that
+				 * we may run concurrently on pool threads, but a race on nextShard
+				 * only affects the balance.
+				 */
+				pPoll = pThis->pShards[pThis->nextShard++ % pThis->nShardsRunning].pPoll;
+			}
 			if(pPoll != NULL) {
 				CHKiRet(nspoll.Ctl(pPoll, pNewSess->pStrm, 0, pNewSess, NSDPOLL_IN, NSDPOLL_ADD));
 			}
@@ -652,6 +666,98 @@ wrkr(void *myself)
 }
 
 
+/* Session threads ("sharding"). With iShards set, each accepted session is
+ * assigned round-robin to one of iShards threads, each of which has its own
+ * poll set and handles all i/o of its sessions, including the TLS work of
+ * the netstream driver. The Run() thread then only accepts new connections.
+ * This lets busy, especially TLS, listeners use more than the few cores the
+ * worker pool is able to keep busy. Sharding requires epoll mode.
+ */
+static void *
+shardWrkr(void *arg)
+{
+	tcpsrvShard_t *const pShard = (tcpsrvShard_t*) arg;
+	nsd_epworkset_t workset[128];
+	int numEntries;
+	int i;
+	rsRetVal localRet;
+
+	while(glbl.GetGlobalInputTermState() == 0) {
+		numEntries = sizeof(workset)/sizeof(nsd_epworkset_t);
+		/* the timeout makes sure we see termination even if we miss the wakeup */
+		localRet = nspoll.Wait(pShard->pPoll, 1000, &numEntries, workset);
+		if(glbl.GetGlobalInputTermState() == 1)
+			break;
+		if(localRet != RS_RET_OK)
+			continue;
+		for(i = 0 ; i < numEntries ; ++i) {
+			processWorksetItem(pShard->pSrv, pShard->pPoll, workset[i].id, workset[i].pUsr);
+		}
+	}
+	return NULL;
+}
+
+
+/* start the session threads. If something fails, we use what we have
+ * got so far (which may be nothing, in which case all is done by Run()).
+ */
+static void
+startShards(tcpsrv_t *pThis)
+{
+	pthread_attr_t sessThrdAttr;
+	rsRetVal localRet;
+	int i;
+
+	pThis->nShardsRunning = 0;
+	if((pThis->pShards = calloc(pThis->iShards, sizeof(tcpsrvShard_t))) == NULL)
+		return;
+
+	pthread_attr_init(&sessThrdAttr);
+	pthread_attr_setstacksize(&sessThrdAttr, 4096*1024);
+	for(i = 0 ; i < pThis->iShards ; ++i) {
+		pThis->pShards[i].pSrv = pThis;
+		if((localRet = nspoll.Construct(&pThis->pShards[i].pPoll)) == RS_RET_OK) {
+			if(pThis->pszDrvrName != NULL)
+				nspoll.SetDrvrName(pThis->pShards[i].pPoll, pThis->pszDrvrName);
+			localRet = nspoll.ConstructFinalize(pThis->pShards[i].pPoll);
+		}
+		if(localRet != RS_RET_OK)
+			break;
+		if(pthread_create(&pThis->pShards[i].tid, &sessThrdAttr, shardWrkr, &pThis->pShards[i]) != 0) {
+			char errStr[1024];
+			rs_strerror_r(errno, errStr, sizeof(errStr));
+			errmsg.LogError(0, NO_ERRCODE, "tcpsrv error creating session thread %d: "
+					"%s", i, errStr);
+			break;
+		}
+		++pThis->nShardsRunning;
+	}
+	/* a poll set without thread (if any) is destructed in stopShards() */
+	pthread_attr_destroy(&sessThrdAttr);
+	DBGPRINTF("tcpsrv: %d session threads running\n", pThis->nShardsRunning);
+}
+
+
+/* stop the session threads, called when input is terminated */
+static void
+stopShards(tcpsrv_t *pThis)
+{
+	int i;
+
+	for(i = 0 ; i < pThis->nShardsRunning ; ++i)
+		pthread_kill(pThis->pShards[i].tid, SIGTTIN); /* awake from epoll_wait */
+	for(i = 0 ; i < pThis->nShardsRunning ; ++i)
+		pthread_join(pThis->pShards[i].tid, NULL);
+	for(i = 0 ; i < pThis->iShards ; ++i) {
+		if(pThis->pShards[i].pPoll != NULL)
+			nspoll.Destruct(&pThis->pShards[i].pPoll);
+	}
+	pThis->nShardsRunning = 0;
+	free(pThis->pShards);
+	pThis->pShards = NULL;
+}
+
+
 /* Process a workset, that is handle io. We become activated
  * from either select or epoll handler. We split the workload
  * out to a pool of threads, but try to avoid context switches
@@ -877,6 +983,9 @@ Run(tcpsrv_t *pThis)
 	/* flag that we are in epoll mode */
 	pThis->bUsingEPoll = RSTRUE;
 
+	if(pThis->iShards > 0)
+		startShards(pThis);
+
 	/* Add the TCP listen sockets to the list of sockets to monitor */
 	for(i = 0 ; i < pThis->iLstnCurr ; ++i) {
 		DBGPRINTF("Trying to add listener %d, pUsr=%p\n", i, pThis->ppLstn);
@@ -906,6 +1015,8 @@ Run(tcpsrv_t *pThis)
 	}
 
 finalize_it:
+	if(pThis->pShards != NULL)
+		stopShards(pThis);
 	if(pPoll != NULL)
 		nspoll.Destruct(&pPoll);
 	RETiRet;
@@ -918,6 +1029,7 @@ BEGINobjConstruct(tcpsrv) /* be sure to specify the object type also in END macr
 	pThis->iLstnMax = TCPLSTN_MAX_DEFAULT;
 	pThis->addtlFrameDelim = TCPSRV_NO_ADDTL_DELIMITER;
 	pThis->bDisableLFDelim = 0;
+	pThis->maxFrameSize = 0;
 	pThis->OnMsgReceive = NULL;
 	pThis->dfltTZ[0] = '\0';
 	pThis->ratelimitInterval = 0;
@@ -1268,6 +1380,32 @@ SetSessMax(tcpsrv_t *pThis, int iMax)
 }
 
 
+/* set number of session threads (0 - sessions are handled by the
+ * Run() thread and the worker pool)
+ */
+static rsRetVal
+SetShards(tcpsrv_t *pThis, int iShards)
+{
+	DEFiRet;
+	ISOBJ_TYPE_assert(pThis, tcpsrv);
+	pThis->iShards = iShards;
+	RETiRet;
+}
+
+
+/* set the max size of frames that are passed on as a single message, even
+ * if they are larger than the max message size (0 - max message size)
+ */
+static rsRetVal
+SetMaxFrameSize(tcpsrv_t *pThis, int maxFrameSize)
+{
+	DEFiRet;
+	ISOBJ_TYPE_assert(pThis, tcpsrv);
+	pThis->maxFrameSize = maxFrameSize;
+	RETiRet;
+}
+
+
 /* queryInterface function
  * rgerhards, 2008-02-29
  */
@@ -1318,6 +1456,8 @@ CODESTARTobjQueryInterface(tcpsrv)
 	pIf->SetRuleset = SetRuleset;
 	pIf->SetLinuxLikeRatelimiters = SetLinuxLikeRatelimiters;
 	pIf->SetNotificationOnRemoteClose = SetNotificationOnRemoteClose;
+	pIf->SetShards = SetShards;
+	pIf->SetMaxFrameSize = SetMaxFrameSize;
 
 finalize_it:
 ENDobjQueryInterface(tcpsrv)
@@ -44,10 +44,19 @@ struct tcpLstnPortList_s {
 	sbool bSuppOctetFram;	/**< do we support octect-counted framing? (if no->legay only!)*/
 	ratelimit_t *ratelimiter;
 	uchar dfltTZ[8];		/**< default TZ if none in timestamp; '\0' =No Default */
-	STATSCOUNTER_DEF(ctrSubmit, mutCtrSubmit)
+	STATSCOUNTER_SHARDED_DEF(ctrSubmit)	/* updated by all session workers */
+	STATSCOUNTER_DEF(ctrLargeMsgs, mutCtrLargeMsgs)
+	STATSCOUNTER_DEF(ctrSplitMsgs, mutCtrSplitMsgs)
 	tcpLstnPortList_t *pNext;	/**< next port or NULL */
 };
 
+/* a session thread with its own poll set, see tcpsrv.c */
+typedef struct tcpsrvShard_s {
+	tcpsrv_t *pSrv;
+	nspoll_t *pPoll;
+	pthread_t tid;
+} tcpsrvShard_t;
+
 #define TCPSRV_NO_ADDTL_DELIMITER -1 /* specifies that no additional delimiter is to be used in TCP framing */
 
 /* the tcpsrv object */
@@ -71,9 +80,14 @@ struct tcpsrv_s {
 	int iSessMax;		/**< max number of sessions supported */
 	uchar dfltTZ[8];	/**< default TZ if none in timestamp; '\0' =No Default */
 	tcpLstnPortList_t *pLstnPorts;	/**< head pointer for listen ports */
+	int iShards;		/**< number of session threads with their own poll set (0 - none) */
+	tcpsrvShard_t *pShards;	/**< the session threads */
+	int nShardsRunning;	/**< number of session threads actually started */
+	unsigned nextShard;	/**< session thread to receive the next new session */
 
 	int addtlFrameDelim;	/**< additional frame delimiter for plain TCP syslog framing (e.g. to handle NetScreen) */
 	int bDisableLFDelim;	/**< if 1, standard LF frame delimiter is disabled (*very dangerous*) */
+	int maxFrameSize;	/**< frames up to this size are not split (0 - max msg size) */
 	int ratelimitInterval;
 	int ratelimitBurst;
 	tcps_sess_t **pSessions;/**< array of all of our sessions */
@@ -153,8 +167,12 @@ BEGINinterface(tcpsrv) /* name must also be changed in ENDinterface macro! */
 	rsRetVal (*SetDfltTZ)(tcpsrv_t *pThis, uchar *dfltTZ);
 	/* added v15 -- rgerhards, 2013-09-17 */
 	rsRetVal (*SetDrvrName)(tcpsrv_t *pThis, uchar *pszName);
+	/* added v16 -- 2026-10-14 */
+	rsRetVal (*SetShards)(tcpsrv_t *pThis, int iShards);
+	/* added v17 -- 2026-10-14 */
+	rsRetVal (*SetMaxFrameSize)(tcpsrv_t *pThis, int maxFrameSize);
 ENDinterface(tcpsrv)
-#define tcpsrvCURR_IF_VERSION 15 /* increment whenever you change the interface structure! */
+#define tcpsrvCURR_IF_VERSION 17 /* increment whenever you change the interface structure! */
 /* change for v4:
  * - SetAddtlFrameDelim() added -- rgerhards, 2008-12-10
  * - SetInputName() added -- rgerhards, 2008-12-10
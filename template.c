@@ -46,6 +46,7 @@
 #include "rsconf.h"
 #include "msg.h"
 #include "unicode-helper.h"
+#include "escape.h"
 
 /* static data */
 DEFobjCurrIf(obj)
@@ -132,6 +133,201 @@ finalize_it:
 }
 
 
+/* get the characters the template escape mode escapes (see doEscape()).
+ * Returns 0 if the mode does not escape anything.
+ */
+static inline int
+tplEscapeChars(const int mode, uchar *const c1, uchar *const c2)
+{
+	switch(mode) {
+	case STDSQL_ESCAPE:
+		*c1 = *c2 = '\'';
+		return 1;
+	case SQL_ESCAPE:
+		*c1 = '\'';
+		*c2 = '\\';
+		return 1;
+	case JSON_ESCAPE:
+		*c1 = *c2 = '"';
+		return 1;
+	default:
+		*c1 = *c2 = '\0';
+		return 0;
+	}
+}
+
+
+/* append pVal to iparam at *piBuf, escaped as doEscape() does, but without
+ * building the escaped value in a temporary string.
+ */
+static rsRetVal
+tplAppendEscaped(actWrkrIParams_t *__restrict const iparam,
+		 size_t *__restrict__ const piBuf,
+		 const uchar *__restrict__ const pVal,
+		 const size_t lenVal,
+		 const int mode)
+{
+	const uchar cEsc = (mode == STDSQL_ESCAPE) ? '\'' : '\\';
+	size_t iBuf = *piBuf;
+	size_t iVal;
+	size_t lenRun;
+	uchar c1, c2;
+	DEFiRet;
+
+	tplEscapeChars(mode, &c1, &c2);
+	for(iVal = 0 ; iVal < lenVal ; ) {
+		lenRun = escScanChars(pVal + iVal, lenVal - iVal, c1, c2);
+		if(iBuf + lenRun + 2 >= iparam->lenBuf) /* we reserve one char for the final \0! */
+			CHKiRet(ExtendBuf(iparam, iBuf + lenRun + 3));
+		memcpy(iparam->param + iBuf, pVal + iVal, lenRun);
+		iBuf += lenRun;
+		iVal += lenRun;
+		if(iVal < lenVal) {
+			iparam->param[iBuf++] = cEsc;
+			iparam->param[iBuf++] = pVal[iVal++];
+		}
+	}
+	*piBuf = iBuf;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* JSON-encode a field straight into iparam at *piBuf, as MsgGetProp() would
+ * do for the "json" and "jsonf" formats, but without building the encoded
+ * value in a temporary string. The buffer is extended as needed, always
+ * keeping one byte for the final \0.
+ */
+static rsRetVal
+tplRenderJSON(const struct tplOp *__restrict__ const pOp,
+	      msg_t *__restrict__ const pMsg,
+	      actWrkrIParams_t *__restrict const iparam,
+	      size_t *__restrict__ const piBuf,
+	      struct syslogTime *const ttNow)
+{
+	struct templateEntry *const pTpe = pOp->pTpe;
+	unsigned short bMustBeFreed;
+	uchar *pVal;
+	rs_size_t iLenVal;
+	size_t iBuf = *piBuf;
+	size_t iVal;
+	size_t lenRun;
+	DEFiRet;
+
+	pVal = MsgGetPropRaw(pMsg, pTpe, &pTpe->data.field.msgProp, &iLenVal, &bMustBeFreed, ttNow);
+
+	if(pOp->jsonMode == TPLOP_JSONF) {
+		if(iBuf + pTpe->lenFieldName + 4 >= iparam->lenBuf)
+			CHKiRet(ExtendBuf(iparam, iBuf + pTpe->lenFieldName + 5));
+		iparam->param[iBuf++] = '"';
+		memcpy(iparam->param + iBuf, pTpe->fieldName, pTpe->lenFieldName);
+		iBuf += pTpe->lenFieldName;
+		memcpy(iparam->param + iBuf, "\":\"", 3);
+		iBuf += 3;
+	}
+
+	for(iVal = 0 ; iVal < (size_t) iLenVal ; ) {
+		lenRun = escScanJSON(pVal + iVal, iLenVal - iVal);
+		if(iBuf + lenRun + ESC_JSON_MAXSEQ >= iparam->lenBuf)
+			CHKiRet(ExtendBuf(iparam, iBuf + lenRun + ESC_JSON_MAXSEQ + 1));
+		memcpy(iparam->param + iBuf, pVal + iVal, lenRun);
+		iBuf += lenRun;
+		iVal += lenRun;
+		if(iVal < (size_t) iLenVal)
+			iBuf += escJSONChar(pVal[iVal++], (char*) iparam->param + iBuf);
+	}
+
+	if(pOp->jsonMode == TPLOP_JSONF) {
+		if(iBuf + 1 >= iparam->lenBuf)
+			CHKiRet(ExtendBuf(iparam, iBuf + 2));
+		iparam->param[iBuf++] = '"';
+	}
+	*piBuf = iBuf;
+
+finalize_it:
+	if(bMustBeFreed)
+		free(pVal);
+	RETiRet;
+}
+
+
+/* update the length estimate of pTpl with a string of lenStr bytes that
+ * was just rendered. The estimate is the length of the longest string of
+ * the last TPL_LENEST_WINDOW ones, which is about their 99th percentile,
+ * so that a single unusually large message does not keep it up forever.
+ * It is raised immediately if a longer string is seen.
+ */
+#define TPL_LENEST_WINDOW 128
+static inline void
+tplUpdateLenEstimate(struct template *__restrict__ const pTpl, const size_t lenStr)
+{
+	if(lenStr > pTpl->lenWindowMax)
+		pTpl->lenWindowMax = lenStr;
+	if(lenStr > pTpl->lenEstimate)
+		pTpl->lenEstimate = lenStr;
+	if(++pTpl->nWindow >= TPL_LENEST_WINDOW) {
+		pTpl->lenEstimate = pTpl->lenWindowMax;
+		pTpl->lenWindowMax = 0;
+		pTpl->nWindow = 0;
+	}
+}
+
+
+/* render the compiled ops of pTpl (see tplCompile()) into iparam */
+static rsRetVal
+tplRenderOps(struct template *__restrict__ const pTpl,
+	     msg_t *__restrict__ const pMsg,
+	     actWrkrIParams_t *__restrict const iparam,
+	     struct syslogTime *const ttNow)
+{
+	const struct tplOp *__restrict__ pOp;
+	const struct tplOp *const pOpsEnd = pTpl->pOps + pTpl->nOps;
+	const int escapeMode = pTpl->optFormatEscape;
+	size_t iBuf = 0;
+	unsigned short bMustBeFreed;
+	uchar *pVal;
+	rs_size_t iLenVal;
+	rsRetVal localRet;
+	DEFiRet;
+
+	for(pOp = pTpl->pOps ; pOp < pOpsEnd ; ++pOp) {
+		if(pOp->pTpe == NULL) {
+			if(iBuf + pOp->lenConst >= iparam->lenBuf)
+				CHKiRet(ExtendBuf(iparam, iBuf + pOp->lenConst + 1));
+			memcpy(iparam->param + iBuf, pOp->pConst, pOp->lenConst);
+			iBuf += pOp->lenConst;
+			continue;
+		}
+		if(pOp->jsonMode != TPLOP_JSON_NONE) {
+			CHKiRet(tplRenderJSON(pOp, pMsg, iparam, &iBuf, ttNow));
+			continue;
+		}
+		pVal = (uchar*) MsgGetProp(pMsg, pOp->pTpe, &pOp->pTpe->data.field.msgProp,
+					   &iLenVal, &bMustBeFreed, ttNow);
+		localRet = RS_RET_OK;
+		if(escapeMode != NO_ESCAPE) {
+			localRet = tplAppendEscaped(iparam, &iBuf, pVal, iLenVal, escapeMode);
+		} else if(iLenVal > 0) {
+			if(iBuf + iLenVal >= iparam->lenBuf) /* we reserve one char for the final \0! */
+				localRet = ExtendBuf(iparam, iBuf + iLenVal + 1);
+			if(localRet == RS_RET_OK) {
+				memcpy(iparam->param + iBuf, pVal, iLenVal);
+				iBuf += iLenVal;
+			}
+		}
+		if(bMustBeFreed)
+			free(pVal);
+		CHKiRet(localRet);
+	}
+
+	iparam->param[iBuf] = '\0';
+	iparam->lenStr = iBuf;
+finalize_it:
+	RETiRet;
+}
+
+
 /* This functions converts a template into a string.
  *
  * The function takes a pointer to a template and a pointer to a msg object
@@ -170,12 +366,24 @@ tplToString(struct template *__restrict__ const pTpl,
 		if(iLenVal >= (rs_size_t)iparam->lenBuf) /* we reserve one char for the final \0! */
 			CHKiRet(ExtendBuf(iparam, iLenVal + 1));
 		memcpy(iparam->param, pVal, iLenVal+1);
+		iparam->lenStr = iLenVal;
 		if(bMustBeFreed)
 			free(pVal);
 		FINALIZE;
 	}
 	
-	/* we have a "regular" template with template entries */
+	/* we have a "regular" template with template entries. Size the buffer
+	 * for the expected length at once instead of growing it field by field.
+	 */
+	iBuf = (pTpl->lenEstimate > pTpl->lenReserve) ? pTpl->lenEstimate : pTpl->lenReserve;
+	if(iparam->lenBuf <= iBuf)
+		CHKiRet(ExtendBuf(iparam, iBuf + 1));
+
+	if(pTpl->pOps != NULL) {
+		CHKiRet(tplRenderOps(pTpl, pMsg, iparam, ttNow));
+		tplUpdateLenEstimate(pTpl, iparam->lenStr);
+		FINALIZE;
+	}
 
 	/* loop through the template. We obtain one value
 	 * and copy it over to our dynamic string buffer. Then, we
@@ -231,6 +439,7 @@ tplToString(struct template *__restrict__ const pTpl,
 	}
 	iparam->param[iBuf] = '\0';
 	iparam->lenStr = iBuf;
+	tplUpdateLenEstimate(pTpl, iBuf);
 	
 finalize_it:
 	RETiRet;
@@ -323,6 +532,7 @@ tplToJSON(struct template *pTpl, msg_t *pMsg, struct json_object **pjson, struct
 	DEFiRet;
 
 	if(pTpl->bHaveSubtree){
+		msgVarsToJSON(pMsg);
 		localRet = jsonFind(pMsg->json, &pTpl->subtree, pjson);
 		if(*pjson == NULL) {
 			/* we need to have a root object! */
@@ -430,8 +640,12 @@ rsRetVal
 doEscape(uchar **pp, rs_size_t *pLen, unsigned short *pbMustBeFreed, int mode)
 {
 	DEFiRet;
-	uchar *p = NULL;
+	uchar *p;
 	int iLen;
+	size_t lenSrc;
+	size_t iSrc;
+	size_t iRun;
+	uchar c1, c2;
 	cstr_t *pStrB = NULL;
 	uchar *pszGenerated;
 
@@ -440,39 +654,32 @@ doEscape(uchar **pp, rs_size_t *pLen, unsigned short *pbMustBeFreed, int mode)
 	assert(pLen != NULL);
 	assert(pbMustBeFreed != NULL);
 
+	if(!tplEscapeChars(mode, &c1, &c2))
+		FINALIZE;
+
 	/* first check if we need to do anything at all... */
-	if(mode == STDSQL_ESCAPE)
-		for(p = *pp ; *p && *p != '\'' ; ++p)
-			;
-	else if(mode == SQL_ESCAPE)
-		for(p = *pp ; *p && *p != '\'' && *p != '\\' ; ++p)
-			;
-	else if(mode == JSON_ESCAPE)
-		for(p = *pp ; *p && *p != '"' ; ++p)
-			;
-	/* when we get out of the loop, we are either at the
-	 * string terminator or the first character to escape */
-	if(p && *p == '\0')
+	p = *pp;
+	lenSrc = (size_t) *pLen;
+	iSrc = escScanChars(p, lenSrc, c1, c2);
+	if(iSrc == lenSrc)
 		FINALIZE; /* nothing to do in this case! */
 
-	p = *pp;
+	/* we now copy everything up to the next character to escape in one
+	 * go. The escaped character itself is copied as part of the next run,
+	 * so we only need to add the escape in front of it.
+	 */
 	iLen = *pLen;
+	iRun = 0;
 	CHKiRet(cstrConstruct(&pStrB));
-
-	while(*p) {
-		if((mode == SQL_ESCAPE || mode == STDSQL_ESCAPE) && *p == '\'') {
-			CHKiRet(cstrAppendChar(pStrB, (mode == STDSQL_ESCAPE) ? '\'' : '\\'));
-			iLen++;	/* reflect the extra character */
-		} else if((mode == SQL_ESCAPE) && *p == '\\') {
-			CHKiRet(cstrAppendChar(pStrB, '\\'));
-			iLen++;	/* reflect the extra character */
-		} else if((mode == JSON_ESCAPE) && *p == '"') {
-			CHKiRet(cstrAppendChar(pStrB, '\\'));
-			iLen++;	/* reflect the extra character */
-		}
-		CHKiRet(cstrAppendChar(pStrB, *p));
-		++p;
+	while(iSrc < lenSrc) {
+		CHKiRet(rsCStrAppendStrWithLen(pStrB, p + iRun, iSrc - iRun));
+		CHKiRet(cstrAppendChar(pStrB, (mode == STDSQL_ESCAPE) ? '\'' : '\\'));
+		iLen++;	/* reflect the extra character */
+		iRun = iSrc;
+		++iSrc;
+		iSrc += escScanChars(p + iSrc, lenSrc - iSrc, c1, c2);
 	}
+	CHKiRet(rsCStrAppendStrWithLen(pStrB, p + iRun, lenSrc - iRun));
 	CHKiRet(cstrFinalize(pStrB));
 	CHKiRet(cstrConvSzStrAndDestruct(pStrB, &pszGenerated, 0));
 
@@ -745,6 +952,21 @@ static void doOptions(unsigned char **pp, struct templateEntry *pTpe)
 }
 
 
+/* get the regexp.regcomp() flags for a template regex type */
+static inline int
+tplRegexOptions(const enum tplRegexType typeRegex)
+{
+	switch(typeRegex) {
+	case TPL_REGEX_ERE:
+		return REG_EXTENDED;
+	case TPL_REGEX_PCRE:
+		return RS_REG_PCRE;
+	default:
+		return 0;
+	}
+}
+
+
 /* helper to tplAddLine. Parses a parameter and generates
  * the necessary structure.
  */
@@ -803,6 +1025,9 @@ do_Parameter(uchar **pp, struct template *pTpl)
 				} else if(p[0] == 'E' && p[1] == 'R' && p[2] == 'E' && (p[3] == ',' || p[3] == ':')) {
 					pTpe->data.field.typeRegex = TPL_REGEX_ERE;
 					p += 3; /* eat indicator sequence */
+				} else if(!strncmp((char*) p, "PCRE", 4) && (p[4] == ',' || p[4] == ':')) {
+					pTpe->data.field.typeRegex = TPL_REGEX_PCRE;
+					p += 4; /* eat indicator sequence */
 				} else {
 					errmsg.LogError(0, NO_ERRCODE, "error: invalid regular expression type, rest of line %s",
 				               (char*) p);
@@ -981,7 +1206,7 @@ do_Parameter(uchar **pp, struct template *pTpl)
 				/* Remember that the re is an attribute of the Template entry */
 				if((iRetLocal = objUse(regexp, LM_REGEXP_FILENAME)) == RS_RET_OK) {
 					int iOptions;
-					iOptions = (pTpe->data.field.typeRegex == TPL_REGEX_ERE) ? REG_EXTENDED : 0;
+					iOptions = tplRegexOptions(pTpe->data.field.typeRegex);
 					if(regexp.regcomp(&(pTpe->data.field.re), (char*) regex_char, iOptions) != 0) {
 						dbgprintf("error: can not compile regex: '%s'\n", regex_char);
 						pTpe->data.field.has_regex = 2;
@@ -1154,6 +1379,141 @@ finalize_it:
 }
 
 
+/* length of a field if it is known at config time (0 otherwise). This is
+ * just an estimate to size the output buffer and not relied upon.
+ */
+static int
+tplFixedFieldLen(struct templateEntry *pTpe)
+{
+	if(pTpe->bComplexProcessing)
+		return 0;
+	switch(pTpe->data.field.msgProp.id) {
+	case PROP_SYS_NOW:
+		return 10; /* YYYY-MM-DD */
+	case PROP_TIMESTAMP:
+	case PROP_TIMEGENERATED:
+		break;
+	default:
+		return 0;
+	}
+	switch(pTpe->data.field.eDateFormat) {
+	case tplFmtDefault:
+	case tplFmtRFC3164Date:
+	case tplFmtRFC3164BuggyDate:
+		return CONST_LEN_TIMESTAMP_3164;
+	case tplFmtMySQLDate:
+		return 14;
+	case tplFmtPgSQLDate:
+		return 19;
+	default:
+		return 0;
+	}
+}
+
+
+/* check if a field can be JSON-encoded by tplRenderJSON(). This is the case
+ * if the json or jsonf format is its only option that MsgGetProp() applies
+ * and the template itself does not escape.
+ */
+static char
+tplOpJSONMode(struct template *pTpl, struct templateEntry *pTpe)
+{
+	if(   pTpl->optFormatEscape != NO_ESCAPE
+	   || !(pTpe->data.field.options.bJSON || pTpe->data.field.options.bJSONf)
+	   || pTpe->data.field.iFromPos != 0 || pTpe->data.field.iToPos != 0
+	   || pTpe->data.field.has_fields
+#ifdef FEATURE_REGEXP
+	   || pTpe->data.field.has_regex
+#endif
+	   || pTpe->data.field.eCaseConv != tplCaseConvNo
+	   || pTpe->data.field.options.bDropCC || pTpe->data.field.options.bSpaceCC
+	   || pTpe->data.field.options.bEscapeCC || pTpe->data.field.options.bDropLastLF
+	   || pTpe->data.field.options.bSecPathDrop || pTpe->data.field.options.bSecPathReplace
+	   || pTpe->data.field.options.bSPIffNo1stSP || pTpe->data.field.options.bCSV)
+		return TPLOP_JSON_NONE;
+	if(pTpe->data.field.options.bJSON)
+		return TPLOP_JSON;
+	return (pTpe->fieldName == NULL) ? TPLOP_JSON_NONE : TPLOP_JSONF;
+}
+
+
+/* Compile the entry list of pTpl into a flat array of render ops for
+ * tplToString(). Adjacent constants are merged into one op and all
+ * constants are copied into a single buffer, so rendering is a loop over
+ * the array without list walking and type dispatch. Field option
+ * processing is already skipped by MsgGetProp() for fields without
+ * options. If we run out of memory, the template is simply not compiled.
+ * We also record here if the output depends on the time of the call, in
+ * which case it must not be shared between actions (see action.c).
+ */
+static void
+tplCompile(struct template *pTpl)
+{
+	struct templateEntry *pTpe;
+	struct tplOp *pOps = NULL;
+	struct tplOp *pOp;
+	uchar *pConsts = NULL;
+	size_t lenConsts = 0;
+	int nOps = 0;
+	int propid;
+
+	pTpl->bUsesSysTime = 0;
+	for(pTpe = pTpl->pEntryRoot ; pTpe != NULL ; pTpe = pTpe->pNext) {
+		if(pTpe->eEntryType != FIELD)
+			continue;
+		propid = pTpe->data.field.msgProp.id;
+		if(   (propid >= PROP_SYS_NOW && propid <= PROP_SYS_MINUTE)
+		   || propid == PROP_SYS_UPTIME || propid == PROP_GLOBAL_VAR)
+			pTpl->bUsesSysTime = 1;
+	}
+
+	if(pTpl->pStrgen != NULL || pTpl->bHaveSubtree || pTpl->pEntryRoot == NULL)
+		return;
+
+	for(pTpe = pTpl->pEntryRoot ; pTpe != NULL ; pTpe = pTpe->pNext) {
+		if(pTpe->eEntryType == CONSTANT)
+			lenConsts += pTpe->data.constant.iLenConstant;
+		if(pTpe->eEntryType == FIELD || pTpe->eEntryType == CONSTANT)
+			++nOps;
+	}
+	if((pOps = calloc(nOps, sizeof(struct tplOp))) == NULL
+	   || (pConsts = malloc(lenConsts + 1)) == NULL)
+		goto fail;
+
+	pTpl->lenReserve = 0;
+	nOps = 0;
+	lenConsts = 0;
+	pOp = NULL;
+	for(pTpe = pTpl->pEntryRoot ; pTpe != NULL ; pTpe = pTpe->pNext) {
+		if(pTpe->eEntryType == CONSTANT) {
+			if(pOp == NULL || pOp->pTpe != NULL) {
+				pOp = pOps + nOps++;
+				pOp->pConst = pConsts + lenConsts;
+			}
+			memcpy(pConsts + lenConsts, pTpe->data.constant.pConstant,
+			       pTpe->data.constant.iLenConstant);
+			lenConsts += pTpe->data.constant.iLenConstant;
+			pOp->lenConst += pTpe->data.constant.iLenConstant;
+		} else if(pTpe->eEntryType == FIELD) {
+			pOp = pOps + nOps++;
+			pOp->pTpe = pTpe;
+			pOp->jsonMode = tplOpJSONMode(pTpl, pTpe);
+			pTpl->lenReserve += tplFixedFieldLen(pTpe);
+		}
+	}
+	pTpl->lenReserve += lenConsts;
+	pTpl->pOps = pOps;
+	pTpl->nOps = nOps;
+	pTpl->pOpConsts = pConsts;
+	DBGPRINTF("template '%s' compiled into %d ops\n", pTpl->pszName, nOps);
+	return;
+
+fail:
+	free(pOps);
+	free(pConsts);
+}
+
+
 /* Add a new template line
  * returns pointer to new object if it succeeds, NULL otherwise.
  */
@@ -1290,6 +1650,7 @@ struct template *tplAddLine(rsconf_t *conf, char* pName, uchar** ppRestOfConfLin
 	}
 
 	*ppRestOfConfLine = p;
+	tplCompile(pTpl);
 
 	return(pTpl);
 }
@@ -1413,6 +1774,8 @@ createPropertyTpe(struct template *pTpl, struct cnfobj *o)
 				re_type = TPL_REGEX_BRE;
 			} else if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"ERE", sizeof("ERE")-1)) {
 				re_type = TPL_REGEX_ERE;
+			} else if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"PCRE", sizeof("PCRE")-1)) {
+				re_type = TPL_REGEX_PCRE;
 			} else {
 				uchar *typeStr = (uchar*) es_str2cstr(pvals[i].val.d.estr, NULL);
 				errmsg.LogError(0, RS_RET_ERR, "invalid regex.type '%s' for property",
@@ -1631,7 +1994,7 @@ createPropertyTpe(struct template *pTpl, struct cnfobj *o)
 		pTpe->data.field.has_regex = 1;
 		if((iRetLocal = objUse(regexp, LM_REGEXP_FILENAME)) == RS_RET_OK) {
 			int iOptions;
-			iOptions = (pTpe->data.field.typeRegex == TPL_REGEX_ERE) ? REG_EXTENDED : 0;
+			iOptions = tplRegexOptions(pTpe->data.field.typeRegex);
 			if(regexp.regcomp(&(pTpe->data.field.re), (char*) re_expr, iOptions) != 0) {
 				dbgprintf("error: can not compile regex: '%s'\n", re_expr);
 				errmsg.LogError(0, NO_ERRCODE, "error compiling regex '%s'", re_expr);
@@ -1874,6 +2237,7 @@ tplProcessCnf(struct cnfobj *o)
 		pTpl->optFormatEscape = SQL_ESCAPE;
 	else if(o_json)
 		pTpl->optFormatEscape = JSON_ESCAPE;
+	tplCompile(pTpl);
 
 finalize_it:
 	free(tplStr);
@@ -1968,6 +2332,8 @@ void tplDeleteAll(rsconf_t *conf)
 		free(pTplDel->pszName);
 		if(pTplDel->bHaveSubtree)
 			msgPropDescrDestruct(&pTplDel->subtree);
+		free(pTplDel->pOps);
+		free(pTplDel->pOpConsts);
 		free(pTplDel);
 	}
 	ENDfunc
@@ -2026,6 +2392,8 @@ void tplDeleteNew(rsconf_t *conf)
 		free(pTplDel->pszName);
 		if(pTplDel->bHaveSubtree)
 			msgPropDescrDestruct(&pTplDel->subtree);
+		free(pTplDel->pOps);
+		free(pTplDel->pOpConsts);
 		free(pTplDel);
 	}
 	ENDfunc
@@ -45,6 +45,20 @@ struct template {
 	int tpenElements; /* number of elements in templateEntry list */
 	struct templateEntry *pEntryRoot;
 	struct templateEntry *pEntryLast;
+	/* the entry list compiled for tplToString(), see tplCompile() */
+	struct tplOp *pOps;	/* NULL if not compiled, then the list is used */
+	int nOps;
+	uchar *pOpConsts;	/* all constants, adjacent ones merged into one op */
+	size_t lenReserve;	/* minimum length of the rendered string */
+	/* running estimate of the rendered length, used to size output buffers
+	 * up front (see tplUpdateLenEstimate()). Updated without locking by all
+	 * workers, a lost update only makes the estimate a bit less accurate.
+	 */
+	size_t lenEstimate;
+	size_t lenWindowMax;	/* longest string rendered in the current window */
+	unsigned nWindow;	/* number of strings rendered in the current window */
+	int nActRefs;		/* number of action parameters using this template */
+	sbool bUsesSysTime;	/* has $NOW-type properties, output depends on call time */
 	char optFormatEscape;	/* in text fields, */
 #	define NO_ESCAPE 0	/* 0 - do not escape, */
 #	define SQL_ESCAPE 1	/* 1 - escape "the MySQL way"  */
@@ -62,7 +76,8 @@ enum tplFormatTypes { tplFmtDefault = 0, tplFmtMySQLDate = 1,
 		      tplFmtSecFrac = 5, tplFmtRFC3164BuggyDate = 6, tplFmtUnixDate};
 enum tplFormatCaseConvTypes { tplCaseConvNo = 0, tplCaseConvUpper = 1, tplCaseConvLower = 2 };
 enum tplRegexType { TPL_REGEX_BRE = 0, /* posix BRE */
-		    TPL_REGEX_ERE = 1  /* posix ERE */
+		    TPL_REGEX_ERE = 1, /* posix ERE */
+		    TPL_REGEX_PCRE = 2 /* PCRE, see regexp.h */
 		  };
 
 #include "msg.h"
@@ -85,7 +100,7 @@ struct templateEntry {
 			unsigned iToPos;	/* up to that one... */
 			unsigned iFieldNr;	/* for field extraction: field to extract */
 #ifdef FEATURE_REGEXP
-			regex_t re;	/* APR: this is the regular expression */
+			rsregex_t re;	/* APR: this is the regular expression */
 			short has_regex;
 			short iMatchToUse;/* which match should be obtained (10 max) */
 			short iSubMatchToUse;/* which submatch should be obtained (10 max) */
@@ -126,6 +141,20 @@ struct templateEntry {
 };
 
 
+/* a render op of a compiled template: either a (merged) constant or
+ * a field, which is rendered via MsgGetProp().
+ */
+struct tplOp {
+	struct templateEntry *pTpe;	/* field to render, NULL for a constant */
+	uchar *pConst;			/* constant, points into pOpConsts */
+	int lenConst;
+	char jsonMode;			/* field is JSON-encoded straight into the output: */
+#	define TPLOP_JSON_NONE 0	/* no (regular MsgGetProp() processing) */
+#	define TPLOP_JSON 1		/* as value (format "json") */
+#	define TPLOP_JSONF 2		/* as name/value pair (format "jsonf") */
+};
+
+
 /* interfaces */
 BEGINinterface(tpl) /* name must also be changed in ENDinterface macro! */
 ENDinterface(tpl)
@@ -0,0 +1,19 @@
+# Test for the per-worker arena that keeps the parameters of transactional
+# actions. Messages of random size, many of them above the size that gets
+# a chunk of its own, are written by a multi-worker action queue with
+# large batches. Every line must arrive completely and unmixed.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[actarena.sh\]: testing action parameter arena
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup actarena.conf
+source $srcdir/diag.sh tcpflood -m5000 -r -d30000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 4999
+awk -F, 'length($3) != $2 || $3 ~ /[^X]/ { print "bad line " NR ": " substr($0, 1, 80); exit 1 }' rsyslog.out.log
+if [ "$?" -ne "0" ]; then
+  echo "message content error detected"
+  exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,18 @@
+# check that a suspended action is resumed after its resume interval.
+# The action is suspended by the 10th message and must stay suspended
+# for the rest of the first burst, which thus goes to the file. After the
+# resume interval, the timer wheel marks the action for retry and the
+# second burst is handled by the action itself.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[action-resume.sh\]: test action resume via the timer wheel
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup action-resume.conf
+source $srcdir/diag.sh injectmsg 0 15
+source $srcdir/diag.sh wait-queueempty
+sleep 3 # resume interval is 1 second
+source $srcdir/diag.sh injectmsg 15 5
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 9 14
+source $srcdir/diag.sh exit
@@ -0,0 +1,13 @@
+# Test for the action call latency and batch size histograms
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[actionhist.sh\]: testing the action histograms
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup actionhist.conf
+
+# 40000 messages should be enough
+source $srcdir/diag.sh injectmsg  0 40000
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown 
+source $srcdir/diag.sh seq-check 0 39999
+source $srcdir/diag.sh exit
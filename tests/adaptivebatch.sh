@@ -0,0 +1,27 @@
+# Test for adaptive dequeue batch sizing. Dequeue is slowed down so that
+# every batch takes longer than queue.dequeuebatchtarget, so the batch
+# size must be halved after each batch. With 2000 messages, there are at
+# least six batches, so it must end up at 16 or less.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[adaptivebatch.sh\]: testing adaptive dequeue batch sizing
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup adaptivebatch.conf
+source $srcdir/diag.sh injectmsg  0 2000
+source $srcdir/diag.sh wait-queueempty
+sleep 3 # let impstats emit at least one line after the burst
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 1999
+grep " main Q: " rsyslog.out.stats.log | tail -1 | awk '{
+	for(i = 1 ; i <= NF ; ++i) {
+		split($i, kv, "=")
+		if(kv[1] == "dequeue.batchsize") size = kv[2]
+	}
+} END { exit (size >= 8 && size <= 16) ? 0 : 1 }'
+if [ $? -ne 0 ]; then
+	echo "dequeue batch size was not adapted, stats are:"
+	cat rsyslog.out.stats.log
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,14 @@
+# Test for failed asynchronous transactions. Every 5th transaction is
+# completed with RS_RET_SUSPENDED without being written. Its messages must
+# be re-enqueued and written by a later transaction, so that in the end
+# every message is written exactly once.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[asynccommit-fail.sh\]: test for re-enqueue of failed asynchronous transactions
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup asynccommit-fail.conf
+source $srcdir/diag.sh injectmsg 0 10000
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh exit
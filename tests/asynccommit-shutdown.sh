@@ -0,0 +1,36 @@
+# Test for shutdown while asynchronous transactions are still pending. In
+# the first run the test output module never completes its transactions.
+# Shutdown must nevertheless finish within the configured timeouts and
+# the messages of the abandoned transactions must be saved together with
+# the rest of the queue. The second run completes normally and must write
+# all messages. Duplicates are not expected, but permitted, as is usual
+# for forced shutdowns.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[asynccommit-shutdown.sh\]: test for shutdown with pending asynchronous transactions
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup asynccommit-shutdown.conf
+source $srcdir/diag.sh injectmsg 0 5000
+./msleep 1000
+$srcdir/diag.sh shutdown-immediate
+i=0
+while test -f rsyslog.pid; do
+	./msleep 100
+	let "i++"
+	if test $i -gt 100; then
+		echo "FAIL: rsyslogd did not shut down within 10 seconds"
+		kill -9 `cat rsyslog.pid`
+		exit 1
+	fi
+done
+if [ -s rsyslog.out.log ]; then
+	echo "FAIL: messages written although all transactions were held"
+	exit 1
+fi
+
+# restart engine and have the saved messages processed
+source $srcdir/diag.sh startup asynccommit-shutdown2.conf
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 4999 -d
+source $srcdir/diag.sh exit
@@ -0,0 +1,14 @@
+# Test for asynchronous transaction commit. The test output module completes
+# its transactions from a separate thread after a short delay, so each
+# action worker has several transactions in flight. All messages must be
+# written exactly once.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[asynccommit.sh\]: test for asynchronous transaction commit
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup asynccommit.conf
+source $srcdir/diag.sh injectmsg 0 20000
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 19999
+source $srcdir/diag.sh exit
@@ -0,0 +1,13 @@
+# Test for compact $! variables (global(variables.compact="on")). Variables
+# are set, overwritten, used in filters and templates and finally the
+# full tree is requested via a container, which must contain all of them.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[compactvars.sh\]: testing compact $! variables
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup compactvars.conf
+source $srcdir/diag.sh injectmsg  0 10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh exit
@@ -0,0 +1,21 @@
+# Test for omfile compression.driver="zlib". The output is written once as
+# a single compressed stream and once with veryRobustZip="on"; both must
+# decompress to all messages in order.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[compression-zlib.sh\]: test for the zlib compression driver
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup compression-zlib.conf
+source $srcdir/diag.sh tcpflood -m4000 -r -d5000 -P129
+sleep 1 # due to large messages, we need this time for the tcp receiver to settle...
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown       # and wait for it to terminate
+gunzip < rsyslog.out.zip.log > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 3999 -E
+gunzip < rsyslog.out.robust.log > rsyslog.out.robust.plain.log
+cmp rsyslog.out.log rsyslog.out.robust.plain.log
+if [ $? -ne 0 ]; then
+	echo "veryRobustZip output differs from regular output"
+	exit 1
+fi
+source $srcdir/diag.sh exit
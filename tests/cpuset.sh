@@ -0,0 +1,24 @@
+# Test for queue.cpuset and the imudp cpuset parameter. The main queue
+# worker, the action queue worker and the imudp receiver are bound to
+# CPU 0. All messages must still be processed and, where /proc shows it,
+# at least these three threads must be restricted to CPU 0.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[cpuset.sh\]: test for binding worker threads to CPUs
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup cpuset.conf
+source $srcdir/diag.sh tcpflood -m10000
+source $srcdir/diag.sh wait-queueempty
+if [ -d /proc/`cat rsyslog.pid`/task ]; then
+	nbound=`grep -h '^Cpus_allowed_list:' /proc/\`cat rsyslog.pid\`/task/*/status | awk '$2 == "0"' | wc -l`
+	if [ "$nbound" -lt 3 ]; then
+		echo "FAIL: only $nbound threads are bound to CPU 0, expected at least 3"
+		grep -H '^Cpus_allowed_list:' /proc/`cat rsyslog.pid`/task/*/status
+		. $srcdir/diag.sh shutdown-immediate
+		exit 1
+	fi
+fi
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh exit
@@ -0,0 +1,37 @@
+# Test for encryption with the authenticated GCM mode. The encrypted file
+# consists of many write buffers, each one encrypted as a block of its
+# own. rscryutil must decrypt it completely, and after one byte has been
+# modified it must report an authentication failure.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[cry-gcm.sh\]: test lmcry_gcry with cry.mode GCM
+source $srcdir/diag.sh init
+rm -f rsyslog.out.log.encinfo
+source $srcdir/diag.sh startup cry-gcm.conf
+source $srcdir/diag.sh tcpflood -m20000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+if grep -q "00000100" rsyslog.out.log ; then
+	echo "file is not encrypted"
+	exit 1
+fi
+mv rsyslog.out.log rsyslog.out.enc
+mv rsyslog.out.log.encinfo rsyslog.out.enc.encinfo
+../tools/rscryutil -K 1234567890123456 -a AES128 -m GCM rsyslog.out.enc > rsyslog.out.log 2> rsyslog.out.err
+if [ -s rsyslog.out.err ]; then
+	echo "decryption failed:"
+	cat rsyslog.out.err
+	exit 1
+fi
+source $srcdir/diag.sh seq-check 0 19999
+# flip one byte in the middle of the file
+dd if=rsyslog.out.enc bs=1 skip=50000 count=1 2>/dev/null | tr '\000-\377' '\001-\377\000' | \
+	dd of=rsyslog.out.enc bs=1 seek=50000 conv=notrunc 2>/dev/null
+../tools/rscryutil -K 1234567890123456 -a AES128 -m GCM rsyslog.out.enc > /dev/null 2> rsyslog.out.err
+if ! grep -q "failed authentication" rsyslog.out.err ; then
+	echo "modified file was not detected:"
+	cat rsyslog.out.err
+	exit 1
+fi
+rm -f rsyslog.out.enc rsyslog.out.enc.encinfo rsyslog.out.err
+source $srcdir/diag.sh exit
@@ -0,0 +1,16 @@
+# Test for the DA spill, which writes whole batches to the disk queue
+# without holding the queue mutex. A small in-memory queue and small
+# queue files make sure that many batches are spilled and files are
+# switched while the disk queue is being read.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo "[da-spill.sh]: testing batch spill to the disk part of a DA queue"
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup da-spill.conf
+
+source $srcdir/diag.sh injectmsg 0 20000
+
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 19999
+source $srcdir/diag.sh exit
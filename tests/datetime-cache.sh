@@ -0,0 +1,21 @@
+# Test for the per-thread cache in the datetime formatting functions.
+# Template date options render the reported time (UTC) and the reception
+# time (local time) in several formats, interleaved, so that cache
+# entries of both time zones are used at the same time.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[datetime-cache.sh\]: testing datetime formatting cache
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup datetime-cache.conf
+source $srcdir/diag.sh tcpflood -m10000 -y
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999
+awk -F, '$2 != "2003-03-01T01:00:00.000Z" || $3 !~ /^[0-9][0-9][0-9][0-9]-[0-9][0-9]-[0-9][0-9]T/ ||
+	 $4 != "Mar  1 01:00:00" || $5 != "2003-03-01 01:00:00" || $6 != "1046480400" ||
+	 $7 != $3 || $8 != $2 { print "bad timestamp in line " NR ": " $0; exit 1 }' rsyslog.out.log
+if [ "$?" -ne "0" ]; then
+  echo "datetime cache error detected"
+  exit 1
+fi
+source $srcdir/diag.sh exit
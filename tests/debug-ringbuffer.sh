@@ -0,0 +1,27 @@
+# Test for the RSYSLOG_DEBUG options RingBuffer and Subsystem. rsyslogd
+# runs with debug output buffered in per-thread rings and restricted to
+# omfile.c. Debug messages from omfile must be written, those of other
+# source files must not, and message processing must not be affected.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[debug-ringbuffer.sh\]: test debug ring buffers and subsystem filter
+source $srcdir/diag.sh init
+rm -f rsyslog.out.debug.log
+export RSYSLOG_DEBUG="Debug NoStdOut RingBuffer=256 Subsystem=omfile"
+export RSYSLOG_DEBUGLOG="rsyslog.out.debug.log"
+source $srcdir/diag.sh startup debug-ringbuffer.conf
+unset RSYSLOG_DEBUG RSYSLOG_DEBUGLOG
+source $srcdir/diag.sh tcpflood -m10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999
+if ! grep -q "omfile: write to stream" rsyslog.out.debug.log; then
+	echo "debug messages of omfile.c missing"
+	exit 1
+fi
+if grep -q "msg parser: flags" rsyslog.out.debug.log; then
+	echo "debug messages of parser.c not filtered"
+	exit 1
+fi
+rm -f rsyslog.out.debug.log
+source $srcdir/diag.sh exit
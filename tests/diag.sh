@@ -165,6 +165,15 @@ case $1 in
 		fi
 		rm -f work2
 		;;
+   'get-stat')  # print the last value of impstats counter $3 of stats object $2
+		# (as written to rsyslog.out.stats.log), empty if not found
+		grep -F " $2: " rsyslog.out.stats.log | tail -1 | awk -v name="$3" '{
+			for(i = 1 ; i <= NF ; ++i) {
+				split($i, kv, "=")
+				if(kv[1] == name) n = kv[2]
+			}
+		} END { print n }'
+		;;
    'gzip-seq-check') # do the usual sequence check, but for gzip files
 		rm -f work
 		ls -l rsyslog.out.log
@@ -184,6 +193,16 @@ case $1 in
 		  exit 1
 		fi
 		;;
+   'es-init')   # initialize local Elasticsearch *testbench* instance for the next
+                # test. NOTE: do NOT put anything useful on that instance!
+		curl -s -XDELETE localhost:9200/rsyslog_testbench > /dev/null
+		;;
+   'es-getdata') # read data from ES to a local file so that we can process it
+		# with out regular tooling. $2 is the number of records to read.
+		curl -s -XPOST localhost:9200/rsyslog_testbench/_refresh > /dev/null
+		curl -s "localhost:9200/rsyslog_testbench/_search?size=$2" > work
+		grep -o '"msgnum":"[0-9]*"' work | cut -d'"' -f4 > rsyslog.out.log
+		;;
    'setzcat')   # find out name of zcat tool
 		if [ `uname` == SunOS ]; then
 		   ZCAT=gzcat
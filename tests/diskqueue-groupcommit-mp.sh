@@ -0,0 +1,15 @@
+# Test for disk-only queue mode with group commit and several concurrent
+# producers. The group commit delay is very long, so the test only finishes
+# in time if the group leader syncs as soon as no producer is waiting any
+# longer instead of sleeping the full delay for each group.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[diskqueue-groupcommit-mp.sh\]: testing queue disk-only mode, group commit with multiple producers
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup diskqueue-groupcommit-mp.conf
+source $srcdir/diag.sh tcpflood -c10 -m20000
+source $srcdir/diag.sh injectmsg 20000 1000
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 20999
+source $srcdir/diag.sh exit
@@ -0,0 +1,13 @@
+# Test for disk-only queue mode with group commit for synced queue files
+# This checks that messages are correctly written and read back when the
+# queue files are synced in groups instead of after each write.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[diskqueue-groupcommit.sh\]: testing queue disk-only mode, group commit case
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup diskqueue-groupcommit.conf
+source $srcdir/diag.sh injectmsg 0 5000
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 4999
+source $srcdir/diag.sh exit
@@ -0,0 +1,13 @@
+# Test for disk-only queue mode with memory-mapped queue segments
+# The max file size is small, so that many segments are written, read
+# back and deleted.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[diskqueue-mmap.sh\]: testing queue disk-only mode, mmap segments
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup diskqueue-mmap.conf
+source $srcdir/diag.sh tcpflood -m20000
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 19999
+source $srcdir/diag.sh exit
@@ -0,0 +1,20 @@
+# Test for structured data passing through a disk queue. RFC5424 messages
+# with structured data are processed by an action with a disk queue, so
+# every message is written to and read back from a queue file. The
+# structured data of each message must still be present afterwards.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[diskqueue-sd.sh\]: testing structured data in disk queue records
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup diskqueue-sd.conf
+source $srcdir/diag.sh tcpflood -m10000 -y
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999
+awk '$2 != "[tcpflood@32473" || $3 != "MSGNUM=\"" $1 "\"]" { print "bad line: " $0 ; nBad++ }
+     END { exit nBad > 0 }' rsyslog.out.log
+if [ $? -ne 0 ]; then
+	echo "structured data lost in disk queue"
+	exit 1
+fi
+source $srcdir/diag.sh exit
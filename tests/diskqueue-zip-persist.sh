@@ -0,0 +1,24 @@
+# Test for restarting a disk queue with compressed queue files. Messages
+# are processed slowly, so that a backlog is left at shutdown. After the
+# restart, the reader must be positioned inside a compressed file.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[diskqueue-zip-persist.sh\]: testing restart of disk queue with compressed files
+source $srcdir/diag.sh init
+
+echo "*.*     :omtesting:sleep 0 1000" > work-delay.conf
+source $srcdir/diag.sh startup diskqueue-zip-persist.conf
+source $srcdir/diag.sh injectmsg 0 5000
+$srcdir/diag.sh shutdown-immediate
+$srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh check-mainq-spool
+
+# restart engine and have rest processed
+echo "#" > work-delay.conf
+source $srcdir/diag.sh startup diskqueue-zip-persist.conf
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+./msleep 500
+$srcdir/diag.sh wait-shutdown
+# duplicates are permitted, see queue-persist-drvr.sh
+source $srcdir/diag.sh seq-check 0 4999 -d
+source $srcdir/diag.sh exit
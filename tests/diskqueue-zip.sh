@@ -0,0 +1,13 @@
+# Test for disk-only queue mode with compressed queue files
+# The max file size is small, so that many files are written, read
+# back and deleted.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[diskqueue-zip.sh\]: testing queue disk-only mode, compressed files
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup diskqueue-zip.conf
+source $srcdir/diag.sh tcpflood -m20000
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 19999
+source $srcdir/diag.sh exit
@@ -0,0 +1,27 @@
+# Test for dnscache.expire, dnscache.negativeExpire and dnscache.maxEntries.
+# Messages are sent in three bursts, with pauses longer than the expiry
+# time in between, so the cache entry for 127.0.0.1 is queried again.
+# All messages must arrive, and all must carry the name of 127.0.0.1.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[dnscache-expire.sh\]: test for dnscache expiry
+RESOLVED=`getent hosts 127.0.0.1 | awk '{ print $2 }'`
+if [ -z "$RESOLVED" ]; then
+	exit 77 # 127.0.0.1 cannot be resolved, skip this test
+fi
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup dnscache-expire.conf
+source $srcdir/diag.sh tcpflood -m1000
+sleep 2
+source $srcdir/diag.sh tcpflood -m1000 -i1000
+sleep 2
+source $srcdir/diag.sh tcpflood -m1000 -i2000
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 2999
+if [ "`sort -u rsyslog.out.host.log`" != "$RESOLVED" ]; then
+	echo "fromhost wrong, expected $RESOLVED, got:"
+	sort rsyslog.out.host.log | uniq -c
+	exit 1
+fi
+source $srcdir/diag.sh exit
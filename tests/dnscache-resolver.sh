@@ -0,0 +1,27 @@
+# Test for dnscache.resolver.threads and dnscache.resolver.queueSize. The
+# first connection may still see the IP address as fromhost, as the name is
+# resolved in the background. Once it is resolved, the messages of later
+# connections must carry the name. No message may be lost.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[dnscache-resolver.sh\]: test for the background dns resolvers
+RESOLVED=`getent hosts 127.0.0.1 | awk '{ print $2 }'`
+if [ -z "$RESOLVED" ]; then
+	exit 77 # 127.0.0.1 cannot be resolved, skip this test
+fi
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup dnscache-resolver.conf
+source $srcdir/diag.sh tcpflood -m100
+sleep 1 # give the resolvers time to complete
+source $srcdir/diag.sh tcpflood -m1000 -i100
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 1099
+awk -v name="$RESOLVED" '
+	$2 != name && $2 != "127.0.0.1" { print "invalid fromhost: " $0; err = 1 }
+	$1 >= 100 && $2 != name { print "name not resolved: " $0; err = 1 }
+	END { exit err }' rsyslog.out.host.log
+if [ $? -ne 0 ]; then
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,33 @@
+# Test for omfile dynafile.closetimeout. Messages are written to 20
+# dynafiles per action. After more than the timeout, one more message is
+# sent, which makes both actions check for idle files: then at most the
+# file just written to may remain open per action.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[dynafile-closetimeout.sh\]: test for closing idle dynafiles
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup dynafile-closetimeout.conf
+source $srcdir/diag.sh tcpflood -m5000 -f20
+source $srcdir/diag.sh wait-queueempty
+sleep 3
+source $srcdir/diag.sh tcpflood -m1 -i5000 -f20
+source $srcdir/diag.sh wait-queueempty
+sleep 2 # let impstats emit at least one line after the last message
+NOPEN=`ls -l /proc/$(cat rsyslog.pid)/fd | grep -c "rsyslog.out.[ab]."`
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+if [ $NOPEN -gt 2 ]; then
+	echo "$NOPEN dynafiles open, expected at most 2"
+	exit 1
+fi
+CLOSED=$($srcdir/diag.sh get-stat "dynafile cache dyna" closed)
+if [ -z "$CLOSED" ] || [ "$CLOSED" -lt 19 ]; then
+	echo "dynafile cache dyna closed=$CLOSED, expected at least 19, stats are:"
+	cat rsyslog.out.stats.log
+	exit 1
+fi
+cat rsyslog.out.a.*.log > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 5000
+cat rsyslog.out.b.*.log > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 5000
+source $srcdir/diag.sh exit
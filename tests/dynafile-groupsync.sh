@@ -0,0 +1,23 @@
+# Test for sync="on" with dynafiles, which syncs all files of a transaction
+# as a group at its end. All messages must be written, and the stats must
+# show that transactions spanning several files were synced.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[dynafile-groupsync.sh\]: test for group sync of dynafiles
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup dynafile-groupsync.conf
+source $srcdir/diag.sh tcpflood -m5000 -f10
+source $srcdir/diag.sh wait-queueempty
+sleep 2 # let impstats emit at least one line after the burst
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+SYNCS=$($srcdir/diag.sh get-stat "dynafile cache dynsync" syncs)
+SYNCFILES=$($srcdir/diag.sh get-stat "dynafile cache dynsync" syncs.files)
+if [ -z "$SYNCS" ] || [ "$SYNCS" -lt 1 ] || [ -z "$SYNCFILES" ] || [ "$SYNCFILES" -le "$SYNCS" ]; then
+	echo "group sync stats wrong: syncs=$SYNCS (expected > 0), syncs.files=$SYNCFILES (expected > syncs), stats are:"
+	cat rsyslog.out.stats.log
+	exit 1
+fi
+cat rsyslog.out.sync.*.log > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 4999
+source $srcdir/diag.sh exit
@@ -0,0 +1,23 @@
+# Test for omfile dynafile.groupwrites. Messages go to 20 files in random
+# order, with a cache smaller than the number of files. Every message must
+# be written exactly once, and each file must have the same content as
+# without grouping, in particular its messages must still be in order.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[dynafile-groupwrites.sh\]: test for grouped dynafile writes
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup dynafile-groupwrites.conf
+source $srcdir/diag.sh tcpflood -m20000 -f20
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+for f in rsyslog.out.plain.*.log ; do
+	cmp $f ${f/plain/group}
+	if [ ! $? -eq 0 ]; then
+		echo "grouped file differs from $f, first differences:"
+		diff $f ${f/plain/group} | head -10
+		exit 1
+	fi
+done
+cat rsyslog.out.group.*.log > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 19999
+source $srcdir/diag.sh exit
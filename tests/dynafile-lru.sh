@@ -0,0 +1,29 @@
+# Test for the hash-indexed dynafile cache. Messages go to 20 files in
+# random order, once with a cache that is much too small and once with one
+# that holds all files. Both must write every message exactly once. The
+# small cache must evict files, the large one must open each file only once.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[dynafile-lru.sh\]: test for dynafile cache eviction
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup dynafile-lru.conf
+source $srcdir/diag.sh tcpflood -m10000 -f20
+source $srcdir/diag.sh wait-queueempty
+sleep 2 # let impstats emit at least one line after the burst
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+SMALL_EVICTED=$($srcdir/diag.sh get-stat "dynafile cache dynsmall" evicted)
+LARGE_EVICTED=$($srcdir/diag.sh get-stat "dynafile cache dynlarge" evicted)
+LARGE_MISSED=$($srcdir/diag.sh get-stat "dynafile cache dynlarge" missed)
+if [ -z "$SMALL_EVICTED" ] || [ "$SMALL_EVICTED" -lt 1 ] || [ "$LARGE_EVICTED" != "0" ] \
+   || [ -z "$LARGE_MISSED" ] || [ "$LARGE_MISSED" -gt 20 ]; then
+	echo "dynafile cache stats wrong: small evicted=$SMALL_EVICTED (expected > 0),"
+	echo "large evicted=$LARGE_EVICTED (expected 0), large missed=$LARGE_MISSED (expected <= 20), stats are:"
+	cat rsyslog.out.stats.log
+	exit 1
+fi
+cat rsyslog.out.small.*.log > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 9999
+cat rsyslog.out.large.*.log > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh exit
@@ -0,0 +1,31 @@
+# Test for omfile dynafile.maxopen. Two actions write to 20 dynafiles each
+# with caches that hold all of them, but only 5 files may be open over both
+# actions. All messages must be written, files must have been closed, and
+# once everything is processed no more than 5 output files may be open.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[dynafile-maxopen.sh\]: test for the global open dynafile limit
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup dynafile-maxopen.conf
+source $srcdir/diag.sh tcpflood -m10000 -f20
+source $srcdir/diag.sh wait-queueempty
+sleep 2 # let impstats emit at least one line after the burst
+NOPEN=`ls -l /proc/$(cat rsyslog.pid)/fd | grep -c "rsyslog.out.[ab]."`
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+if [ $NOPEN -gt 5 ]; then
+	echo "$NOPEN dynafiles open, expected at most 5"
+	exit 1
+fi
+CLOSED_A=$($srcdir/diag.sh get-stat "dynafile cache dyna" closed)
+CLOSED_B=$($srcdir/diag.sh get-stat "dynafile cache dynb" closed)
+if [ -z "$CLOSED_A" ] || [ -z "$CLOSED_B" ] || [ $(($CLOSED_A + $CLOSED_B)) -lt 1 ]; then
+	echo "no dynafiles closed: dyna closed=$CLOSED_A, dynb closed=$CLOSED_B, stats are:"
+	cat rsyslog.out.stats.log
+	exit 1
+fi
+cat rsyslog.out.a.*.log > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 9999
+cat rsyslog.out.b.*.log > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh exit
@@ -0,0 +1,49 @@
+# Test for omfile dynafile.timebucket. Messages are written in two
+# different minutes, each message to the file of its key and of the minute
+# in which it was written. Each message must be in exactly the right file.
+# As a bucket change needs to be waited for, this test takes up to two
+# minutes.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[dynafile-timebucket.sh\]: test time-bucketed dynafiles
+source $srcdir/diag.sh init
+rm -f rsyslog.out.bucket.*
+source $srcdir/diag.sh startup dynafile-timebucket.conf
+# make sure the first batch is written well within one minute
+while [ $(date +%S | sed 's/^0//') -ge 45 ]; do
+	sleep 1
+done
+MIN1=$(date +%Y%m%d%H%M)
+source $srcdir/diag.sh injectmsg 0 1000
+source $srcdir/diag.sh wait-queueempty
+while [ $(date +%Y%m%d%H%M) == "$MIN1" ]; do
+	sleep 1
+done
+sleep 1 # the timer needs to signal the bucket change
+MIN2=$(date +%Y%m%d%H%M)
+source $srcdir/diag.sh injectmsg 1000 1000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+for k in 0 1 2 3; do
+	for min in $MIN1 $MIN2; do
+		f=rsyslog.out.bucket.$k.$min.log
+		if [ "$min" == "$MIN1" ]; then lo=0; else lo=1000; fi
+		awk -v k=$k -v lo=$lo '$1 % 4 != k || $1 < lo || $1 >= lo + 1000 {
+			print FILENAME ": misplaced message " $0; bad = 1; exit }
+			END { exit bad }' $f
+		if [ $? -ne 0 ]; then
+			ls -l rsyslog.out.bucket.*
+			exit 1
+		fi
+	done
+done
+NFILES=$(ls rsyslog.out.bucket.* | wc -l)
+if [ "$NFILES" != "8" ]; then
+	echo "expected 8 bucket files, got $NFILES"
+	ls -l rsyslog.out.bucket.*
+	exit 1
+fi
+cat rsyslog.out.bucket.* > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 1999
+rm -f rsyslog.out.bucket.*
+source $srcdir/diag.sh exit
@@ -0,0 +1,95 @@
+#!/bin/bash
+# End-to-end throughput benchmark. For each of the canned configs in
+# testsuites/e2ebench-<name>.conf, rsyslogd is started, messages are
+# injected via imdiag as fast as they can be taken and the time until
+# the main queue is drained again is measured. Reported are messages per
+# second, CPU time per message (user+system of rsyslogd) and the peak
+# RSS of rsyslogd.
+#
+# usage: e2ebench.sh [-n messages] [-f filter] [-j] [-r rev] [name...]
+# -n number of messages to inject (default 1000000). Use enough of them
+#    so that a run takes a few seconds: the end of a run is detected by
+#    imdiag's WaitMainQueueEmpty, which polls every 200ms.
+# -f run only configs whose name contains this string
+# -j emit one JSON object per config instead of a table
+# -r revision to tag JSON output with (e.g. the git commit id)
+# If names are given, only these configs are run. Other options (like
+# rsbench's -t) are ignored, so that both can share BENCH_FLAGS.
+#
+# CPU time and RSS are taken from /proc, so this needs Linux.
+# This file is part of the rsyslog project, released under GPLv3
+NUMMSGS=1000000
+FILTER=
+JSON=0
+REV=
+while getopts "n:f:jr:t:M:" opt; do
+	case $opt in
+	n) NUMMSGS=$OPTARG ;;
+	f) FILTER=$OPTARG ;;
+	j) JSON=1 ;;
+	r) REV=$OPTARG ;;
+	*) ;;
+	esac
+done
+shift $((OPTIND - 1))
+if [ "$srcdir" == "" ]; then
+	srcdir=.
+fi
+if [ $# -gt 0 ]; then
+	BENCHES="$*"
+else
+	BENCHES="parse filter json omfile daqueue"
+fi
+CLK_TCK=`getconf CLK_TCK`
+
+# $1 is the pid, prints utime+stime in clock ticks
+cpu_ticks() {
+	# the command name may contain spaces, so strip everything up to it
+	sed -e 's/^.*) //' /proc/$1/stat | awk '{ print $12 + $13 }'
+}
+
+# $1 is the config name
+run_bench() {
+	source $srcdir/diag.sh init > /dev/null
+	source $srcdir/diag.sh startup e2ebench-$1.conf > /dev/null
+	pid=`cat rsyslog.pid`
+
+	cpu0=`cpu_ticks $pid`
+	t0=`date +%s%N`
+	echo injectmsg 0 $NUMMSGS | ./diagtalker > /dev/null
+	echo WaitMainQueueEmpty | ./diagtalker > /dev/null
+	t1=`date +%s%N`
+	cpu1=`cpu_ticks $pid`
+	rss=`awk '/^VmHWM:/ { print $2 }' /proc/$pid/status`
+
+	kill $pid
+	source $srcdir/diag.sh wait-shutdown
+	lost=0
+	if [ -f rsyslog.out.log ]; then
+		lost=$(($NUMMSGS - `wc -l < rsyslog.out.log`))
+	fi
+
+	# WaitMainQueueEmpty spends 750ms verifying the queue stays empty
+	awk -v name=$1 -v rev="$REV" -v json=$JSON -v n=$NUMMSGS -v t0=$t0 -v t1=$t1 \
+	    -v cpu=$(($cpu1 - $cpu0)) -v tck=$CLK_TCK -v rss=$rss -v lost=$lost 'BEGIN {
+		secs = (t1 - t0) / 1000000000 - 0.75;
+		if(secs <= 0)
+			secs = 0.001;
+		rate = n / secs;
+		cpumsg = cpu / tck * 1000000 / n;
+		if(json)
+			printf("{\"name\":\"%s\",\"rev\":\"%s\",\"messages\":%d,\"msgs_per_sec\":%.0f," \
+			       "\"cpu_us_per_msg\":%.3f,\"peak_rss_kb\":%d,\"lost\":%d}\n",
+			       name, rev, n, rate, cpumsg, rss, lost);
+		else
+			printf("%-10s %10d msgs %12.0f msgs/s %10.3f us cpu/msg %10d kB peak rss%s\n",
+			       name, n, rate, cpumsg, rss, lost ? sprintf(" (%d lost)", lost) : "");
+	}'
+	source $srcdir/diag.sh exit > /dev/null
+}
+
+for bench in $BENCHES; do
+	case $bench in
+	*$FILTER*) run_bench $bench ;;
+	esac
+done
@@ -0,0 +1,16 @@
+# Test for omelasticsearch in bulk mode, where each batch is passed to the
+# module in a single commitTransaction() call and posted as one bulk
+# request. Needs an Elasticsearch instance on localhost:9200, whose
+# rsyslog_testbench index is deleted by the test.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[es-bulk.sh\]: testing omelasticsearch bulk mode
+source $srcdir/diag.sh init
+source $srcdir/diag.sh es-init
+source $srcdir/diag.sh startup es-bulk.conf
+source $srcdir/diag.sh injectmsg  0 10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh es-getdata 10000
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh exit
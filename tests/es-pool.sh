@@ -0,0 +1,19 @@
+# Test for omelasticsearch with an array of servers, maxbytes, maxinflight
+# and compression. The first node is down, so its requests must be retried
+# on the second one. Each batch is split into several compressed bulk
+# requests that run concurrently. Every message must be indexed exactly once.
+# Needs an Elasticsearch instance on localhost:9200 that accepts compressed
+# requests, whose rsyslog_testbench index is deleted by the test.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[es-pool.sh\]: testing omelasticsearch node pools and split bulk requests
+source $srcdir/diag.sh init
+source $srcdir/diag.sh es-init
+source $srcdir/diag.sh startup es-pool.conf
+source $srcdir/diag.sh injectmsg  0 10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+# read more records than expected, so that duplicates are detected
+source $srcdir/diag.sh es-getdata 20000
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh exit
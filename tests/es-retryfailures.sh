@@ -0,0 +1,39 @@
+# Test for omelasticsearch retryFailures and retryFailures.max. The index
+# is blocked while the messages are sent, so Elasticsearch rejects all
+# documents with status 429. The block is lifted after a few seconds, and
+# the re-submissions must then index every message exactly once, with
+# nothing written to the error file. Needs an Elasticsearch instance on
+# localhost:9200 that reports blocked indices with status 429 (7.x or
+# above), whose rsyslog_testbench index is deleted by the test.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[es-retryfailures.sh\]: testing omelasticsearch re-submission of rejected documents
+source $srcdir/diag.sh init
+source $srcdir/diag.sh es-init
+curl -s -XPUT localhost:9200/rsyslog_testbench > /dev/null
+curl -s -XPUT -H 'Content-Type: application/json' localhost:9200/rsyslog_testbench/_settings \
+	-d '{"index.blocks.read_only_allow_delete": true}' > /dev/null
+source $srcdir/diag.sh startup es-retryfailures.conf
+source $srcdir/diag.sh injectmsg  0 1000
+sleep 2 # let the first re-submissions be rejected as well
+curl -s -XPUT -H 'Content-Type: application/json' localhost:9200/rsyslog_testbench/_settings \
+	-d '{"index.blocks.read_only_allow_delete": null}' > /dev/null
+source $srcdir/diag.sh wait-queueempty
+sleep 12 # wait for the longest re-submission delay, then for impstats
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+RETRIED=$($srcdir/diag.sh get-stat omelasticsearch retried.es)
+if [ -z "$RETRIED" ] || [ "$RETRIED" -lt 1000 ]; then
+	echo "retried.es is '$RETRIED', expected at least 1000, stats are:"
+	cat rsyslog.out.stats.log
+	exit 1
+fi
+if [ -s rsyslog.out.errorfile.log ]; then
+	echo "documents were written to the error file:"
+	head rsyslog.out.errorfile.log
+	exit 1
+fi
+# read more records than expected, so that duplicates are detected
+source $srcdir/diag.sh es-getdata 2000
+source $srcdir/diag.sh seq-check 0 999
+source $srcdir/diag.sh exit
@@ -0,0 +1,173 @@
+/* Verifies the escape scan kernels (runtime/escape.c) against their
+ * plain C versions and, optionally, benchmarks both.
+ *
+ * Params
+ * -b benchmark instead of verify
+ * -l<len> length of the benchmark strings (default 256)
+ * -n<number> number of benchmark rounds (default 2000000)
+ *
+ * Without -b, random strings of all lengths up to 300 bytes and with
+ * different densities of characters to escape are checked at all
+ * alignments. Exit code is 1 if a kernel returns a wrong result.
+ *
+ * Part of the testbench for rsyslog.
+ *
+ * Copyright 2014 Rainer Gerhards and Adiscon GmbH.
+ *
+ * This file is part of rsyslog.
+ *
+ * Rsyslog is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Rsyslog is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Rsyslog.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * A copy of the GPL can be found in the file "COPYING" in this distribution.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <sys/time.h>
+#include "escape.h"
+
+#define MAXLEN 300
+#define ALIGNMENTS 32
+
+/* characters the kernels must (and must not) find */
+static const unsigned char special[] = { '"', '\\', '\'', '\0', '\n', 0x1f, 0x20, 0x7f, 0x80, 0xff };
+
+static void
+fillRandom(unsigned char *buf, int len, int density)
+{
+	int i;
+
+	for(i = 0 ; i < len ; ++i) {
+		if(rand() % 100 < density)
+			buf[i] = special[rand() % sizeof(special)];
+		else
+			buf[i] = 'a' + rand() % 26;
+	}
+}
+
+static int
+verify(void)
+{
+	static const int densities[] = { 0, 1, 5, 50 };
+	unsigned char buf[MAXLEN + ALIGNMENTS];
+	unsigned char *p;
+	int len, align, d, round;
+	size_t r, rScalar;
+	int nErr = 0;
+
+	srand(1);
+	for(round = 0 ; round < 4 ; ++round) {
+		for(d = 0 ; d < (int) (sizeof(densities) / sizeof(int)) ; ++d) {
+			for(len = 0 ; len <= MAXLEN ; ++len) {
+				for(align = 0 ; align < ALIGNMENTS ; ++align) {
+					p = buf + align;
+					fillRandom(p, len, densities[d]);
+					r = escScanJSON(p, len);
+					rScalar = escScanJSONScalar(p, len);
+					if(r != rScalar) {
+						printf("escScanJSON: len %d, align %d: %u, expected %u\n",
+						       len, align, (unsigned) r, (unsigned) rScalar);
+						++nErr;
+					}
+					r = escScanChars(p, len, '\'', '\\');
+					rScalar = escScanCharsScalar(p, len, '\'', '\\');
+					if(r != rScalar) {
+						printf("escScanChars: len %d, align %d: %u, expected %u\n",
+						       len, align, (unsigned) r, (unsigned) rScalar);
+						++nErr;
+					}
+					r = escScanChars(p, len, 0xff, 0xff);
+					rScalar = escScanCharsScalar(p, len, 0xff, 0xff);
+					if(r != rScalar) {
+						printf("escScanChars(0xff): len %d, align %d: %u, expected %u\n",
+						       len, align, (unsigned) r, (unsigned) rScalar);
+						++nErr;
+					}
+				}
+			}
+		}
+	}
+	printf("%s kernels: %d errors\n", escScanImpl, nErr);
+	return nErr == 0 ? 0 : 1;
+}
+
+static double
+timeDiff(struct timeval *tBeg, struct timeval *tEnd)
+{
+	return (tEnd->tv_sec - tBeg->tv_sec) + (tEnd->tv_usec - tBeg->tv_usec) / 1000000.0;
+}
+
+#define BENCH(name, expr) \
+	gettimeofday(&tBeg, NULL); \
+	for(i = 0 ; i < nRounds ; ++i) \
+		sum += (expr); \
+	gettimeofday(&tEnd, NULL); \
+	secs = timeDiff(&tBeg, &tEnd); \
+	printf("%-24s %8.3fs %10.1f MB/s\n", name, secs, \
+	       secs > 0 ? (double) len * nRounds / secs / (1024 * 1024) : 0.0);
+
+static void
+bench(int len, int nRounds)
+{
+	unsigned char *buf;
+	struct timeval tBeg, tEnd;
+	volatile size_t sum = 0;
+	double secs;
+	int i;
+
+	/* typical log data: nothing to escape */
+	if((buf = malloc(len + 1)) == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	fillRandom(buf, len, 0);
+	buf[len] = '\0';
+
+	printf("%d rounds of %d bytes, kernel: %s\n", nRounds, len, escScanImpl);
+	BENCH("escScanJSONScalar", escScanJSONScalar(buf, len));
+	BENCH("escScanJSON", escScanJSON(buf, len));
+	BENCH("escScanCharsScalar", escScanCharsScalar(buf, len, '\'', '\\'));
+	BENCH("escScanChars", escScanChars(buf, len, '\'', '\\'));
+	free(buf);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	int bBench = 0;
+	int len = 256;
+	int nRounds = 2000000;
+
+	while((opt = getopt(argc, argv, "bl:n:")) != -1) {
+		switch (opt) {
+		case 'b':	bBench = 1;
+				break;
+		case 'l':	len = atoi(optarg);
+				break;
+		case 'n':	nRounds = atoi(optarg);
+				break;
+		default:	printf("Invalid call of escapebench\n");
+				printf("Usage: escapebench [-b] [-l len] [-n rounds]\n");
+				exit(1);
+		}
+	}
+
+	if(bBench) {
+		bench(len, nRounds);
+		exit(0);
+	}
+	exit(verify());
+}
@@ -0,0 +1,11 @@
+# Checks the vector scan kernels used for escaping against their plain
+# C versions (see runtime/escape.c). Run "./escapebench -b" to see how
+# fast they are.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[escapebench.sh\]: testing escape scan kernels
+./escapebench
+if [ $? -ne 0 ]; then
+	echo "escape scan kernels returned wrong results"
+	exit 1
+fi
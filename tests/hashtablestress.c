@@ -0,0 +1,283 @@
+/* Randomized consistency check for the open addressing hashtable
+ * (runtime/hashtable.c). Inserts, searches and removes random keys and
+ * compares every result against a plain reference array. Every few
+ * hundred operations the table is walked with an iterator, and some
+ * entries are removed via hashtable_iterator_remove(), which must
+ * neither skip nor repeat an entry.
+ *
+ * All three key modes are covered: pointer keys (the table owns a
+ * malloc'd key), inline keys copied by hashtable_insert_copy() and
+ * inline keys handed over to hashtable_insert(). Inline tables are run
+ * with a key that fits into the slot's pointer field and with a larger
+ * one, which uses the wider slot stride. A deliberately weak hash
+ * function forces long probe runs and wrap-around at the table end.
+ *
+ * Params
+ * -n<number> number of operations per run (default 200000)
+ * -s<seed> random seed (default: current time, printed on failure)
+ *
+ * Exit code is 1 if the table ever disagrees with the reference. The
+ * driver is best run under valgrind or with -fsanitize=address to also
+ * catch memory errors and leaks.
+ *
+ * Part of the testbench for rsyslog.
+ *
+ * Copyright 2014 Rainer Gerhards and Adiscon GmbH.
+ *
+ * This file is part of rsyslog.
+ *
+ * Rsyslog is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Rsyslog is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Rsyslog.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * A copy of the GPL can be found in the file "COPYING" in this distribution.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include "hashtable.h"
+#include "hashtable_itr.h"
+
+#define KEYRANGE 4096	/* keys are drawn from [0, KEYRANGE) */
+#define MAXKEYSIZE 24
+
+enum mode { MODE_PTRKEY, MODE_COPY, MODE_INSERT };
+static const char *modeNames[] = { "pointer keys", "insert_copy", "inline insert" };
+
+static unsigned keysize;	/* size of the key of the current run */
+static int weakHash;		/* use the colliding hash function? */
+static void *present[KEYRANGE];	/* reference: value stored for key or NULL */
+static int values[KEYRANGE];	/* value objects, value for key i is &values[i] */
+static unsigned char seen[KEYRANGE];
+static unsigned nPresent;
+
+/* keys are the key number followed by filler bytes derived from it, so
+ * that key comparison must look at the whole key */
+static void
+makeKey(unsigned char *buf, unsigned num)
+{
+	unsigned i;
+	memcpy(buf, &num, sizeof(num));
+	for(i = sizeof(num) ; i < keysize ; ++i)
+		buf[i] = (unsigned char) (num * 7 + i);
+}
+
+static unsigned
+keyNum(void *k)
+{
+	unsigned num;
+	memcpy(&num, k, sizeof(num));
+	return num;
+}
+
+static unsigned
+hashKey(void *k)
+{
+	unsigned num = keyNum(k);
+	return weakHash ? num % 61 : num * 2654435761u;
+}
+
+static int
+keysEqual(void *k1, void *k2)
+{
+	return !memcmp(k1, k2, keysize);
+}
+
+static int
+fail(const char *what, unsigned num)
+{
+	fprintf(stderr, "hashtablestress: %s (key %u, %u entries expected)\n",
+		what, num, nPresent);
+	return 1;
+}
+
+static int
+doInsert(struct hashtable *ht, enum mode mode, unsigned num)
+{
+	unsigned char buf[MAXKEYSIZE];
+	unsigned char *pKey;
+
+	makeKey(buf, num);
+	if(mode == MODE_COPY) {
+		if(!hashtable_insert_copy(ht, buf, keysize, &values[num]))
+			return fail("insert_copy failed", num);
+	} else {
+		if((pKey = malloc(keysize)) == NULL)
+			return fail("out of memory", num);
+		memcpy(pKey, buf, keysize);
+		if(!hashtable_insert(ht, pKey, &values[num])) {
+			free(pKey);
+			return fail("insert failed", num);
+		}
+	}
+	present[num] = &values[num];
+	++nPresent;
+	return 0;
+}
+
+/* walk the whole table; if bRemove is set, remove about every third
+ * entry through the iterator */
+static int
+checkIteration(struct hashtable *ht, int bRemove)
+{
+	struct hashtable_itr *itr;
+	unsigned num, count = 0, nAtStart = nPresent;
+	int more;
+
+	if(hashtable_count(ht) != nPresent)
+		return fail("entry count differs", 0);
+	memset(seen, 0, sizeof(seen));
+	if(nPresent == 0)
+		return 0;
+	if((itr = hashtable_iterator(ht)) == NULL)
+		return fail("out of memory", 0);
+	do {
+		num = keyNum(hashtable_iterator_key(itr));
+		if(num >= KEYRANGE || present[num] == NULL) {
+			free(itr);
+			return fail("iterator returned unknown key", num);
+		}
+		if(seen[num]) {
+			free(itr);
+			return fail("iterator returned key twice", num);
+		}
+		if(hashtable_iterator_value(itr) != present[num]) {
+			free(itr);
+			return fail("iterator returned wrong value", num);
+		}
+		seen[num] = 1;
+		++count;
+		if(bRemove && rand() % 3 == 0) {
+			present[num] = NULL;
+			--nPresent;
+			more = hashtable_iterator_remove(itr);
+		} else {
+			more = hashtable_iterator_advance(itr);
+		}
+	} while(more);
+	free(itr);
+	if(count != nAtStart)
+		return fail("iterator missed entries", 0);
+	for(num = 0 ; num < KEYRANGE ; ++num) {
+		if(present[num] != NULL && !seen[num])
+			return fail("iterator missed key", num);
+	}
+	if(hashtable_count(ht) != nPresent)
+		return fail("entry count differs after iterator removal", 0);
+	return 0;
+}
+
+static int
+runOne(enum mode mode, unsigned ksize, int bWeak, int nOps)
+{
+	struct hashtable *ht;
+	unsigned char buf[MAXKEYSIZE];
+	unsigned num;
+	void *v;
+	int i, r = 0;
+
+	keysize = ksize;
+	weakHash = bWeak;
+	memset(present, 0, sizeof(present));
+	nPresent = 0;
+	if(mode == MODE_PTRKEY)
+		ht = create_hashtable(16, hashKey, keysEqual, NULL);
+	else
+		ht = create_hashtable_inlinekey(16, keysize, hashKey, keysEqual, NULL);
+	if(ht == NULL)
+		return fail("cannot create table", 0);
+
+	for(i = 0 ; r == 0 && i < nOps ; ++i) {
+		/* keep a fill level that drifts over the run so that the table
+		 * grows and afterwards sees long removal sequences */
+		num = (unsigned) rand() % (i < nOps / 2 ? KEYRANGE : KEYRANGE / 4);
+		makeKey(buf, num);
+		switch(rand() % 4) {
+		case 0:
+		case 1:
+			if(present[num] == NULL)
+				r = doInsert(ht, mode, num);
+			else if(hashtable_search(ht, buf) != present[num])
+				r = fail("search returned wrong value", num);
+			break;
+		case 2:
+			v = hashtable_remove(ht, buf);
+			if(v != present[num])
+				r = fail("remove returned wrong value", num);
+			else if(v != NULL) {
+				present[num] = NULL;
+				--nPresent;
+			}
+			break;
+		case 3:
+			if(hashtable_search(ht, buf) != present[num])
+				r = fail("search returned wrong value", num);
+			break;
+		}
+		if(r == 0 && i % 503 == 0)
+			r = checkIteration(ht, i % 2);
+	}
+	if(r == 0)
+		r = checkIteration(ht, 0);
+	if(r == 0) {
+		/* the iterator has to survive removing every single entry */
+		while(r == 0 && nPresent > 0)
+			r = checkIteration(ht, 1);
+		if(r == 0 && hashtable_count(ht) != 0)
+			r = fail("table not empty after removing all entries", 0);
+	}
+	hashtable_destroy(ht, 0);
+	if(r != 0)
+		fprintf(stderr, "hashtablestress: failed in mode '%s', keysize %u%s\n",
+			modeNames[mode], ksize, bWeak ? ", weak hash" : "");
+	return r;
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const unsigned inlineSizes[] = { sizeof(unsigned), MAXKEYSIZE };
+	unsigned seed = (unsigned) time(NULL);
+	int nOps = 200000;
+	int opt, bWeak;
+	unsigned i;
+	int r = 0;
+
+	while((opt = getopt(argc, argv, "n:s:")) != EOF) {
+		switch((char)opt) {
+		case 'n':
+			nOps = atoi(optarg);
+			break;
+		case 's':
+			seed = (unsigned) strtoul(optarg, NULL, 10);
+			break;
+		default:printf("Invalid call of hashtablestress, usage: [-n<ops>] [-s<seed>]\n");
+			exit (1);
+		}
+	}
+	srand(seed);
+
+	for(bWeak = 0 ; r == 0 && bWeak < 2 ; ++bWeak) {
+		r = runOne(MODE_PTRKEY, sizeof(unsigned), bWeak, nOps);
+		for(i = 0 ; r == 0 && i < sizeof(inlineSizes)/sizeof(inlineSizes[0]) ; ++i) {
+			r = runOne(MODE_COPY, inlineSizes[i], bWeak, nOps);
+			if(r == 0)
+				r = runOne(MODE_INSERT, inlineSizes[i], bWeak, nOps);
+		}
+	}
+	if(r != 0)
+		fprintf(stderr, "hashtablestress: seed was %u\n", seed);
+	return r;
+}
@@ -0,0 +1,11 @@
+# Randomized consistency check of the hash table (runtime/hashtable.c)
+# for all key modes, including removal through the iterator. Rerun a
+# failure with "./hashtablestress -s<seed>", the seed is printed.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[hashtablestress.sh\]: randomized hash table check
+./hashtablestress
+if [ $? -ne 0 ]; then
+	echo "hash table disagrees with reference"
+	exit 1
+fi
@@ -0,0 +1,55 @@
+# Test for omhiredis cluster="on". A three node Redis Cluster is started
+# on ports 13611-13613 and rsyslog only knows the first node. Values go to
+# eight keys, which are spread over the slots of all nodes, so commands
+# must be routed by hash slot. Every list must contain its messages
+# exactly once, in order. Needs redis-server with cluster support and a
+# redis-cli that knows --cluster (Redis 5 or newer); the test is skipped
+# otherwise.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[hiredis-cluster.sh\]: testing omhiredis cluster mode
+if ! redis-cli --cluster help > /dev/null 2>&1; then
+	echo "redis-cli does not support --cluster, skipping test"
+	exit 77
+fi
+source $srcdir/diag.sh init
+rm -rf redis-cluster
+for port in 13611 13612 13613; do
+	mkdir -p redis-cluster/$port
+	redis-server --port $port --bind 127.0.0.1 --dir redis-cluster/$port \
+		--cluster-enabled yes --cluster-config-file nodes.conf \
+		--save "" --appendonly no --daemonize yes > /dev/null
+	if [ $? -ne 0 ]; then
+		echo "could not start redis-server on port $port, skipping test"
+		rm -rf redis-cluster
+		exit 77
+	fi
+done
+sleep 1
+redis-cli --cluster create 127.0.0.1:13611 127.0.0.1:13612 127.0.0.1:13613 \
+	--cluster-replicas 0 --cluster-yes > /dev/null
+for i in $(seq 1 30); do
+	redis-cli -p 13611 cluster info | grep -q "cluster_state:ok" && break
+	sleep 1
+done
+source $srcdir/diag.sh startup hiredis-cluster.conf
+source $srcdir/diag.sh injectmsg  0 10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+rc=0
+for k in 0 1 2 3 4 5 6 7; do
+	redis-cli -c -p 13611 --raw LRANGE rsyslog_testbench_$k 0 -1 > rsyslog.out.log
+	seq -f "%08g" $k 8 9999 | cmp - rsyslog.out.log
+	if [ $? -ne 0 ]; then
+		echo "list rsyslog_testbench_$k is not complete or out of order"
+		rc=1
+	fi
+done
+for port in 13611 13612 13613; do
+	redis-cli -p $port shutdown nosave > /dev/null 2>&1
+done
+rm -rf redis-cluster
+if [ $rc -ne 0 ]; then
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,23 @@
+# Test for omhiredis mode="queue" with a list of servers, of which the
+# first one is down, and for dynakey. The values of each batch are pushed
+# with one RPUSH, and the lists must contain every message exactly once,
+# in order. Needs a Redis server on localhost:6379 and redis-cli; the
+# test deletes the rsyslog_testbench keys.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[hiredis-queue.sh\]: testing omhiredis queue mode
+source $srcdir/diag.sh init
+redis-cli DEL rsyslog_testbench rsyslog_testbench_dyn > /dev/null
+source $srcdir/diag.sh startup hiredis-queue.conf
+source $srcdir/diag.sh injectmsg  0 10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+redis-cli --raw LRANGE rsyslog_testbench 0 -1 > rsyslog.out.log
+redis-cli --raw LRANGE rsyslog_testbench_dyn 0 -1 > rsyslog2.out.log
+seq -f "%08g" 0 9999 | cmp - rsyslog.out.log
+if [ $? -ne 0 ]; then
+	echo "list rsyslog_testbench is not complete or out of order"
+	exit 1
+fi
+source $srcdir/diag.sh seq-check2 0 9999
+source $srcdir/diag.sh exit
@@ -0,0 +1,40 @@
+# Test for imfile line splitting with lines of random length, many of them
+# longer than the stream buffer. The file is read in two runs, with more
+# lines appended in between, so reading must resume exactly at the state
+# persisted on shutdown. Every line must arrive complete and exactly once.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imfile-longlines.sh\]: test for imfile with long lines
+source $srcdir/diag.sh init
+genlines() {
+	awk -v start=$1 -v end=$2 'BEGIN {
+		srand(start)
+		for(i = start ; i < end ; ++i) {
+			n = int(rand() * 8000)
+			d = ""
+			for(j = 0 ; j < n ; ++j)
+				d = d "X"
+			printf("msgnum:%8.8d:%d:%s\n", i, n, d)
+		}
+	}'
+}
+wait_lines() { # wait until $1 lines are written, at most 30 seconds
+	for i in `seq 300`; do
+		if [ -f rsyslog.out.log ] && [ `wc -l < rsyslog.out.log` -ge $1 ]; then
+			return
+		fi
+		./msleep 100
+	done
+}
+genlines 0 3000 > rsyslog.input
+source $srcdir/diag.sh startup imfile-longlines.conf
+wait_lines 3000
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+genlines 3000 6000 >> rsyslog.input
+source $srcdir/diag.sh startup imfile-longlines.conf
+wait_lines 6000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 5999 -E
+source $srcdir/diag.sh exit
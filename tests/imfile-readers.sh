@@ -0,0 +1,30 @@
+# Test for the imfile readers parameter. Four files of different size are
+# read by three reader threads. Each file's lines must arrive complete and
+# in file order, and no file may lag behind once everything is read.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imfile-readers.sh\]: test for imfile with multiple reader threads
+source $srcdir/diag.sh init
+rm -f stat-file2 stat-file3 stat-file4
+for i in 1 2 3 4; do
+	./inputfilegen $((i * 10000)) > rsyslog.input.$i
+done
+source $srcdir/diag.sh startup imfile-readers.conf
+sleep 3 # give imfile time to read the files and impstats to report
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+for i in 1 2 3 4; do
+	cut -d: -f2 rsyslog.input.$i | cmp - rsyslog.out.$i.log
+	if [ $? -ne 0 ]; then
+		echo "file $i not read completely or out of order"
+		exit 1
+	fi
+	LAG=$($srcdir/diag.sh get-stat "imfile(./rsyslog.input.$i)" lag)
+	if [ "$LAG" != "0" ]; then
+		echo "file $i lag is '$LAG', expected 0, stats are:"
+		cat rsyslog.out.stats.log
+		exit 1
+	fi
+done
+rm -f rsyslog.input.* stat-file2 stat-file3 stat-file4
+source $srcdir/diag.sh exit
@@ -0,0 +1,50 @@
+# Test for the imfile stateStore parameter. The first run uses per-file
+# state files, which the second run must migrate into the state store.
+# The third run continues from the store. Each run reads lines appended
+# since the previous one, and no line may be lost or read twice.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imfile-statestore.sh\]: test for the imfile state store
+source $srcdir/diag.sh init
+mkdir test-spool
+# append lines $2 to $3 - 1 to file $1
+genlines() {
+	awk -v from=$2 -v to=$3 'BEGIN { for(i = from ; i < to ; ++i) printf("msgnum:%8.8d:\n", i) }' >> $1
+}
+runrsyslog() {
+	source $srcdir/diag.sh startup imfile-statestore.conf
+	sleep 2 # give imfile time to read the files
+	source $srcdir/diag.sh shutdown-when-empty
+	source $srcdir/diag.sh wait-shutdown
+}
+rm -f rsyslog.input.1 rsyslog.input.2
+echo 'module(load="../plugins/imfile/.libs/imfile")' > work-statestore.conf
+genlines rsyslog.input.1 0 5000
+genlines rsyslog.input.2 0 3000
+runrsyslog
+if test ! -f test-spool/stat-file1 || test ! -f test-spool/stat-file2; then
+	echo "error: per-file state files not written"
+	ls -l test-spool
+	exit 1
+fi
+
+echo 'module(load="../plugins/imfile/.libs/imfile" statestore="imfile-state")' > work-statestore.conf
+genlines rsyslog.input.1 5000 10000
+genlines rsyslog.input.2 3000 6000
+runrsyslog
+if test ! -f test-spool/imfile-state || test -f test-spool/stat-file1 || test -f test-spool/stat-file2; then
+	echo "error: state files not migrated to the state store"
+	ls -l test-spool
+	exit 1
+fi
+
+genlines rsyslog.input.1 10000 15000
+genlines rsyslog.input.2 6000 9000
+runrsyslog
+
+cp rsyslog.out.1.log rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 14999
+cp rsyslog.out.2.log rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 8999
+rm -f rsyslog.input.1 rsyslog.input.2
+source $srcdir/diag.sh exit
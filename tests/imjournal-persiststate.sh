@@ -0,0 +1,29 @@
+# Test for imjournal persistStateTime. The state is only persisted by time
+# (persistStateInterval is huge). rsyslogd is killed without a chance to
+# save its state, then restarted. It must continue exactly where it left
+# off: no message may be lost or read twice. Needs a running systemd
+# journal, otherwise the test is skipped.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imjournal-persiststate.sh\]: test for imjournal state persistence
+if ! journalctl -n0 --quiet > /dev/null 2>&1 || ! type systemd-cat > /dev/null 2>&1; then
+	exit 77 # no journal available, skip this test
+fi
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup imjournal-persiststate.conf
+for i in `seq 0 999`; do printf "msgnum:%8.8d:\n" $i; done | systemd-cat -t rstest-imjournal
+sleep 3 # let imjournal read all and persist its state by time
+if [ ! -s test-spool/imjournal.state ]; then
+	echo "imjournal state was not persisted"
+	exit 1
+fi
+kill -9 `cat rsyslog.pid`
+sleep 1
+rm -f rsyslog.pid rsyslogd.started
+for i in `seq 1000 1999`; do printf "msgnum:%8.8d:\n" $i; done | systemd-cat -t rstest-imjournal
+source $srcdir/diag.sh startup imjournal-persiststate.conf
+sleep 3 # let imjournal read the journal
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 1999
+source $srcdir/diag.sh exit
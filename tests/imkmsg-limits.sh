@@ -0,0 +1,48 @@
+# Test for the imkmsg dedup and ratelimit parameters. Messages are written
+# to /dev/kmsg with prefixes unique to this test run. Repeated messages
+# must be reported by a single message, only ratelimit.burst messages of
+# a prefix may pass, and other prefixes must not be affected. This needs
+# root permissions.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imkmsg-limits.sh\]: test imkmsg dedup and rate limiting
+if [ `id -u` -ne 0 ] || [ ! -w /dev/kmsg ]; then
+	echo "this test needs write access to /dev/kmsg - skipping"
+	exit 77
+fi
+source $srcdir/diag.sh init
+PFX=rstest$$
+# the kernel rate limits writes to /dev/kmsg by default
+DEVKMSG=`cat /proc/sys/kernel/printk_devkmsg 2>/dev/null`
+if [ -n "$DEVKMSG" ]; then
+	echo on > /proc/sys/kernel/printk_devkmsg
+fi
+source $srcdir/diag.sh startup imkmsg-limits.conf
+for i in `seq 1 10`; do
+	echo "<5>${PFX}a: same" > /dev/kmsg
+done
+echo "<5>${PFX}a: other" > /dev/kmsg
+for i in `seq 1 100`; do
+	echo "<5>${PFX}b: msgnum:$i" > /dev/kmsg
+done
+for i in `seq 1 20`; do
+	echo "<5>${PFX}c: msgnum:$i" > /dev/kmsg
+done
+sleep 1 # give imkmsg time to read everything
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+if [ -n "$DEVKMSG" ]; then
+	echo $DEVKMSG > /proc/sys/kernel/printk_devkmsg
+fi
+SAME=`grep -c "${PFX}a: same" rsyslog.out.log`
+OTHER=`grep -c "${PFX}a: other" rsyslog.out.log`
+REPEATED=`grep -c "last message for '${PFX}a' repeated 9 times" rsyslog.out.log`
+NB=`grep -c "${PFX}b: msgnum" rsyslog.out.log`
+NC=`grep -c "${PFX}c: msgnum" rsyslog.out.log`
+if [ $SAME -ne 1 ] || [ $OTHER -ne 1 ] || [ $REPEATED -ne 1 ] || [ $NB -ne 50 ] || [ $NC -ne 20 ]; then
+	echo "unexpected result: $SAME 'same' (expected 1), $OTHER 'other' (expected 1),"
+	echo "$REPEATED repeat reports (expected 1), $NB of prefix b (expected 50), $NC of prefix c (expected 20)"
+	cat rsyslog.out.log
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,41 @@
+# Test for impstats emit.delta and emit.changedonly. Messages are sent in
+# two bursts. The deltas over all intervals must add up to the counter
+# value, and the listener's object must not be emitted while it is idle.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[impstats-delta.sh\]: test impstats emit.delta and emit.changedonly
+source $srcdir/diag.sh init
+rm -f rsyslog.out.stats.log
+source $srcdir/diag.sh startup impstats-delta.conf
+source $srcdir/diag.sh tcpflood -m5000
+source $srcdir/diag.sh wait-queueempty
+sleep 3 # let impstats report the first burst
+NLINES=$(grep -c -F " imtcp(13514): " rsyslog.out.stats.log)
+sleep 3
+if [ $(grep -c -F " imtcp(13514): " rsyslog.out.stats.log) -ne $NLINES ]; then
+	echo "unchanged object emitted although emit.changedonly is on"
+	exit 1
+fi
+source $srcdir/diag.sh tcpflood -m3000 -i5000
+source $srcdir/diag.sh wait-queueempty
+sleep 3 # let impstats report the second burst
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 7999
+grep -F " imtcp(13514): " rsyslog.out.stats.log | awk '{
+	for(i = 1 ; i <= NF ; ++i) {
+		split($i, kv, "=")
+		if(kv[1] == "submitted.delta") sum += kv[2]
+		if(kv[1] == "submitted.rate") ++rates
+	}
+} END { if(sum != 8000 || rates == 0) { print "deltas add up to " sum; exit 1 } }'
+if [ ! $? -eq 0 ]; then
+	echo "submitted.delta/rate not as expected"
+	exit 1
+fi
+SUBMITTED=$($srcdir/diag.sh get-stat "imtcp(13514)" submitted)
+if [ "$SUBMITTED" != "8000" ]; then
+	echo "counter was modified, submitted is $SUBMITTED"
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,36 @@
+# Test for the impstats http.port/http.address metrics endpoint. It is
+# scraped in classic Prometheus text format and in OpenMetrics format,
+# both must contain the current main queue counters and its latency
+# histogram.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[impstats-http.sh\]: test impstats metrics endpoint
+if ! hash curl 2>/dev/null; then
+	echo "curl not found, skipping test"
+	exit 77
+fi
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup impstats-http.conf
+source $srcdir/diag.sh tcpflood -m1000
+source $srcdir/diag.sh wait-queueempty
+curl -s http://127.0.0.1:13520/metrics > rsyslog.out.metrics
+curl -s -H "Accept: application/openmetrics-text; version=1.0.0" \
+	http://127.0.0.1:13520/metrics > rsyslog.out.openmetrics
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 999
+for f in rsyslog.out.metrics rsyslog.out.openmetrics; do
+	ENQ=$(grep '^rsyslog_enqueued\(_total\)\?{object="main Q"}' $f | awk '{ print $2 }')
+	LAT=$(grep '^rsyslog_latency_seconds_count{object="main Q"}' $f | awk '{ print $2 }')
+	if [ -z "$ENQ" ] || [ $ENQ -lt 1000 ] || [ -z "$LAT" ] || [ $LAT -lt 1000 ]; then
+		echo "$f: main queue enqueued '$ENQ', latency count '$LAT', expected at least 1000"
+		head -20 $f
+		exit 1
+	fi
+done
+if grep -q "^# EOF" rsyslog.out.metrics || [ "$(tail -1 rsyslog.out.openmetrics)" != "# EOF" ]; then
+	echo "wrong exposition format returned"
+	exit 1
+fi
+rm -f rsyslog.out.metrics rsyslog.out.openmetrics
+source $srcdir/diag.sh exit
@@ -0,0 +1,32 @@
+# Test for backpressure from the main queue to imptcp. The queue is
+# drained much slower than tcpflood sends, so imptcp must pause its session
+# when the queue reaches its full delay mark and resume it later. No
+# message may be lost, and the stats must show that backpressure was
+# signalled and the session was paused.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imptcp-backpressure.sh\]: test for imptcp pausing on queue backpressure
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup imptcp-backpressure.conf
+source $srcdir/diag.sh tcpflood -m20000
+source $srcdir/diag.sh wait-queueempty
+sleep 2 # let impstats emit at least one line after the burst
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 19999
+getctr() {
+	grep -F " $1: " rsyslog.out.stats.log | tail -1 | awk -v name="$2" '{
+		for(i = 1 ; i <= NF ; ++i) {
+			split($i, kv, "=")
+			if(kv[1] == name) n = kv[2]
+		}
+	} END { print n }'
+}
+EVENTS=$(getctr "main Q" backpressure.events)
+PAUSED=$(getctr "imptcp(*/13514/IPv4)" sessions.paused)
+if [ -z "$EVENTS" ] || [ "$EVENTS" -lt 1 ] || [ -z "$PAUSED" ] || [ "$PAUSED" -lt 1 ]; then
+	echo "backpressure not signalled: backpressure.events=$EVENTS, sessions.paused=$PAUSED (both expected >= 1), stats are:"
+	cat rsyslog.out.stats.log
+	exit 1
+fi
+source $srcdir/diag.sh exit
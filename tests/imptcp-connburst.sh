@@ -0,0 +1,33 @@
+# Test for imptcp under connection bursts. Two bursts of 500 connections
+# each are sent, so that the second one reuses the session objects freed by
+# the first one. Peer names are resolved only when a session delivers data
+# or is closed, so each message must still carry the right fromhost-ip and
+# each close message the right peer name.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imptcp-connburst.sh\]: test imptcp with connection bursts
+source $srcdir/diag.sh init
+rm -f rsyslog.out.fromhost.log rsyslog.out.close.log
+source $srcdir/diag.sh startup imptcp-connburst.conf
+source $srcdir/diag.sh tcpflood -c500 -m10000
+source $srcdir/diag.sh tcpflood -c500 -m10000 -i10000
+sleep 1 # let the receiver handle the closed connections
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 19999
+FROMHOSTS=$(sort -u rsyslog.out.fromhost.log)
+if [ "$FROMHOSTS" != "127.0.0.1" ]; then
+	echo "unexpected fromhost-ip values:"
+	echo "$FROMHOSTS" | head -10
+	exit 1
+fi
+NCLOSE=$(wc -l < rsyslog.out.close.log)
+if [ "$NCLOSE" != "1000" ]; then
+	echo "expected 1000 close messages, got $NCLOSE"
+	exit 1
+fi
+if grep -v "closed by remote peer \(127\.0\.0\.1\|localhost\)" rsyslog.out.close.log ; then
+	echo "close messages with wrong peer name, see above"
+	exit 1
+fi
+source $srcdir/diag.sh exit
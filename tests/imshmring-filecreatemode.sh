@@ -0,0 +1,30 @@
+# Test for the imshmring filecreatemode parameter. The socket must be
+# created with the configured mode, independent of the umask, and the
+# default must be 0666. Messages sent via both sockets must arrive.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imshmring-filecreatemode.sh\]: test imshmring filecreatemode
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup imshmring-filecreatemode.conf
+MODE1=`stat -c %a ./rsyslog.shm1.sock`
+MODE2=`stat -c %a ./rsyslog.shm2.sock`
+if [ "$MODE1" != "600" ] || [ "$MODE2" != "666" ]; then
+	echo "wrong socket modes: $MODE1 (expected 600), $MODE2 (expected 666)"
+	source $srcdir/diag.sh shutdown-immediate
+	source $srcdir/diag.sh wait-shutdown
+	exit 1
+fi
+./shmringsend -s ./rsyslog.shm1.sock -m1000
+if [ ! $? -eq 0 ]; then
+	echo "shmringsend failed"
+	exit 1
+fi
+./shmringsend -s ./rsyslog.shm2.sock -m1000 -i1000
+if [ ! $? -eq 0 ]; then
+	echo "shmringsend failed"
+	exit 1
+fi
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 1999
+source $srcdir/diag.sh exit
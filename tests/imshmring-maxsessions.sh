@@ -0,0 +1,34 @@
+# Test for the imshmring maxsessions and maxsessions.peruid parameters.
+# Two producers keep their sessions open on each socket, so a third one
+# must be refused, by the total limit on the first socket and by the
+# per-user limit on the second. Once the sessions are closed, producers
+# must be accepted again.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imshmring-maxsessions.sh\]: test imshmring session limits
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup imshmring-maxsessions.conf
+./shmringsend -s ./rsyslog.shm1.sock -m10 -c2 -w5 &
+PID1=$!
+./shmringsend -s ./rsyslog.shm2.sock -m10 -i20 -c2 -w5 &
+PID2=$!
+sleep 2
+for sock in rsyslog.shm1.sock rsyslog.shm2.sock; do
+	./shmringsend -s ./$sock -m10 -i100 2> /dev/null
+	if [ $? -eq 0 ]; then
+		echo "session limit of $sock not enforced"
+		exit 1
+	fi
+done
+wait $PID1 $PID2
+sleep 1 # let rsyslog notice the closed sessions
+./shmringsend -s ./rsyslog.shm1.sock -m10 -i10 && \
+./shmringsend -s ./rsyslog.shm2.sock -m10 -i30
+if [ ! $? -eq 0 ]; then
+	echo "shmringsend failed after sessions were closed"
+	exit 1
+fi
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 39
+source $srcdir/diag.sh exit
@@ -0,0 +1,35 @@
+# Test for imshmring. Several producers send via the default ring size,
+# and others write large messages in place into the smallest ring, so
+# that the ring wraps around and is full many times. No message may be
+# lost, and the input counters must match.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imshmring.sh\]: test imshmring input
+source $srcdir/diag.sh init
+rm -f rsyslog.out.stats.log
+source $srcdir/diag.sh startup imshmring.conf
+./shmringsend -s ./rsyslog.shm1.sock -m20000 -c4
+if [ ! $? -eq 0 ]; then
+	echo "shmringsend failed"
+	exit 1
+fi
+./shmringsend -s ./rsyslog.shm2.sock -m2000 -i20000 -c2 -d5000 -r
+if [ ! $? -eq 0 ]; then
+	echo "shmringsend failed"
+	exit 1
+fi
+source $srcdir/diag.sh wait-queueempty
+sleep 3 # let impstats emit the final values
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+SUBMITTED=$($srcdir/diag.sh get-stat "imshmring(./rsyslog.shm1.sock)" submitted)
+SESSIONS=$($srcdir/diag.sh get-stat "imshmring(./rsyslog.shm1.sock)" sessions.opened)
+SUBMITTED2=$($srcdir/diag.sh get-stat "imshmring(./rsyslog.shm2.sock)" submitted)
+if [ "$SUBMITTED" != "20000" ] || [ "$SESSIONS" != "4" ] || [ "$SUBMITTED2" != "2000" ]; then
+	echo "wrong imshmring counters: submitted=$SUBMITTED (expected 20000), sessions.opened=$SESSIONS"
+	echo "(expected 4), submitted=$SUBMITTED2 for the small ring (expected 2000), stats are:"
+	grep imshmring rsyslog.out.stats.log | tail -2
+	exit 1
+fi
+source $srcdir/diag.sh seq-check 0 21999
+source $srcdir/diag.sh exit
@@ -0,0 +1,14 @@
+# Test for imtcp sessionThreads. Twenty connections, some of them dropped
+# and re-established while sending, are spread over four session threads.
+# All messages must be received completely and exactly once.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imtcp-sessionthreads.sh\]: test for imtcp session threads
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup imtcp-sessionthreads.conf
+source $srcdir/diag.sh tcpflood -c20 -m20000 -r -d2000 -P129 -D
+sleep 1 # due to large messages, we need this time for the tcp receiver to settle...
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 19999 -E
+source $srcdir/diag.sh exit
@@ -0,0 +1,27 @@
+# Test imtcp with frames above the max message size, but below
+# maxFrameSize. Each frame must arrive as a single message and be counted
+# by the listener's messages.large counter, and none must be split.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ====================================================================================
+echo TEST: \[imtcp_largeframe.sh\]: test imtcp with frames above the max message size
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup imtcp_largeframe.conf
+# send 100 messages with 50.000 bytes of extra data each, max message size is 10k
+source $srcdir/diag.sh tcpflood -c2 -m100 -d50000 -P129
+sleep 3 # let impstats emit at least one line after all messages were received
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown       # and wait for it to terminate
+source $srcdir/diag.sh seq-check 0 99 -E
+grep "imtcp(13514): " rsyslog.out.stats.log | tail -1 | awk '{
+	for(i = 1 ; i <= NF ; ++i) {
+		split($i, kv, "=")
+		if(kv[1] == "messages.large") nLarge = kv[2]
+		if(kv[1] == "messages.split") nSplit = kv[2]
+	}
+} END { exit (nLarge == 100 && nSplit == 0) ? 0 : 1 }'
+if [ $? -ne 0 ]; then
+	echo "messages.large/messages.split counters wrong, stats are:"
+	cat rsyslog.out.stats.log
+	exit 1
+fi
+source $srcdir/diag.sh exit
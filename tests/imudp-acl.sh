@@ -0,0 +1,23 @@
+# Test for UDP AllowedSenders checks. First 127.0.0.1 is permitted by a
+# network entry and all messages must be received, then it is listed
+# nowhere and all UDP messages must be dropped. In the second run only
+# the messages sent via TCP, which has no ACL, may show up. Messages are
+# sent slowly to avoid UDP loss, but failure of the first part may still
+# mean that the system dropped packets.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imudp-acl.sh\]: test UDP AllowedSenders checks
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup imudp-acl-allow.conf
+./tcpflood -Tudp -p13514 -c4 -m2000 -b100 -W10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 1999
+rm -f rsyslog.out.log
+source $srcdir/diag.sh startup imudp-acl-deny.conf
+./tcpflood -Tudp -p13514 -c4 -m2000 -b100 -W10000
+./tcpflood -p13515 -m100 -i2000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 2000 2099
+source $srcdir/diag.sh exit
@@ -0,0 +1,18 @@
+# Test for imudp capture.interface, capture.ringSize and capture.fanout.
+# Packets to the port are captured on the loopback interface by two workers
+# with round-robin fanout. No socket is bound to the port. Every packet must
+# be received exactly once, as loopback also shows outgoing copies that
+# must be skipped. Capturing needs CAP_NET_RAW, so this test needs root.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imudp-capture.sh\]: test for imudp AF_PACKET capture mode
+if [ "$EUID" -ne 0 ]; then
+    exit 77 # Not root, skip this test
+fi
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup imudp-capture.conf
+./tcpflood -Tudp -c4 -m2000 -b100 -W10000
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 1999
+source $srcdir/diag.sh exit
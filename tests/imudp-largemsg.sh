@@ -0,0 +1,15 @@
+# Test for imudp with a mix of small and large packets. Small packets are
+# copied into the message, large ones hand their receive buffer over to it.
+# Each message's data must arrive complete and unmixed with the data of the
+# other packets of the same receive batch. Messages are sent slowly to
+# avoid UDP loss, but failure may still mean that the system dropped packets.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imudp-largemsg.sh\]: test for imudp with large packets
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup imudp-largemsg.conf
+./tcpflood -Tudp -m2000 -r -d4000 -P129 -b50 -W10000
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 1999 -E
+source $srcdir/diag.sh exit
@@ -0,0 +1,24 @@
+# Test for imudp reusePort and reusePort.cpuSteering. With four worker
+# threads, each listener must have four sockets bound to its port, and
+# messages from several senders must all be received, no matter which
+# socket the kernel picks for them. Messages are sent slowly to avoid UDP
+# loss, but failure may still mean that the system dropped packets.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imudp-reuseport.sh\]: test for imudp SO_REUSEPORT listeners
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup imudp-reuseport.conf
+for port in 13514 13515; do
+	NSOCKS=`grep -ci ":$(printf %04X $port) 00000000:0000" /proc/net/udp`
+	if [ $NSOCKS -ne 4 ]; then
+		echo "$NSOCKS sockets bound to port $port, expected 4"
+		cat /proc/net/udp
+		exit 1
+	fi
+done
+./tcpflood -Tudp -p13514 -c8 -m2000 -b100 -W10000
+./tcpflood -Tudp -p13515 -c8 -m2000 -i2000 -b100 -W10000
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 3999
+source $srcdir/diag.sh exit
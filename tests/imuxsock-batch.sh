@@ -0,0 +1,27 @@
+# Test for imuxsock batch receiving, the trusted property cache and the
+# per-process ratelimiter. Two logger processes send 2000 messages each
+# in a burst. The ratelimiter lets 1000 messages of each process pass, so
+# switching between senders must not let one use the other's budget. All
+# messages passed must carry the trusted properties of their sender.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imuxsock-batch.sh\]: test for imuxsock batches and per-process ratelimiting
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup imuxsock-batch.conf
+for i in `seq 0 1999`; do printf "msgnum:%8.8d:\n" $i; done | logger -d -u rsyslog.sock
+for i in `seq 2000 3999`; do printf "msgnum:%8.8d:\n" $i; done | logger -d -u rsyslog.sock
+./msleep 500 # let imuxsock read the socket before we shut down
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+for i in `seq 0 999` `seq 2000 2999`; do printf "%8.8d\n" $i; done > rsyslog.out.expected.log
+sort rsyslog.out.log | cmp - rsyslog.out.expected.log
+if [ $? -ne 0 ]; then
+	echo "ratelimited messages are wrong, got `wc -l < rsyslog.out.log` lines"
+	exit 1
+fi
+if [ "`sort -u rsyslog.out.comm.log`" != "logger" ]; then
+	echo "trusted property appname wrong:"
+	sort rsyslog.out.comm.log | uniq -c
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,37 @@
+# Test for the imzmq3 multipart parameter. Messages of three frames are
+# sent to three inputs. "join" must create one message of all frames,
+# "fields" must use the last frame as message and keep the others in
+# $!zmq!frames, and "split" must create one message per frame.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imzmq3-multipart.sh\]: test imzmq3 multipart modes
+source $srcdir/diag.sh init
+rm -f rsyslog.out.join.log rsyslog.out.fields.log rsyslog.out.split.log
+awk 'BEGIN {
+	for(i = 0 ; i < 10000 ; ++i) {
+		msg = sprintf("<167>Mar  1 01:00:00 172.20.245.8 tag msgnum:%8.8d:", i)
+		print "frame1 frame2 " msg > "rsyslog.out.join.expected"
+		printf("[ \"frame1\", \"frame2\" ],%8.8d\n", i) > "rsyslog.out.fields.expected"
+		print "frame1\nframe2\n" msg > "rsyslog.out.split.expected"
+	}
+}'
+source $srcdir/diag.sh startup imzmq3-multipart.conf
+for port in 13520 13521 13522; do
+	./zmqsend -d tcp://127.0.0.1:$port -m10000 -f3
+	if [ ! $? -eq 0 ]; then
+		echo "zmqsend failed"
+		exit 1
+	fi
+done
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+for mode in join fields split; do
+	cmp rsyslog.out.$mode.log rsyslog.out.$mode.expected
+	if [ ! $? -eq 0 ]; then
+		echo "unexpected result for multipart=\"$mode\", first differences:"
+		diff rsyslog.out.$mode.log rsyslog.out.$mode.expected | head -10
+		exit 1
+	fi
+done
+rm -f rsyslog.out.*.expected
+source $srcdir/diag.sh exit
@@ -0,0 +1,26 @@
+# Test for global(input.prefilter). The leading "stop" filter of the
+# ruleset is evaluated on the input thread, so discarded messages never
+# reach the main queue, and the input's prefilter counter shows them.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[input-prefilter.sh\]: test discarding messages on the input thread
+source $srcdir/diag.sh init
+rm -f rsyslog.out.stats.log
+source $srcdir/diag.sh startup input-prefilter.conf
+source $srcdir/diag.sh tcpflood -m20000
+source $srcdir/diag.sh wait-queueempty
+sleep 3 # let impstats emit the final values
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+DISCARDED=$($srcdir/diag.sh get-stat "tcperver prefilter" discarded)
+ENQUEUED=$($srcdir/diag.sh get-stat "main Q" enqueued)
+if [ "$DISCARDED" != "10000" ]; then
+	echo "prefilter discarded $DISCARDED messages, expected 10000"
+	exit 1
+fi
+if [ -z "$ENQUEUED" ] || [ "$ENQUEUED" -ge 20000 ]; then
+	echo "main queue enqueued $ENQUEUED messages, prefiltered ones must not be enqueued"
+	exit 1
+fi
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh exit
@@ -0,0 +1,19 @@
+# Test for global(io.uring="on"). Messages pass a disk queue with synced
+# queue files and are written to a regular and a synced output file. Both
+# files must contain all messages. Where the kernel lacks io_uring, write()
+# is used, so the test also passes there.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[io-uring.sh\]: test for writing files via io_uring
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup io-uring.conf
+source $srcdir/diag.sh tcpflood -m5000
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 4999
+cmp rsyslog.out.log rsyslog.out.sync.log
+if [ $? -ne 0 ]; then
+	echo "synced output differs from regular output"
+	exit 1
+fi
+source $srcdir/diag.sh exit
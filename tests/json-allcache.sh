@@ -0,0 +1,31 @@
+# Test for the cached serialization of the $! tree. The tree is modified
+# between actions, so each action must see the current tree and not a
+# stale cached one. Also, $!all-json and %$!% must give the same result.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[json-allcache.sh\]: test cached serialization of the \$! tree
+source $srcdir/diag.sh init
+rm -f rsyslog.out.a.log rsyslog.out.b.log rsyslog.out.c.log
+source $srcdir/diag.sh startup json-allcache.conf
+source $srcdir/diag.sh injectmsg 0 10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+# check that every line has both serializations identical, the number
+# ($1) present or absent, and "extra" present or absent as expected
+check() {
+	awk -F'|' -v hasnum=$2 -v hasextra=$3 '
+		$2 != $3 { print "serializations differ: " $0; bad = 1; exit }
+		(index($2, "\"" $1 "\"") > 0) != hasnum { print "wrong num: " $0; bad = 1; exit }
+		(index($2, "\"extra\"") > 0) != hasextra { print "wrong extra: " $0; bad = 1; exit }
+		END { exit bad }' $1
+	if [ $? -ne 0 ]; then
+		echo "$1 has unexpected content"
+		exit 1
+	fi
+	cut -d'|' -f1 $1 > rsyslog.out.log
+	source $srcdir/diag.sh seq-check 0 9999
+}
+check rsyslog.out.a.log 1 0
+check rsyslog.out.b.log 1 1
+check rsyslog.out.c.log 0 1
+source $srcdir/diag.sh exit
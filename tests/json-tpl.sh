@@ -0,0 +1,24 @@
+# check that fields with format="json"/"jsonf" and templates with
+# option.sql are escaped correctly. These are rendered directly into the
+# template output buffer.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[json-tpl.sh\]: test JSON and SQL escaping in list templates
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup json-tpl.conf
+./tcpflood -m1 -M '<129>Mar 10 01:00:00 172.20.245.8 tag"x: a "quoted" \back\slash text'
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+printf '%s\n' '{"msg":" a \"quoted\" \\back\\slash text", "tag":"tag\"x:"}' | cmp rsyslog.out.log
+if [ ! $? -eq 0 ]; then
+  echo "invalid JSON output generated, rsyslog.out.log is:"
+  cat rsyslog.out.log
+  exit 1
+fi;
+printf '%s\n' "' a \"quoted\" \\\\back\\\\slash text'" | cmp rsyslog2.out.log
+if [ ! $? -eq 0 ]; then
+  echo "invalid SQL output generated, rsyslog2.out.log is:"
+  cat rsyslog2.out.log
+  exit 1
+fi;
+source $srcdir/diag.sh exit
@@ -0,0 +1,18 @@
+# Test for JSON property paths, which are split into their elements when
+# the config is loaded. Nested $! and $. properties are used in filters
+# and templates, including paths with empty elements and paths whose
+# intermediate container does not exist.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[jsonpaths.sh\]: testing nested JSON property paths
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup jsonpaths.conf
+source $srcdir/diag.sh injectmsg  0 10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999
+if grep -v ',local,d,$' rsyslog.out.log; then
+  echo "unexpected property values in output"
+  exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,30 @@
+# Test for the enqueue-to-dequeue latency histogram. All messages are
+# dequeued from a memory queue, so once the queue is drained the
+# histogram buckets of the main queue must add up to its "enqueued"
+# counter.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[latencyhist.sh\]: testing the enqueue-to-dequeue latency histogram
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup latencyhist.conf
+
+# 40000 messages should be enough
+source $srcdir/diag.sh injectmsg  0 40000
+source $srcdir/diag.sh wait-queueempty
+sleep 3 # let impstats emit at least one line with the queue drained
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 39999
+grep " main Q: " rsyslog.out.stats.log | tail -1 | awk '{
+	for(i = 1 ; i <= NF ; ++i) {
+		split($i, kv, "=")
+		if(kv[1] ~ /^latency\./) sum += kv[2]
+		if(kv[1] == "enqueued") enq = kv[2]
+	}
+} END { exit (enq >= 40000 && sum == enq) ? 0 : 1 }'
+if [ $? -ne 0 ]; then
+	echo "latency histogram does not match the number of dequeued messages, stats are:"
+	cat rsyslog.out.stats.log
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,434 @@
+/* Receives messages that carry a send time stamp and records their
+ * end-to-end latency in a histogram. This is the counterpart of
+ * tcpflood -l: somewhere in each message, there must be a "lat:<usecs>:"
+ * field, with usecs being the send time in microseconds since the epoch.
+ * If a message contains more than one such field, the last one is used.
+ * Messages without it are counted, but ignored otherwise. As the
+ * receive time is taken from the same clock, sender and receiver must
+ * run on the same machine (or on machines with well-synchronized clocks).
+ *
+ * Data is read line by line either from stdin (the default, e.g. when
+ * called via omprog) or from TCP connections (e.g. from omfwd).
+ *
+ * Params
+ * -p	listen on this TCP port instead of reading stdin
+ * -t	address to listen on (default: 127.0.0.1)
+ * -n	terminate after this many messages were received (default: run
+ *      until EOF or SIGINT/SIGTERM)
+ * -o	write the latency report to this file (default: stdout)
+ *
+ * The report is in the HdrHistogram percentile distribution (.hgrm)
+ * format, so it can be plotted with the usual HdrHistogram tools. Values
+ * are in microseconds with 3 significant digits, for latencies between
+ * 1us and one hour. Larger latencies are recorded as one hour.
+ *
+ * Part of the testbench for rsyslog.
+ *
+ * Copyright 2014 Rainer Gerhards and Adiscon GmbH.
+ *
+ * This file is part of rsyslog.
+ *
+ * Rsyslog is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Rsyslog is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Rsyslog.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * A copy of the GPL can be found in the file "COPYING" in this distribution.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define MAX_CONNS 1024
+#define MAX_LINE (64*1024)
+
+/* histogram layout: 3 significant digits mean 2048 sub-buckets, of which
+ * all but the first bucket use only the upper half. Each bucket doubles
+ * the value range, 22 buckets cover 1us..2^32us (more than one hour).
+ */
+#define SUB_BUCKET_HALF_COUNT_MAGNITUDE 10
+#define SUB_BUCKET_HALF_COUNT (1 << SUB_BUCKET_HALF_COUNT_MAGNITUDE)
+#define SUB_BUCKET_COUNT (2 * SUB_BUCKET_HALF_COUNT)
+#define SUB_BUCKET_MASK ((int64_t) SUB_BUCKET_COUNT - 1)
+#define BUCKET_COUNT 22
+#define COUNTS_LEN ((BUCKET_COUNT + 1) * SUB_BUCKET_HALF_COUNT)
+#define HIGHEST_VALUE (3600LL * 1000000LL)
+#define TICKS_PER_HALF_DISTANCE 5
+
+static long long counts[COUNTS_LEN];
+static long long totalCount = 0;
+static long long numNoStamp = 0;
+static int64_t maxVal = 0;
+static double sum = 0.0;
+static double sumSq = 0.0;
+
+static long long expected = 0;	/* number of messages to wait for, 0 - unlimited */
+static char *outFile = NULL;
+static volatile sig_atomic_t bTerminate = 0;
+
+struct conn {
+	int fd;
+	size_t lenBuf;
+	char buf[MAX_LINE];
+};
+static struct conn *conns[MAX_CONNS];
+
+
+static int
+getBucketIdx(int64_t val)
+{
+	/* position of highest bit, never below sub bucket resolution */
+	int pow2ceiling = 64 - __builtin_clzll((uint64_t) (val | SUB_BUCKET_MASK));
+	return pow2ceiling - (SUB_BUCKET_HALF_COUNT_MAGNITUDE + 1);
+}
+
+static int
+getCountsIdx(int64_t val)
+{
+	const int bucketIdx = getBucketIdx(val);
+	const int subBucketIdx = (int) (val >> bucketIdx);
+	return ((bucketIdx + 1) << SUB_BUCKET_HALF_COUNT_MAGNITUDE)
+		+ (subBucketIdx - SUB_BUCKET_HALF_COUNT);
+}
+
+/* returns the highest value that is recorded into the same slot as the
+ * value stored at counts index idx. This is what is reported for it.
+ */
+static int64_t
+highestEquivalentVal(int idx)
+{
+	int bucketIdx = (idx >> SUB_BUCKET_HALF_COUNT_MAGNITUDE) - 1;
+	int subBucketIdx = (idx & (SUB_BUCKET_HALF_COUNT - 1)) + SUB_BUCKET_HALF_COUNT;
+	if(bucketIdx < 0) {
+		subBucketIdx -= SUB_BUCKET_HALF_COUNT;
+		bucketIdx = 0;
+	}
+	return ((int64_t) subBucketIdx << bucketIdx) + ((int64_t) 1 << bucketIdx) - 1;
+}
+
+static void
+recordLatency(int64_t lat)
+{
+	if(lat < 0)
+		lat = 0; /* clock went backwards, nothing better we can do */
+	if(lat > HIGHEST_VALUE)
+		lat = HIGHEST_VALUE;
+	counts[getCountsIdx(lat)]++;
+	++totalCount;
+	if(lat > maxVal)
+		maxVal = lat;
+	sum += lat;
+	sumSq += (double) lat * lat;
+}
+
+
+/* process a single received line (not NUL-terminated) */
+static void
+processLine(char *ln, size_t len, int64_t tNow)
+{
+	size_t i;
+	int64_t tSent;
+	char *p;
+
+	/* search the last "lat:" field */
+	for(i = len ; i >= 4 ; --i) {
+		if(!strncmp(ln + i - 4, "lat:", 4))
+			break;
+	}
+	if(i < 4) {
+		++numNoStamp;
+		return;
+	}
+
+	tSent = 0;
+	for(p = ln + i ; p < ln + len && *p >= '0' && *p <= '9' ; ++p)
+		tSent = tSent * 10 + (*p - '0');
+	if(p == ln + i || p == ln + len || *p != ':') {
+		++numNoStamp;
+		return;
+	}
+	recordLatency(tNow - tSent);
+}
+
+
+/* process newly received data, keeps partial lines for the next call */
+static void
+processData(struct conn *conn)
+{
+	struct timeval tv;
+	int64_t tNow;
+	size_t iStart = 0;
+	size_t i;
+
+	gettimeofday(&tv, NULL);
+	tNow = (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+	for(i = 0 ; i < conn->lenBuf ; ++i) {
+		if(conn->buf[i] == '\n') {
+			processLine(conn->buf + iStart, i - iStart, tNow);
+			iStart = i + 1;
+		}
+	}
+	if(iStart == 0 && conn->lenBuf == sizeof(conn->buf)) {
+		/* overlong line, process what we have (the stamp is at its end) */
+		processLine(conn->buf, conn->lenBuf, tNow);
+		iStart = conn->lenBuf;
+	}
+	memmove(conn->buf, conn->buf + iStart, conn->lenBuf - iStart);
+	conn->lenBuf -= iStart;
+}
+
+
+/* read from a connection. Returns 0 on EOF or error, 1 otherwise. */
+static int
+readConn(struct conn *conn)
+{
+	ssize_t nRead;
+
+	nRead = read(conn->fd, conn->buf + conn->lenBuf, sizeof(conn->buf) - conn->lenBuf);
+	if(nRead <= 0) {
+		if(nRead < 0 && errno == EINTR)
+			return 1;
+		if(conn->lenBuf > 0) {
+			/* last line without LF */
+			conn->buf[conn->lenBuf++] = '\n';
+			processData(conn);
+		}
+		return 0;
+	}
+	conn->lenBuf += nRead;
+	processData(conn);
+	return 1;
+}
+
+
+static struct conn *
+newConn(int fd)
+{
+	struct conn *conn;
+
+	if((conn = malloc(sizeof(struct conn))) == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	conn->fd = fd;
+	conn->lenBuf = 0;
+	return conn;
+}
+
+
+static int
+openListener(char *addr, int port)
+{
+	int fd;
+	int on = 1;
+	struct sockaddr_in srvAddr;
+
+	if((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+		perror("socket");
+		exit(1);
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	memset(&srvAddr, 0, sizeof(srvAddr));
+	srvAddr.sin_family = AF_INET;
+	srvAddr.sin_addr.s_addr = inet_addr(addr);
+	srvAddr.sin_port = htons(port);
+	if(bind(fd, (struct sockaddr *)&srvAddr, sizeof(srvAddr)) != 0) {
+		perror("bind");
+		exit(1);
+	}
+	if(listen(fd, 20) != 0) {
+		perror("listen");
+		exit(1);
+	}
+	return fd;
+}
+
+
+/* handle input until we are done. If fdListen is -1, stdin is read,
+ * otherwise connections are accepted on it.
+ */
+static void
+receiveMsgs(int fdListen)
+{
+	struct pollfd pfd[MAX_CONNS + 1];
+	int nConns = 0;
+	int nfds;
+	int fd;
+	int i;
+
+	if(fdListen == -1)
+		conns[nConns++] = newConn(0);
+
+	while(!bTerminate && (expected == 0 || totalCount + numNoStamp < expected)) {
+		nfds = 0;
+		if(fdListen != -1) {
+			pfd[nfds].fd = fdListen;
+			pfd[nfds++].events = POLLIN;
+		}
+		for(i = 0 ; i < nConns ; ++i) {
+			pfd[nfds].fd = conns[i]->fd;
+			pfd[nfds++].events = POLLIN;
+		}
+		if(poll(pfd, nfds, -1) == -1) {
+			if(errno == EINTR)
+				continue;
+			perror("poll");
+			exit(1);
+		}
+
+		nfds = 0;
+		if(fdListen != -1 && (pfd[nfds++].revents & POLLIN)) {
+			if((fd = accept(fdListen, NULL, NULL)) != -1) {
+				if(nConns < MAX_CONNS) {
+					conns[nConns++] = newConn(fd);
+				} else {
+					fprintf(stderr, "latsink: too many connections, refusing\n");
+					close(fd);
+				}
+			}
+		}
+		for(i = 0 ; i < nConns ; ++i, ++nfds) {
+			if(pfd[nfds].revents == 0)
+				continue;
+			if(!readConn(conns[i])) {
+				close(conns[i]->fd);
+				free(conns[i]);
+				conns[i] = NULL;
+			}
+		}
+		/* compact connection table */
+		for(i = 0 ; i < nConns ; ) {
+			if(conns[i] == NULL)
+				conns[i] = conns[--nConns];
+			else
+				++i;
+		}
+		if(fdListen == -1 && nConns == 0)
+			break; /* EOF on stdin */
+	}
+}
+
+
+/* write the percentile distribution in HdrHistogram .hgrm format */
+static void
+writeReport(FILE *fp)
+{
+	double percentileToIterTo = 0.0;
+	double percentile;
+	double mean = 0.0;
+	double stddev = 0.0;
+	long long cumCount = 0;
+	long long countAtPercentile;
+	int64_t halfDistance;
+	int idx = 0;
+
+	fprintf(fp, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+	if(totalCount > 0) {
+		while(1) {
+			countAtPercentile = (long long) ((percentileToIterTo / 100.0) * totalCount + 0.5);
+			if(countAtPercentile < 1)
+				countAtPercentile = 1;
+			while(cumCount < countAtPercentile && idx < COUNTS_LEN)
+				cumCount += counts[idx++];
+			percentile = (double) cumCount / totalCount;
+			if(cumCount >= totalCount) {
+				fprintf(fp, "%12.3f %2.12f %10lld\n", (double) highestEquivalentVal(idx - 1),
+					1.0, cumCount);
+				break;
+			}
+			fprintf(fp, "%12.3f %2.12f %10lld %14.2f\n", (double) highestEquivalentVal(idx - 1),
+				percentile, cumCount, 1.0 / (1.0 - percentile));
+			/* advance to next reporting point; ticks get denser towards 100% */
+			do {
+				halfDistance = (int64_t) 1 << ((int) (log(100.0 / (100.0 - percentileToIterTo))
+								/ log(2)) + 1);
+				percentileToIterTo += 100.0 / (TICKS_PER_HALF_DISTANCE * halfDistance);
+			} while(percentileToIterTo < 100.0 * percentile);
+		}
+		mean = sum / totalCount;
+		stddev = sqrt(fabs(sumSq / totalCount - mean * mean));
+	}
+	fprintf(fp, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", mean, stddev);
+	fprintf(fp, "#[Max     = %12.3f, Total count    = %12lld]\n", (double) maxVal, totalCount);
+	fprintf(fp, "#[Buckets = %12d, SubBuckets     = %12d]\n", BUCKET_COUNT, SUB_BUCKET_COUNT);
+	if(numNoStamp > 0)
+		fprintf(fp, "#[Messages without latency stamp = %lld]\n", numNoStamp);
+}
+
+
+static void
+sigHdlr(int sig)
+{
+	(void) sig;
+	bTerminate = 1;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	int opt;
+	int port = 0;
+	char *addr = "127.0.0.1";
+	int fdListen = -1;
+	FILE *fp;
+	struct sigaction sigAct;
+
+	while((opt = getopt(argc, argv, "n:o:p:t:")) != -1) {
+		switch (opt) {
+		case 'n':	expected = atoll(optarg);
+				break;
+		case 'o':	outFile = optarg;
+				break;
+		case 'p':	port = atoi(optarg);
+				break;
+		case 't':	addr = optarg;
+				break;
+		default:	fprintf(stderr, "usage: latsink [-p port [-t addr]] [-n count] [-o outfile]\n");
+				exit(1);
+		}
+	}
+
+	memset(&sigAct, 0, sizeof(sigAct));
+	sigemptyset(&sigAct.sa_mask);
+	sigAct.sa_handler = sigHdlr;
+	sigaction(SIGINT, &sigAct, NULL);
+	sigaction(SIGTERM, &sigAct, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	if(port != 0)
+		fdListen = openListener(addr, port);
+
+	receiveMsgs(fdListen);
+
+	if(outFile == NULL) {
+		fp = stdout;
+	} else if((fp = fopen(outFile, "w")) == NULL) {
+		perror(outFile);
+		exit(1);
+	}
+	writeReport(fp);
+	if(fp != stdout)
+		fclose(fp);
+	/* let the OS do the cleanup */
+	return 0;
+}
@@ -0,0 +1,22 @@
+# Test for lock-free queue mode with several concurrent producers. imtcp
+# runs with several session threads, each of them enqueueing the messages
+# of its own connections, while imdiag injects messages at the same time.
+# This exercises the multi-producer enqueue path of the lock-free queue.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[lockfreequeue-mp.sh\]: testing lock-free queue with multiple producers
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup lockfreequeue-mp.conf
+./tcpflood -c8 -Y -m40000 &
+TCPFLOOD=$!
+source $srcdir/diag.sh injectmsg 40000 40000
+wait $TCPFLOOD
+if [ "$?" -ne "0" ]; then
+	echo "error during tcpflood!"
+	exit 1
+fi
+sleep 1 # prevent too-early termination of the tcp listener
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 79999
+source $srcdir/diag.sh exit
@@ -0,0 +1,51 @@
+# check binary lookup table files generated by rslookuputil. A large
+# string table and an array table are converted and used, then the string
+# table is regenerated and reloaded via HUP. Messages injected after the
+# reload must see the new table.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[lookup_binary.sh\]: testing binary lookup table files
+source $srcdir/diag.sh init
+rm -f rsyslog.lookup.*
+mktable() {
+	awk -v marker=$1 'BEGIN {
+		printf("{ \"version\":1, \"nomatch\":\"unknown\", \"type\":\"string\",\n  \"table\":[ ")
+		printf("{\"index\":\"tag\", \"value\":\"ok\" },\n\t{\"index\":\"marker\", \"value\":\"%s\" }", marker)
+		for(i = 0 ; i < 10000 ; ++i)
+			printf(",\n\t{\"index\":\"k%d\", \"value\":\"v%d\" }", i, i)
+		printf(" ]\n}\n")
+	}' > rsyslog.lookup.json
+	../tools/rslookuputil -o rsyslog.lookup.lkb rsyslog.lookup.json
+	if [ ! $? -eq 0 ]; then
+		echo "rslookuputil failed"
+		exit 1
+	fi
+}
+mktable old
+../tools/rslookuputil -o rsyslog.lookup.array.lkb $srcdir/testsuites/lookup_array.json
+if [ ! $? -eq 0 ]; then
+	echo "rslookuputil failed"
+	exit 1
+fi
+source $srcdir/diag.sh startup lookup_binary.conf
+source $srcdir/diag.sh injectmsg  0 1000
+source $srcdir/diag.sh wait-queueempty
+mktable new
+kill -HUP `cat rsyslog.pid`
+sleep 1
+source $srcdir/diag.sh injectmsg  1000 1000
+echo doing shutdown
+source $srcdir/diag.sh shutdown-when-empty
+echo wait on shutdown
+source $srcdir/diag.sh wait-shutdown
+awk -F, '$1 + 0 < 1000 && $2 != "old" || $1 + 0 >= 1000 && $2 != "new" {
+		print "unexpected lookup result: " $0; exit 1 }' rsyslog.out.log
+if [ "$?" -ne "0" ]; then
+  echo "binary lookup table reload error detected"
+  exit 1
+fi
+cut -d, -f1 rsyslog.out.log > rsyslog.out.seq
+mv rsyslog.out.seq rsyslog.out.log
+source $srcdir/diag.sh seq-check  0 1999
+rm -f rsyslog.lookup.*
+source $srcdir/diag.sh exit
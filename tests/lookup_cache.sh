@@ -0,0 +1,27 @@
+# check that lookup tables loaded from the compiled cache work like
+# freshly built ones. The first run builds the cache, the second uses it.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[lookup_cache.sh\]: testing the lookup table cache
+rm -rf rsyslog.lkcache
+mkdir rsyslog.lkcache
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup lookup_cache.conf
+source $srcdir/diag.sh injectmsg  0 1000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown 
+if [ ! -f rsyslog.lkcache/hosts.lkc -o ! -f rsyslog.lkcache/tags.lkc -o ! -f rsyslog.lkcache/lens.lkc ]; then
+	echo "FAIL: lookup table cache files were not created"
+	ls -l rsyslog.lkcache
+	exit 1
+fi
+source $srcdir/diag.sh seq-check  0 999
+# second run, now from the cache
+rm -f rsyslog.out.log
+source $srcdir/diag.sh startup lookup_cache.conf
+source $srcdir/diag.sh injectmsg  0 1000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown 
+source $srcdir/diag.sh seq-check  0 999
+rm -rf rsyslog.lkcache
+source $srcdir/diag.sh exit
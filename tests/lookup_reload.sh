@@ -0,0 +1,36 @@
+# check that lookup tables can be reloaded while messages are looked up
+# in them. The table is replaced and reloaded via HUP repeatedly during
+# a message burst. No message may be lost, and messages injected after
+# the last reload must see the new table.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[lookup_reload.sh\]: testing lookup table reload under load
+source $srcdir/diag.sh init
+cp $srcdir/testsuites/lookup_reload1.json rsyslog.lookup.json
+source $srcdir/diag.sh startup lookup_reload.conf
+source $srcdir/diag.sh injectmsg  0 20000 &
+INJECTOR=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+	cp $srcdir/testsuites/lookup_reload$(( i % 2 + 1 )).json rsyslog.lookup.json
+	kill -HUP `cat rsyslog.pid`
+	sleep 0.2
+done
+wait $INJECTOR
+cp $srcdir/testsuites/lookup_reload2.json rsyslog.lookup.json
+kill -HUP `cat rsyslog.pid`
+source $srcdir/diag.sh wait-queueempty
+sleep 1
+source $srcdir/diag.sh injectmsg  20000 1000
+echo doing shutdown
+source $srcdir/diag.sh shutdown-when-empty
+echo wait on shutdown
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check  0 20999
+awk -F, '$2 != "old" && $2 != "new" || $1 + 0 >= 20000 && $2 != "new" {
+		print "unexpected lookup result: " $0; exit 1 }' rsyslog.out.log
+if [ "$?" -ne "0" ]; then
+  echo "lookup table reload error detected"
+  exit 1
+fi
+rm -f rsyslog.lookup.json
+source $srcdir/diag.sh exit
@@ -0,0 +1,32 @@
+# check lookup_table() reloadOnHUP. After both table files have been
+# replaced, a HUP must reload only the table that has reloadOnHUP on.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[lookup_reloadonhup.sh\]: testing lookup table reloadOnHUP
+source $srcdir/diag.sh init
+cp $srcdir/testsuites/lookup_reload1.json rsyslog.lookup.static.json
+cp $srcdir/testsuites/lookup_reload1.json rsyslog.lookup.dynamic.json
+source $srcdir/diag.sh startup lookup_reloadonhup.conf
+source $srcdir/diag.sh injectmsg  0 1000
+source $srcdir/diag.sh wait-queueempty
+cp $srcdir/testsuites/lookup_reload2.json rsyslog.lookup.static.json
+cp $srcdir/testsuites/lookup_reload2.json rsyslog.lookup.dynamic.json
+kill -HUP `cat rsyslog.pid`
+sleep 1
+source $srcdir/diag.sh injectmsg  1000 1000
+echo doing shutdown
+source $srcdir/diag.sh shutdown-when-empty
+echo wait on shutdown
+source $srcdir/diag.sh wait-shutdown
+awk -F, '$1 + 0 < 1000 && ($2 != "old" || $3 != "old") ||
+	 $1 + 0 >= 1000 && ($2 != "old" || $3 != "new") {
+		print "unexpected lookup result: " $0; exit 1 }' rsyslog.out.log
+if [ "$?" -ne "0" ]; then
+  echo "lookup table reloadOnHUP error detected"
+  exit 1
+fi
+cut -d, -f1 rsyslog.out.log > rsyslog.out.seq
+mv rsyslog.out.seq rsyslog.out.log
+source $srcdir/diag.sh seq-check  0 1999
+rm -f rsyslog.lookup.static.json rsyslog.lookup.dynamic.json
+source $srcdir/diag.sh exit
@@ -0,0 +1,13 @@
+# check the hash, array and cidr lookup table types
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[lookup_types.sh\]: testing lookup table types
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup lookup_types.conf
+source $srcdir/diag.sh injectmsg  0 5000
+echo doing shutdown
+source $srcdir/diag.sh shutdown-when-empty
+echo wait on shutdown
+source $srcdir/diag.sh wait-shutdown 
+source $srcdir/diag.sh seq-check  0 4999
+source $srcdir/diag.sh exit
@@ -0,0 +1,212 @@
+/* a minimal SMTP server for testing ommail. It accepts everything and
+ * writes a trace of what it received to a file.
+ *
+ * Command line options:
+ * -p port to listen on (127.0.0.1 only, default 13520)
+ * -f file to write the trace to (required)
+ * -P do NOT announce the PIPELINING extension
+ *
+ * The trace contains a line "session" for each EHLO/HELO, a line "mail"
+ * for each MAIL FROM and the non-empty body lines of each mail, the header
+ * lines are skipped. Each connection is served by a process of its own.
+ * The server runs until it is killed.
+ *
+ * Part of the testbench for rsyslog.
+ *
+ * Copyright 2014 Rainer Gerhards and Adiscon GmbH.
+ *
+ * This file is part of rsyslog.
+ *
+ * Rsyslog is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Rsyslog is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Rsyslog.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * A copy of the GPL can be found in the file "COPYING" in this distribution.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static int fdOut;
+static int bPipelining = 1;
+
+
+/* write a trace line. O_APPEND keeps lines of concurrent sessions intact */
+static void
+trace(char *ln)
+{
+	char buf[4096];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "%s\n", ln);
+	if(len >= (int) sizeof(buf))
+		len = sizeof(buf) - 1;
+	if(write(fdOut, buf, len) != len)
+		perror("minismtpsrv: write");
+}
+
+
+static void
+reply(FILE *fp, char *rsp)
+{
+	fputs(rsp, fp);
+	fflush(fp);
+}
+
+
+/* serve a single SMTP session. Commands are processed line by line, so
+ * pipelined commands simply queue up in the stdio buffer.
+ */
+static void
+session(int sock)
+{
+	FILE *fpIn, *fp;
+	char ln[4096];
+	char *p;
+	int bData = 0;
+	int bHdr = 0;
+
+	/* separate streams, as we cannot fseek() between reading and writing */
+	if((fpIn = fdopen(sock, "r")) == NULL || (fp = fdopen(dup(sock), "w")) == NULL) {
+		perror("minismtpsrv: fdopen");
+		exit(1);
+	}
+	reply(fp, "220 localhost minismtpsrv ready\r\n");
+	while(fgets(ln, sizeof(ln), fpIn) != NULL) {
+		if((p = strchr(ln, '\r')) != NULL || (p = strchr(ln, '\n')) != NULL)
+			*p = '\0';
+		if(bData) {
+			if(!strcmp(ln, ".")) {
+				bData = 0;
+				reply(fp, "250 OK\r\n");
+			} else if(bHdr) {
+				if(ln[0] == '\0')
+					bHdr = 0;
+			} else if(ln[0] != '\0') {
+				trace(ln[0] == '.' ? ln + 1 : ln); /* undo dot-stuffing */
+			}
+		} else if(!strncasecmp(ln, "EHLO", 4)) {
+			trace("session");
+			reply(fp, bPipelining ? "250-localhost\r\n250 PIPELINING\r\n" : "250 localhost\r\n");
+		} else if(!strncasecmp(ln, "HELO", 4)) {
+			trace("session");
+			reply(fp, "250 localhost\r\n");
+		} else if(!strncasecmp(ln, "MAIL", 4)) {
+			trace("mail");
+			reply(fp, "250 OK\r\n");
+		} else if(!strncasecmp(ln, "RCPT", 4)) {
+			reply(fp, "250 OK\r\n");
+		} else if(!strncasecmp(ln, "DATA", 4)) {
+			bData = 1;
+			bHdr = 1;
+			reply(fp, "354 go ahead\r\n");
+		} else if(!strncasecmp(ln, "QUIT", 4)) {
+			reply(fp, "221 bye\r\n");
+			break;
+		} else {
+			reply(fp, "500 unknown command\r\n");
+		}
+	}
+	fclose(fp);
+	fclose(fpIn);
+}
+
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: minismtpsrv -f file [-p port] [-P]\n"
+			"-f MUST be specified\n");
+	exit(1);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	int opt;
+	int port = 13520;
+	char *fnOut = NULL;
+	int sockListen;
+	int sock;
+	int one = 1;
+	struct sockaddr_in addr;
+
+	while((opt = getopt(argc, argv, "p:f:P")) != EOF) {
+		switch((char)opt) {
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'f':
+			fnOut = optarg;
+			break;
+		case 'P':
+			bPipelining = 0;
+			break;
+		default:usage();
+		}
+	}
+	if(fnOut == NULL)
+		usage();
+
+	if((fdOut = open(fnOut, O_WRONLY|O_CREAT|O_APPEND|O_TRUNC, 0644)) == -1) {
+		perror(fnOut);
+		exit(1);
+	}
+	signal(SIGCHLD, SIG_IGN); /* we do not care about our children's fate */
+	signal(SIGPIPE, SIG_IGN);
+
+	if((sockListen = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+		perror("minismtpsrv: socket");
+		exit(1);
+	}
+	setsockopt(sockListen, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+	if(bind(sockListen, (struct sockaddr*) &addr, sizeof(addr)) == -1
+	   || listen(sockListen, 16) == -1) {
+		perror("minismtpsrv: bind/listen");
+		exit(1);
+	}
+
+	while(1) {
+		if((sock = accept(sockListen, NULL, NULL)) == -1) {
+			perror("minismtpsrv: accept");
+			continue;
+		}
+		switch(fork()) {
+		case -1:
+			perror("minismtpsrv: fork");
+			close(sock);
+			break;
+		case 0:
+			close(sockListen);
+			session(sock);
+			exit(0);
+		default:
+			close(sock);
+			break;
+		}
+	}
+}
@@ -0,0 +1,37 @@
+# Test for mmanon with ipv6.enable, ipv6.bits and mode="hash". In rewrite
+# mode the addresses must be written in canonical form, with mapped IPv4
+# addresses handled by the IPv4 settings. In hash mode each address must
+# always get the same pseudonym, which keeps the non-anonymized prefix.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[mmanon-ipv6.sh\]: test mmanon IPv6 and hash mode
+source $srcdir/diag.sh init
+awk 'BEGIN {
+	for(i = 0 ; i < 1000 ; ++i) {
+		printf("<129>Mar  1 01:00:00 host1 tag: msgnum:%8.8d a 2001:DB8:1:2:3:4:5:6 b 10.1.2.3 c ::ffff:10.1.2.3 d 64:ff9b::10.1.2.3 e 0.1.2.3 f 9.8.7.6 g 1..2.3 h\n", i) > "rsyslog.input"
+		printf(" msgnum:%8.8d a 2001:db8:: b 10.1.0.0 c ::ffff:10.1.0.0 d 64:ff9b::0.0.0.0 e 0.1.0.0 f 9.8.0.0 g 1..2.3 h\n", i) > "rsyslog.out.expected"
+	}
+}'
+source $srcdir/diag.sh startup mmanon-ipv6.conf
+./tcpflood -p13514 -B -I rsyslog.input
+./tcpflood -p13515 -B -I rsyslog.input
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+cmp rsyslog.out.log rsyslog.out.expected
+if [ ! $? -eq 0 ]; then
+	echo "unexpected rewrite mode result, first differences:"
+	diff rsyslog.out.log rsyslog.out.expected | head -10
+	exit 1
+fi
+rm -f rsyslog.out.expected
+if [ `wc -l < rsyslog2.out.log` -ne 1000 ] || [ `sort -u rsyslog2.out.log | wc -l` -ne 1 ]; then
+	echo "hash mode did not produce one consistent pseudonym per address:"
+	sort rsyslog2.out.log | uniq -c | head -10
+	exit 1
+fi
+if ! grep -q "^2001:db8:1:[^,]*,10\.1\.[0-9]*\.[0-9]*$" rsyslog2.out.log; then
+	echo "hash mode did not preserve the address prefixes:"
+	head -1 rsyslog2.out.log
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,33 @@
+# Test for mmcount with four main queue workers. Messages cycle through
+# all severities; for each severity, the counts handed out must be exactly
+# 1 to the number of messages, and impstats must show the final counts.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[mmcount-workers.sh\]: test mmcount with several workers
+source $srcdir/diag.sh init
+rm -f rsyslog.out.stats.log
+awk 'BEGIN {
+	for(i = 0 ; i < 8000 ; ++i)
+		printf("<%d>Mar  1 01:00:00 host1 app: msgnum:%8.8d\n", 8 + i % 8, i) > "rsyslog.input"
+}'
+source $srcdir/diag.sh startup mmcount-workers.conf
+./tcpflood -B -I rsyslog.input
+source $srcdir/diag.sh wait-queueempty
+sleep 3 # let impstats write the final counters
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+for sev in 0 1 2 3 4 5 6 7; do
+	grep "^$sev," rsyslog.out.log | cut -d, -f2 | sort -n > rsyslog.out.sev
+	seq 1 1000 | cmp - rsyslog.out.sev
+	if [ ! $? -eq 0 ]; then
+		echo "counts for severity $sev are not exactly 1..1000"
+		exit 1
+	fi
+	COUNT=$($srcdir/diag.sh get-stat "mmcount(app)" severity.$sev)
+	if [ "$COUNT" != "1000" ]; then
+		echo "impstats shows $COUNT messages of severity $sev, expected 1000"
+		exit 1
+	fi
+done
+rm -f rsyslog.out.sev
+source $srcdir/diag.sh exit
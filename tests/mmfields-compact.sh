@@ -0,0 +1,16 @@
+# Test for mmfields with global(variables.compact="on"), with the fields
+# stored directly under $! and below a jsonRoot container. Messages have
+# random size up to 40000 bytes, so some of them are larger than 32KiB.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[mmfields-compact.sh\]: test mmfields with compact variables
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup mmfields-compact.conf
+source $srcdir/diag.sh tcpflood -p13514 -m2000 -r -d40000
+source $srcdir/diag.sh tcpflood -p13515 -m2000 -r -d40000
+sleep 1 # due to large messages, we need this time for the tcp receiver to settle...
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 1999 -E
+source $srcdir/diag.sh seq-check2 0 1999 -E
+source $srcdir/diag.sh exit
@@ -0,0 +1,33 @@
+# Test for mmjsonparse parser="fast" and lazy="on". Every other message
+# contains a floating point number, so it must be handed to json-c. Every
+# third message repeats a key with objects as values, of which json-c keeps
+# only the last one, so the objects must not be merged. The result must be
+# the same as that of the default json-c parser, and the names referenced
+# in the configuration must survive lazy mode.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[mmjsonparse-fast.sh\]: test mmjsonparse fast parser and lazy mode
+source $srcdir/diag.sh init
+awk 'BEGIN {
+	for(i = 0 ; i < 1000 ; ++i) {
+		extra = (i % 2) ? ", \"f\": 1.5" : ""
+		dup = (i % 3) ? "" : "\"o\":{\"x\":\"dup\"},"
+		printf("<129>Mar  1 01:00:00 host1 tag: @cee:{\"n\":%d,\"s\":\"a\\\"b\",\"b\":true,%s\"o\":{\"k\":\"v%d\"},\"unused\":\"zzz\"%s}\n", i, dup, i, extra) > "rsyslog.input"
+		printf("%d,a\"b,true,v%d,\n", i, i) > "rsyslog.out.expected"
+	}
+}'
+source $srcdir/diag.sh startup mmjsonparse-fast.conf
+./tcpflood -p13514 -B -I rsyslog.input
+./tcpflood -p13515 -B -I rsyslog.input
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+for f in rsyslog.out.log rsyslog2.out.log; do
+	cmp $f rsyslog.out.expected
+	if [ ! $? -eq 0 ]; then
+		echo "unexpected JSON values in $f, first differences:"
+		diff $f rsyslog.out.expected | head -10
+		exit 1
+	fi
+done
+rm -f rsyslog.out.expected
+source $srcdir/diag.sh exit
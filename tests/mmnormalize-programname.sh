@@ -0,0 +1,48 @@
+# Test for the mmnormalize programName filter, its counters and the
+# rulebase reload on HUP. Every other message comes from a program that
+# is not listed and must be skipped. After the first half of the messages
+# the rulebase is replaced by one that sets a different variable.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[mmnormalize-programname.sh\]: test mmnormalize programName and HUP
+source $srcdir/diag.sh init
+rm -f rsyslog.out.stats.log
+cp $srcdir/testsuites/mmnormalize_programname1.rb work-mmnormalize.rb
+awk 'BEGIN {
+	for(i = 0 ; i < 2000 ; ++i) {
+		app = (i % 2) ? "app2" : "app1"
+		out = (i < 1000) ? sprintf("%8.8d,", i) : sprintf(",%8.8d", i)
+		printf("<129>1 2003-03-01T01:00:00Z host1 %s - - - msgnum:%8.8d\n", app, i) > ((i < 1000) ? "rsyslog.input" : "rsyslog.input2")
+		if(i % 2)
+			printf("app2,FAIL,,\n") > "rsyslog.out.expected"
+		else
+			printf("app1,OK,%s\n", out) > "rsyslog.out.expected"
+	}
+}'
+source $srcdir/diag.sh startup mmnormalize-programname.conf
+./tcpflood -B -I rsyslog.input
+source $srcdir/diag.sh wait-queueempty
+cp $srcdir/testsuites/mmnormalize_programname2.rb work-mmnormalize.rb
+kill -HUP `cat rsyslog.pid`
+sleep 1
+./tcpflood -B -I rsyslog.input2
+source $srcdir/diag.sh wait-queueempty
+sleep 3 # let impstats write the final counters
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+cmp rsyslog.out.log rsyslog.out.expected
+if [ ! $? -eq 0 ]; then
+	echo "unexpected normalization results, first differences:"
+	diff rsyslog.out.log rsyslog.out.expected | head -10
+	exit 1
+fi
+SKIPPED=$($srcdir/diag.sh get-stat "mmnormalize(work-mmnormalize.rb)" skipped)
+PARSED=$($srcdir/diag.sh get-stat "mmnormalize(work-mmnormalize.rb)" parsed)
+TAGA=$($srcdir/diag.sh get-stat "mmnormalize(work-mmnormalize.rb)" tag.tagA)
+echo "mmnormalize counters: skipped $SKIPPED, parsed $PARSED, tag.tagA $TAGA"
+if [ "$SKIPPED" != "1000" ] || [ "$PARSED" != "1000" ] || [ "$TAGA" != "500" ]; then
+	echo "unexpected mmnormalize counters"
+	exit 1
+fi
+rm -f rsyslog.out.expected rsyslog.input2 work-mmnormalize.rb
+source $srcdir/diag.sh exit
@@ -0,0 +1,14 @@
+# Test for mmpstrucdata lazy="on". The SD-ID referenced by the template
+# must be stored exactly as without lazy mode.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[mmpstrucdata-lazy.sh\]: test mmpstrucdata lazy mode
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup mmpstrucdata-lazy.conf
+source $srcdir/diag.sh tcpflood -p13514 -m1000 -y
+source $srcdir/diag.sh tcpflood -p13515 -m1000 -y
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 999
+source $srcdir/diag.sh seq-check2 0 999
+source $srcdir/diag.sh exit
@@ -0,0 +1,35 @@
+# Test for mmrfc5424addhmac. The HMAC added to each message must match
+# the one computed by openssl over the raw message. The messages carry an
+# SD-ID longer than 32 characters, and a message that already has the
+# HMAC element must not be modified.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[mmrfc5424addhmac.sh\]: test mmrfc5424addhmac
+if ! hash openssl 2>/dev/null; then
+	echo "openssl not found, skipping test"
+	exit 77
+fi
+source $srcdir/diag.sh init
+SD='[a-very-long-sd-id-that-exceeds-32-characters@32473 x="1"]'
+rm -f rsyslog.out.expected
+for i in $(seq 1 20); do
+	m="<129>1 2003-03-01T01:00:00Z host1 app - - $SD msgnum:$i"
+	echo "$m" >> rsyslog.input
+	HMAC=$(printf '%s' "$m" | openssl dgst -sha256 -hmac testbench-key | awk '{ print $NF }')
+	echo "$SD[hmac@32473 hash=\"$HMAC\"]" >> rsyslog.out.expected
+done
+echo '<129>1 2003-03-01T01:00:00Z host1 app - - [hmac@32473 hash="00"] msgnum:21' >> rsyslog.input
+echo '[hmac@32473 hash="00"]' >> rsyslog.out.expected
+source $srcdir/diag.sh startup mmrfc5424addhmac.conf
+./tcpflood -B -I rsyslog.input
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+sort rsyslog.out.log > rsyslog.out.sorted
+sort rsyslog.out.expected | cmp - rsyslog.out.sorted
+if [ ! $? -eq 0 ]; then
+	echo "unexpected HMACs:"
+	sort rsyslog.out.expected | diff - rsyslog.out.sorted
+	exit 1
+fi
+rm -f rsyslog.out.expected rsyslog.out.sorted
+source $srcdir/diag.sh exit
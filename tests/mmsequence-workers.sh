@@ -0,0 +1,21 @@
+# Test for mmsequence with four main queue workers. Two actions share a
+# counter in "key" mode and another one has its own "instance" counter;
+# no value may be handed out twice or skipped. "random" mode values must
+# stay inside the configured range.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[mmsequence-workers.sh\]: test mmsequence with several workers
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup mmsequence-workers.conf
+source $srcdir/diag.sh tcpflood -m10000 -c4
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 19999
+source $srcdir/diag.sh seq-check2 0 9999
+awk '$1 < 100 || $1 >= 200 { ++bad } END { if(NR != 10000 || bad) exit 1 }' rsyslog.out.random.log
+if [ ! $? -eq 0 ]; then
+	echo "random mode values missing or out of range:"
+	sort -n rsyslog.out.random.log | uniq -c | head -5
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,44 @@
+# Test for mmutf8fix on valid and invalid input. Valid messages (ASCII
+# and multibyte) must pass unmodified, invalid sequences must be replaced
+# wherever they are located relative to the eight byte words scanned by
+# the fast path.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[mmutf8fix-validate.sh\]: test mmutf8fix utf-8 and controlcharacters mode
+source $srcdir/diag.sh init
+printf '%s\n' \
+	'<129>Mar  1 01:00:00 host1 tag: msgnum:1 plain ascii text, long enough for several words' \
+	$'<129>Mar  1 01:00:00 host1 tag: msgnum:2 caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80 ok' \
+	$'<129>Mar  1 01:00:00 host1 tag: msgnum:3 abcdefgh\xffijk' \
+	$'<129>Mar  1 01:00:00 host1 tag: msgnum:4 abcdefghijklmno\xc3A' \
+	$'<129>Mar  1 01:00:00 host1 tag: msgnum:5 abcdefghijklmn\xe2\x82' \
+	$'<129>Mar  1 01:00:00 host1 tag: msgnum:6 abcdefghij\x01k' > rsyslog.input
+printf '%s\n' \
+	' msgnum:1 plain ascii text, long enough for several words' \
+	$' msgnum:2 caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80 ok' \
+	' msgnum:3 abcdefghXijk' \
+	' msgnum:4 abcdefghijklmnoXA' \
+	' msgnum:5 abcdefghijklmnXX' \
+	$' msgnum:6 abcdefghij\x01k' > rsyslog.out.expected
+printf '%s\n' \
+	' msgnum:1 plain ascii text, long enough for several words' \
+	' msgnum:2 caf__ ___ ____ ok' \
+	' msgnum:3 abcdefgh_ijk' \
+	' msgnum:4 abcdefghijklmno_A' \
+	' msgnum:5 abcdefghijklmn__' \
+	' msgnum:6 abcdefghij_k' > rsyslog2.out.expected
+source $srcdir/diag.sh startup mmutf8fix-validate.conf
+./tcpflood -p13514 -B -I rsyslog.input
+./tcpflood -p13515 -B -I rsyslog.input
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+for f in rsyslog.out rsyslog2.out; do
+	cmp $f.log $f.expected
+	if [ ! $? -eq 0 ]; then
+		echo "unexpected mmutf8fix result in $f.log:"
+		diff $f.log $f.expected | cat -v
+		exit 1
+	fi
+done
+rm -f rsyslog.out.expected rsyslog2.out.expected
+source $srcdir/diag.sh exit
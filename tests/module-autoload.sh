@@ -0,0 +1,20 @@
+# Test for loading modules on their first use. imtcp is not loaded via
+# module(), so it must be loaded by its input() statement. imudp is in the
+# module path as well, but not used, so it must not be loaded.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[module-autoload.sh\]: test loading modules on first use
+source $srcdir/diag.sh init
+# the standard startup has no module dir for plugins, so we need our own
+../tools/rsyslogd -u2 -n -irsyslog.pid -M../runtime/.libs:../.libs:../plugins/imtcp/.libs:../plugins/imudp/.libs -f$srcdir/testsuites/module-autoload.conf &
+source $srcdir/diag.sh wait-startup
+if ! grep -q "imtcp.so" /proc/`cat rsyslog.pid`/maps || grep -q "imudp.so" /proc/`cat rsyslog.pid`/maps; then
+	echo "wrong modules loaded:"
+	grep "\.so" /proc/`cat rsyslog.pid`/maps | awk '{ print $6 }' | sort -u
+	exit 1
+fi
+source $srcdir/diag.sh tcpflood -m10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh exit
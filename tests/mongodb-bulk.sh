@@ -0,0 +1,19 @@
+# Test for ommongodb bulk.ordered, bulk.maxDocs and the write concern
+# settings. Batches of 500 messages are inserted with unordered inserts of
+# at most 100 documents, each batch acknowledged by the journal. The
+# documents are built from the template fields, and every message must be
+# stored exactly once. Needs a MongoDB server on localhost and the mongo
+# shell; the test drops the rsyslog_testbench database.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[mongodb-bulk.sh\]: test for ommongodb bulk inserts
+source $srcdir/diag.sh init
+mongo --quiet rsyslog_testbench --eval 'db.dropDatabase()' > /dev/null
+source $srcdir/diag.sh startup mongodb-bulk.conf
+source $srcdir/diag.sh injectmsg  0 10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+mongo --quiet rsyslog_testbench --eval 'db.log.find().forEach(function(d) { print(d.msgnum); })' > rsyslog.out.log
+mongo --quiet rsyslog_testbench --eval 'db.dropDatabase()' > /dev/null
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh exit
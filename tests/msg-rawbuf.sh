@@ -0,0 +1,20 @@
+# Test for the raw message buffer inside msg_t and the lazily allocated
+# timestamp strings. Messages of random length, both shorter and longer
+# than the inline raw buffer, must be stored completely, and both
+# timestamps must be formatted for each of them.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[msg-rawbuf.sh\]: testing raw message buffer and timestamp strings
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup msg-rawbuf.conf
+source $srcdir/diag.sh tcpflood -m10000 -r -d300
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999
+awk -F, 'length($3) != $2 || $3 ~ /[^X]/ || $4 !~ /-03-01T01:00:00/ || $5 !~ /^[0-9][0-9][0-9][0-9]-/ {
+		print "bad line " NR ": " $0; exit 1 }' rsyslog.out.log
+if [ "$?" -ne "0" ]; then
+  echo "message content error detected"
+  exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,38 @@
+# Test for the inline storage of APP-NAME, PROCID and MSGID. The values
+# are sized around the inline buffer limit of 31 characters, and PROCID
+# is also taken from RFC3164 tags. The second output receives the
+# messages through a queued ruleset, which works on copies of them.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[msg-shortstrings.sh\]: test APP-NAME, PROCID and MSGID handling
+source $srcdir/diag.sh init
+awk 'function str(c, n,   s) { s = ""; while(n-- > 0) s = s c; return s }
+BEGIN {
+	split("1 30 31 32 48", alen, " ")
+	split("1 31 32 100", plen, " ")
+	split("1 31 32", mlen, " ")
+	for(i = 0 ; i < 600 ; ++i) {
+		a = str("a", alen[i % 5 + 1]); p = str("1", plen[i % 4 + 1]); m = str("m", mlen[i % 3 + 1])
+		if(i % 2) {
+			printf("<165>1 2003-03-01T01:00:00.000Z host %s %s %s - msgnum:%8.8d:\n", a, p, m, i) > "rsyslog.input"
+			printf("%s,%s,%s,msgnum:%8.8d:\n", a, p, m, i) > "rsyslog.out.expected"
+		} else {
+			printf("<129>Mar  1 01:00:00 host %s[%s]: msgnum:%8.8d:\n", a, p, i) > "rsyslog.input"
+			printf("%s,%s,-, msgnum:%8.8d:\n", a, p, i) > "rsyslog.out.expected"
+		}
+	}
+}'
+source $srcdir/diag.sh startup msg-shortstrings.conf
+./tcpflood -B -I rsyslog.input
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+for f in rsyslog.out.log rsyslog2.out.log ; do
+	cmp $f rsyslog.out.expected
+	if [ ! $? -eq 0 ]; then
+		echo "unexpected result in $f, first differences:"
+		diff $f rsyslog.out.expected | head -10
+		exit 1
+	fi
+done
+rm -f rsyslog.out.expected
+source $srcdir/diag.sh exit
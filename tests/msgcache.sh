@@ -0,0 +1,16 @@
+# Test for the per-thread msg_t cache. Messages are created by the
+# input thread and destroyed by several queue workers, so most of them
+# are returned to their cache by other threads.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[msgcache.sh\]: testing the msg_t object cache
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup msgcache.conf
+
+source $srcdir/diag.sh tcpflood -m50000 -c4
+source $srcdir/diag.sh tcpflood -m10000 -i50000
+
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 59999
+source $srcdir/diag.sh exit
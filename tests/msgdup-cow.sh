@@ -0,0 +1,19 @@
+# Test for copy-on-write JSON trees of duplicated messages. "call" to a
+# ruleset with its own queue duplicates the message. Both the original and
+# the duplicate modify their $! variables afterwards, and each of them must
+# only see its own modifications.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[msgdup-cow.sh\]: testing copy-on-write for duplicated messages
+source $srcdir/diag.sh init
+rm -f rsyslog2.out.log
+source $srcdir/diag.sh startup msgdup-cow.conf
+source $srcdir/diag.sh injectmsg  0 10000
+# the ruleset queue may need some time to drain, see rulesetmultiqueue.sh
+sleep 2
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh seq-check2 0 9999
+rm -f rsyslog2.out.log
+source $srcdir/diag.sh exit
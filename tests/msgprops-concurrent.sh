@@ -0,0 +1,28 @@
+# Test for lazily computed message properties. Several action queues with
+# multiple workers each format the same messages concurrently, so the
+# properties are computed by whichever thread gets there first. All
+# outputs must contain complete and identical values.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[msgprops-concurrent.sh\]: testing concurrent access to lazy message properties
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup msgprops-concurrent.conf
+source $srcdir/diag.sh injectmsg 0 20000
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 19999
+for i in 1 2 3; do
+  sort -g < rsyslog.out.props$i.log > work-props$i
+done
+awk -F, '$2 != "tag" || $3 != "tag" || $4 != "-" || $5 !~ /-03-01T01:00:00/ ||
+	 $6 != "Mar  1 01:00:00" { print "bad line: " $0; exit 1 }' work-props1
+if [ "$?" -ne "0" ]; then
+  echo "incomplete message property detected"
+  exit 1
+fi
+if ! cmp work-props1 work-props2 || ! cmp work-props1 work-props3; then
+  echo "message properties differ between actions"
+  exit 1
+fi
+rm -f work-props*
+source $srcdir/diag.sh exit
@@ -0,0 +1,44 @@
+# Test for the comparison done by "last message repeated n times"
+# processing. Only messages with the same MSG, HOSTNAME, APPNAME and
+# PROCID are repeats, a difference in any of them must end the repeat
+# sequence. A single repeat is emitted as the message itself.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[msgreduc-compare.sh\]: test repeated message detection
+source $srcdir/diag.sh init
+awk 'BEGIN {
+	for(i = 0 ; i < 5 ; ++i)
+		print "<133>Mar  1 01:00:00 rpt1 app[1]: msg A"
+	print "<133>Mar  1 01:00:00 rpt2 app[1]: msg A"
+	print "<133>Mar  1 01:00:00 rpt2 other[1]: msg A"
+	print "<133>Mar  1 01:00:00 rpt2 other[2]: msg A"
+	print "<133>Mar  1 01:00:00 rpt2 other[2]: msg A"
+	print "<133>Mar  1 01:00:00 rpt2 other[2]: msg B"
+	print "<133>Mar  1 01:00:00 rpt2 other[2]: msg B"
+	print "<133>Mar  1 01:00:00 rpt2 other[2]: msg BB"
+	print "<133>Mar  1 01:00:00 rpt2 other[2]: msg C"
+}' > rsyslog.input
+source $srcdir/diag.sh startup msgreduc-compare.conf
+./tcpflood -B -I rsyslog.input
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+cat > rsyslog.out.expected <<'EOX'
+rpt1,app,1, msg A
+rpt1,app,1, message repeated 4 times: [ msg A]
+rpt2,app,1, msg A
+rpt2,other,1, msg A
+rpt2,other,2, msg A
+rpt2,other,2, msg A
+rpt2,other,2, msg B
+rpt2,other,2, msg B
+rpt2,other,2, msg BB
+rpt2,other,2, msg C
+EOX
+cmp rsyslog.out.log rsyslog.out.expected
+if [ $? -ne 0 ]; then
+	echo "unexpected output, diff is:"
+	diff rsyslog.out.log rsyslog.out.expected | head -10
+	exit 1
+fi
+rm -f rsyslog.out.expected
+source $srcdir/diag.sh exit
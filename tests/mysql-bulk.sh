@@ -0,0 +1,16 @@
+# Test for ommysql bulkMode and bulk.maxBytes. The inserts of each batch of
+# 500 messages are merged into multi-row INSERT statements, which are split
+# at 4k. Every message must be inserted exactly once.
+# This file is part of the rsyslog project, released under GPLv3
+echo ===============================================================================
+echo \[mysql-bulk.sh\]: test for ommysql bulk mode
+source $srcdir/diag.sh init
+mysql --user=rsyslog --password=testbench < testsuites/mysql-truncate.sql
+source $srcdir/diag.sh startup mysql-bulk.conf
+source $srcdir/diag.sh injectmsg  0 10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown 
+# note "-s" is requried to suppress the select "field header"
+mysql -s --user=rsyslog --password=testbench < testsuites/mysql-select-msg.sql > rsyslog.out.log
+source $srcdir/diag.sh seq-check  0 9999
+source $srcdir/diag.sh exit
@@ -0,0 +1,369 @@
+/* omasynctest.c
+ * This is a testbench tool, not meant for production use. It is an output
+ * module that implements commitTransactionAsync(): transactions are handed
+ * to a completion thread per worker instance, which writes the messages to
+ * a file after a delay and then reports the outcome. Parameters:
+ *
+ * file      - output file name (mandatory)
+ * delay     - ms before a transaction is completed (default 10)
+ * failevery - complete every n-th asynchronous transaction with
+ *             RS_RET_SUSPENDED without writing it (default 0 - never)
+ * hold      - "on" to never complete asynchronous transactions, which
+ *             lets them pile up until shutdown
+ *
+ * Copyright 2026 Adiscon GmbH.
+ *
+ * This file is part of rsyslog.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include "rsyslog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "conf.h"
+#include "syslogd-types.h"
+#include "srUtils.h"
+#include "template.h"
+#include "module-template.h"
+#include "errmsg.h"
+
+MODULE_TYPE_OUTPUT
+MODULE_TYPE_NOKEEP
+MODULE_CNFNAME("omasynctest")
+
+
+DEFobjCurrIf(errmsg);
+DEF_OMOD_STATIC_DATA
+
+typedef struct _instanceData {
+	uchar *fileName;
+	int fd;
+	int iDelay;		/* ms before a transaction is completed */
+	int iFailEvery;		/* fail every n-th transaction, 0 - never */
+	sbool bHold;		/* never complete asynchronous transactions */
+	unsigned nTx;		/* number of asynchronous transactions, guarded by mut */
+	pthread_mutex_t mut;	/* also serializes writes to fd */
+} instanceData;
+
+/* a transaction waiting for completion */
+typedef struct asyncTx_s {
+	actAsyncTx_t *pTx;
+	actWrkrIParams_t *pParams;
+	unsigned nParams;
+	sbool bFail;
+	struct asyncTx_s *pNext;
+} asyncTx_t;
+
+typedef struct wrkrInstanceData {
+	instanceData *pData;
+	pthread_t thrd;
+	sbool bThrdRunning;
+	sbool bStop;
+	asyncTx_t *pHead;
+	asyncTx_t *pTail;
+	pthread_mutex_t mut;
+	pthread_cond_t cond;
+} wrkrInstanceData_t;
+
+struct modConfData_s {
+	rsconf_t *pConf;	/* our overall config object */
+};
+static modConfData_t *loadModConf = NULL;/* modConf ptr to use for the current load process */
+static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current exec process */
+
+/* action (instance) parameters */
+static struct cnfparamdescr actpdescr[] = {
+	{ "file", eCmdHdlrGetWord, CNFPARAM_REQUIRED },
+	{ "template", eCmdHdlrGetWord, 0 },
+	{ "delay", eCmdHdlrNonNegInt, 0 },
+	{ "failevery", eCmdHdlrNonNegInt, 0 },
+	{ "hold", eCmdHdlrBinary, 0 }
+};
+static struct cnfparamblk actpblk =
+	{ CNFPARAMBLK_VERSION,
+	  sizeof(actpdescr)/sizeof(struct cnfparamdescr),
+	  actpdescr
+	};
+
+BEGINbeginCnfLoad
+CODESTARTbeginCnfLoad
+	loadModConf = pModConf;
+	pModConf->pConf = pConf;
+ENDbeginCnfLoad
+
+BEGINendCnfLoad
+CODESTARTendCnfLoad
+ENDendCnfLoad
+
+BEGINcheckCnf
+CODESTARTcheckCnf
+ENDcheckCnf
+
+BEGINactivateCnf
+CODESTARTactivateCnf
+	runModConf = pModConf;
+ENDactivateCnf
+
+BEGINfreeCnf
+CODESTARTfreeCnf
+ENDfreeCnf
+
+
+BEGINcreateInstance
+CODESTARTcreateInstance
+	pData->fd = -1;
+	pData->iDelay = 10;
+	pthread_mutex_init(&pData->mut, NULL);
+ENDcreateInstance
+
+
+BEGINcreateWrkrInstance
+CODESTARTcreateWrkrInstance
+	pthread_mutex_init(&pWrkrData->mut, NULL);
+	pthread_cond_init(&pWrkrData->cond, NULL);
+ENDcreateWrkrInstance
+
+
+BEGINisCompatibleWithFeature
+CODESTARTisCompatibleWithFeature
+ENDisCompatibleWithFeature
+
+
+BEGINfreeInstance
+CODESTARTfreeInstance
+	if(pData->fd != -1)
+		close(pData->fd);
+	free(pData->fileName);
+	pthread_mutex_destroy(&pData->mut);
+ENDfreeInstance
+
+
+/* stop the completion thread. Transactions still pending (only in hold
+ * mode) are dropped without calling done(): the core has given up on
+ * them before it frees the worker instance.
+ */
+BEGINfreeWrkrInstance
+	asyncTx_t *pAtx;
+CODESTARTfreeWrkrInstance
+	if(pWrkrData->bThrdRunning) {
+		pthread_mutex_lock(&pWrkrData->mut);
+		pWrkrData->bStop = 1;
+		pthread_cond_signal(&pWrkrData->cond);
+		pthread_mutex_unlock(&pWrkrData->mut);
+		pthread_join(pWrkrData->thrd, NULL);
+	}
+	while(pWrkrData->pHead != NULL) {
+		pAtx = pWrkrData->pHead;
+		pWrkrData->pHead = pAtx->pNext;
+		free(pAtx);
+	}
+	pthread_mutex_destroy(&pWrkrData->mut);
+	pthread_cond_destroy(&pWrkrData->cond);
+ENDfreeWrkrInstance
+
+
+BEGINnewActInst
+	struct cnfparamvals *pvals;
+	uchar *tplName = NULL;
+	int i;
+CODESTARTnewActInst
+	if((pvals = nvlstGetParams(lst, &actpblk, NULL)) == NULL) {
+		ABORT_FINALIZE(RS_RET_MISSING_CNFPARAMS);
+	}
+
+	CHKiRet(createInstance(&pData));
+	for(i = 0 ; i < actpblk.nParams ; ++i) {
+		if(!pvals[i].bUsed)
+			continue;
+		if(!strcmp(actpblk.descr[i].name, "file")) {
+			pData->fileName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "template")) {
+			tplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "delay")) {
+			pData->iDelay = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "failevery")) {
+			pData->iFailEvery = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "hold")) {
+			pData->bHold = (sbool) pvals[i].val.d.n;
+		} else {
+			dbgprintf("omasynctest: program error, non-handled "
+			  "param '%s'\n", actpblk.descr[i].name);
+		}
+	}
+	pData->fd = open((char*)pData->fileName, O_WRONLY|O_APPEND|O_CREAT|O_CLOEXEC, 0644);
+	if(pData->fd == -1) {
+		errmsg.LogError(errno, RS_RET_FOPEN_FAILURE, "omasynctest: can not open '%s'",
+				pData->fileName);
+		ABORT_FINALIZE(RS_RET_FOPEN_FAILURE);
+	}
+
+	CODE_STD_STRING_REQUESTnewActInst(1)
+	CHKiRet(OMSRsetEntry(*ppOMSR, 0, (tplName == NULL) ?
+		ustrdup(UCHAR_CONSTANT("RSYSLOG_FileFormat")) : tplName, OMSR_NO_RQD_TPL_OPTS));
+	tplName = NULL;
+CODE_STD_FINALIZERnewActInst
+	free(tplName);
+	cnfparamvalsDestruct(pvals, &actpblk);
+ENDnewActInst
+
+
+BEGINdbgPrintInstInfo
+CODESTARTdbgPrintInstInfo
+	dbgprintf("omasynctest\n");
+	dbgprintf("\tfile='%s'\n", pData->fileName);
+	dbgprintf("\tdelay=%d, failevery=%d, hold=%d\n", pData->iDelay, pData->iFailEvery, pData->bHold);
+ENDdbgPrintInstInfo
+
+
+BEGINtryResume
+CODESTARTtryResume
+ENDtryResume
+
+
+BEGINbeginTransaction
+CODESTARTbeginTransaction
+ENDbeginTransaction
+
+
+/* write the messages of a transaction, each one with a single write(), so
+ * that lines of concurrent workers do not get mixed
+ */
+static rsRetVal
+writeParams(instanceData *pData, actWrkrIParams_t *const pParams, const unsigned nParams)
+{
+	unsigned i;
+	DEFiRet;
+
+	pthread_mutex_lock(&pData->mut);
+	for(i = 0 ; i < nParams ; ++i) {
+		if(write(pData->fd, actParam(pParams, 1, i, 0).param,
+			 actParam(pParams, 1, i, 0).lenStr) != (ssize_t) actParam(pParams, 1, i, 0).lenStr) {
+			DBGPRINTF("omasynctest: write error %d\n", errno);
+			iRet = RS_RET_SUSPENDED;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&pData->mut);
+	RETiRet;
+}
+
+
+/* the completion thread of a worker instance */
+static void *
+completionThread(void *arg)
+{
+	wrkrInstanceData_t *const pWrkrData = (wrkrInstanceData_t*) arg;
+	asyncTx_t *pAtx;
+	rsRetVal iRet;
+
+	pthread_mutex_lock(&pWrkrData->mut);
+	while(1) {
+		while(pWrkrData->pHead == NULL && !pWrkrData->bStop)
+			pthread_cond_wait(&pWrkrData->cond, &pWrkrData->mut);
+		if(pWrkrData->bStop)
+			break;
+		pAtx = pWrkrData->pHead;
+		pWrkrData->pHead = pAtx->pNext;
+		if(pWrkrData->pHead == NULL)
+			pWrkrData->pTail = NULL;
+		pthread_mutex_unlock(&pWrkrData->mut);
+
+		srSleep(pWrkrData->pData->iDelay / 1000, (pWrkrData->pData->iDelay % 1000) * 1000);
+		if(pAtx->bFail)
+			iRet = RS_RET_SUSPENDED;
+		else
+			iRet = writeParams(pWrkrData->pData, pAtx->pParams, pAtx->nParams);
+		pAtx->pTx->done(pAtx->pTx, iRet);
+		free(pAtx);
+
+		pthread_mutex_lock(&pWrkrData->mut);
+	}
+	pthread_mutex_unlock(&pWrkrData->mut);
+	return NULL;
+}
+
+
+BEGINcommitTransaction
+CODESTARTcommitTransaction
+	iRet = writeParams(pWrkrData->pData, pParams, nParams);
+ENDcommitTransaction
+
+
+BEGINcommitTransactionAsync
+	instanceData *const pData = pWrkrData->pData;
+	asyncTx_t *pAtx;
+CODESTARTcommitTransactionAsync
+	CHKmalloc(pAtx = calloc(1, sizeof(asyncTx_t)));
+	pAtx->pTx = pTx;
+	pAtx->pParams = pParams;
+	pAtx->nParams = nParams;
+	pthread_mutex_lock(&pData->mut);
+	++pData->nTx;
+	pAtx->bFail = pData->iFailEvery != 0 && pData->nTx % pData->iFailEvery == 0;
+	pthread_mutex_unlock(&pData->mut);
+
+	pthread_mutex_lock(&pWrkrData->mut);
+	if(pWrkrData->pTail == NULL)
+		pWrkrData->pHead = pAtx;
+	else
+		pWrkrData->pTail->pNext = pAtx;
+	pWrkrData->pTail = pAtx;
+	if(!pWrkrData->bThrdRunning && !pData->bHold) {
+		if(pthread_create(&pWrkrData->thrd, NULL, completionThread, pWrkrData) == 0)
+			pWrkrData->bThrdRunning = 1;
+	}
+	pthread_cond_signal(&pWrkrData->cond);
+	pthread_mutex_unlock(&pWrkrData->mut);
+	iRet = RS_RET_IN_FLIGHT;
+finalize_it:
+ENDcommitTransactionAsync
+
+
+BEGINparseSelectorAct
+CODESTARTparseSelectorAct
+CODE_STD_STRING_REQUESTparseSelectorAct(1)
+	ABORT_FINALIZE(RS_RET_CONFLINE_UNPROCESSED);
+CODE_STD_FINALIZERparseSelectorAct
+ENDparseSelectorAct
+
+
+BEGINmodExit
+CODESTARTmodExit
+	objRelease(errmsg, CORE_COMPONENT);
+ENDmodExit
+
+
+BEGINqueryEtryPt
+CODESTARTqueryEtryPt
+CODEqueryEtryPt_STD_OMODTX_QUERIES
+CODEqueryEtryPt_OMODTX_ASYNC_QUERIES
+CODEqueryEtryPt_STD_OMOD8_QUERIES
+CODEqueryEtryPt_STD_CONF2_OMOD_QUERIES
+CODEqueryEtryPt_STD_CONF2_QUERIES
+ENDqueryEtryPt
+
+
+BEGINmodInit()
+CODESTARTmodInit
+	*ipIFVersProvided = CURR_MOD_IF_VERSION; /* we only support the current interface specification */
+CODEmodInit_QueryRegCFSLineHdlr
+	CHKiRet(objUse(errmsg, CORE_COMPONENT));
+ENDmodInit
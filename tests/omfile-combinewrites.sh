@@ -0,0 +1,15 @@
+# Test for omfile combinewrites="on" with four action queue workers. The
+# messages have random length, and the batches of several workers are
+# written together from their private buffers. Lost, duplicated or
+# interleaved lines break the sequence or the data check.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[omfile-combinewrites.sh\]: test for omfile combined writes of multiple workers
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup omfile-combinewrites.conf
+source $srcdir/diag.sh tcpflood -m20000 -r -d3000 -P129
+sleep 1 # due to large messages, we need this time for the tcp receiver to settle...
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 19999 -E
+source $srcdir/diag.sh exit
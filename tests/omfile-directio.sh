@@ -0,0 +1,22 @@
+# Test for omfile directio="on" with four action queue workers writing
+# to the same file. Messages have random length, so writes regularly end
+# inside a block. Lost, duplicated or interleaved lines break the
+# sequence or the data check. The second run appends to the now unaligned
+# file, which exercises reading back its last block on open.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[omfile-directio.sh\]: test for omfile O_DIRECT output with multiple workers
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup omfile-directio.conf
+source $srcdir/diag.sh tcpflood -m5000 -r -d3000 -P129
+sleep 1 # due to large messages, we need this time for the tcp receiver to settle...
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 4999 -E
+source $srcdir/diag.sh startup omfile-directio.conf
+source $srcdir/diag.sh tcpflood -m5000 -i5000 -r -d3000 -P129
+sleep 1
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999 -E
+source $srcdir/diag.sh exit
@@ -0,0 +1,26 @@
+# Test for omfile preallocate.size. While rsyslogd runs, the file size must
+# still be exactly what was written. After shutdown, all messages must be
+# there and the unused preallocated space must have been released again.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[omfile-preallocate.sh\]: test for omfile file space preallocation
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup omfile-preallocate.conf
+source $srcdir/diag.sh tcpflood -m5000
+source $srcdir/diag.sh wait-queueempty
+./msleep 500 # let the writer flush its buffer
+if [ `stat -c %s rsyslog.out.log` -ne `cat rsyslog.out.log | wc -c` ]; then
+	echo "file size does not match the data written"
+	ls -l rsyslog.out.log
+	exit 1
+fi
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 4999
+# 5000 messages are 45000 bytes, so a leftover preallocation of 4m shows
+if [ `du -k rsyslog.out.log | cut -f1` -gt 1024 ]; then
+	echo "preallocated space was not released"
+	du -k rsyslog.out.log
+	exit 1
+fi
+source $srcdir/diag.sh exit
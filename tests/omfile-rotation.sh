@@ -0,0 +1,52 @@
+# Test for omfile size limit rotation at the action. In numbered mode no
+# message may be lost and the rotated files must be in order, with
+# rotation.keep only the newest files must be left. In timestamp mode
+# the size limit command must be run for each rotated file.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[omfile-rotation.sh\]: test omfile rotation.sizelimit and rotation.mode
+source $srcdir/diag.sh init
+rm -f rsyslog.out.numbered.log* rsyslog.out.keep.log* rsyslog.out.timestamp.log* rsyslog.out.rotated.log
+source $srcdir/diag.sh startup omfile-rotation.conf
+source $srcdir/diag.sh tcpflood -m20000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+sleep 1 # the size limit commands run in the background
+NFILES=$(ls rsyslog.out.numbered.log.* | wc -l)
+if [ $NFILES -lt 10 ]; then
+	echo "only $NFILES rotated files, expected at least 10"
+	exit 1
+fi
+rm -f rsyslog.out.log
+for i in $(seq $NFILES -1 1); do
+	cat rsyslog.out.numbered.log.$i >> rsyslog.out.log
+done
+cat rsyslog.out.numbered.log >> rsyslog.out.log
+sort -n -c rsyslog.out.log
+if [ ! $? -eq 0 ]; then
+	echo "rotated files are not in order"
+	exit 1
+fi
+source $srcdir/diag.sh seq-check 0 19999
+if [ "$(ls rsyslog.out.keep.log.*)" != "rsyslog.out.keep.log.1
+rsyslog.out.keep.log.2" ]; then
+	echo "rotation.keep not honored, rotated files:"
+	ls rsyslog.out.keep.log.*
+	exit 1
+fi
+if [ $(ls rsyslog.out.timestamp.log.* | wc -l) -ne $(wc -l < rsyslog.out.rotated.log) ] || \
+   [ $(sort -u rsyslog.out.rotated.log | wc -l) -lt 10 ]; then
+	echo "size limit command not run for each rotated file:"
+	ls rsyslog.out.timestamp.log.*
+	cat rsyslog.out.rotated.log
+	exit 1
+fi
+for f in $(cat rsyslog.out.rotated.log); do
+	if [ ! -f $f ]; then
+		echo "size limit command received wrong file name $f"
+		exit 1
+	fi
+done
+cat rsyslog.out.timestamp.log* > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 19999
+source $srcdir/diag.sh exit
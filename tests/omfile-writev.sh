@@ -0,0 +1,13 @@
+# Test for vectored writes in omfile. The IO buffer is much smaller than a
+# batch, so transactions are written directly from the template buffers.
+# All messages must be written exactly once and in order.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[omfile-writev.sh\]: testing omfile vectored writes
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup omfile-writev.conf
+source $srcdir/diag.sh injectmsg  0 20000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 19999
+source $srcdir/diag.sh exit
@@ -0,0 +1,30 @@
+# Test omhdfs block buffering. Two actions write into the same file and
+# share its buffer, a third one writes a different file in parallel.
+# Needs an HDFS namenode on localhost:8020 and the "hdfs" client; the
+# test directory /tmp/rsyslog_testbench is deleted by the test.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[omhdfs-block.sh\]: test omhdfs block size and flush interval
+if ! hash hdfs 2>/dev/null; then
+	echo "hdfs client not found, skipping test"
+	exit 77
+fi
+. $srcdir/diag.sh init
+hdfs dfs -rm -r -f /tmp/rsyslog_testbench > /dev/null 2>&1
+hdfs dfs -mkdir -p /tmp/rsyslog_testbench
+. $srcdir/diag.sh startup omhdfs-block.conf
+. $srcdir/diag.sh tcpflood -m30000 -f3
+# let the flush interval expire with no new messages
+sleep 3
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+hdfs dfs -cat /tmp/rsyslog_testbench/omhdfs-a.log > rsyslog.out.a.log
+hdfs dfs -cat /tmp/rsyslog_testbench/omhdfs-b.log > rsyslog.out.b.log
+if grep -q "^2," rsyslog.out.a.log || grep -qv "^2," rsyslog.out.b.log; then
+	echo "messages written to the wrong file"
+	exit 1
+fi
+cat rsyslog.out.a.log rsyslog.out.b.log | cut -d, -f2 | sort -n > rsyslog.out.log
+hdfs dfs -rm -r -f /tmp/rsyslog_testbench > /dev/null 2>&1
+. $srcdir/diag.sh seq-check 0 29999
+. $srcdir/diag.sh exit
@@ -0,0 +1,29 @@
+# Test for omjournal with the socket and template parameters. A socket
+# receiver takes the place of journald. Each datagram must contain the
+# fields generated by the template in journald's native format, lines
+# that are not fields must be left out.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[omjournal-socket.sh\]: test omjournal native protocol output
+source $srcdir/diag.sh init
+awk 'BEGIN {
+	for(i = 0 ; i < 10000 ; ++i)
+		printf("PRIORITY=7\nTEST_NUM=%8.8d\nMESSAGE=msgnum %8.8d\n", i, i) > "rsyslog.out.expected"
+}'
+./uxsockrcvr -srsyslog-testbench-journal-sock -orsyslog.out.journal.log &
+BGPROCESS=$!
+source $srcdir/diag.sh startup omjournal-socket.conf
+source $srcdir/diag.sh injectmsg 0 10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+kill $BGPROCESS
+wait $BGPROCESS
+mv rsyslog.out.journal.log rsyslog.out.log
+cmp rsyslog.out.log rsyslog.out.expected
+if [ ! $? -eq 0 ]; then
+	echo "unexpected journal entries, first differences:"
+	diff rsyslog.out.log rsyslog.out.expected | head -10
+	exit 1
+fi
+rm -f rsyslog.out.expected
+source $srcdir/diag.sh exit
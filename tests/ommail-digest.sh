@@ -0,0 +1,35 @@
+# Test for ommail digest mode and SMTP session reuse. A minimal SMTP
+# server receives the mails. 1000 messages with a digest size of 100 must
+# result in 10 mails. The first 9 are sent by the action worker over one
+# kept-open session, the last one is flushed on shutdown via a session of
+# its own. The test is run with and without PIPELINING.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[ommail-digest.sh\]: test ommail digest mode and session reuse
+for smtpopt in "" "-P" ; do
+	source $srcdir/diag.sh init
+	rm -f rsyslog.out.mail.log
+	./minismtpsrv -p 13520 -f rsyslog.out.mail.log $smtpopt &
+	SMTPSRV=$!
+	sleep 1
+	source $srcdir/diag.sh startup ommail-digest.conf
+	source $srcdir/diag.sh injectmsg 0 1000
+	source $srcdir/diag.sh shutdown-when-empty
+	source $srcdir/diag.sh wait-shutdown
+	sleep 1 # let the server sessions finish
+	kill $SMTPSRV
+	wait $SMTPSRV
+	NMAILS=$(grep -c "^mail$" rsyslog.out.mail.log)
+	if [ "$NMAILS" != "10" ]; then
+		echo "expected 10 digest mails, got $NMAILS (server options: '$smtpopt')"
+		exit 1
+	fi
+	NSESSIONS=$(grep -c "^session$" rsyslog.out.mail.log)
+	if [ "$NSESSIONS" != "2" ]; then
+		echo "expected 2 SMTP sessions, got $NSESSIONS (server options: '$smtpopt')"
+		exit 1
+	fi
+	grep "^[0-9]" rsyslog.out.mail.log > rsyslog.out.log
+	source $srcdir/diag.sh seq-check 0 999
+done
+source $srcdir/diag.sh exit
@@ -0,0 +1,45 @@
+# Test for ompipe buffer.overflow="dropoldest". The pipe reader is stalled
+# until all messages are processed, so the pipe and the buffer fill up and
+# the oldest buffered messages must be dropped. What is already in the pipe
+# can not be dropped, so the first message as well as the last one must
+# arrive once the reader starts, and the dropped counter must account for
+# the messages that did not.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[ompipe-dropoldest.sh\]: testing ompipe buffer overflow policy dropoldest
+source $srcdir/diag.sh init
+mkfifo ./rsyslog.pipe
+# hold the pipe open for reading, but do not read
+sleep 1000 < ./rsyslog.pipe &
+STALLPROCESS=$!
+source $srcdir/diag.sh startup ompipe-dropoldest.conf
+source $srcdir/diag.sh injectmsg 0 2000
+source $srcdir/diag.sh wait-queueempty
+sleep 3 # let impstats emit at least one line after the burst
+cat ./rsyslog.pipe > rsyslog.out.log &
+CATPROCESS=$!
+kill $STALLPROCESS
+sleep 2 # let the flusher write the buffer
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+wait $CATPROCESS
+NRECV=`wc -l < rsyslog.out.log`
+echo $NRECV messages received
+grep "ompipe(./rsyslog.pipe): " rsyslog.out.stats.log | tail -1 | awk -v nRecv=$NRECV '{
+	for(i = 1 ; i <= NF ; ++i) {
+		split($i, kv, "=")
+		if(kv[1] == "dropped") nDropped = kv[2]
+	}
+} END { exit (nDropped > 0 && nDropped + nRecv == 2000) ? 0 : 1 }'
+if [ $? -ne 0 ]; then
+	echo "dropped counter wrong, stats are:"
+	cat rsyslog.out.stats.log
+	exit 1
+fi
+sort -g < rsyslog.out.log > work
+if [ "`head -1 work | cut -d' ' -f1`" != "00000000" ] || [ "`tail -1 work | cut -d' ' -f1`" != "00001999" ]; then
+	echo "first or last message missing, received:"
+	cat work
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,35 @@
+# Test for ompipe buffer.overflow="suspend". The pipe reader is stalled
+# for a while, so the pipe and the buffer fill up and the action must be
+# suspended. Once the reader starts, the action resumes and all messages
+# must arrive.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[ompipe-suspend.sh\]: testing ompipe buffer overflow policy suspend
+source $srcdir/diag.sh init
+mkfifo ./rsyslog.pipe
+# hold the pipe open for reading, but do not read
+sleep 1000 < ./rsyslog.pipe &
+STALLPROCESS=$!
+source $srcdir/diag.sh startup ompipe-suspend.conf
+source $srcdir/diag.sh injectmsg 0 2000
+sleep 4 # let the action be suspended and impstats report it
+cat ./rsyslog.pipe > rsyslog.out.log &
+CATPROCESS=$!
+kill $STALLPROCESS
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+wait $CATPROCESS
+grep "ompipe(./rsyslog.pipe): " rsyslog.out.stats.log | tail -1 | awk '{
+	for(i = 1 ; i <= NF ; ++i) {
+		split($i, kv, "=")
+		if(kv[1] == "suspended") nSuspended = kv[2]
+		if(kv[1] == "dropped") nDropped = kv[2]
+	}
+} END { exit (nSuspended > 0 && nDropped == 0) ? 0 : 1 }'
+if [ $? -ne 0 ]; then
+	echo "suspended/dropped counters wrong, stats are:"
+	cat rsyslog.out.stats.log
+	exit 1
+fi
+source $srcdir/diag.sh seq-check 0 1999
+source $srcdir/diag.sh exit
@@ -0,0 +1,31 @@
+# Test omprog with a pool of processes that acknowledge each message.
+# Messages are spread by hashtemplate over 3 children; all messages must
+# arrive, and all messages of one dynafile id must go to the same child.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[omprog-confirm.sh\]: test omprog processes, hashtemplate and confirmMessages
+. $srcdir/diag.sh init
+rm -f rsyslog.out.prog.*.log
+. $srcdir/diag.sh startup omprog-confirm.conf
+. $srcdir/diag.sh tcpflood -m10000 -f5
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+NPROCS=$(ls rsyslog.out.prog.*.log 2>/dev/null | wc -l)
+if [ $NPROCS -lt 2 ]; then
+	echo "expected messages spread over several processes, got $NPROCS"
+	exit 1
+fi
+# every dynafile id must be handled by exactly one process
+for f in rsyslog.out.prog.*.log; do
+	cut -d, -f1 $f | sort -u
+done | sort | uniq -d > rsyslog.out.dups
+if [ -s rsyslog.out.dups ]; then
+	echo "hash keys handled by more than one process:"
+	cat rsyslog.out.dups
+	exit 1
+fi
+rm -f rsyslog.out.dups
+cut -d, -f2 rsyslog.out.prog.*.log | sort -n > rsyslog.out.log
+rm -f rsyslog.out.prog.*.log
+. $srcdir/diag.sh seq-check 0 9999
+. $srcdir/diag.sh exit
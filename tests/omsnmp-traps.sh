@@ -0,0 +1,28 @@
+# Test for omsnmp with SNMPv1 and SNMPv2c traps, which are built from a
+# prepared PDU. snmptrapd receives the traps, and each message must show
+# up once per trap version. This needs snmptrapd from net-snmp.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[omsnmp-traps.sh\]: test omsnmp SNMPv1 and SNMPv2c traps
+if ! which snmptrapd > /dev/null 2>&1 ; then
+	echo "snmptrapd not found - skipping test"
+	exit 77
+fi
+source $srcdir/diag.sh init
+rm -f rsyslog.out.traps.log
+snmptrapd -f -n -C -c $srcdir/testsuites/omsnmp-snmptrapd.conf -Lf rsyslog.out.traps.log \
+	udp:127.0.0.1:13520 &
+TRAPD=$!
+sleep 1
+source $srcdir/diag.sh startup omsnmp-traps.conf
+source $srcdir/diag.sh injectmsg 0 1000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+sleep 1 # let snmptrapd write the last traps
+kill $TRAPD
+wait $TRAPD
+grep -o "v1:[0-9]*" rsyslog.out.traps.log | cut -d: -f2 > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 999
+grep -o "v2:[0-9]*" rsyslog.out.traps.log | cut -d: -f2 > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 999
+source $srcdir/diag.sh exit
@@ -0,0 +1,19 @@
+# Test omudpspoof with batched sendmmsg() and with the libnet path
+# (batchsize 0). Messages of random size up to 4000 bytes are sent with
+# an mtu of 1500, so many of them are fragmented; all of them must be
+# reassembled and received completely. Needs root for the raw socket.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[omudpspoof-batch.sh\]: test omudpspoof batchsize
+if [ "$EUID" -ne 0 ]; then
+	echo "omudpspoof needs root, skipping test"
+	exit 77
+fi
+. $srcdir/diag.sh init
+. $srcdir/diag.sh startup omudpspoof-batch.conf
+. $srcdir/diag.sh tcpflood -m1000 -r -d4000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 0 999 -E
+. $srcdir/diag.sh seq-check2 0 999 -E
+. $srcdir/diag.sh exit
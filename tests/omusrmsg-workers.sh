@@ -0,0 +1,24 @@
+# Test for omusrmsg with concurrent action workers. All workers share the
+# cached list of logged on users, which must be safe to refresh and scan
+# from several threads at once. The message goes to a user who is not
+# logged on, so no terminal is written to. Every message must be
+# processed by the omusrmsg action without failure.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[omusrmsg-workers.sh\]: test omusrmsg with concurrent workers
+source $srcdir/diag.sh init
+rm -f rsyslog.out.stats.log
+source $srcdir/diag.sh startup omusrmsg-workers.conf
+source $srcdir/diag.sh injectmsg 0 20000
+source $srcdir/diag.sh wait-queueempty
+sleep 3 # let impstats emit the final values
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+PROCESSED=$($srcdir/diag.sh get-stat "usrmsg" processed)
+FAILED=$($srcdir/diag.sh get-stat "usrmsg" failed)
+if [ "$PROCESSED" != "20000" ] || [ "$FAILED" != "0" ]; then
+	echo "omusrmsg processed=$PROCESSED (expected 20000), failed=$FAILED (expected 0)"
+	exit 1
+fi
+source $srcdir/diag.sh seq-check 0 19999
+source $srcdir/diag.sh exit
@@ -0,0 +1,47 @@
+# Test for parser.trylastsuccessful. One sender switches between RFC5424
+# and "last message repeated n times" messages every 100 messages, with
+# a parser chain of rsyslog.rfc5424 and rsyslog.lastline. Every message
+# must still be handled by the right parser, and the RFC5424 parser must
+# only be tried for its own messages and once after each switch.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[parser-trylastsuccessful.sh\]: test parser.trylastsuccessful
+source $srcdir/diag.sh init
+rm -f rsyslog.out.stats.log
+awk 'BEGIN {
+	for(i = 0 ; i < 2000 ; ++i) {
+		if(int(i / 100) % 2) {
+			printf("<129>last message repeated %d times\n", i) > "rsyslog.input"
+			printf("last message repeated %d times\n", i) > "rsyslog.out.expected"
+		} else {
+			printf("<129>1 2003-03-01T01:00:00Z host1 app - - - msgnum:%8.8d\n", i) > "rsyslog.input"
+			printf("msgnum:%8.8d\n", i) > "rsyslog.out.expected"
+		}
+	}
+}'
+source $srcdir/diag.sh startup parser-trylastsuccessful.conf
+./tcpflood -B -I rsyslog.input
+source $srcdir/diag.sh wait-queueempty
+sleep 3 # let impstats write the final counters
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+cmp rsyslog.out.log rsyslog.out.expected
+if [ ! $? -eq 0 ]; then
+	echo "messages parsed by the wrong parser, first differences:"
+	diff rsyslog.out.log rsyslog.out.expected | head -10
+	exit 1
+fi
+rm -f rsyslog.out.expected
+PARSED=$($srcdir/diag.sh get-stat "parser.rsyslog.rfc5424" parsed)
+ATTEMPTS=$($srcdir/diag.sh get-stat "parser.rsyslog.rfc5424" attempts)
+echo "rfc5424 parser: $ATTEMPTS attempts, $PARSED parsed"
+if [ "$PARSED" != "1000" ] || [ -z "$ATTEMPTS" ] || [ $ATTEMPTS -gt 1010 ]; then
+	echo "unexpected rfc5424 parser counters"
+	exit 1
+fi
+PARSED=$($srcdir/diag.sh get-stat "parser.rsyslog.lastline" parsed)
+if [ "$PARSED" != "1000" ]; then
+	echo "lastline parser parsed $PARSED messages, expected 1000"
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,19 @@
+# Test for the PCRE regex engine in templates, property filters and
+# re_match_pcre(). Only odd message numbers must be filtered out of
+# the second file.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[pcre.sh\]: testing PCRE regular expressions
+source $srcdir/diag.sh init
+rm -f rsyslog2.out.log
+source $srcdir/diag.sh startup pcre.conf
+source $srcdir/diag.sh injectmsg  0 10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999
+if [ `grep -c -E '^[0-9]*[02468]$' rsyslog2.out.log` -ne 5000 -o `wc -l < rsyslog2.out.log` -ne 5000 ]; then
+	echo "re_match_pcre() did not select the even message numbers"
+	exit 1
+fi
+rm -f rsyslog2.out.log
+source $srcdir/diag.sh exit
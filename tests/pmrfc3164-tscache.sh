@@ -0,0 +1,34 @@
+# Test for the per-sender timestamp shape cache of pmrfc3164. A single
+# sender switches between RFC3339, RFC3164 and RFC3164 timestamps with a
+# leading SP every few messages, so the cached shape regularly does not
+# match. Every message must be parsed exactly as without the cache.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[pmrfc3164-tscache.sh\]: test pmrfc3164 timestamp detection
+source $srcdir/diag.sh init
+awk 'BEGIN {
+	for(i = 0 ; i < 3000 ; ++i) {
+		s = i % 60
+		shape = int(i / 4) % 3
+		if(shape == 0)
+			ts = sprintf("Mar  1 01:00:%2.2d", s)
+		else if(shape == 1)
+			ts = sprintf("2003-03-01T01:00:%2.2dZ", s)
+		else
+			ts = sprintf(" Mar  1 01:00:%2.2d", s)
+		printf("<129>%s host1 tag: msgnum:%8.8d\n", ts, i) > "rsyslog.input"
+		printf("Mar  1 01:00:%2.2d,host1,tag:, msgnum:%8.8d\n", s, i) > "rsyslog.out.expected"
+	}
+}'
+source $srcdir/diag.sh startup pmrfc3164-tscache.conf
+./tcpflood -B -I rsyslog.input
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+cmp rsyslog.out.log rsyslog.out.expected
+if [ ! $? -eq 0 ]; then
+	echo "pmrfc3164 parsed messages incorrectly, first differences:"
+	diff rsyslog.out.log rsyslog.out.expected | head -10
+	exit 1
+fi
+rm -f rsyslog.out.expected
+source $srcdir/diag.sh exit
@@ -0,0 +1,32 @@
+# Test for priority lanes inside a queue. A slow main queue builds up a
+# backlog of debug messages, then critical messages are injected. They
+# must overtake the backlog, keep their own order, and no message must be
+# lost.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[prioritylanes.sh\]: testing queue priority lanes
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup prioritylanes.conf
+
+# debug messages go to the last lane, crit ones to the first
+source $srcdir/diag.sh tcpflood -m10000 -P167 -i0
+source $srcdir/diag.sh tcpflood -m100 -P130 -i10000
+
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 10099
+
+# the crit messages must be in order and ahead of most of the backlog
+awk -F: '$1 + 0 >= 10000 { if($1 + 0 <= last) { print "crit message " $1 " out of order"; bad = 1 }
+			   last = $1 + 0; lastline = NR }
+	 END { if(bad) exit 1
+	       behind = NR - lastline
+	       if(behind < 3000) {
+		 print "only " behind " debug messages processed after last crit message, expected >= 3000"
+		 exit 1
+	       } }' rsyslog.out.log
+if [ "$?" -ne "0" ]; then
+  echo "priority lane order error detected"
+  exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,22 @@
+# Test for the interned sender props. Messages from many TCP sessions and
+# UDP must all carry the same sender address and name, no matter by which
+# input and worker thread they were processed.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[prop-intern.sh\]: test sender props of many sessions
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup prop-intern.conf
+./tcpflood -p13514 -c20 -m20000
+./tcpflood -Tudp -p13515 -c4 -m2000 -i20000 -b100 -W10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+if [ `cut -d, -f2- rsyslog.out.log | sort -u | wc -l` -ne 1 ] || \
+   [ `cut -d, -f2 rsyslog.out.log | sort -u` != "127.0.0.1" ]; then
+	echo "sender props differ between messages:"
+	cut -d, -f2- rsyslog.out.log | sort | uniq -c
+	exit 1
+fi
+cut -d, -f1 rsyslog.out.log > rsyslog.out.seq
+mv rsyslog.out.seq rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 21999
+source $srcdir/diag.sh exit
@@ -0,0 +1,29 @@
+# Test for byte based queue limits. A DA queue whose message count limits
+# are far away must start spooling to disk when it reaches its high water
+# mark in bytes, and when the global memory budget is exhausted. In both
+# cases no message may be lost, and once the queue is empty its size in
+# bytes must be back at 0. As with the other DA tests, there is some
+# uncertainty based on machine speed, so a machine that keeps up with the
+# message burst can let the test fail.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo "[queue-bytes.sh]: testing byte based queue limits"
+source $srcdir/diag.sh init
+for conf in queue-maxbytes.conf queue-memorybudget.conf ; do
+	rm -f rsyslog.out.log rsyslog.out.stats.log
+	source $srcdir/diag.sh startup $conf
+	source $srcdir/diag.sh injectmsg 0 20000
+	source $srcdir/diag.sh wait-queueempty
+	sleep 3 # let impstats emit the final values
+	source $srcdir/diag.sh shutdown-when-empty
+	source $srcdir/diag.sh wait-shutdown
+	BYTES=$($srcdir/diag.sh get-stat "main Q" bytes)
+	DA_ENQUEUED=$($srcdir/diag.sh get-stat "main Q[DA]" enqueued)
+	if [ "$BYTES" != "0" ] || [ -z "$DA_ENQUEUED" ] || [ "$DA_ENQUEUED" -lt 1 ]; then
+		echo "$conf: queue bytes=$BYTES (expected 0), DA enqueued=$DA_ENQUEUED (expected > 0), stats are:"
+		grep "main Q" rsyslog.out.stats.log | tail -4
+		exit 1
+	fi
+	source $srcdir/diag.sh seq-check 0 19999
+done
+source $srcdir/diag.sh exit
@@ -0,0 +1,34 @@
+# Test for queue.checkpointlog. With a checkpoint for every message, the
+# queue positions go to the checkpoint log instead of the .qi file. After
+# rsyslogd is killed hard, the restart must apply the log on top of the
+# .qi file and process the messages still in the queue.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[queue-checkpointlog.sh\]: testing disk queue checkpoint log
+source $srcdir/diag.sh init
+echo "*.*     :omtesting:sleep 0 1000" > work-delay.conf
+source $srcdir/diag.sh startup queue-checkpointlog.conf
+source $srcdir/diag.sh injectmsg 0 2000
+sleep 1 # let some messages be processed
+if test ! -f test-spool/mainq.qi || test ! -s test-spool/mainq.qi.log; then
+	echo "error: mainq.qi or a non-empty mainq.qi.log does not exist"
+	ls -l test-spool
+	exit 1
+fi
+kill -9 `cat rsyslog.pid`
+sleep 1
+rm -f rsyslog.pid rsyslogd.started
+
+# restart engine and have rest processed
+echo "#" > work-delay.conf
+source $srcdir/diag.sh startup queue-checkpointlog.conf
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+$srcdir/diag.sh wait-shutdown
+# the checkpoint for processed messages may not have been written before
+# the kill, so duplicates are permitted
+source $srcdir/diag.sh seq-check 0 1999 -d
+if test -f test-spool/mainq.qi.log; then
+	echo "error: mainq.qi.log still exists after the queue was emptied"
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,31 @@
+# Test for queue.discardmarkbytes. The main queue has a small discard mark
+# in bytes and a slow action, while its message count based marks are far
+# away. Alert messages are below the discard severity and must all be
+# kept. Debug messages beyond the mark must be discarded, and every
+# message that is not counted as discarded must be written.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo "[queue-discardmarkbytes.sh]: testing queue.discardmarkbytes"
+source $srcdir/diag.sh init
+rm -f rsyslog.out.stats.log
+source $srcdir/diag.sh startup queue-discardmarkbytes.conf
+source $srcdir/diag.sh tcpflood -m5000 -P129
+source $srcdir/diag.sh wait-queueempty
+source $srcdir/diag.sh tcpflood -m5000 -i5000
+source $srcdir/diag.sh wait-queueempty
+sleep 3 # let impstats emit the final values
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+head -5000 rsyslog.out.log > rsyslog.out.head.log
+seq -f "%08g" 0 4999 | cmp - rsyslog.out.head.log
+if [ $? -ne 0 ]; then
+	echo "messages below the discard severity were lost"
+	exit 1
+fi
+DISCARDED=$($srcdir/diag.sh get-stat "main Q" discarded.nf)
+WRITTEN=`wc -l < rsyslog.out.log`
+if [ -z "$DISCARDED" ] || [ "$DISCARDED" -lt 1 ] || [ $((DISCARDED + WRITTEN)) -ne 10000 ]; then
+	echo "discarded $DISCARDED (expected > 0), written $WRITTEN, sum must be 10000"
+	exit 1
+fi
+source $srcdir/diag.sh exit
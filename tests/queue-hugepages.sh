@@ -0,0 +1,25 @@
+# Test for queue.hugepages. The main queue is a fixed array large enough to
+# be backed by huge pages. If the kernel supports transparent huge pages,
+# the storage must show up in the huge page stats. In any case, no message
+# may be lost.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[queue-hugepages.sh\]: test queue storage backed by huge pages
+source $srcdir/diag.sh init
+rm -f rsyslog.out.stats.log
+source $srcdir/diag.sh startup queue-hugepages.conf
+source $srcdir/diag.sh injectmsg 0 50000
+source $srcdir/diag.sh wait-queueempty
+sleep 3 # let impstats emit the final values
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+RESERVED=$($srcdir/diag.sh get-stat "main Q" hugepages.reserved)
+TRANSPARENT=$($srcdir/diag.sh get-stat "main Q" hugepages.transparent)
+# the storage is 1000000 pointers, so at least 4MB even with 32 bit pointers
+if [ -d /sys/kernel/mm/transparent_hugepage ] &&
+   [ $((${RESERVED:-0} + ${TRANSPARENT:-0})) -lt 4000000 ]; then
+	echo "no huge pages reported (reserved=$RESERVED, transparent=$TRANSPARENT)"
+	exit 1
+fi
+source $srcdir/diag.sh seq-check 0 49999
+source $srcdir/diag.sh exit
@@ -0,0 +1,30 @@
+# Test for queue.partitionkey. Messages from 10 hosts are processed by an
+# action queue with 4 workers, partitioned by hostname. All messages of
+# one host must be written in the order they were received.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[queue-partitionkey.sh\]: test ordering with queue.partitionkey
+source $srcdir/diag.sh init
+awk 'BEGIN {
+	for(i = 0 ; i < 20000 ; ++i)
+		printf("<129>Mar  1 01:00:00 host%d tag: msgnum:%8.8d:\n", i % 10, i) > "rsyslog.input"
+}'
+source $srcdir/diag.sh startup queue-partitionkey.conf
+./tcpflood -B -I rsyslog.input
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+awk -F, '($1 in last) && $2 + 0 <= last[$1] { print "out of order for " $1 ": " last[$1] " before " $2; bad = 1; exit }
+	{ last[$1] = $2 + 0 }
+	END { exit bad }' rsyslog.out.log
+if [ ! $? -eq 0 ]; then
+	exit 1
+fi
+if [ `cut -d, -f1 rsyslog.out.log | sort -u | wc -l` -ne 10 ]; then
+	echo "wrong hostnames:"
+	cut -d, -f1 rsyslog.out.log | sort | uniq -c
+	exit 1
+fi
+cut -d, -f2 rsyslog.out.log > rsyslog.out.seq
+mv rsyslog.out.seq rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 19999
+source $srcdir/diag.sh exit
@@ -0,0 +1,32 @@
+# Test for queue.readahead on a disk queue. First, a backlog is worked off
+# through the read-ahead thread. Then, messages are processed slowly and
+# rsyslogd is shut down with messages read ahead but not processed. These
+# must still be in the queue files and be processed after the restart.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[queue-readahead.sh\]: testing disk queue read-ahead
+source $srcdir/diag.sh init
+echo "#" > work-delay.conf
+source $srcdir/diag.sh startup queue-readahead.conf
+source $srcdir/diag.sh tcpflood -m20000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 19999
+
+source $srcdir/diag.sh init
+echo "*.*     :omtesting:sleep 0 1000" > work-delay.conf
+source $srcdir/diag.sh startup queue-readahead.conf
+source $srcdir/diag.sh injectmsg 0 5000
+$srcdir/diag.sh shutdown-immediate
+$srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh check-mainq-spool
+
+# restart engine and have rest processed
+echo "#" > work-delay.conf
+source $srcdir/diag.sh startup queue-readahead.conf
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+./msleep 500
+$srcdir/diag.sh wait-shutdown
+# duplicates are permitted, see queue-persist-drvr.sh
+source $srcdir/diag.sh seq-check 0 4999 -d
+source $srcdir/diag.sh exit
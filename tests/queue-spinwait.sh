@@ -0,0 +1,16 @@
+# Test for queue.spinwait. Messages come in bursts with short pauses in
+# between, so that the workers of both the main and the action queue go
+# through polling and sleeping. No message may be lost or duplicated, and
+# polling workers must not delay the shutdown.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[queue-spinwait.sh\]: test queue.spinwait with bursty traffic
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup queue-spinwait.conf
+# bursts of 100 messages with 500 microseconds and 200 milliseconds pauses
+source $srcdir/diag.sh tcpflood -m10000 -b100 -W500
+source $srcdir/diag.sh tcpflood -m1000 -i10000 -b100 -W200000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 10999
+source $srcdir/diag.sh exit
@@ -0,0 +1,28 @@
+# Test for omrabbitmq publisher_confirms, confirm_timeout and channels. The
+# messages are published on four channels, with the broker's confirms
+# collected per batch. A consumer bound to the routing key must get every
+# message exactly once. Needs a RabbitMQ broker on localhost:5672 with the
+# default guest account and the amqp-* tools of librabbitmq; the test
+# deletes the rsyslog_testbench queue.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[rabbitmq-confirms.sh\]: test for omrabbitmq publisher confirms
+source $srcdir/diag.sh init
+amqp-delete-queue -q rsyslog_testbench > /dev/null 2>&1
+amqp-declare-queue -q rsyslog_testbench > /dev/null
+amqp-consume -q rsyslog_testbench -e amq.direct -r rsyslog_testbench -c 10000 cat > rsyslog.out.log &
+CONSUMER=$!
+sleep 1 # let the consumer bind the queue before anything is published
+source $srcdir/diag.sh startup rabbitmq-confirms.conf
+source $srcdir/diag.sh injectmsg  0 10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+# the consumer exits once it got all messages
+for i in `seq 100`; do
+	kill -0 $CONSUMER 2> /dev/null || break
+	./msleep 100
+done
+kill $CONSUMER 2> /dev/null
+amqp-delete-queue -q rsyslog_testbench > /dev/null
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh exit
@@ -0,0 +1,9 @@
+# Test the RFC5424 header fast path of pmrfc5424 and its fallback to the
+# strict parser, checking every header field.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[rfc5424-fastpath.sh\]: test pmrfc5424 header parsing
+source $srcdir/diag.sh init
+source $srcdir/diag.sh nettester parse5424 udp
+source $srcdir/diag.sh nettester parse5424 tcp
+source $srcdir/diag.sh exit
@@ -0,0 +1,917 @@
+/* In-process microbenchmarks for the hot paths of the rsyslog core.
+ *
+ * The runtime is initialized like it is done by rsyslogd and a generated
+ * config is loaded, but it is never activated: no inputs or main queues
+ * are started. Each benchmark then calls the core functions directly,
+ * so that their cost can be tracked without the noise of a full
+ * rsyslogd run (use tcpflood and latsink for those).
+ *
+ * Params
+ * -M<dir> module load path, needed for the modules the built-in output
+ *         modules use (e.g. -M../runtime/.libs)
+ * -t<msecs> minimum run time per benchmark (default 500). Each benchmark
+ *         is repeated with doubled iteration count until it runs that long.
+ * -f<string> run only benchmarks whose name contains string
+ * -j      emit one JSON object per benchmark instead of a table
+ * -r<rev> revision to tag JSON output with (e.g. the git commit id)
+ *
+ * With -Q, the queue types are compared instead: each one is loaded by
+ * producer threads and drained by its worker threads. Reported are the
+ * throughput, the p50/p99 latency from enqueue until the consumer sees
+ * the message, the average time a producer spent in qqueueEnqMsg() and
+ * the queue's own full and maximum size counters, which show contention.
+ * -P<n>   number of producer threads (default 1)
+ * -C<n>   number of queue worker threads (default 1)
+ * -B<n>   dequeue batch size (default 128)
+ * -S<n>   message size in bytes (default 128)
+ * -N<n>   number of messages per queue type (default 1000000)
+ * The sharded type is a FixedArray queue with one shard per producer.
+ *
+ * Times are wall clock times per operation. For benchmarks that need a
+ * message to work on (parser, queues), the cost of constructing it is
+ * included; msg.construct shows how large it is.
+ *
+ * Part of the testbench for rsyslog.
+ *
+ * Copyright 2014 Rainer Gerhards and Adiscon GmbH.
+ *
+ * This file is part of rsyslog.
+ *
+ * Rsyslog is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Rsyslog is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Rsyslog.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * A copy of the GPL can be found in the file "COPYING" in this distribution.
+ */
+#include "config.h"
+#include "rsyslog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "srUtils.h"
+#include "template.h"
+#include "msg.h"
+#include "action.h"
+#include "wti.h"
+#include "queue.h"
+#include "errmsg.h"
+#include "datetime.h"
+#include "parser.h"
+#include "batch.h"
+#include "unicode-helper.h"
+#include "ruleset.h"
+#include "prop.h"
+#include "rsconf.h"
+#include "dnscache.h"
+#include "lookup.h"
+#include "rainerscript.h"
+#include "ratelimit.h"
+
+DEFobjCurrIf(obj)
+DEFobjCurrIf(glbl)
+DEFobjCurrIf(datetime)
+DEFobjCurrIf(errmsg)
+DEFobjCurrIf(ruleset)
+DEFobjCurrIf(prop)
+DEFobjCurrIf(parser)
+DEFobjCurrIf(rsconf)
+
+/* the runtime expects rsyslogd to provide these */
+rsconf_t *ourConf;
+int MarkInterval = 20 * 60;
+int bHaveMainQueue = 0;
+int iConfigVerify = 0;
+qqueue_t *pMsgQueue = NULL;
+int send_to_all = 0;
+
+#define MSG_RFC3164 "<34>Oct 11 22:14:15 web01 sshd[4123]: Failed password for invalid user " \
+	"admin from 10.0.0.1 port 51422 ssh2"
+#define MSG_RFC5424 "<165>1 2003-10-11T22:14:15.003Z web01.example.com evntslog 4123 ID47 " \
+	"[exampleSDID@32473 iut=\"3\" eventSource=\"Application\" eventID=\"1011\"] " \
+	"An application event log entry"
+#define NUM_LOOKUP_KEYS 1000
+#define QUEUE_SIZE 10000
+
+static long minRunTime = 500; /* msecs */
+static char *filter = NULL;
+static int bJSON = 0;
+static char *revision = "";
+static char tmpDir[] = "/tmp/rsbench.XXXXXX";
+static prop_t *pInputName;
+static prop_t *pRcvFrom;
+static prop_t *pRcvFromIP;
+static msg_t *pParsedMsg;	/* message some benchmarks work on */
+static long nConsumed;		/* messages processed by the queue consumer */
+static pthread_mutex_t mutConsumed = PTHREAD_MUTEX_INITIALIZER;
+
+struct bench_s {
+	const char *name;
+	void (*run)(void *usr, long n);
+	void *usr;
+};
+
+
+/* these interfaces of rsyslogd are used by the runtime, but do not matter
+ * for benchmarking
+ */
+rsRetVal
+logmsgInternal(const int __attribute__((unused)) iErr, const int __attribute__((unused)) pri,
+	       const uchar *const msg, int __attribute__((unused)) flags)
+{
+	fprintf(stderr, "rsbench: %s\n", msg);
+	return RS_RET_OK;
+}
+
+rsRetVal
+submitMsg2(msg_t *pMsg)
+{
+	msgDestruct(&pMsg);
+	return RS_RET_OK;
+}
+
+rsRetVal
+multiSubmitMsg2(multi_submit_t *pMultiSub)
+{
+	int i;
+
+	for(i = 0 ; i < pMultiSub->nElem ; ++i)
+		msgDestruct(&pMultiSub->ppMsgs[i]);
+	pMultiSub->nElem = 0;
+	return RS_RET_OK;
+}
+
+rsRetVal
+createMainQueue(qqueue_t __attribute__((unused)) **ppQueue, uchar __attribute__((unused)) *pszQueueName,
+		struct nvlst __attribute__((unused)) *lst)
+{
+	fprintf(stderr, "rsbench: ruleset queues are not supported\n");
+	return RS_RET_NOT_IMPLEMENTED;
+}
+
+rsRetVal
+startMainQueue(qqueue_t __attribute__((unused)) *pQueue)
+{
+	return RS_RET_OK;
+}
+
+
+static long long
+getNsecs(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (long long) t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+
+static msg_t *
+newMsg(char *rawmsg, ruleset_t *pRuleset)
+{
+	msg_t *pMsg;
+
+	if(msgConstruct(&pMsg) != RS_RET_OK) {
+		fprintf(stderr, "rsbench: could not construct message\n");
+		exit(1);
+	}
+	MsgSetInputName(pMsg, pInputName);
+	MsgSetRawMsg(pMsg, rawmsg, strlen(rawmsg));
+	MsgSetRcvFrom(pMsg, pRcvFrom);
+	MsgSetRcvFromIP(pMsg, pRcvFromIP);
+	MsgSetFlowControlType(pMsg, eFLOWCTL_FULL_DELAY);
+	if(pRuleset != NULL)
+		MsgSetRuleset(pMsg, pRuleset);
+	pMsg->msgFlags = NEEDS_PARSING | PARSE_HOSTNAME;
+	return pMsg;
+}
+
+
+/* --- the benchmarks --- */
+
+static void
+benchMsgConstruct(void *usr, long n)
+{
+	msg_t *pMsg;
+	long i;
+
+	for(i = 0 ; i < n ; ++i) {
+		pMsg = newMsg((char*) usr, NULL);
+		msgDestruct(&pMsg);
+	}
+}
+
+
+static void
+benchParseMsg(void *usr, long n)
+{
+	ruleset_t *pRuleset = (ruleset_t*) usr;
+	char *rawmsg;
+	msg_t *pMsg;
+	long i;
+
+	rawmsg = strstr((char*)rulesetGetName(pRuleset), "5424") == NULL ? MSG_RFC3164 : MSG_RFC5424;
+	for(i = 0 ; i < n ; ++i) {
+		pMsg = newMsg(rawmsg, pRuleset);
+		if(parser.ParseMsg(pMsg) != RS_RET_OK) {
+			fprintf(stderr, "rsbench: message could not be parsed\n");
+			exit(1);
+		}
+		msgDestruct(&pMsg);
+	}
+}
+
+
+static void
+benchTplToString(void *usr, long n)
+{
+	struct template *pTpl = (struct template*) usr;
+	actWrkrIParams_t iparam;
+	struct syslogTime ttNow;
+	long i;
+
+	memset(&iparam, 0, sizeof(iparam));
+	ttNow.year = 0;
+	for(i = 0 ; i < n ; ++i) {
+		if(tplToString(pTpl, pParsedMsg, &iparam, &ttNow) != RS_RET_OK) {
+			fprintf(stderr, "rsbench: template could not be applied\n");
+			exit(1);
+		}
+	}
+	free(iparam.param);
+}
+
+
+static void
+benchExprEval(void *usr, long n)
+{
+	struct cnfexpr *expr = (struct cnfexpr*) usr;
+	struct var ret;
+	long i;
+
+	for(i = 0 ; i < n ; ++i) {
+		cnfexprEval(expr, &ret, pParsedMsg);
+		varDelete(&ret);
+	}
+}
+
+
+static rsRetVal
+benchConsumer(void __attribute__((unused)) *pUsr, batch_t *pBatch, wti_t __attribute__((unused)) *pWti)
+{
+	int i;
+
+	for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i)
+		pBatch->eltState[i] = BATCH_STATE_COMM;
+	pthread_mutex_lock(&mutConsumed);
+	nConsumed += batchNumMsgs(pBatch);
+	pthread_mutex_unlock(&mutConsumed);
+	return RS_RET_OK;
+}
+
+/* enqueue n messages and wait until the consumer processed all of them */
+static void
+benchQueue(void *usr, long n)
+{
+	queueType_t qType = (queueType_t) (intptr_t) usr;
+	qqueue_t *pQueue;
+	long nDone;
+	long i;
+
+	nConsumed = 0;
+	if(qqueueConstruct(&pQueue, qType, 1, QUEUE_SIZE, benchConsumer) != RS_RET_OK) {
+		fprintf(stderr, "rsbench: could not construct queue\n");
+		exit(1);
+	}
+	obj.SetName((obj_t*) pQueue, UCHAR_CONSTANT("rsbench"));
+	if(qType == QUEUETYPE_DISK)
+		qqueueSetFilePrefix(pQueue, UCHAR_CONSTANT("rsbench"), sizeof("rsbench") - 1);
+	if(qqueueStart(pQueue) != RS_RET_OK) {
+		fprintf(stderr, "rsbench: could not start queue\n");
+		exit(1);
+	}
+	for(i = 0 ; i < n ; ++i)
+		qqueueEnqMsg(pQueue, eFLOWCTL_FULL_DELAY, newMsg(MSG_RFC3164, NULL));
+	do {
+		pthread_mutex_lock(&mutConsumed);
+		nDone = nConsumed;
+		pthread_mutex_unlock(&mutConsumed);
+		if(nDone < n)
+			usleep(100);
+	} while(nDone < n);
+	qqueueDestruct(&pQueue);
+}
+
+
+static void
+benchLookup(void *usr, long n)
+{
+	lookup_t *pTable = (lookup_t*) usr;
+	uchar key[32];
+	es_str_t *val;
+	long i;
+
+	for(i = 0 ; i < n ; ++i) {
+		snprintf((char*)key, sizeof(key), "host-%4.4ld", i % NUM_LOOKUP_KEYS);
+		val = lookupKey_estr(pTable, key);
+		es_deleteStr(val);
+	}
+}
+
+
+static void
+benchDnscache(void __attribute__((unused)) *usr, long n)
+{
+	struct sockaddr_storage addr;
+	struct sockaddr_in *sin = (struct sockaddr_in*) &addr;
+	prop_t *fqdnLowerCase = NULL;
+	prop_t *localName = NULL;
+	prop_t *ip = NULL;
+	long i;
+
+	memset(&addr, 0, sizeof(addr));
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	for(i = 0 ; i < n ; ++i) {
+		if(dnscacheLookup(&addr, NULL, &fqdnLowerCase, &localName, &ip) != RS_RET_OK) {
+			fprintf(stderr, "rsbench: dnscache lookup failed\n");
+			exit(1);
+		}
+		prop.Destruct(&fqdnLowerCase);
+		prop.Destruct(&localName);
+		prop.Destruct(&ip);
+	}
+}
+
+
+/* run a benchmark with growing iteration count until it takes at least
+ * minRunTime and report the result of that last run.
+ */
+static void
+runBench(struct bench_s *b)
+{
+	long n = 1;
+	long long tStart, tElapsed;
+
+	if(filter != NULL && strstr(b->name, filter) == NULL)
+		return;
+	b->run(b->usr, 1); /* warm up caches, e.g. the dnscache */
+	while(1) {
+		tStart = getNsecs();
+		b->run(b->usr, n);
+		tElapsed = getNsecs() - tStart;
+		if(tElapsed >= minRunTime * 1000000LL || n >= (1L << 30))
+			break;
+		n *= 2;
+	}
+
+	if(bJSON) {
+		printf("{\"name\":\"%s\",\"rev\":\"%s\",\"iterations\":%ld,\"ns_per_op\":%.1f}\n",
+		       b->name, revision, n, (double) tElapsed / n);
+	} else {
+		printf("%-32s %12ld %12.1f ns/op\n", b->name, n, (double) tElapsed / n);
+	}
+	fflush(stdout);
+}
+
+
+/* --- queue type comparison (-Q) --- */
+
+/* latency histogram: 16 linear sub-buckets for each power of two, which
+ * gives about 6% precision over the whole 64 bit range.
+ */
+#define LAT_SUB_BITS 4
+#define LAT_SUB_COUNT (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS ((64 - LAT_SUB_BITS + 1) * LAT_SUB_COUNT)
+
+static int nProducers = 1;
+static int nConsumers = 1;
+static int iBatchSize = 128;
+static int iMsgSize = 128;
+static long nQMsgs = 1000000;
+static long long latHist[LAT_BUCKETS];
+static long long tLastConsumed; /* when the last message was consumed */
+
+struct producer_s {
+	pthread_t tid;
+	qqueue_t *pQueue;
+	long nMsgs;
+	long long nsEnq;	/* total time spent in qqueueEnqMsg() */
+};
+
+static int
+latBucket(uint64_t v)
+{
+	int msb;
+
+	if(v < LAT_SUB_COUNT)
+		return (int) v;
+	msb = 63 - __builtin_clzll(v);
+	return (msb - LAT_SUB_BITS + 1) * LAT_SUB_COUNT
+		+ (int) ((v >> (msb - LAT_SUB_BITS)) & (LAT_SUB_COUNT - 1));
+}
+
+/* lowest value that is recorded into bucket idx */
+static uint64_t
+latBucketVal(int idx)
+{
+	int e;
+
+	if(idx < LAT_SUB_COUNT)
+		return idx;
+	e = idx / LAT_SUB_COUNT + LAT_SUB_BITS - 1;
+	return (uint64_t) (LAT_SUB_COUNT + idx % LAT_SUB_COUNT) << (e - LAT_SUB_BITS);
+}
+
+static double
+latPercentile(double pct)
+{
+	long long cum = 0;
+	long long total = 0;
+	int i;
+
+	for(i = 0 ; i < LAT_BUCKETS ; ++i)
+		total += latHist[i];
+	for(i = 0 ; i < LAT_BUCKETS ; ++i) {
+		cum += latHist[i];
+		if(cum >= total * pct / 100.0)
+			break;
+	}
+	return (i == LAT_BUCKETS) ? 0.0 : latBucketVal(i) / 1000.0;
+}
+
+
+/* the message carries its enqueue time as the first 20 characters */
+static msg_t *
+newQMsg(void)
+{
+	char buf[64*1024];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "%20lld ", getNsecs());
+	if(iMsgSize > len) {
+		memset(buf + len, 'x', iMsgSize - len);
+		len = iMsgSize;
+	}
+	buf[len] = '\0';
+	return newMsg(buf, NULL);
+}
+
+static rsRetVal
+qbenchConsumer(void __attribute__((unused)) *pUsr, batch_t *pBatch, wti_t __attribute__((unused)) *pWti)
+{
+	int lat[LAT_BUCKETS];
+	int nUsed[LAT_BUCKETS];
+	int nBuckets = 0;
+	long long tNow;
+	int idx;
+	int i;
+
+	memset(lat, 0, sizeof(lat));
+	tNow = getNsecs();
+	for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i) {
+		idx = latBucket(tNow - atoll((char*) pBatch->pElem[i].pMsg->pszRawMsg));
+		if(lat[idx]++ == 0)
+			nUsed[nBuckets++] = idx;
+		pBatch->eltState[i] = BATCH_STATE_COMM;
+	}
+	pthread_mutex_lock(&mutConsumed);
+	for(i = 0 ; i < nBuckets ; ++i)
+		latHist[nUsed[i]] += lat[nUsed[i]];
+	nConsumed += batchNumMsgs(pBatch);
+	if(nConsumed == nQMsgs)
+		tLastConsumed = getNsecs();
+	pthread_mutex_unlock(&mutConsumed);
+	return RS_RET_OK;
+}
+
+static void *
+qbenchProducer(void *arg)
+{
+	struct producer_s *prod = (struct producer_s*) arg;
+	msg_t *pMsg;
+	long long tStart;
+	long i;
+
+	for(i = 0 ; i < prod->nMsgs ; ++i) {
+		pMsg = newQMsg();
+		tStart = getNsecs();
+		qqueueEnqMsg(prod->pQueue, eFLOWCTL_FULL_DELAY, pMsg);
+		prod->nsEnq += getNsecs() - tStart;
+	}
+	return NULL;
+}
+
+/* run one queue type. bDA requests a disk-assisted in-memory queue,
+ * bSharded one shard per producer
+ */
+static void
+runQueueBench(const char *name, queueType_t qType, int bDA, int bSharded)
+{
+	struct producer_s *prods;
+	qqueue_t *pQueue;
+	long long tStart;
+	long long nsEnq = 0;
+	long long nFull = 0;
+	long nDone;
+	int i;
+
+	if(filter != NULL && strstr(name, filter) == NULL)
+		return;
+
+	nConsumed = 0;
+	tLastConsumed = 0;
+	memset(latHist, 0, sizeof(latHist));
+	if((prods = calloc(nProducers, sizeof(struct producer_s))) == NULL) {
+		perror("calloc");
+		exit(1);
+	}
+	if(qqueueConstruct(&pQueue, qType, nConsumers, QUEUE_SIZE, qbenchConsumer) != RS_RET_OK) {
+		fprintf(stderr, "rsbench: could not construct queue\n");
+		exit(1);
+	}
+	obj.SetName((obj_t*) pQueue, (uchar*) name);
+	qqueueSetiDeqBatchSize(pQueue, iBatchSize);
+	qqueueSetiMinMsgsPerWrkr(pQueue, iBatchSize);
+	if(qType == QUEUETYPE_DISK || bDA)
+		qqueueSetFilePrefix(pQueue, (uchar*) name, strlen(name));
+	if(bSharded)
+		pQueue->nShards = nProducers;
+	if(qqueueStart(pQueue) != RS_RET_OK) {
+		fprintf(stderr, "rsbench: could not start queue\n");
+		exit(1);
+	}
+
+	tStart = getNsecs();
+	for(i = 0 ; i < nProducers ; ++i) {
+		prods[i].pQueue = pQueue;
+		prods[i].nMsgs = nQMsgs / nProducers + (i < nQMsgs % nProducers);
+		pthread_create(&prods[i].tid, NULL, qbenchProducer, &prods[i]);
+	}
+	for(i = 0 ; i < nProducers ; ++i) {
+		pthread_join(prods[i].tid, NULL);
+		nsEnq += prods[i].nsEnq;
+	}
+	do {
+		pthread_mutex_lock(&mutConsumed);
+		nDone = nConsumed;
+		pthread_mutex_unlock(&mutConsumed);
+		if(nDone < nQMsgs)
+			usleep(100);
+	} while(nDone < nQMsgs);
+
+	if(pQueue->nShards > 1) {
+		for(i = 0 ; i < pQueue->nShards ; ++i)
+			nFull += pQueue->pShards[i]->ctrFull;
+	} else {
+		nFull = pQueue->ctrFull;
+	}
+	if(bJSON) {
+		printf("{\"name\":\"%s\",\"rev\":\"%s\",\"producers\":%d,\"consumers\":%d,\"batchsize\":%d,"
+		       "\"msgsize\":%d,\"messages\":%ld,\"msgs_per_sec\":%.0f,\"lat_p50_us\":%.1f,"
+		       "\"lat_p99_us\":%.1f,\"enq_ns_per_msg\":%.1f,\"full\":%lld,\"maxqsize\":%d}\n",
+		       name, revision, nProducers, nConsumers, iBatchSize, iMsgSize, nQMsgs,
+		       nQMsgs * 1e9 / (tLastConsumed - tStart), latPercentile(50), latPercentile(99),
+		       (double) nsEnq / nQMsgs, nFull, pQueue->ctrMaxqsize);
+	} else {
+		printf("%-20s %10.0f msgs/s  p50 %10.1f us  p99 %10.1f us  enq %8.1f ns/msg  "
+		       "full %8lld  maxqsize %6d\n",
+		       name, nQMsgs * 1e9 / (tLastConsumed - tStart), latPercentile(50), latPercentile(99),
+		       (double) nsEnq / nQMsgs, nFull, pQueue->ctrMaxqsize);
+	}
+	fflush(stdout);
+	qqueueDestruct(&pQueue);
+	free(prods);
+}
+
+
+static void
+runQueueBenchAll(void)
+{
+	if(!bJSON)
+		printf("%d producers, %d consumers, batch size %d, msg size %d, %ld msgs\n",
+		       nProducers, nConsumers, iBatchSize, iMsgSize, nQMsgs);
+	runQueueBench("direct", QUEUETYPE_DIRECT, 0, 0);
+	runQueueBench("fixedarray", QUEUETYPE_FIXED_ARRAY, 0, 0);
+	runQueueBench("linkedlist", QUEUETYPE_LINKEDLIST, 0, 0);
+	runQueueBench("lockfree", QUEUETYPE_LOCKFREE, 0, 0);
+	runQueueBench("sharded", QUEUETYPE_FIXED_ARRAY, 0, 1);
+	runQueueBench("disk", QUEUETYPE_DISK, 0, 0);
+	runQueueBench("da", QUEUETYPE_LINKEDLIST, 1, 0);
+}
+
+
+/* --- setup --- */
+
+static void
+writeFile(const char *name, const char *content)
+{
+	char fn[256];
+	FILE *fp;
+
+	snprintf(fn, sizeof(fn), "%s/%s", tmpDir, name);
+	if((fp = fopen(fn, "w")) == NULL) {
+		perror(fn);
+		exit(1);
+	}
+	fputs(content, fp);
+	fclose(fp);
+}
+
+
+static void
+writeLookupTable(const char *name, const char *type)
+{
+	char fn[256];
+	FILE *fp;
+	int i;
+
+	snprintf(fn, sizeof(fn), "%s/%s", tmpDir, name);
+	if((fp = fopen(fn, "w")) == NULL) {
+		perror(fn);
+		exit(1);
+	}
+	fprintf(fp, "{ \"version\": 1, \"nomatch\": \"unknown\", \"type\": \"%s\", \"table\": [\n", type);
+	for(i = 0 ; i < NUM_LOOKUP_KEYS ; ++i)
+		fprintf(fp, "%s{ \"index\": \"host-%4.4d\", \"value\": \"dc-%d\" }\n", i ? "," : "", i, i % 10);
+	fprintf(fp, "]}\n");
+	fclose(fp);
+}
+
+
+/* the config that provides the objects to benchmark. The expressions are
+ * set statements so that the optimizer keeps them as they are.
+ */
+static void
+loadBenchConf(void)
+{
+	char conf[4096];
+	char fn[256];
+
+	writeLookupTable("string.json", "string");
+	writeLookupTable("hash.json", "hash");
+	snprintf(conf, sizeof(conf),
+		"global(workDirectory=\"%s\")\n"
+		"template(name=\"bench_json\" type=\"string\" string=\"{\\\"host\\\":"
+			"\\\"%%hostname:::json%%\\\",\\\"tag\\\":\\\"%%syslogtag:::json%%\\\","
+			"\\\"msg\\\":\\\"%%msg:::json%%\\\"}\")\n"
+		"lookup_table(name=\"bench_string\" file=\"%s/string.json\")\n"
+		"lookup_table(name=\"bench_hash\" file=\"%s/hash.json\")\n"
+		"ruleset(name=\"bench_rfc3164\" parser=\"rsyslog.rfc3164\") { stop }\n"
+		"ruleset(name=\"bench_rfc5424\" parser=\"rsyslog.rfc5424\") { stop }\n"
+		"ruleset(name=\"bench_expr\") {\n"
+		"	set $.contains = $msg contains \"Failed password\";\n"
+		"	set $.sevprog = $syslogseverity <= 3 and $programname == \"sshd\";\n"
+		"	set $.hostip = $hostname startswith \"web\" or $fromhost-ip == \"10.0.0.1\";\n"
+		"	set $.facnot = $syslogfacility-text == \"auth\" and not ($msg contains \"session\");\n"
+		"}\n"
+		"action(type=\"omfile\" file=\"/dev/null\")\n",
+		tmpDir, tmpDir, tmpDir);
+	writeFile("rsbench.conf", conf);
+
+	snprintf(fn, sizeof(fn), "%s/rsbench.conf", tmpDir);
+	if(rsconf.Load(&ourConf, (uchar*) fn) != RS_RET_OK) {
+		fprintf(stderr, "rsbench: could not load benchmark config %s\n", fn);
+		exit(1);
+	}
+}
+
+
+static void
+cleanup(void)
+{
+	char cmd[512];
+
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", tmpDir);
+	if(system(cmd) != 0)
+		fprintf(stderr, "rsbench: could not remove %s\n", tmpDir);
+}
+
+
+static rsRetVal
+initRuntime(void)
+{
+	char *pErrObj;
+	DEFiRet;
+
+	pErrObj = "rsyslog runtime";
+	CHKiRet(rsrtInit(&pErrObj, &obj));
+	pErrObj = "glbl";
+	CHKiRet(objUse(glbl,     CORE_COMPONENT));
+	pErrObj = "errmsg";
+	CHKiRet(objUse(errmsg,   CORE_COMPONENT));
+	pErrObj = "datetime";
+	CHKiRet(objUse(datetime, CORE_COMPONENT));
+	pErrObj = "ruleset";
+	CHKiRet(objUse(ruleset,  CORE_COMPONENT));
+	pErrObj = "prop";
+	CHKiRet(objUse(prop,     CORE_COMPONENT));
+	pErrObj = "parser";
+	CHKiRet(objUse(parser,   CORE_COMPONENT));
+	pErrObj = "rsconf";
+	CHKiRet(objUse(rsconf,   CORE_COMPONENT));
+	pErrObj = "action";
+	CHKiRet(actionClassInit());
+	pErrObj = "template";
+	CHKiRet(templateInit());
+	dnscacheInit();
+	initRainerscript();
+	ratelimitModInit();
+
+	CHKiRet(prop.CreateStringProp(&pInputName, UCHAR_CONSTANT("rsbench"), sizeof("rsbench") - 1));
+	CHKiRet(prop.CreateStringProp(&pRcvFrom, UCHAR_CONSTANT("web01.example.com"),
+				      sizeof("web01.example.com") - 1));
+	CHKiRet(prop.CreateStringProp(&pRcvFromIP, UCHAR_CONSTANT("10.0.0.1"), sizeof("10.0.0.1") - 1));
+
+finalize_it:
+	if(iRet != RS_RET_OK)
+		fprintf(stderr, "rsbench: error during class init for object '%s'\n", pErrObj);
+	RETiRet;
+}
+
+
+static ruleset_t *
+getRuleset(char *name)
+{
+	ruleset_t *pRuleset;
+
+	if(ruleset.GetRuleset(ourConf, &pRuleset, (uchar*) name) != RS_RET_OK) {
+		fprintf(stderr, "rsbench: ruleset %s not found\n", name);
+		exit(1);
+	}
+	return pRuleset;
+}
+
+
+static struct template *
+getTemplate(char *name)
+{
+	struct template *pTpl;
+
+	if((pTpl = tplFind(ourConf, name, strlen(name))) == NULL) {
+		fprintf(stderr, "rsbench: template %s not found\n", name);
+		exit(1);
+	}
+	return pTpl;
+}
+
+
+static lookup_t *
+getLookupTable(char *name)
+{
+	lookup_t *pTable;
+
+	if((pTable = lookupFindTable((uchar*) name)) == NULL) {
+		fprintf(stderr, "rsbench: lookup table %s not found\n", name);
+		exit(1);
+	}
+	return pTable;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	static char *tplNames[] = { "RSYSLOG_TraditionalFileFormat", "RSYSLOG_FileFormat",
+		"RSYSLOG_ForwardFormat", "RSYSLOG_SyslogProtocol23Format", "bench_json" };
+	static struct {
+		const char *name;
+		queueType_t qType;
+	} queueTypes[] = {
+		{ "queue.direct", QUEUETYPE_DIRECT },
+		{ "queue.fixedarray", QUEUETYPE_FIXED_ARRAY },
+		{ "queue.linkedlist", QUEUETYPE_LINKEDLIST },
+		{ "queue.lockfree", QUEUETYPE_LOCKFREE },
+		{ "queue.disk", QUEUETYPE_DISK }
+	};
+	struct bench_s b;
+	struct cnfstmt *stmt;
+	char name[128];
+	unsigned i;
+	int bQueueMode = 0;
+	int opt;
+
+	while((opt = getopt(argc, argv, "B:C:f:jM:N:P:Qr:S:t:")) != -1) {
+		switch (opt) {
+		case 'B':	iBatchSize = atoi(optarg);
+				break;
+		case 'C':	nConsumers = atoi(optarg);
+				break;
+		case 'f':	filter = optarg;
+				break;
+		case 'j':	bJSON = 1;
+				break;
+		case 'M':	glblModPath = (uchar*) optarg;
+				break;
+		case 'N':	nQMsgs = atol(optarg);
+				break;
+		case 'P':	nProducers = atoi(optarg);
+				break;
+		case 'Q':	bQueueMode = 1;
+				break;
+		case 'r':	revision = optarg;
+				break;
+		case 'S':	iMsgSize = atoi(optarg);
+				if(iMsgSize > 64*1024 - 1)
+					iMsgSize = 64*1024 - 1;
+				break;
+		case 't':	minRunTime = atol(optarg);
+				break;
+		default:	fprintf(stderr, "usage: rsbench [-M moddir] [-t msecs] [-f filter] [-j] [-r rev]\n"
+					"       rsbench -Q [-P producers] [-C consumers] [-B batchsize] "
+					"[-S msgsize] [-N msgs] ...\n");
+				exit(1);
+		}
+	}
+
+	if(nProducers < 1 || nConsumers < 1 || iBatchSize < 1 || nQMsgs < 1) {
+		fprintf(stderr, "rsbench: -P, -C, -B and -N must be at least 1\n");
+		exit(1);
+	}
+
+	if(mkdtemp(tmpDir) == NULL) {
+		perror("mkdtemp");
+		exit(1);
+	}
+	atexit(cleanup);
+	if(initRuntime() != RS_RET_OK)
+		exit(1);
+	loadBenchConf();
+
+	if(bQueueMode) {
+		runQueueBenchAll();
+		return 0;
+	}
+
+	pParsedMsg = newMsg(MSG_RFC3164, NULL);
+	parser.ParseMsg(pParsedMsg);
+
+	b.name = "msg.construct";
+	b.run = benchMsgConstruct;
+	b.usr = MSG_RFC3164;
+	runBench(&b);
+
+	b.run = benchParseMsg;
+	b.name = "ParseMsg.rfc3164";
+	b.usr = getRuleset("bench_rfc3164");
+	runBench(&b);
+	b.name = "ParseMsg.rfc5424";
+	b.usr = getRuleset("bench_rfc5424");
+	runBench(&b);
+
+	b.run = benchTplToString;
+	for(i = 0 ; i < sizeof(tplNames) / sizeof(char*) ; ++i) {
+		snprintf(name, sizeof(name), "tplToString.%s", tplNames[i]);
+		b.name = name;
+		b.usr = getTemplate(tplNames[i]);
+		runBench(&b);
+	}
+
+	b.run = benchExprEval;
+	for(stmt = getRuleset("bench_expr")->root ; stmt != NULL ; stmt = stmt->next) {
+		if(stmt->nodetype != S_SET)
+			continue;
+		snprintf(name, sizeof(name), "cnfexprEval.%s", stmt->d.s_set.varname + 1);
+		b.name = name;
+		b.usr = stmt->d.s_set.expr;
+		runBench(&b);
+	}
+
+	b.run = benchQueue;
+	for(i = 0 ; i < sizeof(queueTypes) / sizeof(queueTypes[0]) ; ++i) {
+		b.name = queueTypes[i].name;
+		b.usr = (void*) (intptr_t) queueTypes[i].qType;
+		runBench(&b);
+	}
+
+	b.run = benchLookup;
+	b.name = "lookupKey_estr.string";
+	b.usr = getLookupTable("bench_string");
+	runBench(&b);
+	b.name = "lookupKey_estr.hash";
+	b.usr = getLookupTable("bench_hash");
+	runBench(&b);
+
+	b.name = "dnscacheLookup.hit";
+	b.run = benchDnscache;
+	b.usr = NULL;
+	runBench(&b);
+
+	msgDestruct(&pParsedMsg);
+	/* let the OS do the rest of the cleanup */
+	return 0;
+}
@@ -0,0 +1,14 @@
+# check that adaptive reordering of and/or operands (script.adaptiveorder)
+# does not change which messages a condition selects
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[rscript_adaptive.sh\]: testing script.adaptiveorder
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup rscript_adaptive.conf
+source $srcdir/diag.sh injectmsg  0 30000
+echo doing shutdown
+source $srcdir/diag.sh shutdown-when-empty
+echo wait on shutdown
+source $srcdir/diag.sh wait-shutdown 
+source $srcdir/diag.sh seq-check  0 29999
+source $srcdir/diag.sh exit
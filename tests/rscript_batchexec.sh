@@ -0,0 +1,14 @@
+# check batch execution of rulesets (global(script.batchexec)): stop,
+# filters and calls must select the right messages.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[rscript_batchexec.sh\]: testing batch execution of rulesets
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup rscript_batchexec.conf
+source $srcdir/diag.sh injectmsg  0 8000
+echo doing shutdown
+source $srcdir/diag.sh shutdown-when-empty
+echo wait on shutdown
+source $srcdir/diag.sh wait-shutdown 
+source $srcdir/diag.sh seq-check  0 4999
+source $srcdir/diag.sh exit
@@ -0,0 +1,25 @@
+# Test for batch execution with batches that mix rulesets. Three inputs
+# bound to different rulesets without queues of their own are flooded at
+# the same time, so the main queue batches contain messages of all three.
+# Each ruleset must see exactly the messages of its input.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[rscript_batchexec_mixed.sh\]: testing batch execution of mixed batches
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup rscript_batchexec_mixed.conf
+./tcpflood -p13514 -m10000 &
+PID1=$!
+./tcpflood -p13515 -m10000 -i10000 &
+PID2=$!
+./tcpflood -p13516 -m10000 -i20000 &
+PID3=$!
+wait $PID1 $PID2 $PID3
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+i=0
+for rs in rs1 rs2 rs3; do
+	cp rsyslog.out.$rs.log rsyslog.out.log
+	source $srcdir/diag.sh seq-check $((i * 10000)) $((i * 10000 + 9999))
+	i=$((i + 1))
+done
+source $srcdir/diag.sh exit
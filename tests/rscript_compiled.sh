@@ -0,0 +1,14 @@
+# check that compiled if conditions (see cnfexprCompile()) give the same
+# results as the tree walker: each message must be written exactly once.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[rscript_compiled.sh\]: test for compiled script-filters
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup rscript_compiled.conf
+source $srcdir/diag.sh injectmsg  0 5000
+echo doing shutdown
+source $srcdir/diag.sh shutdown-when-empty
+echo wait on shutdown
+source $srcdir/diag.sh wait-shutdown 
+source $srcdir/diag.sh seq-check  0 4999
+source $srcdir/diag.sh exit
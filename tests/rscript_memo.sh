@@ -0,0 +1,34 @@
+# Test for the memoized results of lookup(), exec_template() and the regex
+# functions. Each function is called several times per message with the
+# same arguments, and the results must still be correct when the table is
+# reloaded, the message is modified or the next message is processed.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[rscript_memo.sh\]: test memoized script function results
+source $srcdir/diag.sh init
+cp $srcdir/testsuites/lookup_reload1.json rsyslog.lookup.memo.json
+source $srcdir/diag.sh startup rscript_memo.conf
+source $srcdir/diag.sh injectmsg 0 5000
+source $srcdir/diag.sh wait-queueempty
+cp $srcdir/testsuites/lookup_reload2.json rsyslog.lookup.memo.json
+kill -HUP `cat rsyslog.pid`
+sleep 1
+source $srcdir/diag.sh injectmsg 5000 5000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+# fields: msgnum, 2x lookup, exec_template before/after set, the msgnum
+# via exec_template, 2x re_extract on $msg, re_extract on something else
+awk -F, '{ n = $1 + 0; l = (n < 5000) ? "old" : "new" }
+	$2 != l || $3 != l || $4 != "a" || $5 != "b" || $6 != $1 ||
+	$7 != $1 || $8 != $1 || $9 != "none" {
+		print "unexpected result: " $0; bad = 1; exit }
+	END { exit bad }' rsyslog.out.log
+if [ "$?" -ne "0" ]; then
+	echo "memoized function results are wrong"
+	exit 1
+fi
+cut -d, -f1 rsyslog.out.log > rsyslog.out.seq
+mv rsyslog.out.seq rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 9999
+rm -f rsyslog.lookup.memo.json
+source $srcdir/diag.sh exit
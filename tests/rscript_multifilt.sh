@@ -0,0 +1,14 @@
+# check that sibling contains/startswith filters that the optimizer
+# combines into a single multi-pattern filter select the right messages
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[rscript_multifilt.sh\]: testing multi-pattern filters
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup rscript_multifilt.conf
+source $srcdir/diag.sh injectmsg  0 5000
+echo doing shutdown
+source $srcdir/diag.sh shutdown-when-empty
+echo wait on shutdown
+source $srcdir/diag.sh wait-shutdown 
+source $srcdir/diag.sh seq-check  0 4999
+source $srcdir/diag.sh exit
@@ -0,0 +1,21 @@
+# check that actions executed in parallel (script.parallelactions) each
+# receive all messages, in order
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[rscript_parallel.sh\]: testing script.parallelactions
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup rscript_parallel.conf
+source $srcdir/diag.sh injectmsg  0 20000
+echo doing shutdown
+source $srcdir/diag.sh shutdown-when-empty
+echo wait on shutdown
+source $srcdir/diag.sh wait-shutdown 
+source $srcdir/diag.sh seq-check  0 19999
+for f in rsyslog2.out.log rsyslog3.out.log; do
+	if ! cmp rsyslog.out.log $f; then
+		echo "$f differs from rsyslog.out.log"
+		exit 1
+	fi
+done
+rm -f rsyslog2.out.log rsyslog3.out.log
+source $srcdir/diag.sh exit
@@ -0,0 +1,23 @@
+# check that the script profiler (script.profile.file) writes a report
+# with the execution counts of all statements
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[rscript_profile.sh\]: testing script.profile.file
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup rscript_profile.conf
+source $srcdir/diag.sh injectmsg  0 1000
+echo doing shutdown
+source $srcdir/diag.sh shutdown-when-empty
+echo wait on shutdown
+source $srcdir/diag.sh wait-shutdown 
+source $srcdir/diag.sh seq-check  0 999
+for stmt in "6: *if: executions=1000 " "7: *set \$!nbr: executions=1000 " \
+	    "8: *action .* (builtin:omfile): executions=1000 "; do
+	if ! grep -q "rscript_profile.conf:$stmt" rsyslog.profile.log; then
+		echo "statement '$stmt' missing in profile:"
+		cat rsyslog.profile.log
+		exit 1
+	fi
+done
+rm -f rsyslog.profile.log
+source $srcdir/diag.sh exit
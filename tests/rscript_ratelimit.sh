@@ -0,0 +1,15 @@
+# check that the ratelimit() function drops messages above the burst of
+# each key, but keeps the keys apart and passes everything below the limit
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[rscript_ratelimit.sh\]: testing rainerscript ratelimit\(\) function
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup rscript_ratelimit.conf
+source $srcdir/diag.sh injectmsg  0 1000
+echo doing shutdown
+source $srcdir/diag.sh shutdown-when-empty
+echo wait on shutdown
+source $srcdir/diag.sh wait-shutdown 
+source $srcdir/diag.sh seq-check  0 99
+source $srcdir/diag.sh seq-check2  0 999
+source $srcdir/diag.sh exit
@@ -0,0 +1,14 @@
+# check that string functions and comparisons which operate on borrowed
+# views of message properties give the right results
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[rscript_strview.sh\]: testing rainerscript functions on property views
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup rscript_strview.conf
+source $srcdir/diag.sh injectmsg  0 5000
+echo doing shutdown
+source $srcdir/diag.sh shutdown-when-empty
+echo wait on shutdown
+source $srcdir/diag.sh wait-shutdown 
+source $srcdir/diag.sh seq-check  0 4999
+source $srcdir/diag.sh exit
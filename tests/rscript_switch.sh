@@ -0,0 +1,14 @@
+# check that if/else-if chains on one property, which the optimizer turns
+# into a hash-dispatched switch, select the same branches as the chain
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[rscript_switch.sh\]: testing if/else-if chains turned into switches
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup rscript_switch.conf
+source $srcdir/diag.sh injectmsg  0 5000
+echo doing shutdown
+source $srcdir/diag.sh shutdown-when-empty
+echo wait on shutdown
+source $srcdir/diag.sh wait-shutdown 
+source $srcdir/diag.sh seq-check  0 4999
+source $srcdir/diag.sh exit
@@ -0,0 +1,29 @@
+# Test for rscryutil -j. Messages are spread over 5 encrypted files with a
+# dynafile cache of only 2, so each file is reopened often and consists of
+# many crypto blocks. Decrypting with several threads must give exactly the
+# same result as decrypting with one.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[rscryutil-jobs.sh\]: test parallel decryption with rscryutil
+source $srcdir/diag.sh init
+rm -f rsyslog.out.cry.*
+source $srcdir/diag.sh startup rscryutil-jobs.conf
+source $srcdir/diag.sh tcpflood -m20000 -f5
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+../tools/rscryutil -j1 -K 1234567890123456 rsyslog.out.cry.*.log > rsyslog.out.log 2> rsyslog.out.err
+../tools/rscryutil -j4 -K 1234567890123456 rsyslog.out.cry.*.log > rsyslog.out.j4 2>> rsyslog.out.err
+if [ -s rsyslog.out.err ]; then
+	echo "decryption failed:"
+	cat rsyslog.out.err
+	exit 1
+fi
+cmp rsyslog.out.log rsyslog.out.j4
+if [ ! $? -eq 0 ]; then
+	echo "parallel decryption result differs, first differences:"
+	diff rsyslog.out.log rsyslog.out.j4 | head -10
+	exit 1
+fi
+rm -f rsyslog.out.j4 rsyslog.out.err
+source $srcdir/diag.sh seq-check 0 19999
+source $srcdir/diag.sh exit
@@ -0,0 +1,30 @@
+# Test for the ruleset cpuset parameter. The ruleset is bound to CPU 0,
+# so the workers of the ruleset queue and of its action queue must run
+# on CPU 0 only, and the stats must show the mapping.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[ruleset-cpuset.sh\]: test binding a ruleset to CPUs
+source $srcdir/diag.sh init
+rm -f rsyslog.out.stats.log
+source $srcdir/diag.sh startup ruleset-cpuset.conf
+./tcpflood -m20000
+source $srcdir/diag.sh wait-queueempty
+# the workers are still alive, as their idle timeout is long
+if [ $(nproc) -gt 1 ]; then
+	NBOUND=$(grep -l "^Cpus_allowed_list:[[:space:]]*0$" /proc/`cat rsyslog.pid`/task/*/status | wc -l)
+	if [ "$NBOUND" -lt 2 ]; then
+		echo "expected at least 2 threads bound to CPU 0, got $NBOUND"
+		exit 1
+	fi
+fi
+sleep 3 # let impstats emit the final values
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+CPUS=$($srcdir/diag.sh get-stat "ruleset(rs)" cpus)
+CPUMASK=$($srcdir/diag.sh get-stat "ruleset(rs)" cpumask)
+if [ "$CPUS" != "1" ] || [ "$CPUMASK" != "1" ]; then
+	echo "ruleset stats show cpus=$CPUS (expected 1), cpumask=$CPUMASK (expected 1)"
+	exit 1
+fi
+source $srcdir/diag.sh seq-check 0 19999
+source $srcdir/diag.sh exit
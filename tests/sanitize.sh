@@ -0,0 +1,57 @@
+# Test for the sanitization of received messages: escaping of control
+# and 8-bit characters, $SpaceLFOnReceive and dropping of a trailing LF.
+# Messages are sent octet-counted, so that they can contain LF. Offending
+# bytes are placed at different positions, and one message is too large
+# to be escaped inside the message object's fixed buffer.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[sanitize.sh\]: test message sanitization on reception
+LONG=$(printf '%300s' '' | tr ' ' x)
+export LC_ALL=C
+for m in \
+	$'msgnum:1 abc\001def\tghi\njkl' \
+	$'msgnum:2 caf\xc3\xa9' \
+	$"msgnum:3 $LONG"$'\001end' \
+	$'msgnum:4 end\n' \
+	$'msgnum:5 a\nb\nc'; do
+	m="<129>Mar  1 01:00:00 host1 tag: $m"
+	printf '%d %s' ${#m} "$m"
+done > rsyslog.input
+
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup sanitize-escape.conf
+./tcpflood -B -I rsyslog.input
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+printf ' %s\n' \
+	'msgnum:1 abc#001def#011ghi#012jkl' \
+	'msgnum:2 caf#303#251' \
+	"msgnum:3 $LONG#001end" \
+	'msgnum:4 end' \
+	'msgnum:5 a#012b#012c' > rsyslog.out.expected
+cmp rsyslog.out.log rsyslog.out.expected
+if [ ! $? -eq 0 ]; then
+	echo "unexpected sanitization result with escaping:"
+	diff rsyslog.out.log rsyslog.out.expected | cat -v
+	exit 1
+fi
+
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup sanitize-spacelf.conf
+./tcpflood -B -I rsyslog.input
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+printf ' %s\n' \
+	'msgnum:1 abc#001def#011ghi jkl' \
+	$'msgnum:2 caf\xc3\xa9' \
+	"msgnum:3 $LONG#001end" \
+	'msgnum:4 end' \
+	'msgnum:5 a b c' > rsyslog.out.expected
+cmp rsyslog.out.log rsyslog.out.expected
+if [ ! $? -eq 0 ]; then
+	echo "unexpected sanitization result with \$SpaceLFOnReceive:"
+	diff rsyslog.out.log rsyslog.out.expected | cat -v
+	exit 1
+fi
+rm -f rsyslog.out.expected
+source $srcdir/diag.sh exit
@@ -0,0 +1,14 @@
+# Test that a single producer can use the full size of a sharded queue.
+# All messages are injected by one thread and thus go to one shard. The
+# queue is slowed down and discards immediately when full, so all of them
+# only arrive if that shard can hold more than its 1/4th of queue.size.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[shardedqueue-size.sh\]: testing sharded queue size with a single producer
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup shardedqueue-size.conf
+source $srcdir/diag.sh injectmsg  0 900
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 899
+source $srcdir/diag.sh exit
@@ -0,0 +1,26 @@
+# Test for the shared worker pool with an action that never recovers next
+# to one that works. The pool has only one thread, so the working action
+# would never be served if the thread waited for the suspended action to
+# resume. All messages must reach the working action while rsyslogd is
+# still running.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[sharedworkers-suspended.sh\]: test for shared workers with a suspended action
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup sharedworkers-suspended.conf
+source $srcdir/diag.sh injectmsg 0 10000
+i=0
+while test ! -f rsyslog.out.log || test `wc -l < rsyslog.out.log` -lt 10000; do
+	./msleep 100
+	let "i++"
+	if test $i -gt 300; then
+		echo "FAIL: working action did not deliver all messages within 30 seconds"
+		$srcdir/diag.sh shutdown-immediate
+		$srcdir/diag.sh wait-shutdown
+		exit 1
+	fi
+done
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh exit
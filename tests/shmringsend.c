@@ -0,0 +1,181 @@
+/* sends test messages to an imshmring input via librsshmring.
+ *
+ * Command line options:
+ * -s name of the imshmring socket (required)
+ * -m number of messages to send (default 1000)
+ * -i initial message number (default 0)
+ * -c number of connections, each one is served by a thread of its own
+ *    and sends every c-th message (default 1)
+ * -d amount of extra data to add to each message
+ * -r write messages in place with reserve/commit instead of copying them
+ * -w number of seconds to keep each connection open after sending
+ *
+ * Messages are in the same format as generated by tcpflood. If a ring is
+ * full, sending is retried until the message fits.
+ *
+ * Part of the testbench for rsyslog.
+ *
+ * Copyright 2014 Rainer Gerhards and Adiscon GmbH.
+ *
+ * This file is part of rsyslog.
+ *
+ * Rsyslog is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Rsyslog is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Rsyslog.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * A copy of the GPL can be found in the file "COPYING" in this distribution.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include "rsshmring.h"
+
+#define MAX_EXTRADATA 65536
+
+static char *sockName = NULL;
+static int numMsgs = 1000;
+static int msgNum = 0;
+static int numConnections = 1;
+static int extraDataLen = 0;
+static int bInPlace = 0;
+static int waitClose = 0;
+static char extraData[MAX_EXTRADATA+1];
+
+
+static int
+genMsg(char *buf, size_t lenBuf, int num)
+{
+	return snprintf(buf, lenBuf, "<167>Mar  1 01:00:00 172.20.245.8 tag msgnum:%8.8d:%s%s",
+			num, extraDataLen ? " " : "", extraData);
+}
+
+
+static int
+sendMsg(rsshmring_t *ring, int num)
+{
+	char buf[MAX_EXTRADATA+256];
+	char *p;
+	int len;
+
+	len = genMsg(buf, sizeof(buf), num);
+	while(1) {
+		if(bInPlace) {
+			/* reserve room for the terminating NUL written by snprintf() */
+			if((p = rsshmring_reserve(ring, len + 1)) != NULL) {
+				genMsg(p, len + 1, num);
+				return rsshmring_commit(ring, len);
+			}
+		} else {
+			if(rsshmring_send(ring, buf, len) == 0)
+				return 0;
+		}
+		if(errno != EAGAIN)
+			return -1;
+		usleep(100); /* ring full, give rsyslog a chance to catch up */
+	}
+}
+
+
+static void *
+sender(void *arg)
+{
+	long iConn = (long) arg;
+	rsshmring_t *ring;
+	int i;
+
+	if((ring = rsshmring_open(sockName)) == NULL) {
+		perror("rsshmring_open");
+		exit(1);
+	}
+	for(i = iConn ; i < numMsgs ; i += numConnections) {
+		if(sendMsg(ring, msgNum + i) != 0) {
+			perror("shmringsend: send");
+			exit(1);
+		}
+	}
+	if(waitClose > 0)
+		sleep(waitClose);
+	rsshmring_close(ring);
+	return NULL;
+}
+
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: shmringsend -s /socket/name [-m nbr] [-i nbr] [-c nbr] [-d nbr] [-r] [-w sec]\n"
+			"-s MUST be specified\n");
+	exit(1);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	int opt;
+	long i;
+	pthread_t *thrds;
+
+	while((opt = getopt(argc, argv, "s:m:i:c:d:rw:")) != EOF) {
+		switch((char)opt) {
+		case 's':
+			sockName = optarg;
+			break;
+		case 'm':
+			numMsgs = atoi(optarg);
+			break;
+		case 'i':
+			msgNum = atoi(optarg);
+			break;
+		case 'c':
+			numConnections = atoi(optarg);
+			break;
+		case 'd':
+			extraDataLen = atoi(optarg);
+			break;
+		case 'r':
+			bInPlace = 1;
+			break;
+		case 'w':
+			waitClose = atoi(optarg);
+			break;
+		default:usage();
+		}
+	}
+
+	if(sockName == NULL || numConnections < 1
+	   || extraDataLen < 0 || extraDataLen > MAX_EXTRADATA)
+		usage();
+	memset(extraData, 'X', extraDataLen);
+	extraData[extraDataLen] = '\0';
+
+	if((thrds = calloc(numConnections, sizeof(pthread_t))) == NULL) {
+		perror("calloc");
+		exit(1);
+	}
+	for(i = 0 ; i < numConnections ; ++i) {
+		if(pthread_create(&thrds[i], NULL, sender, (void*) i) != 0) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	for(i = 0 ; i < numConnections ; ++i)
+		pthread_join(thrds[i], NULL);
+	free(thrds);
+
+	return 0;
+}
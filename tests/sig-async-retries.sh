@@ -0,0 +1,35 @@
+# Test for sig.async.retries. The timestamping service is an address
+# where nothing listens, so every request fails. When the file is closed
+# on HUP, the signer must retry three times with a delay of 1, 2 and 4
+# seconds, and only then report the failure, exactly once. The log file
+# itself must be complete. No network access is needed.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[sig-async-retries.sh\]: test lmsig_gt sig.async.retries
+source $srcdir/diag.sh init
+rm -f rsyslog.out.log.gtsig rsyslog.out.err.log
+source $srcdir/diag.sh startup sig-async-retries.conf
+source $srcdir/diag.sh tcpflood -m1000
+source $srcdir/diag.sh wait-queueempty
+tstart=`date +%s`
+kill -HUP `cat rsyslog.pid`
+for i in $(seq 1 60); do
+	test -s rsyslog.out.err.log && break
+	sleep 1
+done
+tend=`date +%s`
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+# the retry delays add up to 7 seconds, allow for clock granularity
+if [ $((tend - tstart)) -lt 6 ]; then
+	echo "failure reported after $((tend - tstart)) seconds, retries not done?"
+	exit 1
+fi
+nerr=`grep -c GTHTTP_createTimestampHash rsyslog.out.err.log`
+if [ "$nerr" != "1" ]; then
+	echo "expected the failure to be reported once, got $nerr reports:"
+	cat rsyslog.out.err.log
+	exit 1
+fi
+source $srcdir/diag.sh seq-check 0 999
+source $srcdir/diag.sh exit
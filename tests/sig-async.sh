@@ -0,0 +1,43 @@
+# Test for signatures obtained by a background thread. The file signed
+# with sig.async must have the same blocks as the one signed
+# synchronously, and both must verify. This needs access to the public
+# Guardtime timestamping service, the test is skipped if it cannot be
+# reached.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[sig-async.sh\]: test lmsig_gt sig.async
+source $srcdir/diag.sh init
+rm -f rsyslog.out.sync.log* rsyslog.out.async.log*
+source $srcdir/diag.sh startup sig-async.conf
+source $srcdir/diag.sh tcpflood -m1000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+../tools/rsgtutil -B rsyslog.out.sync.log.gtsig | grep "Record Count\|Block Nbr" > rsyslog.out.sync.blocks
+if [ `grep -c "Block Nbr" rsyslog.out.sync.blocks` -ne 10 ]; then
+	echo "no signatures obtained, timestamping service not reachable? - skipping test"
+	exit 77
+fi
+../tools/rsgtutil -B rsyslog.out.async.log.gtsig > rsyslog.out.async.params
+grep "Record Count\|Block Nbr" rsyslog.out.async.params > rsyslog.out.async.blocks
+cmp rsyslog.out.sync.blocks rsyslog.out.async.blocks
+if [ ! $? -eq 0 ]; then
+	echo "signature blocks differ between sync and async mode:"
+	diff rsyslog.out.sync.blocks rsyslog.out.async.blocks | head -10
+	exit 1
+fi
+if [ `grep -c "Has Tree Hashes.....: 1" rsyslog.out.async.params` -ne 10 ]; then
+	echo "sig.keeptreehashes not honored"
+	exit 1
+fi
+for f in rsyslog.out.sync.log rsyslog.out.async.log ; do
+	../tools/rsgtutil -t $f 2> rsyslog.out.err
+	if [ -s rsyslog.out.err ]; then
+		echo "signatures of $f do not verify:"
+		cat rsyslog.out.err
+		exit 1
+	fi
+done
+rm -f rsyslog.out.err
+cp rsyslog.out.async.log rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 999
+source $srcdir/diag.sh exit
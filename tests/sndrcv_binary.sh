@@ -0,0 +1,36 @@
+# Test for the binary relay between two rsyslog instances. The sender
+# forwards with omfwd tcp_framing="binary" to an imptcp listener with
+# supportBinaryFraming="on", which also receives traditionally framed
+# messages. Binary records must carry the message variables set by the
+# sender, which text framing can not.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[sndrcv_binary.sh\]: testing binary relay between two instances
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup sndrcv_binary_rcvr.conf
+source $srcdir/diag.sh wait-startup
+source $srcdir/diag.sh startup sndrcv_binary_sender.conf 2
+source $srcdir/diag.sh wait-startup 2
+source $srcdir/diag.sh tcpflood -m10000
+sleep 2 # make sure all data is received in input buffers
+source $srcdir/diag.sh shutdown-when-empty 2
+source $srcdir/diag.sh wait-shutdown 2
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+# binary: msgnum,$!num,$!relay - text: msgnum,,
+awk -F, '$2 != $1 || $3 != "yes" { print "binary: unexpected line: " $0; bad = 1; exit }
+	END { exit bad }' rsyslog.out.log
+if [ $? -ne 0 ]; then
+	exit 1
+fi
+awk -F, '$2 != "" || $3 != "" { print "text: unexpected line: " $0; bad = 1; exit }
+	END { exit bad }' rsyslog2.out.log
+if [ $? -ne 0 ]; then
+	exit 1
+fi
+cut -d, -f1 rsyslog.out.log > rsyslog.out.seq
+mv rsyslog.out.seq rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 9999
+cut -d, -f1 rsyslog2.out.log > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh exit
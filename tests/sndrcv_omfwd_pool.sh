@@ -0,0 +1,37 @@
+# Test for omfwd target pools. Two actions forward to three targets each,
+# one with round-robin and one with least-loaded distribution. One target
+# of each pool is down, so its batch must be retried on the next target,
+# and the remaining targets must share all messages between them. A third
+# action has the dead target first, so resuming the action must skip it
+# and use the second one.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[sndrcv_omfwd_pool.sh\]: testing omfwd target pools
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup sndrcv_omfwd_pool_rcvr.conf
+source $srcdir/diag.sh startup sndrcv_omfwd_pool_sender.conf 2
+# send in several rounds, so that both actions get many transactions
+for i in `seq 0 9`; do
+	source $srcdir/diag.sh tcpflood -m1000 -i$((i * 1000))
+	./msleep 200
+done
+sleep 2 # make sure all data is received in input buffers
+source $srcdir/diag.sh shutdown-when-empty 2
+source $srcdir/diag.sh wait-shutdown 2
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh seq-check2 0 9999
+sort rsyslog.out.df.log > rsyslog.out.df.sorted.log
+seq -f "%08g" 0 9999 | cmp - rsyslog.out.df.sorted.log
+if [ $? -ne 0 ]; then
+	echo "action with the dead target first did not deliver all messages exactly once"
+	exit 1
+fi
+for f in rr1 rr2; do
+	if [ ! -s rsyslog.out.$f.log ]; then
+		echo "round-robin target $f did not receive any messages"
+		exit 1
+	fi
+done
+source $srcdir/diag.sh exit
@@ -0,0 +1,9 @@
+# Test for imrelp threads. The receiver runs two RELP engines with one
+# listener each. The sender relays all messages to both listeners, and
+# each of them must receive all messages.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[sndrcv_relp_threads.sh\]: testing receiving via relp with multiple engines
+source $srcdir/sndrcv_drvr_noexit.sh sndrcv_relp_threads 50000
+source $srcdir/diag.sh seq-check2 1 50000
+source $srcdir/diag.sh exit
@@ -0,0 +1,30 @@
+# Test for omrelp connections, windowSize.auto and windowSize.max. The
+# sender uses four RELP connections with a very small initial window, so
+# sends regularly have to wait for acknowledgements. All messages must be
+# received exactly once, and the statistics must show that all of them
+# were submitted and that the window did limit sending.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[sndrcv_relp_window.sh\]: testing omrelp with multiple connections
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup sndrcv_relp_window_rcvr.conf
+source $srcdir/diag.sh startup sndrcv_relp_window_sender.conf 2
+source $srcdir/diag.sh tcpflood -m50000 -i1
+source $srcdir/diag.sh wait-queueempty 2
+sleep 2 # let impstats emit at least one line after everything was sent
+source $srcdir/diag.sh shutdown-when-empty 2
+source $srcdir/diag.sh wait-shutdown 2
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 1 50000
+SUBMITTED=$($srcdir/diag.sh get-stat "omrelp(127.0.0.1:13515)" submitted)
+WINDOWFULL=$($srcdir/diag.sh get-stat "omrelp(127.0.0.1:13515)" window.full)
+WINDOWSIZE=$($srcdir/diag.sh get-stat "omrelp(127.0.0.1:13515)" window.size)
+if [ "$SUBMITTED" != "50000" ] || [ -z "$WINDOWFULL" ] || [ "$WINDOWFULL" -lt 1 ] \
+   || [ -z "$WINDOWSIZE" ] || [ "$WINDOWSIZE" -lt 8 ] || [ "$WINDOWSIZE" -gt 256 ]; then
+	echo "omrelp stats wrong: submitted=$SUBMITTED (expected 50000),"
+	echo "window.full=$WINDOWFULL (expected > 0), window.size=$WINDOWSIZE (expected 8..256), stats are:"
+	cat rsyslog.out.stats.log
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,18 @@
+# Test for omfwd gathered TCP sends. Messages have random length up to
+# 50000 bytes, so frames larger than the send buffer regularly go out in the
+# same call as the buffered small frames before them, and short writes
+# have to be resumed across buffers. All messages must arrive complete.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[sndrcv_tcp_largemsg.sh\]: testing sending large messages via tcp
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup sndrcv_tcp_largemsg_rcvr.conf
+source $srcdir/diag.sh startup sndrcv_tcp_largemsg_sender.conf 2
+source $srcdir/diag.sh tcpflood -m5000 -i1 -r -d50000 -P129
+sleep 2 # make sure all data is received in input buffers
+source $srcdir/diag.sh shutdown-when-empty 2
+source $srcdir/diag.sh wait-shutdown 2
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 1 5000 -E
+source $srcdir/diag.sh exit
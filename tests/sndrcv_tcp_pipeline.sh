@@ -0,0 +1,18 @@
+# Test for omfwd tcp.pipeline.size. The receiver processes messages slowly,
+# so its socket buffers fill up and the sender has to queue data in the
+# pipeline buffer and send it as the connection becomes writable again.
+# All messages must arrive complete.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[sndrcv_tcp_pipeline.sh\]: testing non-blocking omfwd tcp sends
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup sndrcv_tcp_pipeline_rcvr.conf
+source $srcdir/diag.sh startup sndrcv_tcp_pipeline_sender.conf 2
+source $srcdir/diag.sh tcpflood -m5000 -i1 -r -d10000 -P129
+sleep 2 # make sure all data is received in input buffers
+source $srcdir/diag.sh shutdown-when-empty 2
+source $srcdir/diag.sh wait-shutdown 2
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 1 5000 -E
+source $srcdir/diag.sh exit
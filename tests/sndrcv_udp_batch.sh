@@ -0,0 +1,30 @@
+# Test for omfwd sending UDP messages in batches via sendmmsg(). The input
+# contains one message too large for a UDP datagram in the middle. It must
+# be skipped, while all other messages of its batch must still be sent.
+# Note that with UDP we can always have message loss, so failure of this
+# test does not necessarily mean that the code is wrong.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[sndrcv_udp_batch.sh\]: testing sending batches of udp messages
+source $srcdir/diag.sh init
+awk 'BEGIN {
+	for(i = 1 ; i <= 2000 ; ++i) {
+		printf("<129>Mar  1 01:00:00 172.20.245.8 tag msgnum:%8.8d:\n", i)
+		if(i == 1000) {
+			d = ""
+			for(j = 0 ; j < 70000 ; ++j)
+				d = d "X"
+			printf("<129>Mar  1 01:00:00 172.20.245.8 tag msgnum:toolarge:%s\n", d)
+		}
+	}
+}' > rsyslog.input
+source $srcdir/diag.sh startup sndrcv_udp_batch_rcvr.conf
+source $srcdir/diag.sh startup sndrcv_udp_batch_sender.conf 2
+./tcpflood -B -I rsyslog.input
+sleep 2 # make sure all data is received in input buffers
+source $srcdir/diag.sh shutdown-when-empty 2
+source $srcdir/diag.sh wait-shutdown 2
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 1 2000
+source $srcdir/diag.sh exit
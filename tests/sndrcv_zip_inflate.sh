@@ -0,0 +1,20 @@
+# Test for the decompression of received data, both for single compressed
+# messages via UDP (handled by the core with a per-thread zlib stream) and
+# for a compressed imptcp stream. Messages have random size up to 8000
+# bytes, so the output buffers must grow. All messages must arrive
+# complete on both paths.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[sndrcv_zip_inflate.sh\]: testing uncompression of received messages
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup sndrcv_zip_inflate_rcvr.conf
+source $srcdir/diag.sh startup sndrcv_zip_inflate_sender.conf 2
+source $srcdir/diag.sh tcpflood -m2000 -i1 -r -d8000 -P129
+sleep 2 # make sure all data is received in input buffers
+source $srcdir/diag.sh shutdown-when-empty 2
+source $srcdir/diag.sh wait-shutdown 2
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 1 2000 -E
+source $srcdir/diag.sh seq-check2 1 2000 -E
+source $srcdir/diag.sh exit
@@ -0,0 +1,33 @@
+# Test for the per-thread sharded stats counters. Messages are received by
+# four imtcp session threads and processed by four main queue workers,
+# with resetCounters on. The values reported over all intervals must add
+# up to exactly the number of messages.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[stats-sharded.sh\]: test sharded stats counters
+source $srcdir/diag.sh init
+rm -f rsyslog.out.stats.log
+source $srcdir/diag.sh startup stats-sharded.conf
+source $srcdir/diag.sh tcpflood -m20000 -c8
+source $srcdir/diag.sh wait-queueempty
+sleep 3 # let impstats write the final counters
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 19999
+# sum up counter $2 of stats object $1 over all intervals
+sumstat() {
+	grep -F " $1: " rsyslog.out.stats.log | awk -v name="$2" '{
+		for(i = 1 ; i <= NF ; ++i) {
+			split($i, kv, "=")
+			if(kv[1] == name) n += kv[2]
+		}
+	} END { print n + 0 }'
+}
+SUBMITTED=$(sumstat "imtcp(13514)" submitted)
+PROCESSED=$(sumstat "out" processed)
+echo "imtcp submitted $SUBMITTED, action processed $PROCESSED"
+if [ "$SUBMITTED" != "20000" ] || [ "$PROCESSED" != "20000" ]; then
+	echo "sharded counters do not add up to 20000"
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,31 @@
+# Test for the frame scanning of imtcp and imptcp. The same stream is sent
+# to both of them. It alternates LF-delimited and octet-counted frames of
+# random length up to 3000 bytes, so frames regularly span receive buffers
+# or end exactly at one. Every message must arrive complete.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[tcp-mixedframing.sh\]: test for mixed LF and octet-counted framing
+source $srcdir/diag.sh init
+awk 'BEGIN {
+	srand(1)
+	for(i = 0 ; i < 5000 ; ++i) {
+		n = int(rand() * 3000)
+		d = ""
+		for(j = 0 ; j < n ; ++j)
+			d = d "X"
+		m = sprintf("<129>Mar  1 01:00:00 172.20.245.8 tag msgnum:%8.8d:%d:%s", i, n, d)
+		if(i % 2)
+			printf("%d %s", length(m), m)
+		else
+			printf("%s\n", m)
+	}
+}' > rsyslog.input
+source $srcdir/diag.sh startup tcp-mixedframing.conf
+./tcpflood -p13514 -B -I rsyslog.input
+./tcpflood -p13515 -B -I rsyslog.input
+sleep 1 # due to large messages, we need this time for the tcp receivers to settle...
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 4999 -E
+source $srcdir/diag.sh seq-check2 0 4999 -E
+source $srcdir/diag.sh exit
@@ -49,6 +49,12 @@
  * -Y	use multiple threads, one per connection (which means 1 if one only connection
  *  	is configured!)
  * -y   use RFC5424 style test message
+ * -O	send rate limit in messages per second per connection (default: 0,
+ *      unlimited). This is a token bucket with a burst of 10ms worth of
+ *      messages. Without -Y, all connections share one bucket of -O times
+ *      number of connections.
+ * -l	embed the send time (usecs since the epoch) as "lat:<usecs>:" at the
+ *      end of generated messages, so that latsink can measure their latency
  * -z	private key file for TLS mode
  * -Z	cert (public key) file for TLS mode
  * -L	loglevel to use for GnuTLS troubleshooting (0-off to 10-all, 0 default)
@@ -135,6 +141,8 @@ static int bCSVoutput = 0;	/* generate output in CSV (where applicable) */
 static long long batchsize = 100000000ll;
 static int waittime = 0;
 static int runMultithreaded = 0; /* run tests in multithreaded mode */
+static unsigned msgRate = 0;	/* max msgs/s per connection, 0 - unlimited */
+static int bEmbedSendTime = 0;	/* embed send timestamp for latency measurement */
 static int numThrds = 1;	/* number of threads to use */
 static char *tlsCertFile = NULL;
 static char *tlsKeyFile = NULL;
@@ -159,6 +167,8 @@ struct instdata {
 	unsigned long long numMsgs; /* number of messages to send */
 	unsigned long long numSent; /* number of messages already sent */
 	unsigned idx;	/**< index of fd to be used for sending */
+	double tokens;	/**< rate limiter tokens available */
+	long long tLastRefill; /**< when tokens were last refilled (monotonic usecs) */
 	pthread_t thread; /**< thread processing this instance */
 } *instarray = NULL;
 
@@ -343,6 +353,8 @@ genMsg(char *buf, size_t maxBuf, int *pLenBuf, struct instdata *inst)
 	int edLen; /* actual extra data length to use */
 	char extraData[MAX_EXTRADATA_LEN + 1];
 	char dynFileIDBuf[128] = "";
+	char sendTimeBuf[64] = "";
+	struct timeval tv;
 	int done;
 
 	if(dataFP != NULL) {
@@ -361,17 +373,22 @@ genMsg(char *buf, size_t maxBuf, int *pLenBuf, struct instdata *inst)
 			}
 		} while(!done); /* Attention: do..while()! */
 	} else if(MsgToSend == NULL) {
+		if(bEmbedSendTime) {
+			gettimeofday(&tv, NULL);
+			snprintf(sendTimeBuf, sizeof(sendTimeBuf), "lat:%lld:",
+				 (long long) tv.tv_sec * 1000000 + tv.tv_usec);
+		}
 		if(dynFileIDs > 0) {
 			snprintf(dynFileIDBuf, sizeof(dynFileIDBuf), "%d:", rand() % dynFileIDs);
 		}
 		if(extraDataLen == 0) {
 			if(useRFC5424Format) {
 				*pLenBuf = snprintf(buf, maxBuf, "<%s>1 2003-03-01T01:00:00.000Z mymachine.example.com tcpflood "
-						     "- tag [tcpflood@32473 MSGNUM=\"%8.8d\"] msgnum:%s%8.8d:%c",
-						       msgPRI, msgNum, dynFileIDBuf, msgNum, frameDelim);
+						     "- tag [tcpflood@32473 MSGNUM=\"%8.8d\"] msgnum:%s%8.8d:%s%c",
+						       msgPRI, msgNum, dynFileIDBuf, msgNum, sendTimeBuf, frameDelim);
 			} else {
-				*pLenBuf = snprintf(buf, maxBuf, "<%s>Mar  1 01:00:00 172.20.245.8 tag msgnum:%s%8.8d:%c",
-						       msgPRI, dynFileIDBuf, msgNum, frameDelim);
+				*pLenBuf = snprintf(buf, maxBuf, "<%s>Mar  1 01:00:00 172.20.245.8 tag msgnum:%s%8.8d:%s%c",
+						       msgPRI, dynFileIDBuf, msgNum, sendTimeBuf, frameDelim);
 			}
 		} else {
 			if(bRandomizeExtraData)
@@ -382,11 +399,11 @@ genMsg(char *buf, size_t maxBuf, int *pLenBuf, struct instdata *inst)
 			extraData[edLen] = '\0';
 			if(useRFC5424Format) {
 				*pLenBuf = snprintf(buf, maxBuf, "<%s>1 2003-03-01T01:00:00.000Z mymachine.example.com tcpflood "
-						     "- tag [tcpflood@32473 MSGNUM=\"%8.8d\"] msgnum:%s%8.8d:%c",
-						       msgPRI, msgNum, dynFileIDBuf, msgNum, frameDelim);
+						     "- tag [tcpflood@32473 MSGNUM=\"%8.8d\"] msgnum:%s%8.8d:%s%c",
+						       msgPRI, msgNum, dynFileIDBuf, msgNum, sendTimeBuf, frameDelim);
 			} else {
-				*pLenBuf = snprintf(buf, maxBuf, "<%s>Mar  1 01:00:00 172.20.245.8 tag msgnum:%s%8.8d:%d:%s%c",
-						       msgPRI, dynFileIDBuf, msgNum, edLen, extraData, frameDelim);
+				*pLenBuf = snprintf(buf, maxBuf, "<%s>Mar  1 01:00:00 172.20.245.8 tag msgnum:%s%8.8d:%d:%s%s%c",
+						       msgPRI, dynFileIDBuf, msgNum, edLen, extraData, sendTimeBuf, frameDelim);
 			}
 		}
 	} else {
@@ -398,6 +415,42 @@ genMsg(char *buf, size_t maxBuf, int *pLenBuf, struct instdata *inst)
 finalize_it: /*EMPTY to keep the compiler happy */;
 }
 
+/* get a monotonic time stamp in microseconds */
+static long long
+getMonotonicUsecs(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (long long) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+
+/* wait until the rate limit (-O) permits to send the next message. This
+ * is a token bucket that is refilled according to the time passed, so
+ * that sending takes up where it left off after a slow send. The bucket
+ * holds at most 10ms worth of messages, which limits bursts.
+ */
+static void
+rateLimitWait(struct instdata *inst)
+{
+	const double rate = (double) msgRate * (runMultithreaded ? 1 : numConnections);
+	const double burst = (rate / 100.0 < 1.0) ? 1.0 : rate / 100.0;
+	long long tNow;
+
+	while(1) {
+		tNow = getMonotonicUsecs();
+		inst->tokens += (tNow - inst->tLastRefill) * rate / 1000000.0;
+		inst->tLastRefill = tNow;
+		if(inst->tokens > burst)
+			inst->tokens = burst;
+		if(inst->tokens >= 1.0) {
+			inst->tokens -= 1.0;
+			return;
+		}
+		usleep((useconds_t) ((1.0 - inst->tokens) * 1000000.0 / rate) + 1);
+	}
+}
+
 /* send messages to the tcp connections we keep open. We use
  * a very basic format that helps identify the message
  * (via msgnum:<number>: e.g. msgnum:00000001:). This format is suitable
@@ -429,7 +482,11 @@ int sendMessages(struct instdata *inst)
 	}
 	if(bShowProgress)
 		printf("\r%8.8d %s sent", 0, statusText);
+	inst->tokens = 1.0;
+	inst->tLastRefill = getMonotonicUsecs();
 	while(i < inst->numMsgs) {
+		if(msgRate > 0)
+			rateLimitWait(inst);
 		if(runMultithreaded) {
 			socknum = inst->idx;
 		} else {
@@ -844,7 +901,7 @@ int main(int argc, char *argv[])
 
 	setvbuf(stdout, buf, _IONBF, 48);
 	
-	while((opt = getopt(argc, argv, "b:ef:F:t:p:c:C:m:i:I:P:d:Dn:L:M:rsBR:S:T:XW:yYz:Z:")) != -1) {
+	while((opt = getopt(argc, argv, "b:ef:F:t:p:c:C:m:i:I:lO:P:d:Dn:L:M:rsBR:S:T:XW:yYz:Z:")) != -1) {
 		switch (opt) {
 		case 'b':	batchsize = atoll(optarg);
 				break;
@@ -862,6 +919,10 @@ int main(int argc, char *argv[])
 				break;
 		case 'i':	msgNum = atoi(optarg);
 				break;
+		case 'l':	bEmbedSendTime = 1;
+				break;
+		case 'O':	msgRate = (unsigned) atoi(optarg);
+				break;
 		case 'P':	msgPRI = optarg;
 				break;
 		case 'd':	extraDataLen = atoi(optarg);
@@ -0,0 +1 @@
+rule=tagA:msgnum:%n:number%
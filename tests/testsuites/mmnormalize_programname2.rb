@@ -0,0 +1 @@
+rule=tagB:msgnum:%m:number%
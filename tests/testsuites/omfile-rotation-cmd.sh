@@ -0,0 +1,3 @@
+#!/bin/bash
+# helper for omfile-rotation.sh: record the name of each rotated file
+echo "$1" >> rsyslog.out.rotated.log
@@ -0,0 +1,7 @@
+#!/bin/bash
+# helper for omprog-confirm.sh: write each line into a per-process
+# file and acknowledge it with "OK"
+while read line; do
+	echo "$line" >> rsyslog.out.prog.$$.log
+	echo OK
+done
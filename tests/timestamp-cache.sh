@@ -0,0 +1,21 @@
+# Test for the per-thread cache of formatted timestamps. The same
+# timestamp of each message is rendered in several formats, one after the
+# other, so every format is served from the cache for most messages. Each
+# string must be complete and not contain parts of another format.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[timestamp-cache.sh\]: testing formatted timestamp cache
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup timestamp-cache.conf
+source $srcdir/diag.sh injectmsg  0 10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999
+awk -F, '$2 != "Mar  1 01:00:00" || $3 !~ /^[0-9][0-9][0-9][0-9]-03-01T01:00:00[+-][0-9][0-9]:[0-9][0-9]$/ ||
+	 $4 != $2 || $5 !~ /^[0-9][0-9][0-9][0-9]0301010000$/ || $6 != $3 {
+		print "bad timestamp in line " NR ": " $0; exit 1 }' rsyslog.out.log
+if [ "$?" -ne "0" ]; then
+  echo "timestamp cache error detected"
+  exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,56 @@
+# Test for the per-thread prefix cache of the timestamp parsers and the
+# memoized start of day. Timestamps advance by 31 seconds from Feb 28 into
+# Mar 1 of a leap year, alternating RFC3339 with different offsets and
+# fractions and RFC3164, so the cached date and minute regularly change.
+# The resulting times must be the same as from a full parse.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[timestamp-parsecache.sh\]: test timestamp parser caching
+source $srcdir/diag.sh init
+awk 'function ts3339(t, frac, ofs,    d, s) {
+		d = int((t - day0) / 86400); s = t - day0 - d * 86400; ++d
+		return sprintf("2012-%s-%2.2dT%2.2d:%2.2d:%2.2d%s%s", mon3339[d], mday[d],
+			int(s / 3600), int(s % 3600 / 60), s % 60, frac, ofs)
+	}
+	function ts3164(t,    d, s) {
+		d = int((t - day0) / 86400); s = t - day0 - d * 86400; ++d
+		return sprintf("%s %2d %2.2d:%2.2d:%2.2d", mon3164[d], mday[d],
+			int(s / 3600), int(s % 3600 / 60), s % 60)
+	}
+	BEGIN {
+	day0 = 1330300800 # 2012-02-27T00:00:00Z
+	split("02 02 02 03", mon3339); split("Feb Feb Feb Mar", mon3164)
+	split("27 28 29 1", mday)
+	for(i = 0 ; i < 3000 ; ++i) {
+		t = 1330473480 + 31 * i # starts 2012-02-28T23:58:00Z
+		n = sprintf("%8.8d", i)
+		kind = int(i / 3) % 4
+		if(kind == 0)
+			ts = ts3339(t, "", "Z")
+		else if(kind == 1)
+			ts = ts3339(t + 3600, sprintf(".%6.6d", i), "+01:00")
+		else if(kind == 2)
+			ts = ts3339(t - 19800, "", "-05:30")
+		if(kind < 3) {
+			printf("<129>%s host1 a: msgnum:%s\n", ts, n) > "rsyslog.input"
+			printf("%d,%s\n", t, n) > "rsyslog.out.expected"
+		} else {
+			printf("<129>%s host1 b: msgnum:%s\n", ts3164(t), n) > "rsyslog.input"
+			printf("%s,%s\n", ts3164(t), n) > "rsyslog2.out.expected"
+		}
+	}
+}'
+source $srcdir/diag.sh startup timestamp-parsecache.conf
+./tcpflood -B -I rsyslog.input
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+for f in rsyslog.out rsyslog2.out; do
+	cmp $f.log $f.expected
+	if [ ! $? -eq 0 ]; then
+		echo "wrong timestamps in $f.log, first differences:"
+		diff $f.log $f.expected | head -10
+		exit 1
+	fi
+done
+rm -f rsyslog.out.expected rsyslog2.out.expected
+source $srcdir/diag.sh exit
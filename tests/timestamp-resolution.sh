@@ -0,0 +1,23 @@
+# Test for global(timestamp.resolution). Reception timestamps must be
+# rounded down to 100ms and must still be the current time.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[timestamp-resolution.sh\]: test coarse reception timestamps
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup timestamp-resolution.conf
+TSTART=$(date +%s)
+source $srcdir/diag.sh tcpflood -m10000
+TEND=$(date +%s)
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+awk -F, -v tstart=$TSTART -v tend=$TEND '
+	$2 < tstart || $2 > tend { print "timestamp out of range: " $0; bad = 1; exit }
+	$3 !~ /T[0-9][0-9]:[0-9][0-9]:[0-9][0-9]\.[0-9]00000[-+Z]/ { print "timestamp not rounded: " $0; bad = 1; exit }
+	END { exit bad }' rsyslog.out.log
+if [ ! $? -eq 0 ]; then
+	exit 1
+fi
+cut -d, -f1 rsyslog.out.log > rsyslog.out.seq
+mv rsyslog.out.seq rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh exit
@@ -0,0 +1,24 @@
+# Test for tls.ktls. A sender forwards via TLS to a receiver, both with
+# kernel TLS enabled, and reconnects every 100 messages. The messages have
+# random length up to 5000 bytes, so records regularly span several reads.
+# All messages must arrive complete. If the kernel or GnuTLS cannot do kTLS,
+# the sessions stay with GnuTLS and the test still has to pass.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[tls-ktls.sh\]: test for kernel TLS offload
+source $srcdir/diag.sh init
+echo 'global(tls.ktls="on")' > work-tls-global.conf
+source $srcdir/diag.sh startup sndrcv_tls_global_rcvr.conf
+source $srcdir/diag.sh startup sndrcv_tls_global_sender.conf 2
+source $srcdir/diag.sh tcpflood -m10000 -i1 -r -d5000 -P129
+sleep 2 # make sure all data is received in input buffers
+source $srcdir/diag.sh shutdown-when-empty 2
+source $srcdir/diag.sh wait-shutdown 2
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+if [ -f /proc/net/tls_stat ]; then
+	echo "kernel TLS statistics:"
+	cat /proc/net/tls_stat
+fi
+source $srcdir/diag.sh seq-check 1 10000 -E
+source $srcdir/diag.sh exit
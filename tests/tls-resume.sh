@@ -0,0 +1,35 @@
+# Test for TLS session resumption of the gtls driver. A sender forwards via
+# TLS to a receiver and reconnects every 100 messages. First with session
+# tickets, then with tickets disabled (tls.ticketKey.rotation="0") so that
+# the server's session cache (tls.sessionCache.size) is used. In both
+# runs, the receiver must resume sessions and receive all messages.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[tls-resume.sh\]: test for TLS session resumption
+source $srcdir/diag.sh init
+for run in tickets cache; do
+	if [ $run == tickets ]; then
+		echo 'global(tls.ticketkey.rotation="3600")' > work-tls-global.conf
+		START=1
+	else
+		echo 'global(tls.ticketkey.rotation="0" tls.sessioncache.size="16")' > work-tls-global.conf
+		START=5001
+	fi
+	source $srcdir/diag.sh startup sndrcv_tls_global_rcvr.conf
+	source $srcdir/diag.sh startup sndrcv_tls_global_sender.conf 2
+	source $srcdir/diag.sh tcpflood -m5000 -i$START -r -d1000 -P129
+	sleep 2 # make sure all data is received in input buffers
+	source $srcdir/diag.sh shutdown-when-empty 2
+	source $srcdir/diag.sh wait-shutdown 2
+	sleep 2 # let impstats emit at least one line after the last session
+	source $srcdir/diag.sh shutdown-when-empty
+	source $srcdir/diag.sh wait-shutdown
+	RESUMED=$($srcdir/diag.sh get-stat nsd_gtls server.resumed)
+	if [ -z "$RESUMED" ] || [ "$RESUMED" -lt 1 ]; then
+		echo "no TLS sessions resumed with $run, stats are:"
+		cat rsyslog.out.stats.log
+		exit 1
+	fi
+done
+source $srcdir/diag.sh seq-check 1 10000 -E
+source $srcdir/diag.sh exit
@@ -0,0 +1,17 @@
+# Test for compiled templates. A list template with adjacent constants,
+# fixed-width date fields and field options must be rendered exactly as
+# defined.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[tpl-compiled.sh\]: testing compiled template rendering
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup tpl-compiled.conf
+source $srcdir/diag.sh injectmsg  0 10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999
+if grep -v '^[0-9]*,\[a\]b,[0-9][0-9][0-9][0-9]0301010000,Mar  1 01:00:00,TAG,tag|$' rsyslog.out.log; then
+  echo "unexpected template output"
+  exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,31 @@
+# Test for the "tplbuf.reallocs" action counter. Fixed-length output must
+# never grow the buffer after it was allocated for the first message.
+# Output that suddenly gets much longer than before must be counted.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[tplbuf-reallocs.sh\]: testing template buffer reallocation counter
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup tplbuf-reallocs.conf
+source $srcdir/diag.sh tcpflood -m1000 -d10
+source $srcdir/diag.sh tcpflood -m10 -i1000 -d5000
+source $srcdir/diag.sh wait-queueempty
+sleep 3 # let impstats emit at least one line after the burst
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 1009
+getreallocs() {
+	grep " $1: " rsyslog.out.stats.log | tail -1 | awk '{
+		for(i = 1 ; i <= NF ; ++i) {
+			split($i, kv, "=")
+			if(kv[1] == "tplbuf.reallocs") n = kv[2]
+		}
+	} END { print n }'
+}
+SIZED=$(getreallocs sized)
+GROWN=$(getreallocs grown)
+if [ "$SIZED" != "0" ] || [ -z "$GROWN" ] || [ "$GROWN" -lt 1 ] || [ "$GROWN" -gt 10 ]; then
+	echo "tplbuf.reallocs wrong: sized=$SIZED (expected 0), grown=$GROWN (expected 1..10), stats are:"
+	cat rsyslog.out.stats.log
+	exit 1
+fi
+source $srcdir/diag.sh exit
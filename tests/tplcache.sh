@@ -0,0 +1,22 @@
+# Test for the per-worker cache of rendered template strings. Several
+# actions use the same template, and $! variables used by it are changed
+# and removed between them. Each action must see the current values.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[tplcache.sh\]: testing template cache shared between actions
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup tplcache.conf
+source $srcdir/diag.sh injectmsg  0 10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999
+if ! cmp rsyslog.out.log rsyslog.out.a2.log; then
+  echo "actions with the same template rendered different strings"
+  exit 1
+fi
+if grep -v ',a$' rsyslog.out.log || grep -v ',b$' rsyslog.out.b.log ||
+   grep -v '^[0-9]*,$' rsyslog.out.c.log; then
+  echo "stale cached template string detected"
+  exit 1
+fi
+source $srcdir/diag.sh exit
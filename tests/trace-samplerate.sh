@@ -0,0 +1,30 @@
+# Test for global(trace.samplerate). Every tenth message is traced, and
+# the traced messages must be accounted for each stage they pass,
+# including the action queue of the output action.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[trace-samplerate.sh\]: test sampled message tracing
+source $srcdir/diag.sh init
+rm -f rsyslog.out.stats.log
+source $srcdir/diag.sh startup trace-samplerate.conf
+source $srcdir/diag.sh tcpflood -m10000
+source $srcdir/diag.sh wait-queueempty
+sleep 3 # let the action queue drain and impstats write the final counters
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999
+# a few internal messages may be sampled, too
+SAMPLED=$($srcdir/diag.sh get-stat "message-trace" sampled)
+echo "message-trace: $SAMPLED messages sampled"
+if [ -z "$SAMPLED" ] || [ $SAMPLED -lt 990 ] || [ $SAMPLED -gt 1010 ]; then
+	echo "expected about 1000 sampled messages"
+	exit 1
+fi
+for stage in mainq.dequeue parse ruleset actionq.dequeue action; do
+	COUNT=$($srcdir/diag.sh get-stat "message-trace" $stage.count)
+	if [ -z "$COUNT" ] || [ $COUNT -lt 990 ]; then
+		echo "stage $stage was reached by '$COUNT' traced messages, expected about 1000"
+		exit 1
+	fi
+done
+source $srcdir/diag.sh exit
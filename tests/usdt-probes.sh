@@ -0,0 +1,49 @@
+# Test for the USDT static tracepoints (--enable-usdt). All probes must be
+# present in the rsyslogd binary, and rsyslogd must work normally with
+# them compiled in. If bpftrace is available and we are root, the probes
+# are also attached during a run and must fire.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[usdt-probes.sh\]: test USDT tracepoints
+if ! hash readelf 2>/dev/null; then
+	echo "readelf not found, skipping test"
+	exit 77
+fi
+RSYSLOGD=../tools/rsyslogd
+if [ -f ../tools/.libs/rsyslogd ]; then
+	RSYSLOGD=../tools/.libs/rsyslogd
+fi
+readelf -n $RSYSLOGD > rsyslog.out.notes
+for probe in queue__enqueue queue__dequeue batch__start batch__end \
+	     parse__begin parse__end action__call__begin action__call__end \
+	     action__commit__begin action__commit__end stream__write stream__flush; do
+	if ! grep -q "Name: $probe\$" rsyslog.out.notes; then
+		echo "probe rsyslog:$probe missing in $RSYSLOGD"
+		exit 1
+	fi
+done
+rm -f rsyslog.out.notes
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup usdt-probes.conf
+BPFTRACE_PID=
+if [ "$EUID" -eq 0 ] && hash bpftrace 2>/dev/null; then
+	bpftrace -p `cat rsyslog.pid` -e 'usdt:*:rsyslog:parse__end { @n = count(); }
+		interval:s:5 { exit(); }' > rsyslog.out.bpftrace 2>&1 &
+	BPFTRACE_PID=$!
+	sleep 2 # give bpftrace time to attach
+fi
+source $srcdir/diag.sh tcpflood -m10000
+source $srcdir/diag.sh wait-queueempty
+if [ -n "$BPFTRACE_PID" ]; then
+	wait $BPFTRACE_PID
+	if ! grep -q "^@n: [1-9]" rsyslog.out.bpftrace; then
+		echo "parse__end probe did not fire:"
+		cat rsyslog.out.bpftrace
+		exit 1
+	fi
+	rm -f rsyslog.out.bpftrace
+fi
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh exit
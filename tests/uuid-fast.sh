@@ -0,0 +1,23 @@
+# Test for the per-thread UUID generator (global(uuid.type="v7")). All
+# UUIDs must be unique and carry the version 7 and RFC 4122 variant bits.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[uuid-fast.sh\]: testing fast uuid generation
+source $srcdir/diag.sh init
+rm -f rsyslog2.out.log
+source $srcdir/diag.sh startup uuid-fast.conf
+source $srcdir/diag.sh injectmsg  0 10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999
+if [ `grep -c -E '^[0-9A-F]{12}7[0-9A-F]{3}[89AB][0-9A-F]{15}$' rsyslog2.out.log` -ne 10000 ]; then
+	echo "invalid UUIDs generated:"
+	grep -v -E '^[0-9A-F]{12}7[0-9A-F]{3}[89AB][0-9A-F]{15}$' rsyslog2.out.log | head
+	exit 1
+fi
+if [ `sort -u rsyslog2.out.log | wc -l` -ne 10000 ]; then
+	echo "duplicate UUIDs generated"
+	exit 1
+fi
+rm -f rsyslog2.out.log
+source $srcdir/diag.sh exit
@@ -0,0 +1,29 @@
+# Test for latency-driven worker scaling. Dequeue is slowed down, so
+# the backlog of injected messages is far above the latency target and
+# the queue must scale up, but never beyond queue.workerthreads.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[workerscaling.sh\]: testing latency-driven worker scaling
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup workerscaling.conf
+
+# 40000 messages should be enough
+source $srcdir/diag.sh injectmsg  0 40000
+source $srcdir/diag.sh wait-queueempty
+sleep 3 # let impstats emit at least one line after the burst
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 39999
+grep " main Q: " rsyslog.out.stats.log | awk '{
+	for(i = 1 ; i <= NF ; ++i) {
+		split($i, kv, "=")
+		if(kv[1] == "workers.scaleup" && kv[2] > scaleup) scaleup = kv[2]
+		if(kv[1] == "workers.target" && kv[2] > target) target = kv[2]
+	}
+} END { exit (scaleup >= 1 && target >= 2 && target <= 4) ? 0 : 1 }'
+if [ $? -ne 0 ]; then
+	echo "queue did not scale up within its bounds, stats are:"
+	cat rsyslog.out.stats.log
+	exit 1
+fi
+source $srcdir/diag.sh exit
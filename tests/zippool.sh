@@ -0,0 +1,23 @@
+# Test for global(zip.threads), which compresses the buffers of zipped
+# output files on a pool of threads. The output must still decompress to
+# all messages in order, both as a single gzip member and, with
+# veryRobustZip="on", as one member per buffer.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[zippool.sh\]: test for the compression thread pool
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup zippool.conf
+# send 4000 messages of 10.000bytes plus header max, randomized
+source $srcdir/diag.sh tcpflood -m4000 -r -d10000 -P129
+sleep 1 # due to large messages, we need this time for the tcp receiver to settle...
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown       # and wait for it to terminate
+source $srcdir/diag.sh gzip-seq-check 0 3999 -E
+gunzip < rsyslog.out.log > rsyslog.out.plain.log
+gunzip < rsyslog.out.robust.log > rsyslog.out.robust.plain.log
+cmp rsyslog.out.plain.log rsyslog.out.robust.plain.log
+if [ $? -ne 0 ]; then
+	echo "veryRobustZip output differs from regular zipped output"
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,17 @@
+# Test for omzmq3 multipart and suspendOnHWM, received by imzmq3 in the
+# same instance. The first action sends each batch as one multipart message,
+# which imzmq3 splits into one message per frame. The second action has a
+# tiny send HWM, so it is regularly suspended until the receiver catches up.
+# In both cases, every message must be received exactly once.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[zmq3-batch.sh\]: test for omzmq3 batches
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup zmq3-batch.conf
+source $srcdir/diag.sh tcpflood -m10000
+sleep 3 # the suspended action needs some time to catch up
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh seq-check2 0 9999
+source $srcdir/diag.sh exit
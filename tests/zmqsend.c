@@ -0,0 +1,118 @@
+/* sends test messages to a zmq socket, optionally as multipart messages.
+ *
+ * Command line options:
+ * -d zmq endpoint to connect to, e.g. tcp://127.0.0.1:13520 (required)
+ * -m number of messages to send (default 1000)
+ * -i initial message number (default 0)
+ * -f number of frames per message (default 1). The last frame is the
+ *    message in the format generated by tcpflood, the ones before are
+ *    "frame1", "frame2", ...
+ *
+ * A PUSH socket is used, so the receiver must use a PULL socket.
+ *
+ * Part of the testbench for rsyslog.
+ *
+ * Copyright 2014 Rainer Gerhards and Adiscon GmbH.
+ *
+ * This file is part of rsyslog.
+ *
+ * Rsyslog is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Rsyslog is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Rsyslog.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * A copy of the GPL can be found in the file "COPYING" in this distribution.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <czmq.h>
+
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: zmqsend -d endpoint [-m nbr] [-i nbr] [-f nbr]\n"
+			"-d MUST be specified\n");
+	exit(1);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	int opt;
+	char *endpoint = NULL;
+	int numMsgs = 1000;
+	int msgNum = 0;
+	int numFrames = 1;
+	zctx_t *ctx;
+	void *sock;
+	char buf[256];
+	int len;
+	int i, j;
+
+	while((opt = getopt(argc, argv, "d:m:i:f:")) != EOF) {
+		switch((char)opt) {
+		case 'd':
+			endpoint = optarg;
+			break;
+		case 'm':
+			numMsgs = atoi(optarg);
+			break;
+		case 'i':
+			msgNum = atoi(optarg);
+			break;
+		case 'f':
+			numFrames = atoi(optarg);
+			break;
+		default:usage();
+		}
+	}
+	if(endpoint == NULL || numFrames < 1)
+		usage();
+
+	if((ctx = zctx_new()) == NULL) {
+		fprintf(stderr, "zctx_new failed\n");
+		exit(1);
+	}
+	zctx_set_linger(ctx, 10000); /* deliver everything before we terminate */
+	if((sock = zsocket_new(ctx, ZMQ_PUSH)) == NULL) {
+		fprintf(stderr, "zsocket_new failed\n");
+		exit(1);
+	}
+	if(zsocket_connect(sock, "%s", endpoint) != 0) {
+		fprintf(stderr, "could not connect to %s: %s\n", endpoint, zmq_strerror(errno));
+		exit(1);
+	}
+
+	for(i = 0 ; i < numMsgs ; ++i) {
+		for(j = 1 ; j < numFrames ; ++j) {
+			len = snprintf(buf, sizeof(buf), "frame%d", j);
+			if(zmq_send(sock, buf, len, ZMQ_SNDMORE) == -1)
+				goto fail;
+		}
+		len = snprintf(buf, sizeof(buf), "<167>Mar  1 01:00:00 172.20.245.8 tag msgnum:%8.8d:",
+			       msgNum + i);
+		if(zmq_send(sock, buf, len, 0) == -1)
+			goto fail;
+	}
+
+	zctx_destroy(&ctx);
+	return 0;
+
+fail:
+	fprintf(stderr, "zmq_send failed: %s\n", zmq_strerror(errno));
+	exit(1);
+}
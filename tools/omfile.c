@@ -48,6 +48,8 @@
 #include <libgen.h>
 #include <unistd.h>
 #include <sys/file.h>
+#include <sys/uio.h>
+#include <signal.h>
 #ifdef OS_SOLARIS
 #	include <fcntl.h>
 #endif
@@ -71,6 +73,7 @@
 #include "statsobj.h"
 #include "sigprov.h"
 #include "cryprov.h"
+#include "compprov.h"
 
 MODULE_TYPE_OUTPUT
 MODULE_TYPE_NOKEEP
@@ -86,45 +89,69 @@ DEFobjCurrIf(errmsg)
 DEFobjCurrIf(strm)
 DEFobjCurrIf(statsobj)
 
-/* for our current LRU mechanism, we need a monotonically increasing counters. We use
- * it much like a "Lamport logical clock": we do not need the actual time, we just need
- * to know the sequence in which files were accessed. So we use a simple counter to
- * create that sequence. We use an unsigned 64 bit value which is extremely unlike to
- * wrap within the lifetime of a process. If we process 1,000,000 file writes per
- * second, the process could still exist over 500,000 years before a wrap to 0 happens.
- * That should be sufficient (and even than, there would no really bad effect ;)).
- * The variable below is the global counter/clock.
- */
-#if HAVE_ATOMIC_BUILTINS_64BIT
-static uint64 clockFileAccess = 0;
-#else
-static unsigned clockFileAccess = 0;
-#endif
-/* and the "tick" function */
-#ifndef HAVE_ATOMIC_BUILTINS
-static pthread_mutex_t mutClock;
-#endif
-static inline uint64
-getClockFileAccess(void)
-{
-#if HAVE_ATOMIC_BUILTINS_64BIT
-	return ATOMIC_INC_AND_FETCH_uint64(&clockFileAccess, &mutClock);
-#else
-	return ATOMIC_INC_AND_FETCH_unsigned(&clockFileAccess, &mutClock);
-#endif
-}
-
-
 /* The following structure is a dynafile name cache entry.
  */
 struct s_dynaFileCacheEntry {
 	uchar *pName;		/* name currently open, if dynamic name */
 	strm_t	*pStrm;		/* our output stream */
 	void	*sigprovFileData;	/* opaque data ptr for provider use */
-	uint64	clkTickAccessed;/* for LRU - based on clockFileAccess */
+	unsigned hash;		/* hash of pName */
+	int	iHashNext;	/* next entry in the same hash bucket (-1 = none) */
+	int	iLruPrev;	/* next more recently used entry (-1 = none) */
+	int	iLruNext;	/* next less recently used entry (-1 = none) */
+	sbool	bDirty;		/* on the dirty list, to be synced at commit */
+	/* open file list, see dynaFileOpenTouch(), guarded by mutOpenFiles */
+	struct _instanceData *pOwner;	/* the action the entry belongs to */
+	struct s_dynaFileCacheEntry *pOpenPrev;
+	struct s_dynaFileCacheEntry *pOpenNext;
+	time_t	tLastUse;
+	sbool	bOpen;		/* on the open file list */
 };
 typedef struct s_dynaFileCacheEntry dynaFileCacheEntry;
 
+/* All dynafile cache entries whose file is open, across all actions, most
+ * recently used first. Beyond module(dynafile.maxopen) open files, and for
+ * files not used for module(dynafile.closetimeout) seconds, the least
+ * recently used files are closed (but stay in their action's cache). The
+ * list is only maintained if one of these parameters is set.
+ */
+static pthread_mutex_t mutOpenFiles = PTHREAD_MUTEX_INITIALIZER;
+static dynaFileCacheEntry *pOpenHead = NULL;
+static dynaFileCacheEntry *pOpenTail = NULL;
+static int nOpenFiles = 0;
+static int iMaxOpenFiles = 0;	/* 0 - no limit */
+static int iCloseTimeout = 0;	/* 0 - never close idle files */
+#define DYNAFILE_MAX_CLOSE 16	/* max number of files closed at one time */
+
+/* Time-bucketed dynafiles, see dynafile.timebucket. The time part of the
+ * file name is formatted once per bucket, the dynafile template renders just
+ * the variable part. Instead of checking the time for each message, a timer
+ * thread bumps bucketGen at every full minute (the smallest bucket) and the
+ * actions check for a new bucket only when it changed. The thread is started
+ * with the first such transaction. If it could not be started, the actions
+ * check the time once per transaction.
+ */
+static pthread_mutex_t mutBucketTimer = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t condBucketTimer = PTHREAD_COND_INITIALIZER;
+static pthread_t bucketTimerThrd;
+static sbool bBucketTimerStarted = 0;	/* start was tried */
+static sbool bBucketTimerRunning = 0;
+static sbool bBucketTimerStop = 0;
+static unsigned bucketGen = 1;		/* 0 is never used, it means "check now" */
+#define BUCKET_DYNAFILE "{dynafile}"	/* placeholder in dynafile.bucketpath */
+
+/* a worker's batch in combined write mode, see combineWrite() */
+typedef struct omfileBatch_s omfileBatch_t;
+struct omfileBatch_s {
+	uchar	*pBuf;		/* the batch's messages, back to back */
+	size_t	lenBuf;
+	size_t	sizeBuf;
+	unsigned nMsgs;
+	sbool	bDone;		/* written (guarded by mutCombine) */
+	rsRetVal iRet;		/* result of the write */
+	omfileBatch_t *pNext;	/* list of pending batches */
+};
+
 
 #define IOBUF_DFLT_SIZE 4096	/* default size for io buffers */
 #define FLUSH_INTRVL_DFLT 1 	/* default buffer flush interval (in seconds) */
@@ -159,33 +186,74 @@ typedef struct _instanceData {
 	void	*cryprovData;	/* opaque data ptr for provider use */
 	cryprov_if_t cryprov;	/* ptr to crypto provider interface */
 	sbool	useCryprov;	/* quicker than checkig ptr (1 vs 8 bytes!) */
+	uchar 	*compprovName;	/* compression driver, NULL - zlib */
+	uchar 	*compprovNameFull;/* full internal compression provider name */
+	compprov_if_t compprov;	/* ptr to compression provider interface */
+	sbool	useCompprov;	/* quicker than checkig ptr (1 vs 8 bytes!) */
 	int	iCurrElt;	/* currently active cache element (-1 = none) */
 	int	iCurrCacheSize;	/* currently cache size (1-based) */
 	int	iDynaFileCacheSize; /* size of file handle cache */
 	/* The cache is implemented as an array. An empty element is indicated
 	 * by a NULL pointer. Memory is allocated as needed. The following
-	 * pointer points to the overall structure.
+	 * pointer points to the overall structure. Entries in use are found
+	 * via a hash table and kept on a LRU list, both linked by array index.
 	 */
 	dynaFileCacheEntry **dynCache;
+	int	*dynHash;	/* hash buckets: first entry (-1 = empty) */
+	unsigned dynHashMask;	/* number of buckets - 1 (a power of 2) */
+	int	iLruHead;	/* most recently used entry, always iCurrElt if set */
+	int	iLruTail;	/* least recently used entry, evicted first */
+	int	iFreeElt;	/* allocated entry not in use (open failed), -1 = none */
+	int	*dirtyElts;	/* entries written to in the current transaction (sync only) */
+	int	nDirty;		/* number of entries on the dirty list */
 	off_t	iSizeLimit;		/* file size limit, 0 = no limit */
 	uchar	*pszSizeLimitCmd;	/* command to carry out when size limit is reached */
+	int	iSizeLimitRotate;	/* strmRotateMode_t, -1: not set */
+	int	iSizeLimitKeep;		/* nbr of rotated files kept in numbered mode */
 	int 	iZipLevel;		/* zip mode to use for this selector */
 	int	iIOBufSize;		/* size of associated io buffer */
+	int64	iPreallocSize;		/* preallocate file space in chunks of this size, 0 = off */
+	sbool	bDirectIO;		/* write with O_DIRECT, bypassing the page cache */
 	int	iFlushInterval;		/* how fast flush buffer on inactivity? */
 	sbool	bFlushOnTXEnd;		/* flush write buffers when transaction has ended? */
 	sbool	bUseAsyncWriter;	/* use async stream writer? */
 	sbool	bVeryRobustZip;
+	sbool	bCombineWrites;		/* workers write via combineWrite() */
+	sbool	bGroupWrites;		/* dynafile: write transaction grouped by file */
+	int	iTimeBucket;		/* dynafile.timebucket length in seconds, 0 = off */
+	uchar	*pszBucketPath;		/* strftime() pattern before the placeholder */
+	uchar	*pszBucketSuffixFmt;	/* strftime() pattern after the placeholder */
+	uchar	*pszBucketName;		/* prefix of the current bucket, then the file name */
+	size_t	sizeBucketName;
+	size_t	lenBucketPrefix;
+	uchar	*pszBucketSuffix;	/* suffix of the current bucket */
+	size_t	sizeBucketSuffix;
+	size_t	lenBucketSuffix;
+	time_t	tBucketStart;		/* start of the current bucket, 0 = none yet */
+	unsigned bucketGen;		/* timer generation the bucket was checked at */
+	pthread_mutex_t mutCombine;	/* guards the pending batches */
+	pthread_cond_t condCombine;	/* batches written or writer done */
+	omfileBatch_t *pCombRoot;	/* batches waiting to be written */
+	omfileBatch_t *pCombLast;
+	sbool	bCombining;		/* a worker is writing pending batches */
 	statsobj_t *stats;		/* dynafile, primarily cache stats */
 	STATSCOUNTER_DEF(ctrRequests, mutCtrRequests);
 	STATSCOUNTER_DEF(ctrLevel0, mutCtrLevel0);
+	STATSCOUNTER_DEF(ctrHit, mutCtrHit);
 	STATSCOUNTER_DEF(ctrEvict, mutCtrEvict);
 	STATSCOUNTER_DEF(ctrMiss, mutCtrMiss);
 	STATSCOUNTER_DEF(ctrMax, mutCtrMax);
+	STATSCOUNTER_DEF(ctrSyncs, mutCtrSyncs);
+	STATSCOUNTER_DEF(ctrSyncFiles, mutCtrSyncFiles);
+	STATSCOUNTER_DEF(ctrClosed, mutCtrClosed);
 } instanceData;
 
 
 typedef struct wrkrInstanceData {
 	instanceData *pData;
+	omfileBatch_t batch;	/* combined write mode */
+	int	*grpBuf;	/* scratch space for dynafile.groupwrites */
+	unsigned sizeGrpBuf;	/* number of messages grpBuf is sized for */
 } wrkrInstanceData_t;
 
 
@@ -215,6 +283,8 @@ struct modConfData_s {
 	uchar 	*tplName;	/* default template */
 	int fCreateMode; /* default mode to use when creating files */
 	int fDirCreateMode; /* default mode to use when creating files */
+	int iMaxOpenFiles; /* max number of open dynafiles of all actions, 0 - no limit */
+	int iCloseTimeout; /* close dynafiles idle for that many seconds, 0 - never */
 };
 
 static modConfData_t *loadModConf = NULL;/* modConf ptr to use for the current load process */
@@ -225,7 +295,9 @@ static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current ex
 static struct cnfparamdescr modpdescr[] = {
 	{ "template", eCmdHdlrGetWord, 0 },
 	{ "dircreatemode", eCmdHdlrFileCreateMode, 0 },
-	{ "filecreatemode", eCmdHdlrFileCreateMode, 0 }
+	{ "filecreatemode", eCmdHdlrFileCreateMode, 0 },
+	{ "dynafile.maxopen", eCmdHdlrNonNegInt, 0 },
+	{ "dynafile.closetimeout", eCmdHdlrNonNegInt, 0 }
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -235,13 +307,15 @@ static struct cnfparamblk modpblk =
 
 /* action (instance) parameters */
 static struct cnfparamdescr actpdescr[] = {
-	{ "dynafilecachesize", eCmdHdlrInt, 0 }, /* legacy: dynafilecachesize */
+	{ "dynafilecachesize", eCmdHdlrPositiveInt, 0 }, /* legacy: dynafilecachesize */
 	{ "ziplevel", eCmdHdlrInt, 0 }, /* legacy: omfileziplevel */
 	{ "flushinterval", eCmdHdlrInt, 0 }, /* legacy: omfileflushinterval */
 	{ "asyncwriting", eCmdHdlrBinary, 0 }, /* legacy: omfileasyncwriting */
 	{ "veryrobustzip", eCmdHdlrBinary, 0 },
 	{ "flushontxend", eCmdHdlrBinary, 0 }, /* legacy: omfileflushontxend */
 	{ "iobuffersize", eCmdHdlrSize, 0 }, /* legacy: omfileiobuffersize */
+	{ "preallocate.size", eCmdHdlrSize, 0 },
+	{ "directio", eCmdHdlrBinary, 0 },
 	{ "dirowner", eCmdHdlrUID, 0 }, /* legacy: dirowner */
 	{ "dirownernum", eCmdHdlrInt, 0 }, /* legacy: dirownernum */
 	{ "dirgroup", eCmdHdlrGID, 0 }, /* legacy: dirgroup */
@@ -255,10 +329,19 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "failonchownfailure", eCmdHdlrBinary, 0 }, /* legacy: failonchownfailure */
 	{ "createdirs", eCmdHdlrBinary, 0 }, /* legacy: createdirs */
 	{ "sync", eCmdHdlrBinary, 0 }, /* legacy: actionfileenablesync */
+	{ "combinewrites", eCmdHdlrBinary, 0 },
+	{ "dynafile.groupwrites", eCmdHdlrBinary, 0 },
+	{ "dynafile.timebucket", eCmdHdlrGetWord, 0 },
+	{ "dynafile.bucketpath", eCmdHdlrString, 0 },
+	{ "rotation.sizelimit", eCmdHdlrSize, 0 },
+	{ "rotation.sizelimitcommand", eCmdHdlrString, 0 },
+	{ "rotation.mode", eCmdHdlrGetWord, 0 },
+	{ "rotation.keep", eCmdHdlrPositiveInt, 0 },
 	{ "file", eCmdHdlrString, 0 },     /* either "file" or ... */
 	{ "dynafile", eCmdHdlrString, 0 }, /* "dynafile" MUST be present */
 	{ "sig.provider", eCmdHdlrGetWord, 0 },
 	{ "cry.provider", eCmdHdlrGetWord, 0 },
+	{ "compression.driver", eCmdHdlrGetWord, 0 },
 	{ "template", eCmdHdlrGetWord, 0 }
 };
 static struct cnfparamblk actpblk =
@@ -427,10 +510,8 @@ static rsRetVal cflineParseOutchannel(instanceData *pData, uchar* p, omodStringR
 	/* OK, we finally got a correct template. So let's use it... */
 	pData->fname = ustrdup(pOch->pszFileTemplate);
 	pData->iSizeLimit = pOch->uSizeLimit;
-	/* WARNING: It is dangerous "just" to pass the pointer. As we
-	 * never rebuild the output channel description, this is acceptable here.
-	 */
-	pData->pszSizeLimitCmd = pOch->cmdOnSizeLimit;
+	if(pOch->cmdOnSizeLimit != NULL)
+		CHKmalloc(pData->pszSizeLimitCmd = ustrdup(pOch->cmdOnSizeLimit));
 
 	iRet = cflineParseTemplateName(&p, pOMSR, iEntry, iTplOpts, getDfltTpl());
 
@@ -439,6 +520,23 @@ finalize_it:
 }
 
 
+/* remove an entry from the open file list, mutOpenFiles must be locked */
+static inline void
+dynaFileOpenUnlink(dynaFileCacheEntry *const pEntry)
+{
+	if(pEntry->pOpenPrev == NULL)
+		pOpenHead = pEntry->pOpenNext;
+	else
+		pEntry->pOpenPrev->pOpenNext = pEntry->pOpenNext;
+	if(pEntry->pOpenNext == NULL)
+		pOpenTail = pEntry->pOpenPrev;
+	else
+		pEntry->pOpenNext->pOpenPrev = pEntry->pOpenPrev;
+	pEntry->bOpen = 0;
+	--nOpenFiles;
+}
+
+
 /* This function deletes an entry from the dynamic file name
  * cache. A pointer to the cache must be passed in as well
  * as the index of the to-be-deleted entry. This index may
@@ -464,6 +562,12 @@ dynaFileDelCacheEntry(instanceData *__restrict__ const pData, const int iEntry,
 		pCache[iEntry]->pName = NULL;
 	}
 
+	if(pCache[iEntry]->bOpen) {
+		pthread_mutex_lock(&mutOpenFiles);
+		dynaFileOpenUnlink(pCache[iEntry]);
+		pthread_mutex_unlock(&mutOpenFiles);
+	}
+
 	if(pCache[iEntry]->pStrm != NULL) {
 		strm.Destruct(&pCache[iEntry]->pStrm);
 		if(pData->useSigprov) {
@@ -496,6 +600,14 @@ dynaFileFreeCacheEntries(instanceData *__restrict__ const pData)
 	for(i = 0 ; i < pData->iCurrCacheSize ; ++i) {
 		dynaFileDelCacheEntry(pData, i, 1);
 	}
+	pData->iCurrCacheSize = 0;
+	if(pData->dynHash != NULL) {
+		for(i = 0 ; i <= (int) pData->dynHashMask ; ++i)
+			pData->dynHash[i] = -1;
+	}
+	pData->iLruHead = pData->iLruTail = -1;
+	pData->iFreeElt = -1;
+	pData->nDirty = 0; /* closing the files synced them */
 	pData->iCurrElt = -1; /* invalidate current element */
 	ENDfunc;
 }
@@ -511,10 +623,170 @@ static void dynaFileFreeCache(instanceData *__restrict__ const pData)
 	dynaFileFreeCacheEntries(pData);
 	if(pData->dynCache != NULL)
 		d_free(pData->dynCache);
+	free(pData->dynHash);
+	free(pData->dirtyElts);
 	ENDfunc;
 }
 
 
+/* allocate the dynamic file name cache for nEntries files. The hash table
+ * has at least twice as many buckets, so chains stay very short.
+ */
+static rsRetVal
+dynaFileAllocCache(instanceData *__restrict__ const pData, const int nEntries)
+{
+	unsigned nBuckets;
+	unsigned i;
+	DEFiRet;
+
+	for(nBuckets = 8 ; nBuckets < 2 * (unsigned) nEntries ; nBuckets *= 2)
+		/* just size */;
+	CHKmalloc(pData->dynCache = (dynaFileCacheEntry**)
+			calloc(nEntries, sizeof(dynaFileCacheEntry*)));
+	CHKmalloc(pData->dynHash = malloc(nBuckets * sizeof(int)));
+	if(pData->bSyncFile) {
+		CHKmalloc(pData->dirtyElts = malloc(nEntries * sizeof(int)));
+	}
+	for(i = 0 ; i < nBuckets ; ++i)
+		pData->dynHash[i] = -1;
+	pData->dynHashMask = nBuckets - 1;
+	pData->iCurrCacheSize = 0;
+	pData->iLruHead = pData->iLruTail = -1;
+	pData->iFreeElt = -1;
+	pData->nDirty = 0;
+	pData->iCurrElt = -1;		  /* no current element */
+
+finalize_it:
+	RETiRet;
+}
+
+
+static inline unsigned
+dynaFileHash(const uchar *pszName)
+{
+	unsigned hash = 2166136261u; /* FNV-1a */
+	for( ; *pszName ; ++pszName)
+		hash = (hash ^ *pszName) * 16777619u;
+	return hash;
+}
+
+
+/* find the cache entry for a file name, returns its index or -1 */
+static inline int
+dynaFileHashFind(instanceData *__restrict__ const pData, const uchar *__restrict__ const pszName,
+	const unsigned hash)
+{
+	dynaFileCacheEntry **pCache = pData->dynCache;
+	int i;
+
+	for(i = pData->dynHash[hash & pData->dynHashMask] ; i != -1 ; i = pCache[i]->iHashNext) {
+		if(pCache[i]->hash == hash && !ustrcmp(pszName, pCache[i]->pName))
+			break;
+	}
+	return i;
+}
+
+
+static inline void
+dynaFileHashUnlink(instanceData *__restrict__ const pData, const int iEntry)
+{
+	dynaFileCacheEntry **pCache = pData->dynCache;
+	int *pi;
+
+	for(pi = &pData->dynHash[pCache[iEntry]->hash & pData->dynHashMask] ; *pi != iEntry ;
+	    pi = &pCache[*pi]->iHashNext)
+		/* just search */;
+	*pi = pCache[iEntry]->iHashNext;
+}
+
+
+static inline void
+dynaFileLruUnlink(instanceData *__restrict__ const pData, const int iEntry)
+{
+	dynaFileCacheEntry **pCache = pData->dynCache;
+	dynaFileCacheEntry *const pEntry = pCache[iEntry];
+
+	if(pEntry->iLruPrev == -1)
+		pData->iLruHead = pEntry->iLruNext;
+	else
+		pCache[pEntry->iLruPrev]->iLruNext = pEntry->iLruNext;
+	if(pEntry->iLruNext == -1)
+		pData->iLruTail = pEntry->iLruPrev;
+	else
+		pCache[pEntry->iLruNext]->iLruPrev = pEntry->iLruPrev;
+}
+
+
+static inline void
+dynaFileLruPushHead(instanceData *__restrict__ const pData, const int iEntry)
+{
+	dynaFileCacheEntry **pCache = pData->dynCache;
+
+	pCache[iEntry]->iLruPrev = -1;
+	pCache[iEntry]->iLruNext = pData->iLruHead;
+	if(pData->iLruHead == -1)
+		pData->iLruTail = iEntry;
+	else
+		pCache[pData->iLruHead]->iLruPrev = iEntry;
+	pData->iLruHead = iEntry;
+}
+
+
+/* mark a cache entry as used now, moving it to the head of the open file
+ * list. Then close the least recently used files, until we are within
+ * module(dynafile.maxopen) and no file is idle longer than
+ * module(dynafile.closetimeout). The caller holds pData->mutWrite. A file
+ * of another action can only be closed while that action is not busy; we
+ * never wait for it (which could deadlock) but skip its files. The streams
+ * are just closed, not destructed, so the owning action can continue to
+ * use them and they reopen the file on the next write.
+ */
+static void
+dynaFileOpenTouch(instanceData *__restrict__ const pData, dynaFileCacheEntry *__restrict__ const pEntry)
+{
+	dynaFileCacheEntry *pVictims[DYNAFILE_MAX_CLOSE];
+	dynaFileCacheEntry *pCurr;
+	dynaFileCacheEntry *pPrev;
+	const time_t tNow = time(NULL);
+	int nVictims = 0;
+	int i;
+
+	pthread_mutex_lock(&mutOpenFiles);
+	if(pEntry->bOpen)
+		dynaFileOpenUnlink(pEntry);
+	pEntry->pOpenPrev = NULL;
+	pEntry->pOpenNext = pOpenHead;
+	if(pOpenHead == NULL)
+		pOpenTail = pEntry;
+	else
+		pOpenHead->pOpenPrev = pEntry;
+	pOpenHead = pEntry;
+	pEntry->bOpen = 1;
+	pEntry->tLastUse = tNow;
+	++nOpenFiles;
+
+	for(pCurr = pOpenTail ; pCurr != pEntry && nVictims < DYNAFILE_MAX_CLOSE ; pCurr = pPrev) {
+		pPrev = pCurr->pOpenPrev;
+		if(   !(iMaxOpenFiles > 0 && nOpenFiles > iMaxOpenFiles)
+		   && !(iCloseTimeout > 0 && tNow - pCurr->tLastUse >= iCloseTimeout))
+			break; /* the rest is more recently used */
+		if(pCurr->pOwner != pData && pthread_mutex_trylock(&pCurr->pOwner->mutWrite) != 0)
+			continue; /* busy, try the next one */
+		dynaFileOpenUnlink(pCurr);
+		pVictims[nVictims++] = pCurr;
+	}
+	pthread_mutex_unlock(&mutOpenFiles);
+
+	for(i = 0 ; i < nVictims ; ++i) {
+		DBGPRINTF("omfile: closing dynafile '%s' (open file limit or idle)\n", pVictims[i]->pName);
+		strm.Close(pVictims[i]->pStrm);
+		STATSCOUNTER_INC(pVictims[i]->pOwner->ctrClosed, pVictims[i]->pOwner->mutCtrClosed);
+		if(pVictims[i]->pOwner != pData)
+			pthread_mutex_unlock(&pVictims[i]->pOwner->mutWrite);
+	}
+}
+
+
 /* close current file */
 static rsRetVal
 closeFile(instanceData *__restrict__ const pData)
@@ -608,13 +880,28 @@ prepareFile(instanceData *__restrict__ const pData, const uchar *__restrict__ co
 	CHKiRet(strm.SetsIOBufSize(pData->pStrm, (size_t) pData->iIOBufSize));
 	CHKiRet(strm.SettOperationsMode(pData->pStrm, STREAMMODE_WRITE_APPEND));
 	CHKiRet(strm.SettOpenMode(pData->pStrm, cs.fCreateMode));
-	CHKiRet(strm.SetbSync(pData->pStrm, pData->bSyncFile));
+	/* dynafiles are synced as a group at the end of each transaction, see
+	 * dynaFileSyncDirty(). A single file is synced whenever it is written.
+	 */
+	if(pData->bDynamicName) {
+		CHKiRet(strm.SetbDeferSync(pData->pStrm, pData->bSyncFile));
+	} else {
+		CHKiRet(strm.SetbSync(pData->pStrm, pData->bSyncFile));
+	}
 	CHKiRet(strm.SetsType(pData->pStrm, STREAMTYPE_FILE_SINGLE));
 	CHKiRet(strm.SetiSizeLimit(pData->pStrm, pData->iSizeLimit));
+	CHKiRet(strm.SetiSizeLimitRotate(pData->pStrm,
+		(pData->iSizeLimitRotate == -1) ? STRM_ROTATE_COMMAND : pData->iSizeLimitRotate));
+	CHKiRet(strm.SetiSizeLimitKeep(pData->pStrm, pData->iSizeLimitKeep));
+	CHKiRet(strm.SetiPreallocSize(pData->pStrm, pData->iPreallocSize));
+	CHKiRet(strm.SetbDirectIO(pData->pStrm, pData->bDirectIO));
 	if(pData->useCryprov) {
 		CHKiRet(strm.Setcryprov(pData->pStrm, &pData->cryprov));
 		CHKiRet(strm.SetcryprovData(pData->pStrm, pData->cryprovData));
 	}
+	if(pData->useCompprov) {
+		CHKiRet(strm.Setcompprov(pData->pStrm, &pData->compprov));
+	}
 	/* set the flush interval only if we actually use it - otherwise it will activate
 	 * async processing, which is a real performance waste if we do not do buffered
 	 * writes! -- rgerhards, 2009-07-06
@@ -649,10 +936,9 @@ finalize_it:
 static inline rsRetVal
 prepareDynFile(instanceData *__restrict__ const pData, const uchar *__restrict__ const newFileName)
 {
-	uint64 ctOldest; /* "timestamp" of oldest element */
-	int iOldest;
+	unsigned hash;
 	int i;
-	int iFirstFree;
+	int iFree;
 	rsRetVal localRet;
 	dynaFileCacheEntry **pCache;
 	DEFiRet;
@@ -662,43 +948,32 @@ prepareDynFile(instanceData *__restrict__ const pData, const uchar *__restrict__
 
 	pCache = pData->dynCache;
 
-	/* first check, if we still have the current file */
+	/* first check, if we still have the current file (it is already
+	 * the most recently used one, so the LRU list needs no update).
+	 */
 	if(   (pData->iCurrElt != -1)
 	   && !ustrcmp(newFileName, pCache[pData->iCurrElt]->pName)) {
 	   	/* great, we are all set */
-		pCache[pData->iCurrElt]->clkTickAccessed = getClockFileAccess();
 		STATSCOUNTER_INC(pData->ctrLevel0, pData->mutCtrLevel0);
-		/* LRU needs only a strictly monotonically increasing counter, so such a one could do */
 		FINALIZE;
 	}
 
-	/* ok, no luck. Now let's search the table if we find a matching spot.
-	 * While doing so, we also prepare for creation of a new one.
-	 */
+	/* ok, no luck. Now let's look up the file in the cache. */
 	pData->iCurrElt = -1;	/* invalid current element pointer */
-	iFirstFree = -1; /* not yet found */
-	iOldest = 0; /* we assume the first element to be the oldest - that will change as we loop */
-	ctOldest = getClockFileAccess(); /* there must always be an older one */
-	for(i = 0 ; i < pData->iCurrCacheSize ; ++i) {
-		if(pCache[i] == NULL || pCache[i]->pName == NULL) {
-			if(iFirstFree == -1)
-				iFirstFree = i;
-		} else { /* got an element, let's see if it matches */
-			if(!ustrcmp(newFileName, pCache[i]->pName)) {
-				/* we found our element! */
-				pData->pStrm = pCache[i]->pStrm;
-				if(pData->useSigprov)
-					pData->sigprovFileData = pCache[i]->sigprovFileData;
-				pData->iCurrElt = i;
-				pCache[i]->clkTickAccessed = getClockFileAccess(); /* update "timestamp" for LRU */
-				FINALIZE;
-			}
-			/* did not find it - so lets keep track of the counters for LRU */
-			if(pCache[i]->clkTickAccessed < ctOldest) {
-				ctOldest = pCache[i]->clkTickAccessed;
-				iOldest = i;
-				}
-		}
+	hash = dynaFileHash(newFileName);
+	i = dynaFileHashFind(pData, newFileName, hash);
+	if(i != -1) {
+		/* we found our element! */
+		pData->pStrm = pCache[i]->pStrm;
+		if(pData->useSigprov)
+			pData->sigprovFileData = pCache[i]->sigprovFileData;
+		dynaFileLruUnlink(pData, i);
+		dynaFileLruPushHead(pData, i);
+		if(iMaxOpenFiles > 0 || iCloseTimeout > 0)
+			dynaFileOpenTouch(pData, pCache[i]);
+		pData->iCurrElt = i;
+		STATSCOUNTER_INC(pData->ctrHit, pData->mutCtrHit);
+		FINALIZE;
 	}
 
 	/* we have not found an entry */
@@ -717,24 +992,27 @@ prepareDynFile(instanceData *__restrict__ const pData, const uchar *__restrict__
 	 */
 	pData->pStrm = NULL, pData->sigprovFileData = NULL;
 
-	if(iFirstFree == -1 && (pData->iCurrCacheSize < pData->iDynaFileCacheSize)) {
-		/* there is space left, so set it to that index */
-		iFirstFree = pData->iCurrCacheSize++;
-		STATSCOUNTER_SETMAX_NOMUT(pData->ctrMax, (unsigned) pData->iCurrCacheSize);
-	}
-
 	/* Note that the following code sequence does not work with the cache entry itself,
 	 * but rather with pData->pStrm, the (sole) stream pointer in the non-dynafile case.
 	 * The cache array is only updated after the open was successful. -- rgerhards, 2010-03-21
+	 * An entry whose open failed is kept as iFreeElt and reused first.
 	 */
-	if(iFirstFree == -1) {
-		dynaFileDelCacheEntry(pData, iOldest, 0);
-		STATSCOUNTER_INC(pData->ctrEvict, pData->mutCtrEvict);
-		iFirstFree = iOldest; /* this one *is* now free ;) */
+	if(pData->iFreeElt != -1) {
+		iFree = pData->iFreeElt;
+	} else if(pData->iCurrCacheSize < pData->iDynaFileCacheSize) {
+		/* there is space left, so we need to allocate memory for the cache structure */
+		iFree = pData->iCurrCacheSize;
+		CHKmalloc(pCache[iFree] = (dynaFileCacheEntry*) calloc(1, sizeof(dynaFileCacheEntry)));
+		++pData->iCurrCacheSize;
+		STATSCOUNTER_SETMAX_NOMUT(pData->ctrMax, (unsigned) pData->iCurrCacheSize);
 	} else {
-		/* we need to allocate memory for the cache structure */
-		CHKmalloc(pCache[iFirstFree] = (dynaFileCacheEntry*) calloc(1, sizeof(dynaFileCacheEntry)));
+		iFree = pData->iLruTail;
+		dynaFileHashUnlink(pData, iFree);
+		dynaFileLruUnlink(pData, iFree);
+		dynaFileDelCacheEntry(pData, iFree, 0);
+		STATSCOUNTER_INC(pData->ctrEvict, pData->mutCtrEvict);
 	}
+	pData->iFreeElt = iFree; /* until the file is successfully opened */
 
 	/* Ok, we finally can open the file */
 	localRet = prepareFile(pData, newFileName); /* ignore exact error, we check fd below */
@@ -748,22 +1026,65 @@ prepareDynFile(instanceData *__restrict__ const pData, const uchar *__restrict__
 		ABORT_FINALIZE(localRet);
 	}
 
-	if((pCache[iFirstFree]->pName = ustrdup(newFileName)) == NULL) {
+	if((pCache[iFree]->pName = ustrdup(newFileName)) == NULL) {
 		closeFile(pData); /* need to free failed entry! */
 		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 	}
-	pCache[iFirstFree]->pStrm = pData->pStrm;
+	pCache[iFree]->pStrm = pData->pStrm;
 	if(pData->useSigprov)
-		pCache[iFirstFree]->sigprovFileData = pData->sigprovFileData;
-	pCache[iFirstFree]->clkTickAccessed = getClockFileAccess();
-	pData->iCurrElt = iFirstFree;
-	DBGPRINTF("Added new entry %d for file cache, file '%s'.\n", iFirstFree, newFileName);
+		pCache[iFree]->sigprovFileData = pData->sigprovFileData;
+	pCache[iFree]->hash = hash;
+	pCache[iFree]->iHashNext = pData->dynHash[hash & pData->dynHashMask];
+	pData->dynHash[hash & pData->dynHashMask] = iFree;
+	dynaFileLruPushHead(pData, iFree);
+	pCache[iFree]->pOwner = pData;
+	if(iMaxOpenFiles > 0 || iCloseTimeout > 0)
+		dynaFileOpenTouch(pData, pCache[iFree]);
+	pData->iFreeElt = -1;
+	pData->iCurrElt = iFree;
+	DBGPRINTF("Added new entry %d for file cache, file '%s'.\n", iFree, newFileName);
 
 finalize_it:
 	RETiRet;
 }
 
 
+/* sync all dynafiles written to in the current transaction. Instead of
+ * syncing the files one after the other, we first flush all of them and
+ * start their writeback, and only then wait for each one to complete. So
+ * the I/O for all files is in flight at the same time and the transaction
+ * needs roughly the time of the slowest sync instead of the sum of all.
+ * An entry evicted during the transaction stays on the list (its file was
+ * synced when closed); if it was reused, we sync the new file.
+ */
+static rsRetVal
+dynaFileSyncDirty(instanceData *__restrict__ const pData)
+{
+	dynaFileCacheEntry **pCache = pData->dynCache;
+	rsRetVal localRet;
+	int i;
+	DEFiRet;
+
+	for(i = 0 ; i < pData->nDirty ; ++i) {
+		if(pCache[pData->dirtyElts[i]]->pStrm != NULL)
+			strm.SyncStart(pCache[pData->dirtyElts[i]]->pStrm);
+	}
+	for(i = 0 ; i < pData->nDirty ; ++i) {
+		if(pCache[pData->dirtyElts[i]]->pStrm != NULL) {
+			localRet = strm.Sync(pCache[pData->dirtyElts[i]]->pStrm);
+			if(localRet != RS_RET_OK)
+				iRet = localRet;
+			STATSCOUNTER_INC(pData->ctrSyncFiles, pData->mutCtrSyncFiles);
+		}
+		pCache[pData->dirtyElts[i]]->bDirty = 0;
+	}
+	pData->nDirty = 0;
+	STATSCOUNTER_INC(pData->ctrSyncs, pData->mutCtrSyncs);
+
+	RETiRet;
+}
+
+
 /* do the actual write process. This function is to be called once we are ready for writing.
  * It will do buffered writes and persist data only when the buffer is full. Note that we must
  * be careful to detect when the file handle changed.
@@ -790,12 +1111,177 @@ finalize_it:
 }
 
 
+/* the bucket timer, see bucketGen */
+static void *
+bucketTimer(void __attribute__((unused)) *arg)
+{
+	struct timespec t;
+	sigset_t sigSet;
+
+	sigfillset(&sigSet);
+	pthread_sigmask(SIG_BLOCK, &sigSet, NULL);
+	dbgSetThrdName((uchar*) "omfile bucket timer");
+
+	pthread_mutex_lock(&mutBucketTimer);
+	while(!bBucketTimerStop) {
+		t.tv_sec = (time(NULL) / 60 + 1) * 60;
+		t.tv_nsec = 0;
+		if(pthread_cond_timedwait(&condBucketTimer, &mutBucketTimer, &t) == ETIMEDOUT) {
+			if(++bucketGen == 0)
+				bucketGen = 1;
+		}
+	}
+	pthread_mutex_unlock(&mutBucketTimer);
+	return NULL;
+}
+
+
+/* get the current timer generation, starting the timer if this is the first
+ * call. Returns 0 if there is no timer, in which case the caller must check
+ * the time itself.
+ */
+static unsigned
+bucketTimerGen(void)
+{
+	unsigned gen;
+	int r;
+
+	pthread_mutex_lock(&mutBucketTimer);
+	if(!bBucketTimerStarted) {
+		bBucketTimerStarted = 1;
+		if((r = pthread_create(&bucketTimerThrd, NULL, bucketTimer, NULL)) == 0) {
+			bBucketTimerRunning = 1;
+		} else {
+			errmsg.LogError(r, RS_RET_ERR, "omfile: bucket timer thread could not be "
+					"started, checking time buckets per transaction");
+		}
+	}
+	gen = bBucketTimerRunning ? bucketGen : 0;
+	pthread_mutex_unlock(&mutBucketTimer);
+	return gen;
+}
+
+
+/* format one part of the bucket path into a malloc'ed buffer */
+static rsRetVal
+bucketFormat(const uchar *__restrict__ const pszFmt, const struct tm *__restrict__ const tm,
+	     uchar **__restrict__ const ppBuf, size_t *__restrict__ const pSize, size_t *__restrict__ const pLen)
+{
+	uchar szBuf[MAXFNAME];
+	size_t len;
+	uchar *pNew;
+	DEFiRet;
+
+	len = (*pszFmt == '\0') ? 0 : strftime((char*) szBuf, sizeof(szBuf), (char*) pszFmt, tm);
+	if(len == 0 && *pszFmt != '\0') {
+		errmsg.LogError(0, RS_RET_INVALID_PARAMS, "omfile: dynafile.bucketpath part '%s' "
+				"gives an empty or too long file name", pszFmt);
+		ABORT_FINALIZE(RS_RET_INVALID_PARAMS);
+	}
+	if(len + 1 > *pSize) {
+		CHKmalloc(pNew = realloc(*ppBuf, len + 1));
+		*ppBuf = pNew;
+		*pSize = len + 1;
+	}
+	memcpy(*ppBuf, szBuf, len);
+	(*ppBuf)[len] = '\0';
+	*pLen = len;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* switch to a new time bucket if the current one has ended. The files of the
+ * old bucket will not be written to again, so they are closed right away.
+ * Called at the start of a transaction, with mutWrite locked.
+ */
+static rsRetVal
+bucketCheck(instanceData *__restrict__ const pData)
+{
+	const unsigned gen = bucketTimerGen();
+	time_t tNow;
+	time_t tStart;
+	struct tm tm;
+	DEFiRet;
+
+	if(gen != 0 && gen == pData->bucketGen)
+		FINALIZE;
+	pData->bucketGen = gen;
+
+	tNow = time(NULL);
+	localtime_r(&tNow, &tm);
+	tm.tm_sec = 0;
+	if(pData->iTimeBucket >= 3600)
+		tm.tm_min = 0;
+	if(pData->iTimeBucket >= 86400)
+		tm.tm_hour = 0;
+	tm.tm_isdst = -1;
+	tStart = mktime(&tm);
+	if(tStart == pData->tBucketStart)
+		FINALIZE;
+
+	DBGPRINTF("omfile: new time bucket for dynafile %s\n", pData->fname);
+	if(pData->tBucketStart != 0)
+		dynaFileFreeCacheEntries(pData);
+	pData->tBucketStart = tStart;
+	CHKiRet(bucketFormat(pData->pszBucketPath, &tm, &pData->pszBucketName,
+			     &pData->sizeBucketName, &pData->lenBucketPrefix));
+	CHKiRet(bucketFormat(pData->pszBucketSuffixFmt, &tm, &pData->pszBucketSuffix,
+			     &pData->sizeBucketSuffix, &pData->lenBucketSuffix));
+
+finalize_it:
+	if(iRet != RS_RET_OK)
+		pData->tBucketStart = 0; /* try again with the next transaction */
+	RETiRet;
+}
+
+
+/* get the name of the dynafile to write to. In time bucket mode, the
+ * rendered template is just the variable part, which is put in between the
+ * prefix and suffix of the current bucket. The returned name is valid until
+ * the next call.
+ */
+static rsRetVal
+getDynFileName(instanceData *__restrict__ const pData, uchar *__restrict__ const pszRendered,
+	       uchar **__restrict__ const ppszName)
+{
+	size_t lenRendered;
+	size_t lenNeeded;
+	uchar *pNew;
+	DEFiRet;
+
+	if(pData->iTimeBucket == 0) {
+		*ppszName = pszRendered;
+		FINALIZE;
+	}
+	if(pData->tBucketStart == 0)
+		ABORT_FINALIZE(RS_RET_INVALID_PARAMS); /* bucket setup failed, already reported */
+
+	lenRendered = ustrlen(pszRendered);
+	lenNeeded = pData->lenBucketPrefix + lenRendered + pData->lenBucketSuffix + 1;
+	if(lenNeeded > pData->sizeBucketName) {
+		CHKmalloc(pNew = realloc(pData->pszBucketName, lenNeeded + 128));
+		pData->pszBucketName = pNew;
+		pData->sizeBucketName = lenNeeded + 128;
+	}
+	memcpy(pData->pszBucketName + pData->lenBucketPrefix, pszRendered, lenRendered);
+	memcpy(pData->pszBucketName + pData->lenBucketPrefix + lenRendered, pData->pszBucketSuffix,
+	       pData->lenBucketSuffix + 1);
+	*ppszName = pData->pszBucketName;
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* rgerhards 2004-11-11: write to a file output.  */
 static rsRetVal
 writeFile(instanceData *__restrict__ const pData,
 	  const actWrkrIParams_t *__restrict__ const pParam,
 	  const int iMsg)
 {
+	uchar *fn;
 	DEFiRet;
 
 	STATSCOUNTER_INC(pData->ctrRequests, pData->mutCtrRequests);
@@ -803,9 +1289,13 @@ writeFile(instanceData *__restrict__ const pData,
 	 * check if it still is ok or a new file needs to be created
 	 */
 	if(pData->bDynamicName) {
-		DBGPRINTF("omfile: file to log to: %s\n",
-			  actParam(pParam, pData->iNumTpls, iMsg, 1).param);
-		CHKiRet(prepareDynFile(pData, actParam(pParam, pData->iNumTpls, iMsg, 1).param));
+		CHKiRet(getDynFileName(pData, actParam(pParam, pData->iNumTpls, iMsg, 1).param, &fn));
+		DBGPRINTF("omfile: file to log to: %s\n", fn);
+		CHKiRet(prepareDynFile(pData, fn));
+		if(pData->bSyncFile && !pData->dynCache[pData->iCurrElt]->bDirty) {
+			pData->dynCache[pData->iCurrElt]->bDirty = 1;
+			pData->dirtyElts[pData->nDirty++] = pData->iCurrElt;
+		}
 	} else { /* "regular", non-dynafile */
 		if(pData->pStrm == NULL) {
 			CHKiRet(prepareFile(pData, pData->fname));
@@ -825,6 +1315,268 @@ finalize_it:
 }
 
 
+/* write all messages of a transaction to a static file. They are handed to
+ * the stream as a vector, so that large transactions are written directly
+ * from the template buffers without copying them to the stream's IO buffer
+ * (see strmWritev()). Dynafiles and signature providers need per-message
+ * processing and use writeFile().
+ */
+static rsRetVal
+writeFileVec(instanceData *__restrict__ const pData,
+	     const actWrkrIParams_t *__restrict__ const pParams,
+	     const unsigned nParams)
+{
+	struct iovec iov[STRM_WRITEV_MAX];
+	int nIov;
+	unsigned i;
+	DEFiRet;
+
+	if(pData->pStrm == NULL) {
+		CHKiRet(prepareFile(pData, pData->fname));
+		if(pData->pStrm == NULL) {
+			errmsg.LogError(0, RS_RET_NO_FILE_ACCESS,
+				"Could not open output file '%s'", pData->fname);
+			FINALIZE;
+		}
+	}
+
+	nIov = 0;
+	for(i = 0 ; i < nParams ; ++i) {
+		STATSCOUNTER_INC(pData->ctrRequests, pData->mutCtrRequests);
+		iov[nIov].iov_base = actParam(pParams, pData->iNumTpls, i, 0).param;
+		iov[nIov].iov_len = actParam(pParams, pData->iNumTpls, i, 0).lenStr;
+		if(++nIov == STRM_WRITEV_MAX) {
+			CHKiRet(strm.Writev(pData->pStrm, iov, nIov));
+			nIov = 0;
+		}
+	}
+	if(nIov > 0)
+		CHKiRet(strm.Writev(pData->pStrm, iov, nIov));
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* Combined write mode (combinewrites="on"), for static files written by
+ * several workers. Each worker copies its whole batch into its own buffer
+ * without any lock and queues it. Then one of the waiting workers becomes
+ * the writer: it takes all pending batches and writes them with a single
+ * writev() under mutWrite, while the others wait until their batch is
+ * written. New batches queue up meanwhile and are written together in the
+ * next round. So the file mutex is taken once for a group of batches, and
+ * the copying is done in parallel. As each batch is written as a whole,
+ * lines are never interleaved.
+ */
+static rsRetVal
+combineFillBatch(instanceData *__restrict__ const pData, omfileBatch_t *__restrict__ const pBatch,
+	const actWrkrIParams_t *__restrict__ const pParams, const unsigned nParams)
+{
+	size_t lenTotal;
+	uchar *pNew;
+	unsigned i;
+	DEFiRet;
+
+	lenTotal = 0;
+	for(i = 0 ; i < nParams ; ++i)
+		lenTotal += actParam(pParams, pData->iNumTpls, i, 0).lenStr;
+	if(lenTotal > pBatch->sizeBuf) {
+		CHKmalloc(pNew = realloc(pBatch->pBuf, lenTotal));
+		pBatch->pBuf = pNew;
+		pBatch->sizeBuf = lenTotal;
+	}
+	pBatch->lenBuf = 0;
+	for(i = 0 ; i < nParams ; ++i) {
+		memcpy(pBatch->pBuf + pBatch->lenBuf, actParam(pParams, pData->iNumTpls, i, 0).param,
+		       actParam(pParams, pData->iNumTpls, i, 0).lenStr);
+		pBatch->lenBuf += actParam(pParams, pData->iNumTpls, i, 0).lenStr;
+	}
+	pBatch->nMsgs = nParams;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* write a list of batches, called with mutWrite locked */
+static rsRetVal
+combineWriteList(instanceData *__restrict__ const pData, omfileBatch_t *pList)
+{
+	struct iovec iov[STRM_WRITEV_MAX];
+	int nIov;
+	DEFiRet;
+
+	if(pData->pStrm == NULL) {
+		CHKiRet(prepareFile(pData, pData->fname));
+		if(pData->pStrm == NULL) {
+			errmsg.LogError(0, RS_RET_NO_FILE_ACCESS,
+				"Could not open output file '%s'", pData->fname);
+			FINALIZE;
+		}
+	}
+
+	nIov = 0;
+	for( ; pList != NULL ; pList = pList->pNext) {
+		STATSCOUNTER_ADD(pData->ctrRequests, pData->mutCtrRequests, pList->nMsgs);
+		iov[nIov].iov_base = pList->pBuf;
+		iov[nIov].iov_len = pList->lenBuf;
+		if(++nIov == STRM_WRITEV_MAX) {
+			CHKiRet(strm.Writev(pData->pStrm, iov, nIov));
+			nIov = 0;
+		}
+	}
+	if(nIov > 0)
+		CHKiRet(strm.Writev(pData->pStrm, iov, nIov));
+	if(pData->bFlushOnTXEnd && !pData->bUseAsyncWriter)
+		CHKiRet(strm.Flush(pData->pStrm));
+
+finalize_it:
+	RETiRet;
+}
+
+
+static rsRetVal
+combineWrite(instanceData *__restrict__ const pData, omfileBatch_t *__restrict__ const pBatch)
+{
+	omfileBatch_t *pList;
+	omfileBatch_t *pNext;
+	rsRetVal localRet;
+	DEFiRet;
+
+	pthread_mutex_lock(&pData->mutCombine);
+	pBatch->bDone = 0;
+	pBatch->pNext = NULL;
+	if(pData->pCombLast == NULL)
+		pData->pCombRoot = pBatch;
+	else
+		pData->pCombLast->pNext = pBatch;
+	pData->pCombLast = pBatch;
+
+	while(!pBatch->bDone && pData->bCombining)
+		pthread_cond_wait(&pData->condCombine, &pData->mutCombine);
+
+	if(!pBatch->bDone) {
+		/* we are the writer for everything pending, including our batch */
+		pData->bCombining = 1;
+		pList = pData->pCombRoot;
+		pData->pCombRoot = pData->pCombLast = NULL;
+		pthread_mutex_unlock(&pData->mutCombine);
+
+		pthread_mutex_lock(&pData->mutWrite);
+		localRet = combineWriteList(pData, pList);
+		pthread_mutex_unlock(&pData->mutWrite);
+
+		pthread_mutex_lock(&pData->mutCombine);
+		for( ; pList != NULL ; pList = pNext) {
+			pNext = pList->pNext; /* the batch is reused once done is set */
+			pList->iRet = localRet;
+			pList->bDone = 1;
+		}
+		pData->bCombining = 0;
+		pthread_cond_broadcast(&pData->condCombine);
+	}
+	iRet = pBatch->iRet;
+	pthread_mutex_unlock(&pData->mutCombine);
+
+	RETiRet;
+}
+
+
+/* Grouped dynafile write mode (dynafile.groupwrites="on"). All file names
+ * of the transaction are already rendered, so instead of switching files
+ * whenever consecutive messages go to different files, the messages are
+ * first grouped by file name (in order of their first appearance). Then
+ * each file is looked up once and all its messages are written with one
+ * vectored write. Messages of the same file keep their order.
+ * The scratch space holds, per message, the next message of its group and
+ * the last message of the group it heads, followed by the list of group
+ * heads and a hash table (file name -> group head) of at least twice the
+ * number of messages.
+ */
+static rsRetVal
+writeDynFileGrouped(instanceData *__restrict__ const pData, wrkrInstanceData_t *__restrict__ const pWrkrData,
+	const actWrkrIParams_t *__restrict__ const pParams, const unsigned nParams)
+{
+	struct iovec iov[STRM_WRITEV_MAX];
+	int nIov;
+	int *next, *last, *heads, *tab;
+	int *pNew;
+	unsigned sizeTab;
+	unsigned sizeNeeded;
+	unsigned nGroups;
+	unsigned i, j;
+	int m;
+	uchar *fn;
+	DEFiRet;
+
+	for(sizeTab = 16 ; sizeTab < 2 * nParams ; sizeTab <<= 1)
+		/* just calc size */;
+	sizeNeeded = 3 * nParams + sizeTab;
+	if(sizeNeeded > pWrkrData->sizeGrpBuf) {
+		CHKmalloc(pNew = realloc(pWrkrData->grpBuf, sizeNeeded * sizeof(int)));
+		pWrkrData->grpBuf = pNew;
+		pWrkrData->sizeGrpBuf = sizeNeeded;
+	}
+	next = pWrkrData->grpBuf;
+	last = next + nParams;
+	heads = last + nParams;
+	tab = heads + nParams;
+	memset(tab, 0xff, sizeTab * sizeof(int)); /* all -1 */
+
+	nGroups = 0;
+	for(i = 0 ; i < nParams ; ++i) {
+		STATSCOUNTER_INC(pData->ctrRequests, pData->mutCtrRequests);
+		next[i] = -1;
+		fn = actParam(pParams, pData->iNumTpls, i, 1).param;
+		for(j = dynaFileHash(fn) & (sizeTab - 1) ; tab[j] != -1 ; j = (j + 1) & (sizeTab - 1)) {
+			if(!ustrcmp(fn, actParam(pParams, pData->iNumTpls, tab[j], 1).param))
+				break;
+		}
+		if(tab[j] == -1) { /* new group */
+			tab[j] = i;
+			last[i] = i;
+			heads[nGroups++] = i;
+		} else {
+			next[last[tab[j]]] = i;
+			last[tab[j]] = i;
+		}
+	}
+
+	/* all messages are in the same time bucket, so grouping by the rendered
+	 * template is the same as grouping by file name
+	 */
+	for(i = 0 ; i < nGroups ; ++i) {
+		if(getDynFileName(pData, actParam(pParams, pData->iNumTpls, heads[i], 1).param, &fn)
+		   != RS_RET_OK)
+			continue;
+		DBGPRINTF("omfile: file to log to: %s\n", fn);
+		if(prepareDynFile(pData, fn) != RS_RET_OK)
+			continue; /* error already reported, messages are discarded */
+		if(pData->bSyncFile && !pData->dynCache[pData->iCurrElt]->bDirty) {
+			pData->dynCache[pData->iCurrElt]->bDirty = 1;
+			pData->dirtyElts[pData->nDirty++] = pData->iCurrElt;
+		}
+		nIov = 0;
+		for(m = heads[i] ; m != -1 ; m = next[m]) {
+			iov[nIov].iov_base = actParam(pParams, pData->iNumTpls, m, 0).param;
+			iov[nIov].iov_len = actParam(pParams, pData->iNumTpls, m, 0).lenStr;
+			if(++nIov == STRM_WRITEV_MAX) {
+				CHKiRet(strm.Writev(pData->pStrm, iov, nIov));
+				nIov = 0;
+			}
+		}
+		if(nIov > 0)
+			CHKiRet(strm.Writev(pData->pStrm, iov, nIov));
+		/* the last file is flushed by our caller, like in the other modes */
+		if(pData->bFlushOnTXEnd && !pData->bUseAsyncWriter && i + 1 < nGroups)
+			CHKiRet(strm.Flush(pData->pStrm));
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
 BEGINbeginCnfLoad
 CODESTARTbeginCnfLoad
 	loadModConf = pModConf;
@@ -832,6 +1584,8 @@ CODESTARTbeginCnfLoad
 	pModConf->tplName = NULL;
 	pModConf->fCreateMode = 0644;
 	pModConf->fDirCreateMode = 0700;
+	pModConf->iMaxOpenFiles = 0;
+	pModConf->iCloseTimeout = 0;
 ENDbeginCnfLoad
 
 BEGINsetModCnf
@@ -864,6 +1618,10 @@ CODESTARTsetModCnf
 			loadModConf->fDirCreateMode = (int) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "filecreatemode")) {
 			loadModConf->fCreateMode = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "dynafile.maxopen")) {
+			loadModConf->iMaxOpenFiles = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "dynafile.closetimeout")) {
+			loadModConf->iCloseTimeout = (int) pvals[i].val.d.n;
 		} else {
 			dbgprintf("omfile: program error, non-handled "
 			  "param '%s' in beginCnfLoad\n", modpblk.descr[i].name);
@@ -889,6 +1647,8 @@ ENDcheckCnf
 BEGINactivateCnf
 CODESTARTactivateCnf
 	runModConf = pModConf;
+	iMaxOpenFiles = runModConf->iMaxOpenFiles;
+	iCloseTimeout = runModConf->iCloseTimeout;
 ENDactivateCnf
 
 BEGINfreeCnf
@@ -901,6 +1661,8 @@ BEGINcreateInstance
 CODESTARTcreateInstance
 	pData->pStrm = NULL;
 	pthread_mutex_init(&pData->mutWrite, NULL);
+	pthread_mutex_init(&pData->mutCombine, NULL);
+	pthread_cond_init(&pData->condCombine, NULL);
 ENDcreateInstance
 
 
@@ -913,8 +1675,16 @@ BEGINfreeInstance
 CODESTARTfreeInstance
 	free(pData->tplName);
 	free(pData->fname);
+	free(pData->pszSizeLimitCmd);
+	free(pData->pszBucketPath);
+	free(pData->pszBucketSuffixFmt);
+	free(pData->pszBucketName);
+	free(pData->pszBucketSuffix);
 	if(pData->bDynamicName) {
+		/* other actions may close our files until they are off the open file list */
+		pthread_mutex_lock(&pData->mutWrite);
 		dynaFileFreeCache(pData);
+		pthread_mutex_unlock(&pData->mutWrite);
 	} else if(pData->pStrm != NULL)
 		closeFile(pData);
 	if(pData->useSigprov) {
@@ -931,12 +1701,22 @@ CODESTARTfreeInstance
 		free(pData->cryprovName);
 		free(pData->cryprovNameFull);
 	}
+	if(pData->useCompprov) {
+		obj.ReleaseObj(__FILE__, pData->compprovNameFull+2, pData->compprovNameFull,
+			       (void*) &pData->compprov);
+		free(pData->compprovNameFull);
+	}
+	free(pData->compprovName);
 	pthread_mutex_destroy(&pData->mutWrite);
+	pthread_mutex_destroy(&pData->mutCombine);
+	pthread_cond_destroy(&pData->condCombine);
 ENDfreeInstance
 
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
+	free(pWrkrData->batch.pBuf);
+	free(pWrkrData->grpBuf);
 ENDfreeWrkrInstance
 
 
@@ -952,13 +1732,32 @@ ENDbeginTransaction
 
 BEGINcommitTransaction
 	instanceData *__restrict__ const pData = pWrkrData->pData;
+	const int bCombine = pData->bCombineWrites && !pData->bDynamicName && !pData->useSigprov;
 	unsigned i;
 CODESTARTcommitTransaction
+	if(bCombine) {
+		CHKiRet(combineFillBatch(pData, &pWrkrData->batch, pParams, nParams));
+		CHKiRet(combineWrite(pData, &pWrkrData->batch));
+		FINALIZE;
+	}
 	pthread_mutex_lock(&pData->mutWrite);
 
-	for(i = 0 ; i < nParams ; ++i) {
-		writeFile(pData, pParams, i);
+	if(pData->iTimeBucket != 0)
+		CHKiRet(bucketCheck(pData));
+	if(pData->bDynamicName && pData->bGroupWrites && !pData->useSigprov) {
+		CHKiRet(writeDynFileGrouped(pData, pWrkrData, pParams, nParams));
+	} else if(pData->bDynamicName || pData->useSigprov) {
+		for(i = 0 ; i < nParams ; ++i) {
+			writeFile(pData, pParams, i);
+		}
+	} else {
+		writeFileVec(pData, pParams, nParams);
 	}
+	if(pData->nDirty > 0)
+		CHKiRet(dynaFileSyncDirty(pData));
+	/* the current file was used throughout, but only touched when switched to */
+	if(pData->iCurrElt != -1 && (iMaxOpenFiles > 0 || iCloseTimeout > 0))
+		dynaFileOpenTouch(pData, pData->dynCache[pData->iCurrElt]);
 	/* Note: pStrm may be NULL if there was an error opening the stream */
 	if(pData->bFlushOnTXEnd && pData->pStrm != NULL) {
 		/* if we have an async writer, it controls the flush via
@@ -969,7 +1768,8 @@ CODESTARTcommitTransaction
 			CHKiRet(strm.Flush(pData->pStrm));
 	}
 finalize_it:
-	pthread_mutex_unlock(&pData->mutWrite);
+	if(!bCombine)
+		pthread_mutex_unlock(&pData->mutWrite);
 ENDcommitTransaction
 
 
@@ -992,12 +1792,22 @@ setInstParamDefaults(instanceData *__restrict__ const pData)
 	pData->bVeryRobustZip = 0;
 	pData->bFlushOnTXEnd = FLUSHONTX_DFLT;
 	pData->iIOBufSize = IOBUF_DFLT_SIZE;
+	pData->iPreallocSize = 0;
+	pData->bDirectIO = 0;
+	pData->bCombineWrites = 0;
+	pData->bGroupWrites = 0;
+	pData->iTimeBucket = 0;
+	pData->pszBucketPath = NULL;
+	pData->iSizeLimitRotate = -1;
+	pData->iSizeLimitKeep = 5;
 	pData->iFlushInterval = FLUSH_INTRVL_DFLT;
 	pData->bUseAsyncWriter = USE_ASYNCWRITER_DFLT;
 	pData->sigprovName = NULL;
 	pData->cryprovName = NULL;
 	pData->useSigprov = 0;
 	pData->useCryprov = 0;
+	pData->compprovName = NULL;
+	pData->useCompprov = 0;
 }
 
 
@@ -1022,6 +1832,9 @@ setupInstStatsCtrs(instanceData *__restrict__ const pData)
 	STATSCOUNTER_INIT(pData->ctrLevel0, pData->mutCtrLevel0);
 	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("level0"),
 		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pData->ctrLevel0)));
+	STATSCOUNTER_INIT(pData->ctrHit, pData->mutCtrHit);
+	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("hits"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pData->ctrHit)));
 	STATSCOUNTER_INIT(pData->ctrMiss, pData->mutCtrMiss);
 	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("missed"),
 		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pData->ctrMiss)));
@@ -1031,6 +1844,15 @@ setupInstStatsCtrs(instanceData *__restrict__ const pData)
 	STATSCOUNTER_INIT(pData->ctrMax, pData->mutCtrMax);
 	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("maxused"),
 		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pData->ctrMax)));
+	STATSCOUNTER_INIT(pData->ctrSyncs, pData->mutCtrSyncs);
+	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("syncs"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pData->ctrSyncs)));
+	STATSCOUNTER_INIT(pData->ctrSyncFiles, pData->mutCtrSyncFiles);
+	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("syncs.files"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pData->ctrSyncFiles)));
+	STATSCOUNTER_INIT(pData->ctrClosed, pData->mutCtrClosed);
+	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("closed"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pData->ctrClosed)));
 	CHKiRet(statsobj.ConstructFinalize(pData->stats));
 
 finalize_it:
@@ -1123,6 +1945,38 @@ finalize_it:
 	RETiRet;
 }
 
+/* load the compression provider. "zlib" is built into the stream class. */
+static inline rsRetVal
+initCompprov(instanceData *__restrict__ const pData)
+{
+	uchar szDrvrName[1024];
+	DEFiRet;
+
+	if(!strcmp((char*)pData->compprovName, "zlib"))
+		FINALIZE;
+	if(snprintf((char*)szDrvrName, sizeof(szDrvrName), "lmcomp_%s", pData->compprovName)
+		== sizeof(szDrvrName)) {
+		errmsg.LogError(0, RS_RET_ERR, "omfile: compression driver "
+				"name is too long: '%s'", pData->compprovName);
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+
+	pData->compprov.ifVersion = compprovCURR_IF_VERSION;
+	/* see initCryprov() for the +2 hack */
+	if(obj.UseObj(__FILE__, szDrvrName, szDrvrName, (void*) &pData->compprov)
+		!= RS_RET_OK) {
+		errmsg.LogError(0, RS_RET_LOAD_ERROR, "omfile: could not load "
+				"compression driver '%s'", szDrvrName);
+		ABORT_FINALIZE(RS_RET_COMPPROV_ERR);
+	}
+	pData->compprovNameFull = ustrdup(szDrvrName);
+
+	dbgprintf("loaded compression provider %s\n", szDrvrName);
+	pData->useCompprov = 1;
+finalize_it:
+	RETiRet;
+}
+
 BEGINnewActInst
 	struct cnfparamvals *pvals;
 	uchar *tplToUse;
@@ -1162,6 +2016,10 @@ CODESTARTnewActInst
 			pData->bFlushOnTXEnd = pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "iobuffersize")) {
 			pData->iIOBufSize = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "preallocate.size")) {
+			pData->iPreallocSize = pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "directio")) {
+			pData->bDirectIO = (sbool) pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "dirowner")) {
 			pData->dirUID = (int) pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "dirownernum")) {
@@ -1186,6 +2044,46 @@ CODESTARTnewActInst
 			pData->bFailOnChown = (int) pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "sync")) {
 			pData->bSyncFile = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "combinewrites")) {
+			pData->bCombineWrites = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "dynafile.groupwrites")) {
+			pData->bGroupWrites = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "dynafile.timebucket")) {
+			if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"minute", sizeof("minute")-1)) {
+				pData->iTimeBucket = 60;
+			} else if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"hour", sizeof("hour")-1)) {
+				pData->iTimeBucket = 3600;
+			} else if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"day", sizeof("day")-1)) {
+				pData->iTimeBucket = 86400;
+			} else {
+				uchar *cstr = (uchar*) es_str2cstr(pvals[i].val.d.estr, NULL);
+				errmsg.LogError(0, RS_RET_INVALID_PARAMS, "omfile: invalid dynafile.timebucket "
+						"'%s', must be minute, hour or day", cstr);
+				free(cstr);
+				ABORT_FINALIZE(RS_RET_INVALID_PARAMS);
+			}
+		} else if(!strcmp(actpblk.descr[i].name, "dynafile.bucketpath")) {
+			pData->pszBucketPath = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "rotation.sizelimit")) {
+			pData->iSizeLimit = (off_t) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "rotation.sizelimitcommand")) {
+			pData->pszSizeLimitCmd = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "rotation.keep")) {
+			pData->iSizeLimitKeep = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "rotation.mode")) {
+			if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"command", sizeof("command")-1)) {
+				pData->iSizeLimitRotate = STRM_ROTATE_COMMAND;
+			} else if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"numbered", sizeof("numbered")-1)) {
+				pData->iSizeLimitRotate = STRM_ROTATE_NUMBERED;
+			} else if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"timestamp", sizeof("timestamp")-1)) {
+				pData->iSizeLimitRotate = STRM_ROTATE_TIMESTAMP;
+			} else {
+				uchar *cstr = (uchar*) es_str2cstr(pvals[i].val.d.estr, NULL);
+				errmsg.LogError(0, RS_RET_INVALID_PARAMS, "omfile: invalid rotation.mode '%s', "
+						"must be command, numbered or timestamp", cstr);
+				free(cstr);
+				ABORT_FINALIZE(RS_RET_INVALID_PARAMS);
+			}
 		} else if(!strcmp(actpblk.descr[i].name, "createdirs")) {
 			pData->bCreateDirs = (int) pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "file")) {
@@ -1202,6 +2100,8 @@ CODESTARTnewActInst
 			pData->sigprovName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(actpblk.descr[i].name, "cry.provider")) {
 			pData->cryprovName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "compression.driver")) {
+			pData->compprovName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else {
 			dbgprintf("omfile: program error, non-handled "
 			  "param '%s'\n", actpblk.descr[i].name);
@@ -1214,6 +2114,22 @@ CODESTARTnewActInst
 		ABORT_FINALIZE(RS_RET_MISSING_CNFPARAMS);
 	}
 
+	if(pData->iTimeBucket != 0 || pData->pszBucketPath != NULL) {
+		uchar *p;
+		if(!pData->bDynamicName || pData->iTimeBucket == 0 || pData->pszBucketPath == NULL) {
+			errmsg.LogError(0, RS_RET_INVALID_PARAMS, "omfile: dynafile.timebucket and "
+					"dynafile.bucketpath must both be given, together with dynafile");
+			ABORT_FINALIZE(RS_RET_INVALID_PARAMS);
+		}
+		if((p = (uchar*) strstr((char*) pData->pszBucketPath, BUCKET_DYNAFILE)) == NULL) {
+			errmsg.LogError(0, RS_RET_INVALID_PARAMS, "omfile: dynafile.bucketpath '%s' "
+					"does not contain " BUCKET_DYNAFILE, pData->pszBucketPath);
+			ABORT_FINALIZE(RS_RET_INVALID_PARAMS);
+		}
+		CHKmalloc(pData->pszBucketSuffixFmt = ustrdup(p + sizeof(BUCKET_DYNAFILE) - 1));
+		*p = '\0';
+	}
+
 	if(pData->sigprovName != NULL) {
 		initSigprov(pData, lst);
 	}
@@ -1222,6 +2138,10 @@ CODESTARTnewActInst
 		CHKiRet(initCryprov(pData, lst));
 	}
 
+	if(pData->compprovName != NULL) {
+		CHKiRet(initCompprov(pData));
+	}
+
 	tplToUse = ustrdup((pData->tplName == NULL) ? getDfltTpl() : pData->tplName);
 	CHKiRet(OMSRsetEntry(*ppOMSR, 0, tplToUse, OMSR_NO_RQD_TPL_OPTS));
 	pData->iNumTpls = 1;
@@ -1234,11 +2154,13 @@ CODESTARTnewActInst
 		pData->iNumTpls = 2;
 		// TODO: create unified code for this (legacy+v6 system)
 		/* we now allocate the cache table */
-		CHKmalloc(pData->dynCache = (dynaFileCacheEntry**)
-				calloc(pData->iDynaFileCacheSize, sizeof(dynaFileCacheEntry*)));
-		pData->iCurrElt = -1;		  /* no current element */
+		CHKiRet(dynaFileAllocCache(pData, pData->iDynaFileCacheSize));
+	}
+	if(pData->iSizeLimitRotate == -1) {
+		/* without a command, the only sensible thing is to rotate ourselves */
+		pData->iSizeLimitRotate = (pData->pszSizeLimitCmd == NULL) ?
+			STRM_ROTATE_NUMBERED : STRM_ROTATE_COMMAND;
 	}
-// TODO: add	pData->iSizeLimit = 0; /* default value, use outchannels to configure! */
 	setupInstStatsCtrs(pData);
 
 CODE_STD_FINALIZERnewActInst
@@ -1300,8 +2222,7 @@ CODESTARTparseSelectorAct
 		 */
 		CHKiRet(OMSRsetEntry(*ppOMSR, 1, ustrdup(pData->fname), OMSR_NO_RQD_TPL_OPTS));
 		/* we now allocate the cache table */
-		CHKmalloc(pData->dynCache = (dynaFileCacheEntry**)
-				calloc(cs.iDynaFileCacheSize, sizeof(dynaFileCacheEntry*)));
+		CHKiRet(dynaFileAllocCache(pData, cs.iDynaFileCacheSize));
 		break;
 
 	case '/':
@@ -1379,10 +2300,17 @@ ENDdoHUP
 
 BEGINmodExit
 CODESTARTmodExit
+	if(bBucketTimerRunning) {
+		pthread_mutex_lock(&mutBucketTimer);
+		bBucketTimerStop = 1;
+		pthread_cond_signal(&condBucketTimer);
+		pthread_mutex_unlock(&mutBucketTimer);
+		pthread_join(bucketTimerThrd, NULL);
+		bBucketTimerRunning = 0;
+	}
 	objRelease(errmsg, CORE_COMPONENT);
 	objRelease(strm, CORE_COMPONENT);
 	objRelease(statsobj, CORE_COMPONENT);
-	DESTROY_ATOMIC_HELPER_MUT(mutClock);
 ENDmodExit
 
 
@@ -1406,7 +2334,6 @@ INITLegCnfVars
 	CHKiRet(objUse(strm, CORE_COMPONENT));
 	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 
-	INIT_ATOMIC_HELPER_MUT(mutClock);
 
 	INITChkCoreFeature(bCoreSupportsBatching, CORE_FEATURE_BATCHING);
 	DBGPRINTF("omfile: %susing transactional output interface.\n", bCoreSupportsBatching ? "" : "not ");
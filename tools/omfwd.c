@@ -41,6 +41,11 @@
 #include <zlib.h>
 #endif
 #include <pthread.h>
+#include <fcntl.h>
+#include <poll.h>
+#ifdef HAVE_EPOLL_CREATE
+#include <sys/epoll.h>
+#endif
 #include "syslogd.h"
 #include "conf.h"
 #include "syslogd-types.h"
@@ -77,13 +82,40 @@ DEFobjCurrIf(tcpclt)
 #define IS_FLUSH 1
 #define NO_FLUSH 0
 
+#ifdef HAVE_SENDMMSG
+#define UDP_BATCH_SIZE 64	/* max number of datagrams per sendmmsg() call */
+#define UDP_BATCH_BUFSIZE (128*1024) /* buffer for the datagrams of one batch */
+#endif
+#define TCP_SNDBUF_MIN (16*1024)	/* bounds for the TCP frame buffer */
+#define TCP_SNDBUF_MAX (256*1024)
+#define TCP_PIPE_DRAIN_TIMEOUT 1000 /* ms to wait for queued data to drain on close */
+
+/* a forwarding target. This is shared between all workers of an action, so
+ * that the health state of a target is known to all of them. The state
+ * fields are protected by the instance's mutTargets.
+ */
+typedef struct fwdTarget_s {
+	char *target;
+	char *port;		/* NULL - use the action's port */
+	int nActive;		/* number of transactions currently being sent to this target */
+	int nFails;		/* consecutive failures */
+	time_t ttResume;	/* target is not used before this time, 0 - target is healthy */
+} fwdTarget_t;
+
 typedef struct _instanceData {
 	uchar 	*tplName;	/* name of assigned template */
 	uchar *pszStrmDrvr;
 	uchar *pszStrmDrvrAuthMode;
 	permittedPeers_t *pPermPeers;
 	int iStrmDrvrMode;
-	char	*target;
+	fwdTarget_t *targets;
+	int nTargets;
+	int iNextTarget;	/* where to start the search for the next target */
+	int distribution;	/* how to distribute transactions over targets */
+#	define FWD_DISTR_ROUNDROBIN 0
+#	define FWD_DISTR_LEASTLOADED 1
+	int iPoolResumeInterval; /* seconds a failed target is not tried */
+	pthread_mutex_t mutTargets;
 	int compressionLevel;	/* 0 - no compression, else level for zlib */
 	char *port;
 	int protocol;
@@ -100,10 +132,14 @@ typedef struct _instanceData {
 	uint8_t compressionMode;
 	int errsToReport;	/* max number of errors to report (per instance) */
 	sbool strmCompFlushOnTxEnd; /* flush stream compression on transaction end? */
+	size_t pipelineSize;	/* bytes queued per TCP connection for non-blocking sends, 0 - blocking */
 } instanceData;
 
-typedef struct wrkrInstanceData {
+/* the per-worker connection to a target */
+typedef struct targetData_s {
 	instanceData *pData;
+	struct wrkrInstanceData *pWrkrData;
+	fwdTarget_t *pDesc;	/* the target we talk to */
 	netstrms_t *pNS; /* netstream subsystem */
 	netstrm_t *pNetstrm; /* our output netstream */
 	struct addrinfo *f_addr;
@@ -113,9 +149,40 @@ typedef struct wrkrInstanceData {
 	tcpclt_t *pTCPClt;	/* our tcpclt object */
 	sbool bzInitDone; /* did we do an init of zstrm already? */
 	z_stream zstrm;	/* zip stream to use for tcp compression */
-	uchar sndBuf[16*1024];	/* this is intensionally fixed -- see no good reason to make configurable */
+	uchar *sndBuf;		/* frame buffer, sized after the socket's send buffer on first connect */
+	unsigned lenSndBuf;	/* size of sndBuf */
 	unsigned offsSndBuf;	/* next free spot in send buffer */
+#	ifdef HAVE_SENDMMSG
+	/* UDP datagrams collected during a transaction, sent via sendmmsg() */
+	struct mmsghdr udpMsgs[UDP_BATCH_SIZE];
+	struct iovec udpIov[UDP_BATCH_SIZE];
+	uchar *udpBuf;
+	unsigned offsUdpBuf;	/* next free spot in udpBuf */
+	int nUdpMsgs;		/* number of datagrams in batch */
+#	endif
+#	ifdef HAVE_EPOLL_CREATE
+	/* outbound ring for pipelined (non-blocking) TCP sends. It is shared
+	 * with the worker's flusher thread and guarded by mutOut.
+	 */
+	pthread_mutex_t mutOut;
+	uchar *outRing;		/* NULL - blocking sends */
+	size_t offsOut;		/* start of queued data */
+	size_t lenOut;		/* number of bytes queued */
+	int sock;		/* socket of the current connection, -1 if none */
+	sbool bOutRegistered;	/* sock is registered with the flusher */
+	sbool bOutErr;		/* flusher hit an I/O error */
+#	endif
+} targetData_t;
+
+typedef struct wrkrInstanceData {
+	instanceData *pData;
+	targetData_t *target;	/* one connection per target, same order as pData->targets */
 	int errsToReport;	/* (remaining) number of errors to report */
+#	ifdef HAVE_EPOLL_CREATE
+	int efdOut;		/* epoll set of the flusher, -1 if not pipelining */
+	int pipeOut[2];		/* used to terminate the flusher */
+	pthread_t tidFlusher;
+#	endif
 } wrkrInstanceData_t;
 
 /* config data */
@@ -144,7 +211,7 @@ static struct cnfparamblk modpblk =
 
 /* action (instance) parameters */
 static struct cnfparamdescr actpdescr[] = {
-	{ "target", eCmdHdlrGetWord, 0 },
+	{ "target", eCmdHdlrArray, 0 },
 	{ "port", eCmdHdlrGetWord, 0 },
 	{ "protocol", eCmdHdlrGetWord, 0 },
 	{ "tcp_framing", eCmdHdlrGetWord, 0 },
@@ -159,6 +226,9 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "streamdriverpermittedpeers", eCmdHdlrGetWord, 0 },
 	{ "resendlastmsgonreconnect", eCmdHdlrBinary, 0 },
 	{ "template", eCmdHdlrGetWord, 0 },
+	{ "pool.distribution", eCmdHdlrGetWord, 0 },
+	{ "pool.resumeinterval", eCmdHdlrPositiveInt, 0 },
+	{ "tcp.pipeline.size", eCmdHdlrSize, 0 },
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -175,7 +245,7 @@ static modConfData_t *loadModConf = NULL;/* modConf ptr to use for the current l
 static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current exec process */
 
 
-static rsRetVal initTCP(wrkrInstanceData_t *pWrkrData);
+static rsRetVal initTCP(targetData_t *pTarget);
 
 
 BEGINinitConfVars		/* (re)set config variables to default values */
@@ -191,8 +261,13 @@ CODESTARTinitConfVars
 ENDinitConfVars
 
 
-static rsRetVal doTryResume(wrkrInstanceData_t *);
-static rsRetVal doZipFinish(wrkrInstanceData_t *);
+static rsRetVal doTryResume(targetData_t *);
+static rsRetVal doZipFinish(targetData_t *);
+#ifdef HAVE_EPOLL_CREATE
+static void TCPPipeClose(targetData_t *);
+static rsRetVal startFlusher(wrkrInstanceData_t *);
+static void stopFlusher(wrkrInstanceData_t *);
+#endif
 
 /* this function gets the default template. It coordinates action between
  * old-style and new-style configuration parts.
@@ -232,20 +307,88 @@ finalize_it:
 	RETiRet;
 }
 
+/* get the port to use for a target */
+static inline char *
+getPort(targetData_t *pTarget)
+{
+	return (pTarget->pDesc->port == NULL) ? pTarget->pData->port : pTarget->pDesc->port;
+}
+
+
+/* add a target to the action's pool. The strings are copied, port may be
+ * NULL, in which case the action's port is used.
+ */
+static rsRetVal
+addTarget(instanceData *const pData, const char *const target, const char *const port)
+{
+	fwdTarget_t *newTargets;
+	fwdTarget_t *t;
+	DEFiRet;
+
+	CHKmalloc(newTargets = realloc(pData->targets, (pData->nTargets + 1) * sizeof(fwdTarget_t)));
+	pData->targets = newTargets;
+	t = &pData->targets[pData->nTargets];
+	memset(t, 0, sizeof(fwdTarget_t));
+	CHKmalloc(t->target = strdup(target));
+	if(port != NULL && *port != '\0') {
+		if((t->port = strdup(port)) == NULL) {
+			free(t->target);
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
+	}
+	++pData->nTargets;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* parse a "host", "host:port" or "[ipv6-addr]:port" target specification
+ * and add it to the pool.
+ */
+static rsRetVal
+addTargetSpec(instanceData *const pData, char *const spec)
+{
+	char *host = spec;
+	char *port = NULL;
+	char *p;
+	DEFiRet;
+
+	if(*spec == '[') {
+		host = spec + 1;
+		if((p = strchr(host, ']')) == NULL)
+			ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+		*p++ = '\0';
+		if(*p == ':')
+			port = p + 1;
+	} else if((p = strchr(spec, ':')) != NULL && strchr(p + 1, ':') == NULL) {
+		/* exactly one colon - host:port; more colons mean a plain IPv6 address */
+		*p = '\0';
+		port = p + 1;
+	}
+	if(*host == '\0')
+		ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+	CHKiRet(addTarget(pData, host, port));
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* Close the UDP sockets.
  * rgerhards, 2009-05-29
  */
 static rsRetVal
-closeUDPSockets(wrkrInstanceData_t *pWrkrData)
+closeUDPSockets(targetData_t *pTarget)
 {
 	DEFiRet;
-	if(pWrkrData->pSockArray != NULL) {
-		net.closeUDPListenSockets(pWrkrData->pSockArray);
-		pWrkrData->pSockArray = NULL;
-		freeaddrinfo(pWrkrData->f_addr);
-		pWrkrData->f_addr = NULL;
+	if(pTarget->pSockArray != NULL) {
+		net.closeUDPListenSockets(pTarget->pSockArray);
+		pTarget->pSockArray = NULL;
+		freeaddrinfo(pTarget->f_addr);
+		pTarget->f_addr = NULL;
 	}
-pWrkrData->bIsConnected = 0; // TODO: remove this variable altogether
+pTarget->bIsConnected = 0; // TODO: remove this variable altogether
 	RETiRet;
 }
 
@@ -260,13 +403,17 @@ pWrkrData->bIsConnected = 0; // TODO: remove this variable altogether
  * loose data.
  */
 static inline void
-DestructTCPInstanceData(wrkrInstanceData_t *pWrkrData)
+DestructTCPInstanceData(targetData_t *pTarget)
 {
-	doZipFinish(pWrkrData);
-	if(pWrkrData->pNetstrm != NULL)
-		netstrm.Destruct(&pWrkrData->pNetstrm);
-	if(pWrkrData->pNS != NULL)
-		netstrms.Destruct(&pWrkrData->pNS);
+	doZipFinish(pTarget);
+#	ifdef HAVE_EPOLL_CREATE
+	if(pTarget->outRing != NULL)
+		TCPPipeClose(pTarget);
+#	endif
+	if(pTarget->pNetstrm != NULL)
+		netstrm.Destruct(&pTarget->pNetstrm);
+	if(pTarget->pNS != NULL)
+		netstrms.Destruct(&pTarget->pNS);
 }
 
 
@@ -337,6 +484,8 @@ ENDfreeCnf
 
 BEGINcreateInstance
 CODESTARTcreateInstance
+	pthread_mutex_init(&pData->mutTargets, NULL);
+	pData->iPoolResumeInterval = 30;
 	pData->errsToReport = 5;
 	if(cs.pszStrmDrvr != NULL)
 		CHKmalloc(pData->pszStrmDrvr = (uchar*)strdup((char*)cs.pszStrmDrvr));
@@ -348,11 +497,32 @@ ENDcreateInstance
 
 
 BEGINcreateWrkrInstance
+	int i;
 CODESTARTcreateWrkrInstance
 	dbgprintf("DDDD: createWrkrInstance: pWrkrData %p\n", pWrkrData);
-	pWrkrData->offsSndBuf = 0;
 	pWrkrData->errsToReport = pData->errsToReport;
-	iRet = initTCP(pWrkrData);
+#	ifdef HAVE_EPOLL_CREATE
+	pWrkrData->efdOut = -1;
+	pWrkrData->pipeOut[0] = pWrkrData->pipeOut[1] = -1;
+#	endif
+	CHKmalloc(pWrkrData->target = calloc(pData->nTargets, sizeof(targetData_t)));
+	for(i = 0 ; i < pData->nTargets ; ++i) {
+		pWrkrData->target[i].pData = pData;
+		pWrkrData->target[i].pWrkrData = pWrkrData;
+		pWrkrData->target[i].pDesc = &pData->targets[i];
+#		ifdef HAVE_EPOLL_CREATE
+		pthread_mutex_init(&pWrkrData->target[i].mutOut, NULL);
+		pWrkrData->target[i].sock = -1;
+#		endif
+		CHKiRet(initTCP(&pWrkrData->target[i]));
+	}
+#	ifdef HAVE_EPOLL_CREATE
+	if(pData->pipelineSize > 0 && pData->protocol == FORW_TCP) {
+		if(startFlusher(pWrkrData) != RS_RET_OK)
+			DBGPRINTF("omfwd: flusher not started, using blocking sends\n");
+	}
+#	endif
+finalize_it:
 ENDcreateWrkrInstance
 
 
@@ -364,36 +534,91 @@ ENDisCompatibleWithFeature
 
 
 BEGINfreeInstance
+	int i;
 CODESTARTfreeInstance
 	free(pData->pszStrmDrvr);
 	free(pData->pszStrmDrvrAuthMode);
 	free(pData->port);
-	free(pData->target);
+	for(i = 0 ; i < pData->nTargets ; ++i) {
+		free(pData->targets[i].target);
+		free(pData->targets[i].port);
+	}
+	free(pData->targets);
+	pthread_mutex_destroy(&pData->mutTargets);
 	net.DestructPermittedPeers(&pData->pPermPeers);
 ENDfreeInstance
 
 
 BEGINfreeWrkrInstance
+	targetData_t *pTarget;
+	int i;
 CODESTARTfreeWrkrInstance
-	DestructTCPInstanceData(pWrkrData);
-	closeUDPSockets(pWrkrData);
+#	ifdef HAVE_EPOLL_CREATE
+	if(pWrkrData->efdOut != -1)
+		stopFlusher(pWrkrData);
+#	endif
+	for(i = 0 ; pWrkrData->target != NULL && i < pWrkrData->pData->nTargets ; ++i) {
+		pTarget = &pWrkrData->target[i];
+		DestructTCPInstanceData(pTarget);
+		closeUDPSockets(pTarget);
 
-	if(pWrkrData->pData->protocol == FORW_TCP) {
-		tcpclt.Destruct(&pWrkrData->pTCPClt);
+		if(pTarget->pTCPClt != NULL) {
+			tcpclt.Destruct(&pTarget->pTCPClt);
+		}
+		free(pTarget->sndBuf);
+#		ifdef HAVE_SENDMMSG
+		free(pTarget->udpBuf);
+#		endif
+#		ifdef HAVE_EPOLL_CREATE
+		free(pTarget->outRing);
+		pthread_mutex_destroy(&pTarget->mutOut);
+#		endif
+	}
+	free(pWrkrData->target);
+#	ifdef HAVE_EPOLL_CREATE
+	if(pWrkrData->efdOut != -1) {
+		close(pWrkrData->pipeOut[0]);
+		close(pWrkrData->pipeOut[1]);
+		close(pWrkrData->efdOut);
 	}
+#	endif
 ENDfreeWrkrInstance
 
 
 BEGINdbgPrintInstInfo
+	int i;
 CODESTARTdbgPrintInstInfo
-	dbgprintf("%s", pData->target);
+	for(i = 0 ; i < pData->nTargets ; ++i)
+		dbgprintf("%s%s", (i == 0) ? "" : ",", pData->targets[i].target);
 ENDdbgPrintInstInfo
 
 
+/* report an UDP send error (if we did not yet report too many) */
+static void
+reportUDPError(targetData_t *__restrict__ const pTarget, const int lasterrno)
+{
+	char errStr[1024];
+
+	dbgprintf("error forwarding via udp, suspending\n");
+	if(pTarget->pWrkrData->errsToReport > 0) {
+		rs_strerror_r(lasterrno, errStr, sizeof(errStr));
+		errmsg.LogError(0, RS_RET_ERR_UDPSEND, "omfwd: error sending "
+				"via udp: %s", errStr);
+		if(pTarget->pWrkrData->errsToReport == 1) {
+			errmsg.LogError(0, RS_RET_LAST_ERRREPORT, "omfwd: "
+					"max number of error message emitted "
+					"- further messages will be "
+					"suppressed");
+		}
+		--pTarget->pWrkrData->errsToReport;
+	}
+}
+
+
 /* Send a message via UDP
  * rgehards, 2007-12-20
  */
-static rsRetVal UDPSend(wrkrInstanceData_t *__restrict__ const pWrkrData,
+static rsRetVal UDPSend(targetData_t *__restrict__ const pTarget,
 	uchar *__restrict__ const msg,
 	const size_t len)
 {
@@ -405,17 +630,17 @@ static rsRetVal UDPSend(wrkrInstanceData_t *__restrict__ const pWrkrData,
 	int lasterrno;
 	char errStr[1024];
 
-	if(pWrkrData->pData->iRebindInterval && (pWrkrData->nXmit++ % pWrkrData->pData->iRebindInterval == 0)) {
+	if(pTarget->pData->iRebindInterval && (pTarget->nXmit++ % pTarget->pData->iRebindInterval == 0)) {
 		dbgprintf("omfwd dropping UDP 'connection' (as configured)\n");
-		pWrkrData->nXmit = 1;	/* else we have an addtl wrap at 2^31-1 */
-		CHKiRet(closeUDPSockets(pWrkrData));
+		pTarget->nXmit = 1;	/* else we have an addtl wrap at 2^31-1 */
+		CHKiRet(closeUDPSockets(pTarget));
 	}
 
-	if(pWrkrData->pSockArray == NULL) {
-		CHKiRet(doTryResume(pWrkrData));
+	if(pTarget->pSockArray == NULL) {
+		CHKiRet(doTryResume(pTarget));
 	}
 
-	if(pWrkrData->pSockArray != NULL) {
+	if(pTarget->pSockArray != NULL) {
 		/* we need to track if we have success sending to the remote
 		 * peer. Success is indicated by at least one sendto() call
 		 * succeeding. We track this be bSendSuccess. We can not simply
@@ -424,9 +649,9 @@ static rsRetVal UDPSend(wrkrInstanceData_t *__restrict__ const pWrkrData,
 		 * the sendto() succeeded. -- rgerhards, 2007-06-22
 		 */
 		bSendSuccess = RSFALSE;
-		for (r = pWrkrData->f_addr; r; r = r->ai_next) {
-			for (i = 0; i < *pWrkrData->pSockArray; i++) {
-			       lsent = sendto(pWrkrData->pSockArray[i+1], msg, len, 0, r->ai_addr, r->ai_addrlen);
+		for (r = pTarget->f_addr; r; r = r->ai_next) {
+			for (i = 0; i < *pTarget->pSockArray; i++) {
+			       lsent = sendto(pTarget->pSockArray[i+1], msg, len, 0, r->ai_addr, r->ai_addrlen);
 				if (lsent == len) {
 					bSendSuccess = RSTRUE;
 					break;
@@ -442,26 +667,159 @@ static rsRetVal UDPSend(wrkrInstanceData_t *__restrict__ const pWrkrData,
 		}
 		/* finished looping */
 		if(bSendSuccess == RSFALSE) {
-			dbgprintf("error forwarding via udp, suspending\n");
-			if(pWrkrData->errsToReport > 0) {
-				rs_strerror_r(lasterrno, errStr, sizeof(errStr));
-				errmsg.LogError(0, RS_RET_ERR_UDPSEND, "omfwd: error sending "
-						"via udp: %s", errStr);
-				if(pWrkrData->errsToReport == 1) {
-					errmsg.LogError(0, RS_RET_LAST_ERRREPORT, "omfwd: "
-							"max number of error message emitted "
-							"- further messages will be "
-							"suppressed");
+			reportUDPError(pTarget, lasterrno);
+			iRet = RS_RET_SUSPENDED;
+		}
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+#ifdef HAVE_SENDMMSG
+/* send the current UDP batch to one address via one socket. Returns the
+ * number of datagrams delivered. If a single datagram is rejected (e.g.
+ * because it is too large), it is skipped and the rest of the batch is
+ * still sent. If the very first call fails for another reason, we assume
+ * the socket can not reach that address and return 0, so that the caller
+ * can try the next socket.
+ */
+static int
+UDPSendBatch(targetData_t *__restrict__ const pTarget, const int sock,
+	struct addrinfo *__restrict__ const r, int *__restrict__ const lasterrno)
+{
+	int i;
+	int nDone = 0;
+	int nDelivered = 0;
+	int nSent;
+	char errStr[1024];
+
+	for(i = 0 ; i < pTarget->nUdpMsgs ; ++i) {
+		pTarget->udpMsgs[i].msg_hdr.msg_name = r->ai_addr;
+		pTarget->udpMsgs[i].msg_hdr.msg_namelen = r->ai_addrlen;
+	}
+
+	while(nDone < pTarget->nUdpMsgs) {
+		nSent = sendmmsg(sock, pTarget->udpMsgs + nDone, pTarget->nUdpMsgs - nDone, 0);
+		if(nSent > 0) {
+			nDone += nSent;
+			nDelivered += nSent;
+			continue;
+		}
+		*lasterrno = errno;
+		DBGPRINTF("sendmmsg() error: %d = %s.\n", *lasterrno,
+			rs_strerror_r(*lasterrno, errStr, sizeof(errStr)));
+		if(*lasterrno == ENOSYS) {
+			/* kernel without sendmmsg(), send the rest one by one */
+			for( ; nDone < pTarget->nUdpMsgs ; ++nDone) {
+				if(sendto(sock, pTarget->udpIov[nDone].iov_base, pTarget->udpIov[nDone].iov_len,
+					  0, r->ai_addr, r->ai_addrlen) == (ssize_t) pTarget->udpIov[nDone].iov_len)
+					++nDelivered;
+				else
+					*lasterrno = errno;
+			}
+		} else if(nDelivered == 0 && *lasterrno != EMSGSIZE) {
+			break; /* try next socket */
+		} else {
+			++nDone; /* skip the offending datagram */
+		}
+	}
+	return nDelivered;
+}
+
+
+/* send all UDP datagrams collected so far. As with single messages, the
+ * batch counts as sent if it could be delivered via at least one of the
+ * sockets to at least one of the addresses (all addresses with send_to_all).
+ */
+static rsRetVal
+UDPFlush(targetData_t *__restrict__ const pTarget)
+{
+	struct addrinfo *r;
+	int i;
+	int nDelivered = 0;
+	sbool bSendSuccess = RSFALSE;
+	int lasterrno = 0;
+	DEFiRet;
+
+	if(pTarget->nUdpMsgs == 0)
+		FINALIZE;
+	if(pTarget->pSockArray == NULL) {
+		lasterrno = ENOTCONN;
+	} else {
+		for(r = pTarget->f_addr; r; r = r->ai_next) {
+			for(i = 0; i < *pTarget->pSockArray; i++) {
+				nDelivered = UDPSendBatch(pTarget, pTarget->pSockArray[i+1], r, &lasterrno);
+				if(nDelivered > 0) {
+					bSendSuccess = RSTRUE;
+					break;
 				}
-				--pWrkrData->errsToReport;
 			}
-			iRet = RS_RET_SUSPENDED;
+			if(nDelivered == pTarget->nUdpMsgs && !send_to_all)
+				break;
 		}
 	}
+	if(bSendSuccess == RSFALSE) {
+		reportUDPError(pTarget, lasterrno);
+		iRet = RS_RET_SUSPENDED;
+	}
+
+finalize_it:
+	pTarget->nUdpMsgs = 0;
+	pTarget->offsUdpBuf = 0;
+	RETiRet;
+}
+
+
+/* add a message to the UDP batch; the batch is sent when it is full and at
+ * the end of the transaction.
+ */
+static rsRetVal
+UDPQueue(targetData_t *__restrict__ const pTarget,
+	uchar *__restrict__ const msg,
+	const size_t len)
+{
+	struct mmsghdr *mmsg;
+	DEFiRet;
+
+	if(pTarget->pData->iRebindInterval && (pTarget->nXmit++ % pTarget->pData->iRebindInterval == 0)) {
+		dbgprintf("omfwd dropping UDP 'connection' (as configured)\n");
+		pTarget->nXmit = 1;	/* else we have an addtl wrap at 2^31-1 */
+		CHKiRet(UDPFlush(pTarget));
+		CHKiRet(closeUDPSockets(pTarget));
+	}
+
+	if(pTarget->pSockArray == NULL) {
+		CHKiRet(doTryResume(pTarget));
+	}
+
+	if(len > UDP_BATCH_BUFSIZE) {
+		/* nonsense for UDP, but let the kernel decide... */
+		CHKiRet(UDPFlush(pTarget));
+		CHKiRet(UDPSend(pTarget, msg, len));
+		FINALIZE;
+	}
+	if(pTarget->udpBuf == NULL)
+		CHKmalloc(pTarget->udpBuf = MALLOC(UDP_BATCH_BUFSIZE));
+	if(pTarget->offsUdpBuf + len > UDP_BATCH_BUFSIZE)
+		CHKiRet(UDPFlush(pTarget));
+
+	memcpy(pTarget->udpBuf + pTarget->offsUdpBuf, msg, len);
+	pTarget->udpIov[pTarget->nUdpMsgs].iov_base = pTarget->udpBuf + pTarget->offsUdpBuf;
+	pTarget->udpIov[pTarget->nUdpMsgs].iov_len = len;
+	mmsg = &pTarget->udpMsgs[pTarget->nUdpMsgs];
+	memset(mmsg, 0, sizeof(*mmsg));
+	mmsg->msg_hdr.msg_iov = &pTarget->udpIov[pTarget->nUdpMsgs];
+	mmsg->msg_hdr.msg_iovlen = 1;
+	pTarget->offsUdpBuf += len;
+	if(++pTarget->nUdpMsgs == UDP_BATCH_SIZE)
+		CHKiRet(UDPFlush(pTarget));
 
 finalize_it:
 	RETiRet;
 }
+#endif /* #ifdef HAVE_SENDMMSG */
 
 
 /* set the permitted peers -- rgerhards, 2008-05-19
@@ -480,35 +838,362 @@ finalize_it:
 
 /* CODE FOR SENDING TCP MESSAGES */
 
+#ifdef HAVE_EPOLL_CREATE
+/* Pipelined TCP sending. If enabled, the socket is non-blocking and data
+ * the kernel does not take immediately is queued in a per-connection ring.
+ * The ring is drained by the worker on its next send and, in between, by a
+ * flusher thread that waits for the sockets of all of the worker's targets
+ * to become writable. So a stalled receive window only blocks the worker
+ * when the ring is full. Data in the ring counts as sent; it is lost if the
+ * connection breaks, just like data in the kernel's send buffer.
+ */
+
+/* send as much as the socket takes without blocking, adjusting iov.
+ * Must be called with mutOut locked.
+ */
+static rsRetVal
+TCPPipeSendNow(targetData_t *pTarget, struct iovec **piov, int *piovcnt)
+{
+	struct iovec *iov = *piov;
+	int iovcnt = *piovcnt;
+	ssize_t lenSend;
+	DEFiRet;
+
+	while(iovcnt > 0) {
+		CHKiRet(netstrm.SendV(pTarget->pNetstrm, iov, iovcnt, &lenSend, 0));
+		if(lenSend == 0)
+			break; /* EAGAIN */
+		while(iovcnt > 0 && (size_t) lenSend >= iov->iov_len) {
+			lenSend -= iov->iov_len;
+			++iov;
+			--iovcnt;
+		}
+		if(iovcnt > 0) {
+			iov->iov_base = (char*)iov->iov_base + lenSend;
+			iov->iov_len -= lenSend;
+		}
+	}
+	*piov = iov;
+	*piovcnt = iovcnt;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* send queued data as far as possible. Must be called with mutOut locked. */
+static rsRetVal
+TCPPipeDrain(targetData_t *pTarget)
+{
+	struct iovec iovBuf[2];
+	struct iovec *iov = iovBuf;
+	const size_t size = pTarget->pData->pipelineSize;
+	size_t lenFirst;
+	size_t lenSent;
+	int iovcnt;
+	DEFiRet;
+
+	if(pTarget->lenOut == 0)
+		FINALIZE;
+	lenFirst = size - pTarget->offsOut;
+	if(lenFirst > pTarget->lenOut)
+		lenFirst = pTarget->lenOut;
+	iov[0].iov_base = pTarget->outRing + pTarget->offsOut;
+	iov[0].iov_len = lenFirst;
+	iov[1].iov_base = pTarget->outRing;
+	iov[1].iov_len = pTarget->lenOut - lenFirst;
+	iovcnt = (iov[1].iov_len == 0) ? 1 : 2;
+	CHKiRet(TCPPipeSendNow(pTarget, &iov, &iovcnt));
+
+	lenSent = pTarget->lenOut;
+	if(iovcnt > 0)
+		lenSent -= iov[0].iov_len + ((iovcnt == 2) ? iov[1].iov_len : 0);
+	pTarget->offsOut = (pTarget->offsOut + lenSent) % size;
+	pTarget->lenOut -= lenSent;
+	if(pTarget->lenOut == 0)
+		pTarget->offsOut = 0;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* have the flusher wait for the socket to become writable if data is
+ * queued. Must be called with mutOut locked.
+ */
+static void
+TCPPipeArm(targetData_t *pTarget)
+{
+	struct epoll_event evt;
+
+	if(pTarget->lenOut == 0 || pTarget->sock == -1)
+		return;
+	memset(&evt, 0, sizeof(evt));
+	evt.events = EPOLLOUT | EPOLLONESHOT;
+	evt.data.ptr = pTarget;
+	if(epoll_ctl(pTarget->pWrkrData->efdOut, pTarget->bOutRegistered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+		     pTarget->sock, &evt) == 0) {
+		pTarget->bOutRegistered = 1;
+	} else {
+		DBGPRINTF("omfwd: could not register socket %d with flusher, errno %d\n",
+			  pTarget->sock, errno);
+	}
+}
+
+
+/* queue data for sending. We only block while the ring does not have room
+ * for what the socket did not take.
+ */
+static rsRetVal
+TCPPipeSendV(targetData_t *pTarget, struct iovec *iov, int iovcnt)
+{
+	const size_t size = pTarget->pData->pipelineSize;
+	struct pollfd pfd;
+	size_t lenRemain;
+	size_t offsPut;
+	size_t lenCopy;
+	int i;
+	DEFiRet;
+
+	pthread_mutex_lock(&pTarget->mutOut);
+	while(1) {
+		if(pTarget->bOutErr)
+			ABORT_FINALIZE(RS_RET_IO_ERROR);
+		CHKiRet(TCPPipeDrain(pTarget));
+		if(pTarget->lenOut == 0) /* keep order: direct sends only if nothing is queued */
+			CHKiRet(TCPPipeSendNow(pTarget, &iov, &iovcnt));
+		for(lenRemain = 0, i = 0 ; i < iovcnt ; ++i)
+			lenRemain += iov[i].iov_len;
+		if(lenRemain <= size - pTarget->lenOut)
+			break;
+		/* ring full, we need to wait for the peer */
+		pthread_mutex_unlock(&pTarget->mutOut);
+		pfd.fd = pTarget->sock;
+		pfd.events = POLLOUT;
+		poll(&pfd, 1, -1);
+		pthread_mutex_lock(&pTarget->mutOut);
+	}
+
+	for(i = 0 ; i < iovcnt ; ++i) {
+		while(iov[i].iov_len > 0) {
+			offsPut = (pTarget->offsOut + pTarget->lenOut) % size;
+			lenCopy = size - offsPut;
+			if(lenCopy > iov[i].iov_len)
+				lenCopy = iov[i].iov_len;
+			memcpy(pTarget->outRing + offsPut, iov[i].iov_base, lenCopy);
+			pTarget->lenOut += lenCopy;
+			iov[i].iov_base = (char*)iov[i].iov_base + lenCopy;
+			iov[i].iov_len -= lenCopy;
+		}
+	}
+	TCPPipeArm(pTarget);
+
+finalize_it:
+	pthread_mutex_unlock(&pTarget->mutOut);
+	RETiRet;
+}
+
+
+/* the connection is about to be closed. Give queued data a chance to go
+ * out, then forget about it and the socket.
+ */
+static void
+TCPPipeClose(targetData_t *pTarget)
+{
+	struct pollfd pfd;
+	int i;
+
+	pthread_mutex_lock(&pTarget->mutOut);
+	while(pTarget->lenOut > 0 && !pTarget->bOutErr && pTarget->sock != -1) {
+		if(TCPPipeDrain(pTarget) != RS_RET_OK || pTarget->lenOut == 0)
+			break;
+		pthread_mutex_unlock(&pTarget->mutOut);
+		pfd.fd = pTarget->sock;
+		pfd.events = POLLOUT;
+		i = poll(&pfd, 1, TCP_PIPE_DRAIN_TIMEOUT);
+		pthread_mutex_lock(&pTarget->mutOut);
+		if(i <= 0) {
+			DBGPRINTF("omfwd: peer does not take data, discarding %u queued bytes\n",
+				  (unsigned) pTarget->lenOut);
+			break;
+		}
+	}
+	if(pTarget->bOutRegistered) {
+		epoll_ctl(pTarget->pWrkrData->efdOut, EPOLL_CTL_DEL, pTarget->sock, NULL);
+		pTarget->bOutRegistered = 0;
+	}
+	pTarget->sock = -1;
+	pTarget->offsOut = 0;
+	pTarget->lenOut = 0;
+	pTarget->bOutErr = 0;
+	pthread_mutex_unlock(&pTarget->mutOut);
+}
+
+
+/* the flusher thread of a worker. It drains the rings of all targets
+ * the worker talks to whenever their sockets become writable.
+ */
+static void *
+flusherWrkr(void *arg)
+{
+	wrkrInstanceData_t *const pWrkrData = (wrkrInstanceData_t*) arg;
+	struct epoll_event evts[16];
+	targetData_t *pTarget;
+	int nEvts;
+	int i;
+
+	while(1) {
+		nEvts = epoll_wait(pWrkrData->efdOut, evts, sizeof(evts)/sizeof(struct epoll_event), -1);
+		for(i = 0 ; i < nEvts ; ++i) {
+			pTarget = (targetData_t*) evts[i].data.ptr;
+			if(pTarget == NULL)
+				return NULL; /* terminate request */
+			pthread_mutex_lock(&pTarget->mutOut);
+			if(pTarget->bOutRegistered && !pTarget->bOutErr) {
+				if(TCPPipeDrain(pTarget) == RS_RET_OK)
+					TCPPipeArm(pTarget);
+				else
+					pTarget->bOutErr = 1; /* worker tears down connection on next send */
+			}
+			pthread_mutex_unlock(&pTarget->mutOut);
+		}
+	}
+	return NULL;
+}
+
+
+/* start the flusher of a worker */
+static rsRetVal
+startFlusher(wrkrInstanceData_t *pWrkrData)
+{
+	struct epoll_event evt;
+	int r;
+	DEFiRet;
+
+#	if defined(EPOLL_CLOEXEC) && defined(HAVE_EPOLL_CREATE1)
+	pWrkrData->efdOut = epoll_create1(EPOLL_CLOEXEC);
+	if(pWrkrData->efdOut < 0 && errno == ENOSYS)
+#	endif
+		pWrkrData->efdOut = epoll_create(16);
+	if(pWrkrData->efdOut < 0)
+		ABORT_FINALIZE(RS_RET_EPOLL_CR_FAILED);
+	if(pipe(pWrkrData->pipeOut) != 0)
+		ABORT_FINALIZE(RS_RET_ERR);
+	memset(&evt, 0, sizeof(evt));
+	evt.events = EPOLLIN;
+	evt.data.ptr = NULL;
+	if(epoll_ctl(pWrkrData->efdOut, EPOLL_CTL_ADD, pWrkrData->pipeOut[0], &evt) != 0)
+		ABORT_FINALIZE(RS_RET_EPOLL_CTL_FAILED);
+	if((r = pthread_create(&pWrkrData->tidFlusher, NULL, flusherWrkr, pWrkrData)) != 0) {
+		errmsg.LogError(r, RS_RET_ERR, "omfwd: could not start flusher thread, "
+			"using blocking sends");
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+
+finalize_it:
+	if(iRet != RS_RET_OK) {
+		if(pWrkrData->pipeOut[0] != -1) {
+			close(pWrkrData->pipeOut[0]);
+			close(pWrkrData->pipeOut[1]);
+			pWrkrData->pipeOut[0] = pWrkrData->pipeOut[1] = -1;
+		}
+		if(pWrkrData->efdOut != -1) {
+			close(pWrkrData->efdOut);
+			pWrkrData->efdOut = -1;
+		}
+	}
+	RETiRet;
+}
+
+
+static void
+stopFlusher(wrkrInstanceData_t *pWrkrData)
+{
+	const char c = 0;
+
+	if(write(pWrkrData->pipeOut[1], &c, 1) == 1)
+		pthread_join(pWrkrData->tidFlusher, NULL);
+}
+
+
+/* set up the connection for pipelined sending, called after connect */
+static rsRetVal
+TCPPipeInit(targetData_t *pTarget)
+{
+	int sock;
+	int flags;
+	DEFiRet;
+
+	CHKiRet(netstrm.GetSock(pTarget->pNetstrm, &sock));
+	if((flags = fcntl(sock, F_GETFL)) == -1 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1)
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	if(pTarget->outRing == NULL)
+		CHKmalloc(pTarget->outRing = MALLOC(pTarget->pData->pipelineSize));
+	pthread_mutex_lock(&pTarget->mutOut);
+	pTarget->sock = sock;
+	pthread_mutex_unlock(&pTarget->mutOut);
+
+finalize_it:
+	RETiRet;
+}
+#endif /* #ifdef HAVE_EPOLL_CREATE */
+
+
+/* send a set of buffers with as few calls as possible, handling short
+ * writes. If bMore is set, the driver is told that more data follows
+ * within the current transaction. Note that iov is modified.
+ */
 static rsRetVal
-TCPSendBufUncompressed(wrkrInstanceData_t *pWrkrData, uchar *buf, unsigned len)
+TCPSendV(targetData_t *pTarget, struct iovec *iov, int iovcnt, sbool bMore)
 {
 	DEFiRet;
-	unsigned alreadySent;
 	ssize_t lenSend;
 
-	alreadySent = 0;
-	CHKiRet(netstrm.CheckConnection(pWrkrData->pNetstrm)); /* hack for plain tcp syslog - see ptcp driver for details */
+	CHKiRet(netstrm.CheckConnection(pTarget->pNetstrm)); /* hack for plain tcp syslog - see ptcp driver for details */
 
-	while(alreadySent != len) {
-		lenSend = len - alreadySent;
-		CHKiRet(netstrm.Send(pWrkrData->pNetstrm, buf+alreadySent, &lenSend));
-		DBGPRINTF("omfwd: TCP sent %ld bytes, requested %u\n", (long) lenSend, len - alreadySent);
-		alreadySent += lenSend;
+#	ifdef HAVE_EPOLL_CREATE
+	if(pTarget->outRing != NULL && pTarget->sock != -1) {
+		CHKiRet(TCPPipeSendV(pTarget, iov, iovcnt));
+		FINALIZE;
+	}
+#	endif
+	while(iovcnt > 0) {
+		CHKiRet(netstrm.SendV(pTarget->pNetstrm, iov, iovcnt, &lenSend, bMore));
+		DBGPRINTF("omfwd: TCP sent %ld bytes from %d buffers\n", (long) lenSend, iovcnt);
+		/* skip what was written */
+		while(iovcnt > 0 && (size_t) lenSend >= iov->iov_len) {
+			lenSend -= iov->iov_len;
+			++iov;
+			--iovcnt;
+		}
+		if(iovcnt > 0) {
+			iov->iov_base = (char*)iov->iov_base + lenSend;
+			iov->iov_len -= lenSend;
+		}
 	}
 
 finalize_it:
 	if(iRet != RS_RET_OK) {
 		/* error! */
 		dbgprintf("TCPSendBuf error %d, destruct TCP Connection!\n", iRet);
-		DestructTCPInstanceData(pWrkrData);
+		DestructTCPInstanceData(pTarget);
 		iRet = RS_RET_SUSPENDED;
 	}
 	RETiRet;
 }
 
 static rsRetVal
-TCPSendBufCompressed(wrkrInstanceData_t *pWrkrData, uchar *buf, unsigned len, sbool bIsFlush)
+TCPSendBufUncompressed(targetData_t *pTarget, uchar *buf, unsigned len, sbool bMore)
+{
+	struct iovec iov;
+
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	return TCPSendV(pTarget, &iov, 1, bMore);
+}
+
+static rsRetVal
+TCPSendBufCompressed(targetData_t *pTarget, uchar *buf, unsigned len, sbool bIsFlush)
 {
 	int zRet;	/* zlib return state */
 	unsigned outavail;
@@ -516,52 +1201,52 @@ TCPSendBufCompressed(wrkrInstanceData_t *pWrkrData, uchar *buf, unsigned len, sb
 	int op;
 	DEFiRet;
 
-	if(!pWrkrData->bzInitDone) {
+	if(!pTarget->bzInitDone) {
 		/* allocate deflate state */
-		pWrkrData->zstrm.zalloc = Z_NULL;
-		pWrkrData->zstrm.zfree = Z_NULL;
-		pWrkrData->zstrm.opaque = Z_NULL;
+		pTarget->zstrm.zalloc = Z_NULL;
+		pTarget->zstrm.zfree = Z_NULL;
+		pTarget->zstrm.opaque = Z_NULL;
 		/* see note in file header for the params we use with deflateInit2() */
-		zRet = deflateInit(&pWrkrData->zstrm, 9);
+		zRet = deflateInit(&pTarget->zstrm, 9);
 		if(zRet != Z_OK) {
 			DBGPRINTF("error %d returned from zlib/deflateInit()\n", zRet);
 			ABORT_FINALIZE(RS_RET_ZLIB_ERR);
 		}
-		pWrkrData->bzInitDone = RSTRUE;
+		pTarget->bzInitDone = RSTRUE;
 	}
 
 	/* now doing the compression */
-	pWrkrData->zstrm.next_in = (Bytef*) buf;
-	pWrkrData->zstrm.avail_in = len;
-	if(pWrkrData->pData->strmCompFlushOnTxEnd && bIsFlush)
+	pTarget->zstrm.next_in = (Bytef*) buf;
+	pTarget->zstrm.avail_in = len;
+	if(pTarget->pData->strmCompFlushOnTxEnd && bIsFlush)
 		op = Z_SYNC_FLUSH;
 	else
 		op = Z_NO_FLUSH;
 	/* run deflate() on buffer until everything has been compressed */
 	do {
-		DBGPRINTF("omfwd: in deflate() loop, avail_in %d, total_in %ld, isFlush %d\n", pWrkrData->zstrm.avail_in, pWrkrData->zstrm.total_in, bIsFlush);
-		pWrkrData->zstrm.avail_out = sizeof(zipBuf);
-		pWrkrData->zstrm.next_out = zipBuf;
-		zRet = deflate(&pWrkrData->zstrm, op);    /* no bad return value */
-		DBGPRINTF("after deflate, ret %d, avail_out %d\n", zRet, pWrkrData->zstrm.avail_out);
-		outavail = sizeof(zipBuf) - pWrkrData->zstrm.avail_out;
+		DBGPRINTF("omfwd: in deflate() loop, avail_in %d, total_in %ld, isFlush %d\n", pTarget->zstrm.avail_in, pTarget->zstrm.total_in, bIsFlush);
+		pTarget->zstrm.avail_out = sizeof(zipBuf);
+		pTarget->zstrm.next_out = zipBuf;
+		zRet = deflate(&pTarget->zstrm, op);    /* no bad return value */
+		DBGPRINTF("after deflate, ret %d, avail_out %d\n", zRet, pTarget->zstrm.avail_out);
+		outavail = sizeof(zipBuf) - pTarget->zstrm.avail_out;
 		if(outavail != 0) {
-			CHKiRet(TCPSendBufUncompressed(pWrkrData, zipBuf, outavail));
+			CHKiRet(TCPSendBufUncompressed(pTarget, zipBuf, outavail, 0));
 		}
-	} while (pWrkrData->zstrm.avail_out == 0);
+	} while (pTarget->zstrm.avail_out == 0);
 
 finalize_it:
 	RETiRet;
 }
 
 static rsRetVal
-TCPSendBuf(wrkrInstanceData_t *pWrkrData, uchar *buf, unsigned len, sbool bIsFlush)
+TCPSendBuf(targetData_t *pTarget, uchar *buf, unsigned len, sbool bIsFlush)
 {
 	DEFiRet;
-	if(pWrkrData->pData->compressionMode >= COMPRESS_STREAM_ALWAYS)
-		iRet = TCPSendBufCompressed(pWrkrData, buf, len, bIsFlush);
+	if(pTarget->pData->compressionMode >= COMPRESS_STREAM_ALWAYS)
+		iRet = TCPSendBufCompressed(pTarget, buf, len, bIsFlush);
 	else
-		iRet = TCPSendBufUncompressed(pWrkrData, buf, len);
+		iRet = TCPSendBufUncompressed(pTarget, buf, len, !bIsFlush);
 	RETiRet;
 }
 
@@ -569,39 +1254,39 @@ TCPSendBuf(wrkrInstanceData_t *pWrkrData, uchar *buf, unsigned len, sbool bIsFlu
  * running in stream mode).
  */
 static rsRetVal
-doZipFinish(wrkrInstanceData_t *pWrkrData)
+doZipFinish(targetData_t *pTarget)
 {
 	int zRet;	/* zlib return state */
 	DEFiRet;
 	unsigned outavail;
 	uchar zipBuf[32*1024];
 
-	if(!pWrkrData->bzInitDone)
+	if(!pTarget->bzInitDone)
 		goto done;
 
 // TODO: can we get this into a single common function?
 dbgprintf("DDDD: in doZipFinish()\n");
-	pWrkrData->zstrm.avail_in = 0;
+	pTarget->zstrm.avail_in = 0;
 	/* run deflate() on buffer until everything has been compressed */
 	do {
-		DBGPRINTF("in deflate() loop, avail_in %d, total_in %ld\n", pWrkrData->zstrm.avail_in, pWrkrData->zstrm.total_in);
-		pWrkrData->zstrm.avail_out = sizeof(zipBuf);
-		pWrkrData->zstrm.next_out = zipBuf;
-		zRet = deflate(&pWrkrData->zstrm, Z_FINISH);    /* no bad return value */
-		DBGPRINTF("after deflate, ret %d, avail_out %d\n", zRet, pWrkrData->zstrm.avail_out);
-		outavail = sizeof(zipBuf) - pWrkrData->zstrm.avail_out;
+		DBGPRINTF("in deflate() loop, avail_in %d, total_in %ld\n", pTarget->zstrm.avail_in, pTarget->zstrm.total_in);
+		pTarget->zstrm.avail_out = sizeof(zipBuf);
+		pTarget->zstrm.next_out = zipBuf;
+		zRet = deflate(&pTarget->zstrm, Z_FINISH);    /* no bad return value */
+		DBGPRINTF("after deflate, ret %d, avail_out %d\n", zRet, pTarget->zstrm.avail_out);
+		outavail = sizeof(zipBuf) - pTarget->zstrm.avail_out;
 		if(outavail != 0) {
-			CHKiRet(TCPSendBufUncompressed(pWrkrData, zipBuf, outavail));
+			CHKiRet(TCPSendBufUncompressed(pTarget, zipBuf, outavail, 0));
 		}
-	} while (pWrkrData->zstrm.avail_out == 0);
+	} while (pTarget->zstrm.avail_out == 0);
 
 finalize_it:
-	zRet = deflateEnd(&pWrkrData->zstrm);
+	zRet = deflateEnd(&pTarget->zstrm);
 	if(zRet != Z_OK) {
 		DBGPRINTF("error %d returned from zlib/deflateEnd()\n", zRet);
 	}
 
-	pWrkrData->bzInitDone = 0;
+	pTarget->bzInitDone = 0;
 done:	RETiRet;
 }
 
@@ -611,26 +1296,40 @@ done:	RETiRet;
 static rsRetVal TCPSendFrame(void *pvData, char *msg, size_t len)
 {
 	DEFiRet;
-	wrkrInstanceData_t *pWrkrData = (wrkrInstanceData_t *) pvData;
+	targetData_t *pTarget = (targetData_t *) pvData;
+	struct iovec iov[2];
 
 	DBGPRINTF("omfwd: add %u bytes to send buffer (curr offs %u)\n",
-		(unsigned) len, pWrkrData->offsSndBuf);
-	if(pWrkrData->offsSndBuf != 0 && pWrkrData->offsSndBuf + len >= sizeof(pWrkrData->sndBuf)) {
+		(unsigned) len, pTarget->offsSndBuf);
+	if(len > pTarget->lenSndBuf && pTarget->pData->compressionMode < COMPRESS_STREAM_ALWAYS) {
+		/* frame does not fit into buffer: send what is buffered and the
+		 * frame itself with a single call, without copying the frame.
+		 */
+		iov[0].iov_base = pTarget->sndBuf;
+		iov[0].iov_len = pTarget->offsSndBuf;
+		iov[1].iov_base = msg;
+		iov[1].iov_len = len;
+		pTarget->offsSndBuf = 0;
+		CHKiRet(TCPSendV(pTarget, iov, 2, 0));
+		ABORT_FINALIZE(RS_RET_OK);	/* committed everything so far */
+	}
+
+	if(pTarget->offsSndBuf != 0 && pTarget->offsSndBuf + len >= pTarget->lenSndBuf) {
 		/* no buffer space left, need to commit previous records */
-		CHKiRet(TCPSendBuf(pWrkrData, pWrkrData->sndBuf, pWrkrData->offsSndBuf, NO_FLUSH));
-		pWrkrData->offsSndBuf = 0;
+		CHKiRet(TCPSendBuf(pTarget, pTarget->sndBuf, pTarget->offsSndBuf, NO_FLUSH));
+		pTarget->offsSndBuf = 0;
 		iRet = RS_RET_PREVIOUS_COMMITTED;
 	}
 
 	/* check if the message is too large to fit into buffer */
-	if(len > sizeof(pWrkrData->sndBuf)) {
-		CHKiRet(TCPSendBuf(pWrkrData, (uchar*)msg, len, NO_FLUSH));
+	if(len > pTarget->lenSndBuf) {
+		CHKiRet(TCPSendBuf(pTarget, (uchar*)msg, len, NO_FLUSH));
 		ABORT_FINALIZE(RS_RET_OK);	/* committed everything so far */
 	}
 
 	/* we now know the buffer has enough free space */
-	memcpy(pWrkrData->sndBuf + pWrkrData->offsSndBuf, msg, len);
-	pWrkrData->offsSndBuf += len;
+	memcpy(pTarget->sndBuf + pTarget->offsSndBuf, msg, len);
+	pTarget->offsSndBuf += len;
 	iRet = RS_RET_DEFER_COMMIT;
 
 finalize_it:
@@ -645,10 +1344,35 @@ finalize_it:
 static rsRetVal TCPSendPrepRetry(void *pvData)
 {
 	DEFiRet;
-	wrkrInstanceData_t *pWrkrData = (wrkrInstanceData_t *) pvData;
+	targetData_t *pTarget = (targetData_t *) pvData;
 
-	assert(pWrkrData != NULL);
-	DestructTCPInstanceData(pWrkrData);
+	assert(pTarget != NULL);
+	DestructTCPInstanceData(pTarget);
+	RETiRet;
+}
+
+
+/* allocate the frame buffer. We size it after the socket's send buffer,
+ * so that one flush fills the send window without blocking. This is done
+ * once, on the first connect.
+ */
+static rsRetVal
+allocSndBuf(targetData_t *pTarget)
+{
+	int size;
+	DEFiRet;
+
+	if(netstrm.GetSndBufSize(pTarget->pNetstrm, &size) != RS_RET_OK)
+		size = TCP_SNDBUF_MIN;
+	if(size < TCP_SNDBUF_MIN)
+		size = TCP_SNDBUF_MIN;
+	else if(size > TCP_SNDBUF_MAX)
+		size = TCP_SNDBUF_MAX;
+	CHKmalloc(pTarget->sndBuf = MALLOC(size));
+	pTarget->lenSndBuf = size;
+	DBGPRINTF("omfwd: using TCP frame buffer of %d bytes\n", size);
+
+finalize_it:
 	RETiRet;
 }
 
@@ -659,39 +1383,45 @@ static rsRetVal TCPSendPrepRetry(void *pvData)
 static rsRetVal TCPSendInit(void *pvData)
 {
 	DEFiRet;
-	wrkrInstanceData_t *pWrkrData = (wrkrInstanceData_t *) pvData;
+	targetData_t *pTarget = (targetData_t *) pvData;
 	instanceData *pData;
 
-	assert(pWrkrData != NULL);
-	pData = pWrkrData->pData;
+	assert(pTarget != NULL);
+	pData = pTarget->pData;
 
-	if(pWrkrData->pNetstrm == NULL) {
+	if(pTarget->pNetstrm == NULL) {
 		dbgprintf("TCPSendInit CREATE\n");
-		CHKiRet(netstrms.Construct(&pWrkrData->pNS));
+		CHKiRet(netstrms.Construct(&pTarget->pNS));
 		/* the stream driver must be set before the object is finalized! */
-		CHKiRet(netstrms.SetDrvrName(pWrkrData->pNS, pData->pszStrmDrvr));
-		CHKiRet(netstrms.ConstructFinalize(pWrkrData->pNS));
+		CHKiRet(netstrms.SetDrvrName(pTarget->pNS, pData->pszStrmDrvr));
+		CHKiRet(netstrms.ConstructFinalize(pTarget->pNS));
 
 		/* now create the actual stream and connect to the server */
-		CHKiRet(netstrms.CreateStrm(pWrkrData->pNS, &pWrkrData->pNetstrm));
-		CHKiRet(netstrm.ConstructFinalize(pWrkrData->pNetstrm));
-		CHKiRet(netstrm.SetDrvrMode(pWrkrData->pNetstrm, pData->iStrmDrvrMode));
+		CHKiRet(netstrms.CreateStrm(pTarget->pNS, &pTarget->pNetstrm));
+		CHKiRet(netstrm.ConstructFinalize(pTarget->pNetstrm));
+		CHKiRet(netstrm.SetDrvrMode(pTarget->pNetstrm, pData->iStrmDrvrMode));
 		/* now set optional params, but only if they were actually configured */
 		if(pData->pszStrmDrvrAuthMode != NULL) {
-			CHKiRet(netstrm.SetDrvrAuthMode(pWrkrData->pNetstrm, pData->pszStrmDrvrAuthMode));
+			CHKiRet(netstrm.SetDrvrAuthMode(pTarget->pNetstrm, pData->pszStrmDrvrAuthMode));
 		}
 		if(pData->pPermPeers != NULL) {
-			CHKiRet(netstrm.SetDrvrPermPeers(pWrkrData->pNetstrm, pData->pPermPeers));
+			CHKiRet(netstrm.SetDrvrPermPeers(pTarget->pNetstrm, pData->pPermPeers));
 		}
 		/* params set, now connect */
-		CHKiRet(netstrm.Connect(pWrkrData->pNetstrm, glbl.GetDefPFFamily(),
-			(uchar*)pData->port, (uchar*)pData->target));
+		CHKiRet(netstrm.Connect(pTarget->pNetstrm, glbl.GetDefPFFamily(),
+			(uchar*)getPort(pTarget), (uchar*)pTarget->pDesc->target));
+		if(pTarget->sndBuf == NULL)
+			CHKiRet(allocSndBuf(pTarget));
+#		ifdef HAVE_EPOLL_CREATE
+		if(pTarget->pWrkrData->efdOut != -1)
+			CHKiRet(TCPPipeInit(pTarget));
+#		endif
 	}
 
 finalize_it:
 	if(iRet != RS_RET_OK) {
 		dbgprintf("TCPSendInit FAILED with %d.\n", iRet);
-		DestructTCPInstanceData(pWrkrData);
+		DestructTCPInstanceData(pTarget);
 	}
 
 	RETiRet;
@@ -701,7 +1431,7 @@ finalize_it:
 /* try to resume connection if it is not ready
  * rgerhards, 2007-08-02
  */
-static rsRetVal doTryResume(wrkrInstanceData_t *pWrkrData)
+static rsRetVal doTryResume(targetData_t *pTarget)
 {
 	int iErr;
 	struct addrinfo *res;
@@ -709,38 +1439,38 @@ static rsRetVal doTryResume(wrkrInstanceData_t *pWrkrData)
 	instanceData *pData;
 	DEFiRet;
 
-	if(pWrkrData->bIsConnected)
+	if(pTarget->bIsConnected)
 		FINALIZE;
-	pData = pWrkrData->pData;
+	pData = pTarget->pData;
 
 	/* The remote address is not yet known and needs to be obtained */
-	dbgprintf(" %s\n", pData->target);
+	dbgprintf(" %s\n", pTarget->pDesc->target);
 	if(pData->protocol == FORW_UDP) {
 		memset(&hints, 0, sizeof(hints));
 		/* port must be numeric, because config file syntax requires this */
 		hints.ai_flags = AI_NUMERICSERV;
 		hints.ai_family = glbl.GetDefPFFamily();
 		hints.ai_socktype = SOCK_DGRAM;
-		if((iErr = (getaddrinfo(pData->target, pData->port, &hints, &res))) != 0) {
+		if((iErr = (getaddrinfo(pTarget->pDesc->target, getPort(pTarget), &hints, &res))) != 0) {
 			dbgprintf("could not get addrinfo for hostname '%s':'%s': %d%s\n",
-				  pData->target, pData->port, iErr, gai_strerror(iErr));
+				  pTarget->pDesc->target, getPort(pTarget), iErr, gai_strerror(iErr));
 			ABORT_FINALIZE(RS_RET_SUSPENDED);
 		}
-		dbgprintf("%s found, resuming.\n", pData->target);
-		pWrkrData->f_addr = res;
-		pWrkrData->bIsConnected = 1;
-		if(pWrkrData->pSockArray == NULL) {
-			pWrkrData->pSockArray = net.create_udp_socket((uchar*)pData->target, NULL, 0, 0);
+		dbgprintf("%s found, resuming.\n", pTarget->pDesc->target);
+		pTarget->f_addr = res;
+		pTarget->bIsConnected = 1;
+		if(pTarget->pSockArray == NULL) {
+			pTarget->pSockArray = net.create_udp_socket((uchar*)pTarget->pDesc->target, NULL, 0, 0, 0);
 		}
 	} else {
-		CHKiRet(TCPSendInit((void*)pWrkrData));
+		CHKiRet(TCPSendInit((void*)pTarget));
 	}
 
 finalize_it:
 	if(iRet != RS_RET_OK) {
-		if(pWrkrData->f_addr != NULL) {
-			freeaddrinfo(pWrkrData->f_addr);
-			pWrkrData->f_addr = NULL;
+		if(pTarget->f_addr != NULL) {
+			freeaddrinfo(pTarget->f_addr);
+			pTarget->f_addr = NULL;
 		}
 		iRet = RS_RET_SUSPENDED;
 	}
@@ -749,22 +1479,144 @@ finalize_it:
 }
 
 
+/* select the target for the next transaction. Targets whose circuit is
+ * open (they failed recently) are skipped. If all targets failed, we use
+ * the one that is due for a retry first - we need to send somewhere.
+ */
+static targetData_t *
+selectTarget(wrkrInstanceData_t *const pWrkrData)
+{
+	instanceData *const pData = pWrkrData->pData;
+	fwdTarget_t *t;
+	time_t ttNow;
+	int best = -1;
+	int i, k;
+
+	if(pData->nTargets == 1) /* the usual case */
+		return &pWrkrData->target[0];
+
+	pthread_mutex_lock(&pData->mutTargets);
+	ttNow = time(NULL);
+	for(k = 0 ; k < pData->nTargets ; ++k) {
+		i = (pData->iNextTarget + k) % pData->nTargets;
+		t = &pData->targets[i];
+		if(t->ttResume > ttNow)
+			continue;
+		if(pData->distribution == FWD_DISTR_ROUNDROBIN) {
+			best = i;
+			break;
+		}
+		if(best == -1 || t->nActive < pData->targets[best].nActive)
+			best = i;
+	}
+	if(best == -1) {
+		best = 0;
+		for(i = 1 ; i < pData->nTargets ; ++i)
+			if(pData->targets[i].ttResume < pData->targets[best].ttResume)
+				best = i;
+	}
+	/* ties in least-loaded mode are broken round-robin, too */
+	pData->iNextTarget = (best + 1) % pData->nTargets;
+	++pData->targets[best].nActive;
+	pthread_mutex_unlock(&pData->mutTargets);
+	return &pWrkrData->target[best];
+}
+
+
+/* update target health, called with mutTargets locked */
+static void
+setTargetHealth(targetData_t *const pTarget, const sbool bFailed)
+{
+	instanceData *const pData = pTarget->pData;
+	fwdTarget_t *const t = pTarget->pDesc;
+
+	if(bFailed) {
+		if(t->nFails++ == 0) {
+			errmsg.LogError(0, RS_RET_SUSPENDED, "omfwd: target %s:%s failed, not using it "
+				"for %d seconds", t->target, getPort(pTarget), pData->iPoolResumeInterval);
+		}
+		t->ttResume = time(NULL) + pData->iPoolResumeInterval;
+	} else if(t->nFails != 0) {
+		errmsg.LogError(0, NO_ERRCODE, "omfwd: target %s:%s is available again",
+			t->target, getPort(pTarget));
+		t->nFails = 0;
+		t->ttResume = 0;
+	}
+}
+
+
+/* update target health after a transaction was sent (or not) to it */
+static void
+releaseTarget(targetData_t *const pTarget, const sbool bFailed)
+{
+	instanceData *const pData = pTarget->pData;
+
+	if(pData->nTargets == 1)
+		return;
+
+	pthread_mutex_lock(&pData->mutTargets);
+	--pTarget->pDesc->nActive;
+	setTargetHealth(pTarget, bFailed);
+	pthread_mutex_unlock(&pData->mutTargets);
+}
+
+
+/* we can resume if we can reach at least one target. Targets whose
+ * circuit is open are not tried, otherwise a dead target would cost a
+ * connect attempt on every transaction. If all circuits are open, we stay
+ * suspended until the first one is due for a retry.
+ */
+static rsRetVal
+tryResumeAny(wrkrInstanceData_t *const pWrkrData)
+{
+	instanceData *const pData = pWrkrData->pData;
+	time_t ttNow;
+	sbool bResting;
+	int i;
+	DEFiRet;
+
+	if(pData->nTargets == 1) { /* the usual case */
+		iRet = doTryResume(&pWrkrData->target[0]);
+		FINALIZE;
+	}
+
+	iRet = RS_RET_SUSPENDED;
+	ttNow = time(NULL);
+	for(i = 0 ; i < pData->nTargets ; ++i) {
+		pthread_mutex_lock(&pData->mutTargets);
+		bResting = (pData->targets[i].ttResume > ttNow);
+		pthread_mutex_unlock(&pData->mutTargets);
+		if(bResting)
+			continue;
+		iRet = doTryResume(&pWrkrData->target[i]);
+		if(iRet == RS_RET_OK)
+			break;
+		pthread_mutex_lock(&pData->mutTargets);
+		setTargetHealth(&pWrkrData->target[i], 1);
+		pthread_mutex_unlock(&pData->mutTargets);
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
 BEGINtryResume
 CODESTARTtryResume
 	dbgprintf("DDDD: tryResume: pWrkrData %p\n", pWrkrData);
-	iRet = doTryResume(pWrkrData);
+	iRet = tryResumeAny(pWrkrData);
 ENDtryResume
 
 
 BEGINbeginTransaction
 CODESTARTbeginTransaction
 dbgprintf("omfwd: beginTransaction\n");
-	iRet = doTryResume(pWrkrData);
+	iRet = tryResumeAny(pWrkrData);
 ENDbeginTransaction
 
 
 static rsRetVal
-processMsg(wrkrInstanceData_t *__restrict__ const pWrkrData,
+processMsg(targetData_t *__restrict__ const pTarget,
 	actWrkrIParams_t *__restrict__ const iparam)
 {
 	uchar *psz; /* temporary buffering */
@@ -773,14 +1625,15 @@ processMsg(wrkrInstanceData_t *__restrict__ const pWrkrData,
 #	ifdef	USE_NETZIP
 	Bytef *out = NULL; /* for compression */
 #	endif
-	instanceData *__restrict__ const pData = pWrkrData->pData;
+	instanceData *__restrict__ const pData = pTarget->pData;
 	DEFiRet;
 
 	iMaxLine = glbl.GetMaxLine();
 
 	psz = iparam->param;
 	l = iparam->lenStr;
-	if((int) l > iMaxLine)
+	/* binary records must not be truncated, they carry their own length */
+	if((int) l > iMaxLine && pData->tcp_framing != TCP_FRAMING_BINARY)
 		l = iMaxLine;
 
 #	ifdef	USE_NETZIP
@@ -824,14 +1677,18 @@ processMsg(wrkrInstanceData_t *__restrict__ const pWrkrData,
 
 	if(pData->protocol == FORW_UDP) {
 		/* forward via UDP */
-		CHKiRet(UDPSend(pWrkrData, psz, l));
+#		ifdef HAVE_SENDMMSG
+		CHKiRet(UDPQueue(pTarget, psz, l));
+#		else
+		CHKiRet(UDPSend(pTarget, psz, l));
+#		endif
 	} else {
 		/* forward via TCP */
-		iRet = tcpclt.Send(pWrkrData->pTCPClt, pWrkrData, (char *)psz, l);
+		iRet = tcpclt.Send(pTarget->pTCPClt, pTarget, (char *)psz, l);
 		if(iRet != RS_RET_OK && iRet != RS_RET_DEFER_COMMIT && iRet != RS_RET_PREVIOUS_COMMITTED) {
 			/* error! */
 			dbgprintf("error forwarding via tcp, suspending\n");
-			DestructTCPInstanceData(pWrkrData);
+			DestructTCPInstanceData(pTarget);
 			iRet = RS_RET_SUSPENDED;
 		}
 	}
@@ -842,26 +1699,62 @@ finalize_it:
 	RETiRet;
 }
 
-BEGINcommitTransaction
+/* send all messages of a transaction to one target */
+static rsRetVal
+sendBatch(targetData_t *const pTarget, actWrkrIParams_t *const pParams, const unsigned nParams)
+{
 	unsigned i;
-CODESTARTcommitTransaction
-	CHKiRet(doTryResume(pWrkrData));
+	DEFiRet;
+
+	/* discard leftovers of a failed transaction, it is retried as whole */
+	pTarget->offsSndBuf = 0;
+#	ifdef HAVE_SENDMMSG
+	pTarget->nUdpMsgs = 0;
+	pTarget->offsUdpBuf = 0;
+#	endif
+	CHKiRet(doTryResume(pTarget));
 
-	dbgprintf(" %s:%s/%s\n", pWrkrData->pData->target, pWrkrData->pData->port,
-		 pWrkrData->pData->protocol == FORW_UDP ? "udp" : "tcp");
+	dbgprintf(" %s:%s/%s\n", pTarget->pDesc->target, getPort(pTarget),
+		 pTarget->pData->protocol == FORW_UDP ? "udp" : "tcp");
 
 	for(i = 0 ; i < nParams ; ++i) {
-		iRet = processMsg(pWrkrData, &actParam(pParams, 1, i, 0));
+		iRet = processMsg(pTarget, &actParam(pParams, 1, i, 0));
 		if(iRet != RS_RET_OK && iRet != RS_RET_DEFER_COMMIT && iRet != RS_RET_PREVIOUS_COMMITTED)
 			FINALIZE;
 	}
 
-dbgprintf("omfwd: endTransaction, offsSndBuf %u, iRet %d\n", pWrkrData->offsSndBuf, iRet);
-	if(pWrkrData->offsSndBuf != 0) {
-		iRet = TCPSendBuf(pWrkrData, pWrkrData->sndBuf, pWrkrData->offsSndBuf, IS_FLUSH);
-		pWrkrData->offsSndBuf = 0;
+dbgprintf("omfwd: endTransaction, offsSndBuf %u, iRet %d\n", pTarget->offsSndBuf, iRet);
+#	ifdef HAVE_SENDMMSG
+	if(pTarget->nUdpMsgs != 0)
+		CHKiRet(UDPFlush(pTarget));
+#	endif
+	if(pTarget->offsSndBuf != 0) {
+		iRet = TCPSendBuf(pTarget, pTarget->sndBuf, pTarget->offsSndBuf, IS_FLUSH);
+		pTarget->offsSndBuf = 0;
 	}
 finalize_it:
+	RETiRet;
+}
+
+
+/* With multiple targets, a transaction that could not be sent is retried
+ * on the next target, so a failed target does not suspend the action.
+ * Note that with TCP, part of the transaction may already have been
+ * received by the failed target - this may lead to some duplication.
+ */
+BEGINcommitTransaction
+	targetData_t *pTarget;
+	int nTries;
+CODESTARTcommitTransaction
+	for(nTries = 0 ; nTries < pWrkrData->pData->nTargets ; ++nTries) {
+		pTarget = selectTarget(pWrkrData);
+		iRet = sendBatch(pTarget, pParams, nParams);
+		releaseTarget(pTarget, iRet == RS_RET_SUSPENDED);
+		if(iRet != RS_RET_SUSPENDED)
+			break;
+		if(pTarget->pData->protocol == FORW_UDP)
+			closeUDPSockets(pTarget); /* re-resolve on next use */
+	}
 ENDcommitTransaction
 
 
@@ -886,22 +1779,22 @@ finalize_it:
  * created.
  */
 static rsRetVal
-initTCP(wrkrInstanceData_t *pWrkrData)
+initTCP(targetData_t *pTarget)
 {
 	instanceData *pData;
 	DEFiRet;
 
-	pData = pWrkrData->pData;
+	pData = pTarget->pData;
 	if(pData->protocol == FORW_TCP) {
 		/* create our tcpclt */
-		CHKiRet(tcpclt.Construct(&pWrkrData->pTCPClt));
-		CHKiRet(tcpclt.SetResendLastOnRecon(pWrkrData->pTCPClt, pData->bResendLastOnRecon));
+		CHKiRet(tcpclt.Construct(&pTarget->pTCPClt));
+		CHKiRet(tcpclt.SetResendLastOnRecon(pTarget->pTCPClt, pData->bResendLastOnRecon));
 		/* and set callbacks */
-		CHKiRet(tcpclt.SetSendInit(pWrkrData->pTCPClt, TCPSendInit));
-		CHKiRet(tcpclt.SetSendFrame(pWrkrData->pTCPClt, TCPSendFrame));
-		CHKiRet(tcpclt.SetSendPrepRetry(pWrkrData->pTCPClt, TCPSendPrepRetry));
-		CHKiRet(tcpclt.SetFraming(pWrkrData->pTCPClt, pData->tcp_framing));
-		CHKiRet(tcpclt.SetRebindInterval(pWrkrData->pTCPClt, pData->iRebindInterval));
+		CHKiRet(tcpclt.SetSendInit(pTarget->pTCPClt, TCPSendInit));
+		CHKiRet(tcpclt.SetSendFrame(pTarget->pTCPClt, TCPSendFrame));
+		CHKiRet(tcpclt.SetSendPrepRetry(pTarget->pTCPClt, TCPSendPrepRetry));
+		CHKiRet(tcpclt.SetFraming(pTarget->pTCPClt, pData->tcp_framing));
+		CHKiRet(tcpclt.SetRebindInterval(pTarget->pTCPClt, pData->iRebindInterval));
 	}
 finalize_it:
 	RETiRet;
@@ -930,7 +1823,7 @@ BEGINnewActInst
 	struct cnfparamvals *pvals;
 	uchar *tplToUse;
 	char *cstr;
-	int i;
+	int i, j;
 	rsRetVal localRet;
 	int complevel = -1;
 CODESTARTnewActInst
@@ -955,7 +1848,31 @@ CODESTARTnewActInst
 		if(!pvals[i].bUsed)
 			continue;
 		if(!strcmp(actpblk.descr[i].name, "target")) {
-			pData->target = es_str2cstr(pvals[i].val.d.estr, NULL);
+			for(j = 0 ; j < pvals[i].val.d.ar->nmemb ; ++j) {
+				cstr = es_str2cstr(pvals[i].val.d.ar->arr[j], NULL);
+				localRet = addTargetSpec(pData, cstr);
+				if(localRet != RS_RET_OK) {
+					errmsg.LogError(0, RS_RET_PARAM_ERROR, "omfwd: invalid target "
+						"'%s'", cstr);
+				}
+				free(cstr);
+				CHKiRet(localRet);
+			}
+		} else if(!strcmp(actpblk.descr[i].name, "pool.distribution")) {
+			if(!es_strconstcmp(pvals[i].val.d.estr, "roundrobin")) {
+				pData->distribution = FWD_DISTR_ROUNDROBIN;
+			} else if(!es_strconstcmp(pvals[i].val.d.estr, "leastloaded")) {
+				pData->distribution = FWD_DISTR_LEASTLOADED;
+			} else {
+				cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+				errmsg.LogError(0, RS_RET_PARAM_ERROR, "omfwd: invalid value for "
+					"'pool.distribution' '%s' - ignored", cstr);
+				free(cstr);
+			}
+		} else if(!strcmp(actpblk.descr[i].name, "pool.resumeinterval")) {
+			pData->iPoolResumeInterval = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "tcp.pipeline.size")) {
+			pData->pipelineSize = (size_t) pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "port")) {
 			pData->port = es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(actpblk.descr[i].name, "protocol")) {
@@ -982,6 +1899,8 @@ CODESTARTnewActInst
 				pData->tcp_framing = TCP_FRAMING_OCTET_STUFFING;
 			} else if(!es_strcasebufcmp(pvals[i].val.d.estr, (uchar*)"octet-counted", 13)) {
 				pData->tcp_framing = TCP_FRAMING_OCTET_COUNTING;
+			} else if(!es_strcasebufcmp(pvals[i].val.d.estr, (uchar*)"binary", 6)) {
+				pData->tcp_framing = TCP_FRAMING_BINARY;
 			} else {
 				uchar *str;
 				str = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
@@ -1071,6 +1990,26 @@ CODESTARTnewActInst
 		}
 	}
 
+	if(pData->nTargets == 0) {
+		errmsg.LogError(0, RS_RET_MISSING_CNFPARAMS, "omfwd: no target given");
+		ABORT_FINALIZE(RS_RET_MISSING_CNFPARAMS);
+	}
+	if(pData->port == NULL)
+		CHKmalloc(pData->port = strdup("514"));
+	if(pData->pipelineSize > 0) {
+#		ifdef HAVE_EPOLL_CREATE
+		if(pData->protocol != FORW_TCP || pData->iStrmDrvrMode != 0) {
+			errmsg.LogError(0, RS_RET_PARAM_ERROR, "omfwd: tcp.pipeline.size is only "
+				"supported for plain TCP, using blocking sends");
+			pData->pipelineSize = 0;
+		}
+#		else
+		errmsg.LogError(0, RS_RET_PARAM_ERROR, "omfwd: tcp.pipeline.size is not "
+			"supported on this platform, using blocking sends");
+		pData->pipelineSize = 0;
+#		endif
+	}
+
 	if(complevel != -1) {
 		pData->compressionLevel = complevel;
 		if(pData->compressionMode == COMPRESS_NEVER) {
@@ -1080,6 +2019,26 @@ CODESTARTnewActInst
 			pData->compressionMode = COMPRESS_SINGLE_MSG;
 		}
 	}
+	if(pData->tcp_framing == TCP_FRAMING_BINARY) {
+		/* binary records are only understood by the receiver if they arrive
+		 * unmodified, so the template and single-message compression do not
+		 * apply. Stream compression is transparent and can be used.
+		 */
+		if(pData->protocol != FORW_TCP) {
+			errmsg.LogError(0, RS_RET_CNF_INVLD_FRAMING, "omfwd: tcp_framing "
+					"\"binary\" requires protocol \"tcp\"");
+			ABORT_FINALIZE(RS_RET_CNF_INVLD_FRAMING);
+		}
+		if(pData->tplName != NULL
+		   && strcmp((char*) pData->tplName, "RSYSLOG_BinaryForwardFormat")) {
+			errmsg.LogError(0, RS_RET_PARAM_ERROR, "omfwd: template \"%s\" is ignored "
+					"with tcp_framing \"binary\"", pData->tplName);
+		}
+		free(pData->tplName);
+		CHKmalloc(pData->tplName = ustrdup(UCHAR_CONSTANT("RSYSLOG_BinaryForwardFormat")));
+		if(pData->compressionMode == COMPRESS_SINGLE_MSG)
+			pData->compressionMode = COMPRESS_NEVER;
+	}
 
 	CODE_STD_STRING_REQUESTnewActInst(1)
 
@@ -1228,10 +2187,10 @@ CODE_STD_STRING_REQUESTparseSelectorAct(1)
 	if(*p == ';' || *p == '#' || isspace(*p)) {
 		uchar cTmp = *p;
 		*p = '\0'; /* trick to obtain hostname (later)! */
-		CHKmalloc(pData->target = strdup((char*) q));
+		CHKiRet(addTarget(pData, (char*) q, NULL));
 		*p = cTmp;
 	} else {
-		CHKmalloc(pData->target = strdup((char*) q));
+		CHKiRet(addTarget(pData, (char*) q, NULL));
 	}
 
 	/* copy over config data as needed */
@@ -42,7 +42,11 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
 #include <sys/file.h>
+#include <sys/uio.h>
 
 #include "syslogd.h"
 #include "syslogd-types.h"
@@ -54,6 +58,9 @@
 #include "module-template.h"
 #include "conf.h"
 #include "errmsg.h"
+#include "unicode-helper.h"
+#include "statsobj.h"
+#include "debug.h"
 
 MODULE_TYPE_OUTPUT
 MODULE_TYPE_NOKEEP
@@ -63,7 +70,39 @@ MODULE_CNFNAME("ompipe")
  */
 DEF_OMOD_STATIC_DATA
 DEFobjCurrIf(errmsg)
-
+DEFobjCurrIf(statsobj)
+
+#define PIPE_IOV_MAX 2		/* the buffer ring has at most two pieces */
+
+/* what to do if the buffer is full (buffer.overflow) */
+typedef enum {
+	PIPE_OVERFLOW_SUSPEND = 0,	/* suspend the action until there is room */
+	PIPE_OVERFLOW_DROPOLDEST = 1,	/* discard the oldest (not yet written) messages */
+	PIPE_OVERFLOW_DROPNEWEST = 2	/* discard the message that does not fit */
+} pipeOverflow_t;
+
+/* With buffer.size, messages are not written by doAction(), but appended to
+ * a byte ring of that size, which is written with a single writev() at the
+ * end of each transaction. The pipe is non-blocking, so if the reader does
+ * not keep up, what could not be written stays in the ring and is written
+ * by a flusher thread as soon as the pipe accepts data again. The ring thus
+ * absorbs slow readers up to its size, after which the overflow policy
+ * applies. The lengths of the records in the ring are kept in a second ring,
+ * as dropping the oldest messages needs the record boundaries. The record at
+ * the start of the ring may be partially written, it is never dropped.
+ * Everything is guarded by mutWrite.
+ */
+typedef struct pipeBuf_s {
+	uchar	*buf;
+	size_t	size;		/* size of buf (buffer.size) */
+	size_t	head;		/* offset of next octet to write */
+	size_t	used;		/* octets in the ring */
+	size_t	*lens;		/* ring of record lengths */
+	int	maxRecs;	/* size of lens */
+	int	headRec;	/* index of first record */
+	int	nRecs;		/* nbr of records in the ring */
+	size_t	doneHeadRec;	/* octets of the first record already written */
+} pipeBuf_t;
 
 typedef struct _instanceData {
 	uchar	*pipe;	/* pipe or template name (display only) */
@@ -71,6 +110,15 @@ typedef struct _instanceData {
 	short	fd;		/* pipe descriptor for (current) pipe */
 	pthread_mutex_t mutWrite; /* guard against multiple instances writing to same pipe */
 	sbool	bHadError;	/* did we already have/report an error on this pipe? */
+	pipeBuf_t ring;		/* buffered messages, only with buffer.size */
+	pipeOverflow_t overflow;
+	pthread_t flusherID;
+	pthread_cond_t condFlush; /* signalled to the flusher: work to do or stop */
+	sbool	bFlusherRunning;
+	sbool	bStopFlusher;
+	statsobj_t *stats;
+	intctr_t ctrDropped;	/* counters are guarded by mutWrite */
+	intctr_t ctrSuspended;
 } instanceData;
 
 typedef struct wrkrInstanceData {
@@ -96,7 +144,9 @@ static struct cnfparamblk modpblk =
 /* action (instance) parameters */
 static struct cnfparamdescr actpdescr[] = {
 	{ "pipe", eCmdHdlrString, CNFPARAM_REQUIRED },
-	{ "template", eCmdHdlrGetWord, 0 }
+	{ "template", eCmdHdlrGetWord, 0 },
+	{ "buffer.size", eCmdHdlrSize, 0 },
+	{ "buffer.overflow", eCmdHdlrGetWord, 0 }
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -211,6 +261,225 @@ finalize_it:
 }
 
 
+/* write as much of the ring as the pipe accepts. A full pipe is not an
+ * error, the rest is written later. Must be called with mutWrite locked.
+ */
+static void
+pipeBufFlush(instanceData *pData)
+{
+	pipeBuf_t *pRing = &pData->ring;
+	struct iovec iov[PIPE_IOV_MAX];
+	int nIov;
+	ssize_t lenWritten;
+	size_t n;
+	size_t lenRec;
+	char errStr[1024];
+
+	while(pRing->used > 0 && pData->fd != -1) {
+		iov[0].iov_base = pRing->buf + pRing->head;
+		iov[0].iov_len = pRing->size - pRing->head;
+		if(iov[0].iov_len >= pRing->used) {
+			iov[0].iov_len = pRing->used;
+			nIov = 1;
+		} else {
+			iov[1].iov_base = pRing->buf;
+			iov[1].iov_len = pRing->used - iov[0].iov_len;
+			nIov = 2;
+		}
+		lenWritten = writev(pData->fd, iov, nIov);
+		if(lenWritten < 0) {
+			if(errno == EINTR)
+				continue;
+			if(errno == EAGAIN)
+				break; /* pipe full, retried later */
+			rs_strerror_r(errno, errStr, sizeof(errStr));
+			DBGPRINTF("pipe (%d) write error: %s\n", pData->fd, errStr);
+			errmsg.LogError(0, RS_RET_ERR_WRITE_PIPE, "error writing to pipe '%s', reopening it: %s",
+					pData->pipe, errStr);
+			close(pData->fd);
+			pData->fd = -1;
+			break;
+		}
+		pRing->head = (pRing->head + lenWritten) % pRing->size;
+		pRing->used -= lenWritten;
+		/* remove the records that were written completely */
+		for(n = lenWritten ; n > 0 ; ) {
+			lenRec = pRing->lens[pRing->headRec] - pRing->doneHeadRec;
+			if(n < lenRec) {
+				pRing->doneHeadRec += n;
+				break;
+			}
+			n -= lenRec;
+			pRing->doneHeadRec = 0;
+			pRing->headRec = (pRing->headRec + 1) % pRing->maxRecs;
+			--pRing->nRecs;
+		}
+	}
+}
+
+
+/* drop the oldest record, which must not be partially written */
+static void
+pipeBufDropOldest(instanceData *pData)
+{
+	pipeBuf_t *pRing = &pData->ring;
+	const size_t lenRec = pRing->lens[pRing->headRec];
+
+	pRing->head = (pRing->head + lenRec) % pRing->size;
+	pRing->used -= lenRec;
+	pRing->headRec = (pRing->headRec + 1) % pRing->maxRecs;
+	--pRing->nRecs;
+	++pData->ctrDropped;
+}
+
+
+/* append a record to the ring, applying the overflow policy if it does not
+ * fit. Must be called with mutWrite locked.
+ */
+static rsRetVal
+pipeBufAppend(instanceData *pData, uchar *pRec, size_t lenRec)
+{
+	pipeBuf_t *pRing = &pData->ring;
+	size_t *newLens;
+	size_t tail;
+	size_t lenCopy;
+	int i;
+	DEFiRet;
+
+	if(lenRec == 0)
+		FINALIZE;
+	if(lenRec > pRing->size) {
+		/* can never be buffered, so there is no point in suspending */
+		DBGPRINTF("ompipe: message of %zu octets larger than buffer.size, discarded\n", lenRec);
+		++pData->ctrDropped;
+		FINALIZE;
+	}
+
+	if(pRing->size - pRing->used < lenRec)
+		pipeBufFlush(pData);
+	if(pData->overflow == PIPE_OVERFLOW_DROPOLDEST) {
+		while(pRing->size - pRing->used < lenRec && pRing->nRecs > 0 && pRing->doneHeadRec == 0)
+			pipeBufDropOldest(pData);
+	}
+	if(pRing->size - pRing->used < lenRec) {
+		if(pData->overflow == PIPE_OVERFLOW_SUSPEND) {
+			++pData->ctrSuspended;
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		}
+		/* drop newest - also with dropoldest if the oldest record is
+		 * partially written, as it can not be dropped
+		 */
+		++pData->ctrDropped;
+		FINALIZE;
+	}
+
+	if(pRing->nRecs == pRing->maxRecs) {
+		/* grow the length ring, keeping the records in order */
+		CHKmalloc(newLens = malloc(2 * pRing->maxRecs * sizeof(size_t)));
+		for(i = 0 ; i < pRing->nRecs ; ++i)
+			newLens[i] = pRing->lens[(pRing->headRec + i) % pRing->maxRecs];
+		free(pRing->lens);
+		pRing->lens = newLens;
+		pRing->maxRecs *= 2;
+		pRing->headRec = 0;
+	}
+
+	tail = (pRing->head + pRing->used) % pRing->size;
+	lenCopy = pRing->size - tail;
+	if(lenCopy > lenRec)
+		lenCopy = lenRec;
+	memcpy(pRing->buf + tail, pRec, lenCopy);
+	memcpy(pRing->buf, pRec + lenCopy, lenRec - lenCopy);
+	pRing->used += lenRec;
+	pRing->lens[(pRing->headRec + pRing->nRecs) % pRing->maxRecs] = lenRec;
+	++pRing->nRecs;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* the flusher thread writes what is left in the ring after a transaction,
+ * as soon as the pipe accepts data again.
+ */
+static void *
+pipeFlusher(void *arg)
+{
+	instanceData *pData = (instanceData*) arg;
+	struct pollfd pfd;
+	struct timespec t;
+	sigset_t sigSet;
+
+	sigfillset(&sigSet);
+	pthread_sigmask(SIG_BLOCK, &sigSet, NULL);
+	dbgSetThrdName((uchar*) "ompipe flusher");
+
+	pthread_mutex_lock(&pData->mutWrite);
+	while(!pData->bStopFlusher) {
+		if(pData->ring.used == 0) {
+			pthread_cond_wait(&pData->condFlush, &pData->mutWrite);
+			continue;
+		}
+		if(pData->fd == -1) {
+			preparePipe(pData);
+			if(pData->fd == -1) {
+				timeoutComp(&t, 1000);
+				pthread_cond_timedwait(&pData->condFlush, &pData->mutWrite, &t);
+				continue;
+			}
+		}
+		pfd.fd = pData->fd;
+		pfd.events = POLLOUT;
+		pthread_mutex_unlock(&pData->mutWrite);
+		poll(&pfd, 1, 1000);
+		pthread_mutex_lock(&pData->mutWrite);
+		pipeBufFlush(pData);
+	}
+	pthread_mutex_unlock(&pData->mutWrite);
+	return NULL;
+}
+
+
+/* make sure the ring is written soon, called with mutWrite locked */
+static void
+pipeBufKick(instanceData *pData)
+{
+	int r;
+
+	if(pData->bFlusherRunning) {
+		pthread_cond_signal(&pData->condFlush);
+		return;
+	}
+	if((r = pthread_create(&pData->flusherID, NULL, pipeFlusher, pData)) != 0) {
+		/* the ring is then written with the next transaction */
+		DBGPRINTF("ompipe: could not start flusher thread for '%s', error %d\n", pData->pipe, r);
+		return;
+	}
+	pData->bFlusherRunning = 1;
+}
+
+
+static rsRetVal
+setupInstStatsCtrs(instanceData *pData)
+{
+	uchar ctrName[512];
+	DEFiRet;
+
+	snprintf((char*)ctrName, sizeof(ctrName), "ompipe(%s)", pData->pipe);
+	ctrName[sizeof(ctrName)-1] = '\0'; /* be on the save side */
+	CHKiRet(statsobj.Construct(&(pData->stats)));
+	CHKiRet(statsobj.SetName(pData->stats, ctrName));
+	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("dropped"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pData->ctrDropped)));
+	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("suspended"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pData->ctrSuspended)));
+	CHKiRet(statsobj.ConstructFinalize(pData->stats));
+
+finalize_it:
+	RETiRet;
+}
+
+
 BEGINbeginCnfLoad
 CODESTARTbeginCnfLoad
 	loadModConf = pModConf;
@@ -281,7 +550,15 @@ CODESTARTcreateInstance
 	pData->pipe = NULL;
 	pData->fd = -1;
 	pData->bHadError = 0;
+	memset(&pData->ring, 0, sizeof(pData->ring));
+	pData->overflow = PIPE_OVERFLOW_SUSPEND;
+	pData->bFlusherRunning = 0;
+	pData->bStopFlusher = 0;
+	pData->stats = NULL;
+	pData->ctrDropped = 0;
+	pData->ctrSuspended = 0;
 	pthread_mutex_init(&pData->mutWrite, NULL);
+	pthread_cond_init(&pData->condFlush, NULL);
 ENDcreateInstance
 
 
@@ -292,6 +569,24 @@ ENDcreateWrkrInstance
 
 BEGINfreeInstance
 CODESTARTfreeInstance
+	if(pData->bFlusherRunning) {
+		pthread_mutex_lock(&pData->mutWrite);
+		pData->bStopFlusher = 1;
+		pthread_cond_signal(&pData->condFlush);
+		pthread_mutex_unlock(&pData->mutWrite);
+		pthread_join(pData->flusherID, NULL);
+	}
+	if(pData->ring.used > 0) {
+		pipeBufFlush(pData); /* last chance, but we do not wait for the reader */
+		if(pData->ring.used > 0)
+			DBGPRINTF("ompipe: %d buffered messages for '%s' discarded\n",
+				  pData->ring.nRecs, pData->pipe);
+	}
+	free(pData->ring.buf);
+	free(pData->ring.lens);
+	if(pData->stats != NULL)
+		statsobj.Destruct(&pData->stats);
+	pthread_cond_destroy(&pData->condFlush);
 	pthread_mutex_destroy(&pData->mutWrite);
 	free(pData->pipe);
 	if(pData->fd != -1)
@@ -304,10 +599,28 @@ CODESTARTfreeWrkrInstance
 ENDfreeWrkrInstance
 
 
+/* with a buffer, we can resume as soon as the buffer has some room; the
+ * message that did not fit is then retried.
+ */
 BEGINtryResume
+	instanceData *pData = pWrkrData->pData;
 CODESTARTtryResume
+	if(pData->ring.size > 0) {
+		pthread_mutex_lock(&pData->mutWrite);
+		if(pData->fd == -1)
+			preparePipe(pData);
+		pipeBufFlush(pData);
+		if(pData->ring.used == pData->ring.size)
+			iRet = RS_RET_SUSPENDED;
+		pthread_mutex_unlock(&pData->mutWrite);
+	}
 ENDtryResume
 
+BEGINbeginTransaction
+CODESTARTbeginTransaction
+	/* we have nothing to do to begin a transaction */
+ENDbeginTransaction
+
 BEGINdoAction
 	instanceData *pData;
 CODESTARTdoAction
@@ -315,10 +628,31 @@ CODESTARTdoAction
 	DBGPRINTF("ompipe: writing to %s\n", pData->pipe);
 	/* this module is single-threaded by nature */
 	pthread_mutex_lock(&pData->mutWrite);
-	iRet = writePipe(ppString, pData);
+	if(pData->ring.size == 0) {
+		iRet = writePipe(ppString, pData);
+	} else {
+		if(pData->fd == -1)
+			preparePipe(pData); /* if that fails, we buffer */
+		iRet = pipeBufAppend(pData, ppString[0], strlen((char*)ppString[0]));
+		if(iRet == RS_RET_OK)
+			iRet = RS_RET_DEFER_COMMIT;
+	}
 	pthread_mutex_unlock(&pData->mutWrite);
 ENDdoAction
 
+/* a transaction is written with as few writev() calls as possible */
+BEGINendTransaction
+	instanceData *pData = pWrkrData->pData;
+CODESTARTendTransaction
+	if(pData->ring.size > 0) {
+		pthread_mutex_lock(&pData->mutWrite);
+		pipeBufFlush(pData);
+		if(pData->ring.used > 0)
+			pipeBufKick(pData);
+		pthread_mutex_unlock(&pData->mutWrite);
+	}
+ENDendTransaction
+
 
 static inline void
 setInstParamDefaults(instanceData *pData)
@@ -328,6 +662,7 @@ setInstParamDefaults(instanceData *pData)
 
 BEGINnewActInst
 	struct cnfparamvals *pvals;
+	char *cstr;
 	int i;
 CODESTARTnewActInst
 	if((pvals = nvlstGetParams(lst, &actpblk, NULL)) == NULL) {
@@ -345,6 +680,21 @@ CODESTARTnewActInst
 			pData->pipe = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(actpblk.descr[i].name, "template")) {
 			pData->tplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "buffer.size")) {
+			pData->ring.size = (size_t) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "buffer.overflow")) {
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+			if(!strcasecmp(cstr, "suspend")) {
+				pData->overflow = PIPE_OVERFLOW_SUSPEND;
+			} else if(!strcasecmp(cstr, "dropoldest")) {
+				pData->overflow = PIPE_OVERFLOW_DROPOLDEST;
+			} else if(!strcasecmp(cstr, "dropnewest")) {
+				pData->overflow = PIPE_OVERFLOW_DROPNEWEST;
+			} else {
+				errmsg.LogError(0, RS_RET_PARAM_ERROR, "ompipe: invalid buffer.overflow "
+						"mode '%s', using 'suspend'", cstr);
+			}
+			free(cstr);
 		} else {
 			dbgprintf("ompipe: program error, non-handled "
 			  "param '%s'\n", actpblk.descr[i].name);
@@ -354,6 +704,12 @@ CODESTARTnewActInst
 	CHKiRet(OMSRsetEntry(*ppOMSR, 0, (uchar*)strdup((pData->tplName == NULL) ? 
 						"RSYSLOG_ForwardFormat" : (char*)pData->tplName),
 						OMSR_NO_RQD_TPL_OPTS));
+	if(pData->ring.size > 0) {
+		CHKmalloc(pData->ring.buf = malloc(pData->ring.size));
+		pData->ring.maxRecs = 64;
+		CHKmalloc(pData->ring.lens = malloc(pData->ring.maxRecs * sizeof(size_t)));
+		CHKiRet(setupInstStatsCtrs(pData));
+	}
 	/* Old flawed template code
 	if(pData->tplName == NULL) {
 		CHKiRet(OMSRsetEntry(*ppOMSR, 0, (uchar*) "RSYSLOG_FileFormat",
@@ -397,15 +753,18 @@ ENDparseSelectorAct
 
 BEGINdoHUP
 CODESTARTdoHUP
+	pthread_mutex_lock(&pData->mutWrite);
 	if(pData->fd != -1) {
 		close(pData->fd);
 		pData->fd = -1;
 	}
+	pthread_mutex_unlock(&pData->mutWrite);
 ENDdoHUP
 
 
 BEGINmodExit
 CODESTARTmodExit
+	objRelease(statsobj, CORE_COMPONENT);
 ENDmodExit
 
 
@@ -414,6 +773,7 @@ CODESTARTqueryEtryPt
 CODEqueryEtryPt_STD_OMOD_QUERIES
 CODEqueryEtryPt_STD_OMOD8_QUERIES
 CODEqueryEtryPt_doHUP
+CODEqueryEtryPt_TXIF_OMOD_QUERIES
 CODEqueryEtryPt_STD_CONF2_QUERIES
 CODEqueryEtryPt_STD_CONF2_CNFNAME_QUERIES 
 CODEqueryEtryPt_STD_CONF2_setModCnf_QUERIES
@@ -427,6 +787,7 @@ INITLegCnfVars
 	*ipIFVersProvided = CURR_MOD_IF_VERSION; /* we only support the current interface specification */
 CODEmodInit_QueryRegCFSLineHdlr
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 ENDmodInit
 /* vi:set ai:
  */
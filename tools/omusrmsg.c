@@ -35,6 +35,8 @@
 #include <assert.h>
 #include <signal.h>
 #include <ctype.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/param.h>
 #ifdef HAVE_UTMP_H
 #  include <utmp.h>
@@ -70,6 +72,13 @@
 #ifndef _PATH_DEV
 #	define _PATH_DEV	"/dev/"
 #endif
+#if defined(_PATH_UTMP)
+#	define UTMP_PATH _PATH_UTMP
+#elif defined(_PATH_UTMPX)
+#	define UTMP_PATH _PATH_UTMPX
+#else
+#	define UTMP_PATH "/var/run/utmp"
+#endif
 
 
 MODULE_TYPE_OUTPUT
@@ -96,6 +105,25 @@ typedef struct configSettings_s {
 } configSettings_t;
 static configSettings_t __attribute__((unused)) cs;
 
+/* Snapshot of the logged-in users, so that we do not need to scan the
+ * utmp file for each message. It is re-read when utmp has changed, which
+ * is checked at most once per second. The mutex also serializes access
+ * to getutent(), which is not thread-safe.
+ */
+typedef struct utmpEntry_s {
+	char name[UNAMESZ+1];
+	char line[sizeof(((STRUCTUTMP*)0)->ut_line)+1];
+} utmpEntry_t;
+static struct {
+	pthread_mutex_t mut;
+	utmpEntry_t *entries;
+	int nEntries;
+	int maxEntries;
+	time_t tLastCheck;	/* when we last checked if utmp changed */
+	struct stat st;		/* utmp file state at last read */
+	int bValid;
+} utmpCache = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, {0}, 0 };
+
 
 /* tables for interfacing with the v6 config system */
 /* action (instance) parameters */
@@ -192,6 +220,73 @@ void endutent(void)
 #endif  /* #ifdef OS_BSD */
 
 
+/* re-read the utmp snapshot, if utmp has changed since it was last read.
+ * Must be called with the cache mutex locked.
+ */
+static rsRetVal
+refreshUtmpCache(void)
+{
+	STRUCTUTMP *uptr;
+	struct stat st;
+	utmpEntry_t *pNew;
+	time_t tNow;
+	int bChanged;
+	DEFiRet;
+
+	time(&tNow);
+	if(utmpCache.bValid && tNow == utmpCache.tLastCheck)
+		FINALIZE;
+	utmpCache.tLastCheck = tNow;
+	if(stat(UTMP_PATH, &st) == 0) {
+		bChanged = !utmpCache.bValid
+			|| st.st_mtime != utmpCache.st.st_mtime
+			|| st.st_size != utmpCache.st.st_size
+			|| st.st_ino != utmpCache.st.st_ino;
+	} else {
+		memset(&st, 0, sizeof(st));
+		bChanged = 1; /* no way to tell, so always re-read */
+	}
+	if(!bChanged)
+		FINALIZE;
+
+	DBGPRINTF("omusrmsg: (re-)reading %s\n", UTMP_PATH);
+	utmpCache.bValid = 0;
+	utmpCache.nEntries = 0;
+	setutent();
+	while((uptr = getutent())) {
+		/* is this slot used? */
+		if(uptr->UTNAME[0] == '\0')
+			continue;
+#ifndef OS_BSD
+		if(uptr->ut_type != USER_PROCESS)
+			continue;
+#endif
+		if(!(strncmp (uptr->UTNAME,"LOGIN", 6))) /* paranoia */
+			continue;
+		if(utmpCache.nEntries == utmpCache.maxEntries) {
+			pNew = realloc(utmpCache.entries, (utmpCache.maxEntries + 16) * sizeof(utmpEntry_t));
+			if(pNew == NULL) {
+				endutent();
+				ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+			}
+			utmpCache.entries = pNew;
+			utmpCache.maxEntries += 16;
+		}
+		strncpy(utmpCache.entries[utmpCache.nEntries].name, uptr->UTNAME, UNAMESZ);
+		utmpCache.entries[utmpCache.nEntries].name[UNAMESZ] = '\0';
+		strncpy(utmpCache.entries[utmpCache.nEntries].line, uptr->ut_line, sizeof(uptr->ut_line));
+		utmpCache.entries[utmpCache.nEntries].line[sizeof(uptr->ut_line)] = '\0';
+		++utmpCache.nEntries;
+	}
+	endutent();
+	memcpy(&utmpCache.st, &st, sizeof(st));
+	utmpCache.bValid = 1;
+
+finalize_it:
+	RETiRet;
+}
+
+
 /*  WALLMSG -- Write a message to the world at large
  *
  *	Write the specified message to either the entire
@@ -208,34 +303,26 @@ static rsRetVal wallmsg(uchar* pMsg, instanceData *pData)
 {
   
 	uchar szErr[512];
-	char p[sizeof(_PATH_DEV) + UNAMESZ];
+	char p[sizeof(_PATH_DEV) + sizeof(((utmpEntry_t*)0)->line)];
 	register int i;
+	int iEntry;
 	int errnoSave;
 	int ttyf;
 	int wrRet;
-	STRUCTUTMP ut;
-	STRUCTUTMP *uptr;
+	size_t lenMsg;
+	utmpEntry_t *pEntry;
 	struct stat statb;
 	DEFiRet;
 
 	assert(pMsg != NULL);
+	lenMsg = strlen((char*)pMsg);
 
-	/* open the user login file */
-	setutent();
-
-	/* scan the user login file */
-	while((uptr = getutent())) {
-		memcpy(&ut, uptr, sizeof(ut));
-		/* is this slot used? */
-		if(ut.UTNAME[0] == '\0')
-			continue;
-#ifndef OS_BSD
-		if(ut.ut_type != USER_PROCESS)
-			continue;
-#endif
-		if(!(strncmp (ut.UTNAME,"LOGIN", 6))) /* paranoia */
-			continue;
+	pthread_mutex_lock(&utmpCache.mut);
+	CHKiRet(refreshUtmpCache());
 
+	/* scan the logged-in users */
+	for(iEntry = 0 ; iEntry < utmpCache.nEntries ; ++iEntry) {
+		pEntry = utmpCache.entries + iEntry;
 		/* should we send the message to this user? */
 		if(pData->bIsWall == 0) {
 			for(i = 0; i < MAXUNAMES; i++) {
@@ -243,7 +330,7 @@ static rsRetVal wallmsg(uchar* pMsg, instanceData *pData)
 					i = MAXUNAMES;
 					break;
 				}
-				if(strncmp(pData->uname[i], ut.UTNAME, UNAMESZ) == 0)
+				if(strncmp(pData->uname[i], pEntry->name, UNAMESZ) == 0)
 					break;
 			}
 			if(i == MAXUNAMES) /* user not found? */
@@ -252,7 +339,7 @@ static rsRetVal wallmsg(uchar* pMsg, instanceData *pData)
 
 		/* compute the device name */
 		strcpy(p, _PATH_DEV);
-		strncat(p, ut.ut_line, UNAMESZ);
+		strcat(p, pEntry->line);
 
 		/* we must be careful when writing to the terminal. A terminal may block
 		 * (for example, a user has pressed <ctl>-s). In that case, we can not
@@ -264,7 +351,7 @@ static rsRetVal wallmsg(uchar* pMsg, instanceData *pData)
 		/* open the terminal */
 		if((ttyf = open(p, O_WRONLY|O_NOCTTY|O_NONBLOCK)) >= 0) {
 			if(fstat(ttyf, &statb) == 0 && (statb.st_mode & S_IWRITE)) {
-				wrRet = write(ttyf, pMsg, strlen((char*)pMsg));
+				wrRet = write(ttyf, pMsg, lenMsg);
 				if(Debug && wrRet == -1) {
 					/* we record the state to the debug log */
 					errnoSave = errno;
@@ -277,8 +364,8 @@ static rsRetVal wallmsg(uchar* pMsg, instanceData *pData)
 		}
 	}
 
-	/* close the user login file */
-	endutent();
+finalize_it:
+	pthread_mutex_unlock(&utmpCache.mut);
 	RETiRet;
 }
 
@@ -443,6 +530,10 @@ ENDparseSelectorAct
 
 BEGINmodExit
 CODESTARTmodExit
+	free(utmpCache.entries);
+	utmpCache.entries = NULL;
+	utmpCache.nEntries = utmpCache.maxEntries = 0;
+	utmpCache.bValid = 0;
 ENDmodExit
 
 
@@ -32,6 +32,8 @@
 #include <assert.h>
 #include <errno.h>
 #include <ctype.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 #include "syslogd.h"
 #include "conf.h"
 #include "syslogd-types.h"
@@ -42,6 +44,7 @@
 #include "errmsg.h"
 #include "parser.h"
 #include "datetime.h"
+#include "prop.h"
 #include "unicode-helper.h"
 
 MODULE_TYPE_PARSER
@@ -60,6 +63,22 @@ DEFobjCurrIf(datetime)
 /* static data */
 static int bParseHOSTNAMEandTAG;	/* cache for the equally-named global param - performance enhancement */
 
+/* Timestamp shape cache. Senders practically never change the timestamp
+ * format they emit, so we remember the variant that matched last time for
+ * each sender and try it first. Each entry holds the upper bits of the
+ * sender hash plus the variant in the lower two bits. Entries are read and
+ * written without locking: a torn or stale entry merely results in a wrong
+ * guess, which the timestamp parser itself detects, after which the full
+ * detection sequence is run.
+ */
+#define TS_UNKNOWN	0	/* no timestamp found (or not yet known) */
+#define TS_3339		1
+#define TS_3164		2
+#define TS_3164_SP	3	/* RFC3164 timestamp preceded by a SP (seen from HP procurve) */
+#define TS_SHAPE_MASK	0x03
+#define SHAPE_CACHE_SIZE 4096	/* must be a power of 2 */
+static unsigned shapeCache[SHAPE_CACHE_SIZE];
+
 
 BEGINisCompatibleWithFeature
 CODESTARTisCompatibleWithFeature
@@ -70,12 +89,90 @@ CODESTARTisCompatibleWithFeature
 ENDisCompatibleWithFeature
 
 
+/* compute the key for the shape cache from the sender's IP address. As
+ * the parser runs before DNS resolution, the address is usually still in
+ * its unresolved form. Returns 0 if the sender is unknown, in which case
+ * the cache is not used.
+ */
+static inline unsigned
+getSenderKey(msg_t *pMsg)
+{
+	struct sockaddr_storage *pAddr;
+	uchar *p;
+	int len;
+	unsigned key = 5381;
+
+	if(pMsg->msgFlags & NEEDS_DNSRESOL) {
+		pAddr = pMsg->rcvFrom.pfrominet;
+		if(pAddr == NULL)
+			return 0;
+		if(pAddr->ss_family == AF_INET) {
+			p = (uchar*) &((struct sockaddr_in*) pAddr)->sin_addr;
+			len = sizeof(struct in_addr);
+		} else if(pAddr->ss_family == AF_INET6) {
+			p = (uchar*) &((struct sockaddr_in6*) pAddr)->sin6_addr;
+			len = sizeof(struct in6_addr);
+		} else {
+			return 0;
+		}
+	} else if(pMsg->pRcvFromIP != NULL) {
+		p = propGetSzStr(pMsg->pRcvFromIP);
+		len = pMsg->pRcvFromIP->len;
+	} else {
+		return 0;
+	}
+
+	while(len-- > 0)
+		key = ((key << 5) + key) ^ *p++;
+	return (key & ~TS_SHAPE_MASK) ? key : (key | 0x100);
+}
+
+
+/* try the timestamp variant that matched last time for this sender. The
+ * variants are mutually exclusive (3339 starts with a digit, 3164 with a
+ * letter and the malformed one with a SP), so if the remembered one matches,
+ * the full detection sequence would have selected the very same one.
+ */
+static int
+parseTIMESTAMPFast(msg_t *pMsg, uchar **pp2parse, int *pLenMsg, int tsShape)
+{
+	uchar *p2parse = *pp2parse;
+	int lenMsg = *pLenMsg;
+
+	switch(tsShape) {
+	case TS_3339:
+		return datetime.ParseTIMESTAMP3339(&(pMsg->tTIMESTAMP), pp2parse, pLenMsg) == RS_RET_OK;
+	case TS_3164:
+		if(datetime.ParseTIMESTAMP3164(&(pMsg->tTIMESTAMP), pp2parse, pLenMsg) != RS_RET_OK)
+			return 0;
+		if(pMsg->dfltTZ[0] != '\0')
+			applyDfltTZ(&pMsg->tTIMESTAMP, pMsg->dfltTZ);
+		return 1;
+	case TS_3164_SP:
+		if(lenMsg < 2 || *p2parse != ' ')
+			return 0;
+		++p2parse;
+		--lenMsg;
+		if(datetime.ParseTIMESTAMP3164(&(pMsg->tTIMESTAMP), &p2parse, &lenMsg) != RS_RET_OK)
+			return 0;
+		*pp2parse = p2parse;
+		*pLenMsg = lenMsg;
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+
 /* parse a legay-formatted syslog message.
  */
 BEGINparse
 	uchar *p2parse;
 	int lenMsg;
 	int i;	/* general index for parsing */
+	unsigned senderKey;
+	unsigned shape;
+	int tsShape = TS_UNKNOWN;
 	uchar bufParseTAG[CONF_TAG_MAXSIZE];
 	uchar bufParseHOSTNAME[CONF_HOSTNAME_MAXSIZE];
 CODESTARTparse
@@ -91,25 +188,40 @@ CODESTARTparse
 	 * generated ourselfs and then try to actually find one inside the
 	 * message. There we go from high-to low precison and are done
 	 * when we find a matching one. -- rgerhards, 2008-09-16
+	 * If we already know which variant this sender uses, we try that one
+	 * first and only run the full sequence if it does not match.
 	 */
-	if(datetime.ParseTIMESTAMP3339(&(pMsg->tTIMESTAMP), &p2parse, &lenMsg) == RS_RET_OK) {
-		/* we are done - parse pointer is moved by ParseTIMESTAMP3339 */;
-	} else if(datetime.ParseTIMESTAMP3164(&(pMsg->tTIMESTAMP), &p2parse, &lenMsg) == RS_RET_OK) {
-		if(pMsg->dfltTZ[0] != '\0')
-			applyDfltTZ(&pMsg->tTIMESTAMP, pMsg->dfltTZ);
-		/* we are done - parse pointer is moved by ParseTIMESTAMP3164 */;
-	} else if(*p2parse == ' ' && lenMsg > 1) { /* try to see if it is slighly malformed - HP procurve seems to do that sometimes */
-		++p2parse;	/* move over space */
-		--lenMsg;
-		if(datetime.ParseTIMESTAMP3164(&(pMsg->tTIMESTAMP), &p2parse, &lenMsg) == RS_RET_OK) {
-			/* indeed, we got it! */
+	senderKey = getSenderKey(pMsg);
+	shape = (senderKey == 0) ? 0 : shapeCache[(senderKey >> 2) & (SHAPE_CACHE_SIZE - 1)];
+	if(shape != 0 && (shape & ~TS_SHAPE_MASK) == (senderKey & ~TS_SHAPE_MASK)
+	   && parseTIMESTAMPFast(pMsg, &p2parse, &lenMsg, shape & TS_SHAPE_MASK)) {
+		/* we are done - parse pointer is moved by the timestamp parser */;
+	} else {
+		if(datetime.ParseTIMESTAMP3339(&(pMsg->tTIMESTAMP), &p2parse, &lenMsg) == RS_RET_OK) {
+			/* we are done - parse pointer is moved by ParseTIMESTAMP3339 */;
+			tsShape = TS_3339;
+		} else if(datetime.ParseTIMESTAMP3164(&(pMsg->tTIMESTAMP), &p2parse, &lenMsg) == RS_RET_OK) {
+			if(pMsg->dfltTZ[0] != '\0')
+				applyDfltTZ(&pMsg->tTIMESTAMP, pMsg->dfltTZ);
 			/* we are done - parse pointer is moved by ParseTIMESTAMP3164 */;
-		} else {/* parse pointer needs to be restored, as we moved it off-by-one
-			 * for this try.
-			 */
-			--p2parse;
-			++lenMsg;
+			tsShape = TS_3164;
+		} else if(*p2parse == ' ' && lenMsg > 1) { /* try to see if it is slighly malformed - HP procurve seems to do that sometimes */
+			++p2parse;	/* move over space */
+			--lenMsg;
+			if(datetime.ParseTIMESTAMP3164(&(pMsg->tTIMESTAMP), &p2parse, &lenMsg) == RS_RET_OK) {
+				/* indeed, we got it! */
+				/* we are done - parse pointer is moved by ParseTIMESTAMP3164 */;
+				tsShape = TS_3164_SP;
+			} else {/* parse pointer needs to be restored, as we moved it off-by-one
+				 * for this try.
+				 */
+				--p2parse;
+				++lenMsg;
+			}
 		}
+		if(senderKey != 0)
+			shapeCache[(senderKey >> 2) & (SHAPE_CACHE_SIZE - 1)] =
+				(tsShape == TS_UNKNOWN) ? 0 : ((senderKey & ~TS_SHAPE_MASK) | tsShape);
 	}
 
 	if(pMsg->msgFlags & IGNDATE) {
@@ -194,6 +194,78 @@ static int parseRFCStructuredData(uchar **pp2parse, uchar *pResult, int *pLenStr
 	return iRet;
 }
 
+/* Fast path for parseRFCSyslogMsg: locates the SP delimiters of HOSTNAME,
+ * APP-NAME, PROCID, MSGID and the end of STRUCTURED-DATA in a single pass
+ * via memchr(), which is SIMD-optimized in all relevant libcs, and sets
+ * the properties directly from the raw message, without copying them into
+ * a work buffer first. Only well-formed headers are handled here. For
+ * anything else (missing delimiter, unterminated structured data, NUL
+ * bytes inside the header), 1 is returned and nothing is modified, so that
+ * the caller can use the strict byte-by-byte parser, which exactly defines
+ * how malformed messages are handled. On success, 0 is returned and the
+ * parse pointer and *pLenStr are advanced to the start of MSG.
+ */
+static int parseRFCHdrFast(msg_t *pMsg, uchar **pp2parse, int *pLenStr)
+{
+	uchar *p = *pp2parse;
+	uchar *const pEnd = p + *pLenStr;
+	uchar *fld[4];
+	size_t lenFld[4];
+	uchar *sp;
+	uchar *pSD;
+	size_t lenSD;
+	int i;
+
+	/* HOSTNAME, APP-NAME, PROCID and MSGID are SP-terminated */
+	for(i = 0 ; i < 4 ; ++i) {
+		if((sp = memchr(p, ' ', pEnd - p)) == NULL)
+			return 1;
+		fld[i] = p;
+		lenFld[i] = sp - p;
+		p = sp + 1;
+	}
+
+	/* STRUCTURED-DATA: either "-" or everything up to the first "] "
+	 * where the ] is not escaped by a backslash.
+	 */
+	if(p == pEnd)
+		return 1;
+	pSD = p;
+	if(*p == '-') {
+		++p;
+	} else if(*p == '[') {
+		do {
+			if(pEnd - (p + 1) < 2 || (p = memchr(p + 1, ']', pEnd - (p + 1) - 1)) == NULL)
+				return 1;
+		} while(p[-1] == '\\' || p[1] != ' ');
+		++p; /* the SP is eaten below */
+	} else {
+		return 1;
+	}
+	lenSD = p - pSD;
+	if(p < pEnd && *p == ' ')
+		++p;
+	if(*pSD == '[' && p < pEnd && *p == ' ')
+		++p; /* the strict parser eats one more SP after "] " */
+
+	/* the strict parser works on \0-terminated copies, so NUL bytes would
+	 * truncate fields there. Keep that behaviour by letting it handle them.
+	 */
+	if(memchr(*pp2parse, '\0', p - *pp2parse) != NULL)
+		return 1;
+
+	MsgSetHOSTNAME(pMsg, fld[0], lenFld[0]);
+	MsgSetAPPNAMEWithLen(pMsg, fld[1], lenFld[1]);
+	MsgSetPROCIDWithLen(pMsg, fld[2], lenFld[2]);
+	MsgSetMSGIDWithLen(pMsg, fld[3], lenFld[3]);
+	MsgSetStructuredDataWithLen(pMsg, pSD, lenSD);
+
+	*pLenStr -= p - *pp2parse;
+	*pp2parse = p;
+	return 0;
+}
+
+
 /* parse a RFC5424-formatted syslog message. This function returns
  * 0 if processing of the message shall continue and 1 if something
  * went wrong and this messe should be ignored. This function has been
@@ -231,6 +303,22 @@ CODESTARTparse
 	p2parse += 2;
 	lenMsg -= 2;
 
+	/* TIMESTAMP */
+	if(datetime.ParseTIMESTAMP3339(&(pMsg->tTIMESTAMP),  &p2parse, &lenMsg) == RS_RET_OK) {
+		if(pMsg->msgFlags & IGNDATE) {
+			/* we need to ignore the msg data, so simply copy over reception date */
+			memcpy(&pMsg->tTIMESTAMP, &pMsg->tRcvdAt, sizeof(struct syslogTime));
+		}
+	} else {
+		DBGPRINTF("no TIMESTAMP detected!\n");
+		bContParse = 0;
+	}
+
+	if(bContParse && parseRFCHdrFast(pMsg, &p2parse, &lenMsg) == 0) {
+		MsgSetMSGoffs(pMsg, p2parse - pMsg->pszRawMsg);
+		FINALIZE;
+	}
+
 	/* Now get us some memory we can use as a work buffer while parsing.
 	 * We simply allocated a buffer sufficiently large to hold all of the
 	 * message, so we can not run into any troubles. I think this is
@@ -245,17 +333,6 @@ CODESTARTparse
 	 * rgerhards, 2005-11-24
 	 */
 
-	/* TIMESTAMP */
-	if(datetime.ParseTIMESTAMP3339(&(pMsg->tTIMESTAMP),  &p2parse, &lenMsg) == RS_RET_OK) {
-		if(pMsg->msgFlags & IGNDATE) {
-			/* we need to ignore the msg data, so simply copy over reception date */
-			memcpy(&pMsg->tTIMESTAMP, &pMsg->tRcvdAt, sizeof(struct syslogTime));
-		}
-	} else {
-		DBGPRINTF("no TIMESTAMP detected!\n");
-		bContParse = 0;
-	}
-
 	/* HOSTNAME */
 	if(bContParse) {
 		parseRFCField(&p2parse, pBuf, &lenMsg);
@@ -31,6 +31,8 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
 #include <gcrypt.h>
 
 #include "rsyslog.h"
@@ -40,8 +42,9 @@
 static enum { MD_DECRYPT, MD_WRITE_KEYFILE
 } mode = MD_DECRYPT;
 static int verbose = 0;
-static gcry_cipher_hd_t gcry_chd;
 static size_t blkLength;
+static size_t ivLength;
+static int bAEAD;
 
 static char *keyfile = NULL;
 static char *keyprog = NULL;
@@ -103,7 +106,7 @@ done:	return r;
 }
 
 static int
-eiGetIV(FILE *eifp, char *iv, size_t leniv)
+eiGetHex(FILE *eifp, char *expRectype, char *val, size_t lenval)
 {
 	char rectype[EIF_MAX_RECTYPE_LEN+1];
 	char value[EIF_MAX_VALUE_LEN+1];
@@ -113,15 +116,15 @@ eiGetIV(FILE *eifp, char *iv, size_t leniv)
 	unsigned char nibble;
 
 	if((r = eiGetRecord(eifp, rectype, value)) != 0) goto done;
-	if(strcmp(rectype, "IV")) {
-		fprintf(stderr, "no IV record found when expected, record type "
-			"seen is '%s'\n", rectype);
+	if(strcmp(rectype, expRectype)) {
+		fprintf(stderr, "no %s record found when expected, record type "
+			"seen is '%s'\n", expRectype, rectype);
 		r = 1; goto done;
 	}
 	valueLen = strlen(value);
-	if(valueLen/2 != leniv) {
-		fprintf(stderr, "length of IV is %d, expected %d\n",
-			valueLen/2, leniv);
+	if(valueLen/2 != lenval) {
+		fprintf(stderr, "length of %s is %d, expected %d\n",
+			expRectype, valueLen/2, lenval);
 		r = 1; goto done;
 	}
 
@@ -131,13 +134,13 @@ eiGetIV(FILE *eifp, char *iv, size_t leniv)
 		else if(value[i] >= 'a' && value[i] <= 'f')
 			nibble = value[i] - 'a' + 10;
 		else {
-			fprintf(stderr, "invalid IV '%s'\n", value);
+			fprintf(stderr, "invalid %s '%s'\n", expRectype, value);
 			r = 1; goto done;
 		}
 		if(i % 2 == 0)
-			iv[j] = nibble << 4;
+			val[j] = nibble << 4;
 		else
-			iv[j++] |= nibble;
+			val[j++] |= nibble;
 	}
 	r = 0;
 done:	return r;
@@ -161,53 +164,73 @@ eiGetEND(FILE *eifp, off64_t *offs)
 done:	return r;
 }
 
+/* Decryption is done by a pool of worker threads. Before any of them is
+ * started, the encryption info files are read and the log files are
+ * mmap()ed, which splits the work into units. A unit is either a whole
+ * encrypted block or - for modes where each cipher block can be decrypted
+ * on its own (CBC, CFB, ECB) - a chunk of at most UNIT_MAXLEN bytes of
+ * it. Units of the remaining (chained) modes depend on the cipher state of
+ * their predecessor and are decrypted by the main thread, which also writes
+ * all results to stdout in the original order. Workers never run more than
+ * a few units ahead of it, so memory use is bounded.
+ */
+#define UNIT_MAXLEN (1024*1024)
+#define UNIT_MAXIV 64
+
+enum { UNIT_OK = 0, UNIT_ERR_NOMEM, UNIT_ERR_CIPHER, UNIT_ERR_SETIV,
+       UNIT_ERR_DECRYPT, UNIT_ERR_AUTH };
+
+typedef struct cryfile_s {
+	char *name;
+	char *map;	/* mmap()ed log file */
+	size_t len;
+	int bFailed;	/* do not output further units */
+} cryfile_t;
+
+typedef struct cryunit_s {
+	int iFile;
+	const char *data;	/* ciphertext, points into the file map */
+	size_t len;
+	off64_t blkEnd;		/* end of the encrypted block, for messages */
+	char iv[UNIT_MAXIV];
+	char tag[RSGCRY_AEAD_TAG_LEN];
+	int bSerial;		/* chained mode, decrypted by main thread */
+	int bBlkFirst;		/* first unit of an encrypted block? */
+	int bDone;
+	int err;		/* UNIT_* */
+	gcry_error_t gcryError;
+	char *out;
+	size_t lenOut;
+} cryunit_t;
+
+static int nJobs = 0;	/* 0 - number of online CPUs */
+static cryfile_t *files = NULL;
+static int nFiles = 0;
+static cryunit_t *units = NULL;
+static int nUnits = 0;
+static int maxUnits = 0;
+static int nextUnit = 0;	/* next unit to be picked by a worker */
+static int nWritten = 0;	/* units already written by main thread */
+static int window;		/* max units decrypted ahead of the writer */
+static pthread_mutex_t mutUnits = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cndDone = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t cndSpace = PTHREAD_COND_INITIALIZER;
+
 static int
-initCrypt(FILE *eifp)
+openCipher(gcry_cipher_hd_t *hd, gcry_error_t *pErr)
 {
- 	int r = 0;
 	gcry_error_t gcryError;
-	char iv[4096];
-
-	blkLength = gcry_cipher_get_algo_blklen(cry_algo);
-	if(blkLength > sizeof(iv)) {
-		fprintf(stderr, "internal error[%s:%d]: block length %d too large for "
-			"iv buffer\n", __FILE__, __LINE__, blkLength);
-		r = 1; goto done;
-	}
-	if((r = eiGetIV(eifp, iv, blkLength)) != 0) goto done;
-
-	size_t keyLength = gcry_cipher_get_algo_keylen(cry_algo);
-	if(strlen(cry_key) != keyLength) {
-		fprintf(stderr, "invalid key length; key is %u characters, but "
-			"exactly %u characters are required\n", cry_keylen,
-			keyLength);
-		r = 1; goto done;
-	}
-
-	gcryError = gcry_cipher_open(&gcry_chd, cry_algo, cry_mode, 0);
-	if (gcryError) {
-		printf("gcry_cipher_open failed:  %s/%s\n",
-			gcry_strsource(gcryError),
-			gcry_strerror(gcryError));
-		r = 1; goto done;
-	}
-
-	gcryError = gcry_cipher_setkey(gcry_chd, cry_key, keyLength);
-	if (gcryError) {
-		printf("gcry_cipher_setkey failed:  %s/%s\n",
-			gcry_strsource(gcryError),
-			gcry_strerror(gcryError));
-		r = 1; goto done;
-	}
 
-	gcryError = gcry_cipher_setiv(gcry_chd, iv, blkLength);
-	if (gcryError) {
-		printf("gcry_cipher_setiv failed:  %s/%s\n",
-			gcry_strsource(gcryError),
-			gcry_strerror(gcryError));
-		r = 1; goto done;
+	gcryError = gcry_cipher_open(hd, cry_algo, cry_mode, 0);
+	if(gcryError)
+		goto done;
+	gcryError = gcry_cipher_setkey(*hd, cry_key, cry_keylen);
+	if(gcryError) {
+		gcry_cipher_close(*hd);
+		goto done;
 	}
-done: return r;
+done:	*pErr = gcryError;
+	return gcryError ? 1 : 0;
 }
 
 static inline void
@@ -232,99 +255,341 @@ removePadding(char *buf, size_t *plen)
 done:	return;
 }
 
+/* decrypt a single unit into a newly allocated output buffer. */
 static void
-decryptBlock(FILE *fpin, FILE *fpout, off64_t blkEnd, off64_t *pCurrOffs)
+decryptUnit(gcry_cipher_hd_t hd, cryunit_t *u, int bSetIV)
 {
-	gcry_error_t gcryError;
-	size_t nRead, nWritten;
-	size_t toRead;
-	size_t leftTillBlkEnd;
-	char buf[64*1024];
-	
-	leftTillBlkEnd = blkEnd - *pCurrOffs;
+	if((u->out = malloc(u->len ? u->len : 1)) == NULL) {
+		u->err = UNIT_ERR_NOMEM;
+		return;
+	}
+	if(bSetIV && (u->gcryError = gcry_cipher_setiv(hd, u->iv, ivLength))) {
+		u->err = UNIT_ERR_SETIV;
+		return;
+	}
+	if(u->len > 0
+	   && (u->gcryError = gcry_cipher_decrypt(hd, u->out, u->len, u->data, u->len))) {
+		u->err = UNIT_ERR_DECRYPT;
+		return;
+	}
+	u->lenOut = u->len;
+	if(bAEAD) {
+		if((u->gcryError = gcry_cipher_checktag(hd, u->tag, RSGCRY_AEAD_TAG_LEN)))
+			u->err = UNIT_ERR_AUTH;
+	} else {
+		removePadding(u->out, &u->lenOut);
+	}
+}
+
+static void *
+decryptWorker(void __attribute__((unused)) *arg)
+{
+	gcry_cipher_hd_t hd;
+	gcry_error_t openErr;
+	int bHaveCipher;
+	cryunit_t *u;
+
+	bHaveCipher = !openCipher(&hd, &openErr);
+	pthread_mutex_lock(&mutUnits);
 	while(1) {
-		toRead = sizeof(buf) <= leftTillBlkEnd ? sizeof(buf) : leftTillBlkEnd;
-		toRead = toRead - toRead % blkLength;
-		nRead = fread(buf, 1, toRead, fpin);
-		if(nRead == 0)
+		while(nextUnit < nUnits && nextUnit >= nWritten + window)
+			pthread_cond_wait(&cndSpace, &mutUnits);
+		if(nextUnit >= nUnits)
 			break;
-		leftTillBlkEnd -= nRead, *pCurrOffs += nRead;
-		gcryError = gcry_cipher_decrypt(
-				gcry_chd, // gcry_cipher_hd_t
-				buf,    // void *
-				nRead,    // size_t
-				NULL,    // const void *
-				0);   // size_t
-		if (gcryError) {
-			fprintf(stderr, "gcry_cipher_decrypt failed:  %s/%s\n",
-			gcry_strsource(gcryError),
-			gcry_strerror(gcryError));
-			return;
-		}
-		removePadding(buf, &nRead);
-		nWritten = fwrite(buf, 1, nRead, fpout);
-		if(nWritten != nRead) {
-			perror("fpout");
-			return;
+		u = &units[nextUnit++];
+		if(u->bSerial)
+			continue;
+		if(!files[u->iFile].bFailed) {
+			pthread_mutex_unlock(&mutUnits);
+			if(bHaveCipher) {
+				decryptUnit(hd, u, 1);
+			} else {
+				u->err = UNIT_ERR_CIPHER;
+				u->gcryError = openErr;
+			}
+			pthread_mutex_lock(&mutUnits);
 		}
+		u->bDone = 1;
+		pthread_cond_broadcast(&cndDone);
 	}
+	pthread_mutex_unlock(&mutUnits);
+	if(bHaveCipher)
+		gcry_cipher_close(hd);
+	return NULL;
 }
 
-
 static int
-doDecrypt(FILE *logfp, FILE *eifp, FILE *outfp)
+addUnit(int iFile, off64_t offs, size_t len, off64_t blkEnd, char *iv, int bSerial,
+	int bBlkFirst)
 {
-	off64_t blkEnd;
-	off64_t currOffs = 0;
-	int r;
+	cryunit_t *u;
+	cryunit_t *newUnits;
+	int r = 0;
 
-	while(1) {
-		/* process block */
-		if(initCrypt(eifp) != 0)
-			goto done;
-		if((r = eiGetEND(eifp, &blkEnd)) != 0) goto done;
-		decryptBlock(logfp, outfp, blkEnd, &currOffs);
-		gcry_cipher_close(gcry_chd);
+	if(nUnits == maxUnits) {
+		maxUnits = maxUnits ? 2 * maxUnits : 1024;
+		if((newUnits = realloc(units, maxUnits * sizeof(cryunit_t))) == NULL) {
+			fprintf(stderr, "out of memory\n");
+			r = 1; goto done;
+		}
+		units = newUnits;
 	}
-	r = 0;
+	u = &units[nUnits++];
+	memset(u, 0, sizeof(cryunit_t));
+	u->iFile = iFile;
+	u->data = files[iFile].map + offs;
+	u->len = len;
+	u->blkEnd = blkEnd;
+	memcpy(u->iv, iv, ivLength);
+	u->bSerial = bSerial;
+	u->bBlkFirst = bBlkFirst;
 done:	return r;
 }
 
-static void
-decrypt(char *name)
+/* split one encrypted block into work units */
+static int
+addBlock(int iFile, off64_t offs, size_t len, off64_t blkEnd, char *blkIV, char *tag)
 {
-	FILE *logfp = NULL, *eifp = NULL;
+	char iv[UNIT_MAXIV];
+	size_t lenUnit;
+	int bSplit, bSerial;
 	int r = 0;
+
+	bSplit = !bAEAD && (cry_mode == GCRY_CIPHER_MODE_CBC
+		|| cry_mode == GCRY_CIPHER_MODE_CFB
+		|| cry_mode == GCRY_CIPHER_MODE_ECB);
+	bSerial = !bSplit && !bAEAD;
+	memcpy(iv, blkIV, ivLength);
+	if(bAEAD) {
+		if((r = addUnit(iFile, offs, len, blkEnd, iv, 0, 1)) != 0) goto done;
+		memcpy(units[nUnits-1].tag, tag, RSGCRY_AEAD_TAG_LEN);
+		goto done;
+	}
+	do {
+		lenUnit = len > UNIT_MAXLEN ? UNIT_MAXLEN : len;
+		if((r = addUnit(iFile, offs, lenUnit, blkEnd, iv, bSerial,
+			blkIV != NULL)) != 0) goto done;
+		offs += lenUnit, len -= lenUnit;
+		if(cry_mode == GCRY_CIPHER_MODE_CBC || cry_mode == GCRY_CIPHER_MODE_CFB)
+			memcpy(iv, files[iFile].map + offs - blkLength, blkLength);
+		blkIV = NULL;
+	} while(len > 0);
+done:	return r;
+}
+
+static int
+planFile(int iFile)
+{
+	cryfile_t *f = &files[iFile];
+	FILE *eifp = NULL;
+	int fd = -1;
+	struct stat sb;
 	char eifname[4096];
-	
-	if(!strcmp(name, "-")) {
+	char iv[UNIT_MAXIV];
+	char tag[RSGCRY_AEAD_TAG_LEN];
+	off64_t blkEnd, end;
+	off64_t currOffs = 0;
+	size_t len;
+	int r = 0;
+
+	if(!strcmp(f->name, "-")) {
 		fprintf(stderr, "decrypt mode cannot work on stdin\n");
 		goto err;
-	} else {
-		if((logfp = fopen(name, "r")) == NULL) {
-			perror(name);
+	}
+	if((fd = open(f->name, O_RDONLY)) == -1) {
+		perror(f->name);
+		goto err;
+	}
+	snprintf(eifname, sizeof(eifname), "%s%s", f->name, ENCINFO_SUFFIX);
+	eifname[sizeof(eifname)-1] = '\0';
+	if((eifp = fopen(eifname, "r")) == NULL) {
+		perror(eifname);
+		goto err;
+	}
+	if(eiCheckFiletype(eifp) != 0)
+		goto err;
+	if(fstat(fd, &sb) == -1) {
+		perror(f->name);
+		goto err;
+	}
+	f->len = sb.st_size;
+	if(f->len > 0) {
+		f->map = mmap(NULL, f->len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(f->map == MAP_FAILED) {
+			f->map = NULL;
+			perror(f->name);
 			goto err;
 		}
-		snprintf(eifname, sizeof(eifname), "%s%s", name, ENCINFO_SUFFIX);
-		eifname[sizeof(eifname)-1] = '\0';
-		if((eifp = fopen(eifname, "r")) == NULL) {
-			perror(eifname);
-			goto err;
+		madvise(f->map, f->len, MADV_SEQUENTIAL);
+	}
+	close(fd); fd = -1;
+
+	while(1) {
+		if(eiGetHex(eifp, "IV", iv, ivLength) != 0) break;
+		if(bAEAD && eiGetHex(eifp, "TAG", tag, RSGCRY_AEAD_TAG_LEN) != 0) break;
+		if(eiGetEND(eifp, &blkEnd) != 0) break;
+		end = blkEnd > (off64_t) f->len ? (off64_t) f->len : blkEnd;
+		if(end < currOffs)
+			end = currOffs;
+		len = end - currOffs;
+		if(!bAEAD)
+			len -= len % blkLength;
+		if(len > 0 || bAEAD)
+			if((r = addBlock(iFile, currOffs, len, blkEnd, iv, tag)) != 0)
+				goto err;
+		currOffs = end;
+	}
+	fclose(eifp);
+	return 0;
+
+err:
+	fprintf(stderr, "error %d processing file %s\n", r, f->name);
+	if(fd != -1)
+		close(fd);
+	if(eifp != NULL)
+		fclose(eifp);
+	return 1;
+}
+
+static int
+reportUnitError(cryunit_t *u)
+{
+	switch(u->err) {
+	case UNIT_OK:
+		return 0;
+	case UNIT_ERR_NOMEM:
+		fprintf(stderr, "out of memory\n");
+		break;
+	case UNIT_ERR_CIPHER:
+		fprintf(stderr, "gcry_cipher_open/setkey failed:  %s/%s\n",
+			gcry_strsource(u->gcryError), gcry_strerror(u->gcryError));
+		break;
+	case UNIT_ERR_SETIV:
+		fprintf(stderr, "gcry_cipher_setiv failed:  %s/%s\n",
+			gcry_strsource(u->gcryError), gcry_strerror(u->gcryError));
+		break;
+	case UNIT_ERR_DECRYPT:
+		fprintf(stderr, "gcry_cipher_decrypt failed:  %s/%s\n",
+			gcry_strsource(u->gcryError), gcry_strerror(u->gcryError));
+		break;
+	case UNIT_ERR_AUTH:
+		fprintf(stderr, "block ending at offset %lld failed authentication: "
+			"%s - file was modified or key is wrong\n",
+			(long long) u->blkEnd, gcry_strerror(u->gcryError));
+		break;
+	}
+	return 1;
+}
+
+/* main thread: decrypt chained units, write everything in order */
+static void
+writeUnits(void)
+{
+	gcry_cipher_hd_t hdSerial;
+	int bHaveSerial = 0;
+	cryunit_t *u;
+	int i;
+
+	for(i = 0 ; i < nUnits ; ++i) {
+		u = &units[i];
+		if(u->bSerial) {
+			if(u->bBlkFirst) {
+				if(bHaveSerial)
+					gcry_cipher_close(hdSerial);
+				bHaveSerial = !openCipher(&hdSerial, &u->gcryError);
+			}
+			if(files[u->iFile].bFailed)
+				;
+			else if(bHaveSerial)
+				decryptUnit(hdSerial, u, u->bBlkFirst);
+			else
+				u->err = UNIT_ERR_CIPHER;
+		} else {
+			pthread_mutex_lock(&mutUnits);
+			while(!u->bDone)
+				pthread_cond_wait(&cndDone, &mutUnits);
+			pthread_mutex_unlock(&mutUnits);
 		}
-		if(eiCheckFiletype(eifp) != 0)
-			goto err;
+		if(!files[u->iFile].bFailed) {
+			if(u->out != NULL && fwrite(u->out, 1, u->lenOut, stdout) != u->lenOut) {
+				perror("fpout");
+				u->err = UNIT_ERR_DECRYPT;
+			}
+			if(reportUnitError(u)) {
+				pthread_mutex_lock(&mutUnits);
+				files[u->iFile].bFailed = 1;
+				pthread_mutex_unlock(&mutUnits);
+			}
+		}
+		free(u->out);
+		u->out = NULL;
+		pthread_mutex_lock(&mutUnits);
+		nWritten = i + 1;
+		pthread_cond_broadcast(&cndSpace);
+		pthread_mutex_unlock(&mutUnits);
 	}
+	if(bHaveSerial)
+		gcry_cipher_close(hdSerial);
+}
 
-	doDecrypt(logfp, eifp, stdout);
+static void
+decrypt(int nNames, char *names[])
+{
+	pthread_t *workers;
+	size_t keyLength;
+	int i;
 
-	fclose(logfp); logfp = NULL;
-	fclose(eifp); eifp = NULL;
-	return;
+	blkLength = gcry_cipher_get_algo_blklen(cry_algo);
+	bAEAD = rsgcryModeIsAEAD(cry_mode);
+	ivLength = bAEAD ? RSGCRY_AEAD_NONCE_LEN : blkLength;
+	if(ivLength > UNIT_MAXIV) {
+		fprintf(stderr, "internal error[%s:%d]: block length %d too large for "
+			"iv buffer\n", __FILE__, __LINE__, (int) ivLength);
+		exit(1);
+	}
+	keyLength = gcry_cipher_get_algo_keylen(cry_algo);
+	if(cry_keylen != keyLength) {
+		fprintf(stderr, "invalid key length; key is %u characters, but "
+			"exactly %u characters are required\n", cry_keylen,
+			(unsigned) keyLength);
+		exit(1);
+	}
 
-err:
-	fprintf(stderr, "error %d processing file %s\n", r, name);
-	if(logfp != NULL)
-		fclose(logfp);
+	if((files = calloc(nNames, sizeof(cryfile_t))) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	for(nFiles = 0 ; nFiles < nNames ; ++nFiles) {
+		files[nFiles].name = names[nFiles];
+		if(planFile(nFiles) != 0)
+			files[nFiles].bFailed = 1;
+	}
+
+	if(nJobs == 0)
+		nJobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if(nJobs < 1)
+		nJobs = 1;
+	window = 4 * nJobs;
+	if((workers = calloc(nJobs, sizeof(pthread_t))) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	for(i = 0 ; i < nJobs ; ++i) {
+		if(pthread_create(&workers[i], NULL, decryptWorker, NULL) != 0) {
+			fprintf(stderr, "error creating worker thread\n");
+			exit(1);
+		}
+	}
+	writeUnits();
+	for(i = 0 ; i < nJobs ; ++i)
+		pthread_join(workers[i], NULL);
+
+	free(workers);
+	free(units);
+	for(i = 0 ; i < nFiles ; ++i)
+		if(files[i].map != NULL)
+			munmap(files[i].map, files[i].len);
+	free(files);
 }
 
 static void
@@ -409,19 +674,19 @@ static struct option long_options[] =
 	{"key-program", required_argument, NULL, 'p'},
 	{"algo", required_argument, NULL, 'a'},
 	{"mode", required_argument, NULL, 'm'},
+	{"jobs", required_argument, NULL, 'j'},
 	{NULL, 0, NULL, 0} 
 }; 
 
 int
 main(int argc, char *argv[])
 {
-	int i;
 	int opt;
 	int temp;
 	char *newKeyFile = NULL;
 
 	while(1) {
-		opt = getopt_long(argc, argv, "a:dfk:K:m:p:r:vVW:", long_options, NULL);
+		opt = getopt_long(argc, argv, "a:dfj:k:K:m:p:r:vVW:", long_options, NULL);
 		if(opt == -1)
 			break;
 		switch(opt) {
@@ -432,6 +697,14 @@ main(int argc, char *argv[])
 			mode = MD_WRITE_KEYFILE;
 			newKeyFile = optarg;
 			break;
+		case 'j':
+			nJobs = atoi(optarg);
+			if(nJobs < 1) {
+				fprintf(stderr, "ERROR: number of jobs must be at "
+					"least 1\n");
+				exit(1);
+			}
+			break;
 		case 'k':
 			keyfile = optarg;
 			break;
@@ -498,11 +771,11 @@ main(int argc, char *argv[])
 		}
 		write_keyfile(newKeyFile);
 	} else {
-		if(optind == argc)
-			decrypt("-");
-		else {
-			for(i = optind ; i < argc ; ++i)
-				decrypt(argv[i]);
+		if(optind == argc) {
+			char *stdinName = "-";
+			decrypt(1, &stdinName);
+		} else {
+			decrypt(argc - optind, argv + optind);
 		}
 	}
 
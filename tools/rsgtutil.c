@@ -27,6 +27,11 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <gt_base.h>
 #include <gt_http.h>
 #include <getopt.h>
@@ -39,6 +44,7 @@ static enum { MD_DUMP, MD_DETECT_FILE_TYPE, MD_SHOW_SIGBLK_PARAMS,
               MD_VERIFY, MD_EXTEND
 } mode = MD_DUMP;
 static int verbose = 0;
+static int nJobs = 1;
 
 static void
 dumpFile(char *name)
@@ -148,21 +154,56 @@ detectFileType(char *name)
 err:	fprintf(stderr, "error %d (%s) processing file %s\n", r, RSGTE2String(r), name);
 }
 
+/* The log file is mmap()ed for verification. logrdGetLine() delivers
+ * lines exactly like fgets() would, including when the EOF indicator
+ * gets set, so that results do not depend on how the file is read.
+ */
+typedef struct logrd_s {
+	char *map;
+	size_t len;
+	size_t offs;
+	int bEOF;
+} logrd_t;
+
+static char *
+logrdGetLine(logrd_t *lr, char *line, size_t size)
+{
+	size_t avail, n;
+	char *nl;
+
+	avail = lr->len - lr->offs;
+	if(avail == 0) {
+		lr->bEOF = 1;
+		return NULL;
+	}
+	n = avail < size - 1 ? avail : size - 1;
+	if((nl = memchr(lr->map + lr->offs, '\n', n)) != NULL)
+		n = nl - (lr->map + lr->offs) + 1;
+	else if(avail < size - 1)
+		lr->bEOF = 1;
+	memcpy(line, lr->map + lr->offs, n);
+	line[n] = '\0';
+	lr->offs += n;
+	return line;
+}
+
+/* report a failed system call; like perror(), but to the given stream */
+static void
+reportSysErr(FILE *efp, const char *what)
+{
+	fprintf(efp, "%s: %s\n", what, strerror(errno));
+}
+
 static inline int
-doVerifyRec(FILE *logfp, FILE *sigfp, FILE *nsigfp,
+doVerifyRec(logrd_t *logrd, FILE *sigfp, FILE *nsigfp,
 	    block_sig_t *bs, gtfile gf, gterrctx_t *ectx, uint8_t bInBlock)
 {
 	int r;
 	size_t lenRec;
 	char line[128*1024];
 
-	if(fgets(line, sizeof(line), logfp) == NULL) {
-		if(feof(logfp)) {
-			r = RSGTE_EOF;
-		} else {
-			perror("log file input");
-			r = RSGTE_IO;
-		}
+	if(logrdGetLine(logrd, line, sizeof(line)) == NULL) {
+		r = RSGTE_EOF;
 		goto done;
 	}
 	lenRec = strlen(line);
@@ -187,11 +228,15 @@ done:
  * are very similiar.
  *
  * note: here we need to have the LOG file name, not signature!
+ * All messages go to efp, so that files can be processed concurrently.
  */
 static void
-verify(char *name)
+verify(char *name, FILE *efp)
 {
-	FILE *logfp = NULL, *sigfp = NULL, *nsigfp = NULL;
+	FILE *sigfp = NULL, *nsigfp = NULL;
+	logrd_t logrd;
+	int logfd = -1;
+	struct stat sb;
 	block_sig_t *bs = NULL;
 	gtfile gf;
 	uint8_t bHasRecHashes, bHasIntermedHashes;
@@ -201,27 +246,44 @@ verify(char *name)
 	char oldsigfname[4096];
 	char nsigfname[4096];
 	gterrctx_t ectx;
-	
+
+	memset(&logrd, 0, sizeof(logrd));
+	rsgt_errctxInit(&ectx);
 	if(!strcmp(name, "-")) {
-		fprintf(stderr, "%s mode cannot work on stdin\n",
+		fprintf(efp, "%s mode cannot work on stdin\n",
 			mode == MD_VERIFY ? "verify" : "extend");
 		goto err;
 	} else {
 		snprintf(sigfname, sizeof(sigfname), "%s.gtsig", name);
 		sigfname[sizeof(sigfname)-1] = '\0';
-		if((logfp = fopen(name, "r")) == NULL) {
-			perror(name);
+		if((logfd = open(name, O_RDONLY)) == -1) {
+			reportSysErr(efp, name);
+			goto err;
+		}
+		if(fstat(logfd, &sb) == -1) {
+			reportSysErr(efp, name);
 			goto err;
 		}
+		logrd.len = sb.st_size;
+		if(logrd.len > 0) {
+			logrd.map = mmap(NULL, logrd.len, PROT_READ, MAP_PRIVATE, logfd, 0);
+			if(logrd.map == MAP_FAILED) {
+				logrd.map = NULL;
+				reportSysErr(efp, name);
+				goto err;
+			}
+			madvise(logrd.map, logrd.len, MADV_SEQUENTIAL);
+		}
+		close(logfd); logfd = -1;
 		if((sigfp = fopen(sigfname, "r")) == NULL) {
-			perror(sigfname);
+			reportSysErr(efp, sigfname);
 			goto err;
 		}
 		if(mode == MD_EXTEND) {
 			snprintf(nsigfname, sizeof(nsigfname), "%s.gtsig.new", name);
 			nsigfname[sizeof(nsigfname)-1] = '\0';
 			if((nsigfp = fopen(nsigfname, "w")) == NULL) {
-				perror(nsigfname);
+				reportSysErr(efp, nsigfname);
 				goto err;
 			}
 			snprintf(oldsigfname, sizeof(oldsigfname),
@@ -230,23 +292,21 @@ verify(char *name)
 		}
 	}
 
-	rsgtInit("rsyslog rsgtutil " VERSION);
-	rsgt_errctxInit(&ectx);
 	ectx.verbose = verbose;
-	ectx.fp = stderr;
+	ectx.fp = efp;
 	ectx.filename = strdup(sigfname);
 
 	if((r = rsgt_chkFileHdr(sigfp, "LOGSIG10")) != 0) goto done;
 	if(mode == MD_EXTEND) {
 		if(fwrite("LOGSIG10", 8, 1, nsigfp) != 1) {
-			perror(nsigfname);
+			reportSysErr(efp, nsigfname);
 			r = RSGTE_IO;
 			goto done;
 		}
 	}
 	gf = rsgt_vrfyConstruct_gf();
 	if(gf == NULL) {
-		fprintf(stderr, "error initializing signature file structure\n");
+		fprintf(efp, "error initializing signature file structure\n");
 		goto done;
 	}
 
@@ -254,18 +314,18 @@ verify(char *name)
 	ectx.blkNum = 0;
 	ectx.recNumInFile = 0;
 
-	while(!feof(logfp)) {
+	while(!logrd.bEOF) {
 		if(bInBlock == 0) {
 			if(bs != NULL)
 				rsgt_objfree(0x0902, bs);
 			if((r = rsgt_getBlockParams(sigfp, 1, &bs, &bHasRecHashes,
 							&bHasIntermedHashes)) != 0) {
 				if(ectx.blkNum == 0) {
-					fprintf(stderr, "EOF before finding any signature block - "
+					fprintf(efp, "EOF before finding any signature block - "
 						"is the file still open and being written to?\n");
 				} else {
 					if(verbose)
-						fprintf(stderr, "EOF after signature block %lld\n",
+						fprintf(efp, "EOF after signature block %lld\n",
 							ectx.blkNum);
 				}
 				goto done;
@@ -275,7 +335,7 @@ verify(char *name)
 			++ectx.blkNum;
 		}
 		++ectx.recNum, ++ectx.recNumInFile;
-		if((r = doVerifyRec(logfp, sigfp, nsigfp, bs, gf, &ectx, bInBlock)) != 0)
+		if((r = doVerifyRec(&logrd, sigfp, nsigfp, bs, gf, &ectx, bInBlock)) != 0)
 			goto done;
 		if(ectx.recNum == bs->recCount) {
 			if((r = verifyBLOCK_SIG(bs, gf, sigfp, nsigfp, 
@@ -289,7 +349,9 @@ done:
 	if(r != RSGTE_EOF)
 		goto err;
 
-	fclose(logfp); logfp = NULL;
+	if(logrd.map != NULL) {
+		munmap(logrd.map, logrd.len); logrd.map = NULL;
+	}
 	fclose(sigfp); sigfp = NULL;
 	if(nsigfp != NULL) {
 		fclose(nsigfp); nsigfp = NULL;
@@ -299,53 +361,53 @@ done:
 	if(mode == MD_EXTEND) {
 		if(unlink(oldsigfname) != 0) {
 			if(errno != ENOENT) {
-				perror("unlink oldsig");
+				reportSysErr(efp, "unlink oldsig");
 				r = RSGTE_IO;
 				goto err;
 			}
 		}
 		if(link(sigfname, oldsigfname) != 0) {
-			perror("link oldsig");
+			reportSysErr(efp, "link oldsig");
 			r = RSGTE_IO;
 			goto err;
 		}
 		if(unlink(sigfname) != 0) {
-			perror("unlink cursig");
+			reportSysErr(efp, "unlink cursig");
 			r = RSGTE_IO;
 			goto err;
 		}
 		if(link(nsigfname, sigfname) != 0) {
-			perror("link  newsig");
-			fprintf(stderr, "WARNING: current sig file has been "
+			reportSysErr(efp, "link  newsig");
+			fprintf(efp, "WARNING: current sig file has been "
 			        "renamed to %s - you need to manually recover "
 				"it.\n", oldsigfname);
 			r = RSGTE_IO;
 			goto err;
 		}
 		if(unlink(nsigfname) != 0) {
-			perror("unlink newsig");
-			fprintf(stderr, "WARNING: current sig file has been "
+			reportSysErr(efp, "unlink newsig");
+			fprintf(efp, "WARNING: current sig file has been "
 			        "renamed to %s - you need to manually recover "
 				"it.\n", oldsigfname);
 			r = RSGTE_IO;
 			goto err;
 		}
 	}
-	rsgtExit();
 	rsgt_errctxExit(&ectx);
 	return;
 
 err:
-	fprintf(stderr, "error %d (%s) processing file %s\n", r, RSGTE2String(r), name);
-	if(logfp != NULL)
-		fclose(logfp);
+	fprintf(efp, "error %d (%s) processing file %s\n", r, RSGTE2String(r), name);
+	if(logfd != -1)
+		close(logfd);
+	if(logrd.map != NULL)
+		munmap(logrd.map, logrd.len);
 	if(sigfp != NULL)
 		fclose(sigfp);
 	if(nsigfp != NULL) {
 		fclose(nsigfp);
 		unlink(nsigfname);
 	}
-	rsgtExit();
 	rsgt_errctxExit(&ectx);
 }
 
@@ -364,11 +426,98 @@ processFile(char *name)
 		break;
 	case MD_VERIFY:
 	case MD_EXTEND:
-		verify(name);
+		verify(name, stderr);
 		break;
 	}
 }
 
+/* Verification and extension of multiple files is done by a pool of
+ * nJobs threads, one file at a time each. The hash chain inside a
+ * file must be processed in order, but files are independent. Each
+ * file's messages are collected in memory and written to stderr in
+ * command line order, so the output is the same as when processing
+ * sequentially.
+ */
+typedef struct vrfyjob_s {
+	char *name;
+	char *out;
+	size_t lenOut;
+	int bDone;
+} vrfyjob_t;
+
+static vrfyjob_t *vrfyJobs;
+static int nVrfyJobs;
+static int nextVrfyJob = 0;
+static pthread_mutex_t mutVrfyJobs = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cndVrfyJobDone = PTHREAD_COND_INITIALIZER;
+
+static void *
+verifyWorker(void __attribute__((unused)) *arg)
+{
+	vrfyjob_t *job;
+	FILE *efp;
+
+	pthread_mutex_lock(&mutVrfyJobs);
+	while(nextVrfyJob < nVrfyJobs) {
+		job = &vrfyJobs[nextVrfyJob++];
+		pthread_mutex_unlock(&mutVrfyJobs);
+		if((efp = open_memstream(&job->out, &job->lenOut)) == NULL) {
+			job->out = NULL;
+			fprintf(stderr, "error creating output buffer for file %s\n",
+				job->name);
+		} else {
+			verify(job->name, efp);
+			fclose(efp);
+		}
+		pthread_mutex_lock(&mutVrfyJobs);
+		job->bDone = 1;
+		pthread_cond_broadcast(&cndVrfyJobDone);
+	}
+	pthread_mutex_unlock(&mutVrfyJobs);
+	return NULL;
+}
+
+static void
+verifyParallel(int nNames, char *names[])
+{
+	pthread_t *workers;
+	int nWorkers;
+	int i;
+
+	if((vrfyJobs = calloc(nNames, sizeof(vrfyjob_t))) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	for(i = 0 ; i < nNames ; ++i)
+		vrfyJobs[i].name = names[i];
+	nVrfyJobs = nNames;
+	nWorkers = nJobs < nNames ? nJobs : nNames;
+	if((workers = calloc(nWorkers, sizeof(pthread_t))) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	for(i = 0 ; i < nWorkers ; ++i) {
+		if(pthread_create(&workers[i], NULL, verifyWorker, NULL) != 0) {
+			fprintf(stderr, "error creating worker thread\n");
+			exit(1);
+		}
+	}
+	for(i = 0 ; i < nNames ; ++i) {
+		pthread_mutex_lock(&mutVrfyJobs);
+		while(!vrfyJobs[i].bDone)
+			pthread_cond_wait(&cndVrfyJobDone, &mutVrfyJobs);
+		pthread_mutex_unlock(&mutVrfyJobs);
+		if(vrfyJobs[i].out != NULL) {
+			fwrite(vrfyJobs[i].out, 1, vrfyJobs[i].lenOut, stderr);
+			free(vrfyJobs[i].out);
+		}
+	}
+	for(i = 0 ; i < nWorkers ; ++i)
+		pthread_join(workers[i], NULL);
+	free(workers);
+	free(vrfyJobs);
+}
+
 
 static struct option long_options[] = 
 { 
@@ -381,6 +530,7 @@ static struct option long_options[] =
 	{"extend", no_argument, NULL, 'e'},
 	{"publications-server", optional_argument, NULL, 'P'},
 	{"show-verified", no_argument, NULL, 's'},
+	{"jobs", required_argument, NULL, 'j'},
 	{NULL, 0, NULL, 0} 
 }; 
 
@@ -391,7 +541,7 @@ main(int argc, char *argv[])
 	int opt;
 
 	while(1) {
-		opt = getopt_long(argc, argv, "DvVTBtPs", long_options, NULL);
+		opt = getopt_long(argc, argv, "DvVTBtPsj:", long_options, NULL);
 		if(opt == -1)
 			break;
 		switch(opt) {
@@ -401,6 +551,14 @@ main(int argc, char *argv[])
 		case 's':
 			rsgt_read_showVerified = 1;
 			break;
+		case 'j':
+			nJobs = atoi(optarg);
+			if(nJobs < 1) {
+				fprintf(stderr, "ERROR: number of jobs must be at "
+					"least 1\n");
+				exit(1);
+			}
+			break;
 		case 'V':
 			fprintf(stderr, "rsgtutil " VERSION "\n");
 			exit(0);
@@ -429,12 +587,19 @@ main(int argc, char *argv[])
 		}
 	}
 
+	if(mode == MD_VERIFY || mode == MD_EXTEND)
+		rsgtInit("rsyslog rsgtutil " VERSION);
 	if(optind == argc)
 		processFile("-");
+	else if((mode == MD_VERIFY || mode == MD_EXTEND) && nJobs > 1
+		&& argc - optind > 1)
+		verifyParallel(argc - optind, argv + optind);
 	else {
 		for(i = optind ; i < argc ; ++i)
 			processFile(argv[i]);
 	}
+	if(mode == MD_VERIFY || mode == MD_EXTEND)
+		rsgtExit();
 
 	return 0;
 }
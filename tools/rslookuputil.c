@@ -0,0 +1,390 @@
+/* This is a tool for converting rsyslog lookup tables into their
+ * binary form, which rsyslogd can mmap() and use in place.
+ *
+ * Copyright 2013 Adiscon GmbH
+ *
+ * This file is part of rsyslog.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either exprs or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <json/json.h>
+
+#include "rsyslog.h"
+#include "lookup.h"
+
+static int verbose = 0;
+static char *outfile = NULL;
+
+typedef struct tabetry_s {
+	const char *key;
+	const char *val;
+} tabetry_t;
+
+/* the string area is built in memory. Values are stored only once, as
+ * large tables usually map many keys to few values.
+ */
+static char *strArea = NULL;
+static uint64_t lenStrArea = 0;
+static uint64_t sizeStrArea = 0;
+static uint64_t offsStrings;	/* file offset of the string area */
+static uint64_t *valHash = NULL;	/* offsets of stored values, 0 - free */
+static uint64_t valHashMask;
+
+static void
+outOfMemory(void)
+{
+	fprintf(stderr, "out of memory\n");
+	exit(1);
+}
+
+static uint64_t
+addString(const char *str)
+{
+	size_t len = strlen(str) + 1;
+	uint64_t offs;
+	char *newArea;
+
+	if(lenStrArea + len > sizeStrArea) {
+		sizeStrArea = (sizeStrArea == 0) ? 1024*1024 : 2 * sizeStrArea;
+		while(lenStrArea + len > sizeStrArea)
+			sizeStrArea *= 2;
+		if((newArea = realloc(strArea, sizeStrArea)) == NULL)
+			outOfMemory();
+		strArea = newArea;
+	}
+	memcpy(strArea + lenStrArea, str, len);
+	offs = offsStrings + lenStrArea;
+	lenStrArea += len;
+	return offs;
+}
+
+static uint64_t
+addValue(const char *val)
+{
+	uint64_t h = 0xcbf29ce484222325ull;
+	const char *c;
+	uint64_t i;
+
+	for(c = val ; *c != '\0' ; ++c)
+		h = (h ^ (unsigned char) *c) * 0x100000001b3ull;
+	for(i = h & valHashMask ; valHash[i] != 0 ; i = (i + 1) & valHashMask)
+		if(!strcmp(strArea + (valHash[i] - offsStrings), val))
+			return valHash[i];
+	return valHash[i] = addString(val);
+}
+
+static int
+tabetryCmp(const void *a, const void *b)
+{
+	return strcmp(((tabetry_t*)a)->key, ((tabetry_t*)b)->key);
+}
+
+/* must match lookupParseInt() in lookup.c */
+static int
+parseInt(const char *str, long long *n)
+{
+	char *end;
+
+	if(*str == '\0')
+		return 0;
+	errno = 0;
+	*n = strtoll(str, &end, 10);
+	return *end == '\0' && errno == 0;
+}
+
+static const char *
+getRowString(struct json_object *jtab, uint32_t i, const char *name)
+{
+	struct json_object *jrow, *jval;
+	const char *str;
+
+	jrow = json_object_array_get_idx(jtab, i);
+	jval = (jrow == NULL) ? NULL : json_object_object_get(jrow, name);
+	str = (jval == NULL) ? NULL : json_object_get_string(jval);
+	return (str == NULL) ? "" : str;
+}
+
+/* build the index of a string table, nmemb (key, value) pairs */
+static uint64_t *
+buildStringIndex(struct json_object *jtab, uint32_t nmemb)
+{
+	tabetry_t *etry;
+	uint64_t *idx;
+	uint32_t i;
+
+	if((etry = calloc(nmemb + 1, sizeof(tabetry_t))) == NULL
+	   || (idx = calloc(2 * (size_t) nmemb + 1, sizeof(uint64_t))) == NULL)
+		outOfMemory();
+	for(i = 0 ; i < nmemb ; ++i) {
+		etry[i].key = getRowString(jtab, i, "index");
+		etry[i].val = getRowString(jtab, i, "value");
+	}
+	qsort(etry, nmemb, sizeof(tabetry_t), tabetryCmp);
+	for(i = 0 ; i < nmemb ; ++i) {
+		idx[2 * i] = addString(etry[i].key);
+		idx[2 * i + 1] = addValue(etry[i].val);
+	}
+	free(etry);
+	return idx;
+}
+
+/* determine the index range of an array table, using the same rules as
+ * lookupBuildArrayTable() in lookup.c
+ */
+static void
+arrayRange(struct json_object *jtab, uint32_t n, long long *pFirst, uint32_t *pSpan)
+{
+	long long first = 0, last = 0, key, span;
+	uint32_t i;
+
+	for(i = 0 ; i < n ; ++i) {
+		if(!parseInt(getRowString(jtab, i, "index"), &key)) {
+			fprintf(stderr, "index '%s' of array table is not an integer\n",
+				getRowString(jtab, i, "index"));
+			exit(1);
+		}
+		if(i == 0 || key < first)
+			first = key;
+		if(i == 0 || key > last)
+			last = key;
+	}
+	span = (n == 0) ? 0 : last - first + 1;
+	if(span < 0 || span > LOOKUP_ARRAY_MAXSPAN(n)) {
+		fprintf(stderr, "index range %lld..%lld is too sparse for an array "
+			"table\n", first, last);
+		exit(1);
+	}
+	*pFirst = first;
+	*pSpan = (uint32_t) span;
+}
+
+/* build the index of an array table. As in lookup.c, the first entry for
+ * an index wins, holes are 0.
+ */
+static uint64_t *
+buildArrayIndex(struct json_object *jtab, uint32_t n, long long first, uint32_t span)
+{
+	uint64_t *idx;
+	long long key;
+	uint32_t i;
+
+	if((idx = calloc((size_t) span + 1, sizeof(uint64_t))) == NULL)
+		outOfMemory();
+	for(i = 0 ; i < n ; ++i) {
+		parseInt(getRowString(jtab, i, "index"), &key);
+		if(idx[key - first] == 0)
+			idx[key - first] = addValue(getRowString(jtab, i, "value"));
+	}
+	return idx;
+}
+
+static struct json_object *
+readTable(char *name)
+{
+	struct json_tokener *tokener;
+	struct json_object *json;
+	struct stat sb;
+	char *buf;
+	int fd;
+
+	if((fd = open(name, O_RDONLY)) == -1 || fstat(fd, &sb) == -1) {
+		perror(name);
+		exit(1);
+	}
+	if((buf = malloc(sb.st_size + 1)) == NULL)
+		outOfMemory();
+	if(read(fd, buf, sb.st_size) != sb.st_size) {
+		perror(name);
+		exit(1);
+	}
+	close(fd);
+	tokener = json_tokener_new();
+	json = json_tokener_parse_ex(tokener, buf, sb.st_size);
+	json_tokener_free(tokener);
+	free(buf);
+	if(json == NULL) {
+		fprintf(stderr, "%s: json parsing error\n", name);
+		exit(1);
+	}
+	return json;
+}
+
+static void
+writeTable(char *name, lkb_hdr_t *hdr, uint64_t *idx, uint64_t lenIdx)
+{
+	char tmpname[4096];
+	FILE *fp;
+
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp.%d", name, (int) getpid());
+	if((fp = fopen(tmpname, "w")) == NULL) {
+		perror(tmpname);
+		exit(1);
+	}
+	if(   fwrite(hdr, sizeof(*hdr), 1, fp) != 1
+	   || fwrite(idx, 1, lenIdx, fp) != lenIdx
+	   || fwrite(strArea, 1, lenStrArea, fp) != lenStrArea
+	   || fclose(fp) != 0) {
+		perror(tmpname);
+		unlink(tmpname);
+		exit(1);
+	}
+	/* rsyslogd may have the old file mapped, so it must be replaced,
+	 * never overwritten
+	 */
+	if(rename(tmpname, name) != 0) {
+		perror(name);
+		unlink(tmpname);
+		exit(1);
+	}
+}
+
+static void
+convert(char *name)
+{
+	struct json_object *json, *jnomatch, *jtype, *jtab;
+	const char *type;
+	char outname[4096];
+	lkb_hdr_t hdr;
+	uint64_t *idx;
+	uint64_t nOffs;
+	uint32_t nmemb, span = 0;
+	long long first = 0;
+	size_t len;
+
+	json = readTable(name);
+	jnomatch = json_object_object_get(json, "nomatch");
+	jtype = json_object_object_get(json, "type");
+	jtab = json_object_object_get(json, "table");
+	type = (jtype == NULL) ? "string" : json_object_get_string(jtype);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, LKB_MAGIC, sizeof(hdr.magic));
+	hdr.hdrSize = sizeof(hdr);
+	if(!strcmp(type, "string")) {
+		hdr.type = LOOKUP_TYPE_STRING;
+	} else if(!strcmp(type, "array")) {
+		hdr.type = LOOKUP_TYPE_ARRAY;
+	} else {
+		fprintf(stderr, "%s: tables of type '%s' cannot be converted, "
+			"only 'string' and 'array' are supported\n", name, type);
+		exit(1);
+	}
+	nmemb = (jtab == NULL) ? 0 : json_object_array_length(jtab);
+	if(hdr.type == LOOKUP_TYPE_ARRAY) {
+		arrayRange(jtab, nmemb, &first, &span);
+		nOffs = span;
+	} else {
+		nOffs = 2 * (uint64_t) nmemb;
+	}
+	valHashMask = 1;
+	while(valHashMask < 2 * (uint64_t) nmemb)
+		valHashMask <<= 1;
+	if((valHash = calloc(valHashMask, sizeof(uint64_t))) == NULL)
+		outOfMemory();
+	--valHashMask;
+
+	hdr.index = sizeof(hdr);
+	hdr.strings = offsStrings = hdr.index + nOffs * sizeof(uint64_t);
+	hdr.nomatch = addString((jnomatch == NULL) ? "" : json_object_get_string(jnomatch));
+	if(hdr.type == LOOKUP_TYPE_STRING) {
+		idx = buildStringIndex(jtab, nmemb);
+		hdr.nmemb = nmemb;
+	} else {
+		idx = buildArrayIndex(jtab, nmemb, first, span);
+		hdr.first = first;
+		hdr.nmemb = span;
+	}
+	hdr.fileLen = hdr.strings + lenStrArea;
+
+	if(outfile != NULL) {
+		snprintf(outname, sizeof(outname), "%s", outfile);
+	} else {
+		len = strlen(name);
+		if(len > 5 && !strcmp(name + len - 5, ".json"))
+			len -= 5;
+		snprintf(outname, sizeof(outname), "%.*s.lkb", (int) len, name);
+	}
+	writeTable(outname, &hdr, idx, nOffs * sizeof(uint64_t));
+	if(verbose) {
+		fprintf(stderr, "%s: %s table, %u entries, %llu bytes written to %s\n",
+			name, type, hdr.nmemb, (unsigned long long) hdr.fileLen, outname);
+	}
+
+	free(idx);
+	free(valHash); valHash = NULL;
+	free(strArea); strArea = NULL;
+	lenStrArea = sizeStrArea = 0;
+	json_object_put(json);
+}
+
+static struct option long_options[] =
+{
+	{"verbose", no_argument, NULL, 'v'},
+	{"version", no_argument, NULL, 'V'},
+	{"output", required_argument, NULL, 'o'},
+	{NULL, 0, NULL, 0}
+};
+
+int
+main(int argc, char *argv[])
+{
+	int i;
+	int opt;
+
+	while(1) {
+		opt = getopt_long(argc, argv, "o:vV", long_options, NULL);
+		if(opt == -1)
+			break;
+		switch(opt) {
+		case 'o':
+			outfile = optarg;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'V':
+			fprintf(stderr, "rslookuputil " VERSION "\n");
+			exit(0);
+		case '?':
+			break;
+		default:fprintf(stderr, "getopt_long() returns unknown value %d\n", opt);
+			return 1;
+		}
+	}
+
+	if(optind == argc) {
+		fprintf(stderr, "usage: rslookuputil [-v] [-o outfile] table.json ...\n");
+		exit(1);
+	}
+	if(outfile != NULL && argc - optind > 1) {
+		fprintf(stderr, "ERROR: --output can only be used with a single table\n");
+		exit(1);
+	}
+	for(i = optind ; i < argc ; ++i)
+		convert(argv[i]);
+	return 0;
+}
@@ -0,0 +1,98 @@
+/* smbinfwd.c
+ * This is a strgen module for the binary forwarding format. It does not
+ * generate text, but the binary message record also used by disk queues
+ * (see MsgSerializeBinary()), which carries all message properties
+ * including the message variables. It is meant for relaying messages to
+ * another rsyslog instance via omfwd with tcp_framing="binary". The
+ * receiver (imptcp with supportbinaryframing="on") reconstructs the
+ * message object without any parsing.
+ *
+ * NOTE: read comments in module-template.h to understand how this file
+ *       works!
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of rsyslog.
+ *
+ * Rsyslog is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Rsyslog is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Rsyslog.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * A copy of the GPL can be found in the file "COPYING" in this distribution.
+ */
+#include "config.h"
+#include "rsyslog.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include "syslogd.h"
+#include "conf.h"
+#include "syslogd-types.h"
+#include "template.h"
+#include "msg.h"
+#include "module-template.h"
+#include "unicode-helper.h"
+
+MODULE_TYPE_STRGEN
+MODULE_TYPE_NOKEEP
+STRGEN_NAME("RSYSLOG_BinaryForwardFormat")
+
+/* internal structures
+ */
+DEF_SMOD_STATIC_DATA
+
+
+/* config data */
+
+
+/* The record is built directly in the parameter buffer. Note that it
+ * contains NUL octets, so lenStr is the only valid length indication.
+ */
+BEGINstrgen
+	uchar *buf;
+	size_t lenBuf;
+	size_t lenRec;
+CODESTARTstrgen
+	buf = iparam->param; /* the struct is packed, so we can not pass the member's address */
+	lenBuf = (buf == NULL) ? 0 : iparam->lenBuf;
+	iRet = MsgSerializeBinaryBuf(pMsg, &buf, &lenBuf, &lenRec);
+	iparam->param = buf;
+	iparam->lenBuf = lenBuf;
+	if(iRet != RS_RET_OK)
+		FINALIZE;
+
+	buf[lenRec] = '\0'; /* MsgSerializeBinaryBuf() leaves room for it */
+	iparam->lenStr = lenRec;
+
+finalize_it:
+ENDstrgen
+
+
+BEGINmodExit
+CODESTARTmodExit
+ENDmodExit
+
+
+BEGINqueryEtryPt
+CODESTARTqueryEtryPt
+CODEqueryEtryPt_STD_SMOD_QUERIES
+ENDqueryEtryPt
+
+
+BEGINmodInit(smbinfwd)
+CODESTARTmodInit
+	*ipIFVersProvided = CURR_MOD_IF_VERSION; /* we only support the current interface specification */
+CODEmodInit_QueryRegCFSLineHdlr
+
+	dbgprintf("rsyslog binary forward format strgen init called, compiled with version %s\n", VERSION);
+ENDmodInit
@@ -119,6 +119,8 @@ extern int yydebug; /* interface to flex */
 #include "batch.h"
 #include "unicode-helper.h"
 #include "ruleset.h"
+#include "actpool.h"
+#include "wrkpool.h"
 #include "net.h"
 #include "prop.h"
 #include "rsconf.h"
@@ -255,14 +257,31 @@ static int usage(void)
 /* return back the approximate current number of messages in the main message queue
  * This number includes the messages that reside in an associated DA queue (if
  * it exists) -- rgerhards, 2009-10-14
+ * If the main queue is sharded, the sizes of all shards are summed up.
  */
+static inline int
+getQSize(qqueue_t *pQueue)
+{
+	int iSize;
+	int i;
+
+	if(pQueue->pShards != NULL) {
+		iSize = 0;
+		for(i = 0 ; i < pQueue->nShards ; ++i)
+			iSize += getQSize(pQueue->pShards[i]);
+	} else {
+		iSize = (pQueue->pqDA != NULL) ? pQueue->pqDA->iQueueSize : 0;
+		iSize += pQueue->iQueueSize;
+	}
+	return iSize;
+}
+
 rsRetVal
 diagGetMainMsgQSize(int *piSize)
 {
 	DEFiRet;
 	assert(piSize != NULL);
-	*piSize = (pMsgQueue->pqDA != NULL) ? pMsgQueue->pqDA->iQueueSize : 0;
-	*piSize += pMsgQueue->iQueueSize;
+	*piSize = getQSize(pMsgQueue);
 	RETiRet;
 }
 
@@ -604,6 +623,8 @@ submitMsg2(msg_t *pMsg)
 		FINALIZE;
 	}
 
+	if(iMsgTraceSampleRate != 0)
+		MsgTraceSample(pMsg);
 	qqueueEnqMsg(pQueue, pMsg->flowCtlType, pMsg);
 
 finalize_it:
@@ -626,6 +647,7 @@ multiSubmitMsg2(multi_submit_t *pMultiSub)
 {
 	qqueue_t *pQueue;
 	ruleset_t *pRuleset;
+	int i;
 	DEFiRet;
 	assert(pMultiSub != NULL);
 
@@ -642,6 +664,10 @@ multiSubmitMsg2(multi_submit_t *pMultiSub)
 		FINALIZE;
 	}
 
+	if(iMsgTraceSampleRate != 0) {
+		for(i = 0 ; i < pMultiSub->nElem ; ++i)
+			MsgTraceSample(pMultiSub->ppMsgs[i]);
+	}
 	iRet = pQueue->MultiEnq(pQueue, pMultiSub);
 	pMultiSub->nElem = 0;
 
@@ -822,6 +848,8 @@ die(int sig)
 	/* Free ressources and close connections. This includes flushing any remaining
 	 * repeated msgs.
 	 */
+	rulesetProfileWrite(runConf);
+	actpoolExit();
 	DBGPRINTF("Terminating outputs...\n");
 	destructAllActions();
 
@@ -829,6 +857,8 @@ die(int sig)
 
 	DBGPRINTF("destructing current config...\n");
 	rsconf.Destruct(&runConf);
+	/* only now all queues are gone which might use the shared workers */
+	wrkpoolExit();
 
 	/* rger 2005-02-22
 	 * now clean up the in-memory structures. OK, the OS
@@ -1270,6 +1300,7 @@ doHUP(void)
 	queryLocalHostname(); /* re-read our name */
 	ruleset.IterateAllActions(ourConf, doHUPActions, NULL);
 	lookupDoHUP();
+	rulesetProfileWrite(ourConf);
 }
 
 